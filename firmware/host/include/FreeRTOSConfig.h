@@ -0,0 +1,69 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+/* FreeRTOS configuration for the host (POSIX port) build. Kept close to 
+   ESP-IDF's where it matters to ezDV (priorities, tick type, available
+   APIs); the tick is faster so that esp_timer emulation is reasonably
+   accurate. */
+
+#include <assert.h>
+#include <limits.h>
+
+#define configUSE_PREEMPTION                        1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION     0
+#define configUSE_IDLE_HOOK                         0
+#define configUSE_TICK_HOOK                         0
+#define configUSE_DAEMON_TASK_STARTUP_HOOK          0
+#define configTICK_RATE_HZ                          1000
+#define configMINIMAL_STACK_SIZE                    ( ( unsigned short ) PTHREAD_STACK_MIN )
+#define configMAX_TASK_NAME_LEN                     16
+#define configMAX_PRIORITIES                        25
+#define configTICK_TYPE_WIDTH_IN_BITS               TICK_TYPE_WIDTH_32_BITS
+#define configSTACK_DEPTH_TYPE                      uint32_t
+#define configIDLE_SHOULD_YIELD                     1
+#define configUSE_TASK_NOTIFICATIONS                1
+#define configUSE_MUTEXES                           1
+#define configUSE_RECURSIVE_MUTEXES                 1
+#define configUSE_COUNTING_SEMAPHORES               1
+#define configQUEUE_REGISTRY_SIZE                   0
+#define configUSE_QUEUE_SETS                        0
+#define configUSE_TIME_SLICING                      1
+#define configUSE_TIMERS                            0
+#define configUSE_TRACE_FACILITY                    0
+#define configUSE_STATS_FORMATTING_FUNCTIONS        0
+#define configGENERATE_RUN_TIME_STATS               0
+#define configUSE_CO_ROUTINES                       0
+#define configCHECK_FOR_STACK_OVERFLOW              0
+#define configUSE_MALLOC_FAILED_HOOK                0
+#define configSUPPORT_DYNAMIC_ALLOCATION            1
+#define configSUPPORT_STATIC_ALLOCATION             0
+
+#define INCLUDE_vTaskPrioritySet                    1
+#define INCLUDE_uxTaskPriorityGet                   1
+#define INCLUDE_vTaskDelete                         1
+#define INCLUDE_vTaskSuspend                        1
+#define INCLUDE_xTaskDelayUntil                     1
+#define INCLUDE_vTaskDelay                          1
+#define INCLUDE_xTaskGetCurrentTaskHandle           1
+#define INCLUDE_uxTaskGetStackHighWaterMark         1
+
+#define configASSERT( x )                           assert( x )
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,81 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EZDV_HOST_ESP_DSP_H
+#define EZDV_HOST_ESP_DSP_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* The subset of esp-dsp used by ezDV, implemented in plain C the same way 
+   as esp-dsp's ANSI reference versions (src/esp_dsp.c). Results match the
+   reference code, not necessarily the ESP32-S3 assembly bit for bit. */
+
+typedef struct fir_s16_s 
+{
+    int16_t* coeffs;
+    int16_t* delay;
+    int16_t coeffs_len;
+    int16_t pos;
+    int16_t decim;
+    int16_t d_pos;
+    int16_t shift;
+    int32_t* rounding_buff;
+    int32_t rounding_val;
+    int16_t free_status;
+} fir_s16_t;
+
+typedef struct fir_f32_s 
+{
+    float* coeffs;
+    float* delay;
+    int N;
+    int pos;
+    int decim;
+    int d_pos;
+    int16_t use_delay;
+} fir_f32_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+esp_err_t dsps_fird_init_s16(fir_s16_t* fir, int16_t* coeffs, int16_t* delay, int16_t coeffs_len, int16_t decim, int16_t start_pos, int16_t shift);
+int32_t dsps_fird_s16(fir_s16_t* fir, const int16_t* input, int16_t* output, int32_t len);
+esp_err_t dsps_fird_s16_aexx_free(fir_s16_t* fir);
+
+esp_err_t dsps_fir_init_f32(fir_f32_t* fir, float* coeffs, float* delay, int coeffs_len);
+esp_err_t dsps_fir_f32(fir_f32_t* fir, const float* input, float* output, int len);
+
+esp_err_t dsps_fird_init_f32(fir_f32_t* fir, float* coeffs, float* delay, int N, int decim);
+int dsps_fird_f32(fir_f32_t* fir, const float* input, float* output, int len);
+
+esp_err_t dsps_mulc_s16(const int16_t* input, int16_t* output, int len, int16_t C, int step_in, int step_out);
+
+/* Radix-2 complex FFT on interleaved real/imaginary floats. As with esp-dsp,
+   the output is left in bit-reversed order until dsps_bit_rev_fc32(). The
+   table isn't needed here (twiddles are computed directly). */
+esp_err_t dsps_fft2r_init_fc32(float* fft_table_buff, int table_size);
+esp_err_t dsps_fft2r_fc32(float* data, int N);
+esp_err_t dsps_bit_rev_fc32(float* data, int N);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* EZDV_HOST_ESP_DSP_H */
@@ -1,6 +1,6 @@
 /* 
  * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
- * Copyright (c) 2023 Mooneer Salem
+ * Copyright (c) 2024 Mooneer Salem
  * 
  * This program is free software: you can redistribute it and/or modify  
  * it under the terms of the GNU General Public License as published by  
@@ -15,36 +15,16 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef EZDV_HOST_ESP_MEMORY_UTILS_H
+#define EZDV_HOST_ESP_MEMORY_UTILS_H
 
-#ifndef SINE_WAVE_GENERATOR_H
-#define SINE_WAVE_GENERATOR_H
+#include <stdbool.h>
 
-namespace ezdv
+/* The host only has one kind of memory; it's counted as internal RAM. */
+static inline bool esp_ptr_internal(const void* ptr)
 {
-
-namespace util
-{
-
-class SineWaveGenerator
-{
-public:
-    SineWaveGenerator(int frequency, int amplitude);
-    ~SineWaveGenerator();
-    
-    short getSample(int index);
-    
-private:
-    short* samples_;
-};
-
-inline short SineWaveGenerator::getSample(int index)
-{
-    // XXX: index should not exceed the number of samples! Currently no checking here.
-    return samples_[index];
-}
-
-}
-
+    (void)ptr;
+    return true;
 }
 
-#endif // SINE_WAVE_GENERATOR_H
\ No newline at end of file
+#endif /* EZDV_HOST_ESP_MEMORY_UTILS_H */
@@ -0,0 +1,75 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EZDV_HOST_FREERTOS_H
+#define EZDV_HOST_FREERTOS_H
+
+/* Stands in for ESP-IDF's freertos/FreeRTOS.h: the kernel's own header plus
+   the ESP-IDF additions ezDV uses. The host build is single core, so the
+   spinlocks are just critical sections. */
+
+#include <FreeRTOS.h>
+
+#define tskNO_AFFINITY ( ( BaseType_t ) 0x7FFFFFFF )
+
+/* Per-core tables are sized as on the ESP32-S3; everything runs on "core" 0. */
+#define portNUM_PROCESSORS 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+static inline BaseType_t xPortGetCoreID( void )
+{
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+typedef struct
+{
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portMUX_INITIALIZE( mux ) ( ( void ) ( mux ) )
+
+/* ESP-IDF's versions take the spinlock to use. task.h's taskENTER_CRITICAL()
+   still works as the argument is ignored. */
+#undef portENTER_CRITICAL
+#undef portEXIT_CRITICAL
+#define portENTER_CRITICAL( ... )       vPortEnterCritical()
+#define portEXIT_CRITICAL( ... )        vPortExitCritical()
+#define portENTER_CRITICAL_ISR( mux )   vPortEnterCritical()
+#define portEXIT_CRITICAL_ISR( mux )    vPortExitCritical()
+#define portENTER_CRITICAL_SAFE( mux )  vPortEnterCritical()
+#define portEXIT_CRITICAL_SAFE( mux )   vPortExitCritical()
+
+/* There are no interrupts on the host. */
+#define xPortInIsrContext()             ( 0 )
+
+/* ESP-IDF allows portYIELD_FROM_ISR() without an argument. */
+#undef portYIELD_FROM_ISR
+#define portYIELD_FROM_ISR( ... )       portYIELD()
+
+#ifndef pdTICKS_TO_MS
+#define pdTICKS_TO_MS( xTicks )         ( ( TickType_t ) ( ( ( uint64_t ) ( xTicks ) * 1000 ) / configTICK_RATE_HZ ) )
+#endif
+
+#endif /* EZDV_HOST_FREERTOS_H */
@@ -0,0 +1,50 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EZDV_HOST_FREERTOS_TASK_H
+#define EZDV_HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+#include <task.h>
+
+/* Host stacks need much more room than on the ESP32-S3 (64-bit frames, 
+   glibc, sanitizers). */
+#define EZDV_HOST_MIN_STACK_BYTES ( 256 * 1024 )
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* ESP-IDF stack sizes are in bytes rather than words. Affinity is ignored. */
+static inline BaseType_t xTaskCreatePinnedToCore( TaskFunction_t pxTaskCode,
+                                                  const char * const pcName,
+                                                  const uint32_t usStackDepth,
+                                                  void * const pvParameters,
+                                                  UBaseType_t uxPriority,
+                                                  TaskHandle_t * const pxCreatedTask,
+                                                  const BaseType_t xCoreID )
+{
+    uint32_t stackBytes = usStackDepth < EZDV_HOST_MIN_STACK_BYTES ? EZDV_HOST_MIN_STACK_BYTES : usStackDepth;
+    ( void ) xCoreID;
+    return xTaskCreate( pxTaskCode, pcName, stackBytes / sizeof( StackType_t ), pvParameters, uxPriority, pxCreatedTask );
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* EZDV_HOST_FREERTOS_TASK_H */
@@ -0,0 +1,282 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "audio/AudioRingBuffer.h"
+#include "network/flex/FlexKeyValueParser.h"
+#include "network/flex/SampleRateConverter.h"
+#include "network/icom/IcomPacket.h"
+#include "network/icom/IcomPacketPool.h"
+#include "task/DVTask.h"
+#include "task/DVTaskMessage.h"
+
+#define CURRENT_LOG_TAG ("HostBenchmark")
+
+// 20 ms of audio at each rate, as the Flex and Icom code paths handle it.
+#define BENCH_SAMPLES_8K (160)
+#define BENCH_SAMPLES_24K (BENCH_SAMPLES_8K * FDMDV_OS_24)
+
+#define BENCH_ROUND_TRIPS (20000)
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(HOST_BENCHMARK_MESSAGE);
+    DV_EVENT_DEFINE_BASE(HOST_BENCHMARK_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace host
+{
+
+using namespace ezdv::task;
+
+enum HostBenchmarkMessageTypes
+{
+    START_PING = 1,
+    PING = 2,
+    PONG = 3,
+};
+
+template<uint32_t TYPE_ID>
+class HostBenchmarkMessageCommon : public DVTaskMessageBase<TYPE_ID, HostBenchmarkMessageCommon<TYPE_ID>>
+{
+public:
+    HostBenchmarkMessageCommon()
+        : DVTaskMessageBase<TYPE_ID, HostBenchmarkMessageCommon<TYPE_ID>>(HOST_BENCHMARK_MESSAGE)
+        {}
+    virtual ~HostBenchmarkMessageCommon() = default;
+};
+
+using StartPingMessage = HostBenchmarkMessageCommon<START_PING>;
+using PingMessage = HostBenchmarkMessageCommon<PING>;
+using PongMessage = HostBenchmarkMessageCommon<PONG>;
+
+/// @brief Replies to every PingMessage.
+class EchoTask : public DVTask
+{
+public:
+    EchoTask()
+        : DVTask("EchoTask", 10, 4096, tskNO_AFFINITY, 16)
+    {
+        registerMessageHandler(this, &EchoTask::onPingMessage_);
+    }
+    virtual ~EchoTask() = default;
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    void onPingMessage_(DVTask* origin, PingMessage*)
+    {
+        PongMessage message;
+        sendTo(origin, &message);
+    }
+};
+
+/// @brief Bounces messages off an EchoTask and signals once done.
+class PingTask : public DVTask
+{
+public:
+    PingTask(DVTask* echoTask, SemaphoreHandle_t doneSemaphore)
+        : DVTask("PingTask", 10, 4096, tskNO_AFFINITY, 16)
+        , echoTask_(echoTask)
+        , doneSemaphore_(doneSemaphore)
+        , numRoundTrips_(0)
+    {
+        registerMessageHandler(this, &PingTask::onStartPingMessage_);
+        registerMessageHandler(this, &PingTask::onPongMessage_);
+    }
+    virtual ~PingTask() = default;
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    DVTask* echoTask_;
+    SemaphoreHandle_t doneSemaphore_;
+    int numRoundTrips_;
+
+    void onStartPingMessage_(DVTask*, StartPingMessage*)
+    {
+        numRoundTrips_ = 0;
+
+        PingMessage message;
+        sendTo(echoTask_, &message);
+    }
+
+    void onPongMessage_(DVTask*, PongMessage*)
+    {
+        if (++numRoundTrips_ < BENCH_ROUND_TRIPS)
+        {
+            PingMessage message;
+            sendTo(echoTask_, &message);
+        }
+        else
+        {
+            xSemaphoreGive(doneSemaphore_);
+        }
+    }
+};
+
+template<typename FnType>
+static void RunBenchmark(const char* name, int iterations, FnType fn)
+{
+    // One untimed pass so that first-use costs (allocation, cache misses)
+    // don't skew the result.
+    fn();
+
+    int64_t begin = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    int64_t elapsed = esp_timer_get_time() - begin;
+
+    ESP_LOGI(CURRENT_LOG_TAG, "%-28s %8d iterations, %10.3f us/iteration", name, iterations, (double)elapsed / iterations);
+}
+
+static void BenchmarkMessaging()
+{
+    SemaphoreHandle_t doneSemaphore = xSemaphoreCreateBinary();
+    assert(doneSemaphore != nullptr);
+
+    EchoTask echoTask;
+    PingTask pingTask(&echoTask, doneSemaphore);
+    echoTask.start();
+    pingTask.start();
+
+    int64_t begin = esp_timer_get_time();
+    StartPingMessage message;
+    pingTask.post(&message);
+    xSemaphoreTake(doneSemaphore, portMAX_DELAY);
+    int64_t elapsed = esp_timer_get_time() - begin;
+
+    ESP_LOGI(CURRENT_LOG_TAG, "%-28s %8d iterations, %10.3f us/iteration", "DVTask round trip", BENCH_ROUND_TRIPS, (double)elapsed / BENCH_ROUND_TRIPS);
+
+    pingTask.sleep();
+    echoTask.sleep();
+    vTaskDelay(pdMS_TO_TICKS(100));
+    vSemaphoreDelete(doneSemaphore);
+}
+
+static void BenchmarkAudio()
+{
+    static short samples8k[FDMDV_OS_TAPS_24_8K + BENCH_SAMPLES_8K];
+    static short samples24k[FDMDV_OS_TAPS_24K + BENCH_SAMPLES_24K];
+    static float output24k[BENCH_SAMPLES_24K];
+    static short output8k[BENCH_SAMPLES_8K];
+
+    for (int i = 0; i < FDMDV_OS_TAPS_24_8K + BENCH_SAMPLES_8K; i++)
+    {
+        samples8k[i] = (short)(rand() % 65536 - 32768);
+    }
+    for (int i = 0; i < FDMDV_OS_TAPS_24K + BENCH_SAMPLES_24K; i++)
+    {
+        samples24k[i] = (short)(rand() % 65536 - 32768);
+    }
+
+    audio::AudioRingBuffer ringBuffer(BENCH_SAMPLES_24K * 4);
+    RunBenchmark("AudioRingBuffer write+read", 100000, [&]() {
+        ringBuffer.write(samples24k, BENCH_SAMPLES_24K);
+        ringBuffer.read(samples24k, BENCH_SAMPLES_24K);
+    });
+
+    RunBenchmark("fdmdv_8_to_24_with_scaling", 100000, [&]() {
+        fdmdv_8_to_24_with_scaling(output24k, &samples8k[FDMDV_OS_TAPS_24_8K], BENCH_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+    });
+
+    RunBenchmark("fdmdv_24_to_8", 100000, [&]() {
+        fdmdv_24_to_8(output8k, &samples24k[FDMDV_OS_TAPS_24K], BENCH_SAMPLES_8K);
+    });
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    fdmdv_8_to_24_state_t* upsampler = fdmdv_8_to_24_create(BENCH_SAMPLES_8K);
+    RunBenchmark("fdmdv_8_to_24_fir", 100000, [&]() {
+        fdmdv_8_to_24_fir(upsampler, output24k, samples8k, BENCH_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+    });
+    fdmdv_8_to_24_destroy(upsampler);
+
+    fdmdv_24_to_8_state_t* downsampler = fdmdv_24_to_8_create();
+    RunBenchmark("fdmdv_24_to_8_fir", 100000, [&]() {
+        fdmdv_24_to_8_fir(downsampler, output8k, samples24k, BENCH_SAMPLES_8K);
+    });
+    fdmdv_24_to_8_destroy(downsampler);
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+}
+
+static void BenchmarkNetwork()
+{
+    // A typical slice status update from a Flex radio.
+    static const char statusLine[] = 
+        "slice 0 in_use=1 sample_rate=24000 RF_frequency=14.236000 client_handle=0x7D5D9A4F "
+        "index_letter=A rit_on=0 rit_freq=0 xit_on=0 xit_freq=0 rxant=ANT1 mode=FDVU "
+        "wide=0 filter_lo=1400 filter_hi=1600 step=100 step_list=1,10,50,100,500,1000,2000,3000 "
+        "agc_mode=med agc_threshold=65 agc_off_level=10 pan=0x40000000 txant=ANT1 loopa=0 loopb=0 "
+        "qsk=0 dax=1 dax_clients=1 lock=0 tx=1 active=1 audio_level=50 audio_pan=50 audio_mute=1";
+    network::flex::FlexKeyValueParser::Parameters parameters;
+    RunBenchmark("FlexKeyValueParser", 100000, [&]() {
+        network::flex::FlexKeyValueParser::GetCommandParameters(statusLine, parameters);
+    });
+
+    static short audio[BENCH_SAMPLES_8K];
+    uint16_t audioSeq = 0;
+    RunBenchmark("IcomPacket::CreateAudioPacket", 100000, [&]() {
+        auto packet = network::icom::IcomPacket::CreateAudioPacket(audioSeq++, 0x12345678, 0x87654321, audio, BENCH_SAMPLES_8K);
+        (void)packet;
+    });
+}
+
+static void BenchmarkTaskEntry(void*)
+{
+    DVTask::Initialize();
+    network::icom::IcomPacketPool::Initialize();
+
+    BenchmarkMessaging();
+    BenchmarkAudio();
+    BenchmarkNetwork();
+
+    exit(0);
+}
+
+}
+
+}
+
+int main()
+{
+    // Starts the clock that esp_timer_get_time() and log timestamps use.
+    esp_timer_get_time();
+
+    xTaskCreatePinnedToCore(&ezdv::host::BenchmarkTaskEntry, "HostBenchmark", 8192, nullptr, 5, nullptr, 0);
+    vTaskStartScheduler();
+
+    return 1;
+}
@@ -0,0 +1,1228 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "audio/AudioMixer.h"
+#include "audio/AudioRingBuffer.h"
+#include "network/flex/SampleRateConverter.h"
+#include "task/DVTask.h"
+
+#if EZDV_HOST_CODEC2
+#include "freedv_api.h"
+#include "kiss_fft.h"
+#include "audio/Codec2Fft.h"
+#endif // EZDV_HOST_CODEC2
+
+#define CURRENT_LOG_TAG ("HostRegression")
+
+#define SAMPLE_RATE_8K (8000)
+#define SAMPLE_RATE_24K (24000)
+
+// Everything is processed 20 ms at a time, as FreeDVTask and FlexVitaTask do.
+#define FRAME_SAMPLES_8K (160)
+#define FRAME_SAMPLES_24K (FRAME_SAMPLES_8K * FDMDV_OS_24)
+
+// Length of each generated corpus entry.
+#define SYNTHETIC_SECONDS (4)
+
+// Default thresholds for outputs that aren't compared bit for bit. Float
+// kernels may round differently once optimized; modem and vocoder output
+// is allowed to drift further since small changes compound over frames.
+#define SNR_RESAMPLER_DB (70.0)
+#define SNR_FIR_VS_REFERENCE_DB (50.0)
+#define SNR_FREEDV_TX_DB (40.0)
+#define SNR_FREEDV_RX_DB (20.0)
+#define SNR_FFT_HOOK_DB (90.0)
+
+// Sentinel for outputs that must match exactly.
+#define BIT_EXACT (-1.0)
+
+// Modem silence fed to the demodulator after the last frame so that it 
+// gets decoded too.
+#define FREEDV_FLUSH_FRAMES (4)
+
+// Minimum fraction of the transmitted signal that RX must be in sync for.
+// Leaves room for acquisition at the start of each case.
+#define FREEDV_MIN_SYNC_RATIO_700D (0.5)
+#define FREEDV_MIN_SYNC_RATIO_700E (0.5)
+#define FREEDV_MIN_SYNC_RATIO_1600 (0.8)
+
+namespace ezdv
+{
+
+namespace host
+{
+
+using namespace ezdv::task;
+
+/// @brief Audio as loaded from or saved to a WAV file. PCM files are kept 
+///        at short scale; float files as-is.
+struct Wav
+{
+    int sampleRate = 0;
+    int channels = 1;
+    bool isFloat = false;
+    std::vector<float> samples; // interleaved
+};
+
+/// @brief One output of a stage, checked against its golden file and/or a
+///        reference computed in the harness.
+struct Output
+{
+    std::string name; // <case>.<stage>
+    Wav wav;
+    double minSnrDb = BIT_EXACT; // against the golden file
+    std::vector<float> reference;
+    double referenceMinSnrDb = BIT_EXACT;
+    int referenceMaxLag = 0; // samples of extra delay allowed against the reference
+    double syncRatio = NAN; // modem outputs only: fraction of frames received in sync
+    double minSyncRatio = 0;
+};
+
+struct Case
+{
+    std::string name;
+    Wav input; // short scale
+};
+
+/// @brief A component (or chain of components) to push a case through.
+struct Stage
+{
+    const char* name;
+    bool (*applies)(const Case&);
+    void (*run)(const Case&, std::vector<Output>&, double* audioSeconds);
+    bool needsScheduler; // DVTask-based; run from a FreeRTOS task after the rest
+};
+
+struct WorkItem
+{
+    const Case* testCase;
+    const Stage* stage;
+    std::vector<Output> outputs;
+    double audioSeconds = 0;
+    int64_t elapsedUs = 0;
+};
+
+struct Options
+{
+    std::string goldenDir;
+    bool update = false;
+    int jobs = 0;
+    double snrOverrideDb = NAN;
+    std::vector<std::string> corpus;
+};
+
+static Options Options_;
+static std::vector<Case> Cases_;
+static std::vector<WorkItem> WorkItems_;
+static int64_t ParallelElapsedUs_ = 0;
+
+// WAV files
+// ==================================================================
+
+static uint32_t ReadLe32(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t ReadLe16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static bool LoadWav(const std::string& path, Wav& wav)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> contents;
+    uint8_t buffer[4096];
+    size_t numRead;
+    while ((numRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        contents.insert(contents.end(), buffer, buffer + numRead);
+    }
+    fclose(fp);
+
+    if (contents.size() < 12 || memcmp(&contents[0], "RIFF", 4) || memcmp(&contents[8], "WAVE", 4))
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "%s: not a WAV file", path.c_str());
+        return false;
+    }
+
+    int format = 0;
+    int bitsPerSample = 0;
+    bool hasFormat = false;
+    size_t offset = 12;
+    while (offset + 8 <= contents.size())
+    {
+        const uint8_t* chunk = &contents[offset];
+        size_t chunkSize = ReadLe32(&chunk[4]);
+        size_t available = std::min(chunkSize, contents.size() - offset - 8);
+
+        if (!memcmp(chunk, "fmt ", 4) && available >= 16)
+        {
+            format = ReadLe16(&chunk[8]);
+            wav.channels = ReadLe16(&chunk[10]);
+            wav.sampleRate = ReadLe32(&chunk[12]);
+            bitsPerSample = ReadLe16(&chunk[22]);
+            if (format == 0xFFFE && available >= 26)
+            {
+                // WAVE_FORMAT_EXTENSIBLE; the real format starts the subtype GUID.
+                format = ReadLe16(&chunk[32]);
+            }
+            hasFormat = true;
+        }
+        else if (!memcmp(chunk, "data", 4) && hasFormat)
+        {
+            const uint8_t* data = &chunk[8];
+            if (format == 1 && bitsPerSample == 16)
+            {
+                wav.isFloat = false;
+                for (size_t index = 0; index + 2 <= available; index += 2)
+                {
+                    wav.samples.push_back((int16_t)ReadLe16(&data[index]));
+                }
+                return wav.channels > 0;
+            }
+            else if (format == 3 && bitsPerSample == 32)
+            {
+                wav.isFloat = true;
+                for (size_t index = 0; index + 4 <= available; index += 4)
+                {
+                    uint32_t bits = ReadLe32(&data[index]);
+                    float sample;
+                    memcpy(&sample, &bits, sizeof(sample));
+                    wav.samples.push_back(sample);
+                }
+                return wav.channels > 0;
+            }
+
+            ESP_LOGE(CURRENT_LOG_TAG, "%s: only 16 bit PCM and 32 bit float WAV files are supported", path.c_str());
+            return false;
+        }
+
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    ESP_LOGE(CURRENT_LOG_TAG, "%s: no audio found", path.c_str());
+    return false;
+}
+
+static void AppendLe32(std::vector<uint8_t>& data, uint32_t value)
+{
+    for (int index = 0; index < 4; index++)
+    {
+        data.push_back(value >> (index * 8));
+    }
+}
+
+static void AppendLe16(std::vector<uint8_t>& data, uint16_t value)
+{
+    data.push_back(value);
+    data.push_back(value >> 8);
+}
+
+static bool SaveWav(const std::string& path, const Wav& wav)
+{
+    int bytesPerSample = wav.isFloat ? 4 : 2;
+    uint32_t dataSize = wav.samples.size() * bytesPerSample;
+
+    std::vector<uint8_t> contents;
+    contents.insert(contents.end(), { 'R', 'I', 'F', 'F' });
+    AppendLe32(contents, 36 + dataSize);
+    contents.insert(contents.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+    AppendLe32(contents, 16);
+    AppendLe16(contents, wav.isFloat ? 3 : 1);
+    AppendLe16(contents, wav.channels);
+    AppendLe32(contents, wav.sampleRate);
+    AppendLe32(contents, wav.sampleRate * wav.channels * bytesPerSample);
+    AppendLe16(contents, wav.channels * bytesPerSample);
+    AppendLe16(contents, bytesPerSample * 8);
+    contents.insert(contents.end(), { 'd', 'a', 't', 'a' });
+    AppendLe32(contents, dataSize);
+    for (float sample : wav.samples)
+    {
+        if (wav.isFloat)
+        {
+            uint32_t bits;
+            memcpy(&bits, &sample, sizeof(bits));
+            AppendLe32(contents, bits);
+        }
+        else
+        {
+            AppendLe16(contents, (uint16_t)(int16_t)sample);
+        }
+    }
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not create %s", path.c_str());
+        return false;
+    }
+    bool result = fwrite(contents.data(), 1, contents.size(), fp) == contents.size();
+    fclose(fp);
+    return result;
+}
+
+// Corpus
+// ==================================================================
+
+static int16_t ClampShort(double value)
+{
+    long rounded = lrint(value);
+    return (rounded > INT16_MAX) ? INT16_MAX : ((rounded < INT16_MIN) ? INT16_MIN : rounded);
+}
+
+/// @brief Deterministic noise so that generated cases are the same everywhere.
+static uint32_t NextRandom(uint32_t& state)
+{
+    state = state * 1664525 + 1013904223;
+    return state;
+}
+
+static void GenerateCorpus()
+{
+    int numSamples8k = SAMPLE_RATE_8K * SYNTHETIC_SECONDS;
+    int numSamples24k = SAMPLE_RATE_24K * SYNTHETIC_SECONDS;
+
+    // A voiced, speech-like signal: harmonics of a wandering pitch with a
+    // syllable-rate envelope.
+    Case voice = { "voice_8k", { SAMPLE_RATE_8K, 1, false, {} } };
+    double phase = 0;
+    for (int index = 0; index < numSamples8k; index++)
+    {
+        double t = (double)index / SAMPLE_RATE_8K;
+        double pitch = 120 + 30 * sin(2 * M_PI * 0.7 * t);
+        phase += 2 * M_PI * pitch / SAMPLE_RATE_8K;
+
+        double value = 0;
+        for (int harmonic = 1; harmonic <= 20 && harmonic * pitch < 3800; harmonic++)
+        {
+            value += sin(harmonic * phase) / harmonic;
+        }
+        double envelope = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+        voice.input.samples.push_back(ClampShort(8000 * envelope * value));
+    }
+    Cases_.push_back(voice);
+
+    Case chirp = { "chirp_8k", { SAMPLE_RATE_8K, 1, false, {} } };
+    for (int index = 0; index < numSamples8k; index++)
+    {
+        double t = (double)index / SAMPLE_RATE_8K;
+        double sweep = (3800.0 - 100.0) / SYNTHETIC_SECONDS;
+        chirp.input.samples.push_back(ClampShort(16384 * sin(2 * M_PI * (100 * t + sweep * t * t / 2))));
+    }
+    Cases_.push_back(chirp);
+
+    Case noise = { "noise_8k", { SAMPLE_RATE_8K, 1, false, {} } };
+    uint32_t seed = 1;
+    for (int index = 0; index < numSamples8k; index++)
+    {
+        noise.input.samples.push_back((int16_t)(NextRandom(seed) >> 16) / 4);
+    }
+    Cases_.push_back(noise);
+
+    // What DAX IQ from the radio looks like: complex tones in stereo.
+    Case iq = { "iq_24k", { SAMPLE_RATE_24K, 2, false, {} } };
+    for (int index = 0; index < numSamples24k; index++)
+    {
+        double t = (double)index / SAMPLE_RATE_24K;
+        double i = 12000 * cos(2 * M_PI * 1000 * t) + 3000 * cos(2 * M_PI * -3500 * t);
+        double q = 12000 * sin(2 * M_PI * 1000 * t) + 3000 * sin(2 * M_PI * -3500 * t);
+        iq.input.samples.push_back(ClampShort(i));
+        iq.input.samples.push_back(ClampShort(q));
+    }
+    Cases_.push_back(iq);
+}
+
+static bool EndsWith(const std::string& value, const char* suffix)
+{
+    size_t length = strlen(suffix);
+    return value.size() >= length && !strcasecmp(value.c_str() + value.size() - length, suffix);
+}
+
+static bool AddCorpusFile(const std::string& path)
+{
+    Case testCase;
+    if (!LoadWav(path, testCase.input))
+    {
+        return false;
+    }
+
+    if (testCase.input.sampleRate != SAMPLE_RATE_8K && testCase.input.sampleRate != SAMPLE_RATE_24K)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "%s: skipping, only 8 and 24 kHz audio is used by ezDV", path.c_str());
+        return true;
+    }
+
+    if (testCase.input.isFloat)
+    {
+        // Everything runs at short scale; float files (e.g. IQ recordings) are +/- 1.
+        for (auto& sample : testCase.input.samples)
+        {
+            sample = ClampShort(sample * 32768.0);
+        }
+        testCase.input.isFloat = false;
+    }
+
+    size_t slash = path.find_last_of('/');
+    testCase.name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    testCase.name.resize(testCase.name.size() - 4);
+    Cases_.push_back(testCase);
+    return true;
+}
+
+static bool LoadCorpus()
+{
+    if (Options_.corpus.empty())
+    {
+        GenerateCorpus();
+        return true;
+    }
+
+    for (auto& path : Options_.corpus)
+    {
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr)
+        {
+            if (!AddCorpusFile(path))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        std::vector<std::string> files;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            if (EndsWith(entry->d_name, ".wav"))
+            {
+                files.push_back(path + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+
+        // Same order (and golden file names) on every run.
+        std::sort(files.begin(), files.end());
+        for (auto& file : files)
+        {
+            if (!AddCorpusFile(file))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Stages
+// ==================================================================
+
+/// @brief Returns the first channel of the input padded to whole frames.
+static std::vector<short> GetChannel(const Wav& wav, int frameSamples)
+{
+    std::vector<short> samples;
+    for (size_t index = 0; index < wav.samples.size(); index += wav.channels)
+    {
+        samples.push_back((short)wav.samples[index]);
+    }
+    samples.resize((samples.size() + frameSamples - 1) / frameSamples * frameSamples);
+    return samples;
+}
+
+static void AddOutput(const Case& testCase, const char* stageName, std::vector<Output>& outputs, Wav&& wav, double minSnrDb)
+{
+    Output output;
+    output.name = testCase.name + "." + stageName;
+    output.wav = std::move(wav);
+    output.minSnrDb = minSnrDb;
+    outputs.push_back(std::move(output));
+}
+
+static bool Is8k(const Case& testCase)
+{
+    return testCase.input.sampleRate == SAMPLE_RATE_8K;
+}
+
+static bool Is24k(const Case& testCase)
+{
+    return testCase.input.sampleRate == SAMPLE_RATE_24K;
+}
+
+/// @brief 8 -> 24 kHz as on the way to the Flex (FreeDVTask TX output).
+static void RunUpsampler(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    auto input = GetChannel(testCase.input, FRAME_SAMPLES_8K);
+    *audioSeconds = (double)input.size() / SAMPLE_RATE_8K;
+
+    // Filter memory goes in front of each frame (see SampleRateConverter.h).
+    std::vector<short> frame(FDMDV_OS_TAPS_24_8K + FRAME_SAMPLES_8K);
+    Wav output = { SAMPLE_RATE_24K, 1, true, std::vector<float>(input.size() * FDMDV_OS_24) };
+    for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_8K)
+    {
+        memcpy(&frame[FDMDV_OS_TAPS_24_8K], &input[offset], FRAME_SAMPLES_8K * sizeof(short));
+        fdmdv_8_to_24_with_scaling(&output.samples[offset * FDMDV_OS_24], &frame[FDMDV_OS_TAPS_24_8K], FRAME_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+    }
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    {
+        fdmdv_8_to_24_state_t* state = fdmdv_8_to_24_create(FRAME_SAMPLES_8K);
+        Wav firOutput = { SAMPLE_RATE_24K, 1, true, std::vector<float>(input.size() * FDMDV_OS_24) };
+        for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_8K)
+        {
+            fdmdv_8_to_24_fir(state, &firOutput.samples[offset * FDMDV_OS_24], &input[offset], FRAME_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+        }
+        fdmdv_8_to_24_destroy(state);
+
+        AddOutput(testCase, "fdmdv_8_to_24_fir", outputs, std::move(firOutput), SNR_RESAMPLER_DB);
+        outputs.back().reference = output.samples;
+        outputs.back().referenceMinSnrDb = SNR_FIR_VS_REFERENCE_DB;
+        outputs.back().referenceMaxLag = FDMDV_OS_TAPS_24K;
+    }
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    {
+        std::vector<float> floatInput(input.begin(), input.end());
+        fdmdv_8_to_24_float_state_t* state = fdmdv_8_to_24_float_create(FRAME_SAMPLES_8K);
+        Wav floatOutput = { SAMPLE_RATE_24K, 1, true, std::vector<float>(input.size() * FDMDV_OS_24) };
+        for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_8K)
+        {
+            fdmdv_8_to_24_float(state, &floatOutput.samples[offset * FDMDV_OS_24], &floatInput[offset], FRAME_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+        }
+        fdmdv_8_to_24_float_destroy(state);
+
+        AddOutput(testCase, "fdmdv_8_to_24_float", outputs, std::move(floatOutput), SNR_RESAMPLER_DB);
+        outputs.back().reference = output.samples;
+        outputs.back().referenceMinSnrDb = SNR_FIR_VS_REFERENCE_DB;
+        outputs.back().referenceMaxLag = FDMDV_OS_TAPS_24K;
+    }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    AddOutput(testCase, "fdmdv_8_to_24", outputs, std::move(output), SNR_RESAMPLER_DB);
+}
+
+/// @brief 24 -> 8 kHz as on the way from the Flex (FreeDVTask RX input).
+static void RunDownsampler(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    auto input = GetChannel(testCase.input, FRAME_SAMPLES_24K);
+    *audioSeconds = (double)input.size() / SAMPLE_RATE_24K;
+
+    std::vector<short> frame(FDMDV_OS_TAPS_24K + FRAME_SAMPLES_24K);
+    std::vector<short> frameOutput(FRAME_SAMPLES_8K);
+    Wav output = { SAMPLE_RATE_8K, 1, false, {} };
+    for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_24K)
+    {
+        memcpy(&frame[FDMDV_OS_TAPS_24K], &input[offset], FRAME_SAMPLES_24K * sizeof(short));
+        fdmdv_24_to_8(frameOutput.data(), &frame[FDMDV_OS_TAPS_24K], FRAME_SAMPLES_8K);
+        output.samples.insert(output.samples.end(), frameOutput.begin(), frameOutput.end());
+    }
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    {
+        fdmdv_24_to_8_state_t* state = fdmdv_24_to_8_create();
+        Wav firOutput = { SAMPLE_RATE_8K, 1, false, {} };
+        for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_24K)
+        {
+            fdmdv_24_to_8_fir(state, frameOutput.data(), &input[offset], FRAME_SAMPLES_8K);
+            firOutput.samples.insert(firOutput.samples.end(), frameOutput.begin(), frameOutput.end());
+        }
+        fdmdv_24_to_8_destroy(state);
+
+        AddOutput(testCase, "fdmdv_24_to_8_fir", outputs, std::move(firOutput), BIT_EXACT);
+        outputs.back().reference = output.samples;
+        outputs.back().referenceMinSnrDb = SNR_FIR_VS_REFERENCE_DB;
+        outputs.back().referenceMaxLag = FDMDV_OS_TAPS_24_8K;
+    }
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    {
+        std::vector<float> floatInput(input.begin(), input.end());
+        fdmdv_24_to_8_float_state_t* state = fdmdv_24_to_8_float_create();
+        Wav floatOutput = { SAMPLE_RATE_8K, 1, true, std::vector<float>(input.size() / FDMDV_OS_24) };
+        for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_24K)
+        {
+            fdmdv_24_to_8_float(state, &floatOutput.samples[offset / FDMDV_OS_24], &floatInput[offset], FRAME_SAMPLES_8K);
+        }
+        fdmdv_24_to_8_float_destroy(state);
+
+        AddOutput(testCase, "fdmdv_24_to_8_float", outputs, std::move(floatOutput), SNR_RESAMPLER_DB);
+        outputs.back().reference = output.samples;
+        outputs.back().referenceMinSnrDb = SNR_FIR_VS_REFERENCE_DB;
+        outputs.back().referenceMaxLag = FDMDV_OS_TAPS_24_8K;
+    }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    AddOutput(testCase, "fdmdv_24_to_8", outputs, std::move(output), BIT_EXACT);
+}
+
+static uint32_t FloatToVitaWord(float sample)
+{
+    uint32_t bits;
+    memcpy(&bits, &sample, sizeof(bits));
+    return __builtin_bswap32(bits);
+}
+
+static float BitsToFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/// @brief VITA payload packing and unpacking (FlexVitaTask).
+static void RunVita(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    auto& input = testCase.input;
+    int numFrames = input.samples.size() / input.channels;
+    numFrames = (numFrames + FRAME_SAMPLES_24K - 1) / FRAME_SAMPLES_24K * FRAME_SAMPLES_24K;
+    *audioSeconds = (double)numFrames / SAMPLE_RATE_24K;
+
+    // What the radio sends: interleaved big-endian float pairs. Mono input
+    // goes through fdmdv_float_to_vita() as on TX; stereo (IQ) is packed 
+    // directly as the radio would have.
+    std::vector<uint32_t> payload(numFrames * 2);
+    if (input.channels == 1)
+    {
+        alignas(16) float block[FRAME_SAMPLES_24K];
+        std::vector<float> floats(numFrames);
+        for (size_t index = 0; index < input.samples.size(); index++)
+        {
+            floats[index] = input.samples[index] / 32768.0f;
+        }
+        for (int offset = 0; offset < numFrames; offset += FRAME_SAMPLES_24K)
+        {
+            memcpy(block, &floats[offset], sizeof(block));
+            fdmdv_float_to_vita(&payload[offset * 2], block, FRAME_SAMPLES_24K);
+        }
+
+        Output packed;
+        packed.name = testCase.name + ".fdmdv_float_to_vita";
+        packed.wav = { SAMPLE_RATE_24K, 2, true, {} };
+        for (int index = 0; index < numFrames; index++)
+        {
+            packed.wav.samples.push_back(BitsToFloat(payload[index * 2]));
+            packed.wav.samples.push_back(BitsToFloat(payload[index * 2 + 1]));
+
+            uint32_t expected = FloatToVitaWord(floats[index]);
+            packed.reference.push_back(BitsToFloat(expected));
+            packed.reference.push_back(BitsToFloat(expected));
+        }
+        outputs.push_back(std::move(packed));
+    }
+    else
+    {
+        for (int index = 0; index < numFrames && (size_t)(index * input.channels + 1) < input.samples.size(); index++)
+        {
+            payload[index * 2] = FloatToVitaWord(input.samples[index * input.channels] / 32768.0f);
+            payload[index * 2 + 1] = FloatToVitaWord(input.samples[index * input.channels + 1] / 32768.0f);
+        }
+    }
+
+    Wav unpacked = { SAMPLE_RATE_24K, 1, false, {} };
+    short block[FRAME_SAMPLES_24K];
+    for (int offset = 0; offset < numFrames; offset += FRAME_SAMPLES_24K)
+    {
+        fdmdv_vita_to_short(block, &payload[offset * 2], FRAME_SAMPLES_24K);
+        unpacked.samples.insert(unpacked.samples.end(), block, block + FRAME_SAMPLES_24K);
+    }
+
+    // The plain C version documented in SampleRateConverter.c.
+    std::vector<float> reference;
+    for (int index = 0; index < numFrames; index++)
+    {
+        float sample = BitsToFloat(__builtin_bswap32(payload[index * 2]));
+        reference.push_back(ClampShort(rintf(sample * 32768)));
+    }
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    {
+        Wav unpackedFloat = { SAMPLE_RATE_24K, 1, true, std::vector<float>(numFrames) };
+        fdmdv_vita_to_float(unpackedFloat.samples.data(), payload.data(), numFrames);
+
+        AddOutput(testCase, "fdmdv_vita_to_float", outputs, std::move(unpackedFloat), BIT_EXACT);
+        outputs.back().reference = reference;
+        outputs.back().referenceMinSnrDb = SNR_RESAMPLER_DB;
+    }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    AddOutput(testCase, "fdmdv_vita_to_short", outputs, std::move(unpacked), BIT_EXACT);
+    outputs.back().reference = std::move(reference);
+}
+
+/// @brief Received audio mixed with beeps, as AudioMixer does between
+///        FreeDVTask/BeeperTask and the codec.
+static void RunMixer(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    auto input = GetChannel(testCase.input, FRAME_SAMPLES_8K);
+    *audioSeconds = (double)input.size() / SAMPLE_RATE_8K;
+
+    // Beeps: 1 kHz, 100 ms on and 400 ms off.
+    std::vector<short> beeps(input.size());
+    for (size_t index = 0; index < beeps.size(); index++)
+    {
+        bool on = (index % (SAMPLE_RATE_8K / 2)) < (SAMPLE_RATE_8K / 10);
+        beeps[index] = on ? ClampShort(8192 * sin(2 * M_PI * 1000 * index / SAMPLE_RATE_8K)) : 0;
+    }
+
+    // The mixer isn't started; mix() is called directly instead of by its timer.
+    audio::AudioMixer mixer;
+    audio::AudioRingBuffer mixerOutput(FRAME_SAMPLES_8K * 4);
+    mixer.setAudioOutput(audio::AudioInput::LEFT_CHANNEL, &mixerOutput);
+
+    Wav output = { SAMPLE_RATE_8K, 1, false, {} };
+    short block[FRAME_SAMPLES_8K];
+    for (size_t offset = 0; offset < input.size(); offset += FRAME_SAMPLES_8K)
+    {
+        mixer.getAudioInput(audio::AudioInput::LEFT_CHANNEL)->write(&input[offset], FRAME_SAMPLES_8K);
+        if (beeps[offset] != 0 || beeps[offset + FRAME_SAMPLES_8K - 1] != 0)
+        {
+            mixer.getAudioInput(audio::AudioInput::RIGHT_CHANNEL)->write(&beeps[offset], FRAME_SAMPLES_8K);
+        }
+        mixer.mix();
+
+        while (mixerOutput.numUsed() > 0)
+        {
+            int numSamples = std::min(mixerOutput.numUsed(), (uint32_t)FRAME_SAMPLES_8K);
+            mixerOutput.read(block, numSamples);
+            output.samples.insert(output.samples.end(), block, block + numSamples);
+        }
+    }
+
+    mixer.setAudioOutput(audio::AudioInput::LEFT_CHANNEL, nullptr);
+    AddOutput(testCase, "audio_mixer", outputs, std::move(output), BIT_EXACT);
+}
+
+#if EZDV_HOST_CODEC2
+/// @brief FreeDV TX followed by RX of the result (FreeDVTransmitTask 
+///        and FreeDVTask). The modem signal and decoded speech are both kept.
+static void RunFreeDV(const Case& testCase, int mode, const char* modeName, double minSyncRatio, std::vector<Output>& outputs, double* audioSeconds)
+{
+    auto input = GetChannel(testCase.input, FRAME_SAMPLES_8K);
+    *audioSeconds = (double)input.size() / SAMPLE_RATE_8K;
+
+    struct freedv* dv = freedv_open(mode);
+    assert(dv != nullptr);
+
+    int numSpeechSamples = freedv_get_n_speech_samples(dv);
+    int numModemSamples = freedv_get_n_nom_modem_samples(dv);
+    int maxModemSamples = freedv_get_n_max_modem_samples(dv);
+    int maxSpeechSamples = freedv_get_n_max_speech_samples(dv);
+
+    std::vector<short> speech(numSpeechSamples);
+    std::vector<short> modemFrame(numModemSamples);
+    Wav modem = { SAMPLE_RATE_8K, 1, false, {} };
+    for (size_t offset = 0; offset < input.size(); offset += numSpeechSamples)
+    {
+        size_t count = std::min((size_t)numSpeechSamples, input.size() - offset);
+        std::fill(speech.begin(), speech.end(), 0);
+        memcpy(speech.data(), &input[offset], count * sizeof(short));
+        freedv_tx(dv, modemFrame.data(), speech.data());
+        modem.samples.insert(modem.samples.end(), modemFrame.begin(), modemFrame.end());
+    }
+
+    std::vector<short> rxInput(modem.samples.begin(), modem.samples.end());
+    rxInput.resize(rxInput.size() + numModemSamples * FREEDV_FLUSH_FRAMES + maxModemSamples);
+
+    std::vector<short> rxSpeech(maxSpeechSamples);
+    Wav decoded = { SAMPLE_RATE_8K, 1, false, {} };
+    int numSyncedFrames = 0;
+    int numFrames = 0;
+    size_t position = 0;
+    for (;;)
+    {
+        int nin = freedv_nin(dv);
+        if (position + nin > rxInput.size())
+        {
+            break;
+        }
+
+        int nout = freedv_rx(dv, rxSpeech.data(), &rxInput[position]);
+        position += nin;
+        decoded.samples.insert(decoded.samples.end(), rxSpeech.begin(), rxSpeech.begin() + nout);
+
+        // Only frames carrying the signal count; the flush at the end 
+        // is expected to lose sync.
+        int sync = 0;
+        float snr = 0;
+        freedv_get_modem_stats(dv, &sync, &snr);
+        if (position <= modem.samples.size())
+        {
+            numSyncedFrames += sync ? 1 : 0;
+            numFrames++;
+        }
+    }
+
+    freedv_close(dv);
+
+    std::string stageName = std::string("freedv_tx_") + modeName;
+    AddOutput(testCase, stageName.c_str(), outputs, std::move(modem), SNR_FREEDV_TX_DB);
+    stageName = std::string("freedv_rx_") + modeName;
+    AddOutput(testCase, stageName.c_str(), outputs, std::move(decoded), SNR_FREEDV_RX_DB);
+    outputs.back().syncRatio = numFrames > 0 ? (double)numSyncedFrames / numFrames : 0;
+    outputs.back().minSyncRatio = minSyncRatio;
+}
+
+static void RunFreeDV700D(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    RunFreeDV(testCase, FREEDV_MODE_700D, "700d", FREEDV_MIN_SYNC_RATIO_700D, outputs, audioSeconds);
+}
+
+static void RunFreeDV700E(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    RunFreeDV(testCase, FREEDV_MODE_700E, "700e", FREEDV_MIN_SYNC_RATIO_700E, outputs, audioSeconds);
+}
+
+static void RunFreeDV1600(const Case& testCase, std::vector<Output>& outputs, double* audioSeconds)
+{
+    RunFreeDV(testCase, FREEDV_MODE_1600, "1600", FREEDV_MIN_SYNC_RATIO_1600, outputs, audioSeconds);
+}
+
+extern "C" void __real_kiss_fft(kiss_fft_cfg cfg, const kiss_fft_cpx* fin, kiss_fft_cpx* fout);
+extern "C" void __wrap_kiss_fft(kiss_fft_cfg cfg, const kiss_fft_cpx* fin, kiss_fft_cpx* fout);
+
+static bool IsFftCase(const Case& testCase)
+{
+    // Doesn't use the corpus; runs once.
+    return &testCase == &Cases_.front();
+}
+
+/// @brief Codec2's FFT hook (audio/Codec2Fft.c) against kiss_fft itself.
+static void RunFftHook(const Case&, std::vector<Output>& outputs, double* audioSeconds)
+{
+    uint32_t seed = 2;
+    for (int nfft = 16; nfft <= CODEC2_FFT_MAX_SIZE; nfft <<= 1)
+    {
+        for (int inverse = 0; inverse <= 1; inverse++)
+        {
+            kiss_fft_cfg cfg = kiss_fft_alloc(nfft, inverse, nullptr, nullptr);
+            assert(cfg != nullptr);
+
+            std::vector<kiss_fft_cpx> input(nfft);
+            for (auto& value : input)
+            {
+                value.r = (int32_t)NextRandom(seed) / 2147483648.0f;
+                value.i = (int32_t)NextRandom(seed) / 2147483648.0f;
+            }
+
+            std::vector<kiss_fft_cpx> expected(nfft);
+            std::vector<kiss_fft_cpx> actual(nfft);
+            __real_kiss_fft(cfg, input.data(), expected.data());
+            __wrap_kiss_fft(cfg, input.data(), actual.data());
+            kiss_fft_free(cfg);
+
+            Output output;
+            char name[64];
+            snprintf(name, sizeof(name), "kiss_fft_hook.%s%d", inverse ? "inverse" : "forward", nfft);
+            output.name = name;
+            output.wav = { SAMPLE_RATE_8K, 2, true, {} };
+            for (int index = 0; index < nfft; index++)
+            {
+                output.wav.samples.push_back(actual[index].r);
+                output.wav.samples.push_back(actual[index].i);
+                output.reference.push_back(expected[index].r);
+                output.reference.push_back(expected[index].i);
+            }
+            output.minSnrDb = SNR_FFT_HOOK_DB;
+            output.referenceMinSnrDb = SNR_FFT_HOOK_DB;
+            outputs.push_back(std::move(output));
+        }
+    }
+
+    *audioSeconds = 0;
+}
+#endif // EZDV_HOST_CODEC2
+
+static const Stage Stages_[] = 
+{
+    { "fdmdv_8_to_24", &Is8k, &RunUpsampler, false },
+    { "fdmdv_24_to_8", &Is24k, &RunDownsampler, false },
+    { "vita", &Is24k, &RunVita, false },
+#if EZDV_HOST_CODEC2
+    { "freedv_700d", &Is8k, &RunFreeDV700D, false },
+    { "freedv_700e", &Is8k, &RunFreeDV700E, false },
+    { "freedv_1600", &Is8k, &RunFreeDV1600, false },
+    { "kiss_fft_hook", &IsFftCase, &RunFftHook, false },
+#endif // EZDV_HOST_CODEC2
+    { "audio_mixer", &Is8k, &RunMixer, true },
+};
+
+// Checking and reporting
+// ==================================================================
+
+/// @brief Returns the SNR of actual against expected, with actual delayed
+///        by lag samples (only the overlap is compared).
+static double ComputeSnrDb(const std::vector<float>& expected, const std::vector<float>& actual, int lag)
+{
+    double signal = 0;
+    double noise = 0;
+    for (size_t index = std::max(0, -lag); index < expected.size() && index + lag < actual.size(); index++)
+    {
+        double difference = (double)expected[index] - actual[index + lag];
+        signal += (double)expected[index] * expected[index];
+        noise += difference * difference;
+    }
+
+    if (noise == 0)
+    {
+        // Equal but not bit for bit (e.g. -0 vs 0).
+        return INFINITY;
+    }
+    return 10 * log10((signal > 0 ? signal : 1e-30) / noise);
+}
+
+static bool Check(const char* against, const std::vector<float>& expected, const Output& output, double minSnrDb, int maxLag)
+{
+    if (!std::isnan(Options_.snrOverrideDb) && minSnrDb != BIT_EXACT)
+    {
+        minSnrDb = Options_.snrOverrideDb;
+    }
+
+    auto& actual = output.wav.samples;
+    bool sameLength = expected.size() == actual.size();
+    bool bitExact = sameLength && (expected.empty() || !memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)));
+
+    // Alternative implementations may have a different (fixed) delay.
+    int bestLag = 0;
+    double snr = bitExact ? INFINITY : ComputeSnrDb(expected, actual, 0);
+    for (int lag = -maxLag; !bitExact && lag <= maxLag; lag++)
+    {
+        double lagSnr = ComputeSnrDb(expected, actual, lag);
+        if (lagSnr > snr)
+        {
+            snr = lagSnr;
+            bestLag = lag;
+        }
+    }
+
+    bool pass = bitExact || (minSnrDb != BIT_EXACT && sameLength && snr >= minSnrDb);
+    char lagText[32] = "";
+    if (bestLag != 0)
+    {
+        snprintf(lagText, sizeof(lagText), " at lag %d", bestLag);
+    }
+
+    if (!sameLength)
+    {
+        printf("FAIL  %-44s vs %-9s length %zu, expected %zu\n", output.name.c_str(), against, actual.size(), expected.size());
+    }
+    else if (bitExact)
+    {
+        printf("PASS  %-44s vs %-9s bit exact\n", output.name.c_str(), against);
+    }
+    else if (minSnrDb == BIT_EXACT)
+    {
+        printf("FAIL  %-44s vs %-9s differs (SNR %.1f dB%s, must be bit exact)\n", output.name.c_str(), against, snr, lagText);
+    }
+    else
+    {
+        printf("%s  %-44s vs %-9s SNR %.1f dB%s (min %.1f)\n", pass ? "PASS" : "FAIL", output.name.c_str(), against, snr, lagText, minSnrDb);
+    }
+
+    return pass;
+}
+
+static int CheckOutputs()
+{
+    int numFailures = 0;
+    int numChecks = 0;
+
+    if (Options_.update && mkdir(Options_.goldenDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not create %s", Options_.goldenDir.c_str());
+        return 1;
+    }
+
+    for (auto& item : WorkItems_)
+    {
+        for (auto& output : item.outputs)
+        {
+            if (!output.reference.empty())
+            {
+                numChecks++;
+                numFailures += Check("reference", output.reference, output, output.referenceMinSnrDb, output.referenceMaxLag) ? 0 : 1;
+            }
+
+            // Doesn't need a golden file, so the modem is always checked.
+            if (!std::isnan(output.syncRatio))
+            {
+                bool pass = output.syncRatio > 0 && output.syncRatio >= output.minSyncRatio;
+                printf(
+                    "%s  %-44s vs %-9s in sync for %.0f%% of frames (min %.0f%%)\n", pass ? "PASS" : "FAIL", 
+                    output.name.c_str(), "sync", output.syncRatio * 100, output.minSyncRatio * 100);
+                numChecks++;
+                numFailures += pass ? 0 : 1;
+            }
+
+            if (Options_.goldenDir.empty())
+            {
+                continue;
+            }
+
+            std::string path = Options_.goldenDir + "/" + output.name + ".wav";
+            if (Options_.update)
+            {
+                if (!SaveWav(path, output.wav))
+                {
+                    numFailures++;
+                }
+                continue;
+            }
+
+            Wav golden;
+            numChecks++;
+            if (!LoadWav(path, golden))
+            {
+                printf("FAIL  %-44s no golden file (run with --update)\n", output.name.c_str());
+                numFailures++;
+                continue;
+            }
+            numFailures += Check("golden", golden.samples, output, output.minSnrDb, 0) ? 0 : 1;
+        }
+    }
+
+    // Keeps the summary after the results when both go to a terminal.
+    fflush(stdout);
+
+    if (Options_.update)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Golden files written to %s", Options_.goldenDir.c_str());
+    }
+    ESP_LOGI(CURRENT_LOG_TAG, "%d checks, %d failed", numChecks, numFailures);
+    return numFailures;
+}
+
+static void ReportThroughput()
+{
+    printf("\n%-16s %6s %12s %12s %12s\n", "stage", "cases", "audio (s)", "cpu (ms)", "x realtime");
+    for (auto& stage : Stages_)
+    {
+        int numCases = 0;
+        double audioSeconds = 0;
+        int64_t elapsedUs = 0;
+        for (auto& item : WorkItems_)
+        {
+            if (item.stage == &stage)
+            {
+                numCases++;
+                audioSeconds += item.audioSeconds;
+                elapsedUs += item.elapsedUs;
+            }
+        }
+
+        if (numCases == 0)
+        {
+            continue;
+        }
+
+        if (audioSeconds > 0 && elapsedUs > 0)
+        {
+            printf("%-16s %6d %12.2f %12.3f %12.1f\n", stage.name, numCases, audioSeconds, elapsedUs / 1000.0, audioSeconds * 1000000 / elapsedUs);
+        }
+        else
+        {
+            printf("%-16s %6d %12s %12.3f %12s\n", stage.name, numCases, "-", elapsedUs / 1000.0, "-");
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Parallel stages took %.3f ms on %d threads", ParallelElapsedUs_ / 1000.0, Options_.jobs);
+}
+
+// Running
+// ==================================================================
+
+static void RunItem(WorkItem& item)
+{
+    auto begin = std::chrono::steady_clock::now();
+    item.stage->run(*item.testCase, item.outputs, &item.audioSeconds);
+    item.elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/// @brief Runs everything that's plain C/C++ across all cores. This happens
+///        before the FreeRTOS scheduler starts so that its POSIX port (and
+///        its signals) aren't involved.
+static void RunParallelItems()
+{
+    std::atomic<size_t> nextItem(0);
+    auto worker = [&]() {
+        for (size_t index = nextItem++; index < WorkItems_.size(); index = nextItem++)
+        {
+            if (!WorkItems_[index].stage->needsScheduler)
+            {
+                RunItem(WorkItems_[index]);
+            }
+        }
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int index = 0; index < Options_.jobs; index++)
+    {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    ParallelElapsedUs_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void RegressionTaskEntry(void*)
+{
+    DVTask::Initialize();
+
+    for (auto& item : WorkItems_)
+    {
+        if (item.stage->needsScheduler)
+        {
+            RunItem(item);
+        }
+    }
+
+    int numFailures = CheckOutputs();
+    ReportThroughput();
+
+    exit(numFailures > 0 ? 1 : 0);
+}
+
+static bool ParseArguments(int argc, char** argv)
+{
+    for (int index = 1; index < argc; index++)
+    {
+        std::string argument = argv[index];
+        bool hasValue = index + 1 < argc;
+
+        if (argument == "--golden" && hasValue)
+        {
+            Options_.goldenDir = argv[++index];
+        }
+        else if (argument == "--update")
+        {
+            Options_.update = true;
+        }
+        else if (argument == "--jobs" && hasValue)
+        {
+            Options_.jobs = atoi(argv[++index]);
+        }
+        else if (argument == "--snr" && hasValue)
+        {
+            Options_.snrOverrideDb = atof(argv[++index]);
+        }
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            Options_.corpus.push_back(argument);
+        }
+    }
+
+    if (Options_.update && Options_.goldenDir.empty())
+    {
+        return false;
+    }
+    if (Options_.jobs <= 0)
+    {
+        Options_.jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return true;
+}
+
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    using namespace ezdv::host;
+
+    if (!ParseArguments(argc, argv))
+    {
+        fprintf(
+            stderr, 
+            "Usage: %s [--golden DIR [--update]] [--jobs N] [--snr DB] [corpus.wav|corpus-dir ...]\n"
+            "With no corpus, generated test signals are used.\n", 
+            argv[0]);
+        return 1;
+    }
+
+    // Starts the clock that esp_timer_get_time() and log timestamps use.
+    esp_timer_get_time();
+
+    if (!LoadCorpus())
+    {
+        return 1;
+    }
+
+#if EZDV_HOST_CODEC2
+    // Same as FreeDVTask: must happen before any FreeDV instance is opened.
+    codec2_fft_accel_init();
+#endif // EZDV_HOST_CODEC2
+
+    for (auto& testCase : Cases_)
+    {
+        for (auto& stage : Stages_)
+        {
+            if (stage.applies(testCase))
+            {
+                WorkItem item;
+                item.testCase = &testCase;
+                item.stage = &stage;
+                WorkItems_.push_back(std::move(item));
+            }
+        }
+    }
+    ESP_LOGI(CURRENT_LOG_TAG, "%zu cases, %zu work items", Cases_.size(), WorkItems_.size());
+
+    RunParallelItems();
+
+    // DVTask-based stages need the scheduler.
+    xTaskCreatePinnedToCore(&RegressionTaskEntry, "HostRegression", 16384, nullptr, 5, nullptr, 0);
+    vTaskStartScheduler();
+
+    return 1;
+}
@@ -0,0 +1,445 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "audio/AudioRingBuffer.h"
+#include "network/PacketCapture.h"
+#include "network/flex/SampleRateConverter.h"
+#include "network/flex/VitaJitterBuffer.h"
+#include "network/flex/vita.h"
+#include "network/icom/IcomAudioJitterBuffer.h"
+#include "network/icom/IcomPacket.h"
+#include "network/icom/IcomPacketPool.h"
+#include "network/icom/RadioPacketDefinitions.h"
+
+#define CURRENT_LOG_TAG ("HostReplay")
+
+// These follow FlexVitaTask and AudioState.
+#define FLEX_SAMPLE_RATE (24000)
+#define FLEX_BLOCK_SAMPLES (42)
+#define FLEX_READ_INTERVAL_US (5250 * 4)
+#define FREEDV_SAMPLE_RATE (8000)
+
+// FreeDVTask takes 20ms of audio at a time.
+#define CONSUMER_INTERVAL_US (20000)
+#define CONSUMER_SAMPLES (FREEDV_SAMPLE_RATE * CONSUMER_INTERVAL_US / 1000000)
+
+#define OUTPUT_FIFO_SAMPLES (FREEDV_SAMPLE_RATE)
+
+// Keeps running after the last packet so that buffered audio drains.
+#define DRAIN_TIME_US (500000)
+
+namespace ezdv
+{
+
+namespace host
+{
+
+using namespace ezdv::network;
+
+struct CapturedPacket
+{
+    int64_t timestampUs;
+    NetworkQos::StreamType stream;
+    std::vector<char> data;
+};
+
+static const char* ReplayPath_ = nullptr;
+
+static bool LoadCapture(const char* path, std::vector<CapturedPacket>& packets)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not open %s", path);
+        return false;
+    }
+
+    PacketCapture::PcapFileHeader fileHeader;
+    if (fread(&fileHeader, sizeof(fileHeader), 1, fp) != 1 ||
+        fileHeader.magic != PacketCapture::PCAP_MAGIC ||
+        fileHeader.linkType != PacketCapture::PCAP_LINKTYPE)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "%s is not an ezDV packet capture", path);
+        fclose(fp);
+        return false;
+    }
+
+    PacketCapture::PcapRecordHeader recordHeader;
+    while (fread(&recordHeader, sizeof(recordHeader), 1, fp) == 1)
+    {
+        PacketCapture::StreamHeader streamHeader;
+        if (recordHeader.capturedLength < sizeof(streamHeader) || 
+            recordHeader.capturedLength > PacketCapture::PCAP_SNAPLEN ||
+            fread(&streamHeader, sizeof(streamHeader), 1, fp) != 1)
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Capture is truncated or corrupt, stopping at %zu packets", packets.size());
+            break;
+        }
+
+        CapturedPacket packet;
+        packet.timestampUs = (int64_t)recordHeader.timestampSec * 1000000 + recordHeader.timestampUsec;
+        packet.stream = (NetworkQos::StreamType)streamHeader.stream;
+        packet.data.resize(recordHeader.capturedLength - sizeof(streamHeader));
+        if (packet.data.size() > 0 && fread(packet.data.data(), packet.data.size(), 1, fp) != 1)
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Capture is truncated, stopping at %zu packets", packets.size());
+            break;
+        }
+
+        packets.push_back(std::move(packet));
+    }
+
+    fclose(fp);
+
+    // Packets from different tasks can be recorded slightly out of order.
+    std::stable_sort(packets.begin(), packets.end(), [](const CapturedPacket& a, const CapturedPacket& b) {
+        return a.timestampUs < b.timestampUs;
+    });
+    return true;
+}
+
+/// @brief Feeds Flex RX audio through the same conversion and jitter buffer 
+///        as FlexVitaTask, on the capture's clock instead of the real one.
+class FlexReplay
+{
+public:
+    FlexReplay()
+        : output_(OUTPUT_FIFO_SAMPLES)
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+        , jitterBuffer_(FREEDV_SAMPLE_RATE, CONFIG_EZDV_FLEX_JITTER_BUFFER_MAX_MS)
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+        , streamId_(0)
+        , inputCtr_(0)
+        , numPackets_(0)
+        , numAudioPackets_(0)
+    {
+        memset(downsamplerInBuf_, 0, sizeof(downsamplerInBuf_));
+    }
+
+    audio::AudioRingBuffer* getOutput() { return &output_; }
+
+    void packetReceived(CapturedPacket& captured)
+    {
+        numPackets_++;
+
+        // Same checks as FlexVitaTask::processVitaPacket_().
+        vita_packet packet;
+        int length = std::min(captured.data.size(), sizeof(packet));
+        memcpy(&packet, captured.data.data(), length);
+        if (length < (int)VITA_PACKET_HEADER_SIZE ||
+            (packet.class_id & VITA_OUI_MASK) != FLEX_OUI ||
+            (packet.stream_id & STREAM_BITS_MASK) != (STREAM_BITS_WAVEFORM | STREAM_BITS_IN) ||
+            (htonl(packet.stream_id) & 0x0001u))
+        {
+            // Discovery, TX audio and so on.
+            return;
+        }
+
+        // Only the first slice heard is decoded.
+        if (streamId_ == 0)
+        {
+            streamId_ = packet.stream_id;
+        }
+        else if (packet.stream_id != streamId_)
+        {
+            return;
+        }
+
+        numAudioPackets_++;
+
+        unsigned long payloadLength = ntohs(packet.length) * sizeof(uint32_t) - VITA_PACKET_HEADER_SIZE;
+        payloadLength = std::min(payloadLength, (unsigned long)(length - VITA_PACKET_HEADER_SIZE));
+        unsigned int numSamples = (payloadLength >> 2) >> 1;
+
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+        if (!jitterBuffer_.packetReceived(
+            packet.timestamp_type & 0x0F, numSamples * 1000000 / FLEX_SAMPLE_RATE, captured.timestampUs))
+        {
+            return;
+        }
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+
+        unsigned int i = 0;
+        while (i < numSamples)
+        {
+            unsigned int count = std::min(numSamples - i, (unsigned int)(FLEX_BLOCK_SAMPLES * FDMDV_OS_24 - inputCtr_));
+            fdmdv_vita_to_short(&downsamplerInBuf_[FDMDV_OS_TAPS_24K + inputCtr_], &packet.if_samples[i << 1], count);
+            inputCtr_ += count;
+            i += count;
+
+            if (inputCtr_ == FLEX_BLOCK_SAMPLES * FDMDV_OS_24)
+            {
+                inputCtr_ = 0;
+                fdmdv_24_to_8(downsamplerOutBuf_, &downsamplerInBuf_[FDMDV_OS_TAPS_24K], FLEX_BLOCK_SAMPLES);
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+                jitterBuffer_.write(downsamplerOutBuf_, FLEX_BLOCK_SAMPLES);
+#else
+                output_.write(downsamplerOutBuf_, FLEX_BLOCK_SAMPLES);
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+            }
+        }
+    }
+
+    /// @brief FlexVitaTask's read timer.
+    void readTimer(int64_t nowUs)
+    {
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+        jitterBuffer_.playout(&output_, nowUs);
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+    }
+
+    void report()
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Flex: %" PRIu32 " packets, %" PRIu32 " RX audio packets", numPackets_, numAudioPackets_);
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+        network::flex::VitaJitterBuffer::Statistics stats;
+        jitterBuffer_.getStatistics(stats);
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "Flex jitter buffer: %" PRIu32 " lost, %" PRIu32 " late, %" PRIu32 " underruns, %" PRIu32 " samples concealed, %" PRIu32 " dropped",
+            stats.numLostPackets, stats.numLatePackets, stats.numUnderruns, stats.numConcealedSamples, stats.numDroppedSamples);
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "Flex jitter buffer: jitter %" PRIu32 " us, target %" PRIu32 " ms, depth %" PRIu32 "/%" PRIu32 "/%" PRIu32 " ms (min/avg/max)",
+            stats.jitterUs, stats.targetDepthMs, stats.minDepthMs, stats.avgDepthMs, stats.maxDepthMs);
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        ESP_LOGI(CURRENT_LOG_TAG, "Flex drift correction: %" PRId32 " ppm", jitterBuffer_.getDriftCorrectionPpm());
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+    }
+
+private:
+    audio::AudioRingBuffer output_;
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+    network::flex::VitaJitterBuffer jitterBuffer_;
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+    uint32_t streamId_;
+    int inputCtr_;
+    short downsamplerInBuf_[FLEX_BLOCK_SAMPLES * FDMDV_OS_24 + FDMDV_OS_TAPS_24K];
+    short downsamplerOutBuf_[FLEX_BLOCK_SAMPLES];
+    uint32_t numPackets_;
+    uint32_t numAudioPackets_;
+};
+
+/// @brief Feeds Icom RX audio through AudioState's jitter buffer.
+class IcomReplay
+{
+public:
+    IcomReplay()
+        : output_(OUTPUT_FIFO_SAMPLES)
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+        , jitterBuffer_(CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER_MS / AUDIO_PERIOD)
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+        , numPackets_(0)
+        , numAudioPackets_(0)
+    {
+        // empty
+    }
+
+    audio::AudioRingBuffer* getOutput() { return &output_; }
+
+    void packetReceived(CapturedPacket& captured)
+    {
+        numPackets_++;
+
+        network::icom::IcomPacket packet(captured.data.data(), captured.data.size());
+        uint16_t audioSeq;
+        short* audioData;
+        if (!packet.isAudioPacket(audioSeq, &audioData))
+        {
+            return;
+        }
+
+        numAudioPackets_++;
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+        jitterBuffer_.packetReceived(packet, audioSeq, &output_);
+#else
+        output_.write(audioData, (packet.getSendLength() - 0x18) / sizeof(short));
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    }
+
+    void report()
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Icom audio: %" PRIu32 " packets, %" PRIu32 " RX audio packets", numPackets_, numAudioPackets_);
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+        network::icom::IcomAudioJitterBuffer::Statistics stats;
+        jitterBuffer_.getStatistics(stats);
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "Icom jitter buffer: %" PRIu32 " reordered, %" PRIu32 " late, %" PRIu32 " duplicates, %" PRIu32 " concealed, %" PRIu32 " resets",
+            stats.numReorderedPackets, stats.numLatePackets, stats.numDuplicatePackets, stats.numConcealedPackets, stats.numResets);
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    }
+
+private:
+    audio::AudioRingBuffer output_;
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    network::icom::IcomAudioJitterBuffer jitterBuffer_;
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    uint32_t numPackets_;
+    uint32_t numAudioPackets_;
+};
+
+/// @brief Takes 20ms of audio from the FIFO like FreeDVTask would, counting 
+///        the times there isn't enough.
+static void ConsumeAudio(audio::AudioRingBuffer* fifo)
+{
+    short samples[CONSUMER_SAMPLES];
+    uint32_t available = fifo->numUsed();
+    if (fifo->read(samples, CONSUMER_SAMPLES) < 0)
+    {
+        fifo->reportUnderrun(CONSUMER_SAMPLES - available);
+        fifo->read(samples, available);
+    }
+}
+
+static void ReportFifo(const char* name, audio::AudioRingBuffer* fifo)
+{
+    audio::AudioRingBuffer::Statistics stats;
+    fifo->getStatistics(stats);
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "%s output: %" PRIu32 "/%" PRIu32 "/%" PRIu32 " samples queued (min/avg/max), %" PRIu32 " underruns, %" PRIu32 " overruns",
+        name, stats.minUsed, stats.averageUsed, stats.maxUsed, stats.numUnderruns, stats.numOverruns);
+}
+
+static void ReplayTaskEntry(void*)
+{
+    network::icom::IcomPacketPool::Initialize();
+
+    std::vector<CapturedPacket> packets;
+    if (!LoadCapture(ReplayPath_, packets))
+    {
+        exit(1);
+    }
+    if (packets.empty())
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Capture is empty");
+        exit(1);
+    }
+
+    FlexReplay flex;
+    IcomReplay icom;
+    bool hasFlex = false;
+    bool hasIcom = false;
+
+    // Everything runs on the capture's clock, so the results are the same
+    // on every run regardless of how fast this machine is.
+    int64_t startUs = packets.front().timestampUs;
+    int64_t endUs = packets.back().timestampUs + DRAIN_TIME_US;
+    int64_t nextReadUs = startUs + FLEX_READ_INTERVAL_US;
+    int64_t nextConsumeUs = startUs + CONSUMER_INTERVAL_US;
+    auto runTimersUntil = [&](int64_t nowUs) {
+        while (std::min(nextReadUs, nextConsumeUs) <= nowUs)
+        {
+            if (nextReadUs <= nextConsumeUs)
+            {
+                flex.readTimer(nextReadUs);
+                nextReadUs += FLEX_READ_INTERVAL_US;
+            }
+            else
+            {
+                if (hasFlex)
+                {
+                    ConsumeAudio(flex.getOutput());
+                }
+                if (hasIcom)
+                {
+                    ConsumeAudio(icom.getOutput());
+                }
+                nextConsumeUs += CONSUMER_INTERVAL_US;
+            }
+        }
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    for (auto& packet : packets)
+    {
+        runTimersUntil(packet.timestampUs);
+
+        switch (packet.stream)
+        {
+            case NetworkQos::FLEX_VITA:
+                hasFlex = true;
+                flex.packetReceived(packet);
+                break;
+            case NetworkQos::ICOM_AUDIO:
+                hasIcom = true;
+                icom.packetReceived(packet);
+                break;
+            default:
+                // Control and CI-V traffic needs the state machines, which 
+                // don't run on the host.
+                break;
+        }
+    }
+    runTimersUntil(endUs);
+    auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "Replayed %zu packets (%.3f s of traffic) in %.3f ms, %.3f us/packet",
+        packets.size(), (double)(endUs - DRAIN_TIME_US - startUs) / 1000000, (double)elapsedUs / 1000, (double)elapsedUs / packets.size());
+
+    if (hasFlex)
+    {
+        flex.report();
+        ReportFifo("Flex", flex.getOutput());
+    }
+    if (hasIcom)
+    {
+        icom.report();
+        ReportFifo("Icom", icom.getOutput());
+    }
+
+    exit(0);
+}
+
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s capture.pcap\n", argv[0]);
+        return 1;
+    }
+    ezdv::host::ReplayPath_ = argv[1];
+
+    // Starts the clock that esp_timer_get_time() and log timestamps use.
+    esp_timer_get_time();
+
+    xTaskCreatePinnedToCore(&ezdv::host::ReplayTaskEntry, "HostReplay", 16384, nullptr, 5, nullptr, 0);
+    vTaskStartScheduler();
+
+    return 1;
+}
@@ -0,0 +1,435 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "audio/AudioRingBuffer.h"
+#include "network/WebSocketSendQueue.h"
+#include "network/flex/SampleRateConverter.h"
+#include "task/DVMessagePool.h"
+#include "task/DVTask.h"
+#include "task/DVTaskMessage.h"
+
+#define CURRENT_LOG_TAG ("HostTests")
+
+// 20 ms of audio at 8 kHz, as FlexVitaTask converts it.
+#define TEST_SAMPLES_8K (160)
+#define TEST_FRAMES (10)
+
+// Fails the current test (but keeps running the rest) if the condition is false.
+#define TEST_CHECK(condition) \
+    do { \
+        if (!(condition)) \
+        { \
+            ESP_LOGE(CURRENT_LOG_TAG, "%s:%d: check failed: %s", __FILE__, __LINE__, #condition); \
+            return false; \
+        } \
+    } while (0)
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(HOST_TESTS_MESSAGE);
+    DV_EVENT_DEFINE_BASE(HOST_TESTS_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace host
+{
+
+using namespace ezdv::task;
+
+enum HostTestsMessageTypes
+{
+    FAN_OUT = 1,
+};
+
+class FanOutMessage : public DVTaskMessageBase<FAN_OUT, FanOutMessage>
+{
+public:
+    FanOutMessage()
+        : DVTaskMessageBase<FAN_OUT, FanOutMessage>(HOST_TESTS_MESSAGE)
+        {}
+    virtual ~FanOutMessage() = default;
+};
+
+static std::atomic<int> NumFanOutDropped_(0);
+
+/// @brief Subscribes to FanOutMessage and cleans up any that are dropped.
+class SubscriberTask : public DVTask
+{
+public:
+    SubscriberTask(const char* name)
+        : DVTask(name, 10, 4096, tskNO_AFFINITY, 16)
+    {
+        registerMessageHandler(this, &SubscriberTask::onFanOutMessage_);
+        setMessageOverflowPolicy<FanOutMessage>(OVERFLOW_BLOCK, &OnFanOutDropped_);
+    }
+    virtual ~SubscriberTask() = default;
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    void onFanOutMessage_(DVTask*, FanOutMessage*) { }
+
+    static void OnFanOutDropped_(DVTaskMessage*)
+    {
+        NumFanOutDropped_++;
+    }
+};
+
+struct Test
+{
+    const char* name;
+    bool (*fn)();
+};
+
+static void FillRamp(short* samples, int numSamples, short first)
+{
+    for (int index = 0; index < numSamples; index++)
+    {
+        samples[index] = first + index;
+    }
+}
+
+static bool TestRingBufferFlushThenRead()
+{
+    audio::AudioRingBuffer ringBuffer(64);
+    short samples[48];
+    short output[48];
+
+    // Everything written before the flush is discarded; the new producer's
+    // samples come through untouched.
+    FillRamp(samples, 40, 0);
+    TEST_CHECK(ringBuffer.write(samples, 40) == 0);
+    ringBuffer.requestFlush();
+    FillRamp(samples, 16, 1000);
+    TEST_CHECK(ringBuffer.write(samples, 16) == 0);
+
+    TEST_CHECK(ringBuffer.read(output, 8) == 0);
+    TEST_CHECK(output[0] == 1000 && output[7] == 1007);
+    TEST_CHECK(ringBuffer.read(output, 8) == 0);
+    TEST_CHECK(output[0] == 1008 && output[7] == 1015);
+    TEST_CHECK(ringBuffer.numUsed() == 0);
+    TEST_CHECK(ringBuffer.read(output, 1) == -1);
+    return true;
+}
+
+static bool TestRingBufferFlushRace()
+{
+    // The producer and the task requesting the flush are usually different, 
+    // so the consumer can read past the index requestFlush() snapshots 
+    // before it sees the request. Reads must still only ever move forward.
+    // Floats hold the sample count exactly for far longer than this runs.
+    audio::AudioFloatRingBuffer ringBuffer(64);
+    std::atomic<bool> done(false);
+
+    std::thread producer([&]() {
+        float samples[8];
+        float next = 0;
+        while (!done.load(std::memory_order_relaxed))
+        {
+            for (int index = 0; index < 8; index++)
+            {
+                samples[index] = next + index;
+            }
+            if (ringBuffer.write(samples, 8) == 0)
+            {
+                next += 8;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread flusher([&]() {
+        for (int numFlushes = 0; numFlushes < 2000; numFlushes++)
+        {
+            ringBuffer.requestFlush();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        done.store(true, std::memory_order_relaxed);
+    });
+
+    bool inOrder = true;
+    float last = -1;
+    float output[8];
+    while (!done.load(std::memory_order_relaxed) && inOrder)
+    {
+        if (ringBuffer.read(output, 8) != 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (int index = 0; index < 8 && inOrder; index++)
+        {
+            // Flushes may skip samples, but nothing is ever read twice.
+            inOrder = output[index] > last;
+            last = output[index];
+        }
+    }
+
+    done.store(true);
+    producer.join();
+    flusher.join();
+    TEST_CHECK(inOrder);
+    return true;
+}
+
+static bool TestFloatFirMatchesScalarFir()
+{
+    // esp-dsp documents its FIRs as coeffs[0] * the oldest sample in the 
+    // delay line through coeffs[N - 1] * the newest. The taps aren't 
+    // symmetric so running them the other way around fails.
+    const int numTaps = 7;
+    const int decim = 3;
+    float coeffs[numTaps] = { 1, -2, 3, -4, 5, -6, 7 };
+    float delay[numTaps];
+    float input[decim * 32];
+    float output[32];
+    for (int index = 0; index < decim * 32; index++)
+    {
+        input[index] = (float)((index * 37) % 19 - 9);
+    }
+
+    fir_f32_t fir;
+    TEST_CHECK(dsps_fird_init_f32(&fir, coeffs, delay, numTaps, decim) == ESP_OK);
+    TEST_CHECK(dsps_fird_f32(&fir, input, output, 32) == 32);
+
+    for (int index = 0; index < 32; index++)
+    {
+        int newest = index * decim + decim - 1;
+        float expected = 0;
+        for (int tap = 0; tap < numTaps; tap++)
+        {
+            int sample = newest - (numTaps - 1) + tap;
+            expected += (sample >= 0) ? coeffs[tap] * input[sample] : 0;
+        }
+        TEST_CHECK(output[index] == expected);
+    }
+    return true;
+}
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+static bool TestFloatUpsamplerMatchesReference()
+{
+    // Two tones well inside the passband.
+    std::vector<short> input(TEST_SAMPLES_8K * TEST_FRAMES);
+    for (size_t index = 0; index < input.size(); index++)
+    {
+        input[index] = (short)(8000 * sinf(2 * M_PI * 500 * index / 8000) + 6000 * sinf(2 * M_PI * 1300 * index / 8000));
+    }
+
+    // The int16 version reads its filter memory from in front of the input.
+    std::vector<float> reference(input.size() * FDMDV_OS_24);
+    std::vector<short> frame(FDMDV_OS_TAPS_24_8K + TEST_SAMPLES_8K);
+    for (size_t offset = 0; offset < input.size(); offset += TEST_SAMPLES_8K)
+    {
+        memmove(&frame[0], &frame[TEST_SAMPLES_8K], FDMDV_OS_TAPS_24_8K * sizeof(short));
+        memcpy(&frame[FDMDV_OS_TAPS_24_8K], &input[offset], TEST_SAMPLES_8K * sizeof(short));
+        fdmdv_8_to_24_with_scaling(&reference[offset * FDMDV_OS_24], &frame[FDMDV_OS_TAPS_24_8K], TEST_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+    }
+
+    std::vector<float> floatInput(input.begin(), input.end());
+    std::vector<float> output(input.size() * FDMDV_OS_24);
+    fdmdv_8_to_24_float_state_t* state = fdmdv_8_to_24_float_create(TEST_SAMPLES_8K);
+    for (size_t offset = 0; offset < input.size(); offset += TEST_SAMPLES_8K)
+    {
+        fdmdv_8_to_24_float(state, &output[offset * FDMDV_OS_24], &floatInput[offset], TEST_SAMPLES_8K, FDMDV_SHORT_TO_FLOAT);
+    }
+    fdmdv_8_to_24_float_destroy(state);
+
+    // The two differ by a fixed delay (the float version has no look-behind
+    // buffer, so it's ahead) and the int16 version's rounding. Samples out
+    // of order within each group of phases show up as noise.
+    double bestSnrDb = -INFINITY;
+    for (int lag = -FDMDV_OS_TAPS_24K; lag <= FDMDV_OS_TAPS_24K; lag++)
+    {
+        double signal = 0;
+        double noise = 0;
+        for (size_t index = FDMDV_OS_TAPS_24K * 2; index < output.size() - FDMDV_OS_TAPS_24K; index++)
+        {
+            double error = output[index] - reference[index - lag];
+            signal += (double)reference[index - lag] * reference[index - lag];
+            noise += error * error;
+        }
+        bestSnrDb = std::max(bestSnrDb, 10 * log10(signal / std::max(noise, 1e-20)));
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "fdmdv_8_to_24_float vs fdmdv_8_to_24: %.1f dB", bestSnrDb);
+    TEST_CHECK(bestSnrDb >= 50);
+    return true;
+}
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+static bool TestPublishPoolExhausted()
+{
+    // Neither task is started, so anything that does get allocated is 
+    // dropped once queued.
+    SubscriberTask first("Subscriber1");
+    SubscriberTask second("Subscriber2");
+    NumFanOutDropped_ = 0;
+
+    // Use up every block in the pool and keep the heap from standing in.
+    std::vector<void*> blocks;
+    heap_caps_host_fail_allocations(1);
+    for (void* block = DVMessagePool::Allocate(1); block != nullptr; block = DVMessagePool::Allocate(1))
+    {
+        blocks.push_back(block);
+    }
+
+    // Both subscribers lose the message, but it's only cleaned up once.
+    FanOutMessage message;
+    first.publish(&message);
+    int numDroppedUnallocated = NumFanOutDropped_;
+
+    heap_caps_host_fail_allocations(0);
+    for (void* block : blocks)
+    {
+        DVMessagePool::Free(block);
+    }
+
+    // Same as when the shared entry is dropped by every subscriber.
+    first.publish(&message);
+    int numDroppedQueued = NumFanOutDropped_ - numDroppedUnallocated;
+
+    TEST_CHECK(!blocks.empty());
+    TEST_CHECK(numDroppedUnallocated == 1);
+    TEST_CHECK(numDroppedQueued == 1);
+    return true;
+}
+
+struct SentFrame
+{
+    int fd;
+    uint8_t firstByte;
+};
+
+static std::vector<SentFrame> SentFrames_;
+
+static void OnFrameSent(esp_err_t, int, void*)
+{
+    // Completions are fed to the queue by hand below.
+}
+
+static bool TestWebSocketLostCompletion()
+{
+    network::WebSocketSendQueue queue(&OnFrameSent, nullptr);
+    queue.setServer((httpd_handle_t)&queue);
+    SentFrames_.clear();
+
+    const uint8_t frameA = 'A';
+    const uint8_t frameB = 'B';
+    const uint8_t frameC = 'C';
+    TEST_CHECK(queue.enqueue(5, HTTPD_WS_TYPE_TEXT, &frameA, 1));
+    TEST_CHECK(queue.enqueue(5, HTTPD_WS_TYPE_TEXT, &frameB, 1));
+    TEST_CHECK(SentFrames_.size() == 1);
+
+    // As if HttpServerTask's queue was full when A finished sending. B
+    // goes out as soon as the queue is next used, even for another client.
+    queue.onSendCompleteLost(5, ESP_OK);
+    TEST_CHECK(SentFrames_.size() == 1);
+    TEST_CHECK(queue.enqueue(7, HTTPD_WS_TYPE_TEXT, &frameC, 1));
+    TEST_CHECK(SentFrames_.size() == 3);
+    TEST_CHECK(SentFrames_[1].fd == 5 && SentFrames_[1].firstByte == 'B');
+    TEST_CHECK(SentFrames_[2].fd == 7 && SentFrames_[2].firstByte == 'C');
+
+    // Handled once only.
+    TEST_CHECK(queue.onSendComplete(5, ESP_OK));
+    TEST_CHECK(queue.onSendComplete(7, ESP_OK));
+    TEST_CHECK(queue.onSendComplete(5, ESP_OK));
+    TEST_CHECK(SentFrames_.size() == 3);
+
+    // The client's queue still works normally afterwards.
+    TEST_CHECK(queue.enqueue(5, HTTPD_WS_TYPE_TEXT, &frameA, 1));
+    TEST_CHECK(SentFrames_.size() == 4);
+    queue.clear();
+    return true;
+}
+
+static const Test Tests_[] =
+{
+    { "AudioRingBuffer flush then read", &TestRingBufferFlushThenRead },
+    { "AudioRingBuffer flush racing reads", &TestRingBufferFlushRace },
+    { "WebSocketSendQueue lost completion", &TestWebSocketLostCompletion },
+    { "DVTask publish with pool exhausted", &TestPublishPoolExhausted },
+    { "dsps_fird_f32 vs scalar FIR", &TestFloatFirMatchesScalarFir },
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    { "fdmdv_8_to_24_float vs reference", &TestFloatUpsamplerMatchesReference },
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+};
+
+static void TestTaskEntry(void*)
+{
+    DVTask::Initialize();
+
+    int numFailed = 0;
+    for (auto& test : Tests_)
+    {
+        bool passed = (*test.fn)();
+        ESP_LOGI(CURRENT_LOG_TAG, "%-44s %s", test.name, passed ? "ok" : "FAILED");
+        if (!passed)
+        {
+            numFailed++;
+        }
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "%d of %d tests failed", numFailed, (int)(sizeof(Tests_) / sizeof(Tests_[0])));
+    exit(numFailed > 0 ? 1 : 0);
+}
+
+}
+
+}
+
+// Stands in for the HTTP server; frames are "sent" by recording them.
+esp_err_t httpd_ws_send_data_async(httpd_handle_t, int socket, httpd_ws_frame_t* frame, transfer_complete_cb, void*)
+{
+    ezdv::host::SentFrames_.push_back({ socket, frame->len > 0 ? frame->payload[0] : (uint8_t)0 });
+    return ESP_OK;
+}
+
+int main()
+{
+    // Starts the clock that esp_timer_get_time() and log timestamps use.
+    esp_timer_get_time();
+
+    xTaskCreatePinnedToCore(&ezdv::host::TestTaskEntry, "HostTests", 16384, nullptr, 5, nullptr, 0);
+    vTaskStartScheduler();
+
+    return 1;
+}
@@ -0,0 +1,243 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_dsp.h"
+
+static int16_t saturate_s16(int64_t value)
+{
+    if (value > INT16_MAX) return INT16_MAX;
+    if (value < INT16_MIN) return INT16_MIN;
+    return (int16_t)value;
+}
+
+esp_err_t dsps_fird_init_s16(fir_s16_t* fir, int16_t* coeffs, int16_t* delay, int16_t coeffs_len, int16_t decim, int16_t start_pos, int16_t shift)
+{
+    if (fir == NULL || coeffs == NULL || delay == NULL || coeffs_len <= 0 || decim <= 0 || start_pos < 0 || start_pos >= decim)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(fir, 0, sizeof(fir_s16_t));
+    fir->coeffs = coeffs;
+    fir->delay = delay;
+    fir->coeffs_len = coeffs_len;
+    fir->pos = 0;
+    fir->decim = decim;
+    fir->d_pos = start_pos;
+    fir->shift = shift;
+
+    memset(fir->delay, 0, coeffs_len * sizeof(int16_t));
+    return ESP_OK;
+}
+
+int32_t dsps_fird_s16(fir_s16_t* fir, const int16_t* input, int16_t* output, int32_t len)
+{
+    const int finalShift = 15 - fir->shift;
+    int32_t inputPos = 0;
+
+    for (int32_t i = 0; i < len; i++)
+    {
+        for (int j = 0; j < fir->decim; j++)
+        {
+            fir->delay[fir->pos++] = input[inputPos++];
+            if (fir->pos >= fir->coeffs_len)
+            {
+                fir->pos = 0;
+            }
+        }
+
+        /* delay[pos] is now the oldest sample, which gets the first
+           coefficient. */
+        int64_t acc = (finalShift > 0) ? ((int64_t)1 << (finalShift - 1)) : 0;
+        int coeffPos = 0;
+        for (int n = fir->pos; n < fir->coeffs_len; n++)
+        {
+            acc += (int32_t)fir->coeffs[coeffPos++] * fir->delay[n];
+        }
+        for (int n = 0; n < fir->pos; n++)
+        {
+            acc += (int32_t)fir->coeffs[coeffPos++] * fir->delay[n];
+        }
+
+        output[i] = saturate_s16((finalShift >= 0) ? (acc >> finalShift) : (acc << -finalShift));
+    }
+
+    return len;
+}
+
+esp_err_t dsps_fird_s16_aexx_free(fir_s16_t* fir)
+{
+    /* Nothing is allocated on the host. */
+    (void)fir;
+    return ESP_OK;
+}
+
+esp_err_t dsps_fir_init_f32(fir_f32_t* fir, float* coeffs, float* delay, int coeffs_len)
+{
+    return dsps_fird_init_f32(fir, coeffs, delay, coeffs_len, 1);
+}
+
+esp_err_t dsps_fir_f32(fir_f32_t* fir, const float* input, float* output, int len)
+{
+    dsps_fird_f32(fir, input, output, len);
+    return ESP_OK;
+}
+
+esp_err_t dsps_fird_init_f32(fir_f32_t* fir, float* coeffs, float* delay, int N, int decim)
+{
+    if (fir == NULL || coeffs == NULL || delay == NULL || N <= 0 || decim <= 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(fir, 0, sizeof(fir_f32_t));
+    fir->coeffs = coeffs;
+    fir->delay = delay;
+    fir->N = N;
+    fir->decim = decim;
+
+    memset(fir->delay, 0, N * sizeof(float));
+    return ESP_OK;
+}
+
+int dsps_fird_f32(fir_f32_t* fir, const float* input, float* output, int len)
+{
+    int inputPos = 0;
+
+    for (int i = 0; i < len; i++)
+    {
+        for (int j = 0; j < fir->decim; j++)
+        {
+            fir->delay[fir->pos++] = input[inputPos++];
+            if (fir->pos >= fir->N)
+            {
+                fir->pos = 0;
+            }
+        }
+
+        /* Same order as the S16 filters (and esp-dsp's ANSI version): 
+           delay[pos] is the oldest sample and gets the first coefficient. */
+        float acc = 0;
+        int coeffPos = 0;
+        for (int n = fir->pos; n < fir->N; n++)
+        {
+            acc += fir->coeffs[coeffPos++] * fir->delay[n];
+        }
+        for (int n = 0; n < fir->pos; n++)
+        {
+            acc += fir->coeffs[coeffPos++] * fir->delay[n];
+        }
+
+        output[i] = acc;
+    }
+
+    return len;
+}
+
+esp_err_t dsps_mulc_s16(const int16_t* input, int16_t* output, int len, int16_t C, int step_in, int step_out)
+{
+    if (input == NULL || output == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        output[i * step_out] = (int16_t)(((int32_t)input[i * step_in] * C) >> 15);
+    }
+
+    return ESP_OK;
+}
+
+static int is_power_of_two(int N)
+{
+    return N > 0 && (N & (N - 1)) == 0;
+}
+
+esp_err_t dsps_fft2r_init_fc32(float* fft_table_buff, int table_size)
+{
+    (void)fft_table_buff;
+    return is_power_of_two(table_size) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t dsps_fft2r_fc32(float* data, int N)
+{
+    if (data == NULL || !is_power_of_two(N))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Decimation in frequency: natural order in, bit-reversed order out. */
+    for (int len = N; len >= 2; len >>= 1)
+    {
+        int half = len >> 1;
+        for (int k = 0; k < half; k++)
+        {
+            double angle = -2.0 * M_PI * k / len;
+            float wRe = (float)cos(angle);
+            float wIm = (float)sin(angle);
+
+            for (int start = 0; start < N; start += len)
+            {
+                float* a = &data[2 * (start + k)];
+                float* b = &data[2 * (start + k + half)];
+                float diffRe = a[0] - b[0];
+                float diffIm = a[1] - b[1];
+                a[0] += b[0];
+                a[1] += b[1];
+                b[0] = diffRe * wRe - diffIm * wIm;
+                b[1] = diffRe * wIm + diffIm * wRe;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t dsps_bit_rev_fc32(float* data, int N)
+{
+    if (data == NULL || !is_power_of_two(N))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 1, j = 0; i < N; i++)
+    {
+        int bit = N >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+
+        if (i < j)
+        {
+            float re = data[2 * i];
+            float im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
+
+    return ESP_OK;
+}
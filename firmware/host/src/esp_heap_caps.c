@@ -0,0 +1,100 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+static atomic_int FailAllocations_ = 0;
+
+void* heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    if (atomic_load(&FailAllocations_))
+    {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void)caps;
+    if (atomic_load(&FailAllocations_))
+    {
+        return NULL;
+    }
+    return calloc(n, size);
+}
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return realloc(ptr, size);
+}
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    void* ptr = NULL;
+    (void)caps;
+
+    if (alignment < sizeof(void*))
+    {
+        alignment = sizeof(void*);
+    }
+
+    /* posix_memalign() memory can be released with free(), which keeps
+       heap_caps_free() the same for everything. */
+    if (posix_memalign(&ptr, alignment, size) != 0)
+    {
+        return NULL;
+    }
+    return ptr;
+}
+
+void* heap_caps_aligned_calloc(size_t alignment, size_t n, size_t size, uint32_t caps)
+{
+    if (size != 0 && n > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    void* ptr = heap_caps_aligned_alloc(alignment, n * size, caps);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void heap_caps_free(void* ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_allocated_size(void* ptr)
+{
+    return malloc_usable_size(ptr);
+}
+
+void heap_caps_host_fail_allocations(int fail)
+{
+    atomic_store(&FailAllocations_, fail);
+}
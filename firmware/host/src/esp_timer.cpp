@@ -0,0 +1,262 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <ctime>
+#include <new>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Runs above every ezDV task, like esp_timer's own task does on the device.
+#define ESP_TIMER_TASK_PRIORITY (configMAX_PRIORITIES - 3)
+#define ESP_TIMER_TASK_STACK_SIZE (8192)
+
+static int64_t MonotonicTimeUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+struct esp_timer
+{
+    esp_timer_create_args_t args;
+    bool armed;
+    int64_t deadlineUs;
+    uint64_t periodUs; // 0 for one-shot timers
+    esp_timer* next;
+};
+
+namespace
+{
+
+esp_timer* TimerList = nullptr;
+TaskHandle_t TimerTask = nullptr;
+portMUX_TYPE TimerLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Returns the armed timer that's due soonest, or nullptr. Must hold TimerLock.
+esp_timer* NextTimer()
+{
+    esp_timer* next = nullptr;
+    for (esp_timer* timer = TimerList; timer != nullptr; timer = timer->next)
+    {
+        if (timer->armed && (next == nullptr || timer->deadlineUs < next->deadlineUs))
+        {
+            next = timer;
+        }
+    }
+    return next;
+}
+
+void TimerTaskEntry(void*)
+{
+    for (;;)
+    {
+        esp_timer_cb_t callback = nullptr;
+        void* arg = nullptr;
+        TickType_t waitTicks = portMAX_DELAY;
+
+        portENTER_CRITICAL(&TimerLock);
+        esp_timer* timer = NextTimer();
+        if (timer != nullptr)
+        {
+            int64_t now = esp_timer_get_time();
+            if (timer->deadlineUs <= now)
+            {
+                callback = timer->args.callback;
+                arg = timer->args.arg;
+
+                if (timer->periodUs == 0)
+                {
+                    timer->armed = false;
+                }
+                else
+                {
+                    timer->deadlineUs += timer->periodUs;
+                    if (timer->args.skip_unhandled_events && timer->deadlineUs <= now)
+                    {
+                        timer->deadlineUs = now + timer->periodUs;
+                    }
+                }
+                waitTicks = 0;
+            }
+            else
+            {
+                int64_t waitMs = (timer->deadlineUs - now + 999) / 1000;
+                waitTicks = (TickType_t)((waitMs * configTICK_RATE_HZ + 999) / 1000);
+            }
+        }
+        portEXIT_CRITICAL(&TimerLock);
+
+        if (callback != nullptr)
+        {
+            // Called without the lock held so the callback can start/stop
+            // timers (including its own).
+            (*callback)(arg);
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, waitTicks);
+        }
+    }
+}
+
+// Lets the timer task recalculate its next wakeup.
+void WakeTimerTask()
+{
+    if (TimerTask != nullptr)
+    {
+        xTaskNotifyGive(TimerTask);
+    }
+}
+
+esp_err_t StartTimer(esp_timer_handle_t timer, uint64_t timeoutUs, uint64_t periodUs)
+{
+    if (timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = ESP_OK;
+    portENTER_CRITICAL(&TimerLock);
+    if (timer->armed)
+    {
+        result = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        timer->armed = true;
+        timer->deadlineUs = esp_timer_get_time() + timeoutUs;
+        timer->periodUs = periodUs;
+    }
+    portEXIT_CRITICAL(&TimerLock);
+
+    WakeTimerTask();
+    return result;
+}
+
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
+{
+    if (create_args == nullptr || create_args->callback == nullptr || out_handle == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (TimerTask == nullptr)
+    {
+        if (xTaskCreatePinnedToCore(&TimerTaskEntry, "esp_timer", ESP_TIMER_TASK_STACK_SIZE, nullptr, ESP_TIMER_TASK_PRIORITY, &TimerTask, 0) != pdPASS)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    esp_timer* timer = new (std::nothrow) esp_timer();
+    if (timer == nullptr)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->args = *create_args;
+
+    portENTER_CRITICAL(&TimerLock);
+    timer->next = TimerList;
+    TimerList = timer;
+    portEXIT_CRITICAL(&TimerLock);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return StartTimer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return StartTimer(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = ESP_OK;
+    portENTER_CRITICAL(&TimerLock);
+    if (!timer->armed)
+    {
+        result = ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    portEXIT_CRITICAL(&TimerLock);
+
+    WakeTimerTask();
+    return result;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = ESP_OK;
+    portENTER_CRITICAL(&TimerLock);
+    if (timer->armed)
+    {
+        result = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        for (esp_timer** entry = &TimerList; *entry != nullptr; entry = &(*entry)->next)
+        {
+            if (*entry == timer)
+            {
+                *entry = timer->next;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&TimerLock);
+
+    if (result == ESP_OK)
+    {
+        delete timer;
+    }
+    return result;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    assert(timer != nullptr);
+    return timer->armed;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    // Relative to the first call (early in main()) to look like time since boot.
+    static const int64_t StartUs = MonotonicTimeUs();
+    return MonotonicTimeUs() - StartUs;
+}
@@ -16,12 +16,20 @@
  */
 
 #include "Application.h"
+#include "task/DVTaskStartScheduler.h"
+#include "util/AllocationProfiler.h"
+#include "util/BootTimeline.h"
+#include "util/EventTrace.h"
+#include "util/MicroBenchmark.h"
 
 #include "driver/rtc_io.h"
 #include "driver/gpio.h"
 #include "ulp_riscv.h"
 #include "ulp_main.h"
 #include "esp_sleep.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif // CONFIG_PM_ENABLE
 #include "esp_log.h"
 
 #if CONFIG_EZDV_PRINT_HEAP_USAGE
@@ -34,11 +42,6 @@
 #define MAIN_APP_TASK_TICK_INTERVAL (portMAX_DELAY)
 #endif // CONFIG_EZDV_ENABLE_TICK_OUTPUT
 
-#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
-#include "driver/ButtonMessage.h"
-#include "audio/FreeDVMessage.h"
-#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
-
 #define CURRENT_LOG_TAG ("app")
 
 #define BOOTUP_VOL_DOWN_GPIO (GPIO_NUM_7)
@@ -60,7 +63,21 @@ extern "C"
 
 void* operator new  ( std::size_t count )
 {
-    return heap_caps_malloc(count, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    void* ptr = heap_caps_malloc(count, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    ezdv::util::AllocationProfiler::AttributeCaller(ptr, __builtin_return_address(0));
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+    return ptr;
+}
+
+// Otherwise the library's operator new[] would be the caller for every array.
+void* operator new[]  ( std::size_t count )
+{
+    void* ptr = heap_caps_malloc(count, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    ezdv::util::AllocationProfiler::AttributeCaller(ptr, __builtin_return_address(0));
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+    return ptr;
 }
 
 void operator delete  ( void* ptr ) noexcept
@@ -81,11 +98,24 @@ App::App()
     , audioMixer_(nullptr)
     , beeperTask_(nullptr)
     , freedvTask_(nullptr)
+#if CONFIG_EZDV_RX_RECORDER
+    , rxRecorderTask_(nullptr)
+#endif // CONFIG_EZDV_RX_RECORDER
+#if CONFIG_EZDV_AUDIO_MONITOR
+    , rxMonitorTask_(nullptr)
+#endif // CONFIG_EZDV_AUDIO_MONITOR
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    , latencyProbe_(nullptr)
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
+    , soakTestTask_(nullptr)
+#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
     , max17048_(&i2cMaster_)
     , tlv320Device_(nullptr)
     , networkTask_(nullptr)
     , settingsTask_(nullptr)
     , softwareUpdateTask_(nullptr)
+    , telemetryTask_(nullptr)
     , uiTask_(nullptr)
     , rfComplianceTask_(nullptr)
     , fuelGaugeTask_(nullptr)
@@ -356,8 +386,18 @@ void App::onTaskStart_()
     {
         tlv320Device_ = new driver::TLV320(&i2cMaster_);
         assert(tlv320Device_ != nullptr);
-        
-        start(tlv320Device_, pdMS_TO_TICKS(10000));
+
+        // Tasks below are started as soon as the tasks they depend on 
+        // are up, so that e.g. TLV320 configuration and the voice keyer
+        // filesystem mount can happen at the same time.
+        task::DVTaskStartScheduler startScheduler(this);
+        startScheduler.add(tlv320Device_, pdMS_TO_TICKS(10000));
+
+#if CONFIG_EZDV_ENABLE_TELEMETRY
+        telemetryTask_ = new telemetry::TelemetryTask();
+        assert(telemetryTask_ != nullptr);
+        startScheduler.add(telemetryTask_, pdMS_TO_TICKS(1000));
+#endif // CONFIG_EZDV_ENABLE_TELEMETRY
     
         if (!rfComplianceEnabled_)
         {
@@ -366,68 +406,119 @@ void App::onTaskStart_()
             
             audioMixer_ = new audio::AudioMixer();
             assert(audioMixer_ != nullptr);
+
+#if CONFIG_EZDV_BEEPER_DUCKING_PERCENT < 100
+            // Make the beeper easier to hear over decoded audio.
+            audioMixer_->setDucking(
+                audio::AudioInput::LEFT_CHANNEL, audio::AudioInput::RIGHT_CHANNEL, 
+                CONFIG_EZDV_BEEPER_DUCKING_PERCENT * audio::AudioMixer::UNITY_GAIN / 100);
+#endif // CONFIG_EZDV_BEEPER_DUCKING_PERCENT < 100
             
             beeperTask_ = new audio::BeeperTask();
             assert(beeperTask_ != nullptr);
+
+            // Decoded audio passes through each of these (if enabled) on its
+            // way to the mixer.
+            audio::AudioPort rxOutput = { freedvTask_, audio::AudioInput::USER_CHANNEL };
+
+#if CONFIG_EZDV_RX_RECORDER
+            rxRecorderTask_ = new audio::AudioRecorderTask();
+            assert(rxRecorderTask_ != nullptr);
+
+            audio::AudioGraph::Apply({
+                { rxOutput.node, rxOutput.channel, rxRecorderTask_, audio::AudioInput::LEFT_CHANNEL },
+            });
+            rxOutput = { rxRecorderTask_, audio::AudioInput::LEFT_CHANNEL };
+#endif // CONFIG_EZDV_RX_RECORDER
+
+#if CONFIG_EZDV_AUDIO_MONITOR
+            rxMonitorTask_ = new audio::AudioMonitorTask();
+            assert(rxMonitorTask_ != nullptr);
+
+            audio::AudioGraph::Apply({
+                { rxOutput.node, rxOutput.channel, rxMonitorTask_, audio::AudioInput::LEFT_CHANNEL },
+            });
+            rxOutput = { rxMonitorTask_, audio::AudioInput::LEFT_CHANNEL };
+#endif // CONFIG_EZDV_AUDIO_MONITOR
             
-            // Link TLV320 output FIFOs to FreeDVTask
-            tlv320Device_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-                freedvTask_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-            );
-
-            tlv320Device_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RIGHT_CHANNEL, 
-                freedvTask_->getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
-            );
-
-            // Link FreeDVTask output FIFOs to:
-            //    * RX: AudioMixer left channel
-            //    * TX: TLV320 right channel
-            freedvTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::USER_CHANNEL, 
-                audioMixer_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-            );
-
-            freedvTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
-
-            // Link beeper output to AudioMixer right channel
-            beeperTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                audioMixer_->getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
-            );
-
-            // Link audio mixer to TLV320 left channel
-            audioMixer_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
+            // Link up the audio pipeline:
+            //    * TLV320 -> FreeDVTask
+            //    * FreeDVTask RX -> AudioMixer left channel (via the above)
+            //    * FreeDVTask TX -> TLV320 right channel
+            //    * Beeper -> AudioMixer right channel
+            //    * AudioMixer -> TLV320 left channel
+            audio::AudioGraph::Apply({
+                { tlv320Device_, audio::AudioInput::LEFT_CHANNEL, freedvTask_, audio::AudioInput::LEFT_CHANNEL },
+                { tlv320Device_, audio::AudioInput::RIGHT_CHANNEL, freedvTask_, audio::AudioInput::RIGHT_CHANNEL },
+                { rxOutput.node, rxOutput.channel, audioMixer_, audio::AudioInput::LEFT_CHANNEL },
+                { freedvTask_, audio::AudioInput::RADIO_CHANNEL, tlv320Device_, audio::AudioInput::RADIO_CHANNEL },
+                { beeperTask_, audio::AudioInput::LEFT_CHANNEL, audioMixer_, audio::AudioInput::RIGHT_CHANNEL },
+                { audioMixer_, audio::AudioInput::LEFT_CHANNEL, tlv320Device_, audio::AudioInput::USER_CHANNEL },
+            });
+
+            audio::AudioGraph::LogLatencyBudget("TX", {
+                { freedvTask_, audio::AudioInput::USER_CHANNEL },
+                { tlv320Device_, audio::AudioInput::RADIO_CHANNEL },
+            });
+            audio::AudioGraph::LogLatencyBudget("RX", {
+                { freedvTask_, audio::AudioInput::RADIO_CHANNEL },
+                { audioMixer_, audio::AudioInput::LEFT_CHANNEL },
+                { tlv320Device_, audio::AudioInput::USER_CHANNEL },
+            });
                 
             // Start audio processing
-            start(freedvTask_, pdMS_TO_TICKS(1000));
-            start(audioMixer_, pdMS_TO_TICKS(1000));
-            start(beeperTask_, pdMS_TO_TICKS(1000));
-
-            // Start UI
-            voiceKeyerTask_ = new audio::VoiceKeyerTask(tlv320Device_, freedvTask_);
+            startScheduler.add(freedvTask_, pdMS_TO_TICKS(1000), { tlv320Device_ });
+            startScheduler.add(audioMixer_, pdMS_TO_TICKS(1000), { tlv320Device_ });
+            startScheduler.add(beeperTask_, pdMS_TO_TICKS(1000), { audioMixer_ });
+#if CONFIG_EZDV_RX_RECORDER
+            startScheduler.add(rxRecorderTask_, pdMS_TO_TICKS(1000), { audioMixer_ });
+#endif // CONFIG_EZDV_RX_RECORDER
+#if CONFIG_EZDV_AUDIO_MONITOR
+            startScheduler.add(rxMonitorTask_, pdMS_TO_TICKS(1000), { audioMixer_ });
+#endif // CONFIG_EZDV_AUDIO_MONITOR
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+            latencyProbe_ = new audio::AudioLatencyProbe();
+            assert(latencyProbe_ != nullptr);
+            startScheduler.add(latencyProbe_, pdMS_TO_TICKS(1000), { freedvTask_, audioMixer_ });
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+            // Start voice keyer. Only needs its own filesystem to start.
+            // It's always connected; FreeDV picks between it and the mic.
+            voiceKeyerTask_ = new audio::VoiceKeyerTask();
             assert(voiceKeyerTask_ != nullptr);
-            start(voiceKeyerTask_, pdMS_TO_TICKS(1000));
+
+            audio::AudioGraph::Apply({
+                { voiceKeyerTask_, audio::AudioInput::LEFT_CHANNEL, freedvTask_, audio::FreeDVTask::KEYER_CHANNEL },
+#if CONFIG_EZDV_VOICE_KEYER_MONITOR
+                { voiceKeyerTask_, audio::VoiceKeyerTask::MONITOR_CHANNEL, audioMixer_, audio::AudioMixer::KEYER_MONITOR_CHANNEL },
+#endif // CONFIG_EZDV_VOICE_KEYER_MONITOR
+            });
+            startScheduler.add(voiceKeyerTask_, pdMS_TO_TICKS(1000));
             
+            // Start UI. This turns off the boot LEDs, so wait for audio to be ready.
             uiTask_ = new ui::UserInterfaceTask();
             assert(uiTask_ != nullptr);
-            start(uiTask_, pdMS_TO_TICKS(1000));
+            startScheduler.add(uiTask_, pdMS_TO_TICKS(1000), { freedvTask_, audioMixer_, beeperTask_, voiceKeyerTask_ });
+
+#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
+            soakTestTask_ = new telemetry::SoakTestTask();
+            assert(soakTestTask_ != nullptr);
+            startScheduler.add(soakTestTask_, pdMS_TO_TICKS(1000), { uiTask_, telemetryTask_ });
+#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
         
             // Start Wi-Fi
-            networkTask_ = new network::NetworkTask(freedvTask_, tlv320Device_, audioMixer_, voiceKeyerTask_);
+            networkTask_ = new network::NetworkTask(freedvTask_, tlv320Device_, audioMixer_);
             assert(networkTask_ != nullptr);
             
             networkTask_->setWiFiOverride(wifiOverrideEnabled_);
-            start(networkTask_, pdMS_TO_TICKS(5000));
+            startScheduler.add(networkTask_, pdMS_TO_TICKS(5000), { freedvTask_, audioMixer_, voiceKeyerTask_ });
+
+            startScheduler.start();
+
+            // Start storage handling. Settings are broadcast on startup, 
+            // so everything else needs to be awake by now.
 
-            // Start storage handling
             settingsTask_ = new storage::SettingsTask();
             assert(settingsTask_ != nullptr);
             settingsTask_->start();
@@ -438,6 +529,7 @@ void App::onTaskStart_()
             
             // Mark boot as successful, no need to rollback.
             esp_ota_mark_app_valid_cancel_rollback();
+            util::BootTimeline::Mark("ready");
         }
         else
         {
@@ -445,17 +537,13 @@ void App::onTaskStart_()
             assert(rfComplianceTask_ != nullptr);
             
             // RF compliance task should be piped to TLV320.
-            rfComplianceTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
-            
-            rfComplianceTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
+            audio::AudioGraph::Apply({
+                { rfComplianceTask_, audio::AudioInput::LEFT_CHANNEL, tlv320Device_, audio::AudioInput::USER_CHANNEL },
+                { rfComplianceTask_, audio::AudioInput::RIGHT_CHANNEL, tlv320Device_, audio::AudioInput::RADIO_CHANNEL },
+            });
             
-            start(rfComplianceTask_, pdMS_TO_TICKS(1000));
+            startScheduler.add(rfComplianceTask_, pdMS_TO_TICKS(1000), { tlv320Device_ });
+            startScheduler.start();
         }
     }
 }
@@ -507,6 +595,22 @@ void App::onTaskSleep_()
                 sleep(softwareUpdateTask_, pdMS_TO_TICKS(1000));
             }
             
+#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
+            // Stop keying up before anything else goes away.
+            if (soakTestTask_ != nullptr)
+            {
+                sleep(soakTestTask_, pdMS_TO_TICKS(1000));
+            }
+#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+            // Stop injecting before the audio tasks go away.
+            if (latencyProbe_ != nullptr)
+            {
+                sleep(latencyProbe_, pdMS_TO_TICKS(1000));
+            }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
             // Delay a second or two to allow final beeper to play.
             if (beeperTask_ != nullptr)
             {
@@ -519,6 +623,20 @@ void App::onTaskSleep_()
                 sleep(freedvTask_, pdMS_TO_TICKS(1000));
             }
             
+#if CONFIG_EZDV_RX_RECORDER
+            if (rxRecorderTask_ != nullptr)
+            {
+                sleep(rxRecorderTask_, pdMS_TO_TICKS(1000));
+            }
+#endif // CONFIG_EZDV_RX_RECORDER
+
+#if CONFIG_EZDV_AUDIO_MONITOR
+            if (rxMonitorTask_ != nullptr)
+            {
+                sleep(rxMonitorTask_, pdMS_TO_TICKS(1000));
+            }
+#endif // CONFIG_EZDV_AUDIO_MONITOR
+
             if (audioMixer_ != nullptr)
             {
                 sleep(audioMixer_, pdMS_TO_TICKS(3000));
@@ -532,6 +650,11 @@ void App::onTaskSleep_()
             }
         }
         
+        if (telemetryTask_ != nullptr)
+        {
+            sleep(telemetryTask_, pdMS_TO_TICKS(1000));
+        }
+        
         if (tlv320Device_ != nullptr)
         {
             sleep(tlv320Device_, pdMS_TO_TICKS(2000));
@@ -700,11 +823,6 @@ void App::onTaskTick_()
 {
 #if CONFIG_EZDV_ENABLE_TICK_OUTPUT
     // infinite loop to track heap use
-#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
-    bool ptt = false;
-    bool hasChangedModes = false;
-#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
-
 #if CONFIG_EZDV_PRINT_HEAP_USAGE
     ESP_LOGI(CURRENT_LOG_TAG, "heap free (8 bit): %d", heap_caps_get_free_size(MALLOC_CAP_8BIT));
     ESP_LOGI(CURRENT_LOG_TAG, "heap free (32 bit): %d", heap_caps_get_free_size(MALLOC_CAP_32BIT));
@@ -724,29 +842,6 @@ void App::onTaskTick_()
     esp_timer_dump(stdout);
 #endif // CONFIG_EZDV_DUMP_TIMERS
 
-#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
-    ptt = !ptt;
-
-    // Trigger PTT
-    if (!hasChangedModes)
-    {
-        ezdv::audio::SetFreeDVModeMessage modeSetMessage(ezdv::audio::SetFreeDVModeMessage::FREEDV_700D);
-        app->getFreeDVTask().post(&modeSetMessage);
-        hasChangedModes = true;
-    }
-
-    if (ptt)
-    {
-        ezdv::driver::ButtonShortPressedMessage pressedMessage(ezdv::driver::PTT);
-        app->getUITask().post(&pressedMessage);
-    }
-    else
-    {
-        ezdv::driver::ButtonReleasedMessage releasedMessage(ezdv::driver::PTT);
-        app->getUITask().post(&releasedMessage);
-    }
-#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
-
 #endif // CONFIG_EZDV_ENABLE_TICK_OUTPUT
 }
 
@@ -762,6 +857,11 @@ void StartSleeping()
 
 extern "C" void app_main()
 {
+    ezdv::util::BootTimeline::Begin();
+    ezdv::util::BootTimeline::Mark("app_main");
+    ezdv::util::EventTrace::Initialize();
+    ezdv::util::AllocationProfiler::Initialize();
+
     // Make sure the ULP program isn't running.
     ulp_riscv_timer_stop();
     ulp_riscv_halt();
@@ -772,6 +872,28 @@ extern "C" void app_main()
     // Note: mandatory before using DVTask.
     DVTask::Initialize();
 
+#if CONFIG_PM_ENABLE
+    // Run slower while nothing's holding a PowerLock (i.e. no audio is 
+    // being processed). The I2S driver holds its own lock while the codec
+    // is running, so light sleep only happens with audio fully stopped.
+    esp_pm_config_t pmConfig = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_EZDV_PM_MIN_CPU_FREQ_MHZ,
+#if CONFIG_EZDV_PM_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#else
+        .light_sleep_enable = false,
+#endif // CONFIG_EZDV_PM_LIGHT_SLEEP
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pmConfig));
+#endif // CONFIG_PM_ENABLE
+
+#if CONFIG_EZDV_MICROBENCHMARKS
+    // Nothing else is started, so the benchmarks have the device to themselves.
+    ezdv::util::MicroBenchmark::Start();
+    return;
+#endif // CONFIG_EZDV_MICROBENCHMARKS
+
     // Note: GPIO ISRs use per GPIO ISRs.
     ESP_ERROR_CHECK(gpio_install_isr_service(ESP_INTR_FLAG_LOWMED));
     
@@ -20,7 +20,10 @@
 
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
+#include "audio/AudioLatencyProbe.h"
 #include "audio/AudioMixer.h"
+#include "audio/AudioMonitorTask.h"
+#include "audio/AudioRecorderTask.h"
 #include "audio/BeeperTask.h"
 #include "audio/FreeDVTask.h"
 #include "audio/VoiceKeyerTask.h"
@@ -33,16 +36,14 @@
 #include "network/NetworkTask.h"
 #include "storage/SettingsTask.h"
 #include "storage/SoftwareUpdateTask.h"
+#include "telemetry/SoakTestTask.h"
+#include "telemetry/TelemetryTask.h"
 #include "ui/UserInterfaceTask.h"
 #include "ui/FuelGaugeTask.h"
 #include "ui/RFComplianceTestTask.h"
 
 using namespace ezdv::task;
 
-// Uncomment below to enable automated TX/RX test
-// (5s TX, 5s RX, repeat indefinitely)
-//#define ENABLE_AUTOMATED_TX_RX_TEST
-
 namespace ezdv
 {
 
@@ -51,11 +52,6 @@ class App : public DVTask
 public:
     App();
 
-#if defined(ENABLE_AUTOMATED_TX_RX_TEST)
-    audio::FreeDVTask& getFreeDVTask() { return freedvTask_; }
-    ui::UserInterfaceTask& getUITask() { return uiTask_; }
-#endif // ENABLE_AUTOMATED_TX_RX_TEST
-
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
@@ -65,6 +61,18 @@ private:
     audio::AudioMixer* audioMixer_;
     audio::BeeperTask* beeperTask_;
     audio::FreeDVTask* freedvTask_;
+#if CONFIG_EZDV_RX_RECORDER
+    audio::AudioRecorderTask* rxRecorderTask_;
+#endif // CONFIG_EZDV_RX_RECORDER
+#if CONFIG_EZDV_AUDIO_MONITOR
+    audio::AudioMonitorTask* rxMonitorTask_;
+#endif // CONFIG_EZDV_AUDIO_MONITOR
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    audio::AudioLatencyProbe* latencyProbe_;
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+#if CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
+    telemetry::SoakTestTask* soakTestTask_;
+#endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
     driver::ButtonArray buttonArray_;
     driver::I2CMaster i2cMaster_;
     driver::LedArray ledArray_;
@@ -73,6 +81,7 @@ private:
     network::NetworkTask* networkTask_;
     storage::SettingsTask* settingsTask_;
     storage::SoftwareUpdateTask* softwareUpdateTask_;
+    telemetry::TelemetryTask* telemetryTask_;
     ui::UserInterfaceTask* uiTask_;
     ui::RfComplianceTestTask* rfComplianceTask_;
     ui::FuelGaugeTask* fuelGaugeTask_;
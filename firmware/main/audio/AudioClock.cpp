@@ -0,0 +1,88 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <sys/time.h>
+
+#include "esp_log.h"
+
+#include "AudioClock.h"
+
+#define CURRENT_LOG_TAG "AudioClock"
+
+// How much the stream may drift from the wall clock before it's re-anchored
+// (e.g. when SNTP first sets the time).
+#define AUDIO_CLOCK_MAX_ERROR_MS (20)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioClock::AudioClock(uint32_t sampleRate)
+    : sampleRate_(sampleRate)
+{
+    reset();
+}
+
+void AudioClock::reset()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+
+    timestamp_.seconds = tv.tv_sec;
+    timestamp_.fraction = (uint64_t)tv.tv_usec * sampleRate_ / 1000000;
+    samplesSinceCheck_ = 0;
+}
+
+void AudioClock::advance(uint32_t numSamples)
+{
+    timestamp_.fraction += numSamples;
+    while (timestamp_.fraction >= sampleRate_)
+    {
+        timestamp_.fraction -= sampleRate_;
+        timestamp_.seconds++;
+    }
+
+    samplesSinceCheck_ += numSamples;
+    if (samplesSinceCheck_ >= sampleRate_)
+    {
+        checkWallClock_();
+    }
+}
+
+void AudioClock::checkWallClock_()
+{
+    samplesSinceCheck_ = 0;
+
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+
+    int64_t wallSamples = (int64_t)tv.tv_sec * sampleRate_ + (int64_t)tv.tv_usec * sampleRate_ / 1000000;
+    int64_t ourSamples = (int64_t)timestamp_.seconds * sampleRate_ + timestamp_.fraction;
+    int64_t errorSamples = wallSamples - ourSamples;
+    if (std::llabs(errorSamples) * 1000 > (int64_t)AUDIO_CLOCK_MAX_ERROR_MS * sampleRate_)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Re-anchoring to the wall clock (off by %" PRId64 " ms)", errorSamples * 1000 / sampleRate_);
+        reset();
+    }
+}
+
+}
+
+}
@@ -0,0 +1,69 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_CLOCK_H
+#define AUDIO_CLOCK_H
+
+#include <cinttypes>
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Keeps sample-accurate time for an audio stream: whole seconds of
+///        wall clock time plus the number of samples into the current second.
+///        It only reads the wall clock when (re)anchored and once a second 
+///        after that, to follow SNTP once it sets the time. Not thread safe;
+///        intended to be owned by the task producing the stream.
+class AudioClock
+{
+public:
+    struct Timestamp
+    {
+        uint32_t seconds; // since the epoch
+        uint32_t fraction; // samples into the second
+    };
+
+    /// @brief Creates a new clock.
+    /// @param sampleRate The sample rate of the stream being timed.
+    AudioClock(uint32_t sampleRate);
+    virtual ~AudioClock() = default;
+
+    /// @brief Anchors the next sample to the current wall clock time.
+    void reset();
+
+    /// @brief Returns the time of the next sample.
+    Timestamp getTimestamp() const { return timestamp_; }
+
+    /// @brief Moves the clock forward after samples have been produced.
+    void advance(uint32_t numSamples);
+
+private:
+    uint32_t sampleRate_;
+    Timestamp timestamp_;
+    uint32_t samplesSinceCheck_;
+
+    void checkWallClock_();
+};
+
+}
+
+}
+
+#endif // AUDIO_CLOCK_H
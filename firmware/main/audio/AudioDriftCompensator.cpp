@@ -0,0 +1,163 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "AudioDriftCompensator.h"
+
+// The largest correction applied. Crystals are typically good to within 
+// +/- 50 ppm, so this leaves headroom while staying inaudible.
+#define DRIFT_MAX_CORRECTION_PPM (500)
+
+// Loop gains. A 50 sample error is corrected at 500 ppm (proportional), with 
+// the integral term taking over on a ~10 s timescale so that steady drift 
+// ends up with no error.
+#define DRIFT_KP (1e-5f)
+#define DRIFT_KI (DRIFT_KP / 10.0f)
+
+// The FIFO level is smoothed heavily since producers and consumers usually 
+// work in different block sizes, which makes it sawtooth.
+#define DRIFT_LEVEL_SMOOTHING (1.0f / 64.0f)
+
+// When no target is set, the level is captured after this long (in seconds)
+// so that startup transients don't end up as the setpoint.
+#define DRIFT_SETTLING_TIME_S (2)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioDriftCompensator::AudioDriftCompensator(uint32_t sampleRate)
+    : sampleRate_(sampleRate)
+    , isTargetFixed_(false)
+    , targetLevel_(0)
+{
+    reset();
+}
+
+void AudioDriftCompensator::reset()
+{
+    for (auto& sample : history_)
+    {
+        sample = 0;
+    }
+    position_ = 0;
+    ratio_ = 1.0f;
+
+    hasTarget_ = isTargetFixed_;
+    filteredLevel_ = -1;
+    integral_ = 0;
+    numSettlingSamples_ = 0;
+}
+
+void AudioDriftCompensator::setTargetLevel(uint32_t numSamples)
+{
+    hasTarget_ = true;
+    isTargetFixed_ = true;
+    targetLevel_ = numSamples;
+}
+
+uint32_t AudioDriftCompensator::process(AudioRingBuffer* input, short* output, uint32_t numSamples)
+{
+    // Worst case number of input samples needed (plus margin for rounding).
+    uint32_t numNeeded = (uint32_t)(position_ + ratio_ * numSamples) + 2;
+    uint32_t level = input->numUsed();
+    if (level < numNeeded)
+    {
+        return 0;
+    }
+
+    auto span = input->acquireRead(numNeeded);
+    assert(span.size() == numNeeded);
+
+    uint32_t numRead = 0;
+    for (uint32_t index = 0; index < numSamples; index++)
+    {
+        while (position_ >= 1.0f)
+        {
+            history_[0] = history_[1];
+            history_[1] = history_[2];
+            history_[2] = history_[3];
+            history_[3] = span[numRead++];
+            position_ -= 1.0f;
+        }
+
+        // Catmull-Rom between history_[1] and history_[2].
+        float t = position_;
+        float a = -0.5f * history_[0] + 1.5f * history_[1] - 1.5f * history_[2] + 0.5f * history_[3];
+        float b = history_[0] - 2.5f * history_[1] + 2.0f * history_[2] - 0.5f * history_[3];
+        float c = -0.5f * history_[0] + 0.5f * history_[2];
+        float result = ((a * t + b) * t + c) * t + history_[1];
+
+        output[index] = (short)std::max(std::min(result, 32767.0f), -32768.0f);
+        position_ += ratio_;
+    }
+
+    assert(numRead <= numNeeded);
+    input->release(numRead);
+
+    updateRatio_(level, numSamples);
+    return numSamples;
+}
+
+int32_t AudioDriftCompensator::getCorrectionPpm() const
+{
+    return (int32_t)std::round((ratio_ - 1.0f) * 1e6f);
+}
+
+void AudioDriftCompensator::updateRatio_(uint32_t level, uint32_t numSamples)
+{
+    if (filteredLevel_ < 0)
+    {
+        filteredLevel_ = level;
+    }
+    else
+    {
+        filteredLevel_ += (level - filteredLevel_) * DRIFT_LEVEL_SMOOTHING;
+    }
+
+    if (!hasTarget_)
+    {
+        numSettlingSamples_ += numSamples;
+        if (numSettlingSamples_ >= sampleRate_ * DRIFT_SETTLING_TIME_S)
+        {
+            hasTarget_ = true;
+            targetLevel_ = filteredLevel_;
+        }
+        return;
+    }
+
+    // Positive error means the producer is ahead, so consume a bit faster.
+    float error = filteredLevel_ - targetLevel_;
+    float maxCorrection = DRIFT_MAX_CORRECTION_PPM * 1e-6f;
+    integral_ += error * numSamples / sampleRate_;
+
+    // Don't wind up beyond what the ratio can actually be trimmed by.
+    float maxIntegral = maxCorrection / DRIFT_KI;
+    integral_ = std::max(std::min(integral_, maxIntegral), -maxIntegral);
+
+    float correction = DRIFT_KP * error + DRIFT_KI * integral_;
+    ratio_ = 1.0f + std::max(std::min(correction, maxCorrection), -maxCorrection);
+}
+
+}
+
+}
@@ -0,0 +1,86 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_DRIFT_COMPENSATOR_H
+#define AUDIO_DRIFT_COMPENSATOR_H
+
+#include <cinttypes>
+
+#include "AudioRingBuffer.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Reads from a FIFO filled on one clock (e.g. the radio's) on behalf
+///        of a consumer running on another (e.g. an ESP32 timer). The FIFO's
+///        level is fed to a PI control loop which trims the resampling ratio
+///        by up to a few hundred ppm, so that the level holds steady instead 
+///        of slowly filling or draining. Samples are interpolated with a cubic
+///        (Catmull-Rom) curve; at these ratios the result is inaudible.
+class AudioDriftCompensator
+{
+public:
+    /// @brief Creates a new drift compensator.
+    /// @param sampleRate The sample rate of the audio going through it.
+    AudioDriftCompensator(uint32_t sampleRate);
+    virtual ~AudioDriftCompensator() = default;
+
+    /// @brief Starts over with a 1:1 ratio. The level to hold is captured again
+    ///        unless one's given to setTargetLevel().
+    void reset();
+
+    /// @brief Sets the FIFO level to hold, in samples. 
+    void setTargetLevel(uint32_t numSamples);
+
+    /// @brief Produces samples from the given FIFO.
+    /// @param input The FIFO to read from.
+    /// @param output Where to store the resampled audio.
+    /// @param numSamples The number of samples to produce.
+    /// @return The number of samples produced; either numSamples or 0 if the FIFO
+    ///         doesn't have enough. No input is consumed in the latter case.
+    uint32_t process(AudioRingBuffer* input, short* output, uint32_t numSamples);
+
+    /// @brief Returns the current correction in parts per million (positive
+    ///        when the producer's clock is running fast).
+    int32_t getCorrectionPpm() const;
+
+private:
+    uint32_t sampleRate_;
+
+    float history_[4]; // x[-1], x[0], x[1], x[2]
+    float position_; // between x[0] and x[1]
+    float ratio_; // input samples per output sample
+
+    // Control loop state.
+    bool hasTarget_;
+    bool isTargetFixed_;
+    float targetLevel_;
+    float filteredLevel_;
+    float integral_;
+    uint32_t numSettlingSamples_;
+
+    void updateRatio_(uint32_t level, uint32_t numSamples);
+};
+
+}
+
+}
+
+#endif // AUDIO_DRIFT_COMPENSATOR_H
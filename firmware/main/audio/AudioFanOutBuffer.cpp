@@ -0,0 +1,121 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+
+#include "AudioFanOutBuffer.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioFanOutBuffer::AudioFanOutBuffer(uint32_t numSamples)
+    : writeIndex_(0)
+{
+    assert(numSamples > 0 && numSamples <= 0x80000000);
+
+    capacity_ = 1;
+    while (capacity_ < numSamples)
+    {
+        capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+
+    buffer_ = (short*)heap_caps_calloc(capacity_, sizeof(short), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(buffer_ != nullptr);
+}
+
+AudioFanOutBuffer::~AudioFanOutBuffer()
+{
+    heap_caps_free(buffer_);
+}
+
+AudioFanOutBuffer::Cursor AudioFanOutBuffer::head() const
+{
+    return writeIndex_.load(std::memory_order_acquire);
+}
+
+uint32_t AudioFanOutBuffer::numAvailable(Cursor cursor) const
+{
+    return std::min(writeIndex_.load(std::memory_order_acquire) - cursor, capacity_ / 2);
+}
+
+void AudioFanOutBuffer::write(const short* samples, uint32_t numSamples)
+{
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+    while (numSamples > 0)
+    {
+        uint32_t offset = writeIndex & mask_;
+        uint32_t toCopy = std::min(numSamples, capacity_ - offset);
+        memcpy(&buffer_[offset], samples, toCopy * sizeof(short));
+
+        samples += toCopy;
+        numSamples -= toCopy;
+        writeIndex += toCopy;
+    }
+
+    writeIndex_.store(writeIndex, std::memory_order_release);
+}
+
+int AudioFanOutBuffer::read(Cursor* cursor, short* samples, uint32_t numSamples)
+{
+    assert(numSamples <= capacity_ / 2);
+
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_acquire);
+    uint32_t skipped = 0;
+
+    // If we've fallen behind, jump to the oldest samples that are still 
+    // safe to read. Half the buffer is kept as margin so the producer 
+    // can't overwrite what we're copying.
+    if (writeIndex - *cursor > capacity_ / 2)
+    {
+        uint32_t newCursor = writeIndex - capacity_ / 2;
+        skipped = newCursor - *cursor;
+        *cursor = newCursor;
+    }
+
+    if (writeIndex - *cursor < numSamples)
+    {
+        return -1;
+    }
+
+    uint32_t readIndex = *cursor;
+    uint32_t remaining = numSamples;
+    while (remaining > 0)
+    {
+        uint32_t offset = readIndex & mask_;
+        uint32_t toCopy = std::min(remaining, capacity_ - offset);
+        memcpy(samples, &buffer_[offset], toCopy * sizeof(short));
+
+        samples += toCopy;
+        remaining -= toCopy;
+        readIndex += toCopy;
+    }
+
+    *cursor = readIndex;
+    return skipped;
+}
+
+}
+
+}
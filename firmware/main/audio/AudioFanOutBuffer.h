@@ -0,0 +1,75 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_FAN_OUT_BUFFER_H
+#define AUDIO_FAN_OUT_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief A single-producer buffer that any number of consumers can read at
+///        their own pace. Unlike AudioRingBuffer, the producer never waits 
+///        for consumers; anyone who falls too far behind skips ahead and 
+///        loses the samples in between.
+class AudioFanOutBuffer
+{
+public:
+    /// @brief Position of a consumer within the stream.
+    using Cursor = uint32_t;
+
+    /// @brief Creates a new fan-out buffer.
+    /// @param numSamples The number of samples kept for consumers (rounded up to a power of two).
+    AudioFanOutBuffer(uint32_t numSamples);
+    virtual ~AudioFanOutBuffer();
+
+    /// @brief Returns a cursor positioned at the newest sample (i.e. that 
+    ///        skips everything written so far).
+    Cursor head() const;
+
+    /// @brief Returns the number of samples available to the given cursor.
+    uint32_t numAvailable(Cursor cursor) const;
+
+    /// @brief Appends samples to the buffer (producer only).
+    void write(const short* samples, uint32_t numSamples);
+
+    /// @brief Copies samples out for the given consumer. Nothing is read 
+    ///        unless numSamples are available.
+    /// @param cursor The consumer's position, advanced on success.
+    /// @param samples Where to store the samples.
+    /// @param numSamples The number of samples to read.
+    /// @return The number of samples skipped because the consumer fell 
+    ///         behind (0 normally), or -1 if not enough samples are available.
+    int read(Cursor* cursor, short* samples, uint32_t numSamples);
+
+private:
+    short* buffer_;
+    uint32_t capacity_;
+    uint32_t mask_;
+    std::atomic<uint32_t> writeIndex_;
+};
+
+}
+
+}
+
+#endif // AUDIO_FAN_OUT_BUFFER_H
@@ -0,0 +1,84 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+
+#include "AudioGain.h"
+
+// Volume settings are in 0.5 dB steps, same as the TLV320.
+#define VOLUME_STEPS_PER_DB (2.0f)
+#define MIN_VOLUME (-127)
+#define MAX_VOLUME (48)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioGain::AudioGain(float trimDb)
+    : trimDb_(trimDb)
+{
+    setVolume(0);
+}
+
+void AudioGain::setVolume(int8_t volume)
+{
+    if (volume < MIN_VOLUME)
+    {
+        volume = MIN_VOLUME;
+    }
+    else if (volume > MAX_VOLUME)
+    {
+        volume = MAX_VOLUME;
+    }
+
+    float gainDb = volume / VOLUME_STEPS_PER_DB + trimDb_;
+    linearGain_ = std::pow(10.0f, gainDb / 20.0f);
+
+    // Use as many fractional bits as the gain allows so that low volumes 
+    // keep their precision. The product of a sample and the multiplier 
+    // then always fits in 32 bits.
+    shift_ = 15;
+    while (shift_ > 1 && linearGain_ * (1 << shift_) >= 32767.5f)
+    {
+        shift_--;
+    }
+    multiplier_ = (int16_t)lrintf(linearGain_ * (1 << shift_));
+    isUnity_ = multiplier_ == (1 << shift_);
+}
+
+void AudioGain::apply(short* samples, int numSamples) const
+{
+    if (isUnity_)
+    {
+        return;
+    }
+
+    const int32_t multiplier = multiplier_;
+    const int32_t rounding = 1 << (shift_ - 1);
+    for (int index = 0; index < numSamples; index++)
+    {
+        int32_t value = (samples[index] * multiplier + rounding) >> shift_;
+        value = (value > 32767) ? 32767 : ((value < -32768) ? -32768 : value);
+        samples[index] = value;
+    }
+}
+
+}
+
+}
@@ -0,0 +1,70 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_GAIN_H
+#define AUDIO_GAIN_H
+
+#include <cinttypes>
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief The TX gain and limiter shared by every transport. The gain comes
+///        from the right channel volume setting (the same 0.5 dB steps as 
+///        the TLV320's hardware volume) plus a fixed per-transport trim. 
+///        Transports that already make a pass over the audio (e.g. Flex
+///        resampling) fold getLinearGain() into it; others call apply() just
+///        before packetizing, which does nothing at unity gain.
+class AudioGain
+{
+public:
+    /// @brief Creates a new gain stage.
+    /// @param trimDb Fixed gain added to the volume setting.
+    AudioGain(float trimDb = 0.0f);
+    virtual ~AudioGain() = default;
+
+    /// @brief Sets the gain from the right channel volume setting.
+    /// @param volume The volume in 0.5 dB steps (-127 to 48).
+    void setVolume(int8_t volume);
+
+    /// @brief Returns true if apply() would leave the audio unchanged.
+    bool isUnity() const { return isUnity_; }
+
+    /// @brief Returns the gain as a multiplier, for callers fusing it into another pass.
+    float getLinearGain() const { return linearGain_; }
+
+    /// @brief Applies the gain in place, hard limiting to the range of a short.
+    /// @param samples The audio to scale.
+    /// @param numSamples The number of samples.
+    void apply(short* samples, int numSamples) const;
+
+private:
+    float trimDb_;
+    float linearGain_;
+    int16_t multiplier_; // linearGain_ in Q(15-shift_).shift_
+    int shift_;
+    bool isUnity_;
+};
+
+}
+
+}
+
+#endif // AUDIO_GAIN_H
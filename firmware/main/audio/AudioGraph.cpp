@@ -0,0 +1,444 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cassert>
+#include <cstring>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "AudioGraph.h"
+#include "AudioRateConverter.h"
+
+#define MAX_AUDIO_GRAPH_NODES (24)
+#define MAX_ROUTES_PER_CHANGE (16)
+#define MAX_RATE_CONVERTERS (8)
+#define CURRENT_LOG_TAG ("AudioGraph")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static AudioInput* Nodes_[MAX_AUDIO_GRAPH_NODES];
+static portMUX_TYPE GraphLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+// Serializes route changes, which wait for producers with GraphLock_ released.
+static SemaphoreHandle_t ApplyLock_ = nullptr;
+
+// Converters are never deleted: a producer that was just disconnected may 
+// still be finishing a write through one. Idle ones are reused instead.
+struct RateConverterEntry
+{
+    AudioRateConverter* converter;
+    bool inUse;
+};
+static RateConverterEntry RateConverters_[MAX_RATE_CONVERTERS];
+
+void AudioGraph::Apply(std::initializer_list<AudioRoute> routes, uint32_t fadeInSamples)
+{
+    AudioRingBuffer* oldFifos[MAX_ROUTES_PER_CHANGE];
+    AudioFloatRingBuffer* oldFloatFifos[MAX_ROUTES_PER_CHANGE];
+    AudioRateConverter* converters[MAX_ROUTES_PER_CHANGE];
+    assert(routes.size() <= MAX_ROUTES_PER_CHANGE);
+
+    // Converters can't be created with the lock held, so reserve any we
+    // need first.
+    int index = 0;
+    for (auto& route : routes)
+    {
+        converters[index] = nullptr;
+        if (route.source != nullptr && route.sink != nullptr)
+        {
+            uint32_t sourceRate = route.source->getOutputSampleRate(route.sourceChannel);
+            uint32_t sinkRate = route.sink->getInputSampleRate(route.sinkChannel);
+            if (sourceRate != sinkRate)
+            {
+                converters[index] = ReserveRateConverter_(sourceRate, sinkRate);
+            }
+        }
+        index++;
+    }
+
+    // Route changes are rare, so ApplyLock_ is held for the whole change to 
+    // keep other changes from interleaving with this one. Audio tasks never
+    // take either lock.
+    xSemaphoreTake(ApplyLock_, portMAX_DELAY);
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+
+    // Disconnect every rerouted source first so that e.g. swapping two sinks
+    // doesn't briefly have both sources writing to the same buffer.
+    index = 0;
+    for (auto& route : routes)
+    {
+        oldFifos[index] = nullptr;
+        oldFloatFifos[index] = nullptr;
+        if (route.source != nullptr)
+        {
+            oldFifos[index] = route.source->getAudioOutput(route.sourceChannel);
+            route.source->setAudioOutput(route.sourceChannel, nullptr);
+            oldFloatFifos[index] = route.source->getFloatAudioOutput(route.sourceChannel);
+            route.source->setFloatAudioOutput(route.sourceChannel, nullptr);
+        }
+        index++;
+    }
+
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    // A source may have picked up its old FIFO just before we disconnected 
+    // it. Let any such write finish before the FIFO goes to someone else.
+    for (auto& route : routes)
+    {
+        if (route.source != nullptr)
+        {
+            route.source->waitForOutputClaim_(route.sourceChannel);
+        }
+    }
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+
+    // Converters only run from their source's writes, so any the old 
+    // sources were feeding are idle now and can go back in the pool.
+    for (index = 0; index < (int)routes.size(); index++)
+    {
+        ReleaseRateConverter_(oldFifos[index]);
+    }
+
+    index = 0;
+    for (auto& route : routes)
+    {
+        if (route.source != nullptr && route.sink != nullptr)
+        {
+            auto fifo = route.sink->getAudioInput(route.sinkChannel);
+            assert(fifo != nullptr);
+
+            // Each input buffer is single producer; if this fires, the same
+            // sink is being fed by two sources.
+            assert(FindProducer_(fifo, route.source, route.sourceChannel) == nullptr);
+
+            // Both ends working in float skips converting to short and back.
+            auto floatFifo = route.sink->getFloatAudioInput(route.sinkChannel);
+            bool useFloat = 
+                floatFifo != nullptr && converters[index] == nullptr && 
+                route.source->supportsFloatAudioOutput(route.sourceChannel);
+            route.sink->setFloatAudioInputActive_(route.sinkChannel, useFloat);
+
+            if (useFloat)
+            {
+                assert(FindProducer_(floatFifo, route.source, route.sourceChannel) == nullptr);
+
+                if (floatFifo != oldFloatFifos[index])
+                {
+                    floatFifo->requestFlush();
+                    if (fadeInSamples > 0)
+                    {
+                        floatFifo->requestFadeIn(fadeInSamples * route.sink->getInputSampleRate(route.sinkChannel) / AUDIO_DEFAULT_SAMPLE_RATE);
+                    }
+                }
+
+                route.source->setFloatAudioOutput(route.sourceChannel, floatFifo);
+            }
+            else
+            {
+                // With a converter in the way, the source writes to the converter
+                // and the converter writes to the sink.
+                auto sourceFifo = fifo;
+                if (converters[index] != nullptr)
+                {
+                    sourceFifo = converters[index]->getAudioInput(AudioInput::LEFT_CHANNEL);
+                    sourceFifo->requestFlush();
+                    converters[index]->reset();
+                    converters[index]->setAudioOutput(AudioInput::LEFT_CHANNEL, fifo);
+                }
+
+                if (sourceFifo != oldFifos[index])
+                {
+                    // Drop whatever the previous producer left behind so the
+                    // new audio plays immediately rather than after stale samples.
+                    fifo->requestFlush();
+                    if (fadeInSamples > 0)
+                    {
+                        fifo->requestFadeIn(fadeInSamples * route.sink->getInputSampleRate(route.sinkChannel) / AUDIO_DEFAULT_SAMPLE_RATE);
+                    }
+                }
+
+                route.source->setAudioOutput(route.sourceChannel, sourceFifo);
+            }
+        }
+        index++;
+    }
+
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+    xSemaphoreGive(ApplyLock_);
+}
+
+int AudioGraph::GetLinkStatistics(AudioLinkStatistics* links, int maxLinks, bool reset)
+{
+    int numLinks = 0;
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    for (int index = 0; index < MAX_AUDIO_GRAPH_NODES && numLinks < maxLinks; index++)
+    {
+        auto node = Nodes_[index];
+        if (node == nullptr)
+        {
+            continue;
+        }
+
+        for (int channel = 0; channel < node->getNumInputChannels() && numLinks < maxLinks; channel++)
+        {
+            // Whichever FIFO is in use represents the link.
+            auto label = (AudioInput::ChannelLabel)channel;
+            AudioLinkStatistics& link = links[numLinks++];
+            AudioInput* source = nullptr;
+            if (node->isFloatAudioInputActive(label))
+            {
+                auto fifo = node->getFloatAudioInput(label);
+                source = FindProducer_(fifo, nullptr, AudioInput::LEFT_CHANNEL);
+                fifo->getStatistics(link.statistics, reset);
+            }
+            else
+            {
+                auto fifo = node->getAudioInput(label);
+                source = FindProducer_(fifo, nullptr, AudioInput::LEFT_CHANNEL);
+                fifo->getStatistics(link.statistics, reset);
+            }
+
+            link.sinkName = node->getAudioNodeName();
+            link.sinkChannel = label;
+            link.sourceName = source != nullptr ? source->getAudioNodeName() : nullptr;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    return numLinks;
+}
+
+uint32_t AudioGraph::LogLatencyBudget(const char* pathName, std::initializer_list<AudioPort> path)
+{
+    uint32_t totalMs = 0;
+
+    for (auto& port : path)
+    {
+        if (port.node == nullptr)
+        {
+            continue;
+        }
+
+        uint32_t capacity = port.node->getAudioInput(port.channel)->capacity();
+        uint32_t sampleRate = port.node->getInputSampleRate(port.channel);
+        uint32_t capacityMs = capacity * 1000 / sampleRate;
+        totalMs += capacityMs;
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "%s path: %s/%d buffers up to %" PRIu32 " samples (%" PRIu32 " ms)", 
+            pathName,
+            port.node->getAudioNodeName(),
+            (int)port.channel,
+            capacity,
+            capacityMs);
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "%s path: worst case buffering delay is %" PRIu32 " ms", pathName, totalMs);
+    return totalMs;
+}
+
+AudioInput* AudioGraph::FindNode(const char* name)
+{
+    AudioInput* result = nullptr;
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    for (int index = 0; index < MAX_AUDIO_GRAPH_NODES; index++)
+    {
+        auto node = Nodes_[index];
+        if (node != nullptr && !strcmp(node->getAudioNodeName(), name))
+        {
+            result = node;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    return result;
+}
+
+bool AudioGraph::FindFifoSink(const void* fifo, AudioPort& port)
+{
+    bool found = false;
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    for (int index = 0; index < MAX_AUDIO_GRAPH_NODES && !found; index++)
+    {
+        auto node = Nodes_[index];
+        if (node == nullptr)
+        {
+            continue;
+        }
+
+        for (int channel = 0; channel < node->getNumInputChannels(); channel++)
+        {
+            auto label = (AudioInput::ChannelLabel)channel;
+            if (node->getAudioInput(label) == fifo || node->getFloatAudioInput(label) == fifo)
+            {
+                port = { node, label };
+                found = true;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    return found;
+}
+
+void AudioGraph::AddNode_(AudioInput* node)
+{
+    int index = 0;
+
+    // Nodes are created during startup, before any routes are applied.
+    if (ApplyLock_ == nullptr)
+    {
+        ApplyLock_ = xSemaphoreCreateMutex();
+        assert(ApplyLock_ != nullptr);
+    }
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    for (; index < MAX_AUDIO_GRAPH_NODES; index++)
+    {
+        if (Nodes_[index] == nullptr)
+        {
+            Nodes_[index] = node;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    // If this fires, MAX_AUDIO_GRAPH_NODES needs to be increased.
+    assert(index < MAX_AUDIO_GRAPH_NODES);
+}
+
+void AudioGraph::RemoveNode_(AudioInput* node)
+{
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    for (int index = 0; index < MAX_AUDIO_GRAPH_NODES; index++)
+    {
+        if (Nodes_[index] == node)
+        {
+            Nodes_[index] = nullptr;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+}
+
+AudioRateConverter* AudioGraph::ReserveRateConverter_(uint32_t inputSampleRate, uint32_t outputSampleRate)
+{
+    int freeIndex = -1;
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    for (int index = 0; index < MAX_RATE_CONVERTERS; index++)
+    {
+        auto& entry = RateConverters_[index];
+        if (entry.converter == nullptr)
+        {
+            if (freeIndex < 0)
+            {
+                freeIndex = index;
+            }
+        }
+        else if (!entry.inUse &&
+                 entry.converter->getInputSampleRate(AudioInput::LEFT_CHANNEL) == inputSampleRate &&
+                 entry.converter->getOutputSampleRate(AudioInput::LEFT_CHANNEL) == outputSampleRate)
+        {
+            entry.inUse = true;
+            portEXIT_CRITICAL_SAFE(&GraphLock_);
+            return entry.converter;
+        }
+    }
+
+    // Hold the slot while we create a converter for it.
+    if (freeIndex >= 0)
+    {
+        RateConverters_[freeIndex].inUse = true;
+    }
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    // If this fires, MAX_RATE_CONVERTERS needs to be increased.
+    assert(freeIndex >= 0);
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Creating converter from %" PRIu32 " Hz to %" PRIu32 " Hz", inputSampleRate, outputSampleRate);
+    auto converter = new AudioRateConverter(inputSampleRate, outputSampleRate);
+    assert(converter != nullptr);
+
+    portENTER_CRITICAL_SAFE(&GraphLock_);
+    RateConverters_[freeIndex].converter = converter;
+    portEXIT_CRITICAL_SAFE(&GraphLock_);
+
+    return converter;
+}
+
+void AudioGraph::ReleaseRateConverter_(AudioRingBuffer* fifo)
+{
+    // Must be called with GraphLock_ held.
+    for (int index = 0; fifo != nullptr && index < MAX_RATE_CONVERTERS; index++)
+    {
+        auto& entry = RateConverters_[index];
+        if (entry.converter != nullptr && entry.inUse && entry.converter->getAudioInput(AudioInput::LEFT_CHANNEL) == fifo)
+        {
+            entry.converter->setAudioOutput(AudioInput::LEFT_CHANNEL, nullptr);
+            entry.inUse = false;
+            break;
+        }
+    }
+}
+
+AudioInput* AudioGraph::FindProducer_(const void* fifo, AudioInput* except, AudioInput::ChannelLabel exceptChannel)
+{
+    // Must be called with GraphLock_ held.
+    for (int index = 0; index < MAX_AUDIO_GRAPH_NODES; index++)
+    {
+        auto node = Nodes_[index];
+        if (node == nullptr)
+        {
+            continue;
+        }
+
+        for (int channel = 0; channel < node->getNumOutputChannels(); channel++)
+        {
+            if (node == except && channel == (int)exceptChannel)
+            {
+                continue;
+            }
+
+            if (node->getAudioOutput((AudioInput::ChannelLabel)channel) == fifo ||
+                node->getFloatAudioOutput((AudioInput::ChannelLabel)channel) == fifo)
+            {
+                return node;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+}
+
+}
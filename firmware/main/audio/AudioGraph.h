@@ -0,0 +1,133 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef AUDIO_GRAPH_H
+#define AUDIO_GRAPH_H
+
+#include <initializer_list>
+
+#include "AudioInput.h"
+
+// 10ms at 8 kHz; avoids clicks when audio is rerouted.
+#define AUDIO_ROUTE_FADE_IN_SAMPLES (80)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+class AudioRateConverter;
+
+/// @brief A single connection between one task's output and another's input.
+struct AudioRoute
+{
+    AudioInput* source;
+    AudioInput::ChannelLabel sourceChannel;
+    AudioInput* sink; // nullptr to disconnect the source channel
+    AudioInput::ChannelLabel sinkChannel;
+
+    AudioRoute(
+        AudioInput* source, AudioInput::ChannelLabel sourceChannel, 
+        AudioInput* sink = nullptr, AudioInput::ChannelLabel sinkChannel = AudioInput::LEFT_CHANNEL)
+        : source(source)
+        , sourceChannel(sourceChannel)
+        , sink(sink)
+        , sinkChannel(sinkChannel)
+    {
+        // empty
+    }
+};
+
+/// @brief An input channel on a given node.
+struct AudioPort
+{
+    AudioInput* node;
+    AudioInput::ChannelLabel channel;
+};
+
+/// @brief Statistics for a single input buffer and whoever is feeding it.
+struct AudioLinkStatistics
+{
+    const char* sinkName;
+    AudioInput::ChannelLabel sinkChannel;
+    const char* sourceName; // nullptr if nothing is connected
+    AudioRingBuffer::Statistics statistics;
+};
+
+/// @brief Tracks every AudioInput in the system so that routes can be changed
+///        as a group while audio is flowing.
+class AudioGraph
+{
+public:
+    /// @brief Applies a set of route changes. Every source channel listed is 
+    ///        disconnected, and any write it had in progress (see 
+    ///        AudioInput::OutputClaim) allowed to finish, before any new 
+    ///        connection is made, so a buffer is never written by two tasks
+    ///        at once. This can block for a tick or two, and must not be
+    ///        called while holding an OutputClaim. Routes whose source is null
+    ///        are ignored. Sources and sinks running at different sample
+    ///        rates are connected through an AudioRateConverter. Otherwise,
+    ///        float links are used where both ends support them.
+    /// @param routes The routes to apply.
+    /// @param fadeInSamples If non-zero, ramps up audio on input buffers whose
+    ///        producer changes over this many samples.
+    static void Apply(std::initializer_list<AudioRoute> routes, uint32_t fadeInSamples = 0);
+
+    /// @brief Retrieves statistics for every input buffer in the system.
+    /// @param links Array to store the statistics in.
+    /// @param maxLinks The number of entries in links.
+    /// @param reset If true, starts the statistics over afterward.
+    /// @return The number of entries filled in.
+    static int GetLinkStatistics(AudioLinkStatistics* links, int maxLinks, bool reset = false);
+
+    /// @brief Logs how much delay the given input buffers can add in the worst
+    ///        case (i.e. when full), along with the total.
+    /// @param pathName Name of the path to log (e.g. "TX").
+    /// @param path The inputs audio passes through, in order. Null nodes are skipped.
+    /// @return The total worst case delay in milliseconds.
+    static uint32_t LogLatencyBudget(const char* pathName, std::initializer_list<AudioPort> path);
+
+    /// @brief Looks up a node by name (see AudioInput::getAudioNodeName()).
+    /// @param name The name to look for.
+    /// @return The first node with that name, or nullptr if there isn't one.
+    static AudioInput* FindNode(const char* name);
+
+    /// @brief Finds the input a FIFO belongs to (e.g. to name it in a trace).
+    /// @param fifo The FIFO to look up (short or float).
+    /// @param port Filled in with the node and channel if found.
+    /// @return false if no node has that FIFO as an input.
+    static bool FindFifoSink(const void* fifo, AudioPort& port);
+
+private:
+    friend class AudioInput;
+
+    static void AddNode_(AudioInput* node);
+    static void RemoveNode_(AudioInput* node);
+
+    static AudioRateConverter* ReserveRateConverter_(uint32_t inputSampleRate, uint32_t outputSampleRate);
+    static void ReleaseRateConverter_(AudioRingBuffer* fifo);
+
+    static AudioInput* FindProducer_(const void* fifo, AudioInput* except, AudioInput::ChannelLabel exceptChannel);
+};
+
+}
+
+}
+
+#endif // AUDIO_GRAPH_H
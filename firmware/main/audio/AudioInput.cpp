@@ -17,7 +17,24 @@
 
 #include <cassert>
 
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include "AudioInput.h"
+#include "AudioGraph.h"
+#include "task/DVTask.h"
+
+#if CONFIG_EZDV_AUDIO_LATENCY_LOW
+// Just enough for the producer to write a frame while the consumer is 
+// still working on the previous one.
+#define FIFO_FRAMES_PER_LINK (2)
+#define FIFO_JITTER_SAMPLES (0)
+#else
+// Also absorbs ~100ms of scheduling or network jitter.
+#define FIFO_FRAMES_PER_LINK (2)
+#define FIFO_JITTER_SAMPLES (800)
+#endif // CONFIG_EZDV_AUDIO_LATENCY_LOW
 
 namespace ezdv
 {
@@ -25,53 +42,274 @@ namespace ezdv
 namespace audio
 {
 
-AudioInput::AudioInput(int8_t numInputChannels, int8_t numOutputChannels, uint32_t numSamplesInFifo)
-    : numChannels_(numInputChannels)
+AudioInput::AudioInput(const char* name, int8_t numOutputChannels, std::initializer_list<uint32_t> inputFrameSizes)
+    : name_(name)
+    , numChannels_(inputFrameSizes.size())
+    , numOutputChannels_(numOutputChannels)
 {
-    assert(numInputChannels > 0);
-    assert(numSamplesInFifo > 0);
+    assert(numChannels_ > 0);
 
-    inputAudioFifos_ = new FIFO*[numInputChannels];
+    inputAudioFifos_ = new AudioRingBuffer*[numChannels_];
     assert(inputAudioFifos_ != nullptr);
 
-    outputAudioFifos_ = new FIFO*[numOutputChannels];
+    outputAudioFifos_ = new std::atomic<AudioRingBuffer*>[numOutputChannels];
     assert(outputAudioFifos_ != nullptr);
 
-    for (int index = 0; index < numInputChannels; index++)
+    outputClaimEpochs_ = new std::atomic<uint32_t>[numOutputChannels];
+    assert(outputClaimEpochs_ != nullptr);
+
+    inputSampleRates_ = new uint32_t[numChannels_];
+    assert(inputSampleRates_ != nullptr);
+
+    outputSampleRates_ = new uint32_t[numOutputChannels];
+    assert(outputSampleRates_ != nullptr);
+
+    floatInputAudioFifos_ = new AudioFloatRingBuffer*[numChannels_];
+    assert(floatInputAudioFifos_ != nullptr);
+
+    floatInputActive_ = new std::atomic<bool>[numChannels_];
+    assert(floatInputActive_ != nullptr);
+
+    floatOutputAudioFifos_ = new std::atomic<AudioFloatRingBuffer*>[numOutputChannels];
+    assert(floatOutputAudioFifos_ != nullptr);
+
+    floatOutputSupported_ = new bool[numOutputChannels];
+    assert(floatOutputSupported_ != nullptr);
+
+    int index = 0;
+    for (auto frameSize : inputFrameSizes)
     {
-        inputAudioFifos_[index] = codec2_fifo_create(numSamplesInFifo);
+        inputAudioFifos_[index] = new AudioRingBuffer(GetFifoSize(frameSize));
         assert(inputAudioFifos_[index] != nullptr);
+        inputSampleRates_[index] = AUDIO_DEFAULT_SAMPLE_RATE;
+        floatInputAudioFifos_[index] = nullptr;
+        floatInputActive_[index].store(false, std::memory_order_relaxed);
+        index++;
     }
 
-    for (int index = 0; index < numOutputChannels; index++)
+    for (index = 0; index < numOutputChannels; index++)
     {
-        outputAudioFifos_[index] = nullptr;
+        outputAudioFifos_[index].store(nullptr, std::memory_order_relaxed);
+        outputClaimEpochs_[index].store(0, std::memory_order_relaxed);
+        outputSampleRates_[index] = AUDIO_DEFAULT_SAMPLE_RATE;
+        floatOutputAudioFifos_[index].store(nullptr, std::memory_order_relaxed);
+        floatOutputSupported_[index] = false;
     }
+
+    AudioGraph::AddNode_(this);
 }
 
 AudioInput::~AudioInput()
 {
+    AudioGraph::RemoveNode_(this);
+
     for (int index = 0; index < numChannels_; index++)
     {
-        codec2_fifo_free(inputAudioFifos_[index]);
+        delete inputAudioFifos_[index];
+        delete floatInputAudioFifos_[index];
     }
 
     delete[] inputAudioFifos_;
+    delete[] outputAudioFifos_;
+    delete[] outputClaimEpochs_;
+    delete[] inputSampleRates_;
+    delete[] outputSampleRates_;
+    delete[] floatInputAudioFifos_;
+    delete[] floatInputActive_;
+    delete[] floatOutputAudioFifos_;
+    delete[] floatOutputSupported_;
 }
 
-struct FIFO* AudioInput::getAudioInput(ChannelLabel channel)
+AudioRingBuffer* AudioInput::getAudioInput(ChannelLabel channel)
 {
     return inputAudioFifos_[(int)channel];
 }
 
-void AudioInput::setAudioOutput(ChannelLabel channel, struct FIFO* fifo)
+void AudioInput::setAudioOutput(ChannelLabel channel, AudioRingBuffer* fifo)
+{
+    // seq_cst pairs with OutputClaim (see waitForOutputClaim_()).
+    outputAudioFifos_[(int)channel].store(fifo, std::memory_order_seq_cst);
+}
+
+AudioRingBuffer* AudioInput::getAudioOutput(ChannelLabel channel)
+{
+    return outputAudioFifos_[(int)channel].load(std::memory_order_acquire);
+}
+
+void AudioInput::enableFloatAudioInput(ChannelLabel channel)
+{
+    assert((int)channel < numChannels_);
+    assert(floatInputAudioFifos_[(int)channel] == nullptr);
+
+    // Same latency as the regular FIFO, just twice the memory.
+    floatInputAudioFifos_[(int)channel] = new AudioFloatRingBuffer(inputAudioFifos_[(int)channel]->capacity());
+    assert(floatInputAudioFifos_[(int)channel] != nullptr);
+}
+
+AudioFloatRingBuffer* AudioInput::getFloatAudioInput(ChannelLabel channel)
+{
+    return floatInputAudioFifos_[(int)channel];
+}
+
+bool AudioInput::isFloatAudioInputActive(ChannelLabel channel) const
+{
+    return floatInputActive_[(int)channel].load(std::memory_order_acquire);
+}
+
+void AudioInput::setFloatAudioInputActive_(ChannelLabel channel, bool active)
+{
+    floatInputActive_[(int)channel].store(active, std::memory_order_release);
+}
+
+void AudioInput::enableFloatAudioOutput(ChannelLabel channel)
+{
+    assert((int)channel < numOutputChannels_);
+    floatOutputSupported_[(int)channel] = true;
+}
+
+bool AudioInput::supportsFloatAudioOutput(ChannelLabel channel) const
+{
+    return floatOutputSupported_[(int)channel];
+}
+
+void AudioInput::setFloatAudioOutput(ChannelLabel channel, AudioFloatRingBuffer* fifo)
+{
+    floatOutputAudioFifos_[(int)channel].store(fifo, std::memory_order_seq_cst);
+}
+
+AudioFloatRingBuffer* AudioInput::getFloatAudioOutput(ChannelLabel channel)
+{
+    return floatOutputAudioFifos_[(int)channel].load(std::memory_order_acquire);
+}
+
+void AudioInput::waitForOutputClaim_(ChannelLabel channel)
+{
+    // The caller has already disconnected the channel. Each side stores 
+    // before it loads (the claim its epoch, us the FIFO pointer), so either 
+    // the claim sees the new pointer or we see it in progress here. Waiting 
+    // for the epoch to move rather than to become even keeps a producer that
+    // claims again right away from holding us up.
+    uint32_t epoch = outputClaimEpochs_[(int)channel].load(std::memory_order_seq_cst);
+    if (epoch & 1)
+    {
+        while (outputClaimEpochs_[(int)channel].load(std::memory_order_acquire) == epoch)
+        {
+            vTaskDelay(1);
+        }
+    }
+}
+
+AudioInput::OutputClaim::OutputClaim(AudioInput* node, ChannelLabel channel)
+    : node_(node)
+    , channel_(channel)
+{
+    assert((int)channel < node_->numOutputChannels_);
+
+    uint32_t epoch = node_->outputClaimEpochs_[(int)channel].fetch_add(1, std::memory_order_seq_cst);
+    assert((epoch & 1) == 0);
+
+    fifo_ = node_->outputAudioFifos_[(int)channel].load(std::memory_order_seq_cst);
+    floatFifo_ = node_->floatOutputAudioFifos_[(int)channel].load(std::memory_order_seq_cst);
+}
+
+AudioInput::OutputClaim::~OutputClaim()
+{
+    node_->outputClaimEpochs_[(int)channel_].fetch_add(1, std::memory_order_release);
+}
+
+AudioRingBuffer* AudioInput::OutputClaim::fifo() const
+{
+    return fifo_;
+}
+
+AudioFloatRingBuffer* AudioInput::OutputClaim::floatFifo() const
+{
+    return floatFifo_;
+}
+
+static void RequestConsumerTick_(void* arg)
+{
+    ((task::DVTask*)arg)->requestTick();
+}
+
+void AudioInput::setAudioInputNotification(ChannelLabel channel, task::DVTask* task, uint32_t threshold)
+{
+    assert((int)channel < numChannels_);
+    assert(task != nullptr);
+
+    inputAudioFifos_[(int)channel]->setConsumerNotification(&RequestConsumerTick_, task, threshold);
+    if (floatInputAudioFifos_[(int)channel] != nullptr)
+    {
+        floatInputAudioFifos_[(int)channel]->setConsumerNotification(&RequestConsumerTick_, task, threshold);
+    }
+}
+
+void AudioInput::setAudioInputNotification(ChannelLabel channel, AudioRingBuffer::NotifyFn fn, void* arg, uint32_t threshold)
+{
+    assert((int)channel < numChannels_);
+    inputAudioFifos_[(int)channel]->setConsumerNotification(fn, arg, threshold);
+    if (floatInputAudioFifos_[(int)channel] != nullptr)
+    {
+        floatInputAudioFifos_[(int)channel]->setConsumerNotification(fn, arg, threshold);
+    }
+}
+
+void AudioInput::setAudioInputThreshold(ChannelLabel channel, uint32_t threshold)
+{
+    assert((int)channel < numChannels_);
+    inputAudioFifos_[(int)channel]->setNotificationThreshold(threshold);
+    if (floatInputAudioFifos_[(int)channel] != nullptr)
+    {
+        floatInputAudioFifos_[(int)channel]->setNotificationThreshold(threshold);
+    }
+}
+
+void AudioInput::setInputSampleRate(ChannelLabel channel, uint32_t sampleRate)
+{
+    assert((int)channel < numChannels_);
+    inputSampleRates_[(int)channel] = sampleRate;
+}
+
+uint32_t AudioInput::getInputSampleRate(ChannelLabel channel) const
+{
+    return inputSampleRates_[(int)channel];
+}
+
+void AudioInput::setOutputSampleRate(ChannelLabel channel, uint32_t sampleRate)
+{
+    assert((int)channel < numOutputChannels_);
+    outputSampleRates_[(int)channel] = sampleRate;
+}
+
+uint32_t AudioInput::getOutputSampleRate(ChannelLabel channel) const
+{
+    return outputSampleRates_[(int)channel];
+}
+
+uint32_t AudioInput::GetFifoSize(uint32_t frameSize)
+{
+    if (frameSize == AUDIO_INPUT_UNUSED)
+    {
+        // Still needs to exist so that getAudioInput() never returns null.
+        return 1;
+    }
+
+    return frameSize * FIFO_FRAMES_PER_LINK + FIFO_JITTER_SAMPLES;
+}
+
+const char* AudioInput::getAudioNodeName() const
+{
+    return name_;
+}
+
+int8_t AudioInput::getNumInputChannels() const
 {
-    outputAudioFifos_[(int)channel] = fifo;
+    return numChannels_;
 }
 
-struct FIFO* AudioInput::getAudioOutput(ChannelLabel channel)
+int8_t AudioInput::getNumOutputChannels() const
 {
-    return outputAudioFifos_[(int)channel];
+    return numOutputChannels_;
 }
 
 }
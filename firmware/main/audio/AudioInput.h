@@ -18,16 +18,32 @@
 #ifndef AUDIO_INPUT_H
 #define AUDIO_INPUT_H
 
+#include <atomic>
+#include <initializer_list>
 #include <inttypes.h>
 
-#include "codec2_fifo.h"
+#include "AudioRingBuffer.h"
 
 // 0.5s @ 8000 Hz
-#define DEFAULT_NUM_SAMPLES_FOR_FIFO 4000
+// Sample rate used by every link unless configured otherwise.
+#define AUDIO_DEFAULT_SAMPLE_RATE (8000)
+
+// Frame size to use for input channels that nothing ever writes to.
+#define AUDIO_INPUT_UNUSED (0)
+
+// Largest number of samples FreeDVTask reads or writes at once 
+// (700D: 1280 per modem frame, plus up to a quarter symbol of 
+// timing adjustment on receive).
+#define FREEDV_MAX_FRAME_SAMPLES (1320)
 
 namespace ezdv
 {
 
+namespace task
+{
+    class DVTask;
+}
+
 namespace audio
 {
 
@@ -45,28 +61,168 @@ public:
     };
 
     /// @brief Creates an instance of AudioInput.
-    /// @param numInputChannels The number of input channels to support.
+    /// @param name The name to report this node as in telemetry (usually the task name).
     /// @param numOutputChannels The number of output channels to support.
-    /// @param numSamplesInFifo The number of input samples per FIFO.
-    AudioInput(int8_t numInputChannels, int8_t numOutputChannels, uint32_t numSamplesInFifo = DEFAULT_NUM_SAMPLES_FOR_FIFO);
+    /// @param inputFrameSizes For each input channel, the largest number of samples
+    ///        written to or read from it at once. FIFOs are sized from these
+    ///        according to the configured audio latency profile.
+    AudioInput(const char* name, int8_t numOutputChannels, std::initializer_list<uint32_t> inputFrameSizes);
     virtual ~AudioInput();
 
     /// @brief Retrieves the input FIFO for the given channel.
     /// @param channel The channel to retrieve the FIFO for.
-    struct FIFO* getAudioInput(ChannelLabel channel);
+    AudioRingBuffer* getAudioInput(ChannelLabel channel);
 
     /// @brief Stores a link to the output FIFO on the given channel.
+    /// @note Use AudioGraph to change routes while audio is flowing.
     /// @param channel The channel to set the output FIFO for.
     /// @param fifo The FIFO to set the channel's output to.
-    void setAudioOutput(ChannelLabel channel, struct FIFO* fifo);
+    void setAudioOutput(ChannelLabel channel, AudioRingBuffer* fifo);
 
     /// @brief Retrieves the output FIFO for the given channel.
+    /// @note Producers write through an OutputClaim instead, so that a route
+    ///       change can't hand the FIFO to another source mid-write.
     /// @param channel The channel to retrieve the FIFO for.
-    struct FIFO* getAudioOutput(ChannelLabel channel);
+    AudioRingBuffer* getAudioOutput(ChannelLabel channel);
+
+    /// @brief Gives the given input channel a second FIFO carrying float samples,
+    ///        used instead of the usual one whenever the channel's producer can
+    ///        write floats (see enableFloatAudioOutput()). Must be called 
+    ///        before the channel is routed or has notifications set up.
+    /// @param channel The channel to enable float audio on.
+    void enableFloatAudioInput(ChannelLabel channel);
+
+    /// @brief Retrieves the float input FIFO for the given channel.
+    /// @return The FIFO, or nullptr if enableFloatAudioInput() wasn't called.
+    AudioFloatRingBuffer* getFloatAudioInput(ChannelLabel channel);
+
+    /// @brief Returns true if the given channel's current producer writes to
+    ///        the float FIFO rather than the usual one.
+    bool isFloatAudioInputActive(ChannelLabel channel) const;
+
+    /// @brief Indicates that this node can write float samples on the given 
+    ///        output channel. AudioGraph connects it to a sink's float FIFO
+    ///        when there is one and no rate conversion is needed.
+    /// @param channel The channel to enable float audio on.
+    void enableFloatAudioOutput(ChannelLabel channel);
+
+    /// @brief Returns true if enableFloatAudioOutput() was called for the given channel.
+    bool supportsFloatAudioOutput(ChannelLabel channel) const;
+
+    /// @brief Stores a link to the float output FIFO on the given channel.
+    /// @note Use AudioGraph to change routes while audio is flowing.
+    /// @param channel The channel to set the output FIFO for.
+    /// @param fifo The FIFO to set the channel's output to.
+    void setFloatAudioOutput(ChannelLabel channel, AudioFloatRingBuffer* fifo);
+
+    /// @brief Retrieves the float output FIFO for the given channel. At most one
+    ///        of this and getAudioOutput() is non-null at a time.
+    /// @param channel The channel to retrieve the FIFO for.
+    AudioFloatRingBuffer* getFloatAudioOutput(ChannelLabel channel);
+
+    /// @brief Holds one of a node's output channels while its producer writes
+    ///        to it. AudioGraph waits for any claim that may have seen the old
+    ///        FIFO before connecting that FIFO to another source. Claims 
+    ///        should be short (e.g. a single tick's writes) and must not be 
+    ///        nested on the same channel.
+    class OutputClaim
+    {
+    public:
+        OutputClaim(AudioInput* node, ChannelLabel channel);
+        ~OutputClaim();
+
+        /// @brief The output FIFO as of when the claim was made, or nullptr
+        ///        if the channel isn't connected.
+        AudioRingBuffer* fifo() const;
+
+        /// @brief The float output FIFO as of when the claim was made (see
+        ///        getFloatAudioOutput()).
+        AudioFloatRingBuffer* floatFifo() const;
+
+    private:
+        AudioInput* node_;
+        ChannelLabel channel_;
+        AudioRingBuffer* fifo_;
+        AudioFloatRingBuffer* floatFifo_;
+    };
+
+    /// @brief Runs the given task's onTaskTick_() whenever the input FIFO on
+    ///        the given channel has at least threshold samples, instead of 
+    ///        it having to poll. Must be called before audio starts flowing.
+    /// @param channel The channel to watch.
+    /// @param task The task consuming the FIFO (usually this one).
+    /// @param threshold The number of samples to wait for, or 0 to disable.
+    void setAudioInputNotification(ChannelLabel channel, task::DVTask* task, uint32_t threshold);
+
+    /// @brief Calls the given function whenever the input FIFO on the given 
+    ///        channel has at least threshold samples. The function runs in 
+    ///        the producer's task.
+    /// @param channel The channel to watch.
+    /// @param fn The function to call.
+    /// @param arg The argument to pass to fn.
+    /// @param threshold The number of samples to wait for, or 0 to disable.
+    void setAudioInputNotification(ChannelLabel channel, AudioRingBuffer::NotifyFn fn, void* arg, uint32_t threshold);
+
+    /// @brief Changes the number of samples needed before the task is notified.
+    /// @param channel The channel to change.
+    /// @param threshold The number of samples to wait for, or 0 to disable.
+    void setAudioInputThreshold(ChannelLabel channel, uint32_t threshold);
+
+    /// @brief Sets the sample rate this node expects on the given input channel.
+    ///        AudioGraph converts audio from sources running at other rates. 
+    ///        Must be set before the channel is routed.
+    /// @param channel The channel to set the rate for.
+    /// @param sampleRate The sample rate in Hz.
+    void setInputSampleRate(ChannelLabel channel, uint32_t sampleRate);
+
+    /// @brief Returns the sample rate expected on the given input channel.
+    uint32_t getInputSampleRate(ChannelLabel channel) const;
+
+    /// @brief Sets the sample rate of audio produced on the given output channel.
+    /// @param channel The channel to set the rate for.
+    /// @param sampleRate The sample rate in Hz.
+    void setOutputSampleRate(ChannelLabel channel, uint32_t sampleRate);
+
+    /// @brief Returns the sample rate of audio produced on the given output channel.
+    uint32_t getOutputSampleRate(ChannelLabel channel) const;
+
+    /// @brief Returns the FIFO size used for a link with the given frame size.
+    /// @param frameSize The largest number of samples written or read at once.
+    static uint32_t GetFifoSize(uint32_t frameSize);
+
+    /// @brief Returns the name given to this node.
+    const char* getAudioNodeName() const;
+
+    /// @brief Returns the number of input channels.
+    int8_t getNumInputChannels() const;
+
+    /// @brief Returns the number of output channels.
+    int8_t getNumOutputChannels() const;
 private:
-    struct FIFO** inputAudioFifos_;
-    struct FIFO** outputAudioFifos_;
+    friend class AudioGraph;
+
+    const char* name_;
+    AudioRingBuffer** inputAudioFifos_;
+
+    // Outputs can be rerouted by other tasks at any time (see AudioGraph).
+    std::atomic<AudioRingBuffer*>* outputAudioFifos_;
+
+    // Incremented when an OutputClaim starts and again when it ends, so it's
+    // odd while the producer may be writing.
+    std::atomic<uint32_t>* outputClaimEpochs_;
+
+    // Float links (only allocated if a channel is enabled for them).
+    AudioFloatRingBuffer** floatInputAudioFifos_;
+    std::atomic<bool>* floatInputActive_;
+    std::atomic<AudioFloatRingBuffer*>* floatOutputAudioFifos_;
+    bool* floatOutputSupported_;
     int8_t numChannels_;
+    int8_t numOutputChannels_;
+    uint32_t* inputSampleRates_;
+    uint32_t* outputSampleRates_;
+
+    void setFloatAudioInputActive_(ChannelLabel channel, bool active);
+    void waitForOutputClaim_(ChannelLabel channel);
 };
 
 }
@@ -0,0 +1,374 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "AudioGraph.h"
+#include "AudioLatencyProbe.h"
+
+#define CURRENT_LOG_TAG ("AudioLatencyProbe")
+
+#define LATENCY_PROBE_TIMER_INTERVAL_US (100000)
+
+// Gives up on a trial whose burst hasn't arrived after this long.
+#define LATENCY_PROBE_TRIAL_TIMEOUT_US (2000000)
+
+// Silence before the burst so that audio already in flight can't be 
+// mistaken for it.
+#define LATENCY_PROBE_GUARD_MS (200)
+#define LATENCY_PROBE_BURST_MS (20)
+#define LATENCY_PROBE_BURST_HZ (1000)
+#define LATENCY_PROBE_BURST_AMPLITUDE (29000)
+
+// Low enough to survive rate conversion and the mixer's default gain.
+#define LATENCY_PROBE_DETECT_THRESHOLD (8192)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioLatencyProbe::AudioLatencyProbe()
+    : DVTask("AudioLatencyProbe", 2, 4096, tskNO_AFFINITY, 8)
+    , trialTimer_(this, this, &AudioLatencyProbe::onTrialTimer_, LATENCY_PROBE_TIMER_INTERVAL_US, "LatencyProbeTimer")
+    , requestedTrial_(0)
+    , sourceSampleRate_(AUDIO_DEFAULT_SAMPLE_RATE)
+    , armedTrial_(0)
+    , markerTimeUs_(0)
+    , detectedTrial_(0)
+    , detectedLatencyUs_(0)
+    , injectedTrial_(0)
+    , injectPosition_(0)
+    , running_(false)
+    , requester_(nullptr)
+    , fd_(0)
+    , sourceChannel_(AudioInput::LEFT_CHANNEL)
+    , sinkChannel_(AudioInput::LEFT_CHANNEL)
+    , currentTrial_(0)
+    , trialStartUs_(0)
+    , numTrials_(0)
+    , numTrialsDone_(0)
+    , numDetected_(0)
+{
+    memset(source_, 0, sizeof(source_));
+    memset(sink_, 0, sizeof(sink_));
+
+    registerMessageHandlers<
+        &AudioLatencyProbe::onStartAudioLatencyProbeMessage_>(this);
+}
+
+AudioLatencyProbe::~AudioLatencyProbe()
+{
+    trialTimer_.stop();
+    detach_();
+}
+
+void AudioLatencyProbe::onTaskStart_()
+{
+    // empty, probes are started on request
+}
+
+void AudioLatencyProbe::onTaskSleep_()
+{
+    // Report whatever we have so far.
+    if (running_)
+    {
+        finish_();
+    }
+}
+
+void AudioLatencyProbe::onStartAudioLatencyProbeMessage_(DVTask* origin, StartAudioLatencyProbeMessage* message)
+{
+    if (running_)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Probe already running");
+
+        AudioLatencyProbeResultMessage response(message->fd);
+        sendTo(origin, &response);
+        return;
+    }
+
+    requester_ = origin;
+    fd_ = message->fd;
+    strncpy(source_, message->source, sizeof(source_) - 1);
+    sourceChannel_ = message->sourceChannel;
+    strncpy(sink_, message->sink, sizeof(sink_) - 1);
+    sinkChannel_ = message->sinkChannel;
+    numTrials_ = message->numTrials > 0 ? std::min((uint16_t)MAX_TRIALS, message->numTrials) : (uint16_t)DEFAULT_TRIALS;
+    numTrialsDone_ = 0;
+    numDetected_ = 0;
+
+    if (!attach_())
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not find %s/%d or %s/%d", source_, (int)sourceChannel_, sink_, (int)sinkChannel_);
+        detach_();
+
+        AudioLatencyProbeResultMessage response(fd_);
+        sendTo(requester_, &response);
+        return;
+    }
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "Measuring %s/%d -> %s/%d over %d trials", 
+        source_, (int)sourceChannel_, sink_, (int)sinkChannel_, numTrials_);
+
+    running_ = true;
+    trialStartUs_ = 0;
+    trialTimer_.start();
+}
+
+void AudioLatencyProbe::onTrialTimer_(DVTimer*)
+{
+    int64_t nowUs = esp_timer_get_time();
+
+    if (trialStartUs_ != 0)
+    {
+        if (detectedTrial_.load(std::memory_order_acquire) == currentTrial_)
+        {
+            latenciesUs_[numDetected_++] = detectedLatencyUs_.load(std::memory_order_relaxed);
+        }
+        else if (nowUs - trialStartUs_ < LATENCY_PROBE_TRIAL_TIMEOUT_US)
+        {
+            // Still waiting for the burst.
+            return;
+        }
+        else
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Trial %d timed out", numTrialsDone_ + 1);
+        }
+
+        if (++numTrialsDone_ >= numTrials_)
+        {
+            finish_();
+            return;
+        }
+    }
+
+    currentTrial_++;
+    trialStartUs_ = nowUs;
+    requestedTrial_.store(currentTrial_, std::memory_order_release);
+}
+
+bool AudioLatencyProbe::attach_()
+{
+    bool found = true;
+
+    for (bool isSource : { true, false })
+    {
+        auto node = AudioGraph::FindNode(isSource ? source_ : sink_);
+        auto channel = isSource ? sourceChannel_ : sinkChannel_;
+        if (node == nullptr || channel >= node->getNumInputChannels())
+        {
+            found = false;
+            continue;
+        }
+
+        if (isSource)
+        {
+            sourceSampleRate_.store(node->getInputSampleRate(channel), std::memory_order_relaxed);
+        }
+
+        // Only the FIFO currently in use sees any audio.
+        if (node->isFloatAudioInputActive(channel))
+        {
+            auto fifo = node->getFloatAudioInput(channel);
+            if (isSource)
+            {
+                fifo->setProducerProbe(&OnSourceWrite_<float>, this);
+            }
+            else
+            {
+                fifo->setConsumerProbe(&OnSinkRead_<float>, this);
+            }
+        }
+        else if (node->getAudioInput(channel) != nullptr)
+        {
+            auto fifo = node->getAudioInput(channel);
+            if (isSource)
+            {
+                fifo->setProducerProbe(&OnSourceWrite_<short>, this);
+            }
+            else
+            {
+                fifo->setConsumerProbe(&OnSinkRead_<short>, this);
+            }
+        }
+        else
+        {
+            found = false;
+        }
+    }
+
+    return found;
+}
+
+void AudioLatencyProbe::detach_()
+{
+    // Nodes are looked up again in case one went away (or the route changed 
+    // to the other FIFO) during the run.
+    for (bool isSource : { true, false })
+    {
+        auto node = AudioGraph::FindNode(isSource ? source_ : sink_);
+        auto channel = isSource ? sourceChannel_ : sinkChannel_;
+        if (node == nullptr || channel >= node->getNumInputChannels())
+        {
+            continue;
+        }
+
+        auto floatFifo = node->getFloatAudioInput(channel);
+        auto fifo = node->getAudioInput(channel);
+        if (floatFifo != nullptr)
+        {
+            if (isSource)
+            {
+                floatFifo->setProducerProbe(nullptr, this);
+            }
+            else
+            {
+                floatFifo->setConsumerProbe(nullptr, this);
+            }
+        }
+
+        if (fifo != nullptr)
+        {
+            if (isSource)
+            {
+                fifo->setProducerProbe(nullptr, this);
+            }
+            else
+            {
+                fifo->setConsumerProbe(nullptr, this);
+            }
+        }
+    }
+}
+
+void AudioLatencyProbe::finish_()
+{
+    trialTimer_.stop();
+    detach_();
+    running_ = false;
+
+    AudioLatencyProbeResultMessage response(fd_);
+    auto& result = response.result;
+    result.success = true;
+    result.numTrials = numTrialsDone_;
+    result.numDetected = numDetected_;
+
+    if (numDetected_ > 0)
+    {
+        std::sort(latenciesUs_, latenciesUs_ + numDetected_);
+
+        uint64_t totalUs = 0;
+        for (int index = 0; index < numDetected_; index++)
+        {
+            totalUs += latenciesUs_[index];
+        }
+
+        result.minUs = latenciesUs_[0];
+        result.averageUs = totalUs / numDetected_;
+        result.p50Us = latenciesUs_[(numDetected_ - 1) * 50 / 100];
+        result.p90Us = latenciesUs_[(numDetected_ - 1) * 90 / 100];
+        result.p99Us = latenciesUs_[(numDetected_ - 1) * 99 / 100];
+        result.maxUs = latenciesUs_[numDetected_ - 1];
+    }
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "%s/%d -> %s/%d: %d of %d detected, min %" PRIu32 " avg %" PRIu32 " p50 %" PRIu32 " p90 %" PRIu32 " p99 %" PRIu32 " max %" PRIu32 " us",
+        source_, (int)sourceChannel_, sink_, (int)sinkChannel_, 
+        result.numDetected, result.numTrials,
+        result.minUs, result.averageUs, result.p50Us, result.p90Us, result.p99Us, result.maxUs);
+
+    sendTo(requester_, &response);
+}
+
+template<typename SampleType>
+void AudioLatencyProbe::OnSourceWrite_(void* arg, typename AudioRingBufferBase<SampleType>::Span& span)
+{
+    // Runs in the source's producer.
+    auto thisObj = (AudioLatencyProbe*)arg;
+
+    uint32_t requestedTrial = thisObj->requestedTrial_.load(std::memory_order_acquire);
+    if (requestedTrial != thisObj->injectedTrial_)
+    {
+        thisObj->injectedTrial_ = requestedTrial;
+        thisObj->injectPosition_ = 0;
+    }
+
+    uint32_t sampleRate = thisObj->sourceSampleRate_.load(std::memory_order_relaxed);
+    uint32_t guardSamples = LATENCY_PROBE_GUARD_MS * sampleRate / 1000;
+    uint32_t markerSamples = guardSamples + LATENCY_PROBE_BURST_MS * sampleRate / 1000;
+    if (requestedTrial == 0 || thisObj->injectPosition_ >= markerSamples)
+    {
+        return;
+    }
+
+    for (uint32_t index = 0; index < span.size() && thisObj->injectPosition_ < markerSamples; index++)
+    {
+        uint32_t position = thisObj->injectPosition_++;
+        if (position < guardSamples)
+        {
+            span[index] = 0;
+            continue;
+        }
+
+        if (position == guardSamples)
+        {
+            // The samples aren't visible to the consumer until after we return.
+            thisObj->markerTimeUs_.store((uint32_t)esp_timer_get_time(), std::memory_order_relaxed);
+            thisObj->armedTrial_.store(requestedTrial, std::memory_order_release);
+        }
+
+        float phase = 2 * M_PI * LATENCY_PROBE_BURST_HZ * (position - guardSamples) / sampleRate;
+        span[index] = (SampleType)(LATENCY_PROBE_BURST_AMPLITUDE * sinf(phase));
+    }
+}
+
+template<typename SampleType>
+void AudioLatencyProbe::OnSinkRead_(void* arg, typename AudioRingBufferBase<SampleType>::Span& span)
+{
+    // Runs in the sink's consumer.
+    auto thisObj = (AudioLatencyProbe*)arg;
+
+    uint32_t armedTrial = thisObj->armedTrial_.load(std::memory_order_acquire);
+    if (armedTrial == 0 || armedTrial == thisObj->detectedTrial_.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    for (uint32_t index = 0; index < span.size(); index++)
+    {
+        if (span[index] >= LATENCY_PROBE_DETECT_THRESHOLD || span[index] <= -LATENCY_PROBE_DETECT_THRESHOLD)
+        {
+            uint32_t latencyUs = (uint32_t)esp_timer_get_time() - thisObj->markerTimeUs_.load(std::memory_order_relaxed);
+            thisObj->detectedLatencyUs_.store(latencyUs, std::memory_order_relaxed);
+            thisObj->detectedTrial_.store(armedTrial, std::memory_order_release);
+            break;
+        }
+    }
+}
+
+}
+
+}
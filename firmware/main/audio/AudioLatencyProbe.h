@@ -0,0 +1,109 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_LATENCY_PROBE_H
+#define AUDIO_LATENCY_PROBE_H
+
+#include <atomic>
+
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+#include "AudioLatencyProbeMessage.h"
+#include "AudioRingBuffer.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Measures end-to-end delay between two points in the audio graph. 
+///        Each trial replaces the audio written to the source input with a 
+///        short stretch of silence followed by a tone burst, then waits for
+///        the burst to come out of the sink input. Anything in between (other
+///        buffers, rate converters, tasks and analog mode FreeDV) is included;
+///        digital FreeDV modes don't pass the marker through, so measure 
+///        either side of the modem separately. Started with 
+///        StartAudioLatencyProbeMessage; results are logged and sent back 
+///        in an AudioLatencyProbeResultMessage.
+class AudioLatencyProbe : public DVTask
+{
+public:
+    enum { MAX_TRIALS = 200, DEFAULT_TRIALS = 50 };
+
+    AudioLatencyProbe();
+    virtual ~AudioLatencyProbe();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    DVTimer trialTimer_;
+
+    // Set by the probe task for the source's producer.
+    std::atomic<uint32_t> requestedTrial_;
+    std::atomic<uint32_t> sourceSampleRate_;
+
+    // Set by the source's producer when the burst starts.
+    std::atomic<uint32_t> armedTrial_;
+    std::atomic<uint32_t> markerTimeUs_;
+
+    // Set by the sink's consumer when the burst arrives.
+    std::atomic<uint32_t> detectedTrial_;
+    std::atomic<uint32_t> detectedLatencyUs_;
+
+    // Only used by the source's producer.
+    uint32_t injectedTrial_;
+    uint32_t injectPosition_;
+
+    // Only used by the probe task.
+    bool running_;
+    DVTask* requester_;
+    int fd_;
+    char source_[StartAudioLatencyProbeMessage::MAX_STR_SIZE];
+    AudioInput::ChannelLabel sourceChannel_;
+    char sink_[StartAudioLatencyProbeMessage::MAX_STR_SIZE];
+    AudioInput::ChannelLabel sinkChannel_;
+    uint32_t currentTrial_; // keeps counting across runs so old trials never match
+    int64_t trialStartUs_;
+    uint16_t numTrials_;
+    uint16_t numTrialsDone_;
+    uint16_t numDetected_;
+    uint32_t latenciesUs_[MAX_TRIALS];
+
+    void onStartAudioLatencyProbeMessage_(DVTask* origin, StartAudioLatencyProbeMessage* message);
+    void onTrialTimer_(DVTimer*);
+
+    bool attach_();
+    void detach_();
+    void finish_();
+
+    template<typename SampleType>
+    static void OnSourceWrite_(void* arg, typename AudioRingBufferBase<SampleType>::Span& span);
+
+    template<typename SampleType>
+    static void OnSinkRead_(void* arg, typename AudioRingBufferBase<SampleType>::Span& span);
+};
+
+}
+
+}
+
+#endif // AUDIO_LATENCY_PROBE_H
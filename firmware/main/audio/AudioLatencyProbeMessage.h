@@ -0,0 +1,112 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_LATENCY_PROBE_MESSAGE_H
+#define AUDIO_LATENCY_PROBE_MESSAGE_H
+
+#include <cstring>
+
+#include "task/DVTaskMessage.h"
+#include "AudioInput.h"
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(AUDIO_LATENCY_PROBE_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+enum AudioLatencyProbeMessageTypes
+{
+    START_LATENCY_PROBE = 1,
+    LATENCY_PROBE_RESULT = 2,
+};
+
+/// @brief Summary of a latency probe run. All times are in microseconds.
+struct AudioLatencyProbeResult
+{
+    bool success; // false if the probe couldn't start (e.g. unknown node)
+    uint16_t numTrials;
+    uint16_t numDetected; // the rest timed out
+    uint32_t minUs;
+    uint32_t averageUs;
+    uint32_t p50Us;
+    uint32_t p90Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+};
+
+class StartAudioLatencyProbeMessage : public DVTaskMessageBase<START_LATENCY_PROBE, StartAudioLatencyProbeMessage>
+{
+public:
+    enum { MAX_STR_SIZE = 24 };
+
+    StartAudioLatencyProbeMessage(
+        int fdProvided = 0, 
+        const char* sourceProvided = "", AudioInput::ChannelLabel sourceChannelProvided = AudioInput::LEFT_CHANNEL,
+        const char* sinkProvided = "", AudioInput::ChannelLabel sinkChannelProvided = AudioInput::LEFT_CHANNEL,
+        uint16_t numTrialsProvided = 0)
+        : DVTaskMessageBase<START_LATENCY_PROBE, StartAudioLatencyProbeMessage>(AUDIO_LATENCY_PROBE_MESSAGE)
+        , fd(fdProvided)
+        , sourceChannel(sourceChannelProvided)
+        , sinkChannel(sinkChannelProvided)
+        , numTrials(numTrialsProvided)
+    {
+        memset(source, 0, sizeof(source));
+        strncpy(source, sourceProvided, sizeof(source) - 1);
+        memset(sink, 0, sizeof(sink));
+        strncpy(sink, sinkProvided, sizeof(sink) - 1);
+    }
+    virtual ~StartAudioLatencyProbeMessage() = default;
+
+    int fd; // passed back in the result
+
+    // The marker is injected as the source input is written and detected as 
+    // the sink input is read.
+    char source[MAX_STR_SIZE];
+    AudioInput::ChannelLabel sourceChannel;
+    char sink[MAX_STR_SIZE];
+    AudioInput::ChannelLabel sinkChannel;
+    uint16_t numTrials; // 0 for the default
+};
+
+class AudioLatencyProbeResultMessage : public DVTaskMessageBase<LATENCY_PROBE_RESULT, AudioLatencyProbeResultMessage>
+{
+public:
+    AudioLatencyProbeResultMessage(int fdProvided = 0)
+        : DVTaskMessageBase<LATENCY_PROBE_RESULT, AudioLatencyProbeResultMessage>(AUDIO_LATENCY_PROBE_MESSAGE)
+        , fd(fdProvided)
+    {
+        memset(&result, 0, sizeof(result));
+    }
+    virtual ~AudioLatencyProbeResultMessage() = default;
+
+    int fd;
+    AudioLatencyProbeResult result;
+};
+
+}
+
+}
+
+#endif // AUDIO_LATENCY_PROBE_MESSAGE_H
@@ -15,30 +15,107 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
 #include "AudioMixer.h"
 
+#include "esp_dsp.h"
+
 #define AUDIO_MIXER_TIMER_TICK_US (20000)
 #define AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL 160
 
+// BeeperTask writes one 80ms CW element at a time.
+#define AUDIO_MIXER_MAX_BEEPER_SAMPLES 640
+
+// VoiceKeyerTask may write two 20ms blocks at once when catching up.
+#define AUDIO_MIXER_MAX_KEYER_SAMPLES 320
+
+// Ducking continues for this many ticks after the trigger goes quiet so
+// that it doesn't flap during short gaps (e.g. between CW elements).
+#define AUDIO_MIXER_DUCK_HOLD_TICKS 10
+
 namespace ezdv
 {
 
 namespace audio
 {
 
+static short* GetContiguous_(AudioRingBuffer::Span& span, uint32_t index, uint32_t* maxLength)
+{
+    // Returns the location of span[index] and shortens maxLength to however 
+    // many samples follow it in the same half of the span.
+    if (index < span.firstLength)
+    {
+        *maxLength = std::min(*maxLength, span.firstLength - index);
+        return span.first + index;
+    }
+    else
+    {
+        index -= span.firstLength;
+        *maxLength = std::min(*maxLength, span.secondLength - index);
+        return span.second + index;
+    }
+}
+
 AudioMixer::AudioMixer()
-    : DVTask("AudioMixer", 15, 3144, tskNO_AFFINITY, 16, pdMS_TO_TICKS(20))
-    , AudioInput(2, 1)
-    , mixerTick_(this, this, &AudioMixer::onTimerTick_, AUDIO_MIXER_TIMER_TICK_US, "AudioMixerTimer")
+#if CONFIG_EZDV_VOICE_KEYER_MONITOR
+    : AudioMixer({ FREEDV_MAX_FRAME_SAMPLES, AUDIO_MIXER_MAX_BEEPER_SAMPLES, AUDIO_MIXER_MAX_KEYER_SAMPLES })
+#else
+    : AudioMixer({ FREEDV_MAX_FRAME_SAMPLES, AUDIO_MIXER_MAX_BEEPER_SAMPLES })
+#endif // CONFIG_EZDV_VOICE_KEYER_MONITOR
 {
     // empty
 }
 
+AudioMixer::AudioMixer(std::initializer_list<uint32_t> inputFrameSizes)
+    : DVTask("AudioMixer", 15, 3144, tskNO_AFFINITY, 16)
+    , AudioInput("AudioMixer", 1, inputFrameSizes)
+    , mixerTick_(this, this, &AudioMixer::onTimerTick_, AUDIO_MIXER_TIMER_TICK_US, "AudioMixerTimer")
+{
+    assert(inputFrameSizes.size() <= MAX_INPUTS);
+
+    for (int index = 0; index < MAX_INPUTS; index++)
+    {
+        gain_[index].store(DEFAULT_GAIN, std::memory_order_relaxed);
+        muted_[index].store(false, std::memory_order_relaxed);
+        duckTrigger_[index].store(-1, std::memory_order_relaxed);
+        duckGain_[index].store(UNITY_GAIN, std::memory_order_relaxed);
+        duckHoldTicks_[index] = 0;
+    }
+}
+
 AudioMixer::~AudioMixer()
 {
     mixerTick_.stop();
 }
 
+void AudioMixer::setInputGain(ChannelLabel channel, int16_t gainQ15)
+{
+    assert(channel < getNumInputChannels());
+    gain_[channel].store(gainQ15, std::memory_order_relaxed);
+}
+
+void AudioMixer::setInputMuted(ChannelLabel channel, bool muted)
+{
+    assert(channel < getNumInputChannels());
+    muted_[channel].store(muted, std::memory_order_relaxed);
+}
+
+void AudioMixer::setDucking(ChannelLabel channel, ChannelLabel trigger, int16_t duckGainQ15)
+{
+    assert(channel < getNumInputChannels() && trigger < getNumInputChannels() && channel != trigger);
+    duckGain_[channel].store(duckGainQ15, std::memory_order_relaxed);
+    duckTrigger_[channel].store(trigger, std::memory_order_release);
+}
+
+void AudioMixer::clearDucking(ChannelLabel channel)
+{
+    assert(channel < getNumInputChannels());
+    duckTrigger_[channel].store(-1, std::memory_order_release);
+}
+
 void AudioMixer::onTaskStart_()
 {
     mixerTick_.start();
@@ -48,49 +125,139 @@ void AudioMixer::onTaskSleep_()
 {
     mixerTick_.stop();
 
-    // Flush anything remaining in the fifos.
-    struct FIFO* leftInputFifo = getAudioInput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* rightInputFifo = getAudioInput(AudioInput::RIGHT_CHANNEL);
-    int ctr = 2; // Should only need to run twice to flush everything
-    while (ctr-- > 0 && (codec2_fifo_used(leftInputFifo) > 0 || codec2_fifo_used(rightInputFifo) > 0))
+    // Flush anything remaining in the fifos. Should only need to run twice 
+    // to flush everything.
+    for (int ctr = 0; ctr < 2; ctr++)
     {
-        onTimerTick_(nullptr);
+        mix();
     }
 }
 
 void AudioMixer::onTimerTick_(DVTimer*)
 {
-    struct FIFO* leftInputFifo = getAudioInput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* rightInputFifo = getAudioInput(AudioInput::RIGHT_CHANNEL);
-    struct FIFO* outputFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
-
-    // Process on a sample by sample basis
-    int ctr = AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL;
-    short bufLeft;
-    short bufRight;
-    while (ctr-- > 0 && (codec2_fifo_used(leftInputFifo) > 0 || codec2_fifo_used(rightInputFifo) > 0))
+    mix();
+}
+
+void AudioMixer::mix()
+{
+    int numInputs = getNumInputChannels();
+    OutputClaim output(this, AudioInput::LEFT_CHANNEL);
+    AudioRingBuffer* outputFifo = output.fifo();
+
+    AudioRingBuffer* inputFifos[MAX_INPUTS];
+    uint32_t numUsed[MAX_INPUTS];
+    uint32_t numSamples = 0;
+    for (int index = 0; index < numInputs; index++)
+    {
+        inputFifos[index] = getAudioInput((ChannelLabel)index);
+        numUsed[index] = std::min(inputFifos[index]->numUsed(), (uint32_t)AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL);
+        numSamples = std::max(numSamples, numUsed[index]);
+    }
+
+    for (int index = 0; index < numInputs; index++)
+    {
+        // Ducking is held for a bit after the trigger stops.
+        int trigger = duckTrigger_[index].load(std::memory_order_acquire);
+        if (trigger >= 0 && numUsed[trigger] > 0)
+        {
+            duckHoldTicks_[index] = AUDIO_MIXER_DUCK_HOLD_TICKS;
+        }
+        else if (duckHoldTicks_[index] > 0)
+        {
+            duckHoldTicks_[index]--;
+        }
+    }
+
+    if (numSamples == 0)
+    {
+        return;
+    }
+
+    // Work out which inputs actually contribute to the output. If one input
+    // has fewer samples than the others, the rest of it is treated as silence.
+    int numActive = 0;
+    int active[MAX_INPUTS];
+    int16_t activeGain[MAX_INPUTS];
+    AudioRingBuffer::Span activeSpan[MAX_INPUTS];
+    for (int index = 0; index < numInputs; index++)
     {
-        bufLeft = 0;
-        bufRight = 0;
-        
-        codec2_fifo_read(leftInputFifo, &bufLeft, 1);
-        codec2_fifo_read(rightInputFifo, &bufRight, 1);
-        
-        // See https://dsp.stackexchange.com/questions/3581/algorithms-to-mix-audio-signals-without-clipping
-        // for more info. This is basically (1/sqrt(2)) * (a + b) but done in a way that avoids the use
-        // of float or SW division (i.e. multiplies the sum by 724/1024 or ~0.707).
-        int32_t addedSample = ((bufLeft + bufRight) * 724) >> 10;
-        if (addedSample >= SHRT_MAX)
+        int32_t gain = gain_[index].load(std::memory_order_relaxed);
+        if (duckHoldTicks_[index] > 0 && duckTrigger_[index].load(std::memory_order_relaxed) >= 0)
         {
-            addedSample = SHRT_MAX;
+            gain = (gain * duckGain_[index].load(std::memory_order_relaxed)) >> 15;
         }
-        else if (addedSample <= SHRT_MIN)
+
+        if (numUsed[index] > 0 && gain > 0 && !muted_[index].load(std::memory_order_relaxed))
         {
-            addedSample = SHRT_MIN;
+            active[numActive] = index;
+            activeGain[numActive] = gain;
+            activeSpan[numActive] = inputFifos[index]->acquireRead(numUsed[index]);
+            numActive++;
         }
-        short resultShort = (short)addedSample;
-        
-        codec2_fifo_write(outputFifo, &resultShort, 1);
+    }
+
+    auto outputSpan = outputFifo->acquireWrite(std::min(numSamples, outputFifo->numFree()));
+    outputFifo->reportOverrun(numSamples - outputSpan.size());
+
+    // Mix in runs that are contiguous in every FIFO involved (at most a
+    // handful per tick given wraparound and differing input lengths).
+    uint32_t index = 0;
+    while (index < outputSpan.size())
+    {
+        uint32_t runLength = outputSpan.size() - index;
+        short* output = GetContiguous_(outputSpan, index, &runLength);
+
+        const short* inputs[MAX_INPUTS];
+        int16_t gains[MAX_INPUTS];
+        int numInRun = 0;
+        for (int activeIndex = 0; activeIndex < numActive; activeIndex++)
+        {
+            if (index < numUsed[active[activeIndex]])
+            {
+                inputs[numInRun] = GetContiguous_(activeSpan[activeIndex], index, &runLength);
+                gains[numInRun] = activeGain[activeIndex];
+                numInRun++;
+            }
+        }
+
+        if (numInRun == 0)
+        {
+            memset(output, 0, runLength * sizeof(short));
+        }
+        else if (numInRun == 1 && gains[0] == UNITY_GAIN)
+        {
+            // Only one input and nothing to do to it.
+            memcpy(output, inputs[0], runLength * sizeof(short));
+        }
+        else if (numInRun == 1)
+        {
+            // Scaling a single input by at most unity can't overflow.
+            dsps_mulc_s16(inputs[0], output, runLength, gains[0], 1, 1);
+        }
+        else
+        {
+            // See https://dsp.stackexchange.com/questions/3581/algorithms-to-mix-audio-signals-without-clipping
+            // for more info. With the default gains this is (1/sqrt(2)) * (a + b). esp-dsp's s16 add isn't 
+            // guaranteed to saturate, so this stays scalar (the clamp compiles to a single instruction).
+            for (uint32_t sample = 0; sample < runLength; sample++)
+            {
+                int32_t addedSample = 0;
+                for (int input = 0; input < numInRun; input++)
+                {
+                    addedSample += ((int32_t)inputs[input][sample] * gains[input]) >> 15;
+                }
+                output[sample] = (short)std::clamp(addedSample, (int32_t)SHRT_MIN, (int32_t)SHRT_MAX);
+            }
+        }
+
+        index += runLength;
+    }
+
+    // Anything that didn't fit in the output is dropped.
+    outputFifo->commitWrite(outputSpan.size());
+    for (int input = 0; input < numInputs; input++)
+    {
+        inputFifos[input]->release(numUsed[input]);
     }
 }
 
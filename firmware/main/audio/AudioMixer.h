@@ -18,6 +18,11 @@
 #ifndef AUDIO_MIXER_H
 #define AUDIO_MIXER_H
 
+#include <atomic>
+#include <initializer_list>
+
+#include "sdkconfig.h"
+
 #include "AudioInput.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
@@ -30,18 +35,71 @@ namespace audio
 
 using namespace ezdv::task;
 
+/// @brief Mixes any number of input channels into LEFT_CHANNEL's output, 
+///        each with its own gain. An input can be muted or automatically 
+///        ducked while another input has audio. Gain, mute and ducking 
+///        settings can be changed from any task.
 class AudioMixer : public DVTask, public AudioInput
 {
 public:
+    enum { MAX_INPUTS = 4 };
+
+    // Q15 gain that passes audio through unchanged.
+    static constexpr int16_t UNITY_GAIN = INT16_MAX;
+
+    // Default gain for each input; keeps two full scale inputs from clipping.
+    static constexpr int16_t DEFAULT_GAIN = 23170;
+
+#if CONFIG_EZDV_VOICE_KEYER_MONITOR
+    /// @brief Input for VoiceKeyerTask's copy of the keyed audio.
+    static constexpr AudioInput::ChannelLabel KEYER_MONITOR_CHANNEL = (AudioInput::ChannelLabel)2;
+#endif // CONFIG_EZDV_VOICE_KEYER_MONITOR
+
+    /// @brief Creates a mixer for FreeDVTask RX (LEFT_CHANNEL), the beeper 
+    ///        (RIGHT_CHANNEL) and, if enabled, the voice keyer monitor 
+    ///        (KEYER_MONITOR_CHANNEL).
     AudioMixer();
+
+    /// @brief Creates a mixer with the given inputs.
+    /// @param inputFrameSizes The largest number of samples written to each 
+    ///        input at once (up to MAX_INPUTS).
+    AudioMixer(std::initializer_list<uint32_t> inputFrameSizes);
     virtual ~AudioMixer();
 
+    /// @brief Sets the gain applied to an input.
+    /// @param channel The input channel.
+    /// @param gainQ15 The gain in Q15 (UNITY_GAIN for none).
+    void setInputGain(ChannelLabel channel, int16_t gainQ15);
+
+    /// @brief Mutes or unmutes an input. Muted inputs are still consumed.
+    void setInputMuted(ChannelLabel channel, bool muted);
+
+    /// @brief Automatically reduces an input's gain while another input has audio.
+    /// @param channel The input to duck.
+    /// @param trigger The input whose audio causes ducking.
+    /// @param duckGainQ15 Additional Q15 gain applied while ducked (0 silences the input).
+    void setDucking(ChannelLabel channel, ChannelLabel trigger, int16_t duckGainQ15);
+
+    /// @brief Stops ducking an input.
+    void clearDucking(ChannelLabel channel);
+
+    /// @brief Mixes up to one timer tick's worth of queued input into the 
+    ///        output. Normally only called from the mixer's own timer; also
+    ///        used by the microbenchmarks.
+    void mix();
+
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
 
 private:
     DVTimer mixerTick_;
+
+    std::atomic<int16_t> gain_[MAX_INPUTS];
+    std::atomic<bool> muted_[MAX_INPUTS];
+    std::atomic<int8_t> duckTrigger_[MAX_INPUTS]; // -1 if not ducked
+    std::atomic<int16_t> duckGain_[MAX_INPUTS];
+    int duckHoldTicks_[MAX_INPUTS];
     
     void onTimerTick_(DVTimer*);
 };
@@ -50,4 +108,4 @@ private:
 
 }
 
-#endif // AUDIO_MIXER_H
\ No newline at end of file
+#endif // AUDIO_MIXER_H
@@ -0,0 +1,227 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "esp_log.h"
+
+#include "AudioMonitorTask.h"
+
+#define CURRENT_LOG_TAG "AudioMonitor"
+
+#define MONITOR_FIFO_SAMPLES (4096)
+#define MONITOR_FRAME_INTERVAL_MS (40)
+
+// Anything older than this when it's time to encode is discarded rather 
+// than sent late.
+#define MONITOR_MAX_DELAY_SAMPLES (8000 * 250 / 1000)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static const int16_t AdpcmStepTable_[] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209,
+    230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876,
+    963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+    3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493,
+    10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086,
+    29794, 32767
+};
+
+static const int8_t AdpcmIndexTable_[] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+#define ADPCM_MAX_STEP_INDEX ((int)(sizeof(AdpcmStepTable_) / sizeof(AdpcmStepTable_[0])) - 1)
+
+// Copies as much of span into fifo as fits.
+static void CopyToFifo_(AudioRingBuffer* fifo, AudioRingBuffer::Span& span)
+{
+    auto outputSpan = fifo->acquireWrite(std::min(span.size(), fifo->numFree()));
+    for (uint32_t index = 0; index < outputSpan.size(); index++)
+    {
+        outputSpan[index] = span[index];
+    }
+    fifo->commitWrite(outputSpan.size());
+    fifo->reportOverrun(span.size() - outputSpan.size());
+}
+
+AudioMonitorTask::AudioMonitorTask()
+    : DVTask("AudioMonitor", 2, 4096, tskNO_AFFINITY, 16)
+    , AudioInput("AudioMonitor", 1, { FREEDV_MAX_FRAME_SAMPLES })
+    , encodeTick_(this, this, &AudioMonitorTask::onTimerTick_, MS_TO_US(MONITOR_FRAME_INTERVAL_MS), "AudioMonitorTimer")
+    , monitorFifo_(MONITOR_FIFO_SAMPLES)
+    , isMonitoring_(false)
+    , predictor_(0)
+    , stepIndex_(0)
+{
+    registerMessageHandlers<&AudioMonitorTask::onSetAudioMonitorEnabledMessage_>(this);
+
+    // Pass audio through as soon as it arrives.
+    setAudioInputNotification(LEFT_CHANNEL, &OnInputReady_, this, 1);
+}
+
+AudioMonitorTask::~AudioMonitorTask()
+{
+    // empty
+}
+
+void AudioMonitorTask::onTaskStart_()
+{
+    // Nothing to do until someone listens.
+}
+
+void AudioMonitorTask::onTaskSleep_()
+{
+    if (isMonitoring_.load(std::memory_order_acquire))
+    {
+        isMonitoring_.store(false, std::memory_order_release);
+        encodeTick_.stop();
+    }
+}
+
+void AudioMonitorTask::passThrough_()
+{
+    AudioRingBuffer* inputFifo = getAudioInput(LEFT_CHANNEL);
+    OutputClaim output(this, LEFT_CHANNEL);
+    AudioRingBuffer* outputFifo = output.fifo();
+
+    auto inputSpan = inputFifo->acquireRead(inputFifo->numUsed());
+    if (outputFifo != nullptr)
+    {
+        CopyToFifo_(outputFifo, inputSpan);
+    }
+
+    // Nobody listening means no copy and nothing to encode.
+    if (isMonitoring_.load(std::memory_order_acquire))
+    {
+        CopyToFifo_(&monitorFifo_, inputSpan);
+    }
+
+    inputFifo->release(inputSpan.size());
+}
+
+void AudioMonitorTask::onTimerTick_(DVTimer*)
+{
+    // Keep the delay bounded if we've fallen behind.
+    uint32_t numUsed = monitorFifo_.numUsed();
+    if (numUsed > MONITOR_MAX_DELAY_SAMPLES)
+    {
+        auto span = monitorFifo_.acquireRead(numUsed - MONITOR_MAX_DELAY_SAMPLES);
+        monitorFifo_.release(span.size());
+    }
+
+    while (monitorFifo_.read(frame_, FreeDVAudioMonitorMessage::NUM_SAMPLES) == 0)
+    {
+        FreeDVAudioMonitorMessage message;
+        encodeFrame_(message);
+        publish(&message);
+    }
+}
+
+void AudioMonitorTask::encodeFrame_(FreeDVAudioMonitorMessage& message)
+{
+    message.predictor = predictor_;
+    message.stepIndex = stepIndex_;
+
+    for (int index = 0; index < FreeDVAudioMonitorMessage::NUM_SAMPLES; index++)
+    {
+        int step = AdpcmStepTable_[stepIndex_];
+        int diff = frame_[index] - predictor_;
+        int code = 0;
+        if (diff < 0)
+        {
+            code = 8;
+            diff = -diff;
+        }
+
+        // Quantize the difference and track what the decoder will reconstruct.
+        int delta = step >> 3;
+        if (diff >= step)
+        {
+            code |= 4;
+            diff -= step;
+            delta += step;
+        }
+        step >>= 1;
+        if (diff >= step)
+        {
+            code |= 2;
+            diff -= step;
+            delta += step;
+        }
+        step >>= 1;
+        if (diff >= step)
+        {
+            code |= 1;
+            delta += step;
+        }
+
+        predictor_ += (code & 8) ? -delta : delta;
+        predictor_ = std::clamp(predictor_, -32768, 32767);
+        stepIndex_ = std::clamp(stepIndex_ + AdpcmIndexTable_[code & 7], 0, ADPCM_MAX_STEP_INDEX);
+
+        if (index & 1)
+        {
+            message.data[index >> 1] |= code << 4;
+        }
+        else
+        {
+            message.data[index >> 1] = code;
+        }
+    }
+}
+
+void AudioMonitorTask::onSetAudioMonitorEnabledMessage_(DVTask* origin, FreeDVSetAudioMonitorEnabledMessage* message)
+{
+    if (message->enabled == isMonitoring_.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Audio monitor %s", message->enabled ? "enabled" : "disabled");
+
+    if (message->enabled)
+    {
+        // Throw away anything left over from last time.
+        auto span = monitorFifo_.acquireRead(monitorFifo_.numUsed());
+        monitorFifo_.release(span.size());
+        predictor_ = 0;
+        stepIndex_ = 0;
+
+        isMonitoring_.store(true, std::memory_order_release);
+        encodeTick_.start();
+    }
+    else
+    {
+        isMonitoring_.store(false, std::memory_order_release);
+        encodeTick_.stop();
+    }
+}
+
+void AudioMonitorTask::OnInputReady_(void* arg)
+{
+    ((AudioMonitorTask*)arg)->passThrough_();
+}
+
+}
+
+}
@@ -0,0 +1,77 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_MONITOR_TASK_H
+#define AUDIO_MONITOR_TASK_H
+
+#include <atomic>
+
+#include "AudioInput.h"
+#include "AudioRingBuffer.h"
+#include "FreeDVMessage.h"
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Lets web UI clients listen to received audio. Audio written to 
+///        LEFT_CHANNEL is passed straight through to LEFT_CHANNEL's output in
+///        the producer's task. While someone is listening (see 
+///        FreeDVSetAudioMonitorEnabledMessage), it's also copied into a FIFO 
+///        that this task encodes as IMA ADPCM and publishes as 
+///        FreeDVAudioMonitorMessages. If encoding falls behind, the oldest 
+///        audio is dropped to keep the delay bounded.
+class AudioMonitorTask : public DVTask, public AudioInput
+{
+public:
+    AudioMonitorTask();
+    virtual ~AudioMonitorTask();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    DVTimer encodeTick_;
+    AudioRingBuffer monitorFifo_;
+    std::atomic<bool> isMonitoring_;
+    short frame_[FreeDVAudioMonitorMessage::NUM_SAMPLES];
+
+    // ADPCM encoder state.
+    int predictor_;
+    int stepIndex_;
+
+    void passThrough_();
+    void onTimerTick_(DVTimer*);
+    void encodeFrame_(FreeDVAudioMonitorMessage& message);
+
+    void onSetAudioMonitorEnabledMessage_(DVTask* origin, FreeDVSetAudioMonitorEnabledMessage* message);
+
+    static void OnInputReady_(void* arg);
+};
+
+}
+
+}
+
+#endif // AUDIO_MONITOR_TASK_H
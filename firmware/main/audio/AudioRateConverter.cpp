@@ -0,0 +1,246 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+
+#include "AudioRateConverter.h"
+
+// Filter taps per output phase; higher gives a sharper cutoff at the
+// cost of CPU time in the producer's task. esp-dsp's optimized S16 FIR
+// wants a multiple of 8.
+#define TAPS_PER_PHASE (16)
+
+// Maximum number of input samples processed per pass.
+#define CONVERTER_BLOCK_SAMPLES (160)
+
+// esp-dsp's optimized S16 FIR needs 16 byte aligned coefficients and delay
+// lines. The delay lines are padded by one vector to be safe.
+#define CONVERTER_FIR_ALIGNMENT (16)
+#define CONVERTER_FIR_PADDING (8)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static int16_t* AllocateAligned_(uint32_t len)
+{
+    int16_t* buf = (int16_t*)heap_caps_aligned_calloc(CONVERTER_FIR_ALIGNMENT, len + CONVERTER_FIR_PADDING, sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(buf != nullptr);
+    return buf;
+}
+
+AudioRateConverter::AudioRateConverter(uint32_t inputSampleRate, uint32_t outputSampleRate)
+    : AudioInput("RateConverter", 1, { FREEDV_MAX_FRAME_SAMPLES * std::max((uint32_t)1, inputSampleRate / AUDIO_DEFAULT_SAMPLE_RATE) })
+    , upsampleFactor_(1)
+    , downsampleFactor_(1)
+{
+    assert(inputSampleRate != outputSampleRate);
+
+    uint32_t factor = 0;
+    if (outputSampleRate > inputSampleRate)
+    {
+        assert((outputSampleRate % inputSampleRate) == 0);
+        factor = upsampleFactor_ = outputSampleRate / inputSampleRate;
+    }
+    else
+    {
+        assert((inputSampleRate % outputSampleRate) == 0);
+        factor = downsampleFactor_ = inputSampleRate / outputSampleRate;
+    }
+
+    setInputSampleRate(LEFT_CHANNEL, inputSampleRate);
+    setOutputSampleRate(LEFT_CHANNEL, outputSampleRate);
+
+    // Windowed-sinc lowpass at the lower rate's Nyquist frequency. This only 
+    // happens when a converter is first needed, so floating point is fine.
+    uint32_t numTaps = TAPS_PER_PHASE * factor;
+    float* prototype = new float[numTaps];
+    assert(prototype != nullptr);
+
+    float center = (numTaps - 1) / 2.0f;
+    for (uint32_t tap = 0; tap < numTaps; tap++)
+    {
+        float x = (tap - center) / factor;
+        float sinc = (x == 0) ? 1.0f : sinf(M_PI * x) / (M_PI * x);
+        float window = 0.54f - 0.46f * cosf(2 * M_PI * tap / (numTaps - 1));
+        prototype[tap] = sinc * window / factor;
+    }
+
+    // Upsampling splits the filter into one short FIR per output phase 
+    // (phase p uses taps p, p + factor, ...), so the zeros stuffed between
+    // input samples never need to be multiplied. Downsampling runs the 
+    // whole filter but only at the output rate.
+    numPhases_ = upsampleFactor_;
+    tapsPerFilter_ = (upsampleFactor_ > 1) ? TAPS_PER_PHASE : numTaps;
+    blockSamples_ = (CONVERTER_BLOCK_SAMPLES / downsampleFactor_) * downsampleFactor_;
+
+    filters_ = (fir_s16_t*)heap_caps_calloc(numPhases_, sizeof(fir_s16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    coeffs_ = (int16_t**)heap_caps_calloc(numPhases_, sizeof(int16_t*), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    delays_ = (int16_t**)heap_caps_calloc(numPhases_, sizeof(int16_t*), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(filters_ != nullptr && coeffs_ != nullptr && delays_ != nullptr);
+
+    for (uint32_t phase = 0; phase < numPhases_; phase++)
+    {
+        coeffs_[phase] = AllocateAligned_(tapsPerFilter_);
+        delays_[phase] = AllocateAligned_(tapsPerFilter_);
+
+        // esp-dsp multiplies the first coefficient by the oldest sample, so
+        // the taps go in backwards. Zero stuffing when upsampling reduces the
+        // level by the upsample factor, so that's made up for here too.
+        for (uint32_t index = 0; index < tapsPerFilter_; index++)
+        {
+            uint32_t tap = phase + (tapsPerFilter_ - 1 - index) * numPhases_;
+            float value = prototype[tap] * upsampleFactor_ * SHRT_MAX;
+            value = std::max((float)SHRT_MIN, std::min((float)SHRT_MAX, value));
+            coeffs_[phase][index] = (int16_t)lrintf(value);
+        }
+    }
+
+    delete[] prototype;
+
+    inputBlock_ = AllocateAligned_(blockSamples_);
+    outputBlock_ = AllocateAligned_(blockSamples_ * upsampleFactor_);
+
+    initFilters_();
+
+    // Downsampling needs a full output sample's worth of input to do anything.
+    setAudioInputNotification(LEFT_CHANNEL, &OnInputReady_, this, downsampleFactor_);
+}
+
+AudioRateConverter::~AudioRateConverter()
+{
+    freeFilters_();
+
+    for (uint32_t phase = 0; phase < numPhases_; phase++)
+    {
+        heap_caps_free(coeffs_[phase]);
+        heap_caps_free(delays_[phase]);
+    }
+
+    heap_caps_free(filters_);
+    heap_caps_free(coeffs_);
+    heap_caps_free(delays_);
+    heap_caps_free(inputBlock_);
+    heap_caps_free(outputBlock_);
+}
+
+void AudioRateConverter::reset()
+{
+    // Called by AudioGraph with its spinlock held, so this only clears state
+    // in place; re-running dsps_fird_init_s16() could allocate.
+    for (uint32_t phase = 0; phase < numPhases_; phase++)
+    {
+        memset(delays_[phase], 0, tapsPerFilter_ * sizeof(int16_t));
+        filters_[phase].pos = 0;
+        filters_[phase].d_pos = 0;
+    }
+}
+
+void AudioRateConverter::initFilters_()
+{
+    for (uint32_t phase = 0; phase < numPhases_; phase++)
+    {
+        memset(delays_[phase], 0, tapsPerFilter_ * sizeof(int16_t));
+        ESP_ERROR_CHECK(dsps_fird_init_s16(&filters_[phase], coeffs_[phase], delays_[phase], tapsPerFilter_, downsampleFactor_, 0, 0));
+    }
+}
+
+void AudioRateConverter::freeFilters_()
+{
+    for (uint32_t phase = 0; phase < numPhases_; phase++)
+    {
+        dsps_fird_s16_aexx_free(&filters_[phase]);
+    }
+}
+
+void AudioRateConverter::process_()
+{
+    AudioRingBuffer* inputFifo = getAudioInput(LEFT_CHANNEL);
+    OutputClaim output(this, LEFT_CHANNEL);
+    AudioRingBuffer* outputFifo = output.fifo();
+
+    // Leftover input that doesn't make up a whole output sample waits 
+    // for the next write.
+    uint32_t numAvailable = inputFifo->numUsed();
+    numAvailable -= numAvailable % downsampleFactor_;
+
+    while (numAvailable > 0)
+    {
+        uint32_t numInput = std::min(numAvailable, blockSamples_);
+        uint32_t numOutput = numInput * upsampleFactor_ / downsampleFactor_;
+
+        inputFifo->read(inputBlock_, numInput);
+
+        // Keep the filter running even if there's nowhere to put the result,
+        // so that audio picks back up cleanly.
+        if (upsampleFactor_ > 1)
+        {
+            for (uint32_t phase = 0; phase < numPhases_; phase++)
+            {
+                dsps_fird_s16(&filters_[phase], inputBlock_, outputBlock_ + phase * blockSamples_, numInput);
+            }
+        }
+        else
+        {
+            dsps_fird_s16(&filters_[0], inputBlock_, outputBlock_, numOutput);
+        }
+
+        if (outputFifo != nullptr)
+        {
+            auto outputSpan = outputFifo->acquireWrite(std::min(numOutput, outputFifo->numFree()));
+            outputFifo->reportOverrun(numOutput - outputSpan.size());
+
+            if (upsampleFactor_ > 1)
+            {
+                // Interleave the phases.
+                for (uint32_t index = 0; index < outputSpan.size(); index++)
+                {
+                    outputSpan[index] = outputBlock_[(index % numPhases_) * blockSamples_ + index / numPhases_];
+                }
+            }
+            else
+            {
+                for (uint32_t index = 0; index < outputSpan.size(); index++)
+                {
+                    outputSpan[index] = outputBlock_[index];
+                }
+            }
+
+            outputFifo->commitWrite(outputSpan.size());
+        }
+
+        numAvailable -= numInput;
+    }
+}
+
+void AudioRateConverter::OnInputReady_(void* arg)
+{
+    ((AudioRateConverter*)arg)->process_();
+}
+
+}
+
+}
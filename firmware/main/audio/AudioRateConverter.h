@@ -0,0 +1,73 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef AUDIO_RATE_CONVERTER_H
+#define AUDIO_RATE_CONVERTER_H
+
+#include "esp_dsp.h"
+
+#include "AudioInput.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Converts audio between two sample rates that are integer multiples
+///        of each other. Inserted automatically by AudioGraph between nodes
+///        whose rates don't match. Conversion happens in the producer's task
+///        right after it writes, so no extra task or delay is involved. 
+///        Filtering uses esp-dsp's polyphase S16 FIRs.
+class AudioRateConverter : public AudioInput
+{
+public:
+    /// @brief Creates a new converter.
+    /// @param inputSampleRate The sample rate of audio written to the converter.
+    /// @param outputSampleRate The sample rate of audio it produces.
+    AudioRateConverter(uint32_t inputSampleRate, uint32_t outputSampleRate);
+    virtual ~AudioRateConverter();
+
+    /// @brief Clears filter history, e.g. when the converter is assigned a new route.
+    ///        Doesn't allocate, so it's safe to call with AudioGraph's lock held.
+    void reset();
+
+private:
+    uint32_t upsampleFactor_;
+    uint32_t downsampleFactor_;
+    uint32_t numPhases_; // one FIR per output phase when upsampling
+    uint32_t tapsPerFilter_;
+    uint32_t blockSamples_;
+    fir_s16_t* filters_;
+    int16_t** coeffs_; // Q15, designed at the higher of the two rates
+    int16_t** delays_;
+    int16_t* inputBlock_;
+    int16_t* outputBlock_;
+
+    void process_();
+    void initFilters_();
+    void freeFilters_();
+
+    static void OnInputReady_(void* arg);
+};
+
+}
+
+}
+
+#endif // AUDIO_RATE_CONVERTER_H
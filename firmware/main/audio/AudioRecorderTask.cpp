@@ -0,0 +1,259 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "codec2.h"
+
+#include "AudioRecorderTask.h"
+
+#define CURRENT_LOG_TAG "AudioRecorder"
+
+// About a second of audio, enough to ride out a sector erase.
+#define RECORDER_FIFO_SAMPLES (8192)
+#define RECORDER_WRITE_INTERVAL_MS (100)
+#define RECORDER_PCM_FRAME_SAMPLES (160)
+
+// A partially filled block is padded with silence and written once nothing
+// has been received for this long (i.e. at the end of each over).
+#define RECORDER_IDLE_FLUSH_MS (3000)
+
+#if CONFIG_EZDV_RX_RECORDER_CODEC2
+#define RECORDER_FORMAT (RecordingStore::CODEC2_700C)
+#define RECORDER_TASK_STACK_SIZE (16384) /* codec2_encode() needs a lot of stack */
+#else
+#define RECORDER_FORMAT (RecordingStore::PCM_8K)
+#define RECORDER_TASK_STACK_SIZE (4096)
+#endif // CONFIG_EZDV_RX_RECORDER_CODEC2
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+// Copies as much of span into fifo as fits.
+static void CopyToFifo_(AudioRingBuffer* fifo, AudioRingBuffer::Span& span)
+{
+    auto outputSpan = fifo->acquireWrite(std::min(span.size(), fifo->numFree()));
+    for (uint32_t index = 0; index < outputSpan.size(); index++)
+    {
+        outputSpan[index] = span[index];
+    }
+    fifo->commitWrite(outputSpan.size());
+    fifo->reportOverrun(span.size() - outputSpan.size());
+}
+
+AudioRecorderTask::AudioRecorderTask()
+    : DVTask("AudioRecorder", 2, RECORDER_TASK_STACK_SIZE, tskNO_AFFINITY, 16, pdMS_TO_TICKS(RECORDER_WRITE_INTERVAL_MS))
+    , AudioInput("AudioRecorder", 1, { FREEDV_MAX_FRAME_SAMPLES })
+    , writerTick_(this, this, &AudioRecorderTask::onTimerTick_, MS_TO_US(RECORDER_WRITE_INTERVAL_MS), "AudioRecorderTimer")
+    , recordFifo_(RECORDER_FIFO_SAMPLES)
+    , store_(RECORDER_FORMAT)
+    , isRecording_(false)
+    , codec2_(nullptr)
+    , samplesPerFrame_(RECORDER_PCM_FRAME_SAMPLES)
+    , bytesPerFrame_(RECORDER_PCM_FRAME_SAMPLES * sizeof(short))
+    , encodedFrame_(nullptr)
+    , silenceFrame_(nullptr)
+    , payloadUsed_(0)
+    , lastAudioTimeUs_(0)
+{
+#if CONFIG_EZDV_RX_RECORDER_CODEC2
+    codec2_ = codec2_create(CODEC2_MODE_700C);
+    assert(codec2_ != nullptr);
+
+    samplesPerFrame_ = codec2_samples_per_frame(codec2_);
+    bytesPerFrame_ = codec2_bytes_per_frame(codec2_);
+
+    // Frames can't straddle blocks; every block has to decode on its own.
+    assert(RecordingStore::PAYLOAD_SIZE % bytesPerFrame_ == 0);
+
+    encodedFrame_ = (uint8_t*)heap_caps_calloc(bytesPerFrame_, 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(encodedFrame_ != nullptr);
+    silenceFrame_ = (uint8_t*)heap_caps_calloc(bytesPerFrame_, 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(silenceFrame_ != nullptr);
+#endif // CONFIG_EZDV_RX_RECORDER_CODEC2
+
+    frame_ = (short*)heap_caps_calloc(samplesPerFrame_, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(frame_ != nullptr);
+
+    payload_ = (uint8_t*)heap_caps_calloc(RecordingStore::PAYLOAD_SIZE, 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(payload_ != nullptr);
+
+    if (codec2_ != nullptr)
+    {
+        // Used to pad out partial blocks.
+        codec2_encode(codec2_, silenceFrame_, frame_);
+    }
+
+    // Pass audio through as soon as it arrives.
+    setAudioInputNotification(LEFT_CHANNEL, &OnInputReady_, this, 1);
+}
+
+AudioRecorderTask::~AudioRecorderTask()
+{
+    if (codec2_ != nullptr)
+    {
+        codec2_destroy(codec2_);
+        heap_caps_free(encodedFrame_);
+        heap_caps_free(silenceFrame_);
+    }
+
+    heap_caps_free(frame_);
+    heap_caps_free(payload_);
+}
+
+void AudioRecorderTask::onTaskStart_()
+{
+    if (!store_.isAvailable())
+    {
+        // Still pass audio through, just don't record it.
+        return;
+    }
+
+    lastAudioTimeUs_ = esp_timer_get_time();
+    isRecording_.store(true, std::memory_order_release);
+    writerTick_.start();
+}
+
+void AudioRecorderTask::onTaskSleep_()
+{
+    if (!isRecording_.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    isRecording_.store(false, std::memory_order_release);
+    writerTick_.stop();
+
+    // Save whatever's left.
+    onTimerTick_(nullptr);
+    if (payloadUsed_ > 0)
+    {
+        flushPayload_();
+    }
+}
+
+void AudioRecorderTask::passThrough_()
+{
+    AudioRingBuffer* inputFifo = getAudioInput(LEFT_CHANNEL);
+    OutputClaim output(this, LEFT_CHANNEL);
+    AudioRingBuffer* outputFifo = output.fifo();
+
+    auto inputSpan = inputFifo->acquireRead(inputFifo->numUsed());
+    if (outputFifo != nullptr)
+    {
+        CopyToFifo_(outputFifo, inputSpan);
+    }
+    if (isRecording_.load(std::memory_order_acquire))
+    {
+        CopyToFifo_(&recordFifo_, inputSpan);
+    }
+    inputFifo->release(inputSpan.size());
+}
+
+void AudioRecorderTask::onTimerTick_(DVTimer*)
+{
+    int64_t now = esp_timer_get_time();
+
+    while (recordFifo_.read(frame_, samplesPerFrame_) == 0)
+    {
+        // Squelched audio is all zeros; there's no point wearing out flash
+        // recording it.
+        bool isSilent = true;
+        for (uint32_t index = 0; index < samplesPerFrame_ && isSilent; index++)
+        {
+            isSilent = frame_[index] == 0;
+        }
+
+        if (isSilent)
+        {
+            continue;
+        }
+
+        lastAudioTimeUs_ = now;
+        if (codec2_ != nullptr)
+        {
+            codec2_encode(codec2_, encodedFrame_, frame_);
+            appendFrame_(encodedFrame_, bytesPerFrame_);
+        }
+        else
+        {
+            appendFrame_((const uint8_t*)frame_, bytesPerFrame_);
+        }
+    }
+
+    if (payloadUsed_ > 0 && (now - lastAudioTimeUs_) >= MS_TO_US(RECORDER_IDLE_FLUSH_MS))
+    {
+        flushPayload_();
+    }
+}
+
+void AudioRecorderTask::appendFrame_(const uint8_t* data, uint32_t length)
+{
+    while (length > 0)
+    {
+        uint32_t amountToCopy = std::min(length, RecordingStore::PAYLOAD_SIZE - payloadUsed_);
+        memcpy(payload_ + payloadUsed_, data, amountToCopy);
+        payloadUsed_ += amountToCopy;
+        data += amountToCopy;
+        length -= amountToCopy;
+
+        if (payloadUsed_ == RecordingStore::PAYLOAD_SIZE)
+        {
+            flushPayload_();
+        }
+    }
+}
+
+void AudioRecorderTask::flushPayload_()
+{
+    if (codec2_ != nullptr)
+    {
+        for (; payloadUsed_ < RecordingStore::PAYLOAD_SIZE; payloadUsed_ += bytesPerFrame_)
+        {
+            memcpy(payload_ + payloadUsed_, silenceFrame_, bytesPerFrame_);
+        }
+    }
+    else
+    {
+        memset(payload_ + payloadUsed_, 0, RecordingStore::PAYLOAD_SIZE - payloadUsed_);
+    }
+    payloadUsed_ = 0;
+
+    esp_err_t rv = store_.append(payload_);
+    if (rv != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not write recording block: %s", esp_err_to_name(rv));
+    }
+}
+
+void AudioRecorderTask::OnInputReady_(void* arg)
+{
+    ((AudioRecorderTask*)arg)->passThrough_();
+}
+
+}
+
+}
@@ -0,0 +1,85 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_RECORDER_TASK_H
+#define AUDIO_RECORDER_TASK_H
+
+#include <atomic>
+
+#include "sdkconfig.h"
+
+#include "AudioInput.h"
+#include "AudioRingBuffer.h"
+#include "RecordingStore.h"
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+
+struct CODEC2;
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Records received audio to flash. Audio written to LEFT_CHANNEL is
+///        passed straight through to LEFT_CHANNEL's output in the producer's
+///        task and also copied into a lock-free FIFO, which this (low priority)
+///        task drains into RecordingStore blocks. The FreeDV path never waits 
+///        on flash; if the FIFO fills up, the recording drops audio instead.
+class AudioRecorderTask : public DVTask, public AudioInput
+{
+public:
+    AudioRecorderTask();
+    virtual ~AudioRecorderTask();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    DVTimer writerTick_;
+    AudioRingBuffer recordFifo_;
+    RecordingStore store_;
+    std::atomic<bool> isRecording_;
+
+    struct CODEC2* codec2_;
+    uint32_t samplesPerFrame_;
+    uint32_t bytesPerFrame_;
+    short* frame_;
+    uint8_t* encodedFrame_;
+    uint8_t* silenceFrame_;
+
+    uint8_t* payload_;
+    uint32_t payloadUsed_;
+    int64_t lastAudioTimeUs_;
+
+    void passThrough_();
+    void onTimerTick_(DVTimer*);
+    void appendFrame_(const uint8_t* data, uint32_t length);
+    void flushPayload_();
+
+    static void OnInputReady_(void* arg);
+};
+
+}
+
+}
+
+#endif // AUDIO_RECORDER_TASK_H
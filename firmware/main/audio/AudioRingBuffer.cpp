@@ -0,0 +1,422 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+
+#include "AudioRingBuffer.h"
+#include "util/EventTrace.h"
+
+#define RESET_PRODUCER_STATISTICS (1 << 0)
+#define RESET_CONSUMER_STATISTICS (1 << 1)
+
+// Keeps the running total used for the average fill level from overflowing.
+#define MAX_USED_SAMPLES_IN_AVERAGE (1 << 12)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static inline short ScaleSample_(short sample, uint32_t numerator, uint32_t denominator)
+{
+    return (short)(((int32_t)sample * (int32_t)numerator) / (int32_t)denominator);
+}
+
+static inline float ScaleSample_(float sample, uint32_t numerator, uint32_t denominator)
+{
+    return sample * numerator / denominator;
+}
+
+template<typename SampleType>
+AudioRingBufferBase<SampleType>::AudioRingBufferBase(uint32_t numSamples)
+    : capacity_(numSamples)
+    , writeIndex_(0)
+    , writeOffset_(0)
+    , readIndex_(0)
+    , readOffset_(0)
+    , flushPending_(false)
+    , flushToIndex_(0)
+    , fadeInRequest_(0)
+    , fadeInLength_(0)
+    , fadeInPosition_(0)
+    , notifyFn_(nullptr)
+    , notifyArg_(nullptr)
+    , notifyThreshold_(0)
+    , numOverruns_(0)
+    , numSamplesDropped_(0)
+    , numUnderruns_(0)
+    , minUsed_(UINT32_MAX)
+    , maxUsed_(0)
+    , totalUsed_(0)
+    , numUsedSamples_(0)
+    , resetPending_(0)
+#if CONFIG_EZDV_EVENT_TRACE
+    , aboveHighWater_(false)
+#endif // CONFIG_EZDV_EVENT_TRACE
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    , producerProbeFn_(nullptr)
+    , producerProbeArg_(nullptr)
+    , consumerProbeFn_(nullptr)
+    , consumerProbeArg_(nullptr)
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+{
+    assert(numSamples > 0 && numSamples <= 0x80000000);
+
+    buffer_ = (SampleType*)heap_caps_aligned_calloc(AUDIO_RING_BUFFER_CACHE_LINE_SIZE, capacity_, sizeof(SampleType), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(buffer_ != nullptr);
+}
+
+template<typename SampleType>
+AudioRingBufferBase<SampleType>::~AudioRingBufferBase()
+{
+    heap_caps_free(buffer_);
+}
+
+template<typename SampleType>
+uint32_t AudioRingBufferBase<SampleType>::numUsed() const
+{
+    return writeIndex_.load(std::memory_order_acquire) - readIndex_.load(std::memory_order_acquire);
+}
+
+template<typename SampleType>
+uint32_t AudioRingBufferBase<SampleType>::numFree() const
+{
+    return capacity_ - numUsed();
+}
+
+template<typename SampleType>
+typename AudioRingBufferBase<SampleType>::Span AudioRingBufferBase<SampleType>::acquireWrite(uint32_t numSamples)
+{
+    if (resetPending_.load(std::memory_order_relaxed) & RESET_PRODUCER_STATISTICS)
+    {
+        resetProducerStatistics_();
+    }
+
+    // Only we update writeIndex_. The acquire on readIndex_ makes sure the
+    // consumer is done with the space before we overwrite it.
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+    uint32_t numFree = capacity_ - (writeIndex - readIndex_.load(std::memory_order_acquire));
+    return getSpan_(writeOffset_, numSamples <= numFree ? numSamples : 0);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::commitWrite(uint32_t numSamples)
+{
+    // The fade is started here rather than by requestFadeIn() so that only
+    // the producer ever touches its position.
+    if (fadeInRequest_.load(std::memory_order_relaxed) > 0)
+    {
+        fadeInLength_ = fadeInRequest_.exchange(0, std::memory_order_acquire);
+        fadeInPosition_ = 0;
+    }
+
+    if (fadeInLength_ > 0)
+    {
+        Span span = getSpan_(writeOffset_, numSamples);
+        applyFadeIn_(span);
+    }
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    ProbeFn probeFn = producerProbeFn_.load(std::memory_order_acquire);
+    if (probeFn != nullptr && numSamples > 0)
+    {
+        Span span = getSpan_(writeOffset_, numSamples);
+        (*probeFn)(producerProbeArg_.load(std::memory_order_relaxed), span);
+    }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+    // Publishes the samples written so far to the consumer.
+    writeOffset_ = advanceOffset_(writeOffset_, numSamples);
+    writeIndex_.store(writeIndex_.load(std::memory_order_relaxed) + numSamples, std::memory_order_release);
+
+#if CONFIG_EZDV_EVENT_TRACE
+    // The gap between the marks keeps a buffer hovering around one of them
+    // from flooding the trace.
+    uint32_t used = numUsed();
+    if (!aboveHighWater_ && used >= capacity_ * 3 / 4)
+    {
+        aboveHighWater_ = true;
+        EZDV_TRACE(FIFO_WATERMARK, 1, this, used);
+    }
+    else if (aboveHighWater_ && used <= capacity_ / 2)
+    {
+        aboveHighWater_ = false;
+        EZDV_TRACE(FIFO_WATERMARK, 0, this, used);
+    }
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+    uint32_t threshold = notifyThreshold_.load(std::memory_order_acquire);
+    if (threshold > 0 && numSamples > 0 && numUsed() >= threshold)
+    {
+        (*notifyFn_)(notifyArg_);
+    }
+}
+
+template<typename SampleType>
+typename AudioRingBufferBase<SampleType>::Span AudioRingBufferBase<SampleType>::acquireRead(uint32_t numSamples)
+{
+    if (flushPending_.exchange(false, std::memory_order_acq_rel))
+    {
+        // Never more than capacity_ behind, so a single advance is enough.
+        // If we've already read past the snapshot there's nothing left to
+        // discard, and moving back would hand out stale samples again.
+        uint32_t flushToIndex = flushToIndex_.load(std::memory_order_acquire);
+        uint32_t numToDiscard = flushToIndex - readIndex_.load(std::memory_order_relaxed);
+        if ((int32_t)numToDiscard > 0)
+        {
+            readOffset_ = advanceOffset_(readOffset_, numToDiscard);
+            readIndex_.store(flushToIndex, std::memory_order_release);
+        }
+    }
+
+    uint32_t readIndex = readIndex_.load(std::memory_order_relaxed);
+    uint32_t numUsed = writeIndex_.load(std::memory_order_acquire) - readIndex;
+    recordUsed_(numUsed);
+    return getSpan_(readOffset_, numSamples <= numUsed ? numSamples : 0);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::release(uint32_t numSamples)
+{
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    ProbeFn probeFn = consumerProbeFn_.load(std::memory_order_acquire);
+    if (probeFn != nullptr && numSamples > 0)
+    {
+        Span span = getSpan_(readOffset_, numSamples);
+        (*probeFn)(consumerProbeArg_.load(std::memory_order_relaxed), span);
+    }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+    // Hands the space back to the producer.
+    readOffset_ = advanceOffset_(readOffset_, numSamples);
+    readIndex_.store(readIndex_.load(std::memory_order_relaxed) + numSamples, std::memory_order_release);
+}
+
+template<typename SampleType>
+int AudioRingBufferBase<SampleType>::write(const SampleType* samples, uint32_t numSamples)
+{
+    Span span = acquireWrite(numSamples);
+    if (span.size() < numSamples)
+    {
+        reportOverrun(numSamples);
+        return -1;
+    }
+
+    memcpy(span.first, samples, span.firstLength * sizeof(SampleType));
+    memcpy(span.second, samples + span.firstLength, span.secondLength * sizeof(SampleType));
+    commitWrite(numSamples);
+    return 0;
+}
+
+template<typename SampleType>
+int AudioRingBufferBase<SampleType>::read(SampleType* samples, uint32_t numSamples)
+{
+    Span span = acquireRead(numSamples);
+    if (span.size() < numSamples)
+    {
+        return -1;
+    }
+
+    memcpy(samples, span.first, span.firstLength * sizeof(SampleType));
+    memcpy(samples + span.firstLength, span.second, span.secondLength * sizeof(SampleType));
+    release(numSamples);
+    return 0;
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::requestFlush()
+{
+    // Only discard what's there now, not what the new producer writes.
+    flushToIndex_.store(writeIndex_.load(std::memory_order_acquire), std::memory_order_release);
+    flushPending_.store(true, std::memory_order_release);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::requestFadeIn(uint32_t numSamples)
+{
+    fadeInRequest_.store(numSamples, std::memory_order_release);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::applyFadeIn_(Span& span)
+{
+    for (uint32_t index = 0; index < span.size() && fadeInPosition_ < fadeInLength_; index++)
+    {
+        span[index] = ScaleSample_(span[index], fadeInPosition_, fadeInLength_);
+        fadeInPosition_++;
+    }
+
+    if (fadeInPosition_ >= fadeInLength_)
+    {
+        fadeInLength_ = 0;
+    }
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::setConsumerNotification(NotifyFn fn, void* arg, uint32_t threshold)
+{
+    assert(fn != nullptr || threshold == 0);
+
+    notifyFn_ = fn;
+    notifyArg_ = arg;
+    notifyThreshold_.store(threshold, std::memory_order_release);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::setNotificationThreshold(uint32_t threshold)
+{
+    assert(notifyFn_ != nullptr || threshold == 0);
+    notifyThreshold_.store(threshold, std::memory_order_release);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::reportOverrun(uint32_t numSamples)
+{
+    if (numSamples > 0)
+    {
+        EZDV_TRACE(FIFO_OVERRUN, 0, this, numSamples);
+        numOverruns_.store(numOverruns_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        numSamplesDropped_.store(numSamplesDropped_.load(std::memory_order_relaxed) + numSamples, std::memory_order_relaxed);
+    }
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::reportUnderrun(uint32_t numSamples)
+{
+    if (numSamples > 0)
+    {
+        EZDV_TRACE(FIFO_UNDERRUN, 0, this, numSamples);
+        numUnderruns_.store(numUnderruns_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::getStatistics(Statistics& stats, bool reset)
+{
+    uint32_t numUsedSamples = numUsedSamples_.load(std::memory_order_relaxed);
+
+    stats.minUsed = numUsedSamples > 0 ? minUsed_.load(std::memory_order_relaxed) : 0;
+    stats.maxUsed = maxUsed_.load(std::memory_order_relaxed);
+    stats.averageUsed = numUsedSamples > 0 ? totalUsed_.load(std::memory_order_relaxed) / numUsedSamples : 0;
+    stats.numUnderruns = numUnderruns_.load(std::memory_order_relaxed);
+    stats.numOverruns = numOverruns_.load(std::memory_order_relaxed);
+    stats.numSamplesDropped = numSamplesDropped_.load(std::memory_order_relaxed);
+
+    if (reset)
+    {
+        resetPending_.store(RESET_PRODUCER_STATISTICS | RESET_CONSUMER_STATISTICS, std::memory_order_relaxed);
+    }
+}
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::setProducerProbe(ProbeFn fn, void* arg)
+{
+    // The argument has to be in place before the producer can see fn.
+    producerProbeArg_.store(arg, std::memory_order_relaxed);
+    producerProbeFn_.store(fn, std::memory_order_release);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::setConsumerProbe(ProbeFn fn, void* arg)
+{
+    consumerProbeArg_.store(arg, std::memory_order_relaxed);
+    consumerProbeFn_.store(fn, std::memory_order_release);
+}
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::recordUsed_(uint32_t numUsed)
+{
+    if (resetPending_.load(std::memory_order_relaxed) & RESET_CONSUMER_STATISTICS)
+    {
+        resetConsumerStatistics_();
+    }
+
+    uint32_t numUsedSamples = numUsedSamples_.load(std::memory_order_relaxed);
+    uint32_t totalUsed = totalUsed_.load(std::memory_order_relaxed);
+    if (numUsedSamples >= MAX_USED_SAMPLES_IN_AVERAGE)
+    {
+        // Favor recent behavior if nobody's been collecting statistics.
+        numUsedSamples >>= 1;
+        totalUsed >>= 1;
+    }
+
+    numUsedSamples_.store(numUsedSamples + 1, std::memory_order_relaxed);
+    totalUsed_.store(totalUsed + numUsed, std::memory_order_relaxed);
+
+    if (numUsed < minUsed_.load(std::memory_order_relaxed))
+    {
+        minUsed_.store(numUsed, std::memory_order_relaxed);
+    }
+
+    if (numUsed > maxUsed_.load(std::memory_order_relaxed))
+    {
+        maxUsed_.store(numUsed, std::memory_order_relaxed);
+    }
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::resetProducerStatistics_()
+{
+    numOverruns_.store(0, std::memory_order_relaxed);
+    numSamplesDropped_.store(0, std::memory_order_relaxed);
+    resetPending_.fetch_and(~RESET_PRODUCER_STATISTICS, std::memory_order_relaxed);
+}
+
+template<typename SampleType>
+void AudioRingBufferBase<SampleType>::resetConsumerStatistics_()
+{
+    numUnderruns_.store(0, std::memory_order_relaxed);
+    minUsed_.store(UINT32_MAX, std::memory_order_relaxed);
+    maxUsed_.store(0, std::memory_order_relaxed);
+    totalUsed_.store(0, std::memory_order_relaxed);
+    numUsedSamples_.store(0, std::memory_order_relaxed);
+    resetPending_.fetch_and(~RESET_CONSUMER_STATISTICS, std::memory_order_relaxed);
+}
+
+template<typename SampleType>
+typename AudioRingBufferBase<SampleType>::Span AudioRingBufferBase<SampleType>::getSpan_(uint32_t offset, uint32_t numSamples)
+{
+    uint32_t samplesBeforeEnd = capacity_ - offset;
+
+    Span span;
+    span.first = &buffer_[offset];
+    span.firstLength = numSamples < samplesBeforeEnd ? numSamples : samplesBeforeEnd;
+    span.second = buffer_;
+    span.secondLength = numSamples - span.firstLength;
+    return span;
+}
+
+template<typename SampleType>
+uint32_t AudioRingBufferBase<SampleType>::advanceOffset_(uint32_t offset, uint32_t numSamples) const
+{
+    // numSamples is never more than capacity_.
+    offset += numSamples;
+    return offset >= capacity_ ? offset - capacity_ : offset;
+}
+
+template class AudioRingBufferBase<short>;
+template class AudioRingBufferBase<float>;
+
+}
+
+}
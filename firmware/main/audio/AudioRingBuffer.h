@@ -0,0 +1,238 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_RING_BUFFER_H
+#define AUDIO_RING_BUFFER_H
+
+#include <atomic>
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+
+// Matches CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE.
+#define AUDIO_RING_BUFFER_CACHE_LINE_SIZE 32
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Occupancy and glitch counters, used to find which link in the
+///        audio pipeline is starving or backing up.
+struct AudioRingBufferStatistics
+{
+    uint32_t minUsed; // samples queued when the consumer read
+    uint32_t maxUsed;
+    uint32_t averageUsed;
+    uint32_t numUnderruns; // times the consumer ran short of samples
+    uint32_t numOverruns; // times the producer ran out of room
+    uint32_t numSamplesDropped;
+};
+
+/// @brief Lock-free single-producer/single-consumer audio sample queue. This is
+///        safe to use between tasks on different cores as long as only one task
+///        writes and one task reads. Only instantiated for short (the usual
+///        format for links) and float (see AudioFloatRingBuffer).
+template<typename SampleType>
+class AudioRingBufferBase
+{
+public:
+    /// @brief A region of the ring buffer. As the buffer wraps around, this may 
+    ///        consist of two separate pieces; operator[] takes care of this.
+    struct Span
+    {
+        SampleType* first;
+        uint32_t firstLength;
+        SampleType* second;
+        uint32_t secondLength;
+
+        uint32_t size() const { return firstLength + secondLength; }
+        SampleType& operator[](uint32_t index) { return index < firstLength ? first[index] : second[index - firstLength]; }
+    };
+
+    /// @brief Occupancy and glitch counters (shared between sample formats).
+    using Statistics = AudioRingBufferStatistics;
+
+    /// @brief Called by the producer when enough samples are queued (see setConsumerNotification()).
+    typedef void (*NotifyFn)(void* arg);
+
+    /// @brief Creates a new ring buffer.
+    /// @param numSamples The number of samples the buffer can hold (exactly;
+    ///        storage isn't rounded up).
+    AudioRingBufferBase(uint32_t numSamples);
+    virtual ~AudioRingBufferBase();
+
+    /// @brief Returns the maximum number of samples that can be queued.
+    uint32_t capacity() const { return capacity_; }
+
+    /// @brief Returns the number of samples available for reading.
+    uint32_t numUsed() const;
+
+    /// @brief Returns the number of samples that can be written.
+    uint32_t numFree() const;
+
+    /// @brief Reserves space for writing samples directly into the buffer (producer only).
+    /// @param numSamples The number of samples to reserve.
+    /// @return The reserved region, or an empty span if there isn't enough room.
+    Span acquireWrite(uint32_t numSamples);
+
+    /// @brief Makes samples written via acquireWrite() available to the consumer.
+    /// @param numSamples The number of samples written (at most the size of the acquired span).
+    void commitWrite(uint32_t numSamples);
+
+    /// @brief Provides direct access to queued samples (consumer only).
+    /// @param numSamples The number of samples to access.
+    /// @return The requested region, or an empty span if there aren't enough samples.
+    Span acquireRead(uint32_t numSamples);
+
+    /// @brief Removes samples from the buffer once the consumer is done with them.
+    /// @param numSamples The number of samples to remove (at most the size of the acquired span).
+    void release(uint32_t numSamples);
+
+    /// @brief Copies samples into the buffer. Like codec2_fifo_write(), nothing is
+    ///        written unless there's room for everything.
+    /// @return 0 on success, -1 if there isn't enough room.
+    int write(const SampleType* samples, uint32_t numSamples);
+
+    /// @brief Copies samples out of the buffer. Like codec2_fifo_read(), nothing is
+    ///        read unless there are enough samples available.
+    /// @return 0 on success, -1 if there aren't enough samples.
+    int read(SampleType* samples, uint32_t numSamples);
+
+    /// @brief Asks the consumer to discard everything written so far the next 
+    ///        time it reads. Used when the buffer's producer changes.
+    void requestFlush();
+
+    /// @brief Ramps up the volume of the next samples written to avoid clicks
+    ///        when the buffer's producer changes.
+    /// @param numSamples The length of the ramp in samples.
+    /// @note Must be called before the new producer is connected.
+    void requestFadeIn(uint32_t numSamples);
+
+    /// @brief Has the producer call the given function after each write that 
+    ///        leaves at least threshold samples queued, so that the consumer
+    ///        doesn't need to poll. Must be called before audio starts flowing.
+    /// @param fn The function to call (from the producer's task).
+    /// @param arg The argument to pass to fn.
+    /// @param threshold The minimum number of queued samples, or 0 to disable.
+    void setConsumerNotification(NotifyFn fn, void* arg, uint32_t threshold);
+
+    /// @brief Changes the number of samples needed before the consumer is notified.
+    /// @param threshold The minimum number of queued samples, or 0 to disable.
+    void setNotificationThreshold(uint32_t threshold);
+
+    /// @brief Records samples the producer discarded for lack of room (producer only).
+    ///        Failed write() calls are counted automatically.
+    /// @param numSamples The number of samples discarded.
+    void reportOverrun(uint32_t numSamples);
+
+    /// @brief Records that the consumer had to fill in silence (consumer only).
+    /// @param numSamples The number of samples that were missing.
+    void reportUnderrun(uint32_t numSamples);
+
+    /// @brief Retrieves the statistics gathered so far. Safe to call from any task.
+    /// @param stats Structure to store the statistics in.
+    /// @param reset If true, the producer and consumer start over the next time
+    ///        they access the buffer.
+    void getStatistics(Statistics& stats, bool reset = false);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    /// @brief Called with each block of samples passing through the buffer
+    ///        (see AudioLatencyProbe).
+    typedef void (*ProbeFn)(void* arg, Span& span);
+
+    /// @brief Has the producer pass every block it writes to fn just before 
+    ///        it's committed. fn may change the samples.
+    /// @param fn The function to call (from the producer's task), or nullptr to stop.
+    /// @param arg The argument to pass to fn. Must stay valid after fn is removed.
+    void setProducerProbe(ProbeFn fn, void* arg);
+
+    /// @brief Has the consumer pass every block it reads to fn just before 
+    ///        it's released.
+    /// @param fn The function to call (from the consumer's task), or nullptr to stop.
+    /// @param arg The argument to pass to fn. Must stay valid after fn is removed.
+    void setConsumerProbe(ProbeFn fn, void* arg);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+private:
+    SampleType* buffer_;
+    uint32_t capacity_;
+
+    // Free-running indices, each only written by one side. These are kept on
+    // separate cache lines so the producer and consumer don't contend for them.
+    // Each side also keeps its own position in buffer_, since the indices 
+    // can't simply be masked with a capacity that isn't a power of two.
+    alignas(AUDIO_RING_BUFFER_CACHE_LINE_SIZE) std::atomic<uint32_t> writeIndex_;
+    uint32_t writeOffset_; // producer only
+    alignas(AUDIO_RING_BUFFER_CACHE_LINE_SIZE) std::atomic<uint32_t> readIndex_;
+    uint32_t readOffset_; // consumer only
+
+    // Route changes (see AudioGraph). The flush is performed by the consumer
+    // and the fade by the producer, so neither side touches the other's index.
+    std::atomic<bool> flushPending_;
+    std::atomic<uint32_t> flushToIndex_;
+    std::atomic<uint32_t> fadeInRequest_;
+    uint32_t fadeInLength_; // producer only
+    uint32_t fadeInPosition_; // producer only
+
+    NotifyFn notifyFn_;
+    void* notifyArg_;
+    std::atomic<uint32_t> notifyThreshold_;
+
+    // Statistics. Each counter is only updated by one side; resets are
+    // requested via resetPending_ so that they never race with an update.
+    std::atomic<uint32_t> numOverruns_;
+    std::atomic<uint32_t> numSamplesDropped_;
+    std::atomic<uint32_t> numUnderruns_;
+    std::atomic<uint32_t> minUsed_;
+    std::atomic<uint32_t> maxUsed_;
+    std::atomic<uint32_t> totalUsed_;
+    std::atomic<uint32_t> numUsedSamples_;
+    std::atomic<uint8_t> resetPending_;
+
+#if CONFIG_EZDV_EVENT_TRACE
+    bool aboveHighWater_; // producer only
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    std::atomic<ProbeFn> producerProbeFn_;
+    std::atomic<void*> producerProbeArg_;
+    std::atomic<ProbeFn> consumerProbeFn_;
+    std::atomic<void*> consumerProbeArg_;
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+    Span getSpan_(uint32_t offset, uint32_t numSamples);
+    uint32_t advanceOffset_(uint32_t offset, uint32_t numSamples) const;
+    void recordUsed_(uint32_t numUsed);
+    void resetProducerStatistics_();
+    void resetConsumerStatistics_();
+    void applyFadeIn_(Span& span);
+};
+
+/// @brief The sample format used by most links.
+using AudioRingBuffer = AudioRingBufferBase<short>;
+
+/// @brief Carries samples at the same scale as AudioRingBuffer (i.e. +/- 32767)
+///        but without rounding them, for links where both ends work in float.
+using AudioFloatRingBuffer = AudioRingBufferBase<float>;
+
+}
+
+}
+
+#endif // AUDIO_RING_BUFFER_H
@@ -16,9 +16,14 @@
  */
 
 #include <cmath>
+#include <cstring>
 
 #include "BeeperTask.h"
 
+#include "util/Nco.h"
+
+#include "esp_heap_caps.h"
+
 // Beeper constants. This is based on 1 dit per 60/(50 * wpm) = 60/(50*15) = 0.08s
 #define CW_TIME_UNIT_MS 80
 #define DIT_SIZE 1
@@ -27,6 +32,18 @@
 #define SPACE_BETWEEN_CHARS 3
 #define SPACE_BETWEEN_WORDS 7
 #define CW_SIDETONE_FREQ_HZ ((float)600.0)
+#define CW_SIDETONE_AMPLITUDE (10000)
+
+// TBD -- assuming 8KHz sample rate. 600 Hz is a whole number of cycles per
+// time unit, so cached elements join up without phase jumps.
+#define CW_SAMPLE_RATE (8000)
+#define CW_TIME_UNIT_SAMPLES (CW_TIME_UNIT_MS * CW_SAMPLE_RATE / 1000)
+
+// Raised cosine rise/fall time at the ends of each dit and dah to avoid key clicks.
+#define CW_RAMP_SAMPLES (40)
+
+// Must be a power of two. More than enough for the longest SetBeeperTextMessage.
+#define BEEPER_SCRIPT_SIZE (1024)
 
 // Found via experimentation
 #define BEEPER_TIMER_TICK_MS ((int)(CW_TIME_UNIT_MS))
@@ -81,20 +98,58 @@ std::map<char, std::string> BeeperTask::CharacterToMorse_ = {
 };
 
 BeeperTask::BeeperTask()
-    : DVTask("BeeperTask", 10, 4096, tskNO_AFFINITY, 16, pdMS_TO_TICKS(10))
-    , AudioInput(1, 1) // we don't need the input FIFO, just the output one
+    : DVTask("BeeperTask", 10, 4096, tskNO_AFFINITY, 16)
+    , AudioInput("BeeperTask", 1, { AUDIO_INPUT_UNUSED }) // we don't need the input FIFO, just the output one
     , beeperTimer_(this, this, &BeeperTask::onTimerTick_, BEEPER_TIMER_TICK_US, "BeeperTimer")
-    , sineGenerator_(CW_SIDETONE_FREQ_HZ, 10000)
-    , sineCounter_(0)
     , deferShutdown_(false)
+    , scriptHead_(0)
+    , scriptTail_(0)
 {
-    registerMessageHandler(this, &BeeperTask::onSetBeeperText_);
-    registerMessageHandler(this, &BeeperTask::onClearBeeperText_);
+    static_assert((BEEPER_SCRIPT_SIZE & (BEEPER_SCRIPT_SIZE - 1)) == 0, "Beeper script size must be a power of two");
+
+    registerMessageHandlers<
+        &BeeperTask::onSetBeeperText_,
+        &BeeperTask::onClearBeeperText_>(this);
+
+    script_ = new Element[BEEPER_SCRIPT_SIZE];
+    assert(script_ != nullptr);
+
+    // Pre-render everything we'll ever play (SILENCE is left out as there's
+    // nothing to cache).
+    waveforms_ = (short*)heap_caps_malloc(NUM_ELEMENTS * CW_TIME_UNIT_SAMPLES * sizeof(short), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(waveforms_ != nullptr);
+
+    util::Nco sidetone(CW_SIDETONE_FREQ_HZ, CW_SIDETONE_AMPLITUDE, CW_SAMPLE_RATE);
+    for (int element = TONE_SINGLE; element < NUM_ELEMENTS; element++)
+    {
+        short* waveform = &waveforms_[element * CW_TIME_UNIT_SAMPLES];
+        bool rampUp = element == TONE_SINGLE || element == TONE_START;
+        bool rampDown = element == TONE_SINGLE || element == TONE_END;
+
+        sidetone.reset();
+        sidetone.generate(waveform, CW_TIME_UNIT_SAMPLES);
+
+        for (int index = 0; index < CW_RAMP_SAMPLES; index++)
+        {
+            float gain = 0.5 * (1 - cosf(M_PI * (index + 0.5) / CW_RAMP_SAMPLES));
+            if (rampUp)
+            {
+                waveform[index] *= gain;
+            }
+            if (rampDown)
+            {
+                waveform[CW_TIME_UNIT_SAMPLES - 1 - index] *= gain;
+            }
+        }
+    }
 }
 
 BeeperTask::~BeeperTask()
 {
     beeperTimer_.stop();
+
+    heap_caps_free(waveforms_);
+    delete[] script_;
 }
 
 void BeeperTask::onTaskStart_()
@@ -105,13 +160,12 @@ void BeeperTask::onTaskStart_()
 void BeeperTask::onTaskSleep_()
 {
     beeperTimer_.stop();
-    beeperList_.clear();
-    sineCounter_ = 0;
+    clearScript_();
 }
 
 void BeeperTask::onTaskSleep_(DVTask* origin, TaskSleepMessage* message)
 {
-    if (beeperList_.size() > 0)
+    if (!isScriptEmpty_())
     {
         // We're deferring shutdown until we've played through the beeper
         // list.
@@ -129,7 +183,6 @@ void BeeperTask::onSetBeeperText_(DVTask* origin, SetBeeperTextMessage* message)
 
     beeperTimer_.stop();
 
-    sineCounter_ = 0;
     stringToBeeperScript_(message->text);
 
     beeperTimer_.start();
@@ -138,36 +191,35 @@ void BeeperTask::onSetBeeperText_(DVTask* origin, SetBeeperTextMessage* message)
 void BeeperTask::onClearBeeperText_(DVTask* origin, ClearBeeperTextMessage* message)
 {
     beeperTimer_.stop();
-    beeperList_.clear();
-    sineCounter_ = 0;
+    clearScript_();
 }
 
 void BeeperTask::onTimerTick_(DVTimer*)
 {
-    // TBD -- assuming 8KHz sample rate
-    struct FIFO* outputFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
+    OutputClaim output(this, AudioInput::LEFT_CHANNEL);
+    AudioRingBuffer* outputFifo = output.fifo();
 
-    if (beeperList_.size() > 0)
+    if (!isScriptEmpty_())
     {
-        short bufToQueue[CW_TIME_UNIT_MS * 8000 / 1000];
-        bool emitSine = beeperList_[0];
-        beeperList_.erase(beeperList_.begin());
+        Element element = script_[scriptHead_++ & (BEEPER_SCRIPT_SIZE - 1)];
+
+        // Copy directly into the output FIFO. As before, the beep is
+        // dropped if there isn't room for all of it.
+        auto span = outputFifo->acquireWrite(CW_TIME_UNIT_SAMPLES);
 
-        //ESP_LOGI("UserInterface", "Beep: %d", emitSine);
-        if (emitSine)
+        if (element != SILENCE)
         {
-            for (int index = 0; index < sizeof(bufToQueue) / sizeof(short); index++)
-            {
-                bufToQueue[index] = sineGenerator_.getSample(sineCounter_++);
-            }
+            const short* waveform = &waveforms_[element * CW_TIME_UNIT_SAMPLES];
+            memcpy(span.first, waveform, span.firstLength * sizeof(short));
+            memcpy(span.second, waveform + span.firstLength, span.secondLength * sizeof(short));
         }
         else
         {
-            sineCounter_ = 0;
-            memset(bufToQueue, 0, sizeof(bufToQueue));
+            memset(span.first, 0, span.firstLength * sizeof(short));
+            memset(span.second, 0, span.secondLength * sizeof(short));
         }
 
-        codec2_fifo_write(outputFifo, bufToQueue, sizeof(bufToQueue) / sizeof(short));
+        outputFifo->commitWrite(span.size());
     }
     else
     {
@@ -179,11 +231,27 @@ void BeeperTask::onTimerTick_(DVTimer*)
         else
         {
             beeperTimer_.stop();
-            sineCounter_ = 0;
         }
     }
 }
 
+void BeeperTask::appendToScript_(Element element)
+{
+    if (scriptTail_ - scriptHead_ >= BEEPER_SCRIPT_SIZE)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Beeper script full, dropping remaining text");
+        return;
+    }
+
+    script_[scriptTail_++ & (BEEPER_SCRIPT_SIZE - 1)] = element;
+}
+
+void BeeperTask::clearScript_()
+{
+    scriptHead_ = 0;
+    scriptTail_ = 0;
+}
+
 void BeeperTask::stringToBeeperScript_(std::string str)
 {
     for (int index = 0; index < str.size(); index++)
@@ -199,7 +267,7 @@ void BeeperTask::stringToBeeperScript_(std::string str)
             // Add inter-word spacing
             for (int count = 0; count < SPACE_BETWEEN_WORDS; count++)
             {
-                beeperList_.push_back(false);
+                appendToScript_(SILENCE);
             }
         }
     }
@@ -214,9 +282,18 @@ void BeeperTask::charToBeeperScript_(char ch)
         int counts = morseString[index] == '-' ? DAH_SIZE : DIT_SIZE;
         
         // Add audio for the character
-        for (int count = 0; count < counts; count++)
+        if (counts == 1)
         {
-            beeperList_.push_back(true);
+            appendToScript_(TONE_SINGLE);
+        }
+        else
+        {
+            appendToScript_(TONE_START);
+            for (int count = 2; count < counts; count++)
+            {
+                appendToScript_(TONE_MIDDLE);
+            }
+            appendToScript_(TONE_END);
         }
         
         // Add intra-character space
@@ -224,7 +301,7 @@ void BeeperTask::charToBeeperScript_(char ch)
         {
             for (int count = 0; count < SPACE_BETWEEN_DITS; count++)
             {
-                beeperList_.push_back(false);
+                appendToScript_(SILENCE);
             }
         }
     }
@@ -232,7 +309,7 @@ void BeeperTask::charToBeeperScript_(char ch)
     // Add inter-character space
     for (int count = 0; count < SPACE_BETWEEN_CHARS; count++)
     {
-        beeperList_.push_back(false);
+        appendToScript_(SILENCE);
     }
 }
 }
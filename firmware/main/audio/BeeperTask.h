@@ -25,7 +25,6 @@
 #include "BeeperMessage.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
-#include "util/SineWaveGenerator.h"
 
 namespace ezdv
 {
@@ -48,11 +47,32 @@ protected:
     virtual void onTaskSleep_() override;
 
 private:
+    // Each script entry is one CW time unit of one of these.
+    enum Element : uint8_t
+    {
+        SILENCE,
+        TONE_SINGLE, // a dit: ramps up and back down
+        TONE_START,  // ramps up
+        TONE_MIDDLE,
+        TONE_END,    // ramps down
+
+        NUM_ELEMENTS
+    };
+
     DVTimer beeperTimer_;
-    util::SineWaveGenerator sineGenerator_;
-    int sineCounter_;
     bool deferShutdown_;
-    std::vector<bool> beeperList_;
+
+    // Pre-rendered audio for each element other than SILENCE.
+    short* waveforms_;
+
+    // Ring of elements left to play; indices increase forever and wrap via masking.
+    Element* script_;
+    uint32_t scriptHead_;
+    uint32_t scriptTail_;
+
+    void appendToScript_(Element element);
+    void clearScript_();
+    bool isScriptEmpty_() const { return scriptHead_ == scriptTail_; }
 
     void onSetBeeperText_(DVTask* origin, SetBeeperTextMessage* message);
     void onClearBeeperText_(DVTask* origin, ClearBeeperTextMessage* message);
@@ -0,0 +1,171 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "sdkconfig.h"
+
+#include "Codec2Allocator.h"
+#include "util/MemoryPlacement.h"
+
+// Allocations at or below this size are candidates for internal RAM.
+#define CODEC2_INTERNAL_MAX_ALLOC_SIZE (CONFIG_EZDV_CODEC2_INTERNAL_MAX_ALLOC_SIZE)
+
+// Total internal RAM Codec2 may use across all FreeDV instances.
+#define CODEC2_INTERNAL_BUDGET (CONFIG_EZDV_CODEC2_INTERNAL_RAM_BUDGET)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+// RX, TX and the extra decoders all open instances at the same time, so
+// the budget is shared and reports are per task.
+static std::atomic<size_t> InternalBytesInUse_(0);
+static thread_local Codec2Allocator::Report* CurrentReport_ = nullptr;
+
+void Codec2Allocator::BeginReport(Report* report)
+{
+    memset(report, 0, sizeof(Report));
+    CurrentReport_ = report;
+}
+
+void Codec2Allocator::EndReport()
+{
+    CurrentReport_ = nullptr;
+}
+
+size_t Codec2Allocator::GetInternalBytesInUse()
+{
+    return InternalBytesInUse_.load();
+}
+
+void* Codec2Allocator::Allocate(size_t size)
+{
+    void* ptr = nullptr;
+
+    if (util::MemoryPlacement::IsInternal(util::MemoryPlacement::CODEC2))
+    {
+        // Everything is wanted in internal RAM, so the budget doesn't apply.
+        ptr = util::MemoryPlacement::Allocate(util::MemoryPlacement::CODEC2, size);
+        if (ptr != nullptr && esp_ptr_internal(ptr))
+        {
+            size_t actualSize = heap_caps_get_allocated_size(ptr);
+            InternalBytesInUse_ += actualSize;
+
+            if (CurrentReport_ != nullptr)
+            {
+                CurrentReport_->internalBytes += actualSize;
+                CurrentReport_->internalAllocations++;
+            }
+        }
+        else if (ptr != nullptr && CurrentReport_ != nullptr)
+        {
+            CurrentReport_->spiramBytes += size;
+            CurrentReport_->spiramAllocations++;
+        }
+        return ptr;
+    }
+
+    if (size <= CODEC2_INTERNAL_MAX_ALLOC_SIZE)
+    {
+        // Reserve space in the budget before actually allocating.
+        size_t inUse = InternalBytesInUse_.load();
+        while (inUse + size <= CODEC2_INTERNAL_BUDGET && 
+               !InternalBytesInUse_.compare_exchange_weak(inUse, inUse + size))
+        {
+            // inUse was updated by compare_exchange_weak, try again.
+        }
+
+        if (inUse + size <= CODEC2_INTERNAL_BUDGET)
+        {
+            ptr = util::MemoryPlacement::AllocateWithCaps(
+                util::MemoryPlacement::CODEC2, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+            if (ptr != nullptr)
+            {
+                // Free() subtracts what the heap actually gave us.
+                size_t actualSize = heap_caps_get_allocated_size(ptr);
+                InternalBytesInUse_ += actualSize - size;
+
+                if (CurrentReport_ != nullptr)
+                {
+                    CurrentReport_->internalBytes += actualSize;
+                    CurrentReport_->internalAllocations++;
+                }
+                return ptr;
+            }
+
+            // Internal RAM is lower than expected, fall back to SPIRAM.
+            InternalBytesInUse_ -= size;
+        }
+    }
+
+    ptr = util::MemoryPlacement::AllocateWithCaps(
+        util::MemoryPlacement::CODEC2, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    if (ptr != nullptr && CurrentReport_ != nullptr)
+    {
+        CurrentReport_->spiramBytes += size;
+        CurrentReport_->spiramAllocations++;
+    }
+    return ptr;
+}
+
+void Codec2Allocator::Free(void* ptr)
+{
+    if (ptr == nullptr) return;
+
+    if (esp_ptr_internal(ptr))
+    {
+        InternalBytesInUse_ -= heap_caps_get_allocated_size(ptr);
+    }
+    util::MemoryPlacement::Free(util::MemoryPlacement::CODEC2, ptr);
+}
+
+}
+
+}
+
+// Required memory allocation wrappers for embedded platforms.
+extern "C"
+{
+    void* codec2_malloc(size_t size)
+    {
+        return ezdv::audio::Codec2Allocator::Allocate(size);
+    }
+
+    void* codec2_calloc(size_t nmemb, size_t size)
+    {
+        if (size != 0 && nmemb > SIZE_MAX / size) return nullptr;
+
+        void* ptr = ezdv::audio::Codec2Allocator::Allocate(nmemb * size);
+        if (ptr != nullptr)
+        {
+            memset(ptr, 0, nmemb * size);
+        }
+        return ptr;
+    }
+
+    void codec2_free(void* ptr)
+    {
+        ezdv::audio::Codec2Allocator::Free(ptr);
+    }
+}
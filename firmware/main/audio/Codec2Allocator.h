@@ -0,0 +1,62 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CODEC2_ALLOCATOR_H
+#define CODEC2_ALLOCATOR_H
+
+#include <cstddef>
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Allocation policy for Codec2's state (via codec2_malloc() and friends).
+///        Small allocations (which tend to be the per-frame working buffers and 
+///        filter states) go to a budgeted amount of internal RAM; everything 
+///        else, and anything that doesn't fit in the budget, goes to SPIRAM.
+class Codec2Allocator
+{
+public:
+    /// @brief Where a series of Codec2 allocations ended up.
+    struct Report
+    {
+        size_t internalBytes;
+        int internalAllocations;
+        size_t spiramBytes;
+        int spiramAllocations;
+    };
+
+    /// @brief Starts collecting allocations made by the current task into report.
+    static void BeginReport(Report* report);
+
+    /// @brief Stops collecting allocations for the current task.
+    static void EndReport();
+
+    /// @brief Returns the amount of internal RAM currently used by Codec2.
+    static size_t GetInternalBytesInUse();
+
+    static void* Allocate(size_t size);
+    static void Free(void* ptr);
+};
+
+}
+
+}
+
+#endif // CODEC2_ALLOCATOR_H
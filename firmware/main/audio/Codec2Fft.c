@@ -0,0 +1,142 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+
+#include "kiss_fft.h"
+#include "_kiss_fft_guts.h"
+
+#include "Codec2Fft.h"
+
+/* The smallest transform worth handing to esp-dsp. */
+#define CODEC2_FFT_MIN_SIZE (16)
+
+/* The S3's SIMD FFT wants 16 byte aligned data. */
+#define CODEC2_FFT_ALIGNMENT (16)
+
+static float* fft_table_ = NULL;
+
+void __real_kiss_fft(kiss_fft_cfg cfg, const kiss_fft_cpx *fin, kiss_fft_cpx *fout);
+kiss_fft_cfg __real_kiss_fft_alloc(int nfft, int inverse_fft, void *mem, size_t *lenmem);
+
+void codec2_fft_accel_init(void)
+{
+    if (fft_table_ != NULL) return;
+
+    float* table = (float*)heap_caps_aligned_calloc(
+        CODEC2_FFT_ALIGNMENT, CODEC2_FFT_MAX_SIZE, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    assert(table != NULL);
+
+    ESP_ERROR_CHECK(dsps_fft2r_init_fc32(table, CODEC2_FFT_MAX_SIZE));
+    fft_table_ = table;
+}
+
+static int uses_esp_dsp_(int nfft)
+{
+    return nfft >= CODEC2_FFT_MIN_SIZE && 
+           nfft <= CODEC2_FFT_MAX_SIZE && 
+           (nfft & (nfft - 1)) == 0;
+}
+
+/* Output buffers that esp-dsp can't use directly go through a scratch 
+   buffer placed right after the kiss_fft state (see __wrap_kiss_fft_alloc()).
+   Every codec2 instance has its own states, so tasks running codec2 at the 
+   same time never share one. */
+static kiss_fft_cpx* get_scratch_(kiss_fft_cfg cfg)
+{
+    uintptr_t stateEnd = (uintptr_t)cfg + sizeof(struct kiss_fft_state) + sizeof(kiss_fft_cpx) * (cfg->nfft - 1);
+    return (kiss_fft_cpx*)((stateEnd + CODEC2_FFT_ALIGNMENT - 1) & ~(uintptr_t)(CODEC2_FFT_ALIGNMENT - 1));
+}
+
+/* kiss_fft_cpx and esp-dsp's fc32 format are both interleaved real/imaginary
+   floats, so data can be handed over as is. kiss_fft's inverse transform is
+   unscaled, which is the same as conjugating before and after a forward one. */
+static void conjugate_(kiss_fft_cpx* data, int nfft)
+{
+    for (int index = 0; index < nfft; index++)
+    {
+        data[index].i = -data[index].i;
+    }
+}
+
+static void esp_dsp_fft_(int inverse, const kiss_fft_cpx *fin, kiss_fft_cpx *fout, int nfft)
+{
+    if (fin != fout)
+    {
+        memcpy(fout, fin, nfft * sizeof(kiss_fft_cpx));
+    }
+
+    if (inverse) conjugate_(fout, nfft);
+    dsps_fft2r_fc32((float*)fout, nfft);
+    dsps_bit_rev_fc32((float*)fout, nfft);
+    if (inverse) conjugate_(fout, nfft);
+}
+
+kiss_fft_cfg __wrap_kiss_fft_alloc(int nfft, int inverse_fft, void *mem, size_t *lenmem)
+{
+    if (!uses_esp_dsp_(nfft))
+    {
+        return __real_kiss_fft_alloc(nfft, inverse_fft, mem, lenmem);
+    }
+
+    /* Same as kiss_fft_alloc() but with room for the scratch buffer, so 
+       that it's freed along with the state. kiss_fftr_alloc() embeds 
+       its kiss_fft state this way too, so it gets one as well. */
+    size_t stateSize = 0;
+    __real_kiss_fft_alloc(nfft, inverse_fft, NULL, &stateSize);
+    size_t memNeeded = stateSize + CODEC2_FFT_ALIGNMENT - 1 + sizeof(kiss_fft_cpx) * nfft;
+
+    if (lenmem == NULL)
+    {
+        mem = KISS_FFT_MALLOC(memNeeded);
+        return (mem != NULL) ? __real_kiss_fft_alloc(nfft, inverse_fft, mem, &stateSize) : NULL;
+    }
+
+    kiss_fft_cfg cfg = NULL;
+    if (mem != NULL && *lenmem >= memNeeded)
+    {
+        cfg = __real_kiss_fft_alloc(nfft, inverse_fft, mem, &stateSize);
+    }
+    *lenmem = memNeeded;
+    return cfg;
+}
+
+void __wrap_kiss_fft(kiss_fft_cfg cfg, const kiss_fft_cpx *fin, kiss_fft_cpx *fout)
+{
+    int nfft = cfg->nfft;
+
+    if (fft_table_ == NULL || !uses_esp_dsp_(nfft))
+    {
+        __real_kiss_fft(cfg, fin, fout);
+    }
+    else if (((uintptr_t)fout & (CODEC2_FFT_ALIGNMENT - 1)) == 0)
+    {
+        esp_dsp_fft_(cfg->inverse, fin, fout, nfft);
+    }
+    else
+    {
+        /* Most of codec2's buffers are on the stack and aren't aligned. */
+        kiss_fft_cpx* scratch = get_scratch_(cfg);
+        esp_dsp_fft_(cfg->inverse, fin, scratch, nfft);
+        memcpy(fout, scratch, nfft * sizeof(kiss_fft_cpx));
+    }
+}
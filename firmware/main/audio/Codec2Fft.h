@@ -0,0 +1,42 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CODEC2_FFT_H
+#define CODEC2_FFT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/* esp-dsp backed FFT for codec2. codec2 has no FFT hook of its own, so its 
+   kiss_fft() calls are redirected here at link time (-Wl,--wrap=kiss_fft).
+   Power of two transforms up to CODEC2_FFT_MAX_SIZE points use esp-dsp's
+   radix-2 FFT; everything else goes to the original kiss_fft. kiss_fft_alloc()
+   is wrapped as well so that each of those transforms carries its own 
+   aligned scratch buffer. */
+
+#define CODEC2_FFT_MAX_SIZE (512)
+
+/* Sets up esp-dsp's twiddle tables. Must be called before any FreeDV/Codec2 
+   instance is created. Until then, every transform uses kiss_fft. */
+void codec2_fft_accel_init(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // CODEC2_FFT_H
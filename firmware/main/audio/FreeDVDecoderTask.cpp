@@ -0,0 +1,241 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "sdkconfig.h"
+#include "FreeDVDecoderTask.h"
+#include "AudioInput.h"
+
+#include "esp_timer.h"
+
+#define CURRENT_LOG_TAG ("FreeDVDecoder")
+
+// Same as FreeDVTask as we do the same work.
+#define FREEDV_DECODER_TASK_STACK_SIZE (47000)
+
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+// FreeDVTask wakes us up whenever it adds audio; the tick is only a fallback.
+#define FREEDV_DECODER_TICK_INTERVAL_MS (100)
+#else
+#define FREEDV_DECODER_TICK_INTERVAL_MS (10)
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+FreeDVDecoderTask::FreeDVDecoderTask(AudioFanOutBuffer* input)
+    : DVTask("FreeDVDecoderTask", 14, FREEDV_DECODER_TASK_STACK_SIZE, 1, 16, pdMS_TO_TICKS(FREEDV_DECODER_TICK_INTERVAL_MS))
+    , input_(input)
+    , activeDecoder_(NO_ACTIVE_DECODER)
+    , hunting_(true)
+    , isActive_(false)
+    , profiler_("FreeDVDecoder")
+{
+    registerMessageHandlers<
+        &FreeDVDecoderTask::onSetFreeDVMode_,
+        &FreeDVDecoderTask::onReportingSettingsUpdate_>(this);
+
+    for (int index = 0; index < MAX_DECODERS; index++)
+    {
+        Decoder& decoder = decoders_[index];
+        decoder.mode = ANALOG;
+        decoder.sync = false;
+        decoder.dv = nullptr;
+        decoder.cursor = 0;
+        decoder.output = new AudioRingBuffer(FREEDV_MAX_FRAME_SAMPLES * 2);
+        assert(decoder.output != nullptr);
+    }
+}
+
+FreeDVDecoderTask::~FreeDVDecoderTask()
+{
+    releaseDecoders_();
+    cache_.clear();
+
+    for (int index = 0; index < MAX_DECODERS; index++)
+    {
+        delete decoders_[index].output;
+    }
+}
+
+FreeDVMode FreeDVDecoderTask::getDecoderMode(int index) const
+{
+    return (FreeDVMode)decoders_[index].mode.load();
+}
+
+bool FreeDVDecoderTask::getDecoderSync(int index) const
+{
+    return decoders_[index].sync.load();
+}
+
+AudioRingBuffer* FreeDVDecoderTask::getDecoderOutput(int index)
+{
+    return decoders_[index].output;
+}
+
+void FreeDVDecoderTask::setSchedule(int activeDecoder, bool hunting)
+{
+    activeDecoder_ = activeDecoder;
+    hunting_ = hunting;
+}
+
+void FreeDVDecoderTask::onTaskStart_()
+{
+    isActive_ = true;
+}
+
+void FreeDVDecoderTask::onTaskSleep_()
+{
+    isActive_ = false;
+    releaseDecoders_();
+    cache_.clear();
+}
+
+void FreeDVDecoderTask::releaseDecoders_()
+{
+    for (int index = 0; index < MAX_DECODERS; index++)
+    {
+        Decoder& decoder = decoders_[index];
+
+        // FreeDVTask stops looking at this decoder as soon as the mode is cleared.
+        decoder.mode = ANALOG;
+        decoder.sync = false;
+        decoder.output->requestFlush();
+
+        decoder.dv = nullptr;
+    }
+
+    // Instances stay in the cache for the next mode change.
+    for (int mode = FREEDV_700D; mode < MAX_FREEDV_MODES; mode++)
+    {
+        cache_.release((FreeDVMode)mode);
+    }
+}
+
+void FreeDVDecoderTask::onTaskTick_()
+{
+    if (!isActive_) return;
+
+    bool hunting = hunting_;
+    int activeDecoder = activeDecoder_;
+
+    for (int index = 0; index < MAX_DECODERS; index++)
+    {
+        Decoder& decoder = decoders_[index];
+        if (decoder.dv == nullptr) continue;
+
+        if (!hunting && index != activeDecoder)
+        {
+            // Someone else has sync. Don't spend CPU on this decoder until
+            // they lose it; it'll start over with current audio then.
+            decoder.cursor = input_->head();
+            decoder.sync = false;
+            continue;
+        }
+
+        int numSpeechSamples = freedv_get_n_speech_samples(decoder.dv);
+        short* inputBuf = cache_.getModemBuffer();
+        short* outputBuf = cache_.getSpeechBuffer();
+        int nin = freedv_nin(decoder.dv);
+
+        while (decoder.output->numFree() >= (uint32_t)numSpeechSamples && 
+               input_->read(&decoder.cursor, inputBuf, nin) >= 0)
+        {
+            auto timeBegin = esp_timer_get_time();
+            int nout = freedv_rx(decoder.dv, outputBuf, inputBuf);
+            profiler_.record(
+                (FreeDVMode)decoder.mode.load(), esp_timer_get_time() - timeBegin, 
+                nin, freedv_get_modem_sample_rate(decoder.dv));
+
+            decoder.output->write(outputBuf, nout);
+            nin = freedv_nin(decoder.dv);
+        }
+
+        decoder.sync = freedv_get_sync(decoder.dv) > 0;
+    }
+}
+
+void FreeDVDecoderTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+{
+    releaseDecoders_();
+
+    // Analog means the user doesn't want any decoding.
+    if (message->mode == FreeDVMode::ANALOG) return;
+
+    int index = 0;
+    for (int mode = FREEDV_700D; mode < MAX_FREEDV_MODES; mode++)
+    {
+        if (mode == message->mode) continue;
+
+        assert(index < MAX_DECODERS);
+        Decoder& decoder = decoders_[index++];
+        decoder.dv = cache_.acquire((FreeDVMode)mode);
+        decoder.cursor = input_->head();
+        decoder.mode = mode;
+    }
+
+    // Make sure reliable_text is set up on any newly created instances.
+    storage::Settings::Reporting reporting;
+    if (storage::SettingsSnapshot::Read(&storage::Settings::reporting, reporting) > 0)
+    {
+        setCallsign_(reporting.callsign);
+    }
+}
+
+void FreeDVDecoderTask::onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message)
+{
+    setCallsign_(message->callsign);
+}
+
+void FreeDVDecoderTask::setCallsign_(const char* callsign)
+{
+    if (strlen(callsign) == 0) return;
+
+    cache_.setCallsign(callsign, OnReliableTextRx_, this);
+}
+
+void FreeDVDecoderTask::OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int length, void* state)
+{
+    FreeDVDecoderTask* obj = (FreeDVDecoderTask*)state;
+
+    // Find the decoder this reliable_text instance belongs to.
+    for (int index = 0; index < MAX_DECODERS; index++)
+    {
+        Decoder& decoder = obj->decoders_[index];
+        if (decoder.dv == nullptr || 
+            obj->cache_.getReliableText((FreeDVMode)decoder.mode.load()) != rt) continue;
+
+        int sync = 0;
+        float snr = 0;
+        freedv_get_modem_stats(decoder.dv, &sync, &snr);
+        ESP_LOGI(CURRENT_LOG_TAG, "Received TX from %s in mode %d", txt_ptr, decoder.mode.load());
+
+        FreeDVReceivedCallsignMessage message((char*)txt_ptr, snr);
+        obj->publish(&message);
+        break;
+    }
+
+    reliable_text_reset(rt);
+}
+
+}
+
+}
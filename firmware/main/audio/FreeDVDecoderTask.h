@@ -0,0 +1,110 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_DECODER_TASK_H
+#define FREEDV_DECODER_TASK_H
+
+#include <atomic>
+
+#include "AudioFanOutBuffer.h"
+#include "AudioRingBuffer.h"
+#include "FreeDVInstanceCache.h"
+#include "FreeDVMessage.h"
+#include "ModemProfiler.h"
+#include "storage/SettingsMessage.h"
+#include "storage/SettingsSnapshot.h"
+#include "task/DVTask.h"
+
+#include "freedv_api.h"
+#include "reliable_text.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Runs decoders for the FreeDV modes other than the selected one so 
+///        that FreeDVTask can switch to whichever mode is actually on the air.
+///        All decoders read the same radio audio from a shared AudioFanOutBuffer.
+class FreeDVDecoderTask : public DVTask
+{
+public:
+    enum { MAX_DECODERS = MAX_FREEDV_MODES - 2 }; // everything but analog and the selected mode
+    enum { NO_ACTIVE_DECODER = -1 };
+
+    /// @brief Creates the decoder task.
+    /// @param input The radio audio shared with FreeDVTask.
+    FreeDVDecoderTask(AudioFanOutBuffer* input);
+    virtual ~FreeDVDecoderTask();
+
+    /// @brief Returns the mode a decoder is running (ANALOG if unused).
+    FreeDVMode getDecoderMode(int index) const;
+
+    /// @brief Returns whether a decoder currently has sync.
+    bool getDecoderSync(int index) const;
+
+    /// @brief Returns the decoded speech produced by a decoder (consumed by FreeDVTask).
+    AudioRingBuffer* getDecoderOutput(int index);
+
+    /// @brief Controls which decoders are allowed to use CPU time.
+    /// @param activeDecoder The decoder currently providing audio, or 
+    ///        NO_ACTIVE_DECODER if FreeDVTask's own decoder is.
+    /// @param hunting If true, every decoder runs. Otherwise only the active one does.
+    void setSchedule(int activeDecoder, bool hunting);
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+    virtual void onTaskTick_() override;
+
+private:
+    struct Decoder
+    {
+        std::atomic<int> mode;
+        std::atomic<bool> sync;
+        struct freedv* dv;
+        AudioFanOutBuffer::Cursor cursor;
+        AudioRingBuffer* output;
+    };
+
+    AudioFanOutBuffer* input_;
+    FreeDVInstanceCache cache_;
+    Decoder decoders_[MAX_DECODERS];
+    std::atomic<int> activeDecoder_;
+    std::atomic<bool> hunting_;
+    bool isActive_;
+
+    ModemProfiler profiler_;
+
+    void releaseDecoders_();
+
+    void onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message);
+    void onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message);
+    void setCallsign_(const char* callsign);
+
+    static void OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int length, void* state);
+};
+
+}
+
+}
+
+#endif // FREEDV_DECODER_TASK_H
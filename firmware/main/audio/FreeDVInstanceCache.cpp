@@ -0,0 +1,270 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "Codec2Allocator.h"
+#include "FreeDVInstanceCache.h"
+#include "util/MemoryPlacement.h"
+
+// Unused instances are only kept while at least this much SPIRAM is free.
+#define FREEDV_CACHE_MIN_FREE_SPIRAM (1024 * 1024)
+
+#define CURRENT_LOG_TAG ("FreeDVCache")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+FreeDVInstanceCache::FreeDVInstanceCache()
+    : onReceive_(nullptr)
+    , onReceiveState_(nullptr)
+    , modemBuf_(nullptr)
+    , modemBufSamples_(0)
+    , speechBuf_(nullptr)
+    , speechBufSamples_(0)
+{
+    memset(entries_, 0, sizeof(entries_));
+    memset(callsign_, 0, sizeof(callsign_));
+}
+
+FreeDVInstanceCache::~FreeDVInstanceCache()
+{
+    clear();
+}
+
+struct freedv* FreeDVInstanceCache::acquire(FreeDVMode mode)
+{
+    assert(mode > ANALOG && mode < MAX_FREEDV_MODES);
+    Entry& entry = entries_[mode];
+
+    if (entry.dv != nullptr)
+    {
+        // Start over as if we'd just been created.
+        freedv_set_sync(entry.dv, FREEDV_SYNC_UNSYNC);
+        if (entry.rText != nullptr)
+        {
+            reliable_text_reset(entry.rText);
+        }
+    }
+    else
+    {
+        if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < FREEDV_CACHE_MIN_FREE_SPIRAM)
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Low on SPIRAM, freeing unused FreeDV instances");
+            for (int index = 0; index < MAX_FREEDV_MODES; index++)
+            {
+                if (!entries_[index].inUse)
+                {
+                    close_(entries_[index]);
+                }
+            }
+        }
+
+        entry.dv = Open_(mode);
+        linkReliableText_(entry);
+        growFrameBuffers_(entry.dv);
+    }
+
+    entry.inUse = true;
+    return entry.dv;
+}
+
+void FreeDVInstanceCache::release(FreeDVMode mode)
+{
+    if (mode > ANALOG && mode < MAX_FREEDV_MODES)
+    {
+        entries_[mode].inUse = false;
+    }
+}
+
+reliable_text_t FreeDVInstanceCache::getReliableText(FreeDVMode mode) const
+{
+    return entries_[mode].rText;
+}
+
+void FreeDVInstanceCache::setCallsign(const char* callsign, ReliableTextFn onReceive, void* state)
+{
+    if (!strncmp(callsign_, callsign, sizeof(callsign_) - 1) && onReceive == onReceive_ && state == onReceiveState_)
+    {
+        // Nothing's changed, no need to recreate everything.
+        return;
+    }
+
+    memset(callsign_, 0, sizeof(callsign_));
+    strncpy(callsign_, callsign, sizeof(callsign_) - 1);
+    onReceive_ = onReceive;
+    onReceiveState_ = state;
+
+    for (int index = 0; index < MAX_FREEDV_MODES; index++)
+    {
+        Entry& entry = entries_[index];
+        if (entry.dv != nullptr)
+        {
+            unlinkReliableText_(entry);
+            linkReliableText_(entry);
+        }
+    }
+}
+
+void FreeDVInstanceCache::clear()
+{
+    for (int index = 0; index < MAX_FREEDV_MODES; index++)
+    {
+        close_(entries_[index]);
+    }
+
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, modemBuf_);
+    modemBuf_ = nullptr;
+    modemBufSamples_ = 0;
+
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, speechBuf_);
+    speechBuf_ = nullptr;
+    speechBufSamples_ = 0;
+}
+
+void FreeDVInstanceCache::growFrameBuffers_(struct freedv* dv)
+{
+    int numModemSamples = freedv_get_n_max_modem_samples(dv);
+    int numNomModemSamples = freedv_get_n_nom_modem_samples(dv);
+    if (numNomModemSamples > numModemSamples)
+    {
+        numModemSamples = numNomModemSamples;
+    }
+
+    GrowBuffer_(&modemBuf_, &modemBufSamples_, numModemSamples);
+    GrowBuffer_(&speechBuf_, &speechBufSamples_, freedv_get_n_speech_samples(dv));
+}
+
+void FreeDVInstanceCache::GrowBuffer_(short** buf, int* currentSamples, int numSamples)
+{
+    if (numSamples <= *currentSamples) return;
+
+    // Frame buffers are touched on every freedv_rx()/freedv_tx() call, so 
+    // they're DSP buffers (internal RAM by default) rather than SPIRAM.
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, *buf);
+    *buf = (short*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, numSamples, sizeof(short));
+    assert(*buf != nullptr);
+    *currentSamples = numSamples;
+}
+
+void FreeDVInstanceCache::linkReliableText_(Entry& entry)
+{
+    // Only a non-null callsign means we should set up reliable_text.
+    if (strlen(callsign_) == 0) return;
+
+    entry.rText = reliable_text_create();
+    assert(entry.rText != nullptr);
+
+    reliable_text_set_string(entry.rText, callsign_, strlen(callsign_));
+    reliable_text_use_with_freedv(entry.rText, entry.dv, onReceive_, onReceiveState_);
+}
+
+void FreeDVInstanceCache::unlinkReliableText_(Entry& entry)
+{
+    if (entry.rText != nullptr)
+    {
+        reliable_text_unlink_from_freedv(entry.rText);
+        reliable_text_destroy(entry.rText);
+        entry.rText = nullptr;
+    }
+}
+
+void FreeDVInstanceCache::close_(Entry& entry)
+{
+    if (entry.dv != nullptr)
+    {
+        unlinkReliableText_(entry);
+        freedv_close(entry.dv);
+        entry.dv = nullptr;
+    }
+    entry.inUse = false;
+}
+
+struct freedv* FreeDVInstanceCache::Open_(FreeDVMode mode)
+{
+    int freedvApiMode = 0;
+    switch (mode)
+    {
+        case FREEDV_700D:
+            freedvApiMode = FREEDV_MODE_700D;
+            break;
+        case FREEDV_700E:
+            freedvApiMode = FREEDV_MODE_700E;
+            break;
+        case FREEDV_1600:
+            freedvApiMode = FREEDV_MODE_1600;
+            break;
+        default:
+            assert(0);
+    }
+
+    Codec2Allocator::Report report;
+    Codec2Allocator::BeginReport(&report);
+    struct freedv* dv = freedv_open(freedvApiMode);
+    Codec2Allocator::EndReport();
+    assert(dv != nullptr);
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "Mode %d: %d bytes internal (%d allocations), %d bytes SPIRAM (%d allocations), %d bytes internal in use overall",
+        (int)mode, (int)report.internalBytes, report.internalAllocations, 
+        (int)report.spiramBytes, report.spiramAllocations,
+        (int)Codec2Allocator::GetInternalBytesInUse());
+    
+    switch (freedvApiMode)
+    {
+        case FREEDV_MODE_700D:
+            freedv_set_eq(dv, 1);
+            freedv_set_clip(dv, 1);
+            freedv_set_tx_bpf(dv, 1);
+            freedv_set_squelch_en(dv, 1);
+            freedv_set_snr_squelch_thresh(dv, -2.0);  /* squelch at -2.0 dB      */
+            break;
+        case FREEDV_MODE_700E:
+            freedv_set_eq(dv, 1);
+            freedv_set_clip(dv, 1);
+            freedv_set_tx_bpf(dv, 1);
+            freedv_set_squelch_en(dv, 1);
+            freedv_set_snr_squelch_thresh(dv, 1);  /* squelch at 1.0 dB      */
+            break;
+        case FREEDV_MODE_1600:
+            freedv_set_clip(dv, 0);
+            freedv_set_tx_bpf(dv, 0);
+            freedv_set_squelch_en(dv, 0);
+            break;
+        default:
+            assert(0);
+            freedv_set_clip(dv, 0);
+            freedv_set_tx_bpf(dv, 0);
+            freedv_set_squelch_en(dv, 1);
+            freedv_set_snr_squelch_thresh(dv, 0.0);  /* squelch at 0.0 dB      */
+            break;
+    }
+
+    return dv;
+}
+
+}
+
+}
@@ -0,0 +1,109 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_INSTANCE_CACHE_H
+#define FREEDV_INSTANCE_CACHE_H
+
+#include "FreeDVMessage.h"
+
+#include "freedv_api.h"
+#include "reliable_text.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Keeps configured freedv instances around after they're no longer
+///        in use so switching back to a mode doesn't require recreating it.
+///        Unused instances are freed if SPIRAM runs low. Also owns internal RAM
+///        frame buffers large enough for any instance it's handed out. Not 
+///        thread safe; each task using FreeDV has its own cache.
+class FreeDVInstanceCache
+{
+public:
+    /// @brief Called when reliable_text receives a callsign.
+    using ReliableTextFn = void(*)(reliable_text_t rt, const char* txt_ptr, int length, void* state);
+
+    FreeDVInstanceCache();
+    virtual ~FreeDVInstanceCache();
+
+    /// @brief Returns a ready to use instance for the given mode (creating 
+    ///        it if needed) and marks it as in use. Cached instances lose sync
+    ///        and any partially received text.
+    /// @param mode The mode to use (anything other than ANALOG).
+    struct freedv* acquire(FreeDVMode mode);
+
+    /// @brief Marks a mode's instance as no longer in use (but keeps it cached).
+    void release(FreeDVMode mode);
+
+    /// @brief Returns the reliable_text instance linked to the mode's freedv 
+    ///        instance, or nullptr if there's no callsign.
+    reliable_text_t getReliableText(FreeDVMode mode) const;
+
+    /// @brief Sets up reliable_text on all current and future instances.
+    /// @param callsign The callsign to transmit (empty to disable reliable_text).
+    /// @param onReceive Called when a callsign is received (nullptr if we never receive).
+    /// @param state Passed to onReceive.
+    void setCallsign(const char* callsign, ReliableTextFn onReceive, void* state);
+
+    /// @brief Frees every instance, including ones in use, and the frame buffers.
+    void clear();
+
+    /// @brief Returns a buffer that can hold a frame of modem samples (the
+    ///        larger of freedv_get_n_max_modem_samples() and 
+    ///        freedv_get_n_nom_modem_samples()) for any acquired instance.
+    short* getModemBuffer() const { return modemBuf_; }
+
+    /// @brief Returns a buffer that can hold a frame of speech samples for 
+    ///        any acquired instance.
+    short* getSpeechBuffer() const { return speechBuf_; }
+
+private:
+    struct Entry
+    {
+        struct freedv* dv;
+        reliable_text_t rText;
+        bool inUse;
+    };
+
+    Entry entries_[MAX_FREEDV_MODES];
+    char callsign_[FreeDVReceivedCallsignMessage::MAX_STR_SIZE];
+    ReliableTextFn onReceive_;
+    void* onReceiveState_;
+
+    short* modemBuf_;
+    int modemBufSamples_;
+    short* speechBuf_;
+    int speechBufSamples_;
+
+    void linkReliableText_(Entry& entry);
+    void unlinkReliableText_(Entry& entry);
+    void close_(Entry& entry);
+    void growFrameBuffers_(struct freedv* dv);
+
+    static void GrowBuffer_(short** buf, int* currentSamples, int numSamples);
+
+    static struct freedv* Open_(FreeDVMode mode);
+};
+
+}
+
+}
+
+#endif // FREEDV_INSTANCE_CACHE_H
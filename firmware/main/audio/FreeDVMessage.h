@@ -46,6 +46,17 @@ enum FreeDVMessageTypes
     // Indicates that we've processed all remaining input and 
     // PTT can be terminated.
     TX_COMPLETE = 7,
+
+    // The mode currently being received (multi-mode RX only).
+    FREEDV_RX_MODE = 8,
+
+    // Spectrum feed for the web UI. Only generated while enabled.
+    SET_SPECTRUM_ENABLED = 9,
+    FREEDV_SPECTRUM = 10,
+
+    // Decoded audio for listening from the web UI. Only encoded while enabled.
+    SET_AUDIO_MONITOR_ENABLED = 11,
+    AUDIO_MONITOR_FRAME = 12,
 };
 
 class FreeDVSyncStateMessage : public DVTaskMessageBase<SYNC_STATE, FreeDVSyncStateMessage>
@@ -57,6 +68,11 @@ public:
         {}
     virtual ~FreeDVSyncStateMessage() = default;
 
+    bool operator==(const FreeDVSyncStateMessage& other) const
+    {
+        return syncState == other.syncState;
+    }
+
     bool syncState;
 };
 
@@ -85,6 +101,7 @@ public:
 
 using SetFreeDVModeMessage = FreeDVModeMessageCommon<SET_FREEDV_MODE>;
 using RequestSetFreeDVModeMessage = FreeDVModeMessageCommon<REQUEST_SET_FREEDV_MODE>;
+using FreeDVReceivedModeMessage = FreeDVModeMessageCommon<FREEDV_RX_MODE>;
 
 class RequestGetFreeDVModeMessage : public DVTaskMessageBase<REQUEST_GET_FREEDV_MODE, RequestGetFreeDVModeMessage>
 {
@@ -126,6 +143,79 @@ public:
     float snr;
 };
 
+class FreeDVSetSpectrumEnabledMessage : public DVTaskMessageBase<SET_SPECTRUM_ENABLED, FreeDVSetSpectrumEnabledMessage>
+{
+public:
+    FreeDVSetSpectrumEnabledMessage(bool enabledProvided = false)
+        : DVTaskMessageBase<SET_SPECTRUM_ENABLED, FreeDVSetSpectrumEnabledMessage>(FREEDV_MESSAGE)
+        , enabled(enabledProvided)
+        {}
+    virtual ~FreeDVSetSpectrumEnabledMessage() = default;
+
+    bool enabled;
+};
+
+class FreeDVSpectrumMessage : public DVTaskMessageBase<FREEDV_SPECTRUM, FreeDVSpectrumMessage>
+{
+public:
+    // Bins are evenly spaced from 0 Hz to half the modem sample rate.
+    enum { NUM_BINS = 128 };
+
+    // Bin values map linearly from MIN_DB (0) to MAX_DB (255) relative to full scale.
+    enum { MIN_DB = -100, MAX_DB = 0 };
+
+    FreeDVSpectrumMessage()
+        : DVTaskMessageBase<FREEDV_SPECTRUM, FreeDVSpectrumMessage>(FREEDV_MESSAGE)
+        , mode(0)
+        , sync(false)
+        , snr(0)
+        , freqOffsetHz(0)
+    {
+        memset(bins, 0, sizeof(bins));
+    }
+    virtual ~FreeDVSpectrumMessage() = default;
+
+    uint8_t mode; // FreeDVMode
+    bool sync;
+    int8_t snr; // dB
+    int16_t freqOffsetHz;
+    uint8_t bins[NUM_BINS];
+};
+
+class FreeDVSetAudioMonitorEnabledMessage : public DVTaskMessageBase<SET_AUDIO_MONITOR_ENABLED, FreeDVSetAudioMonitorEnabledMessage>
+{
+public:
+    FreeDVSetAudioMonitorEnabledMessage(bool enabledProvided = false)
+        : DVTaskMessageBase<SET_AUDIO_MONITOR_ENABLED, FreeDVSetAudioMonitorEnabledMessage>(FREEDV_MESSAGE)
+        , enabled(enabledProvided)
+        {}
+    virtual ~FreeDVSetAudioMonitorEnabledMessage() = default;
+
+    bool enabled;
+};
+
+class FreeDVAudioMonitorMessage : public DVTaskMessageBase<AUDIO_MONITOR_FRAME, FreeDVAudioMonitorMessage>
+{
+public:
+    // 40 ms of 8 kHz audio as IMA ADPCM, two samples per byte (low nibble 
+    // first). Each frame carries the encoder state it started with so it 
+    // can be decoded on its own.
+    enum { NUM_SAMPLES = 320 };
+
+    FreeDVAudioMonitorMessage()
+        : DVTaskMessageBase<AUDIO_MONITOR_FRAME, FreeDVAudioMonitorMessage>(FREEDV_MESSAGE)
+        , predictor(0)
+        , stepIndex(0)
+    {
+        memset(data, 0, sizeof(data));
+    }
+    virtual ~FreeDVAudioMonitorMessage() = default;
+
+    int16_t predictor;
+    uint8_t stepIndex;
+    uint8_t data[NUM_SAMPLES / 2];
+};
+
 class TransmitCompleteMessage : public DVTaskMessageBase<TX_COMPLETE, TransmitCompleteMessage>
 {
 public:
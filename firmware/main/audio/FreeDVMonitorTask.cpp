@@ -0,0 +1,158 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "esp_log.h"
+
+#include "FreeDVMonitorTask.h"
+
+#define CURRENT_LOG_TAG ("FreeDVMonitor")
+
+// Same as FreeDVTask as we do the same work.
+#define FREEDV_MONITOR_TASK_STACK_SIZE (40000)
+#define FREEDV_MONITOR_TICK_INTERVAL_MS (20)
+
+// Audio is skipped once this many modem frames are waiting.
+#define FREEDV_MONITOR_MAX_BACKLOG_FRAMES (4)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+FreeDVMonitorTask::FreeDVMonitorTask()
+    : DVTask("FreeDVMonitorTask", 3, FREEDV_MONITOR_TASK_STACK_SIZE, 1, 8, pdMS_TO_TICKS(FREEDV_MONITOR_TICK_INTERVAL_MS))
+    , AudioInput("FreeDVMonitorTask", 1, { FREEDV_MAX_FRAME_SAMPLES })
+    , dv_(nullptr)
+    , currentMode_(ANALOG)
+    , isActive_(false)
+    , hasSync_(false)
+    , numSkippedSamples_(0)
+{
+    registerMessageHandlers<&FreeDVMonitorTask::onSetFreeDVMode_>(this);
+}
+
+FreeDVMonitorTask::~FreeDVMonitorTask()
+{
+    cache_.clear();
+}
+
+void FreeDVMonitorTask::onTaskStart_()
+{
+    isActive_ = true;
+
+    // Start out in the same mode as FreeDVTask.
+    RequestGetFreeDVModeMessage request;
+    publish(&request);
+}
+
+void FreeDVMonitorTask::onTaskSleep_()
+{
+    isActive_ = false;
+
+    if (numSkippedSamples_ > 0)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Skipped %" PRIu32 " samples to keep up", numSkippedSamples_);
+        numSkippedSamples_ = 0;
+    }
+
+    if (dv_ != nullptr)
+    {
+        cache_.release(currentMode_);
+        dv_ = nullptr;
+    }
+    cache_.clear();
+}
+
+void FreeDVMonitorTask::onTaskTick_()
+{
+    if (!isActive_) return;
+
+    auto input = getAudioInput(LEFT_CHANNEL);
+    OutputClaim claim(this, LEFT_CHANNEL);
+    auto output = claim.fifo();
+
+    if (dv_ == nullptr)
+    {
+        // Analog: pass audio through as-is.
+        short buf[FREEDV_MAX_FRAME_SAMPLES];
+        uint32_t numSamples = std::min(input->numUsed(), (uint32_t)FREEDV_MAX_FRAME_SAMPLES);
+        while (numSamples > 0 && input->read(buf, numSamples) == 0)
+        {
+            if (output != nullptr)
+            {
+                output->write(buf, numSamples);
+            }
+            numSamples = std::min(input->numUsed(), (uint32_t)FREEDV_MAX_FRAME_SAMPLES);
+        }
+        return;
+    }
+
+    // Fall behind gracefully rather than building up latency.
+    int nin = freedv_nin(dv_);
+    uint32_t numUsed = input->numUsed();
+    uint32_t maxBacklog = freedv_get_n_max_modem_samples(dv_) * FREEDV_MONITOR_MAX_BACKLOG_FRAMES;
+    if (numUsed > maxBacklog)
+    {
+        auto span = input->acquireRead(numUsed - maxBacklog);
+        input->release(span.size());
+        numSkippedSamples_ += span.size();
+    }
+
+    short* inputBuf = cache_.getModemBuffer();
+    short* outputBuf = cache_.getSpeechBuffer();
+    while (input->read(inputBuf, nin) == 0)
+    {
+        int nout = freedv_rx(dv_, outputBuf, inputBuf);
+        if (output != nullptr)
+        {
+            output->write(outputBuf, nout);
+        }
+        nin = freedv_nin(dv_);
+    }
+
+    bool sync = freedv_get_sync(dv_) > 0;
+    if (sync != hasSync_)
+    {
+        hasSync_ = sync;
+        ESP_LOGI(CURRENT_LOG_TAG, "%s sync", sync ? "Gained" : "Lost");
+    }
+}
+
+void FreeDVMonitorTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+{
+    if (message->mode == currentMode_) return;
+
+    if (dv_ != nullptr)
+    {
+        cache_.release(currentMode_);
+        dv_ = nullptr;
+    }
+
+    currentMode_ = message->mode;
+    hasSync_ = false;
+    if (currentMode_ != ANALOG)
+    {
+        dv_ = cache_.acquire(currentMode_);
+    }
+}
+
+}
+
+}
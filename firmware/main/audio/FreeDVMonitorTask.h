@@ -0,0 +1,67 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_MONITOR_TASK_H
+#define FREEDV_MONITOR_TASK_H
+
+#include "AudioInput.h"
+#include "FreeDVInstanceCache.h"
+#include "FreeDVMessage.h"
+#include "task/DVTask.h"
+
+#include "freedv_api.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Decodes a second radio audio stream (e.g. another Flex slice) in
+///        the current FreeDV mode, alongside FreeDVTask. Runs at low priority
+///        so it only uses CPU time the main decoder doesn't need; if it falls 
+///        behind, the oldest audio is skipped. Analog audio passes through.
+class FreeDVMonitorTask : public DVTask, public AudioInput
+{
+public:
+    FreeDVMonitorTask();
+    virtual ~FreeDVMonitorTask();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+    virtual void onTaskTick_() override;
+
+private:
+    FreeDVInstanceCache cache_;
+    struct freedv* dv_;
+    FreeDVMode currentMode_;
+    bool isActive_;
+    bool hasSync_;
+    uint32_t numSkippedSamples_;
+
+    void onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message);
+};
+
+}
+
+}
+
+#endif // FREEDV_MONITOR_TASK_H
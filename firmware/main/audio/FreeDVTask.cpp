@@ -15,17 +15,71 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cinttypes>
+#include <cmath>
 #include <cstring>
+#include <type_traits>
 
+#include "sdkconfig.h"
 #include "FreeDVTask.h"
+#include "Codec2Fft.h"
 
 #include "esp_dsp.h"
 #include "codec2_math.h"
 #include "modem_stats.h"
+#include "esp_timer.h"
+
+#if CONFIG_EZDV_BENCHMARK_CODEC2_MATH
+#include "Codec2Allocator.h"
+#include "util/BootTimeline.h"
+#endif // CONFIG_EZDV_BENCHMARK_CODEC2_MATH
 
 #define FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP 160
+
+// Not yet reduced for the frame buffers moving to cache_. Only shrink this
+// based on the peaks CONFIG_EZDV_TASK_WATERMARKS logs on hardware.
+#define FREEDV_TASK_STACK_SIZE (47000)
+
+// Radio audio kept for the other decoders. They can fall up to half of
+// this behind (~0.5s) before losing audio.
+#define FREEDV_MULTI_RX_FAN_OUT_SAMPLES (8192)
 #define CURRENT_LOG_TAG ("FreeDV")
 
+// After a stall, RX catches up by processing as many frames as it can within
+// this much time per tick before letting other messages through.
+#define FREEDV_RX_TICK_BUDGET_US (20000)
+
+// Anything further behind than this is dropped rather than decoded late (0 = never drop).
+#define FREEDV_RX_MAX_BACKLOG_SAMPLES (CONFIG_EZDV_FREEDV_RX_MAX_BACKLOG_MS * 8)
+
+// After this long without sync, only every Nth frame is demodulated to save
+// power (0 = always demodulate every frame).
+#define FREEDV_IDLE_SEARCH_DELAY_US (CONFIG_EZDV_FREEDV_IDLE_SEARCH_DELAY_S * 1000000LL)
+#define FREEDV_IDLE_SEARCH_DECIMATION (CONFIG_EZDV_FREEDV_IDLE_SEARCH_DECIMATION)
+
+// Spectrum feed: one FFT of the most recent radio audio per interval.
+#define FREEDV_SPECTRUM_FFT_SIZE (FreeDVSpectrumMessage::NUM_BINS * 2)
+#define FREEDV_SPECTRUM_INTERVAL_US (CONFIG_EZDV_SPECTRUM_INTERVAL_MS * 1000)
+
+// Spectrum updates are this much less frequent while shedding load.
+#define FREEDV_SPECTRUM_LOAD_SHED_MULTIPLIER (4)
+#define FREEDV_SPECTRUM_ALIGNMENT (16)
+
+#if CONFIG_EZDV_BENCHMARK_CODEC2_MATH
+// Pilot correlation lengths (M + Ncp) for 700E and 700D.
+#define BENCHMARK_VECTOR_LENGTHS { 64, 160 }
+#define BENCHMARK_ITERATIONS (1000)
+
+static void BenchmarkCodec2Math_();
+#endif // CONFIG_EZDV_BENCHMARK_CODEC2_MATH
+
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+// Audio is processed as soon as a full frame arrives; the tick is only a fallback.
+#define FREEDV_TICK_INTERVAL_MS (100)
+#else
+#define FREEDV_TICK_INTERVAL_MS (10)
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+
 namespace ezdv
 {
 
@@ -33,60 +87,113 @@ namespace audio
 {
 
 FreeDVTask::FreeDVTask()
-    : DVTask("FreeDVTask", 15, 47000, 0, 16, pdMS_TO_TICKS(10))
-    , AudioInput(2, 2)
+    : DVTask("FreeDVTask", 15, FREEDV_TASK_STACK_SIZE, 0, 16, pdMS_TO_TICKS(FREEDV_TICK_INTERVAL_MS))
+    , AudioInput("FreeDVTask", 2, { FREEDV_MAX_FRAME_SAMPLES, FREEDV_MAX_FRAME_SAMPLES, FREEDV_MAX_FRAME_SAMPLES })
+    , txTask_(this)
     , dv_(nullptr)
-    , rText_(nullptr)
     , currentMode_(0)
     , isTransmitting_(false)
-    , isEndingTransmit_(false)
     , isActive_(false)
-    , samplesBeforeEnd_(0)
+    , profiler_("FreeDVRx")
     , stats_(nullptr)
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    , rxDeadline_("FreeDV RX", 0, 0)
+    , modemRecoveryPending_(false)
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+    , spectrumEnabled_(false)
+    , lastSpectrumTimeUs_(0)
+    , spectrumIntervalUs_(FREEDV_SPECTRUM_INTERVAL_US)
+    , spectrumWindow_(nullptr)
+    , spectrumBuf_(nullptr)
+    , lastSyncTimeUs_(0)
+    , idleFrameCount_(0)
+    , isIdleSearch_(false)
+    , powerLock_("FreeDVTask")
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+    , fanOut_(FREEDV_MULTI_RX_FAN_OUT_SAMPLES)
+    , decoderTask_(&fanOut_)
+    , fanOutCursor_(0)
+    , activeDecoder_(FreeDVDecoderTask::NO_ACTIVE_DECODER)
+    , lastReportedRxMode_(ANALOG)
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
 {
-    registerMessageHandler(this, &FreeDVTask::onSetFreeDVMode_);
-    registerMessageHandler(this, &FreeDVTask::onSetPTTState_);
-    registerMessageHandler(this, &FreeDVTask::onReportingSettingsUpdate_);
-    registerMessageHandler(this, &FreeDVTask::onRequestGetFreeDVMode_);
+    registerMessageHandlers<
+        &FreeDVTask::onSetFreeDVMode_,
+        &FreeDVTask::onSetPTTState_,
+        &FreeDVTask::onReportingSettingsUpdate_,
+        &FreeDVTask::onRequestGetFreeDVMode_,
+        &FreeDVTask::onTransmitComplete_,
+        &FreeDVTask::onSetSpectrumEnabled_>(this);
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    registerMessageHandlers<&FreeDVTask::onLoadSheddingMessage_>(this);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+    // Needs to happen before any FreeDV instance (including txTask_'s) is opened.
+    codec2_fft_accel_init();
+
+#if CONFIG_EZDV_BENCHMARK_CODEC2_MATH
+    BenchmarkCodec2Math_();
+#endif // CONFIG_EZDV_BENCHMARK_CODEC2_MATH
+
+    // Audio needs to be processed on a fixed cadence to keep FIFO levels stable.
+    enableDeadlineTicks();
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // Used by FlexVitaTask in both directions (see AudioGraph).
+    enableFloatAudioInput(AudioInput::RADIO_CHANNEL);
+    enableFloatAudioOutput(AudioInput::RADIO_CHANNEL);
+
+    floatModemBuf_ = (float*)heap_caps_calloc(FREEDV_MAX_FRAME_SAMPLES, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    assert(floatModemBuf_ != nullptr);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+    // USER_CHANNEL and KEYER_CHANNEL belong to txTask_.
+    setAudioInputNotification(AudioInput::RADIO_CHANNEL, this, 0);
+    updateAudioThresholds_();
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
 }
 
 FreeDVTask::~FreeDVTask()
 {
-    if (dv_ != nullptr)
-    {
-        if (rText_ != nullptr)
-        {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
-        }
+    cache_.clear();
+    dv_ = nullptr;
 
-        freedv_close(dv_);
-        dv_ = nullptr;
+    if (stats_ != nullptr)
+    {
+        modem_stats_close(stats_);
+        delete stats_;
     }
+
+    heap_caps_free(spectrumWindow_);
+    heap_caps_free(spectrumBuf_);
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    heap_caps_free(floatModemBuf_);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
 }
 
 void FreeDVTask::onTaskStart_()
 {
     isActive_ = true;
+    start(&txTask_, pdMS_TO_TICKS(1000));
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+    start(&decoderTask_, pdMS_TO_TICKS(1000));
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
 }
 
 void FreeDVTask::onTaskSleep_()
 {
     isActive_ = false;
-
-    if (dv_ != nullptr)
-    {
-        if (rText_ != nullptr)
-        {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
-        }
-
-        freedv_close(dv_);
-        dv_ = nullptr;
-    }
+    sleep(&txTask_, pdMS_TO_TICKS(1000));
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+    sleep(&decoderTask_, pdMS_TO_TICKS(1000));
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
+
+    cache_.clear();
+    dv_ = nullptr;
+    powerLock_.release();
 }
 
 void FreeDVTask::onTaskTick_()
@@ -97,257 +204,454 @@ void FreeDVTask::onTaskTick_()
 
     //ESP_LOGI(CURRENT_LOG_TAG, "timer tick");
 
-    struct FIFO* codecInputFifo = nullptr;
-    struct FIFO* codecOutputFifo = nullptr;
-    if (isTransmitting_)
+    // Input is radio, output is microphone
+    AudioRingBuffer* codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+    OutputClaim output(this, audio::AudioInput::ChannelLabel::USER_CHANNEL);
+    AudioRingBuffer* codecOutputFifo = output.fifo();
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // Flex audio arrives as float and reaches the modem without being rounded to shorts.
+    if (isFloatAudioInputActive(audio::AudioInput::ChannelLabel::RADIO_CHANNEL))
     {
-        // Input is microphone, output is radio
-        codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
-        codecOutputFifo = getAudioOutput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+        if (!receive_(getFloatAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL), codecOutputFifo, syncLed)) return;
     }
     else
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
     {
-        // Input is radio, output is microphone
-        codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
-        codecOutputFifo = getAudioOutput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
+        if (!receive_(codecInputFifo, codecOutputFifo, syncLed)) return;
     }
+    util::BootTimeline::MarkOnce("first audio frame");
+
+    // Broadcast sync state whenever it changes.
+    FreeDVSyncStateMessage message(syncLed);
+    publishIfChanged(&message);
 
+    // nin can change after every freedv_rx() call.
+    updateAudioThresholds_();
+}
+
+template<typename SampleType>
+bool FreeDVTask::receive_(AudioRingBufferBase<SampleType>* codecInputFifo, AudioRingBuffer* codecOutputFifo, bool& syncLed)
+{
     if (dv_ == nullptr)
     {
         // Analog mode, just pipe through the audio.
-        short inputBuf[FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP];
+        SampleType inputBuf[FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP];
         memset(inputBuf, 0, sizeof(inputBuf));
 
-        if (codec2_fifo_free(codecOutputFifo) < FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP) return;
+        if (codecOutputFifo->numFree() < FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP) return false;
         
-        while (!(isTransmitting_ && isEndingTransmit_) && 
-               codec2_fifo_used(codecInputFifo) >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP)
+        while (codecInputFifo->numUsed() >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP)
+        {
+            codecInputFifo->read(inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            if (!isTransmitting_)
+            {
+                if constexpr (std::is_same<SampleType, float>::value)
+                {
+                    // The speaker path is shorts regardless.
+                    short outputBuf[FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP];
+                    for (int index = 0; index < FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP; index++)
+                    {
+                        long value = lrintf(inputBuf[index]);
+                        outputBuf[index] = (value > 32767) ? 32767 : ((value < -32768) ? -32768 : value);
+                    }
+                    codecOutputFifo->write(outputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+                }
+                else
+                {
+                    codecOutputFifo->write(inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+                }
+            }
+        }
+    }
+    else
+    {
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+        if (modemRecoveryPending_)
+        {
+            // Drop what piled up while we were behind and make the modem 
+            // search for the signal again.
+            modemRecoveryPending_ = false;
+            codecInputFifo->requestFlush();
+            freedv_set_sync(dv_, FREEDV_SYNC_UNSYNC);
+        }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+        syncLed = decodeAllModes_(codecInputFifo, codecOutputFifo);
+#else
+        int numSpeechSamples = freedv_get_n_speech_samples(dv_);
+        SampleType* inputBuf = nullptr;
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+        if constexpr (std::is_same<SampleType, float>::value)
+        {
+            inputBuf = floatModemBuf_;
+        }
+        else
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
         {
-            codec2_fifo_read(codecInputFifo, inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
-            codec2_fifo_write(codecOutputFifo, inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            inputBuf = cache_.getModemBuffer();
         }
+        short* outputBuf = cache_.getSpeechBuffer();
+        int nin = freedv_nin(dv_);
 
-        if (isTransmitting_ && isEndingTransmit_)
+        if (codecOutputFifo->numFree() < (uint32_t)numSpeechSamples) return false;
+
+        uint32_t numUsed = codecInputFifo->numUsed();
+        uint32_t backlogLimit = getBacklogLimit_(nin);
+        if (numUsed > backlogLimit)
         {
-            // We've finished processing everything that's left, end TX now.
-            TransmitCompleteMessage message;
-            publish(&message);
+            ESP_LOGD(CURRENT_LOG_TAG, "Dropping %" PRIu32 " samples of stale RX audio", numUsed - backlogLimit);
+            codecInputFifo->release(numUsed - backlogLimit);
+        }
+
+        auto tickBegin = esp_timer_get_time();
+        while (codecOutputFifo->numFree() >= (uint32_t)numSpeechSamples &&
+               codecInputFifo->read(inputBuf, nin) == 0)
+        {
+            int nout = receiveFrame_(outputBuf, inputBuf, nin);
+
+            if (!isTransmitting_)
+            {
+                codecOutputFifo->write(outputBuf, nout);
+            }
+            nin = freedv_nin(dv_);
 
-            isEndingTransmit_ = false;
-            isTransmitting_ = false;
+            if (esp_timer_get_time() - tickBegin >= FREEDV_RX_TICK_BUDGET_US)
+            {
+                // Pick up the rest once any waiting messages are handled.
+                if (codecInputFifo->numUsed() >= (uint32_t)nin)
+                {
+                    requestTick();
+                }
+                break;
+            }
         }
+    
+        syncLed = !isTransmitting_ && freedv_get_sync(dv_) > 0;
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
     }
-    else
+
+    return true;
+}
+
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+bool FreeDVTask::decodeAllModes_(AudioRingBuffer* codecInputFifo, AudioRingBuffer* codecOutputFifo)
+{
+    // Everything from the radio goes through fanOut_ so that every decoder 
+    // reads the same audio from one place.
+    auto span = codecInputFifo->acquireRead(codecInputFifo->numUsed());
+    fanOut_.write(span.first, span.firstLength);
+    fanOut_.write(span.second, span.secondLength);
+    codecInputFifo->release(span.size());
+    decoderTask_.requestTick();
+
+    // The backlog lives in fanOut_ from here on.
+    uint32_t backlogLimit = getBacklogLimit_(freedv_nin(dv_));
+    uint32_t backlog = fanOut_.numAvailable(fanOutCursor_);
+    if (backlog > backlogLimit)
     {
-        if (isTransmitting_)
+        ESP_LOGD(CURRENT_LOG_TAG, "Dropping %" PRIu32 " samples of stale RX audio", backlog - backlogLimit);
+        fanOutCursor_ = fanOut_.head() - backlogLimit;
+    }
+
+    // CPU budget: while the active decoder has sync, nothing else runs. 
+    // Otherwise everyone hunts.
+    bool ownActive = activeDecoder_ == FreeDVDecoderTask::NO_ACTIVE_DECODER;
+    bool activeSync = ownActive ? 
+        freedv_get_sync(dv_) > 0 : 
+        decoderTask_.getDecoderSync(activeDecoder_);
+    bool ownSync = false;
+
+    if (ownActive || !activeSync)
+    {
+        short* inputBuf = cache_.getModemBuffer();
+        short* outputBuf = cache_.getSpeechBuffer();
+        int nin = freedv_nin(dv_);
+
+        auto tickBegin = esp_timer_get_time();
+        while (fanOut_.read(&fanOutCursor_, inputBuf, nin) >= 0)
         {
-            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
-            int numModemSamples = freedv_get_n_nom_modem_samples(dv_);
-            short inputBuf[numSpeechSamples];
-            short outputBuf[numModemSamples];
+            int nout = receiveFrame_(outputBuf, inputBuf, nin);
 
-            if (codec2_fifo_free(codecOutputFifo) < numModemSamples) return;
-        
-            while (codec2_fifo_read(codecInputFifo, inputBuf, numSpeechSamples) == 0)
+            if (ownActive && !isTransmitting_)
             {
-                // Limit the amount of time we spend here so we don't end up
-                // stuck transmitting forever.
-                if (isEndingTransmit_)
+                codecOutputFifo->write(outputBuf, nout);
+            }
+            nin = freedv_nin(dv_);
+
+            if (esp_timer_get_time() - tickBegin >= FREEDV_RX_TICK_BUDGET_US)
+            {
+                // Pick up the rest once any waiting messages are handled.
+                if (fanOut_.numAvailable(fanOutCursor_) >= (uint32_t)nin)
                 {
-                    samplesBeforeEnd_ -= numSpeechSamples;
-                    if (samplesBeforeEnd_ <= 0)
-                    {
-                        break;
-                    }
+                    requestTick();
                 }
-                //auto timeBegin = esp_timer_get_time();
-
-                freedv_tx(dv_, outputBuf, inputBuf);
-                //auto timeEnd = esp_timer_get_time();
-                //ESP_LOGI(CURRENT_LOG_TAG, "freedv_tx ran in %d us on %d samples and generated %d samples", (int)(timeEnd - timeBegin), numSpeechSamples, numModemSamples);
-                codec2_fifo_write(codecOutputFifo, outputBuf, numModemSamples);
+                break;
             }
-            
-            if (isEndingTransmit_ && samplesBeforeEnd_ < numSpeechSamples)
-            {
-                // We've finished processing everything that's left, end TX now.
-                TransmitCompleteMessage message;
-                publish(&message);
+        }
 
-                isEndingTransmit_ = false;
-                isTransmitting_ = false;
-            }
+        ownSync = freedv_get_sync(dv_) > 0;
+    }
+    else
+    {
+        // We'll start over with current audio once it's our turn again.
+        fanOutCursor_ = fanOut_.head();
+    }
+
+    // Pick whoever has sync if the active decoder doesn't, preferring the 
+    // selected mode.
+    activeSync = ownActive ? ownSync : decoderTask_.getDecoderSync(activeDecoder_);
+    if (!activeSync)
+    {
+        if (ownSync)
+        {
+            activeDecoder_ = FreeDVDecoderTask::NO_ACTIVE_DECODER;
+            activeSync = true;
         }
         else
         {
-            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
-            short inputBuf[freedv_get_n_max_modem_samples(dv_)];
-            short outputBuf[numSpeechSamples];
-            int nin = freedv_nin(dv_);
-
-            if (codec2_fifo_free(codecOutputFifo) < numSpeechSamples) return;
-        
-            int rv = codec2_fifo_read(codecInputFifo, inputBuf, nin);
-            if (rv == 0)
+            for (int index = 0; index < FreeDVDecoderTask::MAX_DECODERS; index++)
             {
-                //auto timeBegin = esp_timer_get_time();
+                if (decoderTask_.getDecoderMode(index) != ANALOG && decoderTask_.getDecoderSync(index))
+                {
+                    activeDecoder_ = index;
+                    activeSync = true;
+                    break;
+                }
+            }
+        }
+    }
+    decoderTask_.setSchedule(activeDecoder_, !activeSync);
 
-                int nout = freedv_rx(dv_, outputBuf, inputBuf);
+    // Pass along audio from the active decoder if it's one of the others.
+    for (int index = 0; index < FreeDVDecoderTask::MAX_DECODERS; index++)
+    {
+        AudioRingBuffer* decoderOutput = decoderTask_.getDecoderOutput(index);
+        auto speech = decoderOutput->acquireRead(decoderOutput->numUsed());
+        if (index == activeDecoder_ && !isTransmitting_)
+        {
+            codecOutputFifo->write(speech.first, speech.firstLength);
+            codecOutputFifo->write(speech.second, speech.secondLength);
+        }
+        decoderOutput->release(speech.size());
+    }
 
-                //auto timeEnd = esp_timer_get_time();
-                //ESP_LOGI(CURRENT_LOG_TAG, "freedv_rx ran in %lld us on %d samples and generated %d samples", timeEnd - timeBegin, nin, nout);
-                codec2_fifo_write(codecOutputFifo, outputBuf, nout);
-                nin = freedv_nin(dv_);
-            }
-        
-            syncLed = freedv_get_sync(dv_) > 0;
+    if (activeSync)
+    {
+        FreeDVMode rxMode = (activeDecoder_ == FreeDVDecoderTask::NO_ACTIVE_DECODER) ? 
+            (FreeDVMode)currentMode_ : 
+            decoderTask_.getDecoderMode(activeDecoder_);
+        if (rxMode != lastReportedRxMode_)
+        {
+            ESP_LOGI(CURRENT_LOG_TAG, "Receiving mode %d", (int)rxMode);
+            FreeDVReceivedModeMessage message(rxMode);
+            publish(&message);
+            lastReportedRxMode_ = rxMode;
         }
     }
 
-    // Broadcast current sync state
-    FreeDVSyncStateMessage* message = new FreeDVSyncStateMessage(syncLed);
-    publish(message);
-    delete message;
+    return activeSync && !isTransmitting_;
 }
 
-void FreeDVTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+void FreeDVTask::resetDecoderSelection_()
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV mode to %d", (int)message->mode);
-    currentMode_ = (int)message->mode;
+    fanOutCursor_ = fanOut_.head();
+    activeDecoder_ = FreeDVDecoderTask::NO_ACTIVE_DECODER;
+    lastReportedRxMode_ = ANALOG;
+    decoderTask_.setSchedule(activeDecoder_, true);
+}
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
 
-    if (dv_ != nullptr)
+template<typename SampleType>
+int FreeDVTask::receiveFrame_(short* outputBuf, SampleType* inputBuf, int nin)
+{
+    auto timeBegin = esp_timer_get_time();
+    updateSpectrum_(inputBuf, nin);
+
+    // 1600 isn't squelched, so what it outputs without sync is still worth hearing.
+    if (FREEDV_IDLE_SEARCH_DELAY_US > 0 && currentMode_ != FREEDV_1600 &&
+        timeBegin - lastSyncTimeUs_ >= FREEDV_IDLE_SEARCH_DELAY_US)
     {
-        if (rText_ != nullptr)
+        if (!isIdleSearch_)
         {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
+            ESP_LOGI(CURRENT_LOG_TAG, "No sync for %d seconds, entering idle search", CONFIG_EZDV_FREEDV_IDLE_SEARCH_DELAY_S);
+            isIdleSearch_ = true;
+            idleFrameCount_ = 0;
+            updatePowerLock_();
         }
 
-        modem_stats_close(stats_);
-        delete stats_;
+        if (idleFrameCount_++ % FREEDV_IDLE_SEARCH_DECIMATION != 0)
+        {
+            // Squelched output is silence until there's sync anyway.
+            int nout = freedv_get_n_speech_samples(dv_);
+            memset(outputBuf, 0, nout * sizeof(short));
+            return nout;
+        }
+    }
 
-        freedv_close(dv_);
-        dv_ = nullptr;
+    int nout = 0;
+    if constexpr (std::is_same<SampleType, float>::value)
+    {
+        // Samples are already at freedv_rx()'s scale; it would only convert them to float.
+        nout = freedv_floatrx(dv_, outputBuf, inputBuf);
+    }
+    else
+    {
+        nout = freedv_rx(dv_, outputBuf, inputBuf);
     }
+    auto timeEnd = esp_timer_get_time();
+    profiler_.record(
+        (FreeDVMode)currentMode_, timeEnd - timeBegin, 
+        nin, freedv_get_modem_sample_rate(dv_));
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    int64_t frameUs = (int64_t)nin * 1000000 / freedv_get_modem_sample_rate(dv_);
+    if (timeEnd - timeBegin > frameUs && rxDeadline_.reportMiss(timeEnd, timeEnd - timeBegin - frameUs))
+    {
+        modemRecoveryPending_ = true;
+    }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
 
-    if (message->mode != FreeDVMode::ANALOG)
+    modemStatus_.update(dv_);
+    if (modemStatus_.hasSync())
     {
-        int freedvApiMode = 0;
-        switch (message->mode)
+        if (isIdleSearch_)
         {
-            case FREEDV_700D:
-                freedvApiMode = FREEDV_MODE_700D;
-                break;
-            case FREEDV_700E:
-                freedvApiMode = FREEDV_MODE_700E;
-                break;
-            case FREEDV_1600:
-                freedvApiMode = FREEDV_MODE_1600;
-                break;
-            default:
-                assert(0);
+            ESP_LOGI(CURRENT_LOG_TAG, "Sync detected, leaving idle search");
+            isIdleSearch_ = false;
+            updatePowerLock_();
         }
+        lastSyncTimeUs_ = timeEnd;
+    }
 
-        dv_ = freedv_open(freedvApiMode);
-        assert(dv_ != nullptr);
-        
-        switch (freedvApiMode)
-        {
-            case FREEDV_MODE_700D:
-                freedv_set_eq(dv_, 1);
-                freedv_set_clip(dv_, 1);
-                freedv_set_tx_bpf(dv_, 1);
-                freedv_set_squelch_en(dv_, 1);
-                freedv_set_snr_squelch_thresh(dv_, -2.0);  /* squelch at -2.0 dB      */
-                break;
-            case FREEDV_MODE_700E:
-                freedv_set_eq(dv_, 1);
-                freedv_set_clip(dv_, 1);
-                freedv_set_tx_bpf(dv_, 1);
-                freedv_set_squelch_en(dv_, 1);
-                freedv_set_snr_squelch_thresh(dv_, 1);  /* squelch at 1.0 dB      */
-                break;
-            case FREEDV_MODE_1600:
-                freedv_set_clip(dv_, 0);
-                freedv_set_tx_bpf(dv_, 0);
-                freedv_set_squelch_en(dv_, 0);
-                break;
-            default:
-                assert(0);
-                freedv_set_clip(dv_, 0);
-                freedv_set_tx_bpf(dv_, 0);
-                freedv_set_squelch_en(dv_, 1);
-                freedv_set_snr_squelch_thresh(dv_, 0.0);  /* squelch at 0.0 dB      */
-                break;
-        }
+    return nout;
+}
 
-        stats_ = new MODEM_STATS();
-        assert(stats_ != nullptr);
-        modem_stats_open(stats_);
+void FreeDVTask::resetIdleSearch_()
+{
+    lastSyncTimeUs_ = esp_timer_get_time();
+    isIdleSearch_ = false;
+    updatePowerLock_();
+}
 
-        // Note: reliable_text setup is deferred until we know for sure whether
-        // we have a valid callsign saved.
-        storage::RequestReportingSettingsMessage requestReportingSettings;
-        publish(&requestReportingSettings);
+void FreeDVTask::updatePowerLock_()
+{
+    // Idle search only needs a fraction of the CPU, so the clock can drop
+    // until there's sync again. The other decoders always run in full.
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+    bool needsFullSpeed = dv_ != nullptr || isTransmitting_;
+#else
+    bool needsFullSpeed = (dv_ != nullptr && !isIdleSearch_) || isTransmitting_;
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
+
+    if (needsFullSpeed)
+    {
+        powerLock_.acquire();
+    }
+    else
+    {
+        powerLock_.release();
     }
 }
 
-void FreeDVTask::onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message)
+uint32_t FreeDVTask::getBacklogLimit_(int nin)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV transmit state to %d", (int)message->pttState);
+    if (FREEDV_RX_MAX_BACKLOG_SAMPLES == 0)
+    {
+        return UINT32_MAX;
+    }
+
+    // Always keep enough for the next frame.
+    return FREEDV_RX_MAX_BACKLOG_SAMPLES > nin ? FREEDV_RX_MAX_BACKLOG_SAMPLES : nin;
+}
+
+void FreeDVTask::updateAudioThresholds_()
+{
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+    // Wake up once there's a full frame to work on.
+    uint32_t frameSize = FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP;
+    if (dv_ != nullptr)
+    {
+        frameSize = freedv_nin(dv_);
+    }
+
+    setAudioInputThreshold(AudioInput::RADIO_CHANNEL, frameSize);
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+}
+
+void FreeDVTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV mode to %d", (int)message->mode);
 
-    if (isTransmitting_ && !message->pttState)
+    // The previous mode's instance stays cached for next time.
+    cache_.release((FreeDVMode)currentMode_);
+    currentMode_ = (int)message->mode;
+    dv_ = nullptr;
+    modemStatus_.reset();
+    resetIdleSearch_();
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    rxDeadline_.reset();
+    modemRecoveryPending_ = false;
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    if (message->mode != FreeDVMode::ANALOG)
     {
-        // Delay ending TX until we've processed what's remaining. This means we'll need
-        // to add a bit of silence at the end of the transmission as well depending on 
-        // the currently active mode.
-        samplesBeforeEnd_ = 2000; // 250ms maximum @ 8000 Hz
-        isEndingTransmit_ = true;
+        dv_ = cache_.acquire(message->mode);
 
-        if (dv_ != nullptr)
+        // Note: reliable_text setup is deferred until we know for sure whether
+        // we have a valid callsign saved. If settings haven't been loaded yet,
+        // onReportingSettingsUpdate_() will do it once they are.
+        storage::Settings::Reporting reporting;
+        if (storage::SettingsSnapshot::Read(&storage::Settings::reporting, reporting) > 0)
         {
-            auto codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
-            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
-            short* tmpBuffer = new short[numSpeechSamples];
-            assert(tmpBuffer != nullptr);
-
-            memset(tmpBuffer, 0, sizeof(short) * numSpeechSamples);
-            codec2_fifo_write(codecInputFifo, tmpBuffer, numSpeechSamples);
-            delete[] tmpBuffer;
+            setCallsign_(reporting.callsign);
         }
     }
-    else
+
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+    resetDecoderSelection_();
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
+
+    updateAudioThresholds_();
+    updatePowerLock_();
+}
+
+void FreeDVTask::onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message)
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV transmit state to %d", (int)message->pttState);
+
+    // txTask_ gets this message too and takes care of the actual TX. We 
+    // only unmute once it tells us it's done.
+    if (message->pttState)
     {
-        isEndingTransmit_ = false;
-        isTransmitting_ = message->pttState;
-        if (!isTransmitting_)
-        {
-            TransmitCompleteMessage message;
-            publish(&message);
-        }
+        isTransmitting_ = true;
+        updatePowerLock_();
     }
 }
 
+void FreeDVTask::onTransmitComplete_(DVTask* origin, TransmitCompleteMessage* message)
+{
+    isTransmitting_ = false;
+
+    // Whoever we were talking to may come right back.
+    resetIdleSearch_();
+}
+
 void FreeDVTask::onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message)
 {
-    if (dv_ != nullptr && strlen(message->callsign) > 0)
+    setCallsign_(message->callsign);
+}
+
+void FreeDVTask::setCallsign_(const char* callsign)
+{
+    if (dv_ != nullptr && strlen(callsign) > 0)
     {
         ESP_LOGI(CURRENT_LOG_TAG, "Registering reliable_text handler");
 
-        if (rText_ != nullptr)
-        {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
-        }
-
-        // Non-null callsign means we should set up reliable_text.
-        rText_ = reliable_text_create();
-        assert(rText_ != nullptr);
-
-        reliable_text_set_string(rText_, message->callsign, strlen(message->callsign));
-        reliable_text_use_with_freedv(rText_, dv_, OnReliableTextRx_, this);
+        // Non-null callsign means we should set up reliable_text. This 
+        // applies to every cached instance.
+        cache_.setCallsign(callsign, OnReliableTextRx_, this);
     }
 }
 
@@ -356,29 +660,178 @@ void FreeDVTask::OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int
     // Broadcast receipt to other components that may want it (such as FreeDV Reporter).
     FreeDVTask* thisPtr = (FreeDVTask*)state;
     
-    // Get stats so we can provide updated SNR.
-    freedv_get_modem_extended_stats(thisPtr->dv_, thisPtr->stats_);
-    
-    float snr = thisPtr->stats_->snr_est;
+    // The tracker is updated every frame, so there's no need to pull the
+    // (much more expensive) extended modem stats here.
+    float snr = thisPtr->modemStatus_.getSnr();
     ESP_LOGI(CURRENT_LOG_TAG, "Received TX from %s" /*at %.1f SNR"*/, txt_ptr /*, (float)snr*/);
 
     FreeDVReceivedCallsignMessage message((char*)txt_ptr, snr);
     thisPtr->publish(&message);
 
-    FreeDVTask* task = (FreeDVTask*)state;
-    reliable_text_reset(task->rText_);
+    reliable_text_reset(rt);
+}
+
+void FreeDVTask::onSetSpectrumEnabled_(DVTask* origin, FreeDVSetSpectrumEnabledMessage* message)
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Spectrum feed %s", message->enabled ? "enabled" : "disabled");
+
+    spectrumEnabled_ = message->enabled;
+    if (spectrumEnabled_ && spectrumBuf_ == nullptr)
+    {
+        spectrumWindow_ = (float*)heap_caps_aligned_calloc(
+            FREEDV_SPECTRUM_ALIGNMENT, FREEDV_SPECTRUM_FFT_SIZE, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+        spectrumBuf_ = (float*)heap_caps_aligned_calloc(
+            FREEDV_SPECTRUM_ALIGNMENT, FREEDV_SPECTRUM_FFT_SIZE * 2, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+        assert(spectrumWindow_ != nullptr && spectrumBuf_ != nullptr);
+
+        dsps_wind_hann_f32(spectrumWindow_, FREEDV_SPECTRUM_FFT_SIZE);
+        lastSpectrumTimeUs_ = 0;
+
+        // Only the waterfall needs the extended stats (for the frequency offset).
+        stats_ = new MODEM_STATS();
+        assert(stats_ != nullptr);
+        modem_stats_open(stats_);
+    }
+    else if (!spectrumEnabled_)
+    {
+        heap_caps_free(spectrumWindow_);
+        heap_caps_free(spectrumBuf_);
+        spectrumWindow_ = nullptr;
+        spectrumBuf_ = nullptr;
+
+        if (stats_ != nullptr)
+        {
+            modem_stats_close(stats_);
+            delete stats_;
+            stats_ = nullptr;
+        }
+    }
+}
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+void FreeDVTask::onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message)
+{
+    // HttpServerTask turns the feed off entirely at the highest level.
+    spectrumIntervalUs_ = FREEDV_SPECTRUM_INTERVAL_US;
+    if (message->level >= telemetry::LoadSheddingMessage::SHED_SPECTRUM_RATE)
+    {
+        spectrumIntervalUs_ *= FREEDV_SPECTRUM_LOAD_SHED_MULTIPLIER;
+    }
+}
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+template<typename SampleType>
+void FreeDVTask::updateSpectrum_(const SampleType* samples, int numSamples)
+{
+    if (!spectrumEnabled_ || numSamples < FREEDV_SPECTRUM_FFT_SIZE) return;
+
+    auto now = esp_timer_get_time();
+    if (now - lastSpectrumTimeUs_ < spectrumIntervalUs_) return;
+    lastSpectrumTimeUs_ = now;
+
+    // Windowed FFT of the end of the frame, interleaved real/imaginary as esp-dsp 
+    // expects. esp-dsp's tables were already set up by codec2_fft_accel_init().
+    const SampleType* start = samples + numSamples - FREEDV_SPECTRUM_FFT_SIZE;
+    for (int index = 0; index < FREEDV_SPECTRUM_FFT_SIZE; index++)
+    {
+        spectrumBuf_[2 * index] = start[index] * spectrumWindow_[index];
+        spectrumBuf_[2 * index + 1] = 0;
+    }
+    dsps_fft2r_fc32(spectrumBuf_, FREEDV_SPECTRUM_FFT_SIZE);
+    dsps_bit_rev_fc32(spectrumBuf_, FREEDV_SPECTRUM_FFT_SIZE);
+
+    FreeDVSpectrumMessage message;
+
+    // A full scale sine wave peaks at 32767 * N/4 with a Hann window.
+    const float fullScale = 32767.0f * FREEDV_SPECTRUM_FFT_SIZE / 4;
+    const float dbRange = FreeDVSpectrumMessage::MAX_DB - FreeDVSpectrumMessage::MIN_DB;
+    for (int bin = 0; bin < FreeDVSpectrumMessage::NUM_BINS; bin++)
+    {
+        float re = spectrumBuf_[2 * bin];
+        float im = spectrumBuf_[2 * bin + 1];
+        float db = 10.0f * log10f((re * re + im * im) / (fullScale * fullScale) + 1e-12f);
+
+        float scaled = (db - FreeDVSpectrumMessage::MIN_DB) * 255.0f / dbRange;
+        message.bins[bin] = scaled < 0 ? 0 : (scaled > 255 ? 255 : (uint8_t)scaled);
+    }
+
+    // Modem state to go along with it.
+    freedv_get_modem_extended_stats(dv_, stats_);
+    float snr = modemStatus_.getSnr();
+    message.mode = currentMode_;
+    message.sync = modemStatus_.hasSync();
+    message.snr = snr < INT8_MIN ? INT8_MIN : (snr > INT8_MAX ? INT8_MAX : (int8_t)snr);
+    message.freqOffsetHz = stats_->foff;
+
+    publish(&message);
 }
 
 void FreeDVTask::onRequestGetFreeDVMode_(DVTask* origin, RequestGetFreeDVModeMessage* message)
 {
     SetFreeDVModeMessage msg((FreeDVMode)currentMode_);
-    origin->post(&msg);
+    sendTo(origin, &msg);
 }
 
 }
 
 }
 
+// Four strided esp-dsp passes over the same data.
+static inline void ComplexDotProductEspDsp_(COMP* left, COMP* right, size_t len, float* resultReal, float* resultImag)
+{
+    float realTimesRealResult = 0; // ac
+    float realTimesImag1Result = 0; // bc
+    float realTimesImag2Result = 0; // ad
+    float imagTimesImagResult = 0; // bi * di
+    
+    dsps_dotprode_f32((float*)left, (float*)right, &realTimesRealResult, len, 2, 2);
+    dsps_dotprode_f32((float*)left + 1, (float*)right, &realTimesImag1Result, len, 2, 2);
+    dsps_dotprode_f32((float*)left, (float*)right + 1, &realTimesImag2Result, len, 2, 2);
+    dsps_dotprode_f32((float*)left + 1, (float*)right + 1, &imagTimesImagResult, len, 2, 2);
+    
+    *resultReal = realTimesRealResult - imagTimesImagResult;
+    *resultImag = realTimesImag1Result + realTimesImag2Result;
+}
+
+static inline void ComplexDotProductSinglePass_(COMP* left, COMP* right, size_t len, float* resultReal, float* resultImag)
+{
+    // (a + bi)(c + di) = (ac - bd) + (bc + ad)i, accumulated in a single
+    // pass over both vectors. Two sets of accumulators let consecutive
+    // multiply-adds overlap in the FPU pipeline.
+    float real0 = 0, real1 = 0;
+    float imag0 = 0, imag1 = 0;
+    size_t index = 0;
+
+    for (; index + 1 < len; index += 2)
+    {
+        float a0 = left[index].real, b0 = left[index].imag;
+        float c0 = right[index].real, d0 = right[index].imag;
+        float a1 = left[index + 1].real, b1 = left[index + 1].imag;
+        float c1 = right[index + 1].real, d1 = right[index + 1].imag;
+
+        real0 += a0 * c0;
+        imag0 += b0 * c0;
+        real1 += a1 * c1;
+        imag1 += b1 * c1;
+        real0 -= b0 * d0;
+        imag0 += a0 * d0;
+        real1 -= b1 * d1;
+        imag1 += a1 * d1;
+    }
+
+    if (index < len)
+    {
+        float a = left[index].real, b = left[index].imag;
+        float c = right[index].real, d = right[index].imag;
+
+        real0 += a * c - b * d;
+        imag0 += b * c + a * d;
+    }
+
+    *resultReal = real0 + real1;
+    *resultImag = imag0 + imag1;
+}
+
 // Implement required Codec2 math methods below as CMSIS doesn't work on ESP32.
 extern "C"
 {
@@ -389,35 +842,58 @@ extern "C"
 
     void codec2_complex_dot_product_f32(COMP* left, COMP* right, size_t len, float* resultReal, float* resultImag)
     {
-        float realTimesRealResult = 0; // ac
-        float realTimesImag1Result = 0; // bc
-        float realTimesImag2Result = 0; // ad
-        float imagTimesImagResult = 0; // bi * di
-        
-        dsps_dotprode_f32((float*)left, (float*)right, &realTimesRealResult, len, 2, 2);
-        dsps_dotprode_f32((float*)left + 1, (float*)right, &realTimesImag1Result, len, 2, 2);
-        dsps_dotprode_f32((float*)left, (float*)right + 1, &realTimesImag2Result, len, 2, 2);
-        dsps_dotprode_f32((float*)left + 1, (float*)right + 1, &imagTimesImagResult, len, 2, 2);
-        
-        *resultReal = realTimesRealResult - imagTimesImagResult;
-        *resultImag = realTimesImag1Result + realTimesImag2Result;
+#if CONFIG_EZDV_CODEC2_SINGLE_PASS_COMPLEX_DOT
+        ComplexDotProductSinglePass_(left, right, len, resultReal, resultImag);
+#else
+        ComplexDotProductEspDsp_(left, right, len, resultReal, resultImag);
+#endif // CONFIG_EZDV_CODEC2_SINGLE_PASS_COMPLEX_DOT
     }
+}
 
-    /* Required memory allocation wrapper for embedded platforms. For ezDV, we want to allocate as much as possible
-    on external RAM. */
+#if CONFIG_EZDV_BENCHMARK_CODEC2_MATH
+static void BenchmarkCodec2Math_()
+{
+    const int lengths[] = BENCHMARK_VECTOR_LENGTHS;
 
-    void* codec2_malloc(size_t size)
+    for (int len : lengths)
     {
-        return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    }
+        // Allocated the same way codec2 allocates its own state.
+        COMP* left = (COMP*)ezdv::audio::Codec2Allocator::Allocate(len * sizeof(COMP));
+        COMP* right = (COMP*)ezdv::audio::Codec2Allocator::Allocate(len * sizeof(COMP));
+        assert(left != nullptr && right != nullptr);
 
-    void* codec2_calloc(size_t nmemb, size_t size)
-    {
-        return heap_caps_calloc(nmemb, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    }
+        for (int index = 0; index < len; index++)
+        {
+            left[index].real = cosf(index * 0.1f);
+            left[index].imag = sinf(index * 0.1f);
+            right[index].real = cosf(index * 0.3f);
+            right[index].imag = -sinf(index * 0.3f);
+        }
 
-    void codec2_free(void* ptr)
-    {
-        heap_caps_free(ptr);
+        float oldReal = 0, oldImag = 0, newReal = 0, newImag = 0;
+
+        auto timeBegin = esp_timer_get_time();
+        for (int count = 0; count < BENCHMARK_ITERATIONS; count++)
+        {
+            ComplexDotProductEspDsp_(left, right, len, &oldReal, &oldImag);
+        }
+        auto timeOld = esp_timer_get_time() - timeBegin;
+
+        timeBegin = esp_timer_get_time();
+        for (int count = 0; count < BENCHMARK_ITERATIONS; count++)
+        {
+            ComplexDotProductSinglePass_(left, right, len, &newReal, &newImag);
+        }
+        auto timeNew = esp_timer_get_time() - timeBegin;
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "Complex dot product (len %d, %d runs): esp-dsp %lld us, single pass %lld us (results %f%+fi vs %f%+fi)",
+            len, BENCHMARK_ITERATIONS, timeOld, timeNew, 
+            (double)oldReal, (double)oldImag, (double)newReal, (double)newImag);
+
+        ezdv::audio::Codec2Allocator::Free(left);
+        ezdv::audio::Codec2Allocator::Free(right);
     }
 }
+#endif // CONFIG_EZDV_BENCHMARK_CODEC2_MATH
@@ -18,11 +18,28 @@
 #ifndef FREEDV_TASK_H
 #define FREEDV_TASK_H
 
+#include "sdkconfig.h"
+
 #include "AudioInput.h"
+#include "FreeDVInstanceCache.h"
 #include "FreeDVMessage.h"
+#include "FreeDVTransmitTask.h"
+#include "ModemProfiler.h"
+#include "ModemStatusTracker.h"
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+#include "AudioFanOutBuffer.h"
+#include "FreeDVDecoderTask.h"
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
 #include "storage/SettingsMessage.h"
+#include "storage/SettingsSnapshot.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
+#include "util/DeadlineMonitor.h"
+#include "util/PowerLock.h"
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+#include "telemetry/TelemetryMessage.h"
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 
 #include "freedv_api.h"
 #include "reliable_text.h"
@@ -35,9 +52,15 @@ namespace audio
 
 using namespace ezdv::task;
 
+/// @brief Receives FreeDV and owns the FreeDV audio ports. Transmit is 
+///        handled concurrently by FreeDVTransmitTask.
 class FreeDVTask : public DVTask, public AudioInput
 {
 public:
+    /// @brief Voice keyer audio in. Sent instead of USER_CHANNEL while the 
+    ///        keyer is transmitting.
+    static constexpr AudioInput::ChannelLabel KEYER_CHANNEL = (AudioInput::ChannelLabel)2;
+
     FreeDVTask();
     virtual ~FreeDVTask();
 
@@ -48,21 +71,83 @@ protected:
     virtual void onTaskTick_() override;
     
 private:
+    FreeDVTransmitTask txTask_;
+    FreeDVInstanceCache cache_;
     struct freedv* dv_;
-    reliable_text_t rText_;
     int currentMode_;
 
+    // Decoded audio is muted from PTT until TX has fully ended, but
+    // demodulation continues so we're ready as soon as it does.
     bool isTransmitting_;
-    bool isEndingTransmit_;
     bool isActive_;
-    int samplesBeforeEnd_;
 
-    MODEM_STATS* stats_;
+    ModemProfiler profiler_;
+    MODEM_STATS* stats_; // only while the spectrum is enabled
+    ModemStatusTracker modemStatus_;
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    // Frames that take longer to demodulate than they last.
+    util::DeadlineMonitor rxDeadline_;
+    bool modemRecoveryPending_;
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    // Spectrum feed state, only allocated while someone wants it.
+    bool spectrumEnabled_;
+    int64_t lastSpectrumTimeUs_;
+    int64_t spectrumIntervalUs_; // longer while shedding load
+    float* spectrumWindow_;
+    float* spectrumBuf_;
+
+    // Idle search: demodulating only some frames after a long time 
+    // without sync.
+    int64_t lastSyncTimeUs_;
+    unsigned int idleFrameCount_;
+    bool isIdleSearch_;
+
+    // Held while demodulating at full rate or transmitting.
+    util::PowerLock powerLock_;
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // Modem input for the float link from FlexVitaTask.
+    float* floatModemBuf_;
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    template<typename SampleType>
+    bool receive_(AudioRingBufferBase<SampleType>* codecInputFifo, AudioRingBuffer* codecOutputFifo, bool& syncLed);
+
+    template<typename SampleType>
+    int receiveFrame_(short* outputBuf, SampleType* inputBuf, int nin);
+    void resetIdleSearch_();
+    void updatePowerLock_();
+
+    template<typename SampleType>
+    void updateSpectrum_(const SampleType* samples, int numSamples);
+    void onSetSpectrumEnabled_(DVTask* origin, FreeDVSetSpectrumEnabledMessage* message);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    void onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+#if CONFIG_EZDV_FREEDV_MULTI_RX
+    // Radio audio is shared with the decoders for the other modes. 
+    // Whichever decoder has sync provides audio.
+    AudioFanOutBuffer fanOut_;
+    FreeDVDecoderTask decoderTask_;
+    AudioFanOutBuffer::Cursor fanOutCursor_;
+    int activeDecoder_;
+    FreeDVMode lastReportedRxMode_;
+
+    bool decodeAllModes_(AudioRingBuffer* codecInputFifo, AudioRingBuffer* codecOutputFifo);
+    void resetDecoderSelection_();
+#endif // CONFIG_EZDV_FREEDV_MULTI_RX
+
+    void updateAudioThresholds_();
+    uint32_t getBacklogLimit_(int nin);
 
     void onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message);
     void onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message);
     void onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message);
+    void setCallsign_(const char* callsign);
     void onRequestGetFreeDVMode_(DVTask* origin, RequestGetFreeDVModeMessage* message);
+    void onTransmitComplete_(DVTask* origin, TransmitCompleteMessage* message);
 
     static void OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int length, void* state);
 };
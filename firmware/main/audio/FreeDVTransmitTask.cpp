@@ -0,0 +1,664 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cinttypes>
+#include <cstring>
+#include <type_traits>
+
+#include "sdkconfig.h"
+#include "FreeDVTransmitTask.h"
+#include "FreeDVTask.h"
+#include "AudioGraph.h"
+#include "PttFastPath.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "codec2.h"
+
+#define FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP 160
+#define CURRENT_LOG_TAG ("FreeDVTx")
+
+// Stack is smaller than FreeDVTask's as the modulator needs much less 
+// than sync/demodulation does. See FreeDVTask.cpp before reducing it.
+#define FREEDV_TX_TASK_STACK_SIZE (32768)
+
+// Encoding a backlog (e.g. from the voice keyer) stops after this much time 
+// per tick so that other work on this core gets a chance to run.
+#define FREEDV_TX_TICK_BUDGET_US (20000)
+
+// TX started by the PTT fast path ends if UserInterfaceTask doesn't confirm it within this time.
+#define FREEDV_TX_FAST_PATH_CONFIRM_US (CONFIG_EZDV_PTT_FAST_PATH_CONFIRM_MS * 1000)
+
+// Enough codec2 frames for the longest clip the keyer accepts (32s) in 
+// any supported mode.
+#define FREEDV_TX_KEYER_CACHE_SIZE (8192)
+
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+// Audio is processed as soon as a full frame arrives; the tick is only a fallback.
+#define FREEDV_TX_TICK_INTERVAL_MS (100)
+#else
+#define FREEDV_TX_TICK_INTERVAL_MS (10)
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+FreeDVTransmitTask::FreeDVTransmitTask(AudioInput* ports)
+    : DVTask("FreeDVTxTask", 15, FREEDV_TX_TASK_STACK_SIZE, 1, 16, pdMS_TO_TICKS(FREEDV_TX_TICK_INTERVAL_MS))
+    , ports_(ports)
+    , dv_(nullptr)
+    , currentMode_(ANALOG)
+    , isTransmitting_(false)
+    , isEndingTransmit_(false)
+    , isActive_(false)
+    , samplesBeforeEnd_(0)
+    , keyUpTimeUs_(0)
+    , unconfirmedSinceUs_(0)
+    , profiler_("FreeDVTx")
+    , speechChannel_(AudioInput::USER_CHANNEL)
+    , isKeyerTransmitting_(false)
+    , speechFadePosition_(AUDIO_ROUTE_FADE_IN_SAMPLES)
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    , keyerCacheLength_(0)
+    , keyerCachePosition_(0)
+    , isKeyerCacheValid_(false)
+    , isRecordingKeyerCache_(false)
+    , keyerSlot_(0)
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+{
+    registerMessageHandlers<
+        &FreeDVTransmitTask::onSetFreeDVMode_,
+        &FreeDVTransmitTask::onSetPTTState_,
+        &FreeDVTransmitTask::onReportingSettingsUpdate_,
+        &FreeDVTransmitTask::onVoiceKeyerTransmitState_>(this);
+
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    registerMessageHandlers<
+        &FreeDVTransmitTask::onFileUploadComplete_,
+        &FreeDVTransmitTask::onVoiceKeyerSettings_>(this);
+
+    keyerCache_ = (uint8_t*)heap_caps_malloc(FREEDV_TX_KEYER_CACHE_SIZE, MALLOC_CAP_SPIRAM);
+    assert(keyerCache_ != nullptr);
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    floatModemBuf_ = (float*)heap_caps_calloc(FREEDV_MAX_FRAME_SAMPLES, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    assert(floatModemBuf_ != nullptr);
+    compModemBuf_ = (COMP*)heap_caps_calloc(FREEDV_MAX_FRAME_SAMPLES, sizeof(COMP), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    assert(compModemBuf_ != nullptr);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    // Audio needs to be processed on a fixed cadence to keep FIFO levels stable.
+    enableDeadlineTicks();
+
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+    ports_->setAudioInputNotification(AudioInput::USER_CHANNEL, this, 0);
+    ports_->setAudioInputNotification(FreeDVTask::KEYER_CHANNEL, this, 0);
+    updateAudioThresholds_();
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+
+#if CONFIG_EZDV_PTT_FAST_PATH
+    PttFastPath::SetTransmitTask(this);
+#endif // CONFIG_EZDV_PTT_FAST_PATH
+}
+
+FreeDVTransmitTask::~FreeDVTransmitTask()
+{
+#if CONFIG_EZDV_PTT_FAST_PATH
+    PttFastPath::SetTransmitTask(nullptr);
+#endif // CONFIG_EZDV_PTT_FAST_PATH
+
+    cache_.clear();
+
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    heap_caps_free(keyerCache_);
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    heap_caps_free(floatModemBuf_);
+    heap_caps_free(compModemBuf_);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+}
+
+void FreeDVTransmitTask::onTaskStart_()
+{
+    isActive_ = true;
+}
+
+void FreeDVTransmitTask::onTaskSleep_()
+{
+    isActive_ = false;
+    cache_.clear();
+    dv_ = nullptr;
+}
+
+void FreeDVTransmitTask::onTaskTick_()
+{
+    if (!isActive_) return;
+
+#if CONFIG_EZDV_PTT_FAST_PATH
+    checkFastPathPtt_();
+#endif // CONFIG_EZDV_PTT_FAST_PATH
+
+    selectSpeechInput_();
+
+    // Input is microphone or voice keyer, output is radio
+    AudioRingBuffer* codecInputFifo = getSpeechInput_();
+    AudioInput::OutputClaim output(ports_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+    AudioRingBuffer* codecOutputFifo = output.fifo();
+
+    // Whichever source isn't selected is never sent.
+    AudioRingBuffer* unusedInputFifo = getUnusedSpeechInput_();
+    unusedInputFifo->release(unusedInputFifo->numUsed());
+
+    if (!isTransmitting_)
+    {
+        // Nobody wants microphone audio while we're receiving. Throw it 
+        // away so that we start TX with fresh audio.
+        codecInputFifo->release(codecInputFifo->numUsed());
+        return;
+    }
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // The Flex path takes the modulator's output as is rather than rounded to shorts.
+    AudioFloatRingBuffer* floatOutputFifo = output.floatFifo();
+    if (floatOutputFifo != nullptr)
+    {
+        transmit_(codecInputFifo, floatOutputFifo);
+    }
+    else
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    {
+        transmit_(codecInputFifo, codecOutputFifo);
+    }
+
+    if (!isTransmitting_)
+    {
+        selectSpeechInput_();
+        updateAudioThresholds_();
+    }
+}
+
+template<typename SampleType>
+void FreeDVTransmitTask::transmit_(AudioRingBuffer* codecInputFifo, AudioRingBufferBase<SampleType>* codecOutputFifo)
+{
+    if (dv_ == nullptr)
+    {
+        // Analog mode, just pipe through the audio.
+        short inputBuf[FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP];
+        memset(inputBuf, 0, sizeof(inputBuf));
+
+        if (codecOutputFifo->numFree() < FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP) return;
+        
+        while (!isEndingTransmit_ && 
+               codecInputFifo->numUsed() >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP)
+        {
+            readSpeech_(codecInputFifo, inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            if constexpr (std::is_same<SampleType, float>::value)
+            {
+                // Lossless, and much cheaper than the modem.
+                float floatBuf[FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP];
+                for (int index = 0; index < FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP; index++)
+                {
+                    floatBuf[index] = inputBuf[index];
+                }
+                codecOutputFifo->write(floatBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            }
+            else
+            {
+                codecOutputFifo->write(inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            }
+            recordKeyUpLatency_();
+        }
+
+        if (isEndingTransmit_)
+        {
+            // We've finished processing everything that's left, end TX now.
+            TransmitCompleteMessage message;
+            publish(&message);
+
+            isEndingTransmit_ = false;
+            isTransmitting_ = false;
+        }
+    }
+    else
+    {
+        int numSpeechSamples = freedv_get_n_speech_samples(dv_);
+        int numModemSamples = freedv_get_n_nom_modem_samples(dv_);
+        short* inputBuf = cache_.getSpeechBuffer();
+        SampleType* outputBuf = nullptr;
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+        if constexpr (std::is_same<SampleType, float>::value)
+        {
+            assert(numModemSamples <= FREEDV_MAX_FRAME_SAMPLES);
+            outputBuf = floatModemBuf_;
+        }
+        else
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+        {
+            outputBuf = cache_.getModemBuffer();
+        }
+
+        auto tickBegin = esp_timer_get_time();
+        while (codecOutputFifo->numFree() >= (uint32_t)numModemSamples &&
+               readSpeech_(codecInputFifo, inputBuf, numSpeechSamples) == 0)
+        {
+            // Limit the amount of time we spend here so we don't end up
+            // stuck transmitting forever.
+            if (isEndingTransmit_)
+            {
+                samplesBeforeEnd_ -= numSpeechSamples;
+                if (samplesBeforeEnd_ <= 0)
+                {
+                    break;
+                }
+            }
+
+            auto timeBegin = esp_timer_get_time();
+            modulate_(outputBuf, inputBuf, numModemSamples);
+            profiler_.record(
+                currentMode_, esp_timer_get_time() - timeBegin, 
+                numSpeechSamples, freedv_get_speech_sample_rate(dv_));
+
+            codecOutputFifo->write(outputBuf, numModemSamples);
+            recordKeyUpLatency_();
+
+            if (esp_timer_get_time() - tickBegin >= FREEDV_TX_TICK_BUDGET_US)
+            {
+                // Pick up the rest once any waiting messages are handled.
+                if (codecInputFifo->numUsed() >= (uint32_t)numSpeechSamples)
+                {
+                    profiler_.recordDeferral(currentMode_);
+                    requestTick();
+                }
+                break;
+            }
+        }
+
+        // How far ahead of the radio we are.
+        profiler_.recordOutputLead(
+            currentMode_, 
+            (uint64_t)codecOutputFifo->numUsed() * 1000000 / freedv_get_modem_sample_rate(dv_));
+        
+        if (isEndingTransmit_ && samplesBeforeEnd_ < numSpeechSamples)
+        {
+            // We've finished processing everything that's left, end TX now.
+            TransmitCompleteMessage message;
+            publish(&message);
+
+            isEndingTransmit_ = false;
+            isTransmitting_ = false;
+        }
+    }
+}
+
+void FreeDVTransmitTask::modulate_(short* outputBuf, short* inputBuf, int numModemSamples)
+{
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    encodeFrame_(outputBuf, inputBuf);
+#else
+    freedv_tx(dv_, outputBuf, inputBuf);
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+}
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+void FreeDVTransmitTask::modulate_(float* outputBuf, short* inputBuf, int numModemSamples)
+{
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    if (isKeyerTransmitting_ && (isKeyerCacheValid_ || isRecordingKeyerCache_))
+    {
+        // The cache only has a short entry point (freedv_codectx()).
+        short* shortBuf = cache_.getModemBuffer();
+        encodeFrame_(shortBuf, inputBuf);
+        for (int index = 0; index < numModemSamples; index++)
+        {
+            outputBuf[index] = shortBuf[index];
+        }
+        return;
+    }
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+
+    // freedv_tx() is freedv_comptx() plus rounding the real part to shorts.
+    freedv_comptx(dv_, compModemBuf_, inputBuf);
+    for (int index = 0; index < numModemSamples; index++)
+    {
+        outputBuf[index] = compModemBuf_[index].real;
+    }
+}
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+void FreeDVTransmitTask::encodeFrame_(short* outputBuf, short* inputBuf)
+{
+    if (!isKeyerTransmitting_ || (!isKeyerCacheValid_ && !isRecordingKeyerCache_))
+    {
+        freedv_tx(dv_, outputBuf, inputBuf);
+        return;
+    }
+
+    // Equivalent to freedv_tx(), but with the codec2 frames kept so that 
+    // only modulation is needed next time. (reliable_text is added during
+    // modulation, so it isn't affected by the cache.)
+    struct CODEC2* codec2 = freedv_get_codec2(dv_);
+    int samplesPerCodecFrame = codec2_samples_per_frame(codec2);
+    int bytesPerCodecFrame = codec2_bytes_per_frame(codec2);
+    int codecFramesPerModemFrame = freedv_get_n_speech_samples(dv_) / samplesPerCodecFrame;
+    uint32_t bytesPerModemFrame = codecFramesPerModemFrame * bytesPerCodecFrame;
+
+    if (isKeyerCacheValid_)
+    {
+        if (keyerCachePosition_ + bytesPerModemFrame <= keyerCacheLength_)
+        {
+            // The keyer's audio still paces TX, but it's already encoded.
+            freedv_codectx(dv_, outputBuf, keyerCache_ + keyerCachePosition_);
+            keyerCachePosition_ += bytesPerModemFrame;
+        }
+        else
+        {
+            // Past the end of the recording (e.g. trailing silence).
+            freedv_tx(dv_, outputBuf, inputBuf);
+        }
+        return;
+    }
+
+    if (keyerCacheLength_ + bytesPerModemFrame > FREEDV_TX_KEYER_CACHE_SIZE)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Voice keyer clip too long to cache");
+        isRecordingKeyerCache_ = false;
+        freedv_tx(dv_, outputBuf, inputBuf);
+        return;
+    }
+
+    uint8_t* frameBits = keyerCache_ + keyerCacheLength_;
+    for (int index = 0; index < codecFramesPerModemFrame; index++)
+    {
+        codec2_encode(
+            codec2, 
+            frameBits + index * bytesPerCodecFrame, 
+            inputBuf + index * samplesPerCodecFrame);
+    }
+    freedv_codectx(dv_, outputBuf, frameBits);
+    keyerCacheLength_ += bytesPerModemFrame;
+}
+
+void FreeDVTransmitTask::invalidateKeyerCache_()
+{
+    isKeyerCacheValid_ = false;
+    isRecordingKeyerCache_ = false;
+    keyerCacheLength_ = 0;
+    keyerCachePosition_ = 0;
+}
+
+void FreeDVTransmitTask::onFileUploadComplete_(DVTask* origin, FileUploadCompleteMessage* message)
+{
+    if (message->success)
+    {
+        invalidateKeyerCache_();
+    }
+}
+
+void FreeDVTransmitTask::onVoiceKeyerSettings_(DVTask* origin, storage::VoiceKeyerSettingsMessage* message)
+{
+    // Only the selected slot's clip is cached.
+    if (message->slot != keyerSlot_)
+    {
+        keyerSlot_ = message->slot;
+        invalidateKeyerCache_();
+    }
+}
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+
+AudioRingBuffer* FreeDVTransmitTask::getSpeechInput_()
+{
+    return ports_->getAudioInput(speechChannel_);
+}
+
+AudioRingBuffer* FreeDVTransmitTask::getUnusedSpeechInput_()
+{
+    return ports_->getAudioInput(
+        speechChannel_ == AudioInput::USER_CHANNEL ? FreeDVTask::KEYER_CHANNEL : AudioInput::USER_CHANNEL);
+}
+
+void FreeDVTransmitTask::selectSpeechInput_()
+{
+    // The keyer keeps the input until TX ends so that the end of its clip 
+    // (and the silence flushing the encoder) isn't replaced by mic audio.
+    auto channel = speechChannel_;
+    if (isKeyerTransmitting_)
+    {
+        channel = FreeDVTask::KEYER_CHANNEL;
+    }
+    else if (!isTransmitting_)
+    {
+        channel = AudioInput::USER_CHANNEL;
+    }
+
+    if (channel != speechChannel_)
+    {
+        speechChannel_ = channel;
+        speechFadePosition_ = 0;
+        updateAudioThresholds_();
+    }
+}
+
+int FreeDVTransmitTask::readSpeech_(AudioRingBuffer* codecInputFifo, short* samples, uint32_t numSamples)
+{
+    int rv = codecInputFifo->read(samples, numSamples);
+    if (rv == 0)
+    {
+        for (uint32_t index = 0; index < numSamples && speechFadePosition_ < AUDIO_ROUTE_FADE_IN_SAMPLES; index++)
+        {
+            samples[index] = (int32_t)samples[index] * (int32_t)speechFadePosition_ / AUDIO_ROUTE_FADE_IN_SAMPLES;
+            speechFadePosition_++;
+        }
+    }
+
+    return rv;
+}
+
+void FreeDVTransmitTask::recordKeyUpLatency_()
+{
+    if (keyUpTimeUs_ != 0)
+    {
+        PttFastPath::RecordLatency(esp_timer_get_time() - keyUpTimeUs_);
+        keyUpTimeUs_ = 0;
+    }
+}
+
+#if CONFIG_EZDV_PTT_FAST_PATH
+void FreeDVTransmitTask::checkFastPathPtt_()
+{
+    int64_t keyDownTimeUs = 0;
+    if (PttFastPath::TakeKeyDown(&keyDownTimeUs) && !isTransmitting_)
+    {
+        // Start encoding now rather than after the PTT message makes its 
+        // way through UserInterfaceTask, which will confirm it shortly.
+        auto codecInputFifo = getSpeechInput_();
+        codecInputFifo->release(codecInputFifo->numUsed());
+
+        isEndingTransmit_ = false;
+        isTransmitting_ = true;
+        keyUpTimeUs_ = keyDownTimeUs;
+        unconfirmedSinceUs_ = keyDownTimeUs;
+        updateAudioThresholds_();
+    }
+    else if (unconfirmedSinceUs_ != 0 && 
+             esp_timer_get_time() - unconfirmedSinceUs_ >= FREEDV_TX_FAST_PATH_CONFIRM_US)
+    {
+        // Whatever PTT was pressed for, it wasn't to transmit.
+        ESP_LOGW(CURRENT_LOG_TAG, "PTT not confirmed, returning to receive");
+
+        isTransmitting_ = false;
+        keyUpTimeUs_ = 0;
+        unconfirmedSinceUs_ = 0;
+        updateAudioThresholds_();
+    }
+}
+#endif // CONFIG_EZDV_PTT_FAST_PATH
+
+void FreeDVTransmitTask::updateAudioThresholds_()
+{
+#if CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+    // Only wake up once there's a full frame to encode. While receiving,
+    // the fallback tick is enough to keep the microphone FIFO drained.
+    uint32_t frameSize = FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP;
+    if (dv_ != nullptr)
+    {
+        frameSize = freedv_get_n_speech_samples(dv_);
+    }
+
+    ports_->setAudioInputThreshold(speechChannel_, isTransmitting_ ? frameSize : 0);
+    ports_->setAudioInputThreshold(
+        speechChannel_ == AudioInput::USER_CHANNEL ? FreeDVTask::KEYER_CHANNEL : AudioInput::USER_CHANNEL, 0);
+#endif // CONFIG_EZDV_EVENT_DRIVEN_AUDIO
+}
+
+void FreeDVTransmitTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+{
+    // The previous mode's instance stays cached for next time.
+    cache_.release(currentMode_);
+    currentMode_ = message->mode;
+    dv_ = nullptr;
+
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    // The cached codec2 frames are only good for the mode they came from.
+    invalidateKeyerCache_();
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+
+    if (message->mode != FreeDVMode::ANALOG)
+    {
+        dv_ = cache_.acquire(message->mode);
+
+        // Note: reliable_text setup is deferred until we know for sure whether
+        // we have a valid callsign saved. If settings haven't been loaded yet,
+        // onReportingSettingsUpdate_() will do it once they are.
+        storage::Settings::Reporting reporting;
+        if (storage::SettingsSnapshot::Read(&storage::Settings::reporting, reporting) > 0)
+        {
+            setCallsign_(reporting.callsign);
+        }
+    }
+
+    updateAudioThresholds_();
+}
+
+void FreeDVTransmitTask::onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message)
+{
+    // Anything started by the fast path is now either confirmed or ending.
+    unconfirmedSinceUs_ = 0;
+
+    if (isTransmitting_ && !message->pttState)
+    {
+        // Delay ending TX until we've processed what's remaining. This means we'll need
+        // to add a bit of silence at the end of the transmission as well depending on 
+        // the currently active mode.
+        samplesBeforeEnd_ = 2000; // 250ms maximum @ 8000 Hz
+        isEndingTransmit_ = true;
+
+        if (dv_ != nullptr)
+        {
+            auto codecInputFifo = getSpeechInput_();
+            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
+
+            // Silence goes directly into the FIFO; if there isn't room for
+            // all of it, the remaining audio will flush the encoder anyway.
+            auto span = codecInputFifo->acquireWrite(numSpeechSamples);
+            for (uint32_t index = 0; index < span.size(); index++)
+            {
+                span[index] = 0;
+            }
+            codecInputFifo->commitWrite(span.size());
+        }
+
+        // Finish up right away rather than waiting for more audio.
+        requestTick();
+    }
+    else
+    {
+        if (!isTransmitting_ && message->pttState)
+        {
+            // Drop anything queued since the last tick so TX starts with 
+            // current audio.
+            auto codecInputFifo = getSpeechInput_();
+            codecInputFifo->release(codecInputFifo->numUsed());
+            keyUpTimeUs_ = esp_timer_get_time();
+        }
+
+        isEndingTransmit_ = false;
+        isTransmitting_ = message->pttState;
+        if (!isTransmitting_)
+        {
+            TransmitCompleteMessage message;
+            publish(&message);
+        }
+    }
+
+    updateAudioThresholds_();
+}
+
+void FreeDVTransmitTask::onVoiceKeyerTransmitState_(DVTask* origin, VoiceKeyerTransmitStateMessage* message)
+{
+    isKeyerTransmitting_ = message->transmitting;
+    selectSpeechInput_();
+
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    if (message->transmitting)
+    {
+        keyerCachePosition_ = 0;
+        if (!isKeyerCacheValid_)
+        {
+            keyerCacheLength_ = 0;
+            isRecordingKeyerCache_ = dv_ != nullptr;
+        }
+    }
+    else if (isRecordingKeyerCache_)
+    {
+        // Only a complete recording of the clip can be reused.
+        isRecordingKeyerCache_ = false;
+        isKeyerCacheValid_ = message->clipFinished;
+        if (isKeyerCacheValid_)
+        {
+            ESP_LOGI(CURRENT_LOG_TAG, "Cached %" PRIu32 " bytes of encoded voice keyer audio", keyerCacheLength_);
+        }
+    }
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+}
+
+void FreeDVTransmitTask::onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message)
+{
+    setCallsign_(message->callsign);
+}
+
+void FreeDVTransmitTask::setCallsign_(const char* callsign)
+{
+    if (dv_ != nullptr && strlen(callsign) > 0)
+    {
+        // Non-null callsign means we should send it via reliable_text. We never
+        // call freedv_rx() on these instances, so no receive callback is needed.
+        cache_.setCallsign(callsign, nullptr, this);
+    }
+}
+
+}
+
+}
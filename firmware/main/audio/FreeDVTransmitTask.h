@@ -0,0 +1,137 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_TRANSMIT_TASK_H
+#define FREEDV_TRANSMIT_TASK_H
+
+#include "sdkconfig.h"
+
+#include "AudioInput.h"
+#include "FreeDVInstanceCache.h"
+#include "FreeDVMessage.h"
+#include "ModemProfiler.h"
+#include "VoiceKeyerMessage.h"
+#include "storage/SettingsMessage.h"
+#include "storage/SettingsSnapshot.h"
+#include "task/DVTask.h"
+
+#include "freedv_api.h"
+#include "comp.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Encodes FreeDV for transmit. Runs alongside FreeDVTask (which 
+///        handles receive) with its own freedv instance so that the two can
+///        be on different cores and RX never has to stop for TX.
+class FreeDVTransmitTask : public DVTask
+{
+public:
+    /// @brief Creates the transmit engine.
+    /// @param ports The AudioInput whose USER_CHANNEL and KEYER_CHANNEL inputs
+    ///        and RADIO_CHANNEL output this task services (see FreeDVTask).
+    FreeDVTransmitTask(AudioInput* ports);
+    virtual ~FreeDVTransmitTask();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+    virtual void onTaskTick_() override;
+
+private:
+    AudioInput* ports_;
+    FreeDVInstanceCache cache_;
+    struct freedv* dv_;
+    FreeDVMode currentMode_;
+
+    bool isTransmitting_;
+    bool isEndingTransmit_;
+    bool isActive_;
+    int samplesBeforeEnd_;
+
+    // When TX started (0 once the first modem samples are out), and when 
+    // the fast path started TX that UserInterfaceTask has yet to confirm.
+    int64_t keyUpTimeUs_;
+    int64_t unconfirmedSinceUs_;
+
+    ModemProfiler profiler_;
+
+    // Speech comes from the microphone unless the voice keyer is sending. 
+    // Both inputs stay connected; the one not in use is drained, and the
+    // new one fades in after a switch.
+    AudioInput::ChannelLabel speechChannel_;
+    bool isKeyerTransmitting_;
+    uint32_t speechFadePosition_;
+
+#if CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+    // Codec2 frames for the voice keyer clip, recorded the first time it's 
+    // sent in the current mode and reused when it's sent again.
+    uint8_t* keyerCache_;
+    uint32_t keyerCacheLength_;
+    uint32_t keyerCachePosition_;
+    bool isKeyerCacheValid_;
+    bool isRecordingKeyerCache_;
+    int keyerSlot_;
+
+    void encodeFrame_(short* outputBuf, short* inputBuf);
+    void invalidateKeyerCache_();
+
+    void onFileUploadComplete_(DVTask* origin, FileUploadCompleteMessage* message);
+    void onVoiceKeyerSettings_(DVTask* origin, storage::VoiceKeyerSettingsMessage* message);
+#endif // CONFIG_EZDV_VOICE_KEYER_ENCODE_CACHE
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // Modulator output for float links.
+    float* floatModemBuf_;
+    COMP* compModemBuf_;
+
+    void modulate_(float* outputBuf, short* inputBuf, int numModemSamples);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    template<typename SampleType>
+    void transmit_(AudioRingBuffer* codecInputFifo, AudioRingBufferBase<SampleType>* codecOutputFifo);
+    void modulate_(short* outputBuf, short* inputBuf, int numModemSamples);
+
+    AudioRingBuffer* getSpeechInput_();
+    AudioRingBuffer* getUnusedSpeechInput_();
+    void selectSpeechInput_();
+    int readSpeech_(AudioRingBuffer* codecInputFifo, short* samples, uint32_t numSamples);
+
+    void updateAudioThresholds_();
+    void recordKeyUpLatency_();
+#if CONFIG_EZDV_PTT_FAST_PATH
+    void checkFastPathPtt_();
+#endif // CONFIG_EZDV_PTT_FAST_PATH
+
+    void onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message);
+    void onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message);
+    void onVoiceKeyerTransmitState_(DVTask* origin, VoiceKeyerTransmitStateMessage* message);
+    void onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message);
+    void setCallsign_(const char* callsign);
+};
+
+}
+
+}
+
+#endif // FREEDV_TRANSMIT_TASK_H
@@ -0,0 +1,190 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "freertos/FreeRTOS.h"
+
+#include "ModemProfiler.h"
+
+#define MAX_MODEM_PROFILERS (8)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static ModemProfiler* Profilers_[MAX_MODEM_PROFILERS];
+static portMUX_TYPE ProfilerLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+ModemProfiler::ModemProfiler(const char* name)
+    : name_(name)
+    , resetPending_(false)
+{
+    memset(stats_, 0, sizeof(stats_));
+
+    portENTER_CRITICAL_SAFE(&ProfilerLock_);
+    int index = 0;
+    for (; index < MAX_MODEM_PROFILERS; index++)
+    {
+        if (Profilers_[index] == nullptr)
+        {
+            Profilers_[index] = this;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&ProfilerLock_);
+
+    assert(index < MAX_MODEM_PROFILERS);
+}
+
+ModemProfiler::~ModemProfiler()
+{
+    portENTER_CRITICAL_SAFE(&ProfilerLock_);
+    for (int index = 0; index < MAX_MODEM_PROFILERS; index++)
+    {
+        if (Profilers_[index] == this)
+        {
+            Profilers_[index] = nullptr;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&ProfilerLock_);
+}
+
+void ModemProfiler::record(FreeDVMode mode, uint32_t elapsedUs, uint32_t numSamples, uint32_t sampleRate)
+{
+    checkReset_();
+
+    if (mode <= ANALOG || mode >= MAX_FREEDV_MODES || sampleRate == 0) return;
+
+    ModeStatistics& stats = stats_[mode];
+    uint32_t periodUs = (uint64_t)numSamples * 1000000 / sampleRate;
+    int32_t marginUs = (int32_t)periodUs - (int32_t)elapsedUs;
+
+    if (stats.numFrames == 0 || marginUs < stats.worstMarginUs)
+    {
+        stats.worstMarginUs = marginUs;
+    }
+
+    stats.numFrames++;
+    stats.totalUs += elapsedUs;
+    if (elapsedUs > stats.worstUs)
+    {
+        stats.worstUs = elapsedUs;
+    }
+
+    if (marginUs < 0)
+    {
+        stats.numLate++;
+    }
+
+    int bucket = NUM_HISTOGRAM_BUCKETS - 1;
+    if (periodUs > 0 && elapsedUs < periodUs)
+    {
+        bucket = ((uint64_t)elapsedUs * (NUM_HISTOGRAM_BUCKETS - 1)) / periodUs;
+    }
+    stats.histogram[bucket]++;
+}
+
+void ModemProfiler::recordOutputLead(FreeDVMode mode, uint32_t leadUs)
+{
+    checkReset_();
+
+    if (mode <= ANALOG || mode >= MAX_FREEDV_MODES) return;
+
+    ModeStatistics& stats = stats_[mode];
+    if (leadUs > stats.maxOutputLeadUs)
+    {
+        stats.maxOutputLeadUs = leadUs;
+    }
+}
+
+void ModemProfiler::recordDeferral(FreeDVMode mode)
+{
+    checkReset_();
+
+    if (mode <= ANALOG || mode >= MAX_FREEDV_MODES) return;
+
+    stats_[mode].numDeferred++;
+}
+
+void ModemProfiler::checkReset_()
+{
+    if (resetPending_.exchange(false, std::memory_order_relaxed))
+    {
+        memset(stats_, 0, sizeof(stats_));
+    }
+}
+
+void ModemProfiler::getStatistics_(FreeDVMode mode, Statistics& stats, bool reset)
+{
+    // Values are only ever updated by the owning task, so at worst this 
+    // is off by the frame currently being recorded.
+    ModeStatistics& modeStats = stats_[mode];
+
+    stats.numFrames = modeStats.numFrames;
+    stats.averageUs = modeStats.numFrames > 0 ? modeStats.totalUs / modeStats.numFrames : 0;
+    stats.worstUs = modeStats.worstUs;
+    stats.worstMarginUs = modeStats.worstMarginUs;
+    stats.numLate = modeStats.numLate;
+    memcpy(stats.histogram, modeStats.histogram, sizeof(stats.histogram));
+    stats.maxOutputLeadUs = modeStats.maxOutputLeadUs;
+    stats.numDeferred = modeStats.numDeferred;
+
+    if (reset)
+    {
+        resetPending_.store(true, std::memory_order_relaxed);
+    }
+}
+
+int ModemProfiler::GetStatistics(Statistics* stats, FreeDVMode* modes, const char** names, int maxEntries, bool reset)
+{
+    int numEntries = 0;
+
+    portENTER_CRITICAL_SAFE(&ProfilerLock_);
+    for (int index = 0; index < MAX_MODEM_PROFILERS && numEntries < maxEntries; index++)
+    {
+        auto profiler = Profilers_[index];
+        if (profiler == nullptr || profiler->resetPending_.load(std::memory_order_relaxed))
+        {
+            // Nothing new since the last reset.
+            continue;
+        }
+
+        for (int mode = FREEDV_700D; mode < MAX_FREEDV_MODES && numEntries < maxEntries; mode++)
+        {
+            if (profiler->stats_[mode].numFrames == 0)
+            {
+                continue;
+            }
+
+            profiler->getStatistics_((FreeDVMode)mode, stats[numEntries], reset);
+            modes[numEntries] = (FreeDVMode)mode;
+            names[numEntries] = profiler->getName();
+            numEntries++;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&ProfilerLock_);
+
+    return numEntries;
+}
+
+}
+
+}
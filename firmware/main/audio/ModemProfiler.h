@@ -0,0 +1,111 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODEM_PROFILER_H
+#define MODEM_PROFILER_H
+
+#include <atomic>
+#include <cinttypes>
+
+#include "FreeDVMessage.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Keeps per-mode timing statistics for freedv_rx()/freedv_tx() calls
+///        made by one task. Recording is done only by the owning task; 
+///        statistics can be read from anywhere via GetStatistics().
+class ModemProfiler
+{
+public:
+    // Each bucket covers 10% of the frame period; the last is anything over 100%.
+    enum { NUM_HISTOGRAM_BUCKETS = 11 };
+
+    struct Statistics
+    {
+        uint32_t numFrames;
+        uint32_t averageUs;
+        uint32_t worstUs;
+        int32_t worstMarginUs; // smallest (frame period - processing time) seen, negative if late
+        uint32_t numLate; // frames that took longer than their period
+        uint32_t histogram[NUM_HISTOGRAM_BUCKETS];
+        uint32_t maxOutputLeadUs; // most audio seen queued ahead of the output at once
+        uint32_t numDeferred; // ticks that ran out of time with frames still waiting
+    };
+
+    /// @brief Creates and registers a profiler.
+    /// @param name The name reported with the statistics (e.g. "FreeDVRx").
+    ModemProfiler(const char* name);
+    virtual ~ModemProfiler();
+
+    /// @brief Records how long a frame took to process.
+    /// @param mode The mode the frame was processed in.
+    /// @param elapsedUs Time spent in freedv_rx()/freedv_tx().
+    /// @param numSamples The number of samples the frame covers.
+    /// @param sampleRate The rate of those samples (e.g. freedv_get_modem_sample_rate()).
+    void record(FreeDVMode mode, uint32_t elapsedUs, uint32_t numSamples, uint32_t sampleRate);
+
+    /// @brief Records how much audio is queued in the output FIFO after
+    ///        processing, i.e. how far ahead of the consumer we are.
+    /// @param mode The current mode.
+    /// @param leadUs The duration of the queued audio.
+    void recordOutputLead(FreeDVMode mode, uint32_t leadUs);
+
+    /// @brief Records that processing stopped for this tick with frames still waiting.
+    /// @param mode The current mode.
+    void recordDeferral(FreeDVMode mode);
+
+    const char* getName() const { return name_; }
+
+    /// @brief Returns the statistics for each profiler and mode that's processed any frames.
+    /// @param stats Where to store the statistics.
+    /// @param modes The mode for each entry in stats.
+    /// @param names The profiler name for each entry in stats.
+    /// @param maxEntries The maximum number of entries to return.
+    /// @param reset Whether to reset the statistics once read.
+    /// @return The number of entries returned.
+    static int GetStatistics(Statistics* stats, FreeDVMode* modes, const char** names, int maxEntries, bool reset = false);
+
+private:
+    struct ModeStatistics
+    {
+        uint32_t numFrames;
+        uint64_t totalUs;
+        uint32_t worstUs;
+        int32_t worstMarginUs;
+        uint32_t numLate;
+        uint32_t histogram[NUM_HISTOGRAM_BUCKETS];
+        uint32_t maxOutputLeadUs;
+        uint32_t numDeferred;
+    };
+
+    const char* name_;
+    ModeStatistics stats_[MAX_FREEDV_MODES];
+    std::atomic<bool> resetPending_;
+
+    void checkReset_();
+    void getStatistics_(FreeDVMode mode, Statistics& stats, bool reset);
+};
+
+}
+
+}
+
+#endif // MODEM_PROFILER_H
@@ -0,0 +1,68 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ModemStatusTracker.h"
+
+// Weight of each new frame's SNR estimate. The per-frame estimates are 
+// noisy, so this averages over roughly the last five frames.
+#define SNR_SMOOTHING_FACTOR (0.2f)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+ModemStatusTracker::ModemStatusTracker()
+{
+    reset();
+}
+
+void ModemStatusTracker::reset()
+{
+    hasSync_ = false;
+    snr_ = 0;
+}
+
+void ModemStatusTracker::update(struct freedv* dv)
+{
+    bool hadSync = hasSync_;
+    hasSync_ = freedv_get_sync(dv) > 0;
+    if (!hasSync_)
+    {
+        // The estimate isn't meaningful without sync; keep the last one.
+        return;
+    }
+
+    int sync = 0;
+    float snr = 0;
+    freedv_get_modem_stats(dv, &sync, &snr);
+
+    if (hadSync)
+    {
+        snr_ += SNR_SMOOTHING_FACTOR * (snr - snr_);
+    }
+    else
+    {
+        // Likely a different station, so start over.
+        snr_ = snr;
+    }
+}
+
+}
+
+}
@@ -0,0 +1,61 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODEM_STATUS_TRACKER_H
+#define MODEM_STATUS_TRACKER_H
+
+#include "freedv_api.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Keeps a smoothed SNR and the sync state of a FreeDV instance, 
+///        updated after every freedv_rx() from the modem's cheap per-frame
+///        fields. Anything that needs the SNR (e.g. callsign reports) reads 
+///        it from here instead of pulling the extended modem stats, which 
+///        are only needed for the waterfall.
+class ModemStatusTracker
+{
+public:
+    ModemStatusTracker();
+    virtual ~ModemStatusTracker() = default;
+
+    /// @brief Forgets the current signal (e.g. after a mode change).
+    void reset();
+
+    /// @brief Updates the state after a frame has been demodulated.
+    /// @param dv The FreeDV instance that demodulated it.
+    void update(struct freedv* dv);
+
+    bool hasSync() const { return hasSync_; }
+
+    /// @brief Returns the smoothed SNR (dB) while in sync, or the last one seen before sync was lost.
+    float getSnr() const { return snr_; }
+
+private:
+    bool hasSync_;
+    float snr_;
+};
+
+}
+
+}
+
+#endif // MODEM_STATUS_TRACKER_H
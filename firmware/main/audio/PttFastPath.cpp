@@ -0,0 +1,118 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstring>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "PttFastPath.h"
+
+#define CURRENT_LOG_TAG ("PttFastPath")
+#define PTT_MAX_LATENCY_US (CONFIG_EZDV_PTT_MAX_LATENCY_MS * 1000)
+
+// Key downs older than this are ignored (e.g. if the transmit task was asleep).
+#define PTT_KEY_DOWN_MAX_AGE_US (CONFIG_EZDV_PTT_FAST_PATH_CONFIRM_MS * 1000)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static std::atomic<DVTask*> TransmitTask_(nullptr);
+static std::atomic<int64_t> KeyDownTimeUs_(0);
+static std::atomic<bool> KeyDownPending_(false);
+
+static PttFastPath::Statistics Statistics_;
+static portMUX_TYPE StatisticsLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+void PttFastPath::SetTransmitTask(DVTask* task)
+{
+    TransmitTask_.store(task, std::memory_order_release);
+}
+
+void PttFastPath::KeyDown()
+{
+    KeyDownTimeUs_.store(esp_timer_get_time(), std::memory_order_relaxed);
+    KeyDownPending_.store(true, std::memory_order_release);
+
+    DVTask* task = TransmitTask_.load(std::memory_order_acquire);
+    if (task != nullptr)
+    {
+        task->requestTick();
+    }
+}
+
+void PttFastPath::KeyUp()
+{
+    KeyDownPending_.store(false, std::memory_order_release);
+}
+
+bool PttFastPath::TakeKeyDown(int64_t* keyDownTimeUs)
+{
+    if (!KeyDownPending_.exchange(false, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    *keyDownTimeUs = KeyDownTimeUs_.load(std::memory_order_relaxed);
+    return esp_timer_get_time() - *keyDownTimeUs < PTT_KEY_DOWN_MAX_AGE_US;
+}
+
+void PttFastPath::RecordLatency(uint32_t latencyUs)
+{
+    portENTER_CRITICAL_SAFE(&StatisticsLock_);
+    Statistics_.count++;
+    Statistics_.lastLatencyUs = latencyUs;
+    if (latencyUs > Statistics_.maxLatencyUs)
+    {
+        Statistics_.maxLatencyUs = latencyUs;
+    }
+    if (latencyUs > PTT_MAX_LATENCY_US)
+    {
+        Statistics_.numOverBound++;
+    }
+    portEXIT_CRITICAL_SAFE(&StatisticsLock_);
+
+    if (latencyUs > PTT_MAX_LATENCY_US)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Key-up to first modem sample took %" PRIu32 " us (limit %d ms)", latencyUs, CONFIG_EZDV_PTT_MAX_LATENCY_MS);
+    }
+    else
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Key-up to first modem sample took %" PRIu32 " us", latencyUs);
+    }
+}
+
+void PttFastPath::GetStatistics(Statistics& stats, bool reset)
+{
+    portENTER_CRITICAL_SAFE(&StatisticsLock_);
+    stats = Statistics_;
+    if (reset)
+    {
+        memset(&Statistics_, 0, sizeof(Statistics_));
+    }
+    portEXIT_CRITICAL_SAFE(&StatisticsLock_);
+}
+
+}
+
+}
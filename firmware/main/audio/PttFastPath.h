@@ -0,0 +1,78 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PTT_FAST_PATH_H
+#define PTT_FAST_PATH_H
+
+#include <cinttypes>
+
+#include "task/DVTask.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Lets the PTT button wake FreeDVTransmitTask directly instead of 
+///        waiting for UserInterfaceTask's PTT message to arrive, and measures
+///        how long it takes from key-up to the first modem samples. The 
+///        message from UserInterfaceTask remains authoritative; TX started
+///        here is abandoned if it doesn't confirm it in time.
+class PttFastPath
+{
+public:
+    struct Statistics
+    {
+        uint32_t count;
+        uint32_t lastLatencyUs;
+        uint32_t maxLatencyUs;
+        uint32_t numOverBound; // key-ups that took longer than CONFIG_EZDV_PTT_MAX_LATENCY_MS
+    };
+
+    /// @brief Sets the task that starts transmitting on KeyDown() 
+    ///        (nullptr to stop waking anyone up).
+    static void SetTransmitTask(DVTask* task);
+
+    /// @brief Called as soon as PTT is pressed. Safe to call from any task.
+    static void KeyDown();
+
+    /// @brief Called as soon as PTT is released. Safe to call from any task.
+    static void KeyUp();
+
+    /// @brief Returns the time of a KeyDown() not yet taken by the transmit 
+    ///        task, if it's recent enough to still act on.
+    /// @param keyDownTimeUs Where to store the time (from esp_timer_get_time()).
+    /// @return true if there was a pending key down, false otherwise.
+    static bool TakeKeyDown(int64_t* keyDownTimeUs);
+
+    /// @brief Records the time from key-up to the first modem samples.
+    static void RecordLatency(uint32_t latencyUs);
+
+    /// @brief Retrieves the key-up latency statistics.
+    /// @param stats The structure to fill in.
+    /// @param reset Whether to reset the statistics once read.
+    static void GetStatistics(Statistics& stats, bool reset = false);
+};
+
+}
+
+}
+
+#endif // PTT_FAST_PATH_H
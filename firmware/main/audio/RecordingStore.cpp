@@ -0,0 +1,223 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "codec2.h"
+
+#include "RecordingStore.h"
+#include "WAVFile.h"
+
+#define CURRENT_LOG_TAG "RecordingStore"
+#define RECORDING_PARTITION_LABEL "rec"
+
+#define RECORDING_BLOCK_MAGIC (0x43525A45) /* "EZRC" */
+#define RECORDING_ERASED_SEQUENCE (0xFFFFFFFF)
+
+// Header understood by c2dec and friends (see codec2's c2file.h).
+#define C2_FILE_HEADER_SIZE (7)
+#define C2_FILE_VERSION_MAJOR (1)
+#define C2_FILE_VERSION_MINOR (2)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+RecordingStore* RecordingStore::Instance_ = nullptr;
+
+RecordingStore::RecordingStore(Format format)
+    : format_(format)
+    , numBlocks_(0)
+    , firstSequence_(1)
+    , nextSequence_(1)
+    , blockBuf_(nullptr)
+{
+    static_assert(sizeof(BlockHeader) == HEADER_SIZE, "Block header must be HEADER_SIZE bytes");
+
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, RECORDING_PARTITION_LABEL);
+    if (partition_ == nullptr)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "No recording partition found, recording disabled");
+    }
+    else
+    {
+        numBlocks_ = partition_->size / BLOCK_SIZE;
+        assert(numBlocks_ > 1);
+
+        blockBuf_ = (uint8_t*)heap_caps_malloc(BLOCK_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+        assert(blockBuf_ != nullptr);
+
+        findNewestBlock_();
+    }
+
+    assert(Instance_ == nullptr);
+    Instance_ = this;
+}
+
+RecordingStore::~RecordingStore()
+{
+    Instance_ = nullptr;
+
+    if (blockBuf_ != nullptr)
+    {
+        heap_caps_free(blockBuf_);
+    }
+}
+
+RecordingStore* RecordingStore::GetInstance()
+{
+    return Instance_;
+}
+
+esp_err_t RecordingStore::append(const uint8_t* payload)
+{
+    assert(isAvailable());
+
+    uint32_t sequence = nextSequence_.load(std::memory_order_relaxed);
+    uint32_t offset = (sequence % numBlocks_) * BLOCK_SIZE;
+
+    // Readers have to stop using the block we're about to erase first.
+    if (sequence - firstSequence_.load(std::memory_order_relaxed) >= numBlocks_)
+    {
+        firstSequence_.store(sequence + 1 - numBlocks_, std::memory_order_release);
+    }
+
+    BlockHeader* header = (BlockHeader*)blockBuf_;
+    header->magic = RECORDING_BLOCK_MAGIC;
+    header->sequence = sequence;
+    header->format = format_;
+    header->payloadSize = PAYLOAD_SIZE;
+    header->reserved = 0;
+    memcpy(blockBuf_ + HEADER_SIZE, payload, PAYLOAD_SIZE);
+
+    esp_err_t rv = esp_partition_erase_range(partition_, offset, BLOCK_SIZE);
+    if (rv == ESP_OK)
+    {
+        rv = esp_partition_write(partition_, offset, blockBuf_, BLOCK_SIZE);
+    }
+
+    if (rv == ESP_OK)
+    {
+        nextSequence_.store(sequence + 1, std::memory_order_release);
+    }
+    return rv;
+}
+
+void RecordingStore::getRange(uint32_t* first, uint32_t* end) const
+{
+    *end = nextSequence_.load(std::memory_order_acquire);
+    *first = std::min(firstSequence_.load(std::memory_order_acquire), *end);
+}
+
+bool RecordingStore::read(uint32_t sequence, uint8_t* payload)
+{
+    if (!isAvailable() || 
+        sequence < firstSequence_.load(std::memory_order_acquire) || 
+        sequence >= nextSequence_.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    uint32_t offset = (sequence % numBlocks_) * BLOCK_SIZE;
+    BlockHeader header;
+    if (esp_partition_read(partition_, offset, &header, sizeof(header)) != ESP_OK ||
+        header.magic != RECORDING_BLOCK_MAGIC ||
+        header.sequence != sequence ||
+        header.format != format_ ||
+        header.payloadSize != PAYLOAD_SIZE ||
+        esp_partition_read(partition_, offset + HEADER_SIZE, payload, PAYLOAD_SIZE) != ESP_OK)
+    {
+        return false;
+    }
+
+    // The writer may have started erasing the block while we were reading it.
+    return sequence >= firstSequence_.load(std::memory_order_acquire);
+}
+
+const char* RecordingStore::getFileName() const
+{
+    return (format_ == CODEC2_700C) ? "recording.c2" : "recording.wav";
+}
+
+uint32_t RecordingStore::getFileHeader(uint8_t* buf, uint32_t numBlocks) const
+{
+    if (format_ == CODEC2_700C)
+    {
+        const uint8_t header[C2_FILE_HEADER_SIZE] = {
+            0xc0, 0xde, 0xc2, C2_FILE_VERSION_MAJOR, C2_FILE_VERSION_MINOR, CODEC2_MODE_700C, 0
+        };
+        memcpy(buf, header, sizeof(header));
+        return sizeof(header);
+    }
+    
+    wav_header_t header;
+    header.sample_rate = 8000;
+    header.byte_rate = header.sample_rate * sizeof(short);
+    header.data_bytes = numBlocks * PAYLOAD_SIZE;
+    header.wav_size = sizeof(header) - 8 + header.data_bytes;
+    memcpy(buf, &header, sizeof(header));
+    return sizeof(header);
+}
+
+void RecordingStore::findNewestBlock_()
+{
+    // Every block lives at (sequence % numBlocks_), so whatever's stored is 
+    // always the numBlocks_ (or fewer) blocks ending at the highest sequence.
+    bool found = false;
+    uint32_t minSequence = 0;
+    uint32_t maxSequence = 0;
+    for (uint32_t index = 0; index < numBlocks_; index++)
+    {
+        BlockHeader header;
+        if (esp_partition_read(partition_, index * BLOCK_SIZE, &header, sizeof(header)) != ESP_OK ||
+            header.magic != RECORDING_BLOCK_MAGIC ||
+            header.format != format_ ||
+            header.sequence == RECORDING_ERASED_SEQUENCE ||
+            (header.sequence % numBlocks_) != index)
+        {
+            continue;
+        }
+
+        if (!found || header.sequence < minSequence)
+        {
+            minSequence = header.sequence;
+        }
+        if (!found || header.sequence > maxSequence)
+        {
+            maxSequence = header.sequence;
+        }
+        found = true;
+    }
+
+    if (found)
+    {
+        firstSequence_ = minSequence;
+        nextSequence_ = maxSequence + 1;
+        ESP_LOGI(CURRENT_LOG_TAG, "Found %" PRIu32 " recorded blocks", maxSequence + 1 - minSequence);
+    }
+}
+
+}
+
+}
@@ -0,0 +1,112 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDING_STORE_H
+#define RECORDING_STORE_H
+
+#include <atomic>
+#include <cinttypes>
+
+#include "esp_partition.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief A circular log of fixed-size blocks in the "rec" flash partition. 
+///        Each block is one flash sector with a small header (including an 
+///        ever-increasing sequence number), so the newest block can be found 
+///        again after a reboot and the oldest is simply overwritten once the
+///        partition fills up. One task appends; any task can read.
+class RecordingStore
+{
+public:
+    static constexpr uint32_t BLOCK_SIZE = 4096;
+    static constexpr uint32_t HEADER_SIZE = 16;
+    static constexpr uint32_t PAYLOAD_SIZE = BLOCK_SIZE - HEADER_SIZE;
+
+    /// @brief Size of the largest header returned by getFileHeader().
+    static constexpr uint32_t MAX_FILE_HEADER_SIZE = 44;
+
+    enum Format : uint16_t
+    {
+        PCM_8K = 1, // 16-bit mono samples
+        CODEC2_700C = 2, // packed codec2 frames
+    };
+
+    RecordingStore(Format format);
+    virtual ~RecordingStore();
+
+    /// @brief Returns the store in use by the recorder, or nullptr if there isn't one.
+    static RecordingStore* GetInstance();
+
+    /// @brief Returns false if there's no partition to record into (e.g. an 
+    ///        older partition table that was upgraded over the air).
+    bool isAvailable() const { return partition_ != nullptr; }
+
+    /// @brief Appends a block, replacing the oldest one if the partition is full.
+    /// @param payload PAYLOAD_SIZE bytes of audio.
+    esp_err_t append(const uint8_t* payload);
+
+    /// @brief Gets the sequence numbers of the blocks currently stored.
+    /// @param first The oldest block.
+    /// @param end One past the newest block.
+    void getRange(uint32_t* first, uint32_t* end) const;
+
+    /// @brief Reads a stored block.
+    /// @param sequence The block to read.
+    /// @param payload Where to store PAYLOAD_SIZE bytes of audio.
+    /// @return false if the block has been overwritten or couldn't be read.
+    bool read(uint32_t sequence, uint8_t* payload);
+
+    /// @brief Returns the name to download the recording as.
+    const char* getFileName() const;
+
+    /// @brief Builds the header of a downloadable file (WAV or .c2) for the given number of blocks.
+    /// @param buf Where to store the header (at least MAX_FILE_HEADER_SIZE bytes).
+    /// @return The header's length.
+    uint32_t getFileHeader(uint8_t* buf, uint32_t numBlocks) const;
+
+private:
+    struct BlockHeader
+    {
+        uint32_t magic;
+        uint32_t sequence;
+        uint16_t format;
+        uint16_t payloadSize;
+        uint32_t reserved;
+    };
+
+    static RecordingStore* Instance_;
+
+    const esp_partition_t* partition_;
+    Format format_;
+    uint32_t numBlocks_;
+    std::atomic<uint32_t> firstSequence_;
+    std::atomic<uint32_t> nextSequence_;
+    uint8_t* blockBuf_;
+
+    void findNewestBlock_();
+};
+
+}
+
+}
+
+#endif // RECORDING_STORE_H
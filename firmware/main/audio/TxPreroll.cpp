@@ -0,0 +1,87 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "esp_log.h"
+
+#include "TxPreroll.h"
+
+#if CONFIG_EZDV_TX_PREROLL
+
+#define TX_PREROLL_US (CONFIG_EZDV_TX_PREROLL_MS * 1000)
+
+// Start anyway if no audio arrives by then (e.g. the encoder isn't running).
+#define TX_PREROLL_MAX_WAIT_US (1000000)
+
+#define CURRENT_LOG_TAG ("TxPreroll")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+TxPreroll::TxPreroll()
+    : isPriming_(false)
+    , startTimeUs_(0)
+    , firstAudioTimeUs_(0)
+{
+    // empty
+}
+
+void TxPreroll::start(int64_t nowUs)
+{
+    isPriming_ = true;
+    startTimeUs_ = nowUs;
+    firstAudioTimeUs_ = 0;
+}
+
+void TxPreroll::cancel()
+{
+    isPriming_ = false;
+}
+
+bool TxPreroll::update(uint32_t numQueued, int64_t nowUs)
+{
+    if (!isPriming_)
+    {
+        return true;
+    }
+
+    if (firstAudioTimeUs_ == 0 && numQueued > 0)
+    {
+        firstAudioTimeUs_ = nowUs;
+    }
+
+    if (firstAudioTimeUs_ != 0 && nowUs - firstAudioTimeUs_ >= TX_PREROLL_US)
+    {
+        ESP_LOGD(CURRENT_LOG_TAG, "TX primed with %" PRIu32 " samples after %" PRId64 " us", numQueued, nowUs - startTimeUs_);
+        isPriming_ = false;
+    }
+    else if (nowUs - startTimeUs_ >= TX_PREROLL_MAX_WAIT_US)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "No TX audio after %d ms, starting anyway", TX_PREROLL_MAX_WAIT_US / 1000);
+        isPriming_ = false;
+    }
+
+    return !isPriming_;
+}
+
+}
+
+}
+
+#endif // CONFIG_EZDV_TX_PREROLL
@@ -0,0 +1,72 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TX_PREROLL_H
+#define TX_PREROLL_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+
+#if CONFIG_EZDV_TX_PREROLL
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Holds back the start of a transport's TX stream after PTT. FreeDV
+///        produces audio a whole modem frame at a time, so a stream started
+///        with the first frame runs dry if the next one is even slightly 
+///        late. Instead, the stream starts CONFIG_EZDV_TX_PREROLL_MS after
+///        the first modem audio is queued, which leaves that much slack for
+///        the encoder and gives the same latency every time.
+class TxPreroll
+{
+public:
+    TxPreroll();
+    virtual ~TxPreroll() = default;
+
+    /// @brief Starts priming (i.e. PTT was requested).
+    void start(int64_t nowUs);
+
+    /// @brief Stops priming without waiting (e.g. back to RX).
+    void cancel();
+
+    bool isPriming() const { return isPriming_; }
+
+    /// @brief Checks whether the stream should start.
+    /// @param numQueued The number of samples currently in the TX FIFO.
+    /// @param nowUs The current time.
+    /// @return true once the FIFO is primed (or priming has taken too long). 
+    ///         Priming is over at that point.
+    bool update(uint32_t numQueued, int64_t nowUs);
+
+private:
+    bool isPriming_;
+    int64_t startTimeUs_;
+    int64_t firstAudioTimeUs_; // 0 until audio is queued
+};
+
+}
+
+}
+
+#endif // CONFIG_EZDV_TX_PREROLL
+
+#endif // TX_PREROLL_H
@@ -0,0 +1,240 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "VoiceKeyerClip.h"
+
+#define CURRENT_LOG_TAG "VoiceKeyerClip"
+#define VOICE_KEYER_PARTITION_LABEL "vk"
+
+// The index lives in its own sector so that it can be rewritten without 
+// touching any of the samples. Slots follow, each starting on a sector
+// boundary.
+#define CLIP_INDEX_MAGIC (0x49565A45) /* "EZVI" */
+#define CLIP_SECTOR_SIZE (4096)
+#define CLIP_SLOTS_OFFSET CLIP_SECTOR_SIZE
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+VoiceKeyerClip::VoiceKeyerClip()
+    : mmapHandle_(0)
+    , isMapped_(false)
+    , uploadSlot_(-1)
+    , sampleBytesWritten_(0)
+    , sectorBuf_(nullptr)
+    , sectorBufUsed_(0)
+{
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, VOICE_KEYER_PARTITION_LABEL);
+    assert(partition_ != nullptr);
+
+    slotSize_ = ((partition_->size - CLIP_SLOTS_OFFSET) / NUM_SLOTS) & ~(CLIP_SECTOR_SIZE - 1);
+    assert(slotSize_ > 0);
+
+    readIndex_();
+}
+
+VoiceKeyerClip::~VoiceKeyerClip()
+{
+    close();
+
+    if (sectorBuf_ != nullptr)
+    {
+        heap_caps_free(sectorBuf_);
+    }
+}
+
+esp_err_t VoiceKeyerClip::beginUpload(int slot)
+{
+    assert(!isMapped_);
+
+    if (slot < 0 || slot >= NUM_SLOTS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (sectorBuf_ == nullptr)
+    {
+        sectorBuf_ = (uint8_t*)heap_caps_malloc(CLIP_SECTOR_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+        assert(sectorBuf_ != nullptr);
+    }
+
+    uploadSlot_ = slot;
+    sampleBytesWritten_ = 0;
+    sectorBufUsed_ = 0;
+
+    // Nothing is playable from this slot until finishUpload().
+    index_.entries[slot].numSamples = 0;
+    index_.entries[slot].sampleRate = 0;
+    return writeIndex_();
+}
+
+esp_err_t VoiceKeyerClip::uploadSamples(const short* samples, uint32_t numSamples)
+{
+    assert(uploadSlot_ >= 0);
+
+    const uint8_t* buf = (const uint8_t*)samples;
+    uint32_t length = numSamples * sizeof(short);
+    if (sampleBytesWritten_ + sectorBufUsed_ + length > slotSize_)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    while (length > 0)
+    {
+        uint32_t amountToCopy = std::min(length, (uint32_t)CLIP_SECTOR_SIZE - sectorBufUsed_);
+        memcpy(sectorBuf_ + sectorBufUsed_, buf, amountToCopy);
+        sectorBufUsed_ += amountToCopy;
+        buf += amountToCopy;
+        length -= amountToCopy;
+
+        if (sectorBufUsed_ == CLIP_SECTOR_SIZE)
+        {
+            esp_err_t rv = flushSectorBuf_();
+            if (rv != ESP_OK)
+            {
+                return rv;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t VoiceKeyerClip::flushSectorBuf_()
+{
+    if (sectorBufUsed_ == 0)
+    {
+        return ESP_OK;
+    }
+
+    // Every flush but the last is a full sector, so each one starts on a 
+    // fresh sector and only needs that sector erased.
+    uint32_t offset = getSlotOffset_(uploadSlot_) + sampleBytesWritten_;
+    esp_err_t rv = esp_partition_erase_range(partition_, offset, CLIP_SECTOR_SIZE);
+    if (rv == ESP_OK)
+    {
+        rv = esp_partition_write(partition_, offset, sectorBuf_, sectorBufUsed_);
+    }
+
+    if (rv == ESP_OK)
+    {
+        sampleBytesWritten_ += sectorBufUsed_;
+        sectorBufUsed_ = 0;
+    }
+    return rv;
+}
+
+esp_err_t VoiceKeyerClip::finishUpload(uint32_t sampleRate)
+{
+    assert(uploadSlot_ >= 0);
+
+    int slot = uploadSlot_;
+    uploadSlot_ = -1;
+
+    esp_err_t rv = flushSectorBuf_();
+    if (rv != ESP_OK)
+    {
+        return rv;
+    }
+
+    index_.entries[slot].numSamples = sampleBytesWritten_ / sizeof(short);
+    index_.entries[slot].sampleRate = sampleRate;
+    rv = writeIndex_();
+    if (rv == ESP_OK)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Stored %" PRIu32 " sample voice keyer clip in slot %d", index_.entries[slot].numSamples, slot);
+    }
+    return rv;
+}
+
+const short* VoiceKeyerClip::open(int slot, uint32_t* numSamples)
+{
+    assert(!isMapped_);
+
+    readIndex_();
+    if (slot < 0 || slot >= NUM_SLOTS || index_.entries[slot].numSamples == 0)
+    {
+        return nullptr;
+    }
+
+    // Only the slot being played needs to be mapped.
+    const void* ptr = nullptr;
+    esp_err_t rv = esp_partition_mmap(
+        partition_, getSlotOffset_(slot), index_.entries[slot].numSamples * sizeof(short),
+        ESP_PARTITION_MMAP_DATA, &ptr, &mmapHandle_);
+    if (rv != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not map voice keyer clip: %s", esp_err_to_name(rv));
+        return nullptr;
+    }
+
+    isMapped_ = true;
+    *numSamples = index_.entries[slot].numSamples;
+    return (const short*)ptr;
+}
+
+void VoiceKeyerClip::close()
+{
+    if (isMapped_)
+    {
+        esp_partition_munmap(mmapHandle_);
+        isMapped_ = false;
+    }
+}
+
+uint32_t VoiceKeyerClip::getSlotOffset_(int slot)
+{
+    return CLIP_SLOTS_OFFSET + slot * slotSize_;
+}
+
+void VoiceKeyerClip::readIndex_()
+{
+    // Anything that isn't an index for this slot layout (e.g. FATFS) means
+    // there's nothing stored yet.
+    if (esp_partition_read(partition_, 0, &index_, sizeof(index_)) != ESP_OK ||
+        index_.magic != CLIP_INDEX_MAGIC ||
+        index_.numSlots != NUM_SLOTS)
+    {
+        memset(&index_, 0, sizeof(index_));
+        index_.magic = CLIP_INDEX_MAGIC;
+        index_.numSlots = NUM_SLOTS;
+    }
+}
+
+esp_err_t VoiceKeyerClip::writeIndex_()
+{
+    esp_err_t rv = esp_partition_erase_range(partition_, 0, CLIP_SECTOR_SIZE);
+    if (rv == ESP_OK)
+    {
+        rv = esp_partition_write(partition_, 0, &index_, sizeof(index_));
+    }
+    return rv;
+}
+
+}
+
+}
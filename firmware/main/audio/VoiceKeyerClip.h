@@ -0,0 +1,108 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VOICE_KEYER_CLIP_H
+#define VOICE_KEYER_CLIP_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+#include "esp_partition.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Stores voice keyer recordings as raw, contiguous samples in the
+///        "vk" partition so that they can be played straight out of 
+///        memory-mapped flash (no filesystem, read buffers or copies needed).
+///        The partition is split into equally sized slots, with a small 
+///        index in the first sector describing what's in each.
+class VoiceKeyerClip
+{
+public:
+    static constexpr int NUM_SLOTS = CONFIG_EZDV_VOICE_KEYER_NUM_SLOTS;
+
+    VoiceKeyerClip();
+    virtual ~VoiceKeyerClip();
+
+    /// @brief Starts replacing the clip in a slot. The slot's old clip is 
+    ///        invalidated immediately.
+    /// @param slot The slot to store the clip in.
+    /// @return ESP_OK on success.
+    esp_err_t beginUpload(int slot);
+
+    /// @brief Stores the next part of the clip.
+    /// @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the clip won't fit.
+    esp_err_t uploadSamples(const short* samples, uint32_t numSamples);
+
+    /// @brief Makes the uploaded samples the slot's clip.
+    /// @param sampleRate The clip's sample rate.
+    esp_err_t finishUpload(uint32_t sampleRate);
+
+    /// @brief Maps a slot's clip into memory.
+    /// @param slot The slot to play.
+    /// @param numSamples Where to store the number of samples in the clip.
+    /// @return The clip's samples, or nullptr if the slot is empty.
+    const short* open(int slot, uint32_t* numSamples);
+
+    /// @brief Unmaps the clip returned by open().
+    void close();
+
+    // Note: separate instances can be used for playback and upload; open()
+    // always uses the latest index.
+
+private:
+    struct IndexEntry
+    {
+        uint32_t numSamples; // 0 if the slot is empty
+        uint32_t sampleRate;
+    };
+
+    struct Index
+    {
+        uint32_t magic;
+        uint32_t numSlots;
+        IndexEntry entries[NUM_SLOTS];
+    };
+
+    const esp_partition_t* partition_;
+    esp_partition_mmap_handle_t mmapHandle_;
+    bool isMapped_;
+    uint32_t slotSize_;
+    Index index_;
+
+    // Upload state. Samples are collected into whole sectors before 
+    // they're written.
+    int uploadSlot_;
+    uint32_t sampleBytesWritten_;
+    uint8_t* sectorBuf_;
+    uint32_t sectorBufUsed_;
+
+    uint32_t getSlotOffset_(int slot);
+    void readIndex_();
+    esp_err_t writeIndex_();
+    esp_err_t flushSectorBuf_();
+};
+
+}
+
+}
+
+#endif // VOICE_KEYER_CLIP_H
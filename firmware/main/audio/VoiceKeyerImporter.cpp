@@ -0,0 +1,493 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "VoiceKeyerImporter.h"
+
+#define CURRENT_LOG_TAG "VoiceKeyerImporter"
+
+#define RIFF_HEADER_SIZE (12)
+#define CHUNK_HEADER_SIZE (8)
+#define FMT_CHUNK_MIN_SIZE (16)
+
+#define WAVE_FORMAT_PCM (0x0001)
+#define WAVE_FORMAT_IEEE_FLOAT (0x0003)
+#define WAVE_FORMAT_EXTENSIBLE (0xFFFE)
+
+#define IMPORT_MAX_CHANNELS (8)
+#define IMPORT_MIN_SAMPLE_RATE (4000)
+#define IMPORT_MAX_SAMPLE_RATE (192000)
+
+// Filter taps per phase for each multiple of the decimation factor. Imports
+// aren't time sensitive, so this errs on the side of a sharp cutoff.
+#define IMPORT_TAPS_PER_PHASE (16)
+
+// Lowpass cutoff as a fraction of the lower of the two sample rates. Leaves 
+// some room for the transition band below Nyquist.
+#define IMPORT_CUTOFF (0.45f)
+
+// Limits filter memory for awkward ratios (e.g. 11025 Hz needs 320 phases).
+#define IMPORT_MAX_UPSAMPLE_FACTOR (320)
+#define IMPORT_MAX_FILTER_TAPS (16384)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static uint16_t ReadLE16_(const uint8_t* buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t ReadLE32_(const uint8_t* buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+VoiceKeyerImporter::VoiceKeyerImporter(SampleFn fn, void* arg)
+    : sampleFn_(fn)
+    , sampleFnArg_(arg)
+    , filter_(nullptr)
+    , history_(nullptr)
+{
+    begin();
+}
+
+VoiceKeyerImporter::~VoiceKeyerImporter()
+{
+    freeResampler_();
+}
+
+void VoiceKeyerImporter::begin()
+{
+    freeResampler_();
+
+    state_ = RIFF_HEADER;
+    error_ = FileUploadCompleteMessage::NONE;
+    headerBytes_ = 0;
+    chunkBytesLeft_ = 0;
+    hasFormat_ = false;
+    frameBytes_ = 0;
+    upsampleFactor_ = 1;
+    downsampleFactor_ = 1;
+    tapsPerPhase_ = 0;
+    historyPos_ = 0;
+    phase_ = 0;
+    outputUsed_ = 0;
+}
+
+FileUploadCompleteMessage::ErrorType VoiceKeyerImporter::process(const uint8_t* buf, uint32_t length)
+{
+    while (length > 0 && state_ != DONE && state_ != FAILED)
+    {
+        uint32_t amount = length;
+        switch (state_)
+        {
+            case RIFF_HEADER:
+            case CHUNK_HEADER:
+            {
+                uint32_t headerSize = (state_ == RIFF_HEADER) ? RIFF_HEADER_SIZE : CHUNK_HEADER_SIZE;
+                amount = std::min(length, headerSize - headerBytes_);
+                memcpy(headerBuf_ + headerBytes_, buf, amount);
+                headerBytes_ += amount;
+
+                if (headerBytes_ == headerSize)
+                {
+                    headerBytes_ = 0;
+                    if (state_ == CHUNK_HEADER)
+                    {
+                        parseChunkHeader_();
+                    }
+                    else if (memcmp(headerBuf_, "RIFF", 4) != 0 || memcmp(headerBuf_ + 8, "WAVE", 4) != 0)
+                    {
+                        ESP_LOGE(CURRENT_LOG_TAG, "Not a WAV file");
+                        fail_(FileUploadCompleteMessage::UNSUPPORTED_FORMAT);
+                    }
+                    else
+                    {
+                        state_ = CHUNK_HEADER;
+                    }
+                }
+                break;
+            }
+            case FMT_CHUNK:
+            {
+                // Anything past the extensible format fields is ignored.
+                amount = std::min(length, chunkBytesLeft_);
+                uint32_t amountToCopy = std::min(amount, FMT_CHUNK_MAX_SIZE - headerBytes_);
+                memcpy(headerBuf_ + headerBytes_, buf, amountToCopy);
+                headerBytes_ += amountToCopy;
+
+                chunkBytesLeft_ -= amount;
+                if (chunkBytesLeft_ == 0)
+                {
+                    parseFormat_();
+                    headerBytes_ = 0;
+                }
+                break;
+            }
+            case SKIP_CHUNK:
+            {
+                amount = std::min(length, chunkBytesLeft_);
+                chunkBytesLeft_ -= amount;
+                if (chunkBytesLeft_ == 0)
+                {
+                    state_ = CHUNK_HEADER;
+                }
+                break;
+            }
+            case DATA_CHUNK:
+            {
+                amount = std::min(length, chunkBytesLeft_);
+                if (frameBytes_ > 0 || amount < frameSize_)
+                {
+                    // Frame split across two uploaded chunks.
+                    amount = std::min(amount, frameSize_ - frameBytes_);
+                    memcpy(frameBuf_ + frameBytes_, buf, amount);
+                    frameBytes_ += amount;
+
+                    if (frameBytes_ == frameSize_)
+                    {
+                        decodeFrames_(frameBuf_, 1);
+                        frameBytes_ = 0;
+                    }
+                }
+                else
+                {
+                    uint32_t numFrames = std::min(amount / frameSize_, BLOCK_SAMPLES);
+                    amount = numFrames * frameSize_;
+                    decodeFrames_(buf, numFrames);
+                }
+
+                // Streamed files may not know their length, in which case
+                // everything up to the end of the upload is audio.
+                if (chunkBytesLeft_ != UINT32_MAX)
+                {
+                    chunkBytesLeft_ -= amount;
+                    if (chunkBytesLeft_ == 0 && state_ != FAILED)
+                    {
+                        state_ = DONE;
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        buf += amount;
+        length -= amount;
+    }
+
+    return error_;
+}
+
+FileUploadCompleteMessage::ErrorType VoiceKeyerImporter::finish()
+{
+    if (state_ != DATA_CHUNK && state_ != DONE)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "File ended before any audio was found");
+        return fail_(FileUploadCompleteMessage::UNSUPPORTED_FORMAT);
+    }
+
+    // Push the last of the audio out of the filter.
+    if (filter_ != nullptr)
+    {
+        memset(inputBlock_, 0, sizeof(inputBlock_));
+        resample_(inputBlock_, std::min(tapsPerPhase_ / 2, BLOCK_SAMPLES));
+    }
+
+    flushOutput_();
+    freeResampler_();
+
+    if (state_ != FAILED)
+    {
+        state_ = DONE;
+    }
+    return error_;
+}
+
+FileUploadCompleteMessage::ErrorType VoiceKeyerImporter::fail_(FileUploadCompleteMessage::ErrorType errorType)
+{
+    if (state_ != FAILED)
+    {
+        state_ = FAILED;
+        error_ = errorType;
+    }
+    return error_;
+}
+
+void VoiceKeyerImporter::freeResampler_()
+{
+    if (filter_ != nullptr)
+    {
+        heap_caps_free(filter_);
+        filter_ = nullptr;
+    }
+
+    if (history_ != nullptr)
+    {
+        heap_caps_free(history_);
+        history_ = nullptr;
+    }
+}
+
+void VoiceKeyerImporter::parseChunkHeader_()
+{
+    uint32_t size = ReadLE32_(headerBuf_ + 4);
+
+    if (memcmp(headerBuf_, "fmt ", 4) == 0)
+    {
+        if (size < FMT_CHUNK_MIN_SIZE)
+        {
+            fail_(FileUploadCompleteMessage::UNSUPPORTED_FORMAT);
+            return;
+        }
+
+        state_ = FMT_CHUNK;
+        chunkBytesLeft_ = size + (size & 1);
+    }
+    else if (memcmp(headerBuf_, "data", 4) == 0)
+    {
+        if (!hasFormat_)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Data chunk found before format chunk");
+            fail_(FileUploadCompleteMessage::UNSUPPORTED_FORMAT);
+            return;
+        }
+
+        chunkBytesLeft_ = (size == 0) ? UINT32_MAX : size;
+        startData_();
+    }
+    else if (size > 0)
+    {
+        // LIST, fact, cue, etc. Chunks are padded to an even length.
+        state_ = SKIP_CHUNK;
+        chunkBytesLeft_ = (size == UINT32_MAX) ? size : size + (size & 1);
+    }
+}
+
+void VoiceKeyerImporter::parseFormat_()
+{
+    audioFormat_ = ReadLE16_(headerBuf_);
+    numChannels_ = ReadLE16_(headerBuf_ + 2);
+    sampleRate_ = ReadLE32_(headerBuf_ + 4);
+    frameSize_ = ReadLE16_(headerBuf_ + 12);
+    bitDepth_ = ReadLE16_(headerBuf_ + 14);
+
+    // The real format is in the first two bytes of the subformat GUID.
+    if (audioFormat_ == WAVE_FORMAT_EXTENSIBLE && headerBytes_ >= 26)
+    {
+        audioFormat_ = ReadLE16_(headerBuf_ + 24);
+    }
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "Importing format %d, %d channels, %" PRIu32 " Hz, %d bits", 
+        audioFormat_, numChannels_, sampleRate_, bitDepth_);
+
+    bool isPcm = 
+        audioFormat_ == WAVE_FORMAT_PCM && 
+        (bitDepth_ == 8 || bitDepth_ == 16 || bitDepth_ == 24 || bitDepth_ == 32);
+    bool isFloat = audioFormat_ == WAVE_FORMAT_IEEE_FLOAT && bitDepth_ == 32;
+    if (!isPcm && !isFloat)
+    {
+        fail_(FileUploadCompleteMessage::UNSUPPORTED_FORMAT);
+    }
+    else if (numChannels_ == 0 || numChannels_ > IMPORT_MAX_CHANNELS)
+    {
+        fail_(FileUploadCompleteMessage::INCORRECT_NUM_CHANNELS);
+    }
+    else if (frameSize_ != numChannels_ * (bitDepth_ / 8u))
+    {
+        fail_(FileUploadCompleteMessage::UNSUPPORTED_FORMAT);
+    }
+    else
+    {
+        hasFormat_ = true;
+        state_ = CHUNK_HEADER;
+    }
+}
+
+void VoiceKeyerImporter::startData_()
+{
+    if (sampleRate_ < IMPORT_MIN_SAMPLE_RATE || sampleRate_ > IMPORT_MAX_SAMPLE_RATE)
+    {
+        fail_(FileUploadCompleteMessage::INCORRECT_SAMPLE_RATE);
+        return;
+    }
+
+    uint32_t divisor = std::gcd(sampleRate_, OUTPUT_SAMPLE_RATE);
+    upsampleFactor_ = OUTPUT_SAMPLE_RATE / divisor;
+    downsampleFactor_ = sampleRate_ / divisor;
+
+    // Enough taps per phase to cover IMPORT_TAPS_PER_PHASE samples at 
+    // the lower of the two rates.
+    tapsPerPhase_ = IMPORT_TAPS_PER_PHASE * ((downsampleFactor_ + upsampleFactor_ - 1) / upsampleFactor_);
+    uint32_t numTaps = upsampleFactor_ * tapsPerPhase_;
+    if (upsampleFactor_ > IMPORT_MAX_UPSAMPLE_FACTOR || numTaps > IMPORT_MAX_FILTER_TAPS)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Cannot convert from %" PRIu32 " Hz", sampleRate_);
+        fail_(FileUploadCompleteMessage::INCORRECT_SAMPLE_RATE);
+        return;
+    }
+
+    if (sampleRate_ != OUTPUT_SAMPLE_RATE)
+    {
+        filter_ = (short*)heap_caps_malloc(numTaps * sizeof(short), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        assert(filter_ != nullptr);
+        history_ = (short*)heap_caps_calloc(2 * tapsPerPhase_, sizeof(short), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        assert(history_ != nullptr);
+
+        // Windowed-sinc lowpass designed at the upsampled rate, then split
+        // into phases. This only happens once per upload, so floating point
+        // is fine.
+        const float pi = M_PI;
+        float cutoff = IMPORT_CUTOFF * std::min(sampleRate_, OUTPUT_SAMPLE_RATE) / ((float)sampleRate_ * upsampleFactor_);
+        float center = (numTaps - 1) / 2.0f;
+        for (uint32_t tap = 0; tap < numTaps; tap++)
+        {
+            float x = 2 * pi * cutoff * (tap - center);
+            float sinc = (x == 0) ? 1.0f : sinf(x) / x;
+            float window = 0.54f - 0.46f * cosf(2 * pi * tap / (numTaps - 1));
+            long coeff = lrintf(2 * cutoff * upsampleFactor_ * sinc * window * SHRT_MAX);
+
+            filter_[(tap % upsampleFactor_) * tapsPerPhase_ + tap / upsampleFactor_] = 
+                (short)std::max((long)SHRT_MIN, std::min((long)SHRT_MAX, coeff));
+        }
+    }
+
+    state_ = DATA_CHUNK;
+}
+
+void VoiceKeyerImporter::decodeFrames_(const uint8_t* buf, uint32_t numFrames)
+{
+    uint32_t bytesPerSample = bitDepth_ / 8;
+
+    for (uint32_t frame = 0; frame < numFrames; frame++)
+    {
+        // Downmix by averaging all channels.
+        int32_t sum = 0;
+        for (uint32_t channel = 0; channel < numChannels_; channel++)
+        {
+            const uint8_t* sample = buf + channel * bytesPerSample;
+            if (audioFormat_ == WAVE_FORMAT_IEEE_FLOAT)
+            {
+                float value;
+                memcpy(&value, sample, sizeof(value));
+                if (!std::isnan(value))
+                {
+                    sum += (int32_t)(std::max(-1.0f, std::min(1.0f, value)) * SHRT_MAX);
+                }
+                continue;
+            }
+
+            switch (bytesPerSample)
+            {
+                case 1:
+                    sum += (sample[0] - 128) << 8;
+                    break;
+                case 2:
+                    sum += (int16_t)ReadLE16_(sample);
+                    break;
+                case 3:
+                    sum += (int32_t)(((uint32_t)sample[0] << 8) | (sample[1] << 16) | ((uint32_t)sample[2] << 24)) >> 16;
+                    break;
+                case 4:
+                    sum += (int32_t)ReadLE32_(sample) >> 16;
+                    break;
+            }
+        }
+
+        inputBlock_[frame] = sum / numChannels_;
+        buf += frameSize_;
+    }
+
+    resample_(inputBlock_, numFrames);
+}
+
+void VoiceKeyerImporter::resample_(const short* samples, uint32_t numSamples)
+{
+    if (filter_ == nullptr)
+    {
+        for (uint32_t index = 0; index < numSamples; index++)
+        {
+            writeOutput_(samples[index]);
+        }
+        return;
+    }
+
+    for (uint32_t index = 0; index < numSamples; index++)
+    {
+        historyPos_ = (historyPos_ == 0) ? tapsPerPhase_ - 1 : historyPos_ - 1;
+        history_[historyPos_] = history_[historyPos_ + tapsPerPhase_] = samples[index];
+
+        // Emit every output sample that lines up with this input sample.
+        const short* history = &history_[historyPos_];
+        while (phase_ < upsampleFactor_)
+        {
+            const short* taps = &filter_[phase_ * tapsPerPhase_];
+            int64_t accumulator = 0;
+            for (uint32_t tap = 0; tap < tapsPerPhase_; tap++)
+            {
+                accumulator += (int32_t)taps[tap] * history[tap];
+            }
+
+            accumulator >>= 15;
+            writeOutput_((short)std::max((int64_t)SHRT_MIN, std::min((int64_t)SHRT_MAX, accumulator)));
+            phase_ += downsampleFactor_;
+        }
+        phase_ -= upsampleFactor_;
+    }
+}
+
+void VoiceKeyerImporter::writeOutput_(short sample)
+{
+    outputBlock_[outputUsed_++] = sample;
+    if (outputUsed_ == BLOCK_SAMPLES)
+    {
+        flushOutput_();
+    }
+}
+
+void VoiceKeyerImporter::flushOutput_()
+{
+    if (outputUsed_ > 0 && state_ != FAILED)
+    {
+        auto rv = sampleFn_(sampleFnArg_, outputBlock_, outputUsed_);
+        if (rv != FileUploadCompleteMessage::NONE)
+        {
+            fail_(rv);
+        }
+    }
+
+    outputUsed_ = 0;
+}
+
+}
+
+}
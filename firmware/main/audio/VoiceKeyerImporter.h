@@ -0,0 +1,129 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VOICE_KEYER_IMPORTER_H
+#define VOICE_KEYER_IMPORTER_H
+
+#include <cinttypes>
+
+#include "VoiceKeyerMessage.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Converts a WAV file to 8 kHz mono as it's being uploaded. The file
+///        is parsed chunk by chunk as data arrives, then downmixed and 
+///        resampled one block at a time, so it never has to be held in RAM.
+///        Any chunk layout is accepted, as are 8/16/24/32-bit PCM and 32-bit 
+///        float, up to 8 channels, at sample rates that are a reasonable 
+///        rational multiple of 8 kHz (8, 11.025, 16, 22.05, 44.1, 48 kHz etc.)
+class VoiceKeyerImporter
+{
+public:
+    static constexpr uint32_t OUTPUT_SAMPLE_RATE = 8000;
+
+    /// @brief Called with each block of converted samples.
+    /// @return NONE to continue, otherwise the reason to stop the import.
+    typedef FileUploadCompleteMessage::ErrorType (*SampleFn)(void* arg, const short* samples, uint32_t numSamples);
+
+    /// @brief Creates a new importer.
+    /// @param fn The function that stores converted samples.
+    /// @param arg Passed to fn.
+    VoiceKeyerImporter(SampleFn fn, void* arg);
+    virtual ~VoiceKeyerImporter();
+
+    /// @brief Starts importing a new file.
+    void begin();
+
+    /// @brief Processes the next part of the file.
+    /// @return NONE on success, otherwise the reason the file was rejected.
+    FileUploadCompleteMessage::ErrorType process(const uint8_t* buf, uint32_t length);
+
+    /// @brief Passes on any remaining samples once the whole file has been received.
+    /// @return NONE on success, otherwise the reason the file was rejected.
+    FileUploadCompleteMessage::ErrorType finish();
+
+private:
+    enum State
+    {
+        RIFF_HEADER,
+        CHUNK_HEADER,
+        FMT_CHUNK,
+        SKIP_CHUNK,
+        DATA_CHUNK,
+        DONE,
+        FAILED,
+    };
+
+    static constexpr uint32_t FMT_CHUNK_MAX_SIZE = 40; // WAVE_FORMAT_EXTENSIBLE
+    static constexpr uint32_t MAX_FRAME_SIZE = 32; // 8 channels of 32-bit samples
+    static constexpr uint32_t BLOCK_SAMPLES = 256;
+
+    SampleFn sampleFn_;
+    void* sampleFnArg_;
+
+    State state_;
+    FileUploadCompleteMessage::ErrorType error_;
+    uint8_t headerBuf_[FMT_CHUNK_MAX_SIZE];
+    uint32_t headerBytes_;
+    uint32_t chunkBytesLeft_;
+    bool hasFormat_;
+
+    uint16_t audioFormat_;
+    uint16_t numChannels_;
+    uint16_t bitDepth_;
+    uint32_t sampleRate_;
+    uint32_t frameSize_;
+    uint8_t frameBuf_[MAX_FRAME_SIZE]; // frames split across uploaded chunks
+    uint32_t frameBytes_;
+
+    // Polyphase resampler: upsample by upsampleFactor_, filter, then
+    // keep every downsampleFactor_th sample. Only the taps that line up 
+    // with real input samples are ever evaluated.
+    uint32_t upsampleFactor_;
+    uint32_t downsampleFactor_;
+    uint32_t tapsPerPhase_;
+    short* filter_; // Q15, one row of tapsPerPhase_ taps per phase
+    short* history_; // two copies back to back, newest sample first
+    uint32_t historyPos_;
+    uint32_t phase_;
+
+    short inputBlock_[BLOCK_SAMPLES];
+    short outputBlock_[BLOCK_SAMPLES];
+    uint32_t outputUsed_;
+
+    FileUploadCompleteMessage::ErrorType fail_(FileUploadCompleteMessage::ErrorType errorType);
+    void freeResampler_();
+
+    void parseChunkHeader_();
+    void parseFormat_();
+    void startData_();
+
+    void decodeFrames_(const uint8_t* buf, uint32_t numFrames);
+    void resample_(const short* samples, uint32_t numSamples);
+    void writeOutput_(short sample);
+    void flushOutput_();
+};
+
+}
+
+}
+
+#endif // VOICE_KEYER_IMPORTER_H
@@ -52,6 +52,9 @@ enum VoiceKeyerMessageTypes
     // buttons
     REQUEST_START_STOP_KEYER = 7,
     GET_KEYER_STATE = 8,
+
+    // Sent by voice keyer when it starts and stops sending the clip
+    KEYER_TRANSMIT_STATE = 9,
 };
 
 template<uint32_t MSG_ID>
@@ -76,6 +79,7 @@ public:
         MISSING_FIELDS,
         UNABLE_SAVE_SETTINGS,
         FILE_TOO_LARGE,
+        UNSUPPORTED_FORMAT,
     };
 
     FileUploadCompleteMessage(bool successProvided = true, ErrorType errorTypeProvided = NONE, int errnoProvided = 0)
@@ -112,6 +116,22 @@ public:
 
 using GetKeyerStateMessage = StartStopCommon<GET_KEYER_STATE>;
 
+class VoiceKeyerTransmitStateMessage : public DVTaskMessageBase<KEYER_TRANSMIT_STATE, VoiceKeyerTransmitStateMessage>
+{
+public:
+    VoiceKeyerTransmitStateMessage(bool transmittingProvided = false, bool clipFinishedProvided = false)
+        : DVTaskMessageBase<KEYER_TRANSMIT_STATE, VoiceKeyerTransmitStateMessage>(VOICE_KEYER_MESSAGE)
+        , transmitting(transmittingProvided)
+        , clipFinished(clipFinishedProvided)
+        {}
+    virtual ~VoiceKeyerTransmitStateMessage() = default;
+
+    bool transmitting;
+
+    // True if the whole clip was sent (as opposed to the keyer being stopped).
+    bool clipFinished;
+};
+
 }
 
 }
@@ -0,0 +1,164 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "VoiceKeyerStorage.h"
+#include "util/BootTimeline.h"
+
+#define CURRENT_LOG_TAG "VoiceKeyerStorage"
+
+#define VOICE_KEYER_MOUNT_POINT "/vk"
+#define VOICE_KEYER_PARTITION_LABEL "vk"
+
+// How long the partition stays mounted after its last use.
+#define VOICE_KEYER_IDLE_UNMOUNT_TIME_US (MS_TO_US(60000))
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+SemaphoreHandle_t VoiceKeyerStorage::Lock_ = nullptr;
+int VoiceKeyerStorage::RefCount_ = 0;
+wl_handle_t VoiceKeyerStorage::WlHandle_ = WL_INVALID_HANDLE;
+uint64_t VoiceKeyerStorage::LastReleaseTimeUs_ = 0;
+
+VoiceKeyerStorage::VoiceKeyerStorage(DVTask* owner)
+    : idleTimer_(owner, this, &VoiceKeyerStorage::onIdleTimer_, VOICE_KEYER_IDLE_UNMOUNT_TIME_US, "VKIdleTimer")
+    , acquired_(false)
+{
+    // Instances are created during startup, before any tasks run.
+    if (Lock_ == nullptr)
+    {
+        Lock_ = xSemaphoreCreateMutex();
+        assert(Lock_ != nullptr);
+    }
+
+    idleTimer_.useTimerWheel();
+}
+
+VoiceKeyerStorage::~VoiceKeyerStorage()
+{
+    shutdown();
+}
+
+esp_err_t VoiceKeyerStorage::acquire()
+{
+    if (acquired_)
+    {
+        return ESP_OK;
+    }
+
+    idleTimer_.stop();
+
+    esp_err_t rv = ESP_OK;
+    xSemaphoreTake(Lock_, portMAX_DELAY);
+    if (WlHandle_ == WL_INVALID_HANDLE)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Mounting voice keyer partition");
+
+        esp_vfs_fat_mount_config_t mountConfig = {
+            .format_if_mount_failed = true,
+            .max_files = 5,
+            .allocation_unit_size = 0,
+            .disk_status_check_enable = false,
+        };
+
+        util::BootTimeline::Step step("fatfs mount");
+        rv = esp_vfs_fat_spiflash_mount_rw_wl(
+            VOICE_KEYER_MOUNT_POINT,
+            VOICE_KEYER_PARTITION_LABEL,
+            &mountConfig,
+            &WlHandle_
+        );
+        if (rv != ESP_OK)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not mount voice keyer partition: %s", esp_err_to_name(rv));
+            WlHandle_ = WL_INVALID_HANDLE;
+        }
+    }
+
+    if (rv == ESP_OK)
+    {
+        RefCount_++;
+        acquired_ = true;
+    }
+    xSemaphoreGive(Lock_);
+
+    return rv;
+}
+
+void VoiceKeyerStorage::release()
+{
+    if (!acquired_)
+    {
+        return;
+    }
+
+    xSemaphoreTake(Lock_, portMAX_DELAY);
+    RefCount_--;
+    LastReleaseTimeUs_ = esp_timer_get_time();
+    xSemaphoreGive(Lock_);
+
+    acquired_ = false;
+    idleTimer_.restart(true);
+}
+
+void VoiceKeyerStorage::shutdown()
+{
+    release();
+    idleTimer_.stop();
+    UnmountIfIdle_(0);
+}
+
+void VoiceKeyerStorage::onIdleTimer_(DVTimer*)
+{
+    // Someone else may have used the partition since our last release, in
+    // which case their own timer takes care of it.
+    UnmountIfIdle_(VOICE_KEYER_IDLE_UNMOUNT_TIME_US);
+}
+
+void VoiceKeyerStorage::UnmountIfIdle_(uint64_t minIdleTimeUs)
+{
+    xSemaphoreTake(Lock_, portMAX_DELAY);
+    if (WlHandle_ != WL_INVALID_HANDLE && RefCount_ == 0 && 
+        (esp_timer_get_time() - LastReleaseTimeUs_) >= minIdleTimeUs)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Unmounting idle voice keyer partition");
+
+        auto err = esp_vfs_fat_spiflash_unmount_rw_wl(
+            VOICE_KEYER_MOUNT_POINT,
+            WlHandle_
+        );
+            
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not unmount voice keyer partition: %s", esp_err_to_name(err));
+        }
+        WlHandle_ = WL_INVALID_HANDLE;
+    }
+    xSemaphoreGive(Lock_);
+}
+
+}
+
+}
@@ -0,0 +1,76 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VOICE_KEYER_STORAGE_H
+#define VOICE_KEYER_STORAGE_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_vfs_fat.h"
+
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Mounts the voice keyer's FAT partition on first use and unmounts it
+///        again once nothing has used it for a while, which keeps FATFS and
+///        wear levelling off the boot path and frees their RAM most of the
+///        time. Each task that uses the partition has its own instance; the
+///        mount itself is shared between them.
+class VoiceKeyerStorage
+{
+public:
+    VoiceKeyerStorage(DVTask* owner);
+    virtual ~VoiceKeyerStorage();
+
+    /// @brief Mounts the partition if needed and keeps it mounted until release().
+    /// @return ESP_OK on success.
+    esp_err_t acquire();
+
+    /// @brief Lets the partition be unmounted once it's been idle for a while.
+    void release();
+
+    /// @brief Releases the partition and unmounts it right away if no one 
+    ///        else is using it. Called when the owner goes to sleep.
+    void shutdown();
+
+private:
+    static SemaphoreHandle_t Lock_;
+    static int RefCount_;
+    static wl_handle_t WlHandle_;
+    static uint64_t LastReleaseTimeUs_;
+
+    DVTimer idleTimer_;
+    bool acquired_;
+
+    void onIdleTimer_(DVTimer*);
+
+    static void UnmountIfIdle_(uint64_t minIdleTimeUs);
+};
+
+}
+
+}
+
+#endif // VOICE_KEYER_STORAGE_H
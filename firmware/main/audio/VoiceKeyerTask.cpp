@@ -20,7 +20,6 @@
 #include "VoiceKeyerTask.h"
 
 #define CURRENT_LOG_TAG "VoiceKeyerTask"
-#define VOICE_KEYER_FILE ("/vk/keyer.wav")
 
 // Number of audio samples to read from the WAV file.
 // This number was set to match the flash page size (4KB).
@@ -50,9 +49,9 @@ namespace ezdv
 namespace audio
 {
 
-VoiceKeyerTask::VoiceKeyerTask(AudioInput* micDeviceTask, AudioInput* fdvTask)
+VoiceKeyerTask::VoiceKeyerTask()
     : DVTask("VoiceKeyerTask", 15, 4096, tskNO_AFFINITY, 256, portMAX_DELAY)
-    , AudioInput(1, 1)
+    , AudioInput("VoiceKeyerTask", 2, { AUDIO_INPUT_UNUSED })
     , currentState_(VoiceKeyerTask::IDLE)
     , voiceKeyerTickTimer_(this, this, &VoiceKeyerTask::tickKeyer_, TIMER_TICK_INTERVAL, "VKSendTimer")
     , lastTimeInTick_(0)
@@ -62,51 +61,51 @@ VoiceKeyerTask::VoiceKeyerTask(AudioInput* micDeviceTask, AudioInput* fdvTask)
     , numSecondsToWait_(0)
     , timesToTransmit_(0)
     , timesTransmitted_(0)
-    , bytesToUpload_(0)
+    , currentSlot_(0)
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    , clipSamples_(nullptr)
+    , clipLength_(0)
+    , clipPosition_(0)
+#else
     , fileReadTimer_(this, this, &VoiceKeyerTask::readSamplesIntoFifo_, FILE_READ_INTERVAL, "VKFileReadTimer")
-    , micDeviceTask_(micDeviceTask)
-    , fdvTask_(fdvTask)
-    , wlHandle_(-1)
+    , storage_(this)
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 {
-    registerMessageHandler(this, &VoiceKeyerTask::onStartVoiceKeyerMessage_);
-    registerMessageHandler(this, &VoiceKeyerTask::onStopVoiceKeyerMessage_);
-    registerMessageHandler(this, &VoiceKeyerTask::onVoiceKeyerSettingsMessage_);
+    registerMessageHandlers<
+        &VoiceKeyerTask::onStartVoiceKeyerMessage_,
+        &VoiceKeyerTask::onStopVoiceKeyerMessage_,
+        &VoiceKeyerTask::onVoiceKeyerSettingsMessage_>(this);
 
-    registerMessageHandler(this, &VoiceKeyerTask::onFileUploadDataMessage_);
-    registerMessageHandler(this, &VoiceKeyerTask::onStartFileUploadMessage_);
+    registerMessageHandlers<&VoiceKeyerTask::onStartFileUploadMessage_>(this);
 
-    registerMessageHandler(this, &VoiceKeyerTask::onRequestRxMessage_);
+    registerMessageHandlers<&VoiceKeyerTask::onRequestRxMessage_>(this);
 
+    // Keep the keyer's audio cadence steady while other messages are queued.
+    voiceKeyerTickTimer_.enableDirectDispatch();
+
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
     fileReadFifo_ = codec2_fifo_create(MAX_SAMPLES_IN_FIFO);
     assert(fileReadFifo_ != nullptr);
 
     fileReadScratchBuf_ = (short*)heap_caps_calloc(SAMPLES_TO_READ_PER_CYCLE, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
     assert(fileReadScratchBuf_ != nullptr);
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 }
 
 VoiceKeyerTask::~VoiceKeyerTask()
 {
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
     heap_caps_free(fileReadScratchBuf_);
     codec2_fifo_destroy(fileReadFifo_);
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 }
 
 void VoiceKeyerTask::onTaskStart_()
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Starting VoiceKeyerTask");
-    esp_vfs_fat_mount_config_t mountConfig = {
-        .format_if_mount_failed = true,
-        .max_files = 5,
-        .allocation_unit_size = 0,
-        .disk_status_check_enable = false,
-    };
-
-    ESP_ERROR_CHECK(
-        esp_vfs_fat_spiflash_mount_rw_wl(
-            "/vk",
-            "vk",
-            &mountConfig,
-            &wlHandle_
-        ));
+
+    // Note: the voice keyer partition isn't mounted until it's first needed.
+    start(&uploadTask_, pdMS_TO_TICKS(1000));
 }
 
 void VoiceKeyerTask::onTaskSleep_()
@@ -117,21 +116,15 @@ void VoiceKeyerTask::onTaskSleep_()
         stopKeyer_();
     }
 
+    sleep(&uploadTask_, pdMS_TO_TICKS(1000));
+
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
     // Unmount FATFS after we're done with it
-    if (wlHandle_ != -1)
-    {
-        auto err = esp_vfs_fat_spiflash_unmount_rw_wl(
-            "/vk",
-            wlHandle_
-        );
-            
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(CURRENT_LOG_TAG, "Could not unmount voice keyer partition: %s", esp_err_to_name(err));
-        }
-    }
+    storage_.shutdown();
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 }
 
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 void VoiceKeyerTask::readSamplesIntoFifo_(DVTimer*)
 {
     if (wavReader_ == nullptr || codec2_fifo_free(fileReadFifo_) < SAMPLES_TO_READ_PER_CYCLE)
@@ -153,6 +146,7 @@ void VoiceKeyerTask::readSamplesIntoFifo_(DVTimer*)
 
     codec2_fifo_write(fileReadFifo_, fileReadScratchBuf_, numRead);
 }
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 
 void VoiceKeyerTask::onTaskTick_()
 {
@@ -169,8 +163,11 @@ void VoiceKeyerTask::tickKeyer_(DVTimer*)
             break;
         case VoiceKeyerTask::TX:
         {
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
             short samples[SAMPLES_TO_SEND_PER_CYCLE];
-            auto fifo = getAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL);
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+            OutputClaim output(this, ezdv::audio::AudioInput::LEFT_CHANNEL);
+            auto fifo = output.fifo();
             assert(fifo != nullptr);
 
             // If it takes longer than expected to get into this handler,
@@ -184,21 +181,37 @@ void VoiceKeyerTask::tickKeyer_(DVTimer*)
 
             for (int count = 0; count < numTimesToRead; count++)
             {
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+                auto numToRead = std::min(clipLength_ - clipPosition_, (uint32_t)SAMPLES_TO_SEND_PER_CYCLE);
+
+                if (fifo->numFree() < numToRead)
+                {
+                    break;
+                }
+
+                // Samples come straight from flash via the MMU cache.
+                sendSamples_(fifo, clipSamples_ + clipPosition_, numToRead);
+                clipPosition_ += numToRead;
+#else
                 auto numToRead = std::min(codec2_fifo_used(fileReadFifo_), SAMPLES_TO_SEND_PER_CYCLE);
 
-                if (codec2_fifo_free(fifo) < numToRead)
+                if (fifo->numFree() < numToRead)
                 {
                     break;
                 }
 
                 codec2_fifo_read(fileReadFifo_, samples, numToRead);
-                codec2_fifo_write(fifo, samples, numToRead);
+                sendSamples_(fifo, samples, numToRead);
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 
                 if (numToRead < SAMPLES_TO_SEND_PER_CYCLE)
                 {
                     currentState_ = VoiceKeyerTask::WAITING;
                     timeAtBeginningOfState_ = currentTime;
 
+                    VoiceKeyerTransmitStateMessage stateMessage(false, true);
+                    publish(&stateMessage);
+
                     // Request return to RX
                     RequestRxMessage message;
                     publish(&message);
@@ -238,12 +251,45 @@ void VoiceKeyerTask::tickKeyer_(DVTimer*)
     lastTimeInTick_ = currentTime;
 }
 
+void VoiceKeyerTask::sendSamples_(AudioRingBuffer* fifo, const short* samples, uint32_t numSamples)
+{
+    fifo->write(samples, numSamples);
+
+#if CONFIG_EZDV_VOICE_KEYER_MONITOR
+    // Best effort; the local speaker never holds up TX.
+    OutputClaim monitorOutput(this, MONITOR_CHANNEL);
+    auto monitorFifo = monitorOutput.fifo();
+    if (monitorFifo != nullptr && monitorFifo->numFree() >= numSamples)
+    {
+        monitorFifo->write(samples, numSamples);
+    }
+#endif // CONFIG_EZDV_VOICE_KEYER_MONITOR
+}
+
 void VoiceKeyerTask::startKeyer_()
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Starting voice keyer");
 
-    // Open keyer file
-    voiceKeyerFile_ = fopen(VOICE_KEYER_FILE, "rb");
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    // Map the clip, which may be in a different slot than last time.
+    if (clipSamples_ != nullptr)
+    {
+        clip_.close();
+    }
+    clipSamples_ = clip_.open(currentSlot_, &clipLength_);
+    clipPosition_ = 0;
+
+    if (clipSamples_ != nullptr)
+    {
+#else
+    // Open keyer file, mounting the partition first if needed. It stays
+    // mounted until the keyer stops.
+    char fileName[VoiceKeyerUploadTask::MAX_FILE_NAME_LENGTH];
+    VoiceKeyerUploadTask::GetSlotFileName(currentSlot_, fileName);
+    if (storage_.acquire() == ESP_OK)
+    {
+        voiceKeyerFile_ = fopen(fileName, "rb");
+    }
     if (voiceKeyerFile_ != nullptr)
     {
         wavReader_ = new WAVFileReader(voiceKeyerFile_);
@@ -260,16 +306,11 @@ void VoiceKeyerTask::startKeyer_()
         // Start file read timer to ensure that the input FIFO
         // remains full.
         fileReadTimer_.start();
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 
-        // Reroute input audio so it's coming from us.
-        // Only do this if we just started the keyer for the first time.
-        if (timesTransmitted_ == 0)
-        {
-            micDeviceTask_->setAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL, nullptr);
-            setAudioOutput(
-                ezdv::audio::AudioInput::LEFT_CHANNEL,
-                fdvTask_->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL));
-        }
+        // FreeDV switches over to our audio once it sees this.
+        VoiceKeyerTransmitStateMessage stateMessage(true);
+        publish(&stateMessage);
 
         // Request TX
         RequestTxMessage message;
@@ -281,21 +322,24 @@ void VoiceKeyerTask::startKeyer_()
     }
     else
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "No voice keyer file found, possibly not set up yet");
+        ESP_LOGW(CURRENT_LOG_TAG, "No voice keyer file found in slot %d, possibly not set up yet", currentSlot_ + 1);
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+        storage_.release();
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
     }
 }
 
 void VoiceKeyerTask::stopKeyer_()
 {
-    // Reroute input audio so it's coming from mic
-    micDeviceTask_->setAudioOutput(
-        ezdv::audio::AudioInput::LEFT_CHANNEL, 
-        fdvTask_->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL));
-
-    setAudioOutput(
-        ezdv::audio::AudioInput::LEFT_CHANNEL,
-        nullptr);
-
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    if (clipSamples_ != nullptr)
+    {
+        clip_.close();
+        clipSamples_ = nullptr;
+        clipLength_ = 0;
+        clipPosition_ = 0;
+    }
+#else
     if (wavReader_ != nullptr)
     {
         delete wavReader_;
@@ -305,6 +349,15 @@ void VoiceKeyerTask::stopKeyer_()
         voiceKeyerFile_ = nullptr;
     }
 
+    storage_.release();
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    if (currentState_ == VoiceKeyerTask::TX)
+    {
+        VoiceKeyerTransmitStateMessage stateMessage(false);
+        publish(&stateMessage);
+    }
+
     // Request RX
     RequestRxMessage message;
     publish(&message);
@@ -312,6 +365,7 @@ void VoiceKeyerTask::stopKeyer_()
     currentState_ = VoiceKeyerTask::IDLE;
     voiceKeyerTickTimer_.stop();
 
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
     // If there's anything still in the FIFO,
     // make sure it's gone.
     short tmp;
@@ -319,6 +373,7 @@ void VoiceKeyerTask::stopKeyer_()
     {
         // empty
     }
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 }
 
 void VoiceKeyerTask::onStartVoiceKeyerMessage_(DVTask* origin, StartVoiceKeyerMessage* message)
@@ -336,106 +391,19 @@ void VoiceKeyerTask::onVoiceKeyerSettingsMessage_(DVTask* origin, storage::Voice
 {
     numSecondsToWait_ = message->secondsToWait;
     timesToTransmit_ = message->timesToTransmit;
+
+    // Takes effect the next time the clip starts.
+    currentSlot_ = message->slot;
 }
 
 void VoiceKeyerTask::onStartFileUploadMessage_(DVTask* origin, network::StartFileUploadMessage* message)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Saving %d bytes to %s", message->length, VOICE_KEYER_FILE);
-    bytesToUpload_ = message->length;
-
-    if (voiceKeyerFile_ != nullptr)
+    // The file itself is saved by uploadTask_; we just need to make sure
+    // we're not playing anything while it's being replaced.
+    if (currentState_ != IDLE)
     {
         stopKeyer_();
     }
-
-    // Don't allow files larger than 512KB to avoid crashes.
-    if (bytesToUpload_ >= 512000)
-    {
-        FileUploadCompleteMessage response(false, FileUploadCompleteMessage::FILE_TOO_LARGE);
-        publish(&response);
-
-        bytesToUpload_ = 0;
-        return;
-    }
-
-    unlink(VOICE_KEYER_FILE);
-    voiceKeyerFile_ = fopen(VOICE_KEYER_FILE, "w+b");
-    if (voiceKeyerFile_ == nullptr)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "Cannot open voice keyer file (errno %d)", errno);
-        vTaskDelay(pdMS_TO_TICKS(100));
-
-        FileUploadCompleteMessage response(false, FileUploadCompleteMessage::SYSTEM_ERROR, errno);
-        publish(&response);
-
-        bytesToUpload_ = 0;
-    }
-}
-
-void VoiceKeyerTask::onFileUploadDataMessage_(DVTask* origin, network::FileUploadDataMessage* message)
-{
-    if (voiceKeyerFile_ != nullptr && currentState_ == VoiceKeyerTask::IDLE)
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "Saving %d bytes to %s", message->length, VOICE_KEYER_FILE);
-
-        auto numWritten = fwrite(message->buf, 1, message->length, voiceKeyerFile_);
-        heap_caps_free(message->buf);
-        bytesToUpload_ -= message->length;
-
-        if (numWritten <= 0)
-        {
-            FileUploadCompleteMessage response(false, FileUploadCompleteMessage::SYSTEM_ERROR, errno);
-            publish(&response);
-
-            bytesToUpload_ = 0;
-        }
-        else if (bytesToUpload_ <= 0)
-        {
-            // Make sure the user uploaded something using the 
-            // correct number of channels and sample rate.
-            fseek(voiceKeyerFile_, 0, SEEK_SET);
-
-            wavReader_ = new WAVFileReader(voiceKeyerFile_);
-            assert(wavReader_ != nullptr);
-
-            bool success = true;
-            if (wavReader_->num_channels() != 1)
-            {
-                FileUploadCompleteMessage response(false, FileUploadCompleteMessage::INCORRECT_NUM_CHANNELS);
-                publish(&response);
-                success = false;
-            }
-            else if (wavReader_->sample_rate() != 8000)
-            {
-                FileUploadCompleteMessage response(false, FileUploadCompleteMessage::INCORRECT_SAMPLE_RATE);
-                publish(&response);
-                success = false;
-            }
-            else
-            {
-                FileUploadCompleteMessage response(true);
-                publish(&response);
-            }
-
-            delete wavReader_;
-            wavReader_ = nullptr;
-
-            fclose(voiceKeyerFile_);
-            voiceKeyerFile_ = nullptr;
-
-            if (!success)
-            {
-                unlink(VOICE_KEYER_FILE);
-            }
-
-            bytesToUpload_ = 0;
-        }
-    }
-    else
-    {
-        heap_caps_free(message->buf);
-        bytesToUpload_ = 0;
-    }
 }
 
 void VoiceKeyerTask::onRequestRxMessage_(DVTask* origin, audio::RequestRxMessage* message)
@@ -18,12 +18,15 @@
 #ifndef VOICE_KEYER_TASK_H
 #define VOICE_KEYER_TASK_H
 
-#include "esp_vfs_fat.h"
+#include "sdkconfig.h"
 
 #include "codec2_fifo.h"
 
 #include "AudioInput.h"
+#include "VoiceKeyerClip.h"
 #include "VoiceKeyerMessage.h"
+#include "VoiceKeyerStorage.h"
+#include "VoiceKeyerUploadTask.h"
 #include "WAVFileReader.h"
 #include "audio/FreeDVMessage.h"
 #include "network/NetworkMessage.h"
@@ -39,15 +42,19 @@ namespace audio
 
 using namespace ezdv::task;
 
+/// @brief Plays back the voice keyer clip. LEFT_CHANNEL stays connected to 
+///        FreeDVTask::KEYER_CHANNEL, which FreeDV sends in place of the mic
+///        while the keyer is transmitting, so the mic route is never touched.
 class VoiceKeyerTask : public DVTask, public AudioInput
 {
 public:
-    VoiceKeyerTask(AudioInput* micDeviceTask, AudioInput* fdvTask);
-    virtual ~VoiceKeyerTask();
+#if CONFIG_EZDV_VOICE_KEYER_MONITOR
+    /// @brief Copy of the keyed audio for the local speaker (via AudioMixer).
+    static constexpr AudioInput::ChannelLabel MONITOR_CHANNEL = AudioInput::RIGHT_CHANNEL;
+#endif // CONFIG_EZDV_VOICE_KEYER_MONITOR
 
-    // Special setter for Flex radios as microphone goes through SmartSDR
-    // instead of TLV320.
-    void setMicDeviceTask(AudioInput* task) { micDeviceTask_ = task; }
+    VoiceKeyerTask();
+    virtual ~VoiceKeyerTask();
     
 protected:
     virtual void onTaskStart_() override;
@@ -66,37 +73,41 @@ private:
     int numSecondsToWait_;
     int timesToTransmit_;
     int timesTransmitted_;
-    int bytesToUpload_;
-
+    int currentSlot_;
+
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    // The clip is played straight out of memory-mapped flash.
+    VoiceKeyerClip clip_;
+    const short* clipSamples_;
+    uint32_t clipLength_;
+    uint32_t clipPosition_;
+#else
     FIFO* fileReadFifo_;
     short* fileReadScratchBuf_;
     DVTimer fileReadTimer_;
-
-    // These are so we can shut off mic audio from the codec
-    // chip during TX and restore audio routing once voice keying
-    // ends.
-    AudioInput* micDeviceTask_;
-    AudioInput* fdvTask_;
-
-    wl_handle_t wlHandle_;
+    VoiceKeyerStorage storage_;
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 
     void startKeyer_();
     void stopKeyer_();
     void tickKeyer_(DVTimer*);
+    void sendSamples_(AudioRingBuffer* fifo, const short* samples, uint32_t numSamples);
 
     void onStartVoiceKeyerMessage_(DVTask* origin, StartVoiceKeyerMessage* message);
     void onStopVoiceKeyerMessage_(DVTask* origin, StopVoiceKeyerMessage* message);
     void onVoiceKeyerSettingsMessage_(DVTask* origin, storage::VoiceKeyerSettingsMessage* message);
 
-    // Voice keyer file upload handlers
+    // Uploads happen in the background; the keyer only needs to stop.
+    VoiceKeyerUploadTask uploadTask_;
     void onStartFileUploadMessage_(DVTask* origin, network::StartFileUploadMessage* message);
-    void onFileUploadDataMessage_(DVTask* origin, network::FileUploadDataMessage* message);
 
     // Listen for RequestRxMessage so we can stop voice keyer if running.
     void onRequestRxMessage_(DVTask* origin, audio::RequestRxMessage* message);
 
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
     // Timer handler to read VK file into FIFO
     void readSamplesIntoFifo_(DVTimer*);
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
 };
 
 }
@@ -0,0 +1,410 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "VoiceKeyerUploadTask.h"
+#include "WAVFile.h"
+#include "network/UploadBufferPool.h"
+
+#define CURRENT_LOG_TAG "VoiceKeyerUpload"
+
+// Slot 0 keeps the original file name so existing recordings carry over.
+#define VOICE_KEYER_FILE ("/vk/keyer.wav")
+#define VOICE_KEYER_SLOT_FILE_FORMAT ("/vk/keyer%d.wav")
+#define VOICE_KEYER_UPLOAD_TEMP_FILE ("/vk/upload.tmp")
+
+// Don't store converted files larger than 512KB to avoid crashes.
+#define VOICE_KEYER_MAX_FILE_SIZE (512000)
+
+// Uploads are converted as they arrive, so the original file can be much
+// larger (e.g. 48 kHz stereo).
+#define VOICE_KEYER_MAX_UPLOAD_SIZE (16 * 1024 * 1024)
+
+// Data is written to flash one sector at a time.
+#define UPLOAD_WRITE_SIZE (4096)
+
+// Number of websocket chunks (4KB each from the web UI) that can be 
+// waiting to be written. The browser is granted this many up front and
+// one more as each is processed; the web server also waits if it gets 
+// ahead anyway.
+#define UPLOAD_MAX_CHUNKS_IN_FLIGHT (4)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+SemaphoreHandle_t VoiceKeyerUploadTask::ChunkSemaphore_ = nullptr;
+VoiceKeyerUploadTask* VoiceKeyerUploadTask::Instance_ = nullptr;
+
+VoiceKeyerUploadTask::VoiceKeyerUploadTask()
+    : DVTask("VoiceKeyerUpload", 2, 4096, tskNO_AFFINITY, 16)
+    , bytesToUpload_(0)
+    , uploadSlot_(0)
+    , isUploading_(false)
+    , samplesWritten_(0)
+    , importer_(&OnImportedSamples_, this)
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    , storage_(this)
+    , uploadFile_(nullptr)
+    , writeBufUsed_(0)
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+{
+    registerMessageHandlers<
+        &VoiceKeyerUploadTask::onStartFileUploadMessage_,
+        &VoiceKeyerUploadTask::onFileUploadDataMessage_>(this);
+
+    // A chunk that can't be queued still has to go back to the pool.
+    setMessageOverflowPolicy<network::FileUploadDataMessage>(OVERFLOW_BLOCK, &OnFileUploadDataDropped_);
+    network::UploadBufferPool::Initialize();
+
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    writeBuf_ = (uint8_t*)heap_caps_malloc(UPLOAD_WRITE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(writeBuf_ != nullptr);
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    assert(ChunkSemaphore_ == nullptr);
+    ChunkSemaphore_ = xSemaphoreCreateCounting(UPLOAD_MAX_CHUNKS_IN_FLIGHT, UPLOAD_MAX_CHUNKS_IN_FLIGHT);
+    assert(ChunkSemaphore_ != nullptr);
+
+    assert(Instance_ == nullptr);
+    Instance_ = this;
+}
+
+VoiceKeyerUploadTask::~VoiceKeyerUploadTask()
+{
+    vSemaphoreDelete(ChunkSemaphore_);
+    ChunkSemaphore_ = nullptr;
+    Instance_ = nullptr;
+
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    heap_caps_free(writeBuf_);
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+}
+
+bool VoiceKeyerUploadTask::WaitForSpace(TickType_t ticksToWait)
+{
+    if (ChunkSemaphore_ == nullptr)
+    {
+        return true;
+    }
+
+    return xSemaphoreTake(ChunkSemaphore_, ticksToWait) == pdTRUE;
+}
+
+VoiceKeyerUploadTask* VoiceKeyerUploadTask::GetInstance()
+{
+    return Instance_;
+}
+
+void VoiceKeyerUploadTask::OnFileUploadDataDropped_(DVTaskMessage* message)
+{
+    network::UploadBufferPool::Release(((network::FileUploadDataMessage*)message)->buf);
+    xSemaphoreGive(ChunkSemaphore_);
+}
+
+void VoiceKeyerUploadTask::GetSlotFileName(int slot, char* fileName)
+{
+    if (slot == 0)
+    {
+        strcpy(fileName, VOICE_KEYER_FILE);
+    }
+    else
+    {
+        snprintf(fileName, MAX_FILE_NAME_LENGTH, VOICE_KEYER_SLOT_FILE_FORMAT, slot);
+    }
+}
+
+void VoiceKeyerUploadTask::onTaskStart_()
+{
+    // empty
+}
+
+void VoiceKeyerUploadTask::onTaskSleep_()
+{
+    if (isUploading_)
+    {
+        failUpload_(FileUploadCompleteMessage::SYSTEM_ERROR);
+    }
+
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    storage_.shutdown();
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+}
+
+void VoiceKeyerUploadTask::onTaskTick_()
+{
+    // empty
+}
+
+void VoiceKeyerUploadTask::failUpload_(FileUploadCompleteMessage::ErrorType errorType, int errorNumber)
+{
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    if (uploadFile_ != nullptr)
+    {
+        fclose(uploadFile_);
+        uploadFile_ = nullptr;
+        unlink(VOICE_KEYER_UPLOAD_TEMP_FILE);
+    }
+
+    storage_.release();
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    FileUploadCompleteMessage response(false, errorType, errorNumber);
+    publish(&response);
+
+    isUploading_ = false;
+    bytesToUpload_ = 0;
+}
+
+void VoiceKeyerUploadTask::onStartFileUploadMessage_(DVTask* origin, network::StartFileUploadMessage* message)
+{
+    if (isUploading_)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Abandoning previous upload");
+        failUpload_(FileUploadCompleteMessage::SYSTEM_ERROR);
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Saving %d bytes to voice keyer slot %d", message->length, message->slot + 1);
+    bytesToUpload_ = message->length;
+    uploadSlot_ = message->slot;
+
+    if (uploadSlot_ < 0 || uploadSlot_ >= CONFIG_EZDV_VOICE_KEYER_NUM_SLOTS)
+    {
+        failUpload_(FileUploadCompleteMessage::SYSTEM_ERROR, EINVAL);
+        return;
+    }
+    else if (bytesToUpload_ >= VOICE_KEYER_MAX_UPLOAD_SIZE)
+    {
+        failUpload_(FileUploadCompleteMessage::FILE_TOO_LARGE);
+        return;
+    }
+
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    auto rv = clip_.beginUpload(uploadSlot_);
+    if (rv != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Cannot erase voice keyer partition: %s", esp_err_to_name(rv));
+        failUpload_(FileUploadCompleteMessage::SYSTEM_ERROR, rv);
+        return;
+    }
+#else
+    // Mounted on first use; see VoiceKeyerStorage.
+    auto rv = storage_.acquire();
+    if (rv != ESP_OK)
+    {
+        failUpload_(FileUploadCompleteMessage::SYSTEM_ERROR, rv);
+        return;
+    }
+
+    unlink(VOICE_KEYER_UPLOAD_TEMP_FILE);
+    uploadFile_ = fopen(VOICE_KEYER_UPLOAD_TEMP_FILE, "wb");
+    if (uploadFile_ == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Cannot open voice keyer file (errno %d)", errno);
+        failUpload_(FileUploadCompleteMessage::SYSTEM_ERROR, errno);
+        return;
+    }
+
+    // We only ever write whole sectors, so stdio buffering would just add 
+    // another copy.
+    setvbuf(uploadFile_, nullptr, _IONBF, 0);
+
+    // The header is filled in once we know how many samples there are.
+    wav_header_t header;
+    memcpy(writeBuf_, &header, sizeof(header));
+    writeBufUsed_ = sizeof(header);
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    importer_.begin();
+    samplesWritten_ = 0;
+    isUploading_ = true;
+
+    network::UploadCreditMessage credit(UPLOAD_MAX_CHUNKS_IN_FLIGHT);
+    publish(&credit);
+}
+
+void VoiceKeyerUploadTask::onFileUploadDataMessage_(DVTask* origin, network::FileUploadDataMessage* message)
+{
+    if (isUploading_)
+    {
+        bytesToUpload_ -= message->length;
+
+        auto errorType = importer_.process((const uint8_t*)message->buf, message->length);
+        if (errorType == FileUploadCompleteMessage::NONE && bytesToUpload_ <= 0)
+        {
+            errorType = finishUpload_();
+            if (errorType == FileUploadCompleteMessage::NONE)
+            {
+                FileUploadCompleteMessage response(true);
+                publish(&response);
+
+                isUploading_ = false;
+                bytesToUpload_ = 0;
+            }
+        }
+
+        if (errorType != FileUploadCompleteMessage::NONE)
+        {
+            failUpload_(errorType, (errorType == FileUploadCompleteMessage::SYSTEM_ERROR) ? errno : 0);
+        }
+    }
+
+    network::UploadBufferPool::Release(message->buf);
+
+    // Let the web server (and the browser) pass on the next chunk.
+    xSemaphoreGive(ChunkSemaphore_);
+
+    network::UploadCreditMessage credit(1);
+    publish(&credit);
+}
+
+FileUploadCompleteMessage::ErrorType VoiceKeyerUploadTask::writeSamples_(const short* samples, uint32_t numSamples)
+{
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    auto rv = clip_.uploadSamples(samples, numSamples);
+    if (rv == ESP_ERR_INVALID_SIZE)
+    {
+        return FileUploadCompleteMessage::FILE_TOO_LARGE;
+    }
+    else if (rv != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Cannot write voice keyer clip: %s", esp_err_to_name(rv));
+        return FileUploadCompleteMessage::SYSTEM_ERROR;
+    }
+#else
+    if (sizeof(wav_header_t) + (samplesWritten_ + numSamples) * sizeof(short) > VOICE_KEYER_MAX_FILE_SIZE)
+    {
+        return FileUploadCompleteMessage::FILE_TOO_LARGE;
+    }
+
+    const uint8_t* buf = (const uint8_t*)samples;
+    uint32_t length = numSamples * sizeof(short);
+    while (length > 0)
+    {
+        uint32_t amountToCopy = std::min(length, (uint32_t)UPLOAD_WRITE_SIZE - writeBufUsed_);
+        memcpy(writeBuf_ + writeBufUsed_, buf, amountToCopy);
+        writeBufUsed_ += amountToCopy;
+        buf += amountToCopy;
+        length -= amountToCopy;
+
+        if (writeBufUsed_ == UPLOAD_WRITE_SIZE && !flushWriteBuf_())
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Cannot write voice keyer file (errno %d)", errno);
+            return FileUploadCompleteMessage::SYSTEM_ERROR;
+        }
+    }
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    samplesWritten_ += numSamples;
+    return FileUploadCompleteMessage::NONE;
+}
+
+FileUploadCompleteMessage::ErrorType VoiceKeyerUploadTask::finishUpload_()
+{
+    // Whatever's still in the resampler goes out first.
+    auto errorType = importer_.finish();
+    if (errorType != FileUploadCompleteMessage::NONE)
+    {
+        return errorType;
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Converted upload to %" PRIu32 " samples", samplesWritten_);
+
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    auto rv = clip_.finishUpload(VoiceKeyerImporter::OUTPUT_SAMPLE_RATE);
+    if (rv != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Cannot save voice keyer clip: %s", esp_err_to_name(rv));
+        errorType = FileUploadCompleteMessage::SYSTEM_ERROR;
+    }
+#else
+    if (!flushWriteBuf_())
+    {
+        errorType = FileUploadCompleteMessage::SYSTEM_ERROR;
+    }
+    else
+    {
+        wav_header_t header;
+        header.sample_rate = VoiceKeyerImporter::OUTPUT_SAMPLE_RATE;
+        header.byte_rate = header.sample_rate * sizeof(short);
+        header.data_bytes = samplesWritten_ * sizeof(short);
+        header.wav_size = sizeof(header) - 8 + header.data_bytes;
+
+        if (fseek(uploadFile_, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, uploadFile_) != 1)
+        {
+            errorType = FileUploadCompleteMessage::SYSTEM_ERROR;
+        }
+    }
+
+    fclose(uploadFile_);
+    uploadFile_ = nullptr;
+
+    if (errorType == FileUploadCompleteMessage::NONE)
+    {
+        // Only now does the old clip go away.
+        char fileName[MAX_FILE_NAME_LENGTH];
+        GetSlotFileName(uploadSlot_, fileName);
+        unlink(fileName);
+        if (rename(VOICE_KEYER_UPLOAD_TEMP_FILE, fileName) != 0)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Cannot rename uploaded file to %s (errno %d)", fileName, errno);
+            errorType = FileUploadCompleteMessage::SYSTEM_ERROR;
+        }
+    }
+
+    if (errorType != FileUploadCompleteMessage::NONE)
+    {
+        unlink(VOICE_KEYER_UPLOAD_TEMP_FILE);
+    }
+
+    storage_.release();
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    return errorType;
+}
+
+FileUploadCompleteMessage::ErrorType VoiceKeyerUploadTask::OnImportedSamples_(void* arg, const short* samples, uint32_t numSamples)
+{
+    return ((VoiceKeyerUploadTask*)arg)->writeSamples_(samples, numSamples);
+}
+
+#if !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+bool VoiceKeyerUploadTask::flushWriteBuf_()
+{
+    if (writeBufUsed_ > 0 && fwrite(writeBuf_, 1, writeBufUsed_, uploadFile_) != writeBufUsed_)
+    {
+        return false;
+    }
+
+    writeBufUsed_ = 0;
+    return true;
+}
+#endif // !CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+}
+
+}
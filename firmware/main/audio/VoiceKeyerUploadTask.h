@@ -0,0 +1,118 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VOICE_KEYER_UPLOAD_TASK_H
+#define VOICE_KEYER_UPLOAD_TASK_H
+
+#include <cstdio>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "VoiceKeyerImporter.h"
+#include "VoiceKeyerMessage.h"
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+#include "VoiceKeyerClip.h"
+#else
+#include "VoiceKeyerStorage.h"
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+#include "network/NetworkMessage.h"
+#include "task/DVTask.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Saves voice keyer files uploaded through the web interface. Files
+///        are converted to 8 kHz mono as they arrive (see VoiceKeyerImporter).
+///        Runs at low priority and writes whole flash sectors at a time so that
+///        uploads don't disturb real-time audio. The number of chunks waiting
+///        to be written is limited: the browser only sends chunks it has 
+///        been given credit for (see UploadCreditMessage), and the web server
+///        waits if it gets ahead anyway.
+class VoiceKeyerUploadTask : public DVTask
+{
+public:
+    static constexpr int MAX_FILE_NAME_LENGTH = 32;
+
+    VoiceKeyerUploadTask();
+    virtual ~VoiceKeyerUploadTask();
+
+    /// @brief Waits until another chunk of upload data can be accepted. 
+    ///        Called by the web server before passing each chunk on.
+    /// @param ticksToWait The maximum amount of time to wait.
+    /// @return false if the upload didn't catch up in time.
+    static bool WaitForSpace(TickType_t ticksToWait);
+
+    /// @brief Returns the task that upload chunks should be sent to, if it exists.
+    static VoiceKeyerUploadTask* GetInstance();
+
+    /// @brief Gets the name of the file that stores the given slot's clip.
+    static void GetSlotFileName(int slot, char* fileName);
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+    virtual void onTaskTick_() override;
+
+private:
+    static SemaphoreHandle_t ChunkSemaphore_;
+    static VoiceKeyerUploadTask* Instance_;
+
+    int bytesToUpload_;
+    int uploadSlot_;
+    bool isUploading_;
+    uint32_t samplesWritten_;
+    VoiceKeyerImporter importer_;
+
+#if CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+    VoiceKeyerClip clip_;
+#else
+    // The file is written to a temporary name and only replaces the 
+    // slot's clip once it's been validated.
+    VoiceKeyerStorage storage_;
+    FILE* uploadFile_;
+    uint8_t* writeBuf_;
+    uint32_t writeBufUsed_;
+
+    bool flushWriteBuf_();
+#endif // CONFIG_EZDV_VOICE_KEYER_RAW_PARTITION
+
+    FileUploadCompleteMessage::ErrorType writeSamples_(const short* samples, uint32_t numSamples);
+    FileUploadCompleteMessage::ErrorType finishUpload_();
+
+    void failUpload_(FileUploadCompleteMessage::ErrorType errorType, int errorNumber = 0);
+
+    void onStartFileUploadMessage_(DVTask* origin, network::StartFileUploadMessage* message);
+    void onFileUploadDataMessage_(DVTask* origin, network::FileUploadDataMessage* message);
+
+    static void OnFileUploadDataDropped_(DVTaskMessage* message);
+
+    static FileUploadCompleteMessage::ErrorType OnImportedSamples_(void* arg, const short* samples, uint32_t numSamples);
+};
+
+}
+
+}
+
+#endif // VOICE_KEYER_UPLOAD_TASK_H
@@ -4,6 +4,10 @@
  * for original source.
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
 #include "esp_log.h"
 #include "WAVFileReader.h"
 
@@ -18,8 +22,15 @@ static const char *TAG = "WAV";
 WAVFileReader::WAVFileReader(FILE *fp)
 {
     m_fp = fp;
-    // read the WAV header
-    fread((void *)&m_wav_header, sizeof(wav_header_t), 1, m_fp);
+    m_data_remaining = 0;
+    // read the WAV header, which isn't necessarily the canonical 44 bytes
+    if (!find_chunks())
+    {
+        ESP_LOGE(TAG, "ERROR: no fmt and data chunks found\n");
+        m_wav_header.num_channels = 0;
+        m_wav_header.sample_rate = 0;
+        m_data_remaining = 0;
+    }
     // sanity check the bit depth
     if (m_wav_header.bit_depth != 16)
     {
@@ -33,9 +44,57 @@ WAVFileReader::WAVFileReader(FILE *fp)
              m_wav_header.fmt_chunk_size, m_wav_header.audio_format, m_wav_header.num_channels, m_wav_header.sample_rate, m_wav_header.sample_alignment, m_wav_header.bit_depth, m_wav_header.data_bytes);
 }
 
+bool WAVFileReader::find_chunks()
+{
+    // RIFF header, then a list of chunks in any order. Only "fmt " and
+    // "data" matter; everything else (LIST, fact, etc.) is skipped.
+    if (fread(m_wav_header.riff_header, 1, 12, m_fp) != 12 ||
+        memcmp(m_wav_header.riff_header, "RIFF", 4) != 0 ||
+        memcmp(m_wav_header.wave_header, "WAVE", 4) != 0)
+    {
+        return false;
+    }
+
+    bool found_fmt = false;
+    char chunk_id[4];
+    uint32_t chunk_size;
+    while (fread(chunk_id, 1, 4, m_fp) == 4 && fread(&chunk_size, 4, 1, m_fp) == 1)
+    {
+        // chunks are padded to an even number of bytes
+        long skip = chunk_size + (chunk_size & 1);
+        if (memcmp(chunk_id, "fmt ", 4) == 0 && chunk_size >= 16)
+        {
+            m_wav_header.fmt_chunk_size = chunk_size;
+            if (fread(&m_wav_header.audio_format, 16, 1, m_fp) != 1)
+            {
+                return false;
+            }
+            found_fmt = true;
+            skip -= 16;
+        }
+        else if (memcmp(chunk_id, "data", 4) == 0)
+        {
+            // some writers leave the size at 0 or -1 when streaming
+            m_wav_header.data_bytes = chunk_size;
+            m_data_remaining = (chunk_size == 0 || chunk_size > INT32_MAX) ? INT32_MAX : chunk_size;
+            return found_fmt;
+        }
+
+        if (skip > 0 && fseek(m_fp, skip, SEEK_CUR) != 0)
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
 int WAVFileReader::read(int16_t *samples, int count)
 {
+    // don't play back any chunks that come after the data
+    count = std::min(count, m_data_remaining / (int)sizeof(int16_t));
     size_t read = fread(samples, sizeof(int16_t), count, m_fp);
+    m_data_remaining -= read * sizeof(int16_t);
     return read;
 }
 
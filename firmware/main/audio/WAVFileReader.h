@@ -22,6 +22,9 @@ private:
     wav_header_t m_wav_header;
 
     FILE *m_fp;
+    int m_data_remaining; // bytes of sample data left to read
+
+    bool find_chunks();
 
 public:
     WAVFileReader(FILE *fp);
@@ -15,34 +15,56 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "sdkconfig.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
 
 #include "ButtonArray.h"
-#include "InputGPIO.h"
+#include "audio/PttFastPath.h"
 
 // One second for long press
 #define LONG_PRESS_INTERVAL_US (1000000)
 
+// How long a button's level needs to settle after an edge before it's 
+// sampled. Further edges on that button are ignored until then.
+#define DEBOUNCE_INTERVAL_US (20000)
+
 namespace ezdv
 {
 
 namespace driver
 {
 
-using namespace std::placeholders;
-
 ButtonArray::ButtonArray()
     : DVTask("ButtonArray", 10, 3072, tskNO_AFFINITY, 10)
-    , pttButtonTimer_(this, std::bind(&ButtonArray::handleLongPressButton_, this, ButtonLabel::PTT), LONG_PRESS_INTERVAL_US, "PttButtonTimer")
-    , modeButtonTimer_(this, std::bind(&ButtonArray::handleLongPressButton_, this, ButtonLabel::MODE), LONG_PRESS_INTERVAL_US, "ModeButtonTimer")
-    , volUpButtonTimer_(this, std::bind(&ButtonArray::handleLongPressButton_, this, ButtonLabel::VOL_UP), LONG_PRESS_INTERVAL_US, "VolUpTimer")
-    , volDownButtonTimer_(this, std::bind(&ButtonArray::handleLongPressButton_, this, ButtonLabel::VOL_DOWN), LONG_PRESS_INTERVAL_US, "VolDownTimer")
-    , pttButton_(this, std::bind(&ButtonArray::handleButton_, this, ButtonLabel::PTT, _2))
-    , modeButton_(this, std::bind(&ButtonArray::handleButton_, this, ButtonLabel::MODE, _2))
-    , volUpButton_(this, std::bind(&ButtonArray::handleButton_, this, ButtonLabel::VOL_UP, _2))
-    , volDownButton_(this, std::bind(&ButtonArray::handleButton_, this, ButtonLabel::VOL_DOWN, _2))
+    , scanTimer_(this, this, &ButtonArray::onScanTimer_, DEBOUNCE_INTERVAL_US, "ButtonScanTimer")
+    , scanPending_(false)
+    , enabled_(false)
 {
-    // empty
+    const gpio_num_t gpios[] = { GPIO_PTT_BUTTON, GPIO_MODE_BUTTON, GPIO_VOL_UP_BUTTON, GPIO_VOL_DOWN_BUTTON };
+    const ButtonLabel labels[] = { ButtonLabel::PTT, ButtonLabel::MODE, ButtonLabel::VOL_UP, ButtonLabel::VOL_DOWN };
+
+    for (int index = 0; index < NUM_BUTTONS; index++)
+    {
+        auto button = &buttons_[index];
+        button->owner = this;
+        button->gpio = gpios[index];
+        button->label = labels[index];
+        button->glitchFilterHandle = nullptr;
+        button->edgePending = false;
+        button->pressed = false;
+        button->longPressSent = false;
+        button->pressTimeUs = 0;
+    }
+
+    scanTimer_.useTimerWheel();
+
+    registerMessageHandlers<&ButtonArray::onButtonScanMessage_>(this);
 }
 
 ButtonArray::~ButtonArray()
@@ -52,25 +74,60 @@ ButtonArray::~ButtonArray()
 
 void ButtonArray::onTaskStart_()
 {
-    pttButton_.start();
-    pttButton_.enableInterrupt(true);
-    
-    modeButton_.start();
-    modeButton_.enableInterrupt(true);
-    
-    volUpButton_.start();
-    volUpButton_.enableInterrupt(true);
-    
-    volDownButton_.start();
-    volDownButton_.enableInterrupt(true);
+    for (auto& button : buttons_)
+    {
+        ESP_ERROR_CHECK(gpio_reset_pin(button.gpio));
+        ESP_ERROR_CHECK(gpio_set_direction(button.gpio, GPIO_MODE_INPUT));
+        ESP_ERROR_CHECK(gpio_set_pull_mode(button.gpio, GPIO_PULLUP_ONLY));
+        ESP_ERROR_CHECK(gpio_pulldown_dis(button.gpio));
+        ESP_ERROR_CHECK(gpio_pullup_en(button.gpio));
+
+        if (button.glitchFilterHandle == nullptr)
+        {
+            gpio_pin_glitch_filter_config_t glitchConfig = {
+                .clk_src = GLITCH_FILTER_CLK_SRC_DEFAULT,
+                .gpio_num = button.gpio
+            };
+            ESP_ERROR_CHECK(gpio_new_pin_glitch_filter(&glitchConfig, &button.glitchFilterHandle));
+        }
+        ESP_ERROR_CHECK(gpio_glitch_filter_enable(button.glitchFilterHandle));
+
+        // Buttons are active low.
+        button.pressed = gpio_get_level(button.gpio) == 0;
+        button.longPressSent = button.pressed;
+        button.edgePending = false;
+
+#if CONFIG_EZDV_PM_LIGHT_SLEEP
+        // Light sleep wakeup needs level interrupts; see updateWakeup_().
+        updateWakeup_(&button);
+#else
+        ESP_ERROR_CHECK(gpio_set_intr_type(button.gpio, GPIO_INTR_ANYEDGE));
+#endif // CONFIG_EZDV_PM_LIGHT_SLEEP
+        ESP_ERROR_CHECK(gpio_isr_handler_add(button.gpio, &OnGPIOInterrupt_, &button));
+        ESP_ERROR_CHECK(gpio_intr_enable(button.gpio));
+    }
+
+#if CONFIG_EZDV_PM_LIGHT_SLEEP
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+#endif // CONFIG_EZDV_PM_LIGHT_SLEEP
+
+    enabled_ = true;
 }
 
 void ButtonArray::onTaskSleep_()
 {
-    pttButton_.enableInterrupt(false);
-    modeButton_.enableInterrupt(false);
-    volUpButton_.enableInterrupt(false);
-    volDownButton_.enableInterrupt(false);
+    enabled_ = false;
+    scanTimer_.stop();
+
+    for (auto& button : buttons_)
+    {
+        ESP_ERROR_CHECK(gpio_intr_disable(button.gpio));
+        ESP_ERROR_CHECK(gpio_isr_handler_remove(button.gpio));
+        ESP_ERROR_CHECK(gpio_glitch_filter_disable(button.glitchFilterHandle));
+#if CONFIG_EZDV_PM_LIGHT_SLEEP
+        ESP_ERROR_CHECK(gpio_wakeup_disable(button.gpio));
+#endif // CONFIG_EZDV_PM_LIGHT_SLEEP
+    }
 }
 
 static const char* ButtonLabelStrings_[] = {
@@ -81,51 +138,105 @@ static const char* ButtonLabelStrings_[] = {
     "VolDown"
 };
 
-void ButtonArray::handleButton_(ButtonLabel label, bool val)
+void ButtonArray::onButtonScanMessage_(DVTask* origin, ButtonScanMessage* message)
 {
-    DVTimer* timerToSet = nullptr;
-    bool buttonPressed = !val;
+    scanPending_ = false;
+
+    if (enabled_)
+    {
+        // Give the button(s) that just changed time to settle. This may pull
+        // in a scan that was scheduled later for long press detection; that
+        // scan works out the next deadline again.
+        scanTimer_.changeInterval(DEBOUNCE_INTERVAL_US);
+        scanTimer_.restart(true);
+    }
+}
 
-    switch(label)
+void ButtonArray::onScanTimer_(DVTimer*)
+{
+    if (!enabled_)
     {
-        case ButtonLabel::PTT:
-            timerToSet = &pttButtonTimer_;
-            break;
-        case ButtonLabel::MODE:
-            timerToSet = &modeButtonTimer_;
-            break;
-        case ButtonLabel::VOL_UP:
-            timerToSet = &volUpButtonTimer_;
-            break;
-        case ButtonLabel::VOL_DOWN:
-            timerToSet = &volDownButtonTimer_;
-            break;
-        default:
-            assert(0);
+        return;
     }
 
-    ESP_LOGI("ButtonArray", "Button %s now %d", ButtonLabelStrings_[label], (int)buttonPressed);
+    auto now = esp_timer_get_time();
+    int64_t nextDeadlineUs = INT64_MAX;
 
-    // Start long press timer
-    if (buttonPressed)
+    for (auto& button : buttons_)
     {
-        ButtonShortPressedMessage* message = new ButtonShortPressedMessage(label);
-        publish(message);
-        delete message;
+        if (button.edgePending.exchange(false))
+        {
+            bool pressed = gpio_get_level(button.gpio) == 0;
+            bool changed = pressed != button.pressed;
+
+            if (changed)
+            {
+                button.pressed = pressed;
+                button.longPressSent = false;
+                button.pressTimeUs = now;
+                updateWakeup_(&button);
+            }
+
+            // Re-arm for the next edge now that the level has settled.
+            ESP_ERROR_CHECK(gpio_intr_enable(button.gpio));
 
-        if (timerToSet != nullptr)
+            if (changed)
+            {
+                handleButton_(button.label, pressed);
+            }
+        }
+
+        if (button.pressed && !button.longPressSent)
         {
-            timerToSet->stop();
-            timerToSet->start(true);
+            auto heldUs = now - button.pressTimeUs;
+            if (heldUs >= LONG_PRESS_INTERVAL_US)
+            {
+                button.longPressSent = true;
+                handleLongPressButton_(button.label);
+            }
+            else
+            {
+                nextDeadlineUs = std::min(nextDeadlineUs, LONG_PRESS_INTERVAL_US - heldUs);
+            }
         }
     }
-    else
+
+    // Only keep scanning while a long press may still be pending. Edges 
+    // restart the timer from onButtonScanMessage_().
+    if (nextDeadlineUs != INT64_MAX)
+    {
+        scanTimer_.changeInterval(nextDeadlineUs);
+        scanTimer_.restart(true);
+    }
+}
+
+void ButtonArray::handleButton_(ButtonLabel label, bool pressed)
+{
+#if CONFIG_EZDV_PTT_FAST_PATH
+    if (label == ButtonLabel::PTT)
     {
-        if (timerToSet != nullptr)
+        // Get FreeDV started before the press makes its way to UserInterfaceTask.
+        if (pressed)
+        {
+            audio::PttFastPath::KeyDown();
+        }
+        else
         {
-            timerToSet->stop();
+            audio::PttFastPath::KeyUp();
         }
-        
+    }
+#endif // CONFIG_EZDV_PTT_FAST_PATH
+
+    ESP_LOGI("ButtonArray", "Button %s now %d", ButtonLabelStrings_[label], (int)pressed);
+
+    if (pressed)
+    {
+        ButtonShortPressedMessage* message = new ButtonShortPressedMessage(label);
+        publish(message);
+        delete message;
+    }
+    else
+    {
         ButtonReleasedMessage* message = new ButtonReleasedMessage(label);
         publish(message);
         delete message;
@@ -141,6 +252,32 @@ void ButtonArray::handleLongPressButton_(ButtonLabel label)
     delete message;
 }
 
+void ButtonArray::updateWakeup_(ButtonState* button)
+{
+#if CONFIG_EZDV_PM_LIGHT_SLEEP
+    // GPIO wakeup is level triggered (and sets the pin's interrupt type to 
+    // match), so wait for whichever level would be the next edge. Otherwise
+    // a held button would keep waking us up.
+    ESP_ERROR_CHECK(gpio_wakeup_enable(button->gpio, button->pressed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL));
+#endif // CONFIG_EZDV_PM_LIGHT_SLEEP
+}
+
+void ButtonArray::OnGPIOInterrupt_(void* ptr)
+{
+    ButtonState* button = (ButtonState*)ptr;
+
+    // Ignore the bouncing that follows until the scan timer samples it.
+    gpio_intr_disable(button->gpio);
+    button->edgePending = true;
+
+    // One message covers any number of edges until it's handled.
+    if (!button->owner->scanPending_.exchange(true))
+    {
+        ButtonScanMessage message;
+        button->owner->postISR(&message);
+    }
+}
+
 }
 
-}
\ No newline at end of file
+}
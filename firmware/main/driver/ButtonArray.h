@@ -18,9 +18,13 @@
 #ifndef BUTTON_ARRAY_H
 #define BUTTON_ARRAY_H
 
+#include <atomic>
+
+#include "driver/gpio.h"
+#include "driver/gpio_filter.h"
+
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
-#include "InputGPIO.h"
 #include "ButtonMessage.h"
 
 #define GPIO_PTT_BUTTON GPIO_NUM_4
@@ -36,6 +40,9 @@ namespace driver
 
 using namespace ezdv::task;
 
+/// @brief Scans the front panel buttons. All buttons share one ISR and one
+///        timer (used for both debouncing and long press detection); only 
+///        short press, long press and release events leave this task.
 class ButtonArray : public DVTask
 {
 public:
@@ -47,18 +54,43 @@ protected:
     virtual void onTaskSleep_() override;
 
 private:
-    DVTimer pttButtonTimer_;
-    DVTimer modeButtonTimer_;
-    DVTimer volUpButtonTimer_;
-    DVTimer volDownButtonTimer_;
+    enum { NUM_BUTTONS = 4 };
+    enum ButtonArrayMessageTypes { BUTTON_SCAN = 100 };
+
+    class ButtonScanMessage : public DVTaskMessageBase<BUTTON_SCAN, ButtonScanMessage>
+    {
+    public:
+        ButtonScanMessage()
+            : DVTaskMessageBase<BUTTON_SCAN, ButtonScanMessage>(BUTTON_MESSAGE)
+            {}
+        virtual ~ButtonScanMessage() = default;
+    };
 
-    InputGPIO<GPIO_PTT_BUTTON> pttButton_;
-    InputGPIO<GPIO_MODE_BUTTON> modeButton_;
-    InputGPIO<GPIO_VOL_UP_BUTTON> volUpButton_;
-    InputGPIO<GPIO_VOL_DOWN_BUTTON> volDownButton_;
+    struct ButtonState
+    {
+        ButtonArray* owner;
+        gpio_num_t gpio;
+        ButtonLabel label;
+        gpio_glitch_filter_handle_t glitchFilterHandle;
+        std::atomic<bool> edgePending; // set from ISR, interrupt disabled until scanned
+        bool pressed;
+        bool longPressSent;
+        int64_t pressTimeUs;
+    };
 
-    void handleButton_(ButtonLabel label, bool val);
+    ButtonState buttons_[NUM_BUTTONS];
+    DVTimer scanTimer_;
+    std::atomic<bool> scanPending_;
+    bool enabled_;
+
+    void onButtonScanMessage_(DVTask* origin, ButtonScanMessage* message);
+    void onScanTimer_(DVTimer*);
+
+    void handleButton_(ButtonLabel label, bool pressed);
     void handleLongPressButton_(ButtonLabel label);
+    void updateWakeup_(ButtonState* button);
+
+    static void OnGPIOInterrupt_(void* ptr);
 };
 
 }
@@ -22,6 +22,14 @@
 #define I2C_SDA_GPIO GPIO_NUM_47
 #define I2C_SCL_GPIO GPIO_NUM_48
 #define I2C_SCK_FREQ_HZ (400000)
+#define I2C_TIMEOUT_MS (1000)
+
+// Worker task parameters. The worker only waits on the bus, so it's 
+// kept below the audio tasks.
+#define I2C_WORKER_TASK_NAME ("I2CMaster")
+#define I2C_WORKER_TASK_PRIORITY (12)
+#define I2C_WORKER_STACK_SIZE (3072)
+#define I2C_TRANSACTION_QUEUE_SIZE (16)
 
 namespace ezdv
 {
@@ -42,13 +50,102 @@ I2CMaster::I2CMaster()
     masterConfig.flags.enable_internal_pullup = true;
 
     ESP_ERROR_CHECK(i2c_new_master_bus(&masterConfig, &masterHandle_));
+
+    transactionQueue_ = xQueueCreate(I2C_TRANSACTION_QUEUE_SIZE, sizeof(Transaction*));
+    assert(transactionQueue_ != nullptr);
+
+    workerStopped_ = xSemaphoreCreateBinary();
+    assert(workerStopped_ != nullptr);
+
+    auto returnValue = 
+        xTaskCreate(&WorkerEntry_, I2C_WORKER_TASK_NAME, I2C_WORKER_STACK_SIZE, this, I2C_WORKER_TASK_PRIORITY, &workerTask_);
+    assert(returnValue == pdPASS);
 }
 
 I2CMaster::~I2CMaster()
 {
+    // A null transaction tells the worker to exit once everything
+    // before it is done.
+    Transaction* stop = nullptr;
+    xQueueSendToBack(transactionQueue_, &stop, portMAX_DELAY);
+    xSemaphoreTake(workerStopped_, portMAX_DELAY);
+
+    vSemaphoreDelete(workerStopped_);
+    vQueueDelete(transactionQueue_);
+
     ESP_ERROR_CHECK(i2c_del_master_bus(masterHandle_));
 }
 
+void I2CMaster::submit_(Transaction* transaction)
+{
+    // Blocks if the queue is full; callers are never on the audio path.
+    auto rv = xQueueSendToBack(transactionQueue_, &transaction, portMAX_DELAY);
+    assert(rv == pdTRUE);
+}
+
+bool I2CMaster::execute_(Transaction* transaction)
+{
+    i2c_master_dev_handle_t devHandle = transaction->device->devHandle_;
+    switch (transaction->type)
+    {
+        case TRANSACTION_WRITE:
+            return i2c_master_transmit(devHandle, transaction->data, transaction->size + 1, I2C_TIMEOUT_MS) == ESP_OK;
+        case TRANSACTION_READ:
+            return i2c_master_transmit_receive(devHandle, &transaction->data[0], 1, &transaction->data[1], transaction->size, I2C_TIMEOUT_MS) == ESP_OK;
+        case TRANSACTION_WRITE_BATCH:
+            // data holds register/value pairs.
+            for (uint8_t index = 0; index < transaction->size; index++)
+            {
+                if (i2c_master_transmit(devHandle, &transaction->data[2 * index], 2, I2C_TIMEOUT_MS) != ESP_OK)
+                {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            assert(0);
+            return false;
+    }
+}
+
+void I2CMaster::workerLoop_()
+{
+    for (;;)
+    {
+        Transaction* transaction = nullptr;
+        xQueueReceive(transactionQueue_, &transaction, portMAX_DELAY);
+        if (transaction == nullptr)
+        {
+            break;
+        }
+
+        bool result = execute_(transaction);
+        if (transaction->onComplete)
+        {
+            if (transaction->type == TRANSACTION_READ)
+            {
+                transaction->onComplete(result, &transaction->data[1], transaction->size);
+            }
+            else
+            {
+                transaction->onComplete(result, nullptr, 0);
+            }
+        }
+
+        delete[] transaction->data;
+        delete transaction;
+    }
+}
+
+void I2CMaster::WorkerEntry_(void* arg)
+{
+    I2CMaster* thisObj = (I2CMaster*)arg;
+    thisObj->workerLoop_();
+
+    xSemaphoreGive(thisObj->workerStopped_);
+    vTaskDelete(nullptr);
+}
+
 I2CMaster::I2CDevice* I2CMaster::getDevice(uint8_t i2cAddress)
 {
     return new I2CDevice(this, i2cAddress);
@@ -65,31 +162,106 @@ I2CMaster::I2CDevice::I2CDevice(I2CMaster* master, uint8_t i2cAddress)
     devCfg.scl_speed_hz = I2C_SCK_FREQ_HZ;
 
     ESP_ERROR_CHECK(i2c_master_bus_add_device(master_->masterHandle_, &devCfg, &devHandle_));
+
+    syncDone_ = xSemaphoreCreateBinary();
+    assert(syncDone_ != nullptr);
 }
 
 I2CMaster::I2CDevice::~I2CDevice()
 {
+    // Wait for anything still queued for us so the worker doesn't use
+    // the device after it's gone.
+    writeRegistersAsync(nullptr, 0, [&](bool, const uint8_t*, uint8_t) {
+        xSemaphoreGive(syncDone_);
+    });
+    xSemaphoreTake(syncDone_, portMAX_DELAY);
+
+    vSemaphoreDelete(syncDone_);
     ESP_ERROR_CHECK(i2c_master_bus_rm_device(devHandle_));
 }
 
 bool I2CMaster::I2CDevice::writeBytes(uint8_t registerAddress, uint8_t* val, uint8_t size)
 {
-    uint8_t* tmp = new uint8_t[size + 1];
-    assert(tmp != nullptr);
-    
-    tmp[0] = registerAddress;
-    memcpy(&tmp[1], val, size);
-    
-    bool result = i2c_master_transmit(devHandle_, tmp, size + 1, 1000) == ESP_OK;
-    delete[] tmp;
+    bool result = false;
+    writeBytesAsync(registerAddress, val, size, [&](bool success, const uint8_t*, uint8_t) {
+        result = success;
+        xSemaphoreGive(syncDone_);
+    });
+    xSemaphoreTake(syncDone_, portMAX_DELAY);
     
     return result;
 }
 
 bool I2CMaster::I2CDevice::readBytes(uint8_t registerAddress, uint8_t* buffer, uint8_t size)
 {
-    uint8_t regBuf[] = { registerAddress };
-    return i2c_master_transmit_receive(devHandle_, regBuf, 1, buffer, size, 1000) == ESP_OK;
+    bool result = false;
+    readBytesAsync(registerAddress, size, [&](bool success, const uint8_t* data, uint8_t dataSize) {
+        result = success;
+        if (success)
+        {
+            memcpy(buffer, data, dataSize);
+        }
+        xSemaphoreGive(syncDone_);
+    });
+    xSemaphoreTake(syncDone_, portMAX_DELAY);
+
+    return result;
+}
+
+void I2CMaster::I2CDevice::writeBytesAsync(uint8_t registerAddress, const uint8_t* val, uint8_t size, CompletionFn onComplete)
+{
+    Transaction* transaction = new Transaction();
+    assert(transaction != nullptr);
+
+    transaction->device = this;
+    transaction->type = TRANSACTION_WRITE;
+    transaction->data = new uint8_t[size + 1];
+    assert(transaction->data != nullptr);
+    transaction->size = size;
+    transaction->onComplete = onComplete;
+
+    transaction->data[0] = registerAddress;
+    memcpy(&transaction->data[1], val, size);
+
+    master_->submit_(transaction);
+}
+
+void I2CMaster::I2CDevice::readBytesAsync(uint8_t registerAddress, uint8_t size, CompletionFn onComplete)
+{
+    Transaction* transaction = new Transaction();
+    assert(transaction != nullptr);
+
+    transaction->device = this;
+    transaction->type = TRANSACTION_READ;
+    transaction->data = new uint8_t[size + 1];
+    assert(transaction->data != nullptr);
+    transaction->size = size;
+    transaction->onComplete = onComplete;
+
+    transaction->data[0] = registerAddress;
+
+    master_->submit_(transaction);
+}
+
+void I2CMaster::I2CDevice::writeRegistersAsync(const RegisterWrite* writes, uint8_t count, CompletionFn onComplete)
+{
+    Transaction* transaction = new Transaction();
+    assert(transaction != nullptr);
+
+    transaction->device = this;
+    transaction->type = TRANSACTION_WRITE_BATCH;
+    transaction->data = new uint8_t[2 * count + 1];
+    assert(transaction->data != nullptr);
+    transaction->size = count;
+    transaction->onComplete = onComplete;
+
+    for (uint8_t index = 0; index < count; index++)
+    {
+        transaction->data[2 * index] = writes[index].registerAddress;
+        transaction->data[2 * index + 1] = writes[index].value;
+    }
+
+    master_->submit_(transaction);
 }
 
 } // namespace driver
@@ -19,8 +19,14 @@
 #define I2C_DEVICE_H
 
 #include <inttypes.h>
+#include <functional>
 #include "driver/i2c_master.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
 namespace ezdv
 {
 
@@ -31,7 +37,24 @@ namespace driver
 class I2CMaster
 {
 public:
+    /// @brief Called from the I2C worker once an asynchronous transaction finishes.
+    /// @param success Whether the transaction succeeded.
+    /// @param data The bytes read (reads only, otherwise nullptr).
+    /// @param size The number of bytes read.
+    /// @note This must not wait on further I2C transactions (e.g. by calling readBytes()).
+    using CompletionFn = std::function<void(bool success, const uint8_t* data, uint8_t size)>;
+
+    /// @brief A single register write within a batch (see writeRegistersAsync()).
+    struct RegisterWrite
+    {
+        uint8_t registerAddress;
+        uint8_t value;
+    };
+
     /// @brief Represents a I2C device in the system.
+    /// @note All transactions on the bus are carried out in order by a single 
+    ///       worker task. The synchronous calls below simply wait for theirs
+    ///       and should only be used by one task per device.
     class I2CDevice
     {
     public:
@@ -52,10 +75,33 @@ public:
         /// @param buffer The buffer in which to store the bytes read.
         /// @param size The number of bytes to read from the register.
         bool readBytes(uint8_t registerAddress, uint8_t* buffer, uint8_t size);
+
+        /// @brief Queues a register write without waiting for it to complete.
+        /// @param registerAddress The register on the device to update.
+        /// @param val The bytes to write to the register (copied before returning).
+        /// @param size The size of the provided buffer in bytes.
+        /// @param onComplete Called once the write finishes (optional).
+        void writeBytesAsync(uint8_t registerAddress, const uint8_t* val, uint8_t size, CompletionFn onComplete = nullptr);
+
+        /// @brief Queues a register read without waiting for it to complete.
+        /// @param registerAddress The register on the device to start reading from.
+        /// @param size The number of bytes to read from the register.
+        /// @param onComplete Called with the bytes read once the read finishes.
+        void readBytesAsync(uint8_t registerAddress, uint8_t size, CompletionFn onComplete);
+
+        /// @brief Queues several single-byte register writes that are carried out
+        ///        back to back, with no other transactions in between.
+        /// @param writes The writes to perform, in order (copied before returning).
+        /// @param count The number of writes.
+        /// @param onComplete Called once all writes finish, or on the first failure (optional).
+        void writeRegistersAsync(const RegisterWrite* writes, uint8_t count, CompletionFn onComplete = nullptr);
         
     private:
+        friend class I2CMaster;
+
         I2CMaster* master_;
         i2c_master_dev_handle_t devHandle_;
+        SemaphoreHandle_t syncDone_;
     };
     
     /// @brief Initializes the I2C master.
@@ -69,7 +115,32 @@ public:
     I2CDevice* getDevice(uint8_t i2cAddress);
     
 private:
+    enum TransactionType
+    {
+        TRANSACTION_WRITE,
+        TRANSACTION_READ,
+        TRANSACTION_WRITE_BATCH,
+    };
+
+    struct Transaction
+    {
+        I2CDevice* device;
+        TransactionType type;
+        uint8_t* data; // register address + bytes for writes, destination for reads
+        uint8_t size; // not including the register address
+        CompletionFn onComplete;
+    };
+
     i2c_master_bus_handle_t masterHandle_;
+    QueueHandle_t transactionQueue_;
+    TaskHandle_t workerTask_;
+    SemaphoreHandle_t workerStopped_;
+
+    void submit_(Transaction* transaction);
+    bool execute_(Transaction* transaction);
+    void workerLoop_();
+
+    static void WorkerEntry_(void* arg);
 };
 
 } // namespace driver
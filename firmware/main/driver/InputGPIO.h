@@ -152,7 +152,7 @@ void InputGPIO<NumGPIO>::start()
     
     currentState_ = gpio_get_level(NumGPIO) == 1;
 
-    owner_->registerMessageHandler(this, &InputGPIO<NumGPIO>::onGPIOStateChange_);
+    owner_->registerMessageHandlers<&InputGPIO<NumGPIO>::onGPIOStateChange_>(this);
 }
 
 template<gpio_num_t NumGPIO>
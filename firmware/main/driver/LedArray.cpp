@@ -25,6 +25,8 @@
 
 #define CURRENT_LOG_TAG ("LedArray")
 
+#define DEFAULT_BLINK_PERIOD_MS (2000)
+
 namespace ezdv
 {
 
@@ -38,9 +40,38 @@ LedArray::LedArray()
     , pttLed_(GPIO_PTT_LED, true)
     , pttNpmLed_(GPIO_PTT_NPN, true, true)
     , networkLed_(GPIO_NET_LED, true)
+    , blinkTimer_(this, this, &LedArray::onBlinkTimer_, MS_TO_US(DEFAULT_BLINK_PERIOD_MS / 2), "LedBlinkTimer")
+    , blinkPeriodMs_(DEFAULT_BLINK_PERIOD_MS)
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    , animationsHeld_(false)
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 {
-    registerMessageHandler(this, &LedArray::onSetLedState_);
-    registerMessageHandler(this, &LedArray::onLedBrightnessSettingsMessage_);
+    blinkTimer_.useTimerWheel();
+
+    for (int index = 0; index < NUM_LEDS; index++)
+    {
+        auto pattern = &patterns_[index];
+        pattern->owner = this;
+        pattern->led = (SetLedStateMessage::LedLabel)index;
+        pattern->pattern = SetLedStateMessage::SOLID;
+        pattern->periodMs = 0;
+        pattern->state = false;
+
+        auto led = getLed_(pattern->led);
+        if (led != nullptr)
+        {
+            led->setFadeCompleteCallback(&LedArray::OnFadeComplete_, pattern);
+        }
+    }
+
+    registerMessageHandlers<
+        &LedArray::onSetLedState_,
+        &LedArray::onLedFadeComplete_,
+        &LedArray::onLedBrightnessSettingsMessage_>(this);
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    registerMessageHandlers<&LedArray::onLoadSheddingMessage_>(this);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 }
 
 LedArray::~LedArray()
@@ -55,41 +86,212 @@ void LedArray::onTaskStart_()
 
 void LedArray::onTaskSleep_()
 {
-    // empty
+    blinkTimer_.stop();
 }
 
 void LedArray::onSetLedState_(DVTask* origin, SetLedStateMessage* message)
 {
     //ESP_LOGI(CURRENT_LOG_TAG, "LED %d now %d", (int)message->led, message->ledState);
+
+    assert(message->led > SetLedStateMessage::NONE && (int)message->led < NUM_LEDS);
+    assert(message->pattern == SetLedStateMessage::SOLID || message->periodMs > 0);
     
-    switch(message->led)
+    auto pattern = &patterns_[message->led];
+    bool wasAnimated = pattern->pattern != SetLedStateMessage::SOLID;
+    bool wasBlinking = pattern->pattern == SetLedStateMessage::BLINK;
+
+    pattern->pattern = message->pattern;
+    pattern->periodMs = message->periodMs;
+    pattern->state = message->ledState;
+    
+    // Only stop fades when needed so that plain on/off changes behave 
+    // exactly as before (e.g. the PTT output's EMI fade).
+    if (wasAnimated)
+    {
+        getLed_(pattern->led)->stopFade();
+    }
+    applyPattern_(pattern);
+
+    if (pattern->pattern == SetLedStateMessage::BLINK)
+    {
+        if (pattern->periodMs != blinkPeriodMs_)
+        {
+            blinkPeriodMs_ = pattern->periodMs;
+            blinkTimer_.changeInterval(MS_TO_US(blinkPeriodMs_ / 2));
+        }
+#if CONFIG_EZDV_LOAD_GOVERNOR
+        if (!animationsHeld_)
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+        {
+            blinkTimer_.restart();
+        }
+    }
+    else if (wasBlinking)
+    {
+        updateBlinkTimer_();
+    }
+}
+
+void LedArray::onLedFadeComplete_(DVTask* origin, LedFadeCompleteMessage* message)
+{
+    // The pattern may have changed since the interrupt fired.
+    auto pattern = &patterns_[message->led];
+    if (pattern->pattern == SetLedStateMessage::BREATHE)
+    {
+        pattern->state = !pattern->state;
+        getLed_(pattern->led)->fadeTo(pattern->state, pattern->periodMs / 2);
+    }
+}
+
+void LedArray::onLedBrightnessSettingsMessage_(DVTask* origin, storage::LedBrightnessSettingsMessage* message)
+{
+    OutputGPIO* leds[] = { &networkLed_, &overloadLed_, &pttLed_, &syncLed_ };
+    SetLedStateMessage::LedLabel labels[] = { 
+        SetLedStateMessage::NETWORK, SetLedStateMessage::OVERLOAD, 
+        SetLedStateMessage::PTT, SetLedStateMessage::SYNC };
+
+    for (size_t index = 0; index < sizeof(leds) / sizeof(leds[0]); index++)
+    {
+        auto pattern = &patterns_[labels[index]];
+        if (pattern->pattern != SetLedStateMessage::SOLID)
+        {
+            // Fades have their target duty baked in, so restart them
+            // at the new brightness.
+            leds[index]->stopFade();
+            leds[index]->setDutyCycle(message->dutyCycle);
+            applyPattern_(pattern);
+        }
+        else
+        {
+            leds[index]->setDutyCycle(message->dutyCycle);
+        }
+    }
+}
+
+void LedArray::onBlinkTimer_(DVTimer*)
+{
+    for (int index = 0; index < NUM_LEDS; index++)
+    {
+        auto pattern = &patterns_[index];
+        if (pattern->pattern == SetLedStateMessage::BLINK)
+        {
+            pattern->state = !pattern->state;
+            getLed_(pattern->led)->setState(pattern->state);
+        }
+    }
+}
+
+OutputGPIO* LedArray::getLed_(SetLedStateMessage::LedLabel led)
+{
+    switch(led)
     {
         case SetLedStateMessage::LedLabel::NETWORK:
-            networkLed_.setState(message->ledState);
-            break;
+            return &networkLed_;
         case SetLedStateMessage::LedLabel::OVERLOAD:
-            overloadLed_.setState(message->ledState);
-            break;
+            return &overloadLed_;
         case SetLedStateMessage::LedLabel::PTT:
-            pttLed_.setState(message->ledState);
-            break;
+            return &pttLed_;
         case SetLedStateMessage::LedLabel::PTT_NPN:
-            pttNpmLed_.setState(message->ledState);
-            break;
+            return &pttNpmLed_;
         case SetLedStateMessage::LedLabel::SYNC:
-            syncLed_.setState(message->ledState);
+            return &syncLed_;
+        default:
+            return nullptr;
+    }
+}
+#if CONFIG_EZDV_LOAD_GOVERNOR
+void LedArray::onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message)
+{
+    bool hold = message->level >= telemetry::LoadSheddingMessage::SHED_BACKGROUND;
+    if (hold == animationsHeld_)
+    {
+        return;
+    }
+
+    animationsHeld_ = hold;
+
+    bool anyBlinking = false;
+    for (int index = 0; index < NUM_LEDS; index++)
+    {
+        auto pattern = &patterns_[index];
+        if (pattern->pattern == SetLedStateMessage::BLINK || pattern->pattern == SetLedStateMessage::BREATHE)
+        {
+            anyBlinking |= pattern->pattern == SetLedStateMessage::BLINK;
+            getLed_(pattern->led)->stopFade();
+            applyPattern_(pattern);
+        }
+    }
+
+    if (animationsHeld_)
+    {
+        blinkTimer_.stop();
+    }
+    else if (anyBlinking)
+    {
+        blinkTimer_.restart();
+    }
+}
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+void LedArray::applyPattern_(LedPatternState* pattern)
+{
+    auto led = getLed_(pattern->led);
+    assert(led != nullptr);
+
+    switch(pattern->pattern)
+    {
+        case SetLedStateMessage::SOLID:
+        case SetLedStateMessage::BLINK:
+            led->setState(pattern->state);
+            break;
+        case SetLedStateMessage::FADE:
+            led->fadeTo(pattern->state, pattern->periodMs);
+            break;
+        case SetLedStateMessage::BREATHE:
+#if CONFIG_EZDV_LOAD_GOVERNOR
+            if (animationsHeld_)
+            {
+                led->setState(true);
+                break;
+            }
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+            // Each half of the cycle is one hardware fade; the next one is
+            // started from the fade end interrupt.
+            led->setState(false);
+            pattern->state = true;
+            led->fadeTo(true, pattern->periodMs / 2);
             break;
         default:
             assert(0);
     }
 }
 
-void LedArray::onLedBrightnessSettingsMessage_(DVTask* origin, storage::LedBrightnessSettingsMessage* message)
+void LedArray::updateBlinkTimer_()
 {
-    networkLed_.setDutyCycle(message->dutyCycle);
-    overloadLed_.setDutyCycle(message->dutyCycle);
-    pttLed_.setDutyCycle(message->dutyCycle);
-    syncLed_.setDutyCycle(message->dutyCycle);
+    for (int index = 0; index < NUM_LEDS; index++)
+    {
+        if (patterns_[index].pattern == SetLedStateMessage::BLINK)
+        {
+            return;
+        }
+    }
+
+    blinkTimer_.stop();
+}
+
+bool LedArray::OnFadeComplete_(const ledc_cb_param_t* param, void* arg)
+{
+    auto pattern = (LedPatternState*)arg;
+
+    // Runs in ISR context. Only breathing LEDs need to hear about this.
+    if (param->event == LEDC_FADE_END_EVT && pattern->pattern == SetLedStateMessage::BREATHE)
+    {
+        LedFadeCompleteMessage message(pattern->led);
+        pattern->owner->postISR(&message);
+    }
+
+    return false;
 }
 
 }
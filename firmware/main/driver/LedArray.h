@@ -18,11 +18,17 @@
 #ifndef LED_ARRAY_H
 #define LED_ARRAY_H
 
+#include "sdkconfig.h"
 #include "storage/SettingsMessage.h"
 #include "task/DVTask.h"
+#include "task/DVTimer.h"
 #include "LedMessage.h"
 #include "OutputGPIO.h"
 
+#if CONFIG_EZDV_LOAD_GOVERNOR
+#include "telemetry/TelemetryMessage.h"
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
 namespace ezdv
 {
 
@@ -42,14 +48,50 @@ protected:
     virtual void onTaskSleep_() override;
 
 private:
+    enum { NUM_LEDS = SetLedStateMessage::NETWORK + 1 };
+
+    // Pattern currently running on each LED (indexed by LedLabel).
+    struct LedPatternState
+    {
+        LedArray* owner;
+        SetLedStateMessage::LedLabel led;
+        SetLedStateMessage::LedPattern pattern;
+        uint32_t periodMs;
+        bool state;
+    };
+
     OutputGPIO syncLed_;
     OutputGPIO overloadLed_;
     OutputGPIO pttLed_;
     OutputGPIO pttNpmLed_;
     OutputGPIO networkLed_;
 
+    // Blinking LEDs share this timer and toggle together. The LEDC timers
+    // can't run anywhere near slowly enough to blink by themselves.
+    DVTimer blinkTimer_;
+    uint32_t blinkPeriodMs_;
+
+    LedPatternState patterns_[NUM_LEDS];
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    // Blinking and breathing LEDs are held steady while shedding load.
+    bool animationsHeld_;
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
     void onSetLedState_(DVTask* origin, SetLedStateMessage* message);
+    void onLedFadeComplete_(DVTask* origin, LedFadeCompleteMessage* message);
     void onLedBrightnessSettingsMessage_(DVTask* origin, storage::LedBrightnessSettingsMessage* message);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    void onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+    void onBlinkTimer_(DVTimer*);
+
+    OutputGPIO* getLed_(SetLedStateMessage::LedLabel led);
+    void applyPattern_(LedPatternState* pattern);
+    void updateBlinkTimer_();
+
+    static bool OnFadeComplete_(const ledc_cb_param_t* param, void* arg);
 };
 
 }
@@ -36,6 +36,7 @@ using namespace ezdv::task;
 enum LedMessageTypes
 {
     SET_LED_STATE = 1,
+    LED_FADE_COMPLETE = 2,
 };
 
 class SetLedStateMessage : public DVTaskMessageBase<SET_LED_STATE, SetLedStateMessage>
@@ -51,15 +52,43 @@ public:
         NETWORK
     };
 
-    SetLedStateMessage(LedLabel ledProvided = NONE, bool ledStateProvided = false)
+    /// @brief How the LED should behave after this message. Everything other
+    ///        than SOLID runs on the LEDC peripheral inside LedArray, so 
+    ///        senders only need to send a message when the pattern changes.
+    enum LedPattern
+    {
+        SOLID,   // on or off per ledState
+        BLINK,   // toggles every periodMs / 2, starting from ledState
+        BREATHE, // hardware fades up and down, one full cycle every periodMs
+        FADE,    // single hardware fade to ledState over periodMs
+    };
+
+    SetLedStateMessage(LedLabel ledProvided = NONE, bool ledStateProvided = false, LedPattern patternProvided = SOLID, uint32_t periodMsProvided = 0)
         : DVTaskMessageBase<SET_LED_STATE, SetLedStateMessage>(LED_MESSAGE)
         , led(ledProvided)
         , ledState(ledStateProvided)
+        , pattern(patternProvided)
+        , periodMs(periodMsProvided)
         {}
     virtual ~SetLedStateMessage() = default;
 
     LedLabel led;
     bool ledState;
+    LedPattern pattern;
+    uint32_t periodMs;
+};
+
+/// @brief Posted by LedArray to itself from the LEDC fade interrupt.
+class LedFadeCompleteMessage : public DVTaskMessageBase<LED_FADE_COMPLETE, LedFadeCompleteMessage>
+{
+public:
+    LedFadeCompleteMessage(SetLedStateMessage::LedLabel ledProvided = SetLedStateMessage::NONE)
+        : DVTaskMessageBase<LED_FADE_COMPLETE, LedFadeCompleteMessage>(LED_MESSAGE)
+        , led(ledProvided)
+        {}
+    virtual ~LedFadeCompleteMessage() = default;
+
+    SetLedStateMessage::LedLabel led;
 };
 
 }
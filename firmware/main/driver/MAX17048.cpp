@@ -48,6 +48,17 @@
 
 #define ADC_GPIO_NUM GPIO_NUM_18
 
+// Polling bounds. SOC change alerts cover every 1% step, so polls only 
+// need to keep RCOMP and VCELL current; the interval is chosen so SOC 
+// moves by roughly POLL_SOC_STEP_PERCENT between polls at the current rate.
+#define POLL_INTERVAL_MIN_MS (15000)
+#define POLL_INTERVAL_MAX_MS (300000)
+#define POLL_SOC_STEP_PERCENT (0.5f)
+
+// Below this SOC, poll at the minimum interval so that the forced 
+// shutdown checks run promptly.
+#define LOW_SOC_FAST_POLL_PERCENT (15)
+
 using namespace std::placeholders;
 
 // Global function to trigger shutdown.
@@ -60,21 +71,27 @@ namespace driver
 {
 
 MAX17048::MAX17048(I2CMaster* i2cMaster)
-    : DVTask("MAX17048", 10, 2870, tskNO_AFFINITY, 32, pdMS_TO_TICKS(60000))
+    : DVTask("MAX17048", 10, 2870, tskNO_AFFINITY, 32)
     , batAlertGpio_(this, std::bind(&MAX17048::onInterrupt_, this, _2))
-    , usbPower_(this, std::bind(&MAX17048::onTaskTick_, this), false, false)
+    , usbPower_(this, std::bind(&MAX17048::onUsbPowerChanged_, this), false, false)
+    , pollTimer_(this, this, &MAX17048::onPollTimer_, MS_TO_US(POLL_INTERVAL_MIN_MS), "BatteryPollTimer")
     , enabled_(false)
     , adcHandle_(nullptr)
     , adcCalibrationHandle_(nullptr)
     , isLowSoc_(false)
     , isStarting_(true)
     , suppressForcedSleep_(false)
+    , hasCachedState_(false)
+    , pollIntervalMs_(POLL_INTERVAL_MIN_MS)
 {
-    registerMessageHandler(this, &MAX17048::onLowBatteryShutdownMessage_);
-    registerMessageHandler(this, &MAX17048::onRequestBatteryStateMessage_);
+    registerMessageHandlers<
+        &MAX17048::onLowBatteryShutdownMessage_,
+        &MAX17048::onRequestBatteryStateMessage_>(this);
     
     i2cDevice_ = i2cMaster->getDevice(I2C_ADDRESS);
     assert(i2cDevice_ != nullptr);
+
+    pollTimer_.useTimerWheel();
 }
 
 MAX17048::~MAX17048()
@@ -141,15 +158,22 @@ void MAX17048::onTaskStart_()
     };
     ESP_ERROR_CHECK(adc_cali_create_scheme_curve_fitting(&calibrationConfig, &adcCalibrationHandle_));
 
-    // Perform initial task tick in case we need to immediately force sleep on boot
+    // Perform initial read in case we need to immediately force sleep on boot
     // (e.g. very low voltage)
-    onTaskTick_();
+    if (enabled_)
+    {
+        readBatteryState_(true);
+        pollTimer_.start();
+    }
 
     isStarting_ = false;
 }
 
 void MAX17048::onTaskSleep_()
 {
+    pollTimer_.stop();
+    hasCachedState_ = false;
+
     // Stop ADC
     ESP_ERROR_CHECK(adc_cali_delete_scheme_curve_fitting(adcCalibrationHandle_));
     ESP_ERROR_CHECK(adc_oneshot_del_unit(adcHandle_));
@@ -183,19 +207,32 @@ void MAX17048::onTaskSleep_()
 
 void MAX17048::onRequestBatteryStateMessage_(DVTask* origin, RequestBatteryStateMessage* reqMessage)
 {
-    uint16_t config = 0;
-    bool success = true;
-        
     if (!enabled_)
     {
         return;
     }
+
+    if (!reqMessage->updateTemp && hasCachedState_)
+    {
+        // USB power is a GPIO read, so that part can always be current.
+        cachedState_.usbPowerEnabled = usbPower_.getCurrentValue();
+        publish(&cachedState_);
+        return;
+    }
+
+    readBatteryState_(reqMessage->updateTemp);
+}
+
+void MAX17048::readBatteryState_(bool updateTemp)
+{
+    uint16_t config = 0;
+    bool success = true;
     
     // Read current temperature sensor value (in degC) and update RCOMP
     // based on formula from the datasheet. Note that the ESP32 internal
     // temperature sensor will read higher than ambient a lot of the time,
     // but it's likely better to underestimate capacity than overestimate.
-    if (reqMessage->updateTemp)
+    if (updateTemp)
     {
         success = readInt16Reg_(REG_CONFIG, &config);
         assert(success);
@@ -251,6 +288,12 @@ void MAX17048::onRequestBatteryStateMessage_(DVTask* origin, RequestBatteryState
     }
     BatteryStateMessage message(voltage * 0.000078125, calcSoc, (int16_t)socChangeRate * 0.208, usbPower_.getCurrentValue());
     publish(&message);
+
+    cachedState_.voltage = message.voltage;
+    cachedState_.soc = message.soc;
+    cachedState_.socChangeRate = message.socChangeRate;
+    hasCachedState_ = true;
+    updatePollInterval_(message.soc, message.socChangeRate);
     
     //ESP_LOGI(CURRENT_LOG_TAG, "Current battery stats: STATUS = %x, CONFIG = %x, V = %.2f, SOC = %.2f%%, CRATE = %.2f%%/hr", status, config, message.voltage, message.soc, message.socChangeRate);
 
@@ -269,12 +312,46 @@ void MAX17048::onRequestBatteryStateMessage_(DVTask* origin, RequestBatteryState
     }
 }
 
-void MAX17048::onTaskTick_()
+void MAX17048::onPollTimer_(DVTimer*)
 {
     if (enabled_)
     {
-        RequestBatteryStateMessage message(true);
-        post(&message);
+        readBatteryState_(true);
+    }
+}
+
+void MAX17048::onUsbPowerChanged_()
+{
+    // Plugging in or unplugging changes the charge rate, so take a fresh 
+    // reading and let the poll interval adapt from there.
+    if (enabled_)
+    {
+        readBatteryState_(true);
+        pollTimer_.restart();
+    }
+}
+
+void MAX17048::updatePollInterval_(float soc, float socChangeRate)
+{
+    uint64_t intervalMs = POLL_INTERVAL_MAX_MS;
+    float rate = std::fabs(socChangeRate);
+    
+    if (soc <= LOW_SOC_FAST_POLL_PERCENT)
+    {
+        intervalMs = POLL_INTERVAL_MIN_MS;
+    }
+    else if (rate > 0)
+    {
+        // socChangeRate is in %/hr.
+        intervalMs = (uint64_t)(POLL_SOC_STEP_PERCENT * 3600000 / rate);
+        if (intervalMs < POLL_INTERVAL_MIN_MS) intervalMs = POLL_INTERVAL_MIN_MS;
+        else if (intervalMs > POLL_INTERVAL_MAX_MS) intervalMs = POLL_INTERVAL_MAX_MS;
+    }
+    
+    if (intervalMs != pollIntervalMs_)
+    {
+        pollIntervalMs_ = intervalMs;
+        pollTimer_.changeInterval(MS_TO_US(intervalMs));
     }
 }
 
@@ -369,7 +446,7 @@ void MAX17048::onInterrupt_(bool val)
         bool voltageLow = (val & (1 << 10)) != 0;
         //bool voltageReset = (val & (1 << 11)) != 0;
         bool socLow = (val & (1 << 12)) != 0;
-        //bool socChange = (val & (1 << 13)) != 0;
+        bool socChange = (val & (1 << 13)) != 0;
         
         /*ESP_LOGI(
             CURRENT_LOG_TAG, 
@@ -382,12 +459,16 @@ void MAX17048::onInterrupt_(bool val)
             StartSleeping();
         }
         
-        // TBD: report other values to the user
-        
         // Clear status register to deassert interrupt.
         val = 0;
         rv = writeInt16Reg_(REG_STATUS, val);
         assert(rv == true);
+
+        if (socChange)
+        {
+            // SOC moved by 1%; refresh the cached state for everyone else.
+            readBatteryState_(false);
+        }
     }
 }
 
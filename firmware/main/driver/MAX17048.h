@@ -27,6 +27,7 @@
 
 #include "BatteryMessage.h"
 #include "task/DVTask.h"
+#include "task/DVTimer.h"
 #include "I2CMaster.h"
 #include "InputGPIO.h"
 
@@ -54,13 +55,12 @@ public:
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
-
-    virtual void onTaskTick_() override;
     
 private:
     I2CMaster::I2CDevice* i2cDevice_;
     InputGPIO<BAT_ALERT_GPIO> batAlertGpio_;
     InputGPIO<GPIO_USB_POWER_DETECT> usbPower_;
+    DVTimer pollTimer_;
     bool enabled_;
     adc_oneshot_unit_handle_t adcHandle_;
     adc_cali_handle_t adcCalibrationHandle_;
@@ -68,6 +68,13 @@ private:
     bool isStarting_;
     bool suppressForcedSleep_;
     
+    // Last state read from the device. Requests that don't need a 
+    // temperature update are answered from here instead of over I2C; 
+    // it's refreshed by pollTimer_, SOC change alerts and USB power changes.
+    BatteryStateMessage cachedState_;
+    bool hasCachedState_;
+    uint64_t pollIntervalMs_;
+    
     bool writeInt16Reg_(uint8_t reg, uint16_t val);
     bool readInt16Reg_(uint8_t reg, uint16_t* val);
     
@@ -76,6 +83,11 @@ private:
     void configureDevice_();
     
     void onInterrupt_(bool val);
+    void onUsbPowerChanged_();
+    void onPollTimer_(DVTimer*);
+    
+    void readBatteryState_(bool updateTemp);
+    void updatePollInterval_(float soc, float socChangeRate);
     
     float temperatureFromADC_();
 
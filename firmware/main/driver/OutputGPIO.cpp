@@ -103,6 +103,33 @@ void OutputGPIO::setState(bool state)
     }
 }
 
+void OutputGPIO::fadeTo(bool state, int timeMs)
+{
+    assert(pwm_);
+
+    state_ = state;
+    ESP_ERROR_CHECK(ledc_set_fade_time_and_start(LEDC_LOW_SPEED_MODE, getPWMChannel_(), state_ ? dutyCycle_ >> LED_DUTY_CYCLE_SHIFT : 0, timeMs, LEDC_FADE_NO_WAIT));
+}
+
+void OutputGPIO::stopFade()
+{
+    if (pwm_)
+    {
+        ESP_ERROR_CHECK(ledc_fade_stop(LEDC_LOW_SPEED_MODE, getPWMChannel_()));
+        updateDutyCycle_();
+    }
+}
+
+void OutputGPIO::setFadeCompleteCallback(ledc_cb_t fn, void* arg)
+{
+    assert(pwm_);
+
+    ledc_cbs_t callbacks = {
+        .fade_cb = fn
+    };
+    ESP_ERROR_CHECK(ledc_cb_register(LEDC_LOW_SPEED_MODE, getPWMChannel_(), &callbacks, arg));
+}
+
 void OutputGPIO::updateDutyCycle_()
 {
     if (pwm_)
@@ -36,6 +36,17 @@ public:
     void setState(bool state);
     void setDutyCycle(int dutyCycle);
 
+    /// @brief Fades to the given state in hardware without blocking (PWM outputs only).
+    /// @param state The state to end up in.
+    /// @param timeMs How long the fade should take.
+    void fadeTo(bool state, int timeMs);
+
+    /// @brief Stops any fade started by fadeTo() and jumps to its end state.
+    void stopFade();
+
+    /// @brief Registers a function to call from the LEDC ISR when a fade finishes.
+    void setFadeCompleteCallback(ledc_cb_t fn, void* arg);
+
 private:
     gpio_num_t gpio_;
     bool pwm_;
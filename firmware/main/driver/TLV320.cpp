@@ -15,14 +15,18 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cstring>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/i2s_std.h"
 
 #include "TLV320.h"
 #include "TLV320Message.h"
+#include "task/DVTaskSchedulingProfile.h"
+#include "util/BootTimeline.h"
 
 // TLV320 reset pin GPIO
 #define TLV320_RESET_GPIO GPIO_NUM_13
@@ -40,8 +44,41 @@
 // Tag to prepend to log entries coming from this file.
 #define CURRENT_LOG_TAG ("TLV320Driver")
 
-// Timer constants below are for 8000 Hz sample rate
-#define I2S_NUM_SAMPLES_PER_INTERVAL (160)
+#if CONFIG_EZDV_TLV320_16KHZ
+#define TLV320_SAMPLE_RATE_HZ (16000)
+#else
+#define TLV320_SAMPLE_RATE_HZ (8000)
+#endif // CONFIG_EZDV_TLV320_16KHZ
+
+// Clock settings that depend on the sample rate (see tlv320ConfigureClocks_()).
+#define TLV320_PLL_J (24 * 8000 / TLV320_SAMPLE_RATE_HZ)
+#define TLV320_MADC (48 * 8000 / TLV320_SAMPLE_RATE_HZ)
+#define TLV320_DOSR (768 * 8000 / TLV320_SAMPLE_RATE_HZ)
+
+// 20ms of audio per interval
+#define I2S_NUM_SAMPLES_PER_INTERVAL (TLV320_SAMPLE_RATE_HZ / 50)
+#define I2S_INTERVAL_US (20000)
+
+static_assert(I2S_NUM_SAMPLES_PER_INTERVAL <= I2S_MAX_SAMPLES_PER_INTERVAL);
+
+// Number of DMA buffers per direction, each holding one interval. The 
+// audio engine has one interval to refill/drain a buffer before the
+// DMA engine needs it again.
+#define TLV320_DMA_NUM_BUFFERS (2)
+
+// Audio engine task parameters (can be overridden by DVTaskSchedulingProfile).
+#define AUDIO_ENGINE_TASK_NAME ("TLV320Driver/Audio")
+#define AUDIO_ENGINE_TASK_PRIORITY (16)
+#define AUDIO_ENGINE_STACK_SIZE (4096)
+
+// Notification bits for the audio engine task.
+#define AUDIO_ENGINE_EVENT_RX (1 << 0)
+#define AUDIO_ENGINE_EVENT_TX (1 << 1)
+#define AUDIO_ENGINE_EVENT_RX_OVERFLOW (1 << 2)
+#define AUDIO_ENGINE_EVENT_STOP (1 << 3)
+
+// FreeDV frames grow by the same ratio once converted to our rate.
+#define TLV320_MAX_FREEDV_FRAME_SAMPLES (FREEDV_MAX_FRAME_SAMPLES * TLV320_SAMPLE_RATE_HZ / AUDIO_DEFAULT_SAMPLE_RATE)
 
 namespace ezdv
 {
@@ -52,17 +89,36 @@ namespace driver
 using namespace std::placeholders;
 
 TLV320::TLV320(I2CMaster* i2cMaster)
-    : DVTask("TLV320Driver", 15, 4096, tskNO_AFFINITY, 10, pdMS_TO_TICKS(10))
-    , audio::AudioInput(2, 2)
+    : DVTask("TLV320Driver", 15, 4096, tskNO_AFFINITY, 10)
+    , audio::AudioInput("TLV320Driver", 2, { I2S_NUM_SAMPLES_PER_INTERVAL, TLV320_MAX_FREEDV_FRAME_SAMPLES })
     , currentPage_(-1) // This will cause the page to be set to 0 on first I2C write.
     , i2sTxDevice_(nullptr)
     , i2sRxDevice_(nullptr)
     , int1Gpio_(this, std::bind(&TLV320::onInterrupt1Fire_, this, _2), false, true, false)
     , int2Gpio_(this, std::bind(&TLV320::onInterrupt2Fire_, this, _2), false, true, false)
+    , audioEngineTask_(nullptr)
+    , txBytesPending_(0)
+    , txBytesWritten_(0)
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    // Missing a whole interval means the DMA ring (TLV320_DMA_NUM_BUFFERS
+    // deep) came close to or did overflow.
+    , rxDeadline_("I2S RX", I2S_INTERVAL_US, I2S_INTERVAL_US)
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
 {
     // Register message handlers
-    registerMessageHandler<storage::LeftChannelVolumeMessage>(this, &TLV320::onLeftChannelVolume_);
-    registerMessageHandler<storage::RightChannelVolumeMessage>(this, &TLV320::onRightChannelVolume_);
+    registerMessageHandlers<
+        &TLV320::onLeftChannelVolume_,
+        &TLV320::onRightChannelVolume_>(this);
+
+    audioEngineStopped_ = xSemaphoreCreateBinary();
+    assert(audioEngineStopped_ != nullptr);
+
+    // AudioGraph takes care of conversion to/from everyone else's rate.
+    for (int channel = 0; channel < 2; channel++)
+    {
+        setInputSampleRate((audio::AudioInput::ChannelLabel)channel, TLV320_SAMPLE_RATE_HZ);
+        setOutputSampleRate((audio::AudioInput::ChannelLabel)channel, TLV320_SAMPLE_RATE_HZ);
+    }
 
     initializeResetGPIO_();
     
@@ -73,14 +129,18 @@ TLV320::TLV320(I2CMaster* i2cMaster)
 TLV320::~TLV320()
 {
     delete i2cDevice_;
+    vSemaphoreDelete(audioEngineStopped_);
 }
 
 void TLV320::onTaskStart_()
 {
     // To begin, we need to hard reset the TLV320.
     ESP_LOGI(CURRENT_LOG_TAG, "reset TLV320");
-    initializeResetGPIO_();
-    tlv320HardReset_();
+    {
+        util::BootTimeline::Step step("tlv320 reset");
+        initializeResetGPIO_();
+        tlv320HardReset_();
+    }
     
     // Make sure the TLV320 is actually there. If not, no point in continuing.
     bool result = false;
@@ -91,6 +151,9 @@ void TLV320::onTaskStart_()
         return;
     }
     
+    // Everything from here on counts as configuration.
+    util::BootTimeline::Step configStep("tlv320 config");
+
     // Initialize I2S.
     initializeI2S_();
     
@@ -124,16 +187,27 @@ void TLV320::onTaskStart_()
 
 void TLV320::onTaskSleep_()
 {
-    // Stop reading from I2S.
+    // Stop reading from I2S. The channels are disabled first so that
+    // the DMA callbacks stop before the audio engine goes away.
     if (i2sRxDevice_ != nullptr)
     {
         i2s_channel_disable(i2sRxDevice_);
-        i2s_del_channel(i2sRxDevice_);
     }
     
     if (i2sTxDevice_ != nullptr)
     {
         i2s_channel_disable(i2sTxDevice_);
+    }
+
+    stopAudioEngine_();
+
+    if (i2sRxDevice_ != nullptr)
+    {
+        i2s_del_channel(i2sRxDevice_);
+    }
+    
+    if (i2sTxDevice_ != nullptr)
+    {
         i2s_del_channel(i2sTxDevice_);
     }
     
@@ -143,48 +217,282 @@ void TLV320::onTaskSleep_()
     tlv320HardReset_();
 }
 
-void TLV320::onTaskTick_()
+void TLV320::startAudioEngine_()
 {
-    if (i2sRxDevice_ == nullptr || i2sTxDevice_ == nullptr) return;
+    UBaseType_t priority = AUDIO_ENGINE_TASK_PRIORITY;
+    BaseType_t coreId = tskNO_AFFINITY;
+    task::DVTaskSchedulingProfile::Apply(AUDIO_ENGINE_TASK_NAME, &priority, &coreId);
+
+    txBytesPending_ = 0;
+    txBytesWritten_ = 0;
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    rxDeadline_.reset();
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    auto returnValue = 
+        xTaskCreatePinnedToCore(&AudioEngineEntry_, AUDIO_ENGINE_TASK_NAME, AUDIO_ENGINE_STACK_SIZE, this, priority, &audioEngineTask_, coreId);
+    assert(returnValue == pdPASS);
+}
 
-    short tempData[I2S_NUM_SAMPLES_PER_INTERVAL * 2];
-    memset(tempData, 0, sizeof(tempData));
-    
-    // Perform read from I2S. 
-    size_t bytesRead = sizeof(tempData);
-    ESP_ERROR_CHECK(i2s_channel_read(i2sRxDevice_, tempData, sizeof(tempData), &bytesRead, portMAX_DELAY));
+void TLV320::stopAudioEngine_()
+{
+    if (audioEngineTask_ == nullptr) return;
+
+    xTaskNotify(audioEngineTask_, AUDIO_ENGINE_EVENT_STOP, eSetBits);
+    xSemaphoreTake(audioEngineStopped_, portMAX_DELAY);
+    audioEngineTask_ = nullptr;
+}
+
+void TLV320::AudioEngineEntry_(void* arg)
+{
+    TLV320* thisObj = (TLV320*)arg;
+    thisObj->audioEngineLoop_();
+
+    xSemaphoreGive(thisObj->audioEngineStopped_);
+    vTaskDelete(nullptr);
+}
 
-    // Output channel bytes to configured output FIFOs.
-    struct FIFO* leftChannelFifo = getAudioOutput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
-    struct FIFO* rightChannelFifo = getAudioOutput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
-    for (int index = 0; index < bytesRead / 2 / sizeof(short); index++)
+void TLV320::audioEngineLoop_()
+{
+    for (;;)
     {
-        if (leftChannelFifo != nullptr) codec2_fifo_write(leftChannelFifo, &tempData[2*index], 1);
-        if (rightChannelFifo != nullptr) codec2_fifo_write(rightChannelFifo, &tempData[2*index + 1], 1);
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        if (events & AUDIO_ENGINE_EVENT_STOP)
+        {
+            break;
+        }
+
+        if (events & AUDIO_ENGINE_EVENT_RX_OVERFLOW)
+        {
+            // The I2S driver had to drop a buffer because we didn't get to it
+            // in time. Charge it to whoever we're feeding.
+            for (int channel = 0; channel < 2; channel++)
+            {
+                OutputClaim output(this, (audio::AudioInput::ChannelLabel)channel);
+                audio::AudioRingBuffer* fifo = output.fifo();
+                if (fifo != nullptr)
+                {
+                    fifo->reportOverrun(I2S_NUM_SAMPLES_PER_INTERVAL);
+                }
+            }
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+            if (rxDeadline_.reportMiss(esp_timer_get_time(), I2S_INTERVAL_US))
+            {
+                recoverAudio_();
+            }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+        }
+
+        if (events & AUDIO_ENGINE_EVENT_RX)
+        {
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+            if (rxDeadline_.mark(esp_timer_get_time()))
+            {
+                recoverAudio_();
+            }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+            moveReceivedAudio_();
+        }
+
+        if (events & AUDIO_ENGINE_EVENT_TX)
+        {
+            moveTransmitAudio_();
+        }
     }
+}
 
-    leftChannelFifo = getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
-    rightChannelFifo = getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
-    if ((leftChannelFifo && codec2_fifo_used(leftChannelFifo) >= I2S_NUM_SAMPLES_PER_INTERVAL) || 
-        (rightChannelFifo && codec2_fifo_used(rightChannelFifo) >= I2S_NUM_SAMPLES_PER_INTERVAL))
+void TLV320::moveReceivedAudio_()
+{
+    // Notifications may have been coalesced, so drain every buffer that's
+    // ready without waiting for more.
+    for (int count = 0; count < TLV320_DMA_NUM_BUFFERS; count++)
     {
-        memset(tempData, 0, sizeof(tempData));
+        size_t bytesRead = 0;
+        esp_err_t result = i2s_channel_read(i2sRxDevice_, rxFrames_, I2S_NUM_SAMPLES_PER_INTERVAL * sizeof(uint32_t), &bytesRead, 0);
+
+        // Output channel bytes to configured output FIFOs.
+        // Each channel is deinterleaved a block at a time directly into its FIFO.
+        uint32_t numSamplesRead = bytesRead / sizeof(uint32_t);
+        for (int channel = 0; channel < 2 && numSamplesRead > 0; channel++)
+        {
+            OutputClaim output(this, (audio::AudioInput::ChannelLabel)channel);
+            audio::AudioRingBuffer* fifo = output.fifo();
+            if (fifo == nullptr) continue;
+
+            auto span = fifo->acquireWrite(std::min(numSamplesRead, fifo->numFree()));
+            fifo->reportOverrun(numSamplesRead - span.size());
+            DeinterleaveChannel_(rxFrames_, span.first, span.firstLength, channel);
+            DeinterleaveChannel_(rxFrames_ + span.firstLength, span.second, span.secondLength, channel);
+            fifo->commitWrite(span.size());
+        }
+
+        if (result != ESP_OK)
+        {
+            break;
+        }
+    }
+}
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+void TLV320::recoverAudio_()
+{
+    // Everything queued either way is now stale. Start over with what the
+    // codec gives us next instead of running permanently behind.
+    for (int channel = 0; channel < 2; channel++)
+    {
+        {
+            OutputClaim claim(this, (audio::AudioInput::ChannelLabel)channel);
+            if (claim.fifo() != nullptr)
+            {
+                claim.fifo()->requestFlush();
+            }
+        }
+
+        audio::AudioRingBuffer* input = getAudioInput((audio::AudioInput::ChannelLabel)channel);
+        if (input != nullptr)
+        {
+            input->requestFlush();
+        }
+    }
+
+    txBytesPending_ = 0;
+    txBytesWritten_ = 0;
+}
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+bool TLV320::flushPendingTransmitAudio_()
+{
+    if (txBytesWritten_ < txBytesPending_)
+    {
+        size_t bytesWritten = 0;
+        i2s_channel_write(i2sTxDevice_, (uint8_t*)txFrames_ + txBytesWritten_, txBytesPending_ - txBytesWritten_, &bytesWritten, 0);
+        txBytesWritten_ += bytesWritten;
+    }
+
+    return txBytesWritten_ >= txBytesPending_;
+}
+
+void TLV320::moveTransmitAudio_()
+{
+    // Anything left over from last time goes out first. If there's still 
+    // no room after that, the DMA engine is ahead of us and we'll try 
+    // again on the next TX completion. auto_clear sends silence if we fall
+    // behind instead.
+    for (int count = 0; count < TLV320_DMA_NUM_BUFFERS && flushPendingTransmitAudio_(); count++)
+    {
+        audio::AudioRingBuffer* channelFifos[] = {
+            getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL),
+            getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
+        };
+        if ((channelFifos[0] == nullptr || channelFifos[0]->numUsed() < I2S_NUM_SAMPLES_PER_INTERVAL) && 
+            (channelFifos[1] == nullptr || channelFifos[1]->numUsed() < I2S_NUM_SAMPLES_PER_INTERVAL))
+        {
+            break;
+        }
+
+        memset(txFrames_, 0, sizeof(txFrames_));
         
-        for (auto index = 0; index < I2S_NUM_SAMPLES_PER_INTERVAL; index++)
+        // Interleave whatever each channel has (up to one interval's worth)
+        // directly from its FIFO. Missing samples are left as silence.
+        for (int channel = 0; channel < 2; channel++)
         {
-            if (leftChannelFifo) codec2_fifo_read(leftChannelFifo, &tempData[2*index], 1);
-            if (rightChannelFifo) codec2_fifo_read(rightChannelFifo, &tempData[2*index + 1], 1);
+            audio::AudioRingBuffer* fifo = channelFifos[channel];
+            if (fifo == nullptr) continue;
+
+            auto span = fifo->acquireRead(std::min(fifo->numUsed(), (uint32_t)I2S_NUM_SAMPLES_PER_INTERVAL));
+            if (span.size() > 0)
+            {
+                // Only count channels that are actually streaming; ones with
+                // nothing queued are just idle.
+                fifo->reportUnderrun(I2S_NUM_SAMPLES_PER_INTERVAL - span.size());
+            }
+            InterleaveChannel_(span.first, txFrames_, span.firstLength, channel);
+            InterleaveChannel_(span.second, txFrames_ + span.firstLength, span.secondLength, channel);
+            fifo->release(span.size());
         }
         
-        size_t bytesWritten = 0;
-        ESP_ERROR_CHECK(i2s_channel_write(i2sTxDevice_, tempData, sizeof(tempData), &bytesWritten, portMAX_DELAY));
+        txBytesPending_ = I2S_NUM_SAMPLES_PER_INTERVAL * sizeof(uint32_t);
+        txBytesWritten_ = 0;
+    }
+}
+
+// The callbacks below run in ISR context with the flash cache possibly 
+// disabled (CONFIG_I2S_ISR_IRAM_SAFE), so they only use the task handle
+// passed in and never touch the TLV320 object itself.
+bool IRAM_ATTR TLV320::OnI2SReceived_(i2s_chan_handle_t handle, i2s_event_data_t* event, void* userCtx)
+{
+    BaseType_t taskWoken = pdFALSE;
+    xTaskNotifyFromISR((TaskHandle_t)userCtx, AUDIO_ENGINE_EVENT_RX, eSetBits, &taskWoken);
+    return taskWoken == pdTRUE;
+}
+
+bool IRAM_ATTR TLV320::OnI2SSent_(i2s_chan_handle_t handle, i2s_event_data_t* event, void* userCtx)
+{
+    BaseType_t taskWoken = pdFALSE;
+    xTaskNotifyFromISR((TaskHandle_t)userCtx, AUDIO_ENGINE_EVENT_TX, eSetBits, &taskWoken);
+    return taskWoken == pdTRUE;
+}
+
+bool IRAM_ATTR TLV320::OnI2SReceiveQueueOverflow_(i2s_chan_handle_t handle, i2s_event_data_t* event, void* userCtx)
+{
+    BaseType_t taskWoken = pdFALSE;
+    xTaskNotifyFromISR((TaskHandle_t)userCtx, AUDIO_ENGINE_EVENT_RX_OVERFLOW, eSetBits, &taskWoken);
+    return taskWoken == pdTRUE;
+}
+
+void TLV320::DeinterleaveChannel_(const uint32_t* frames, short* out, uint32_t numFrames, int channel)
+{
+    // Working on whole frames lets us pull each sample out with a single
+    // 32-bit load and shift. Unrolling keeps the loop overhead down; the 
+    // tail only runs when a FIFO wraps mid-block.
+    const int shift = channel * 16;
+    uint32_t index = 0;
+    for (; index + 4 <= numFrames; index += 4)
+    {
+        out[index] = (short)(frames[index] >> shift);
+        out[index + 1] = (short)(frames[index + 1] >> shift);
+        out[index + 2] = (short)(frames[index + 2] >> shift);
+        out[index + 3] = (short)(frames[index + 3] >> shift);
+    }
+    for (; index < numFrames; index++)
+    {
+        out[index] = (short)(frames[index] >> shift);
+    }
+}
+
+void TLV320::InterleaveChannel_(const short* in, uint32_t* frames, uint32_t numFrames, int channel)
+{
+    const int shift = channel * 16;
+    uint32_t index = 0;
+    for (; index + 4 <= numFrames; index += 4)
+    {
+        frames[index] |= (uint32_t)(uint16_t)in[index] << shift;
+        frames[index + 1] |= (uint32_t)(uint16_t)in[index + 1] << shift;
+        frames[index + 2] |= (uint32_t)(uint16_t)in[index + 2] << shift;
+        frames[index + 3] |= (uint32_t)(uint16_t)in[index + 3] << shift;
+    }
+    for (; index < numFrames; index++)
+    {
+        frames[index] |= (uint32_t)(uint16_t)in[index] << shift;
     }
 }
 
 void TLV320::setVolumeCommon_(uint8_t reg, int8_t vol)
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Volume control: setting volume on register %d to %d", (int)reg, vol);    
-    setConfigurationOption_(0, reg, vol);
+
+    // Nothing needs to wait for volume changes to reach the codec. The page
+    // is always selected as part of the batch so it doesn't matter what's
+    // queued ahead of us.
+    I2CMaster::RegisterWrite writes[] = {
+        { 0, 0 }, // page 0
+        { reg, (uint8_t)vol },
+    };
+    i2cDevice_->writeRegistersAsync(writes, sizeof(writes) / sizeof(writes[0]));
+    currentPage_ = 0;
 }
 
 void TLV320::onLeftChannelVolume_(DVTask* origin, storage::LeftChannelVolumeMessage* message)
@@ -252,21 +560,22 @@ void TLV320::initializeI2S_()
     // Get the default channel configuration by helper macro.
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
 
-    // Update DMA info for the channel to prevent overflows.
-    //chan_cfg.dma_desc_num = 16;
-    //chan_cfg.dma_frame_num = I2S_NUM_SAMPLES_PER_INTERVAL;
+    // One DMA buffer per interval, double buffered. Each completed
+    // buffer wakes up the audio engine.
+    chan_cfg.dma_desc_num = TLV320_DMA_NUM_BUFFERS;
+    chan_cfg.dma_frame_num = I2S_NUM_SAMPLES_PER_INTERVAL;
     chan_cfg.auto_clear = true;
     
     // Allocate a new full duplex channel and get the handles of the channels
     ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &i2sTxDevice_, &i2sRxDevice_));
 
     // Set up configuration for the I2S device:
-    //     8 KHz sample rate
+    //     8 or 16 KHz sample rate
     //     Philips format (1 bit shifted, 16 bit/channel stereo)
     //     GPIOs as listed
     i2s_std_config_t i2sConfiguration = {
         .clk_cfg = {
-            .sample_rate_hz = 8000,
+            .sample_rate_hz = TLV320_SAMPLE_RATE_HZ,
             .clk_src = I2S_CLK_SRC_DEFAULT,
             .ext_clk_freq_hz = 0, // ignored by ESP-IDF
             .mclk_multiple = I2S_MCLK_MULTIPLE_256,
@@ -291,6 +600,19 @@ void TLV320::initializeI2S_()
 
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(i2sTxDevice_, &i2sConfiguration));
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(i2sRxDevice_, &i2sConfiguration));
+
+    // The audio engine needs to exist before the callbacks can wake it up.
+    startAudioEngine_();
+
+    i2s_event_callbacks_t rxCallbacks = {};
+    rxCallbacks.on_recv = &OnI2SReceived_;
+    rxCallbacks.on_recv_q_ovf = &OnI2SReceiveQueueOverflow_;
+    ESP_ERROR_CHECK(i2s_channel_register_event_callback(i2sRxDevice_, &rxCallbacks, audioEngineTask_));
+
+    i2s_event_callbacks_t txCallbacks = {};
+    txCallbacks.on_sent = &OnI2SSent_;
+    ESP_ERROR_CHECK(i2s_channel_register_event_callback(i2sTxDevice_, &txCallbacks, audioEngineTask_));
+
     ESP_ERROR_CHECK(i2s_channel_enable(i2sTxDevice_));
     ESP_ERROR_CHECK(i2s_channel_enable(i2sRxDevice_));
 }
@@ -320,6 +642,13 @@ void TLV320::tlv320ConfigureClocks_()
 {
     // Clock calculations for 8K sample rate per guide at 
     // https://www.ti.com/lit/an/slaa404c/slaa404c.pdf
+    //
+    // For 16K, MCLK doubles to 8.192 MHz, so J is halved to keep 
+    // CODEC_CLKIN the same. MADC and DOSR are halved to keep ADC_CLK
+    // at 49.152 MHz and DAC_MOD_CLK at 6.144 MHz:
+    //     J = 12, MADC = 24, DOSR = 384
+    //     (MADC * AOSR) / 32 = 96 >= RC(R1) = 6
+    //     (MDAC * DOSR) / 32 = 96 >= RC(P1) = 8
             
     // AOSR = 128
     // DOSR = 768
@@ -354,10 +683,10 @@ void TLV320::tlv320ConfigureClocks_()
         // (Page 0, register 4)
         (0 << 2) | 0b11,
 
-        // Set PLL P = 1, R = 1, J = 24, D = 0, power up PLL
+        // Set PLL P = 1, R = 1, J = 24 (12 @ 16K), D = 0, power up PLL
         // (Page 0, registers 5-8)
         (1 << 7) | (0b001 << 4) | (0b001),  // P, R, power up
-        24, // J
+        TLV320_PLL_J, // J
         0, // D[MSB]
         0 // D[LSB]
     };
@@ -369,20 +698,20 @@ void TLV320::tlv320ConfigureClocks_()
         
     // Set NDAC = 2, MDAC = 8. Power on divider.
     // (Page 0, registers 11 and 12)
-    // Program DOSR to 768 (Page 0, registers 13-14)
+    // Program DOSR to 768 (384 @ 16K) (Page 0, registers 13-14)
     uint8_t dacOpts[] = {
         (1 << 7) | 2,
         (1 << 7) | 8,
-        0b11,
-        0
+        (TLV320_DOSR >> 8) & 0b11,
+        TLV320_DOSR & 0xFF
     };
     setConfigurationOptionMultiple_(0, 11, dacOpts, 4);
         
-    // Set NADC = 2, MADC = 48. (Page 0, registers 18 and 19)
+    // Set NADC = 2, MADC = 48 (24 @ 16K). (Page 0, registers 18 and 19)
     // Program AOSR to 128 (Page 0, register 20).
     uint8_t adcOpts[] = {
         2,
-        (1 << 7) | 48,
+        (1 << 7) | TLV320_MADC,
         128
     };
     setConfigurationOptionMultiple_(0, 18, adcOpts, 2);
@@ -18,6 +18,7 @@
 #ifndef TLV320_DRIVER_H
 #define TLV320_DRIVER_H
 
+#include "sdkconfig.h"
 #include "driver/i2s_std.h"
 
 #include "InputGPIO.h"
@@ -26,6 +27,10 @@
 #include "storage/SettingsMessage.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
+#include "util/DeadlineMonitor.h"
+
+// Largest number of stereo frames moved per DMA buffer (20ms at 16 KHz).
+#define I2S_MAX_SAMPLES_PER_INTERVAL (320)
 
 // GPIO assignments for TLV320 interrupts
 #define GPIO_TLV320_INT1 GPIO_NUM_12
@@ -49,8 +54,6 @@ protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
 
-    virtual void onTaskTick_() override;
-
 private:
     I2CMaster::I2CDevice* i2cDevice_;
     int currentPage_;
@@ -58,6 +61,33 @@ private:
     i2s_chan_handle_t i2sRxDevice_;
     InputGPIO<GPIO_TLV320_INT1> int1Gpio_;
     InputGPIO<GPIO_TLV320_INT2> int2Gpio_;
+
+    // Audio is moved by a separate task woken by the I2S DMA callbacks,
+    // so messages and I2C traffic here never hold it up.
+    TaskHandle_t audioEngineTask_;
+    SemaphoreHandle_t audioEngineStopped_;
+    uint32_t rxFrames_[I2S_MAX_SAMPLES_PER_INTERVAL];
+    uint32_t txFrames_[I2S_MAX_SAMPLES_PER_INTERVAL];
+    uint32_t txBytesPending_;
+    uint32_t txBytesWritten_;
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    util::DeadlineMonitor rxDeadline_; // one DMA buffer per interval
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    void startAudioEngine_();
+    void stopAudioEngine_();
+    void audioEngineLoop_();
+    void moveReceivedAudio_();
+    void moveTransmitAudio_();
+    bool flushPendingTransmitAudio_();
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    void recoverAudio_();
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    static void AudioEngineEntry_(void* arg);
+    static bool OnI2SReceived_(i2s_chan_handle_t handle, i2s_event_data_t* event, void* userCtx);
+    static bool OnI2SSent_(i2s_chan_handle_t handle, i2s_event_data_t* event, void* userCtx);
+    static bool OnI2SReceiveQueueOverflow_(i2s_chan_handle_t handle, i2s_event_data_t* event, void* userCtx);
     
     void onLeftChannelVolume_(DVTask* origin, storage::LeftChannelVolumeMessage* message);
     void onRightChannelVolume_(DVTask* origin, storage::RightChannelVolumeMessage* message);
@@ -81,6 +111,12 @@ private:
     void tlv320ConfigureAGC_();
     void tlv320ConfigureInterrupts_();
 
+    /// @brief Copies one channel out of a block of interleaved stereo frames.
+    static void DeinterleaveChannel_(const uint32_t* frames, short* out, uint32_t numFrames, int channel);
+
+    /// @brief Copies samples into one channel of a block of silent stereo frames.
+    static void InterleaveChannel_(const short* in, uint32_t* frames, uint32_t numFrames, int channel);
+
     void onInterrupt1Fire_(bool state);
     void onInterrupt2Fire_(bool state);
 };
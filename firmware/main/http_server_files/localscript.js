@@ -161,7 +161,8 @@ var saveVoiceKeyerSettings = function() {
         "type": "saveVoiceKeyerInfo",
         "enabled": $("#voiceKeyerEnable").is(':checked'),
         "secondsToWait": parseInt($("#voiceKeyerSecondsToWait").val()),
-        "timesToTransmit": parseInt($("#voiceKeyerTimesToTransmit").val())
+        "timesToTransmit": parseInt($("#voiceKeyerTimesToTransmit").val()),
+        "slot": parseInt($("#voiceKeyerSlot").val())
     };
     
     $("#voiceKeyerSuccessAlertRow").hide();
@@ -214,16 +215,19 @@ var setVKErrorMessage = function(errorType, errno)
             $("#vkErrorText").html("System error: " + errno.toString());
            break;
         case 2:
-            $("#vkErrorText").html("Incorrect sample rate: ezDV only supports .wav files recorded at 8 KHz");
+            $("#vkErrorText").html("Unsupported sample rate: ezDV supports .wav files recorded at common sample rates between 4 and 192 KHz (e.g. 8, 16, 44.1 or 48 KHz)");
             break;
         case 3:
-            $("#vkErrorText").html("Incorrect number of channels: ezDV only supports .wav files recorded as mono, not stereo");
+            $("#vkErrorText").html("Unsupported number of channels: ezDV supports .wav files with up to 8 channels");
             break;
         case 4:
             $("#vkErrorText").html("All fields are required except for the voice keyer file, which can be skipped if not updating");
             break;
         case 6:
-            $("#vkErrorText").html("Voice keyer files can't be larger than 512 kilobytes (KB)");
+            $("#vkErrorText").html("Voice keyer file is too long for the selected slot or larger than 16 megabytes (MB)");
+            break;
+        case 7:
+            $("#vkErrorText").html("Unsupported file format: ezDV supports .wav files containing 8, 16, 24 or 32-bit PCM or 32-bit floating point audio");
             break;
         case 5:
         default:
@@ -232,10 +236,128 @@ var setVKErrorMessage = function(errorType, errno)
     }
 }
 
+//==========================================================================================
+// Received audio monitor
+//==========================================================================================
+var monitorContext = null;
+var monitorEnabled = false;
+var monitorNextTime = 0;
+
+// Most received audio (in seconds) to have waiting to play before skipping ahead.
+var MONITOR_MAX_DELAY = 0.3;
+
+var adpcmStepTable = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209,
+    230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876,
+    963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+    3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493,
+    10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086,
+    29794, 32767
+];
+var adpcmIndexTable = [ -1, -1, -1, -1, 2, 4, 6, 8 ];
+
+// Decodes and queues a received audio frame (see HttpServerTask), returning
+// false if it isn't one.
+var playMonitorFrame = function(buffer)
+{
+    var view = new DataView(buffer);
+    if (view.byteLength < 4 || view.getUint8(0) != 0x41) // 'A'
+    {
+        return false;
+    }
+    
+    if (!monitorEnabled || monitorContext == null)
+    {
+        return true;
+    }
+
+    var stepIndex = view.getUint8(1);
+    var predictor = view.getInt16(2, true);
+    var numSamples = (view.byteLength - 4) * 2;
+    var audio = monitorContext.createBuffer(1, numSamples, 8000);
+    var samples = audio.getChannelData(0);
+    for (var index = 0; index < numSamples; index++)
+    {
+        var code = view.getUint8(4 + (index >> 1));
+        code = (index & 1) ? (code >> 4) : (code & 0x0F);
+        
+        var step = adpcmStepTable[stepIndex];
+        var delta = step >> 3;
+        if (code & 4) delta += step;
+        if (code & 2) delta += step >> 1;
+        if (code & 1) delta += step >> 2;
+        
+        predictor += (code & 8) ? -delta : delta;
+        predictor = Math.max(-32768, Math.min(32767, predictor));
+        stepIndex = Math.max(0, Math.min(adpcmStepTable.length - 1, stepIndex + adpcmIndexTable[code & 7]));
+        samples[index] = predictor / 32768;
+    }
+
+    // Frames are played back to back; start over with a little cushion if 
+    // we ran dry or got too far behind.
+    var now = monitorContext.currentTime;
+    if (monitorNextTime < now || monitorNextTime - now > MONITOR_MAX_DELAY)
+    {
+        monitorNextTime = now + 0.1;
+    }
+
+    var source = monitorContext.createBufferSource();
+    source.buffer = audio;
+    source.connect(monitorContext.destination);
+    source.start(monitorNextTime);
+    monitorNextTime += audio.duration;
+    
+    return true;
+};
+
+var setAudioMonitor = function(enabled)
+{
+    monitorEnabled = enabled;
+    if (enabled)
+    {
+        // Has to be created from a user action for the browser to allow it.
+        if (monitorContext == null)
+        {
+            monitorContext = new AudioContext();
+        }
+        monitorContext.resume();
+        
+        $("#audioMonitor").removeClass("btn-secondary");
+        $("#audioMonitor").addClass("btn-success");
+    }
+    else
+    {
+        $("#audioMonitor").addClass("btn-secondary");
+        $("#audioMonitor").removeClass("btn-success");
+    }
+    
+    ws.send(JSON.stringify({ "type": "subscribeAudioMonitor", "enabled": enabled }));
+};
+
 //==========================================================================================
 // WebSocket handling
 //==========================================================================================
 var ws = null;
+
+// Decodes binary status frames (see HttpServerTask) into the same
+// objects the JSON versions produce, or null if not a status frame.
+var decodeBinaryStatus = function(buffer)
+{
+    var view = new DataView(buffer);
+    if (view.byteLength >= 13 && view.getUint8(0) == 0x42) // 'B'
+    {
+        return {
+            "type": "batteryStatus",
+            "voltage": view.getFloat32(1, true),
+            "stateOfCharge": view.getFloat32(5, true),
+            "stateOfChargeChange": view.getFloat32(9, true)
+        };
+    }
+    
+    return null;
+};
+
 function wsConnect() 
 {
   ws = new WebSocket("ws://" + location.hostname + "/ws");
@@ -250,271 +372,366 @@ function wsConnect()
       else
       {
           $(".modal").hide();
+          
+          // Frequent status updates are smaller as binary frames.
+          ws.send(JSON.stringify({ "type": "setBinaryStatus", "enabled": true }));
+          
+          if (monitorEnabled)
+          {
+              setAudioMonitor(true);
+          }
       }
   };
   ws.onmessage = function(e) 
   {
-      var json = JSON.parse(e.data);
-      
-      if (json.type == "wifiInfo")
+      var json = null;
+      if (e.data instanceof ArrayBuffer)
       {
-          // Display current Wi-Fi settings
-          $("#wifiEnable").prop("disabled", false);
-          $("#wifiReset").prop("disabled", false);
-          $("#wifiEnable").prop("checked", json.enabled);
-          
-          $("#wifiMode").val(json.mode);
-          $("#wifiSecurityType").val(json.security);
-          $("#wifiChannel").val(json.channel);
-          $("#wifiSSID").val(json.ssid);
-          $("#wifiPassword").val(json.password);    
-          $("#wifiHostname").val(json.hostname);  
-          
-          updateWifiFormState();    
-      }
-      else if (json.type == "wifiScanResults")
-      {
-          // Save the current list of Wi-Fi networks and update the form state.
-          wifiNetworkList = json.networkList;
-          updateWifiFormState();
-      }
-      else if (json.type == "wifiSaved")
-      {
-          $("#wifiSave").show();
-          $("#wifiSaveProgress").hide();
-
-          if (json.success)
+          if (playMonitorFrame(e.data))
           {
-              $("#wifiSuccessAlertRow").show();
+              return;
           }
-          else
+          
+          json = decodeBinaryStatus(e.data);
+          if (json == null)
           {
-              $("#wifiFailAlertRow").show();
+              return;
           }
       }
-      else if (json.type == "radioInfo")
+      else
       {
-          // Display current Wi-Fi settings
-          $("#radioEnable").prop("disabled", false);
-          $("#headsetPtt").prop("disabled", false);
-          $("#radioReset").prop("disabled", false);
-          $("#headsetPtt").prop("disabled", false);
-          $("#timeOutTimer").prop("disabled", false);
-          $("#radioEnable").prop("checked", json.enabled);
-          $("#headsetPtt").prop("checked", json.headsetPtt);
-          
-          $("#timeOutTimer").val(json.timeOutTimer);
-          $("#radioType").val(json.radioType);
-          $("#radioIP").val(json.host);
-          $("#radioPort").val(json.port);
-          $("#radioUsername").val(json.username);
-          $("#radioPassword").val(json.password);
-          
-          updateRadioFormState();
+          json = JSON.parse(e.data);
       }
-      else if (json.type == "flexRadioDiscovered")
+      
+      // Settings are sent together when we connect, and status changes
+      // are batched up after that.
+      var messages = [ json ];
+      if (json.type == "settingsSnapshot" || json.type == "status")
       {
-          // Add discovered radio to the list.
-          var radioDescription = json.description;
-          var radioIp = json.ip;
-          
-          // Only update the dropdown if we're adding something brand new.
-          if (!(radioIp in flexRadioDictionary))
-          {
-              flexRadioDictionary[radioIp] = radioDescription;
-              updateRadioFormState();
-          }
+          messages = json.messages;
       }
-      else if (json.type == "radioSaved")
+      
+      messages.forEach(function(json)
       {
-          $("#radioSave").show();
-          $("#radioSaveProgress").hide();
-
-          if (json.success)
+          if (json.type == "wifiInfo")
           {
-              $("#radioSuccessAlertRow").show();
+              // Display current Wi-Fi settings
+              $("#wifiEnable").prop("disabled", false);
+              $("#wifiReset").prop("disabled", false);
+              $("#wifiEnable").prop("checked", json.enabled);
+          
+              $("#wifiMode").val(json.mode);
+              $("#wifiSecurityType").val(json.security);
+              $("#wifiChannel").val(json.channel);
+              $("#wifiSSID").val(json.ssid);
+              $("#wifiPassword").val(json.password);    
+              $("#wifiHostname").val(json.hostname);  
+          
+              updateWifiFormState();    
           }
-          else
+          else if (json.type == "wifiScanResults")
           {
-              $("#radioFailAlertRow").show();
+              // Save the current list of Wi-Fi networks and update the form state.
+              wifiNetworkList = json.networkList.sort();
+              updateWifiFormState();
           }
-      }
-      else if (json.type == "voiceKeyerInfo")
-      {
-          $("#voiceKeyerEnable").prop("disabled", false);
-          $("#voiceKeyerReset").prop("disabled", false);
-          $("#voiceKeyerEnable").prop("checked", json.enabled);
-
-          $("#voiceKeyerTimesToTransmit").val(json.timesToTransmit);
-          $("#voiceKeyerSecondsToWait").val(json.secondsToWait);
-
-          updateVoiceKeyerState();
-      }
-      else if (json.type == "voiceKeyerSaved")
-      {
-          $("#voiceKeyerSave").show();
-          $("#voiceKeyerSaveProgress").hide();
-
-          if (json.success)
+          else if (json.type == "wifiScanChanges")
           {
-              $("#voiceKeyerSuccessAlertRow").show();
+              // Only networks that appeared or went away since the last update.
+              wifiNetworkList = wifiNetworkList.filter(function(ssid) {
+                  return !json.removed.includes(ssid);
+              });
+              json.added.forEach(function(ssid) {
+                  if (!wifiNetworkList.includes(ssid))
+                  {
+                      wifiNetworkList.push(ssid);
+                  }
+              });
+              wifiNetworkList.sort();
+              updateWifiFormState();
           }
-          else
+          else if (json.type == "wifiSaved")
           {
-              $("#voiceKeyerFailAlertRow").show();
-              setVKErrorMessage(json.errorType, 0);
+              $("#wifiSave").show();
+              $("#wifiSaveProgress").hide();
+
+              if (json.success)
+              {
+                  $("#wifiSuccessAlertRow").show();
+              }
+              else
+              {
+                  $("#wifiFailAlertRow").show();
+              }
           }
-      }
-      else if (json.type == "reportingInfo")
-      {
-          $(".reporting-enable-row").show();
-          $("#reportingReset").prop("disabled", false);
-          $("#reportingCallsign").val(json.callsign);
-          $("#reportingGridSquare").val(json.gridSquare);
-          $("#reportingForceEnable").prop("checked", json.forceReporting);
-          $("#reportingMessage").val(json.reportingMessage);
+          else if (json.type == "radioInfo")
+          {
+              // Display current Wi-Fi settings
+              $("#radioEnable").prop("disabled", false);
+              $("#headsetPtt").prop("disabled", false);
+              $("#radioReset").prop("disabled", false);
+              $("#headsetPtt").prop("disabled", false);
+              $("#timeOutTimer").prop("disabled", false);
+              $("#radioEnable").prop("checked", json.enabled);
+              $("#headsetPtt").prop("checked", json.headsetPtt);
           
-          var reportingFrequencyHz = json.reportingFrequency;
-          var reportingFrequencyMHz = reportingFrequencyHz / 1000 / 1000;
-          $("#reportingFrequency").val(reportingFrequencyMHz.toFixed(4));
-      }
-      else if (json.type == "reportingSaved")
-      {
-          $("#reportingSave").show();
-          $("#reportingSaveProgress").hide();
-
-          if (json.success)
+              $("#timeOutTimer").val(json.timeOutTimer);
+              $("#radioType").val(json.radioType);
+              $("#radioIP").val(json.host);
+              $("#radioPort").val(json.port);
+              $("#radioUsername").val(json.username);
+              $("#radioPassword").val(json.password);
+          
+              updateRadioFormState();
+          }
+          else if (json.type == "flexRadioDiscovered")
           {
-              $("#reportingSuccessAlertRow").show();
+              // Add discovered radio to the list.
+              var radioDescription = json.description;
+              var radioIp = json.ip;
+          
+              // Only update the dropdown if we're adding something brand new.
+              if (!(radioIp in flexRadioDictionary))
+              {
+                  flexRadioDictionary[radioIp] = radioDescription;
+                  updateRadioFormState();
+              }
           }
-          else
+          else if (json.type == "radioSaved")
           {
-              $("#reportingFailAlertRow").show();
+              $("#radioSave").show();
+              $("#radioSaveProgress").hide();
+
+              if (json.success)
+              {
+                  $("#radioSuccessAlertRow").show();
+              }
+              else
+              {
+                  $("#radioFailAlertRow").show();
+              }
           }
-      }
-      else if (json.type == "ledBrightnessInfo")
-      {
-          $(".general-enable-row").show();
-          $("#ledBrightness").val(json.dutyCycle);
-      }
-      else if (json.type == "voiceKeyerUploadComplete")
-      {
-          if (json.success)
+          else if (json.type == "voiceKeyerInfo")
           {
-              saveVoiceKeyerSettings();
+              $("#voiceKeyerEnable").prop("disabled", false);
+              $("#voiceKeyerReset").prop("disabled", false);
+              $("#voiceKeyerEnable").prop("checked", json.enabled);
+
+              $("#voiceKeyerTimesToTransmit").val(json.timesToTransmit);
+              $("#voiceKeyerSecondsToWait").val(json.secondsToWait);
+
+              $("#voiceKeyerSlot").empty();
+              for (var slot = 0; slot < json.numSlots; slot++)
+              {
+                  $("#voiceKeyerSlot").append(new Option((slot + 1).toString(), slot.toString()));
+              }
+              $("#voiceKeyerSlot").val(json.slot.toString());
+
+              updateVoiceKeyerState();
           }
-          else
+          else if (json.type == "voiceKeyerSaved")
           {
-              $("#voiceKeyerFailAlertRow").show();
               $("#voiceKeyerSave").show();
               $("#voiceKeyerSaveProgress").hide();
-              setVKErrorMessage(json.errorType, json.errno);
 
-              vkReader.abort();
+              if (json.success)
+              {
+                  $("#voiceKeyerSuccessAlertRow").show();
+              }
+              else
+              {
+                  $("#voiceKeyerFailAlertRow").show();
+                  setVKErrorMessage(json.errorType, 0);
+              }
           }
-      }
-      else if (json.type == "firmwareUploadComplete")
-      {
-          $("#updateSave").show();
-          $("#updateSaveProgress").hide();
+          else if (json.type == "reportingInfo")
+          {
+              $(".reporting-enable-row").show();
+              $("#reportingReset").prop("disabled", false);
+              $("#reportingCallsign").val(json.callsign);
+              $("#reportingGridSquare").val(json.gridSquare);
+              $("#reportingForceEnable").prop("checked", json.forceReporting);
+              $("#reportingMessage").val(json.reportingMessage);
           
-          if (json.success)
+              var reportingFrequencyHz = json.reportingFrequency;
+              var reportingFrequencyMHz = reportingFrequencyHz / 1000 / 1000;
+              $("#reportingFrequency").val(reportingFrequencyMHz.toFixed(4));
+          }
+          else if (json.type == "reportingSaved")
           {
-              $("#updateSuccessAlertRow").show();
-              $("#updateFailAlertRow").hide();
+              $("#reportingSave").show();
+              $("#reportingSaveProgress").hide();
+
+              if (json.success)
+              {
+                  $("#reportingSuccessAlertRow").show();
+              }
+              else
+              {
+                  $("#reportingFailAlertRow").show();
+              }
           }
-          else
+          else if (json.type == "ledBrightnessInfo")
           {
-              $("#updateSuccessAlertRow").hide();
-              $("#updateFailAlertRow").show();
+              $(".general-enable-row").show();
+              $("#ledBrightness").val(json.dutyCycle);
           }
-      }
-      else if (json.type == "batteryStatus")
-      {
-          // Update battery percentage and time remaining
-          $(".battery-level").height(json.stateOfCharge.toFixed(0) + "%");
-          if (json.stateOfChargeChange == 0)
+          else if (json.type == "uploadCredit")
           {
-              $(".time-remaining").hide();
+              if (currentUpload != null)
+              {
+                  currentUpload.granted = json.granted;
+                  sendUploadBlocks();
+              }
           }
-          else
+          else if (json.type == "voiceKeyerUploadComplete")
           {
-              $(".time-remaining").show();
-              if (json.stateOfChargeChange < 0)
+              currentUpload = null;
+              if (json.success)
               {
-                  var numHoursRemaining = json.stateOfCharge / -json.stateOfChargeChange;
-                  if (numHoursRemaining >= 10)
-                  {
-                    $(".time-remaining").text("(>10h remaining)");
-                  }
-                  else if (numHoursRemaining > 1)
-                  {
-                    $(".time-remaining").text("(" + numHoursRemaining.toFixed(0) + "h remaining)");
-                  }
-                  else
-                  {
-                    var numMinutesRemaining = numHoursRemaining * 60;
-                    $(".time-remaining").text("(" + numMinutesRemaining.toFixed(0) + " min remaining)");
-                  }
+                  saveVoiceKeyerSettings();
               }
               else
               {
-                var numHoursRemaining = (100 - json.stateOfCharge) / json.stateOfChargeChange;
-                  if (numHoursRemaining >= 10)
-                  {
-                    $(".time-remaining").text("(not charging)");
-                  }
-                  else if (numHoursRemaining > 1)
-                  {
-                    $(".time-remaining").text("(" + numHoursRemaining.toFixed(0) + "h to full)");
-                  }
-                  else
-                  {
-                    var numMinutesRemaining = numHoursRemaining * 60;
-                    $(".time-remaining").text("(" + numMinutesRemaining.toFixed(0) + " min to full)");
-                  }
-              }
-          }
-      }
-      else if (json.type == "currentMode")
-      {
-          $(".mode-button").addClass("btn-secondary");
-          $(".mode-button").removeClass("btn-primary");
+                  $("#voiceKeyerFailAlertRow").show();
+                  $("#voiceKeyerSave").show();
+                  $("#voiceKeyerSaveProgress").hide();
+                  setVKErrorMessage(json.errorType, json.errno);
 
-          if (json.currentMode == 0)
-          {
-              $("#modeAnalog").addClass("btn-primary");
-              $("#modeAnalog").removeClass("btn-secondary");
+                  vkReader.abort();
+              }
           }
-          else if (json.currentMode == 1)
+          else if (json.type == "firmwareUploadComplete")
           {
-              $("#mode700D").addClass("btn-primary");
-              $("#mode700D").removeClass("btn-secondary");
+              currentUpload = null;
+              $("#updateSave").show();
+              $("#updateSaveProgress").hide();
+          
+              if (json.success)
+              {
+                  $("#updateSuccessAlertRow").show();
+                  $("#updateFailAlertRow").hide();
+              }
+              else
+              {
+                  $("#updateSuccessAlertRow").hide();
+                  $("#updateFailAlertRow").show();
+              }
           }
-          else if (json.currentMode == 2)
+          else if (json.type == "bootTimeline")
           {
-              $("#mode700E").addClass("btn-primary");
-              $("#mode700E").removeClass("btn-secondary");
+              // One row per step of this boot, with the previous boot's duration
+              // alongside for comparison.
+              var previous = {};
+              if (json.previous)
+              {
+                  json.previous.events.forEach(function(event) {
+                      previous[event.name] = event;
+                  });
+              }
+
+              $("#bootTimelineBody").empty();
+              if (json.current)
+              {
+                  json.current.events.forEach(function(event) {
+                      var row = $("<tr>");
+                      row.append($("<td>").text(event.name));
+                      row.append($("<td>").text((event.startUs / 1000).toFixed(1)));
+                      row.append($("<td>").text((event.durationUs / 1000).toFixed(1)));
+                      row.append($("<td>").text(
+                          previous[event.name] ? (previous[event.name].durationUs / 1000).toFixed(1) : "-"));
+                      $("#bootTimelineBody").append(row);
+                  });
+              }
+              $("#bootTimelineRow").show();
           }
-          else if (json.currentMode == 3)
+          else if (json.type == "batteryStatus")
           {
-              $("#mode1600").addClass("btn-primary");
-              $("#mode1600").removeClass("btn-secondary");
+              // Update battery percentage and time remaining
+              $(".battery-level").height(json.stateOfCharge.toFixed(0) + "%");
+              if (json.stateOfChargeChange == 0)
+              {
+                  $(".time-remaining").hide();
+              }
+              else
+              {
+                  $(".time-remaining").show();
+                  if (json.stateOfChargeChange < 0)
+                  {
+                      var numHoursRemaining = json.stateOfCharge / -json.stateOfChargeChange;
+                      if (numHoursRemaining >= 10)
+                      {
+                        $(".time-remaining").text("(>10h remaining)");
+                      }
+                      else if (numHoursRemaining > 1)
+                      {
+                        $(".time-remaining").text("(" + numHoursRemaining.toFixed(0) + "h remaining)");
+                      }
+                      else
+                      {
+                        var numMinutesRemaining = numHoursRemaining * 60;
+                        $(".time-remaining").text("(" + numMinutesRemaining.toFixed(0) + " min remaining)");
+                      }
+                  }
+                  else
+                  {
+                    var numHoursRemaining = (100 - json.stateOfCharge) / json.stateOfChargeChange;
+                      if (numHoursRemaining >= 10)
+                      {
+                        $(".time-remaining").text("(not charging)");
+                      }
+                      else if (numHoursRemaining > 1)
+                      {
+                        $(".time-remaining").text("(" + numHoursRemaining.toFixed(0) + "h to full)");
+                      }
+                      else
+                      {
+                        var numMinutesRemaining = numHoursRemaining * 60;
+                        $(".time-remaining").text("(" + numMinutesRemaining.toFixed(0) + " min to full)");
+                      }
+                  }
+              }
           }
-      }
-      else if (json.type == "voiceKeyerRunning")
-      {
-          if (json.running)
+          else if (json.type == "currentMode")
           {
-              $("#startVoiceKeyer").removeClass("btn-secondary");
-              $("#startVoiceKeyer").addClass("btn-danger");
+              $(".mode-button").addClass("btn-secondary");
+              $(".mode-button").removeClass("btn-primary");
+
+              if (json.currentMode == 0)
+              {
+                  $("#modeAnalog").addClass("btn-primary");
+                  $("#modeAnalog").removeClass("btn-secondary");
+              }
+              else if (json.currentMode == 1)
+              {
+                  $("#mode700D").addClass("btn-primary");
+                  $("#mode700D").removeClass("btn-secondary");
+              }
+              else if (json.currentMode == 2)
+              {
+                  $("#mode700E").addClass("btn-primary");
+                  $("#mode700E").removeClass("btn-secondary");
+              }
+              else if (json.currentMode == 3)
+              {
+                  $("#mode1600").addClass("btn-primary");
+                  $("#mode1600").removeClass("btn-secondary");
+              }
           }
-          else
+          else if (json.type == "voiceKeyerRunning")
           {
-            $("#startVoiceKeyer").addClass("btn-secondary");
-            $("#startVoiceKeyer").removeClass("btn-danger");
+              if (json.running)
+              {
+                  $("#startVoiceKeyer").removeClass("btn-secondary");
+                  $("#startVoiceKeyer").addClass("btn-danger");
+              }
+              else
+              {
+                $("#startVoiceKeyer").addClass("btn-secondary");
+                $("#startVoiceKeyer").removeClass("btn-danger");
+              }
           }
-      }
+      });
   };
 
   ws.onclose = function(e) 
@@ -698,16 +915,10 @@ $("#voiceKeyerSave").click(function()
             // read successful, send to server
             var startMessage = {
                 type: "uploadVoiceKeyerFile",
-                size: reader.result.byteLength
+                size: reader.result.byteLength,
+                slot: parseInt($("#voiceKeyerSlot").val())
             };
-            ws.send(JSON.stringify(startMessage));
-
-            // Send 4K blocks to ezDV so it can better handle
-            // them (vs. sending 100K+ at once).
-            for (var size = 0; size < reader.result.byteLength; size += 4096)
-            {
-                ws.send(reader.result.slice(size, size + 4096));
-            }
+            startUpload(reader.result, startMessage, function() { return true; });
         };
         reader.onerror = function()
         {
@@ -722,6 +933,39 @@ $("#voiceKeyerSave").click(function()
 
 });
 
+// Uploads are sent in 4K blocks so ezDV can better handle them (vs. 
+// sending 100K+ at once). ezDV tells us how many blocks in total we're 
+// allowed to send ("uploadCredit") as it makes room for them.
+var currentUpload = null;
+
+function startUpload(buffer, startMessage, shouldContinue)
+{
+    currentUpload = {
+        buffer: buffer,
+        offset: 0,
+        sent: 0,
+        granted: 0,
+        shouldContinue: shouldContinue
+    };
+    ws.send(JSON.stringify(startMessage));
+}
+
+function sendUploadBlocks()
+{
+    while (currentUpload != null && currentUpload.sent < currentUpload.granted)
+    {
+        if (currentUpload.offset >= currentUpload.buffer.byteLength || !currentUpload.shouldContinue())
+        {
+            currentUpload = null;
+            break;
+        }
+
+        ws.send(currentUpload.buffer.slice(currentUpload.offset, currentUpload.offset + 4096));
+        currentUpload.offset += 4096;
+        currentUpload.sent++;
+    }
+}
+
 $("#modeAnalog").click(function() {
     setFreeDVMode(0);
 });
@@ -738,6 +982,10 @@ $("#mode1600").click(function() {
     setFreeDVMode(3);
 });
 
+$("#audioMonitor").click(function() {
+    setAudioMonitor(!monitorEnabled);
+});
+
 $("#startVoiceKeyer").click(function() {
     var running = $("#startVoiceKeyer").hasClass("btn-secondary");
 
@@ -751,6 +999,11 @@ $("#startVoiceKeyer").click(function() {
     ws.send(JSON.stringify(obj));
 });
 
+$("#bootTimelineRefresh").click(function()
+{
+    ws.send(JSON.stringify({ "type": "getBootTimeline" }));
+});
+
 var vkReader = new FileReader();
 $("#updateSave").click(function()
 {
@@ -760,7 +1013,16 @@ $("#updateSave").click(function()
     $("#updateSave").hide();
     $("#updateSaveProgress").show();
 
-    if ($('#firmwareFile').get(0).files.length === 0) 
+    if ($('#firmwareFile').get(0).files.length === 0 && $("#firmwareUrl").val() !== "")
+    {
+        // ezDV downloads the update itself and sends firmwareUploadComplete when done.
+        var obj = {
+            type: "startFirmwareDownload",
+            url: $("#firmwareUrl").val()
+        };
+        ws.send(JSON.stringify(obj));
+    }
+    else if ($('#firmwareFile').get(0).files.length === 0) 
     {
         // Ignore if there aren't any selected files. TBD
         $("#updateSave").show();
@@ -774,21 +1036,7 @@ $("#updateSave").click(function()
             var startMessage = {
                 type: "uploadFirmwareFile"
             };
-            ws.send(JSON.stringify(startMessage));
-
-            // Send 4K blocks to ezDV so it can better handle
-            // them (vs. sending 100K+ at once).
-            for (var size = 0; size < vkReader.result.byteLength; size += 4096)
-            {
-                if ($("#updateSave").is(":hidden"))
-                {
-                    ws.send(vkReader.result.slice(size, size + 4096));
-                }
-                else
-                {
-                    break;
-                }
-            }
+            startUpload(vkReader.result, startMessage, function() { return $("#updateSave").is(":hidden"); });
         };
         vkReader.onerror = function()
         {
@@ -871,6 +1119,7 @@ $( document ).ready(function()
     
     $("#updateSuccessAlertRow").hide();
     $("#updateFailAlertRow").hide();
+    $("#bootTimelineRow").hide();
     
     $(".general-enable-row").hide();
 
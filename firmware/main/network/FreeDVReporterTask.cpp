@@ -20,12 +20,35 @@
 #include "FreeDVReporterTask.h"
 #include "cJSON.h"
 #include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+#include "util/JsonWriter.h"
 
 #define REPORTING_HOSTNAME "qso.freedv.org"
 #define CURRENT_LOG_TAG "FreeDVReporter"
 
 #define SOCKET_IO_TX_PREFIX "42"
 
+// Events are serialized here. Large enough for the longest possible
+// reporting message even if every character needs escaping.
+#define TX_BUFFER_SIZE (1024)
+
+// Longest we'll wait for the websocket client to accept a message. If the
+// connection is that backed up, the event is retried later instead.
+#define SEND_TIMEOUT_MS (100)
+
+// Received callsigns kept while disconnected (or while sends are failing).
+// Old reports aren't useful to anyone, so they eventually expire.
+#define SPOOL_MAX_REPORTS (16)
+#define SPOOL_MAX_AGE_MS (300000)
+
+// Spooled events are sent a few at a time on reconnect so we don't hog
+// the connection (or this task).
+#define REPLAY_BATCH_SIZE (4)
+#define REPLAY_INTERVAL_MS (250)
+
+// How much more slowly the spool is replayed while shedding load.
+#define REPLAY_LOAD_SHED_MULTIPLIER (4)
+
 extern "C"
 {
     DV_EVENT_DEFINE_BASE(FREEDV_REPORTER_MESSAGE);
@@ -40,6 +63,7 @@ namespace network
 FreeDVReporterTask::FreeDVReporterTask()
     : ezdv::task::DVTask("FreeDVReporterTask", 1, 3072, tskNO_AFFINITY, 32)
     , reconnectTimer_(this, this, &FreeDVReporterTask::startSocketIoConnection_, MS_TO_US(10000), "FDVReporterReconn")
+    , replayTimer_(this, this, &FreeDVReporterTask::onReplayTimer_, MS_TO_US(REPLAY_INTERVAL_MS), "FDVReporterReplay")
     , reportingClientHandle_(nullptr)
     , jsonAuthObj_(nullptr)
     , reportingEnabled_(false)
@@ -53,18 +77,29 @@ FreeDVReporterTask::FreeDVReporterTask()
     , pingIntervalMs_(0)
     , pingTimeoutMs_(0)
     , isConnecting_(false)
+    , pendingUpdates_(0)
 {
-    registerMessageHandler(this, &FreeDVReporterTask::onReportingSettingsMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onEnableReportingMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onDisableReportingMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onFreeDVCallsignReceivedMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onReportFrequencyChangeMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onSetPTTState_);
-    registerMessageHandler(this, &FreeDVReporterTask::onSetFreeDVMode_);
-
-    registerMessageHandler(this, &FreeDVReporterTask::onWebsocketDataMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onWebsocketConnectedMessage_);
-    registerMessageHandler(this, &FreeDVReporterTask::onWebsocketDisconnectedMessage_);
+    reconnectTimer_.useTimerWheel();
+    replayTimer_.useTimerWheel();
+
+    txBuffer_ = (char*)heap_caps_malloc(TX_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    assert(txBuffer_ != nullptr);
+
+    registerMessageHandlers<
+        &FreeDVReporterTask::onReportingSettingsMessage_,
+        &FreeDVReporterTask::onEnableReportingMessage_,
+        &FreeDVReporterTask::onDisableReportingMessage_,
+        &FreeDVReporterTask::onFreeDVCallsignReceivedMessage_,
+        &FreeDVReporterTask::onReportStationStateMessage_>(this);
+
+    registerMessageHandlers<
+        &FreeDVReporterTask::onWebsocketDataMessage_,
+        &FreeDVReporterTask::onWebsocketConnectedMessage_,
+        &FreeDVReporterTask::onWebsocketDisconnectedMessage_>(this);
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    registerMessageHandlers<&FreeDVReporterTask::onLoadSheddingMessage_>(this);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 }
 
 FreeDVReporterTask::~FreeDVReporterTask()
@@ -73,6 +108,8 @@ FreeDVReporterTask::~FreeDVReporterTask()
     {
         stopSocketIoConnection_();
     }
+
+    heap_caps_free(txBuffer_);
 }
 
 void FreeDVReporterTask::onTaskStart_()
@@ -81,9 +118,9 @@ void FreeDVReporterTask::onTaskStart_()
     storage::RequestReportingSettingsMessage reportingRequest;
     publish(&reportingRequest);
 
-    // Request current FreeDV mode
-    audio::RequestGetFreeDVModeMessage modeRequest;
-    publish(&modeRequest);
+    // Request current frequency, mode and PTT state
+    RequestStationStateMessage stateRequest;
+    publish(&stateRequest);
 }
 
 void FreeDVReporterTask::onTaskSleep_()
@@ -96,6 +133,7 @@ void FreeDVReporterTask::onTaskSleep_()
     }
 
     reconnectTimer_.stop();
+    clearSpool_();
 }
 
 void FreeDVReporterTask::onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message)
@@ -114,6 +152,9 @@ void FreeDVReporterTask::onReportingSettingsMessage_(DVTask* origin, storage::Re
     // Disconnect and reconnect if there were any changes
     if (callsignChanged)
     {
+        // Anything spooled was heard by the previous station.
+        clearSpool_();
+
         if (reportingEnabled_)
         {
             stopSocketIoConnection_();
@@ -142,18 +183,11 @@ void FreeDVReporterTask::onReportingSettingsMessage_(DVTask* origin, storage::Re
             post(&request);
         }
     }
-    
-    // If reporting is forced, unconditionally send frequency update.
-    if (forceReporting_)
-    {
-        ReportFrequencyChangeMessage request(message->freqHz);
-        post(&request);
-    }
 
-    // If connected and the reporting message has changed, send that.
-    if (reportingEnabled_ && messageChanged)
+    // If the reporting message has changed, send that (once connected).
+    if (messageChanged)
     {
-        sendReportingMessageUpdate_();
+        queueUpdate_(UPDATE_MESSAGE);
     }
 }
 
@@ -174,6 +208,11 @@ void FreeDVReporterTask::onEnableReportingMessage_(DVTask* origin, EnableReporti
 void FreeDVReporterTask::onDisableReportingMessage_(DVTask* origin, DisableReportingMessage* message)
 {
     reportingRefCount_--;
+    if (reportingRefCount_ == 0)
+    {
+        clearSpool_();
+    }
+
     if (reportingEnabled_ && reportingRefCount_ == 0)
     {
         stopSocketIoConnection_();
@@ -182,70 +221,58 @@ void FreeDVReporterTask::onDisableReportingMessage_(DVTask* origin, DisableRepor
 
 void FreeDVReporterTask::onFreeDVCallsignReceivedMessage_(DVTask* origin, audio::FreeDVReceivedCallsignMessage* message)
 {
-    if (reportingEnabled_)
+    // Hold onto reports heard while the connection is down so they can be
+    // sent once it comes back.
+    if (!reportingEnabled_ && (reportingRefCount_ == 0 || callsign_ == "" || gridSquare_ == ""))
     {
-        cJSON* outMessage = cJSON_CreateArray();
-        assert(outMessage != nullptr);
-
-        cJSON* messageName = cJSON_CreateString("rx_report");
-        assert(messageName != nullptr);
-        cJSON_AddItemToArray(outMessage, messageName);
-
-        cJSON* messagePayload = cJSON_CreateObject();
-        assert(messagePayload != nullptr);
-
-        cJSON* callsign = cJSON_CreateString(message->callsign);
-        assert(callsign != nullptr);
-        cJSON_AddItemToObject(messagePayload, "callsign", callsign);
-
-        cJSON* snr = cJSON_CreateNumber((int)message->snr);
-        assert(snr != nullptr);
-        cJSON_AddItemToObject(messagePayload, "snr", snr);
-
-        cJSON* mode = cJSON_CreateString(freeDVModeAsString_());
-        assert(mode != nullptr);
-        cJSON_AddItemToObject(messagePayload, "mode", mode);
+        return;
+    }
 
-        cJSON_AddItemToArray(outMessage, messagePayload);
+    // Only the most recent report for a given station matters.
+    for (auto iter = spool_.begin(); iter != spool_.end(); iter++)
+    {
+        if (iter->callsign == message->callsign)
+        {
+            spool_.erase(iter);
+            break;
+        }
+    }
 
-        auto tmp = cJSON_PrintUnformatted(outMessage);
+    if (spool_.size() >= SPOOL_MAX_REPORTS)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Spool full, dropping report for %s", spool_.front().callsign.c_str());
+        spool_.pop_front();
+    }
 
-        std::string messageToSend = SOCKET_IO_TX_PREFIX;
-        messageToSend += tmp;
-        esp_websocket_client_send_text(reportingClientHandle_, messageToSend.c_str(), messageToSend.length(), portMAX_DELAY);
+    SpooledReport report;
+    report.callsign = message->callsign;
+    report.snr = (int)message->snr;
+    report.mode = freeDVModeAsString_();
+    report.timeUs = esp_timer_get_time();
+    spool_.push_back(report);
 
-        cJSON_free(tmp);
-        cJSON_Delete(outMessage);        
-    }
+    flushSpool_();
 }
 
-void FreeDVReporterTask::onReportFrequencyChangeMessage_(DVTask* origin, ReportFrequencyChangeMessage* message)
+void FreeDVReporterTask::onReportStationStateMessage_(DVTask* origin, ReportStationStateMessage* message)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Got frequency update: %" PRIu64, message->frequencyHz);
     frequencyHz_ = message->frequencyHz;
-    if (reportingEnabled_)
+    freeDVMode_ = message->mode;
+    pttState_ = message->pttState;
+
+    uint8_t updates = 0;
+    if (message->changed & ReportStationStateMessage::FREQUENCY)
     {
-        sendFrequencyUpdate_();
+        updates |= UPDATE_FREQUENCY;
     }
-}
-
-void FreeDVReporterTask::onSetPTTState_(DVTask* origin, audio::FreeDVSetPTTStateMessage* message)
-{
-    ESP_LOGI(CURRENT_LOG_TAG, "Got PTT update: %d", message->pttState);
-    pttState_ = message->pttState;
-    if (reportingEnabled_)
+    if (message->changed & (ReportStationStateMessage::MODE | ReportStationStateMessage::PTT))
     {
-        sendTransmitStateUpdate_();
+        updates |= UPDATE_TRANSMIT_STATE;
     }
-}
 
-void FreeDVReporterTask::onSetFreeDVMode_(DVTask* origin, audio::SetFreeDVModeMessage* message)
-{
-    ESP_LOGI(CURRENT_LOG_TAG, "Got mode update: %d", message->mode);
-    freeDVMode_ = message->mode;
-    if (reportingEnabled_)
+    if (updates != 0)
     {
-        sendTransmitStateUpdate_();
+        queueUpdate_(updates);
     }
 }
 
@@ -258,7 +285,7 @@ void FreeDVReporterTask::onWebsocketConnectedMessage_(DVTask* origin, WebsocketC
     auto tmp = cJSON_PrintUnformatted(jsonAuthObj_);
     namespaceOpen += tmp;
     cJSON_free(tmp);
-    esp_websocket_client_send_text(reportingClientHandle_, namespaceOpen.c_str(), namespaceOpen.length(), portMAX_DELAY);
+    sendText_(namespaceOpen.c_str(), namespaceOpen.length());
 }
 
 void FreeDVReporterTask::onWebsocketDisconnectedMessage_(DVTask* origin, WebsocketDisconnectedMessage* message)
@@ -361,7 +388,7 @@ void FreeDVReporterTask::handleEngineIoMessage_(char* ptr, int length)
             ESP_LOGI(CURRENT_LOG_TAG, "engine.io ping");
 
             // "ping" -- send pong
-            esp_websocket_client_send_text(reportingClientHandle_, "3", 1, portMAX_DELAY);
+            sendText_("3", 1);
             break;
         }
         case '4':
@@ -399,9 +426,11 @@ void FreeDVReporterTask::handleSocketIoMessage_(char* ptr, int length)
 
             // connection successful
             reportingEnabled_ = true;
-            sendFrequencyUpdate_();
-            sendTransmitStateUpdate_();
-            sendReportingMessageUpdate_();
+
+            // The server has no state for us yet, so send everything.
+            // Anything spooled while we were disconnected follows.
+            pendingUpdates_ = UPDATE_FREQUENCY | UPDATE_TRANSMIT_STATE | UPDATE_MESSAGE;
+            flushSpool_();
             break;
         }
         case '2':
@@ -434,7 +463,7 @@ void FreeDVReporterTask::stopSocketIoConnection_()
         if (esp_websocket_client_is_connected(reportingClientHandle_))
         {
             const char* engineIoDisconnectMessage = "1";
-            esp_websocket_client_send_text(reportingClientHandle_, engineIoDisconnectMessage, strlen(engineIoDisconnectMessage), portMAX_DELAY);
+            sendText_(engineIoDisconnectMessage, strlen(engineIoDisconnectMessage));
             esp_websocket_client_stop(reportingClientHandle_);
         }
 
@@ -479,101 +508,143 @@ void FreeDVReporterTask::stopSocketIoConnection_()
     }
     reportingClientHandle_ = nullptr;
     reportingEnabled_ = false;
+    replayTimer_.stop();
     ESP_LOGI(CURRENT_LOG_TAG, "socket.io connection stopped");
 }
 
-void FreeDVReporterTask::sendReportingMessageUpdate_()
+void FreeDVReporterTask::queueUpdate_(uint8_t update)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Sending reporting message update");
+    // Only the latest state is ever sent, so repeated changes while
+    // disconnected collapse into a single update.
+    pendingUpdates_ |= update;
+    flushSpool_();
+}
 
-    cJSON* message = cJSON_CreateArray();
-    assert(message != nullptr);
+void FreeDVReporterTask::clearSpool_()
+{
+    spool_.clear();
+    pendingUpdates_ = 0;
+    replayTimer_.stop();
+}
 
-    cJSON* messageName = cJSON_CreateString("message_update");
-    assert(messageName != nullptr);
-    cJSON_AddItemToArray(message, messageName);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+void FreeDVReporterTask::onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message)
+{
+    uint64_t intervalMs = REPLAY_INTERVAL_MS;
+    if (message->level >= telemetry::LoadSheddingMessage::SHED_BACKGROUND)
+    {
+        intervalMs *= REPLAY_LOAD_SHED_MULTIPLIER;
+    }
+    replayTimer_.changeInterval(MS_TO_US(intervalMs));
+}
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 
-    cJSON* messagePayload = cJSON_CreateObject();
-    assert(messagePayload != nullptr);
+void FreeDVReporterTask::onReplayTimer_(DVTimer*)
+{
+    flushSpool_();
+}
 
-    cJSON* reportingMessage = cJSON_CreateString(message_.c_str());
-    assert(reportingMessage != nullptr);
-    cJSON_AddItemToObject(messagePayload, "message", reportingMessage);
+void FreeDVReporterTask::flushSpool_()
+{
+    if (!reportingEnabled_)
+    {
+        return;
+    }
 
-    cJSON_AddItemToArray(message, messagePayload);
+    // State updates go first as the server expects to know our mode
+    // before any reports.
+    if ((pendingUpdates_ & UPDATE_FREQUENCY) && sendFrequencyUpdate_())
+    {
+        pendingUpdates_ &= ~UPDATE_FREQUENCY;
+    }
+    if ((pendingUpdates_ & UPDATE_TRANSMIT_STATE) && sendTransmitStateUpdate_())
+    {
+        pendingUpdates_ &= ~UPDATE_TRANSMIT_STATE;
+    }
+    if ((pendingUpdates_ & UPDATE_MESSAGE) && sendReportingMessageUpdate_())
+    {
+        pendingUpdates_ &= ~UPDATE_MESSAGE;
+    }
 
-    auto tmp = cJSON_PrintUnformatted(message);
+    int numSent = 0;
+    auto now = esp_timer_get_time();
+    while (pendingUpdates_ == 0 && !spool_.empty() && numSent < REPLAY_BATCH_SIZE)
+    {
+        auto& report = spool_.front();
+        if ((now - report.timeUs) < MS_TO_US(SPOOL_MAX_AGE_MS))
+        {
+            if (!sendReceiveReport_(report))
+            {
+                break;
+            }
+            numSent++;
+        }
+        else
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Report for %s is too old, dropping", report.callsign.c_str());
+        }
 
-    std::string messageToSend = SOCKET_IO_TX_PREFIX;
-    messageToSend += tmp;
-    esp_websocket_client_send_text(reportingClientHandle_, messageToSend.c_str(), messageToSend.length(), portMAX_DELAY);
+        spool_.pop_front();
+    }
 
-    cJSON_free(tmp);
-    cJSON_Delete(message);
+    // Try again shortly if anything's left (or failed to send).
+    if (pendingUpdates_ != 0 || !spool_.empty())
+    {
+        replayTimer_.restart(true);
+    }
 }
 
-void FreeDVReporterTask::sendFrequencyUpdate_()
+bool FreeDVReporterTask::sendText_(const char* str, int length)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Sending frequency update");
-
-    cJSON* message = cJSON_CreateArray();
-    assert(message != nullptr);
+    if (esp_websocket_client_send_text(reportingClientHandle_, str, length, pdMS_TO_TICKS(SEND_TIMEOUT_MS)) < 0)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Timed out sending message to server");
+        return false;
+    }
 
-    cJSON* messageName = cJSON_CreateString("freq_change");
-    assert(messageName != nullptr);
-    cJSON_AddItemToArray(message, messageName);
+    return true;
+}
 
-    cJSON* messagePayload = cJSON_CreateObject();
-    assert(messagePayload != nullptr);
+template<typename... Members>
+bool FreeDVReporterTask::sendSocketIoEvent_(const char* eventName, Members... members)
+{
+    const int prefixLength = strlen(SOCKET_IO_TX_PREFIX);
+    memcpy(txBuffer_, SOCKET_IO_TX_PREFIX, prefixLength);
 
-    cJSON* frequency = cJSON_CreateNumber(frequencyHz_);
-    assert(frequency != nullptr);
-    cJSON_AddItemToObject(messagePayload, "freq", frequency);
+    util::JsonWriter writer(txBuffer_ + prefixLength, TX_BUFFER_SIZE - prefixLength);
+    writer.beginArray().value(eventName).beginObject().members(members...).endObject().endArray();
+    if (!writer.ok())
+    {
+        // Retrying won't make it fit.
+        ESP_LOGE(CURRENT_LOG_TAG, "%s event is too large to send", eventName);
+        return true;
+    }
 
-    cJSON_AddItemToArray(message, messagePayload);
+    return sendText_(txBuffer_, prefixLength + writer.length());
+}
 
-    auto tmp = cJSON_PrintUnformatted(message);
+bool FreeDVReporterTask::sendReceiveReport_(const SpooledReport& report)
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending RX report for %s", report.callsign.c_str());
+    return sendSocketIoEvent_("rx_report", "callsign", report.callsign, "snr", report.snr, "mode", report.mode);
+}
 
-    std::string messageToSend = SOCKET_IO_TX_PREFIX;
-    messageToSend += tmp;
-    esp_websocket_client_send_text(reportingClientHandle_, messageToSend.c_str(), messageToSend.length(), portMAX_DELAY);
+bool FreeDVReporterTask::sendReportingMessageUpdate_()
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending reporting message update");
+    return sendSocketIoEvent_("message_update", "message", message_);
+}
 
-    cJSON_free(tmp);
-    cJSON_Delete(message);
+bool FreeDVReporterTask::sendFrequencyUpdate_()
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending frequency update");
+    return sendSocketIoEvent_("freq_change", "freq", frequencyHz_);
 }
 
-void FreeDVReporterTask::sendTransmitStateUpdate_()
+bool FreeDVReporterTask::sendTransmitStateUpdate_()
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Sending PTT update");
-
-    cJSON* message = cJSON_CreateArray();
-    assert(message != nullptr);
-
-    cJSON* messageName = cJSON_CreateString("tx_report");
-    assert(messageName != nullptr);
-    cJSON_AddItemToArray(message, messageName);
-
-    cJSON* messagePayload = cJSON_CreateObject();
-    assert(messagePayload != nullptr);
-
-    cJSON* mode = cJSON_CreateString(freeDVModeAsString_());
-    assert(mode != nullptr);
-    cJSON_AddItemToObject(messagePayload, "mode", mode);
-
-    cJSON* transmitting = cJSON_CreateBool(pttState_);
-    assert(transmitting != nullptr);
-    cJSON_AddItemToObject(messagePayload, "transmitting", transmitting);
-
-    cJSON_AddItemToArray(message, messagePayload);
-
-    auto tmp = cJSON_PrintUnformatted(message);
-
-    std::string messageToSend = SOCKET_IO_TX_PREFIX;
-    messageToSend += tmp;
-    esp_websocket_client_send_text(reportingClientHandle_, messageToSend.c_str(), messageToSend.length(), portMAX_DELAY);
-
-    cJSON_free(tmp);
-    cJSON_Delete(message);
+    return sendSocketIoEvent_("tx_report", "mode", freeDVModeAsString_(), "transmitting", pttState_);
 }
 
 void FreeDVReporterTask::WebsocketEventHandler_(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
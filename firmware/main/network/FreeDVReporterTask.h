@@ -18,6 +18,10 @@
 #ifndef FREEDV_REPORTER_TASK_H
 #define FREEDV_REPORTER_TASK_H
 
+#include <deque>
+#include <string>
+
+#include "sdkconfig.h"
 #include "esp_websocket_client.h"
 
 #include "task/DVTask.h"
@@ -26,6 +30,10 @@
 #include "audio/FreeDVMessage.h"
 #include "storage/SettingsMessage.h"
 
+#if CONFIG_EZDV_LOAD_GOVERNOR
+#include "telemetry/TelemetryMessage.h"
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
 struct cJSON; // forward declaration
 
 namespace ezdv
@@ -79,7 +87,23 @@ private:
     using WebsocketDisconnectedMessage = SocketIoMessageCommon<WEBSOCKET_DISCONNECTED>;
     using WebsocketDataMessage = SocketIoMessageCommon<WEBSOCKET_MESSAGE>;
 
+    enum PendingUpdate
+    {
+        UPDATE_FREQUENCY = 0x01,
+        UPDATE_TRANSMIT_STATE = 0x02,
+        UPDATE_MESSAGE = 0x04,
+    };
+
+    struct SpooledReport
+    {
+        std::string callsign;
+        int snr;
+        const char* mode;
+        int64_t timeUs;
+    };
+
     DVTimer reconnectTimer_;
+    DVTimer replayTimer_;
     esp_websocket_client_handle_t reportingClientHandle_;
     cJSON* jsonAuthObj_;
     bool reportingEnabled_;
@@ -96,17 +120,23 @@ private:
     int pingTimeoutMs_;
     bool isConnecting_;
 
+    // Events waiting to go out (e.g. while disconnected).
+    uint8_t pendingUpdates_;
+    std::deque<SpooledReport> spool_;
+    char* txBuffer_;
+
     void onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message);
     void onEnableReportingMessage_(DVTask* origin, EnableReportingMessage* message);
     void onDisableReportingMessage_(DVTask* origin, DisableReportingMessage* message);
     void onFreeDVCallsignReceivedMessage_(DVTask* origin, audio::FreeDVReceivedCallsignMessage* message);
-    void onReportFrequencyChangeMessage_(DVTask* origin, ReportFrequencyChangeMessage* message);
-    void onSetPTTState_(DVTask* origin, audio::FreeDVSetPTTStateMessage* message);
-    void onSetFreeDVMode_(DVTask* origin, audio::SetFreeDVModeMessage* message);
+    void onReportStationStateMessage_(DVTask* origin, ReportStationStateMessage* message);
 
     void onWebsocketConnectedMessage_(DVTask* origin, WebsocketConnectedMessage* message);
     void onWebsocketDisconnectedMessage_(DVTask* origin, WebsocketDisconnectedMessage* message);
     void onWebsocketDataMessage_(DVTask* origin, WebsocketDataMessage* message);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    void onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 
     const char* freeDVModeAsString_();
 
@@ -115,9 +145,18 @@ private:
     void handleEngineIoMessage_(char* ptr, int length);
     void handleSocketIoMessage_(char* ptr, int length);
 
-    void sendFrequencyUpdate_();
-    void sendTransmitStateUpdate_();
-    void sendReportingMessageUpdate_();
+    void queueUpdate_(uint8_t update);
+    void clearSpool_();
+    void onReplayTimer_(DVTimer*);
+    void flushSpool_();
+
+    bool sendText_(const char* str, int length);
+    template<typename... Members>
+    bool sendSocketIoEvent_(const char* eventName, Members... members);
+    bool sendReceiveReport_(const SpooledReport& report);
+    bool sendFrequencyUpdate_();
+    bool sendTransmitStateUpdate_();
+    bool sendReportingMessageUpdate_();
 
     static void WebsocketEventHandler_(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
 };
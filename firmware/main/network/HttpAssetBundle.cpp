@@ -0,0 +1,148 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <cstdlib>
+
+#include "esp_log.h"
+
+#include "HttpAssetBundle.h"
+#include "util/BootTimeline.h"
+
+#define CURRENT_LOG_TAG "HttpAssetBundle"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+HttpAssetBundle::HttpAssetBundle()
+    : mmapHandle_(0)
+    , base_(nullptr)
+    , header_(nullptr)
+    , entries_(nullptr)
+{
+    // empty
+}
+
+HttpAssetBundle::~HttpAssetBundle()
+{
+    close();
+}
+
+bool HttpAssetBundle::open(const char* partitionLabel)
+{
+    util::BootTimeline::Step step("web ui mount");
+
+    close();
+
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partitionLabel);
+    if (partition == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not find partition %s", partitionLabel);
+        return false;
+    }
+
+    // Check the header before mapping, so that we only map what's in use.
+    Header header;
+    ESP_ERROR_CHECK(esp_partition_read(partition, 0, &header, sizeof(header)));
+    if (header.magic != MAGIC || header.version != VERSION ||
+        header.etag[ETAG_LENGTH - 1] != 0 ||
+        header.totalSize < sizeof(Header) + header.numEntries * sizeof(Entry) ||
+        header.totalSize > partition->size)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Partition %s doesn't contain a valid web UI bundle", partitionLabel);
+        return false;
+    }
+
+    const void* ptr = nullptr;
+    esp_err_t err = esp_partition_mmap(partition, 0, header.totalSize, ESP_PARTITION_MMAP_DATA, &ptr, &mmapHandle_);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not map partition %s: %s", partitionLabel, esp_err_to_name(err));
+        return false;
+    }
+
+    base_ = (const uint8_t*)ptr;
+    header_ = (const Header*)base_;
+    entries_ = (const Entry*)(base_ + sizeof(Header));
+
+    // Don't trust anything that would point outside of the bundle.
+    for (int index = 0; index < header_->numEntries; index++)
+    {
+        const Entry& entry = entries_[index];
+        if (entry.offset > header_->totalSize || entry.length > header_->totalSize - entry.offset ||
+            entry.name[NAME_LENGTH - 1] != 0)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Web UI bundle in %s is corrupt", partitionLabel);
+            close();
+            return false;
+        }
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Mapped %d files (%" PRIu32 " bytes) from %s", header_->numEntries, header_->totalSize, partitionLabel);
+    return true;
+}
+
+void HttpAssetBundle::close()
+{
+    if (base_ != nullptr)
+    {
+        esp_partition_munmap(mmapHandle_);
+        mmapHandle_ = 0;
+        base_ = nullptr;
+        header_ = nullptr;
+        entries_ = nullptr;
+    }
+}
+
+bool HttpAssetBundle::isOpen() const
+{
+    return base_ != nullptr;
+}
+
+bool HttpAssetBundle::find(const char* name, const uint8_t*& data, uint32_t& length) const
+{
+    if (header_ == nullptr)
+    {
+        return false;
+    }
+
+    auto entry = (const Entry*)bsearch(
+        name, entries_, header_->numEntries, sizeof(Entry), 
+        [](const void* key, const void* item) {
+            return strcmp((const char*)key, ((const Entry*)item)->name);
+        });
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    data = base_ + entry->offset;
+    length = entry->length;
+    return true;
+}
+
+const char* HttpAssetBundle::getETag() const
+{
+    return header_ != nullptr ? header_->etag : "";
+}
+
+}
+
+}
@@ -0,0 +1,98 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_ASSET_BUNDLE_H
+#define HTTP_ASSET_BUNDLE_H
+
+#include <cinttypes>
+
+#include "esp_partition.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Read-only view of the web UI files packed into an http_* partition
+///        by main/tools/make_http_bundle.py. The partition is memory mapped,
+///        so files can be sent straight from flash without a filesystem.
+class HttpAssetBundle
+{
+public:
+    HttpAssetBundle();
+    virtual ~HttpAssetBundle();
+
+    /// @brief Maps the bundle in the given partition.
+    /// @return false if the partition doesn't contain a valid bundle.
+    bool open(const char* partitionLabel);
+
+    /// @brief Returns true if a bundle is currently mapped.
+    bool isOpen() const;
+
+    /// @brief Unmaps the bundle. Pointers returned by find() are no longer valid.
+    void close();
+
+    /// @brief Looks up a file by name (without leading slash).
+    /// @param name The file to find.
+    /// @param data Set to the file's contents in mapped flash.
+    /// @param length Set to the file's length.
+    /// @return false if the file isn't in the bundle.
+    bool find(const char* name, const uint8_t*& data, uint32_t& length) const;
+
+    /// @brief Returns the ETag the build gave this set of files (unquoted; empty if none).
+    const char* getETag() const;
+
+private:
+    enum 
+    { 
+        MAGIC = 0x42575A45, // "EZWB" read as a little-endian uint32_t
+        VERSION = 1,
+        NAME_LENGTH = 32,
+        ETAG_LENGTH = 20,
+    };
+
+    struct Header
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t numEntries;
+        char etag[ETAG_LENGTH];
+        uint32_t totalSize;
+    };
+
+    struct Entry
+    {
+        char name[NAME_LENGTH];
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    static_assert(sizeof(Header) == 32);
+    static_assert(sizeof(Entry) == 40);
+
+    esp_partition_mmap_handle_t mmapHandle_;
+    const uint8_t* base_;
+    const Header* header_;
+    const Entry* entries_; // sorted by name
+};
+
+}
+
+}
+
+#endif // HTTP_ASSET_BUNDLE_H
@@ -0,0 +1,182 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+#include "HttpFileServerTask.h"
+
+#define CURRENT_LOG_TAG ("HttpFileServerTask")
+
+// Files up to this size are sent in one go (with a Content-Length header); 
+// larger ones are sent this much at a time using chunked encoding.
+#define HTTP_FILE_CHUNK_SIZE (4096)
+
+extern "C"
+{
+    DV_EVENT_DEFINE_BASE(HTTP_FILE_SERVER_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace network
+{
+
+HttpFileServerTask::HttpFileServerTask(const char* name, BaseType_t pinnedCoreId)
+    : DVTask(name, 2, 4096, pinnedCoreId, 32)
+    , isRunning_(false)
+    , numTransfers_(0)
+    , numActive_(0)
+{
+    registerMessageHandlers<&HttpFileServerTask::onServeFileMessage_>(this);
+
+    // A request that never makes it into the queue still has to be 
+    // completed, or its socket and transfer slot are never freed.
+    setMessageOverflowPolicy<ServeFileMessage>(OVERFLOW_BLOCK, &OnServeFileDropped_);
+}
+
+void HttpFileServerTask::serve(const uint8_t* data, uint32_t length, httpd_req_t* request)
+{
+    numTransfers_++;
+
+    ServeFileMessage message(this, data, length, request);
+    post(&message);
+}
+
+void HttpFileServerTask::onTaskStart_()
+{
+    isRunning_ = true;
+}
+
+void HttpFileServerTask::onTaskSleep_()
+{
+    // Anything still queued gets dropped as it comes through (see 
+    // onServeFileMessage_()).
+    isRunning_ = false;
+
+    for (auto& message : waiting_)
+    {
+        ESP_ERROR_CHECK(httpd_req_async_handler_complete(message.request));
+        numTransfers_--;
+    }
+    waiting_.clear();
+}
+
+void HttpFileServerTask::onServeFileMessage_(DVTask* origin, ServeFileMessage* message)
+{
+    if (!isRunning_)
+    {
+        finishTransfer_(message);
+        return;
+    }
+
+    if (!message->started)
+    {
+        if (numActive_ >= CONFIG_EZDV_HTTP_FILE_TRANSFERS_PER_WORKER)
+        {
+            waiting_.push_back(*message);
+            return;
+        }
+
+        message->started = true;
+        numActive_++;
+    }
+
+    sendNextChunk_(message);
+}
+
+void HttpFileServerTask::sendNextChunk_(ServeFileMessage* message)
+{
+    if (message->offset == 0 && message->length <= HTTP_FILE_CHUNK_SIZE)
+    {
+        if (httpd_resp_send(message->request, (const char*)message->data, message->length) != ESP_OK)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Sending %s failed!", message->request->uri);
+        }
+        else
+        {
+            ESP_LOGI(CURRENT_LOG_TAG, "Sending %s complete", message->request->uri);
+        }
+        finishTransfer_(message);
+        return;
+    }
+
+    uint32_t chunkSize = message->length - message->offset;
+    if (chunkSize > HTTP_FILE_CHUNK_SIZE)
+    {
+        chunkSize = HTTP_FILE_CHUNK_SIZE;
+    }
+
+    if (chunkSize == 0)
+    {
+        httpd_resp_send_chunk(message->request, nullptr, 0);
+        ESP_LOGI(CURRENT_LOG_TAG, "Sending %s complete", message->request->uri);
+        finishTransfer_(message);
+    }
+    else if (httpd_resp_send_chunk(message->request, (const char*)message->data + message->offset, chunkSize) != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Sending %s failed!", message->request->uri);
+        finishTransfer_(message);
+    }
+    else
+    {
+        // Go to the back of the line so other transfers get a turn.
+        message->offset += chunkSize;
+        post(message);
+    }
+}
+
+void HttpFileServerTask::finishTransfer_(ServeFileMessage* message)
+{
+    ESP_ERROR_CHECK(httpd_req_async_handler_complete(message->request));
+    numTransfers_--;
+
+    if (!message->started)
+    {
+        return;
+    }
+
+    // The next waiting transfer, if any, starts in this one's place.
+    if (!waiting_.empty() && isRunning_)
+    {
+        // Taken off the list first, as a failed post finishes it right away.
+        ServeFileMessage next = waiting_.front();
+        waiting_.pop_front();
+        next.started = true;
+        post(&next);
+    }
+    else
+    {
+        numActive_--;
+    }
+}
+
+void HttpFileServerTask::OnServeFileDropped_(DVTaskMessage* message)
+{
+    // Runs in the poster's context. Transfers that have started are only
+    // ever posted by the worker itself, so only it touches waiting_.
+    ServeFileMessage* serveMessage = (ServeFileMessage*)message;
+    ESP_LOGW(CURRENT_LOG_TAG, "Couldn't queue transfer of %s, dropping it", serveMessage->request->uri);
+    serveMessage->worker->finishTransfer_(serveMessage);
+}
+
+}
+
+}
@@ -0,0 +1,112 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_FILE_SERVER_TASK_H
+#define HTTP_FILE_SERVER_TASK_H
+
+#include <atomic>
+#include <deque>
+
+#include "esp_http_server.h"
+
+#include "task/DVTask.h"
+#include "task/DVTaskMessage.h"
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(HTTP_FILE_SERVER_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace network
+{
+
+using namespace ezdv::task;
+
+/// @brief Sends static file responses for HttpServerTask so that page loads
+///        don't hold up websocket traffic. Transfers are sent a chunk at a
+///        time and interleaved, with at most CONFIG_EZDV_HTTP_FILE_TRANSFERS_PER_WORKER
+///        in progress; any others wait their turn.
+class HttpFileServerTask : public DVTask
+{
+public:
+    /// @brief Creates a worker.
+    /// @param name The task's name (must remain valid for the task's lifetime).
+    /// @param pinnedCoreId The core to run on.
+    HttpFileServerTask(const char* name, BaseType_t pinnedCoreId);
+    virtual ~HttpFileServerTask() = default;
+
+    /// @brief Queues a response. Safe to call from the HTTP server's task.
+    /// @param data The file's contents (must remain valid until sent).
+    /// @param length The length of the file.
+    /// @param request Async copy of the request; completed once sent.
+    void serve(const uint8_t* data, uint32_t length, httpd_req_t* request);
+
+    /// @brief Returns the number of transfers in progress or waiting.
+    int getNumTransfers() const { return numTransfers_.load(std::memory_order_relaxed); }
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    enum HttpFileServerMessageId
+    {
+        SERVE_FILE = 1,
+    };
+
+    class ServeFileMessage : public DVTaskMessageBase<SERVE_FILE, ServeFileMessage>
+    {
+    public:
+        ServeFileMessage(HttpFileServerTask* workerProvided = nullptr, const uint8_t* dataProvided = nullptr, uint32_t lengthProvided = 0, httpd_req_t* reqProvided = nullptr)
+            : DVTaskMessageBase<SERVE_FILE, ServeFileMessage>(HTTP_FILE_SERVER_MESSAGE)
+            , worker(workerProvided)
+            , data(dataProvided)
+            , length(lengthProvided)
+            , request(reqProvided)
+            , offset(0)
+            , started(false)
+            {}
+        virtual ~ServeFileMessage() = default;
+
+        HttpFileServerTask* worker; // for OnServeFileDropped_()
+        const uint8_t* data;
+        uint32_t length;
+        httpd_req_t* request;
+        uint32_t offset;
+        bool started; // counted in numActive_
+    };
+
+    bool isRunning_;
+    std::atomic<int> numTransfers_;
+    int numActive_;
+    std::deque<ServeFileMessage> waiting_;
+
+    void onServeFileMessage_(DVTask* origin, ServeFileMessage* message);
+    void sendNextChunk_(ServeFileMessage* message);
+    void finishTransfer_(ServeFileMessage* message);
+
+    static void OnServeFileDropped_(DVTaskMessage* message);
+};
+
+}
+
+}
+
+#endif // HTTP_FILE_SERVER_TASK_H
@@ -26,7 +26,6 @@
 
 #include "esp_err.h"
 #include "esp_vfs.h"
-#include "esp_spiffs.h"
 
 #include "esp_partition.h"
 #include "esp_ota_ops.h"
@@ -36,7 +35,15 @@
 
 #include "HttpServerTask.h"
 #include "NetworkMessage.h"
+#include "NetworkQos.h"
+#include "PacketCapture.h"
+#include "UploadBufferPool.h"
+#include "audio/RecordingStore.h"
+#include "audio/VoiceKeyerUploadTask.h"
 #include "storage/SettingsMessage.h"
+#include "storage/SoftwareUpdateTask.h"
+#include "util/BootTimeline.h"
+#include "util/EventTrace.h"
 
 extern "C"
 {
@@ -45,9 +52,23 @@ extern "C"
 
 /* Max length a file path can have on storage */
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
-#define SCRATCH_BUFSIZE 4096
 #define CURRENT_LOG_TAG "HttpServerTask"
 
+// Big enough for everything but telemetry reports and Wi-Fi scan results.
+#define JSON_BUFFER_SIZE (2048)
+
+#define JSON_STATUS_TYPE "status"
+
+// Status changes are held back for at least this long after sending one.
+#define STATUS_HOLDOFF_US (1000000 / CONFIG_EZDV_HTTP_STATUS_RATE_HZ)
+
+// How long to wait for each voice keyer or firmware chunk to be accepted.
+#define UPLOAD_TIMEOUT_MS (5000)
+
+// Static files are sent from the same core as the network stack, away 
+// from FreeDVTask.
+#define HTTP_FILE_SERVER_CORE (1)
+
 #define JSON_BATTERY_STATUS_TYPE "batteryStatus"
 #define JSON_WIFI_STATUS_TYPE "wifiInfo"
 #define JSON_WIFI_SAVED_TYPE "wifiSaved"
@@ -65,6 +86,7 @@ extern "C"
 #define JSON_LED_BRIGHTNESS_SAVED_TYPE "ledBrightnessSaved"
 
 #define JSON_FIRMWARE_UPLOAD_COMPLETE "firmwareUploadComplete"
+#define JSON_UPLOAD_CREDIT_TYPE "uploadCredit"
 
 #define JSON_CURRENT_MODE_TYPE "currentMode"
 
@@ -73,6 +95,15 @@ extern "C"
 #define JSON_FLEX_RADIO_DISCOVERED_TYPE "flexRadioDiscovered"
 
 #define JSON_WIFI_SCAN_RESULTS_TYPE "wifiScanResults"
+#define JSON_WIFI_SCAN_CHANGES_TYPE "wifiScanChanges"
+
+#define JSON_TELEMETRY_TYPE "telemetry"
+
+#define JSON_SETTINGS_SNAPSHOT_TYPE "settingsSnapshot"
+
+#define JSON_BOOT_TIMELINE_TYPE "bootTimeline"
+
+#define JSON_LATENCY_PROBE_RESULT_TYPE "latencyProbeResult"
 
 extern void StartSleeping();
 
@@ -86,56 +117,136 @@ HttpServerTask::HttpServerTask()
     : ezdv::task::DVTask("HttpServerTask", 4, 4096, tskNO_AFFINITY, 256)
     , firmwareUploadInProgress_(false)
     , isRunning_(false)
+    , spectrumEnabled_(false)
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    , spectrumShed_(false)
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+    , audioMonitorEnabled_(false)
+    , jsonBuffer_(nullptr)
+    , statusDirty_(false)
+    , statusHoldoff_(false)
+    , statusTimer_(this, this, &HttpServerTask::onStatusTimer_, STATUS_HOLDOFF_US, "HttpStatusTimer")
+    , sendQueue_(&OnWebSocketSendComplete_, this)
+    , uploadSocket_(-1)
+    , uploadCreditsGranted_(0)
 {
-    registerMessageHandler(this, &HttpServerTask::onBatteryStateMessage_);
-    
-    // HTTP handlers called from web socket
-    registerMessageHandler(this, &HttpServerTask::onHttpWebsocketConnectedMessage_);
-    registerMessageHandler(this, &HttpServerTask::onHttpWebsocketDisconnectedMessage_);
-    registerMessageHandler(this, &HttpServerTask::onUpdateWifiMessage_);
-    registerMessageHandler(this, &HttpServerTask::onUpdateRadioMessage_);
-    registerMessageHandler(this, &HttpServerTask::onUpdateVoiceKeyerMessage_);
+    assetETag_[0] = 0;
 
-    registerMessageHandler(this, &HttpServerTask::onBeginUploadVoiceKeyerFileMessage_);
-    registerMessageHandler(this, &HttpServerTask::onFileUploadCompleteMessage_);
+    static const char* FileServerNames[] = { "HttpFileServer1", "HttpFileServer2" };
+    static_assert(CONFIG_EZDV_HTTP_FILE_WORKERS <= sizeof(FileServerNames) / sizeof(FileServerNames[0]), "Not enough file server names");
+    for (int index = 0; index < CONFIG_EZDV_HTTP_FILE_WORKERS; index++)
+    {
+        fileServers_[index] = new HttpFileServerTask(FileServerNames[index], HTTP_FILE_SERVER_CORE);
+        assert(fileServers_[index] != nullptr);
+    }
 
-    registerMessageHandler(this, &HttpServerTask::onUpdateReportingMessage_);
-    registerMessageHandler(this, &HttpServerTask::onUpdateLedBrightnessMessage_);
-    
-    registerMessageHandler(this, &HttpServerTask::onFirmwareUpdateCompleteMessage_);
+    jsonBuffer_ = (char*)heap_caps_malloc(JSON_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(jsonBuffer_ != nullptr);
 
-    registerMessageHandler(this, &HttpServerTask::onSetModeMessage_);
-    registerMessageHandler(this, &HttpServerTask::onSetFreeDVModeMessage_);
+    statusTimer_.useTimerWheel();
 
-    registerMessageHandler(this, &HttpServerTask::onStartStopVoiceKeyerMessage_);
-    registerMessageHandler(this, &HttpServerTask::onStartVoiceKeyerMessage_);
-    registerMessageHandler(this, &HttpServerTask::onStopVoiceKeyerMessage_);
-    registerMessageHandler(this, &HttpServerTask::onVoiceKeyerCompleteMessage_);
+    registerMessageHandlers<&HttpServerTask::onBatteryStateMessage_>(this);
     
-    registerMessageHandler(this, &HttpServerTask::onFlexRadioDiscoveredMessage_);
+    // HTTP handlers called from web socket
+    registerMessageHandlers<
+        &HttpServerTask::onHttpWebsocketConnectedMessage_,
+        &HttpServerTask::onHttpWebsocketDisconnectedMessage_,
+        &HttpServerTask::onWebSocketSendCompleteMessage_,
+        &HttpServerTask::onUpdateWifiMessage_,
+        &HttpServerTask::onUpdateRadioMessage_,
+        &HttpServerTask::onUpdateVoiceKeyerMessage_>(this);
+
+    registerMessageHandlers<
+        &HttpServerTask::onBeginUploadVoiceKeyerFileMessage_,
+        &HttpServerTask::onBeginUploadFirmwareFileMessage_,
+        &HttpServerTask::onUploadCreditMessage_,
+        &HttpServerTask::onFileUploadCompleteMessage_>(this);
+
+    registerMessageHandlers<
+        &HttpServerTask::onUpdateReportingMessage_,
+        &HttpServerTask::onUpdateLedBrightnessMessage_>(this);
     
-    registerMessageHandler(this, &HttpServerTask::onRebootDeviceMessage_);
-
-    registerMessageHandler(this, &HttpServerTask::onStartWifiScanMessage_);
-    registerMessageHandler(this, &HttpServerTask::onStopWifiScanMessage_);
-    registerMessageHandler(this, &HttpServerTask::onWifiNetworkListMessage_);
-
-    registerMessageHandler(this, &HttpServerTask::onHttpServeStaticFileMessage_);
+    registerMessageHandlers<&HttpServerTask::onFirmwareUpdateCompleteMessage_>(this);
+
+    registerMessageHandlers<
+        &HttpServerTask::onWifiSettingsMessage_,
+        &HttpServerTask::onRadioSettingsMessage_,
+        &HttpServerTask::onVoiceKeyerSettingsMessage_,
+        &HttpServerTask::onReportingSettingsMessage_,
+        &HttpServerTask::onLedBrightnessSettingsMessage_>(this);
+
+    registerMessageHandlers<
+        &HttpServerTask::onSetModeMessage_,
+        &HttpServerTask::onSetFreeDVModeMessage_>(this);
+
+    registerMessageHandlers<
+        &HttpServerTask::onStartStopVoiceKeyerMessage_,
+        &HttpServerTask::onStartVoiceKeyerMessage_,
+        &HttpServerTask::onStopVoiceKeyerMessage_,
+        &HttpServerTask::onVoiceKeyerCompleteMessage_>(this);
+    
+    registerMessageHandlers<&HttpServerTask::onFlexRadioDiscoveredMessage_>(this);
+    
+    registerMessageHandlers<&HttpServerTask::onRebootDeviceMessage_>(this);
+
+    registerMessageHandlers<
+        &HttpServerTask::onStartWifiScanMessage_,
+        &HttpServerTask::onStopWifiScanMessage_,
+        &HttpServerTask::onWifiNetworkListMessage_>(this);
+
+#if CONFIG_EZDV_RX_RECORDER
+    registerMessageHandlers<&HttpServerTask::onHttpServeRecordingMessage_>(this);
+#endif // CONFIG_EZDV_RX_RECORDER
+
+    registerMessageHandlers<&HttpServerTask::onTelemetryReportMessage_>(this);
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    registerMessageHandlers<&HttpServerTask::onLoadSheddingMessage_>(this);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+    registerMessageHandlers<
+        &HttpServerTask::onSubscribeSpectrumMessage_,
+        &HttpServerTask::onFreeDVSpectrumMessage_,
+        &HttpServerTask::onSubscribeAudioMonitorMessage_,
+        &HttpServerTask::onFreeDVAudioMonitorMessage_,
+        &HttpServerTask::onSetBinaryStatusMessage_,
+        &HttpServerTask::onGetBootTimelineMessage_>(this);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    registerMessageHandlers<&HttpServerTask::onAudioLatencyProbeResultMessage_>(this);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
+    // Serving files and uploads can take a while, so keep them from 
+    // delaying status updates to the UI. The spectrum feed is also lower
+    // priority than status.
+    enableMessageLanes(0, 64);
+#if CONFIG_EZDV_RX_RECORDER
+    setMessageLane<HttpServeRecordingMessage>(MESSAGE_LANE_BULK);
+#endif // CONFIG_EZDV_RX_RECORDER
+    setMessageLane<BeginUploadVoiceKeyerFileMessage>(MESSAGE_LANE_BULK);
+    setMessageLane<audio::FreeDVSpectrumMessage>(MESSAGE_LANE_BULK);
+
+    // Each client only has one frame in flight, so losing its completion
+    // would stop its queue for good.
+    setMessageOverflowPolicy<WebSocketSendCompleteMessage>(OVERFLOW_BLOCK, &OnWebSocketSendCompleteDropped_);
 }
 
 HttpServerTask::~HttpServerTask()
 {
-    // empty
+    heap_caps_free(jsonBuffer_);
+
+    for (auto fileServer : fileServers_)
+    {
+        delete fileServer;
+    }
 }
 
 #define IS_FILE_EXT(filename, ext) \
     (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
 
 /* Set HTTP response content type according to file extension */
-static void set_content_type_from_file(httpd_req_t *req, const char *filename)
+static void set_content_type_from_file(httpd_req_t *req, const char *filename, bool gzipEncoding, const char* etag)
 {
-    bool gzipEncoding = false;
-
     if (IS_FILE_EXT(filename, ".pdf")) 
     {
         ESP_ERROR_CHECK(httpd_resp_set_type(req, "application/pdf"));
@@ -172,6 +283,14 @@ static void set_content_type_from_file(httpd_req_t *req, const char *filename)
         gzipEncoding = true;
         ESP_ERROR_CHECK(httpd_resp_set_type(req, "text/css"));
     }
+    else if (IS_FILE_EXT(filename, ".wav")) 
+    {
+        ESP_ERROR_CHECK(httpd_resp_set_type(req, "audio/wav"));
+    }
+    else if (IS_FILE_EXT(filename, ".c2")) 
+    {
+        ESP_ERROR_CHECK(httpd_resp_set_type(req, "application/octet-stream"));
+    }
     else
     {
         /* This is a limited set only */
@@ -182,8 +301,19 @@ static void set_content_type_from_file(httpd_req_t *req, const char *filename)
     // Enable unsafe inline scripting (required by newer Chrome)
     ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "Content-Security-Policy", "script-src 'self' 'unsafe-inline'"));
 
-    // Disable caching to prevent rendering problems during firmware updates
-    ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "Cache-Control", "no-store"));
+    if (*etag != 0)
+    {
+        // Browsers can keep files as long as they check with us first; the
+        // ETag changes with every build, so firmware updates still take
+        // effect right away.
+        ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "Cache-Control", "no-cache"));
+        ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "ETag", etag));
+    }
+    else
+    {
+        // Disable caching to prevent rendering problems during firmware updates
+        ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "Cache-Control", "no-store"));
+    }
 
     // Enable gzip encoding if required
     if (gzipEncoding)
@@ -192,6 +322,20 @@ static void set_content_type_from_file(httpd_req_t *req, const char *filename)
     }
 }
 
+/* Returns true if the request's If-None-Match header includes the given ETag */
+static bool request_matches_etag(httpd_req_t *req, const char *etag)
+{
+    char value[128];
+    size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+    if (len == 0 || len >= sizeof(value) ||
+        httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK)
+    {
+        return false;
+    }
+
+    return !strcmp(value, "*") || strstr(value, etag) != nullptr;
+}
+
 /* Copies the full path into destination buffer and returns
  * pointer to path (skipping the preceding base path) */
 static char* get_path_from_uri(char *dest, const char *base_path, const char *uri, size_t destsize)
@@ -221,116 +365,236 @@ static char* get_path_from_uri(char *dest, const char *base_path, const char *ur
     return dest + base_pathlen;
 }
 
-void HttpServerTask::onHttpServeStaticFileMessage_(DVTask* origin, HttpServeStaticFileMessage* message)
+esp_err_t HttpServerTask::ServeStaticPage_(httpd_req_t *req)
 {
-    // Get path again for debug output
     char filepath[FILE_PATH_MAX];
-    get_path_from_uri(filepath, "/http", message->request->uri, sizeof(filepath));
 
-    if (filepath[strlen(filepath) - 1] == '/')
+    char *filename = get_path_from_uri(filepath, "",
+                                             req->uri, sizeof(filepath));
+    if (!filename) 
     {
-        strcat(filepath, "index.html");
+        ESP_LOGE(CURRENT_LOG_TAG, "Filename is too long");
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
+    }
+    
+    // Append index.html to the end if the path ends with a slash.
+    if (filename[strlen(filename) - 1] == '/')
+    {
+        strlcat(filepath, "index.html", sizeof(filepath));
     }
 
-    char* scratchBuf = (char*)heap_caps_malloc(SCRATCH_BUFSIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    assert(scratchBuf != nullptr);
+    // Bundle names don't have the leading slash.
+    if (*filename == '/')
+    {
+        filename++;
+    }
+    
+    // Most files are stored gzipped by the build (as <name>.gz). Those 
+    // referenced by their .gz name (e.g. bootstrap.min.css.gz) are found 
+    // as-is and handled by set_content_type_from_file().
+    auto thisObj = (HttpServerTask*)req->user_ctx;
+    const uint8_t* data = nullptr;
+    uint32_t length = 0;
+    bool gzipEncoding = false;
+    if (!thisObj->assetBundle_.find(filename, data, length))
+    {
+        char gzipFilename[FILE_PATH_MAX + sizeof(".gz")];
+        snprintf(gzipFilename, sizeof(gzipFilename), "%s.gz", filename);
+        if (thisObj->assetBundle_.find(gzipFilename, data, length))
+        {
+            gzipEncoding = true;
+        }
+        else
+        {
+            // Return 404 if not found.
+            ESP_LOGE(CURRENT_LOG_TAG, "Failed to find file : %s", filename);
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+            return ESP_FAIL;
+        }
+    }
 
-    char *chunk = scratchBuf;
-    size_t chunksize = read(message->fd, chunk, SCRATCH_BUFSIZE);
+    // Nothing to send if the browser already has this build's copy.
+    if (thisObj->assetETag_[0] != 0 && request_matches_etag(req, thisObj->assetETag_))
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "File %s not modified", filename);
+        ESP_ERROR_CHECK(httpd_resp_set_status(req, "304 Not Modified"));
+        ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "Cache-Control", "no-cache"));
+        ESP_ERROR_CHECK(httpd_resp_set_hdr(req, "ETag", thisObj->assetETag_));
+        return httpd_resp_send(req, nullptr, 0);
+    }
 
-    if (chunksize > 0) 
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending file : %s (%" PRIu32 " bytes%s)...", filename, length, gzipEncoding ? ", gzipped" : "");
+    set_content_type_from_file(req, filename, gzipEncoding, thisObj->assetETag_);
+    
+    httpd_req_t* asyncReq;
+    esp_err_t err = httpd_req_async_handler_begin(req, &asyncReq);
+    if (err == ESP_OK)
     {
-        /* Send the buffer contents as HTTP response chunk */
-        if (httpd_resp_send_chunk(message->request, chunk, chunksize) != ESP_OK) 
+        /* Let the least busy file server send it to free up the HTTP task. */
+        HttpFileServerTask* fileServer = thisObj->fileServers_[0];
+        for (auto candidate : thisObj->fileServers_)
         {
-            close(message->fd);
-            ESP_LOGE(CURRENT_LOG_TAG, "Sending %s failed!", filepath);
+            if (candidate->getNumTransfers() < fileServer->getNumTransfers())
+            {
+                fileServer = candidate;
+            }
+        }
+        fileServer->serve(data, length, asyncReq);
+    }
 
-            /* Abort sending file */
-            httpd_resp_sendstr_chunk(message->request, NULL);
+    return err;
+}
 
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(message->request, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
+#if CONFIG_EZDV_RX_RECORDER
+void HttpServerTask::onHttpServeRecordingMessage_(DVTask* origin, HttpServeRecordingMessage* message)
+{
+    auto store = audio::RecordingStore::GetInstance();
 
-            /* Close connection. */
-            ESP_ERROR_CHECK(httpd_req_async_handler_complete(message->request));
-            goto http_static_file_cleanup;
+    uint8_t* scratchBuf = (uint8_t*)heap_caps_malloc(audio::RecordingStore::PAYLOAD_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(scratchBuf != nullptr);
+
+    // One block per call so that other requests aren't held up.
+    uint32_t chunksize = 0;
+    if (!message->headerSent)
+    {
+        chunksize = store->getFileHeader(scratchBuf, message->endSequence - message->nextSequence);
+        message->headerSent = true;
+    }
+    else if (message->nextSequence != message->endSequence)
+    {
+        if (!store->read(message->nextSequence, scratchBuf))
+        {
+            // Overwritten since the download started. Keep the length 
+            // promised by the header.
+            memset(scratchBuf, 0, audio::RecordingStore::PAYLOAD_SIZE);
         }
+        chunksize = audio::RecordingStore::PAYLOAD_SIZE;
+        message->nextSequence++;
+    }
 
-        /* Repost event to be processed again. */
-        post(message);
+    if (chunksize > 0)
+    {
+        if (httpd_resp_send_chunk(message->request, (const char*)scratchBuf, chunksize) != ESP_OK)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Sending recording failed!");
+            httpd_resp_sendstr_chunk(message->request, NULL);
+            ESP_ERROR_CHECK(httpd_req_async_handler_complete(message->request));
+        }
+        else
+        {
+            post(message);
+        }
     }
     else
     {
-        /* Close file after sending complete */
-        close(message->fd);
-        ESP_LOGI(CURRENT_LOG_TAG, "Sending %s complete", filepath);
-
-        /* Respond with an empty chunk to signal HTTP response completion */
+        ESP_LOGI(CURRENT_LOG_TAG, "Sending recording complete");
         httpd_resp_send_chunk(message->request, NULL, 0);
-
-        /* Close connection. */
         ESP_ERROR_CHECK(httpd_req_async_handler_complete(message->request));
     }
 
-http_static_file_cleanup:
     heap_caps_free(scratchBuf);
 }
 
-esp_err_t HttpServerTask::ServeStaticPage_(httpd_req_t *req)
+esp_err_t HttpServerTask::ServeRecording_(httpd_req_t *req)
 {
-    char filepath[FILE_PATH_MAX];
-    int fd = -1;
-    struct stat file_stat;
-
-    char *filename = get_path_from_uri(filepath, "/http",
-                                             req->uri, sizeof(filepath));
-    if (!filename) 
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "Filename is too long");
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
-        return ESP_FAIL;
-    }
-    
-    // Append index.html to the end if the path ends with a slash.
-    if (filename[strlen(filename) - 1] == '/')
+    auto store = audio::RecordingStore::GetInstance();
+    if (store == nullptr || !store->isAvailable() || strcmp(req->uri + 1, store->getFileName()) != 0)
     {
-        strcat(filename, "index.html");
-    }
-    
-    // Return 404 if not found.
-    if (stat(filepath, &file_stat) == -1)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "Failed to stat file : %s", filepath);
         httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
         return ESP_FAIL;
     }
-    
-    fd = open(filepath, O_RDONLY);
-    if (fd < 0) 
+
+    // Blocks written during the download aren't included.
+    uint32_t firstSequence = 0;
+    uint32_t endSequence = 0;
+    store->getRange(&firstSequence, &endSequence);
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending recording (%" PRIu32 " blocks)...", endSequence - firstSequence);
+    set_content_type_from_file(req, store->getFileName(), false, "");
+
+    httpd_req_t* asyncReq;
+    esp_err_t err = httpd_req_async_handler_begin(req, &asyncReq);
+    if (err == ESP_OK)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "Failed to read existing file : %s", filepath);
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
-        return ESP_FAIL;
+        auto thisObj = (HttpServerTask*)req->user_ctx;
+        HttpServerTask::HttpServeRecordingMessage message(asyncReq, firstSequence, endSequence);
+        thisObj->post(&message);
     }
 
-    ESP_LOGI(CURRENT_LOG_TAG, "Sending file : %s (%ld bytes)...", filename, file_stat.st_size);
-    set_content_type_from_file(req, filename);
-    
+    return err;
+}
+#endif // CONFIG_EZDV_RX_RECORDER
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+esp_err_t HttpServerTask::ServeMetrics_(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    // TelemetryTask owns the counters, so it renders the response.
     httpd_req_t* asyncReq;
     esp_err_t err = httpd_req_async_handler_begin(req, &asyncReq);
     if (err == ESP_OK)
     {
-        /* Let associated DVTask handle sending the file to free up the HTTP task. */
         auto thisObj = (HttpServerTask*)req->user_ctx;
-        HttpServerTask::HttpServeStaticFileMessage message(fd, asyncReq);
-        thisObj->post(&message);
+        telemetry::RenderMetricsMessage message(asyncReq);
+        thisObj->publish(&message);
     }
 
     return err;
 }
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+
+#if CONFIG_EZDV_EVENT_TRACE
+esp_err_t HttpServerTask::ServeTrace_(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    // The trace can be larger than we'd want to buffer, so it goes out 
+    // in chunks as it's rendered.
+    bool ok = util::EventTrace::Dump([](void* arg, const char* data, size_t length) {
+        return httpd_resp_send_chunk((httpd_req_t*)arg, data, length) == ESP_OK;
+    }, req);
+
+    if (!ok)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Event trace download interrupted");
+        return ESP_FAIL;
+    }
+
+    return httpd_resp_send_chunk(req, nullptr, 0);
+}
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+#if CONFIG_EZDV_PACKET_CAPTURE
+esp_err_t HttpServerTask::ServeCapture_(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/vnd.tcpdump.pcap");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"capture.pcap\"");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    bool ok = PacketCapture::Dump([](void* arg, const char* data, size_t length) {
+        return httpd_resp_send_chunk((httpd_req_t*)arg, data, length) == ESP_OK;
+    }, req);
+
+    if (!ok)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Packet capture download interrupted");
+        return ESP_FAIL;
+    }
+
+    return httpd_resp_send_chunk(req, nullptr, 0);
+}
+#endif // CONFIG_EZDV_PACKET_CAPTURE
+
+esp_err_t HttpServerTask::OnSessionOpen_(httpd_handle_t hd, int sockfd)
+{
+    NetworkQos::ApplyProfile(sockfd, NetworkQos::HTTP);
+    return ESP_OK;
+}
 
 esp_err_t HttpServerTask::ServeWebsocketPage_(httpd_req_t *req)
 {
@@ -360,7 +624,37 @@ esp_err_t HttpServerTask::ServeWebsocketPage_(httpd_req_t *req)
         return ret;
     }
 
-    if (ws_pkt.len) 
+    if (ws_pkt.type == HTTPD_WS_TYPE_BINARY)
+    {
+        // Upload data is read straight into a pooled buffer that's then
+        // handed to the task writing it, which releases it when done.
+        if (ws_pkt.len == 0)
+        {
+            return ESP_OK;
+        }
+        else if (ws_pkt.len > UploadBufferPool::BUFFER_SIZE)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Upload chunk of %d bytes not supported", ws_pkt.len);
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        buf = (uint8_t*)UploadBufferPool::Acquire(pdMS_TO_TICKS(UPLOAD_TIMEOUT_MS));
+        if (buf == NULL)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Timed out waiting for an upload buffer");
+            return ESP_ERR_NO_MEM;
+        }
+        ws_pkt.payload = buf;
+
+        ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
+        if (ret != ESP_OK) 
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "httpd_ws_recv_frame failed with %d", ret);
+            UploadBufferPool::Release((char*)buf);
+            return ret;
+        }
+    }
+    else if (ws_pkt.len) 
     {
         /* ws_pkt.len + 1 is for NULL termination as we are expecting a string */
         buf = (uint8_t*)heap_caps_calloc(1, ws_pkt.len + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
@@ -431,10 +725,17 @@ esp_err_t HttpServerTask::ServeWebsocketPage_(httpd_req_t *req)
                     // as we could end up getting file blocks before the handler can be
                     // processed.
                     thisObj->firmwareUploadInProgress_ = true;
-                    
-                    ESP_LOGI(CURRENT_LOG_TAG, "Configuring firmware file upload");    
-                    StartFirmwareUploadMessage reqMessage;
-                    thisObj->publish(&reqMessage);
+                    cJSON_Delete(jsonMessage);
+
+                    BeginUploadFirmwareFileMessage message(fd);
+                    thisObj->post(&message);
+                }
+                else if (!strcmp(type, "startFirmwareDownload"))
+                {
+                    // Progress and the result are reported the same way as for uploads.
+                    StartFirmwareDownloadMessage message(cJSON_GetStringValue(cJSON_GetObjectItem(jsonMessage, "url")));
+                    cJSON_Delete(jsonMessage);
+                    thisObj->publish(&message);
                 }
                 else if (!strcmp(type, "setMode"))
                 {
@@ -463,6 +764,81 @@ esp_err_t HttpServerTask::ServeWebsocketPage_(httpd_req_t *req)
                     StopWifiScanMessage message(fd, jsonMessage);
                     thisObj->post(&message);
                 }
+                else if (!strcmp(type, "dumpTaskStatistics"))
+                {
+                    // Statistics go to the console, so there's nothing to respond with.
+                    bool reset = cJSON_IsTrue(cJSON_GetObjectItem(jsonMessage, "reset"));
+                    cJSON_Delete(jsonMessage);
+
+                    ezdv::task::DumpTaskStatisticsMessage message(reset);
+                    thisObj->publish(&message);
+                }
+                else if (!strcmp(type, "getTelemetry"))
+                {
+                    cJSON_Delete(jsonMessage);
+
+                    // Report is sent back to only this socket once TelemetryTask responds.
+                    telemetry::RequestTelemetryMessage message(fd);
+                    thisObj->publish(&message);
+                }
+                else if (!strcmp(type, "subscribeSpectrum"))
+                {
+                    SubscribeSpectrumMessage message(fd, jsonMessage);
+                    thisObj->post(&message);
+                }
+                else if (!strcmp(type, "subscribeAudioMonitor"))
+                {
+                    SubscribeAudioMonitorMessage message(fd, jsonMessage);
+                    thisObj->post(&message);
+                }
+                else if (!strcmp(type, "setBinaryStatus"))
+                {
+                    SetBinaryStatusMessage message(fd, jsonMessage);
+                    thisObj->post(&message);
+                }
+                else if (!strcmp(type, "getBootTimeline"))
+                {
+                    cJSON_Delete(jsonMessage);
+
+                    GetBootTimelineMessage message(fd);
+                    thisObj->post(&message);
+                }
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+                else if (!strcmp(type, "startLatencyProbe"))
+                {
+                    // Node names are as reported in telemetry's audio links. The 
+                    // result is sent back to only this socket.
+                    auto sourceChannelJSON = cJSON_GetObjectItem(jsonMessage, "sourceChannel");
+                    auto sinkChannelJSON = cJSON_GetObjectItem(jsonMessage, "sinkChannel");
+                    auto trialsJSON = cJSON_GetObjectItem(jsonMessage, "trials");
+                    const char* source = cJSON_GetStringValue(cJSON_GetObjectItem(jsonMessage, "source"));
+                    const char* sink = cJSON_GetStringValue(cJSON_GetObjectItem(jsonMessage, "sink"));
+
+                    audio::StartAudioLatencyProbeMessage message(
+                        fd,
+                        source != nullptr ? source : "",
+                        (audio::AudioInput::ChannelLabel)(cJSON_IsNumber(sourceChannelJSON) ? (int)cJSON_GetNumberValue(sourceChannelJSON) : 0),
+                        sink != nullptr ? sink : "",
+                        (audio::AudioInput::ChannelLabel)(cJSON_IsNumber(sinkChannelJSON) ? (int)cJSON_GetNumberValue(sinkChannelJSON) : 0),
+                        cJSON_IsNumber(trialsJSON) ? (uint16_t)cJSON_GetNumberValue(trialsJSON) : 0);
+                    cJSON_Delete(jsonMessage);
+
+                    thisObj->publish(&message);
+                }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+#if CONFIG_EZDV_PACKET_CAPTURE
+                else if (!strcmp(type, "startPacketCapture"))
+                {
+                    // Downloading /capture.pcap stops it.
+                    cJSON_Delete(jsonMessage);
+                    PacketCapture::Start();
+                }
+                else if (!strcmp(type, "stopPacketCapture"))
+                {
+                    cJSON_Delete(jsonMessage);
+                    PacketCapture::Stop();
+                }
+#endif // CONFIG_EZDV_PACKET_CAPTURE
             }
         }
     }
@@ -472,14 +848,48 @@ esp_err_t HttpServerTask::ServeWebsocketPage_(httpd_req_t *req)
         if (thisObj->firmwareUploadInProgress_)
         {
             ESP_LOGI(CURRENT_LOG_TAG, "Received %d bytes of firmware data", ws_pkt.len);
-            FirmwareUploadDataMessage message((char*)buf, ws_pkt.len);
-            thisObj->publish(&message); // note: buf will be freed by voice keyer task.
+
+            // The browser should be waiting for credit, but hold off reading
+            // more if it didn't.
+            if (!storage::SoftwareUpdateTask::WaitForSpace(pdMS_TO_TICKS(UPLOAD_TIMEOUT_MS)))
+            {
+                ESP_LOGW(CURRENT_LOG_TAG, "Timed out waiting for firmware flash to catch up");
+            }
+
+            // Only the update task gets the chunk, and it now owns buf.
+            auto softwareUpdateTask = storage::SoftwareUpdateTask::GetInstance();
+            if (softwareUpdateTask != nullptr)
+            {
+                FirmwareUploadDataMessage message((char*)buf, ws_pkt.len);
+                thisObj->sendTo(softwareUpdateTask, &message);
+            }
+            else
+            {
+                UploadBufferPool::Release((char*)buf);
+            }
         }
         else
         {
             ESP_LOGI(CURRENT_LOG_TAG, "Received %d bytes of voice keyer data", ws_pkt.len);
-            FileUploadDataMessage message((char*)buf, ws_pkt.len);
-            thisObj->publish(&message); // note: buf will be freed by voice keyer task.
+
+            // The browser should be waiting for credit, but hold off reading
+            // more if it didn't.
+            if (!audio::VoiceKeyerUploadTask::WaitForSpace(pdMS_TO_TICKS(UPLOAD_TIMEOUT_MS)))
+            {
+                ESP_LOGW(CURRENT_LOG_TAG, "Timed out waiting for voice keyer upload to catch up");
+            }
+
+            // Only the upload task gets the chunk, and it now owns buf.
+            auto uploadTask = audio::VoiceKeyerUploadTask::GetInstance();
+            if (uploadTask != nullptr)
+            {
+                FileUploadDataMessage message((char*)buf, ws_pkt.len);
+                thisObj->sendTo(uploadTask, &message);
+            }
+            else
+            {
+                UploadBufferPool::Release((char*)buf);
+            }
         }
     }
     
@@ -506,16 +916,22 @@ void HttpServerTask::onTaskStart_()
         const char* partitionLabel = HttpPartitionLabels_[partition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0];
         ESP_LOGI(CURRENT_LOG_TAG, "Using partition %s for HTTP server.", partitionLabel);
         
-        esp_vfs_spiffs_conf_t conf = {
-            .base_path = "/http",
-            .partition_label = partitionLabel,
-            .max_files = 10,
-            .format_if_mount_failed = false
-        };
-
-        // Use settings defined above to initialize and mount SPIFFS filesystem.
-        // Note: esp_vfs_spiffs_register is an all-in-one convenience function.
-        ESP_ERROR_CHECK(esp_vfs_spiffs_register(&conf));
+        // The web UI is read-only and served straight from flash. It stays
+        // mapped until we're destroyed (the slot doesn't change until reboot),
+        // so files queued for sending remain valid even while going to sleep.
+        assetETag_[0] = 0;
+        if (assetBundle_.isOpen() || assetBundle_.open(partitionLabel))
+        {
+            const char* etag = assetBundle_.getETag();
+            if (*etag != 0)
+            {
+                snprintf(assetETag_, sizeof(assetETag_), "\"%s\"", etag);
+            }
+        }
+        else
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Web UI not available (was the HTTP partition flashed?)");
+        }
         
         // Generate default configuration
         httpd_config_t config = HTTPD_DEFAULT_CONFIG();
@@ -528,9 +944,18 @@ void HttpServerTask::onTaskStart_()
         * allow the same handler to respond to multiple different
         * target URIs which match the wildcard scheme */
         config.uri_match_fn = httpd_uri_match_wildcard;
+
+        // Apply the web interface's Wi-Fi QoS profile to each connection.
+        config.open_fn = &OnSessionOpen_;
         
+        for (auto fileServer : fileServers_)
+        {
+            start(fileServer, pdMS_TO_TICKS(1000));
+        }
+
         // Start HTTP server.
         ESP_ERROR_CHECK(httpd_start(&configServerHandle_, &config));
+        sendQueue_.setServer(configServerHandle_);
         
         // Configure URL handlers.
         httpd_uri_t webSocketPage = {
@@ -544,6 +969,63 @@ void HttpServerTask::onTaskStart_()
         };
         httpd_register_uri_handler(configServerHandle_, &webSocketPage);
 
+#if CONFIG_EZDV_RX_RECORDER
+        // Must be registered before the static file handler.
+        httpd_uri_t recordingPage = 
+        {
+            .uri = "/recording.*",
+            .method = HTTP_GET,
+            .handler = &ServeRecording_,
+            .user_ctx = this,
+            .is_websocket = false,
+            .handle_ws_control_frames = false,
+            .supported_subprotocol = nullptr
+        };
+        httpd_register_uri_handler(configServerHandle_, &recordingPage);
+#endif // CONFIG_EZDV_RX_RECORDER
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+        httpd_uri_t metricsPage = 
+        {
+            .uri = "/metrics",
+            .method = HTTP_GET,
+            .handler = &ServeMetrics_,
+            .user_ctx = this,
+            .is_websocket = false,
+            .handle_ws_control_frames = false,
+            .supported_subprotocol = nullptr
+        };
+        httpd_register_uri_handler(configServerHandle_, &metricsPage);
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+
+#if CONFIG_EZDV_EVENT_TRACE
+        httpd_uri_t tracePage = 
+        {
+            .uri = "/trace.json",
+            .method = HTTP_GET,
+            .handler = &ServeTrace_,
+            .user_ctx = this,
+            .is_websocket = false,
+            .handle_ws_control_frames = false,
+            .supported_subprotocol = nullptr
+        };
+        httpd_register_uri_handler(configServerHandle_, &tracePage);
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+#if CONFIG_EZDV_PACKET_CAPTURE
+        httpd_uri_t capturePage = 
+        {
+            .uri = "/capture.pcap",
+            .method = HTTP_GET,
+            .handler = &ServeCapture_,
+            .user_ctx = this,
+            .is_websocket = false,
+            .handle_ws_control_frames = false,
+            .supported_subprotocol = nullptr
+        };
+        httpd_register_uri_handler(configServerHandle_, &capturePage);
+#endif // CONFIG_EZDV_PACKET_CAPTURE
+
         httpd_uri_t rootPage = 
         {
             .uri = "/*",
@@ -583,26 +1065,37 @@ void HttpServerTask::onTaskSleep_()
             
             httpd_ws_send_data(configServerHandle_, sock, &wsPkt);
         }
+
+        // Drops any file transfers still in progress.
+        for (auto fileServer : fileServers_)
+        {
+            sleep(fileServer, pdMS_TO_TICKS(1000));
+        }
         
         ESP_ERROR_CHECK(httpd_stop(configServerHandle_));
 
+        // No more send completions can arrive, so anything still queued 
+        // can go.
+        sendQueue_.clear();
+
+        spectrumSockets_.clear();
+        updateSpectrumSubscription_();
+        audioMonitorSockets_.clear();
+        updateAudioMonitorSubscription_();
+
+        // Changes may be missed while asleep, so ask again next time.
+        settingsSnapshot_.reset();
+
+        statusTimer_.stop();
+        statusHoldoff_ = false;
+        statusDirty_ = false;
+
         if (numWifiScansInProgress > 0)
         {
             StopWifiScanMessage request;
             publish(&request);
         }
 
-        auto partition = const_cast<esp_partition_t*>(esp_ota_get_running_partition());
-        if (partition->subtype != ESP_PARTITION_SUBTYPE_APP_OTA_0 &&
-            partition->subtype != ESP_PARTITION_SUBTYPE_APP_OTA_1)
-        {
-            // Should not reach here.
-            ESP_LOGE(CURRENT_LOG_TAG, "Detected more than two app slots, this is unexpected");
-            assert(false);
-        }
-        const char* partitionLabel = HttpPartitionLabels_[partition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0];
-        esp_vfs_spiffs_unregister(partitionLabel);
-
         isRunning_ = false;
     }
 }
@@ -614,75 +1107,146 @@ void HttpServerTask::onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsoc
         activeWebSockets_[message->fd] = false;
     }
 
-    // Request current settings.
+    // Settings are normally already known from broadcasts. Anything that
+    // isn't is requested now.
+    requestMissingSettings_();
+
+    // Send everything we have as a single message so the UI comes up at once.
+    cJSON* root = cJSON_CreateObject();
+    cJSON* messages = cJSON_CreateArray();
+    if (root != nullptr && messages != nullptr)
     {
-        storage::RequestWifiSettingsMessage request;
+        cJSON_AddStringToObject(root, "type", JSON_SETTINGS_SNAPSHOT_TYPE);
+        cJSON_AddItemToObject(root, "messages", messages);
+
+        if (settingsSnapshot_.wifi)
+        {
+            cJSON_AddItemToArray(messages, createWifiInfoJSON_(*settingsSnapshot_.wifi));
+        }
+        if (settingsSnapshot_.radio)
+        {
+            cJSON_AddItemToArray(messages, createRadioInfoJSON_(*settingsSnapshot_.radio));
+        }
+        if (settingsSnapshot_.voiceKeyer)
+        {
+            cJSON_AddItemToArray(messages, createVoiceKeyerInfoJSON_(*settingsSnapshot_.voiceKeyer));
+        }
+        if (settingsSnapshot_.reporting)
+        {
+            cJSON_AddItemToArray(messages, createReportingInfoJSON_(*settingsSnapshot_.reporting));
+        }
+        if (settingsSnapshot_.ledBrightness)
+        {
+            cJSON_AddItemToArray(messages, createLedBrightnessInfoJSON_(*settingsSnapshot_.ledBrightness));
+        }
+        if (settingsSnapshot_.mode)
+        {
+            cJSON_AddItemToArray(messages, createCurrentModeJSON_(*settingsSnapshot_.mode));
+        }
+
+        // Note: below is responsible for cleanup.
+        WebSocketList sockets;
+        sockets[message->fd] = false;
+        sendJSONMessage_(root, sockets);
+    }
+    else
+    {
+        // HTTP isn't 100% critical but we really should see what's leaking memory.
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for settings snapshot!");
+        cJSON_Delete(root);
+        cJSON_Delete(messages);
+    }
+
+    {
+        audio::GetKeyerStateMessage request;
         publish(&request);
         
-        auto response = waitFor<storage::WifiSettingsMessage>(pdMS_TO_TICKS(1000), NULL);
+        // This is asynchronous, so we don't need to handle here.
+    }
+
+    {
+        driver::RequestBatteryStateMessage request;
+        publish(&request);
+
+        // This is asynchronous, so we don't need to handle here.
+    }
+}
+
+void HttpServerTask::requestMissingSettings_()
+{
+    // These all go out at once so that we only have to wait for a single 
+    // round trip.
+    DVTaskRequestBatch settingsRequests(this);
+    int wifiIndex = -1;
+    int radioIndex = -1;
+    int voiceKeyerIndex = -1;
+    int reportingIndex = -1;
+    int ledBrightnessIndex = -1;
+    int freedvModeIndex = -1;
+
+    storage::RequestWifiSettingsMessage wifiRequest;
+    if (!settingsSnapshot_.wifi)
+    {
+        wifiIndex = settingsRequests.add<storage::WifiSettingsMessage>(nullptr, &wifiRequest);
+    }
+
+    storage::RequestRadioSettingsMessage radioRequest;
+    if (!settingsSnapshot_.radio)
+    {
+        radioIndex = settingsRequests.add<storage::RadioSettingsMessage>(nullptr, &radioRequest);
+    }
+
+    storage::RequestVoiceKeyerSettingsMessage voiceKeyerRequest;
+    if (!settingsSnapshot_.voiceKeyer)
+    {
+        voiceKeyerIndex = settingsRequests.add<storage::VoiceKeyerSettingsMessage>(nullptr, &voiceKeyerRequest);
+    }
+
+    storage::RequestReportingSettingsMessage reportingRequest;
+    if (!settingsSnapshot_.reporting)
+    {
+        reportingIndex = settingsRequests.add<storage::ReportingSettingsMessage>(nullptr, &reportingRequest);
+    }
+
+    storage::RequestLedBrightnessSettingsMessage ledBrightnessRequest;
+    if (!settingsSnapshot_.ledBrightness)
+    {
+        ledBrightnessIndex = settingsRequests.add<storage::LedBrightnessSettingsMessage>(nullptr, &ledBrightnessRequest);
+    }
+
+    audio::RequestGetFreeDVModeMessage freedvModeRequest;
+    if (!settingsSnapshot_.mode)
+    {
+        freedvModeIndex = settingsRequests.add<audio::SetFreeDVModeMessage>(nullptr, &freedvModeRequest);
+    }
+
+    if (wifiIndex < 0 && radioIndex < 0 && voiceKeyerIndex < 0 && 
+        reportingIndex < 0 && ledBrightnessIndex < 0 && freedvModeIndex < 0)
+    {
+        return;
+    }
+
+    settingsRequests.send(pdMS_TO_TICKS(1000));
+
+    if (wifiIndex >= 0)
+    {
+        auto response = settingsRequests.getResponse<storage::WifiSettingsMessage>(wifiIndex);
         if (response)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_WIFI_STATUS_TYPE);
-                cJSON_AddBoolToObject(root, "enabled", response->enabled);
-                cJSON_AddNumberToObject(root, "mode", response->mode);
-                cJSON_AddNumberToObject(root, "security", response->security);
-                cJSON_AddNumberToObject(root, "channel", response->channel);
-                cJSON_AddStringToObject(root, "ssid", response->ssid);
-                cJSON_AddStringToObject(root, "password", response->password);
-                cJSON_AddStringToObject(root, "hostname", response->hostname);
-        
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for Wi-Fi info!");
-            }
+            onWifiSettingsMessage_(nullptr, response);
         }
         else
         {
             ESP_LOGE(CURRENT_LOG_TAG, "Timed out waiting for current Wi-Fi settings");
         }
     }
-    
+
+    if (radioIndex >= 0)
     {
-        storage::RequestRadioSettingsMessage request;
-        publish(&request);
-        
-        auto response = waitFor<storage::RadioSettingsMessage>(pdMS_TO_TICKS(1000), NULL);
+        auto response = settingsRequests.getResponse<storage::RadioSettingsMessage>(radioIndex);
         if (response)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_RADIO_STATUS_TYPE);
-                cJSON_AddBoolToObject(root, "headsetPtt", response->headsetPtt);
-                cJSON_AddNumberToObject(root, "timeOutTimer", response->timeOutTimer);
-                cJSON_AddBoolToObject(root, "enabled", response->enabled);
-                cJSON_AddNumberToObject(root, "radioType", response->type);
-                cJSON_AddStringToObject(root, "host", response->host);
-                cJSON_AddNumberToObject(root, "port", response->port);
-                cJSON_AddStringToObject(root, "username", response->username);
-                cJSON_AddStringToObject(root, "password", response->password);
-        
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for radio info!");
-            }
+            onRadioSettingsMessage_(nullptr, response);
         }
         else
         {
@@ -690,32 +1254,12 @@ void HttpServerTask::onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsoc
         }
     }
 
+    if (voiceKeyerIndex >= 0)
     {
-        storage::RequestVoiceKeyerSettingsMessage request;
-        publish(&request);
-        
-        auto response = waitFor<storage::VoiceKeyerSettingsMessage>(pdMS_TO_TICKS(1000), NULL);
+        auto response = settingsRequests.getResponse<storage::VoiceKeyerSettingsMessage>(voiceKeyerIndex);
         if (response)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_VOICE_KEYER_STATUS_TYPE);
-                cJSON_AddBoolToObject(root, "enabled", response->enabled);
-                cJSON_AddNumberToObject(root, "secondsToWait", response->secondsToWait);
-                cJSON_AddNumberToObject(root, "timesToTransmit", response->timesToTransmit);
-        
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for voice keyer info!");
-            }
+            onVoiceKeyerSettingsMessage_(nullptr, response);
         }
         else
         {
@@ -723,65 +1267,25 @@ void HttpServerTask::onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsoc
         }
     }
 
+    if (reportingIndex >= 0)
     {
-        storage::RequestReportingSettingsMessage request;
-        publish(&request);
-        
-        auto response = waitFor<storage::ReportingSettingsMessage>(pdMS_TO_TICKS(1000), NULL);
+        auto response = settingsRequests.getResponse<storage::ReportingSettingsMessage>(reportingIndex);
         if (response)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_REPORTING_STATUS_TYPE);
-                cJSON_AddStringToObject(root, "callsign", response->callsign);
-                cJSON_AddStringToObject(root, "gridSquare", response->gridSquare);
-                cJSON_AddBoolToObject(root, "forceReporting", response->forceReporting);
-                cJSON_AddNumberToObject(root, "reportingFrequency", response->freqHz);
-                cJSON_AddStringToObject(root, "reportingMessage", response->message);
-
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for reporting info!");
-            }
+            onReportingSettingsMessage_(nullptr, response);
         }
         else
         {
             ESP_LOGE(CURRENT_LOG_TAG, "Timed out waiting for current reporting settings");
         }
     }
-    
+
+    if (ledBrightnessIndex >= 0)
     {
-        storage::RequestLedBrightnessSettingsMessage request;
-        publish(&request);
-        
-        auto response = waitFor<storage::LedBrightnessSettingsMessage>(pdMS_TO_TICKS(1000), NULL);
+        auto response = settingsRequests.getResponse<storage::LedBrightnessSettingsMessage>(ledBrightnessIndex);
         if (response)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_LED_BRIGHTNESS_STATUS_TYPE);
-                cJSON_AddNumberToObject(root, "dutyCycle", response->dutyCycle);
-        
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for LED brightness info!");
-            }
+            onLedBrightnessSettingsMessage_(nullptr, response);
         }
         else
         {
@@ -789,127 +1293,378 @@ void HttpServerTask::onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsoc
         }
     }
 
+    if (freedvModeIndex >= 0)
     {
-        audio::RequestGetFreeDVModeMessage request;
-        publish(&request);
-        
-        auto response = waitFor<audio::SetFreeDVModeMessage>(pdMS_TO_TICKS(1000), NULL);
+        auto response = settingsRequests.getResponse<audio::SetFreeDVModeMessage>(freedvModeIndex);
         if (response)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_CURRENT_MODE_TYPE);
-                cJSON_AddNumberToObject(root, "currentMode", (int)response->mode);
-        
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for FreeDV mode info!");
-            }
+            settingsSnapshot_.mode = response->mode;
         }
         else
         {
             ESP_LOGE(CURRENT_LOG_TAG, "Timed out waiting for current FreeDV mode info");
         }
     }
+}
+
+void HttpServerTask::onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMessage* message)
+{
+    settingsSnapshot_.wifi.emplace(*message);
+}
+
+void HttpServerTask::onRadioSettingsMessage_(DVTask* origin, storage::RadioSettingsMessage* message)
+{
+    settingsSnapshot_.radio.emplace(*message);
+}
 
+void HttpServerTask::onVoiceKeyerSettingsMessage_(DVTask* origin, storage::VoiceKeyerSettingsMessage* message)
+{
+    settingsSnapshot_.voiceKeyer.emplace(*message);
+}
+
+void HttpServerTask::onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message)
+{
+    settingsSnapshot_.reporting.emplace(*message);
+}
+
+void HttpServerTask::onLedBrightnessSettingsMessage_(DVTask* origin, storage::LedBrightnessSettingsMessage* message)
+{
+    settingsSnapshot_.ledBrightness.emplace(*message);
+}
+
+cJSON* HttpServerTask::createWifiInfoJSON_(const storage::WifiSettingsMessage& settings)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
     {
-        audio::GetKeyerStateMessage request;
+        cJSON_AddStringToObject(root, "type", JSON_WIFI_STATUS_TYPE);
+        cJSON_AddBoolToObject(root, "enabled", settings.enabled);
+        cJSON_AddNumberToObject(root, "mode", settings.mode);
+        cJSON_AddNumberToObject(root, "security", settings.security);
+        cJSON_AddNumberToObject(root, "channel", settings.channel);
+        cJSON_AddStringToObject(root, "ssid", settings.ssid);
+        cJSON_AddStringToObject(root, "password", settings.password);
+        cJSON_AddStringToObject(root, "hostname", settings.hostname);
+    }
+    return root;
+}
+
+cJSON* HttpServerTask::createRadioInfoJSON_(const storage::RadioSettingsMessage& settings)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
+    {
+        cJSON_AddStringToObject(root, "type", JSON_RADIO_STATUS_TYPE);
+        cJSON_AddBoolToObject(root, "headsetPtt", settings.headsetPtt);
+        cJSON_AddNumberToObject(root, "timeOutTimer", settings.timeOutTimer);
+        cJSON_AddBoolToObject(root, "enabled", settings.enabled);
+        cJSON_AddNumberToObject(root, "radioType", settings.type);
+        cJSON_AddStringToObject(root, "host", settings.host);
+        cJSON_AddNumberToObject(root, "port", settings.port);
+        cJSON_AddStringToObject(root, "username", settings.username);
+        cJSON_AddStringToObject(root, "password", settings.password);
+    }
+    return root;
+}
+
+cJSON* HttpServerTask::createVoiceKeyerInfoJSON_(const storage::VoiceKeyerSettingsMessage& settings)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
+    {
+        cJSON_AddStringToObject(root, "type", JSON_VOICE_KEYER_STATUS_TYPE);
+        cJSON_AddBoolToObject(root, "enabled", settings.enabled);
+        cJSON_AddNumberToObject(root, "secondsToWait", settings.secondsToWait);
+        cJSON_AddNumberToObject(root, "timesToTransmit", settings.timesToTransmit);
+        cJSON_AddNumberToObject(root, "slot", settings.slot);
+        cJSON_AddNumberToObject(root, "numSlots", CONFIG_EZDV_VOICE_KEYER_NUM_SLOTS);
+    }
+    return root;
+}
+
+cJSON* HttpServerTask::createReportingInfoJSON_(const storage::ReportingSettingsMessage& settings)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
+    {
+        cJSON_AddStringToObject(root, "type", JSON_REPORTING_STATUS_TYPE);
+        cJSON_AddStringToObject(root, "callsign", settings.callsign);
+        cJSON_AddStringToObject(root, "gridSquare", settings.gridSquare);
+        cJSON_AddBoolToObject(root, "forceReporting", settings.forceReporting);
+        cJSON_AddNumberToObject(root, "reportingFrequency", settings.freqHz);
+        cJSON_AddStringToObject(root, "reportingMessage", settings.message);
+    }
+    return root;
+}
+
+cJSON* HttpServerTask::createLedBrightnessInfoJSON_(const storage::LedBrightnessSettingsMessage& settings)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
+    {
+        cJSON_AddStringToObject(root, "type", JSON_LED_BRIGHTNESS_STATUS_TYPE);
+        cJSON_AddNumberToObject(root, "dutyCycle", settings.dutyCycle);
+    }
+    return root;
+}
+
+cJSON* HttpServerTask::createCurrentModeJSON_(audio::FreeDVMode mode)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
+    {
+        cJSON_AddStringToObject(root, "type", JSON_CURRENT_MODE_TYPE);
+        cJSON_AddNumberToObject(root, "currentMode", (int)mode);
+    }
+    return root;
+}
+
+void HttpServerTask::onHttpWebsocketDisconnectedMessage_(DVTask* origin, HttpWebsocketDisconnectedMessage* message)
+{
+    if (activeWebSockets_.contains(message->fd))
+    {
+        activeWebSockets_.erase(message->fd);
+    }
+
+    spectrumSockets_.erase(message->fd);
+    audioMonitorSockets_.erase(message->fd);
+    binaryStatusSockets_.erase(message->fd);
+    sendQueue_.remove(message->fd);
+    updateSpectrumSubscription_();
+    updateAudioMonitorSubscription_();
+    
+    int numWifiScansInProgress = 0;
+    for (auto& kvp : activeWebSockets_)
+    {
+        if (kvp.second)
+        {
+            numWifiScansInProgress++;
+        }
+    }
+
+    if (numWifiScansInProgress == 0)
+    {
+        StopWifiScanMessage request;
         publish(&request);
-        
-        // This is asynchronous, so we don't need to handle here.
+    }
+}
+
+void HttpServerTask::onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message)
+{
+    statusSnapshot_.battery.emplace(*message);
+    markStatusDirty_();
+}
+
+void HttpServerTask::markStatusDirty_()
+{
+    statusDirty_ = true;
+    if (!statusHoldoff_)
+    {
+        // Nothing sent recently, so this can go right away. Anything else 
+        // that changes before the timer fires goes out with it then.
+        sendStatus_();
+        statusHoldoff_ = true;
+        statusTimer_.start(true);
+    }
+}
+
+void HttpServerTask::onStatusTimer_(DVTimer*)
+{
+    statusHoldoff_ = false;
+    if (statusDirty_)
+    {
+        sendStatus_();
+        statusHoldoff_ = true;
+        statusTimer_.start(true);
+    }
+}
+
+void HttpServerTask::sendStatus_()
+{
+    statusDirty_ = false;
+
+    // Binary format: 'B', then voltage, state of charge (%) and its rate of 
+    // change (%/hr) as little endian 32-bit floats.
+    if (statusSnapshot_.battery && !binaryStatusSockets_.empty())
+    {
+        uint8_t frame[1 + 3 * sizeof(float)];
+        float values[] = { statusSnapshot_.battery->voltage, statusSnapshot_.battery->soc, statusSnapshot_.battery->socChangeRate };
+        frame[0] = 'B';
+        memcpy(&frame[1], values, sizeof(values));
+        sendBinaryMessage_(frame, sizeof(frame), binaryStatusSockets_, WebSocketSendQueue::KEY_BATTERY);
+    }
+
+    WebSocketList jsonSockets;
+    WebSocketList binarySockets;
+    for (auto& kvp : activeWebSockets_)
+    {
+        if (binaryStatusSockets_.contains(kvp.first))
+        {
+            binarySockets.insert(kvp);
+        }
+        else
+        {
+            jsonSockets.insert(kvp);
+        }
     }
 
+    // Every frame has everything we know, so a newer one can replace an 
+    // older one still waiting to be sent.
+    if (!jsonSockets.empty())
     {
-        driver::RequestBatteryStateMessage request;
-        publish(&request);
+        util::JsonWriter writer(jsonBuffer_, JSON_BUFFER_SIZE);
+        if (writeStatusFrame_(writer, true))
+        {
+            sendJSONMessage_(writer, jsonSockets, WebSocketSendQueue::KEY_STATUS);
+        }
+    }
 
-        // This is asynchronous, so we don't need to handle here.
+    if (!binarySockets.empty())
+    {
+        util::JsonWriter writer(jsonBuffer_, JSON_BUFFER_SIZE);
+        if (writeStatusFrame_(writer, false))
+        {
+            sendJSONMessage_(writer, binarySockets, WebSocketSendQueue::KEY_STATUS);
+        }
     }
 }
 
-void HttpServerTask::onHttpWebsocketDisconnectedMessage_(DVTask* origin, HttpWebsocketDisconnectedMessage* message)
+bool HttpServerTask::writeStatusFrame_(util::JsonWriter& writer, bool includeBattery)
 {
-    if (activeWebSockets_.contains(message->fd))
+    // Sent frequently, so formatted directly rather than via cJSON. The 
+    // UI handles the messages inside the same way as the settings snapshot.
+    int numMessages = 0;
+    writer.beginObject().member("type", JSON_STATUS_TYPE).key("messages").beginArray();
+    if (includeBattery && statusSnapshot_.battery)
     {
-        activeWebSockets_.erase(message->fd);
+        writer.beginObject().members(
+            "type", JSON_BATTERY_STATUS_TYPE,
+            "voltage", statusSnapshot_.battery->voltage,
+            "stateOfCharge", statusSnapshot_.battery->soc,
+            "stateOfChargeChange", statusSnapshot_.battery->socChangeRate).endObject();
+        numMessages++;
     }
-    
-    int numWifiScansInProgress = 0;
-    for (auto& kvp : activeWebSockets_)
+    if (settingsSnapshot_.mode)
     {
-        if (kvp.second)
-        {
-            numWifiScansInProgress++;
-        }
+        writer.beginObject().members(
+            "type", JSON_CURRENT_MODE_TYPE,
+            "currentMode", (int)*settingsSnapshot_.mode).endObject();
+        numMessages++;
     }
-
-    if (numWifiScansInProgress == 0)
+    if (statusSnapshot_.voiceKeyerRunning)
     {
-        StopWifiScanMessage request;
-        publish(&request);
+        writer.beginObject().members(
+            "type", JSON_VOICE_KEYER_RUNNING_TYPE,
+            "running", (int)*statusSnapshot_.voiceKeyerRunning).endObject();
+        numMessages++;
     }
+    writer.endArray().endObject();
+
+    return numMessages > 0;
 }
 
-void HttpServerTask::onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message)
+void HttpServerTask::sendJSONMessage_(cJSON* message, WebSocketList& socketList, WebSocketSendQueue::StatusKey key)
 {
-    cJSON *root = cJSON_CreateObject();
-    if (root != nullptr)
+    // Most messages fit in our buffer, so there's usually nothing to allocate.
+    char* json = jsonBuffer_;
+    if (!cJSON_PrintPreallocated(message, jsonBuffer_, JSON_BUFFER_SIZE, false))
     {
-        cJSON_AddStringToObject(root, "type", JSON_BATTERY_STATUS_TYPE);
-        cJSON_AddNumberToObject(root, "voltage", message->voltage);
-        cJSON_AddNumberToObject(root, "stateOfCharge", message->soc);
-        cJSON_AddNumberToObject(root, "stateOfChargeChange", message->socChangeRate);
-        
-        // Note: below is responsible for cleanup.
-        sendJSONMessage_(root, activeWebSockets_);
+        json = cJSON_PrintUnformatted(message);
     }
-    else
+
+    if (json == nullptr)
     {
-        // HTTP isn't 100% critical but we really should see what's leaking memory.
-        ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for battery status!");
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not serialize JSON message!");
+        cJSON_Delete(message);
+        return;
     }
-}
 
-void HttpServerTask::sendJSONMessage_(cJSON* message, WebSocketList& socketList)
-{
-    httpd_ws_frame_t wsPkt;
-    memset(&wsPkt, 0, sizeof(httpd_ws_frame_t));
-    wsPkt.payload = (uint8_t*)cJSON_Print(message);
-    wsPkt.len = strlen((char*)wsPkt.payload);
-    wsPkt.type = HTTPD_WS_TYPE_TEXT;
-    
     // Send to all sockets in list
+    size_t length = strlen(json);
     for (auto& kvp : socketList)
     {
         auto fd = kvp.first;
 
         ESP_LOGI(CURRENT_LOG_TAG, "Sending JSON message to socket %d", fd);
-            
-        if (httpd_ws_send_data(configServerHandle_, fd, &wsPkt) != ESP_OK)
-        {
-            ESP_LOGE(CURRENT_LOG_TAG, "Websocket %d disconnected!", fd);
-            
-            // Queue up removal from the socket list.
-            HttpWebsocketDisconnectedMessage message(fd);
-            post(&message);
-        }
+        sendFrame_(fd, HTTPD_WS_TYPE_TEXT, (const uint8_t*)json, length, key);
     }
     
     // Make sure we don't leak memory due to the generated JSON.
-    cJSON_free(wsPkt.payload);
+    if (json != jsonBuffer_)
+    {
+        cJSON_free(json);
+    }
     
     // Free the JSON object itself.
     cJSON_Delete(message);
 }
 
+void HttpServerTask::sendJSONMessage_(const util::JsonWriter& message, WebSocketList& socketList, WebSocketSendQueue::StatusKey key)
+{
+    if (!message.ok())
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "JSON message too large to send!");
+        return;
+    }
+
+    for (auto& kvp : socketList)
+    {
+        sendFrame_(kvp.first, HTTPD_WS_TYPE_TEXT, (const uint8_t*)message.c_str(), message.length(), key);
+    }
+}
+
+void HttpServerTask::sendBinaryMessage_(const uint8_t* frame, size_t length, const std::set<int>& sockets, WebSocketSendQueue::StatusKey key)
+{
+    for (auto fd : sockets)
+    {
+        sendFrame_(fd, HTTPD_WS_TYPE_BINARY, frame, length, key);
+    }
+}
+
+void HttpServerTask::sendFrame_(int fd, httpd_ws_type_t type, const uint8_t* payload, size_t length, WebSocketSendQueue::StatusKey key)
+{
+    if (!sendQueue_.enqueue(fd, type, payload, length, key))
+    {
+        // Client isn't keeping up with what we're sending, so drop it
+        // instead of buffering without bound. It can reconnect.
+        ESP_LOGW(CURRENT_LOG_TAG, "Websocket %d too slow, closing", fd);
+        NetworkQos::RecordSend(NetworkQos::HTTP, false);
+        httpd_sess_trigger_close(configServerHandle_, fd);
+
+        // Queue up removal from the socket lists.
+        HttpWebsocketDisconnectedMessage disconnectMessage(fd);
+        post(&disconnectMessage);
+    }
+}
+
+void HttpServerTask::onWebSocketSendCompleteMessage_(DVTask* origin, WebSocketSendCompleteMessage* message)
+{
+    bool sent = sendQueue_.onSendComplete(message->fd, message->err);
+    NetworkQos::RecordSend(NetworkQos::HTTP, sent);
+    if (!sent)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Websocket %d disconnected!", message->fd);
+        
+        // Queue up removal from the socket lists.
+        HttpWebsocketDisconnectedMessage disconnectMessage(message->fd);
+        post(&disconnectMessage);
+    }
+}
+
+void HttpServerTask::OnWebSocketSendComplete_(esp_err_t err, int socket, void* arg)
+{
+    // Called from the HTTP server's task; the queue is only touched from ours.
+    HttpServerTask* thisObj = (HttpServerTask*)arg;
+    WebSocketSendCompleteMessage message(&thisObj->sendQueue_, socket, err);
+    thisObj->post(&message);
+}
+
+void HttpServerTask::OnWebSocketSendCompleteDropped_(DVTaskMessage* message)
+{
+    WebSocketSendCompleteMessage* completeMessage = (WebSocketSendCompleteMessage*)message;
+    completeMessage->queue->onSendCompleteLost(completeMessage->fd, completeMessage->err);
+}
+
 void HttpServerTask::onUpdateWifiMessage_(DVTask* origin, UpdateWifiMessage* message)
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Updating Wi-Fi settings");
@@ -1173,16 +1928,59 @@ void HttpServerTask::onBeginUploadVoiceKeyerFileMessage_(DVTask* origin, BeginUp
     firmwareUploadInProgress_ = false;
     
     int sizeToUpload = 0;
+    int slot = 0;
     auto sizeJSON = cJSON_GetObjectItem(message->request, "size");
+    auto slotJSON = cJSON_GetObjectItem(message->request, "slot");
+    if (slotJSON != nullptr)
+    {
+        slot = (int)cJSON_GetNumberValue(slotJSON);
+    }
+
     if (sizeJSON != nullptr)
     {
         sizeToUpload = (int)cJSON_GetNumberValue(sizeJSON);
 
-        StartFileUploadMessage message(sizeToUpload);
+        // VoiceKeyerUploadTask grants the initial credits once it's ready.
+        uploadSocket_ = message->fd;
+        uploadCreditsGranted_ = 0;
+
+        StartFileUploadMessage message(sizeToUpload, slot);
         publish(&message);
     }
 }
 
+void HttpServerTask::onBeginUploadFirmwareFileMessage_(DVTask* origin, BeginUploadFirmwareFileMessage* message)
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Configuring firmware file upload");
+
+    // SoftwareUpdateTask grants the initial credits once it's ready.
+    uploadSocket_ = message->fd;
+    uploadCreditsGranted_ = 0;
+
+    StartFirmwareUploadMessage request;
+    publish(&request);
+}
+
+void HttpServerTask::onUploadCreditMessage_(DVTask* origin, UploadCreditMessage* message)
+{
+    uploadCreditsGranted_ += message->credits;
+    if (!activeWebSockets_.contains(uploadSocket_))
+    {
+        return;
+    }
+
+    // The total is sent, rather than the increment, so that only the 
+    // latest needs to reach the browser.
+    util::JsonWriter writer(jsonBuffer_, JSON_BUFFER_SIZE);
+    writer.beginObject().members(
+        "type", JSON_UPLOAD_CREDIT_TYPE,
+        "granted", uploadCreditsGranted_).endObject();
+
+    WebSocketList sockets;
+    sockets[uploadSocket_] = false;
+    sendJSONMessage_(writer, sockets, WebSocketSendQueue::KEY_UPLOAD_CREDIT);
+}
+
 void HttpServerTask::onUpdateVoiceKeyerMessage_(DVTask* origin, UpdateVoiceKeyerMessage* message)
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Updating voice keyer settings");
@@ -1190,8 +1988,16 @@ void HttpServerTask::onUpdateVoiceKeyerMessage_(DVTask* origin, UpdateVoiceKeyer
     bool enabled = false;
     int secondsToWait = 0;
     int timesToTransmit = 0;
+    int slot = 0;
     
     bool settingsValid = true;
+
+    auto slotJSON = cJSON_GetObjectItem(message->request, "slot");
+    if (slotJSON != nullptr)
+    {
+        slot = (int)cJSON_GetNumberValue(slotJSON);
+        settingsValid &= slot >= 0 && slot < CONFIG_EZDV_VOICE_KEYER_NUM_SLOTS;
+    }
     
     auto enabledJSON = cJSON_GetObjectItem(message->request, "enabled");
     if (enabledJSON != nullptr)
@@ -1230,7 +2036,7 @@ void HttpServerTask::onUpdateVoiceKeyerMessage_(DVTask* origin, UpdateVoiceKeyer
     bool success = false;
     if (settingsValid)
     {
-        storage::SetVoiceKeyerSettingsMessage request(enabled, timesToTransmit, secondsToWait);
+        storage::SetVoiceKeyerSettingsMessage request(enabled, timesToTransmit, secondsToWait, slot);
         publish(&request);
     
         auto response = waitFor<storage::VoiceKeyerSettingsSavedMessage>(pdMS_TO_TICKS(5000), NULL);
@@ -1365,6 +2171,7 @@ void HttpServerTask::onUpdateReportingMessage_(DVTask* origin, UpdateReportingMe
 void HttpServerTask::onFileUploadCompleteMessage_(DVTask* origin, audio::FileUploadCompleteMessage* message)
 {
     ESP_LOGI(CURRENT_LOG_TAG, "File upload complete");
+    uploadSocket_ = -1;
 
     // Send response
     cJSON *root = cJSON_CreateObject();
@@ -1388,6 +2195,7 @@ void HttpServerTask::onFileUploadCompleteMessage_(DVTask* origin, audio::FileUpl
 void HttpServerTask::onFirmwareUpdateCompleteMessage_(DVTask* origin, storage::FirmwareUpdateCompleteMessage* message)
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Firmware upload complete");
+    uploadSocket_ = -1;
 
     // Send response
     cJSON *root = cJSON_CreateObject();
@@ -1492,21 +2300,8 @@ void HttpServerTask::onSetModeMessage_(DVTask* origin, SetModeMessage* message)
 
 void HttpServerTask::onSetFreeDVModeMessage_(DVTask* origin, audio::SetFreeDVModeMessage* message)
 {
-    // Send response
-    cJSON *root = cJSON_CreateObject();
-    if (root != nullptr)
-    {
-        cJSON_AddStringToObject(root, "type", JSON_CURRENT_MODE_TYPE);
-        cJSON_AddNumberToObject(root, "currentMode", (int)message->mode);
-
-        // Note: below is responsible for cleanup.
-        sendJSONMessage_(root, activeWebSockets_);
-    }
-    else
-    {
-        // HTTP isn't 100% critical but we really should see what's leaking memory.
-        ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for mode settings");
-    }
+    settingsSnapshot_.mode = message->mode;
+    markStatusDirty_();
 }
 
 void HttpServerTask::onStartStopVoiceKeyerMessage_(DVTask* origin, StartStopVoiceKeyerMessage* message)
@@ -1526,38 +2321,22 @@ void HttpServerTask::onStartStopVoiceKeyerMessage_(DVTask* origin, StartStopVoic
     cJSON_free(message->request);
 }
 
-void HttpServerTask::sendVoiceKeyerExecutionState_(bool state)
-{
-    // Send response
-    cJSON *root = cJSON_CreateObject();
-    if (root != nullptr)
-    {
-        cJSON_AddStringToObject(root, "type", JSON_VOICE_KEYER_RUNNING_TYPE);
-        cJSON_AddNumberToObject(root, "running", state);
-
-        // Note: below is responsible for cleanup.
-        sendJSONMessage_(root, activeWebSockets_);
-    }
-    else
-    {
-        // HTTP isn't 100% critical but we really should see what's leaking memory.
-        ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for voice keyer state");
-    }
-}
-
 void HttpServerTask::onStartVoiceKeyerMessage_(DVTask* origin, audio::StartVoiceKeyerMessage* message)
 {
-    sendVoiceKeyerExecutionState_(true);
+    statusSnapshot_.voiceKeyerRunning = true;
+    markStatusDirty_();
 }
 
 void HttpServerTask::onStopVoiceKeyerMessage_(DVTask* origin, audio::StopVoiceKeyerMessage* message)
 {
-    sendVoiceKeyerExecutionState_(false);
+    statusSnapshot_.voiceKeyerRunning = false;
+    markStatusDirty_();
 }
 
 void HttpServerTask::onVoiceKeyerCompleteMessage_(DVTask* origin, audio::VoiceKeyerCompleteMessage* message)
 {
-    sendVoiceKeyerExecutionState_(false);
+    statusSnapshot_.voiceKeyerRunning = false;
+    markStatusDirty_();
 }
 
 void HttpServerTask::onStartWifiScanMessage_(DVTask* origin, StartWifiScanMessage* message)
@@ -1592,21 +2371,29 @@ void HttpServerTask::onWifiNetworkListMessage_(DVTask* origin, WifiNetworkListMe
     cJSON* root = cJSON_CreateObject();
     if (root != nullptr)
     {
-        cJSON_AddStringToObject(root, "type", JSON_WIFI_SCAN_RESULTS_TYPE);
-        cJSON* networkList = cJSON_AddArrayToObject(root, "networkList");
-        
-        if (networkList != nullptr)
+        if (message->fullList)
         {
-            // The logic below prevents duplicate SSIDs from being sent over.
-            std::map<std::string, bool> ssidList;
-            for (int index = 0; index < message->numRecords; index++)
+            cJSON_AddStringToObject(root, "type", JSON_WIFI_SCAN_RESULTS_TYPE);
+            cJSON* networkList = cJSON_AddArrayToObject(root, "networkList");
+            
+            for (int index = 0; networkList != nullptr && index < message->numRecords; index++)
             {
-                ssidList[(const char*)message->records[index].ssid] = true;
+                cJSON_AddItemToArray(networkList, cJSON_CreateString(message->records[index].ssid));
             }
-            
-            for (auto& ssid : ssidList)
+        }
+        else
+        {
+            // Only what changed since the last message (NetworkTask keeps
+            // track).
+            cJSON_AddStringToObject(root, "type", JSON_WIFI_SCAN_CHANGES_TYPE);
+            cJSON* added = cJSON_AddArrayToObject(root, "added");
+            cJSON* removed = cJSON_AddArrayToObject(root, "removed");
+
+            for (int index = 0; added != nullptr && removed != nullptr && index < message->numRecords; index++)
             {
-                cJSON_AddItemToArray(networkList, cJSON_CreateString(ssid.first.c_str()));
+                cJSON_AddItemToArray(
+                    message->records[index].removed ? removed : added, 
+                    cJSON_CreateString(message->records[index].ssid));
             }
         }
         
@@ -1638,6 +2425,343 @@ void HttpServerTask::onFlexRadioDiscoveredMessage_(DVTask* origin, network::flex
     }
 }
 
+void HttpServerTask::onTelemetryReportMessage_(DVTask* origin, telemetry::TelemetryReportMessage* message)
+{
+    const char* heapNames[telemetry::NUM_HEAP_TYPES] = { "internal", "spiram", "dma" };
+    telemetry::TelemetrySnapshot* snapshot = message->snapshot;
+    assert(snapshot != nullptr);
+
+    cJSON *root = cJSON_CreateObject();
+    if (root != nullptr)
+    {
+        cJSON_AddStringToObject(root, "type", JSON_TELEMETRY_TYPE);
+
+        cJSON* samples = cJSON_AddArrayToObject(root, "samples");
+        for (int index = 0; samples != nullptr && index < snapshot->numSamples; index++)
+        {
+            telemetry::TelemetrySample& sample = snapshot->samples[index];
+            cJSON* sampleJson = cJSON_CreateObject();
+            if (sampleJson == nullptr)
+            {
+                break;
+            }
+
+            cJSON_AddNumberToObject(sampleJson, "timestamp", sample.timestampUs / 1000);
+            cJSON_AddNumberToObject(sampleJson, "wakeupsPerSecond", sample.wakeupsPerSecond);
+            if (sample.batteryCurrentValid)
+            {
+                cJSON_AddNumberToObject(sampleJson, "batteryCurrentMa", sample.batteryCurrentMa);
+            }
+
+            cJSON* idle = cJSON_AddArrayToObject(sampleJson, "idle");
+            for (int core = 0; idle != nullptr && core < portNUM_PROCESSORS; core++)
+            {
+                cJSON_AddItemToArray(idle, cJSON_CreateNumber(sample.idlePercent[core]));
+            }
+
+            cJSON* heap = cJSON_AddObjectToObject(sampleJson, "heap");
+            for (int heapType = 0; heap != nullptr && heapType < telemetry::NUM_HEAP_TYPES; heapType++)
+            {
+                cJSON* heapJson = cJSON_AddObjectToObject(heap, heapNames[heapType]);
+                if (heapJson != nullptr)
+                {
+                    cJSON_AddNumberToObject(heapJson, "free", sample.heap[heapType].freeBytes);
+                    cJSON_AddNumberToObject(heapJson, "largestBlock", sample.heap[heapType].largestFreeBlock);
+                }
+            }
+
+            cJSON* tasks = cJSON_AddArrayToObject(sampleJson, "tasks");
+            for (int taskIndex = 0; tasks != nullptr && taskIndex < sample.numTasks; taskIndex++)
+            {
+                telemetry::TelemetryTaskSample& taskSample = sample.tasks[taskIndex];
+                cJSON* taskJson = cJSON_CreateObject();
+                if (taskJson != nullptr)
+                {
+                    cJSON_AddStringToObject(taskJson, "name", taskSample.name);
+                    cJSON_AddNumberToObject(taskJson, "cpu", taskSample.cpuPercent);
+                    cJSON_AddNumberToObject(taskJson, "core", taskSample.coreId);
+                    cJSON_AddNumberToObject(taskJson, "stackFree", taskSample.stackHighWaterMark);
+                    cJSON_AddItemToArray(tasks, taskJson);
+                }
+            }
+
+            cJSON* audioLinks = cJSON_AddArrayToObject(sampleJson, "audioLinks");
+            for (int linkIndex = 0; audioLinks != nullptr && linkIndex < sample.numAudioLinks; linkIndex++)
+            {
+                telemetry::TelemetryAudioLinkSample& linkSample = sample.audioLinks[linkIndex];
+                cJSON* linkJson = cJSON_CreateObject();
+                if (linkJson != nullptr)
+                {
+                    cJSON_AddStringToObject(linkJson, "sink", linkSample.sinkName);
+                    cJSON_AddNumberToObject(linkJson, "channel", linkSample.sinkChannel);
+                    cJSON_AddStringToObject(linkJson, "source", linkSample.sourceName);
+                    cJSON_AddNumberToObject(linkJson, "minFill", linkSample.minUsed);
+                    cJSON_AddNumberToObject(linkJson, "maxFill", linkSample.maxUsed);
+                    cJSON_AddNumberToObject(linkJson, "avgFill", linkSample.averageUsed);
+                    cJSON_AddNumberToObject(linkJson, "underruns", linkSample.numUnderruns);
+                    cJSON_AddNumberToObject(linkJson, "overruns", linkSample.numOverruns);
+                    cJSON_AddNumberToObject(linkJson, "dropped", linkSample.numSamplesDropped);
+                    cJSON_AddItemToArray(audioLinks, linkJson);
+                }
+            }
+
+            cJSON* modemProfiles = cJSON_AddArrayToObject(sampleJson, "modem");
+            for (int modemIndex = 0; modemProfiles != nullptr && modemIndex < sample.numModemProfiles; modemIndex++)
+            {
+                telemetry::TelemetryModemSample& modemSample = sample.modemProfiles[modemIndex];
+                cJSON* modemJson = cJSON_CreateObject();
+                if (modemJson != nullptr)
+                {
+                    cJSON_AddStringToObject(modemJson, "name", modemSample.name);
+                    cJSON_AddNumberToObject(modemJson, "mode", modemSample.mode);
+                    cJSON_AddNumberToObject(modemJson, "frames", modemSample.numFrames);
+                    cJSON_AddNumberToObject(modemJson, "avgUs", modemSample.averageUs);
+                    cJSON_AddNumberToObject(modemJson, "worstUs", modemSample.worstUs);
+                    cJSON_AddNumberToObject(modemJson, "worstMarginUs", modemSample.worstMarginUs);
+                    cJSON_AddNumberToObject(modemJson, "late", modemSample.numLate);
+                    cJSON_AddNumberToObject(modemJson, "maxLeadUs", modemSample.maxOutputLeadUs);
+                    cJSON_AddNumberToObject(modemJson, "deferred", modemSample.numDeferred);
+
+                    cJSON* histogram = cJSON_AddArrayToObject(modemJson, "histogram");
+                    for (int bucket = 0; histogram != nullptr && bucket < TELEMETRY_MODEM_HISTOGRAM_BUCKETS; bucket++)
+                    {
+                        cJSON_AddItemToArray(histogram, cJSON_CreateNumber(modemSample.histogram[bucket]));
+                    }
+                    cJSON_AddItemToArray(modemProfiles, modemJson);
+                }
+            }
+
+            cJSON* networkStreams = cJSON_AddArrayToObject(sampleJson, "network");
+            for (int stream = 0; networkStreams != nullptr && stream < TELEMETRY_NETWORK_STREAMS; stream++)
+            {
+                telemetry::TelemetryNetworkSample& networkSample = sample.network[stream];
+                const NetworkQos::Profile& profile = NetworkQos::GetProfile((NetworkQos::StreamType)stream);
+                cJSON* networkJson = cJSON_CreateObject();
+                if (networkJson != nullptr)
+                {
+                    cJSON_AddStringToObject(networkJson, "name", NetworkQos::GetStreamName((NetworkQos::StreamType)stream));
+                    cJSON_AddNumberToObject(networkJson, "accessCategory", profile.accessCategory);
+                    cJSON_AddBoolToObject(networkJson, "ampdu", profile.ampdu);
+                    cJSON_AddNumberToObject(networkJson, "batch", profile.sendBatchSize);
+                    cJSON_AddNumberToObject(networkJson, "sent", networkSample.numSent);
+                    cJSON_AddNumberToObject(networkJson, "sendFailures", networkSample.numSendFailures);
+                    cJSON_AddNumberToObject(networkJson, "sendRetries", networkSample.numSendRetries);
+                    cJSON_AddNumberToObject(networkJson, "received", networkSample.numReceived);
+                    cJSON_AddNumberToObject(networkJson, "lost", networkSample.numLost);
+                    cJSON_AddNumberToObject(networkJson, "outOfOrder", networkSample.numOutOfOrder);
+                    cJSON_AddNumberToObject(networkJson, "jitterUs", networkSample.jitterUs);
+                    cJSON_AddNumberToObject(networkJson, "maxJitterUs", networkSample.maxJitterUs);
+                    cJSON_AddNumberToObject(networkJson, "rttUs", networkSample.rttUs);
+                    cJSON_AddNumberToObject(networkJson, "maxRttUs", networkSample.maxRttUs);
+                    cJSON_AddItemToArray(networkStreams, networkJson);
+                }
+            }
+
+            cJSON_AddItemToArray(samples, sampleJson);
+        }
+
+        // Note: below is responsible for cleanup.
+        WebSocketList sockets;
+        sockets[message->fd] = false;
+        sendJSONMessage_(root, sockets);
+    }
+    else
+    {
+        // HTTP isn't 100% critical but we really should see what's leaking memory.
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for telemetry");
+    }
+
+    heap_caps_free(snapshot);
+}
+
+void HttpServerTask::onSubscribeSpectrumMessage_(DVTask* origin, SubscribeSpectrumMessage* message)
+{
+    bool enabled = cJSON_IsTrue(cJSON_GetObjectItem(message->request, "enabled"));
+    cJSON_Delete(message->request);
+
+    if (enabled)
+    {
+        spectrumSockets_.insert(message->fd);
+    }
+    else
+    {
+        spectrumSockets_.erase(message->fd);
+    }
+    updateSpectrumSubscription_();
+}
+
+void HttpServerTask::onSetBinaryStatusMessage_(DVTask* origin, SetBinaryStatusMessage* message)
+{
+    bool enabled = cJSON_IsTrue(cJSON_GetObjectItem(message->request, "enabled"));
+    cJSON_Delete(message->request);
+
+    if (enabled)
+    {
+        binaryStatusSockets_.insert(message->fd);
+    }
+    else
+    {
+        binaryStatusSockets_.erase(message->fd);
+    }
+}
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+void HttpServerTask::onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message)
+{
+    // Subscribers stay subscribed and get the feed back once there's room.
+    spectrumShed_ = message->level >= telemetry::LoadSheddingMessage::SHED_SPECTRUM;
+    updateSpectrumSubscription_();
+}
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+void HttpServerTask::updateSpectrumSubscription_()
+{
+    bool enabled = !spectrumSockets_.empty();
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    enabled = enabled && !spectrumShed_;
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+    if (enabled != spectrumEnabled_)
+    {
+        spectrumEnabled_ = enabled;
+
+        audio::FreeDVSetSpectrumEnabledMessage request(enabled);
+        publish(&request);
+    }
+}
+
+void HttpServerTask::onFreeDVSpectrumMessage_(DVTask* origin, audio::FreeDVSpectrumMessage* message)
+{
+    // Binary format: 'S', mode, sync, SNR (dB, signed), frequency offset 
+    // (Hz, signed 16-bit little endian), number of bins, then one byte per bin.
+    const int headerSize = 7;
+    uint8_t frame[headerSize + audio::FreeDVSpectrumMessage::NUM_BINS];
+    frame[0] = 'S';
+    frame[1] = message->mode;
+    frame[2] = message->sync;
+    frame[3] = (uint8_t)message->snr;
+    frame[4] = (uint16_t)message->freqOffsetHz & 0xFF;
+    frame[5] = (uint16_t)message->freqOffsetHz >> 8;
+    frame[6] = audio::FreeDVSpectrumMessage::NUM_BINS;
+    memcpy(&frame[headerSize], message->bins, audio::FreeDVSpectrumMessage::NUM_BINS);
+
+    sendBinaryMessage_(frame, sizeof(frame), spectrumSockets_, WebSocketSendQueue::KEY_SPECTRUM);
+}
+
+void HttpServerTask::onSubscribeAudioMonitorMessage_(DVTask* origin, SubscribeAudioMonitorMessage* message)
+{
+    bool enabled = cJSON_IsTrue(cJSON_GetObjectItem(message->request, "enabled"));
+    cJSON_Delete(message->request);
+
+    if (enabled)
+    {
+        audioMonitorSockets_.insert(message->fd);
+    }
+    else
+    {
+        audioMonitorSockets_.erase(message->fd);
+    }
+    updateAudioMonitorSubscription_();
+}
+
+void HttpServerTask::updateAudioMonitorSubscription_()
+{
+    bool enabled = !audioMonitorSockets_.empty();
+    if (enabled != audioMonitorEnabled_)
+    {
+        audioMonitorEnabled_ = enabled;
+
+        audio::FreeDVSetAudioMonitorEnabledMessage request(enabled);
+        publish(&request);
+    }
+}
+
+void HttpServerTask::onFreeDVAudioMonitorMessage_(DVTask* origin, audio::FreeDVAudioMonitorMessage* message)
+{
+    // Binary format: 'A', ADPCM step index, predictor (signed 16-bit little
+    // endian), then the ADPCM data (see FreeDVAudioMonitorMessage).
+    const int headerSize = 4;
+    uint8_t frame[headerSize + sizeof(message->data)];
+    frame[0] = 'A';
+    frame[1] = message->stepIndex;
+    frame[2] = (uint16_t)message->predictor & 0xFF;
+    frame[3] = (uint16_t)message->predictor >> 8;
+    memcpy(&frame[headerSize], message->data, sizeof(message->data));
+
+    sendBinaryMessage_(frame, sizeof(frame), audioMonitorSockets_);
+}
+
+void HttpServerTask::onGetBootTimelineMessage_(DVTask* origin, GetBootTimelineMessage* message)
+{
+    // Too big for our stack; only requested occasionally.
+    auto timeline = (util::BootTimeline::Timeline*)heap_caps_malloc(sizeof(util::BootTimeline::Timeline), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    cJSON* root = cJSON_CreateObject();
+    if (timeline == nullptr || root == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not allocate memory for boot timeline");
+        heap_caps_free(timeline);
+        cJSON_Delete(root);
+        return;
+    }
+
+    cJSON_AddStringToObject(root, "type", JSON_BOOT_TIMELINE_TYPE);
+    for (bool previous : { false, true })
+    {
+        if (!util::BootTimeline::Get(*timeline, previous))
+        {
+            // Not available (e.g. first boot after power on).
+            cJSON_AddNullToObject(root, previous ? "previous" : "current");
+            continue;
+        }
+
+        cJSON* timelineJson = cJSON_AddObjectToObject(root, previous ? "previous" : "current");
+        cJSON_AddNumberToObject(timelineJson, "resetReason", timeline->resetReason);
+
+        cJSON* events = cJSON_AddArrayToObject(timelineJson, "events");
+        for (uint32_t index = 0; index < timeline->numEvents; index++)
+        {
+            auto& event = timeline->events[index];
+            cJSON* eventJson = cJSON_CreateObject();
+            cJSON_AddStringToObject(eventJson, "name", event.name);
+            cJSON_AddNumberToObject(eventJson, "startUs", event.startUs);
+            cJSON_AddNumberToObject(eventJson, "durationUs", event.durationUs);
+            cJSON_AddItemToArray(events, eventJson);
+        }
+    }
+    heap_caps_free(timeline);
+
+    WebSocketList sockets;
+    sockets[message->fd] = false;
+    sendJSONMessage_(root, sockets);
+}
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+void HttpServerTask::onAudioLatencyProbeResultMessage_(DVTask* origin, audio::AudioLatencyProbeResultMessage* message)
+{
+    if (!activeWebSockets_.contains(message->fd))
+    {
+        return;
+    }
+
+    auto& result = message->result;
+    util::JsonWriter writer(jsonBuffer_, JSON_BUFFER_SIZE);
+    writer.beginObject().members(
+        "type", JSON_LATENCY_PROBE_RESULT_TYPE,
+        "success", result.success,
+        "trials", result.numTrials,
+        "detected", result.numDetected,
+        "minUs", result.minUs,
+        "averageUs", result.averageUs,
+        "p50Us", result.p50Us,
+        "p90Us", result.p90Us,
+        "p99Us", result.p99Us,
+        "maxUs", result.maxUs).endObject();
+
+    WebSocketList sockets;
+    sockets[message->fd] = false;
+    sendJSONMessage_(writer, sockets);
+}
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
+
 extern "C" bool rebootDevice;
 
 void HttpServerTask::onRebootDeviceMessage_(DVTask* origin, RebootDeviceMessage* message)
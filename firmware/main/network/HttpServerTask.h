@@ -18,19 +18,30 @@
 #ifndef HTTP_SERVER_TASK_H
 #define HTTP_SERVER_TASK_H
 
+#include <optional>
+#include <set>
 #include <vector>
 
+#include "sdkconfig.h"
 #include "esp_event.h"
 #include "esp_http_server.h"
 #include "cJSON.h"
 
 #include "task/DVTask.h"
+#include "task/DVTimer.h"
+#include "audio/AudioLatencyProbeMessage.h"
 #include "audio/FreeDVMessage.h"
 #include "audio/VoiceKeyerMessage.h"
 #include "driver/BatteryMessage.h"
+#include "storage/SettingsMessage.h"
 #include "storage/SoftwareUpdateMessage.h"
+#include "network/HttpAssetBundle.h"
+#include "network/HttpFileServerTask.h"
 #include "network/NetworkMessage.h"
+#include "network/WebSocketSendQueue.h"
 #include "network/flex/FlexMessage.h"
+#include "telemetry/TelemetryMessage.h"
+#include "util/JsonWriter.h"
 
 extern "C"
 {
@@ -73,7 +84,13 @@ private:
         REBOOT_DEVICE = 11,
         START_WIFI_SCAN = 12,
         STOP_WIFI_SCAN = 13,
-        SERVE_STATIC_FILE = 14,
+        SUBSCRIBE_SPECTRUM = 15,
+        SERVE_RECORDING = 16,
+        SET_BINARY_STATUS = 17,
+        WEBSOCKET_SEND_COMPLETE = 18,
+        BEGIN_UPLOAD_FIRMWARE_FILE = 19,
+        SUBSCRIBE_AUDIO_MONITOR = 20,
+        GET_BOOT_TIMELINE = 21,
     };
     
     template<uint32_t MSG_ID>
@@ -91,6 +108,22 @@ private:
     
     using HttpWebsocketConnectedMessage = HttpEventMessageCommon<WEBSOCKET_CONNECTED>;
     using HttpWebsocketDisconnectedMessage = HttpEventMessageCommon<WEBSOCKET_DISCONNECTED>;
+
+    class WebSocketSendCompleteMessage : public DVTaskMessageBase<WEBSOCKET_SEND_COMPLETE, WebSocketSendCompleteMessage>
+    {
+    public:
+        WebSocketSendCompleteMessage(WebSocketSendQueue* queueProvided = nullptr, int fdProvided = 0, esp_err_t errProvided = ESP_OK)
+            : DVTaskMessageBase<WEBSOCKET_SEND_COMPLETE, WebSocketSendCompleteMessage>(HTTP_SERVER_MESSAGE)
+            , queue(queueProvided)
+            , fd(fdProvided)
+            , err(errProvided)
+            {}
+        virtual ~WebSocketSendCompleteMessage() = default;
+
+        WebSocketSendQueue* queue; // for OnWebSocketSendCompleteDropped_()
+        int fd;
+        esp_err_t err;
+    };
     
     template<uint32_t MSG_ID>
     class HttpRequestMessageCommon : public DVTaskMessageBase<MSG_ID, HttpRequestMessageCommon<MSG_ID>>
@@ -107,18 +140,22 @@ private:
         cJSON* request;
     };
 
-    class HttpServeStaticFileMessage : public DVTaskMessageBase<SERVE_STATIC_FILE, HttpServeStaticFileMessage>
+    class HttpServeRecordingMessage : public DVTaskMessageBase<SERVE_RECORDING, HttpServeRecordingMessage>
     {
     public:
-        HttpServeStaticFileMessage(int fdProvided = 0, httpd_req_t* reqProvided = nullptr)
-            : DVTaskMessageBase<SERVE_STATIC_FILE, HttpServeStaticFileMessage>(HTTP_SERVER_MESSAGE)
-            , fd(fdProvided)
+        HttpServeRecordingMessage(httpd_req_t* reqProvided = nullptr, uint32_t nextSequenceProvided = 0, uint32_t endSequenceProvided = 0)
+            : DVTaskMessageBase<SERVE_RECORDING, HttpServeRecordingMessage>(HTTP_SERVER_MESSAGE)
             , request(reqProvided)
+            , nextSequence(nextSequenceProvided)
+            , endSequence(endSequenceProvided)
+            , headerSent(false)
             {}
-        virtual ~HttpServeStaticFileMessage() = default;
+        virtual ~HttpServeRecordingMessage() = default;
 
-        int fd;
         httpd_req_t* request;
+        uint32_t nextSequence;
+        uint32_t endSequence;
+        bool headerSent;
     };
     
     // Internal messages for handling requests
@@ -126,6 +163,7 @@ private:
     using UpdateRadioMessage = HttpRequestMessageCommon<UPDATE_RADIO>;
     using UpdateVoiceKeyerMessage = HttpRequestMessageCommon<UPDATE_VOICE_KEYER>;
     using BeginUploadVoiceKeyerFileMessage = HttpRequestMessageCommon<BEGIN_UPLOAD_VOICE_KEYER_FILE>;
+    using BeginUploadFirmwareFileMessage = HttpRequestMessageCommon<BEGIN_UPLOAD_FIRMWARE_FILE>;
     using UpdateReportingMessage = HttpRequestMessageCommon<UPDATE_REPORTING>;
     using UpdateLedBrightnessMessage = HttpRequestMessageCommon<UPDATE_LED_BRIGHTNESS>;
     using SetModeMessage = HttpRequestMessageCommon<SET_MODE>;
@@ -133,15 +171,96 @@ private:
     using RebootDeviceMessage = HttpRequestMessageCommon<REBOOT_DEVICE>;
     using StartWifiScanMessage = HttpRequestMessageCommon<START_WIFI_SCAN>;
     using StopWifiScanMessage = HttpRequestMessageCommon<STOP_WIFI_SCAN>;
+    using SubscribeSpectrumMessage = HttpRequestMessageCommon<SUBSCRIBE_SPECTRUM>;
+    using SubscribeAudioMonitorMessage = HttpRequestMessageCommon<SUBSCRIBE_AUDIO_MONITOR>;
+    using SetBinaryStatusMessage = HttpRequestMessageCommon<SET_BINARY_STATUS>;
+    using GetBootTimelineMessage = HttpEventMessageCommon<GET_BOOT_TIMELINE>;
     
     using WebSocketList = std::map<int, bool>; // int = socket ID, bool = currently scanning Wi-Fi networks
     
     httpd_handle_t configServerHandle_;
     WebSocketList activeWebSockets_;
     bool isRunning_;
+
+    // Web UI files for the running firmware slot.
+    HttpAssetBundle assetBundle_;
+
+    // ETag (including quotes) shared by everything in the web UI bundle,
+    // generated at build time. Empty if the bundle doesn't have one.
+    char assetETag_[24];
+
+    // Send the files above without tying up this task.
+    HttpFileServerTask* fileServers_[CONFIG_EZDV_HTTP_FILE_WORKERS];
+
+    // Sockets that want the (binary) spectrum feed. FreeDVTask only 
+    // computes it while this is non-empty.
+    std::set<int> spectrumSockets_;
+    bool spectrumEnabled_;
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    bool spectrumShed_; // off regardless of subscribers while shedding load
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+    // Sockets listening to received audio. AudioMonitorTask only encodes
+    // it while this is non-empty.
+    std::set<int> audioMonitorSockets_;
+    bool audioMonitorEnabled_;
+
+    // Sockets that asked for frequent status updates (e.g. battery) as 
+    // binary frames instead of JSON.
+    std::set<int> binaryStatusSockets_;
+
+    // Reused for serializing JSON messages; anything larger is allocated.
+    char* jsonBuffer_;
+
+    // Latest settings, kept current from the broadcasts sent whenever they
+    // change so that new connections can be sent everything at once.
+    // (Messages can't be assigned, hence std::optional and emplace().)
+    struct SettingsSnapshot
+    {
+        std::optional<storage::WifiSettingsMessage> wifi;
+        std::optional<storage::RadioSettingsMessage> radio;
+        std::optional<storage::VoiceKeyerSettingsMessage> voiceKeyer;
+        std::optional<storage::ReportingSettingsMessage> reporting;
+        std::optional<storage::LedBrightnessSettingsMessage> ledBrightness;
+        std::optional<audio::FreeDVMode> mode;
+
+        void reset()
+        {
+            wifi.reset();
+            radio.reset();
+            voiceKeyer.reset();
+            reporting.reset();
+            ledBrightness.reset();
+            mode.reset();
+        }
+    };
+    SettingsSnapshot settingsSnapshot_;
+
+    // Latest status (battery, voice keyer and settingsSnapshot_.mode), sent
+    // to clients as one frame at most CONFIG_EZDV_HTTP_STATUS_RATE_HZ times 
+    // a second instead of a frame per change.
+    struct StatusSnapshot
+    {
+        std::optional<driver::BatteryStateMessage> battery;
+        std::optional<bool> voiceKeyerRunning;
+    };
+    StatusSnapshot statusSnapshot_;
+    bool statusDirty_; // changed since it was last sent
+    bool statusHoldoff_; // statusTimer_ is running
+    DVTimer statusTimer_;
+
+    // Outbound frames for each websocket, so one slow client doesn't hold
+    // up the UI for everyone else.
+    WebSocketSendQueue sendQueue_;
+
+    // Socket the current upload is coming from and the total number of 
+    // chunks it's been allowed to send so far.
+    int uploadSocket_;
+    int uploadCreditsGranted_;
     
     void onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsocketConnectedMessage* message);
     void onHttpWebsocketDisconnectedMessage_(DVTask* origin, HttpWebsocketDisconnectedMessage* message);
+    void onWebSocketSendCompleteMessage_(DVTask* origin, WebSocketSendCompleteMessage* message);
     
     void onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message);
     void onUpdateWifiMessage_(DVTask* origin, UpdateWifiMessage* message);
@@ -149,6 +268,8 @@ private:
     void onUpdateVoiceKeyerMessage_(DVTask* origin, UpdateVoiceKeyerMessage* message);
     void onUpdateReportingMessage_(DVTask* origin, UpdateReportingMessage* message);
     void onBeginUploadVoiceKeyerFileMessage_(DVTask* origin, BeginUploadVoiceKeyerFileMessage* message);
+    void onBeginUploadFirmwareFileMessage_(DVTask* origin, BeginUploadFirmwareFileMessage* message);
+    void onUploadCreditMessage_(DVTask* origin, UploadCreditMessage* message);
     void onFileUploadCompleteMessage_(DVTask* origin, audio::FileUploadCompleteMessage* message);
     void onFirmwareUpdateCompleteMessage_(DVTask* origin, storage::FirmwareUpdateCompleteMessage* message);
     void onUpdateLedBrightnessMessage_(DVTask* origin, UpdateLedBrightnessMessage* message);
@@ -156,7 +277,25 @@ private:
     void onSetModeMessage_(DVTask* origin, SetModeMessage* message);
     void onSetFreeDVModeMessage_(DVTask* origin, audio::SetFreeDVModeMessage* message);
 
-    void sendVoiceKeyerExecutionState_(bool state);
+    void markStatusDirty_();
+    void onStatusTimer_(DVTimer*);
+    void sendStatus_();
+    bool writeStatusFrame_(util::JsonWriter& writer, bool includeBattery);
+
+    void onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMessage* message);
+    void onRadioSettingsMessage_(DVTask* origin, storage::RadioSettingsMessage* message);
+    void onVoiceKeyerSettingsMessage_(DVTask* origin, storage::VoiceKeyerSettingsMessage* message);
+    void onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message);
+    void onLedBrightnessSettingsMessage_(DVTask* origin, storage::LedBrightnessSettingsMessage* message);
+    void requestMissingSettings_();
+
+    cJSON* createWifiInfoJSON_(const storage::WifiSettingsMessage& settings);
+    cJSON* createRadioInfoJSON_(const storage::RadioSettingsMessage& settings);
+    cJSON* createVoiceKeyerInfoJSON_(const storage::VoiceKeyerSettingsMessage& settings);
+    cJSON* createReportingInfoJSON_(const storage::ReportingSettingsMessage& settings);
+    cJSON* createLedBrightnessInfoJSON_(const storage::LedBrightnessSettingsMessage& settings);
+    cJSON* createCurrentModeJSON_(audio::FreeDVMode mode);
+
     void onStartStopVoiceKeyerMessage_(DVTask* origin, StartStopVoiceKeyerMessage* message);
     void onStartVoiceKeyerMessage_(DVTask* origin, audio::StartVoiceKeyerMessage* message);
     void onStopVoiceKeyerMessage_(DVTask* origin, audio::StopVoiceKeyerMessage* message);
@@ -171,12 +310,52 @@ private:
     void onWifiNetworkListMessage_(DVTask* origin, WifiNetworkListMessage* message);
 
     // Helper to asynchronously serve static files.
-    void onHttpServeStaticFileMessage_(DVTask* origin, HttpServeStaticFileMessage* message);
+#if CONFIG_EZDV_RX_RECORDER
+    void onHttpServeRecordingMessage_(DVTask* origin, HttpServeRecordingMessage* message);
+#endif // CONFIG_EZDV_RX_RECORDER
+
+    void onTelemetryReportMessage_(DVTask* origin, telemetry::TelemetryReportMessage* message);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    void onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+    void onSubscribeSpectrumMessage_(DVTask* origin, SubscribeSpectrumMessage* message);
+    void onSetBinaryStatusMessage_(DVTask* origin, SetBinaryStatusMessage* message);
+    void onFreeDVSpectrumMessage_(DVTask* origin, audio::FreeDVSpectrumMessage* message);
+    void updateSpectrumSubscription_();
+
+    void onSubscribeAudioMonitorMessage_(DVTask* origin, SubscribeAudioMonitorMessage* message);
+    void onFreeDVAudioMonitorMessage_(DVTask* origin, audio::FreeDVAudioMonitorMessage* message);
+    void updateAudioMonitorSubscription_();
+
+    void onGetBootTimelineMessage_(DVTask* origin, GetBootTimelineMessage* message);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_PROBE
+    void onAudioLatencyProbeResultMessage_(DVTask* origin, audio::AudioLatencyProbeResultMessage* message);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_PROBE
     
-    void sendJSONMessage_(cJSON* message, WebSocketList& socketList);
+    void sendJSONMessage_(cJSON* message, WebSocketList& socketList, WebSocketSendQueue::StatusKey key = WebSocketSendQueue::NO_KEY);
+    void sendJSONMessage_(const util::JsonWriter& message, WebSocketList& socketList, WebSocketSendQueue::StatusKey key = WebSocketSendQueue::NO_KEY);
+    void sendBinaryMessage_(const uint8_t* frame, size_t length, const std::set<int>& sockets, WebSocketSendQueue::StatusKey key = WebSocketSendQueue::NO_KEY);
+    void sendFrame_(int fd, httpd_ws_type_t type, const uint8_t* payload, size_t length, WebSocketSendQueue::StatusKey key);
     
+    static esp_err_t OnSessionOpen_(httpd_handle_t hd, int sockfd);
+    static void OnWebSocketSendComplete_(esp_err_t err, int socket, void* arg);
+    static void OnWebSocketSendCompleteDropped_(DVTaskMessage* message);
     static esp_err_t ServeWebsocketPage_(httpd_req_t *req);
     static esp_err_t ServeStaticPage_(httpd_req_t *req);
+#if CONFIG_EZDV_RX_RECORDER
+    static esp_err_t ServeRecording_(httpd_req_t *req);
+#endif // CONFIG_EZDV_RX_RECORDER
+#if CONFIG_EZDV_METRICS_ENDPOINT
+    static esp_err_t ServeMetrics_(httpd_req_t *req);
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+#if CONFIG_EZDV_EVENT_TRACE
+    static esp_err_t ServeTrace_(httpd_req_t *req);
+#endif // CONFIG_EZDV_EVENT_TRACE
+#if CONFIG_EZDV_PACKET_CAPTURE
+    static esp_err_t ServeCapture_(httpd_req_t *req);
+#endif // CONFIG_EZDV_PACKET_CAPTURE
 };
 
 }
@@ -48,6 +48,10 @@ enum NetworkMessageTypes
     WIFI_SCAN_START = 8,
     WIFI_SCAN_STOP = 9,
     IP_ASSIGNED = 10,
+    SOCKET_READABLE = 11,
+    UPLOAD_CREDIT = 12,
+    START_FIRMWARE_DOWNLOAD = 13,
+    ACTIVE_INTERFACE_CHANGED = 14,
 };
 
 template<uint32_t MSG_ID>
@@ -69,13 +73,15 @@ using RadioConnectionStatusMessage = NetworkMessageCommon<RADIO_CONNECTION_STATU
 class StartFileUploadMessage : public DVTaskMessageBase<START_FILE_UPLOAD, StartFileUploadMessage>
 {
 public:
-    StartFileUploadMessage(int lengthProvided = 0)
+    StartFileUploadMessage(int lengthProvided = 0, int slotProvided = 0)
         : DVTaskMessageBase<START_FILE_UPLOAD, StartFileUploadMessage>(NETWORK_MESSAGE)
         , length(lengthProvided)
+        , slot(slotProvided)
         {}
     virtual ~StartFileUploadMessage() = default;
 
     int length;
+    int slot; // voice keyer slot to store the file in
 };
 
 class FileUploadDataMessage : public DVTaskMessageBase<FILE_UPLOAD_DATA, FileUploadDataMessage>
@@ -115,21 +121,55 @@ public:
     int length;
 };
 
+/// @brief Asks SoftwareUpdateTask to download and flash a firmware update
+///        from the given URL (or CONFIG_EZDV_OTA_DOWNLOAD_URL if empty) 
+///        rather than waiting for the browser to upload it.
+class StartFirmwareDownloadMessage : public DVTaskMessageBase<START_FIRMWARE_DOWNLOAD, StartFirmwareDownloadMessage>
+{
+public:
+    enum { MAX_URL_SIZE = 256 };
+
+    StartFirmwareDownloadMessage(const char* urlProvided = nullptr)
+        : DVTaskMessageBase<START_FIRMWARE_DOWNLOAD, StartFirmwareDownloadMessage>(NETWORK_MESSAGE)
+    {
+        memset(url, 0, MAX_URL_SIZE);
+
+        if (urlProvided != nullptr)
+        {
+            strncpy(url, urlProvided, MAX_URL_SIZE - 1);
+        }
+    }
+    virtual ~StartFirmwareDownloadMessage() = default;
+
+    char url[MAX_URL_SIZE];
+};
+
+/// @brief One network in a WifiNetworkListMessage.
+struct WifiNetworkListEntry
+{
+    char ssid[33];
+    bool removed; // no longer seen (only in change lists)
+};
+
+/// @brief Networks found by scanning: either all of them (e.g. when a scan
+///        is first requested) or only what changed since the last message.
 class WifiNetworkListMessage : public DVTaskMessageBase<WIFI_NETWORK_LIST, WifiNetworkListMessage>
 {
 public:
-    WifiNetworkListMessage(uint16_t numRecordsProvided = 0, wifi_ap_record_t* recordsProvided = nullptr)
+    WifiNetworkListMessage(bool fullListProvided = false, uint16_t numRecordsProvided = 0, WifiNetworkListEntry* recordsProvided = nullptr)
         : DVTaskMessageBase<WIFI_NETWORK_LIST, WifiNetworkListMessage>(NETWORK_MESSAGE)
+        , fullList(fullListProvided)
         , numRecords(numRecordsProvided)
         , records(recordsProvided)
         {}
     virtual ~WifiNetworkListMessage() = default;
 
+    bool fullList;
     uint16_t numRecords;
 
     // Note: ownership transfers to receiving component, which is responsible for
     // deleting the memory associated with this object.
-    wifi_ap_record_t* records;
+    WifiNetworkListEntry* records;
 };
 
 template<uint32_t MSG_ID>
@@ -166,6 +206,61 @@ public:
     char ip[MAX_STR_SIZE];
 };
 
+/// @brief Sent by NetworkTask when radio traffic moves to a different
+///        network interface (e.g. Ethernet was unplugged and Wi-Fi is 
+///        still up). Sockets bound to the old interface's address need to
+///        be reopened; sessions should be resumed where possible rather 
+///        than started over.
+class ActiveInterfaceChangedMessage : public DVTaskMessageBase<ACTIVE_INTERFACE_CHANGED, ActiveInterfaceChangedMessage>
+{
+public:
+    enum { MAX_STR_SIZE = 32 };
+    
+    ActiveInterfaceChangedMessage(const char* ipProvided = nullptr)
+        : DVTaskMessageBase<ACTIVE_INTERFACE_CHANGED, ActiveInterfaceChangedMessage>(NETWORK_MESSAGE)
+    {
+        memset(ip, 0, MAX_STR_SIZE);
+        
+        if (ipProvided != nullptr)
+        {
+            strncpy(ip, ipProvided, MAX_STR_SIZE - 1);
+        }
+    }
+    
+    virtual ~ActiveInterfaceChangedMessage() = default;
+    
+    char ip[MAX_STR_SIZE]; // our new address
+};
+
+/// @brief Sent by NetworkReactor to a socket's owner when it has data to read.
+///        The owner must call NetworkReactor::Rearm() to be told again.
+class SocketReadableMessage : public DVTaskMessageBase<SOCKET_READABLE, SocketReadableMessage>
+{
+public:
+    SocketReadableMessage(int socketProvided = -1)
+        : DVTaskMessageBase<SOCKET_READABLE, SocketReadableMessage>(NETWORK_MESSAGE)
+        , socket(socketProvided)
+        {}
+    virtual ~SocketReadableMessage() = default;
+
+    int socket;
+};
+
+/// @brief Sent by whoever is consuming an upload (voice keyer or firmware) 
+///        to let the browser send more chunks: an initial window when the 
+///        upload starts, then one for each chunk taken off its queue.
+class UploadCreditMessage : public DVTaskMessageBase<UPLOAD_CREDIT, UploadCreditMessage>
+{
+public:
+    UploadCreditMessage(int creditsProvided = 0)
+        : DVTaskMessageBase<UPLOAD_CREDIT, UploadCreditMessage>(NETWORK_MESSAGE)
+        , credits(creditsProvided)
+        {}
+    virtual ~UploadCreditMessage() = default;
+
+    int credits;
+};
+
 }
 
 }
@@ -0,0 +1,297 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "esp_log.h"
+
+#include "NetworkQos.h"
+#include "util/EventTrace.h"
+
+#define CURRENT_LOG_TAG "NetworkQos"
+
+// A stream that goes quiet for this long (e.g. Flex RX audio during TX) is
+// treated as starting over rather than as one very late packet.
+#define QOS_STREAM_RESTART_US (500000)
+
+// Smoothing for the interarrival mean and jitter (RFC 3550 uses 1/16).
+#define QOS_SMOOTHING_SHIFT (4)
+
+// Upper bound of the first histogram bucket; each one after is twice as wide.
+#define QOS_HISTOGRAM_FIRST_BUCKET_US (250)
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace
+{
+
+// The Wi-Fi driver picks the access category from the 802.1D user priority
+// in the top three bits of the TOS byte.
+constexpr NetworkQos::Profile MakeProfile_(int accessCategory, int sendBatchSize)
+{
+    const uint8_t userPriorities[] = { 1 /* BK */, 0 /* BE */, 5 /* VI */, 6 /* VO */ };
+    return NetworkQos::Profile {
+        (NetworkQos::AccessCategory)accessCategory,
+        (uint8_t)(userPriorities[accessCategory] << 5),
+        accessCategory != NetworkQos::AC_VOICE,
+        sendBatchSize
+    };
+}
+
+const NetworkQos::Profile Profiles_[NetworkQos::NUM_STREAM_TYPES] = {
+    MakeProfile_(CONFIG_EZDV_QOS_FLEX_VITA_AC, CONFIG_EZDV_QOS_FLEX_VITA_BATCH),
+    MakeProfile_(CONFIG_EZDV_QOS_ICOM_AUDIO_AC, 1),
+    MakeProfile_(CONFIG_EZDV_QOS_ICOM_CONTROL_AC, 1),
+    MakeProfile_(CONFIG_EZDV_QOS_ICOM_CONTROL_AC, 1),
+    MakeProfile_(CONFIG_EZDV_QOS_HTTP_AC, 1),
+};
+
+const char* StreamNames_[NetworkQos::NUM_STREAM_TYPES] = {
+    "flex-vita",
+    "icom-audio",
+    "icom-control",
+    "icom-civ",
+    "http",
+};
+
+const char* AccessCategoryNames_[] = { "BK", "BE", "VI", "VO" };
+
+}
+
+NetworkQos::StreamState NetworkQos::States_[NetworkQos::NUM_STREAM_TYPES];
+
+const NetworkQos::Profile& NetworkQos::GetProfile(StreamType type)
+{
+    assert(type < NUM_STREAM_TYPES);
+    return Profiles_[type];
+}
+
+void NetworkQos::ApplyProfile(int socket, StreamType type)
+{
+    const Profile& profile = GetProfile(type);
+
+    int tos = profile.tos;
+    if (setsockopt(socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) != 0)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Could not set TOS for %s socket %d", StreamNames_[type], socket);
+        return;
+    }
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "%s socket %d: access category %s, AMPDU %s, batch %d",
+        StreamNames_[type],
+        socket,
+        AccessCategoryNames_[profile.accessCategory],
+        profile.ampdu ? "on" : "off",
+        profile.sendBatchSize);
+}
+
+void NetworkQos::RecordSend(StreamType type, bool success)
+{
+    EZDV_TRACE(PACKET_TX, success, StreamNames_[type], 0);
+
+    StreamState& state = States_[type];
+    if (success)
+    {
+        state.numSent++;
+    }
+    else
+    {
+        state.numSendFailures++;
+    }
+}
+
+void NetworkQos::RecordSendRetries(StreamType type, uint32_t numRetries)
+{
+    States_[type].numSendRetries += numRetries;
+}
+
+void NetworkQos::RecordReceive(StreamType type, int64_t nowUs, int sequence, int sequenceBits)
+{
+    EZDV_TRACE(PACKET_RX, sequence, StreamNames_[type], 0);
+
+    StreamState& state = States_[type];
+    state.numReceived++;
+
+    int64_t intervalUs = nowUs - state.lastArrivalUs;
+    if (state.lastArrivalUs == 0 || intervalUs > QOS_STREAM_RESTART_US)
+    {
+        state.lastArrivalUs = nowUs;
+        state.meanIntervalUs = 0;
+        state.lastSequence = sequence;
+        return;
+    }
+    state.lastArrivalUs = nowUs;
+
+    // Jitter is how far each interval strays from the average one, which 
+    // works without knowing how often each stream is supposed to send.
+    if (state.meanIntervalUs == 0)
+    {
+        state.meanIntervalUs = intervalUs;
+    }
+    else
+    {
+        state.meanIntervalUs += (intervalUs - state.meanIntervalUs) >> QOS_SMOOTHING_SHIFT;
+    }
+
+    int64_t deviationUs = std::llabs(intervalUs - state.meanIntervalUs);
+    state.jitterAccumUs += (deviationUs - state.jitterAccumUs) >> QOS_SMOOTHING_SHIFT;
+    state.deviationHistogram[GetHistogramBucket_(deviationUs)]++;
+    state.deviationSumUs += deviationUs;
+
+    uint32_t jitterUs = state.jitterAccumUs;
+    state.jitterUs = jitterUs;
+    if (jitterUs > state.maxJitterUs)
+    {
+        state.maxJitterUs = jitterUs;
+    }
+
+    if (sequence >= 0 && state.lastSequence >= 0)
+    {
+        // Anything more than half the sequence space ahead is really a 
+        // duplicate or reordered packet.
+        uint32_t mask = (1u << sequenceBits) - 1;
+        uint32_t gap = (uint32_t)(sequence - state.lastSequence - 1) & mask;
+        if (gap > (mask >> 1))
+        {
+            state.numOutOfOrder++;
+            return;
+        }
+        state.numLost += gap;
+    }
+    state.lastSequence = sequence;
+}
+
+void NetworkQos::RecordLost(StreamType type, uint32_t numPackets)
+{
+    EZDV_TRACE(PACKET_LOST, 0, StreamNames_[type], numPackets);
+    States_[type].numLost += numPackets;
+}
+
+void NetworkQos::RecordOutOfOrder(StreamType type)
+{
+    States_[type].numOutOfOrder++;
+}
+
+void NetworkQos::RecordRtt(StreamType type, uint32_t rttUs)
+{
+    StreamState& state = States_[type];
+    state.rttUs = rttUs;
+    if (rttUs > state.maxRttUs)
+    {
+        state.maxRttUs = rttUs;
+    }
+    state.rttHistogram[GetHistogramBucket_(rttUs)]++;
+    state.rttSumUs += rttUs;
+}
+
+void NetworkQos::RecordRetransmitRequest(StreamType type, uint32_t numPackets)
+{
+    States_[type].numRetransmitRequests += numPackets;
+}
+
+void NetworkQos::RecordRetransmit(StreamType type)
+{
+    States_[type].numRetransmits++;
+}
+
+void NetworkQos::GetStatistics(StreamType type, Statistics& stats, bool reset)
+{
+    assert(type < NUM_STREAM_TYPES);
+    StreamState& state = States_[type];
+
+    if (reset)
+    {
+        stats.numSent = state.numSent.exchange(0);
+        stats.numSendFailures = state.numSendFailures.exchange(0);
+        stats.numSendRetries = state.numSendRetries.exchange(0);
+        stats.numReceived = state.numReceived.exchange(0);
+        stats.numLost = state.numLost.exchange(0);
+        stats.numOutOfOrder = state.numOutOfOrder.exchange(0);
+        stats.numRetransmitRequests = state.numRetransmitRequests.exchange(0);
+        stats.numRetransmits = state.numRetransmits.exchange(0);
+        stats.maxJitterUs = state.maxJitterUs.exchange(0);
+        stats.deviationSumUs = state.deviationSumUs.exchange(0);
+        stats.maxRttUs = state.maxRttUs.exchange(0);
+        stats.rttSumUs = state.rttSumUs.exchange(0);
+        for (int bucket = 0; bucket < NUM_HISTOGRAM_BUCKETS; bucket++)
+        {
+            stats.deviationHistogram[bucket] = state.deviationHistogram[bucket].exchange(0);
+            stats.rttHistogram[bucket] = state.rttHistogram[bucket].exchange(0);
+        }
+    }
+    else
+    {
+        stats.numSent = state.numSent;
+        stats.numSendFailures = state.numSendFailures;
+        stats.numSendRetries = state.numSendRetries;
+        stats.numReceived = state.numReceived;
+        stats.numLost = state.numLost;
+        stats.numOutOfOrder = state.numOutOfOrder;
+        stats.numRetransmitRequests = state.numRetransmitRequests;
+        stats.numRetransmits = state.numRetransmits;
+        stats.maxJitterUs = state.maxJitterUs;
+        stats.deviationSumUs = state.deviationSumUs;
+        stats.maxRttUs = state.maxRttUs;
+        stats.rttSumUs = state.rttSumUs;
+        for (int bucket = 0; bucket < NUM_HISTOGRAM_BUCKETS; bucket++)
+        {
+            stats.deviationHistogram[bucket] = state.deviationHistogram[bucket];
+            stats.rttHistogram[bucket] = state.rttHistogram[bucket];
+        }
+    }
+    stats.jitterUs = state.jitterUs;
+    stats.rttUs = state.rttUs;
+}
+
+const char* NetworkQos::GetStreamName(StreamType type)
+{
+    assert(type < NUM_STREAM_TYPES);
+    return StreamNames_[type];
+}
+
+uint32_t NetworkQos::GetHistogramBucketLimitUs(int bucket)
+{
+    assert(bucket >= 0 && bucket < NUM_HISTOGRAM_BUCKETS);
+    if (bucket == NUM_HISTOGRAM_BUCKETS - 1)
+    {
+        return 0;
+    }
+    return QOS_HISTOGRAM_FIRST_BUCKET_US << bucket;
+}
+
+int NetworkQos::GetHistogramBucket_(uint32_t timeUs)
+{
+    int bucket = 0;
+    while (bucket < NUM_HISTOGRAM_BUCKETS - 1 && timeUs >= (QOS_HISTOGRAM_FIRST_BUCKET_US << bucket))
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+}
+
+}
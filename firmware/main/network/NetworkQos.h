@@ -0,0 +1,177 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NETWORK_QOS_H
+#define NETWORK_QOS_H
+
+#include <atomic>
+#include <cinttypes>
+
+#include "sdkconfig.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Applies per-stream Wi-Fi QoS profiles to sockets and keeps loss/jitter
+///        counters and histograms for each stream so that profiles can be 
+///        compared and audio problems matched up with network ones. Profiles
+///        come from the CONFIG_EZDV_QOS_* options. Each stream is recorded by a
+///        single task; statistics can be read from anywhere.
+class NetworkQos
+{
+public:
+    enum StreamType
+    {
+        FLEX_VITA,
+        ICOM_AUDIO,
+        ICOM_CONTROL,
+        ICOM_CIV,
+        HTTP,
+
+        NUM_STREAM_TYPES
+    };
+
+    /// @brief WMM access categories, lowest priority first.
+    enum AccessCategory
+    {
+        AC_BACKGROUND = 0,
+        AC_BEST_EFFORT = 1,
+        AC_VIDEO = 2,
+        AC_VOICE = 3,
+    };
+
+    struct Profile
+    {
+        AccessCategory accessCategory;
+        uint8_t tos; // IP TOS byte that selects accessCategory
+        bool ampdu; // Whether the Wi-Fi driver may aggregate (it never does for AC_VOICE)
+        int sendBatchSize; // Packets sent back to back, for streams that can batch (FLEX_VITA)
+    };
+
+    // Bucket N holds times less than (250 << N) microseconds, with the last 
+    // bucket holding everything else.
+    enum { NUM_HISTOGRAM_BUCKETS = 10 };
+
+    struct Statistics
+    {
+        uint32_t numSent;
+        uint32_t numSendFailures; // dropped locally (e.g. Wi-Fi out of buffers)
+        uint32_t numSendRetries; // extra attempts while Wi-Fi was out of buffers (ENOMEM)
+        uint32_t numReceived;
+        uint32_t numLost; // gaps detected by sequence number
+        uint32_t numOutOfOrder; // arrived after a later packet
+        uint32_t numRetransmitRequests; // packets we asked the other end to resend
+        uint32_t numRetransmits; // packets we resent when asked
+        uint32_t jitterUs; // current interarrival jitter estimate
+        uint32_t maxJitterUs;
+
+        // How far each arrival strayed from the average interval.
+        uint32_t deviationHistogram[NUM_HISTOGRAM_BUCKETS];
+        uint64_t deviationSumUs;
+
+        // Round trip times of protocol pings (Icom only).
+        uint32_t rttUs; // most recent
+        uint32_t maxRttUs;
+        uint32_t rttHistogram[NUM_HISTOGRAM_BUCKETS];
+        uint64_t rttSumUs;
+    };
+
+    /// @brief Returns the profile used for the given stream.
+    static const Profile& GetProfile(StreamType type);
+
+    /// @brief Applies the stream's profile to a socket.
+    static void ApplyProfile(int socket, StreamType type);
+
+    /// @brief Records an attempt to send a packet.
+    static void RecordSend(StreamType type, bool success);
+
+    /// @brief Records retries needed to send a packet because Wi-Fi was out of buffers.
+    static void RecordSendRetries(StreamType type, uint32_t numRetries);
+
+    /// @brief Records a received packet.
+    /// @param nowUs The packet's arrival time.
+    /// @param sequence The packet's sequence number, or -1 if the protocol doesn't have one.
+    /// @param sequenceBits How many bits the sequence number has before wrapping.
+    static void RecordReceive(StreamType type, int64_t nowUs, int sequence = -1, int sequenceBits = 0);
+
+    /// @brief Records packets found to be missing by the protocol itself.
+    static void RecordLost(StreamType type, uint32_t numPackets);
+
+    /// @brief Records a packet found to be out of order by the protocol itself.
+    static void RecordOutOfOrder(StreamType type);
+
+    /// @brief Records the round trip time of a ping.
+    static void RecordRtt(StreamType type, uint32_t rttUs);
+
+    /// @brief Records a request for the other end to resend packets.
+    static void RecordRetransmitRequest(StreamType type, uint32_t numPackets);
+
+    /// @brief Records resending a packet the other end asked for.
+    static void RecordRetransmit(StreamType type);
+
+    /// @brief Retrieves the statistics gathered for a stream so far.
+    /// @param stats Structure to store the statistics in.
+    /// @param reset If true, counters start over.
+    static void GetStatistics(StreamType type, Statistics& stats, bool reset = false);
+
+    /// @brief Returns the name of a stream for logging and telemetry.
+    static const char* GetStreamName(StreamType type);
+
+    /// @brief Returns the exclusive upper bound of a histogram bucket, 
+    ///        or 0 for the last (unbounded) one.
+    static uint32_t GetHistogramBucketLimitUs(int bucket);
+
+private:
+    struct StreamState
+    {
+        std::atomic<uint32_t> numSent;
+        std::atomic<uint32_t> numSendFailures;
+        std::atomic<uint32_t> numSendRetries;
+        std::atomic<uint32_t> numReceived;
+        std::atomic<uint32_t> numLost;
+        std::atomic<uint32_t> numOutOfOrder;
+        std::atomic<uint32_t> numRetransmitRequests;
+        std::atomic<uint32_t> numRetransmits;
+        std::atomic<uint32_t> jitterUs;
+        std::atomic<uint32_t> maxJitterUs;
+        std::atomic<uint32_t> deviationHistogram[NUM_HISTOGRAM_BUCKETS];
+        std::atomic<uint64_t> deviationSumUs;
+        std::atomic<uint32_t> rttUs;
+        std::atomic<uint32_t> maxRttUs;
+        std::atomic<uint32_t> rttHistogram[NUM_HISTOGRAM_BUCKETS];
+        std::atomic<uint64_t> rttSumUs;
+
+        // Only touched by the receiving task.
+        int64_t lastArrivalUs;
+        int64_t meanIntervalUs;
+        int64_t jitterAccumUs;
+        int lastSequence;
+    };
+
+    static StreamState States_[NUM_STREAM_TYPES];
+
+    static int GetHistogramBucket_(uint32_t timeUs);
+};
+
+}
+
+}
+
+#endif // NETWORK_QOS_H
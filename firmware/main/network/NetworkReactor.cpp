@@ -0,0 +1,305 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+
+#include "esp_log.h"
+
+#include "NetworkReactor.h"
+#include "NetworkMessage.h"
+
+#define CURRENT_LOG_TAG "NetworkReactor"
+
+// The reactor only waits and posts messages, but it needs to run ahead of 
+// the tasks it wakes up (the highest being the Icom audio task).
+#define REACTOR_TASK_NAME ("NetReactor")
+#define REACTOR_TASK_PRIORITY (16)
+#define REACTOR_STACK_SIZE (3072)
+
+// How long to wait before retrying owners whose queues were full.
+#define REACTOR_RETRY_MS (10)
+
+namespace ezdv
+{
+
+namespace network
+{
+
+NetworkReactor::Registration NetworkReactor::Registrations_[NetworkReactor::MAX_SOCKETS] = {};
+portMUX_TYPE NetworkReactor::Lock_ = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t NetworkReactor::ReactorTask_ = nullptr;
+int NetworkReactor::WakeSocket_ = -1;
+bool NetworkReactor::WakePending_ = false;
+
+void NetworkReactor::Register(int socket, task::DVTask* owner)
+{
+    assert(socket >= 0 && owner != nullptr);
+
+    Start_();
+
+    bool registered = false;
+    portENTER_CRITICAL(&Lock_);
+    for (auto& registration : Registrations_)
+    {
+        if (registration.owner == nullptr)
+        {
+            registration.socket = socket;
+            registration.owner = owner;
+            registration.armed = true;
+            registration.deferred = false;
+            registered = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&Lock_);
+    assert(registered);
+
+    Wake_();
+}
+
+void NetworkReactor::Unregister(int socket)
+{
+    portENTER_CRITICAL(&Lock_);
+    for (auto& registration : Registrations_)
+    {
+        if (registration.owner != nullptr && registration.socket == socket)
+        {
+            registration.socket = -1;
+            registration.owner = nullptr;
+            registration.armed = false;
+            registration.deferred = false;
+        }
+    }
+    portEXIT_CRITICAL(&Lock_);
+
+    Wake_();
+}
+
+void NetworkReactor::Rearm(int socket)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&Lock_);
+    for (auto& registration : Registrations_)
+    {
+        if (registration.owner != nullptr && registration.socket == socket)
+        {
+            registration.armed = true;
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&Lock_);
+
+    if (found)
+    {
+        Wake_();
+    }
+}
+
+void NetworkReactor::Start_()
+{
+    // Only called from task context when connections are being set up.
+    if (ReactorTask_ != nullptr)
+    {
+        return;
+    }
+
+    for (auto& registration : Registrations_)
+    {
+        registration.socket = -1;
+        registration.owner = nullptr;
+        registration.armed = false;
+        registration.deferred = false;
+    }
+
+    // Registration changes need to interrupt select(), which we do by 
+    // sending ourselves a datagram over loopback.
+    WakeSocket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    assert(WakeSocket_ >= 0);
+
+    struct sockaddr_in wakeAddress;
+    memset(&wakeAddress, 0, sizeof(wakeAddress));
+    wakeAddress.sin_family = AF_INET;
+    wakeAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    wakeAddress.sin_port = 0;
+
+    auto rv = bind(WakeSocket_, (struct sockaddr*)&wakeAddress, sizeof(wakeAddress));
+    assert(rv == 0);
+
+    socklen_t addressLength = sizeof(wakeAddress);
+    rv = getsockname(WakeSocket_, (struct sockaddr*)&wakeAddress, &addressLength);
+    assert(rv == 0);
+
+    rv = connect(WakeSocket_, (struct sockaddr*)&wakeAddress, sizeof(wakeAddress));
+    assert(rv == 0);
+
+    fcntl(WakeSocket_, F_SETFL, O_NONBLOCK);
+
+    auto returnValue = 
+        xTaskCreate(&ReactorEntry_, REACTOR_TASK_NAME, REACTOR_STACK_SIZE, nullptr, REACTOR_TASK_PRIORITY, &ReactorTask_);
+    assert(returnValue == pdPASS);
+}
+
+void NetworkReactor::Wake_()
+{
+    if (WakeSocket_ < 0)
+    {
+        return;
+    }
+
+    // One outstanding wakeup is enough; the reactor rescans everything.
+    bool alreadyPending = false;
+    portENTER_CRITICAL(&Lock_);
+    alreadyPending = WakePending_;
+    WakePending_ = true;
+    portEXIT_CRITICAL(&Lock_);
+
+    if (!alreadyPending)
+    {
+        char wakeByte = 0;
+        send(WakeSocket_, &wakeByte, sizeof(wakeByte), 0);
+    }
+}
+
+void NetworkReactor::ReactorLoop_()
+{
+    int ready[MAX_SOCKETS];
+    bool hasDeferred = false;
+
+    for (;;)
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(WakeSocket_, &readSet);
+        int maxSocket = WakeSocket_;
+
+        portENTER_CRITICAL(&Lock_);
+        for (auto& registration : Registrations_)
+        {
+            if (registration.owner != nullptr && registration.armed)
+            {
+                FD_SET(registration.socket, &readSet);
+                if (registration.socket > maxSocket)
+                {
+                    maxSocket = registration.socket;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&Lock_);
+
+        struct timeval retryTime = { 0, REACTOR_RETRY_MS * 1000 };
+        auto rv = select(maxSocket + 1, &readSet, nullptr, nullptr, hasDeferred ? &retryTime : nullptr);
+        if (rv < 0)
+        {
+            // Most likely a socket that was closed while we were waiting;
+            // go around again with the current registrations.
+            auto err = errno;
+            ESP_LOGW(CURRENT_LOG_TAG, "select() failed with error %d (%s)", err, strerror(err));
+            vTaskDelay(pdMS_TO_TICKS(REACTOR_RETRY_MS));
+            continue;
+        }
+
+        if (FD_ISSET(WakeSocket_, &readSet))
+        {
+            portENTER_CRITICAL(&Lock_);
+            WakePending_ = false;
+            portEXIT_CRITICAL(&Lock_);
+
+            char wakeBuffer[16];
+            while (recv(WakeSocket_, wakeBuffer, sizeof(wakeBuffer), 0) > 0)
+            {
+                // empty
+            }
+        }
+
+        // Disarm ready sockets before notifying so that owners calling 
+        // Rearm() right away don't race with us. Sockets deferred last time
+        // get watched again on the next pass.
+        int numReady = 0;
+        portENTER_CRITICAL(&Lock_);
+        for (int index = 0; index < MAX_SOCKETS; index++)
+        {
+            auto& registration = Registrations_[index];
+            if (registration.owner == nullptr)
+            {
+                continue;
+            }
+            
+            if (registration.deferred)
+            {
+                registration.deferred = false;
+                registration.armed = true;
+            }
+            else if (registration.armed && FD_ISSET(registration.socket, &readSet))
+            {
+                ready[numReady++] = index;
+                registration.armed = false;
+            }
+        }
+        portEXIT_CRITICAL(&Lock_);
+
+        hasDeferred = false;
+        for (int index = 0; index < numReady; index++)
+        {
+            auto& registration = Registrations_[ready[index]];
+            
+            // Copy out in case of a concurrent Unregister(); a stale 
+            // notification is ignored by the owner.
+            portENTER_CRITICAL(&Lock_);
+            int socket = registration.socket;
+            task::DVTask* owner = registration.owner;
+            portEXIT_CRITICAL(&Lock_);
+
+            if (owner == nullptr)
+            {
+                continue;
+            }
+            else if (!owner->canPostMessage<SocketReadableMessage>())
+            {
+                // The owner is backed up; try again shortly rather than
+                // blocking notifications for everyone else.
+                portENTER_CRITICAL(&Lock_);
+                if (registration.owner == owner && registration.socket == socket)
+                {
+                    registration.deferred = true;
+                    hasDeferred = true;
+                }
+                portEXIT_CRITICAL(&Lock_);
+                continue;
+            }
+
+            SocketReadableMessage message(socket);
+            owner->post(&message);
+        }
+    }
+}
+
+void NetworkReactor::ReactorEntry_(void* arg)
+{
+    ReactorLoop_();
+}
+
+}
+
+}
@@ -0,0 +1,82 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NETWORK_REACTOR_H
+#define NETWORK_REACTOR_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "task/DVTask.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Waits in select() on every registered socket from a single task and
+///        tells each socket's owner (via SocketReadableMessage) when there's 
+///        data to read, so idle sockets don't need to be polled from timers.
+///
+/// Notifications are one-shot: once an owner has been told about a socket, the
+/// socket isn't watched again until the owner calls Rearm() (normally after 
+/// reading everything pending, or as much as its per-wakeup budget allows).
+class NetworkReactor
+{
+public:
+    /// @brief Starts watching a socket. The reactor task is started the first time this is called.
+    /// @param socket The socket to watch. Must be non-blocking.
+    /// @param owner The task to notify when the socket is readable.
+    static void Register(int socket, task::DVTask* owner);
+
+    /// @brief Stops watching a socket. Must be called before closing it.
+    /// @param socket The socket to stop watching (ignored if it isn't registered).
+    static void Unregister(int socket);
+
+    /// @brief Resumes watching a socket after its owner has handled a notification.
+    /// @param socket The socket to watch again.
+    static void Rearm(int socket);
+
+private:
+    enum { MAX_SOCKETS = 8 };
+
+    struct Registration
+    {
+        int socket;
+        task::DVTask* owner;
+        bool armed;
+        bool deferred; // owner's queue was full, retry after REACTOR_RETRY_MS
+    };
+
+    static Registration Registrations_[MAX_SOCKETS];
+    static portMUX_TYPE Lock_;
+    static TaskHandle_t ReactorTask_;
+    static int WakeSocket_;
+    static bool WakePending_;
+
+    static void Start_();
+    static void Wake_();
+    static void ReactorLoop_();
+    static void ReactorEntry_(void* arg);
+};
+
+}
+
+}
+
+#endif // NETWORK_REACTOR_H
@@ -31,6 +31,7 @@
 #include "esp_mac.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "hal/eth_types.h"
 #include "esp_eth.h"
@@ -39,12 +40,23 @@
 #include "NetworkTask.h"
 #include "HttpServerTask.h"
 #include "NetworkMessage.h"
+#include "audio/AudioGraph.h"
+#include "task/DVTaskSchedulingProfile.h"
 
 #include "interfaces/EthernetInterface.h"
 #include "interfaces/WirelessInterface.h"
 
 #define DEFAULT_AP_CHANNEL (1)
 
+// Wi-Fi scans cover one channel at a time so the STA link is only 
+// interrupted briefly; with 13 channels a full sweep takes a few seconds.
+#define WIFI_SCAN_CHANNEL_INTERVAL_US (CONFIG_EZDV_WIFI_SCAN_CHANNEL_INTERVAL_MS * 1000)
+// Scans are spread out this much more while shedding load.
+#define WIFI_SCAN_LOAD_SHED_MULTIPLIER (4)
+#define WIFI_SCAN_MAX_AGE_US (CONFIG_EZDV_WIFI_SCAN_MAX_AGE_MS * 1000LL)
+#define DEFAULT_FIRST_SCAN_CHANNEL (1)
+#define DEFAULT_NUM_SCAN_CHANNELS (13)
+
 /* Max length a file path can have on storage */
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
 #define SCRATCH_BUFSIZE 256
@@ -69,39 +81,70 @@ namespace ezdv
 namespace network
 {
     
-NetworkTask::NetworkTask(audio::AudioInput* freedvHandler, audio::AudioInput* tlv320Handler, audio::AudioInput* audioMixer, audio::VoiceKeyerTask* vkTask)
+NetworkTask::NetworkTask(audio::AudioInput* freedvHandler, audio::AudioInput* tlv320Handler, audio::AudioInput* audioMixer)
     : ezdv::task::DVTask("NetworkTask", 5, 4096, tskNO_AFFINITY, 64)
-    , wifiScanTimer_(this, this, &NetworkTask::triggerWifiScan_, 5000000, "WifiScanTimer") // 5 seconds between Wi-Fi scans
+    , wifiScanTimer_(this, this, &NetworkTask::triggerWifiScan_, WIFI_SCAN_CHANNEL_INTERVAL_US, "WifiScanTimer")
+    , wifiScanCache_(WIFI_SCAN_MAX_AGE_US)
+    , nextScanChannel_(0)
     , icomRestartTimer_(this, this, &NetworkTask::restartIcomConnection_, 10000000, "IcomRestartTimer") // 10 seconds, then restart Icom control task.
+    , httpServerTask_(nullptr)
     , icomControlTask_(nullptr)
     , icomAudioTask_(nullptr)
     , icomCIVTask_(nullptr)
     , flexTcpTask_(nullptr)
     , flexVitaTask_(nullptr)
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    , freedvMonitorTask_(nullptr)
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+    , freeDVReporterTask_(nullptr)
+    , pskReporterTask_(nullptr)
     , freedvHandler_(freedvHandler)
     , tlv320Handler_(tlv320Handler)
     , audioMixerHandler_(audioMixer)
-    , vkTask_(vkTask)
     , isAwake_(false)
     , overrideWifiSettings_(false)
     , wifiRunning_(false)
     , radioRunning_(false)
+    , radioConnected_(false)
+    , pttActive_(false)
+    , reportingAllowed_(false)
+    , reportingConfigured_(false)
+    , forceReporting_(false)
+    , reportingRefCount_(0)
     , wifiInterface_(nullptr)
+    , activeInterface_(nullptr)
 {
-    registerMessageHandler(this, &NetworkTask::onRadioStateChange_);
-    registerMessageHandler(this, &NetworkTask::onWifiSettingsMessage_);
+    wifiScanTimer_.useTimerWheel();
+    icomRestartTimer_.useTimerWheel();
+
+    registerMessageHandlers<
+        &NetworkTask::onRadioStateChange_,
+        &NetworkTask::onWifiSettingsMessage_>(this);
+
+    registerMessageHandlers<
+        &NetworkTask::onWifiScanStartMessage_,
+        &NetworkTask::onWifiScanStopMessage_,
+        &NetworkTask::onSetPTTState_>(this);
 
-    registerMessageHandler(this, &NetworkTask::onWifiScanStartMessage_);
-    registerMessageHandler(this, &NetworkTask::onWifiScanStopMessage_);
+    registerMessageHandlers<
+        &NetworkTask::onReportingSettingsMessage_,
+        &NetworkTask::onEnableReportingMessage_,
+        &NetworkTask::onDisableReportingMessage_>(this);
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    registerMessageHandlers<&NetworkTask::onLoadSheddingMessage_>(this);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 
     // Handlers for internal messages (intended to make events that happen
     // on ESP-IDF tasks happen on this one instead).
-    registerMessageHandler(this, &NetworkTask::onApAssignedIpMessage_);
-    registerMessageHandler(this, &NetworkTask::onStaAssignedIpMessage_);
-    registerMessageHandler(this, &NetworkTask::onWifiScanCompletedMessage_);
-    registerMessageHandler(this, &NetworkTask::onApStartedMessage_);
-    registerMessageHandler(this, &NetworkTask::onNetworkDownMessage_);
-    registerMessageHandler(this, &NetworkTask::onDeviceDisconnectedMessage_);
+    registerMessageHandlers<
+        &NetworkTask::onApAssignedIpMessage_,
+        &NetworkTask::onStaAssignedIpMessage_,
+        &NetworkTask::onWifiScanCompletedMessage_,
+        &NetworkTask::onApStartedMessage_,
+        &NetworkTask::onNetworkDownMessage_,
+        &NetworkTask::onDeviceDisconnectedMessage_,
+        &NetworkTask::onInterfacesChangedMessage_>(this);
 }
 
 NetworkTask::~NetworkTask()
@@ -124,14 +167,13 @@ void NetworkTask::onTaskSleep_()
     isAwake_ = false;
     
     // Stop reporting
-    if (freeDVReporterTask_.isAwake())
-    {
-        sleep(&freeDVReporterTask_, pdMS_TO_TICKS(2000));
-    }
+    reportingAllowed_ = false;
+    reportingRefCount_ = 0;
+    stopReporters_();
 
-    if (pskReporterTask_.isAwake())
+    if (reportingStateTask_.isAwake())
     {
-        sleep(&pskReporterTask_, pdMS_TO_TICKS(1000));
+        sleep(&reportingStateTask_, pdMS_TO_TICKS(1000));
     }
 
     disableHttp_();
@@ -171,6 +213,15 @@ void NetworkTask::onTaskSleep_()
         delete flexTcpTask_;
         flexTcpTask_ = nullptr;
     }
+
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    if (freedvMonitorTask_ != nullptr)
+    {
+        sleep(freedvMonitorTask_, pdMS_TO_TICKS(1000));
+        delete freedvMonitorTask_;
+        freedvMonitorTask_ = nullptr;
+    }
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
     
     disableWifi_();
 }
@@ -206,18 +257,87 @@ void NetworkTask::disableWifi_()
         delete iface;
     }
     interfaceList_.clear();
+    wifiInterface_ = nullptr;
+    activeInterface_ = nullptr;
 }
 
 void NetworkTask::enableHttp_()
 {
-    httpServerTask_.start();
+    // Created the first time the network comes up and only put to sleep 
+    // afterward, as other tasks may still refer to it (e.g. in replies).
+    if (httpServerTask_ == nullptr)
+    {
+        httpServerTask_ = new HttpServerTask();
+        assert(httpServerTask_ != nullptr);
+    }
+
+    if (!httpServerTask_->isAwake())
+    {
+        httpServerTask_->start();
+    }
 }
 
 void NetworkTask::disableHttp_()
 {
-    if (wifiRunning_)
+    if (httpServerTask_ != nullptr && httpServerTask_->isAwake())
+    {
+        sleep(httpServerTask_, pdMS_TO_TICKS(1000));
+    }
+}
+
+void NetworkTask::updateReporters_()
+{
+    // Without a callsign and grid square there's nothing to report, and
+    // otherwise there's only something to do while a radio connection
+    // wants reporting (or it's been forced on).
+    bool needed = 
+        reportingAllowed_ && reportingConfigured_ && 
+        (reportingRefCount_ > 0 || forceReporting_);
+    bool running = freeDVReporterTask_ != nullptr && freeDVReporterTask_->isAwake();
+
+    if (needed && !running)
     {
-        sleep(&httpServerTask_, pdMS_TO_TICKS(1000));
+        ESP_LOGI(CURRENT_LOG_TAG, "Starting reporters");
+
+        // As with the HTTP server, these are never deleted once created.
+        if (freeDVReporterTask_ == nullptr)
+        {
+            freeDVReporterTask_ = new FreeDVReporterTask();
+            assert(freeDVReporterTask_ != nullptr);
+
+            pskReporterTask_ = new PskReporterTask();
+            assert(pskReporterTask_ != nullptr);
+        }
+
+        start(freeDVReporterTask_, pdMS_TO_TICKS(1000));
+        start(pskReporterTask_, pdMS_TO_TICKS(1000));
+
+        // They drop messages while asleep, so they missed the radio
+        // connection(s) asking for reporting. Pass those requests on.
+        for (int count = 0; count < reportingRefCount_; count++)
+        {
+            EnableReportingMessage request;
+            sendTo(freeDVReporterTask_, &request);
+            sendTo(pskReporterTask_, &request);
+        }
+    }
+    else if (!needed && running)
+    {
+        stopReporters_();
+    }
+}
+
+void NetworkTask::stopReporters_()
+{
+    if (freeDVReporterTask_ != nullptr && freeDVReporterTask_->isAwake())
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Stopping reporters");
+        sleep(freeDVReporterTask_, pdMS_TO_TICKS(2000));
+    }
+
+    if (pskReporterTask_ != nullptr && pskReporterTask_->isAwake())
+    {
+        sleep(pskReporterTask_, pdMS_TO_TICKS(1000));
     }
 }
 
@@ -262,20 +382,21 @@ void NetworkTask::onNetworkConnected_(bool client, char* ip, uint8_t* macAddress
     // Get the current Icom radio settings
     if (!overrideWifiSettings_)
     {
-        if (!freeDVReporterTask_.isAwake())
+        // Always started, even if the reporters aren't, so that station
+        // state is already known when they are.
+        if (!reportingStateTask_.isAwake())
         {
-            start(&freeDVReporterTask_, pdMS_TO_TICKS(1000));
+            start(&reportingStateTask_, pdMS_TO_TICKS(1000));
         }
 
-        if (!pskReporterTask_.isAwake())
-        {
-            start(&pskReporterTask_, pdMS_TO_TICKS(1000));
-        }
+        // The reporters themselves are started once the reporting settings
+        // come back (see onReportingSettingsMessage_()).
+        reportingAllowed_ = true;
+        storage::RequestReportingSettingsMessage reportingRequest;
+        publish(&reportingRequest);
         
-        storage::RequestRadioSettingsMessage request;
-        publish(&request);
-
-        auto response = waitFor<storage::RadioSettingsMessage>(pdMS_TO_TICKS(2000), nullptr);
+        storage::RequestRadioSettingsMessage settingsRequest;
+        auto response = request<storage::RadioSettingsMessage>(nullptr, &settingsRequest, pdMS_TO_TICKS(2000));
         if (response != nullptr)
         {
             if (response->enabled && !radioRunning_)
@@ -295,10 +416,17 @@ void NetworkTask::onNetworkConnected_(bool client, char* ip, uint8_t* macAddress
                         case 0:
                         {
                             ESP_LOGI(CURRENT_LOG_TAG, "Starting Icom radio connectivity");
+                            task::DVTaskSchedulingProfile::SetMode(task::SCHEDULING_MODE_ICOM);
 
+#if CONFIG_EZDV_ICOM_SHARED_SOCKET_TASK
+                            // All three connections run on the audio task; the
+                            // control and CI-V task pointers stay null.
+                            icomAudioTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::ALL_SOCKETS);
+#else
                             icomControlTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::CONTROL_SOCKET);
                             icomAudioTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::AUDIO_SOCKET);
                             icomCIVTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::CIV_SOCKET);
+#endif // CONFIG_EZDV_ICOM_SHARED_SOCKET_TASK
 
                             // Wait a bit, then start the connection.
                             icomRestartTimer_.start(true);
@@ -308,10 +436,16 @@ void NetworkTask::onNetworkConnected_(bool client, char* ip, uint8_t* macAddress
                         case 1:
                         {
                             ESP_LOGI(CURRENT_LOG_TAG, "Starting FlexRadio connectivity");
+                            task::DVTaskSchedulingProfile::SetMode(task::SCHEDULING_MODE_FLEX);
 
                             flexTcpTask_ = new flex::FlexTcpTask();
                             start(flexTcpTask_, pdMS_TO_TICKS(1000));
 
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+                            freedvMonitorTask_ = new audio::FreeDVMonitorTask();
+                            start(freedvMonitorTask_, pdMS_TO_TICKS(1000));
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
                             flex::FlexConnectRadioMessage connectMessage(response->host);
                             publish(&connectMessage);
 
@@ -346,14 +480,13 @@ void NetworkTask::onNetworkDisconnected_()
     icomRestartTimer_.stop();
     
     // Force immediate state transition to idle for the radio tasks.
-    if (freeDVReporterTask_.isAwake())
-    {
-        sleep(&freeDVReporterTask_, pdMS_TO_TICKS(2000));
-    }
-    
-    if (pskReporterTask_.isAwake())
+    reportingAllowed_ = false;
+    reportingRefCount_ = 0;
+    stopReporters_();
+
+    if (reportingStateTask_.isAwake())
     {
-        sleep(&pskReporterTask_, pdMS_TO_TICKS(1000));
+        sleep(&reportingStateTask_, pdMS_TO_TICKS(1000));
     }
 
     if (icomControlTask_ != nullptr)
@@ -384,6 +517,15 @@ void NetworkTask::onNetworkDisconnected_()
         flexTcpTask_ = nullptr;
     }
 
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    if (freedvMonitorTask_ != nullptr)
+    {
+        sleep(freedvMonitorTask_, pdMS_TO_TICKS(1000));
+        delete freedvMonitorTask_;
+        freedvMonitorTask_ = nullptr;
+    }
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
     if (flexVitaTask_ != nullptr)
     {
         sleep(flexVitaTask_, pdMS_TO_TICKS(1000));
@@ -391,6 +533,8 @@ void NetworkTask::onNetworkDisconnected_()
         flexVitaTask_ = nullptr;
     }
 
+    task::DVTaskSchedulingProfile::SetMode(task::SCHEDULING_MODE_STANDALONE);
+
     // Shut down HTTP server.
     disableHttp_();
 
@@ -400,93 +544,73 @@ void NetworkTask::onNetworkDisconnected_()
 
 void NetworkTask::onRadioStateChange_(DVTask* origin, RadioConnectionStatusMessage* message)
 {
+    radioConnected_ = message->state;
+    updateWifiPowerSave_();
+
     if (message->state)
     {
         ESP_LOGI(CURRENT_LOG_TAG, "rerouting audio pipes to network");
         
-        tlv320Handler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
-            nullptr
-        );
-        
         if (radioType_ == 0)
         {
-            icomAudioTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-                freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
-        
-            freedvHandler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-                icomAudioTask_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-            );
+            audio::AudioGraph::Apply({
+                { tlv320Handler_, audio::AudioInput::RIGHT_CHANNEL },
+                { icomAudioTask_, audio::AudioInput::LEFT_CHANNEL, freedvHandler_, audio::AudioInput::RADIO_CHANNEL },
+                { freedvHandler_, audio::AudioInput::RADIO_CHANNEL, icomAudioTask_, audio::AudioInput::LEFT_CHANNEL },
+            }, AUDIO_ROUTE_FADE_IN_SAMPLES);
+
+            audio::AudioGraph::LogLatencyBudget("TX", {
+                { freedvHandler_, audio::AudioInput::USER_CHANNEL },
+                { icomAudioTask_, audio::AudioInput::LEFT_CHANNEL },
+            });
         }
         else if (radioType_ == 1)
         {
             // Flex 100% goes through SmartSDR, so disable TLV320 user port handling
-            tlv320Handler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                nullptr
-            );
-            
-            // Make sure voice keyer can restore Flex mic device once done.
-            vkTask_->setMicDeviceTask(flexVitaTask_);
-            
-            flexVitaTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
-                
-            flexVitaTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
-                freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
-                
-            freedvHandler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-                flexVitaTask_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
-                
-            audioMixerHandler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                flexVitaTask_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
+            audio::AudioGraph::Apply({
+                { tlv320Handler_, audio::AudioInput::LEFT_CHANNEL },
+                { tlv320Handler_, audio::AudioInput::RIGHT_CHANNEL },
+                { flexVitaTask_, audio::AudioInput::LEFT_CHANNEL, freedvHandler_, audio::AudioInput::USER_CHANNEL },
+                { flexVitaTask_, audio::AudioInput::RIGHT_CHANNEL, freedvHandler_, audio::AudioInput::RADIO_CHANNEL },
+                { freedvHandler_, audio::AudioInput::RADIO_CHANNEL, flexVitaTask_, audio::AudioInput::RADIO_CHANNEL },
+                { audioMixerHandler_, audio::AudioInput::LEFT_CHANNEL, flexVitaTask_, audio::AudioInput::USER_CHANNEL },
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+                { flexVitaTask_, flex::FlexVitaTask::SECONDARY_SLICE_CHANNEL, freedvMonitorTask_, audio::AudioInput::LEFT_CHANNEL },
+                { freedvMonitorTask_, audio::AudioInput::LEFT_CHANNEL, flexVitaTask_, flex::FlexVitaTask::SECONDARY_SLICE_CHANNEL },
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+            }, AUDIO_ROUTE_FADE_IN_SAMPLES);
+
+            audio::AudioGraph::LogLatencyBudget("TX", {
+                { freedvHandler_, audio::AudioInput::USER_CHANNEL },
+                { flexVitaTask_, audio::AudioInput::RADIO_CHANNEL },
+            });
+            audio::AudioGraph::LogLatencyBudget("RX", {
+                { freedvHandler_, audio::AudioInput::RADIO_CHANNEL },
+                { audioMixerHandler_, audio::AudioInput::LEFT_CHANNEL },
+                { flexVitaTask_, audio::AudioInput::USER_CHANNEL },
+            });
         }
     }
     else
     {
         ESP_LOGI(CURRENT_LOG_TAG, "rerouting audio pipes internally");
 
-        // Make sure voice keyer can restore TLV320 mic device once done.
-        vkTask_->setMicDeviceTask(tlv320Handler_);
-        
-        tlv320Handler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-            freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-        );
-            
-        tlv320Handler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::RIGHT_CHANNEL, 
-            freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
-        );
-        
-        if (icomAudioTask_ != nullptr)
-        {
-            icomAudioTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-                nullptr
-            );
-        }
-
-        freedvHandler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-            tlv320Handler_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-        );
-            
-        audioMixerHandler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-            tlv320Handler_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-        );
+        // Network tasks are disconnected as part of the same change so
+        // that FreeDV's inputs only ever have one writer. Null tasks
+        // are skipped.
+        audio::AudioGraph::Apply({
+            { icomAudioTask_, audio::AudioInput::LEFT_CHANNEL },
+            { flexVitaTask_, audio::AudioInput::LEFT_CHANNEL },
+            { flexVitaTask_, audio::AudioInput::RIGHT_CHANNEL },
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+            { flexVitaTask_, flex::FlexVitaTask::SECONDARY_SLICE_CHANNEL },
+            { freedvMonitorTask_, audio::AudioInput::LEFT_CHANNEL },
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+            { tlv320Handler_, audio::AudioInput::LEFT_CHANNEL, freedvHandler_, audio::AudioInput::LEFT_CHANNEL },
+            { tlv320Handler_, audio::AudioInput::RIGHT_CHANNEL, freedvHandler_, audio::AudioInput::RIGHT_CHANNEL },
+            { freedvHandler_, audio::AudioInput::RADIO_CHANNEL, tlv320Handler_, audio::AudioInput::RADIO_CHANNEL },
+            { audioMixerHandler_, audio::AudioInput::LEFT_CHANNEL, tlv320Handler_, audio::AudioInput::USER_CHANNEL },
+        }, AUDIO_ROUTE_FADE_IN_SAMPLES);
             
         if (radioType_ == 0)
         {
@@ -507,8 +631,13 @@ void NetworkTask::onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMe
         ESP_ERROR_CHECK(esp_netif_init());
         ESP_ERROR_CHECK(esp_event_loop_create_default());
         
+        // Every change is also passed on so that radio traffic can move 
+        // between interfaces without the radio connection being torn down.
         interfaces::INetworkInterface::OnNetworkUpDownHandlerType apUpHandler = [&](interfaces::INetworkInterface&)
         {
+            InterfacesChangedMessage changed;
+            post(&changed);
+
             if (numInterfacesRunning_() == 1)
             {
                 ApStartedMessage message;
@@ -518,6 +647,9 @@ void NetworkTask::onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMe
         
         interfaces::INetworkInterface::OnNetworkIpAssignedType staUpHandler = [&](interfaces::INetworkInterface&, std::string ip)
         {
+            InterfacesChangedMessage changed;
+            post(&changed);
+
             if (numInterfacesRunning_() == 1)
             {
                 StaAssignedIpMessage message(ip.c_str());
@@ -527,6 +659,9 @@ void NetworkTask::onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMe
         
         interfaces::INetworkInterface::OnNetworkUpDownHandlerType downHandler = [&](interfaces::INetworkInterface&)
         {
+            InterfacesChangedMessage changed;
+            post(&changed);
+
             if (numInterfacesRunning_() == 0)
             {
                 NetworkDownMessage message;
@@ -582,6 +717,9 @@ void NetworkTask::onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMe
             iface->setHostname(message->hostname);
         }
         
+        // Nothing's streaming yet.
+        updateWifiPowerSave_();
+
         // Start SNTP
         esp_sntp_init();
         esp_sntp_setservername(0, "pool.ntp.org");
@@ -596,31 +734,77 @@ int NetworkTask::numInterfacesRunning_()
         if (iface->status() == interfaces::INetworkInterface::INTERFACE_IP_UP)
         {
             count++;
-            
-            if (count == 1)
-            {
-                // First network interface found should be the default.
-                iface->setAsDefaultInterface();
-            }
         }
     }
     
     return count;
 }
 
+void NetworkTask::updateActiveInterface_()
+{
+    // interfaceList_ is in order of preference. The others stay up so 
+    // they're ready to take over.
+    interfaces::INetworkInterface* bestInterface = nullptr;
+    for (auto& iface : interfaceList_)
+    {
+        if (iface->status() == interfaces::INetworkInterface::INTERFACE_IP_UP)
+        {
+            bestInterface = iface;
+            break;
+        }
+    }
+
+    if (bestInterface == activeInterface_)
+    {
+        return;
+    }
+
+    auto previousInterface = activeInterface_;
+    activeInterface_ = bestInterface;
+    if (bestInterface == nullptr)
+    {
+        // Nothing left; onNetworkDisconnected_() takes it from here.
+        return;
+    }
+
+    bestInterface->setAsDefaultInterface();
+    if (previousInterface == nullptr)
+    {
+        // First interface up; the normal connection logic applies.
+        return;
+    }
+
+    char ip[ActiveInterfaceChangedMessage::MAX_STR_SIZE] = {0};
+    bestInterface->getIpAddress(ip, sizeof(ip));
+    ESP_LOGI(CURRENT_LOG_TAG, "Moving radio traffic to interface with IP %s", ip);
+
+    IpAddressAssignedMessage ipAssigned(ip);
+    publish(&ipAssigned);
+
+    ActiveInterfaceChangedMessage changed(ip);
+    publish(&changed);
+}
+
+void NetworkTask::onInterfacesChangedMessage_(DVTask* origin, InterfacesChangedMessage* message)
+{
+    updateActiveInterface_();
+}
+
 void NetworkTask::restartIcomConnection_(DVTimer*)
 {
-    storage::RequestRadioSettingsMessage request;
-    publish(&request);
-    
-    auto response = waitFor<storage::RadioSettingsMessage>(pdMS_TO_TICKS(2000), nullptr);
+    storage::RequestRadioSettingsMessage settingsRequest;
+    auto response = request<storage::RadioSettingsMessage>(nullptr, &settingsRequest, pdMS_TO_TICKS(2000));
     if (response != nullptr)
     {
         ESP_LOGI(CURRENT_LOG_TAG, "Starting Icom radio connectivity");
 
+#if CONFIG_EZDV_ICOM_SHARED_SOCKET_TASK
+        start(icomAudioTask_, pdMS_TO_TICKS(1000));
+#else
         start(icomControlTask_, pdMS_TO_TICKS(1000));
         start(icomAudioTask_, pdMS_TO_TICKS(1000));
         start(icomCIVTask_, pdMS_TO_TICKS(1000));
+#endif // CONFIG_EZDV_ICOM_SHARED_SOCKET_TASK
 
         icom::IcomConnectRadioMessage connectMessage(response->host, response->port, response->username, response->password);
         publish(&connectMessage);
@@ -633,7 +817,31 @@ void NetworkTask::restartIcomConnection_(DVTimer*)
 
 void NetworkTask::triggerWifiScan_(DVTimer*)
 {
-    wifiInterface_->beginScan();
+    if (wifiInterface_ == nullptr)
+    {
+        return;
+    }
+
+    // One channel per scan, visiting each of the ones allowed here in turn.
+    uint8_t firstChannel = DEFAULT_FIRST_SCAN_CHANNEL;
+    uint8_t numChannels = DEFAULT_NUM_SCAN_CHANNELS;
+    wifi_country_t country;
+    if (esp_wifi_get_country(&country) == ESP_OK && country.nchan > 0)
+    {
+        firstChannel = country.schan;
+        numChannels = country.nchan;
+    }
+
+    if (nextScanChannel_ < firstChannel || nextScanChannel_ >= firstChannel + numChannels)
+    {
+        nextScanChannel_ = firstChannel;
+    }
+
+    if (!wifiInterface_->beginScan(nextScanChannel_++))
+    {
+        // Try the next one later; there won't be a scan complete event.
+        wifiScanTimer_.start(true);
+    }
 }
 
 void NetworkTask::onWifiScanComplete_()
@@ -665,9 +873,21 @@ void NetworkTask::onWifiScanComplete_()
     // Grab the list of access points found.
     ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&numNetworks, apRecords));
 
-    // Publish list of Wi-Fi networks to interested parties.
-    WifiNetworkListMessage message(numNetworks, apRecords);
-    publish(&message);
+    int64_t nowUs = esp_timer_get_time();
+    wifiScanCache_.update(apRecords, numNetworks, nowUs);
+    wifiScanCache_.expire(nowUs);
+    free(apRecords);
+
+    // Only tell interested parties what's changed.
+    if (wifiScanCache_.numChanges() > 0)
+    {
+        auto changes = (WifiNetworkListEntry*)calloc(WifiScanCache::MAX_ENTRIES, sizeof(WifiNetworkListEntry));
+        assert(changes != nullptr);
+
+        int numChanges = wifiScanCache_.takeChanges(changes);
+        WifiNetworkListMessage message(false, numChanges, changes);
+        publish(&message);
+    }
 
     // Restart Wi-Fi scan after a predefined time interval.
     wifiScanTimer_.start(true);
@@ -678,6 +898,17 @@ void NetworkTask::onWifiScanStartMessage_(DVTask* origin, StartWifiScanMessage*
     ESP_LOGI(CURRENT_LOG_TAG, "Starting Wi-Fi scan");
     
     wifiScanTimer_.stop();
+
+    // Whoever's just started watching gets everything found so far; the
+    // scans below then keep it up to date.
+    wifiScanCache_.expire(esp_timer_get_time());
+    auto networks = (WifiNetworkListEntry*)calloc(WifiScanCache::MAX_ENTRIES, sizeof(WifiNetworkListEntry));
+    assert(networks != nullptr);
+
+    int numNetworks = wifiScanCache_.takeAll(networks);
+    WifiNetworkListMessage list(true, numNetworks, networks);
+    publish(&list);
+
     triggerWifiScan_(nullptr);
 }
 
@@ -720,6 +951,72 @@ void NetworkTask::onNetworkDownMessage_(DVTask* origin, NetworkDownMessage* mess
     }
 }
 
+void NetworkTask::onSetPTTState_(DVTask* origin, audio::FreeDVSetPTTStateMessage* message)
+{
+    pttActive_ = message->pttState;
+    updateWifiPowerSave_();
+}
+
+void NetworkTask::onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message)
+{
+    reportingConfigured_ = message->callsign[0] != 0 && message->gridSquare[0] != 0;
+    forceReporting_ = message->forceReporting;
+    updateReporters_();
+}
+
+void NetworkTask::onEnableReportingMessage_(DVTask* origin, EnableReportingMessage* message)
+{
+    // Reporters that already exist receive this too.
+    reportingRefCount_++;
+    updateReporters_();
+}
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+void NetworkTask::onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message)
+{
+    uint64_t intervalUs = WIFI_SCAN_CHANNEL_INTERVAL_US;
+    if (message->level >= telemetry::LoadSheddingMessage::SHED_BACKGROUND)
+    {
+        intervalUs *= WIFI_SCAN_LOAD_SHED_MULTIPLIER;
+    }
+    wifiScanTimer_.changeInterval(intervalUs);
+}
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+void NetworkTask::onDisableReportingMessage_(DVTask* origin, DisableReportingMessage* message)
+{
+    if (reportingRefCount_ > 0)
+    {
+        reportingRefCount_--;
+    }
+    updateReporters_();
+}
+
+void NetworkTask::updateWifiPowerSave_()
+{
+    if (wifiInterface_ == nullptr)
+    {
+        return;
+    }
+
+    if (radioConnected_)
+    {
+        // Modem sleep delays (and bunches up) VITA/Icom audio packets.
+        wifiInterface_->setPowerSaveProfile(interfaces::WirelessInterface::POWER_SAVE_NONE);
+    }
+    else if (pttActive_)
+    {
+        // No network audio, but TX state updates (web UI, reporters) 
+        // shouldn't wait for a long listen interval.
+        wifiInterface_->setPowerSaveProfile(interfaces::WirelessInterface::POWER_SAVE_MIN);
+    }
+    else
+    {
+        // Idle or only serving the web UI.
+        wifiInterface_->setPowerSaveProfile(interfaces::WirelessInterface::POWER_SAVE_MAX);
+    }
+}
+
 void NetworkTask::onDeviceDisconnectedMessage_(DVTask* origin, DeviceDisconnectedMessage* message)
 {
     // Prevent attempted reconnection of radio if that's the device
@@ -27,14 +27,24 @@
 #include "flex/FlexVitaTask.h"
 #include "FreeDVReporterTask.h"
 #include "PskReporterTask.h"
+#include "ReportingStateTask.h"
 
 #include "audio/AudioInput.h"
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+#include "audio/FreeDVMonitorTask.h"
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
 #include "audio/VoiceKeyerTask.h"
+#include "audio/FreeDVMessage.h"
 
 #include "NetworkMessage.h"
 #include "storage/SettingsMessage.h"
 
+#if CONFIG_EZDV_LOAD_GOVERNOR
+#include "telemetry/TelemetryMessage.h"
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
 #include "HttpServerTask.h"
+#include "WifiScanCache.h"
 
 #include "interfaces/INetworkInterface.h"
 #include "interfaces/WirelessInterface.h"
@@ -58,7 +68,7 @@ class HttpServerTask;
 class NetworkTask : public DVTask
 {
 public:
-    NetworkTask(ezdv::audio::AudioInput* freedvHandler, ezdv::audio::AudioInput* tlv320Handler, ezdv::audio::AudioInput* audioMixerHandler, audio::VoiceKeyerTask* vkTask);
+    NetworkTask(ezdv::audio::AudioInput* freedvHandler, ezdv::audio::AudioInput* tlv320Handler, ezdv::audio::AudioInput* audioMixerHandler);
     virtual ~NetworkTask();
     
     void setWiFiOverride(bool wifiOverride);
@@ -76,6 +86,7 @@ private:
         AP_STARTED = 4,
         NETWORK_DOWN = 5,
         DEVICE_DISCONNECTED = 6,
+        INTERFACES_CHANGED = 7,
     };
 
     class ApAssignedIpMessage : public DVTaskMessageBase<AP_ASSIGNED_IP, ApAssignedIpMessage>
@@ -135,6 +146,7 @@ private:
     using WifiScanCompletedMessage = ZeroArgumentMessageCommon<WIFI_SCAN_COMPLETED>;
     using ApStartedMessage = ZeroArgumentMessageCommon<AP_STARTED>;
     using NetworkDownMessage = ZeroArgumentMessageCommon<NETWORK_DOWN>;
+    using InterfacesChangedMessage = ZeroArgumentMessageCommon<INTERFACES_CHANGED>;
 
     class DeviceDisconnectedMessage : public DVTaskMessageBase<DEVICE_DISCONNECTED, DeviceDisconnectedMessage>
     {
@@ -155,45 +167,74 @@ private:
     };
 
     DVTimer wifiScanTimer_;
+    WifiScanCache wifiScanCache_;
+    uint8_t nextScanChannel_;
     DVTimer icomRestartTimer_;
-    HttpServerTask httpServerTask_;
+    HttpServerTask* httpServerTask_; // created the first time the network comes up
     icom::IcomSocketTask* icomControlTask_;
     icom::IcomSocketTask* icomAudioTask_;
     icom::IcomSocketTask* icomCIVTask_;
     flex::FlexTcpTask* flexTcpTask_;
     flex::FlexVitaTask* flexVitaTask_;
-    FreeDVReporterTask freeDVReporterTask_;
-    PskReporterTask pskReporterTask_;
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    audio::FreeDVMonitorTask* freedvMonitorTask_; // decodes the second Flex slice
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+    FreeDVReporterTask* freeDVReporterTask_; // see updateReporters_()
+    PskReporterTask* pskReporterTask_;
+    ReportingStateTask reportingStateTask_; // shared by the reporters
     
     // for rerouting audio after connection
     ezdv::audio::AudioInput* freedvHandler_;
     ezdv::audio::AudioInput* tlv320Handler_; 
     ezdv::audio::AudioInput* audioMixerHandler_; 
-    ezdv::audio::VoiceKeyerTask* vkTask_; 
     
     bool isAwake_;
     bool overrideWifiSettings_;
     bool wifiRunning_;
     bool radioRunning_;
+    bool radioConnected_;
+    bool pttActive_;
+    bool reportingAllowed_;
+    bool reportingConfigured_; // callsign and grid square set
+    bool forceReporting_;
+    int reportingRefCount_; // number of radio connections that want reporting
     int radioType_;
     esp_event_handler_instance_t wifiEventHandle_;
     esp_event_handler_instance_t  ipEventHandle_;
     uint8_t radioMac_[6];
     std::vector<interfaces::INetworkInterface*> interfaceList_;
     interfaces::WirelessInterface* wifiInterface_;
+    interfaces::INetworkInterface* activeInterface_; // carries radio traffic
     
     void disableWifi_();
     void enableHttp_();
     void disableHttp_();
+
+    /// @brief Starts the reporters when they have something to do and puts
+    ///        them to sleep once they don't. They're only created the first
+    ///        time they're needed, so units that never report don't pay for
+    ///        them.
+    void updateReporters_();
+    void stopReporters_();
     
     void onNetworkUp_();
     void onNetworkConnected_(bool client, char* ip, uint8_t* macAddress);
     void onNetworkDisconnected_();
+
+    /// @brief Picks the Wi-Fi power save profile for what we're currently doing.
+    void updateWifiPowerSave_();
     
     void onRadioStateChange_(DVTask* origin, RadioConnectionStatusMessage* message);
     void onWifiSettingsMessage_(DVTask* origin, storage::WifiSettingsMessage* message);
     void onWifiScanStartMessage_(DVTask* origin, StartWifiScanMessage* message);
     void onWifiScanStopMessage_(DVTask* origin, StopWifiScanMessage* message);
+    void onSetPTTState_(DVTask* origin, audio::FreeDVSetPTTStateMessage* message);
+    void onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message);
+    void onEnableReportingMessage_(DVTask* origin, EnableReportingMessage* message);
+    void onDisableReportingMessage_(DVTask* origin, DisableReportingMessage* message);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    void onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
     
     void restartIcomConnection_(DVTimer*);
     void triggerWifiScan_(DVTimer*);
@@ -207,6 +248,12 @@ private:
     void onDeviceDisconnectedMessage_(DVTask* origin, DeviceDisconnectedMessage* message);
     
     int numInterfacesRunning_();
+
+    /// @brief Picks the interface to use for radio traffic (the first one in
+    ///        interfaceList_ that's up, i.e. wired over Wi-Fi) and tells the
+    ///        radio tasks if it changed.
+    void updateActiveInterface_();
+    void onInterfacesChangedMessage_(DVTask* origin, InterfacesChangedMessage* message);
 };
 
 }
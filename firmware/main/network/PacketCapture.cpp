@@ -0,0 +1,187 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "PacketCapture.h"
+
+#define CURRENT_LOG_TAG ("PacketCapture")
+
+#define PACKET_CAPTURE_SIZE_BYTES (CONFIG_EZDV_PACKET_CAPTURE_SIZE_KB * 1024)
+
+// Output is handed to the caller in pieces of this size.
+#define PACKET_CAPTURE_CHUNK_SIZE (4096)
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace
+{
+
+// Only protects reserving space in the buffer; packets are copied in 
+// after the lock is released.
+portMUX_TYPE CaptureLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+char* Buffer_ = nullptr;
+uint32_t BufferUsed_ = 0;
+bool IsCapturing_ = false;
+
+}
+
+bool PacketCapture::Start()
+{
+    if (Buffer_ == nullptr)
+    {
+        // Kept for the rest of this boot once allocated.
+        Buffer_ = (char*)heap_caps_malloc(PACKET_CAPTURE_SIZE_BYTES, MALLOC_CAP_SPIRAM);
+        if (Buffer_ == nullptr)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not allocate %d bytes for packet capture", PACKET_CAPTURE_SIZE_BYTES);
+            return false;
+        }
+    }
+
+    portENTER_CRITICAL_SAFE(&CaptureLock_);
+    BufferUsed_ = 0;
+    IsCapturing_ = true;
+    portEXIT_CRITICAL_SAFE(&CaptureLock_);
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Packet capture started");
+    return true;
+}
+
+void PacketCapture::Stop()
+{
+    portENTER_CRITICAL_SAFE(&CaptureLock_);
+    bool wasCapturing = IsCapturing_;
+    IsCapturing_ = false;
+    portEXIT_CRITICAL_SAFE(&CaptureLock_);
+
+    if (wasCapturing)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Packet capture stopped (%" PRIu32 " bytes)", BufferUsed_);
+    }
+}
+
+void PacketCapture::Record(NetworkQos::StreamType stream, const void* data, size_t length)
+{
+    // Checked without the lock first so that there's next to no cost when
+    // no capture is running.
+    if (!IsCapturing_)
+    {
+        return;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    uint32_t capturedLength = std::min(length, (size_t)PCAP_SNAPLEN - sizeof(StreamHeader));
+    uint32_t recordSize = sizeof(PcapRecordHeader) + sizeof(StreamHeader) + capturedLength;
+
+    char* record = nullptr;
+    bool isFull = false;
+    portENTER_CRITICAL_SAFE(&CaptureLock_);
+    if (IsCapturing_)
+    {
+        if (BufferUsed_ + recordSize <= PACKET_CAPTURE_SIZE_BYTES)
+        {
+            record = Buffer_ + BufferUsed_;
+            BufferUsed_ += recordSize;
+        }
+        else
+        {
+            // Stopping rather than wrapping keeps the capture contiguous,
+            // which is what replaying it needs.
+            IsCapturing_ = false;
+            isFull = true;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&CaptureLock_);
+
+    if (isFull)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Packet capture buffer full, stopping capture");
+    }
+
+    if (record == nullptr)
+    {
+        return;
+    }
+
+    PcapRecordHeader recordHeader = {
+        .timestampSec = (uint32_t)(nowUs / 1000000),
+        .timestampUsec = (uint32_t)(nowUs % 1000000),
+        .capturedLength = (uint32_t)(sizeof(StreamHeader) + capturedLength),
+        .originalLength = (uint32_t)(sizeof(StreamHeader) + length),
+    };
+    StreamHeader streamHeader = {
+        .stream = (uint8_t)stream,
+        .reserved = { 0, 0, 0 },
+    };
+
+    memcpy(record, &recordHeader, sizeof(recordHeader));
+    record += sizeof(recordHeader);
+    memcpy(record, &streamHeader, sizeof(streamHeader));
+    record += sizeof(streamHeader);
+    memcpy(record, data, capturedLength);
+}
+
+bool PacketCapture::Dump(WriteFn fn, void* arg)
+{
+    Stop();
+
+    // Let anyone who reserved space before we stopped finish copying into it.
+    vTaskDelay(1);
+
+    PcapFileHeader fileHeader = {
+        .magic = PCAP_MAGIC,
+        .versionMajor = 2,
+        .versionMinor = 4,
+        .thisZone = 0,
+        .sigFigs = 0,
+        .snapLen = PCAP_SNAPLEN,
+        .linkType = PCAP_LINKTYPE,
+    };
+
+    if (!fn(arg, (const char*)&fileHeader, sizeof(fileHeader)))
+    {
+        return false;
+    }
+
+    for (uint32_t offset = 0; offset < BufferUsed_; offset += PACKET_CAPTURE_CHUNK_SIZE)
+    {
+        uint32_t length = std::min(BufferUsed_ - offset, (uint32_t)PACKET_CAPTURE_CHUNK_SIZE);
+        if (!fn(arg, Buffer_ + offset, length))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
+
+}
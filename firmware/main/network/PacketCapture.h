@@ -0,0 +1,102 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <cinttypes>
+#include <cstddef>
+
+#include "sdkconfig.h"
+#include "NetworkQos.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Records datagrams received from the radio (Flex VITA and the Icom 
+///        control, CI-V and audio streams) with their arrival times so that
+///        they can be replayed later without a radio (see firmware/host). 
+///        Captures go into PSRAM until full or stopped and are downloaded as
+///        a pcap file. Safe to use from any task.
+class PacketCapture
+{
+public:
+    // Capture file format: a classic pcap (microsecond timestamps, relative 
+    // to boot) using a private link type. Each packet is a StreamHeader 
+    // followed by the datagram as received.
+    enum 
+    { 
+        PCAP_MAGIC = 0xa1b2c3d4,
+        PCAP_LINKTYPE = 147, // LINKTYPE_USER0
+        PCAP_SNAPLEN = 2048,
+    };
+
+#pragma pack(push, 1)
+    struct PcapFileHeader
+    {
+        uint32_t magic;
+        uint16_t versionMajor;
+        uint16_t versionMinor;
+        int32_t thisZone;
+        uint32_t sigFigs;
+        uint32_t snapLen;
+        uint32_t linkType;
+    };
+
+    struct PcapRecordHeader
+    {
+        uint32_t timestampSec;
+        uint32_t timestampUsec;
+        uint32_t capturedLength;
+        uint32_t originalLength;
+    };
+
+    struct StreamHeader
+    {
+        uint8_t stream; // NetworkQos::StreamType
+        uint8_t reserved[3];
+    };
+#pragma pack(pop)
+
+    /// @brief Called with each piece of a download. Returns false to stop early.
+    using WriteFn = bool(*)(void* arg, const char* data, size_t length);
+
+    /// @brief Discards anything captured so far and starts capturing.
+    /// @return false if there isn't enough memory for the capture.
+    static bool Start();
+
+    /// @brief Stops capturing. What was captured is kept until the next Start().
+    static void Stop();
+
+    /// @brief Records a received datagram if a capture is running.
+    static void Record(NetworkQos::StreamType stream, const void* data, size_t length);
+
+    /// @brief Stops capturing and writes the capture as a pcap file.
+    /// @param fn Called with each piece of output, in order.
+    /// @param arg Passed to fn.
+    /// @return false if fn stopped the download.
+    static bool Dump(WriteFn fn, void* arg);
+};
+
+}
+
+}
+
+#endif // PACKET_CAPTURE_H
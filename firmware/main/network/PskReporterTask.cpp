@@ -15,23 +15,35 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <ctime>
 #include <string>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netdb.h>
+
+#include "lwip/dns.h"
+#include "lwip/tcpip.h"
 
 #include "PskReporterTask.h"
 #include "esp_app_desc.h"
+#include "esp_heap_caps.h"
 
 #define PSK_REPORTER_HOSTNAME "report.pskreporter.info"
-#define PSK_REPORTER_PORT "4739" /* or 14739 for testing/debugging */
+#define PSK_REPORTER_PORT (4739) /* or 14739 for testing/debugging */
 #define PSK_REPORTER_MODE "FREEDV"
 
+// Keeps datagrams below the typical path MTU. Any records that don't fit
+// go out in additional datagrams.
+#define PSK_REPORTER_MAX_DATAGRAM_SIZE (1200)
+
 // We should be sending every 5 min, but as an embedded device
 // we can lose internet at any time, so a shorter interval is fine
 // and unlikely to cause problems with the server.
 #define PSK_REPORTER_SEND_INTERVAL_MS (60000) 
 
+// How much longer spots are batched up while shedding load.
+#define PSK_REPORTER_LOAD_SHED_MULTIPLIER (4)
+
 #define CURRENT_LOG_TAG "PskReporter"
 
 // RX record:
@@ -58,6 +70,11 @@ static const unsigned char txFormatHeader[] = {
     0x00, 0x96, 0x00, 0x04
 };
 
+extern "C"
+{
+    DV_EVENT_DEFINE_BASE(PSK_REPORTER_MESSAGE);
+}
+
 namespace ezdv
 {
 
@@ -74,12 +91,29 @@ PskReporterTask::PskReporterTask()
     , forceReporting_(false)
     , reportingRefCount_(0)
     , currentSequenceNumber_(0)
+    , dnsLookupInProgress_(false)
+    , hasServerAddress_(false)
+    , socket_(-1)
+    , socketFamily_(AF_UNSPEC)
 {
-    registerMessageHandler(this, &PskReporterTask::onReportingSettingsMessage_);
-    registerMessageHandler(this, &PskReporterTask::onEnableReportingMessage_);
-    registerMessageHandler(this, &PskReporterTask::onDisableReportingMessage_);
-    registerMessageHandler(this, &PskReporterTask::onFreeDVCallsignReceivedMessage_);
-    registerMessageHandler(this, &PskReporterTask::onReportFrequencyChangeMessage_);
+    udpSendTimer_.useTimerWheel();
+
+    registerMessageHandlers<
+        &PskReporterTask::onReportingSettingsMessage_,
+        &PskReporterTask::onEnableReportingMessage_,
+        &PskReporterTask::onDisableReportingMessage_,
+        &PskReporterTask::onFreeDVCallsignReceivedMessage_,
+        &PskReporterTask::onReportStationStateMessage_,
+        &PskReporterTask::onDnsResultMessage_>(this);
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    registerMessageHandlers<&PskReporterTask::onLoadSheddingMessage_>(this);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+    ip_addr_set_zero(&serverAddress_);
+
+    packetBuffer_ = (char*)heap_caps_malloc(PSK_REPORTER_MAX_DATAGRAM_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    assert(packetBuffer_ != nullptr);
 
     srand(time(0));
     randomIdentifier_ = rand();
@@ -94,6 +128,8 @@ PskReporterTask::~PskReporterTask()
     {
         stopConnection_();
     }
+
+    heap_caps_free(packetBuffer_);
 }
 
 void PskReporterTask::onTaskStart_()
@@ -102,9 +138,9 @@ void PskReporterTask::onTaskStart_()
     storage::RequestReportingSettingsMessage reportingRequest;
     publish(&reportingRequest);
 
-    // Request current FreeDV mode
-    audio::RequestGetFreeDVModeMessage modeRequest;
-    publish(&modeRequest);
+    // Request current frequency
+    RequestStationStateMessage stateRequest;
+    publish(&stateRequest);
 }
 
 void PskReporterTask::onTaskSleep_()
@@ -159,13 +195,6 @@ void PskReporterTask::onReportingSettingsMessage_(DVTask* origin, storage::Repor
             post(&request);
         }
     }
-    
-    // If reporting is forced, unconditionally send frequency update.
-    if (forceReporting_)
-    {
-        ReportFrequencyChangeMessage request(message->freqHz);
-        post(&request);
-    }
 }
 
 void PskReporterTask::onEnableReportingMessage_(DVTask* origin, EnableReportingMessage* message)
@@ -195,31 +224,158 @@ void PskReporterTask::onFreeDVCallsignReceivedMessage_(DVTask* origin, audio::Fr
 {
     if (reportingEnabled_)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "Adding %s to callsign list", message->callsign);
-        recordList_.push_back(SenderRecord(message->callsign, frequencyHz_, (int)message->snr));
+        // Only report each station once per interval (with its best SNR). The
+        // list is short enough for a linear search to be fine.
+        SenderRecord record(message->callsign, frequencyHz_, (int)message->snr);
+        auto existing = std::find_if(recordList_.begin(), recordList_.end(), [&](const SenderRecord& rec) {
+            return rec.callsign == record.callsign && rec.mode == record.mode && rec.frequency == record.frequency;
+        });
+
+        if (existing != recordList_.end())
+        {
+            if ((signed char)record.snr > (signed char)existing->snr)
+            {
+                ESP_LOGI(CURRENT_LOG_TAG, "Updating SNR for %s to %d", message->callsign, (int)(signed char)record.snr);
+                existing->snr = record.snr;
+            }
+        }
+        else
+        {
+            ESP_LOGI(CURRENT_LOG_TAG, "Adding %s to callsign list", message->callsign);
+            recordList_.push_back(record);
+        }
     }
 }
 
-void PskReporterTask::onReportFrequencyChangeMessage_(DVTask* origin, ReportFrequencyChangeMessage* message)
+void PskReporterTask::onReportStationStateMessage_(DVTask* origin, ReportStationStateMessage* message)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Got frequency update: %" PRIu64, message->frequencyHz);
     frequencyHz_ = message->frequencyHz;
 }
 
+#if CONFIG_EZDV_LOAD_GOVERNOR
+void PskReporterTask::onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message)
+{
+    // Spots are still all sent, just in fewer (larger) datagrams.
+    uint64_t intervalMs = PSK_REPORTER_SEND_INTERVAL_MS;
+    if (message->level >= telemetry::LoadSheddingMessage::SHED_BACKGROUND)
+    {
+        intervalMs *= PSK_REPORTER_LOAD_SHED_MULTIPLIER;
+    }
+    udpSendTimer_.changeInterval(MS_TO_US(intervalMs));
+}
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+void PskReporterTask::onDnsResultMessage_(DVTask* origin, DnsResultMessage* message)
+{
+    dnsLookupInProgress_ = false;
+
+    if (!message->found)
+    {
+        // Keep using the previous address (if any) until the next attempt.
+        ESP_LOGW(CURRENT_LOG_TAG, "cannot resolve %s", PSK_REPORTER_HOSTNAME);
+        return;
+    }
+
+    if (!hasServerAddress_ || !ip_addr_cmp(&serverAddress_, &message->address))
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "%s is at %s", PSK_REPORTER_HOSTNAME, ipaddr_ntoa(&message->address));
+    }
+
+    ip_addr_copy(serverAddress_, message->address);
+    hasServerAddress_ = true;
+}
+
 void PskReporterTask::stopConnection_()
 {
     udpSendTimer_.stop();
     recordList_.clear();
+    closeSocket_();
     reportingEnabled_ = false;
 }
 
 void PskReporterTask::startConnection_()
 {
+    // Look up the server now so its address is ready by the first send.
+    startDnsLookup_();
+
     udpSendTimer_.start();
     currentSequenceNumber_ = 0;
     reportingEnabled_ = true;
 }
 
+void PskReporterTask::startDnsLookup_()
+{
+    if (dnsLookupInProgress_)
+    {
+        return;
+    }
+
+    // dns_gethostbyname() must be called from the TCP/IP thread.
+    if (tcpip_callback(&PskReporterTask::LookUpServer_, this) == ERR_OK)
+    {
+        dnsLookupInProgress_ = true;
+    }
+    else
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "cannot start lookup of %s", PSK_REPORTER_HOSTNAME);
+    }
+}
+
+bool PskReporterTask::openSocket_(int family)
+{
+    if (socket_ >= 0 && socketFamily_ == family)
+    {
+        return true;
+    }
+
+    closeSocket_();
+
+    socket_ = socket(family, SOCK_DGRAM, 0);
+    if (socket_ < 0)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "cannot open PSK Reporter socket (err=%d)", errno);
+        return false;
+    }
+
+    socketFamily_ = family;
+    return true;
+}
+
+void PskReporterTask::closeSocket_()
+{
+    if (socket_ >= 0)
+    {
+        close(socket_);
+        socket_ = -1;
+        socketFamily_ = AF_UNSPEC;
+    }
+}
+
+void PskReporterTask::LookUpServer_(void* arg)
+{
+    PskReporterTask* thisObj = (PskReporterTask*)arg;
+
+    // lwIP only goes to the network once the cached entry's TTL has expired.
+    ip_addr_t address;
+    err_t err = dns_gethostbyname(PSK_REPORTER_HOSTNAME, &address, &PskReporterTask::OnServerFound_, thisObj);
+    if (err == ERR_OK)
+    {
+        OnServerFound_(PSK_REPORTER_HOSTNAME, &address, thisObj);
+    }
+    else if (err != ERR_INPROGRESS)
+    {
+        OnServerFound_(PSK_REPORTER_HOSTNAME, nullptr, thisObj);
+    }
+}
+
+void PskReporterTask::OnServerFound_(const char* name, const ip_addr_t* address, void* arg)
+{
+    PskReporterTask* thisObj = (PskReporterTask*)arg;
+
+    DnsResultMessage message(address);
+    thisObj->post(&message);
+}
+
 void PskReporterTask::encodeReceiverRecord_(char* buf)
 {
     // Encode RX record header.
@@ -246,9 +402,9 @@ void PskReporterTask::encodeReceiverRecord_(char* buf)
     memcpy(fieldLoc + 1, decodingSoftware_.c_str(), decodingSoftware_.size());
 }
 
-void PskReporterTask::encodeSenderRecords_(char* buf)
+void PskReporterTask::encodeSenderRecords_(char* buf, size_t firstRecord, size_t numRecords)
 {
-    if (recordList_.size() == 0) return;
+    if (numRecords == 0) return;
     
     // Encode TX record header.
     buf[0] = 0x99;
@@ -256,12 +412,13 @@ void PskReporterTask::encodeSenderRecords_(char* buf)
 
     // Encode record size.
     char* fieldLoc = &buf[2];
-    *((unsigned short*)fieldLoc) = htons(getTxDataSize_());
+    *((unsigned short*)fieldLoc) = htons(getTxDataSize_(firstRecord, numRecords));
 
     // Encode individual records.
     fieldLoc += sizeof(unsigned short);
-    for(auto& rec : recordList_)
+    for (size_t index = firstRecord; index < firstRecord + numRecords; index++)
     {
+        auto& rec = recordList_[index];
         rec.encode(fieldLoc);
         fieldLoc += rec.recordSize();
     }
@@ -269,92 +426,120 @@ void PskReporterTask::encodeSenderRecords_(char* buf)
 
 void PskReporterTask::sendPskReporterRecords_(DVTimer*)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Sending currently queued records to server");
+    // Refresh the server's address in the background for next time.
+    startDnsLookup_();
 
-    // Header (2) + length (2) + time (4) + sequence # (4) + random identifier (4) +
-    // RX format block + TX format block + RX data + TX data
-    int dgSize = 16 + sizeof(rxFormatHeader) + sizeof(txFormatHeader) + getRxDataSize_() + getTxDataSize_();
-    if (getTxDataSize_() == 0) dgSize -= sizeof(txFormatHeader);
+    if (!hasServerAddress_)
+    {
+        // Records are kept until we know where to send them.
+        ESP_LOGW(CURRENT_LOG_TAG, "%s not resolved yet, holding %d records", PSK_REPORTER_HOSTNAME, (int)recordList_.size());
+        return;
+    }
 
-    char* packet = new char[dgSize];
-    memset(packet, 0, dgSize);
+    struct sockaddr_storage serverAddr;
+    socklen_t serverAddrLen;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+#if LWIP_IPV6
+    if (IP_IS_V6(&serverAddress_))
+    {
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&serverAddr;
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(PSK_REPORTER_PORT);
+        inet6_addr_from_ip6addr(&addr6->sin6_addr, ip_2_ip6(&serverAddress_));
+        serverAddrLen = sizeof(struct sockaddr_in6);
+    }
+    else
+#endif // LWIP_IPV6
+    {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)&serverAddr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(PSK_REPORTER_PORT);
+        inet_addr_from_ip4addr(&addr4->sin_addr, ip_2_ip4(&serverAddress_));
+        serverAddrLen = sizeof(struct sockaddr_in);
+    }
 
-    // Encode packet header.
-    packet[0] = 0x00;
-    packet[1] = 0x0A;
+    if (!openSocket_(serverAddr.ss_family))
+    {
+        return;
+    }
 
-    // Encode datagram size.
-    char* fieldLoc = &packet[2];
-    *((unsigned short*)fieldLoc) = htons(dgSize);
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending currently queued records to server");
 
-    // Encode send time.
-    fieldLoc += sizeof(unsigned short);
-    *((unsigned int*)fieldLoc) = htonl(time(0));
+    // Records that don't fit go out in additional datagrams. At least one
+    // is always sent so the server knows we're still around.
+    size_t firstRecord = 0;
+    do
+    {
+        // Header (2) + length (2) + time (4) + sequence # (4) + random identifier (4) +
+        // RX format block + TX format block + RX data + TX data
+        int dgSize = 16 + sizeof(rxFormatHeader) + getRxDataSize_();
+        size_t numRecords = 0;
+        while (firstRecord + numRecords < recordList_.size() &&
+            dgSize + sizeof(txFormatHeader) + getTxDataSize_(firstRecord, numRecords + 1) <= PSK_REPORTER_MAX_DATAGRAM_SIZE)
+        {
+            numRecords++;
+        }
 
-    // Encode sequence number.
-    fieldLoc += sizeof(unsigned int);
-    *((unsigned int*)fieldLoc) = htonl(currentSequenceNumber_++);
+        if (numRecords > 0)
+        {
+            dgSize += sizeof(txFormatHeader) + getTxDataSize_(firstRecord, numRecords);
+        }
+        
+        char* packet = packetBuffer_;
+        memset(packet, 0, dgSize);
 
-    // Encode random identifier.
-    fieldLoc += sizeof(unsigned int);
-    *((unsigned int*)fieldLoc) = htonl(randomIdentifier_);
+        // Encode packet header.
+        packet[0] = 0x00;
+        packet[1] = 0x0A;
 
-    // Copy RX and TX format headers.
-    fieldLoc += sizeof(unsigned int);
-    memcpy(fieldLoc, rxFormatHeader, sizeof(rxFormatHeader));
-    fieldLoc += sizeof(rxFormatHeader);
+        // Encode datagram size.
+        char* fieldLoc = &packet[2];
+        *((unsigned short*)fieldLoc) = htons(dgSize);
 
-    if (getTxDataSize_() > 0)
-    {
-        memcpy(fieldLoc, txFormatHeader, sizeof(txFormatHeader));
-        fieldLoc += sizeof(txFormatHeader);
-    }
+        // Encode send time.
+        fieldLoc += sizeof(unsigned short);
+        *((unsigned int*)fieldLoc) = htonl(time(0));
 
-    // Encode receiver and sender records.
-    encodeReceiverRecord_(fieldLoc);
-    fieldLoc += getRxDataSize_();
-    encodeSenderRecords_(fieldLoc);
+        // Encode sequence number.
+        fieldLoc += sizeof(unsigned int);
+        *((unsigned int*)fieldLoc) = htonl(currentSequenceNumber_++);
 
-    recordList_.clear();
+        // Encode random identifier.
+        fieldLoc += sizeof(unsigned int);
+        *((unsigned int*)fieldLoc) = htonl(randomIdentifier_);
 
-    // Send to PSKReporter.    
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_protocol = 0;
-    hints.ai_flags = AI_ADDRCONFIG | AI_V4MAPPED | AI_NUMERICSERV;
-
-    struct addrinfo* res = NULL;
-    int err = getaddrinfo(PSK_REPORTER_HOSTNAME, PSK_REPORTER_PORT, &hints, &res);
-    if (err != 0) 
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "cannot resolve %s (err=%d)", PSK_REPORTER_HOSTNAME, err);
-        return;
-    }
+        // Copy RX and TX format headers.
+        fieldLoc += sizeof(unsigned int);
+        memcpy(fieldLoc, rxFormatHeader, sizeof(rxFormatHeader));
+        fieldLoc += sizeof(rxFormatHeader);
 
-    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if(fd < 0)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "cannot open PSK Reporter socket (err=%d)\n", errno);
-        freeaddrinfo(res);
-        return;
-    }
+        if (numRecords > 0)
+        {
+            memcpy(fieldLoc, txFormatHeader, sizeof(txFormatHeader));
+            fieldLoc += sizeof(txFormatHeader);
+        }
 
-    if (sendto(fd, packet, dgSize, 0, res->ai_addr, res->ai_addrlen) < 0)
-    {
-        delete[] packet;
-        ESP_LOGE(CURRENT_LOG_TAG, "cannot send message to PSK Reporter (err=%d)\n", errno);
+        // Encode receiver and sender records.
+        encodeReceiverRecord_(fieldLoc);
+        fieldLoc += getRxDataSize_();
+        encodeSenderRecords_(fieldLoc, firstRecord, numRecords);
 
-        close(fd);
-        freeaddrinfo(res);
-        return;
-    }
+        // A record too large for any datagram (shouldn't happen given
+        // callsign lengths) is skipped rather than blocking the rest.
+        firstRecord += std::max(numRecords, (size_t)1);
+
+        // Send to PSKReporter.
+        if (sendto(socket_, packet, dgSize, 0, (struct sockaddr*)&serverAddr, serverAddrLen) < 0)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "cannot send message to PSK Reporter (err=%d)", errno);
 
-    delete[] packet;
-    close(fd);
+            // Start over with a fresh socket next time (e.g. if the network went away).
+            closeSocket_();
+            break;
+        }
+    } while (firstRecord < recordList_.size());
 
-    freeaddrinfo(res);
+    recordList_.clear();
 }
 
 int PskReporterTask::getRxDataSize_()
@@ -368,17 +553,17 @@ int PskReporterTask::getRxDataSize_()
     return size;
 }
 
-int PskReporterTask::getTxDataSize_()
+int PskReporterTask::getTxDataSize_(size_t firstRecord, size_t numRecords)
 {
-    if (recordList_.size() == 0)
+    if (numRecords == 0)
     {
         return 0;
     }
     
     int size = 4;
-    for (auto& item : recordList_)
+    for (size_t index = firstRecord; index < firstRecord + numRecords; index++)
     {
-        size += item.recordSize();
+        size += recordList_[index].recordSize();
     }
     if ((size % 4) > 0)
     {
@@ -20,12 +20,25 @@
 
 #include <vector>
 
+#include "sdkconfig.h"
+#include "lwip/ip_addr.h"
+
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
+#include "task/DVTaskMessage.h"
 #include "ReportingMessage.h"
 #include "audio/FreeDVMessage.h"
 #include "storage/SettingsMessage.h"
 
+#if CONFIG_EZDV_LOAD_GOVERNOR
+#include "telemetry/TelemetryMessage.h"
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(PSK_REPORTER_MESSAGE);
+}
+
 namespace ezdv
 {
 
@@ -46,6 +59,33 @@ protected:
     virtual void onTaskSleep_() override;
     
 private:
+    enum PskReporterMessageId
+    {
+        DNS_RESULT = 1,
+    };
+
+    class DnsResultMessage : public DVTaskMessageBase<DNS_RESULT, DnsResultMessage>
+    {
+    public:
+        DnsResultMessage(const ip_addr_t* addressProvided = nullptr)
+            : DVTaskMessageBase<DNS_RESULT, DnsResultMessage>(PSK_REPORTER_MESSAGE)
+            , found(addressProvided != nullptr)
+        {
+            if (found)
+            {
+                ip_addr_copy(address, *addressProvided);
+            }
+            else
+            {
+                ip_addr_set_zero(&address);
+            }
+        }
+        virtual ~DnsResultMessage() = default;
+
+        bool found;
+        ip_addr_t address;
+    };
+
     struct SenderRecord
     {
         std::string callsign;
@@ -73,20 +113,42 @@ private:
     unsigned int randomIdentifier_;
     std::string decodingSoftware_;
 
+    // The server's address is looked up in the background (lwIP's DNS
+    // cache takes care of honoring the record's TTL) and the last one
+    // found is used in the meantime.
+    bool dnsLookupInProgress_;
+    bool hasServerAddress_;
+    ip_addr_t serverAddress_;
+    int socket_;
+    int socketFamily_;
+
+    // Datagrams are encoded here.
+    char* packetBuffer_;
+
     void onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message);
     void onEnableReportingMessage_(DVTask* origin, EnableReportingMessage* message);
     void onDisableReportingMessage_(DVTask* origin, DisableReportingMessage* message);
     void onFreeDVCallsignReceivedMessage_(DVTask* origin, audio::FreeDVReceivedCallsignMessage* message);
-    void onReportFrequencyChangeMessage_(DVTask* origin, ReportFrequencyChangeMessage* message);
+    void onReportStationStateMessage_(DVTask* origin, ReportStationStateMessage* message);
+    void onDnsResultMessage_(DVTask* origin, DnsResultMessage* message);
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    void onLoadSheddingMessage_(DVTask* origin, telemetry::LoadSheddingMessage* message);
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
 
     void sendPskReporterRecords_(DVTimer*);
     void startConnection_();
     void stopConnection_();
+    void startDnsLookup_();
+    bool openSocket_(int family);
+    void closeSocket_();
 
     int getRxDataSize_();    
-    int getTxDataSize_();  
+    int getTxDataSize_(size_t firstRecord, size_t numRecords);  
     void encodeReceiverRecord_(char* buf);
-    void encodeSenderRecords_(char* buf);
+    void encodeSenderRecords_(char* buf, size_t firstRecord, size_t numRecords);
+
+    static void LookUpServer_(void* arg);
+    static void OnServerFound_(const char* name, const ip_addr_t* address, void* arg);
 };
 
 }
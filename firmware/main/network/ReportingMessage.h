@@ -19,6 +19,7 @@
 #define REPORTING_MESSAGE_H
 
 #include "task/DVTaskMessage.h"
+#include "audio/FreeDVMessage.h"
 
 extern "C"
 {
@@ -38,6 +39,8 @@ enum ReportingMessageTypes
     ENABLE_REPORTING = 1,
     DISABLE_REPORTING = 2,
     REPORT_FREQUENCY_CHANGE = 3,
+    REPORT_STATION_STATE = 4,
+    REQUEST_STATION_STATE = 5,
 };
 
 // These don't require arguments.
@@ -53,6 +56,7 @@ public:
 
 using EnableReportingMessage = ReportingZeroArgMessageCommon<ENABLE_REPORTING>;
 using DisableReportingMessage = ReportingZeroArgMessageCommon<DISABLE_REPORTING>;
+using RequestStationStateMessage = ReportingZeroArgMessageCommon<REQUEST_STATION_STATE>;
 
 class ReportFrequencyChangeMessage : public DVTaskMessageBase<REPORT_FREQUENCY_CHANGE, ReportFrequencyChangeMessage>
 {
@@ -67,6 +71,36 @@ public:
     uint64_t frequencyHz;
 };
 
+/// @brief The station state to report, from ReportingStateTask. Frequency changes
+///        are debounced so that reporters aren't flooded while the VFO is moving.
+class ReportStationStateMessage : public DVTaskMessageBase<REPORT_STATION_STATE, ReportStationStateMessage>
+{
+public:
+    enum ChangedFields
+    {
+        FREQUENCY = 0x01,
+        MODE = 0x02,
+        PTT = 0x04,
+
+        ALL = FREQUENCY | MODE | PTT
+    };
+
+    ReportStationStateMessage(uint64_t frequencyHzProvided = 0, audio::FreeDVMode modeProvided = audio::ANALOG, bool pttStateProvided = false, uint8_t changedProvided = 0)
+        : DVTaskMessageBase<REPORT_STATION_STATE, ReportStationStateMessage>(REPORTING_MESSAGE)
+        , frequencyHz(frequencyHzProvided)
+        , mode(modeProvided)
+        , pttState(pttStateProvided)
+        , changed(changedProvided)
+        {}
+
+    virtual ~ReportStationStateMessage() = default;
+
+    uint64_t frequencyHz;
+    audio::FreeDVMode mode;
+    bool pttState;
+    uint8_t changed; // ChangedFields since the last message (ALL in response to RequestStationStateMessage)
+};
+
 }
 
 }
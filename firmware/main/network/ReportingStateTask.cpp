@@ -0,0 +1,171 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "ReportingStateTask.h"
+
+// Frequency changes are reported once the VFO has been still this long...
+#define FREQUENCY_SETTLE_MS (500)
+
+// ...or at least this often while it keeps moving.
+#define FREQUENCY_MAX_DELAY_MS (2000)
+
+#define CURRENT_LOG_TAG "ReportingState"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+ReportingStateTask::ReportingStateTask()
+    : ezdv::task::DVTask("ReportingStateTask", 1, 3072, tskNO_AFFINITY, 32)
+    , frequencyTimer_(this, this, &ReportingStateTask::onFrequencyTimer_, MS_TO_US(FREQUENCY_SETTLE_MS), "ReportingFreqTimer")
+    , frequencyHz_(0)
+    , reportedFrequencyHz_(0)
+    , mode_(audio::ANALOG)
+    , pttState_(false)
+    , firstPendingFrequencyUs_(0)
+{
+    frequencyTimer_.useTimerWheel();
+
+    registerMessageHandlers<
+        &ReportingStateTask::onReportFrequencyChangeMessage_,
+        &ReportingStateTask::onSetFreeDVModeMessage_,
+        &ReportingStateTask::onSetPTTStateMessage_,
+        &ReportingStateTask::onReportingSettingsMessage_,
+        &ReportingStateTask::onRequestStationStateMessage_>(this);
+}
+
+void ReportingStateTask::onTaskStart_()
+{
+    // Request current reporting settings (for the forced reporting frequency)
+    storage::RequestReportingSettingsMessage reportingRequest;
+    publish(&reportingRequest);
+
+    // Request current FreeDV mode
+    audio::RequestGetFreeDVModeMessage modeRequest;
+    publish(&modeRequest);
+}
+
+void ReportingStateTask::onTaskSleep_()
+{
+    frequencyTimer_.stop();
+    firstPendingFrequencyUs_ = 0;
+}
+
+void ReportingStateTask::onReportFrequencyChangeMessage_(DVTask* origin, ReportFrequencyChangeMessage* message)
+{
+    setFrequency_(message->frequencyHz);
+}
+
+void ReportingStateTask::onSetFreeDVModeMessage_(DVTask* origin, audio::SetFreeDVModeMessage* message)
+{
+    if (mode_ != message->mode)
+    {
+        mode_ = message->mode;
+        publishState_(ReportStationStateMessage::MODE);
+    }
+}
+
+void ReportingStateTask::onSetPTTStateMessage_(DVTask* origin, audio::FreeDVSetPTTStateMessage* message)
+{
+    if (pttState_ != message->pttState)
+    {
+        pttState_ = message->pttState;
+        publishState_(ReportStationStateMessage::PTT);
+    }
+}
+
+void ReportingStateTask::onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message)
+{
+    // With forced reporting, the frequency comes from settings instead of the radio.
+    if (message->forceReporting)
+    {
+        setFrequency_(message->freqHz);
+    }
+}
+
+void ReportingStateTask::onRequestStationStateMessage_(DVTask* origin, RequestStationStateMessage* message)
+{
+    publishState_(ReportStationStateMessage::ALL);
+}
+
+void ReportingStateTask::setFrequency_(uint64_t frequencyHz)
+{
+    if (frequencyHz == frequencyHz_)
+    {
+        return;
+    }
+    frequencyHz_ = frequencyHz;
+
+    auto now = esp_timer_get_time();
+    if (firstPendingFrequencyUs_ == 0)
+    {
+        firstPendingFrequencyUs_ = now;
+    }
+
+    // Wait for the VFO to settle, but not past the maximum delay.
+    int64_t delayUs = MS_TO_US(FREQUENCY_SETTLE_MS);
+    delayUs = std::min(delayUs, firstPendingFrequencyUs_ + MS_TO_US(FREQUENCY_MAX_DELAY_MS) - now);
+    if (delayUs <= 0)
+    {
+        onFrequencyTimer_(nullptr);
+        return;
+    }
+
+    frequencyTimer_.changeInterval(delayUs);
+    frequencyTimer_.restart(true);
+}
+
+void ReportingStateTask::onFrequencyTimer_(DVTimer*)
+{
+    frequencyTimer_.stop();
+    firstPendingFrequencyUs_ = 0;
+
+    if (frequencyHz_ != reportedFrequencyHz_)
+    {
+        publishState_(ReportStationStateMessage::FREQUENCY);
+    }
+}
+
+void ReportingStateTask::publishState_(uint8_t changed)
+{
+    // Any frequency change still settling goes out now too, so that the
+    // reporters never see a state that didn't exist.
+    if (frequencyHz_ != reportedFrequencyHz_)
+    {
+        changed |= ReportStationStateMessage::FREQUENCY;
+        frequencyTimer_.stop();
+        firstPendingFrequencyUs_ = 0;
+    }
+    reportedFrequencyHz_ = frequencyHz_;
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Station state: %" PRIu64 " Hz, mode %d, PTT %d (changed 0x%x)", frequencyHz_, (int)mode_, pttState_, changed);
+    
+    ReportStationStateMessage message(frequencyHz_, mode_, pttState_, changed);
+    publish(&message);
+}
+
+}
+
+}
@@ -0,0 +1,73 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef REPORTING_STATE_TASK_H
+#define REPORTING_STATE_TASK_H
+
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+#include "ReportingMessage.h"
+#include "audio/FreeDVMessage.h"
+#include "storage/SettingsMessage.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+using namespace ezdv::task;
+
+/// @brief Keeps the station state (frequency, mode and PTT) shared by the 
+///        reporters and tells them what changed via ReportStationStateMessage.
+///        Frequency changes are held until the VFO settles (or a maximum delay
+///        passes) so that reporters only see a few updates while tuning.
+class ReportingStateTask : public DVTask
+{
+public:
+    ReportingStateTask();
+    virtual ~ReportingStateTask() = default;
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    DVTimer frequencyTimer_;
+    uint64_t frequencyHz_;
+    uint64_t reportedFrequencyHz_;
+    audio::FreeDVMode mode_;
+    bool pttState_;
+    int64_t firstPendingFrequencyUs_;
+
+    void onReportFrequencyChangeMessage_(DVTask* origin, ReportFrequencyChangeMessage* message);
+    void onSetFreeDVModeMessage_(DVTask* origin, audio::SetFreeDVModeMessage* message);
+    void onSetPTTStateMessage_(DVTask* origin, audio::FreeDVSetPTTStateMessage* message);
+    void onReportingSettingsMessage_(DVTask* origin, storage::ReportingSettingsMessage* message);
+    void onRequestStationStateMessage_(DVTask* origin, RequestStationStateMessage* message);
+
+    void setFrequency_(uint64_t frequencyHz);
+    void onFrequencyTimer_(DVTimer*);
+    void publishState_(uint8_t changed);
+};
+
+}
+
+}
+
+#endif // REPORTING_STATE_TASK_H
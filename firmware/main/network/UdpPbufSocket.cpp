@@ -0,0 +1,214 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cerrno>
+
+#include "UdpPbufSocket.h"
+
+#include "esp_log.h"
+
+#define CURRENT_LOG_TAG "UdpPbufSocket"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+UdpPbufSocket::UdpPbufSocket()
+    : pcb_(nullptr)
+    , receiveFn_(nullptr)
+    , receiveArg_(nullptr)
+{
+    // empty
+}
+
+UdpPbufSocket::~UdpPbufSocket()
+{
+    close();
+}
+
+bool UdpPbufSocket::open(uint16_t localPort, uint8_t tos, ReceiveFn fn, void* arg)
+{
+    assert(pcb_ == nullptr);
+    assert(fn != nullptr);
+
+    receiveFn_ = fn;
+    receiveArg_ = arg;
+
+    CallData call;
+    call.socket = this;
+    call.port = localPort;
+    call.tos = tos;
+
+    err_t err = tcpip_api_call(&Open_, &call.base);
+    if (err != ERR_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not open UDP port %d (%d)", localPort, err);
+        return false;
+    }
+
+    return true;
+}
+
+bool UdpPbufSocket::connect(uint32_t ip, uint16_t port)
+{
+    assert(pcb_ != nullptr);
+
+    CallData call;
+    call.socket = this;
+    call.port = port;
+    ip_addr_set_ip4_u32(&call.address, ip);
+
+    err_t err = tcpip_api_call(&Connect_, &call.base);
+    if (err != ERR_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not connect UDP socket (%d)", err);
+        return false;
+    }
+
+    return true;
+}
+
+void UdpPbufSocket::close()
+{
+    if (pcb_ == nullptr)
+    {
+        return;
+    }
+
+    CallData call;
+    call.socket = this;
+    tcpip_api_call(&Close_, &call.base);
+}
+
+int UdpPbufSocket::send(const void* data, int length)
+{
+    return send_(data, length, nullptr, 0);
+}
+
+int UdpPbufSocket::sendTo(const void* data, int length, const struct sockaddr_in& address)
+{
+    ip_addr_t ip;
+    ip_addr_set_ip4_u32(&ip, address.sin_addr.s_addr);
+    return send_(data, length, &ip, ntohs(address.sin_port));
+}
+
+int UdpPbufSocket::send_(const void* data, int length, const ip_addr_t* address, uint16_t port)
+{
+    if (pcb_ == nullptr)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    // lwIP prepends the headers in a separate pbuf, so the payload itself 
+    // is never copied by the stack. Should the packet need to be queued 
+    // (e.g. waiting on ARP) lwIP takes its own copy first, which is why 
+    // the buffer only needs to last until the call returns.
+    struct pbuf* p = pbuf_alloc_reference((void*)data, length, PBUF_REF);
+    if (p == nullptr)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    CallData call;
+    call.socket = this;
+    call.p = p;
+    call.hasAddress = address != nullptr;
+    if (address != nullptr)
+    {
+        ip_addr_copy(call.address, *address);
+        call.port = port;
+    }
+
+    err_t err = tcpip_api_call(&Send_, &call.base);
+    pbuf_free(p);
+
+    if (err != ERR_OK)
+    {
+        errno = err_to_errno(err);
+        return -1;
+    }
+
+    return length;
+}
+
+err_t UdpPbufSocket::Open_(struct tcpip_api_call_data* data)
+{
+    CallData* call = (CallData*)data;
+
+    struct udp_pcb* pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (pcb == nullptr)
+    {
+        return ERR_MEM;
+    }
+
+    // Needed for Flex discovery broadcasts.
+    ip_set_option(pcb, SOF_BROADCAST);
+    pcb->tos = call->tos;
+
+    err_t err = udp_bind(pcb, IP4_ADDR_ANY, call->port);
+    if (err != ERR_OK)
+    {
+        udp_remove(pcb);
+        return err;
+    }
+
+    udp_recv(pcb, &OnReceive_, call->socket);
+    call->socket->pcb_ = pcb;
+    return ERR_OK;
+}
+
+err_t UdpPbufSocket::Connect_(struct tcpip_api_call_data* data)
+{
+    CallData* call = (CallData*)data;
+    return udp_connect(call->socket->pcb_, &call->address, call->port);
+}
+
+err_t UdpPbufSocket::Close_(struct tcpip_api_call_data* data)
+{
+    CallData* call = (CallData*)data;
+    udp_remove(call->socket->pcb_);
+    call->socket->pcb_ = nullptr;
+    return ERR_OK;
+}
+
+err_t UdpPbufSocket::Send_(struct tcpip_api_call_data* data)
+{
+    CallData* call = (CallData*)data;
+    if (call->hasAddress)
+    {
+        return udp_sendto(call->socket->pcb_, call->p, &call->address, call->port);
+    }
+    else
+    {
+        return udp_send(call->socket->pcb_, call->p);
+    }
+}
+
+void UdpPbufSocket::OnReceive_(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* address, u16_t port)
+{
+    UdpPbufSocket* socket = (UdpPbufSocket*)arg;
+    socket->receiveFn_(socket->receiveArg_, p);
+}
+
+}
+
+}
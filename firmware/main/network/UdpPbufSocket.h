@@ -0,0 +1,110 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UDP_PBUF_SOCKET_H
+#define UDP_PBUF_SOCKET_H
+
+#include <cinttypes>
+
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/sockets.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief UDP socket on top of lwIP's raw API, for audio streams that would 
+///        rather not go through the BSD socket layer. Received datagrams are
+///        handed over as pbufs straight from the lwIP thread (no mailbox or 
+///        copy into a user buffer) and sends reference the caller's buffer 
+///        (PBUF_REF) instead of copying it into a new pbuf.
+///
+/// Calls into lwIP go through tcpip_api_call(), which only takes the core 
+/// lock when CONFIG_LWIP_TCPIP_CORE_LOCKING is enabled and otherwise waits
+/// for the lwIP thread. Not thread safe; open/close/send from one task.
+class UdpPbufSocket
+{
+public:
+    /// @brief Called on the lwIP thread for each datagram received. The
+    ///        callee owns the pbuf and must eventually pbuf_free() it.
+    typedef void (*ReceiveFn)(void* arg, struct pbuf* p);
+
+    UdpPbufSocket();
+    virtual ~UdpPbufSocket();
+
+    /// @brief Binds to the given local port on all interfaces.
+    /// @param localPort The port to bind to (0 to pick one).
+    /// @param tos The IP TOS byte for outgoing packets (see NetworkQos).
+    /// @param fn The function to call for received datagrams.
+    /// @param arg Passed to fn.
+    /// @return true if the socket could be opened.
+    bool open(uint16_t localPort, uint8_t tos, ReceiveFn fn, void* arg);
+
+    /// @brief Sets the default destination (and only accepts datagrams from it).
+    /// @param ip The remote IP address, in network byte order.
+    /// @param port The remote port.
+    /// @return true on success.
+    bool connect(uint32_t ip, uint16_t port);
+
+    /// @brief Closes the socket. No more receive callbacks happen once this returns.
+    void close();
+
+    bool isOpen() const { return pcb_ != nullptr; }
+
+    /// @brief Sends a datagram to the connected address. The buffer only needs
+    ///        to stay valid until this returns.
+    /// @return The number of bytes sent, or -1 with errno set (as for send()).
+    int send(const void* data, int length);
+
+    /// @brief Sends a datagram to the given address.
+    /// @return The number of bytes sent, or -1 with errno set (as for sendto()).
+    int sendTo(const void* data, int length, const struct sockaddr_in& address);
+
+private:
+    struct CallData
+    {
+        struct tcpip_api_call_data base; // must be first
+        UdpPbufSocket* socket;
+        uint16_t port;
+        uint8_t tos;
+        ip_addr_t address;
+        bool hasAddress;
+        struct pbuf* p;
+    };
+
+    struct udp_pcb* pcb_;
+    ReceiveFn receiveFn_;
+    void* receiveArg_;
+
+    int send_(const void* data, int length, const ip_addr_t* address, uint16_t port);
+
+    static err_t Open_(struct tcpip_api_call_data* data);
+    static err_t Connect_(struct tcpip_api_call_data* data);
+    static err_t Close_(struct tcpip_api_call_data* data);
+    static err_t Send_(struct tcpip_api_call_data* data);
+    static void OnReceive_(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* address, u16_t port);
+};
+
+}
+
+}
+
+#endif // UDP_PBUF_SOCKET_H
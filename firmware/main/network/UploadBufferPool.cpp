@@ -0,0 +1,103 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+#include "UploadBufferPool.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+static_assert(CONFIG_EZDV_UPLOAD_BUFFER_COUNT <= 32, "buffer ownership is tracked in a 32 bit mask");
+
+static portMUX_TYPE PoolLock_ = portMUX_INITIALIZER_UNLOCKED;
+static char* Region_ = nullptr;
+static QueueHandle_t FreeBuffers_ = nullptr;
+static uint32_t BuffersInUse_ = 0; // bit per buffer, to catch double or foreign releases
+
+void UploadBufferPool::Initialize()
+{
+    if (Region_ != nullptr)
+    {
+        return;
+    }
+
+    Region_ = (char*)heap_caps_malloc(BUFFER_SIZE * CONFIG_EZDV_UPLOAD_BUFFER_COUNT, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(Region_ != nullptr);
+
+    FreeBuffers_ = xQueueCreate(CONFIG_EZDV_UPLOAD_BUFFER_COUNT, sizeof(char*));
+    assert(FreeBuffers_ != nullptr);
+
+    for (int index = 0; index < CONFIG_EZDV_UPLOAD_BUFFER_COUNT; index++)
+    {
+        char* buffer = Region_ + index * BUFFER_SIZE;
+        xQueueSendToBack(FreeBuffers_, &buffer, 0);
+    }
+}
+
+char* UploadBufferPool::Acquire(TickType_t ticksToWait)
+{
+    assert(FreeBuffers_ != nullptr);
+
+    char* buffer = nullptr;
+    if (xQueueReceive(FreeBuffers_, &buffer, ticksToWait) != pdTRUE)
+    {
+        return nullptr;
+    }
+
+    uint32_t bit = 1UL << ((buffer - Region_) / BUFFER_SIZE);
+    portENTER_CRITICAL(&PoolLock_);
+    assert((BuffersInUse_ & bit) == 0);
+    BuffersInUse_ |= bit;
+    portEXIT_CRITICAL(&PoolLock_);
+
+    return buffer;
+}
+
+void UploadBufferPool::Release(char* buffer)
+{
+    if (buffer == nullptr)
+    {
+        return;
+    }
+
+    // Only buffers from this pool, and only once each.
+    int index = (buffer - Region_) / BUFFER_SIZE;
+    assert(buffer >= Region_ && index < CONFIG_EZDV_UPLOAD_BUFFER_COUNT);
+    assert(buffer == Region_ + index * BUFFER_SIZE);
+
+    uint32_t bit = 1UL << index;
+    portENTER_CRITICAL(&PoolLock_);
+    assert((BuffersInUse_ & bit) != 0);
+    BuffersInUse_ &= ~bit;
+    portEXIT_CRITICAL(&PoolLock_);
+
+    // There's always room since every buffer has its own slot.
+    xQueueSendToBack(FreeBuffers_, &buffer, 0);
+}
+
+}
+
+}
@@ -0,0 +1,64 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UPLOAD_BUFFER_POOL_H
+#define UPLOAD_BUFFER_POOL_H
+
+#include "freertos/FreeRTOS.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Fixed set of buffers that firmware and voice keyer uploads (and 
+///        firmware downloads) are received into. The web server reads each
+///        websocket frame straight into a buffer and hands it to the one task
+///        that consumes it (SoftwareUpdateTask or VoiceKeyerUploadTask). 
+///        Ownership goes with the buffer: whoever holds it is the only one 
+///        that may Release() it, which returns it here for the next frame.
+///        The buffers are allocated in PSRAM once, so uploads don't churn 
+///        the heap.
+class UploadBufferPool
+{
+public:
+    enum 
+    { 
+        // Large enough for the web UI's upload chunks.
+        BUFFER_SIZE = 4096,
+    };
+
+    /// @brief Allocates the buffers. Must be called before the first upload 
+    ///        or download; later calls do nothing.
+    static void Initialize();
+
+    /// @brief Takes a buffer from the pool, waiting for one to be released if needed.
+    /// @param ticksToWait The maximum amount of time to wait.
+    /// @return The buffer (BUFFER_SIZE bytes), or nullptr if none became available.
+    static char* Acquire(TickType_t ticksToWait);
+
+    /// @brief Returns a buffer obtained from Acquire() to the pool.
+    /// @param buffer The buffer to return (may be nullptr).
+    static void Release(char* buffer);
+};
+
+}
+
+}
+
+#endif // UPLOAD_BUFFER_POOL_H
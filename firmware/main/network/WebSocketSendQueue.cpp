@@ -0,0 +1,286 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "WebSocketSendQueue.h"
+
+#define CURRENT_LOG_TAG "WebSocketSendQueue"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+WebSocketSendQueue::WebSocketSendQueue(transfer_complete_cb callback, void* callbackArg)
+    : server_(nullptr)
+    , callback_(callback)
+    , callbackArg_(callbackArg)
+    , hasLostCompletions_(false)
+{
+    for (auto& lost : lostCompletions_)
+    {
+        lost.state.store(LOST_EMPTY, std::memory_order_relaxed);
+    }
+}
+
+WebSocketSendQueue::~WebSocketSendQueue()
+{
+    clear();
+}
+
+void WebSocketSendQueue::setServer(httpd_handle_t server)
+{
+    server_ = server;
+}
+
+bool WebSocketSendQueue::enqueue(int fd, httpd_ws_type_t type, const uint8_t* payload, size_t length, StatusKey key)
+{
+    processLostCompletions_();
+
+    Client* client = nullptr;
+    auto iter = clients_.find(fd);
+    if (iter != clients_.end())
+    {
+        // If removed, this is a new connection that reused the socket
+        // number before the old one's last frame finished sending.
+        client = iter->second;
+        client->removed = false;
+    }
+    else
+    {
+        client = (Client*)heap_caps_calloc(1, sizeof(Client), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+        assert(client != nullptr);
+        clients_[fd] = client;
+    }
+
+    // Only the newest value of a status message is worth sending.
+    Entry* entry = nullptr;
+    if (key != NO_KEY)
+    {
+        for (int index = client->inFlight ? 1 : 0; index < client->count; index++)
+        {
+            Entry& existing = client->entries[(client->head + index) % MAX_DEPTH];
+            if (existing.key == key)
+            {
+                freeEntry_(existing);
+                entry = &existing;
+                break;
+            }
+        }
+    }
+
+    if (entry == nullptr)
+    {
+        if (client->count == MAX_DEPTH)
+        {
+            return false;
+        }
+
+        entry = &client->entries[(client->head + client->count) % MAX_DEPTH];
+        client->count++;
+    }
+
+    entry->payload = (uint8_t*)heap_caps_malloc(length > 0 ? length : 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(entry->payload != nullptr);
+    memcpy(entry->payload, payload, length);
+    entry->length = length;
+    entry->type = type;
+    entry->key = key;
+
+    if (!client->inFlight)
+    {
+        sendNext_(fd, client);
+    }
+
+    return true;
+}
+
+bool WebSocketSendQueue::onSendComplete(int fd, esp_err_t err)
+{
+    processLostCompletions_();
+    return completeSend_(fd, err);
+}
+
+void WebSocketSendQueue::onSendCompleteLost(int fd, esp_err_t err)
+{
+    for (auto& lost : lostCompletions_)
+    {
+        uint8_t expected = LOST_EMPTY;
+        if (lost.state.compare_exchange_strong(expected, LOST_WRITING, std::memory_order_acquire))
+        {
+            lost.fd = fd;
+            lost.err = err;
+            lost.state.store(LOST_READY, std::memory_order_release);
+            hasLostCompletions_.store(true, std::memory_order_release);
+            return;
+        }
+    }
+
+    // Shouldn't happen with no more clients than slots.
+    ESP_LOGE(CURRENT_LOG_TAG, "No room to record lost completion for socket %d", fd);
+}
+
+void WebSocketSendQueue::processLostCompletions_()
+{
+    if (!hasLostCompletions_.exchange(false, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    for (auto& lost : lostCompletions_)
+    {
+        if (lost.state.load(std::memory_order_acquire) != LOST_READY)
+        {
+            continue;
+        }
+
+        int fd = lost.fd;
+        esp_err_t err = lost.err;
+        lost.state.store(LOST_EMPTY, std::memory_order_release);
+
+        // If the send failed, the next frame for this client fails too and
+        // HttpServerTask disconnects it then.
+        ESP_LOGW(CURRENT_LOG_TAG, "Handling late send completion for socket %d", fd);
+        completeSend_(fd, err);
+    }
+}
+
+bool WebSocketSendQueue::completeSend_(int fd, esp_err_t err)
+{
+    auto iter = clients_.find(fd);
+    if (iter == clients_.end() || !iter->second->inFlight)
+    {
+        // Left over from before clear().
+        return err == ESP_OK;
+    }
+
+    Client* client = iter->second;
+    freeEntry_(client->entries[client->head]);
+    client->head = (client->head + 1) % MAX_DEPTH;
+    client->count--;
+    client->inFlight = false;
+
+    if (client->removed)
+    {
+        freeClient_(client);
+        clients_.erase(iter);
+    }
+    else if (err == ESP_OK)
+    {
+        sendNext_(fd, client);
+    }
+
+    return err == ESP_OK;
+}
+
+void WebSocketSendQueue::remove(int fd)
+{
+    auto iter = clients_.find(fd);
+    if (iter == clients_.end())
+    {
+        return;
+    }
+
+    Client* client = iter->second;
+    if (client->inFlight)
+    {
+        // The server still has the payload of the frame being sent, so 
+        // only drop the ones after it for now.
+        while (client->count > 1)
+        {
+            client->count--;
+            freeEntry_(client->entries[(client->head + client->count) % MAX_DEPTH]);
+        }
+        client->removed = true;
+    }
+    else
+    {
+        freeClient_(client);
+        clients_.erase(iter);
+    }
+}
+
+void WebSocketSendQueue::clear()
+{
+    for (auto& kvp : clients_)
+    {
+        freeClient_(kvp.second);
+    }
+    clients_.clear();
+
+    // Nothing's sending any more, so nothing can be recording these.
+    for (auto& lost : lostCompletions_)
+    {
+        lost.state.store(LOST_EMPTY, std::memory_order_relaxed);
+    }
+    hasLostCompletions_.store(false, std::memory_order_relaxed);
+}
+
+void WebSocketSendQueue::sendNext_(int fd, Client* client)
+{
+    while (client->count > 0)
+    {
+        Entry& entry = client->entries[client->head];
+
+        httpd_ws_frame_t wsPkt;
+        memset(&wsPkt, 0, sizeof(httpd_ws_frame_t));
+        wsPkt.payload = entry.payload;
+        wsPkt.len = entry.length;
+        wsPkt.type = entry.type;
+        wsPkt.final = true;
+
+        client->inFlight = true;
+        if (httpd_ws_send_data_async(server_, fd, &wsPkt, callback_, callbackArg_) == ESP_OK)
+        {
+            return;
+        }
+
+        // Couldn't even queue it (e.g. out of memory); drop this one and 
+        // try the next.
+        ESP_LOGW(CURRENT_LOG_TAG, "Could not queue frame for socket %d", fd);
+        client->inFlight = false;
+        freeEntry_(entry);
+        client->head = (client->head + 1) % MAX_DEPTH;
+        client->count--;
+    }
+}
+
+void WebSocketSendQueue::freeEntry_(Entry& entry)
+{
+    heap_caps_free(entry.payload);
+    entry.payload = nullptr;
+    entry.length = 0;
+}
+
+void WebSocketSendQueue::freeClient_(Client* client)
+{
+    for (int index = 0; index < client->count; index++)
+    {
+        freeEntry_(client->entries[(client->head + index) % MAX_DEPTH]);
+    }
+    heap_caps_free(client);
+}
+
+}
+
+}
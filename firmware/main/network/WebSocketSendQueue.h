@@ -0,0 +1,138 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WEB_SOCKET_SEND_QUEUE_H
+#define WEB_SOCKET_SEND_QUEUE_H
+
+#include <atomic>
+#include <map>
+#include <cinttypes>
+
+#include "esp_http_server.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Bounded outbound queue for each websocket client, sent with 
+///        httpd_ws_send_data_async() one frame at a time so that a slow 
+///        client only holds up itself. Queued status frames are replaced by
+///        newer ones with the same key instead of piling up. Only used from
+///        HttpServerTask, which forwards send completions back to us (except
+///        for onSendCompleteLost()).
+class WebSocketSendQueue
+{
+public:
+    enum { MAX_DEPTH = 16 };
+
+    /// @brief Status messages where only the latest value matters.
+    enum StatusKey
+    {
+        NO_KEY = 0, // always queued
+        KEY_BATTERY = 1,
+        KEY_SPECTRUM = 2,
+        KEY_UPLOAD_CREDIT = 3,
+        KEY_STATUS = 4,
+    };
+
+    /// @brief Creates a new set of queues.
+    /// @param callback Called from the HTTP server's task as each frame finishes sending.
+    /// @param callbackArg Passed to callback.
+    WebSocketSendQueue(transfer_complete_cb callback, void* callbackArg);
+    virtual ~WebSocketSendQueue();
+
+    /// @brief Sets the server frames are sent through.
+    void setServer(httpd_handle_t server);
+
+    /// @brief Queues a copy of a frame for the given client.
+    /// @param key Replaces an older queued frame with this key if not NO_KEY.
+    /// @return false if the client's queue is full (i.e. it's too slow to keep up).
+    bool enqueue(int fd, httpd_ws_type_t type, const uint8_t* payload, size_t length, StatusKey key = NO_KEY);
+
+    /// @brief Handles completion of a client's frame and sends its next one.
+    /// @return false if the frame failed to send.
+    bool onSendComplete(int fd, esp_err_t err);
+
+    /// @brief Records a completion that couldn't be forwarded to our task (e.g.
+    ///        because its queue was full), so that the client's queue doesn't
+    ///        stall. Safe to call from any task; handled by the next call to
+    ///        enqueue() or onSendComplete().
+    void onSendCompleteLost(int fd, esp_err_t err);
+
+    /// @brief Forgets a client. Frames still being sent are freed once complete.
+    void remove(int fd);
+
+    /// @brief Forgets all clients. Only call once the server has stopped.
+    void clear();
+
+private:
+    // One frame per client is in flight at a time, so this only needs to
+    // cover as many clients as the server allows.
+    enum { MAX_LOST_COMPLETIONS = 16 };
+
+    enum LostCompletionState
+    {
+        LOST_EMPTY = 0,
+        LOST_WRITING,
+        LOST_READY,
+    };
+
+    struct LostCompletion
+    {
+        std::atomic<uint8_t> state;
+        int fd;
+        esp_err_t err;
+    };
+
+    struct Entry
+    {
+        uint8_t* payload;
+        size_t length;
+        httpd_ws_type_t type;
+        StatusKey key;
+    };
+
+    struct Client
+    {
+        Entry entries[MAX_DEPTH];
+        int head;
+        int count;
+        bool inFlight; // entries[head] is being sent
+        bool removed;
+    };
+
+    httpd_handle_t server_;
+    transfer_complete_cb callback_;
+    void* callbackArg_;
+    std::map<int, Client*> clients_;
+    LostCompletion lostCompletions_[MAX_LOST_COMPLETIONS];
+    std::atomic<bool> hasLostCompletions_;
+
+    bool completeSend_(int fd, esp_err_t err);
+    void processLostCompletions_();
+    void sendNext_(int fd, Client* client);
+    void freeEntry_(Entry& entry);
+    void freeClient_(Client* client);
+};
+
+}
+
+}
+
+#endif // WEB_SOCKET_SEND_QUEUE_H
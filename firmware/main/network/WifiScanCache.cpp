@@ -0,0 +1,177 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "WifiScanCache.h"
+
+#include "esp_log.h"
+
+#define CURRENT_LOG_TAG "WifiScanCache"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+WifiScanCache::WifiScanCache(int64_t maxAgeUs)
+    : maxAgeUs_(maxAgeUs)
+{
+    memset(entries_, 0, sizeof(entries_));
+}
+
+void WifiScanCache::update(const wifi_ap_record_t* records, int numRecords, int64_t nowUs)
+{
+    for (int index = 0; index < numRecords; index++)
+    {
+        const char* ssid = (const char*)records[index].ssid;
+        if (*ssid == 0)
+        {
+            // Hidden networks can't be picked from the UI anyway.
+            continue;
+        }
+
+        Entry* entry = find_(ssid);
+        if (entry == nullptr)
+        {
+            entry = allocate_();
+            if (entry == nullptr)
+            {
+                ESP_LOGW(CURRENT_LOG_TAG, "Too many networks, ignoring %s", ssid);
+                continue;
+            }
+
+            strncpy(entry->ssid, ssid, sizeof(entry->ssid) - 1);
+            entry->ssid[sizeof(entry->ssid) - 1] = 0;
+            entry->state = ENTRY_ADDED;
+        }
+        else if (entry->state == ENTRY_REMOVED)
+        {
+            // Came back before anyone was told it went away.
+            entry->state = ENTRY_REPORTED;
+        }
+
+        entry->lastSeenUs = nowUs;
+    }
+}
+
+void WifiScanCache::expire(int64_t nowUs)
+{
+    for (auto& entry : entries_)
+    {
+        if ((entry.state == ENTRY_ADDED || entry.state == ENTRY_REPORTED) &&
+            nowUs - entry.lastSeenUs > maxAgeUs_)
+        {
+            // Nobody needs to hear about networks that came and went 
+            // between reports.
+            entry.state = (entry.state == ENTRY_ADDED) ? ENTRY_FREE : ENTRY_REMOVED;
+        }
+    }
+}
+
+int WifiScanCache::numChanges() const
+{
+    int count = 0;
+    for (auto& entry : entries_)
+    {
+        if (entry.state == ENTRY_ADDED || entry.state == ENTRY_REMOVED)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+int WifiScanCache::size() const
+{
+    int count = 0;
+    for (auto& entry : entries_)
+    {
+        if (entry.state == ENTRY_ADDED || entry.state == ENTRY_REPORTED)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+int WifiScanCache::takeChanges(WifiNetworkListEntry* list)
+{
+    int count = 0;
+    for (auto& entry : entries_)
+    {
+        if (entry.state == ENTRY_ADDED || entry.state == ENTRY_REMOVED)
+        {
+            memcpy(list[count].ssid, entry.ssid, sizeof(list[count].ssid));
+            list[count].removed = entry.state == ENTRY_REMOVED;
+            count++;
+
+            entry.state = (entry.state == ENTRY_ADDED) ? ENTRY_REPORTED : ENTRY_FREE;
+        }
+    }
+    return count;
+}
+
+int WifiScanCache::takeAll(WifiNetworkListEntry* list)
+{
+    int count = 0;
+    for (auto& entry : entries_)
+    {
+        if (entry.state == ENTRY_ADDED || entry.state == ENTRY_REPORTED)
+        {
+            memcpy(list[count].ssid, entry.ssid, sizeof(list[count].ssid));
+            list[count].removed = false;
+            count++;
+
+            entry.state = ENTRY_REPORTED;
+        }
+        else if (entry.state == ENTRY_REMOVED)
+        {
+            entry.state = ENTRY_FREE;
+        }
+    }
+    return count;
+}
+
+WifiScanCache::Entry* WifiScanCache::find_(const char* ssid)
+{
+    for (auto& entry : entries_)
+    {
+        if (entry.state != ENTRY_FREE && !strncmp(entry.ssid, ssid, sizeof(entry.ssid)))
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+WifiScanCache::Entry* WifiScanCache::allocate_()
+{
+    for (auto& entry : entries_)
+    {
+        if (entry.state == ENTRY_FREE)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+}
+
+}
@@ -0,0 +1,96 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WIFI_SCAN_CACHE_H
+#define WIFI_SCAN_CACHE_H
+
+#include <cinttypes>
+
+#include "esp_wifi.h"
+
+#include "NetworkMessage.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+/// @brief Remembers the networks found by recent Wi-Fi scans (by SSID), so 
+///        that scans can cover one channel at a time and the web UI is 
+///        only told what changed. Networks not seen for a while are 
+///        dropped. Only used from NetworkTask.
+class WifiScanCache
+{
+public:
+    enum { MAX_ENTRIES = 32 };
+
+    /// @brief Creates a new cache.
+    /// @param maxAgeUs How long a network is kept after it was last seen.
+    WifiScanCache(int64_t maxAgeUs);
+    virtual ~WifiScanCache() = default;
+
+    /// @brief Adds or refreshes the networks found by a scan.
+    void update(const wifi_ap_record_t* records, int numRecords, int64_t nowUs);
+
+    /// @brief Drops networks that haven't been seen recently.
+    void expire(int64_t nowUs);
+
+    /// @brief Returns the number of changes that haven't been reported yet.
+    int numChanges() const;
+
+    /// @brief Returns the number of networks currently known.
+    int size() const;
+
+    /// @brief Reports additions and removals since the last report.
+    /// @param list Where to store the changes (MAX_ENTRIES long).
+    /// @return The number of entries stored.
+    int takeChanges(WifiNetworkListEntry* list);
+
+    /// @brief Reports every known network, also clearing any pending changes.
+    /// @param list Where to store the networks (MAX_ENTRIES long).
+    /// @return The number of entries stored.
+    int takeAll(WifiNetworkListEntry* list);
+
+private:
+    enum EntryState
+    {
+        ENTRY_FREE,
+        ENTRY_ADDED,    // not reported yet
+        ENTRY_REPORTED,
+        ENTRY_REMOVED,  // expired; removal not reported yet
+    };
+
+    struct Entry
+    {
+        char ssid[sizeof(WifiNetworkListEntry::ssid)];
+        int64_t lastSeenUs;
+        EntryState state;
+    };
+
+    Entry entries_[MAX_ENTRIES];
+    int64_t maxAgeUs_;
+
+    Entry* find_(const char* ssid);
+    Entry* allocate_();
+};
+
+}
+
+}
+
+#endif // WIFI_SCAN_CACHE_H
@@ -17,6 +17,11 @@
 
 #include "FlexKeyValueParser.h"
 
+// Perfect hash over the known keys: (length * 4 + first char + last char) % 12 
+// is different for each of them. Update KEY_TABLE if keys are added.
+#define KEY_HASH_SIZE (12)
+#define KEY_HASH(key) (((key).length() * 4 + (unsigned char)(key).front() + (unsigned char)(key).back()) % KEY_HASH_SIZE)
+
 namespace ezdv
 {
 
@@ -26,27 +31,98 @@ namespace network
 namespace flex
 {
 
-std::map<std::string, std::string> FlexKeyValueParser::GetCommandParameters(std::stringstream& ss)
+static const std::string_view KEY_NAMES[FlexKeyValueParser::NUM_KEYS] = 
+{
+    "tx",
+    "RF_frequency",
+    "in_use",
+    "mode",
+    "state",
+    "source",
+    "nickname",
+    "callsign",
+    "ip",
+};
+
+static const FlexKeyValueParser::Key KEY_TABLE[KEY_HASH_SIZE] = 
 {
-    std::string word = "";
-    std::map<std::string, std::string> ret;
+    FlexKeyValueParser::KEY_SOURCE,       // 0
+    FlexKeyValueParser::KEY_CALLSIGN,     // 1
+    FlexKeyValueParser::KEY_IN_USE,       // 2
+    FlexKeyValueParser::KEY_NICKNAME,     // 3
+    FlexKeyValueParser::KEY_TX,           // 4
+    FlexKeyValueParser::KEY_UNKNOWN,      // 5
+    FlexKeyValueParser::KEY_UNKNOWN,      // 6
+    FlexKeyValueParser::KEY_UNKNOWN,      // 7
+    FlexKeyValueParser::KEY_STATE,        // 8
+    FlexKeyValueParser::KEY_IP,           // 9
+    FlexKeyValueParser::KEY_MODE,         // 10
+    FlexKeyValueParser::KEY_RF_FREQUENCY, // 11
+};
+
+FlexKeyValueParser::FlexKeyValueParser(std::string_view text)
+    : remaining_(text)
+{
+    // empty
+}
 
-    while (std::getline(ss, word, ' ')) 
+bool FlexKeyValueParser::next(std::string_view& key, std::string_view& value)
+{
+    // Skip any run of separators (including the line's trailing \r, if any).
+    size_t start = remaining_.find_first_not_of(" \r");
+    if (start == std::string_view::npos)
     {
-        std::stringstream wordStream(word);
-        std::string parameter = "";
-        std::string value = "";
-    
-        std::getline(wordStream, parameter, '=');
-        std::getline(wordStream, value);
-        ret[parameter] = value;
+        remaining_ = std::string_view();
+        return false;
+    }
+    remaining_.remove_prefix(start);
+
+    size_t end = remaining_.find_first_of(" \r");
+    std::string_view word = remaining_.substr(0, end);
+    remaining_.remove_prefix(word.length());
+
+    size_t equals = word.find('=');
+    key = word.substr(0, equals);
+    value = equals == std::string_view::npos ? std::string_view() : word.substr(equals + 1);
+    return true;
+}
+
+void FlexKeyValueParser::GetCommandParameters(std::string_view text, Parameters& parameters)
+{
+    for (int index = 0; index < NUM_KEYS; index++)
+    {
+        parameters.values[index] = std::string_view();
+        parameters.present[index] = false;
+    }
+
+    FlexKeyValueParser parser(text);
+    std::string_view key;
+    std::string_view value;
+    while (parser.next(key, value))
+    {
+        Key id = LookupKey(key);
+        if (id != KEY_UNKNOWN)
+        {
+            // Later values win, as they did with the old std::map version.
+            parameters.values[id] = value;
+            parameters.present[id] = true;
+        }
+    }
+}
+
+FlexKeyValueParser::Key FlexKeyValueParser::LookupKey(std::string_view key)
+{
+    if (key.empty())
+    {
+        return KEY_UNKNOWN;
     }
 
-    return ret;
+    Key id = KEY_TABLE[KEY_HASH(key)];
+    return (id != KEY_UNKNOWN && KEY_NAMES[id] == key) ? id : KEY_UNKNOWN;
 }
 
 }
 
 }
 
-}
\ No newline at end of file
+}
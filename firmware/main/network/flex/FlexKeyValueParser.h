@@ -18,8 +18,7 @@
 #ifndef FLEX_KEY_VALUE_PARSER_H
 #define FLEX_KEY_VALUE_PARSER_H
 
-#include <map>
-#include <sstream>
+#include <string_view>
 
 namespace ezdv
 {
@@ -30,10 +29,53 @@ namespace network
 namespace flex
 {
 
+/// @brief Parses the space separated key=value pairs in Flex status updates 
+///        and discovery packets. Works in place on the original text, so 
+///        nothing is allocated; results are only valid as long as it is.
 class FlexKeyValueParser
 {
 public:
-    static std::map<std::string, std::string> GetCommandParameters(std::stringstream& ss);
+    /// @brief The keys we actually use.
+    enum Key
+    {
+        KEY_UNKNOWN = -1,
+        KEY_TX,
+        KEY_RF_FREQUENCY,
+        KEY_IN_USE,
+        KEY_MODE,
+        KEY_STATE,
+        KEY_SOURCE,
+        KEY_NICKNAME,
+        KEY_CALLSIGN,
+        KEY_IP,
+        NUM_KEYS
+    };
+
+    /// @brief Values of the known keys found in a line (empty if missing).
+    struct Parameters
+    {
+        std::string_view values[NUM_KEYS];
+        bool present[NUM_KEYS];
+
+        bool has(Key key) const { return present[key]; }
+        std::string_view operator[](Key key) const { return values[key]; }
+    };
+
+    /// @brief Creates a tokenizer over the given text.
+    FlexKeyValueParser(std::string_view text);
+
+    /// @brief Returns the next pair. Words without '=' have an empty value.
+    /// @return false once there are no more pairs.
+    bool next(std::string_view& key, std::string_view& value);
+
+    /// @brief Finds the values of all known keys in the given text.
+    static void GetCommandParameters(std::string_view text, Parameters& parameters);
+
+    /// @brief Returns which known key the given string is, if any.
+    static Key LookupKey(std::string_view key);
+
+private:
+    std::string_view remaining_;
 };
 
 }
@@ -42,4 +84,4 @@ public:
 
 }
 
-#endif // FLEX_KEY_VALUE_PARSER_H
\ No newline at end of file
+#endif // FLEX_KEY_VALUE_PARSER_H
@@ -21,7 +21,6 @@
 #include <cstring>
 #include "task/DVTaskMessage.h"
 
-#include "vita.h"
 
 extern "C"
 {
@@ -42,8 +41,6 @@ using namespace ezdv::task;
 enum FlexMessageTypes
 {
     CONNECT_RADIO = 1,
-    VITA_RECEIVE = 2,
-    VITA_SEND = 3,
     DISCOVERED_RADIO = 4,
 };
 
@@ -103,27 +100,6 @@ public:
     char ip[STR_SIZE];
 };
 
-template<uint32_t MSG_ID>
-class VitaMessageCommon : public DVTaskMessageBase<MSG_ID,  VitaMessageCommon<MSG_ID> >
-{
-public:
-    VitaMessageCommon(vita_packet* packetProvided = nullptr, int lengthProvided = 0)
-        : DVTaskMessageBase<MSG_ID,  VitaMessageCommon<MSG_ID> >(FLEX_MESSAGE)
-        , packet(packetProvided)
-        , length(lengthProvided)
-    {
-        // empty
-    }
-    
-    virtual ~VitaMessageCommon() = default;
-    
-    vita_packet* packet;
-    int length;
-};
-
-using ReceiveVitaMessage = VitaMessageCommon<VITA_RECEIVE>;
-using SendVitaMessage = VitaMessageCommon<VITA_SEND>;
-
 }
 
 }
@@ -15,6 +15,8 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <charconv>
+#include <cstring>
 #include <string>
 #include <sstream>
 #include <unistd.h>
@@ -24,12 +26,17 @@
 #include "FlexKeyValueParser.h"
 #include "audio/FreeDVMessage.h"
 #include "network/NetworkMessage.h"
+#include "network/NetworkReactor.h"
 #include "network/ReportingMessage.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #define CURRENT_LOG_TAG "FlexTcpTask"
 
+#define COMMAND_TIMEOUT_US (MS_TO_US(500)) /* time out waiting for each command's response after 0.5 second */
+#define COMMAND_TIMEOUT_CHECK_MS (100)
+
 namespace ezdv
 {
 
@@ -40,10 +47,12 @@ namespace flex
 {
 
 FlexTcpTask::FlexTcpTask()
-    : DVTask("FlexTcpTask", 10, 4096, tskNO_AFFINITY, 32, pdMS_TO_TICKS(10))
+    : DVTask("FlexTcpTask", 10, 4096, tskNO_AFFINITY, 32)
+    , rxBufferUsed_(0)
+    , numPendingCommands_(0)
     , reconnectTimer_(this, this, &FlexTcpTask::connect_, MS_TO_US(10000), "FlexTcpReconnectTimer") /* reconnect every 10 seconds */
     , connectionCheckTimer_(this, this, &FlexTcpTask::checkConnection_, MS_TO_US(100), "FlexTcpConnTimer") /* checks for connection every 100ms */
-    , commandHandlingTimer_(this, this, &FlexTcpTask::commandResponseTimeout_, MS_TO_US(500), "FlexTcpCmdTimeout") /* time out waiting for command response after 0.5 second */
+    , commandHandlingTimer_(this, this, &FlexTcpTask::commandResponseTimeout_, MS_TO_US(COMMAND_TIMEOUT_CHECK_MS), "FlexTcpCmdTimeout") /* checks for expired commands while any are outstanding */
     , pingTimer_(this, this, &FlexTcpTask::pingRadio_, MS_TO_US(10000), "FlexTcpPingTimer") /* pings radio every 10 seconds to verify connectivity */
     , socket_(-1)
     , sequenceNumber_(0)
@@ -52,11 +61,24 @@ FlexTcpTask::FlexTcpTask()
     , isTransmitting_(false)
     , isConnecting_(false)
 {
-    registerMessageHandler(this, &FlexTcpTask::onFlexConnectRadioMessage_);
-    registerMessageHandler(this, &FlexTcpTask::onRequestRxMessage_);
-    registerMessageHandler(this, &FlexTcpTask::onRequestTxMessage_);
-    registerMessageHandler(this, &FlexTcpTask::onFreeDVReceivedCallsignMessage_);
-    registerMessageHandler(this, &FlexTcpTask::onFreeDVModeChange_);
+    reconnectTimer_.useTimerWheel();
+    connectionCheckTimer_.useTimerWheel();
+    commandHandlingTimer_.useTimerWheel();
+    pingTimer_.useTimerWheel();
+
+    for (auto& pending : pendingCommands_)
+    {
+        pending.sequenceNumber = -1;
+    }
+
+    registerMessageHandlers<
+        &FlexTcpTask::onFlexConnectRadioMessage_,
+        &FlexTcpTask::onSocketReadable_,
+        &FlexTcpTask::onRequestRxMessage_,
+        &FlexTcpTask::onRequestTxMessage_,
+        &FlexTcpTask::onFreeDVReceivedCallsignMessage_,
+        &FlexTcpTask::onFreeDVModeChange_,
+        &FlexTcpTask::onActiveInterfaceChangedMessage_>(this);
     
     // Initialize filter widths. These are sent to SmartSDR on mode changes.
     filterWidths_.push_back(FilterPair_(150, 2850)); // ANA
@@ -98,37 +120,56 @@ void FlexTcpTask::onTaskSleep_(DVTask* origin, TaskSleepMessage* message)
     }
 }
 
-void FlexTcpTask::onTaskTick_()
+void FlexTcpTask::onSocketReadable_(DVTask* origin, SocketReadableMessage* message)
 {
-    if (socket_ <= 0 || isConnecting_ || !isAwake())
+    if (message->socket != socket_ || isConnecting_ || !isAwake())
     {
-        // Skip tick if we don't have a valid connection yet.
+        // Left over from a previous connection.
         return;
     }
     
     // Process if there is pending data on the socket.
-    char buffer = 0;
     while (true)
     {
-        auto rv = recv(socket_, &buffer, 1, 0);
+        auto rv = recv(socket_, &rxBuffer_[rxBufferUsed_], RX_BUFFER_SIZE - rxBufferUsed_, 0);
         if (rv > 0)
         {
-            // Append to input buffer. Then if we have a full line, we can process
-            // accordingly.
-            if (buffer == '\n')
+            // Hand out each full line received, then keep whatever's left
+            // over for next time.
+            size_t scanStart = rxBufferUsed_;
+            rxBufferUsed_ += rv;
+
+            size_t lineStart = 0;
+            char* newline = nullptr;
+            while ((newline = (char*)memchr(&rxBuffer_[scanStart], '\n', rxBufferUsed_ - scanStart)) != nullptr)
+            {
+                size_t lineEnd = newline - rxBuffer_;
+                processCommand_(std::string_view(&rxBuffer_[lineStart], lineEnd - lineStart));
+                if (socket_ <= 0)
+                {
+                    // Processing the line resulted in a disconnect.
+                    return;
+                }
+
+                lineStart = lineEnd + 1;
+                scanStart = lineStart;
+            }
+
+            if (lineStart > 0)
             {
-                std::string line = inputBuffer_.str();
-                processCommand_(line);
-                inputBuffer_.str("");
+                memmove(rxBuffer_, &rxBuffer_[lineStart], rxBufferUsed_ - lineStart);
+                rxBufferUsed_ -= lineStart;
             }
-            else
+            else if (rxBufferUsed_ == RX_BUFFER_SIZE)
             {
-                inputBuffer_.write(&buffer, rv);
+                ESP_LOGW(CURRENT_LOG_TAG, "Line from radio longer than %d bytes, discarding", RX_BUFFER_SIZE);
+                rxBufferUsed_ = 0;
             }
         }
         else if (rv == -1 && errno == EAGAIN)
         {
-            // Nothing actually available on the socket, ignore.
+            // Read everything available, wait for more.
+            NetworkReactor::Rearm(socket_);
             break;
         }
         else
@@ -148,16 +189,16 @@ void FlexTcpTask::socketFinalCleanup_(bool reconnect)
         ezdv::network::RadioConnectionStatusMessage response(false);
         publish(&response);
 
+        NetworkReactor::Unregister(socket_);
         close(socket_);
         socket_ = -1;
         activeSlice_ = -1;
-        isLSB_ = false;
+        freedvSlices_.clear();
         txSlice_ = -1;
 
-        responseHandlers_.clear();
-        inputBuffer_.clear();
+        clearPendingCommands_();
+        rxBufferUsed_ = 0;
 
-        commandHandlingTimer_.stop();
         connectionCheckTimer_.stop();
         pingTimer_.stop();
         isConnecting_ = false;
@@ -250,6 +291,7 @@ void FlexTcpTask::checkConnection_(DVTimer*)
             connectionCheckTimer_.stop();
 
             ESP_LOGI(CURRENT_LOG_TAG, "Connected to radio successfully");
+            NetworkReactor::Register(socket_, this);
             sequenceNumber_ = 0;
             
             // Report successful connection
@@ -302,27 +344,26 @@ void FlexTcpTask::initializeWaveform_()
 
 void FlexTcpTask::cleanupWaveform_()
 {
-    std::stringstream ss;
-    
-    // Change mode back to something that exists.
-    if (activeSlice_ >= 0)
+    // Change mode back to something that exists on every slice we were using.
+    // The radio answers commands in the order they're sent, so these can all
+    // go out at once and the final handler below still runs last.
+    while (!freedvSlices_.empty() && socket_ > 0)
     {
-        ss << "slice set " << activeSlice_ << " mode=";
-        if (isLSB_) ss << "LSB";
-        else ss << "USB";
+        int sliceId = freedvSlices_.begin()->first;
+        bool isLSB = freedvSlices_.begin()->second;
+        freedvSlices_.erase(freedvSlices_.begin());
 
-        // Ensure that we disconnect from any reporting services as appropriate
-        DisableReportingMessage disableMessage;
-        publish(&disableMessage);
-        
-        sendRadioCommand_(ss.str().c_str(), [&](unsigned int rv, std::string message) {
-            // Recursively call ourselves again to actually remove the waveform
-            // once we get a response for this command.
+        if (sliceId == activeSlice_)
+        {
+            // Ensure that we disconnect from any reporting services as appropriate
+            DisableReportingMessage disableMessage;
+            publish(&disableMessage);
             activeSlice_ = -1;
-            cleanupWaveform_();
-        });
+        }
         
-        return;
+        char command[64];
+        snprintf(command, sizeof(command), "slice set %d mode=%s", sliceId, isLSB ? "LSB" : "USB");
+        sendRadioCommand_(command);
     }
     
     sendRadioCommand_("unsub slice all"/*);
@@ -341,260 +382,293 @@ void FlexTcpTask::createWaveform_(std::string name, std::string shortName, std::
     // Actually create the waveform.
     std::string waveformCommand = "waveform create name=" + name + " mode=" + shortName + " underlying_mode=" + underlyingMode + " version=2.0.0";
     std::string setPrefix = "waveform set " + name + " ";
-    sendRadioCommand_(waveformCommand, [&, setPrefix](unsigned int rv, std::string message) {
-        if (rv == 0)
+    sendRadioCommand_(waveformCommand, [&, name](unsigned int rv, std::string message) {
+        if (rv != 0)
         {
-            // Set the filter-related settings for the just-created waveform.
-            sendRadioCommand_(setPrefix + "tx=1");
-            sendRadioCommand_(setPrefix + "rx_filter depth=256");
-            sendRadioCommand_(setPrefix + "tx_filter depth=256");
-
-            // Link waveform to our UDP audio stream.
-            sendRadioCommand_(setPrefix + "udpport=4992");
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not create waveform %s", name.c_str());
         }
     });
-}
 
-void FlexTcpTask::sendRadioCommand_(std::string command)
-{
-    sendRadioCommand_(command, std::function<void(int rv, std::string message)>());
+    // The radio processes commands in order, so the settings below don't need
+    // to wait for the waveform to be created. A failed create just means 
+    // these fail too.
+    
+    // Set the filter-related settings for the just-created waveform.
+    sendRadioCommand_(setPrefix + "tx=1");
+    sendRadioCommand_(setPrefix + "rx_filter depth=256");
+    sendRadioCommand_(setPrefix + "tx_filter depth=256");
+
+    // Link waveform to our UDP audio stream.
+    sendRadioCommand_(setPrefix + "udpport=4992");
 }
 
-void FlexTcpTask::sendRadioCommand_(std::string command, std::function<void(unsigned int rv, std::string message)> fn)
+void FlexTcpTask::sendRadioCommand_(std::string_view command, HandlerMapFn_ fn)
 {
     int err = 0;
 
-    if (socket_ > 0)
+    if (socket_ <= 0)
     {
-        std::ostringstream ss;
+        return;
+    }
 
-        ESP_LOGI(CURRENT_LOG_TAG, "Sending '%s' as command %d", command.c_str(), sequenceNumber_);    
-        ss << "C" << (sequenceNumber_) << "|" << command << "\n";
-        
-        // Make sure we can actually write to the socket
-        fd_set writeSet;
-        struct timeval tv = {0, 0};
+    PendingCommand_& pending = pendingCommands_[sequenceNumber_ & (MAX_PENDING_COMMANDS - 1)];
+    if (pending.sequenceNumber != -1)
+    {
+        // The radio hasn't answered the command that was sent MAX_PENDING_COMMANDS
+        // commands ago, so there's nowhere to track this one.
+        ESP_LOGE(CURRENT_LOG_TAG, "Too many outstanding commands, not sending '%.*s'", (int)command.length(), command.data());
+        if (fn)
+        {
+            fn(0xFFFFFFFF, "Too many outstanding commands");
+        }
+        return;
+    }
 
-        FD_ZERO(&writeSet);
-        FD_SET(socket_, &writeSet);
+    ESP_LOGI(CURRENT_LOG_TAG, "Sending '%.*s' as command %d", (int)command.length(), command.data(), sequenceNumber_);
+    int length = snprintf(commandBuffer_, COMMAND_BUFFER_SIZE, "C%d|%.*s\n", sequenceNumber_, (int)command.length(), command.data());
+    assert(length > 0 && length < COMMAND_BUFFER_SIZE);
 
-        if (select(socket_ + 1, nullptr, &writeSet, nullptr, &tv) > 0)
-        {
-            int sockErrCode = 0;
-            socklen_t resultLength = sizeof(sockErrCode);
-            auto sockOptError = getsockopt(socket_, SOL_SOCKET, SO_ERROR, &sockErrCode, &resultLength);
+    // The socket is non-blocking, so this fails instead of waiting if the
+    // radio has stopped accepting data.
+    auto rv = send(socket_, commandBuffer_, length, 0);
+    if (rv != length)
+    {
+        err = rv < 0 ? errno : EAGAIN;
+        ESP_LOGE(CURRENT_LOG_TAG, "Failed writing command to radio!");
 
-            if (sockOptError < 0)
-            {
-                err = errno;
-                goto socket_error;
-            }
-            else if (sockErrCode != 0)
-            {
-                err = sockErrCode;
-                goto socket_error;
-            }
-            else if (sockErrCode == 0)
-            {
-                auto rv = write(socket_, ss.str().c_str(), ss.str().length());
-                if (rv <= 0)
-                {
-                    err = rv;
-                    goto socket_error;
-                }
-                else
-                {
-                    responseHandlers_[sequenceNumber_++] = fn;
-                    commandHandlingTimer_.stop();
-                    commandHandlingTimer_.start(true);
-                }
-            }
-            
-            return;
-        }
-        else
+        // We've likely disconnected, do cleanup and re-attempt connection.
+        socketFinalCleanup_(true);
+
+        // Call event handler with failure code in case the sender needs to
+        // do any additional actions.
+        if (fn)
         {
-            err = errno;
+            fn(0xFFFFFFFF, strerror(err));
         }
-    }
-    else
-    {
         return;
     }
 
-socket_error:
-    ESP_LOGE(CURRENT_LOG_TAG, "Failed writing command to radio!");
-
-    // We've likely disconnected, do cleanup and re-attempt connection.
-    socketFinalCleanup_(true);
+    pending.sequenceNumber = sequenceNumber_++;
+    pending.deadlineUs = esp_timer_get_time() + COMMAND_TIMEOUT_US;
+    pending.fn = fn;
+    numPendingCommands_++;
+    commandHandlingTimer_.start();
+}
 
-    // Call event handler with failure code in case the sender needs to
-    // do any additional actions.
-    fn(0xFFFFFFFF, strerror(err));
+void FlexTcpTask::clearPendingCommands_()
+{
+    for (auto& pending : pendingCommands_)
+    {
+        pending.sequenceNumber = -1;
+        pending.fn = HandlerMapFn_();
+    }
+    numPendingCommands_ = 0;
+    commandHandlingTimer_.stop();
 }
 
 void FlexTcpTask::commandResponseTimeout_(DVTimer*)
 {
-    // We timed out waiting for a response, just go ahead and call handlers so that
-    // processing can continue.
-    ESP_LOGW(CURRENT_LOG_TAG, "Timed out waiting for response from radio.");
-    for (auto& kvp : responseHandlers_)
+    // Call handlers for any commands we've given up on so that processing can
+    // continue. The handler may send more commands, so the slot is freed first.
+    int64_t now = esp_timer_get_time();
+    for (auto& pending : pendingCommands_)
     {
-        if (kvp.second)
+        if (pending.sequenceNumber != -1 && pending.deadlineUs <= now)
         {
-            ESP_LOGI(CURRENT_LOG_TAG, "Calling response handler for command %d", kvp.first);
-            kvp.second(0xFFFFFFFF, "Timed out waiting for response from radio");
+            ESP_LOGW(CURRENT_LOG_TAG, "Timed out waiting for response to command %d", pending.sequenceNumber);
+
+            HandlerMapFn_ fn = std::move(pending.fn);
+            pending.sequenceNumber = -1;
+            pending.fn = HandlerMapFn_();
+            numPendingCommands_--;
+
+            if (fn)
+            {
+                fn(0xFFFFFFFF, "Timed out waiting for response from radio");
+            }
+            
+            if (socket_ <= 0)
+            {
+                // Handler disconnected us.
+                return;
+            }
         }
     }
-    responseHandlers_.clear();
+
+    if (numPendingCommands_ == 0)
+    {
+        commandHandlingTimer_.stop();
+    }
 }
 
-void FlexTcpTask::processCommand_(std::string& command)
+void FlexTcpTask::processCommand_(std::string_view command)
 {
+    if (command.empty())
+    {
+        return;
+    }
+
     if (command[0] == 'V')
     {
         // Version information from radio
-        ESP_LOGI(CURRENT_LOG_TAG, "Radio is using protocol version %s", &command.c_str()[1]);
+        ESP_LOGI(CURRENT_LOG_TAG, "Radio is using protocol version %.*s", (int)command.length() - 1, command.data() + 1);
     }
     else if (command[0] == 'H')
     {
         // Received connection's handle. We don't currently do anything with this other
         // than trigger waveform creation.
-        ESP_LOGI(CURRENT_LOG_TAG, "Connection handle is %s", &command.c_str()[1]);
+        ESP_LOGI(CURRENT_LOG_TAG, "Connection handle is %.*s", (int)command.length() - 1, command.data() + 1);
         initializeWaveform_();
     }
     else if (command[0] == 'R')
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "Received response %s", command.c_str());
+        ESP_LOGI(CURRENT_LOG_TAG, "Received response %.*s", (int)command.length(), command.data());
         
-        // Received response for a command.
-        command.erase(0, 1);
-        std::stringstream ss(command);
-        int seq = 0;
+        // Received response for a command. These look like "R<seq>|<hex result>|<message>".
+        std::string_view response = command.substr(1);
+        std::string_view message;
+        int seq = -1;
         unsigned int rv = 0;
-        char temp = 0;
         
-        // Get sequence number and return value
-        ss >> seq >> temp >> std::hex >> rv;
+        std::from_chars(response.data(), response.data() + response.length(), seq);
+        auto pipe = response.find('|');
+        if (pipe != std::string_view::npos)
+        {
+            std::string_view result = response.substr(pipe + 1);
+            std::from_chars(result.data(), result.data() + result.length(), rv, 16);
+
+            pipe = result.find('|');
+            if (pipe != std::string_view::npos)
+            {
+                message = result.substr(pipe + 1);
+            }
+        }
         
         if (rv != 0)
         {
             ESP_LOGE(CURRENT_LOG_TAG, "Command %d returned error %x", seq, rv);
         }
         
-        // If we have a valid command handler, call it now
-        if (responseHandlers_[seq])
+        if (seq < 0 || pendingCommands_[seq & (MAX_PENDING_COMMANDS - 1)].sequenceNumber != seq)
         {
-            responseHandlers_[seq](rv, ss.str());
+            ESP_LOGW(CURRENT_LOG_TAG, "Received response for unknown command %d", seq);
+            return;
         }
-        responseHandlers_.erase(seq);
 
+        PendingCommand_& pending = pendingCommands_[seq & (MAX_PENDING_COMMANDS - 1)];
+        HandlerMapFn_ fn = std::move(pending.fn);
+        pending.sequenceNumber = -1;
+        pending.fn = HandlerMapFn_();
+        numPendingCommands_--;
+        
         // Stop timer if we're not waiting for any more responses.
-        if (responseHandlers_.size() == 0)
+        if (numPendingCommands_ == 0)
         {
             commandHandlingTimer_.stop();
         }
+
+        // If we have a valid command handler, call it now
+        if (fn)
+        {
+            fn(rv, std::string(message));
+        }
     }
     else if (command[0] == 'S')
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "Received status update %s", command.c_str());
-        
-        command.erase(0, 1);
-        std::stringstream ss(command);
-        unsigned int clientId = 0;
-        std::string statusName;
+        ESP_LOGI(CURRENT_LOG_TAG, "Received status update %.*s", (int)command.length(), command.data());
         
-        ss >> std::hex >> clientId;
-        char pipe = 0;
-        ss >> pipe >> statusName;
+        // Status updates look like "S<client ID>|<status name> [<object ID>] key=value key=value ...".
+        // We don't need the client ID.
+        auto pipe = command.find('|');
+        std::string_view status = pipe == std::string_view::npos ? std::string_view() : command.substr(pipe + 1);
+        auto space = status.find(' ');
+        std::string_view statusName = status.substr(0, space);
+        std::string_view rest = space == std::string_view::npos ? std::string_view() : status.substr(space + 1);
+        FlexKeyValueParser::Parameters parameters;
         
         if (statusName == "slice")
         {
             ESP_LOGI(CURRENT_LOG_TAG, "Detected slice update");
             
             int sliceId = 0;
-            ss >> std::dec >> sliceId;
+            auto result = std::from_chars(rest.data(), rest.data() + rest.length(), sliceId);
+            rest.remove_prefix(result.ptr - rest.data());
             
-            auto parameters = FlexKeyValueParser::GetCommandParameters(ss);
+            FlexKeyValueParser::GetCommandParameters(rest, parameters);
 
-            auto tx = parameters.find("tx");
-            if (tx != parameters.end() && tx->second == "1")
+            if (parameters[FlexKeyValueParser::KEY_TX] == "1")
             {
                 txSlice_ = sliceId;
             }
 
-            auto rfFrequency = parameters.find("RF_frequency");
-            if (rfFrequency != parameters.end())
+            if (parameters.has(FlexKeyValueParser::KEY_RF_FREQUENCY))
             {
-                sliceFrequencies_[sliceId] = rfFrequency->second;
+                sliceFrequencies_[sliceId] = parameters[FlexKeyValueParser::KEY_RF_FREQUENCY];
 
                 // Report new frequency to any listening reporters
                 if (activeSlice_ == sliceId)
                 {
                     // Frequency reported by Flex is in MHz but reporters expect
                     // it in Hz.
-                    uint64_t freqHz = atof(rfFrequency->second.c_str()) * 1000000;
+                    uint64_t freqHz = atof(sliceFrequencies_[sliceId].c_str()) * 1000000;
 
                     ReportFrequencyChangeMessage freqChangeMessage(freqHz);
                     publish(&freqChangeMessage);
                 }
             }
             
-            auto isActive = parameters.find("in_use");
-            if (isActive != parameters.end())
+            if (parameters.has(FlexKeyValueParser::KEY_IN_USE))
             {
-                activeSlices_[sliceId] = isActive->second == "1" ? true : false;
-                if (sliceId == activeSlice_ && !activeSlices_[sliceId])
+                activeSlices_[sliceId] = parameters[FlexKeyValueParser::KEY_IN_USE] == "1";
+                if (!activeSlices_[sliceId])
                 {
-                    // Ensure that we disconnect from any reporting services as appropriate
-                    DisableReportingMessage disableMessage;
-                    publish(&disableMessage);
-
-                    activeSlice_ = -1;
+                    releaseSlice_(sliceId);
                 }
             }
             
-            auto mode = parameters.find("mode");
-            if (mode != parameters.end())
+            if (parameters.has(FlexKeyValueParser::KEY_MODE))
             {
-                if (mode->second == "FDVU" || mode->second == "FDVL")
+                auto mode = parameters[FlexKeyValueParser::KEY_MODE];
+                if (mode == "FDVU" || mode == "FDVL")
                 {
-                    if (sliceId != activeSlice_)
+                    if (freedvSlices_.find(sliceId) == freedvSlices_.end())
                     {
                         ESP_LOGI(CURRENT_LOG_TAG, "Swtiching slice %d to FreeDV mode", sliceId);
-                        
+                    }
+                    freedvSlices_[sliceId] = mode == "FDVL";
+
+                    if (sliceId != activeSlice_)
+                    {
                         if (activeSlice_ == -1)
                         {
-                            // Don't enable reporting if we've already done so.
-                            ESP_LOGI(CURRENT_LOG_TAG, "Enabling FreeDV reporting for slice %d", sliceId);
-                            EnableReportingMessage enableMessage;
-                            publish(&enableMessage);
+                            activateSlice_(sliceId);
+                        }
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+                        else if (freedvSlices_.size() <= MAX_FREEDV_SLICES)
+                        {
+                            // Decoded alongside the active slice; TX and 
+                            // reporting stay with the active one.
+                            ESP_LOGI(CURRENT_LOG_TAG, "Monitoring slice %d (active = %d)", sliceId, activeSlice_);
                         }
+                        else
+                        {
+                            ESP_LOGW(CURRENT_LOG_TAG, "Only %d slices can use FDVU/FDVL at once, not decoding slice %d", MAX_FREEDV_SLICES, sliceId);
+                        }
+#else
                         else 
                         {
                             ESP_LOGW(CURRENT_LOG_TAG, "Attempted to activate FDVU/FDVL from a second slice (id = %d, active = %d)", sliceId, activeSlice_);
+                            activateSlice_(sliceId);
                         }
-
-                        // User wants to use the waveform.
-                        activeSlice_ = sliceId;
-
-                        // Ensure that we connect to any reporting services as appropriate
-                        uint64_t freqHz = atof(sliceFrequencies_[activeSlice_].c_str()) * 1000000;
-                        ReportFrequencyChangeMessage freqChangeMessage(freqHz);
-                        publish(&freqChangeMessage);
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
                     }
                     
                     // Set the filter corresponding to the current mode.
-                    isLSB_ = mode->second == "FDVL";
-                    setFilter_(currentWidth_.first, currentWidth_.second);
+                    setFilter_(sliceId, currentWidth_.first, currentWidth_.second);
                 }
-                else if (sliceId == activeSlice_)
+                else
                 {
-                    // Ensure that we disconnect from any reporting services as appropriate
-                    DisableReportingMessage disableMessage;
-                    publish(&disableMessage);
-
-                    activeSlice_ = -1;
+                    releaseSlice_(sliceId);
                 }
             }
         }
@@ -602,12 +676,11 @@ void FlexTcpTask::processCommand_(std::string& command)
         {
             ESP_LOGI(CURRENT_LOG_TAG, "Detected interlock update");
             
-            auto parameters = FlexKeyValueParser::GetCommandParameters(ss);
-            auto state = parameters.find("state");
-            auto source = parameters.find("source");
+            FlexKeyValueParser::GetCommandParameters(rest, parameters);
+            auto state = parameters[FlexKeyValueParser::KEY_STATE];
             
-            if (state != parameters.end() && state->second == "PTT_REQUESTED" &&
-                activeSlice_ == txSlice_ && source->second != "TUNE")
+            if (state == "PTT_REQUESTED" &&
+                activeSlice_ == txSlice_ && parameters[FlexKeyValueParser::KEY_SOURCE] != "TUNE")
             {
                 // Going into transmit mode
                 ESP_LOGI(CURRENT_LOG_TAG, "Radio went into transmit");
@@ -615,7 +688,7 @@ void FlexTcpTask::processCommand_(std::string& command)
                 audio::RequestTxMessage message;
                 publish(&message);
             }
-            else if (state != parameters.end() && state->second == "UNKEY_REQUESTED")
+            else if (state == "UNKEY_REQUESTED")
             {
                 // Going back into receive
                 ESP_LOGI(CURRENT_LOG_TAG, "Radio went out of transmit");
@@ -626,12 +699,12 @@ void FlexTcpTask::processCommand_(std::string& command)
         }
         else
         {
-            ESP_LOGW(CURRENT_LOG_TAG, "Unknown status update type %s", statusName.c_str());
+            ESP_LOGW(CURRENT_LOG_TAG, "Unknown status update type %.*s", (int)statusName.length(), statusName.data());
         }
     }
     else
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "Got unhandled command %s", command.c_str());
+        ESP_LOGW(CURRENT_LOG_TAG, "Got unhandled command %.*s", (int)command.length(), command.data());
     }
 }
 
@@ -642,6 +715,17 @@ void FlexTcpTask::onFlexConnectRadioMessage_(DVTask* origin, FlexConnectRadioMes
     connect_(nullptr);
 }
 
+void FlexTcpTask::onActiveInterfaceChangedMessage_(DVTask* origin, ActiveInterfaceChangedMessage* message)
+{
+    // TCP connections can't move to another address, so reconnect right 
+    // away instead of waiting for this one to time out.
+    if (socket_ != -1)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Network interface changed, reconnecting to radio");
+        connect_(nullptr);
+    }
+}
+
 void FlexTcpTask::onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage* message)
 {
     if (activeSlice_ >= 0 && !isTransmitting_)
@@ -673,28 +757,75 @@ void FlexTcpTask::onFreeDVReceivedCallsignMessage_(DVTask* origin, audio::FreeDV
 void FlexTcpTask::onFreeDVModeChange_(DVTask* origin, audio::SetFreeDVModeMessage* message)
 {
     currentWidth_ = filterWidths_[message->mode];
-    setFilter_(currentWidth_.first, currentWidth_.second);
+    for (auto& slice : freedvSlices_)
+    {
+        setFilter_(slice.first, currentWidth_.first, currentWidth_.second);
+    }
 }
 
-void FlexTcpTask::setFilter_(int low, int high)
+void FlexTcpTask::setFilter_(int sliceId, int low, int high)
 {
-    if (activeSlice_ >= 0)
+    auto slice = freedvSlices_.find(sliceId);
+    if (slice != freedvSlices_.end())
     {
         int low_cut = low;
         int high_cut = high;
 
-        if (isLSB_)
+        if (slice->second)
         {
             low_cut = -high;
             high_cut = -low;
         }
 
         std::stringstream ss;
-        ss << "filt " << activeSlice_ << " " << low_cut << " " << high_cut;
+        ss << "filt " << sliceId << " " << low_cut << " " << high_cut;
         sendRadioCommand_(ss.str());
     }
 }
 
+void FlexTcpTask::activateSlice_(int sliceId)
+{
+    if (activeSlice_ == -1)
+    {
+        // Don't enable reporting if we've already done so.
+        ESP_LOGI(CURRENT_LOG_TAG, "Enabling FreeDV reporting for slice %d", sliceId);
+        EnableReportingMessage enableMessage;
+        publish(&enableMessage);
+    }
+
+    // User wants to use the waveform.
+    activeSlice_ = sliceId;
+
+    // Ensure that we connect to any reporting services as appropriate
+    uint64_t freqHz = atof(sliceFrequencies_[activeSlice_].c_str()) * 1000000;
+    ReportFrequencyChangeMessage freqChangeMessage(freqHz);
+    publish(&freqChangeMessage);
+}
+
+void FlexTcpTask::releaseSlice_(int sliceId)
+{
+    freedvSlices_.erase(sliceId);
+    if (sliceId != activeSlice_)
+    {
+        return;
+    }
+
+    // Ensure that we disconnect from any reporting services as appropriate
+    DisableReportingMessage disableMessage;
+    publish(&disableMessage);
+
+    activeSlice_ = -1;
+
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    // Hand TX and reporting over to a slice we're still monitoring.
+    if (!freedvSlices_.empty())
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Slice %d is now the active FreeDV slice", freedvSlices_.begin()->first);
+        activateSlice_(freedvSlices_.begin()->first);
+    }
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+}
+
 void FlexTcpTask::pingRadio_(DVTimer*)
 {
     // Sends ping command to radio every ten seconds. We don't care about the
@@ -19,9 +19,12 @@
 #define FLEX_TCP_TASK_H
 
 #include <sstream>
+#include <string_view>
 #include <map>
 #include <functional>
 
+#include "sdkconfig.h"
+
 #include "audio/FreeDVMessage.h"
 #include "audio/VoiceKeyerMessage.h"
 #include "task/DVTask.h"
@@ -29,6 +32,7 @@
 #include "util/PSRamAllocator.h"
 
 #include "FlexMessage.h"
+#include "network/NetworkMessage.h"
 
 namespace ezdv
 {
@@ -45,18 +49,45 @@ using namespace ezdv::task;
 class FlexTcpTask : public DVTask
 {
 public:
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    enum { MAX_FREEDV_SLICES = 2 }; // Must match FlexVitaTask.
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
     FlexTcpTask();
     virtual ~FlexTcpTask();
         
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
-    virtual void onTaskTick_() override;
     
     virtual void onTaskSleep_(DVTask* origin, TaskSleepMessage* message);
     
 private:
-    std::stringstream inputBuffer_;
+    enum { RX_BUFFER_SIZE = 2048 }; // Longer than any line the radio sends.
+    enum { COMMAND_BUFFER_SIZE = 512 }; // Longer than any command we send.
+    enum { MAX_PENDING_COMMANDS = 32 }; // Must be a power of two.
+    
+    using HandlerMapFn_ = std::function<void(unsigned int rv, std::string message)>;
+    
+    /// @brief A command sent to the radio that hasn't been answered yet.
+    struct PendingCommand_
+    {
+        int sequenceNumber; // -1 if this slot is free.
+        int64_t deadlineUs;
+        HandlerMapFn_ fn;
+    };
+
+    // Data received from the radio that hasn't been processed yet (at most 
+    // one partial line after each tick).
+    char rxBuffer_[RX_BUFFER_SIZE];
+    size_t rxBufferUsed_;
+    char commandBuffer_[COMMAND_BUFFER_SIZE];
+    
+    // Commands waiting for responses, indexed by sequence number modulo
+    // MAX_PENDING_COMMANDS. Each has its own deadline so that any number
+    // can be in flight at once.
+    PendingCommand_ pendingCommands_[MAX_PENDING_COMMANDS];
+    int numPendingCommands_;
     DVTimer reconnectTimer_;
     DVTimer connectionCheckTimer_;
     DVTimer commandHandlingTimer_;
@@ -64,22 +95,19 @@ private:
     int socket_;
     int sequenceNumber_;
     std::string ip_;
-    int activeSlice_;
-    bool isLSB_;
+    int activeSlice_; // The slice used for TX and reporting.
     int txSlice_;
     bool isTransmitting_;
     bool isConnecting_;
 
     std::map<int, std::string, std::less<int>, util::PSRamAllocator<std::pair<const int, std::string> > > sliceFrequencies_;
     std::map<int, bool, std::less<int>, util::PSRamAllocator<std::pair<const int, bool> > > activeSlices_;
+    std::map<int, bool, std::less<int>, util::PSRamAllocator<std::pair<const int, bool> > > freedvSlices_; // Slices in FDVU/FDVL mode (true if LSB).
     
     using FilterPair_ = std::pair<int, int>; // Low/high cut in Hz.
     std::vector<FilterPair_, util::PSRamAllocator<FilterPair_> > filterWidths_;
     FilterPair_ currentWidth_;
     
-    using HandlerMapFn_ = std::function<void(unsigned int rv, std::string message)>;
-    std::map<int, HandlerMapFn_, std::less<int>, util::PSRamAllocator<std::pair<const int, HandlerMapFn_> > > responseHandlers_;
-    
     void connect_(DVTimer*);
     void checkConnection_(DVTimer*);
     void disconnect_();
@@ -90,17 +118,26 @@ private:
     void createWaveform_(std::string name, std::string shortName, std::string underlyingMode);
     void cleanupWaveform_();
     
-    void sendRadioCommand_(std::string command);
-    void sendRadioCommand_(std::string command, std::function<void(unsigned int rv, std::string message)> fn);
+    /// @brief Sends a command to the radio without waiting for earlier commands to be answered.
+    /// @param command The command to send (without sequence number or newline).
+    /// @param fn Called with the radio's response, or with 0xFFFFFFFF on timeout or failure.
+    void sendRadioCommand_(std::string_view command, HandlerMapFn_ fn = HandlerMapFn_());
+    void clearPendingCommands_();
     
-    void processCommand_(std::string& command);
+    /// @brief Handles a line received from the radio (without the newline).
+    void processCommand_(std::string_view command);
     
     void onFlexConnectRadioMessage_(DVTask* origin, FlexConnectRadioMessage* message);
+    void onActiveInterfaceChangedMessage_(DVTask* origin, ActiveInterfaceChangedMessage* message);
+    void onSocketReadable_(DVTask* origin, SocketReadableMessage* message);
     void onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage* message);
     void onRequestRxMessage_(DVTask* origin, audio::TransmitCompleteMessage* message);
 
     void onFreeDVModeChange_(DVTask* origin, audio::SetFreeDVModeMessage* message);
-    void setFilter_(int low, int high);
+    void setFilter_(int sliceId, int low, int high);
+
+    void activateSlice_(int sliceId);
+    void releaseSlice_(int sliceId);
     
     // Spot handling
     void onFreeDVReceivedCallsignMessage_(DVTask* origin, audio::FreeDVReceivedCallsignMessage* message);
@@ -15,30 +15,42 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cmath>
 #include <unistd.h>
 
 #include "FlexVitaTask.h"
 #include "FlexKeyValueParser.h"
+#include "network/PacketCapture.h"
+#include "storage/SettingsSnapshot.h"
+#include "util/MemoryPlacement.h"
 
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_dsp.h"
+#include "esp_rom_sys.h"
 
-#include "codec2_fifo.h"
 #include "codec2_fdmdv.h"
 
 #include "SampleRateConverter.h"
 
-#define MAX_VITA_PACKETS (200)
 #define MAX_VITA_SAMPLES (42) /* 5.25ms/block @ 8000 Hz */
+
+// AudioMixer writes up to 20ms at a time.
+#define MIXER_MAX_FRAME_SAMPLES (160)
 #define MAX_VITA_SAMPLES_TO_RESAMPLE (MAX_VITA_SAMPLES * FDMDV_OS_24) /* Must be less than the max size of the VITA packet (180 two channel samples) */
 #define VITA_SAMPLES_TO_SEND MAX_VITA_SAMPLES_TO_RESAMPLE
 #define MIN_VITA_PACKETS_TO_SEND (4)
 #define MAX_VITA_PACKETS_TO_SEND (10)
 #define US_OF_AUDIO_PER_VITA_PACKET (5250)
-#define VITA_IO_TIME_INTERVAL_US (US_OF_AUDIO_PER_VITA_PACKET * MIN_VITA_PACKETS_TO_SEND) /* Time interval between subsequent sends or receives */
-#define MAX_JITTER_US (500) /* Corresponds to +/- the maximum amount VITA_IO_TIME_INTERVAL_US should vary by. */
+#define VITA_IO_TIME_INTERVAL_US (US_OF_AUDIO_PER_VITA_PACKET * MIN_VITA_PACKETS_TO_SEND) /* Time interval between subsequent receives */
+#define MAX_JITTER_US (500) /* Corresponds to +/- the maximum amount the write timer's interval should vary by. */
+#define VITA_SEND_RETRY_DELAY_US (250) /* Time to wait between attempts when Wi-Fi is out of buffers. */
+#define VITA_TASK_QUEUE_SIZE (64)
+#define VITA_RX_PBUF_QUEUE_SIZE (MAX_VITA_PACKETS_TO_SEND * 2) /* Received packets held for the read timer (CONFIG_EZDV_AUDIO_PBUF_SOCKETS). */
+#define VITA_SAMPLE_RATE (24000)
+#define VITA_STREAM_TIMEOUT_US (1000000) /* Slices not heard from for this long give up their stream slot. */
+#define FREEDV_SAMPLE_RATE (8000)
 
 #define CURRENT_LOG_TAG "FlexVitaTask"
 
@@ -51,61 +63,167 @@ namespace network
 namespace flex
 {
     
-static float tx_scale_factor = std::exp(9.0f/20.0f * std::log(10.0f));
+// SmartSDR expects audio somewhat louder than what FreeDV produces.
+#define VITA_AUDIO_TRIM_DB (9.0f)
 
 FlexVitaTask::FlexVitaTask()
-    : DVTask("FlexVitaTask", 16, 4096, 1, 512)
-    , audio::AudioInput(2, 2)
+    : DVTask("FlexVitaTask", 16, 4096, 1, VITA_TASK_QUEUE_SIZE)
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    , audio::AudioInput("FlexVitaTask", 3, { MIXER_MAX_FRAME_SAMPLES, FREEDV_MAX_FRAME_SAMPLES, FREEDV_MAX_FRAME_SAMPLES })
+#else
+    , audio::AudioInput("FlexVitaTask", 2, { MIXER_MAX_FRAME_SAMPLES, FREEDV_MAX_FRAME_SAMPLES })
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
     , packetReadTimer_(this, this, &FlexVitaTask::readPendingPackets_, VITA_IO_TIME_INTERVAL_US, "FlexVitaPacketReadTimer")
-    , packetWriteTimer_(this, this, &FlexVitaTask::sendAudioOut_, VITA_IO_TIME_INTERVAL_US, "FlexVitaPacketWriteTimer")
+    , packetWriteTimer_(this, this, &FlexVitaTask::sendAudioOut_, US_OF_AUDIO_PER_VITA_PACKET * CONFIG_EZDV_QOS_FLEX_VITA_BATCH, "FlexVitaPacketWriteTimer") /* one batch of audio; see VitaTxPacer */
     , socket_(-1)
     , rxStreamId_(0)
     , txStreamId_(0)
     , audioSeqNum_(0)
-    , currentTime_(0)
-    , timeFracSeq_(0)
     , audioEnabled_(false)
+    , powerLock_("FlexVitaTask")
     , isTransmitting_(false)
     , inputCtr_(0)
-    , lastVitaGenerationTime_(0)
-    , minPacketsRequired_(0)
-    , timeBeyondExpectedUs_(0)
+    , lastRxPacketTimeUs_(0)
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    , secondaryStreamId_(0)
+    , lastSecondaryPacketTimeUs_(0)
+    , secondarySeqNum_(0)
+    , secondaryInputCtr_(0)
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+    , upsampleTimeUs_(0)
+    , numUpsampleBlocks_(0)
+    , downsampleTimeUs_(0)
+    , numDownsampleBlocks_(0)
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    , userDriftCompensator_(FREEDV_SAMPLE_RATE)
+    , radioDriftCompensator_(FREEDV_SAMPLE_RATE)
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    , secondaryDriftCompensator_(FREEDV_SAMPLE_RATE)
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+    , jitterBuffer_(FREEDV_SAMPLE_RATE, CONFIG_EZDV_FLEX_JITTER_BUFFER_MAX_MS)
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+    , txPacer_(US_OF_AUDIO_PER_VITA_PACKET, MAX_VITA_PACKETS_TO_SEND)
+    , txClock_(VITA_SAMPLE_RATE)
+    , userGain_(VITA_AUDIO_TRIM_DB)
+    , radioGain_(VITA_AUDIO_TRIM_DB)
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    // A whole batch late means the radio has likely run dry.
+    , txDeadline_("VITA TX", US_OF_AUDIO_PER_VITA_PACKET * CONFIG_EZDV_QOS_FLEX_VITA_BATCH, US_OF_AUDIO_PER_VITA_PACKET * CONFIG_EZDV_QOS_FLEX_VITA_BATCH)
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
 {
-    registerMessageHandler(this, &FlexVitaTask::onFlexConnectRadioMessage_);
-    registerMessageHandler(this, &FlexVitaTask::onReceiveVitaMessage_);
-    registerMessageHandler(this, &FlexVitaTask::onSendVitaMessage_);
-    registerMessageHandler(this, &FlexVitaTask::onEnableReportingMessage_);
-    registerMessageHandler(this, &FlexVitaTask::onDisableReportingMessage_);
-    registerMessageHandler(this, &FlexVitaTask::onRequestRxMessage_);
-    registerMessageHandler(this, &FlexVitaTask::onRequestTxMessage_);
-
-    downsamplerInBuf_ = (short*)heap_caps_calloc((MAX_VITA_SAMPLES * FDMDV_OS_24 + FDMDV_OS_TAPS_24K), sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    registerMessageHandlers<
+        &FlexVitaTask::onFlexConnectRadioMessage_,
+        &FlexVitaTask::onEnableReportingMessage_,
+        &FlexVitaTask::onDisableReportingMessage_,
+        &FlexVitaTask::onRequestRxMessage_,
+        &FlexVitaTask::onRequestTxMessage_,
+        &FlexVitaTask::onRightChannelVolumeMessage_>(this);
+
+    // Keep timer fires ahead of control traffic. (Packets are sent and 
+    // received directly from the timers and never go through the queue.)
+    enableMessageLanes(VITA_TASK_QUEUE_SIZE, 0);
+
+    // Packets need to go out on a steady cadence (see MAX_JITTER_US), so
+    // don't wait behind queued messages for the write timer.
+    packetWriteTimer_.enableDirectDispatch();
+
+    // Likewise, read packets as soon as the read timer fires.
+    packetReadTimer_.enableDirectDispatch();
+
+    downsamplerInBuf_ = (short*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, (MAX_VITA_SAMPLES * FDMDV_OS_24 + FDMDV_OS_TAPS_24K), sizeof(short));
     assert(downsamplerInBuf_ != nullptr);
-    downsamplerOutBuf_ = (short*)heap_caps_calloc(MAX_VITA_SAMPLES, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    downsamplerOutBuf_ = (short*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, MAX_VITA_SAMPLES, sizeof(float));
     assert(downsamplerOutBuf_ != nullptr);
-    upsamplerInBuf_ = (short*)heap_caps_calloc((MAX_VITA_SAMPLES + FDMDV_OS_TAPS_24_8K), sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    upsamplerInBuf_ = (short*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, (MAX_VITA_SAMPLES + FDMDV_OS_TAPS_24_8K), sizeof(float));
     assert(upsamplerInBuf_ != nullptr);
-    upsamplerOutBuf_ = (float*)heap_caps_calloc((MAX_VITA_SAMPLES * FDMDV_OS_24), sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    upsamplerOutBuf_ = (float*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, (MAX_VITA_SAMPLES * FDMDV_OS_24), sizeof(float));
     assert(upsamplerOutBuf_ != nullptr);
 
-    packetArray_ = (vita_packet*)heap_caps_calloc(MAX_VITA_PACKETS, sizeof(vita_packet), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    assert(packetArray_ != nullptr);
-    packetIndex_ = 0;
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    // The second slice needs its own filter history in each direction.
+    secondaryDownsamplerInBuf_ = (short*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, (MAX_VITA_SAMPLES * FDMDV_OS_24 + FDMDV_OS_TAPS_24K), sizeof(short));
+    assert(secondaryDownsamplerInBuf_ != nullptr);
+    secondaryUpsamplerInBuf_ = (short*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, (MAX_VITA_SAMPLES + FDMDV_OS_TAPS_24_8K), sizeof(float));
+    assert(secondaryUpsamplerInBuf_ != nullptr);
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    upsampler_ = fdmdv_8_to_24_create(MAX_VITA_SAMPLES);
+    downsampler_ = fdmdv_24_to_8_create();
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // FreeDVTask's audio stays in float between the radio and the modem.
+    enableFloatAudioInput(audio::AudioInput::RADIO_CHANNEL);
+    enableFloatAudioOutput(audio::AudioInput::RADIO_CHANNEL);
+
+    floatDownsamplerInBuf_ = (float*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, MAX_VITA_SAMPLES * FDMDV_OS_24, sizeof(float));
+    assert(floatDownsamplerInBuf_ != nullptr);
+    floatDownsamplerOutBuf_ = (float*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, MAX_VITA_SAMPLES, sizeof(float));
+    assert(floatDownsamplerOutBuf_ != nullptr);
+    floatUpsamplerInBuf_ = (float*)util::MemoryPlacement::Calloc(util::MemoryPlacement::DSP_BUFFERS, MAX_VITA_SAMPLES, sizeof(float));
+    assert(floatUpsamplerInBuf_ != nullptr);
+    floatUpsampler_ = fdmdv_8_to_24_float_create(MAX_VITA_SAMPLES);
+    floatDownsampler_ = fdmdv_24_to_8_float_create();
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+#if CONFIG_EZDV_TX_FRAME_ALIGN && CONFIG_EZDV_TX_PREROLL
+    // Lets the TX stream start as soon as pre-roll is satisfied (see onTaskTick_()).
+    setAudioInputNotification(audio::AudioInput::RADIO_CHANNEL, this, MAX_VITA_SAMPLES);
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN && CONFIG_EZDV_TX_PREROLL
+
+    // Received packets are processed as soon as they're read and sendto()
+    // copies the packet before returning, so one packet each is enough.
+    rxPacket_ = (vita_packet*)util::MemoryPlacement::Calloc(util::MemoryPlacement::VITA_PACKETS, 1, sizeof(vita_packet));
+    assert(rxPacket_ != nullptr);
+
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    rxPbufQueue_ = xQueueCreate(VITA_RX_PBUF_QUEUE_SIZE, sizeof(struct pbuf*));
+    assert(rxPbufQueue_ != nullptr);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
 }
 
 FlexVitaTask::~FlexVitaTask()
 {
     disconnect_();
     
-    heap_caps_free(downsamplerInBuf_);
-    heap_caps_free(upsamplerInBuf_);
-    heap_caps_free(downsamplerOutBuf_);
-    heap_caps_free(upsamplerOutBuf_);
-    heap_caps_free(packetArray_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, downsamplerInBuf_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, upsamplerInBuf_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, downsamplerOutBuf_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, upsamplerOutBuf_);
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, secondaryDownsamplerInBuf_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, secondaryUpsamplerInBuf_);
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    fdmdv_8_to_24_destroy(upsampler_);
+    fdmdv_24_to_8_destroy(downsampler_);
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, floatDownsamplerInBuf_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, floatDownsamplerOutBuf_);
+    util::MemoryPlacement::Free(util::MemoryPlacement::DSP_BUFFERS, floatUpsamplerInBuf_);
+    fdmdv_8_to_24_float_destroy(floatUpsampler_);
+    fdmdv_24_to_8_float_destroy(floatDownsampler_);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    util::MemoryPlacement::Free(util::MemoryPlacement::VITA_PACKETS, rxPacket_);
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    vQueueDelete(rxPbufQueue_);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
 }
 
 void FlexVitaTask::onTaskStart_()
 {
+    // TX level follows the same volume setting as the other transports.
+    storage::Settings::Volume volume;
+    if (storage::SettingsSnapshot::Read(&storage::Settings::volume, volume) > 0)
+    {
+        radioGain_.setVolume(volume.rightChannelVolume);
+    }
+
     openSocket_();
 }
 
@@ -117,191 +235,163 @@ void FlexVitaTask::onTaskSleep_()
 
 void FlexVitaTask::onTaskTick_()
 {
-    // empty
+#if CONFIG_EZDV_TX_FRAME_ALIGN && CONFIG_EZDV_TX_PREROLL
+    // FreeDV just wrote TX audio. Once the stream is running, the pacer's
+    // timeline decides when packets go out, but until then checking here
+    // starts it the moment pre-roll is done instead of on the next write 
+    // timer tick, and puts the timer in phase with it.
+    if (isTransmitting_ && txPreroll_.isPriming())
+    {
+        packetWriteTimer_.restart();
+        sendAudioOut_(&packetWriteTimer_);
+    }
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN && CONFIG_EZDV_TX_PREROLL
 }
 
-void FlexVitaTask::generateVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId)
+void FlexVitaTask::buildVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId)
 {
     auto fifo = getAudioInput(channel);
-
-    auto currentTimeInMicroseconds = esp_timer_get_time();
-    auto timeSinceLastPacketSend = currentTimeInMicroseconds - lastVitaGenerationTime_;
-    lastVitaGenerationTime_ = currentTimeInMicroseconds;
-
-    // If we're starved of audio, don't even bother going through the rest of the logic right now
-    // and reset state back to the point right when we started.
-    /*if (codec2_fifo_used(fifo) < MAX_VITA_SAMPLES_TO_RESAMPLE * minPacketsRequired_)
-    {
-        if (isTransmitting_) ESP_LOGW(CURRENT_LOG_TAG, "Not enough audio samples to process/send packets (minimum packets needed: %d)!", minPacketsRequired_);
-        minPacketsRequired_ = 0;
-        timeBeyondExpectedUs_ = 0;
-        return;
-    }*/
-
-    if (isTransmitting_ && (
-        timeSinceLastPacketSend >= (VITA_IO_TIME_INTERVAL_US + MAX_JITTER_US) ||
-        timeSinceLastPacketSend <= (VITA_IO_TIME_INTERVAL_US - MAX_JITTER_US)))
-    {
-        ESP_LOGW(
-            CURRENT_LOG_TAG, 
-            "Packet TX jitter is a bit high (time = %" PRIu64 ", expected: %d-%d)", 
-            timeSinceLastPacketSend,
-            VITA_IO_TIME_INTERVAL_US - MAX_JITTER_US,
-            VITA_IO_TIME_INTERVAL_US + MAX_JITTER_US);
-    }
-
-    // Determine the number of extra packets we need to send this go-around.
-    // This is since it can take a bit longer than the timer interval to 
-    // actually enter this method (depending on what else is going on in the
-    // system at the time).
-    int addedExtra = 0;
-    auto packetsToSend = MIN_VITA_PACKETS_TO_SEND * timeSinceLastPacketSend / VITA_IO_TIME_INTERVAL_US;
-    if (packetsToSend == 0 && minPacketsRequired_ == 0)
-    {
-        // We're executing too quickly (or there are a bunch of events piled up that
-        // need to be worked through). We'll wait until the next time we're actually
-        // supposed to execute.
-        ESP_LOGW(CURRENT_LOG_TAG, "Executing send handler too quickly!");
-        return;
-    }
-    else
-    {
-        //ESP_LOGI(CURRENT_LOG_TAG, "In the previous interval, %" PRIu64 " packets should have gone out (time since last send = %" PRIu64 ")", packetsToSend, timeSinceLastPacketSend);
-        minPacketsRequired_ += packetsToSend;
-        timeBeyondExpectedUs_ += timeSinceLastPacketSend % VITA_IO_TIME_INTERVAL_US;
-    }
-
-    while (timeBeyondExpectedUs_ >= (US_OF_AUDIO_PER_VITA_PACKET >> 1))
-    {
-        addedExtra = 1;
-        minPacketsRequired_++;
-        timeBeyondExpectedUs_ -= US_OF_AUDIO_PER_VITA_PACKET;
-    }
-
-    if (minPacketsRequired_ <= 0)
-    {
-        minPacketsRequired_ = 0;
-        timeBeyondExpectedUs_ = 0;
-    }
-
-    //ESP_LOGI(CURRENT_LOG_TAG, "Packets to be sent this time: %d", minPacketsRequired_);
-    int ctr = MAX_VITA_PACKETS_TO_SEND;
-    while(minPacketsRequired_ > 0 && ctr > 0 && codec2_fifo_read(fifo, &upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES) == 0)
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    auto driftCompensator = channel == audio::AudioInput::USER_CHANNEL ? &userDriftCompensator_ : &radioDriftCompensator_;
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    const audio::AudioGain& gain = channel == audio::AudioInput::USER_CHANNEL ? userGain_ : radioGain_;
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // FreeDVTask's TX audio arrives as float (see AudioGraph).
+    auto floatFifo = channel == audio::AudioInput::RADIO_CHANNEL && isFloatAudioInputActive(channel) ? getFloatAudioInput(channel) : nullptr;
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    VitaTxPacer::Period* period = nullptr;
+    while ((period = txPacer_.getFreePeriod()) != nullptr)
     {
-        minPacketsRequired_--;
-        ctr--;
-
-        if (!audioEnabled_ || !canPostMessage())
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+        if (floatFifo != nullptr)
         {
-            // Skip sending audio to SmartSDR if the user isn't using us yet
-            // (or if something really goes wrong and our queue fills up).
-            continue;
+            if (floatFifo->read(floatUpsamplerInBuf_, MAX_VITA_SAMPLES) != 0)
+            {
+                break;
+            }
         }
-        
-        // Upsample to 24K floats.
-        fdmdv_8_to_24_with_scaling(upsamplerOutBuf_, &upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES, tx_scale_factor);
-
-        uint32_t* dataPtr = (uint32_t*)&upsamplerOutBuf_[0];
-        uint32_t masks[] = 
-        {
-            0x000000ff,
-            0x00ff0000,
-            0x0000ff00,
-            0xff000000
-        };
-
-        // Get free packet
-        vita_packet* packet = &packetArray_[packetIndex_++];
-        assert(packet != nullptr);
-        if (packetIndex_ == MAX_VITA_PACKETS)
+        else
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        if (driftCompensator->process(fifo, &upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES) != MAX_VITA_SAMPLES)
+#else
+        if (fifo->read(&upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES) != 0)
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
         {
-            packetIndex_ = 0;
+            // Not enough audio for another period yet.
+            break;
         }
-        uint32_t* ptrOut = (uint32_t*)packet->if_samples;
 
-        int optimizedNumToSend = MAX_VITA_SAMPLES_TO_RESAMPLE & 0xFFFFFFFC; // We only operate in blocks of 4 samples.
-        for (int i = 0; i < optimizedNumToSend >> 2; i++)
+        // Every packet in the period shares the same timestamp.
+        auto timestamp = txClock_.getTimestamp();
+
+        // Skip sending audio to SmartSDR if the user isn't using us yet.
+        // The (empty) period still needs to go by, though.
+        if (audioEnabled_)
         {
-            uint32_t* ptrMasks = masks;
-
-            // Assumption: ptrIn is 16 byte aligned.
-            asm volatile(
-                "ld.qr q0, %1, 0\n"              // Load audio sample into q0
-
-                "movi a10, 24\n"
-                "wsr a10, sar\n"                 // Load 24 into sar register
-                "mv.qr q5, q0\n"                 // Copy q0 into q5
-                "mv.qr q6, q0\n"                 // Copy q0 into q6
-                "ee.vldbc.32.ip q1, %2, 4\n"     // Load 0x000000ff 4 times into q1
-                "ee.vsr.32 q5, q5\n"             // Shift all four values in q5 right 24 bits
-                "ee.andq q1, q1, q5\n"           // q1 = q5 & 0x000000ff
-                "ee.vldbc.32.ip q4, %2, 4\n"     // Load 0xff000000 4 times into q4
-                "ee.vsl.32 q6, q6\n"             // Shift all four values in q6 left 24 bits
-                "ee.andq q4, q4, q6\n"           // q4 = q4 & 0xff000000
-
-                "movi a10, 8\n"
-                "wsr a10, sar\n"                 // Load 8 into sar register
-                "mv.qr q5, q0\n"                 // Copy q0 into q5
-                "mv.qr q6, q0\n"                 // Copy q0 into q6
-                "ee.vsr.32 q5, q5\n"             // Shift all four values in q5 right 8 bits
-                "ee.vldbc.32.ip q3, %2, 4\n"     // Load 0x0000ff00 4 times into q3
-                "ee.andq q3, q3, q5\n"           // q3 = q5 & 0x0000ff00
-                "ee.vldbc.32.ip q2, %2, 4\n"     // Load 0x00ff0000 4 times into q2
-                "ee.vsl.32 q6, q6\n"             // Shift all four values in q6 left 8 bits
-                "ee.andq q2, q2, q6\n"           // q2 = q6 & 0x00ff0000
-
-                "ee.orq q0, q1, q2\n"            // q0 = q1 | q2
-                "ee.orq q0, q0, q3\n"            // q0 = q0 | q3
-                "ee.orq q0, q0, q4\n"            // q0 = q0 | q4
-
-                "mv.qr q1, q0\n"                 // Copy q0 into q1
-                "ee.vzip.32 q0, q1\n"            // Interleave each word of q0 and q1 together
-
-                "st.qr q0, %0, 0\n"              // Save first word to ptrOut
-                "st.qr q1, %0, 16\n"             // Save second word to ptrOut
-                "addi %0, %0, 32\n"              // Add 32 to ptrOut address (8 samples)
-                "addi %1, %1, 16\n"              // Add 16 to dataPtr address (4 samples)
-                : "=r"(ptrOut), "=r"(dataPtr), "=r"(ptrMasks)
-                : "0"(ptrOut), "1"(dataPtr), "2"(ptrMasks)
-                : "a10", "memory"
-            );
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+            if (floatFifo != nullptr)
+            {
+                buildAudioPacket_(floatUpsamplerInBuf_, gain, streamId, audioSeqNum_, period, timestamp);
+            }
+            else
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+            {
+                buildAudioPacket_(&upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], true, gain, streamId, audioSeqNum_, period, timestamp);
+            }
         }
 
-        // Get the remaining ones that we couldn't get to with the optimized logic above.
-        while (dataPtr < (uint32_t*)&upsamplerOutBuf_[MAX_VITA_SAMPLES_TO_RESAMPLE])
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+        if (channel == audio::AudioInput::USER_CHANNEL && secondaryStreamId_ != 0)
         {
-            uint32_t tmp = htonl(*dataPtr);
-            *ptrOut++ = tmp;
-            *ptrOut++ = tmp;
-            dataPtr++;
+            // The second slice's decoded audio goes out alongside the main slice's.
+            auto secondaryFifo = getAudioInput(SECONDARY_SLICE_CHANNEL);
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+            if (secondaryDriftCompensator_.process(secondaryFifo, &secondaryUpsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES) == MAX_VITA_SAMPLES && audioEnabled_)
+#else
+            if (secondaryFifo->read(&secondaryUpsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES) == 0 && audioEnabled_)
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+            {
+                buildAudioPacket_(&secondaryUpsamplerInBuf_[FDMDV_OS_TAPS_24_8K], false, userGain_, secondaryStreamId_, secondarySeqNum_, period, timestamp);
+            }
         }
-                
-        // Fil in packet with data
-        packet->packet_type = VITA_PACKET_TYPE_IF_DATA_WITH_STREAM_ID;
-        packet->stream_id = streamId;
-        packet->class_id = AUDIO_CLASS_ID;
-        packet->timestamp_type = audioSeqNum_++;
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
 
-        size_t packet_len = VITA_PACKET_HEADER_SIZE + VITA_SAMPLES_TO_SEND * 2 * sizeof(float);
+        txPacer_.queuePeriod();
+        txClock_.advance(VITA_SAMPLES_TO_SEND);
+    }
+}
 
-        //  XXX Lots of magic numbers here!
-        packet->timestamp_type = 0x50u | (packet->timestamp_type & 0x0Fu);
-        assert((packet_len & 0x3) == 0); // equivalent to packet_len / 4
-        packet->length = htons(packet_len >> 2); // Length is in 32-bit words, note there are two channels
+void FlexVitaTask::buildAudioPacket_(short* samples, bool useMainUpsampler, const audio::AudioGain& gain, uint32_t streamId, uint32_t& seqNum, VitaTxPacer::Period* period, const audio::AudioClock::Timestamp& timestamp)
+{
+    // Upsample to 24K floats. The gain costs nothing extra here.
+    auto upsampleStartTime = esp_timer_get_time();
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    // The esp-dsp filters keep their own history, which belongs to the main streams.
+    if (useMainUpsampler)
+    {
+        fdmdv_8_to_24_fir(upsampler_, upsamplerOutBuf_, samples, MAX_VITA_SAMPLES, gain.getLinearGain());
+    }
+    else
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    {
+        fdmdv_8_to_24_with_scaling(upsamplerOutBuf_, samples, MAX_VITA_SAMPLES, gain.getLinearGain());
+    }
+    upsampleTimeUs_ += esp_timer_get_time() - upsampleStartTime;
+    numUpsampleBlocks_++;
 
-        packet->timestamp_int = htonl(time(NULL));
-        packet->timestamp_frac = __builtin_bswap64(audioSeqNum_ - 1);
-        currentTime_ = packet->timestamp_int;
+    packAudioPacket_(streamId, seqNum, period, timestamp);
+}
 
-        SendVitaMessage message(packet, packet_len);
-        post(&message);
-    }
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+void FlexVitaTask::buildAudioPacket_(const float* samples, const audio::AudioGain& gain, uint32_t streamId, uint32_t& seqNum, VitaTxPacer::Period* period, const audio::AudioClock::Timestamp& timestamp)
+{
+    auto upsampleStartTime = esp_timer_get_time();
+    fdmdv_8_to_24_float(floatUpsampler_, upsamplerOutBuf_, samples, MAX_VITA_SAMPLES, gain.getLinearGain());
+    upsampleTimeUs_ += esp_timer_get_time() - upsampleStartTime;
+    numUpsampleBlocks_++;
+
+    packAudioPacket_(streamId, seqNum, period, timestamp);
+}
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+void FlexVitaTask::packAudioPacket_(uint32_t streamId, uint32_t& seqNum, VitaTxPacer::Period* period, const audio::AudioClock::Timestamp& timestamp)
+{
+    assert(period->numPackets < VitaTxPacer::MAX_PACKETS_PER_PERIOD);
+    vita_packet* packet = period->packets[period->numPackets];
+    fdmdv_float_to_vita((uint32_t*)packet->if_samples, upsamplerOutBuf_, MAX_VITA_SAMPLES_TO_RESAMPLE);
+            
+    // Fil in packet with data
+    packet->packet_type = VITA_PACKET_TYPE_IF_DATA_WITH_STREAM_ID;
+    packet->stream_id = streamId;
+    packet->class_id = AUDIO_CLASS_ID;
+    packet->timestamp_type = seqNum++;
+
+    size_t packet_len = VITA_PACKET_HEADER_SIZE + VITA_SAMPLES_TO_SEND * 2 * sizeof(float);
+
+    //  XXX Lots of magic numbers here!
+    packet->timestamp_type = 0x50u | (packet->timestamp_type & 0x0Fu);
+    assert((packet_len & 0x3) == 0); // equivalent to packet_len / 4
+    packet->length = htons(packet_len >> 2); // Length is in 32-bit words, note there are two channels
+
+    // UTC seconds plus the sample count into the second (TSI = 1, TSF = 1 above).
+    packet->timestamp_int = htonl(timestamp.seconds);
+    packet->timestamp_frac = __builtin_bswap64((uint64_t)timestamp.fraction);
 
-    minPacketsRequired_ -= addedExtra;
+    period->lengths[period->numPackets++] = packet_len;
 }
 
 void FlexVitaTask::openSocket_()
 {
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    bool opened = pbufSocket_.open(VITA_PORT, NetworkQos::GetProfile(NetworkQos::FLEX_VITA).tos, &OnPbufReceived_, this);
+    assert(opened);
+
+    // Keeps the checks against socket_ below working.
+    socket_ = 1;
+#else
     // Bind socket so we can at least get discovery packets.
     socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (socket_ == -1)
@@ -329,21 +419,16 @@ void FlexVitaTask::openSocket_()
 
     fcntl (socket_, F_SETFL , O_NONBLOCK);
 
-    // The below tells ESP-IDF to transmit on this socket using Wi-Fi voice priority.
-    // This also implicitly disables TX AMPDU for this socket. In testing, not having
-    // this worked a lot better than having it, so it's disabled for now. Perhaps in
-    // the future we can play with this again (perhaps with a lower priority level that
-    // will in fact use AMPDU?)
-#if 0
-    const int precedenceVI = 6;
-    const int precedenceOffset = 7;
-    int priority = (precedenceVI << precedenceOffset);
-    setsockopt(socket_, IPPROTO_IP, IP_TOS, &priority, sizeof(priority));
-#endif // 0
-
-    minPacketsRequired_ = MIN_VITA_PACKETS_TO_SEND;
-    timeBeyondExpectedUs_ = 0;
-    lastVitaGenerationTime_ = esp_timer_get_time();
+    // Voice priority implicitly disables TX AMPDU, which in testing made 
+    // things worse, so the access category is configurable (see NetworkQos).
+    NetworkQos::ApplyProfile(socket_, NetworkQos::FLEX_VITA);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+
+    txPacer_.reset(esp_timer_get_time());
+    txClock_.reset();
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    txDeadline_.reset();
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
 
     packetReadTimer_.start();
     packetWriteTimer_.start();
@@ -357,53 +442,166 @@ void FlexVitaTask::disconnect_()
     {
         packetReadTimer_.stop();
         packetWriteTimer_.stop();
+
+        auto timerStats = packetWriteTimer_.getStatistics();
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Packet write timer: %" PRIu32 " fires, max jitter %" PRIu32 " us (limit %d us), max dispatch latency %" PRIu32 " us",
+            timerStats.numFires,
+            timerStats.maxJitterUs,
+            MAX_JITTER_US,
+            timerStats.maxDispatchLatencyUs);
+        packetWriteTimer_.resetStatistics();
+
+        VitaTxPacer::Statistics pacerStats;
+        txPacer_.getStatistics(pacerStats, true);
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "TX pacing: %" PRIu32 " periods, %" PRIu32 " underruns, %" PRIu32 " resyncs, max %" PRIu32 " us late",
+            pacerStats.numPeriods,
+            pacerStats.numUnderruns,
+            pacerStats.numResyncs,
+            pacerStats.maxLateUs);
+
+        // For comparing resampler implementations (see CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER).
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Resampler (%s): 8->24 kHz %" PRId64 " us/block over %" PRIu32 " blocks, 24->8 kHz %" PRId64 " us/block over %" PRIu32 " blocks",
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+            "esp-dsp",
+#else
+            "built-in",
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+            numUpsampleBlocks_ ? upsampleTimeUs_ / numUpsampleBlocks_ : 0,
+            numUpsampleBlocks_,
+            numDownsampleBlocks_ ? downsampleTimeUs_ / numDownsampleBlocks_ : 0,
+            numDownsampleBlocks_);
+        upsampleTimeUs_ = 0;
+        numUpsampleBlocks_ = 0;
+        downsampleTimeUs_ = 0;
+        numDownsampleBlocks_ = 0;
+
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Clock drift correction: %" PRId32 " ppm (to SmartSDR), %" PRId32 " ppm (to radio)",
+            userDriftCompensator_.getCorrectionPpm(),
+            radioDriftCompensator_.getCorrectionPpm());
+        userDriftCompensator_.reset();
+        radioDriftCompensator_.reset();
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+        VitaJitterBuffer::Statistics jitterStats;
+        jitterBuffer_.getStatistics(jitterStats, true);
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "RX jitter buffer: %" PRIu32 " packets (%" PRIu32 " lost, %" PRIu32 " late), %" PRIu32 " underruns, %" PRIu32 " samples concealed, %" PRIu32 " dropped",
+            jitterStats.numPackets,
+            jitterStats.numLostPackets,
+            jitterStats.numLatePackets,
+            jitterStats.numUnderruns,
+            jitterStats.numConcealedSamples,
+            jitterStats.numDroppedSamples);
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "RX jitter buffer: jitter %" PRIu32 " us, target %" PRIu32 " ms, depth %" PRIu32 "/%" PRIu32 "/%" PRIu32 " ms (min/avg/max)",
+            jitterStats.jitterUs,
+            jitterStats.targetDepthMs,
+            jitterStats.minDepthMs,
+            jitterStats.avgDepthMs,
+            jitterStats.maxDepthMs);
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        ESP_LOGI(CURRENT_LOG_TAG, "RX jitter buffer: clock drift correction %" PRId32 " ppm", jitterBuffer_.getDriftCorrectionPpm());
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        jitterBuffer_.reset();
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+        pbufSocket_.close();
+
+        struct pbuf* p;
+        while (xQueueReceive(rxPbufQueue_, &p, 0) == pdTRUE)
+        {
+            pbuf_free(p);
+        }
+#else
         close(socket_);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
         socket_ = -1;
         
         rxStreamId_ = 0;
+        powerLock_.release();
         txStreamId_ = 0;
         audioSeqNum_ = 0;
-        currentTime_ = 0;
-        timeFracSeq_ = 0;
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+        secondaryStreamId_ = 0;
+        secondarySeqNum_ = 0;
+        secondaryInputCtr_ = 0;
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
         inputCtr_ = 0;
-        packetIndex_ = 0;
     }
 }
 
 void FlexVitaTask::readPendingPackets_(DVTimer*)
 { 
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    readPendingPbufs_();
+#else
     // Process if there are pending datagrams in the buffer
     int ctr = MAX_VITA_PACKETS_TO_SEND;
     while (ctr-- > 0)
     {
-        vita_packet* packet = &packetArray_[packetIndex_++];
-        assert(packet != nullptr);
-
-        if (packetIndex_ == MAX_VITA_PACKETS)
-        {
-            packetIndex_ = 0;
-        }
-        
-        auto rv = recv(socket_, (char*)packet, sizeof(vita_packet), 0);
+        auto rv = recv(socket_, (char*)rxPacket_, sizeof(vita_packet), 0);
         if (rv > 0)
         {
-            // Queue up packet for future processing.
-            ReceiveVitaMessage message(packet, rv);
-            post(&message);
+            processVitaPacket_(rxPacket_, rv);
         }
         else
         {
             break;
         }
     }
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    // Free up the stream slots of slices that have stopped sending audio
+    // (e.g. switched out of FDVU/FDVL) so that other slices can use them.
+    // The radio may not send RX audio while transmitting.
+    auto now = esp_timer_get_time();
+    if (secondaryStreamId_ != 0 && now - lastSecondaryPacketTimeUs_ >= VITA_STREAM_TIMEOUT_US)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Second slice stopped sending audio");
+        secondaryStreamId_ = 0;
+    }
+    if (rxStreamId_ != 0 && !isTransmitting_ && now - lastRxPacketTimeUs_ >= VITA_STREAM_TIMEOUT_US)
+    {
+        // The second slice (if any) takes over as the main one, in line 
+        // with FlexTcpTask making it the active slice.
+        ESP_LOGI(CURRENT_LOG_TAG, "Main slice stopped sending audio");
+        rxStreamId_ = secondaryStreamId_;
+        lastRxPacketTimeUs_ = lastSecondaryPacketTimeUs_;
+        secondaryStreamId_ = 0;
+        inputCtr_ = 0;
+    }
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+    // Note: may be null during voice keyer operation
+    OutputClaim output(this, audio::AudioInput::RADIO_CHANNEL);
+    jitterBuffer_.playout(output.fifo(), esp_timer_get_time());
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
 }
 
 void FlexVitaTask::sendAudioOut_(DVTimer*)
 {
-    // Generate packets for both RX and TX.
+    // Only one of the RX and TX streams is active at a time.
+    audio::AudioInput::ChannelLabel channel = audio::AudioInput::USER_CHANNEL;
+    uint32_t streamId = 0;
+    
     if (rxStreamId_ && !isTransmitting_)
     {
-        generateVitaPackets_(audio::AudioInput::USER_CHANNEL, rxStreamId_);
+        streamId = rxStreamId_;
     }
     else if (rxStreamId_)
     {
@@ -412,15 +610,29 @@ void FlexVitaTask::sendAudioOut_(DVTimer*)
         // (i.e. UI beeps being transmitted along with the FreeDV signal).
         auto fifo = getAudioInput(audio::AudioInput::USER_CHANNEL);
         short tmpBuf[MAX_VITA_SAMPLES];
-        while(codec2_fifo_read(fifo, tmpBuf, MAX_VITA_SAMPLES) == 0)
+        while(fifo->read(tmpBuf, MAX_VITA_SAMPLES) == 0)
+        {
+            // empty
+        }
+    }
+    
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    if (!secondaryStreamId_ || isTransmitting_)
+    {
+        // Same as above for the second slice (which is sent alongside the main one).
+        auto fifo = getAudioInput(SECONDARY_SLICE_CHANNEL);
+        short tmpBuf[MAX_VITA_SAMPLES];
+        while(fifo->read(tmpBuf, MAX_VITA_SAMPLES) == 0)
         {
             // empty
         }
     }
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
     
     if (txStreamId_ && isTransmitting_)
     {
-        generateVitaPackets_(audio::AudioInput::RADIO_CHANNEL, txStreamId_);
+        channel = audio::AudioInput::RADIO_CHANNEL;
+        streamId = txStreamId_;
     }
     else if (txStreamId_)
     {
@@ -429,12 +641,102 @@ void FlexVitaTask::sendAudioOut_(DVTimer*)
         // (i.e. UI beeps being transmitted along with the FreeDV signal).
         auto fifo = getAudioInput(audio::AudioInput::RADIO_CHANNEL);
         short tmpBuf[MAX_VITA_SAMPLES];
-        while(codec2_fifo_read(fifo, tmpBuf, MAX_VITA_SAMPLES) == 0)
+        while(fifo->read(tmpBuf, MAX_VITA_SAMPLES) == 0)
         {
             // empty
         }
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+        auto floatFifo = getFloatAudioInput(audio::AudioInput::RADIO_CHANNEL);
+        floatFifo->release(floatFifo->numUsed());
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    }
+
+    if (streamId == 0)
+    {
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+        txDeadline_.reset();
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+        return;
     }
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    if (txDeadline_.mark(esp_timer_get_time()))
+    {
+        recoverTx_(channel);
+    }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+#if CONFIG_EZDV_TX_PREROLL
+    if (channel == audio::AudioInput::RADIO_CHANNEL && txPreroll_.isPriming())
+    {
+        uint32_t numQueued = getAudioInput(channel)->numUsed();
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+        if (isFloatAudioInputActive(channel))
+        {
+            numQueued = getFloatAudioInput(channel)->numUsed();
+        }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+        auto now = esp_timer_get_time();
+        if (!txPreroll_.update(numQueued, now))
+        {
+            // The radio gets nothing (rather than a trickle) until we're primed.
+            return;
+        }
+
+        // The stream starts now, so pacing does too.
+        txPacer_.reset(now);
+        txClock_.reset();
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        radioDriftCompensator_.reset();
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    }
+#endif // CONFIG_EZDV_TX_PREROLL
+
+    // Send whatever's due, along with the rest of the batch. Building more as 
+    // each period goes out lets us catch up if this timer was held up for a bit.
+    auto releaseHorizonUs = esp_timer_get_time() + US_OF_AUDIO_PER_VITA_PACKET * (CONFIG_EZDV_QOS_FLEX_VITA_BATCH - 1);
+    int64_t retryBudgetUs = US_OF_AUDIO_PER_VITA_PACKET;
+    int numPeriodsSent = 0;
+    VitaTxPacer::Period* period = nullptr;
+
+    buildVitaPackets_(channel, streamId);
+    while (numPeriodsSent < MAX_VITA_PACKETS_TO_SEND && (period = txPacer_.getDuePeriod(releaseHorizonUs)) != nullptr)
+    {
+        for (int index = 0; index < period->numPackets; index++)
+        {
+            sendVitaPacket_(period->packets[index], period->lengths[index], retryBudgetUs);
+        }
+        txPacer_.releasePeriod();
+        numPeriodsSent++;
+
+        buildVitaPackets_(channel, streamId);
+    }
+}
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+void FlexVitaTask::recoverTx_(audio::AudioInput::ChannelLabel channel)
+{
+    // Whatever's queued is already late, so drop it and build a fresh 
+    // timeline from the audio that arrives next.
+    getAudioInput(channel)->requestFlush();
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    if (channel == audio::AudioInput::RADIO_CHANNEL)
+    {
+        auto floatFifo = getFloatAudioInput(channel);
+        floatFifo->release(floatFifo->numUsed());
+    }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    txPacer_.reset(esp_timer_get_time());
+    txClock_.reset();
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    userDriftCompensator_.reset();
+    radioDriftCompensator_.reset();
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
 }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
 
 void FlexVitaTask::onFlexConnectRadioMessage_(DVTask* origin, FlexConnectRadioMessage* message)
 {
@@ -447,12 +749,52 @@ void FlexVitaTask::onFlexConnectRadioMessage_(DVTask* origin, FlexConnectRadioMe
     ESP_LOGI(CURRENT_LOG_TAG, "Connected to radio successfully");
 }
 
-void FlexVitaTask::onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* message)
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+void FlexVitaTask::readPendingPbufs_()
 {
-    vita_packet* packet = message->packet;
-    
+    int ctr = MAX_VITA_PACKETS_TO_SEND;
+    struct pbuf* p;
+    while (ctr-- > 0 && xQueueReceive(rxPbufQueue_, &p, 0) == pdTRUE)
+    {
+        // Parse the packet where the driver left it if we can. The VITA
+        // fields need 32-bit alignment and the header's length must fit in
+        // the pbuf (rxPacket_ is always big enough, so recv() never had to
+        // check). Anything else gets copied out, same as recv() would do.
+        vita_packet* packet = (vita_packet*)p->payload;
+        int length = p->tot_len;
+        if (p->next != nullptr || 
+            ((uintptr_t)p->payload & 3) != 0 ||
+            p->len < VITA_PACKET_HEADER_SIZE ||
+            ntohs(packet->length) * sizeof(uint32_t) > p->len)
+        {
+            length = pbuf_copy_partial(p, rxPacket_, sizeof(vita_packet), 0);
+            packet = rxPacket_;
+        }
+
+        processVitaPacket_(packet, length);
+        pbuf_free(p);
+    }
+}
+
+void FlexVitaTask::OnPbufReceived_(void* arg, struct pbuf* p)
+{
+    // On the lwIP thread; just hand the packet over to the read timer.
+    FlexVitaTask* task = (FlexVitaTask*)arg;
+    if (xQueueSend(task->rxPbufQueue_, &p, 0) != pdTRUE)
+    {
+        pbuf_free(p);
+    }
+}
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+
+void FlexVitaTask::processVitaPacket_(vita_packet* packet, int length)
+{
+#if CONFIG_EZDV_PACKET_CAPTURE
+    PacketCapture::Record(NetworkQos::FLEX_VITA, packet, length);
+#endif // CONFIG_EZDV_PACKET_CAPTURE
+
     // Make sure packet is long enough to inspect for VITA header info.
-    if (message->length < VITA_PACKET_HEADER_SIZE)
+    if (length < VITA_PACKET_HEADER_SIZE)
         goto cleanup;
 
     // Make sure packet is from the radio.
@@ -462,15 +804,24 @@ void FlexVitaTask::onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* mes
     // Look for discovery packets
     if (packet->stream_id == DISCOVERY_STREAM_ID && packet->class_id == DISCOVERY_CLASS_ID)
     {
-        std::stringstream ss((char*)packet->raw_payload);
-        auto parameters = FlexKeyValueParser::GetCommandParameters(ss);
-
-        auto radioFriendlyName = parameters["nickname"] + " (" + parameters["callsign"] + ")";
-        auto radioIp = parameters["ip"];
+        // The payload isn't necessarily null terminated.
+        const char* payload = (const char*)packet->raw_payload;
+        FlexKeyValueParser::Parameters parameters;
+        FlexKeyValueParser::GetCommandParameters(
+            std::string_view(payload, strnlen(payload, length - VITA_PACKET_HEADER_SIZE)), parameters);
+
+        auto nickname = parameters[FlexKeyValueParser::KEY_NICKNAME];
+        auto callsign = parameters[FlexKeyValueParser::KEY_CALLSIGN];
+        auto ip = parameters[FlexKeyValueParser::KEY_IP];
+
+        char radioFriendlyName[FlexRadioDiscoveredMessage::STR_SIZE];
+        char radioIp[FlexRadioDiscoveredMessage::STR_SIZE];
+        snprintf(radioFriendlyName, sizeof(radioFriendlyName), "%.*s (%.*s)", (int)nickname.length(), nickname.data(), (int)callsign.length(), callsign.data());
+        snprintf(radioIp, sizeof(radioIp), "%.*s", (int)ip.length(), ip.data());
         
-        ESP_LOGI(CURRENT_LOG_TAG, "Discovery: found radio %s at IP %s", radioFriendlyName.c_str(), radioIp.c_str());
+        ESP_LOGI(CURRENT_LOG_TAG, "Discovery: found radio %s at IP %s", radioFriendlyName, radioIp);
         
-        FlexRadioDiscoveredMessage discoveryMessage((char*)radioFriendlyName.c_str(), (char*)radioIp.c_str());
+        FlexRadioDiscoveredMessage discoveryMessage(radioFriendlyName, radioIp);
         publish(&discoveryMessage);
         
         goto cleanup;
@@ -488,10 +839,43 @@ void FlexVitaTask::onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* mes
             }*/
 
             audio::AudioInput::ChannelLabel channel = audio::AudioInput::RADIO_CHANNEL;
+            short* downsamplerInBuf = downsamplerInBuf_;
+            int* inputCtr = &inputCtr_;
+            bool useMainDownsampler = true;
             if (!(htonl(packet->stream_id) & 0x0001u)) 
             {
                 // Packet contains receive audio from radio.
-                rxStreamId_ = packet->stream_id;
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+                // Each slice using the waveform has its own stream. The first
+                // one heard goes to FreeDVTask and the next to FreeDVMonitorTask.
+                if (rxStreamId_ != 0 && packet->stream_id != rxStreamId_)
+                {
+                    if (secondaryStreamId_ == 0)
+                    {
+                        ESP_LOGI(CURRENT_LOG_TAG, "Decoding second slice (stream %08" PRIx32 ")", htonl(packet->stream_id));
+                        secondaryStreamId_ = packet->stream_id;
+                        secondaryInputCtr_ = 0;
+                    }
+                    else if (packet->stream_id != secondaryStreamId_)
+                    {
+                        // No room for this slice (see FlexTcpTask).
+                        goto cleanup;
+                    }
+
+                    lastSecondaryPacketTimeUs_ = esp_timer_get_time();
+                    channel = SECONDARY_SLICE_CHANNEL;
+                    downsamplerInBuf = secondaryDownsamplerInBuf_;
+                    inputCtr = &secondaryInputCtr_;
+                    useMainDownsampler = false;
+                }
+                else
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+                {
+                    rxStreamId_ = packet->stream_id;
+                    lastRxPacketTimeUs_ = esp_timer_get_time();
+                    powerLock_.acquire();
+                    NetworkQos::RecordReceive(NetworkQos::FLEX_VITA, lastRxPacketTimeUs_, packet->timestamp_type & 0x0F, 4);
+                }
             } 
             else 
             {
@@ -500,26 +884,72 @@ void FlexVitaTask::onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* mes
                 channel = audio::AudioInput::USER_CHANNEL;
             }
             
+            // Don't trust the header's length beyond what was actually received.
+            payload_length = std::min(payload_length, (unsigned long)(length - VITA_PACKET_HEADER_SIZE));
+
             // Downconvert to 8K sample rate.
             unsigned int num_samples = payload_length >> 2; // / sizeof(uint32_t);
             unsigned int half_num_samples = num_samples >> 1;
 
-            int i = 0;
-            auto fifo = getAudioOutput(channel);
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+            bool useJitterBuffer = channel == audio::AudioInput::RADIO_CHANNEL;
+            if (useJitterBuffer && !jitterBuffer_.packetReceived(
+                packet->timestamp_type & 0x0F, half_num_samples * 1000000 / VITA_SAMPLE_RATE, esp_timer_get_time()))
+            {
+                // Late or duplicate; its audio has already been concealed.
+                goto cleanup;
+            }
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+
+            OutputClaim output(this, channel);
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+            auto floatFifo = channel == audio::AudioInput::RADIO_CHANNEL ? output.floatFifo() : nullptr;
+            if (floatFifo != nullptr)
+            {
+                receiveFloatAudio_(floatFifo, packet, half_num_samples);
+                break;
+            }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+            unsigned int i = 0;
+            auto fifo = output.fifo();
             while (fifo != nullptr && i < half_num_samples)
             {
-                uint32_t temp = ntohl(packet->if_samples[i << 1]);
-                downsamplerInBuf_[FDMDV_OS_TAPS_24K + (inputCtr_++)] = *(float*)&temp * FDMDV_FLOAT_TO_SHORT;
-                i++;
+                // Convert as much as fits in the current block in one pass.
+                unsigned int count = std::min(half_num_samples - i, (unsigned int)(MAX_VITA_SAMPLES * FDMDV_OS_24 - *inputCtr));
+                fdmdv_vita_to_short(&downsamplerInBuf[FDMDV_OS_TAPS_24K + *inputCtr], &packet->if_samples[i << 1], count);
+                *inputCtr += count;
+                i += count;
 
-                if (inputCtr_ == MAX_VITA_SAMPLES * FDMDV_OS_24)
+                if (*inputCtr == MAX_VITA_SAMPLES * FDMDV_OS_24)
                 {
-                    inputCtr_ = 0;
-                    fdmdv_24_to_8(downsamplerOutBuf_, &downsamplerInBuf_[FDMDV_OS_TAPS_24K], MAX_VITA_SAMPLES);
+                    *inputCtr = 0;
+                    auto downsampleStartTime = esp_timer_get_time();
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+                    // The esp-dsp filters keep their own history, which belongs to the main streams.
+                    if (useMainDownsampler)
+                    {
+                        fdmdv_24_to_8_fir(downsampler_, downsamplerOutBuf_, &downsamplerInBuf[FDMDV_OS_TAPS_24K], MAX_VITA_SAMPLES);
+                    }
+                    else
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+                    {
+                        fdmdv_24_to_8(downsamplerOutBuf_, &downsamplerInBuf[FDMDV_OS_TAPS_24K], MAX_VITA_SAMPLES);
+                    }
+                    downsampleTimeUs_ += esp_timer_get_time() - downsampleStartTime;
+                    numDownsampleBlocks_++;
             
                     // Queue on respective FIFO.
                     // Note: may be null during voice keyer operation
-                    codec2_fifo_write(fifo, downsamplerOutBuf_, MAX_VITA_SAMPLES);
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+                    if (useJitterBuffer)
+                    {
+                        jitterBuffer_.write(downsamplerOutBuf_, MAX_VITA_SAMPLES);
+                        continue;
+                    }
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+                    fifo->write(downsamplerOutBuf_, MAX_VITA_SAMPLES);
                 }
             }            
             break;
@@ -533,49 +963,84 @@ cleanup:
     // no cleanup needed
 }
 
-void FlexVitaTask::onSendVitaMessage_(DVTask* origin, SendVitaMessage* message)
-{   
-    auto packet = message->packet;
-    assert(packet != nullptr);
-
-    if (socket_ > 0)
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+void FlexVitaTask::receiveFloatAudio_(audio::AudioFloatRingBuffer* fifo, vita_packet* packet, unsigned int numSamples)
+{
+    // Same as the short path, but the filter keeps its own history.
+    unsigned int i = 0;
+    while (i < numSamples)
     {
-        auto startTime = esp_timer_get_time();
-        int tries = 1;
-        int rv = sendto(socket_, (char*)packet, message->length, 0, (struct sockaddr*)&radioAddress_, sizeof(radioAddress_));
-        auto totalTimeUs = esp_timer_get_time() - startTime;
-        while (rv == -1 && totalTimeUs <= US_OF_AUDIO_PER_VITA_PACKET)
-        {
-            auto err = errno;
-            if (err == ENOMEM)
-            {
-                // Wait a bit and try again; the Wi-Fi subsystem isn't ready yet.
-                vTaskDelay(1);
-                tries++;
-                rv = sendto(socket_, (char*)packet, message->length, 0, (struct sockaddr*)&radioAddress_, sizeof(radioAddress_));
-                totalTimeUs = (esp_timer_get_time() - startTime)/1000;
-            }
-            else
-            {
-                // TBD: close/reopen connection
-                ESP_LOGE(
-                    CURRENT_LOG_TAG,
-                    "Got socket error %d (%s) while sending", 
-                    err, strerror(err));
-                break;
-            }
-        }
-        
-        if (totalTimeUs > US_OF_AUDIO_PER_VITA_PACKET)
-        {
-            ESP_LOGE(CURRENT_LOG_TAG, "Wi-Fi subsystem took too long to become ready, dropping packet");
-        }
-        else if (tries > 1)
+        unsigned int count = std::min(numSamples - i, (unsigned int)(MAX_VITA_SAMPLES * FDMDV_OS_24 - inputCtr_));
+        fdmdv_vita_to_float(&floatDownsamplerInBuf_[inputCtr_], &packet->if_samples[i << 1], count);
+        inputCtr_ += count;
+        i += count;
+
+        if (inputCtr_ == MAX_VITA_SAMPLES * FDMDV_OS_24)
         {
-            ESP_LOGW(CURRENT_LOG_TAG, "Needed %d tries to send a packet", tries++);
+            inputCtr_ = 0;
+            auto downsampleStartTime = esp_timer_get_time();
+            fdmdv_24_to_8_float(floatDownsampler_, floatDownsamplerOutBuf_, floatDownsamplerInBuf_, MAX_VITA_SAMPLES);
+            downsampleTimeUs_ += esp_timer_get_time() - downsampleStartTime;
+            numDownsampleBlocks_++;
+
+            fifo->write(floatDownsamplerOutBuf_, MAX_VITA_SAMPLES);
         }
     }
 }
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+void FlexVitaTask::sendVitaPacket_(vita_packet* packet, int length, int64_t& retryBudgetUs)
+{
+    if (socket_ <= 0)
+    {
+        return;
+    }
+
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    auto sendOnce = [&]() { return pbufSocket_.sendTo(packet, length, radioAddress_); };
+#else
+    auto sendOnce = [&]() { return sendto(socket_, (char*)packet, length, 0, (struct sockaddr*)&radioAddress_, sizeof(radioAddress_)); };
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+
+    int rv = sendOnce();
+    if (rv != -1)
+    {
+        NetworkQos::RecordSend(NetworkQos::FLEX_VITA, true);
+        return;
+    }
+
+    auto startTime = esp_timer_get_time();
+    int tries = 1;
+    while (rv == -1 && errno == ENOMEM && (esp_timer_get_time() - startTime) < retryBudgetUs)
+    {
+        // Wait a bit and try again; the Wi-Fi subsystem isn't ready yet.
+        // (A tick is longer than a packet, so vTaskDelay() can't be used.)
+        esp_rom_delay_us(VITA_SEND_RETRY_DELAY_US);
+        tries++;
+        rv = sendOnce();
+    }
+    auto err = errno;
+    retryBudgetUs -= std::min(retryBudgetUs, esp_timer_get_time() - startTime);
+    NetworkQos::RecordSend(NetworkQos::FLEX_VITA, rv != -1);
+    NetworkQos::RecordSendRetries(NetworkQos::FLEX_VITA, tries - 1);
+
+    if (rv != -1)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Needed %d tries to send a packet", tries);
+    }
+    else if (err == ENOMEM)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Wi-Fi subsystem took too long to become ready, dropping packet");
+    }
+    else
+    {
+        // TBD: close/reopen connection
+        ESP_LOGE(
+            CURRENT_LOG_TAG,
+            "Got socket error %d (%s) while sending", 
+            err, strerror(err));
+    }
+}
 
 void FlexVitaTask::onEnableReportingMessage_(DVTask* origin, EnableReportingMessage* message)
 {
@@ -587,28 +1052,58 @@ void FlexVitaTask::onDisableReportingMessage_(DVTask* origin, DisableReportingMe
     audioEnabled_ = false;
 }
 
+void FlexVitaTask::onRightChannelVolumeMessage_(DVTask* origin, storage::RightChannelVolumeMessage* message)
+{
+    radioGain_.setVolume(message->volume);
+}
+
 void FlexVitaTask::onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage* message)
 {
     isTransmitting_ = true;
 
-    // Reset packet timing parameters so we can redetermine how quickly we need to be
-    // sending packets.
-    minPacketsRequired_ = MIN_VITA_PACKETS_TO_SEND;
-    timeBeyondExpectedUs_ = 0;
-    lastVitaGenerationTime_ = esp_timer_get_time();
+    // Start the TX timeline over; anything already built was for the other stream.
+    txPacer_.reset(esp_timer_get_time());
+    txClock_.reset();
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    // The FIFO that was being drained will start out at a different level.
+    userDriftCompensator_.reset();
+    radioDriftCompensator_.reset();
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    secondaryDriftCompensator_.reset();
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
     packetWriteTimer_.stop();
     packetWriteTimer_.start();
+
+#if CONFIG_EZDV_TX_PREROLL
+    // The encoder is starting at the same time; the stream waits until 
+    // it's a little ahead (see TxPreroll).
+    txPreroll_.start(esp_timer_get_time());
+#endif // CONFIG_EZDV_TX_PREROLL
 }
 
 void FlexVitaTask::onRequestRxMessage_(DVTask* origin, audio::TransmitCompleteMessage* message)
 {
     isTransmitting_ = false;
-
-    // Reset packet timing parameters so we can redetermine how quickly we need to be
-    // sending packets.
-    minPacketsRequired_ = MIN_VITA_PACKETS_TO_SEND;
-    timeBeyondExpectedUs_ = 0;
-    lastVitaGenerationTime_ = esp_timer_get_time();
+#if CONFIG_EZDV_TX_PREROLL
+    txPreroll_.cancel();
+#endif // CONFIG_EZDV_TX_PREROLL
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    // Give RX audio a chance to resume before the main slice's stream times out.
+    lastRxPacketTimeUs_ = esp_timer_get_time();
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+
+    // Start the TX timeline over; anything already built was for the other stream.
+    txPacer_.reset(esp_timer_get_time());
+    txClock_.reset();
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    // The FIFO that was being drained will start out at a different level.
+    userDriftCompensator_.reset();
+    radioDriftCompensator_.reset();
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    secondaryDriftCompensator_.reset();
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
     packetWriteTimer_.stop();
     packetWriteTimer_.start();
 }
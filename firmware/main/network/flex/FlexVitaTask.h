@@ -22,16 +22,31 @@
 #include <ctime>
 #include <sys/socket.h>
 
+#include "audio/AudioClock.h"
+#include "audio/AudioDriftCompensator.h"
+#include "audio/AudioGain.h"
 #include "audio/AudioInput.h"
 #include "audio/FreeDVMessage.h"
+#include "audio/TxPreroll.h"
 #include "audio/VoiceKeyerMessage.h"
 #include "network/NetworkMessage.h"
+#include "network/NetworkQos.h"
 #include "network/ReportingMessage.h"
+#include "storage/SettingsMessage.h"
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+#include "network/UdpPbufSocket.h"
+#include "freertos/queue.h"
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
 #include "util/PSRamAllocator.h"
+#include "util/PowerLock.h"
+#include "util/DeadlineMonitor.h"
 
 #include "FlexMessage.h"
+#include "SampleRateConverter.h"
+#include "VitaJitterBuffer.h"
+#include "VitaTxPacer.h"
 #include "vita.h"
 
 namespace ezdv
@@ -49,7 +64,15 @@ using namespace ezdv::task;
 class FlexVitaTask : public DVTask, public audio::AudioInput
 {
 public:
-    enum { VITA_PORT = 4992 }; // Hardcoding VITA port because we can only handle one slice at a time.
+    enum { VITA_PORT = 4992 }; // Audio for every slice using the waveform arrives here, told apart by stream ID.
+
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    enum { MAX_FREEDV_SLICES = 2 }; // Must match FlexTcpTask.
+
+    /// @brief Audio for the second slice: radio audio out to FreeDVMonitorTask
+    ///        and decoded audio back in for SmartSDR.
+    static constexpr audio::AudioInput::ChannelLabel SECONDARY_SLICE_CHANNEL = (audio::AudioInput::ChannelLabel)2;
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
     
     FlexVitaTask();
     virtual ~FlexVitaTask();
@@ -64,42 +87,138 @@ private:
     DVTimer packetReadTimer_;
     DVTimer packetWriteTimer_;
     int socket_;
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    // Used instead of socket_; received pbufs wait in rxPbufQueue_ 
+    // until the read timer fires.
+    UdpPbufSocket pbufSocket_;
+    QueueHandle_t rxPbufQueue_;
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
     std::string ip_;
     uint32_t rxStreamId_;
     uint32_t txStreamId_;
     uint32_t audioSeqNum_;
-    time_t currentTime_;
-    int timeFracSeq_;
     bool audioEnabled_;
+    util::PowerLock powerLock_; // held from the first audio packet until disconnection
     bool isTransmitting_;
     int inputCtr_;
-    int64_t lastVitaGenerationTime_;
-    int minPacketsRequired_;
-    int64_t timeBeyondExpectedUs_;
+    int64_t lastRxPacketTimeUs_;
+
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    // Second slice state. Its audio always uses the built-in resamplers.
+    uint32_t secondaryStreamId_;
+    int64_t lastSecondaryPacketTimeUs_;
+    uint32_t secondarySeqNum_;
+    short* secondaryDownsamplerInBuf_;
+    int secondaryInputCtr_;
+    short* secondaryUpsamplerInBuf_;
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
 
     // Resampler buffers
     short* downsamplerInBuf_;
     short* downsamplerOutBuf_;
     short* upsamplerInBuf_;
     float* upsamplerOutBuf_;
-
-    // vita packet cache -- preallocate on startup
-    // to reduce the amount of latency when sending packets 
-    // to the radio.
-    vita_packet* packetArray_;
-    int packetIndex_;
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+    fdmdv_8_to_24_state_t* upsampler_;
+    fdmdv_24_to_8_state_t* downsampler_;
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    // Float links to and from FreeDVTask. The esp-dsp filters keep their
+    // own history, so these don't need room for it.
+    float* floatDownsamplerInBuf_;
+    float* floatDownsamplerOutBuf_;
+    float* floatUpsamplerInBuf_;
+    fdmdv_8_to_24_float_state_t* floatUpsampler_;
+    fdmdv_24_to_8_float_state_t* floatDownsampler_;
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    // Time spent resampling, for comparing implementations.
+    int64_t upsampleTimeUs_;
+    uint32_t numUpsampleBlocks_;
+    int64_t downsampleTimeUs_;
+    uint32_t numDownsampleBlocks_;
+
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    // Audio going to SmartSDR (USER_CHANNEL) and to the radio for TX (RADIO_CHANNEL) 
+    // is produced on the radio's clock but sent on ours.
+    audio::AudioDriftCompensator userDriftCompensator_;
+    audio::AudioDriftCompensator radioDriftCompensator_;
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    audio::AudioDriftCompensator secondaryDriftCompensator_;
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+#if CONFIG_EZDV_FLEX_JITTER_BUFFER
+    // Holds back RX audio from the radio to ride out bursty arrival.
+    VitaJitterBuffer jitterBuffer_;
+#endif // CONFIG_EZDV_FLEX_JITTER_BUFFER
+
+    // Audio to the radio, built ahead of time and sent on a fixed schedule.
+    VitaTxPacer txPacer_;
+    audio::AudioClock txClock_; // for packet timestamps
+    audio::AudioGain userGain_; // decoded audio to SmartSDR
+    audio::AudioGain radioGain_; // TX audio; follows the right channel volume
+#if CONFIG_EZDV_TX_PREROLL
+    audio::TxPreroll txPreroll_; // TX stream waits for this after PTT
+#endif // CONFIG_EZDV_TX_PREROLL
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    util::DeadlineMonitor txDeadline_; // packetWriteTimer_ cadence
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    // Packet buffers -- preallocated on startup to reduce the amount
+    // of latency when sending or receiving packets.
+    // (TX packets belong to txPacer_.)
+    vita_packet* rxPacket_;
     
     void openSocket_();
     void disconnect_();
     
     void readPendingPackets_(DVTimer*);
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    void readPendingPbufs_();
+    static void OnPbufReceived_(void* arg, struct pbuf* p);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
     void sendAudioOut_(DVTimer*);
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    /// @brief Starts the outgoing stream over after falling too far behind.
+    void recoverTx_(audio::AudioInput::ChannelLabel channel);
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
     
-    void generateVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId);
+    /// @brief Handles a packet from the radio (discovery or audio) as soon as it's read.
+    void processVitaPacket_(vita_packet* packet, int length);
+
+    /// @brief Builds packets from the given channel until txPacer_ has LEAD_PERIODS ready.
+    void buildVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId);
+
+    /// @brief Upsamples a block of audio into a packet for the radio.
+    /// @param samples MAX_VITA_SAMPLES samples, preceded by the upsampler's filter history.
+    /// @param useMainUpsampler Whether the samples belong to the main slice's streams.
+    /// @param gain Gain to fold into the upsampling.
+    /// @param seqNum The stream's packet count; incremented.
+    /// @param period The txPacer_ period to add the packet to.
+    /// @param timestamp The time of the packet's first sample.
+    void buildAudioPacket_(short* samples, bool useMainUpsampler, const audio::AudioGain& gain, uint32_t streamId, uint32_t& seqNum, VitaTxPacer::Period* period, const audio::AudioClock::Timestamp& timestamp);
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+    /// @brief Float version of the above (main slice only).
+    /// @param samples MAX_VITA_SAMPLES samples from a float link.
+    void buildAudioPacket_(const float* samples, const audio::AudioGain& gain, uint32_t streamId, uint32_t& seqNum, VitaTxPacer::Period* period, const audio::AudioClock::Timestamp& timestamp);
+
+    /// @brief Downsamples the main slice's RX audio for a float link.
+    /// @param numSamples The number of stereo samples in the packet.
+    void receiveFloatAudio_(audio::AudioFloatRingBuffer* fifo, vita_packet* packet, unsigned int numSamples);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+    /// @brief Converts the upsampled audio in upsamplerOutBuf_ into a packet 
+    ///        (see buildAudioPacket_()).
+    void packAudioPacket_(uint32_t streamId, uint32_t& seqNum, VitaTxPacer::Period* period, const audio::AudioClock::Timestamp& timestamp);
+
+    /// @brief Sends a packet to the radio, retrying while Wi-Fi is out of buffers.
+    /// @param retryBudgetUs Time left for retries in this burst; reduced by the time spent.
+    void sendVitaPacket_(vita_packet* packet, int length, int64_t& retryBudgetUs);
     
     void onFlexConnectRadioMessage_(DVTask* origin, FlexConnectRadioMessage* message);
-    void onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* message);
-    void onSendVitaMessage_(DVTask* origin, SendVitaMessage* message);
 
     // Listen to EnableReportingMessage and DisableReportingMessage
     // so that we can actually start sending audio to SmartSDR.
@@ -112,6 +231,8 @@ private:
     // the radio one, so we need a way to mute audio for the former during TX.
     void onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage* message);
     void onRequestRxMessage_(DVTask* origin, audio::TransmitCompleteMessage* message);
+
+    void onRightChannelVolumeMessage_(DVTask* origin, storage::RightChannelVolumeMessage* message);
 };
 
 }
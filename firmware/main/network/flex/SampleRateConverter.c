@@ -15,13 +15,17 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <assert.h>
+#include <math.h>
 #include <string.h>
+#include "sdkconfig.h"
 #include "esp_dsp.h"
+#include "esp_heap_caps.h"
 
 #include "SampleRateConverter.h"
 
 // (int16(fir1(47, 1/3) * 32767))' in Octave
-static const short fdmdv_os_filter24_short[] = {
+static const short fdmdv_os_filter24_short[] __attribute__((aligned(16))) = {
     -20,
     -39,
     -21,
@@ -171,6 +175,27 @@ void fdmdv_8_to_24_with_scaling(float out24k[], short in8k[], int n, float scale
 
     scaleFactor *= FDMDV_OS_24;
 
+#if CONFIG_EZDV_HOST_BUILD
+    // No PIE instructions off the ESP32-S3, so do the same in plain C.
+    for (int i = 0; i < n; i++, data++, out += FDMDV_OS_24)
+    {
+        int32_t acc0 = 0;
+        int32_t acc1 = 0;
+        int32_t acc2 = 0;
+        for (int j = 0; j < FDMDV_OS_TAPS_24_8K; j++)
+        {
+            acc0 += fdmdv_os_filter24_short0[j] * data[j];
+            acc1 += fdmdv_os_filter24_short1[j] * data[j];
+            acc2 += fdmdv_os_filter24_short2[j] * data[j];
+        }
+        tmp0 = acc0 >> 15;
+        tmp1 = acc1 >> 15;
+        tmp2 = acc2 >> 15;
+        out[0] = tmp0 * FDMDV_SHORT_TO_FLOAT * scaleFactor;
+        out[1] = tmp1 * FDMDV_SHORT_TO_FLOAT * scaleFactor;
+        out[2] = tmp2 * FDMDV_SHORT_TO_FLOAT * scaleFactor;
+    }
+#else
     asm volatile(
       "movi a9, 15\n"                                                          // a9 = 15
       "ld.qr q0, %[filter0], 0\n"                                              // Load filter0 into q0
@@ -230,6 +255,7 @@ void fdmdv_8_to_24_with_scaling(float out24k[], short in8k[], int n, float scale
       : /* clobbered registers */
         "a9", "f1", "f2", "f3", "memory"
     );
+#endif // CONFIG_EZDV_HOST_BUILD
 
     /* update filter memory */
     memmove(
@@ -255,19 +281,554 @@ void fdmdv_8_to_24_with_scaling(float out24k[], short in8k[], int n, float scale
 
 void fdmdv_24_to_8(short out8k[], short in24k[], int n)
 {
-    for(int i = 0; i < n; i++) 
+    // The below is equivalent to the following C code:
+    //
+    // for(int i = 0; i < n; i++) 
+    // {
+    //     dsps_dotprod_s16(
+    //         fdmdv_os_filter24_short, 
+    //         &in24k[-FDMDV_OS_TAPS_24K + (i * FDMDV_OS_24)], 
+    //         &out8k[i], 
+    //         FDMDV_OS_TAPS_24K, 
+    //         0);
+    // }
+    //
+    // All 48 taps fit in six Q registers, so they're loaded once up front and 
+    // only the input needs to be loaded for each output sample. This also
+    // avoids calling into ESP-DSP once per output sample.
+
+    short* data = &in24k[-FDMDV_OS_TAPS_24K];
+    short* out = &out8k[0];
+    short tmp = 0;
+
+#if CONFIG_EZDV_HOST_BUILD
+    // No PIE instructions off the ESP32-S3, so do the same in plain C.
+    for (int i = 0; i < n; i++, data += FDMDV_OS_24)
     {
-        dsps_dotprod_s16(
-            fdmdv_os_filter24_short, 
-            &in24k[-FDMDV_OS_TAPS_24K + (i * FDMDV_OS_24)], 
-            &out8k[i], 
-            FDMDV_OS_TAPS_24K, 
-            0);
+        int32_t acc = 0;
+        for (int j = 0; j < FDMDV_OS_TAPS_24K; j++)
+        {
+            acc += fdmdv_os_filter24_short[j] * data[j];
+        }
+        tmp = acc >> 15;
+        *out++ = tmp;
     }
+#else
+    asm volatile(
+      "movi a9, 15\n"                                                          // a9 = 15
+      "ld.qr q0, %[filter], 0\n"                                               // Load taps 0-7 into q0
+      "ld.qr q1, %[filter], 16\n"                                              // Load taps 8-15 into q1
+      "ld.qr q2, %[filter], 32\n"                                              // Load taps 16-23 into q2
+      "ld.qr q3, %[filter], 48\n"                                              // Load taps 24-31 into q3
+      "ld.qr q4, %[filter], 64\n"                                              // Load taps 32-39 into q4
+      "ld.qr q5, %[filter], 80\n"                                              // Load taps 40-47 into q5
+      "loopgtz %[n], fdmdv_24_to_8_loop_end\n"                                 // while (n > 0) {
+      "                                     ee.zero.accx\n"                    // accx = 0
+      "                                     ld.qr q6, %[data], 0\n"            // Load data into q6
+      "                                     ld.qr q7, %[data], 16\n"           // Load data + 8 into q7
+      "                                     ee.vmulas.s16.accx q0, q6\n"       // accx += q0 * q6
+      "                                     ee.vmulas.s16.accx q1, q7\n"       // accx += q1 * q7
+      "                                     ld.qr q6, %[data], 32\n"           // Load data + 16 into q6
+      "                                     ld.qr q7, %[data], 48\n"           // Load data + 24 into q7
+      "                                     ee.vmulas.s16.accx q2, q6\n"       // accx += q2 * q6
+      "                                     ee.vmulas.s16.accx q3, q7\n"       // accx += q3 * q7
+      "                                     ld.qr q6, %[data], 64\n"           // Load data + 32 into q6
+      "                                     ld.qr q7, %[data], 80\n"           // Load data + 40 into q7
+      "                                     ee.vmulas.s16.accx q4, q6\n"       // accx += q4 * q6
+      "                                     ee.vmulas.s16.accx q5, q7\n"       // accx += q5 * q7
+      "                                     addi %[data], %[data], 6\n"        // data += FDMDV_OS_24
+      "                                     ee.srs.accx %[tmp], a9, 0\n"       // tmp = accx >> a9
+      "                                     s16i %[tmp], %[out], 0\n"          // out[0] = tmp
+      "                                     addi %[out], %[out], 2\n"          // out++
+      "fdmdv_24_to_8_loop_end:\n"                                              // n--
+                                                                               // }
+
+      : /* outputs */ 
+        [tmp] "=r"(tmp), 
+        [out] "=r"(out), 
+        [data] "=r"(data), 
+        [n] "=r"(n)
+      : /* inputs */
+        [filter] "r"(fdmdv_os_filter24_short), 
+        "1"(out),
+        "2"(data),  
+        "3"(n)
+      : /* clobbered registers */
+        "a9", "memory"
+    );
+#endif // CONFIG_EZDV_HOST_BUILD
+
+    // n is tied to an asm operand, so recompute it for the filter memory update.
+    n = out - out8k;
 
     /* update filter memory */
     memmove(
       &in24k[-FDMDV_OS_TAPS_24K], 
       &in24k[n * FDMDV_OS_24 - FDMDV_OS_TAPS_24K], 
       sizeof(short) * FDMDV_OS_TAPS_24K);
-}
\ No newline at end of file
+}
+
+/*---------------------------------------------------------------------------*\
+                                                       
+  FUNCTION....: fdmdv_vita_to_short()	     
+  AUTHOR......: Mooneer Salem			      
+  DATE CREATED: 14 Oct 2026
+  Converts one channel of interleaved stereo big-endian float samples (as 
+  received from the Flex) to shorts, ready for fdmdv_24_to_8().
+
+  n is the number of stereo samples; in[] holds 2*n words and out[] n shorts.
+\*---------------------------------------------------------------------------*/
+
+void fdmdv_vita_to_short(short out[], const uint32_t in[], int n)
+{
+    // The below is equivalent to the following C code:
+    //
+    // for (int i = 0; i < n; i++)
+    // {
+    //     uint32_t temp = ntohl(in[i * 2]);
+    //     out[i] = clamp(round(*(float*)&temp * 32768), -32768, 32767);
+    // }
+    //
+    // Two stereo samples are byte-swapped at once using the same shift/mask
+    // sequence as the TX path (see fdmdv_float_to_vita()); the 
+    // left channel is then pulled out of the Q register and converted to a
+    // short with a single rounding FPU instruction plus a clamp.
+
+#if CONFIG_EZDV_HOST_BUILD
+    // No PIE instructions off the ESP32-S3, so do the same in plain C.
+    for (int i = 0; i < (n & ~1); i++)
+    {
+        uint32_t temp = __builtin_bswap32(in[i * 2]);
+        float sample;
+        memcpy(&sample, &temp, sizeof(sample));
+        long value = lrintf(sample * 32768.0f);
+        out[i] = (value > 32767) ? 32767 : ((value < -32768) ? -32768 : value);
+    }
+#else
+    static const uint32_t masks[] = 
+    {
+        0x000000ff,
+        0xff000000,
+        0x0000ff00,
+        0x00ff0000
+    };
+
+    int pairs = n >> 1;
+    const uint32_t* data = &in[0];
+    short* out16 = &out[0];
+    const uint32_t* ptrMasks = masks;
+
+    asm volatile(
+      "ee.vldbc.32.ip q1, %[masks], 4\n"                                       // Load 0x000000ff 4 times into q1
+      "ee.vldbc.32.ip q4, %[masks], 4\n"                                       // Load 0xff000000 4 times into q4
+      "ee.vldbc.32.ip q3, %[masks], 4\n"                                       // Load 0x0000ff00 4 times into q3
+      "ee.vldbc.32.ip q2, %[masks], 4\n"                                       // Load 0x00ff0000 4 times into q2
+      "loopgtz %[pairs], fdmdv_vita_to_short_loop_end\n"                       // while (pairs > 0) {
+      "                                     ld.qr q0, %[data], 0\n"            // Load L0 R0 L1 R1 into q0
+
+      "                                     movi a10, 24\n"
+      "                                     wsr a10, sar\n"                    // Load 24 into sar register
+      "                                     ee.vsr.32 q5, q0\n"                // q5 = q0 >> 24
+      "                                     ee.andq q5, q5, q1\n"              // q5 &= 0x000000ff
+      "                                     ee.vsl.32 q6, q0\n"                // q6 = q0 << 24
+      "                                     ee.andq q6, q6, q4\n"              // q6 &= 0xff000000
+      "                                     ee.orq q7, q5, q6\n"               // q7 = q5 | q6
+
+      "                                     movi a10, 8\n"
+      "                                     wsr a10, sar\n"                    // Load 8 into sar register
+      "                                     ee.vsr.32 q5, q0\n"                // q5 = q0 >> 8
+      "                                     ee.andq q5, q5, q3\n"              // q5 &= 0x0000ff00
+      "                                     ee.vsl.32 q6, q0\n"                // q6 = q0 << 8
+      "                                     ee.andq q6, q6, q2\n"              // q6 &= 0x00ff0000
+      "                                     ee.orq q7, q7, q5\n"               // q7 |= q5
+      "                                     ee.orq q7, q7, q6\n"               // q7 |= q6
+
+      "                                     ee.movi.32.a q7, a10, 0\n"         // a10 = L0
+      "                                     ee.movi.32.a q7, a11, 2\n"         // a11 = L1
+      "                                     wfr f1, a10\n"                     // f1 = L0
+      "                                     wfr f2, a11\n"                     // f2 = L1
+      "                                     round.s a10, f1, 15\n"             // a10 = round(f1 * 32768)
+      "                                     round.s a11, f2, 15\n"             // a11 = round(f2 * 32768)
+      "                                     clamps a10, a10, 15\n"             // Clamp a10 to a short
+      "                                     clamps a11, a11, 15\n"             // Clamp a11 to a short
+      "                                     s16i a10, %[out], 0\n"             // out[0] = a10
+      "                                     s16i a11, %[out], 2\n"             // out[1] = a11
+      "                                     addi %[data], %[data], 16\n"       // in += 4
+      "                                     addi %[out], %[out], 4\n"          // out += 2
+      "fdmdv_vita_to_short_loop_end:\n"                                        // pairs--
+                                                                               // }
+
+      : /* outputs */ 
+        [out] "=r"(out16), 
+        [data] "=r"(data), 
+        [masks] "=r"(ptrMasks),
+        [pairs] "=r"(pairs)
+      : /* inputs */
+        "0"(out16),
+        "1"(data),  
+        "2"(ptrMasks),
+        "3"(pairs)
+      : /* clobbered registers */
+        "a10", "a11", "f1", "f2", "memory"
+    );
+#endif // CONFIG_EZDV_HOST_BUILD
+
+    if (n & 1)
+    {
+        // Odd sample out.
+        uint32_t temp = __builtin_bswap32(in[(n - 1) * 2]);
+        float sample;
+        memcpy(&sample, &temp, sizeof(sample));
+
+        long value = lrintf(sample * 32768.0f);
+        out[n - 1] = (value > 32767) ? 32767 : ((value < -32768) ? -32768 : value);
+    }
+}
+
+/*---------------------------------------------------------------------------*\
+                                                       
+  FUNCTION....: fdmdv_float_to_vita()	     
+  AUTHOR......: Mooneer Salem			      
+  DATE CREATED: 14 Oct 2026
+  Copies float samples into both channels of a big-endian VITA payload (as
+  sent to the Flex). The reverse of fdmdv_vita_to_short().
+
+  n is the number of samples; in[] must be 16 byte aligned and out[] holds 
+  2*n words.
+\*---------------------------------------------------------------------------*/
+
+void fdmdv_float_to_vita(uint32_t out[], const float in[], int n)
+{
+    const uint32_t* dataPtr = (const uint32_t*)&in[0];
+    uint32_t* ptrOut = &out[0];
+
+#if !CONFIG_EZDV_HOST_BUILD
+    uint32_t masks[] = 
+    {
+        0x000000ff,
+        0x00ff0000,
+        0x0000ff00,
+        0xff000000
+    };
+
+    int optimizedNumToSend = n & 0xFFFFFFFC; // We only operate in blocks of 4 samples.
+    for (int i = 0; i < optimizedNumToSend >> 2; i++)
+    {
+        uint32_t* ptrMasks = masks;
+
+        // Assumption: dataPtr is 16 byte aligned.
+        asm volatile(
+            "ld.qr q0, %1, 0\n"              // Load audio sample into q0
+
+            "movi a10, 24\n"
+            "wsr a10, sar\n"                 // Load 24 into sar register
+            "mv.qr q5, q0\n"                 // Copy q0 into q5
+            "mv.qr q6, q0\n"                 // Copy q0 into q6
+            "ee.vldbc.32.ip q1, %2, 4\n"     // Load 0x000000ff 4 times into q1
+            "ee.vsr.32 q5, q5\n"             // Shift all four values in q5 right 24 bits
+            "ee.andq q1, q1, q5\n"           // q1 = q5 & 0x000000ff
+            "ee.vldbc.32.ip q4, %2, 4\n"     // Load 0xff000000 4 times into q4
+            "ee.vsl.32 q6, q6\n"             // Shift all four values in q6 left 24 bits
+            "ee.andq q4, q4, q6\n"           // q4 = q4 & 0xff000000
+
+            "movi a10, 8\n"
+            "wsr a10, sar\n"                 // Load 8 into sar register
+            "mv.qr q5, q0\n"                 // Copy q0 into q5
+            "mv.qr q6, q0\n"                 // Copy q0 into q6
+            "ee.vsr.32 q5, q5\n"             // Shift all four values in q5 right 8 bits
+            "ee.vldbc.32.ip q3, %2, 4\n"     // Load 0x0000ff00 4 times into q3
+            "ee.andq q3, q3, q5\n"           // q3 = q5 & 0x0000ff00
+            "ee.vldbc.32.ip q2, %2, 4\n"     // Load 0x00ff0000 4 times into q2
+            "ee.vsl.32 q6, q6\n"             // Shift all four values in q6 left 8 bits
+            "ee.andq q2, q2, q6\n"           // q2 = q6 & 0x00ff0000
+
+            "ee.orq q0, q1, q2\n"            // q0 = q1 | q2
+            "ee.orq q0, q0, q3\n"            // q0 = q0 | q3
+            "ee.orq q0, q0, q4\n"            // q0 = q0 | q4
+
+            "mv.qr q1, q0\n"                 // Copy q0 into q1
+            "ee.vzip.32 q0, q1\n"            // Interleave each word of q0 and q1 together
+
+            "st.qr q0, %0, 0\n"              // Save first word to ptrOut
+            "st.qr q1, %0, 16\n"             // Save second word to ptrOut
+            "addi %0, %0, 32\n"              // Add 32 to ptrOut address (8 samples)
+            "addi %1, %1, 16\n"              // Add 16 to dataPtr address (4 samples)
+            : "=r"(ptrOut), "=r"(dataPtr), "=r"(ptrMasks)
+            : "0"(ptrOut), "1"(dataPtr), "2"(ptrMasks)
+            : "a10", "memory"
+        );
+    }
+#endif // !CONFIG_EZDV_HOST_BUILD
+
+    // Get the remaining ones that we couldn't get to with the optimized logic 
+    // above (everything on the host).
+    while (dataPtr < (const uint32_t*)&in[n])
+    {
+        uint32_t tmp = __builtin_bswap32(*dataPtr);
+        *ptrOut++ = tmp;
+        *ptrOut++ = tmp;
+        dataPtr++;
+    }
+}
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+
+/*---------------------------------------------------------------------------*\
+
+  Polyphase versions of the above built on esp-dsp's FIR filters. Each
+  filter keeps its own delay line, so the caller's buffers don't need room
+  for filter memory and nothing has to be moved after each call.
+
+\*---------------------------------------------------------------------------*/
+
+// esp-dsp's optimized S16 FIR needs 16 byte aligned coefficients and delay
+// lines. The delay lines are padded by one vector to be safe.
+#define FDMDV_FIR_ALIGNMENT (16)
+#define FDMDV_FIR_DELAY_PADDING (8)
+
+struct fdmdv_8_to_24_state
+{
+    fir_s16_t phases[FDMDV_OS_24];
+    int16_t* coeffs[FDMDV_OS_24];
+    int16_t* delays[FDMDV_OS_24];
+    int16_t* phaseOut[FDMDV_OS_24];
+    int maxSamples;
+};
+
+struct fdmdv_24_to_8_state
+{
+    fir_s16_t filter;
+    int16_t* coeffs;
+    int16_t* delay;
+};
+
+static int16_t* fdmdv_fir_alloc(const short* src, int len)
+{
+    int16_t* buf = (int16_t*)heap_caps_aligned_calloc(FDMDV_FIR_ALIGNMENT, len + FDMDV_FIR_DELAY_PADDING, sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(buf != NULL);
+    if (src != NULL)
+    {
+        memcpy(buf, src, len * sizeof(int16_t));
+    }
+    return buf;
+}
+
+fdmdv_8_to_24_state_t* fdmdv_8_to_24_create(int maxSamples)
+{
+    static const short* phaseFilters[FDMDV_OS_24] = 
+    {
+        fdmdv_os_filter24_short0,
+        fdmdv_os_filter24_short1,
+        fdmdv_os_filter24_short2,
+    };
+
+    fdmdv_8_to_24_state_t* state = (fdmdv_8_to_24_state_t*)heap_caps_calloc(1, sizeof(fdmdv_8_to_24_state_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(state != NULL);
+
+    // Output phase p of the 24 kHz signal is the 8 kHz input filtered by 
+    // taps p, p + 3, p + 6, ...
+    for (int phase = 0; phase < FDMDV_OS_24; phase++)
+    {
+        state->coeffs[phase] = fdmdv_fir_alloc(phaseFilters[phase], FDMDV_OS_TAPS_24_8K);
+        state->delays[phase] = fdmdv_fir_alloc(NULL, FDMDV_OS_TAPS_24_8K);
+        state->phaseOut[phase] = fdmdv_fir_alloc(NULL, maxSamples);
+        ESP_ERROR_CHECK(dsps_fird_init_s16(&state->phases[phase], state->coeffs[phase], state->delays[phase], FDMDV_OS_TAPS_24_8K, 1, 0, 0));
+    }
+    state->maxSamples = maxSamples;
+
+    return state;
+}
+
+void fdmdv_8_to_24_destroy(fdmdv_8_to_24_state_t* state)
+{
+    for (int phase = 0; phase < FDMDV_OS_24; phase++)
+    {
+        dsps_fird_s16_aexx_free(&state->phases[phase]);
+        heap_caps_free(state->coeffs[phase]);
+        heap_caps_free(state->delays[phase]);
+        heap_caps_free(state->phaseOut[phase]);
+    }
+    heap_caps_free(state);
+}
+
+void fdmdv_8_to_24_fir(fdmdv_8_to_24_state_t* state, float out24k[], const short in8k[], int n, float scaleFactor)
+{
+    assert(n <= state->maxSamples);
+
+    for (int phase = 0; phase < FDMDV_OS_24; phase++)
+    {
+        dsps_fird_s16(&state->phases[phase], in8k, state->phaseOut[phase], n);
+    }
+
+    // Interleave the phases, making up for the gain lost by zero stuffing.
+    scaleFactor *= FDMDV_SHORT_TO_FLOAT * FDMDV_OS_24;
+    for (int i = 0; i < n; i++)
+    {
+        out24k[i * FDMDV_OS_24] = state->phaseOut[0][i] * scaleFactor;
+        out24k[i * FDMDV_OS_24 + 1] = state->phaseOut[1][i] * scaleFactor;
+        out24k[i * FDMDV_OS_24 + 2] = state->phaseOut[2][i] * scaleFactor;
+    }
+}
+
+fdmdv_24_to_8_state_t* fdmdv_24_to_8_create(void)
+{
+    fdmdv_24_to_8_state_t* state = (fdmdv_24_to_8_state_t*)heap_caps_calloc(1, sizeof(fdmdv_24_to_8_state_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(state != NULL);
+
+    state->coeffs = fdmdv_fir_alloc(fdmdv_os_filter24_short, FDMDV_OS_TAPS_24K);
+    state->delay = fdmdv_fir_alloc(NULL, FDMDV_OS_TAPS_24K);
+    ESP_ERROR_CHECK(dsps_fird_init_s16(&state->filter, state->coeffs, state->delay, FDMDV_OS_TAPS_24K, FDMDV_OS_24, 0, 0));
+
+    return state;
+}
+
+void fdmdv_24_to_8_destroy(fdmdv_24_to_8_state_t* state)
+{
+    dsps_fird_s16_aexx_free(&state->filter);
+    heap_caps_free(state->coeffs);
+    heap_caps_free(state->delay);
+    heap_caps_free(state);
+}
+
+void fdmdv_24_to_8_fir(fdmdv_24_to_8_state_t* state, short out8k[], const short in24k[], int n)
+{
+    // n is the number of output samples; FDMDV_OS_24 * n are consumed.
+    dsps_fird_s16(&state->filter, in24k, out8k, n);
+}
+
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
+/*---------------------------------------------------------------------------*\
+
+  Float versions of the polyphase filters above, for float audio links.
+  Taps are the same as the short versions (scaled to +/- 1.0).
+
+\*---------------------------------------------------------------------------*/
+
+// Same alignment and padding as the S16 filters above.
+#define FDMDV_FLOAT_FIR_ALIGNMENT (16)
+#define FDMDV_FLOAT_FIR_DELAY_PADDING (4)
+
+struct fdmdv_8_to_24_float_state
+{
+    fir_f32_t phases[FDMDV_OS_24];
+    float* coeffs[FDMDV_OS_24];
+    float* delays[FDMDV_OS_24];
+    float* phaseOut[FDMDV_OS_24];
+    int maxSamples;
+};
+
+struct fdmdv_24_to_8_float_state
+{
+    fir_f32_t filter;
+    float* coeffs;
+    float* delay;
+};
+
+// Like the S16 versions, esp-dsp's float FIR filters apply the first tap to
+// the oldest sample, so the taps are stored in the same order.
+static float* fdmdv_fir_alloc_float(const short* src, int len)
+{
+    float* buf = (float*)heap_caps_aligned_calloc(FDMDV_FLOAT_FIR_ALIGNMENT, len + FDMDV_FLOAT_FIR_DELAY_PADDING, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(buf != NULL);
+    for (int i = 0; src != NULL && i < len; i++)
+    {
+        buf[i] = src[i] * (1.0f / 32768.0f);
+    }
+    return buf;
+}
+
+fdmdv_8_to_24_float_state_t* fdmdv_8_to_24_float_create(int maxSamples)
+{
+    static const short* phaseFilters[FDMDV_OS_24] = 
+    {
+        fdmdv_os_filter24_short0,
+        fdmdv_os_filter24_short1,
+        fdmdv_os_filter24_short2,
+    };
+
+    fdmdv_8_to_24_float_state_t* state = (fdmdv_8_to_24_float_state_t*)heap_caps_calloc(1, sizeof(fdmdv_8_to_24_float_state_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(state != NULL);
+
+    for (int phase = 0; phase < FDMDV_OS_24; phase++)
+    {
+        state->coeffs[phase] = fdmdv_fir_alloc_float(phaseFilters[phase], FDMDV_OS_TAPS_24_8K);
+        state->delays[phase] = fdmdv_fir_alloc_float(NULL, FDMDV_OS_TAPS_24_8K);
+        state->phaseOut[phase] = fdmdv_fir_alloc_float(NULL, maxSamples);
+        ESP_ERROR_CHECK(dsps_fir_init_f32(&state->phases[phase], state->coeffs[phase], state->delays[phase], FDMDV_OS_TAPS_24_8K));
+    }
+    state->maxSamples = maxSamples;
+
+    return state;
+}
+
+void fdmdv_8_to_24_float_destroy(fdmdv_8_to_24_float_state_t* state)
+{
+    for (int phase = 0; phase < FDMDV_OS_24; phase++)
+    {
+        heap_caps_free(state->coeffs[phase]);
+        heap_caps_free(state->delays[phase]);
+        heap_caps_free(state->phaseOut[phase]);
+    }
+    heap_caps_free(state);
+}
+
+void fdmdv_8_to_24_float(fdmdv_8_to_24_float_state_t* state, float out24k[], const float in8k[], int n, float scaleFactor)
+{
+    assert(n <= state->maxSamples);
+
+    for (int phase = 0; phase < FDMDV_OS_24; phase++)
+    {
+        dsps_fir_f32(&state->phases[phase], in8k, state->phaseOut[phase], n);
+    }
+
+    // Interleave the phases, making up for the gain lost by zero stuffing.
+    scaleFactor *= FDMDV_SHORT_TO_FLOAT * FDMDV_OS_24;
+    for (int i = 0; i < n; i++)
+    {
+        out24k[i * FDMDV_OS_24] = state->phaseOut[0][i] * scaleFactor;
+        out24k[i * FDMDV_OS_24 + 1] = state->phaseOut[1][i] * scaleFactor;
+        out24k[i * FDMDV_OS_24 + 2] = state->phaseOut[2][i] * scaleFactor;
+    }
+}
+
+fdmdv_24_to_8_float_state_t* fdmdv_24_to_8_float_create(void)
+{
+    fdmdv_24_to_8_float_state_t* state = (fdmdv_24_to_8_float_state_t*)heap_caps_calloc(1, sizeof(fdmdv_24_to_8_float_state_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(state != NULL);
+
+    state->coeffs = fdmdv_fir_alloc_float(fdmdv_os_filter24_short, FDMDV_OS_TAPS_24K);
+    state->delay = fdmdv_fir_alloc_float(NULL, FDMDV_OS_TAPS_24K);
+    ESP_ERROR_CHECK(dsps_fird_init_f32(&state->filter, state->coeffs, state->delay, FDMDV_OS_TAPS_24K, FDMDV_OS_24));
+
+    return state;
+}
+
+void fdmdv_24_to_8_float_destroy(fdmdv_24_to_8_float_state_t* state)
+{
+    heap_caps_free(state->coeffs);
+    heap_caps_free(state->delay);
+    heap_caps_free(state);
+}
+
+void fdmdv_24_to_8_float(fdmdv_24_to_8_float_state_t* state, float out8k[], const float in24k[], int n)
+{
+    // n is the number of output samples; FDMDV_OS_24 * n are consumed.
+    dsps_fird_f32(&state->filter, in24k, out8k, n);
+}
+
+void fdmdv_vita_to_float(float out[], const uint32_t in[], int n)
+{
+    // Only the byte swap and scaling are needed; nothing is rounded.
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t temp = __builtin_bswap32(in[i * 2]);
+        float sample;
+        memcpy(&sample, &temp, sizeof(sample));
+        out[i] = sample * 32768.0f;
+    }
+}
+
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
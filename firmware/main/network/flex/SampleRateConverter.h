@@ -18,6 +18,9 @@
 #ifndef SAMPLE_RATE_CONVERTER_H
 #define SAMPLE_RATE_CONVERTER_H
 
+#include <stdint.h>
+#include "sdkconfig.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -36,6 +39,46 @@ extern "C" {
 void           fdmdv_8_to_24_with_scaling(float out24k[], short in8k[], int n, float scaleFactor);
 void           fdmdv_24_to_8(short out8k[], short in24k[], int n);
 
+/* Extracts one channel of big-endian float VITA samples as shorts. */
+void           fdmdv_vita_to_short(short out[], const uint32_t in[], int n);
+
+/* Copies float samples into both channels of a big-endian VITA payload. */
+void           fdmdv_float_to_vita(uint32_t out[], const float in[], int n);
+
+#if CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+/* Polyphase equivalents of the above using esp-dsp FIR filters. These keep
+   their own filter memory, so in8k[] and in24k[] don't need any. */
+typedef struct fdmdv_8_to_24_state fdmdv_8_to_24_state_t;
+typedef struct fdmdv_24_to_8_state fdmdv_24_to_8_state_t;
+
+fdmdv_8_to_24_state_t* fdmdv_8_to_24_create(int maxSamples);
+void           fdmdv_8_to_24_destroy(fdmdv_8_to_24_state_t* state);
+void           fdmdv_8_to_24_fir(fdmdv_8_to_24_state_t* state, float out24k[], const short in8k[], int n, float scaleFactor);
+
+fdmdv_24_to_8_state_t* fdmdv_24_to_8_create(void);
+void           fdmdv_24_to_8_destroy(fdmdv_24_to_8_state_t* state);
+void           fdmdv_24_to_8_fir(fdmdv_24_to_8_state_t* state, short out8k[], const short in24k[], int n);
+#endif // CONFIG_EZDV_FLEX_ESP_DSP_RESAMPLER
+
+#if CONFIG_EZDV_FLEX_FLOAT_AUDIO
+/* Float equivalents for float audio links, also built on esp-dsp FIR filters.
+   The 8 kHz side is at the same scale as shorts (+/- 32767), which is what
+   freedv_floatrx() expects and freedv_comptx() produces. */
+typedef struct fdmdv_8_to_24_float_state fdmdv_8_to_24_float_state_t;
+typedef struct fdmdv_24_to_8_float_state fdmdv_24_to_8_float_state_t;
+
+fdmdv_8_to_24_float_state_t* fdmdv_8_to_24_float_create(int maxSamples);
+void           fdmdv_8_to_24_float_destroy(fdmdv_8_to_24_float_state_t* state);
+void           fdmdv_8_to_24_float(fdmdv_8_to_24_float_state_t* state, float out24k[], const float in8k[], int n, float scaleFactor);
+
+fdmdv_24_to_8_float_state_t* fdmdv_24_to_8_float_create(void);
+void           fdmdv_24_to_8_float_destroy(fdmdv_24_to_8_float_state_t* state);
+void           fdmdv_24_to_8_float(fdmdv_24_to_8_float_state_t* state, float out8k[], const float in24k[], int n);
+
+/* Extracts one channel of big-endian float VITA samples, scaled to match the above. */
+void           fdmdv_vita_to_float(float out[], const uint32_t in[], int n);
+#endif // CONFIG_EZDV_FLEX_FLOAT_AUDIO
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
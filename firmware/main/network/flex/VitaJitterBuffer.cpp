@@ -0,0 +1,337 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "VitaJitterBuffer.h"
+
+// The buffer never aims for less than this, since playout itself happens in
+// bursts (once per FlexVitaTask read timer interval).
+#define JITTER_BUFFER_MIN_TARGET_MS (30)
+
+// Target depth as a multiple of the measured jitter.
+#define JITTER_BUFFER_JITTER_MULTIPLIER (4)
+
+// How far above the target the buffer can get before audio is dropped to
+// bring it back down (e.g. once a burst of delayed packets arrives), and
+// how much can be dropped per playout call.
+#define JITTER_BUFFER_HYSTERESIS_MS (20)
+#define JITTER_BUFFER_MAX_DROP_SAMPLES (8)
+
+// The stream is considered to have stopped (e.g. during TX) if nothing
+// arrives for this long.
+#define JITTER_BUFFER_IDLE_TIMEOUT_US (500000)
+
+// A packet count this far behind what's expected is late, not a gap.
+#define JITTER_BUFFER_MAX_GAP_PACKETS (8)
+#define JITTER_BUFFER_MAX_CONSECUTIVE_LATE (3)
+
+#define JITTER_BUFFER_CHUNK_SAMPLES (64)
+#define JITTER_BUFFER_CONCEAL_START_GAIN (16384) /* Q15, -6 dB */
+
+namespace ezdv
+{
+
+namespace network
+{
+    
+namespace flex
+{
+
+VitaJitterBuffer::VitaJitterBuffer(uint32_t sampleRate, uint32_t maxDepthMs)
+    : buffer_(2 * sampleRate * maxDepthMs / 1000)
+    , sampleRate_(sampleRate)
+    , maxDepthSamples_(sampleRate * maxDepthMs / 1000)
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    , driftCompensator_(sampleRate)
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+{
+    reset();
+    getStatistics(stats_, true);
+}
+
+void VitaJitterBuffer::reset()
+{
+    auto span = buffer_.acquireRead(buffer_.numUsed());
+    buffer_.release(span.size());
+
+    isActive_ = false;
+    isBuffering_ = true;
+    expectedPacketCount_ = 0;
+    numConsecutiveLate_ = 0;
+    lastArrivalUs_ = 0;
+    mediaTimeUs_ = 0;
+    lastTransitUs_ = 0;
+    hasTransit_ = false;
+    jitterUs_ = 0;
+    targetDepthSamples_ = std::min(sampleRate_ * JITTER_BUFFER_MIN_TARGET_MS / 1000, maxDepthSamples_);
+    lastPlayoutUs_ = 0;
+    playoutRemainder_ = 0;
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    driftCompensator_.reset();
+    driftCompensator_.setTargetLevel(targetDepthSamples_);
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+    memset(history_, 0, sizeof(history_));
+    historyIndex_ = 0;
+    concealIndex_ = 0;
+    concealGain_ = 0;
+}
+
+bool VitaJitterBuffer::packetReceived(uint8_t packetCount, uint32_t durationUs, int64_t nowUs)
+{
+    packetCount &= 0x0F;
+
+    if (!isActive_)
+    {
+        isActive_ = true;
+        isBuffering_ = true;
+        lastPlayoutUs_ = nowUs;
+        expectedPacketCount_ = packetCount;
+    }
+
+    uint8_t gap = (packetCount - expectedPacketCount_) & 0x0F;
+    if (gap >= JITTER_BUFFER_MAX_GAP_PACKETS)
+    {
+        stats_.numLatePackets++;
+        if (++numConsecutiveLate_ < JITTER_BUFFER_MAX_CONSECUTIVE_LATE)
+        {
+            return false;
+        }
+
+        // The radio must have started counting over. 
+        gap = 0;
+    }
+    numConsecutiveLate_ = 0;
+
+    if (gap > 0)
+    {
+        // Fill in for the missing packets so that what follows still plays
+        // at the right time.
+        stats_.numLostPackets += gap;
+        mediaTimeUs_ += gap * durationUs;
+
+        uint32_t numMissing = (uint64_t)gap * durationUs * sampleRate_ / 1000000;
+        short buf[JITTER_BUFFER_CHUNK_SAMPLES];
+        while (numMissing > 0)
+        {
+            uint32_t numToConceal = std::min(numMissing, (uint32_t)JITTER_BUFFER_CHUNK_SAMPLES);
+            conceal_(buf, numToConceal);
+            buffer_.write(buf, std::min(numToConceal, buffer_.numFree()));
+            stats_.numConcealedSamples += numToConceal;
+            numMissing -= numToConceal;
+        }
+    }
+
+    expectedPacketCount_ = (packetCount + 1) & 0x0F;
+    stats_.numPackets++;
+    lastArrivalUs_ = nowUs;
+
+    // Jitter is the smoothed variation in how late each packet arrives
+    // relative to when its audio should play.
+    int64_t transitUs = nowUs - mediaTimeUs_;
+    if (hasTransit_)
+    {
+        int64_t deltaUs = transitUs - lastTransitUs_;
+        if (deltaUs < 0)
+        {
+            deltaUs = -deltaUs;
+        }
+        jitterUs_ += (deltaUs - jitterUs_) / 16;
+    }
+    lastTransitUs_ = transitUs;
+    hasTransit_ = true;
+    mediaTimeUs_ += durationUs;
+
+    uint32_t targetMs = std::max(
+        (uint32_t)(JITTER_BUFFER_JITTER_MULTIPLIER * jitterUs_ / 1000), 
+        (uint32_t)JITTER_BUFFER_MIN_TARGET_MS);
+    targetDepthSamples_ = std::min(sampleRate_ * targetMs / 1000, maxDepthSamples_);
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    driftCompensator_.setTargetLevel(targetDepthSamples_);
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+    return true;
+}
+
+void VitaJitterBuffer::write(const short* samples, uint32_t numSamples)
+{
+    updateHistory_(samples, numSamples);
+
+    // Make room by dropping the oldest audio; it's the most out of date.
+    if (buffer_.numFree() < numSamples)
+    {
+        uint32_t numToDrop = std::min(numSamples - buffer_.numFree(), buffer_.numUsed());
+        auto span = buffer_.acquireRead(numToDrop);
+        buffer_.release(span.size());
+        stats_.numDroppedSamples += span.size();
+    }
+
+    buffer_.write(samples, std::min(numSamples, buffer_.numFree()));
+}
+
+void VitaJitterBuffer::playout(audio::AudioRingBuffer* output, int64_t nowUs)
+{
+    if (!isActive_)
+    {
+        return;
+    }
+
+    if (nowUs - lastArrivalUs_ >= JITTER_BUFFER_IDLE_TIMEOUT_US)
+    {
+        // The stream stopped; let whatever's left play out first.
+        if (buffer_.numUsed() == 0)
+        {
+            reset();
+            return;
+        }
+    }
+
+    // Work out how much audio is due since the last call.
+    playoutRemainder_ += (uint64_t)(nowUs - lastPlayoutUs_) * sampleRate_;
+    lastPlayoutUs_ = nowUs;
+    uint32_t numDue = playoutRemainder_ / 1000000;
+    playoutRemainder_ %= 1000000;
+
+    uint32_t depth = buffer_.numUsed();
+    stats_.minDepthMs = std::min(stats_.minDepthMs, samplesToMs_(depth));
+    stats_.maxDepthMs = std::max(stats_.maxDepthMs, samplesToMs_(depth));
+    depthTotal_ += depth;
+    numDepthSamples_++;
+
+    if (isBuffering_ && depth >= targetDepthSamples_)
+    {
+        isBuffering_ = false;
+    }
+    else if (!isBuffering_ && depth > numDue + targetDepthSamples_ + sampleRate_ * JITTER_BUFFER_HYSTERESIS_MS / 1000)
+    {
+        // Gradually bring latency back down after a burst. (Clock drift is
+        // too slow to get this far with drift compensation enabled.)
+        auto span = buffer_.acquireRead(JITTER_BUFFER_MAX_DROP_SAMPLES);
+        buffer_.release(span.size());
+        stats_.numDroppedSamples += span.size();
+    }
+
+    short buf[JITTER_BUFFER_CHUNK_SAMPLES];
+    while (numDue > 0)
+    {
+        uint32_t numToSend = std::min(numDue, (uint32_t)JITTER_BUFFER_CHUNK_SAMPLES);
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        uint32_t numAvailable = isBuffering_ ? 0 : driftCompensator_.process(&buffer_, buf, numToSend);
+#else
+        uint32_t numAvailable = isBuffering_ ? 0 : std::min(numToSend, buffer_.numUsed());
+        if (numAvailable > 0)
+        {
+            buffer_.read(buf, numAvailable);
+        }
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+        if (numAvailable > 0)
+        {
+            concealIndex_ = 0;
+            concealGain_ = JITTER_BUFFER_CONCEAL_START_GAIN;
+        }
+
+        if (numAvailable < numToSend)
+        {
+            // Keep the decoder fed while (re)buffering.
+            if (!isBuffering_)
+            {
+                stats_.numUnderruns++;
+                isBuffering_ = true;
+            }
+            conceal_(&buf[numAvailable], numToSend - numAvailable);
+            stats_.numConcealedSamples += numToSend - numAvailable;
+        }
+
+        if (output != nullptr)
+        {
+            uint32_t numWritten = std::min(numToSend, output->numFree());
+            output->write(buf, numWritten);
+            output->reportOverrun(numToSend - numWritten);
+        }
+        numDue -= numToSend;
+    }
+}
+
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+int32_t VitaJitterBuffer::getDriftCorrectionPpm() const
+{
+    return driftCompensator_.getCorrectionPpm();
+}
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+void VitaJitterBuffer::getStatistics(Statistics& stats, bool reset)
+{
+    stats = stats_;
+    stats.jitterUs = jitterUs_;
+    stats.targetDepthMs = samplesToMs_(targetDepthSamples_);
+    stats.avgDepthMs = numDepthSamples_ > 0 ? samplesToMs_(depthTotal_ / numDepthSamples_) : 0;
+    if (stats.minDepthMs > stats.maxDepthMs)
+    {
+        stats.minDepthMs = 0;
+    }
+
+    if (reset)
+    {
+        memset(&stats_, 0, sizeof(stats_));
+        stats_.minDepthMs = UINT32_MAX;
+        depthTotal_ = 0;
+        numDepthSamples_ = 0;
+    }
+}
+
+void VitaJitterBuffer::conceal_(short* samples, uint32_t numSamples)
+{
+    // Repeat the last bit of audio received, 6 dB quieter each time, until
+    // it fades to silence.
+    for (uint32_t index = 0; index < numSamples; index++)
+    {
+        uint32_t historyPos = (historyIndex_ + concealIndex_) % HISTORY_SAMPLES;
+        samples[index] = (history_[historyPos] * concealGain_) >> 15;
+
+        if (++concealIndex_ == HISTORY_SAMPLES)
+        {
+            concealIndex_ = 0;
+            concealGain_ >>= 1;
+        }
+    }
+}
+
+void VitaJitterBuffer::updateHistory_(const short* samples, uint32_t numSamples)
+{
+    for (uint32_t index = (numSamples > HISTORY_SAMPLES) ? numSamples - HISTORY_SAMPLES : 0; index < numSamples; index++)
+    {
+        history_[historyIndex_] = samples[index];
+        historyIndex_ = (historyIndex_ + 1) % HISTORY_SAMPLES;
+    }
+
+    // Concealment for lost packets starts over from the new audio.
+    concealIndex_ = 0;
+    concealGain_ = JITTER_BUFFER_CONCEAL_START_GAIN;
+}
+
+uint32_t VitaJitterBuffer::samplesToMs_(uint32_t numSamples) const
+{
+    return numSamples * 1000 / sampleRate_;
+}
+
+}
+
+}
+
+}
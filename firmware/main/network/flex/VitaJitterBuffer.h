@@ -0,0 +1,144 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VITA_JITTER_BUFFER_H
+#define VITA_JITTER_BUFFER_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+#include "audio/AudioDriftCompensator.h"
+#include "audio/AudioRingBuffer.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+    
+namespace flex
+{
+
+/// @brief Smooths out bursty arrival of VITA audio (e.g. over busy Wi-Fi) 
+///        before it reaches FreeDV. Arrival jitter is measured against each
+///        packet's expected play time and the buffer's target depth follows
+///        it. Lost packets (per the VITA packet count) and underruns are 
+///        concealed by repeating the last audio received with decreasing 
+///        volume. Only used from FlexVitaTask.
+class VitaJitterBuffer
+{
+public:
+    struct Statistics
+    {
+        uint32_t numPackets;
+        uint32_t numLostPackets;
+        uint32_t numLatePackets; // out of order or duplicated; discarded
+        uint32_t numUnderruns;
+        uint32_t numConcealedSamples;
+        uint32_t numDroppedSamples; // discarded to bring the depth back down
+        uint32_t jitterUs;
+        uint32_t targetDepthMs;
+        uint32_t minDepthMs;
+        uint32_t maxDepthMs;
+        uint32_t avgDepthMs;
+    };
+
+    /// @brief Creates a new jitter buffer.
+    /// @param sampleRate The sample rate of the buffered audio.
+    /// @param maxDepthMs The most audio the buffer will hold back.
+    VitaJitterBuffer(uint32_t sampleRate, uint32_t maxDepthMs);
+    virtual ~VitaJitterBuffer() = default;
+
+    /// @brief Forgets the current stream; the next packet starts buffering again.
+    void reset();
+
+    /// @brief Called for each packet before its audio is written.
+    /// @param packetCount The 4-bit packet count from the VITA header.
+    /// @param durationUs The amount of audio in the packet.
+    /// @param nowUs The packet's arrival time.
+    /// @return false if the packet is late or a duplicate and should be discarded.
+    bool packetReceived(uint8_t packetCount, uint32_t durationUs, int64_t nowUs);
+
+    /// @brief Queues audio for playout.
+    void write(const short* samples, uint32_t numSamples);
+
+    /// @brief Sends audio that's due (based on the time since the last call) to the given FIFO.
+    /// @param output Where to send audio (nullptr to discard it).
+    /// @param nowUs The current time.
+    void playout(audio::AudioRingBuffer* output, int64_t nowUs);
+
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    /// @brief Returns the current clock drift correction (see AudioDriftCompensator).
+    int32_t getDriftCorrectionPpm() const;
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+    /// @brief Retrieves the statistics gathered so far.
+    /// @param stats Structure to store the statistics in.
+    /// @param reset If true, counters start over.
+    void getStatistics(Statistics& stats, bool reset = false);
+
+private:
+    enum { HISTORY_SAMPLES = 40 };
+
+    audio::AudioRingBuffer buffer_;
+    uint32_t sampleRate_;
+    uint32_t maxDepthSamples_;
+
+    bool isActive_;
+    bool isBuffering_;
+    uint8_t expectedPacketCount_;
+    int numConsecutiveLate_;
+    int64_t lastArrivalUs_;
+
+    // Jitter estimate (RFC 3550 style) from packet transit times.
+    int64_t mediaTimeUs_;
+    int64_t lastTransitUs_;
+    bool hasTransit_;
+    int64_t jitterUs_;
+    uint32_t targetDepthSamples_;
+
+    // Playout clock.
+    int64_t lastPlayoutUs_;
+    uint64_t playoutRemainder_;
+#if CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+    // Keeps the depth at the target despite the radio's clock not quite
+    // matching ours.
+    audio::AudioDriftCompensator driftCompensator_;
+#endif // CONFIG_EZDV_FLEX_DRIFT_COMPENSATION
+
+    // Concealment state.
+    short history_[HISTORY_SAMPLES];
+    uint32_t historyIndex_;
+    uint32_t concealIndex_;
+    int32_t concealGain_;
+
+    Statistics stats_;
+    uint64_t depthTotal_;
+    uint32_t numDepthSamples_;
+
+    void conceal_(short* samples, uint32_t numSamples);
+    void updateHistory_(const short* samples, uint32_t numSamples);
+    uint32_t samplesToMs_(uint32_t numSamples) const;
+};
+
+}
+
+}
+
+}
+
+#endif // VITA_JITTER_BUFFER_H
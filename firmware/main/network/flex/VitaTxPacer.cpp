@@ -0,0 +1,136 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "VitaTxPacer.h"
+#include "util/MemoryPlacement.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+    
+namespace flex
+{
+
+VitaTxPacer::VitaTxPacer(uint32_t periodUs, uint32_t maxLatePeriods)
+    : periodUs_(periodUs)
+    , maxLateUs_(periodUs * maxLatePeriods)
+{
+    for (auto& period : periods_)
+    {
+        for (int index = 0; index < MAX_PACKETS_PER_PERIOD; index++)
+        {
+            period.packets[index] = (vita_packet*)util::MemoryPlacement::Calloc(util::MemoryPlacement::VITA_PACKETS, 1, sizeof(vita_packet));
+            assert(period.packets[index] != nullptr);
+        }
+    }
+
+    reset(0);
+    getStatistics(stats_, true);
+}
+
+VitaTxPacer::~VitaTxPacer()
+{
+    for (auto& period : periods_)
+    {
+        for (int index = 0; index < MAX_PACKETS_PER_PERIOD; index++)
+        {
+            util::MemoryPlacement::Free(util::MemoryPlacement::VITA_PACKETS, period.packets[index]);
+        }
+    }
+}
+
+void VitaTxPacer::reset(int64_t nowUs)
+{
+    readIndex_ = 0;
+    numQueued_ = 0;
+    nextReleaseUs_ = nowUs + periodUs_;
+}
+
+VitaTxPacer::Period* VitaTxPacer::getFreePeriod()
+{
+    if (numQueued_ == LEAD_PERIODS)
+    {
+        return nullptr;
+    }
+
+    Period* period = &periods_[(readIndex_ + numQueued_) % LEAD_PERIODS];
+    period->numPackets = 0;
+    return period;
+}
+
+void VitaTxPacer::queuePeriod()
+{
+    assert(numQueued_ < LEAD_PERIODS);
+    numQueued_++;
+}
+
+VitaTxPacer::Period* VitaTxPacer::getDuePeriod(int64_t nowUs)
+{
+    while (nextReleaseUs_ <= nowUs)
+    {
+        uint32_t lateUs = nowUs - nextReleaseUs_;
+        if (lateUs > maxLateUs_)
+        {
+            // Catching up would just mean a long burst of stale audio 
+            // (e.g. after Wi-Fi stalled); start over from now instead.
+            stats_.numResyncs++;
+            nextReleaseUs_ = nowUs;
+            lateUs = 0;
+        }
+        stats_.maxLateUs = std::max(stats_.maxLateUs, lateUs);
+
+        nextReleaseUs_ += periodUs_;
+        stats_.numPeriods++;
+        if (numQueued_ > 0)
+        {
+            return &periods_[readIndex_];
+        }
+
+        // Nothing was ready in time, so there's simply a gap in the stream.
+        stats_.numUnderruns++;
+    }
+
+    return nullptr;
+}
+
+void VitaTxPacer::releasePeriod()
+{
+    assert(numQueued_ > 0);
+    readIndex_ = (readIndex_ + 1) % LEAD_PERIODS;
+    numQueued_--;
+}
+
+void VitaTxPacer::getStatistics(Statistics& stats, bool reset)
+{
+    memcpy(&stats, &stats_, sizeof(Statistics));
+    if (reset)
+    {
+        memset(&stats_, 0, sizeof(Statistics));
+    }
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,114 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VITA_TX_PACER_H
+#define VITA_TX_PACER_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+#include "vita.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+    
+namespace flex
+{
+
+/// @brief Releases VITA audio packets to the radio on a fixed audio timeline
+///        instead of however often the send timer happens to run. Packets for
+///        each period of audio are built ahead of time (up to LEAD_PERIODS 
+///        ahead), so that once a period is due, all that remains is sending it.
+///        Periods may be released in batches (see CONFIG_EZDV_QOS_FLEX_VITA_BATCH).
+///        Only used from FlexVitaTask.
+class VitaTxPacer
+{
+public:
+#if CONFIG_EZDV_FLEX_MULTI_SLICE
+    enum { MAX_PACKETS_PER_PERIOD = 2 }; // One per slice.
+#else
+    enum { MAX_PACKETS_PER_PERIOD = 1 };
+#endif // CONFIG_EZDV_FLEX_MULTI_SLICE
+    enum { LEAD_PERIODS = CONFIG_EZDV_QOS_FLEX_VITA_BATCH + 1 }; // A full batch plus one being built.
+
+    /// @brief The packets covering one period of audio.
+    struct Period
+    {
+        int numPackets; // May be zero if the audio isn't going anywhere.
+        vita_packet* packets[MAX_PACKETS_PER_PERIOD];
+        int lengths[MAX_PACKETS_PER_PERIOD];
+    };
+
+    struct Statistics
+    {
+        uint32_t numPeriods;
+        uint32_t numUnderruns; // periods that came due with nothing built
+        uint32_t numResyncs;
+        uint32_t maxLateUs;
+    };
+
+    /// @brief Creates a new pacer.
+    /// @param periodUs The amount of audio in each period.
+    /// @param maxLatePeriods How far behind releases can fall before the 
+    ///        timeline is restarted instead of catching up.
+    VitaTxPacer(uint32_t periodUs, uint32_t maxLatePeriods);
+    virtual ~VitaTxPacer();
+
+    /// @brief Discards any built periods and restarts the timeline one period from now.
+    void reset(int64_t nowUs);
+
+    /// @brief Returns the next period to build, or nullptr if LEAD_PERIODS are already built.
+    ///        The period is empty and has packet buffers ready to fill in.
+    Period* getFreePeriod();
+
+    /// @brief Queues the period returned by getFreePeriod() for release.
+    void queuePeriod();
+
+    /// @brief Returns the oldest built period if it's due, or nullptr otherwise.
+    ///        Periods falling due with nothing built are skipped.
+    Period* getDuePeriod(int64_t nowUs);
+
+    /// @brief Frees the period returned by getDuePeriod() once it has been sent.
+    void releasePeriod();
+
+    /// @brief Retrieves the statistics gathered so far.
+    /// @param stats Structure to store the statistics in.
+    /// @param reset If true, counters start over.
+    void getStatistics(Statistics& stats, bool reset = false);
+
+private:
+    uint32_t periodUs_;
+    uint32_t maxLateUs_;
+    int64_t nextReleaseUs_;
+
+    Period periods_[LEAD_PERIODS];
+    int readIndex_;
+    int numQueued_;
+
+    Statistics stats_;
+};
+
+}
+
+}
+
+}
+
+#endif // VITA_TX_PACER_H
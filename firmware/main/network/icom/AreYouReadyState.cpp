@@ -32,7 +32,7 @@ AreYouReadyState::AreYouReadyState(IcomStateMachine* parent)
     : IcomProtocolState(parent)
     , areYouReadyTimer_(parent->getTask(), this, &AreYouReadyState::onAreYouReadyTimer_, MS_TO_US(RETRANSMIT_PERIOD), "IcomAreYouReadyTimer")
 {
-    // empty
+    areYouReadyTimer_.useTimerWheel();
 }
 
 void AreYouReadyState::onEnterState()
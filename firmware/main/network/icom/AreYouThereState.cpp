@@ -32,7 +32,7 @@ AreYouThereState::AreYouThereState(IcomStateMachine* parent)
     : IcomProtocolState(parent)
     , resendTimer_(parent_->getTask(), this, &AreYouThereState::retrySend_, MS_TO_US(AREYOUTHERE_PERIOD), "IcomResendTimer")
 {
-    // empty
+    resendTimer_.useTimerWheel();
 }
  
  void AreYouThereState::onEnterState()
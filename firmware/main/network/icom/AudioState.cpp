@@ -15,203 +15,24 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "esp_dsp.h"
+#include "esp_timer.h"
 
 #include <cstring>
 #include <cmath>
+#include <algorithm>
 #include "IcomSocketTask.h"
 #include "AudioState.h"
 #include "IcomStateMachine.h"
 
-// The below values are calculated values for each possible audio multiplier
-// in terms of Q5.11 fixed point. The formula for calculating these is:
-//
-//     e^(volInDb/20.0 * ln(10.0))
-//
-// And the equivalent fixed point values are calculated by using the calculator
-// at https://chummersone.github.io/qformat.html.
-//
-// (Note: ezDV operates in the range of -63.5dB to +24dB amplification.)
-static short FIXED_POINT_AMPLIFICATION_FACTORS[] = {
-    1,
-    1,
-    2,
-    2,
-    2,
-    2,
-    2,
-    2,
-    2,
-    2,
-    2,
-    3,
-    3,
-    3,
-    3,
-    3,
-    3,
-    4,
-    4,
-    4,
-    4,
-    5,
-    5,
-    5,
-    5,
-    6,
-    6,
-    6,
-    7,
-    7,
-    8,
-    8,
-    9,
-    9,
-    10,
-    10,
-    11,
-    12,
-    12,
-    13,
-    14,
-    14,
-    15,
-    16,
-    17,
-    18,
-    19,
-    20,
-    22,
-    23,
-    24,
-    26,
-    27,
-    29,
-    31,
-    32,
-    34,
-    36,
-    39,
-    41,
-    43,
-    46,
-    49,
-    51,
-    54,
-    58,
-    61,
-    65,
-    69,
-    73,
-    77,
-    82,
-    86,
-    91,
-    97,
-    103,
-    109,
-    115,
-    122,
-    129,
-    137,
-    145,
-    154,
-    163,
-    172,
-    183,
-    193,
-    205,
-    217,
-    230,
-    243,
-    258,
-    273,
-    289,
-    306,
-    325,
-    344,
-    364,
-    386,
-    409,
-    433,
-    458,
-    486,
-    514,
-    545,
-    577,
-    611,
-    648,
-    686,
-    727,
-    770,
-    815,
-    864,
-    915,
-    969,
-    1026,
-    1087,
-    1152,
-    1220,
-    1292,
-    1369,
-    1450,
-    1536,
-    1627,
-    1723,
-    1825,
-    1933,
-    2048,
-    2169,
-    2298,
-    2434,
-    2578,
-    2731,
-    2893,
-    3064,
-    3246,
-    3438,
-    3642,
-    3858,
-    4086,
-    4328,
-    4585,
-    4857,
-    5144,
-    5449,
-    5772,
-    6114,
-    6476,
-    6860,
-    7267,
-    7697,
-    8153,
-    8636,
-    9148,
-    9690,
-    10264,
-    10873,
-    11517,
-    12199,
-    12922,
-    13688,
-    14499,
-    15358,
-    16268,
-    17232,
-    18253,
-    19334,
-    20480,
-    21694,
-    22979,
-    24341,
-    25783,
-    27311,
-    28929,
-    30643,
-};
-
-#define MIN_AMPLIFICATION_DB (-127) /* -63.5dB minimum amplification by TLV320 */
-#define UNITY_AMPLIFICATION_VAL (2048) /* 1.0 */
+static_assert(TX_AUDIO_PERIOD % AUDIO_PERIOD == 0, "Icom TX audio packets must be a multiple of 20ms");
+static_assert(AUDIO_SIZE + TX_AUDIO_MAX_SAMPLES * sizeof(short) <= MAX_PACKET_SIZE, "Icom TX audio packets are too large");
+
+// The radio needs to be able to hold a few of our packets at once.
+static_assert(TX_BUFFER_PERIOD >= 4 * TX_AUDIO_PERIOD, "Icom TX audio packets are too long for the radio's TX buffer");
+
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+#define JITTER_BUFFER_DELAY_PACKETS (CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER_MS / AUDIO_PERIOD)
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
 
 namespace ezdv
 {
@@ -224,18 +45,42 @@ namespace icom
 
 AudioState::AudioState(IcomStateMachine* parent)
     : TrackedPacketState(parent)
-    , audioOutTimer_(parent_->getTask(), this, &AudioState::onAudioOutTimer_, MS_TO_US(20), "IcomAudioOutTimer")
+    , audioOutTimer_(parent_->getTask(), this, &AudioState::onAudioOutTimer_, MS_TO_US(TX_AUDIO_PERIOD), "IcomAudioOutTimer")
     , audioWatchdogTimer_(parent_->getTask(), this, &AudioState::onAudioWatchdog_, MS_TO_US(WATCHDOG_PERIOD), "IcomAudioWatchdogTimer")
     , audioSequenceNumber_(0)
     , completingTransmit_(false)
+    , samplesPerPacket_(TX_AUDIO_MAX_SAMPLES)
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    , playoutEndTimeUs_(0)
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    , isStarved_(true)
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+    , powerLock_("IcomAudio")
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    , txDeadline_("Icom TX", MS_TO_US(TX_AUDIO_PERIOD), MS_TO_US(TX_AUDIO_PERIOD))
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    , jitterBuffer_(JITTER_BUFFER_DELAY_PACKETS)
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
 {
-    parent->getTask()->registerMessageHandler(this, &AudioState::onRightChannelVolumeMessage_);
-    parent->getTask()->registerMessageHandler(this, &AudioState::onTransmitCompleteMessage_);
+    audioWatchdogTimer_.useTimerWheel();
 
-    for (int index = 0; index < 160; index++)
-    {
-        audioMultiplier_[index] = UNITY_AMPLIFICATION_VAL;
-    }
+    parent->getTask()->registerMessageHandlers<
+        &AudioState::onRightChannelVolumeMessage_,
+        &AudioState::onTransmitCompleteMessage_>(this);
+#if CONFIG_EZDV_TX_PREROLL
+    parent->getTask()->registerMessageHandlers<&AudioState::onRequestTxMessage_>(this);
+#endif // CONFIG_EZDV_TX_PREROLL
+
+    // Audio needs to go out on time regardless of what else is queued.
+    audioOutTimer_.enableDirectDispatch();
+
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    // Lost packets can still be used if they make it back before the
+    // jitter buffer needs them.
+    setRxRetransmitWindow_(JITTER_BUFFER_DELAY_PACKETS);
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
 }
 
 void AudioState::onEnterState()
@@ -244,22 +89,69 @@ void AudioState::onEnterState()
 
     // Reset sequence number
     audioSequenceNumber_ = 0;
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    playoutEndTimeUs_ = 0;
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+
+    // The stream's sample rate is agreed on during login and set on the
+    // task before we get here.
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    samplesPerPacket_ = TX_AUDIO_PERIOD * task->getInputSampleRate(ezdv::audio::AudioInput::LEFT_CHANNEL) / 1000;
+    assert(samplesPerPacket_ > 0 && samplesPerPacket_ <= TX_AUDIO_MAX_SAMPLES);
+#if CONFIG_EZDV_TX_PREROLL
+    txPreroll_.cancel();
+#endif // CONFIG_EZDV_TX_PREROLL
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    // Wake up as soon as FreeDV has a whole packet for us.
+    isStarved_ = true;
+    task->setAudioInputThreshold(ezdv::audio::AudioInput::LEFT_CHANNEL, samplesPerPacket_);
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    jitterBuffer_.reset();
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+
+    // Audio flows both ways from here on.
+    powerLock_.acquire();
 
     // Start audio output timer
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    txDeadline_.reset();
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
     audioOutTimer_.start();
     
     // Start watchdog
     audioWatchdogTimer_.start();
     
     // Grab current volumes to make sure we properly recover TX ALC.
-    storage::RequestVolumeSettingsMessage requestMessage;
-    parent_->getTask()->publish(&requestMessage);
+    storage::Settings::Volume volume;
+    if (storage::SettingsSnapshot::Read(&storage::Settings::volume, volume) > 0)
+    {
+        setTxVolume_(volume.rightChannelVolume);
+    }
 }
 
 void AudioState::onExitState()
 {
     audioOutTimer_.stop();
     audioWatchdogTimer_.stop();
+    powerLock_.release();
+
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    task->setAudioInputThreshold(ezdv::audio::AudioInput::LEFT_CHANNEL, 0);
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    IcomAudioJitterBuffer::Statistics stats;
+    jitterBuffer_.getStatistics(stats, true);
+    ESP_LOGI(
+        parent_->getName().c_str(), 
+        "Jitter buffer: %" PRIu32 " packets, %" PRIu32 " reordered, %" PRIu32 " late, %" PRIu32 " duplicate, %" PRIu32 " concealed, %" PRIu32 " resets",
+        stats.numPackets, stats.numReorderedPackets, stats.numLatePackets, stats.numDuplicatePackets, 
+        stats.numConcealedPackets, stats.numResets);
+    jitterBuffer_.reset();
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
 
     TrackedPacketState::onExitState();
 }
@@ -277,16 +169,20 @@ void AudioState::onReceivePacket(IcomPacket& packet)
     if (packet.isAudioPacket(audioSeqId, &audioData))
     {
         // Restart watchdog
-        audioWatchdogTimer_.stop();
-        audioWatchdogTimer_.start();
+        audioWatchdogTimer_.restart();
         
         auto task = (IcomSocketTask*)(parent_->getTask());
-        auto outputFifo = task->getAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL);
+        ezdv::audio::AudioInput::OutputClaim output(task, ezdv::audio::AudioInput::LEFT_CHANNEL);
+        auto outputFifo = output.fifo();
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+        jitterBuffer_.packetReceived(packet, audioSeqId, outputFifo);
+#else
         if (outputFifo != nullptr)
         {
             int totalSize = (packet.getSendLength() - 0x18) / sizeof(short);
-            codec2_fifo_write(outputFifo, audioData, totalSize); 
+            outputFifo->write(audioData, totalSize); 
         }
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
     }
 
     // Call into parent to perform missing packet handling.
@@ -308,22 +204,67 @@ void AudioState::onAudioOutTimer_(DVTimer*)
         ESP_LOGE(parent_->getName().c_str(), "input fifo is null for some reason!");
         return;
     }
-    
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    if (txDeadline_.mark(esp_timer_get_time()))
+    {
+        // The radio has been getting audio in bursts (if at all), and the 
+        // backlog will only grow. Start the stream over from scratch.
+        inputFifo->requestFlush();
+        parent_->transitionState(IcomProtocolState::ARE_YOU_THERE);
+        return;
+    }
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+    sendAudio_(inputFifo);
+}
+
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+void AudioState::onAudioInputReady()
+{
+    // Audio that just missed a tick would otherwise wait almost a whole 
+    // period for the next one. Send it now and move the timer's phase so 
+    // that later ticks line up with FreeDV's output.
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    auto inputFifo = task->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL);
+    if (isStarved_ && inputFifo != nullptr && sendAudio_(inputFifo))
+    {
+        audioOutTimer_.restart();
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+        txDeadline_.mark(esp_timer_get_time());
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+    }
+}
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+
+bool AudioState::sendAudio_(ezdv::audio::AudioRingBuffer* inputFifo)
+{
+#if CONFIG_EZDV_TX_PREROLL
+    if (txPreroll_.isPriming())
+    {
+        if (completingTransmit_)
+        {
+            // Too short to ever prime; send what there is.
+            txPreroll_.cancel();
+        }
+        else if (!txPreroll_.update(inputFifo->numUsed(), esp_timer_get_time()))
+        {
+            return false;
+        }
+    }
+#endif // CONFIG_EZDV_TX_PREROLL
+
     // Get input audio and write to socket
-    uint16_t samplesToRead = 160; // 320 bytes
-    short tempAudioOut[samplesToRead];
+    uint16_t samplesToRead = samplesPerPacket_; // 320 bytes per 20ms at 8 kHz
+    short tempAudioOut[TX_AUDIO_MAX_SAMPLES];
     //memset(tempAudioOut, 0, samplesToRead * sizeof(short));
 
-    if (codec2_fifo_used(inputFifo) >= samplesToRead)
+    if (inputFifo->numUsed() >= samplesToRead)
     {
-        codec2_fifo_read(inputFifo, tempAudioOut, samplesToRead);
+        inputFifo->read(tempAudioOut, samplesToRead);
 
         // Adjust output based on configured volume.
-        // Note that since audioMultiplier_ is a Q5.11 fixed point number,
-        // the result pre-shift is a Q6.27 fixed point number. Shifting
-        // by 11 should cancel this out and result in the proper precision
-        // again.
-        dsps_mul_s16(tempAudioOut, audioMultiplier_, tempAudioOut, samplesToRead, 1, 1, 1, 11);
+        txGain_.apply(tempAudioOut, samplesToRead);
     
         auto packet = IcomPacket::CreateAudioPacket(
             audioSequenceNumber_++,
@@ -333,31 +274,79 @@ void AudioState::onAudioOutTimer_(DVTimer*)
             samplesToRead);
 
         sendTracked_(packet);
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+        // The radio plays packets back to back, so one sent while it's
+        // still playing earlier audio only extends the end of that.
+        playoutEndTimeUs_ = std::max(playoutEndTimeUs_, esp_timer_get_time()) + MS_TO_US(TX_AUDIO_PERIOD);
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+        isStarved_ = false;
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+        return true;
     }
-    else if (completingTransmit_)
+    
+    if (completingTransmit_)
     {
-        completingTransmit_ = false;
-        
-        StopTransmitMessage message;
-        parent_->getTask()->publish(&message);
+        finishTransmit_();
     }
+
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    isStarved_ = true;
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+    return false;
 }
 
 void AudioState::onRightChannelVolumeMessage_(DVTask* origin, storage::RightChannelVolumeMessage* message)
 {
-    short calcResult = FIXED_POINT_AMPLIFICATION_FACTORS[message->volume - MIN_AMPLIFICATION_DB];
+    setTxVolume_(message->volume);
+}
 
-    for (int index = 0; index < 160; index++)
-    {
-        audioMultiplier_[index] = calcResult;
-    }
+void AudioState::setTxVolume_(int8_t volume)
+{
+    txGain_.setVolume(volume);
 }
 
+#if CONFIG_EZDV_TX_PREROLL
+void AudioState::onRequestTxMessage_(DVTask* origin, ezdv::audio::RequestTxMessage* message)
+{
+    // FreeDVTransmitTask starts encoding now; hold off sending until it's
+    // a little ahead of the radio.
+    txPreroll_.start(esp_timer_get_time());
+}
+#endif // CONFIG_EZDV_TX_PREROLL
+
 void AudioState::onTransmitCompleteMessage_(DVTask* origin, ezdv::audio::TransmitCompleteMessage* message)
 {
     // Set completingTransmit_ to true. This will let us know to send the CI-V command to stop
     // TX as soon as there's nothing left in the TX buffer.
     completingTransmit_ = true;
+
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    // If there isn't another packet's worth left, there's no need to wait 
+    // for the next tick to find that out.
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    auto inputFifo = task->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL);
+    if (inputFifo != nullptr && inputFifo->numUsed() < samplesPerPacket_)
+    {
+#if CONFIG_EZDV_TX_PREROLL
+        txPreroll_.cancel();
+#endif // CONFIG_EZDV_TX_PREROLL
+        finishTransmit_();
+    }
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+}
+
+void AudioState::finishTransmit_()
+{
+    completingTransmit_ = false;
+
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    // CIVState holds PTT until the radio has played what we sent.
+    StopTransmitMessage message(playoutEndTimeUs_);
+#else
+    StopTransmitMessage message;
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+    parent_->getTask()->publish(&message);
 }
 
 }
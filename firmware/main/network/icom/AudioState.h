@@ -18,10 +18,18 @@
 #ifndef AUDIO_STATE_H
 #define AUDIO_STATE_H
 
+#include "sdkconfig.h"
 #include "task/DVTimer.h"
 #include "TrackedPacketState.h"
+#include "IcomAudioJitterBuffer.h"
+#include "audio/AudioGain.h"
 #include "audio/FreeDVMessage.h"
+#include "audio/TxPreroll.h"
+#include "audio/VoiceKeyerMessage.h"
 #include "storage/SettingsMessage.h"
+#include "storage/SettingsSnapshot.h"
+#include "util/DeadlineMonitor.h"
+#include "util/PowerLock.h"
 
 namespace ezdv
 {
@@ -47,18 +55,46 @@ public:
 
     virtual void onReceivePacket(IcomPacket& packet) override;
 
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    /// @brief Called when at least a packet's worth of TX audio is queued.
+    void onAudioInputReady();
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+
 private:
     DVTimer audioOutTimer_;
     DVTimer audioWatchdogTimer_;
     uint16_t audioSequenceNumber_;
     bool completingTransmit_;
-    short audioMultiplier_[160]; // Q5.11 fixed point
+    uint16_t samplesPerPacket_;
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    int64_t playoutEndTimeUs_; // when the radio runs out of the audio we've sent
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    bool isStarved_; // the last tick had nothing to send
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+    util::PowerLock powerLock_;
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    util::DeadlineMonitor txDeadline_; // audioOutTimer_ cadence
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+    ezdv::audio::AudioGain txGain_;
+#if CONFIG_EZDV_TX_PREROLL
+    ezdv::audio::TxPreroll txPreroll_;
+#endif // CONFIG_EZDV_TX_PREROLL
+#if CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
+    IcomAudioJitterBuffer jitterBuffer_;
+#endif // CONFIG_EZDV_ICOM_AUDIO_JITTER_BUFFER
 
     void onAudioOutTimer_(DVTimer*);
+    bool sendAudio_(ezdv::audio::AudioRingBuffer* inputFifo);
+    void finishTransmit_();
     void onAudioWatchdog_(DVTimer*);
     
     void onRightChannelVolumeMessage_(DVTask* origin, storage::RightChannelVolumeMessage* message);
+    void setTxVolume_(int8_t volume);
     void onTransmitCompleteMessage_(DVTask* origin, ezdv::audio::TransmitCompleteMessage* message);
+#if CONFIG_EZDV_TX_PREROLL
+    void onRequestTxMessage_(DVTask* origin, ezdv::audio::RequestTxMessage* message);
+#endif // CONFIG_EZDV_TX_PREROLL
 };
 
 }
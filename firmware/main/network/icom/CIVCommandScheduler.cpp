@@ -0,0 +1,195 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "CIVCommandScheduler.h"
+
+// Offsets into a CI-V command (FE FE <to> <from> <cmd> [<subcmd>] ... FD).
+#define CIV_COMMAND_OFFSET (4)
+#define CIV_SUBCOMMAND_OFFSET (5)
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+CIVCommandScheduler::CIVCommandScheduler()
+{
+    reset();
+    getStatistics(stats_, true);
+}
+
+void CIVCommandScheduler::reset()
+{
+    for (auto& entry : entries_)
+    {
+        entry.valid = false;
+    }
+
+    nextOrder_ = 0;
+    isWaitingForResponse_ = false;
+}
+
+bool CIVCommandScheduler::enqueue(const uint8_t* command, uint16_t length, Priority priority)
+{
+    assert(command != nullptr);
+    assert(length > CIV_COMMAND_OFFSET && length <= MAX_COMMAND_SIZE);
+    assert(priority >= 0 && priority < NUM_PRIORITIES);
+
+    uint16_t key = GetKey_(command, length);
+    Entry* freeEntry = nullptr;
+
+    for (auto& entry : entries_)
+    {
+        if (entry.valid && entry.key == key)
+        {
+            // Same request is still waiting to go out; the newer one 
+            // supersedes it but keeps its place in line (unless it's 
+            // now more urgent).
+            memcpy(entry.command.data, command, length);
+            entry.command.length = length;
+            if (priority < entry.priority)
+            {
+                entry.priority = priority;
+            }
+
+            stats_.numCoalesced++;
+            return true;
+        }
+        else if (!entry.valid && freeEntry == nullptr)
+        {
+            freeEntry = &entry;
+        }
+    }
+
+    if (freeEntry == nullptr)
+    {
+        stats_.numDropped++;
+        return false;
+    }
+
+    freeEntry->valid = true;
+    freeEntry->priority = priority;
+    freeEntry->order = nextOrder_++;
+    freeEntry->key = key;
+    memcpy(freeEntry->command.data, command, length);
+    freeEntry->command.length = length;
+
+    stats_.numQueued++;
+    return true;
+}
+
+const CIVCommandScheduler::Command* CIVCommandScheduler::next()
+{
+    if (isWaitingForResponse_)
+    {
+        return nullptr;
+    }
+
+    // Highest priority first, then oldest.
+    Entry* best = nullptr;
+    for (auto& entry : entries_)
+    {
+        if (!entry.valid)
+        {
+            continue;
+        }
+
+        if (best == nullptr ||
+            entry.priority < best->priority ||
+            (entry.priority == best->priority && (int32_t)(entry.order - best->order) < 0))
+        {
+            best = &entry;
+        }
+    }
+
+    if (best == nullptr)
+    {
+        return nullptr;
+    }
+
+    current_ = best->command;
+    best->valid = false;
+    isWaitingForResponse_ = true;
+
+    return &current_;
+}
+
+void CIVCommandScheduler::complete(bool timedOut)
+{
+    if (isWaitingForResponse_ && timedOut)
+    {
+        stats_.numTimeouts++;
+    }
+
+    isWaitingForResponse_ = false;
+}
+
+bool CIVCommandScheduler::isWaitingForResponse() const
+{
+    return isWaitingForResponse_;
+}
+
+void CIVCommandScheduler::getStatistics(Statistics& stats, bool reset)
+{
+    stats = stats_;
+
+    if (reset)
+    {
+        memset(&stats_, 0, sizeof(stats_));
+    }
+}
+
+uint16_t CIVCommandScheduler::GetKey_(const uint8_t* command, uint16_t length)
+{
+    uint8_t cmd = command[CIV_COMMAND_OFFSET];
+    uint8_t subcmd = 0;
+
+    // Only some commands take a subcommand; for the rest, the byte after 
+    // the command is data (e.g. the frequency) and shouldn't make it a 
+    // different request.
+    switch (cmd)
+    {
+        case 0x14: // levels
+        case 0x15: // meters
+        case 0x16: // functions
+        case 0x19: // radio ID
+        case 0x1A: // misc. settings
+        case 0x1C: // PTT/tuner
+            if (length > CIV_SUBCOMMAND_OFFSET + 1)
+            {
+                subcmd = command[CIV_SUBCOMMAND_OFFSET];
+            }
+            break;
+        default:
+            break;
+    }
+
+    return ((uint16_t)cmd << 8) | subcmd;
+}
+
+}
+
+}
+
+}
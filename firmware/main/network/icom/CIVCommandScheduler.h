@@ -0,0 +1,120 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CIV_COMMAND_SCHEDULER_H
+#define CIV_COMMAND_SCHEDULER_H
+
+#include <cinttypes>
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+/// @brief Orders CI-V commands going to the radio so that only one is 
+///        outstanding at a time. Higher priority commands (e.g. PTT) jump 
+///        ahead of everything else and a command that's already queued is 
+///        replaced by a newer one with the same command/subcommand instead
+///        of being sent twice. Only used from CIVState.
+class CIVCommandScheduler
+{
+public:
+    enum Priority
+    {
+        PRIORITY_HIGH = 0,
+        PRIORITY_NORMAL = 1,
+        NUM_PRIORITIES
+    };
+
+    enum { MAX_COMMAND_SIZE = 16 };
+
+    struct Command
+    {
+        uint8_t data[MAX_COMMAND_SIZE];
+        uint16_t length;
+    };
+
+    struct Statistics
+    {
+        uint32_t numQueued;
+        uint32_t numCoalesced; // replaced a command that hadn't been sent yet
+        uint32_t numDropped; // queue was full
+        uint32_t numTimeouts; // radio never responded
+    };
+
+    CIVCommandScheduler();
+    virtual ~CIVCommandScheduler() = default;
+
+    /// @brief Forgets all queued commands and any outstanding one.
+    void reset();
+
+    /// @brief Queues a command to send to the radio.
+    /// @param command The full CI-V command (including preamble and terminator).
+    /// @param length The length of the command.
+    /// @param priority The priority of the command.
+    /// @return false if the queue is full and the command was dropped.
+    bool enqueue(const uint8_t* command, uint16_t length, Priority priority);
+
+    /// @brief Returns the next command to send and marks it outstanding.
+    /// @return The command, or nullptr if there's nothing to send or a command
+    ///         is still waiting for a response.
+    const Command* next();
+
+    /// @brief Marks the outstanding command as done.
+    /// @param timedOut True if the radio never responded.
+    void complete(bool timedOut);
+
+    /// @brief Returns whether a command is waiting for a response from the radio.
+    bool isWaitingForResponse() const;
+
+    /// @brief Retrieves the statistics gathered so far.
+    /// @param stats Structure to store the statistics in.
+    /// @param reset If true, counters start over.
+    void getStatistics(Statistics& stats, bool reset = false);
+
+private:
+    enum { MAX_QUEUED_COMMANDS = 8 };
+
+    struct Entry
+    {
+        bool valid;
+        Priority priority;
+        uint32_t order;
+        uint16_t key;
+        Command command;
+    };
+
+    Entry entries_[MAX_QUEUED_COMMANDS];
+    uint32_t nextOrder_;
+    bool isWaitingForResponse_;
+    Command current_;
+    Statistics stats_;
+
+    static uint16_t GetKey_(const uint8_t* command, uint16_t length);
+};
+
+}
+
+}
+
+}
+
+#endif // CIV_COMMAND_SCHEDULER_H
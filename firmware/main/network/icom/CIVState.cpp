@@ -16,10 +16,15 @@
  */
 
 #include <functional>
+#include "esp_timer.h"
 #include "CIVState.h"
 #include "IcomStateMachine.h"
 #include "network/ReportingMessage.h"
 
+// How long to wait for the radio to respond to a CI-V command before 
+// sending the next one anyway.
+#define CIV_COMMAND_TIMEOUT_MS (100)
+
 namespace ezdv
 {
 
@@ -32,12 +37,31 @@ namespace icom
 CIVState::CIVState(IcomStateMachine* parent)
     : TrackedPacketState(parent)
     , civWatchdogTimer_(parent_->getTask(), this, &CIVState::onCIVWatchdog_, MS_TO_US(WATCHDOG_PERIOD), "IcomCivWatchdog")
+    , commandTimeoutTimer_(parent_->getTask(), this, &CIVState::onCommandTimeout_, MS_TO_US(CIV_COMMAND_TIMEOUT_MS), "IcomCivCommandTimeout")
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    , pttOffTimer_(parent_->getTask(), this, &CIVState::onPttOffTimer_, MS_TO_US(AUDIO_PERIOD), "IcomCivPttOff") // interval set for each transmission
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
     , civSequenceNumber_(0)
     , civId_(0)
     , currentPttState_(false)
 {
-    parent_->getTask()->registerMessageHandler(this, &CIVState::onFreeDVSetPTTStateMessage_);
-    parent_->getTask()->registerMessageHandler(this, &CIVState::onStopTransmitMessage_);
+    civWatchdogTimer_.useTimerWheel();
+    commandTimeoutTimer_.useTimerWheel();
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    // Every millisecond of this is dead air, so it doesn't wait behind 
+    // other messages.
+    pttOffTimer_.enableDirectDispatch();
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+
+    radioState_.frequencyHz = 0;
+    radioState_.mode = IcomRadioStateMessage::MODE_UNKNOWN;
+    radioState_.filter = 0;
+    radioState_.isTransmitting = false;
+
+    parent_->getTask()->registerMessageHandlers<
+        &CIVState::onFreeDVSetPTTStateMessage_,
+        &CIVState::onStopTransmitMessage_,
+        &CIVState::onRequestIcomRadioStateMessage_>(this);
 }
 
 void CIVState::onEnterState()
@@ -47,6 +71,14 @@ void CIVState::onEnterState()
     // Initialize state
     civSequenceNumber_ = 0;
     civId_ = 0;
+    commandScheduler_.reset();
+
+    // Whatever we knew about the radio may have changed while we were
+    // disconnected.
+    radioState_.frequencyHz = 0;
+    radioState_.mode = IcomRadioStateMessage::MODE_UNKNOWN;
+    radioState_.filter = 0;
+    radioState_.isTransmitting = false;
     
     sendCIVOpenPacket_();
     
@@ -61,7 +93,7 @@ void CIVState::onEnterState()
         0xFD
     };
 
-    sendCIVPacket_(civPacket, sizeof(civPacket));
+    queueCIVCommand_(civPacket, sizeof(civPacket), CIVCommandScheduler::PRIORITY_NORMAL);
 }
 
 void CIVState::onExitState()
@@ -69,6 +101,18 @@ void CIVState::onExitState()
     civId_ = 0;
     
     civWatchdogTimer_.stop();
+    commandTimeoutTimer_.stop();
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    pttOffTimer_.stop();
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+
+    CIVCommandScheduler::Statistics stats;
+    commandScheduler_.getStatistics(stats, true);
+    ESP_LOGI(
+        parent_->getName().c_str(), 
+        "CI-V commands: %" PRIu32 " queued, %" PRIu32 " coalesced, %" PRIu32 " dropped, %" PRIu32 " timed out",
+        stats.numQueued, stats.numCoalesced, stats.numDropped, stats.numTimeouts);
+    commandScheduler_.reset();
 
     // Send CIV close packet before performing general close processing.
     sendCIVClosePacket_();
@@ -98,8 +142,8 @@ void CIVState::onReceivePacket(IcomPacket& packet)
             civId_ = civPacket[3];
 
             // Once we've retrieved the CIV ID, we should retrieve the current frequency
-            // for Reporter support.
-            uint8_t civPacket[] = {
+            // and mode for Reporter support.
+            uint8_t civFreqPacket[] = {
                 0xFE,
                 0xFE,
                 civId_,
@@ -108,49 +152,35 @@ void CIVState::onReceivePacket(IcomPacket& packet)
                 0xFD
             };
 
-            sendCIVPacket_(civPacket, sizeof(civPacket));
-            
-            // We should also reset the PTT state in case we lost connection during a state
-            // change.
-            ESP_LOGI(parent_->getName().c_str(), "Sending PTT CIV message (PTT = %d)", currentPttState_ ? 1 : 0);
-        
-            uint8_t civPttPacket[] = {
+            queueCIVCommand_(civFreqPacket, sizeof(civFreqPacket), CIVCommandScheduler::PRIORITY_NORMAL);
+
+            uint8_t civModePacket[] = {
                 0xFE,
                 0xFE,
                 civId_,
                 0xE0,
-                0x1C, // PTT on/off command/subcommand
-                0x00,
-                (uint8_t)(currentPttState_ ? 0x01 : 0x00), // enable PTT
+                0x04, // Request mode
                 0xFD
             };
-        
-            sendCIVPacket_(civPttPacket, sizeof(civPttPacket));
+
+            queueCIVCommand_(civModePacket, sizeof(civModePacket), CIVCommandScheduler::PRIORITY_NORMAL);
+            
+            // We should also reset the PTT state in case we lost connection during a state
+            // change.
+            queuePttCommand_(currentPttState_);
         }
         else if (civPacket[3] == civId_)
         {
-            if (civPacket[4] == 0x00 || civPacket[4] == 0x03)
-            {
-                // Get frequency data for future FreeDV Reporter support -- TBD
-                // Frequency data is BCD and starts from index 5.
-                uint64_t freqHz = 
-                    (civPacket[5] & 0x0F) +                        // 1 Hz
-                    ((civPacket[5] & 0xF0) >> 4) * 10           +  // 10 Hz
-                    (civPacket[6] & 0x0F) * 100                 +  // 100 Hz
-                    ((civPacket[6] & 0xF0) >> 4) * 1000         +  // 1 KHz
-                    (civPacket[7] & 0x0F) * 10000               +  // 10 KHz
-                    ((civPacket[7] & 0xF0) >> 4) * 100000       +  // 100 KHz
-                    (civPacket[8] & 0x0F) * 1000000             +  // 1 MHz
-                    ((civPacket[8] & 0xF0) >> 4) * 10000000     +  // 10 MHz
-                    (civPacket[9] & 0x0F) * 100000000           +  // 100 MHz
-                    ((civPacket[9] & 0xF0) >> 4) * 1000000000;     // 1 GHz
-
-                ESP_LOGI(parent_->getName().c_str(), "Radio frequency changed to %" PRIu64 " Hz", freqHz);
-
-                // Report frequency change to reporters
-                ReportFrequencyChangeMessage message(freqHz);
-                parent_->getTask()->publish(&message);
-            }
+            updateRadioState_(civPacket, civLength);
+        }
+
+        // Anything sent directly to us is the response to the outstanding 
+        // command (broadcasts, e.g. frequency changes, go to 00).
+        if (civPacket[2] == 0xE0 && commandScheduler_.isWaitingForResponse())
+        {
+            commandTimeoutTimer_.stop();
+            commandScheduler_.complete(false);
+            sendNextCIVCommand_();
         }
     }
 
@@ -164,6 +194,13 @@ void CIVState::onCIVWatchdog_(DVTimer*)
     parent_->transitionState(IcomProtocolState::ARE_YOU_THERE);
 }
 
+void CIVState::onCommandTimeout_(DVTimer*)
+{
+    ESP_LOGW(parent_->getName().c_str(), "No response to CI-V command, sending next one");
+    commandScheduler_.complete(true);
+    sendNextCIVCommand_();
+}
+
 void CIVState::sendCIVOpenPacket_()
 {
     ESP_LOGI(parent_->getName().c_str(), "Sending CIV open packet");
@@ -178,14 +215,126 @@ void CIVState::sendCIVClosePacket_()
     sendTracked_(packet);
 }
 
-void CIVState::sendCIVPacket_(uint8_t* civPacket, uint16_t civLength)
+void CIVState::sendCIVPacket_(const uint8_t* civPacket, uint16_t civLength)
 {
     ESP_LOGI(parent_->getName().c_str(), "Sending CIV data packet");
-    auto packet = IcomPacket::CreateCIVPacket(parent_->getOurIdentifier(), parent_->getTheirIdentifier(), civSequenceNumber_++, civPacket, civLength);
+    auto packet = IcomPacket::CreateCIVPacket(parent_->getOurIdentifier(), parent_->getTheirIdentifier(), civSequenceNumber_++, const_cast<uint8_t*>(civPacket), civLength);
     sendTracked_(packet);
     
-    civWatchdogTimer_.stop();
-    civWatchdogTimer_.start();
+    civWatchdogTimer_.restart();
+}
+
+void CIVState::queueCIVCommand_(const uint8_t* civPacket, uint16_t civLength, CIVCommandScheduler::Priority priority)
+{
+    if (!commandScheduler_.enqueue(civPacket, civLength, priority))
+    {
+        ESP_LOGW(parent_->getName().c_str(), "CI-V command queue full, dropping command %02x", civPacket[4]);
+        return;
+    }
+
+    sendNextCIVCommand_();
+}
+
+void CIVState::queuePttCommand_(bool pttState)
+{
+    ESP_LOGI(parent_->getName().c_str(), "Sending PTT CIV message (PTT = %d)", pttState ? 1 : 0);
+
+    uint8_t civPacket[] = {
+        0xFE,
+        0xFE,
+        civId_,
+        0xE0,
+        0x1C, // PTT on/off command/subcommand
+        0x00,
+        (uint8_t)(pttState ? 0x01 : 0x00), // enable/disable PTT
+        0xFD
+    };
+
+    // PTT goes ahead of any polling so that TX starts and stops on time.
+    queueCIVCommand_(civPacket, sizeof(civPacket), CIVCommandScheduler::PRIORITY_HIGH);
+}
+
+void CIVState::sendNextCIVCommand_()
+{
+    auto command = commandScheduler_.next();
+    if (command != nullptr)
+    {
+        sendCIVPacket_(command->data, command->length);
+        commandTimeoutTimer_.start();
+    }
+}
+
+void CIVState::updateRadioState_(const uint8_t* civPacket, uint16_t civLength)
+{
+    // Frequency, mode etc. start from index 5 and are followed by FD.
+    bool changed = false;
+
+    if ((civPacket[4] == 0x00 || civPacket[4] == 0x03) && civLength >= 11)
+    {
+        // Frequency data is BCD and starts from index 5.
+        uint64_t freqHz = 
+            (civPacket[5] & 0x0F) +                        // 1 Hz
+            ((civPacket[5] & 0xF0) >> 4) * 10           +  // 10 Hz
+            (civPacket[6] & 0x0F) * 100                 +  // 100 Hz
+            ((civPacket[6] & 0xF0) >> 4) * 1000         +  // 1 KHz
+            (civPacket[7] & 0x0F) * 10000               +  // 10 KHz
+            ((civPacket[7] & 0xF0) >> 4) * 100000       +  // 100 KHz
+            (civPacket[8] & 0x0F) * 1000000             +  // 1 MHz
+            ((civPacket[8] & 0xF0) >> 4) * 10000000     +  // 10 MHz
+            (civPacket[9] & 0x0F) * 100000000           +  // 100 MHz
+            ((civPacket[9] & 0xF0) >> 4) * 1000000000;     // 1 GHz
+
+        if (freqHz != radioState_.frequencyHz)
+        {
+            ESP_LOGI(parent_->getName().c_str(), "Radio frequency changed to %" PRIu64 " Hz", freqHz);
+            radioState_.frequencyHz = freqHz;
+            changed = true;
+
+            // Report frequency change to reporters
+            ReportFrequencyChangeMessage message(freqHz);
+            parent_->getTask()->publish(&message);
+        }
+    }
+    else if ((civPacket[4] == 0x01 || civPacket[4] == 0x04) && civLength >= 7)
+    {
+        uint8_t mode = civPacket[5];
+        uint8_t filter = (civLength >= 8) ? civPacket[6] : radioState_.filter;
+
+        if (mode != radioState_.mode || filter != radioState_.filter)
+        {
+            ESP_LOGI(parent_->getName().c_str(), "Radio mode changed to %02x (filter %d)", mode, filter);
+            radioState_.mode = mode;
+            radioState_.filter = filter;
+            changed = true;
+        }
+    }
+    else if (civPacket[4] == 0x1C && civPacket[5] == 0x00 && civLength >= 8)
+    {
+        bool isTransmitting = civPacket[6] != 0;
+        if (isTransmitting != radioState_.isTransmitting)
+        {
+            radioState_.isTransmitting = isTransmitting;
+            changed = true;
+        }
+    }
+    else if (civPacket[4] == 0xFB && civPacket[2] == 0xE0 && currentPttState_ != radioState_.isTransmitting)
+    {
+        // OK response; the only state-changing command we send is PTT, so
+        // if one was outstanding the radio has now switched.
+        radioState_.isTransmitting = currentPttState_;
+        changed = true;
+    }
+
+    if (changed)
+    {
+        publishRadioState_();
+    }
+}
+
+void CIVState::publishRadioState_()
+{
+    IcomRadioStateMessage message(radioState_.frequencyHz, radioState_.mode, radioState_.filter, radioState_.isTransmitting);
+    parent_->getTask()->publish(&message);
 }
 
 void CIVState::onFreeDVSetPTTStateMessage_(DVTask* origin, ezdv::audio::FreeDVSetPTTStateMessage* message)
@@ -193,45 +342,65 @@ void CIVState::onFreeDVSetPTTStateMessage_(DVTask* origin, ezdv::audio::FreeDVSe
     if (civId_ > 0 && message->pttState)
     {
         // This only handles the beginning of TX. Ending TX is handled by TransmitCompleteMessage.
-        ESP_LOGI(parent_->getName().c_str(), "Sending PTT CIV message (PTT = %d)", message->pttState);
-        
-        uint8_t civPacket[] = {
-            0xFE,
-            0xFE,
-            civId_,
-            0xE0,
-            0x1C, // PTT on/off command/subcommand
-            0x00,
-            (uint8_t)0x01, // enable PTT
-            0xFD
-        };
-        
-        sendCIVPacket_(civPacket, sizeof(civPacket));
-        
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+        // Keyed again before the last transmission's tail finished.
+        pttOffTimer_.stop();
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
         currentPttState_ = true;
+        queuePttCommand_(true);
     }
 }
 
 void CIVState::onStopTransmitMessage_(DVTask* origin, StopTransmitMessage* message)
+{
+    if (civId_ == 0)
+    {
+        return;
+    }
+
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    // Unkey right as the radio finishes playing the last packet (plus
+    // however long it buffers audio for) rather than whenever the audio
+    // and CI-V tasks next get around to it.
+    int64_t delayUs = message->playoutEndTimeUs + MS_TO_US((int64_t)CONFIG_EZDV_ICOM_PTT_TAIL_MS) - esp_timer_get_time();
+    if (message->playoutEndTimeUs > 0 && delayUs > 0)
+    {
+        pttOffTimer_.changeInterval(delayUs);
+        pttOffTimer_.restart(true);
+        return;
+    }
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+
+    stopTransmit_();
+}
+
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+void CIVState::onPttOffTimer_(DVTimer*)
 {
     if (civId_ > 0)
     {
-        ESP_LOGI(parent_->getName().c_str(), "Sending PTT CIV message (PTT = %d)", 0);
-        
-        uint8_t civPacket[] = {
-            0xFE,
-            0xFE,
-            civId_,
-            0xE0,
-            0x1C, // PTT on/off command/subcommand
-            0x00,
-            (uint8_t)0x00, // disable PTT
-            0xFD
-        };
-        
-        sendCIVPacket_(civPacket, sizeof(civPacket));
-        
-        currentPttState_ = false;
+        stopTransmit_();
+    }
+}
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+
+void CIVState::stopTransmit_()
+{
+    currentPttState_ = false;
+    queuePttCommand_(false);
+}
+
+void CIVState::onRequestIcomRadioStateMessage_(DVTask* origin, RequestIcomRadioStateMessage* message)
+{
+    // Answer from what we already know instead of asking the radio.
+    IcomRadioStateMessage response(radioState_.frequencyHz, radioState_.mode, radioState_.filter, radioState_.isTransmitting);
+    if (origin != nullptr)
+    {
+        parent_->getTask()->sendTo(origin, &response);
+    }
+    else
+    {
+        parent_->getTask()->publish(&response);
     }
 }
 
@@ -239,4 +408,4 @@ void CIVState::onStopTransmitMessage_(DVTask* origin, StopTransmitMessage* messa
 
 }
 
-}
\ No newline at end of file
+}
@@ -18,8 +18,10 @@
 #ifndef CIV_STATE_H
 #define CIV_STATE_H
 
+#include "sdkconfig.h"
 #include "TrackedPacketState.h"
 #include "IcomMessage.h"
+#include "CIVCommandScheduler.h"
 #include "audio/FreeDVMessage.h" // so we can listen for PTT requests
 
 namespace ezdv
@@ -47,16 +49,44 @@ public:
     virtual void onReceivePacket(IcomPacket& packet) override;
 
 private:
+    /// @brief Last known radio state, as reported by the radio.
+    struct RadioState
+    {
+        uint64_t frequencyHz;
+        uint8_t mode;
+        uint8_t filter;
+        bool isTransmitting;
+    };
+
     DVTimer civWatchdogTimer_;
+    DVTimer commandTimeoutTimer_;
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    DVTimer pttOffTimer_; // drops PTT once the radio has played the last TX audio
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+    CIVCommandScheduler commandScheduler_;
     uint16_t civSequenceNumber_;
     uint8_t civId_;
     bool currentPttState_;
+    RadioState radioState_;
     
     void sendCIVOpenPacket_();
     void sendCIVClosePacket_();
-    void sendCIVPacket_(uint8_t* packet, uint16_t size);
+    void sendCIVPacket_(const uint8_t* packet, uint16_t size);
+
+    void queueCIVCommand_(const uint8_t* packet, uint16_t size, CIVCommandScheduler::Priority priority);
+    void queuePttCommand_(bool pttState);
+    void sendNextCIVCommand_();
+
+    void updateRadioState_(const uint8_t* civPacket, uint16_t civLength);
+    void publishRadioState_();
 
     void onCIVWatchdog_(DVTimer*);
+    void onCommandTimeout_(DVTimer*);
+#if CONFIG_EZDV_ICOM_TX_SEQUENCER
+    void onPttOffTimer_(DVTimer*);
+#endif // CONFIG_EZDV_ICOM_TX_SEQUENCER
+    void stopTransmit_();
+    void onRequestIcomRadioStateMessage_(DVTask* origin, RequestIcomRadioStateMessage* message);
     void onFreeDVSetPTTStateMessage_(DVTask* origin, ezdv::audio::FreeDVSetPTTStateMessage* message);
     void onStopTransmitMessage_(DVTask* origin, StopTransmitMessage* message);
 };
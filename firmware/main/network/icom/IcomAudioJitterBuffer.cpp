@@ -0,0 +1,182 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "IcomAudioJitterBuffer.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+IcomAudioJitterBuffer::IcomAudioJitterBuffer(uint32_t delayPackets)
+    : delayPackets_(delayPackets)
+    , isActive_(false)
+    , nextPlayoutSeq_(0)
+    , highestSeq_(0)
+    , lastPacketSamples_(0)
+{
+    assert(delayPackets_ > 0 && delayPackets_ < MAX_DEPTH_PACKETS);
+
+    for (auto& slot : slots_)
+    {
+        slot.valid = false;
+        slot.audioSeq = 0;
+    }
+
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void IcomAudioJitterBuffer::reset()
+{
+    for (auto& slot : slots_)
+    {
+        slot.valid = false;
+        slot.packet = IcomPacket();
+    }
+
+    isActive_ = false;
+}
+
+void IcomAudioJitterBuffer::packetReceived(IcomPacket& packet, uint16_t audioSeq, audio::AudioRingBuffer* output)
+{
+    if (!isActive_)
+    {
+        isActive_ = true;
+        nextPlayoutSeq_ = audioSeq;
+        highestSeq_ = audioSeq;
+    }
+
+    int16_t ahead = (int16_t)(audioSeq - nextPlayoutSeq_);
+    if (ahead < 0)
+    {
+        // Too late, we've moved past this one already.
+        stats_.numLatePackets++;
+        return;
+    }
+    else if (ahead >= MAX_DEPTH_PACKETS)
+    {
+        // Too far ahead to be the same stream (e.g. the radio restarted
+        // or we lost a lot of packets). Play what we have and start over.
+        playoutAll_(output);
+        nextPlayoutSeq_ = audioSeq;
+        highestSeq_ = audioSeq;
+        stats_.numResets++;
+    }
+
+    Slot& slot = slots_[audioSeq & (MAX_DEPTH_PACKETS - 1)];
+    if (slot.valid && slot.audioSeq == audioSeq)
+    {
+        stats_.numDuplicatePackets++;
+        return;
+    }
+
+    slot.valid = true;
+    slot.audioSeq = audioSeq;
+    slot.packet = packet.share();
+    stats_.numPackets++;
+
+    if ((int16_t)(audioSeq - highestSeq_) > 0)
+    {
+        highestSeq_ = audioSeq;
+    }
+    else if (audioSeq != highestSeq_)
+    {
+        stats_.numReorderedPackets++;
+    }
+
+    // Send out everything that's been held long enough.
+    while ((int16_t)(highestSeq_ - nextPlayoutSeq_) >= (int16_t)delayPackets_)
+    {
+        playout_(output);
+    }
+}
+
+void IcomAudioJitterBuffer::getStatistics(Statistics& stats, bool reset)
+{
+    stats = stats_;
+
+    if (reset)
+    {
+        memset(&stats_, 0, sizeof(stats_));
+    }
+}
+
+void IcomAudioJitterBuffer::playout_(audio::AudioRingBuffer* output)
+{
+    Slot& slot = slots_[nextPlayoutSeq_ & (MAX_DEPTH_PACKETS - 1)];
+    if (slot.valid && slot.audioSeq == nextPlayoutSeq_)
+    {
+        uint16_t audioSeq;
+        short* audioData;
+        if (slot.packet.isAudioPacket(audioSeq, &audioData))
+        {
+            lastPacketSamples_ = (slot.packet.getSendLength() - 0x18) / sizeof(short);
+            if (output != nullptr)
+            {
+                output->write(audioData, lastPacketSamples_);
+            }
+        }
+
+        slot.valid = false;
+        slot.packet = IcomPacket();
+    }
+    else if (lastPacketSamples_ > 0)
+    {
+        // Never arrived; keep FreeDV in step with silence.
+        stats_.numConcealedPackets++;
+        if (output != nullptr)
+        {
+            auto span = output->acquireWrite(lastPacketSamples_);
+            if (span.size() > 0)
+            {
+                memset(span.first, 0, span.firstLength * sizeof(short));
+                if (span.second != nullptr)
+                {
+                    memset(span.second, 0, span.secondLength * sizeof(short));
+                }
+                output->commitWrite(span.size());
+            }
+            else
+            {
+                output->reportOverrun(lastPacketSamples_);
+            }
+        }
+    }
+
+    nextPlayoutSeq_++;
+}
+
+void IcomAudioJitterBuffer::playoutAll_(audio::AudioRingBuffer* output)
+{
+    while ((int16_t)(highestSeq_ - nextPlayoutSeq_) >= 0)
+    {
+        playout_(output);
+    }
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,101 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ICOM_AUDIO_JITTER_BUFFER_H
+#define ICOM_AUDIO_JITTER_BUFFER_H
+
+#include <cinttypes>
+
+#include "audio/AudioRingBuffer.h"
+#include "IcomPacket.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+/// @brief Holds received Icom audio packets back by a fixed number of packets
+///        so that ones arriving out of order (including retransmissions of 
+///        lost packets) can be played in sequence. Packets that still haven't
+///        arrived by the time they're due are replaced with silence. Playout 
+///        is driven by arrivals, so the radio's clock sets the pace. Only used
+///        from AudioState.
+class IcomAudioJitterBuffer
+{
+public:
+    struct Statistics
+    {
+        uint32_t numPackets;
+        uint32_t numReorderedPackets; // arrived after a later packet but still in time
+        uint32_t numLatePackets; // arrived after being played out (or concealed); discarded
+        uint32_t numDuplicatePackets;
+        uint32_t numConcealedPackets;
+        uint32_t numResets;
+    };
+
+    /// @brief Creates a new jitter buffer.
+    /// @param delayPackets The number of packets to hold back.
+    IcomAudioJitterBuffer(uint32_t delayPackets);
+    virtual ~IcomAudioJitterBuffer() = default;
+
+    /// @brief Forgets the current stream and releases any packets held.
+    void reset();
+
+    /// @brief Queues a received audio packet and sends any audio now due to the given FIFO.
+    /// @param packet The received packet.
+    /// @param audioSeq The packet's audio sequence number.
+    /// @param output Where to send audio (nullptr to discard it).
+    void packetReceived(IcomPacket& packet, uint16_t audioSeq, audio::AudioRingBuffer* output);
+
+    /// @brief Retrieves the statistics gathered so far.
+    /// @param stats Structure to store the statistics in.
+    /// @param reset If true, counters start over.
+    void getStatistics(Statistics& stats, bool reset = false);
+
+private:
+    enum { MAX_DEPTH_PACKETS = 16 };
+
+    struct Slot
+    {
+        bool valid;
+        uint16_t audioSeq;
+        IcomPacket packet;
+    };
+
+    Slot slots_[MAX_DEPTH_PACKETS];
+    uint32_t delayPackets_;
+    bool isActive_;
+    uint16_t nextPlayoutSeq_;
+    uint16_t highestSeq_;
+    int lastPacketSamples_;
+    Statistics stats_;
+
+    void playout_(audio::AudioRingBuffer* output);
+    void playoutAll_(audio::AudioRingBuffer* output);
+};
+
+}
+
+}
+
+}
+
+#endif // ICOM_AUDIO_JITTER_BUFFER_H
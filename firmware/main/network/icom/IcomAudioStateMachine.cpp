@@ -41,6 +41,21 @@ std::string IcomAudioStateMachine::getName_()
 {
     return "IcomAudio";
 }
+
+NetworkQos::StreamType IcomAudioStateMachine::getQosStreamType()
+{
+    return NetworkQos::ICOM_AUDIO;
+}
+
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+void IcomAudioStateMachine::onAudioInputReady()
+{
+    if (getCurrentState() == &audioState_)
+    {
+        audioState_.onAudioInputReady();
+    }
+}
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
     
 }
 
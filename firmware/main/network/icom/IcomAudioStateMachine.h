@@ -38,6 +38,13 @@ class IcomAudioStateMachine : public IcomStateMachine
 public:
     IcomAudioStateMachine(DVTask* owner);
     virtual ~IcomAudioStateMachine() = default;
+
+    virtual NetworkQos::StreamType getQosStreamType() override;
+
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+    /// @brief Called when at least a packet's worth of TX audio is queued.
+    void onAudioInputReady();
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
     
 protected:
     virtual std::string getName_() override;
@@ -41,6 +41,11 @@ std::string IcomCIVStateMachine::getName_()
 {
     return "IcomCIV";
 }
+
+NetworkQos::StreamType IcomCIVStateMachine::getQosStreamType()
+{
+    return NetworkQos::ICOM_CIV;
+}
     
 }
 
@@ -39,6 +39,8 @@ public:
     IcomCIVStateMachine(DVTask* owner);
     virtual ~IcomCIVStateMachine() = default;
 
+    virtual NetworkQos::StreamType getQosStreamType() override;
+
 protected:
     virtual std::string getName_() override;
     
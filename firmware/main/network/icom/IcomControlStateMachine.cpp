@@ -41,6 +41,11 @@ std::string IcomControlStateMachine::getName_()
 {
     return "IcomControl";
 }
+
+NetworkQos::StreamType IcomControlStateMachine::getQosStreamType()
+{
+    return NetworkQos::ICOM_CONTROL;
+}
     
 }
 
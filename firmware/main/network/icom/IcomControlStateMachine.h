@@ -39,6 +39,8 @@ public:
     IcomControlStateMachine(DVTask* owner);
     virtual ~IcomControlStateMachine() = default;
 
+    virtual NetworkQos::StreamType getQosStreamType() override;
+
 protected:
     virtual std::string getName_() override;
     
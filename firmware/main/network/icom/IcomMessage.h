@@ -38,17 +38,19 @@ namespace icom
 
 using namespace ezdv::task;
 
-class IcomPacket;
+struct IcomPacketBuffer;
+class IcomStateMachine;
 
 enum IcomMessageTypes
 {
     CIV_AUDIO_CONN_INFO = 1,
     CONNECT_RADIO = 2,
     DISCONNECTED_RADIO = 3,
-    SEND_PACKET = 4,
     RECEIVE_PACKET = 5,
     CLOSE_SOCKET = 6,
     STOP_TRANSMIT = 7,
+    RADIO_STATE = 8,
+    REQUEST_RADIO_STATE = 9,
 };
 
 class IcomCIVAudioConnectionInfo : public DVTaskMessageBase<CIV_AUDIO_CONN_INFO, IcomCIVAudioConnectionInfo>
@@ -58,12 +60,14 @@ public:
         int localCivPortProvided = 0, 
         int remoteCivPortProvided = 0, 
         int localAudioPortProvided = 0, 
-        int remoteAudioPortProvided = 0)
+        int remoteAudioPortProvided = 0,
+        uint32_t audioSampleRateProvided = 8000)
         : DVTaskMessageBase<CIV_AUDIO_CONN_INFO, IcomCIVAudioConnectionInfo>(ICOM_MESSAGE)
         , localCivPort(localCivPortProvided)
         , remoteCivPort(remoteCivPortProvided)
         , localAudioPort(localAudioPortProvided)
         , remoteAudioPort(remoteAudioPortProvided)
+        , audioSampleRate(audioSampleRateProvided)
         {}
     virtual ~IcomCIVAudioConnectionInfo() = default;
 
@@ -71,6 +75,7 @@ public:
     int remoteCivPort;
     int localAudioPort;
     int remoteAudioPort; 
+    uint32_t audioSampleRate; // RX and TX
 };
 
 class IcomConnectRadioMessage : public DVTaskMessageBase<CONNECT_RADIO, IcomConnectRadioMessage>
@@ -120,54 +125,83 @@ public:
 class DisconnectedRadioMessage : public DVTaskMessageBase<DISCONNECTED_RADIO, DisconnectedRadioMessage>
 {
 public:
-    DisconnectedRadioMessage()
+    DisconnectedRadioMessage(IcomStateMachine* machineProvided = nullptr)
         : DVTaskMessageBase<DISCONNECTED_RADIO, DisconnectedRadioMessage>(ICOM_MESSAGE)
+        , machine(machineProvided)
         {}
     virtual ~DisconnectedRadioMessage() = default;
-};
-
-class SendPacketMessage : public DVTaskMessageBase<SEND_PACKET, SendPacketMessage>
-{
-public:
-    SendPacketMessage(IcomPacket* packetProvided = nullptr)
-        : DVTaskMessageBase<SEND_PACKET, SendPacketMessage>(ICOM_MESSAGE)
-        , packet(packetProvided)
-        , sendTime(esp_timer_get_time())
-        {}
-    virtual ~SendPacketMessage() = default;
 
-    IcomPacket* packet;
-    int64_t sendTime;
+    IcomStateMachine* machine; // the one that disconnected
 };
 
 class ReceivePacketMessage : public DVTaskMessageBase<RECEIVE_PACKET, ReceivePacketMessage>
 {
 public:
-    ReceivePacketMessage(IcomPacket* packetProvided = nullptr)
+    ReceivePacketMessage(IcomStateMachine* machineProvided = nullptr, IcomPacketBuffer* packetProvided = nullptr)
         : DVTaskMessageBase<RECEIVE_PACKET, ReceivePacketMessage>(ICOM_MESSAGE)
+        , machine(machineProvided)
         , packet(packetProvided)
         {}
     virtual ~ReceivePacketMessage() = default;
 
-    IcomPacket* packet;
+    IcomStateMachine* machine; // may share its task with other machines
+    IcomPacketBuffer* packet; // reference owned by the message
 };
 
 class CloseSocketMessage : public DVTaskMessageBase<CLOSE_SOCKET, CloseSocketMessage>
 {
 public:
-    CloseSocketMessage()
+    CloseSocketMessage(IcomStateMachine* machineProvided = nullptr)
         : DVTaskMessageBase<CLOSE_SOCKET, CloseSocketMessage>(ICOM_MESSAGE)
+        , machine(machineProvided)
         {}
     virtual ~CloseSocketMessage() = default;
+
+    IcomStateMachine* machine;
 };
 
+/// @brief Sent once the last TX audio packet has gone out to the radio.
 class StopTransmitMessage : public DVTaskMessageBase<STOP_TRANSMIT, StopTransmitMessage>
 {
 public:
-    StopTransmitMessage()
+    StopTransmitMessage(int64_t playoutEndTimeUsProvided = 0)
         : DVTaskMessageBase<STOP_TRANSMIT, StopTransmitMessage>(ICOM_MESSAGE)
+        , playoutEndTimeUs(playoutEndTimeUsProvided)
         {}
     virtual ~StopTransmitMessage() = default;
+
+    int64_t playoutEndTimeUs; // esp_timer time the last audio finishes playing (0 = unknown)
+};
+
+/// @brief Last known state of the radio as reported over CI-V. Published 
+///        whenever something changes and in response to RequestIcomRadioStateMessage.
+class IcomRadioStateMessage : public DVTaskMessageBase<RADIO_STATE, IcomRadioStateMessage>
+{
+public:
+    static const uint8_t MODE_UNKNOWN = 0xFF;
+
+    IcomRadioStateMessage(uint64_t frequencyHzProvided = 0, uint8_t modeProvided = MODE_UNKNOWN, uint8_t filterProvided = 0, bool isTransmittingProvided = false)
+        : DVTaskMessageBase<RADIO_STATE, IcomRadioStateMessage>(ICOM_MESSAGE)
+        , frequencyHz(frequencyHzProvided)
+        , mode(modeProvided)
+        , filter(filterProvided)
+        , isTransmitting(isTransmittingProvided)
+        {}
+    virtual ~IcomRadioStateMessage() = default;
+
+    uint64_t frequencyHz; // 0 if not known yet
+    uint8_t mode; // CI-V operating mode
+    uint8_t filter;
+    bool isTransmitting;
+};
+
+class RequestIcomRadioStateMessage : public DVTaskMessageBase<REQUEST_RADIO_STATE, RequestIcomRadioStateMessage>
+{
+public:
+    RequestIcomRadioStateMessage()
+        : DVTaskMessageBase<REQUEST_RADIO_STATE, RequestIcomRadioStateMessage>(ICOM_MESSAGE)
+        {}
+    virtual ~RequestIcomRadioStateMessage() = default;
 };
 
 }
@@ -15,8 +15,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "esp_heap_caps.h"
-
+#include <cassert>
 #include <random>
 #include <cstring>
 #include "IcomPacket.h"
@@ -30,58 +29,76 @@ namespace network
 namespace icom
 {
 
-void* IcomPacket::operator new(std::size_t count)
-{
-    return heap_caps_malloc(sizeof(IcomPacket)*count, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-}
-
-void IcomPacket::operator delete(void* ptr)
-{
-    heap_caps_free(ptr);
-}
-
 IcomPacket::IcomPacket()
-    : rawPacket_(nullptr)
+    : buffer_(nullptr)
+    , rawPacket_(nullptr)
     , size_(0)
+    , kind_(KIND_UNCLASSIFIED)
 {
     // empty
 }
 
 IcomPacket::IcomPacket(char* existingPacket, int size)
-    : rawPacket_((char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT))
+    : buffer_(IcomPacketPool::Allocate(size))
+    , rawPacket_(buffer_->data)
     , size_(size)
+    , kind_(KIND_UNCLASSIFIED)
 {
-    assert(rawPacket_ != nullptr);
     memcpy(rawPacket_, existingPacket, size_);
 }
 
 IcomPacket::IcomPacket(int size)
-    : rawPacket_((char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT))
+    : buffer_(IcomPacketPool::Allocate(size))
+    , rawPacket_(buffer_->data)
     , size_(size)
+    , kind_(KIND_UNCLASSIFIED)
 {
-    assert(rawPacket_ != nullptr);
     memset(rawPacket_, 0, size);
 }
-    
-IcomPacket::IcomPacket(const IcomPacket& packet)
-    : rawPacket_((char*)heap_caps_malloc(packet.size_, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT))
-    , size_(packet.size_)
+
+IcomPacket::IcomPacket(IcomPacketBuffer* buffer)
+    : buffer_(buffer)
+    , rawPacket_(buffer != nullptr ? buffer->data : nullptr)
+    , size_(buffer != nullptr ? buffer->size : 0)
+    , kind_(KIND_UNCLASSIFIED)
 {
-    assert(rawPacket_ != nullptr);
-    memcpy(rawPacket_, packet.rawPacket_, size_);
+    // empty
 }
 
 IcomPacket::IcomPacket(IcomPacket&& packet)
-    : rawPacket_(packet.rawPacket_)
+    : buffer_(packet.buffer_)
+    , rawPacket_(packet.rawPacket_)
     , size_(packet.size_)
+    , kind_(packet.kind_)
 {
+    packet.buffer_ = nullptr;
     packet.rawPacket_ = nullptr;
     packet.size_ = 0;
+    packet.kind_ = KIND_UNCLASSIFIED;
 }
 
 IcomPacket::~IcomPacket()
 {
-    heap_caps_free(rawPacket_);
+    IcomPacketPool::Release(buffer_);
+}
+
+IcomPacket IcomPacket::share() const
+{
+    if (buffer_ != nullptr)
+    {
+        IcomPacketPool::AddReference(buffer_);
+    }
+    return IcomPacket(buffer_);
+}
+
+IcomPacketBuffer* IcomPacket::detach()
+{
+    IcomPacketBuffer* buffer = buffer_;
+    buffer_ = nullptr;
+    rawPacket_ = nullptr;
+    size_ = 0;
+    kind_ = KIND_UNCLASSIFIED;
+    return buffer;
 }
 
 int IcomPacket::getSendLength()
@@ -95,26 +112,21 @@ const uint8_t* IcomPacket::getData()
     return (const uint8_t*)rawPacket_;
 }
 
-IcomPacket& IcomPacket::operator=(const IcomPacket& packet)
-{
-    heap_caps_free(rawPacket_);
-    
-    rawPacket_ = (char*)heap_caps_malloc(packet.size_, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    assert(rawPacket_ != nullptr);
-    memcpy(rawPacket_, packet.rawPacket_, packet.size_);
-    size_ = packet.size_;
-    
-    return *this;
-}
-
 IcomPacket& IcomPacket::operator=(IcomPacket&& packet)
 {
-    heap_caps_free(rawPacket_);
-    
-    rawPacket_ = packet.rawPacket_;
-    size_ = packet.size_;
-    packet.rawPacket_ = nullptr;
-    packet.size_ = 0;
+    if (this != &packet)
+    {
+        IcomPacketPool::Release(buffer_);
+        
+        buffer_ = packet.buffer_;
+        rawPacket_ = packet.rawPacket_;
+        size_ = packet.size_;
+        kind_ = packet.kind_;
+        packet.buffer_ = nullptr;
+        packet.rawPacket_ = nullptr;
+        packet.size_ = 0;
+        packet.kind_ = KIND_UNCLASSIFIED;
+    }
     
     return *this;
 }
@@ -252,12 +264,13 @@ IcomPacket IcomPacket::CreateIdlePacket(uint16_t ourSeq, uint32_t ourId, uint32_
     return result;
 }
 
-IcomPacket IcomPacket::CreateRetransmitRequest(uint32_t ourId, uint32_t theirId, std::vector<uint16_t, util::PSRamAllocator<uint16_t>> packetIdsToRetransmit)
+IcomPacket IcomPacket::CreateRetransmitRequest(uint32_t ourId, uint32_t theirId, const uint16_t* packetIdsToRetransmit, uint16_t numPacketIds)
 {
     static_assert(CONTROL_SIZE == sizeof(control_packet));
     constexpr uint16_t packetType = 0x01;
     
-    size_t numBytesAtEnd = sizeof(uint16_t) * (packetIdsToRetransmit.size());
+    assert(packetIdsToRetransmit != nullptr && numPacketIds > 0);
+    size_t numBytesAtEnd = sizeof(uint16_t) * numPacketIds;
     IcomPacket result(sizeof(control_packet) + numBytesAtEnd);
     auto packet = result.getTypedPacket<control_packet>();
     packet->len = sizeof(control_packet) + numBytesAtEnd;
@@ -267,16 +280,16 @@ IcomPacket IcomPacket::CreateRetransmitRequest(uint32_t ourId, uint32_t theirId,
     packet->rcvdid = theirId;
     
     // If only one packet to resend, we can use the sequence number field to store the ID.
-    if (packetIdsToRetransmit.size() == 1)
+    if (numPacketIds == 1)
     {
         packet->seq = ToBigEndian(packetIdsToRetransmit[0]);
     }
     else
     {
         uint16_t* pos = (uint16_t*)((uint8_t*)result.getData() + sizeof(control_packet));
-        for (auto& id : packetIdsToRetransmit)
+        for (uint16_t index = 0; index < numPacketIds; index++)
         {
-            *(pos++) = ToBigEndian(id);
+            *(pos++) = ToBigEndian(packetIdsToRetransmit[index]);
         }
     }
     
@@ -410,7 +423,7 @@ IcomPacket IcomPacket::CreateAudioPacket(uint16_t audioSeq, uint32_t ourId, uint
 
 bool IcomPacket::isIAmHere(uint32_t& theirId)
 {
-    if (size_ == CONTROL_SIZE)
+    if (getKind_() == KIND_CONTROL)
     {
         auto typedPacket = getTypedPacket<control_packet>();
         theirId = typedPacket->sentid;
@@ -423,7 +436,7 @@ bool IcomPacket::isIAmHere(uint32_t& theirId)
 
 bool IcomPacket::isIAmReady()
 {
-    if (size_ == CONTROL_SIZE)
+    if (getKind_() == KIND_CONTROL)
     {
         auto typedPacket = getTypedPacket<control_packet>();            
         return typedPacket->type == 0x06;
@@ -432,20 +445,37 @@ bool IcomPacket::isIAmReady()
     return false;
 }
 
-bool IcomPacket::isLoginResponse(std::string& connectionType, bool& isInvalidPassword, uint16_t& tokenReq, uint32_t& radioToken)
+bool IcomPacket::isLoginResponse(std::string_view& connectionType, bool& isInvalidPassword, uint16_t& tokenReq, uint32_t& radioToken)
 {
     bool ret = false;
     
-    if (size_ == LOGIN_RESPONSE_SIZE)
+    // Type 0x01 packets are retransmit requests, not login responses (see getKind_()).
+    if (getKind_() == KIND_LOGIN_RESPONSE)
     {
         auto typedPacket = getConstTypedPacket<login_response_packet>();
-        if (typedPacket->type != 0x01) // XXX -- what does 0x01 mean? from wfview source code
+        connectionType = std::string_view(typedPacket->connection, strnlen(typedPacket->connection, sizeof(typedPacket->connection)));
+        isInvalidPassword = typedPacket->error == 0xfeffffff;
+        
+        tokenReq = typedPacket->tokrequest;
+        radioToken = typedPacket->token;
+        
+        ret = true;
+    }
+    
+    return ret;
+}
+
+bool IcomPacket::isTokenResponse(uint8_t& requestType, bool& isSuccessful)
+{
+    bool ret = false;
+    
+    if (getKind_() == KIND_TOKEN)
+    {
+        auto typedPacket = getConstTypedPacket<token_packet>();
+        if (typedPacket->requestreply == 0x02)
         {
-            connectionType = typedPacket->connection;
-            isInvalidPassword = typedPacket->error == 0xfeffffff;
-            
-            tokenReq = typedPacket->tokrequest;
-            radioToken = typedPacket->token;
+            requestType = typedPacket->requesttype;
+            isSuccessful = typedPacket->response == 0;
             
             ret = true;
         }
@@ -458,7 +488,7 @@ bool IcomPacket::isPingRequest(uint16_t& pingSequence)
 {
     bool ret = false;
     
-    if (size_ == PING_SIZE)
+    if (getKind_() == KIND_PING)
     {
         auto typedPacket = getConstTypedPacket<ping_packet>();
         ret = typedPacket->reply == 0;
@@ -472,7 +502,7 @@ bool IcomPacket::isPingResponse(uint16_t& pingSequence)
 {
     bool ret = false;
     
-    if (size_ == PING_SIZE)
+    if (getKind_() == KIND_PING)
     {
         auto typedPacket = getConstTypedPacket<ping_packet>();
         ret = typedPacket->reply == 1;
@@ -482,66 +512,57 @@ bool IcomPacket::isPingResponse(uint16_t& pingSequence)
     return ret;
 }
 
-bool IcomPacket::isCapabilitiesPacket(std::vector<radio_cap_packet_t, util::PSRamAllocator<radio_cap_packet_t>>& radios)
+bool IcomPacket::isCapabilitiesPacket(RadioCapabilityList& radios)
 {
-    auto rawData = getData();
-    
     bool result = false;
-    if ((size_ - CAPABILITIES_SIZE) % RADIO_CAP_SIZE == 0)
+    if (getKind_() == KIND_CAPABILITIES)
     {
-        for (int index = CAPABILITIES_SIZE; index < size_; index += RADIO_CAP_SIZE)
-        {
-            radios.push_back((radio_cap_packet_t)(rawData + index));
-        }
-        
+        radios.data_ = getData() + CAPABILITIES_SIZE;
+        radios.count_ = (size_ - CAPABILITIES_SIZE) / RADIO_CAP_SIZE;
         result = true;
     }
 
     return result;
 }
 
-bool IcomPacket::isRetransmitPacket(std::vector<uint16_t, util::PSRamAllocator<uint16_t>>& retryPackets)
+bool IcomPacket::isRetransmitPacket(SequenceList& retryPackets)
 {
     bool result = false;
     
-    if (size_ >= CONTROL_SIZE)
+    if (getKind_() == KIND_RETRANSMIT)
     {
-        auto typedPacket = getConstTypedPacket<control_packet>();
-        if (typedPacket->type == 0x01)
+        result = true;
+        
+        if (size_ == CONTROL_SIZE)
         {
-            result = true;
-            
-            if (size_ == CONTROL_SIZE)
-            {
-                // only one packet to resend
-                retryPackets.push_back(typedPacket->seq);
-            }
-            else
-            {
-                uint16_t* ids = (uint16_t*)(getData() + CONTROL_SIZE);
-                for (int sz = CONTROL_SIZE; sz < size_; sz += sizeof(uint16_t))
-                {
-                    retryPackets.push_back(*(ids++));
-                }
-            }
+            // only one packet to resend
+            auto typedPacket = getConstTypedPacket<control_packet>();
+            retryPackets.data_ = nullptr;
+            retryPackets.single_ = typedPacket->seq;
+            retryPackets.count_ = 1;
+        }
+        else
+        {
+            retryPackets.data_ = getData() + CONTROL_SIZE;
+            retryPackets.count_ = (size_ - CONTROL_SIZE) / sizeof(uint16_t);
         }
     }
     
     return result;
 }
 
-bool IcomPacket::isConnInfoPacket(std::string& name, uint32_t& ip, bool& isBusy)
+bool IcomPacket::isConnInfoPacket(std::string_view& name, uint32_t& ip, bool& isBusy)
 {
     bool result = false;
     
-    if (size_ == CONNINFO_SIZE)
+    if (getKind_() == KIND_CONNINFO)
     {
         auto typedPacket = getConstTypedPacket<conninfo_packet>();
         result = true;
         
         auto data = getData();
         
-        name = typedPacket->name;
+        name = std::string_view(typedPacket->name, strnlen(typedPacket->name, sizeof(typedPacket->name)));
         ip = *(uint32_t*)(data + 0x84);
         isBusy = *(uint32_t*)(data + 0x60);
     }
@@ -553,7 +574,7 @@ bool IcomPacket::isStatusPacket(bool& connSuccessful, bool& disconnected, uint16
 {
     bool result = false;
     
-    if (size_ == STATUS_SIZE)
+    if (getKind_() == KIND_STATUS)
     {
         auto typedPacket = getConstTypedPacket<status_packet>();
         result = true;
@@ -575,7 +596,7 @@ bool IcomPacket::isAudioPacket(uint16_t& seq, short** dataStart)
     auto typedPacket = getConstTypedPacket<control_packet>();
     if (typedPacket->type != 0x01 && typedPacket->len >= 0x20)
     {
-        // TBD -- we might need to do some reordering by virtue of how UDP works.
+        // Reordering (if enabled) is done by IcomAudioJitterBuffer.
         result = true;
         seq = ToLittleEndian(typedPacket->seq);
         *dataStart = (short*)(getData() + 0x18);
@@ -599,6 +620,76 @@ bool IcomPacket::isCivPacket(uint8_t** civPacket, uint16_t* civPacketLength)
     return result;
 }
 
+IcomPacket::Kind IcomPacket::getKind_()
+{
+    if (kind_ != KIND_UNCLASSIFIED)
+    {
+        return kind_;
+    }
+
+    if (size_ < CONTROL_SIZE)
+    {
+        kind_ = KIND_OTHER;
+    }
+    else if (getConstTypedPacket<control_packet>()->type == 0x01)
+    {
+        // Retransmit requests can be any size (one ID per two bytes), so 
+        // they need to be caught before going by size.
+        kind_ = KIND_RETRANSMIT;
+    }
+    else
+    {
+        switch (size_)
+        {
+            case CONTROL_SIZE:
+                kind_ = KIND_CONTROL;
+                break;
+            case PING_SIZE:
+                kind_ = KIND_PING;
+                break;
+            case TOKEN_SIZE:
+                kind_ = KIND_TOKEN;
+                break;
+            case STATUS_SIZE:
+                kind_ = KIND_STATUS;
+                break;
+            case LOGIN_RESPONSE_SIZE:
+                kind_ = KIND_LOGIN_RESPONSE;
+                break;
+            case CONNINFO_SIZE:
+                kind_ = KIND_CONNINFO;
+                break;
+            default:
+                if (size_ >= CAPABILITIES_SIZE && ((size_ - CAPABILITIES_SIZE) % RADIO_CAP_SIZE) == 0)
+                {
+                    kind_ = KIND_CAPABILITIES;
+                }
+                else
+                {
+                    kind_ = KIND_OTHER;
+                }
+                break;
+        }
+    }
+
+    return kind_;
+}
+
+uint16_t IcomPacket::SequenceList::operator[](uint16_t index) const
+{
+    assert(index < count_);
+
+    if (data_ == nullptr)
+    {
+        return single_;
+    }
+
+    // IDs aren't necessarily aligned within the packet.
+    uint16_t id;
+    memcpy(&id, data_ + index * sizeof(uint16_t), sizeof(id));
+    return id;
+}
+
 void IcomPacket::EncodePassword_(std::string str, char* output)
 {
     const uint8_t sequence[] =
@@ -19,11 +19,10 @@
 #define ICOM_PACKET_H
 
 #include <string>
-#include <vector>
+#include <string_view>
 #include <memory>
 #include "RadioPacketDefinitions.h"
-
-#include "util/PSRamAllocator.h"
+#include "IcomPacketPool.h"
 
 namespace ezdv
 {
@@ -34,19 +33,73 @@ namespace network
 namespace icom
 {
 
+/// @brief Handle to an Icom packet stored in an IcomPacketPool buffer.
+///
+/// Packets are move-only; use share() to get another handle to the same
+/// buffer (e.g. to keep a sent packet around for retransmission).
 class IcomPacket
 {
 public:
-    // To force allocation inside SPI RAM.
-    static void* operator new(std::size_t count);
-    static void operator delete(void* ptr);
+    /// @brief Sequence numbers listed in a received retransmit request. Points
+    ///        into the packet, so it's only valid while the packet is.
+    class SequenceList
+    {
+    public:
+        SequenceList()
+            : data_(nullptr)
+            , single_(0)
+            , count_(0)
+            {}
+
+        uint16_t size() const { return count_; }
+        uint16_t operator[](uint16_t index) const;
+
+    private:
+        friend class IcomPacket;
+
+        const uint8_t* data_; // nullptr if there's only one (in single_)
+        uint16_t single_;
+        uint16_t count_;
+    };
+
+    /// @brief Radios listed in a received capabilities packet. Points into 
+    ///        the packet, so it's only valid while the packet is.
+    class RadioCapabilityList
+    {
+    public:
+        RadioCapabilityList()
+            : data_(nullptr)
+            , count_(0)
+            {}
+
+        int size() const { return count_; }
+        radio_cap_packet_t operator[](int index) const { return (radio_cap_packet_t)(data_ + index * RADIO_CAP_SIZE); }
+
+    private:
+        friend class IcomPacket;
+
+        const uint8_t* data_;
+        int count_;
+    };
 
     IcomPacket();
     IcomPacket(char* existingPacket, int size);
     IcomPacket(int size);
-    IcomPacket(const IcomPacket& packet);
+    IcomPacket(const IcomPacket& packet) = delete;
     IcomPacket(IcomPacket&& packet);
     virtual ~IcomPacket();
+
+    /// @brief Takes over a reference previously given up by detach().
+    /// @param buffer The buffer to take ownership of.
+    explicit IcomPacket(IcomPacketBuffer* buffer);
+
+    /// @brief Returns another handle that shares this packet's buffer.
+    IcomPacket share() const;
+
+    /// @brief Gives up this handle's reference without releasing it 
+    ///        (for passing through DVTask messages).
+    /// @return The buffer, to be adopted later with IcomPacket(IcomPacketBuffer*).
+    IcomPacketBuffer* detach();
     
     virtual int getSendLength();
     virtual const uint8_t* getData();
@@ -57,7 +110,7 @@ public:
     template<typename ActualPacketType>
     const ActualPacketType* getConstTypedPacket();
     
-    IcomPacket& operator=(const IcomPacket& packet);
+    IcomPacket& operator=(const IcomPacket& packet) = delete;
     IcomPacket& operator=(IcomPacket&& packet);
     
     static IcomPacket CreateAreYouTherePacket(uint32_t ourId, uint32_t theirId);
@@ -67,7 +120,7 @@ public:
     static IcomPacket CreatePingPacket(uint16_t pingSeq, uint32_t ourId, uint32_t theirId);
     static IcomPacket CreatePingAckPacket(uint16_t theirPingSeq, uint32_t ourId, uint32_t theirId);
     static IcomPacket CreateIdlePacket(uint16_t ourSeq, uint32_t ourId, uint32_t theirId);
-    static IcomPacket CreateRetransmitRequest(uint32_t ourId, uint32_t theirId, std::vector<uint16_t, util::PSRamAllocator<uint16_t>> packetIdsToRetransmit);
+    static IcomPacket CreateRetransmitRequest(uint32_t ourId, uint32_t theirId, const uint16_t* packetIdsToRetransmit, uint16_t numPacketIds);
     static IcomPacket CreateTokenRenewPacket(uint16_t authSeq, uint16_t tokenRequest, uint32_t token, uint32_t ourId, uint32_t theirId);
     static IcomPacket CreateTokenRemovePacket(uint16_t authSeq, uint16_t tokenRequest, uint32_t token, uint32_t ourId, uint32_t theirId);
     static IcomPacket CreateDisconnectPacket(uint32_t ourId, uint32_t theirId);
@@ -81,18 +134,24 @@ public:
     // Used in Are You Ready state for checking I Am Ready response
     bool isIAmReady();
     
+    // The parsers below don't allocate; anything returned by reference 
+    // points into the packet and is only valid while the packet is.
+
     // Used in Login state to get login response
-    bool isLoginResponse(std::string& connectionType, bool& isInvalidPassword, uint16_t& tokenRequest, uint32_t& radioToken);
+    bool isLoginResponse(std::string_view& connectionType, bool& isInvalidPassword, uint16_t& tokenRequest, uint32_t& radioToken);
+    
+    // Used in Login state to check whether the radio accepted a token request
+    bool isTokenResponse(uint8_t& requestType, bool& isSuccessful);
     
     // Used in Login state to check for ping requests and responses
     bool isPingRequest(uint16_t& pingSequence);
     bool isPingResponse(uint16_t& pingSequence);
     
-    bool isCapabilitiesPacket(std::vector<radio_cap_packet_t, util::PSRamAllocator<radio_cap_packet_t>>& radios);
+    bool isCapabilitiesPacket(RadioCapabilityList& radios);
     
-    bool isRetransmitPacket(std::vector<uint16_t, util::PSRamAllocator<uint16_t>>& retryPackets);
+    bool isRetransmitPacket(SequenceList& retryPackets);
     
-    bool isConnInfoPacket(std::string& name, uint32_t& ip, bool& isBusy);
+    bool isConnInfoPacket(std::string_view& name, uint32_t& ip, bool& isBusy);
     
     bool isStatusPacket(bool& connSuccessful, bool& disconnected, uint16_t& civPort, uint16_t& audioPort);
     
@@ -101,8 +160,29 @@ public:
     bool isCivPacket(uint8_t** civPacket, uint16_t* civPacketLength);
     
 private:
+    /// @brief What a packet is, going by its size and type. Worked out the 
+    ///        first time it's needed since most packets get checked against
+    ///        several of the parsers above.
+    enum Kind : uint8_t
+    {
+        KIND_UNCLASSIFIED,
+        KIND_CONTROL,
+        KIND_RETRANSMIT,
+        KIND_PING,
+        KIND_TOKEN,
+        KIND_STATUS,
+        KIND_LOGIN_RESPONSE,
+        KIND_CONNINFO,
+        KIND_CAPABILITIES,
+        KIND_OTHER,
+    };
+
+    IcomPacketBuffer* buffer_;
     char* rawPacket_;
     int size_;
+    Kind kind_;
+
+    Kind getKind_();
     
     static void EncodePassword_(std::string str, char* output);
 };
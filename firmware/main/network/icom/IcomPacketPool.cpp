@@ -0,0 +1,160 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#include "IcomPacketPool.h"
+#include "util/MemoryPlacement.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+static portMUX_TYPE PoolLock_ = portMUX_INITIALIZER_UNLOCKED;
+static IcomPacketBuffer* FreeList_ = nullptr;
+static uint32_t BuffersInUse_ = 0;
+static uint32_t BuffersHighWater_ = 0;
+static std::atomic<uint32_t> HeapFallbacks_(0);
+static std::atomic<uint32_t> HeapFallbacksInUse_(0);
+static bool Initialized_ = false;
+
+void IcomPacketPool::Initialize()
+{
+    if (Initialized_)
+    {
+        return;
+    }
+
+    IcomPacketBuffer* region = (IcomPacketBuffer*)util::MemoryPlacement::Allocate(
+        util::MemoryPlacement::ICOM_PACKETS,
+        sizeof(IcomPacketBuffer) * CONFIG_EZDV_ICOM_PACKET_POOL_SIZE);
+    assert(region != nullptr);
+
+    portENTER_CRITICAL(&PoolLock_);
+    for (int index = 0; index < CONFIG_EZDV_ICOM_PACKET_POOL_SIZE; index++)
+    {
+        IcomPacketBuffer* buffer = &region[index];
+        buffer->refCount = 0;
+        buffer->size = 0;
+        buffer->pooled = true;
+        buffer->next = FreeList_;
+        FreeList_ = buffer;
+    }
+    portEXIT_CRITICAL(&PoolLock_);
+
+    Initialized_ = true;
+}
+
+IcomPacketBuffer* IcomPacketPool::Allocate(int size)
+{
+    assert(size >= 0 && size <= MAX_PACKET_SIZE);
+
+    portENTER_CRITICAL(&PoolLock_);
+    IcomPacketBuffer* buffer = FreeList_;
+    if (buffer != nullptr)
+    {
+        FreeList_ = buffer->next;
+        BuffersInUse_++;
+        if (BuffersInUse_ > BuffersHighWater_)
+        {
+            BuffersHighWater_ = BuffersInUse_;
+        }
+    }
+    portEXIT_CRITICAL(&PoolLock_);
+
+    if (buffer == nullptr)
+    {
+        // Nothing available in the pool, fall back to the heap.
+        buffer = (IcomPacketBuffer*)util::MemoryPlacement::Allocate(util::MemoryPlacement::ICOM_PACKETS, sizeof(IcomPacketBuffer));
+        assert(buffer != nullptr);
+        buffer->pooled = false;
+
+        HeapFallbacks_++;
+        HeapFallbacksInUse_++;
+    }
+
+    buffer->next = nullptr;
+    buffer->refCount = 1;
+    buffer->size = size;
+
+    return buffer;
+}
+
+void IcomPacketPool::AddReference(IcomPacketBuffer* buffer)
+{
+    assert(buffer != nullptr);
+
+    portENTER_CRITICAL(&PoolLock_);
+    assert(buffer->refCount > 0);
+    buffer->refCount++;
+    portEXIT_CRITICAL(&PoolLock_);
+}
+
+void IcomPacketPool::Release(IcomPacketBuffer* buffer)
+{
+    if (buffer == nullptr)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&PoolLock_);
+    assert(buffer->refCount > 0);
+    bool unused = --buffer->refCount == 0;
+    if (unused && buffer->pooled)
+    {
+        buffer->next = FreeList_;
+        FreeList_ = buffer;
+        BuffersInUse_--;
+    }
+    portEXIT_CRITICAL(&PoolLock_);
+
+    if (unused && !buffer->pooled)
+    {
+        HeapFallbacksInUse_--;
+        util::MemoryPlacement::Free(util::MemoryPlacement::ICOM_PACKETS, buffer);
+    }
+}
+
+void IcomPacketPool::GetStatistics(Statistics& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    portENTER_CRITICAL(&PoolLock_);
+    stats.buffersTotal = Initialized_ ? CONFIG_EZDV_ICOM_PACKET_POOL_SIZE : 0;
+    stats.buffersInUse = BuffersInUse_;
+    stats.buffersHighWater = BuffersHighWater_;
+    portEXIT_CRITICAL(&PoolLock_);
+
+    stats.heapFallbacks = HeapFallbacks_;
+    stats.heapFallbacksInUse = HeapFallbacksInUse_;
+}
+
+}
+
+}
+
+}
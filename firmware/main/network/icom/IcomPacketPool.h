@@ -0,0 +1,91 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ICOM_PACKET_POOL_H
+#define ICOM_PACKET_POOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "RadioPacketDefinitions.h"
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+/// @brief Fixed-size, reference counted storage for a single Icom packet.
+struct IcomPacketBuffer
+{
+    IcomPacketBuffer* next; // only valid while on the free list
+    uint16_t refCount;
+    uint16_t size;
+    bool pooled;
+    alignas(4) char data[MAX_PACKET_SIZE];
+};
+
+/// @brief Slab of MAX_PACKET_SIZE buffers backing IcomPacket.
+///
+/// The slab lives in PSRAM and is allocated once, so steady-state packet
+/// traffic (including the copies kept for retransmission) doesn't touch
+/// the heap. Buffers are shared between IcomPacket instances by reference
+/// count and return to the free list when the last one lets go. If the 
+/// pool is exhausted, buffers fall back to the general heap and are counted.
+class IcomPacketPool
+{
+public:
+    struct Statistics
+    {
+        uint32_t buffersTotal;
+        uint32_t buffersInUse;
+        uint32_t buffersHighWater;
+        uint32_t heapFallbacks;
+        uint32_t heapFallbacksInUse;
+    };
+
+    /// @brief Allocates the slab. Must be called before the first Icom connection.
+    static void Initialize();
+
+    /// @brief Obtains a buffer with a reference count of one.
+    /// @param size The size of the packet that will be stored in it.
+    /// @return The allocated buffer.
+    static IcomPacketBuffer* Allocate(int size);
+
+    /// @brief Adds a reference to a buffer that's already been allocated.
+    /// @param buffer The buffer to reference.
+    static void AddReference(IcomPacketBuffer* buffer);
+
+    /// @brief Drops a reference, returning the buffer to the pool once unused.
+    /// @param buffer The buffer to release.
+    static void Release(IcomPacketBuffer* buffer);
+
+    /// @brief Retrieves a snapshot of pool usage.
+    /// @param stats The structure to fill in.
+    static void GetStatistics(Statistics& stats);
+};
+
+}
+
+}
+
+}
+
+#endif // ICOM_PACKET_POOL_H
@@ -19,7 +19,10 @@
 #include "IcomAudioStateMachine.h"
 #include "IcomControlStateMachine.h"
 #include "IcomCIVStateMachine.h"
-#include "network/NetworkMessage.h"
+#include "IcomPacket.h"
+
+#define ICOM_SOCKET_DRAIN_MAX_MESSAGES (16)
+#define ICOM_SOCKET_DRAIN_MAX_TIME_US (5000)
 
 namespace ezdv
 {
@@ -33,43 +36,84 @@ namespace icom
 IcomSocketTask::IcomSocketTask(SocketType socketType)
     : DVTask(
         GetTaskName_(socketType), 
-        (socketType == AUDIO_SOCKET) ? 16 : 10, 
+        (socketType == CONTROL_SOCKET || socketType == CIV_SOCKET) ? 10 : 16, 
         3500, 
-        (socketType == AUDIO_SOCKET) ? 1 : tskNO_AFFINITY, 
-        (socketType == AUDIO_SOCKET) ? 512 : 256, pdMS_TO_TICKS(20))
-    , ezdv::audio::AudioInput(1, 1)
+        (socketType == CONTROL_SOCKET || socketType == CIV_SOCKET) ? tskNO_AFFINITY : 1, 
+        (socketType == CONTROL_SOCKET || socketType == CIV_SOCKET) ? 256 : 512, 
+        portMAX_DELAY) // everything is driven by timers and received messages
+    , ezdv::audio::AudioInput(GetTaskName_(socketType), 1, { (uint32_t)((socketType == CONTROL_SOCKET || socketType == CIV_SOCKET) ? AUDIO_INPUT_UNUSED : FREEDV_MAX_FRAME_SAMPLES * MAX_AUDIO_SAMPLE_RATE / AUDIO_DEFAULT_SAMPLE_RATE) })
     , socketType_(socketType)
+    , controlStateMachine_(nullptr)
+    , civStateMachine_(nullptr)
+    , audioStateMachine_(nullptr)
+    , sleepReported_(false)
 {
-    switch(socketType)
+    // The audio machine is created first so that it's the first to see
+    // messages all of our machines handle (e.g. received packets).
+    if (socketType == AUDIO_SOCKET || socketType == ALL_SOCKETS)
     {
-        case CONTROL_SOCKET:
-            stateMachine_ = new IcomControlStateMachine(this);
-            break;
-        case CIV_SOCKET:
-            stateMachine_ = new IcomCIVStateMachine(this);
-            break;
-        case AUDIO_SOCKET:
-            stateMachine_ = new IcomAudioStateMachine(this);
-            break;
-        default:
-            assert(0);
+        audioStateMachine_ = new IcomAudioStateMachine(this);
+        assert(audioStateMachine_ != nullptr);
     }
+
+    if (socketType == CONTROL_SOCKET || socketType == ALL_SOCKETS)
+    {
+        controlStateMachine_ = new IcomControlStateMachine(this);
+        assert(controlStateMachine_ != nullptr);
+    }
+
+    if (socketType == CIV_SOCKET || socketType == ALL_SOCKETS)
+    {
+        civStateMachine_ = new IcomCIVStateMachine(this);
+        assert(civStateMachine_ != nullptr);
+    }
+
+    // Audio packets (and timers) shouldn't wait behind anything else. When
+    // shared, control and CI-V packets go in the same lane; there are only 
+    // a few of them a second and all three sockets are read the same way.
+    if (audioStateMachine_ != nullptr)
+    {
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+        // AudioState sets the threshold once the stream's packet size is known.
+        setAudioInputNotification(ezdv::audio::AudioInput::LEFT_CHANNEL, this, 0);
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
+
+        enableMessageLanes(512, 0);
+        setMessageLane<ReceivePacketMessage>(MESSAGE_LANE_REALTIME);
+        setMessageLane<SocketReadableMessage>(MESSAGE_LANE_REALTIME);
+
+        // Stale audio is useless, so make room for new packets instead of
+        // holding up the sender. Control and CI-V packets dropped this way
+        // are retransmitted as usual.
+        setMessageOverflowPolicy<ReceivePacketMessage>(OVERFLOW_DROP_OLDEST, &OnReceivePacketDropped_);
+    }
+    else
+    {
+        setMessageOverflowPolicy<ReceivePacketMessage>(OVERFLOW_BLOCK, &OnReceivePacketDropped_);
+    }
+
+    // Handle bursts of received/sent packets without going back to the
+    // scheduler for each one.
+    setMessageDrainBudget(ICOM_SOCKET_DRAIN_MAX_MESSAGES, ICOM_SOCKET_DRAIN_MAX_TIME_US);
     
-    assert(stateMachine_ != nullptr);
-    
-    registerMessageHandler(this, &IcomSocketTask::onIcomConnectRadioMessage_);
-    registerMessageHandler(this, &IcomSocketTask::onIcomCIVAudioConnectionInfo_);
-    registerMessageHandler(this, &IcomSocketTask::onRadioDisconnectedMessage_);
+    registerMessageHandlers<
+        &IcomSocketTask::onIcomConnectRadioMessage_,
+        &IcomSocketTask::onIcomCIVAudioConnectionInfo_,
+        &IcomSocketTask::onRadioDisconnectedMessage_,
+        &IcomSocketTask::onActiveInterfaceChangedMessage_>(this);
 }
 
 IcomSocketTask::~IcomSocketTask()
 {
-    delete stateMachine_;
+    delete controlStateMachine_;
+    delete civStateMachine_;
+    delete audioStateMachine_;
 }
 
 void IcomSocketTask::onTaskStart_()
 {
-    // empty, must wait for outside to tell us to connect
+    // Must wait for outside to tell us to connect.
+    sleepReported_ = false;
 }
 
 void IcomSocketTask::onTaskSleep_()
@@ -77,16 +121,37 @@ void IcomSocketTask::onTaskSleep_()
     // empty
 }
 
-void IcomSocketTask::onIcomConnectRadioMessage_(DVTask* origin, IcomConnectRadioMessage* message)
+void IcomSocketTask::onTaskTick_()
 {
-    if (socketType_ == CONTROL_SOCKET)
+    // Requested by the state machines when other tasks queue packets to send
+    // (and by FreeDV's TX audio; see AudioState).
+    if (audioStateMachine_ != nullptr)
     {
-        stateMachine_->start(message->ip, message->port, message->username, message->password);
+        audioStateMachine_->flushPendingSends();
+#if CONFIG_EZDV_TX_FRAME_ALIGN
+        ((IcomAudioStateMachine*)audioStateMachine_)->onAudioInputReady();
+#endif // CONFIG_EZDV_TX_FRAME_ALIGN
     }
-    else
+
+    if (controlStateMachine_ != nullptr)
+    {
+        controlStateMachine_->flushPendingSends();
+    }
+
+    if (civStateMachine_ != nullptr)
+    {
+        civStateMachine_->flushPendingSends();
+    }
+}
+
+void IcomSocketTask::onIcomConnectRadioMessage_(DVTask* origin, IcomConnectRadioMessage* message)
+{
+    // Save IP for CI-V and audio, which start once we log in.
+    ip_ = message->ip;
+
+    if (controlStateMachine_ != nullptr)
     {
-        // Save IP For later.
-        ip_ = message->ip;
+        controlStateMachine_->start(message->ip, message->port, message->username, message->password);
     }
 }
 
@@ -94,53 +159,98 @@ void IcomSocketTask::onIcomCIVAudioConnectionInfo_(DVTask* origin, IcomCIVAudioC
 {
     if (message->remoteCivPort == 0 && message->remoteAudioPort == 0)
     {
-        if (socketType_ == AUDIO_SOCKET)
+        // Report connection termination, then transition to idle state.
+        if (audioStateMachine_ != nullptr)
         {
-            // Report connection termination
             ezdv::network::RadioConnectionStatusMessage response(false);
             publish(&response);
+
+            audioStateMachine_->reset();
         }
 
-        // Transition to idle state
-        if (socketType_ == AUDIO_SOCKET || socketType_ == CIV_SOCKET)
+        if (civStateMachine_ != nullptr)
         {
-            stateMachine_->reset();
+            civStateMachine_->reset();
         }
     }
     else
     {
-        if (socketType_ == AUDIO_SOCKET)
+        if (audioStateMachine_ != nullptr)
         {
+            // The audio graph adds rate converters based on this when
+            // routing audio to/from us below.
+            setInputSampleRate(LEFT_CHANNEL, message->audioSampleRate);
+            setOutputSampleRate(LEFT_CHANNEL, message->audioSampleRate);
+
             // Report successful connection
             ezdv::network::RadioConnectionStatusMessage response(true);
             publish(&response);
             
-            stateMachine_->start(ip_, message->remoteAudioPort, "", "", message->localAudioPort);
+            audioStateMachine_->start(ip_, message->remoteAudioPort, "", "", message->localAudioPort);
         }
-        else if (socketType_ == CIV_SOCKET)
+
+        if (civStateMachine_ != nullptr)
         {
-            stateMachine_->start(ip_, message->remoteCivPort, "", "", message->localCivPort);
+            civStateMachine_->start(ip_, message->remoteCivPort, "", "", message->localCivPort);
         }
     }
 }
 
 void IcomSocketTask::onRadioDisconnectedMessage_(DVTask* origin, DisconnectedRadioMessage* message)
 {
-    // Call task sleep actions to trigger reporting of task finishing sleep.
-    DVTask::onTaskSleep_(nullptr, nullptr);
+    // Call task sleep actions to trigger reporting of task finishing sleep,
+    // but only once every machine on this task is done.
+    if (!sleepReported_ && isIdle_())
+    {
+        sleepReported_ = true;
+        DVTask::onTaskSleep_(nullptr, nullptr);
+    }
 }
 
 void IcomSocketTask::onTaskSleep_(DVTask* origin, TaskSleepMessage* message)
 {
     // Transition to the null state. This should trigger state-specific cleanup.
-    if (stateMachine_->getCurrentState() == nullptr)
+    if (isIdle_())
     {
+        sleepReported_ = true;
         DVTask::onTaskSleep_(nullptr, nullptr);
+        return;
     }
-    else
+
+    IcomStateMachine* machines[] = { audioStateMachine_, civStateMachine_, controlStateMachine_ };
+    for (auto machine : machines)
+    {
+        if (machine != nullptr && machine->getCurrentState() != nullptr)
+        {
+            machine->reset();
+        }
+    }
+}
+
+void IcomSocketTask::onActiveInterfaceChangedMessage_(DVTask* origin, ezdv::network::ActiveInterfaceChangedMessage* message)
+{
+    IcomStateMachine* machines[] = { controlStateMachine_, civStateMachine_, audioStateMachine_ };
+    for (auto machine : machines)
+    {
+        if (machine != nullptr)
+        {
+            machine->rebind();
+        }
+    }
+}
+
+bool IcomSocketTask::isIdle_()
+{
+    IcomStateMachine* machines[] = { audioStateMachine_, civStateMachine_, controlStateMachine_ };
+    for (auto machine : machines)
     {
-        stateMachine_->reset();
+        if (machine != nullptr && machine->getCurrentState() != nullptr)
+        {
+            return false;
+        }
     }
+
+    return true;
 }
 
 const char* IcomSocketTask::GetTaskName_(SocketType socketType)
@@ -153,12 +263,19 @@ const char* IcomSocketTask::GetTaskName_(SocketType socketType)
             return "IcomSocketTask/CIV";
         case AUDIO_SOCKET:
             return "IcomSocketTask/Audio";
+        case ALL_SOCKETS:
+            return "IcomSocketTask";
         default:
             assert(0);
             return "";
     }
 }
 
+void IcomSocketTask::OnReceivePacketDropped_(DVTaskMessage* message)
+{
+    IcomPacketPool::Release(((ReceivePacketMessage*)message)->packet);
+}
+
 }
 
 }
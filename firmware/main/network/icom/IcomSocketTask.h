@@ -22,6 +22,7 @@
 #include "task/DVTask.h"
 #include "audio/AudioInput.h"
 #include "IcomMessage.h"
+#include "network/NetworkMessage.h"
 
 namespace ezdv
 {
@@ -44,6 +45,7 @@ public:
         CONTROL_SOCKET,
         CIV_SOCKET,
         AUDIO_SOCKET,
+        ALL_SOCKETS, // control, CI-V and audio share one task
     };
 
     IcomSocketTask(SocketType socketType);
@@ -52,19 +54,31 @@ public:
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
+    virtual void onTaskTick_() override;
     
     virtual void onTaskSleep_(DVTask* origin, TaskSleepMessage* message);
     
 private:
     SocketType socketType_;
-    IcomStateMachine* stateMachine_;
+
+    // Machines this task doesn't run are nullptr.
+    IcomStateMachine* controlStateMachine_;
+    IcomStateMachine* civStateMachine_;
+    IcomStateMachine* audioStateMachine_;
     std::string ip_;
+    bool sleepReported_;
     
     void onIcomConnectRadioMessage_(DVTask* origin, IcomConnectRadioMessage* message);
     void onIcomCIVAudioConnectionInfo_(DVTask* origin, IcomCIVAudioConnectionInfo* message);
     void onRadioDisconnectedMessage_(DVTask* origin, DisconnectedRadioMessage* message);
+    void onActiveInterfaceChangedMessage_(DVTask* origin, ezdv::network::ActiveInterfaceChangedMessage* message);
     
+    /// @brief Returns true once none of our machines have a current state.
+    bool isIdle_();
+
     static const char* GetTaskName_(SocketType socketType);
+
+    static void OnReceivePacketDropped_(DVTaskMessage* message);
 };
 
 }
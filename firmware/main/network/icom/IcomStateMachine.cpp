@@ -22,6 +22,12 @@
 #include "IcomStateMachine.h"
 #include "IcomProtocolState.h"
 #include "IcomPacket.h"
+#include "network/NetworkReactor.h"
+#include "network/PacketCapture.h"
+#include "util/MemoryPlacement.h"
+
+// Maximum number of datagrams to read from the socket per wakeup.
+#define MAX_PACKETS_PER_READ (16)
 
 namespace ezdv
 {
@@ -34,12 +40,12 @@ namespace icom
 
 void* IcomStateMachine::operator new(size_t size)
 {
-    return heap_caps_calloc(size, 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    return util::MemoryPlacement::Calloc(util::MemoryPlacement::CONTAINERS, size, 1);
 }
 
 void IcomStateMachine::operator delete(void* p)
 {
-    heap_caps_free(p);
+    util::MemoryPlacement::Free(util::MemoryPlacement::CONTAINERS, p);
 }
 
 IcomStateMachine::IcomStateMachine(DVTask* owner)
@@ -49,11 +55,18 @@ IcomStateMachine::IcomStateMachine(DVTask* owner)
     , theirIdentifier_(0)
     , port_(0)
     , localPort_(0)
-    , packetReadTimer_(owner, this, &IcomStateMachine::readPendingPackets_, MS_TO_US(10), "IcomPacketReadTimer")
+    , sendRingWriteIndex_(0)
+    , sendRingReadIndex_(0)
+{
+    owner->registerMessageHandlers<
+        &IcomStateMachine::onReceivePacket_,
+        &IcomStateMachine::onCloseSocket_,
+        &IcomStateMachine::onSocketReadable_>(this);
+}
+
+std::string IcomStateMachine::getIp()
 {
-    owner->registerMessageHandler(this, &IcomStateMachine::onSendPacket_);
-    owner->registerMessageHandler(this, &IcomStateMachine::onReceivePacket_);
-    owner->registerMessageHandler(this, &IcomStateMachine::onCloseSocket_);
+    return ip_;
 }
 
 std::string IcomStateMachine::getUsername()
@@ -85,18 +98,43 @@ void IcomStateMachine::sendUntracked(IcomPacket& packet)
 {
     auto task = getTask();
 
-    if (!task->canPostMessage())
+    if (task->isCurrentTask())
+    {
+        sendPacket_(packet, esp_timer_get_time());
+        return;
+    }
+
+    uint32_t writeIndex = sendRingWriteIndex_.load(std::memory_order_relaxed);
+    if (writeIndex - sendRingReadIndex_.load(std::memory_order_acquire) >= SEND_RING_SIZE)
     {
         // something's gone very wrong, just skip sending the packet
         // until our queue clears up.
         return;
     }
 
-    auto allocPacket = new IcomPacket(std::move(packet));
-    assert(allocPacket != nullptr);
+    // The caller may still be holding on to the packet (e.g. for
+    // retransmission), so the ring gets its own reference.
+    PendingSend& entry = sendRing_[writeIndex % SEND_RING_SIZE];
+    entry.packet = packet.share().detach();
+    entry.sendTime = esp_timer_get_time();
+    sendRingWriteIndex_.store(writeIndex + 1, std::memory_order_release);
 
-    SendPacketMessage message(allocPacket);
-    task->post(&message);
+    task->requestTick();
+}
+
+void IcomStateMachine::flushPendingSends()
+{
+    uint32_t readIndex = sendRingReadIndex_.load(std::memory_order_relaxed);
+    uint32_t writeIndex = sendRingWriteIndex_.load(std::memory_order_acquire);
+    while (readIndex != writeIndex)
+    {
+        PendingSend& entry = sendRing_[readIndex % SEND_RING_SIZE];
+        IcomPacket packet(entry.packet);
+        sendPacket_(packet, entry.sendTime);
+
+        readIndex++;
+        sendRingReadIndex_.store(readIndex, std::memory_order_release);
+    }
 }
 
 void IcomStateMachine::start(std::string ip, uint16_t port, std::string username, std::string password, int localPort)
@@ -106,6 +144,11 @@ void IcomStateMachine::start(std::string ip, uint16_t port, std::string username
     username_ = username;
     password_ = password;
 
+    // Packet buffers are only needed once we talk to an Icom radio. The
+    // control connection always starts before CI-V and audio, so this
+    // happens before the other state machines need it.
+    IcomPacketPool::Initialize();
+
     // Create and bind UDP socket to force the specified local port number.
     if (localPort == 0)
     {
@@ -120,22 +163,54 @@ void IcomStateMachine::start(std::string ip, uint16_t port, std::string username
 
     // We're now connected, start running the state machine.
     transitionState(IcomProtocolState::ARE_YOU_THERE);
-    
-    packetReadTimer_.start();
+}
+
+void IcomStateMachine::rebind()
+{
+    if (getCurrentState() == nullptr || socket_ == 0)
+    {
+        return;
+    }
+
+    ESP_LOGI(getName().c_str(), "Reopening socket on new interface");
+    openSocket_();
+
+    // Same as when the radio stops responding; LoginState reuses the 
+    // cached session where it can.
+    transitionState(IcomProtocolState::ARE_YOU_THERE);
 }
 
 void IcomStateMachine::openSocket_()
 {
     if (socket_ > 0)
     {
-        close(socket_);
+        closeSocket_();
     }
 
     struct sockaddr_in radioAddress;
     radioAddress.sin_addr.s_addr = inet_addr(ip_.c_str());
     radioAddress.sin_family = AF_INET;
     radioAddress.sin_port = htons(port_);
-    
+
+    // Generate our identifier by concatenating the last two octets of our IP
+    // with the port we're using to connect. We bind to this port ourselves prior
+    // to connection.
+    uint32_t localIp = radioAddress.sin_addr.s_addr;
+    ourIdentifier_ = 
+        (((localIp >> 8) & 0xFF) << 24) | 
+        ((localIp & 0xFF) << 16) |
+        (localPort_ & 0xFFFF);
+
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    bool ok = pbufSocket_.open(localPort_, NetworkQos::GetProfile(getQosStreamType()).tos, &OnPbufReceived_, this);
+    assert(ok);
+    ok = pbufSocket_.connect(radioAddress.sin_addr.s_addr, port_);
+    assert(ok);
+
+    // Received packets are posted to our task straight from the lwIP 
+    // thread (see OnPbufReceived_()) rather than through NetworkReactor.
+    socket_ = 1;
+#else
     socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (socket_ == -1)
     {
@@ -159,15 +234,6 @@ void IcomStateMachine::openSocket_()
     }
     assert(rv != -1);
 
-    // Generate our identifier by concatenating the last two octets of our IP
-    // with the port we're using to connect. We bind to this port ourselves prior
-    // to connection.
-    uint32_t localIp = radioAddress.sin_addr.s_addr;
-    ourIdentifier_ = 
-        (((localIp >> 8) & 0xFF) << 24) | 
-        ((localIp & 0xFF) << 16) |
-        (localPort_ & 0xFFFF);
-
     // Connect to the radio.
     rv = connect(socket_, (struct sockaddr*)&radioAddress, sizeof(radioAddress));
     if (rv == -1)
@@ -178,13 +244,25 @@ void IcomStateMachine::openSocket_()
     assert(rv != -1);
     
     // Initialize Wi-Fi prioritization
-    const int precedenceVI = 6;
-    const int precedenceOffset = 7;
-    int priority = (precedenceVI << precedenceOffset);
-    setsockopt(socket_, IPPROTO_IP, IP_TOS, &priority, sizeof(priority));
+    NetworkQos::ApplyProfile(socket_, getQosStreamType());
 
     // Use non-blocking sockets
     fcntl(socket_, F_SETFL, O_NONBLOCK);
+
+    // Received packets are handled as NetworkReactor tells us about them.
+    NetworkReactor::Register(socket_, getTask());
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+}
+
+void IcomStateMachine::closeSocket_()
+{
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    pbufSocket_.close();
+#else
+    NetworkReactor::Unregister(socket_);
+    close(socket_);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    socket_ = 0;
 }
 
 void IcomStateMachine::onTransitionComplete_()
@@ -194,16 +272,16 @@ void IcomStateMachine::onTransitionComplete_()
         ESP_LOGI(getName().c_str(), "Disconnecting");
         
         // Close the socket after we send out everything pending.
-        CloseSocketMessage message;
+        CloseSocketMessage message(this);
         getTask()->post(&message);
         
         // Send disconnected message to indicate that we're done.
-        DisconnectedRadioMessage disconnectedMessage;
+        DisconnectedRadioMessage disconnectedMessage(this);
         getTask()->post(&disconnectedMessage);
     }
 }
 
-void IcomStateMachine::readPendingPackets_(DVTimer*)
+void IcomStateMachine::readPendingPackets_()
 {
     auto state = getProtocolState_();
     
@@ -213,38 +291,84 @@ void IcomStateMachine::readPendingPackets_(DVTimer*)
         return;
     }
        
-    // Process if there are pending datagrams in the buffer
+    // Process all pending datagrams in the buffer (e.g. audio plus ping plus
+    // retransmits at once), up to a budget so that a flood can't starve the 
+    // rest of the task. Anything left results in another notification once
+    // we rearm. We also stop once our own queue is full so that the backlog
+    // stays in lwIP instead of being dropped.
     char buffer[MAX_PACKET_SIZE];
-    auto rv = recv(socket_, buffer, MAX_PACKET_SIZE, 0);
-    if (rv > 0)
+    auto task = getTask();
+    int ctr = MAX_PACKETS_PER_READ;
+    while (ctr-- > 0 && task->canPostMessage<ReceivePacketMessage>())
     {
-        auto packet = new IcomPacket(buffer, rv);
-        assert(packet != nullptr);
+        auto rv = recv(socket_, buffer, MAX_PACKET_SIZE, 0);
+        if (rv <= 0)
+        {
+            break;
+        }
+
+        NetworkQos::RecordReceive(getQosStreamType(), esp_timer_get_time());
+#if CONFIG_EZDV_PACKET_CAPTURE
+        PacketCapture::Record(getQosStreamType(), buffer, rv);
+#endif // CONFIG_EZDV_PACKET_CAPTURE
+
+        IcomPacket packet(buffer, rv);
 
         // Queue up packet for future processing.
-        ReceivePacketMessage message(packet);
-        getTask()->post(&message);
+        ReceivePacketMessage message(this, packet.detach());
+        task->post(&message);
     }
 }
 
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+void IcomStateMachine::OnPbufReceived_(void* arg, struct pbuf* p)
+{
+    // Called on the lwIP thread. The packet goes straight from the pbuf into
+    // a pool buffer and onto our task's queue; there's no lwIP backlog to 
+    // leave it in if the queue is full, so it's dropped (and retransmitted
+    // by the radio later if it matters).
+    IcomStateMachine* machine = (IcomStateMachine*)arg;
+    auto task = machine->getTask();
+    if (p->tot_len <= MAX_PACKET_SIZE && task->canPostMessage<ReceivePacketMessage>())
+    {
+        NetworkQos::RecordReceive(machine->getQosStreamType(), esp_timer_get_time());
+
+        IcomPacket packet(p->tot_len);
+        pbuf_copy_partial(p, (void*)packet.getData(), p->tot_len, 0);
+#if CONFIG_EZDV_PACKET_CAPTURE
+        PacketCapture::Record(machine->getQosStreamType(), packet.getData(), p->tot_len);
+#endif // CONFIG_EZDV_PACKET_CAPTURE
+
+        ReceivePacketMessage message(machine, packet.detach());
+        task->post(&message);
+    }
+
+    pbuf_free(p);
+}
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+
 IcomProtocolState* IcomStateMachine::getProtocolState_()
 {
     return static_cast<IcomProtocolState*>(getCurrentState());
 }
 
-void IcomStateMachine::onSendPacket_(DVTask* owner, SendPacketMessage* message)
+void IcomStateMachine::sendPacket_(IcomPacket& packet, int64_t sendTime)
 {
     const int MAX_RETRY_TIME_MS = 25;
     const int EXPIRE_TIME_MS = 500;
-    
-    auto packet = message->packet;
-    assert(packet != nullptr);
 
-    if (socket_ > 0 && (esp_timer_get_time() - message->sendTime)/1000 <= EXPIRE_TIME_MS)
+    if (socket_ > 0 && (esp_timer_get_time() - sendTime)/1000 <= EXPIRE_TIME_MS)
     {
         auto startTime = esp_timer_get_time();
         int tries = 1;
-        int rv = send(socket_, packet->getData(), packet->getSendLength(), 0);
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+        // Sent by reference straight from the packet pool.
+        auto sendOnce = [&]() { return pbufSocket_.send(packet.getData(), packet.getSendLength()); };
+#else
+        auto sendOnce = [&]() { return send(socket_, packet.getData(), packet.getSendLength(), 0); };
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+
+        int rv = sendOnce();
         auto totalTimeMs = (esp_timer_get_time() - startTime)/1000;
         while (rv == -1 && totalTimeMs < MAX_RETRY_TIME_MS)
         {
@@ -254,7 +378,7 @@ void IcomStateMachine::onSendPacket_(DVTask* owner, SendPacketMessage* message)
                 // Wait a bit and try again; the Wi-Fi subsystem isn't ready yet.
                 vTaskDelay(5);
                 tries++;
-                rv = send(socket_, packet->getData(), packet->getSendLength(), 0);
+                rv = sendOnce();
                 totalTimeMs = (esp_timer_get_time() - startTime)/1000;
             }
             else
@@ -268,6 +392,9 @@ void IcomStateMachine::onSendPacket_(DVTask* owner, SendPacketMessage* message)
             }
         }
         
+        NetworkQos::RecordSend(getQosStreamType(), rv != -1);
+        NetworkQos::RecordSendRetries(getQosStreamType(), tries - 1);
+        
         if (totalTimeMs >= MAX_RETRY_TIME_MS)
         {
             ESP_LOGE(getName().c_str(), "Wi-Fi subsystem took too long to become ready, dropping packet");
@@ -276,36 +403,59 @@ void IcomStateMachine::onSendPacket_(DVTask* owner, SendPacketMessage* message)
         {
             ESP_LOGW(getName().c_str(), "Needed %d tries to send a packet", tries);
         }
-
-        // Read any packets that are available from the radio
-        readPendingPackets_(nullptr);
     }
-    
-    delete packet;
 }
 
 void IcomStateMachine::onReceivePacket_(DVTask* origin, ReceivePacketMessage* message)
 {
+    if (message->machine != this)
+    {
+        // For another machine on the same task.
+        return;
+    }
+
     assert(message->packet != nullptr);
+    IcomPacket packet(message->packet);
 
     // Forward packet to current state for processing.
     auto state = static_cast<IcomProtocolState*>(getCurrentState());
     if (state != nullptr)
     {
-        state->onReceivePacket(*message->packet);
+        state->onReceivePacket(packet);
     }
-    delete message->packet;
 }
 
 void IcomStateMachine::onCloseSocket_(DVTask* owner, CloseSocketMessage* message)
 {
+    if (message->machine != this)
+    {
+        return;
+    }
+
     ESP_LOGI(getName().c_str(), "Closing UDP socket");
 
-    // We're fully shut down now, so close the socket.
-    close(socket_);
-    socket_ = 0;
-    
-    packetReadTimer_.stop();
+    // We're fully shut down now, so close the socket once
+    // everything queued has gone out.
+    flushPendingSends();
+    closeSocket_();
+}
+
+void IcomStateMachine::onSocketReadable_(DVTask* owner, SocketReadableMessage* message)
+{
+    if (message->socket != socket_)
+    {
+        // Left over from a socket we've since closed.
+        return;
+    }
+
+    readPendingPackets_();
+
+    // Once disconnected the socket is about to be closed, so there's no 
+    // point in hearing about it again.
+    if (getProtocolState_() != nullptr)
+    {
+        NetworkReactor::Rearm(socket_);
+    }
 }
 
 }
@@ -18,9 +18,16 @@
 #ifndef ICOM_STATE_MACHINE_H
 #define ICOM_STATE_MACHINE_H
 
+#include <atomic>
+
 #include "StateMachine.h"
 #include "IcomMessage.h"
 #include "IcomPacket.h"
+#include "network/NetworkQos.h"
+#include "network/NetworkMessage.h"
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+#include "network/UdpPbufSocket.h"
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
 #include "task/DVTimer.h"
 
 using namespace ezdv::task;
@@ -48,8 +55,23 @@ public:
 
     void start(std::string ip, uint16_t port, std::string username, std::string password, int localPort = 0);
 
+    /// @brief Reopens the socket (e.g. after moving to another network 
+    ///        interface) and reconnects, resuming the session if possible.
+    ///        Does nothing if we're not connected.
+    void rebind();
+
+    /// @brief Sends a packet without tracking it for retransmission. Packets
+    ///        sent from the owning task go straight to the socket; others are
+    ///        queued for it (only one other task may do so at a time).
     void sendUntracked(IcomPacket& packet);
 
+    /// @brief Sends packets queued by sendUntracked() from other tasks. Called from the owning task.
+    void flushPendingSends();
+
+    /// @brief Returns which QoS profile and counters this machine's socket uses.
+    virtual NetworkQos::StreamType getQosStreamType() = 0;
+
+    std::string getIp();
     std::string getUsername();
     std::string getPassword();
 
@@ -62,7 +84,20 @@ protected:
     virtual void onTransitionComplete_();
 
 private:
+    // Single producer/single consumer ring for packets sent from other tasks.
+    enum { SEND_RING_SIZE = 32 };
+
+    struct PendingSend
+    {
+        IcomPacketBuffer* packet; // reference owned by the ring
+        int64_t sendTime;
+    };
+
     int socket_;
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    // Used instead of socket_ (which is then only a "connected" flag).
+    UdpPbufSocket pbufSocket_;
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
 
     uint32_t ourIdentifier_;
     uint32_t theirIdentifier_;
@@ -72,18 +107,26 @@ private:
     std::string username_;
     std::string password_;
     uint16_t localPort_;
-    
-    DVTimer packetReadTimer_;
+
+    PendingSend sendRing_[SEND_RING_SIZE];
+    std::atomic<uint32_t> sendRingWriteIndex_;
+    std::atomic<uint32_t> sendRingReadIndex_;
 
     IcomProtocolState* getProtocolState_();
 
-    void onSendPacket_(DVTask* owner, SendPacketMessage* message);
     void onReceivePacket_(DVTask* owner, ReceivePacketMessage* message);
     void onCloseSocket_(DVTask* owner, CloseSocketMessage* message);
+    void onSocketReadable_(DVTask* owner, SocketReadableMessage* message);
     
     void openSocket_();
     
-    void readPendingPackets_(DVTimer*);
+    void closeSocket_();
+    void sendPacket_(IcomPacket& packet, int64_t sendTime);
+    void readPendingPackets_();
+
+#if CONFIG_EZDV_AUDIO_PBUF_SOCKETS
+    static void OnPbufReceived_(void* arg, struct pbuf* p);
+#endif // CONFIG_EZDV_AUDIO_PBUF_SOCKETS
 };
 
 }
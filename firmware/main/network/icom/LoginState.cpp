@@ -16,14 +16,20 @@
  */
 
 #include <sys/socket.h>
+#include <cstring>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "LoginState.h"
 #include "IcomStateMachine.h"
 #include "RadioPacketDefinitions.h"
 #include "IcomMessage.h"
 #include "network/ReportingMessage.h"
 
+// How long to wait for the radio to accept our cached token before
+// logging in from scratch.
+#define RESUME_TIMEOUT_MS (1000)
+
 namespace ezdv
 {
 
@@ -33,17 +39,26 @@ namespace network
 namespace icom
 {
 
+LoginState::CachedSession LoginState::CachedSession_;
+uint32_t LoginState::AudioSampleRate_ = MAX_AUDIO_SAMPLE_RATE;
+
 LoginState::LoginState(IcomStateMachine* parent)
     : TrackedPacketState(parent)
     , tokenRenewTimer_(parent->getTask(), this, &LoginState::onTokenRenewTimer_, MS_TO_US(TOKEN_RENEWAL), "IcomTokenRenewTimer")
+    , resumeTimer_(parent->getTask(), this, &LoginState::onResumeTimer_, MS_TO_US(RESUME_TIMEOUT_MS), "IcomResumeTimer")
     , ourTokenRequest_(0)
     , theirToken_(0)
     , authSequenceNumber_(0)
     , civPort_(0)
     , audioPort_(0)
+    , requestedSampleRate_(AudioSampleRate_)
     , isDisconnecting_(false)
+    , isResuming_(false)
+    , isStreamRequested_(false)
+    , keepSession_(false)
 {
-    // empty
+    tokenRenewTimer_.useTimerWheel();
+    resumeTimer_.useTimerWheel();
 }
 
 void LoginState::onEnterState()
@@ -52,24 +67,40 @@ void LoginState::onEnterState()
 
     // Reset token/auth info
     isDisconnecting_ = false;
+    isResuming_ = false;
+    isStreamRequested_ = false;
+    keepSession_ = false;
     ourTokenRequest_ = 0;
     theirToken_ = 0;
     authSequenceNumber_ = 0;
     civPort_ = 0;
     audioPort_ = 0;
-
-    // Login packet is only necessary on the control state machine.
-    sendLoginPacket_();
     clearRadioCapabilities_();
+
+    // Login packet is only necessary on the control state machine. If we
+    // were recently logged in, try to pick up where we left off instead.
+    if (canResumeSession_())
+    {
+        resumeSession_();
+    }
+    else
+    {
+        sendLoginPacket_();
+    }
 }
 
 void LoginState::onExitState()
 {
     // Disable token renew timer.
     tokenRenewTimer_.stop();
+    resumeTimer_.stop();
     
-    // Send token removal packet to cause radio to disconnect.
-    sendTokenRemovePacket_();
+    // Send token removal packet to cause radio to disconnect, unless
+    // we're going to try to resume the session right away.
+    if (!keepSession_)
+    {
+        sendTokenRemovePacket_();
+    }
 
     // Perform base class cleanup actions.
     TrackedPacketState::onExitState();
@@ -82,23 +113,25 @@ std::string LoginState::getName()
 
 void LoginState::onReceivePacket(IcomPacket& packet)
 {
-    std::string connType;
+    std::string_view connType;
     bool packetSent = false;
     bool isPasswordIncorrect;
     uint16_t tokenRequest;
     uint32_t radioToken;
-    std::vector<radio_cap_packet_t, util::PSRamAllocator<radio_cap_packet_t>> radios;
-    std::string radioName;
+    IcomPacket::RadioCapabilityList radios;
+    std::string_view radioName;
     uint32_t radioIp;
     bool isBusy;
     bool connSuccess;
     bool connDisconnected;
     uint16_t remoteCivPort;
     uint16_t remoteAudioPort;
+    uint8_t tokenRequestType;
+    bool tokenSuccess;
 
     if (packet.isLoginResponse(connType, isPasswordIncorrect, tokenRequest, radioToken))
     {
-        ESP_LOGI(parent_->getName().c_str(), "Connection type: %s", connType.c_str());
+        ESP_LOGI(parent_->getName().c_str(), "Connection type: %.*s", (int)connType.size(), connType.data());
         ESP_LOGI(parent_->getName().c_str(), "Password incorrect: %d", isPasswordIncorrect);
         ESP_LOGI(parent_->getName().c_str(), "Token req: %x, our token req: %lx, radio token: %lx", tokenRequest, ourTokenRequest_, radioToken);
         
@@ -110,24 +143,55 @@ void LoginState::onReceivePacket(IcomPacket& packet)
             
             // Begin renewing token every 60 seconds.
             tokenRenewTimer_.start();
+
+            // Remember the session in case we need to reconnect.
+            CachedSession_.valid = true;
+            CachedSession_.ip = parent_->getIp();
+            CachedSession_.username = parent_->getUsername();
+            CachedSession_.tokenRequest = ourTokenRequest_;
+            CachedSession_.token = radioToken;
+            CachedSession_.civPort = 0;
+            CachedSession_.audioPort = 0;
+            CachedSession_.lastTokenTime = esp_timer_get_time();
+            CachedSession_.hasCapability = false;
         }
         else
         {
             ESP_LOGE(parent_->getName().c_str(), "Password incorrect!");
+            invalidateSession_();
 
             // TBD: cleanup?
         }
     }
+    else if (packet.isTokenResponse(tokenRequestType, tokenSuccess) && tokenRequestType == 0x05)
+    {
+        // Token renewal response (either periodic or for a resumed session).
+        if (tokenSuccess)
+        {
+            CachedSession_.lastTokenTime = esp_timer_get_time();
+        }
+
+        if (isResuming_)
+        {
+            endResume_(tokenSuccess);
+            packetSent = true;
+        }
+        else if (!tokenSuccess)
+        {
+            ESP_LOGW(parent_->getName().c_str(), "Radio rejected token renewal");
+            invalidateSession_();
+        }
+    }
     else if (packet.isCapabilitiesPacket(radios))
     {
         ESP_LOGI(parent_->getName().c_str(), "Available radios:");
-        int index = 0;
-        for (auto& radio : radios)
+        for (uint16_t index = 0; index < radios.size(); index++)
         {
+            auto radio = radios[index];
             ESP_LOGI(
                 parent_->getName().c_str(),
                 "[%d]    %s: MAC=%02x:%02x:%02x:%02x:%02x:%02x, CIV=%02x, Audio=%s (rxsample %d, txsample %d)", 
-                index++, 
+                index, 
                 radio->name,
                 radio->macaddress[0], radio->macaddress[1], radio->macaddress[2], radio->macaddress[3], radio->macaddress[4], radio->macaddress[5],
                 radio->civ, 
@@ -142,8 +206,9 @@ void LoginState::onReceivePacket(IcomPacket& packet)
     {
         ESP_LOGI(
             parent_->getName().c_str(), 
-            "Connection info for %s: IP = %lx, Is Busy = %d",
-            radioName.c_str(),
+            "Connection info for %.*s: IP = %lx, Is Busy = %d",
+            (int)radioName.size(),
+            radioName.data(),
             radioIp,
             isBusy ? 1 : 0);
             
@@ -166,6 +231,7 @@ void LoginState::onReceivePacket(IcomPacket& packet)
                 IcomCIVAudioConnectionInfo message(0, 0, 0, 0);
                 parent_->getTask()->publish(&message);
 
+                invalidateSession_();
                 parent_->reset();
             }
             else
@@ -176,7 +242,7 @@ void LoginState::onReceivePacket(IcomPacket& packet)
                     remoteAudioPort,
                     remoteCivPort);
                 
-                IcomCIVAudioConnectionInfo message(civPort_, remoteCivPort, audioPort_, remoteAudioPort);
+                IcomCIVAudioConnectionInfo message(civPort_, remoteCivPort, audioPort_, remoteAudioPort, requestedSampleRate_);
                 parent_->getTask()->publish(&message);
 
                 EnableReportingMessage enableReportingMessage;
@@ -193,6 +259,8 @@ void LoginState::onReceivePacket(IcomPacket& packet)
             DisableReportingMessage enableReportingMessage;
             parent_->getTask()->publish(&enableReportingMessage);
             
+            // The token may still be good, so hold on to it.
+            keepSession_ = true;
             parent_->transitionState(IcomProtocolState::ARE_YOU_THERE);
         }
         else
@@ -201,7 +269,15 @@ void LoginState::onReceivePacket(IcomPacket& packet)
                 parent_->getName().c_str(), 
                 "Connection failed"
             );
-                
+
+            if (requestedSampleRate_ > 8000)
+            {
+                // Older radios may not support wideband audio.
+                ESP_LOGW(parent_->getName().c_str(), "Falling back to 8 kHz audio");
+                AudioSampleRate_ = 8000;
+            }
+            
+            keepSession_ = true;
             parent_->transitionState(IcomProtocolState::ARE_YOU_THERE);
         }
     }
@@ -252,6 +328,71 @@ void LoginState::onTokenRenewTimer_(DVTimer*)
     sendTokenRenewPacket_();
 }
 
+void LoginState::onResumeTimer_(DVTimer*)
+{
+    ESP_LOGW(parent_->getName().c_str(), "No response to session resume");
+    endResume_(false);
+}
+
+bool LoginState::canResumeSession_()
+{
+    // Tokens are renewed every TOKEN_RENEWAL ms, so one that hasn't been
+    // renewed in that long has likely expired on the radio.
+    return 
+        CachedSession_.valid &&
+        CachedSession_.hasCapability &&
+        CachedSession_.ip == parent_->getIp() &&
+        CachedSession_.username == parent_->getUsername() &&
+        (esp_timer_get_time() - CachedSession_.lastTokenTime) / 1000 < TOKEN_RENEWAL;
+}
+
+void LoginState::resumeSession_()
+{
+    ESP_LOGI(parent_->getName().c_str(), "Attempting to resume previous session");
+
+    isResuming_ = true;
+    ourTokenRequest_ = CachedSession_.tokenRequest;
+    theirToken_ = CachedSession_.token;
+    civPort_ = CachedSession_.civPort;
+    audioPort_ = CachedSession_.audioPort;
+
+    IcomPacket capPacket(CachedSession_.capability, RADIO_CAP_SIZE);
+    radioCapabilities_.push_back(std::move(capPacket));
+
+    sendTokenRenewPacket_();
+    resumeTimer_.start();
+}
+
+void LoginState::endResume_(bool resumed)
+{
+    isResuming_ = false;
+    resumeTimer_.stop();
+
+    if (resumed)
+    {
+        ESP_LOGI(parent_->getName().c_str(), "Session resumed, reopening streams");
+        tokenRenewTimer_.start();
+        sendUseRadioPacket_(0);
+    }
+    else
+    {
+        ESP_LOGI(parent_->getName().c_str(), "Could not resume session, logging in");
+        invalidateSession_();
+
+        ourTokenRequest_ = 0;
+        theirToken_ = 0;
+        civPort_ = 0;
+        audioPort_ = 0;
+        clearRadioCapabilities_();
+        sendLoginPacket_();
+    }
+}
+
+void LoginState::invalidateSession_()
+{
+    CachedSession_.valid = false;
+}
+
 void LoginState::clearRadioCapabilities_()
 {
     radioCapabilities_.clear();
@@ -259,19 +400,19 @@ void LoginState::clearRadioCapabilities_()
 
 void LoginState::insertCapability_(radio_cap_packet_t radio)
 {
-    IcomPacket packet((char*)&radio, sizeof(radio_cap_packet));
-    //radioCapabilities_.push_back(std::move(packet));
-    radioCapabilities_.push_back(packet);
-}
+    IcomPacket packet((char*)radio, sizeof(radio_cap_packet));
+    radioCapabilities_.push_back(std::move(packet));
 
-void LoginState::sendUseRadioPacket_(int radioIndex)
-{
-    if (civPort_ > 0 || audioPort_ > 0)
+    // Only the first radio is ever used (see sendUseRadioPacket_()).
+    if (!CachedSession_.hasCapability)
     {
-        // we've already connected, no need to try again
-        return;
+        memcpy(CachedSession_.capability, radio, RADIO_CAP_SIZE);
+        CachedSession_.hasCapability = true;
     }
-    
+}
+
+void LoginState::allocateLocalPorts_()
+{
     // We need to create CIV and audio sockets and get their local port numbers.
     // The protocol seems to require it, which is weird but ok.
     auto civSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -306,6 +447,28 @@ void LoginState::sendUseRadioPacket_(int radioIndex)
     close(civSocket);
     close(audioSocket);
 
+    CachedSession_.civPort = civPort_;
+    CachedSession_.audioPort = audioPort_;
+}
+
+void LoginState::sendUseRadioPacket_(int radioIndex)
+{
+    if (isStreamRequested_)
+    {
+        // we've already connected, no need to try again
+        return;
+    }
+    isStreamRequested_ = true;
+
+    if (civPort_ == 0 || audioPort_ == 0)
+    {
+        allocateLocalPorts_();
+    }
+    else
+    {
+        ESP_LOGI(parent_->getName().c_str(), "Reusing local UDP ports %d (CIV) and %d (audio)", civPort_, audioPort_);
+    }
+
     IcomPacket packet(sizeof(conninfo_packet));
     auto typedPacket = packet.getTypedPacket<conninfo_packet>();
     
@@ -336,16 +499,18 @@ void LoginState::sendUseRadioPacket_(int radioIndex)
     typedPacket->rxenable = 1;
     typedPacket->txenable = 1;
     
-    // Force 8K sample rate PCM
+    // Force 16-bit mono PCM (8 or 16 kHz)
+    requestedSampleRate_ = AudioSampleRate_;
+    ESP_LOGI(parent_->getName().c_str(), "Requesting %" PRIu32 " Hz audio", requestedSampleRate_);
     typedPacket->rxcodec = 4;
-    typedPacket->rxsample = ToBigEndian((uint32_t)8000);
+    typedPacket->rxsample = ToBigEndian((uint32_t)requestedSampleRate_);
     typedPacket->txcodec = 4;
-    typedPacket->txsample = ToBigEndian((uint32_t)8000);
+    typedPacket->txsample = ToBigEndian((uint32_t)requestedSampleRate_);
     
     // CIV/audio local port numbers and latency
     typedPacket->civport = ToBigEndian((uint32_t)civPort_);
     typedPacket->audioport = ToBigEndian((uint32_t)audioPort_);
-    typedPacket->txbuffer = ToBigEndian((uint32_t)280);
+    typedPacket->txbuffer = ToBigEndian((uint32_t)TX_BUFFER_PERIOD);
     typedPacket->convert = 1;
     
     sendTracked_(packet);
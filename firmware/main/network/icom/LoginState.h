@@ -18,6 +18,8 @@
 #ifndef LOGIN_STATE_H
 #define LOGIN_STATE_H
 
+#include <vector>
+
 #include "TrackedPacketState.h"
 
 namespace ezdv
@@ -45,25 +47,58 @@ public:
     virtual void onReceivePacket(IcomPacket& packet) override;
 
 private:
+    /// @brief What's needed to pick the session back up after losing the 
+    ///        connection. Kept across task restarts (e.g. after Wi-Fi drops).
+    struct CachedSession
+    {
+        bool valid;
+        std::string ip;
+        std::string username;
+        uint32_t tokenRequest;
+        uint32_t token;
+        int civPort;
+        int audioPort;
+        int64_t lastTokenTime;
+        bool hasCapability;
+        char capability[RADIO_CAP_SIZE];
+    };
+
+    static CachedSession CachedSession_;
+
+    // Audio sample rate to ask for; drops to 8 kHz if the radio won't do better.
+    static uint32_t AudioSampleRate_;
+
     DVTimer tokenRenewTimer_;
+    DVTimer resumeTimer_;
     std::vector<IcomPacket, util::PSRamAllocator<IcomPacket>> radioCapabilities_;
     uint32_t ourTokenRequest_;
     uint32_t theirToken_;
     uint16_t authSequenceNumber_;
     int civPort_;
     int audioPort_;
+    uint32_t requestedSampleRate_;
     bool isDisconnecting_;
+    bool isResuming_;
+    bool isStreamRequested_;
+    bool keepSession_;
 
     void sendLoginPacket_();
     void sendTokenAckPacket_(uint32_t theirToken);
     void sendTokenRenewPacket_();
     void sendTokenRemovePacket_();
     void sendUseRadioPacket_(int radioIndex);
+    void allocateLocalPorts_();
 
     void insertCapability_(radio_cap_packet_t radio);
     void clearRadioCapabilities_();
 
+    bool canResumeSession_();
+    void resumeSession_();
+    void endResume_(bool resumed);
+    void invalidateSession_();
+
     void onTokenRenewTimer_(DVTimer*);
+    void onResumeTimer_(DVTimer*);
 };
 
 }
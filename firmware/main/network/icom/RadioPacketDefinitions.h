@@ -20,6 +20,8 @@
 
 #include <inttypes.h>
 
+#include "sdkconfig.h"
+
 // Thanks to the wfview project for helping reverse engineer Icom's UDP protocol.
 // Original file at https://gitlab.com/eliggett/wfview/-/blob/master/packettypes.h, modified
 // to take into account lower resources on the ESP32 series MCUs and available integer types.
@@ -42,6 +44,14 @@
 #define BUFSIZE 500 // Number of packets to buffer
 #define MAX_MISSING 50 // More than this indicates serious network problem 
 #define AUDIO_PERIOD 20 
+#define TX_AUDIO_PERIOD CONFIG_EZDV_ICOM_TX_AUDIO_PACKET_MS
+#if CONFIG_EZDV_ICOM_AUDIO_16K
+#define MAX_AUDIO_SAMPLE_RATE 16000
+#else
+#define MAX_AUDIO_SAMPLE_RATE 8000
+#endif // CONFIG_EZDV_ICOM_AUDIO_16K
+#define TX_AUDIO_MAX_SAMPLES (TX_AUDIO_PERIOD * MAX_AUDIO_SAMPLE_RATE / 1000)
+#define TX_BUFFER_PERIOD 280            // Radio-side TX buffer requested at login (ms)
 #define GUIDLEN 16
 
 // And this number of RX audio packets
@@ -18,6 +18,7 @@
 #include <cassert>
 #include "StateMachine.h"
 #include "StateMachineState.h"
+#include "util/EventTrace.h"
 
 extern "C"
 {
@@ -37,7 +38,7 @@ StateMachine::StateMachine(DVTask* owner)
     : owner_(owner)
     , currentState_(nullptr)
 {
-    owner_->registerMessageHandler(this, &StateMachine::onStateMachineTransition_);
+    owner_->registerMessageHandlers<&StateMachine::onStateMachineTransition_>(this);
 }
 
 DVTask* StateMachine::getTask()
@@ -68,14 +69,14 @@ std::string StateMachine::getName()
 void StateMachine::transitionState(int newState)
 {
     // Queue up state transition
-    StateMachineTransitionMessage message(newState);
+    StateMachineTransitionMessage message(this, newState);
     owner_->post(&message);
 }
 
 void StateMachine::reset()
 {
     // Queue up state transition
-    StateMachineTransitionMessage message(-1);
+    StateMachineTransitionMessage message(this, -1);
     owner_->post(&message);
 }
 
@@ -91,6 +92,11 @@ void StateMachine::addState_(int stateId, StateMachineState* state)
 
 void StateMachine::onStateMachineTransition_(DVTask* origin, StateMachineTransitionMessage* message)
 {
+    if (message->machine != this)
+    {
+        return;
+    }
+
     if (currentState_ != nullptr)
     {
         currentState_->onExitState();
@@ -104,6 +110,7 @@ void StateMachine::onStateMachineTransition_(DVTask* origin, StateMachineTransit
     }
     
     currentState_ = newState;
+    EZDV_TRACE(STATE_TRANSITION, message->newState, owner_->getTaskName(), 0);
     
     if (currentState_ != nullptr)
     {
@@ -69,12 +69,14 @@ private:
     class StateMachineTransitionMessage : public DVTaskMessageBase<1, StateMachineTransitionMessage>
     {
     public:
-        StateMachineTransitionMessage(int newStateProvided = 0)
+        StateMachineTransitionMessage(StateMachine* machineProvided = nullptr, int newStateProvided = 0)
             : DVTaskMessageBase<1, StateMachineTransitionMessage>(STATE_MACHINE_MESSAGE)
+            , machine(machineProvided)
             , newState(newStateProvided)
             {}
         virtual ~StateMachineTransitionMessage() = default;
 
+        StateMachine* machine; // several machines may share a task
         int newState;
     };
 
@@ -15,11 +15,25 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+#include <algorithm>
+
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "TrackedPacketState.h"
 #include "IcomStateMachine.h"
 #include "IcomMessage.h"
 
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+#define KEEPALIVE_MAX_PERIOD CONFIG_EZDV_ICOM_KEEPALIVE_MAX_MS
+
+// RX loss rates (1/65536ths) above which retransmit requests are spaced out.
+#define RX_LOSS_RATE_ONE (65536)
+#define RX_LOSS_RATE_MODERATE (RX_LOSS_RATE_ONE / 50)
+#define RX_LOSS_RATE_HIGH (RX_LOSS_RATE_ONE / 10)
+#define RX_LOSS_RATE_SHIFT (5) // averages over roughly the last 32 packets
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+
 namespace ezdv
 {
 
@@ -33,14 +47,40 @@ TrackedPacketState::TrackedPacketState(IcomStateMachine* parent)
     : IcomProtocolState(parent)
     , pingTimer_(parent_->getTask(), this, &TrackedPacketState::onPingTimer_, MS_TO_US(PING_PERIOD), "IcomPingTimer")
     , idleTimer_(parent_->getTask(), this, &TrackedPacketState::onIdleTimer_, MS_TO_US(IDLE_PERIOD), "IcomIdleTimer")
-    , retransmitRequestTimer_(parent_->getTask(), this, &TrackedPacketState::onRetransmitTimer_, MS_TO_US(RETRANSMIT_PERIOD), "IcomRetransmitRequestTimer")
     , txRetransmitTimer_(parent_->getTask(), this, &TrackedPacketState::onTxRetransmitTimer_, MS_TO_US(TX_RETRANSMIT_PERIOD), "IcomTxRetransmitTimer")
     , cleanupTimer_(parent_->getTask(), this, &TrackedPacketState::onCleanupTimer_, MS_TO_US(WATCHDOG_PERIOD), "IcomCleanupTimer")
+    , retransmitRequestTimer_(parent_->getTask(), this, &TrackedPacketState::onRetransmitRequestTimer_, MS_TO_US(AUDIO_PERIOD), "IcomRetransmitRequestTimer")
     , pingSequenceNumber_(0)
+    , pingSendTimeUs_(0)
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    , lastPingUs_(0)
+    , lastTrackedSendUs_(0)
+    , lastReceiveUs_(0)
+    , pingPeriodMs_(PING_PERIOD)
+    , idlePeriodMs_(IDLE_PERIOD)
+    , rxLossRate_(0)
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
     , sendSequenceNumber_(1) // Start sequence at 1.
     , numSavedBytesInPacketQueue_(0)
+    , rxWindowActive_(false)
+    , rxHighestSequenceNumber_(0)
+    , rxNumTracked_(0)
+    , rxRetransmitWindow_(0)
 {
-    // empty
+    memset(rxWindow_, 0, sizeof(rxWindow_));
+
+    for (auto& slot : sentPackets_)
+    {
+        slot.valid = false;
+        slot.sequenceNumber = 0;
+        slot.sendTime = 0;
+    }
+
+    pingTimer_.useTimerWheel();
+    idleTimer_.useTimerWheel();
+    txRetransmitTimer_.useTimerWheel();
+    cleanupTimer_.useTimerWheel();
+    retransmitRequestTimer_.useTimerWheel();
 }
 
 void TrackedPacketState::onEnterState()
@@ -49,21 +89,29 @@ void TrackedPacketState::onEnterState()
 
     // Reset sequence numbers.
     pingSequenceNumber_ = 0;
+    pingSendTimeUs_ = 0;
     sendSequenceNumber_ = 1; // Start sequence at 1.
 
     // Reset sent packets list
-    sentPackets_.clear();
-    numSavedBytesInPacketQueue_ = 0;
+    clearSentPackets_();
 
     // Reset received packets
-    rxPacketIds_.clear();
-    rxMissingPacketIds_.clear();
+    rxWindowActive_ = false;
+
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    // Start over at the usual keepalive rates.
+    lastPingUs_ = 0;
+    lastTrackedSendUs_ = 0;
+    lastReceiveUs_ = 0;
+    rxLossRate_ = 0;
+    setPingPeriod_(PING_PERIOD);
+    setIdlePeriod_(IDLE_PERIOD);
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
     
     // Start ping, retransmit and idle timers at this point. Idle will be stopped/started
     // whenever we send something.
     pingTimer_.start();
     idleTimer_.start();
-    retransmitRequestTimer_.start();
     cleanupTimer_.start();
 }
 
@@ -84,16 +132,19 @@ void TrackedPacketState::onExitState()
     // Stop timers
     pingTimer_.stop();
     idleTimer_.stop();
-    retransmitRequestTimer_.stop();
     cleanupTimer_.stop();
     txRetransmitTimer_.stop();
+    retransmitRequestTimer_.stop();
+
+    // Return the saved packets to the pool.
+    clearSentPackets_();
 }
 
 void TrackedPacketState::onReceivePacket(IcomPacket& packet)
 {
     uint16_t pingSequence;
-    bool packetSent;
-    std::vector<uint16_t, util::PSRamAllocator<uint16_t>> retryPackets;
+    bool packetSent = false;
+    IcomPacket::SequenceList retryPackets;
     bool addReceivedPacket = false;
 
     if (packet.isPingRequest(pingSequence))
@@ -108,6 +159,11 @@ void TrackedPacketState::onReceivePacket(IcomPacket& packet)
     {
         // Got ping response, increment to next ping sequence number.
         //ESP_LOGI(sm_.get_name().c_str(), "Got ping ack, seq %d", pingSequence);
+        if (pingSequence == pingSequenceNumber_ && pingSendTimeUs_ != 0)
+        {
+            NetworkQos::RecordRtt(parent_->getQosStreamType(), esp_timer_get_time() - pingSendTimeUs_);
+            pingSendTimeUs_ = 0;
+        }
         incrementPingSequence_(pingSequence);
         
         //ESP_LOGI("HEAP", "Free memory: %d", xPortGetFreeHeapSize());
@@ -115,24 +171,25 @@ void TrackedPacketState::onReceivePacket(IcomPacket& packet)
     else if (packet.isRetransmitPacket(retryPackets))
     {
         ESP_LOGI(parent_->getName().c_str(), "Received retransmit packet (currSendSeq: %d)", sendSequenceNumber_);
-        for (auto packetId : retryPackets)
+        for (uint16_t index = 0; index < retryPackets.size(); index++)
         {
-            txRetryPacketIds_[packetId] = 1;
+            txRetryPacketIds_[retryPackets[index]] = 1;
         }
         
-        txRetransmitTimer_.stop();
-        txRetransmitTimer_.start(true);
+        txRetransmitTimer_.restart(true);
     }
     else
     {
         addReceivedPacket = true;
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+        lastReceiveUs_ = esp_timer_get_time();
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
     }
 
     if (packetSent)
     {
         // Recycle idle timer as we sent something non-idle.
-        idleTimer_.stop();
-        idleTimer_.start();
+        idleTimer_.restart();
     }
     
     // Missing packet list processing    
@@ -141,107 +198,198 @@ void TrackedPacketState::onReceivePacket(IcomPacket& packet)
         auto controlPacket = packet.getConstTypedPacket<control_packet>();
         assert(controlPacket != nullptr);
         
-        auto rxSeq = controlPacket->seq;
+        uint16_t rxSeq = controlPacket->seq;
         
-        if (rxPacketIds_.size() == 0)
+        if (!rxWindowActive_)
         {
-            // Add packet to received list if we just started
-            rxPacketIds_.push_back(rxSeq);
+            // Start tracking if we just started
+            resetRxWindow_(rxSeq);
+            return;
         }
-        else
+
+        int16_t delta = (int16_t)(rxSeq - rxHighestSequenceNumber_);
+        if (delta > MAX_MISSING || delta <= -RX_WINDOW_SIZE)
+        {
+            // Too many missing packets (or too far behind), start over.
+            ESP_LOGE(parent_->getName().c_str(), "Too many missing packets, resetting!");
+            resetRxWindow_(rxSeq);
+        }
+        else if (delta > 0)
         {
-            auto firstSeqInBuffer = *rxPacketIds_.begin();
-            auto lastSeqInBuffer = *rxPacketIds_.rbegin();
-            if (rxSeq < firstSeqInBuffer || (rxSeq - lastSeqInBuffer) > MAX_MISSING)
+            // Slide the window forward, forgetting what we had for the
+            // sequence numbers that are now reusing those bits.
+            for (uint16_t seq = rxHighestSequenceNumber_ + 1; seq != rxSeq; seq++)
             {
-                // Too many missing packets, clear buffer and add.
-                ESP_LOGE(parent_->getName().c_str(), "Too many missing packets, resetting!");
-                //ESP_LOGI(parent_->getName().c_str(), "rxSeq = %d, 1st = %d, last = %d", rxSeq, firstSeqInBuffer, lastSeqInBuffer);
-                rxPacketIds_.clear();
-                rxMissingPacketIds_.clear();
-                rxPacketIds_.push_back(rxSeq);
+                setRxPacketReceived_(seq, false);
             }
-            else
+            setRxPacketReceived_(rxSeq, true);
+            rxNumTracked_ = std::min(rxNumTracked_ + delta, (int)RX_WINDOW_SIZE);
+            rxHighestSequenceNumber_ = rxSeq;
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+            updateRxLossRate_(delta - 1);
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+
+            if (delta > 1)
             {
-                auto iter = std::find(rxPacketIds_.begin(), rxPacketIds_.end(), rxSeq);
-                if (iter == rxPacketIds_.end())
+                // Detected missing packets!
+                ESP_LOGW(parent_->getName().c_str(), "Detected missing packets from seq = %d to %d", (uint16_t)(rxSeq - delta + 1), (uint16_t)(rxSeq - 1));
+                NetworkQos::RecordLost(parent_->getQosStreamType(), delta - 1);
+
+                // Only states that can make use of late packets (see 
+                // setRxRetransmitWindow_()) ask for them to be resent.
+                if (rxRetransmitWindow_ > 0)
                 {
-                    if ((rxPacketIds_.size() + 1) > BUFSIZE)
-                    {
-                        // Make sure RX packet list is no bigger than BUFSIZE
-                        rxPacketIds_.erase(rxPacketIds_.begin());
-                    }
-                    
-                    rxPacketIds_.push_back(rxSeq);
-                    
-                    auto missingIter = rxMissingPacketIds_.find(rxSeq);
-                    if (missingIter != rxMissingPacketIds_.end())
-                    {
-                        rxMissingPacketIds_.erase(missingIter);
-                    }
-                    else
-                    {
-                        if (rxSeq > (lastSeqInBuffer + 1))
-                        {
-                            // Detected missing packets!
-                            ESP_LOGW(parent_->getName().c_str(), "Detected missing packets from seq = %d to %d", lastSeqInBuffer + 1, rxSeq);
-                            
-                            // Don't add to the missing packets list. Because of the way ezDV works,
-                            // we wouldn't be able to incorporate these retransmitted packets into e.g.
-                            // any audio being fed to higher layers.
-                            /*for (int id = lastSeqInBuffer + 1; id < rxSeq; id++)
-                            {
-                                rxMissingPacketIds_[id] = 1;
-                            }*/
-                        }
-                    }
+                    requestRxRetransmits_();
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+                    // Also restarts the timer if it's running, which is fine
+                    // as we just sent a request.
+                    retransmitRequestTimer_.changeInterval(MS_TO_US(getRetransmitRequestPeriodMs_()));
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+                    retransmitRequestTimer_.start();
                 }
             }
         }
+        else if (delta < 0 && !isRxPacketReceived_(rxSeq))
+        {
+            // Late, but not a duplicate.
+            setRxPacketReceived_(rxSeq, true);
+            NetworkQos::RecordOutOfOrder(parent_->getQosStreamType());
+        }
     }
 }
 
-void TrackedPacketState::sendTracked_(IcomPacket& packet)
+void TrackedPacketState::setRxRetransmitWindow_(uint16_t numPackets)
 {
-    uint8_t* rawPacket = const_cast<uint8_t*>(packet.getData());
-    
-    // If sequence number rolled over, clear the sent packets list.
-    if (sendSequenceNumber_ == 0)
+    assert(numPackets <= MAX_MISSING);
+    rxRetransmitWindow_ = numPackets;
+}
+
+void TrackedPacketState::requestRxRetransmits_()
+{
+    // Anything older than the window can't be used anymore, and anything
+    // from before the last reset was never expected.
+    uint16_t numToCheck = std::min(rxRetransmitWindow_, rxNumTracked_);
+    uint16_t retransmitList[MAX_MISSING];
+    uint16_t numToRetransmit = 0;
+    for (uint16_t age = 1; age < numToCheck; age++)
+    {
+        uint16_t seq = rxHighestSequenceNumber_ - age;
+        if (!isRxPacketReceived_(seq))
+        {
+            retransmitList[numToRetransmit++] = seq;
+        }
+    }
+
+    if (numToRetransmit == 0)
+    {
+        // Everything's either arrived or too old now.
+        retransmitRequestTimer_.stop();
+        return;
+    }
+
+    auto packet = IcomPacket::CreateRetransmitRequest(parent_->getOurIdentifier(), parent_->getTheirIdentifier(), retransmitList, numToRetransmit);
+    parent_->sendUntracked(packet);
+    NetworkQos::RecordRetransmitRequest(parent_->getQosStreamType(), numToRetransmit);
+}
+
+void TrackedPacketState::onRetransmitRequestTimer_(DVTimer*)
+{
+    requestRxRetransmits_();
+}
+
+void TrackedPacketState::resetRxWindow_(uint16_t rxSeq)
+{
+    memset(rxWindow_, 0, sizeof(rxWindow_));
+    rxWindowActive_ = true;
+    rxNumTracked_ = 1;
+    rxHighestSequenceNumber_ = rxSeq;
+    setRxPacketReceived_(rxSeq, true);
+}
+
+bool TrackedPacketState::isRxPacketReceived_(uint16_t rxSeq)
+{
+    uint32_t bit = rxSeq & (RX_WINDOW_SIZE - 1);
+    return (rxWindow_[bit >> 5] & (1UL << (bit & 31))) != 0;
+}
+
+void TrackedPacketState::setRxPacketReceived_(uint16_t rxSeq, bool received)
+{
+    uint32_t bit = rxSeq & (RX_WINDOW_SIZE - 1);
+    if (received)
     {
-        ESP_LOGI(parent_->getName().c_str(), "Rollover detected, resetting sent packet list");
-        sentPackets_.clear();
-        numSavedBytesInPacketQueue_ = 0;
+        rxWindow_[bit >> 5] |= 1UL << (bit & 31);
     }
-    else if (sentPackets_.size() > BUFSIZE)
+    else
     {
-        sentPackets_.erase(sentPackets_.begin());
+        rxWindow_[bit >> 5] &= ~(1UL << (bit & 31));
     }
+}
+
+void TrackedPacketState::sendTracked_(IcomPacket& packet)
+{
+    uint8_t* rawPacket = const_cast<uint8_t*>(packet.getData());
     
     // We need to manually force the sequence number into the packet because
     // simply treating it like a control_packet doesn't work.
     rawPacket[6] = sendSequenceNumber_ & 0xFF;
     rawPacket[7] = (sendSequenceNumber_ >> 8) & 0xFF;
     
+    // Save the packet in the slot for its sequence number, replacing
+    // whatever was sent SENT_PACKET_RING_SIZE packets ago.
+    SentPacket& slot = sentPackets_[sendSequenceNumber_ & (SENT_PACKET_RING_SIZE - 1)];
+    releaseSentPacket_(slot);
+    slot.valid = true;
+    slot.sequenceNumber = sendSequenceNumber_;
+    slot.sendTime = time(NULL);
+    slot.packet = packet.share();
     numSavedBytesInPacketQueue_ += packet.getSendLength();
+
     parent_->sendUntracked(packet);
-    sentPackets_[sendSequenceNumber_] = std::pair(time(NULL), std::move(packet));
     sendSequenceNumber_++;
+
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    // Idle packets only need to go out when nothing else is being sent.
+    lastTrackedSendUs_ = esp_timer_get_time();
+    setIdlePeriod_(IDLE_PERIOD);
+    idleTimer_.restart();
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
 }
 
 void TrackedPacketState::sendPing_()
 {
     auto packet = IcomPacket::CreatePingPacket(pingSequenceNumber_, parent_->getOurIdentifier(), parent_->getTheirIdentifier());
+    pingSendTimeUs_ = esp_timer_get_time();
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    lastPingUs_ = pingSendTimeUs_;
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
     parent_->sendUntracked(packet);
 }
 
 void TrackedPacketState::onPingTimer_(DVTimer*)
 {
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    auto now = esp_timer_get_time();
+    bool lastPingAnswered = lastPingUs_ != 0 && pingSendTimeUs_ == 0;
+    int64_t periodUs = MS_TO_US((int64_t)pingPeriodMs_);
+    if (lastPingAnswered &&
+        now - lastTrackedSendUs_ < periodUs &&
+        now - lastReceiveUs_ < periodUs &&
+        now - lastPingUs_ < MS_TO_US(KEEPALIVE_MAX_PERIOD))
+    {
+        // Tracked traffic is flowing both ways, so the radio already knows
+        // we're here. Still ping every so often to keep RTT up to date.
+        return;
+    }
+
+    // Back off while the radio keeps answering, but go back to the 
+    // usual rate as soon as it misses one.
+    setPingPeriod_(lastPingAnswered ? std::min(pingPeriodMs_ * 2, (uint32_t)KEEPALIVE_MAX_PERIOD) : PING_PERIOD);
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+
     // Ping timer fired. Send ping request.
     //ESP_LOGI(sm_.get_name().c_str(), "Send ping, seq %d", sm_.getCurrentPingSequence());
-    auto packet = IcomPacket::CreatePingPacket(pingSequenceNumber_, parent_->getOurIdentifier(), parent_->getTheirIdentifier());
-    parent_->sendUntracked(packet);
-    idleTimer_.stop();
-    idleTimer_.start();
+    sendPing_();
+    idleTimer_.restart();
 }
 
 void TrackedPacketState::onIdleTimer_(DVTimer*)
@@ -249,64 +397,107 @@ void TrackedPacketState::onIdleTimer_(DVTimer*)
     // Idle timer fired. Send control packet with seq = 0
     auto packet = IcomPacket::CreateIdlePacket(0, parent_->getOurIdentifier(), parent_->getTheirIdentifier());
     parent_->sendUntracked(packet);
+
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    // Nothing's been sent for a while; keep backing off until something is.
+    setIdlePeriod_(std::min(idlePeriodMs_ * 2, (uint32_t)KEEPALIVE_MAX_PERIOD));
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
 }
 
-void TrackedPacketState::onTxRetransmitTimer_(DVTimer*)
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+void TrackedPacketState::setPingPeriod_(uint32_t periodMs)
 {
-    for (auto& kvp : txRetryPacketIds_)
+    if (periodMs != pingPeriodMs_)
     {
-        retransmitPacket_(kvp.first);
+        pingPeriodMs_ = periodMs;
+        pingTimer_.changeInterval(MS_TO_US(periodMs));
     }
-    
-    txRetryPacketIds_.clear();
 }
-    
-void TrackedPacketState::onRetransmitTimer_(DVTimer*)
+
+void TrackedPacketState::setIdlePeriod_(uint32_t periodMs)
 {
-    if (rxMissingPacketIds_.size() == 0)
+    if (periodMs != idlePeriodMs_)
     {
-        // Skip processing if there are no missing packets.
-        return;
+        idlePeriodMs_ = periodMs;
+        idleTimer_.changeInterval(MS_TO_US(periodMs));
     }
-    else if (rxMissingPacketIds_.size() > MAX_MISSING)
+}
+
+void TrackedPacketState::updateRxLossRate_(uint16_t numLost)
+{
+    // Exponential moving average over each lost packet followed by
+    // the one that was received.
+    for (uint16_t index = 0; index <= numLost; index++)
     {
-        ESP_LOGE(parent_->getName().c_str(), "Too many missing packets while processing retransmit, resetting!");
-        rxPacketIds_.clear();
-        rxMissingPacketIds_.clear();
-        return;
+        uint32_t sample = index < numLost ? RX_LOSS_RATE_ONE : 0;
+        rxLossRate_ = rxLossRate_ - (rxLossRate_ >> RX_LOSS_RATE_SHIFT) + (sample >> RX_LOSS_RATE_SHIFT);
     }
-    
-    std::vector<uint16_t, util::PSRamAllocator<uint16_t>> retransmitList;
-    for (auto& packet : rxMissingPacketIds_)
+}
+
+uint32_t TrackedPacketState::getRetransmitRequestPeriodMs_()
+{
+    // Requests compete for airtime with the audio they're trying to recover,
+    // so send them less often as loss goes up. They still need to go out 
+    // at least twice while missing packets are within the retransmit window
+    // (which is in AUDIO_PERIOD packets).
+    uint32_t periodMs = AUDIO_PERIOD;
+    if (rxLossRate_ >= RX_LOSS_RATE_HIGH)
     {
-        retransmitList.push_back(packet.first);
+        periodMs *= 4;
     }
-    
-    // Send retransmit request
-    auto packet = IcomPacket::CreateRetransmitRequest(parent_->getOurIdentifier(), parent_->getTheirIdentifier(), retransmitList);
-    parent_->sendUntracked(packet);
+    else if (rxLossRate_ >= RX_LOSS_RATE_MODERATE)
+    {
+        periodMs *= 2;
+    }
+
+    uint32_t maxPeriodMs = std::max((uint32_t)(rxRetransmitWindow_ * AUDIO_PERIOD / 2), (uint32_t)AUDIO_PERIOD);
+    return std::min(periodMs, maxPeriodMs);
 }
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
 
+void TrackedPacketState::onTxRetransmitTimer_(DVTimer*)
+{
+    for (auto& kvp : txRetryPacketIds_)
+    {
+        retransmitPacket_(kvp.first);
+    }
+    
+    txRetryPacketIds_.clear();
+}
+    
 void TrackedPacketState::onCleanupTimer_(DVTimer*)
 {
     // Iterate through the current sent queue and delete packets
     // that are older than PURGE_SECONDS.
-    auto iter = sentPackets_.begin();
     auto curTime = time(NULL);
-    while (iter != sentPackets_.end())
+    for (auto& slot : sentPackets_)
     {
-        if (curTime - iter->second.first >= PURGE_SECONDS)
+        if (slot.valid && curTime - slot.sendTime >= PURGE_SECONDS)
         {
-            numSavedBytesInPacketQueue_ -= iter->second.second.getSendLength();
-            iter = sentPackets_.erase(iter);
-        }
-        else
-        {
-            iter++;
+            releaseSentPacket_(slot);
         }
     }
 }
 
+void TrackedPacketState::clearSentPackets_()
+{
+    for (auto& slot : sentPackets_)
+    {
+        releaseSentPacket_(slot);
+    }
+    numSavedBytesInPacketQueue_ = 0;
+}
+
+void TrackedPacketState::releaseSentPacket_(SentPacket& slot)
+{
+    if (slot.valid)
+    {
+        numSavedBytesInPacketQueue_ -= slot.packet.getSendLength();
+        slot.packet = IcomPacket();
+        slot.valid = false;
+    }
+}
+
 void TrackedPacketState::incrementPingSequence_(uint16_t pingSeq)
 {
     pingSequenceNumber_ = pingSeq + 1;
@@ -314,11 +505,14 @@ void TrackedPacketState::incrementPingSequence_(uint16_t pingSeq)
 
 void TrackedPacketState::retransmitPacket_(uint16_t packet)
 {    
-    if (sentPackets_.find(packet) != sentPackets_.end())
+    NetworkQos::RecordRetransmit(parent_->getQosStreamType());
+
+    SentPacket& slot = sentPackets_[packet & (SENT_PACKET_RING_SIZE - 1)];
+    if (slot.valid && slot.sequenceNumber == packet)
     {
         // No need to track as we've sent it before.
         ESP_LOGI(parent_->getName().c_str(), "Retransmitting packet %d", packet);
-        parent_->sendUntracked(sentPackets_[packet].second);
+        parent_->sendUntracked(slot.packet);
     }
     else
     {
@@ -18,6 +18,9 @@
 #ifndef TRACKED_PACKET_STATE_H
 #define TRACKED_PACKET_STATE_H
 
+#include <map>
+
+#include "sdkconfig.h"
 #include "util/PSRamAllocator.h"
 #include "task/DVTimer.h"
 #include "IcomProtocolState.h"
@@ -48,29 +51,62 @@ public:
 protected:
     DVTimer pingTimer_;
     DVTimer idleTimer_;
-    DVTimer retransmitRequestTimer_;
     DVTimer txRetransmitTimer_;
 
     void sendTracked_(IcomPacket& packet);
 
+    /// @brief Asks the radio to resend missing packets for as long as they're
+    ///        within the given number of packets of the newest one received.
+    /// @param numPackets How far back to request packets (0 to never request them).
+    void setRxRetransmitWindow_(uint16_t numPackets);
+
 private:
     DVTimer cleanupTimer_;
+    DVTimer retransmitRequestTimer_;
     
     uint16_t pingSequenceNumber_;
+    int64_t pingSendTimeUs_; // for the round trip time of pingSequenceNumber_
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    // Keepalives are skipped while tracked traffic shows the link is up 
+    // and spaced out (up to CONFIG_EZDV_ICOM_KEEPALIVE_MAX_MS) while it's quiet.
+    int64_t lastPingUs_;
+    int64_t lastTrackedSendUs_;
+    int64_t lastReceiveUs_;
+    uint32_t pingPeriodMs_;
+    uint32_t idlePeriodMs_;
+    uint32_t rxLossRate_; // moving average of the fraction of RX packets lost, in 1/65536ths
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
     uint16_t sendSequenceNumber_;
     uint32_t numSavedBytesInPacketQueue_;
 
-    std::map<
-        uint16_t, 
-        std::pair<uint64_t, IcomPacket>, 
-        std::less<uint16_t>, 
-        util::PSRamAllocator<
-            std::pair<
-                const uint16_t, 
-                std::pair<uint64_t, IcomPacket>
-            >
-        > > sentPackets_;
-    std::vector<uint16_t, util::PSRamAllocator<uint16_t>> rxPacketIds_;
+    // Sent packets are kept for retransmission in a ring indexed by the 
+    // low bits of their sequence number. The ring size divides 65536, so 
+    // each sequence number always maps to the same slot across rollover.
+    enum { SENT_PACKET_RING_SIZE = 512 };
+    static_assert(SENT_PACKET_RING_SIZE >= BUFSIZE && (SENT_PACKET_RING_SIZE & (SENT_PACKET_RING_SIZE - 1)) == 0);
+
+    struct SentPacket
+    {
+        bool valid;
+        uint16_t sequenceNumber;
+        uint64_t sendTime;
+        IcomPacket packet;
+    };
+
+    SentPacket sentPackets_[SENT_PACKET_RING_SIZE];
+
+    // Received sequence numbers are tracked in a sliding window bitmap 
+    // (bit seq % RX_WINDOW_SIZE is set once seq has been received), as
+    // is done for anti-replay protection. This makes duplicate and gap
+    // detection constant time and handles rollover using 16-bit differences.
+    enum { RX_WINDOW_SIZE = 512 };
+    static_assert(RX_WINDOW_SIZE > MAX_MISSING && (RX_WINDOW_SIZE & (RX_WINDOW_SIZE - 1)) == 0);
+
+    bool rxWindowActive_;
+    uint16_t rxHighestSequenceNumber_;
+    uint16_t rxNumTracked_; // sequence numbers covered since the window was reset
+    uint16_t rxRetransmitWindow_;
+    uint32_t rxWindow_[RX_WINDOW_SIZE / 32];
     std::map<
         uint16_t, 
         uint16_t,
@@ -81,15 +117,27 @@ private:
                 uint16_t
             >
         > > txRetryPacketIds_;
-    std::map<uint16_t, int, std::less<uint16_t>, util::PSRamAllocator<std::pair<const uint16_t, int>>> rxMissingPacketIds_;
     
+    void clearSentPackets_();
+    void releaseSentPacket_(SentPacket& slot);
+    void resetRxWindow_(uint16_t rxSeq);
+    bool isRxPacketReceived_(uint16_t rxSeq);
+    void setRxPacketReceived_(uint16_t rxSeq, bool received);
+    void requestRxRetransmits_();
     void sendPing_();
     void retransmitPacket_(uint16_t packet);
 
+#if CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+    void setPingPeriod_(uint32_t periodMs);
+    void setIdlePeriod_(uint32_t periodMs);
+    void updateRxLossRate_(uint16_t numLost);
+    uint32_t getRetransmitRequestPeriodMs_();
+#endif // CONFIG_EZDV_ICOM_ADAPTIVE_KEEPALIVE
+
     void onPingTimer_(DVTimer*);
     void onIdleTimer_(DVTimer*);
-    void onRetransmitTimer_(DVTimer*);
     void onTxRetransmitTimer_(DVTimer*);
+    void onRetransmitRequestTimer_(DVTimer*);
     void onCleanupTimer_(DVTimer*);
 
     void incrementPingSequence_(uint16_t pingSeq);
@@ -63,6 +63,18 @@ void INetworkInterface::setHostname(std::string hostname)
     }
 }
 
+bool INetworkInterface::getIpAddress(char* buf, int length)
+{
+    esp_netif_ip_info_t ipInfo;
+    if (interfaceHandle_ == nullptr || esp_netif_get_ip_info(interfaceHandle_, &ipInfo) != ESP_OK)
+    {
+        return false;
+    }
+
+    snprintf(buf, length, IPSTR, IP2STR(&ipInfo.ip));
+    return true;
+}
+
 INetworkInterface::InterfaceStatus INetworkInterface::status() const
 {
     return status_;
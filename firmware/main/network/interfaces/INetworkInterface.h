@@ -51,6 +51,10 @@ public:
     virtual void getMacAddress(uint8_t* mac) = 0;
     void setAsDefaultInterface();
     void setHostname(std::string hostname);
+
+    /// @brief Gets the interface's IPv4 address as a string.
+    /// @return false if the interface doesn't have one.
+    bool getIpAddress(char* buf, int length);
     
     // Event handlers
     using OnNetworkUpDownHandlerType = std::function<void(INetworkInterface&)>;
@@ -15,14 +15,42 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
 #include "WirelessInterface.h"
+#include "util/BootTimeline.h"
 
+#include "sdkconfig.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs_handle.hpp"
+#include "mbedtls/pkcs5.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #define CURRENT_LOG_TAG "WirelessInterface"
 #define MAX_AP_CONNECTIONS (5)
 #define DEFAULT_AP_NAME_PREFIX "ezDV "
+#define PASSIVE_SCAN_TIME_MS (110) // just over the usual beacon interval (102.4ms)
+
+#define CACHED_AP_MAGIC (0x657a4151)
+#define CACHED_AP_NVS_NAMESPACE ("wifiCache")
+#define CACHED_AP_NVS_KEY ("lastAp")
+#define CACHED_PMK_MAGIC (0x657a504b)
+#define PMK_LENGTH (32)
+#define PSK_ITERATIONS (4096) // per IEEE 802.11i
+
+// Deriving the PMK takes around a second of CPU time, so it's done at low 
+// priority rather than in the Wi-Fi event handler.
+#define PMK_WORKER_TASK_NAME ("PmkWorker")
+#define PMK_WORKER_STACK_SIZE (4096)
+#define PMK_WORKER_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
 
 namespace ezdv
 {
@@ -33,10 +61,185 @@ namespace network
 namespace interfaces
 {
 
+namespace
+{
+
+// The AP we last connected to. Kept in RTC memory to skip reading flash 
+// after a software reset or wake from sleep, and in NVS for everything 
+// else. Must stay trivially constructible so it isn't cleared on startup.
+struct CachedAp
+{
+    uint32_t magic;
+    uint32_t credentialsCrc; // of the SSID and password it's valid for
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t authMode;
+    uint32_t crc; // of everything above
+};
+
+RTC_NOINIT_ATTR CachedAp RtcCachedAp;
+
+// The PMK for the current network. It's as good as the passphrase for 
+// joining the network, so it's only ever kept in RTC memory (lost on
+// power off) and never written to flash.
+struct CachedPmk
+{
+    uint32_t magic;
+    uint32_t credentialsCrc;
+    uint8_t pmk[PMK_LENGTH];
+    uint32_t crc;
+};
+
+RTC_NOINIT_ATTR CachedPmk RtcCachedPmk;
+portMUX_TYPE CachedPmkLock = portMUX_INITIALIZER_UNLOCKED;
+
+// What the PMK worker needs, copied so that it doesn't depend on the 
+// WirelessInterface outliving it.
+struct PmkRequest
+{
+    uint32_t credentialsCrc;
+    uint8_t ssid[sizeof(wifi_sta_config_t::ssid)];
+    size_t ssidLength;
+    uint8_t password[sizeof(wifi_sta_config_t::password)];
+    size_t passwordLength;
+};
+
+std::atomic<bool> PmkWorkerRunning(false);
+
+uint32_t CachedApCrc(const CachedAp& cache)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&cache, offsetof(CachedAp, crc));
+}
+
+bool IsCachedApValid(const CachedAp& cache)
+{
+    return cache.magic == CACHED_AP_MAGIC && cache.crc == CachedApCrc(cache);
+}
+
+bool LoadCachedAp(CachedAp& cache)
+{
+    if (IsCachedApValid(RtcCachedAp))
+    {
+        cache = RtcCachedAp;
+        return true;
+    }
+
+    esp_err_t result = ESP_OK;
+    auto handle = nvs::open_nvs_handle(CACHED_AP_NVS_NAMESPACE, NVS_READONLY, &result);
+    if (result != ESP_OK || 
+        handle->get_blob(CACHED_AP_NVS_KEY, &cache, sizeof(cache)) != ESP_OK ||
+        !IsCachedApValid(cache))
+    {
+        return false;
+    }
+
+    RtcCachedAp = cache;
+    return true;
+}
+
+void SaveCachedAp(CachedAp& cache)
+{
+    cache.magic = CACHED_AP_MAGIC;
+    cache.crc = CachedApCrc(cache);
+    RtcCachedAp = cache;
+
+    esp_err_t result = ESP_OK;
+    auto handle = nvs::open_nvs_handle(CACHED_AP_NVS_NAMESPACE, NVS_READWRITE, &result);
+    if (result == ESP_OK)
+    {
+        result = handle->set_blob(CACHED_AP_NVS_KEY, &cache, sizeof(cache));
+    }
+    if (result == ESP_OK)
+    {
+        result = handle->commit();
+    }
+
+    if (result != ESP_OK)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Could not save AP to flash: %s", esp_err_to_name(result));
+    }
+}
+
+bool LoadCachedPmk(uint32_t credentialsCrc, uint8_t* pmk)
+{
+    CachedPmk cache;
+    portENTER_CRITICAL(&CachedPmkLock);
+    cache = RtcCachedPmk;
+    portEXIT_CRITICAL(&CachedPmkLock);
+
+    bool valid = 
+        cache.magic == CACHED_PMK_MAGIC && 
+        cache.crc == esp_rom_crc32_le(0, (const uint8_t*)&cache, offsetof(CachedPmk, crc)) &&
+        cache.credentialsCrc == credentialsCrc;
+    if (valid && pmk != nullptr)
+    {
+        memcpy(pmk, cache.pmk, PMK_LENGTH);
+    }
+
+    memset(&cache, 0, sizeof(cache));
+    return valid;
+}
+
+void ClearCachedPmk()
+{
+    portENTER_CRITICAL(&CachedPmkLock);
+    memset(&RtcCachedPmk, 0, sizeof(RtcCachedPmk));
+    portEXIT_CRITICAL(&CachedPmkLock);
+}
+
+void PmkWorkerEntry(void* arg)
+{
+    PmkRequest* request = (PmkRequest*)arg;
+    CachedPmk cache;
+    memset(&cache, 0, sizeof(cache));
+
+    int64_t startTimeUs = esp_timer_get_time();
+    bool derived = mbedtls_pkcs5_pbkdf2_hmac_ext(
+        MBEDTLS_MD_SHA1,
+        request->password, request->passwordLength,
+        request->ssid, request->ssidLength,
+        PSK_ITERATIONS, PMK_LENGTH, cache.pmk) == 0;
+    ESP_LOGI(CURRENT_LOG_TAG, "Derived PMK in %d ms", (int)((esp_timer_get_time() - startTimeUs) / 1000));
+
+    if (derived)
+    {
+        cache.magic = CACHED_PMK_MAGIC;
+        cache.credentialsCrc = request->credentialsCrc;
+        cache.crc = esp_rom_crc32_le(0, (const uint8_t*)&cache, offsetof(CachedPmk, crc));
+
+        portENTER_CRITICAL(&CachedPmkLock);
+        RtcCachedPmk = cache;
+        portEXIT_CRITICAL(&CachedPmkLock);
+    }
+
+    memset(&cache, 0, sizeof(cache));
+    memset(request, 0, sizeof(PmkRequest));
+    delete request;
+
+    PmkWorkerRunning.store(false, std::memory_order_release);
+    vTaskDelete(nullptr);
+}
+
+// The PMK (rather than the passphrase) can only be given for the plain 
+// PSK modes; SAE needs the passphrase itself.
+bool CanUsePmk(uint8_t authMode)
+{
+    return 
+        authMode == WIFI_AUTH_WPA_PSK || 
+        authMode == WIFI_AUTH_WPA2_PSK || 
+        authMode == WIFI_AUTH_WPA_WPA2_PSK;
+}
+
+}
+
 WirelessInterface::WirelessInterface()
     : hasStaConfig_(false)
+    , powerSaveProfile_(POWER_SAVE_MIN)
+    , credentialsCrc_(0)
+    , usingCachedAp_(false)
+    , cachedApConnected_(false)
 {
-    // empty
+    memset(&staConfig_, 0, sizeof(staConfig_));
 }
 
 WirelessInterface::~WirelessInterface()
@@ -64,8 +267,7 @@ void WirelessInterface::configure(storage::WifiMode mode, storage::WifiSecurityM
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
     
-    // Disable power save.
-    //esp_wifi_set_ps(WIFI_PS_NONE);
+    // Power save is chosen based on what we're doing; see setPowerSaveProfile().
 
     if (mode == storage::WifiMode::ACCESS_POINT)
     {
@@ -135,9 +337,12 @@ void WirelessInterface::configure(storage::WifiMode mode, storage::WifiSecurityM
         wifi_config.sta.bssid_set = false;
         memset(wifi_config.sta.bssid, 0, sizeof(wifi_config.sta.bssid));
         wifi_config.sta.channel = 0;
-        wifi_config.sta.listen_interval = 0;
         wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
 
+        // Only used in POWER_SAVE_MAX, but is sent to the AP when associating
+        // so has to be set up front.
+        wifi_config.sta.listen_interval = CONFIG_EZDV_WIFI_IDLE_LISTEN_INTERVAL;
+
         // Enable fast roaming (typically for mesh networks or enterprise setups)
         wifi_config.sta.btm_enabled = 1;
         wifi_config.sta.rm_enabled = 1;
@@ -147,6 +352,13 @@ void WirelessInterface::configure(storage::WifiMode mode, storage::WifiSecurityM
         sprintf((char*)wifi_config.sta.ssid, "%s", ssid);
         sprintf((char*)wifi_config.sta.password, "%s", password);
         
+        // Kept for falling back to a full scan.
+        staConfig_ = wifi_config;
+        credentialsCrc_ = esp_rom_crc32_le(0, (const uint8_t*)ssid, strlen(ssid));
+        credentialsCrc_ = esp_rom_crc32_le(credentialsCrc_, (const uint8_t*)password, strlen(password));
+        usingCachedAp_ = applyCachedAp_(wifi_config);
+        cachedApConnected_ = false;
+        
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
         ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
         
@@ -204,7 +416,10 @@ void WirelessInterface::bringUp()
                                                         this,
                                                         &ipEventHandle_));
     
-    ESP_ERROR_CHECK(esp_wifi_start());
+    {
+        util::BootTimeline::Step step("wifi start");
+        ESP_ERROR_CHECK(esp_wifi_start());
+    }
     status_ = INTERFACE_DEV_UP;
     
     ESP_ERROR_CHECK(esp_wifi_get_mode(&mode));
@@ -245,11 +460,172 @@ void WirelessInterface::setOnWirelessScanComplete(OnWirelessScanCompleteType fn)
     onWirelessScanComplete_ = fn;
 }
 
-void WirelessInterface::beginScan()
+bool WirelessInterface::beginScan(uint8_t channel)
 {
-    // Start Wi-Fi scan using default config. A WIFI_EVENT_SCAN_DONE event
-    // will be fired by ESP-IDF once the scan is done.
-    ESP_ERROR_CHECK(esp_wifi_scan_start(nullptr, false));
+    // A WIFI_EVENT_SCAN_DONE event will be fired by ESP-IDF once the scan is done.
+    if (channel == 0)
+    {
+        // Start Wi-Fi scan using default config.
+        ESP_ERROR_CHECK(esp_wifi_scan_start(nullptr, false));
+        return true;
+    }
+
+    // Listening for beacons (rather than probing) keeps us off the home 
+    // channel for about one beacon interval.
+    wifi_scan_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.channel = channel;
+    config.scan_type = WIFI_SCAN_TYPE_PASSIVE;
+    config.scan_time.passive = PASSIVE_SCAN_TIME_MS;
+
+    esp_err_t result = esp_wifi_scan_start(&config, false);
+    if (result != ESP_OK)
+    {
+        // e.g. still connecting; the next scan will try again.
+        ESP_LOGW(CURRENT_LOG_TAG, "Could not scan channel %d: %s", channel, esp_err_to_name(result));
+    }
+    return result == ESP_OK;
+}
+
+void WirelessInterface::setPowerSaveProfile(PowerSaveProfile profile)
+{
+#if CONFIG_EZDV_WIFI_POWER_SAVE
+    if (!hasStaConfig_ || profile == powerSaveProfile_)
+    {
+        return;
+    }
+
+    wifi_ps_type_t psType = WIFI_PS_MIN_MODEM;
+    switch (profile)
+    {
+        case POWER_SAVE_NONE:
+            psType = WIFI_PS_NONE;
+            break;
+        case POWER_SAVE_MIN:
+            psType = WIFI_PS_MIN_MODEM;
+            break;
+        case POWER_SAVE_MAX:
+            psType = WIFI_PS_MAX_MODEM;
+            break;
+        default:
+            assert(0);
+            break;
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Switching to power save profile %d", (int)profile);
+    ESP_ERROR_CHECK(esp_wifi_set_ps(psType));
+    powerSaveProfile_ = profile;
+#endif // CONFIG_EZDV_WIFI_POWER_SAVE
+}
+
+bool WirelessInterface::applyCachedAp_(wifi_config_t& config)
+{
+#if CONFIG_EZDV_WIFI_FAST_CONNECT
+    CachedAp cache;
+    if (!LoadCachedAp(cache) || cache.credentialsCrc != credentialsCrc_)
+    {
+        return false;
+    }
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "Trying last AP " MACSTR " on channel %d first", 
+        MAC2STR(cache.bssid),
+        cache.channel);
+
+    config.sta.bssid_set = true;
+    memcpy(config.sta.bssid, cache.bssid, sizeof(config.sta.bssid));
+    config.sta.channel = cache.channel;
+
+    uint8_t pmk[PMK_LENGTH];
+    if (CanUsePmk(cache.authMode) && LoadCachedPmk(credentialsCrc_, pmk))
+    {
+        // A 64 character password is taken as the hex PMK, which saves 
+        // deriving it from the passphrase. This fills the password field
+        // so there's no room for a terminator.
+        char pmkHex[PMK_LENGTH * 2 + 1];
+        for (int index = 0; index < PMK_LENGTH; index++)
+        {
+            sprintf(pmkHex + index * 2, "%02x", pmk[index]);
+        }
+        memcpy(config.sta.password, pmkHex, PMK_LENGTH * 2);
+
+        memset(pmkHex, 0, sizeof(pmkHex));
+        memset(pmk, 0, sizeof(pmk));
+    }
+
+    return true;
+#else
+    return false;
+#endif // CONFIG_EZDV_WIFI_FAST_CONNECT
+}
+
+void WirelessInterface::updateCachedAp_(wifi_event_sta_connected_t* event)
+{
+#if CONFIG_EZDV_WIFI_FAST_CONNECT
+    // The PMK only depends on the SSID and passphrase, so it carries over
+    // between APs on the same network. It's lost on power off, though, so
+    // it may be missing even if the AP hasn't changed.
+    size_t passwordLength = strnlen((const char*)staConfig_.sta.password, sizeof(staConfig_.sta.password));
+    if (CanUsePmk(event->authmode) && passwordLength >= 8 && passwordLength < 64 &&
+        !LoadCachedPmk(credentialsCrc_, nullptr) &&
+        !PmkWorkerRunning.exchange(true, std::memory_order_acq_rel))
+    {
+        PmkRequest* request = new PmkRequest();
+        assert(request != nullptr);
+
+        request->credentialsCrc = credentialsCrc_;
+        request->ssidLength = strnlen((const char*)staConfig_.sta.ssid, sizeof(staConfig_.sta.ssid));
+        memcpy(request->ssid, staConfig_.sta.ssid, request->ssidLength);
+        request->passwordLength = passwordLength;
+        memcpy(request->password, staConfig_.sta.password, passwordLength);
+
+        auto returnValue = 
+            xTaskCreate(&PmkWorkerEntry, PMK_WORKER_TASK_NAME, PMK_WORKER_STACK_SIZE, request, PMK_WORKER_TASK_PRIORITY, nullptr);
+        if (returnValue != pdPASS)
+        {
+            // Not worth failing over; we'll try again next time.
+            memset(request, 0, sizeof(PmkRequest));
+            delete request;
+            PmkWorkerRunning.store(false, std::memory_order_release);
+        }
+    }
+
+    CachedAp cache;
+    bool hadCache = LoadCachedAp(cache) && cache.credentialsCrc == credentialsCrc_;
+    if (hadCache &&
+        !memcmp(cache.bssid, event->bssid, sizeof(cache.bssid)) &&
+        cache.channel == event->channel &&
+        cache.authMode == event->authmode)
+    {
+        // Nothing's changed; don't wear out the flash.
+        return;
+    }
+
+    if (!hadCache)
+    {
+        memset(&cache, 0, sizeof(cache));
+        cache.credentialsCrc = credentialsCrc_;
+    }
+    memcpy(cache.bssid, event->bssid, sizeof(cache.bssid));
+    cache.channel = event->channel;
+    cache.authMode = event->authmode;
+
+    SaveCachedAp(cache);
+#endif // CONFIG_EZDV_WIFI_FAST_CONNECT
+}
+
+void WirelessInterface::clearCachedAp_()
+{
+    RtcCachedAp.magic = 0;
+    ClearCachedPmk();
+
+    esp_err_t result = ESP_OK;
+    auto handle = nvs::open_nvs_handle(CACHED_AP_NVS_NAMESPACE, NVS_READWRITE, &result);
+    if (result == ESP_OK && handle->erase_item(CACHED_AP_NVS_KEY) == ESP_OK)
+    {
+        handle->commit();
+    }
 }
 
 void WirelessInterface::IPEventHandler_(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
@@ -344,10 +720,29 @@ void WirelessInterface::WiFiEventHandler_(void *event_handler_arg, esp_event_bas
             obj->status_ = INTERFACE_DOWN;
             break;
         }
+        case WIFI_EVENT_STA_CONNECTED:
+        {
+            obj->cachedApConnected_ = true;
+            obj->updateCachedAp_((wifi_event_sta_connected_t*)event_data);
+            break;
+        }
         case WIFI_EVENT_STA_DISCONNECTED:
         {
             bool networkIsDown = true;
 
+            if (obj->usingCachedAp_)
+            {
+                // Go back to scanning for the best AP, as the one we used 
+                // last time may have moved or gone away.
+                if (!obj->cachedApConnected_)
+                {
+                    ESP_LOGW(CURRENT_LOG_TAG, "Could not connect to last AP, falling back to full scan");
+                    obj->clearCachedAp_();
+                }
+                obj->usingCachedAp_ = false;
+                esp_wifi_set_config(WIFI_IF_STA, &obj->staConfig_);
+            }
+
             if (event_id == WIFI_EVENT_STA_DISCONNECTED)
             {
                 wifi_event_sta_disconnected_t *disconn = (wifi_event_sta_disconnected_t*)event_data;
@@ -24,6 +24,7 @@
 #include <functional>
 
 #include "esp_netif.h"
+#include "esp_wifi.h"
 
 // For WifiMode and WifiSecurityMode enums
 #include "storage/SettingsMessage.h"
@@ -40,6 +41,14 @@ namespace interfaces
 class WirelessInterface : public INetworkInterface
 {
 public:
+    /// @brief How much the station may sleep between beacons.
+    enum PowerSaveProfile
+    {
+        POWER_SAVE_NONE, // streaming radio audio; lowest latency
+        POWER_SAVE_MIN,  // wake for every DTIM beacon
+        POWER_SAVE_MAX,  // wake every CONFIG_EZDV_WIFI_IDLE_LISTEN_INTERVAL beacons
+    };
+
     WirelessInterface();
     virtual ~WirelessInterface();
     
@@ -63,7 +72,14 @@ public:
     using OnWirelessScanCompleteType = std::function<void(INetworkInterface&)>;
     void setOnWirelessScanComplete(OnWirelessScanCompleteType fn);
     
-    void beginScan();
+    /// @brief Starts a scan of all channels, or a passive scan of just one.
+    /// @param channel The channel to scan (0 for all of them).
+    /// @return false if the scan couldn't be started.
+    bool beginScan(uint8_t channel = 0);
+
+    /// @brief Switches to a different power save profile. Has no effect in
+    ///        access point mode, as the AP has to stay awake for its clients.
+    void setPowerSaveProfile(PowerSaveProfile profile);
 
 private:
     OnNetworkIpAssignedType onApAssignedIp_;
@@ -73,6 +89,25 @@ private:
     esp_event_handler_instance_t wifiEventHandle_;
     esp_event_handler_instance_t ipEventHandle_;
     bool hasStaConfig_;
+    PowerSaveProfile powerSaveProfile_;
+
+    // Fast reconnect: the first connection attempt goes straight to the
+    // AP we last connected to, with the full scan configuration in 
+    // staConfig_ used if that fails.
+    wifi_config_t staConfig_;
+    uint32_t credentialsCrc_;
+    bool usingCachedAp_;
+    bool cachedApConnected_;
+
+    /// @brief Points config at the AP we last connected to (if known).
+    /// @return true if config was changed.
+    bool applyCachedAp_(wifi_config_t& config);
+
+    /// @brief Remembers the AP we've just connected to for next time.
+    void updateCachedAp_(wifi_event_sta_connected_t* event);
+
+    /// @brief Forgets the cached AP (e.g. as connecting to it failed).
+    void clearCachedAp_();
     
     static void IPEventHandler_(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
     static void WiFiEventHandler_(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
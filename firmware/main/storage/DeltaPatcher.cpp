@@ -0,0 +1,279 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+#include "DeltaPatcher.h"
+
+#define CURRENT_LOG_TAG "DeltaPatcher"
+
+#define DELTA_MAGIC ("EZDVDLT1")
+
+#define OP_END (0)
+#define OP_COPY (1)
+#define OP_DATA (2)
+
+namespace ezdv
+{
+
+namespace storage
+{
+
+DeltaPatcher::DeltaPatcher()
+    : source_(nullptr)
+    , outputFn_(nullptr)
+    , outputState_(nullptr)
+    , state_(FAILED)
+    , pendingLength_(0)
+    , dataRemaining_(0)
+    , targetLength_(0)
+{
+    memset(&header_, 0, sizeof(header_));
+    memset(&command_, 0, sizeof(command_));
+    mbedtls_sha256_init(&targetHash_);
+
+    copyBuffer_ = (unsigned char*)heap_caps_malloc(COPY_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(copyBuffer_ != nullptr);
+}
+
+DeltaPatcher::~DeltaPatcher()
+{
+    mbedtls_sha256_free(&targetHash_);
+    heap_caps_free(copyBuffer_);
+}
+
+void DeltaPatcher::begin(const esp_partition_t* source, OutputFn outputFn, void* outputState)
+{
+    source_ = source;
+    outputFn_ = outputFn;
+    outputState_ = outputState;
+
+    state_ = READING_HEADER;
+    pendingLength_ = 0;
+    dataRemaining_ = 0;
+    targetLength_ = 0;
+
+    mbedtls_sha256_free(&targetHash_);
+    mbedtls_sha256_init(&targetHash_);
+    mbedtls_sha256_starts(&targetHash_, 0);
+}
+
+bool DeltaPatcher::write(const unsigned char* data, int length)
+{
+    while (length > 0)
+    {
+        switch (state_)
+        {
+            case READING_HEADER:
+            case READING_COMMAND:
+            {
+                int needed = (state_ == READING_HEADER ? sizeof(Header) : sizeof(Command)) - pendingLength_;
+                int toCopy = std::min(needed, length);
+                memcpy(&pending_[pendingLength_], data, toCopy);
+                pendingLength_ += toCopy;
+                data += toCopy;
+                length -= toCopy;
+
+                if (toCopy < needed)
+                {
+                    // Rest arrives with the next block.
+                    break;
+                }
+
+                pendingLength_ = 0;
+                if (state_ == READING_HEADER)
+                {
+                    memcpy(&header_, pending_, sizeof(header_));
+                    if (memcmp(header_.magic, DELTA_MAGIC, sizeof(header_.magic)) != 0)
+                    {
+                        return fail_("not a delta image");
+                    }
+                    if (source_ == nullptr || !verifySource_())
+                    {
+                        return fail_("made for a different firmware version than the one running");
+                    }
+
+                    ESP_LOGI(
+                        CURRENT_LOG_TAG, "Applying delta to %s (%" PRIu32 " -> %" PRIu32 " bytes)", 
+                        source_->label, header_.sourceSize, header_.targetSize);
+                    state_ = READING_COMMAND;
+                    break;
+                }
+
+                memcpy(&command_, pending_, sizeof(command_));
+                if (command_.op == OP_COPY)
+                {
+                    if (!copyFromSource_(command_.arg0, command_.arg1))
+                    {
+                        return false;
+                    }
+                }
+                else if (command_.op == OP_DATA)
+                {
+                    dataRemaining_ = command_.arg0;
+                    if (dataRemaining_ > 0)
+                    {
+                        state_ = READING_DATA;
+                    }
+                }
+                else if (command_.op == OP_END)
+                {
+                    state_ = FINISHED;
+                }
+                else
+                {
+                    return fail_("unknown command");
+                }
+                break;
+            }
+            case READING_DATA:
+            {
+                int toCopy = std::min((uint32_t)length, dataRemaining_);
+                if (!output_(data, toCopy))
+                {
+                    return false;
+                }
+                data += toCopy;
+                length -= toCopy;
+                dataRemaining_ -= toCopy;
+
+                if (dataRemaining_ == 0)
+                {
+                    state_ = READING_COMMAND;
+                }
+                break;
+            }
+            case FINISHED:
+                // Anything after END (e.g. padding) is ignored; the output
+                // is verified either way.
+                length = 0;
+                break;
+            case FAILED:
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool DeltaPatcher::end()
+{
+    if (state_ != FINISHED)
+    {
+        return state_ == FAILED ? false : fail_("delta is incomplete");
+    }
+
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&targetHash_, hash);
+    if (targetLength_ != header_.targetSize || memcmp(hash, header_.targetSha256, sizeof(hash)) != 0)
+    {
+        return fail_("rebuilt image doesn't match");
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Delta applied and verified");
+    return true;
+}
+
+bool DeltaPatcher::verifySource_()
+{
+    if (header_.sourceSize > source_->size)
+    {
+        return false;
+    }
+
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+
+    bool ok = true;
+    for (uint32_t offset = 0; ok && offset < header_.sourceSize; offset += COPY_BUFFER_SIZE)
+    {
+        uint32_t length = std::min((uint32_t)COPY_BUFFER_SIZE, header_.sourceSize - offset);
+        ok = esp_partition_read(source_, offset, copyBuffer_, length) == ESP_OK;
+        if (ok)
+        {
+            mbedtls_sha256_update(&context, copyBuffer_, length);
+        }
+    }
+
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&context, hash);
+    mbedtls_sha256_free(&context);
+
+    return ok && memcmp(hash, header_.sourceSha256, sizeof(hash)) == 0;
+}
+
+bool DeltaPatcher::copyFromSource_(uint32_t offset, uint32_t length)
+{
+    if (offset > header_.sourceSize || length > header_.sourceSize - offset)
+    {
+        return fail_("copy outside of source image");
+    }
+
+    while (length > 0)
+    {
+        uint32_t toCopy = std::min((uint32_t)COPY_BUFFER_SIZE, length);
+        if (esp_partition_read(source_, offset, copyBuffer_, toCopy) != ESP_OK)
+        {
+            return fail_("could not read source image");
+        }
+        if (!output_(copyBuffer_, toCopy))
+        {
+            return false;
+        }
+
+        offset += toCopy;
+        length -= toCopy;
+    }
+
+    return true;
+}
+
+bool DeltaPatcher::output_(const unsigned char* data, int length)
+{
+    targetLength_ += length;
+    if (targetLength_ > header_.targetSize)
+    {
+        return fail_("rebuilt image is too large");
+    }
+
+    mbedtls_sha256_update(&targetHash_, data, length);
+    if (!outputFn_(outputState_, data, length))
+    {
+        state_ = FAILED;
+        return false;
+    }
+
+    return true;
+}
+
+bool DeltaPatcher::fail_(const char* reason)
+{
+    ESP_LOGE(CURRENT_LOG_TAG, "Delta rejected: %s", reason);
+    state_ = FAILED;
+    return false;
+}
+
+}
+
+}
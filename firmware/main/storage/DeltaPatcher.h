@@ -0,0 +1,124 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DELTA_PATCHER_H
+#define DELTA_PATCHER_H
+
+#include <cinttypes>
+
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+namespace ezdv
+{
+
+namespace storage
+{
+
+/// @brief Rebuilds a partition image from the image we're currently running
+///        and a delta (as produced by scripts/make_ota_delta.py), one block
+///        of delta at a time. 
+///
+///        A delta is a header followed by commands:
+///
+///        * "EZDVDLT1", source size, target size (uint32 LE), SHA-256 of 
+///          the source and of the target.
+///        * Commands are an op (uint8) and two uint32 LE arguments:
+///            - COPY (1): copy arg1 bytes from the source at offset arg0.
+///            - DATA (2): the next arg0 bytes are copied as-is.
+///            - END (0): the target is complete.
+///
+///        Deltas made against a different image than the one running are 
+///        rejected before anything is written, and the output is checked 
+///        against the target hash at the end.
+class DeltaPatcher
+{
+public:
+    /// @brief Receives the rebuilt image.
+    /// @return false to abort.
+    typedef bool (*OutputFn)(void* state, const unsigned char* data, int length);
+
+    DeltaPatcher();
+    virtual ~DeltaPatcher();
+
+    /// @brief Starts applying a new delta.
+    /// @param source The partition the delta was made against.
+    /// @param outputFn Receives the rebuilt image.
+    /// @param outputState Passed to outputFn.
+    void begin(const esp_partition_t* source, OutputFn outputFn, void* outputState);
+
+    /// @brief Applies the next part of the delta.
+    /// @return false if the delta is invalid or can't be applied.
+    bool write(const unsigned char* data, int length);
+
+    /// @brief Finishes applying the delta.
+    /// @return true if the complete target image was produced and verified.
+    bool end();
+
+private:
+    enum { COPY_BUFFER_SIZE = 4096 };
+
+    enum State
+    {
+        READING_HEADER,
+        READING_COMMAND,
+        READING_DATA,
+        FINISHED,
+        FAILED,
+    };
+
+    struct __attribute__((packed)) Header
+    {
+        char magic[8];
+        uint32_t sourceSize;
+        uint32_t targetSize;
+        uint8_t sourceSha256[32];
+        uint8_t targetSha256[32];
+    };
+
+    struct __attribute__((packed)) Command
+    {
+        uint8_t op;
+        uint32_t arg0;
+        uint32_t arg1;
+    };
+
+    const esp_partition_t* source_;
+    OutputFn outputFn_;
+    void* outputState_;
+
+    State state_;
+    Header header_;
+    Command command_;
+    uint8_t pending_[sizeof(Header)]; // header or command being received
+    int pendingLength_;
+    uint32_t dataRemaining_;
+    uint32_t targetLength_;
+    mbedtls_sha256_context targetHash_;
+    unsigned char* copyBuffer_;
+
+    bool verifySource_();
+    bool copyFromSource_(uint32_t offset, uint32_t length);
+    bool output_(const unsigned char* data, int length);
+    bool fail_(const char* reason);
+};
+
+}
+
+}
+
+#endif // DELTA_PATCHER_H
@@ -68,6 +68,8 @@ enum SettingsMessageTypes
     LED_BRIGHTNESS_SETTINGS_SAVED = 24,
     
     REQUEST_VOLUME_SETTINGS = 25,
+
+    SETTINGS_CHANGED = 26,
 };
 
 template<uint32_t TYPE_ID>
@@ -204,11 +206,13 @@ public:
     VoiceKeyerSettingsMessageCommon(
         bool enabledProvided = false, 
         int timesToTransmitProvided = 0,
-        int secondsToWaitProvided = 0)
+        int secondsToWaitProvided = 0,
+        int slotProvided = 0)
         : DVTaskMessageBase<TYPE_ID, VoiceKeyerSettingsMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
         , enabled(enabledProvided)
         , timesToTransmit(timesToTransmitProvided)
         , secondsToWait(secondsToWaitProvided)
+        , slot(slotProvided)
     { 
         // empty
     }
@@ -218,6 +222,7 @@ public:
     bool enabled;
     int timesToTransmit;
     int secondsToWait;
+    int slot;
 };
 
 using VoiceKeyerSettingsMessage = VoiceKeyerSettingsMessageCommon<VOICE_KEYER_SETTINGS>;
@@ -315,6 +320,18 @@ using LedBrightnessSettingsSavedMessage = RequesSettingsMessageCommon<LED_BRIGHT
 
 using RequestVolumeSettingsMessage = RequesSettingsMessageCommon<REQUEST_VOLUME_SETTINGS>;
 
+/// @brief Published whenever SettingsSnapshot changes. Read the new values from it.
+class SettingsChangedMessage : public DVTaskMessageBase<SETTINGS_CHANGED, SettingsChangedMessage>
+{
+public:
+    SettingsChangedMessage(uint32_t versionProvided = 0)
+        : DVTaskMessageBase<SETTINGS_CHANGED, SettingsChangedMessage>(SETTINGS_MESSAGE)
+        , version(versionProvided) { }
+    virtual ~SettingsChangedMessage() = default;
+
+    uint32_t version;
+};
+
 }
 
 }
@@ -0,0 +1,86 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SettingsSnapshot.h"
+
+#include "freertos/FreeRTOS.h"
+
+namespace ezdv
+{
+
+namespace storage
+{
+
+std::atomic<uint32_t> SettingsSnapshot::Version_(0);
+Settings SettingsSnapshot::Current_;
+
+// Keeps SettingsTask from being preempted mid-update, so that readers 
+// only ever wait for the copy itself.
+static portMUX_TYPE UpdateLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t SettingsSnapshot::Read(Settings& settings)
+{
+    uint32_t sequence;
+    do
+    {
+        sequence = BeginRead_();
+        memcpy(&settings, &Current_, sizeof(Settings));
+    } while (!EndRead_(sequence));
+
+    return sequence >> 1;
+}
+
+uint32_t SettingsSnapshot::BeginRead_()
+{
+    uint32_t sequence = Version_.load(std::memory_order_acquire);
+    while (sequence & 1)
+    {
+        // SettingsTask is in the middle of an update on the other core 
+        // (it can't be preempted on this one). That's a single memcpy, 
+        // so spinning is quicker than giving up the CPU.
+        sequence = Version_.load(std::memory_order_acquire);
+    }
+    return sequence;
+}
+
+bool SettingsSnapshot::EndRead_(uint32_t sequence)
+{
+    // Keeps the copy from being reordered after the version check.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return Version_.load(std::memory_order_relaxed) == sequence;
+}
+
+uint32_t SettingsSnapshot::Update_(const Settings& settings)
+{
+    portENTER_CRITICAL(&UpdateLock_);
+
+    uint32_t sequence = Version_.load(std::memory_order_relaxed);
+    Version_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&Current_, &settings, sizeof(Settings));
+
+    sequence += 2;
+    Version_.store(sequence, std::memory_order_release);
+
+    portEXIT_CRITICAL(&UpdateLock_);
+    return sequence >> 1;
+}
+
+}
+
+}
@@ -0,0 +1,147 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SETTINGS_SNAPSHOT_H
+#define SETTINGS_SNAPSHOT_H
+
+#include <atomic>
+#include <cinttypes>
+
+#include "SettingsMessage.h"
+
+namespace ezdv
+{
+
+namespace storage
+{
+
+/// @brief A copy of every saved setting, grouped the same way as SettingsMessage.
+struct Settings
+{
+    struct Volume
+    {
+        int8_t leftChannelVolume;
+        int8_t rightChannelVolume;
+    };
+
+    struct Wifi
+    {
+        bool enabled;
+        WifiMode mode;
+        WifiSecurityMode security;
+        int channel;
+        char ssid[WifiSettingsMessage::MAX_STR_SIZE];
+        char password[WifiSettingsMessage::MAX_STR_SIZE];
+        char hostname[WifiSettingsMessage::MAX_STR_SIZE];
+    };
+
+    struct Radio
+    {
+        bool headsetPtt;
+        int timeOutTimer;
+        bool enabled;
+        int type;
+        char host[RadioSettingsMessage::MAX_STR_SIZE];
+        int port;
+        char username[RadioSettingsMessage::MAX_STR_SIZE];
+        char password[RadioSettingsMessage::MAX_STR_SIZE];
+    };
+
+    struct VoiceKeyer
+    {
+        bool enabled;
+        int timesToTransmit;
+        int secondsToWait;
+        int slot;
+    };
+
+    struct Reporting
+    {
+        char callsign[ReportingSettingsMessage::MAX_STR_SIZE];
+        char gridSquare[ReportingSettingsMessage::MAX_STR_SIZE];
+        bool forceReporting;
+        uint64_t freqHz;
+        char message[ReportingSettingsMessage::MAX_MSG_SIZE];
+    };
+
+    Volume volume;
+    Wifi wifi;
+    Radio radio;
+    VoiceKeyer voiceKeyer;
+    Reporting reporting;
+    int ledDutyCycle;
+    int lastMode;
+};
+
+class SettingsTask;
+
+/// @brief Lets any task read the current settings without a round trip 
+///        through SettingsTask. Only SettingsTask writes to it; readers
+///        retry if they overlap a write (seqlock). Writes can't be 
+///        preempted, so a reader never blocks: at most it spins while 
+///        the other core finishes copying the settings in.
+class SettingsSnapshot
+{
+public:
+    /// @brief Returns the current version. Zero means settings haven't been
+    ///        loaded yet; it increases every time any setting changes.
+    static uint32_t GetVersion()
+    {
+        return Version_.load(std::memory_order_acquire) >> 1;
+    }
+
+    /// @brief Copies the current settings.
+    /// @return The version of the copied settings (see GetVersion()).
+    static uint32_t Read(Settings& settings);
+
+    /// @brief Copies one group of settings, e.g. Read(&Settings::reporting, reporting).
+    /// @return The version of the copied settings (see GetVersion()).
+    template<typename T>
+    static uint32_t Read(T Settings::* group, T& value);
+
+private:
+    // Twice the version, plus one while a write is in progress.
+    static std::atomic<uint32_t> Version_;
+    static Settings Current_;
+
+    static uint32_t BeginRead_();
+    static bool EndRead_(uint32_t sequence);
+
+    /// @brief Replaces the current settings and returns the new version.
+    static uint32_t Update_(const Settings& settings);
+
+    friend class SettingsTask;
+};
+
+template<typename T>
+uint32_t SettingsSnapshot::Read(T Settings::* group, T& value)
+{
+    uint32_t sequence;
+    do
+    {
+        sequence = BeginRead_();
+        memcpy(&value, &(Current_.*group), sizeof(T));
+    } while (!EndRead_(sequence));
+
+    return sequence >> 1;
+}
+
+}
+
+}
+
+#endif // SETTINGS_SNAPSHOT_H
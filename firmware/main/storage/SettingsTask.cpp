@@ -15,8 +15,16 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+#include <algorithm>
+
+#include "sdkconfig.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
 #include "SettingsTask.h"
+#include "util/BootTimeline.h"
 
 #define CURRENT_LOG_TAG ("SettingsTask")
 
@@ -44,6 +52,7 @@
 #define VOICE_KEYER_ENABLED_ID ("vkEnable")
 #define VOICE_KEYER_TIMES_TO_TRANSMIT ("vkTimesTX")
 #define VOICE_KEYER_SECONDS_TO_WAIT_AFTER_TRANSMIT ("vkSecWait")
+#define VOICE_KEYER_SLOT_ID ("vkSlot")
 
 #define REPORTING_CALLSIGN_ID ("repCall")
 #define REPORTING_GRID_SQUARE_ID ("repGrid")
@@ -64,6 +73,7 @@
 #define DEFAULT_VOICE_KEYER_ENABLE (false)
 #define DEFAULT_VOICE_KEYER_TIMES_TO_TRANSMIT (10)
 #define DEFAULT_VOICE_KEYER_SECONDS_TO_WAIT (5)
+#define DEFAULT_VOICE_KEYER_SLOT (0)
 
 #define DEFAULT_REPORTING_CALLSIGN ("")
 #define DEFAULT_REPORTING_GRID_SQUARE ("UN00KN")
@@ -84,12 +94,195 @@
 #define LAST_MODE_ID ("lastMode")
 #define DEFAULT_LAST_MODE (1) /* Default to 700D */
 
+// Settings are stored as one blob per group (a header followed by one of the
+// structures below). Fields may only be appended to these; VERSION must be 
+// incremented when doing so.
+#define VOLUME_SETTINGS_ID ("volumeCfg")
+#define WIFI_SETTINGS_ID ("wifiCfg")
+#define RADIO_SETTINGS_ID ("radioCfg")
+#define VOICE_KEYER_SETTINGS_ID ("vkCfg")
+#define REPORTING_SETTINGS_ID ("reportCfg")
+#define LED_BRIGHTNESS_SETTINGS_ID ("ledCfg")
+#define LAST_MODE_SETTINGS_ID ("modeCfg")
+
+#define MAX_BLOB_SIZE (512)
+
+#define FLUSH_IDLE_US (CONFIG_EZDV_SETTINGS_FLUSH_IDLE_MS * 1000LL)
+#define FLUSH_MAX_DELAY_US (CONFIG_EZDV_SETTINGS_FLUSH_MAX_DELAY_MS * 1000LL)
+#define MIN_FLUSH_DELAY_US (10000)
+
+#define RTC_PENDING_MAGIC (0x657a5354)
+
 namespace ezdv
 {
 
 namespace storage
 {
 
+namespace
+{
+
+struct BlobHeader
+{
+    uint16_t version;
+    uint16_t length; // of the payload following the header
+    uint32_t crc; // CRC32 of the payload
+};
+
+struct VolumeSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    int8_t leftChannelVolume;
+    int8_t rightChannelVolume;
+
+    VolumeSettingsBlob()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+};
+
+struct WifiSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    uint8_t enabled;
+    uint8_t mode;
+    uint8_t security;
+    uint8_t channel;
+    char ssid[WifiSettingsMessage::MAX_STR_SIZE];
+    char password[WifiSettingsMessage::MAX_STR_SIZE];
+    char hostname[WifiSettingsMessage::MAX_STR_SIZE];
+
+    WifiSettingsBlob()
+    {
+        memset(this, 0, sizeof(*this));
+        enabled = DEFAULT_WIFI_ENABLED;
+        mode = DEFAULT_WIFI_MODE;
+        security = DEFAULT_WIFI_SECURITY;
+        channel = DEFAULT_WIFI_CHANNEL;
+        strncpy(hostname, DEFAULT_WIFI_HOSTNAME, sizeof(hostname) - 1);
+    }
+};
+
+struct RadioSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    uint8_t enabled;
+    uint8_t headsetPtt;
+    uint16_t port;
+    int32_t timeOutTimer;
+    int32_t type;
+    char hostname[RadioSettingsMessage::MAX_STR_SIZE];
+    char username[RadioSettingsMessage::MAX_STR_SIZE];
+    char password[RadioSettingsMessage::MAX_STR_SIZE];
+
+    RadioSettingsBlob()
+    {
+        memset(this, 0, sizeof(*this));
+        enabled = DEFAULT_RADIO_ENABLED;
+        headsetPtt = DEFAULT_RADIO_HEADSET_PTT_ENABLED;
+        port = DEFAULT_RADIO_PORT;
+        timeOutTimer = DEFAULT_TIME_OUT_TIMER_SEC;
+        type = DEFAULT_RADIO_TYPE;
+    }
+};
+
+struct VoiceKeyerSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    uint8_t enabled;
+    uint8_t slot;
+    uint16_t timesToTransmit;
+    int32_t secondsToWait;
+
+    VoiceKeyerSettingsBlob()
+    {
+        memset(this, 0, sizeof(*this));
+        enabled = DEFAULT_VOICE_KEYER_ENABLE;
+        slot = DEFAULT_VOICE_KEYER_SLOT;
+        timesToTransmit = DEFAULT_VOICE_KEYER_TIMES_TO_TRANSMIT;
+        secondsToWait = DEFAULT_VOICE_KEYER_SECONDS_TO_WAIT;
+    }
+};
+
+struct ReportingSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    uint64_t freqHz;
+    uint8_t forceReporting;
+    char callsign[ReportingSettingsMessage::MAX_STR_SIZE];
+    char gridSquare[ReportingSettingsMessage::MAX_STR_SIZE];
+    char message[ReportingSettingsMessage::MAX_MSG_SIZE];
+
+    ReportingSettingsBlob()
+    {
+        memset(this, 0, sizeof(*this));
+        freqHz = DEFAULT_REPORTING_FREQ;
+        forceReporting = DEFAULT_REPORTING_FORCE;
+        strncpy(gridSquare, DEFAULT_REPORTING_GRID_SQUARE, sizeof(gridSquare) - 1);
+    }
+};
+
+struct LedBrightnessSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    int32_t dutyCycle;
+
+    LedBrightnessSettingsBlob()
+    {
+        dutyCycle = DEFAULT_LED_DUTY_CYCLE;
+    }
+};
+
+struct LastModeSettingsBlob
+{
+    enum { VERSION = 1 };
+
+    int32_t lastMode;
+
+    LastModeSettingsBlob()
+    {
+        lastMode = DEFAULT_LAST_MODE;
+    }
+};
+
+#if CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+// Settings changed but not yet written to flash. Kept in RTC memory so they
+// survive a software reset; must stay trivially constructible so it isn't
+// cleared on startup.
+struct RtcPendingSettings
+{
+    uint32_t magic;
+    uint32_t dirtyGroups;
+    int8_t leftChannelVolume;
+    int8_t rightChannelVolume;
+    int32_t lastMode;
+    uint32_t crc; // of everything above
+};
+
+RTC_NOINIT_ATTR RtcPendingSettings RtcPending;
+
+uint32_t RtcPendingCrc()
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&RtcPending, offsetof(RtcPendingSettings, crc));
+}
+
+bool IsRtcPending(uint32_t group)
+{
+    return 
+        RtcPending.magic == RTC_PENDING_MAGIC &&
+        RtcPending.crc == RtcPendingCrc() &&
+        (RtcPending.dirtyGroups & group) != 0;
+}
+#endif // CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+
+}
+
 SettingsTask::SettingsTask()
     : DVTask("SettingsTask", 2, 4096, tskNO_AFFINITY, 32)
     , leftChannelVolume_(0)
@@ -107,10 +300,17 @@ SettingsTask::SettingsTask()
     , enableVoiceKeyer_(false)
     , voiceKeyerNumberTimesToTransmit_(0)
     , voiceKeyerSecondsToWaitAfterTransmit_(0)
+    , voiceKeyerSlot_(0)
     , ledDutyCycle_(0)
     , lastMode_(0)
     , commitTimer_(this, [this](DVTimer*) { commit_(); }, 1000000, "SettingsCommitTimer")
+    , flushTimer_(this, [this](DVTimer*) { flush_(); }, FLUSH_IDLE_US, "SettingsFlushTimer")
+    , dirtyGroups_(0)
+    , firstDirtyTimeUs_(0)
 {
+    commitTimer_.useTimerWheel();
+    flushTimer_.useTimerWheel();
+
     memset(wifiSsid_, 0, WifiSettingsMessage::MAX_STR_SIZE);
     memset(wifiPassword_, 0, WifiSettingsMessage::MAX_STR_SIZE);
     memset(wifiHostname_, 0, WifiSettingsMessage::MAX_STR_SIZE);
@@ -122,36 +322,40 @@ SettingsTask::SettingsTask()
     memset(callsign_, 0, ReportingSettingsMessage::MAX_STR_SIZE);
 
     // Subscribe to messages
-    registerMessageHandler(this, &SettingsTask::onSetLeftChannelVolume_);
-    registerMessageHandler(this, &SettingsTask::onSetRightChannelVolume_);
-    registerMessageHandler(this, &SettingsTask::onRequestWifiSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onSetWifiSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onRequestRadioSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onSetRadioSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onRequestVoiceKeyerSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onSetVoiceKeyerSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onRequestReportingSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onSetReportingSettingsMessage_);
-    registerMessageHandler(this, &SettingsTask::onRequestLedBrightness_);
-    registerMessageHandler(this, &SettingsTask::onSetLedBrightness_);
-    registerMessageHandler(this, &SettingsTask::onChangeFreeDVMode_);
-    registerMessageHandler(this, &SettingsTask::onRequestVolumeSettings_);
+    registerMessageHandlers<
+        &SettingsTask::onSetLeftChannelVolume_,
+        &SettingsTask::onSetRightChannelVolume_,
+        &SettingsTask::onRequestWifiSettingsMessage_,
+        &SettingsTask::onSetWifiSettingsMessage_,
+        &SettingsTask::onRequestRadioSettingsMessage_,
+        &SettingsTask::onSetRadioSettingsMessage_,
+        &SettingsTask::onRequestVoiceKeyerSettingsMessage_,
+        &SettingsTask::onSetVoiceKeyerSettingsMessage_,
+        &SettingsTask::onRequestReportingSettingsMessage_,
+        &SettingsTask::onSetReportingSettingsMessage_,
+        &SettingsTask::onRequestLedBrightness_,
+        &SettingsTask::onSetLedBrightness_,
+        &SettingsTask::onChangeFreeDVMode_,
+        &SettingsTask::onRequestVolumeSettings_>(this);
 }
 
 void SettingsTask::onTaskStart_()
 {
     // Initialize NVS
     ESP_LOGI(CURRENT_LOG_TAG, "Initializing NVS.");
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_LOGW(CURRENT_LOG_TAG, "erasing NVS");
-        
-        // NVS partition was truncated and needs to be erased
-        // Retry nvs_flash_init
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        err = nvs_flash_init();
+    {
+        util::BootTimeline::Step step("nvs init");
+        esp_err_t err = nvs_flash_init();
+        if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+            ESP_LOGW(CURRENT_LOG_TAG, "erasing NVS");
+            
+            // NVS partition was truncated and needs to be erased
+            // Retry nvs_flash_init
+            ESP_ERROR_CHECK(nvs_flash_erase());
+            err = nvs_flash_init();
+        }
+        ESP_ERROR_CHECK( err );
     }
-    ESP_ERROR_CHECK( err );
     
     // Open NVS handle.
     ESP_LOGI(CURRENT_LOG_TAG, "Opening NVS handle.");
@@ -169,7 +373,13 @@ void SettingsTask::onTaskStart_()
 
 void SettingsTask::onTaskSleep_()
 {
-    // none
+    // Don't lose anything that's only in RAM.
+    if (storageHandle_ && dirtyGroups_ != 0)
+    {
+        flush_();
+        commitTimer_.stop();
+        commit_();
+    }
 }
 
 void SettingsTask::onRequestWifiSettingsMessage_(DVTask* origin, RequestWifiSettingsMessage* message)
@@ -187,7 +397,7 @@ void SettingsTask::onRequestWifiSettingsMessage_(DVTask* origin, RequestWifiSett
     assert(response != nullptr);
     if (origin != nullptr)
     {
-        origin->post(response);
+        sendTo(origin, response);
     }
     delete response;
 }
@@ -208,7 +418,7 @@ void SettingsTask::onRequestRadioSettingsMessage_(DVTask* origin, RequestRadioSe
     assert(response != nullptr);
     if (origin != nullptr)
     {
-        origin->post(response);
+        sendTo(origin, response);
     }
     delete response;
 }
@@ -219,12 +429,13 @@ void SettingsTask::onRequestVoiceKeyerSettingsMessage_(DVTask* origin, RequestVo
     VoiceKeyerSettingsMessage* response = new VoiceKeyerSettingsMessage(
         enableVoiceKeyer_,
         voiceKeyerNumberTimesToTransmit_,
-        voiceKeyerSecondsToWaitAfterTransmit_
+        voiceKeyerSecondsToWaitAfterTransmit_,
+        voiceKeyerSlot_
     );
     assert(response != nullptr);
     if (origin != nullptr)
     {
-        origin->post(response);
+        sendTo(origin, response);
     }
     delete response;
 }
@@ -243,7 +454,7 @@ void SettingsTask::onRequestReportingSettingsMessage_(DVTask* origin, RequestRep
     assert(response != nullptr);
     if (origin != nullptr)
     {
-        origin->post(response);
+        sendTo(origin, response);
     }
     delete response;
 }
@@ -258,7 +469,7 @@ void SettingsTask::onRequestLedBrightness_(DVTask* origin, RequestLedBrightnessS
     assert(response != nullptr);
     if (origin != nullptr)
     {
-        origin->post(response);
+        sendTo(origin, response);
     }
     delete response;
 }
@@ -284,301 +495,239 @@ void SettingsTask::loadAllSettings_()
         initializeLedBrightness_();
         initializeLastMode_();
         initializeReporting_();
+
+#if CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+        // Anything restored from RTC memory has been saved above.
+        RtcPending.magic = 0;
+#endif // CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
     }
 }
 
-void SettingsTask::initializeVolumes_()
+SettingsTask::BlobStatus SettingsTask::readBlob_(const char* key, uint16_t version, void* payload, size_t payloadSize)
 {
-    esp_err_t result = storageHandle_->get_item(LEFT_CHAN_VOL_ID, leftChannelVolume_);
+    uint8_t buffer[MAX_BLOB_SIZE];
+    size_t size = 0;
+    esp_err_t result = storageHandle_->get_item_size(nvs::ItemType::BLOB, key, size);
     if (result == ESP_ERR_NVS_NOT_FOUND)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "leftChannelVolume not found, will set to defaults");
-        setLeftChannelVolume_(0);
+        return BLOB_NOT_FOUND;
     }
-    else if (result != ESP_OK)
+    else if (result == ESP_OK && (size < sizeof(BlobHeader) || size > sizeof(buffer)))
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving leftChannelVolume: %s", esp_err_to_name(result));
+        result = ESP_ERR_NVS_INVALID_LENGTH;
     }
-    else
+    else if (result == ESP_OK)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "leftChannelVolume: %d", leftChannelVolume_);
-
-        // Broadcast volume so that other components can initialize themselves with it.
-        LeftChannelVolumeMessage* message = new LeftChannelVolumeMessage();
-        assert(message != nullptr);
-
-        message->volume = leftChannelVolume_;
-        publish(message);
-        delete message;
-    }
-    
-    result = storageHandle_->get_item(RIGHT_CHAN_VOL_ID, rightChannelVolume_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "rightChannelVolume not found, will set to defaults");
-        setRightChannelVolume_(0);
+        result = storageHandle_->get_blob(key, buffer, size);
     }
-    else if (result != ESP_OK)
+
+    if (result != ESP_OK)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving rightChannelVolume: %s", esp_err_to_name(result));
+        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving %s: %s, will set to defaults", key, esp_err_to_name(result));
+        return BLOB_INVALID;
     }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "rightChannelVolume: %d", rightChannelVolume_);
 
-        // Broadcast volume so that other components can initialize themselves with it.
-        RightChannelVolumeMessage* message = new RightChannelVolumeMessage();
-        assert(message != nullptr);
-
-        message->volume = rightChannelVolume_;
-        publish(message);
-        delete message;
-    }
-}
+    BlobHeader header;
+    memcpy(&header, buffer, sizeof(header));
 
-void SettingsTask::initializeWifi_()
-{
-    bool resaveSettings = false;
-    esp_err_t result = storageHandle_->get_item(WIFI_ENABLED_ID, wifiEnabled_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiEnabled not found, will set to default");
-        wifiEnabled_ = DEFAULT_WIFI_ENABLED;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiEnabled: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiEnabled: %d", wifiEnabled_);
-    }
-    
-    result = storageHandle_->get_item(WIFI_MODE_ID, wifiMode_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiMode not found, will set to default");
-        wifiMode_ = DEFAULT_WIFI_MODE;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiMode: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiMode: %d", wifiMode_);
-    }
-    
-    result = storageHandle_->get_item(WIFI_SECURITY_ID, wifiSecurity_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+    const uint8_t* data = &buffer[sizeof(header)];
+    size_t length = size - sizeof(header);
+    if (header.length != length || esp_rom_crc32_le(0, data, length) != header.crc)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiSecurity not found, will set to default");
-        wifiSecurity_ = DEFAULT_WIFI_SECURITY;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiSecurity: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiSecurity: %d", wifiSecurity_);
-    }
-    
-    result = storageHandle_->get_item(WIFI_CHANNEL_ID, wifiChannel_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiChannel not found, will set to default");
-        wifiChannel_ = DEFAULT_WIFI_CHANNEL;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiChannel: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiChannel: %d", wifiChannel_);
-    }
-    
-    result = storageHandle_->get_string(WIFI_SSID_ID, wifiSsid_, WifiSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiSsid not found, will set to default");
-        memset(wifiSsid_, 0, WifiSettingsMessage::MAX_STR_SIZE);
-        strncpy(wifiSsid_, DEFAULT_WIFI_SSID, WifiSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiSsid: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiSsid: %s", wifiSsid_);
-    }
-    
-    result = storageHandle_->get_string(WIFI_PASSWORD_ID, wifiPassword_, WifiSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiPassword not found, will set to default");
-        memset(wifiPassword_, 0, WifiSettingsMessage::MAX_STR_SIZE);
-        strncpy(wifiPassword_, DEFAULT_WIFI_PASSWORD, WifiSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiPassword: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiPassword: ********");
+        ESP_LOGE(CURRENT_LOG_TAG, "%s is corrupt, will set to defaults", key);
+        return BLOB_INVALID;
     }
 
-    result = storageHandle_->get_string(WIFI_HOSTNAME_ID, wifiHostname_, WifiSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "wifiHostname not found, will set to default");
-        memset(wifiHostname_, 0, WifiSettingsMessage::MAX_STR_SIZE);
-        strncpy(wifiHostname_, DEFAULT_WIFI_HOSTNAME, WifiSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving wifiHostname: %s", esp_err_to_name(result));
-    }
-    else
+    // Fields are only ever appended, so an older blob is a prefix of the
+    // current one and anything it doesn't have keeps its default value.
+    // (A newer one, from before a firmware downgrade, is read the same way.)
+    memcpy(payload, data, std::min(length, payloadSize));
+    if (header.version < version)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "wifiHostname: %s", wifiHostname_);
+        ESP_LOGI(CURRENT_LOG_TAG, "%s is version %d, migrating to version %d", key, header.version, version);
+        return BLOB_MIGRATED;
     }
 
-    if (resaveSettings)
-    {
-        // setWifiSettings_ below will automatically publish WifiSettingsMessage.
-        setWifiSettings_(
-            wifiEnabled_, wifiMode_, wifiSecurity_, 
-            wifiChannel_, wifiSsid_, wifiPassword_,
-            wifiHostname_, true);
-    }
-    else
-    {
-        // Publish current Wi-Fi settings to everyone who may care.
-        WifiSettingsMessage* message = new WifiSettingsMessage(
-            wifiEnabled_,
-            wifiMode_,
-            wifiSecurity_,
-            wifiChannel_,
-            wifiSsid_,
-            wifiPassword_,
-            wifiHostname_
-        );
-        assert(message != nullptr);
-        publish(message);
-        delete message;
-    }
+    return BLOB_OK;
 }
 
-void SettingsTask::initializeRadio_()
+void SettingsTask::writeBlob_(const char* key, uint16_t version, const void* payload, size_t payloadSize)
 {
-    bool resaveSettings = false;
+    uint8_t buffer[MAX_BLOB_SIZE];
+    assert(sizeof(BlobHeader) + payloadSize <= sizeof(buffer));
 
-    esp_err_t result = storageHandle_->get_item(RADIO_ENABLED_ID, radioEnabled_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "radioEnabled not found, will set to default");
-        radioEnabled_ = DEFAULT_RADIO_ENABLED;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving radioEnabled: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "radioEnabled: %d", radioEnabled_);
-    }
+    BlobHeader header;
+    header.version = version;
+    header.length = payloadSize;
+    header.crc = esp_rom_crc32_le(0, (const uint8_t*)payload, payloadSize);
 
-    result = storageHandle_->get_item(HEADSET_PTT_ID, headsetPtt_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "headsetPtt not found, will set to default");
-        headsetPtt_ = DEFAULT_RADIO_HEADSET_PTT_ENABLED;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(&buffer[sizeof(header)], payload, payloadSize);
+
+    // The whole group is replaced at once, so a reset mid-save can't leave 
+    // a mix of old and new values.
+    esp_err_t result = storageHandle_->set_blob(key, buffer, sizeof(header) + payloadSize);
+    if (result != ESP_OK)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving headsetPtt: %s", esp_err_to_name(result));
+        ESP_LOGE(CURRENT_LOG_TAG, "error setting %s: %s", key, esp_err_to_name(result));
     }
     else
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "headsetPtt: %d", headsetPtt_);
+        commitTimer_.restart(true);
     }
+}
 
-    result = storageHandle_->get_item(TIME_OUT_TIMER_ID, timeOutTimer_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "timeOutTimer not found, will set to default");
-        timeOutTimer_ = DEFAULT_TIME_OUT_TIMER_SEC;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving timeOutTimer: %s", esp_err_to_name(result));
-    }
-    else
+template<typename T>
+void SettingsTask::readLegacyItem_(const char* key, T& value, T defaultValue)
+{
+    esp_err_t result = storageHandle_->get_item(key, value);
+    if (result != ESP_OK)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "timeOutTimer: %d", timeOutTimer_);
+        if (result != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "error retrieving %s: %s", key, esp_err_to_name(result));
+        }
+        value = defaultValue;
     }
-    
-    result = storageHandle_->get_item(RADIO_TYPE_ID, radioType_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+}
+
+void SettingsTask::readLegacyString_(const char* key, char* value, size_t size, const char* defaultValue)
+{
+    esp_err_t result = storageHandle_->get_string(key, value, size);
+    if (result != ESP_OK)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "radioType not found, will set to default");
-        radioType_ = DEFAULT_RADIO_TYPE;
-        resaveSettings = true;
+        if (result != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "error retrieving %s: %s", key, esp_err_to_name(result));
+        }
+        memset(value, 0, size);
+        strncpy(value, defaultValue, size - 1);
     }
-    else if (result != ESP_OK)
+}
+
+void SettingsTask::initializeVolumes_()
+{
+    VolumeSettingsBlob blob;
+    auto status = readBlob_(VOLUME_SETTINGS_ID, VolumeSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving radioType: %s", esp_err_to_name(result));
+        // Saved by firmware from before settings were grouped (or first boot).
+        ESP_LOGW(CURRENT_LOG_TAG, "volume settings not found, migrating individual settings");
+        readLegacyItem_(LEFT_CHAN_VOL_ID, blob.leftChannelVolume, (int8_t)0);
+        readLegacyItem_(RIGHT_CHAN_VOL_ID, blob.rightChannelVolume, (int8_t)0);
     }
-    else
+
+    bool resave = status != BLOB_OK;
+#if CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+    if (IsRtcPending(DIRTY_VOLUME))
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "radioType: %d", radioType_);
+        // Changed right before we were reset, but never saved.
+        ESP_LOGW(CURRENT_LOG_TAG, "restoring unsaved volume settings");
+        blob.leftChannelVolume = RtcPending.leftChannelVolume;
+        blob.rightChannelVolume = RtcPending.rightChannelVolume;
+        resave = true;
     }
-    
-    result = storageHandle_->get_string(RADIO_HOSTNAME_ID, radioHostname_, RadioSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+#endif // CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+
+    leftChannelVolume_ = blob.leftChannelVolume;
+    rightChannelVolume_ = blob.rightChannelVolume;
+    ESP_LOGI(CURRENT_LOG_TAG, "leftChannelVolume: %d, rightChannelVolume: %d", leftChannelVolume_, rightChannelVolume_);
+
+    if (resave)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "radioHostname not found, will set to default");
-        memset(radioHostname_, 0, RadioSettingsMessage::MAX_STR_SIZE);
-        strncpy(radioHostname_, DEFAULT_RADIO_HOSTNAME, RadioSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
+        saveVolumeSettings_();
     }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving radioHostname: %s", esp_err_to_name(result));
+
+    updateSnapshot_();
+
+    // Broadcast volume so that other components can initialize themselves with it.
+    LeftChannelVolumeMessage leftMessage;
+    leftMessage.volume = leftChannelVolume_;
+    publish(&leftMessage);
+
+    RightChannelVolumeMessage rightMessage;
+    rightMessage.volume = rightChannelVolume_;
+    publish(&rightMessage);
+}
+
+void SettingsTask::initializeWifi_()
+{
+    WifiSettingsBlob blob;
+    auto status = readBlob_(WIFI_SETTINGS_ID, WifiSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Wi-Fi settings not found, migrating individual settings");
+        readLegacyItem_(WIFI_ENABLED_ID, wifiEnabled_, DEFAULT_WIFI_ENABLED);
+        readLegacyItem_(WIFI_MODE_ID, wifiMode_, DEFAULT_WIFI_MODE);
+        readLegacyItem_(WIFI_SECURITY_ID, wifiSecurity_, DEFAULT_WIFI_SECURITY);
+        readLegacyItem_(WIFI_CHANNEL_ID, wifiChannel_, DEFAULT_WIFI_CHANNEL);
+        readLegacyString_(WIFI_SSID_ID, wifiSsid_, WifiSettingsMessage::MAX_STR_SIZE, DEFAULT_WIFI_SSID);
+        readLegacyString_(WIFI_PASSWORD_ID, wifiPassword_, WifiSettingsMessage::MAX_STR_SIZE, DEFAULT_WIFI_PASSWORD);
+        readLegacyString_(WIFI_HOSTNAME_ID, wifiHostname_, WifiSettingsMessage::MAX_STR_SIZE, DEFAULT_WIFI_HOSTNAME);
     }
     else
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "radioHostname: %s", radioHostname_);
+        wifiEnabled_ = blob.enabled;
+        wifiMode_ = (WifiMode)blob.mode;
+        wifiSecurity_ = (WifiSecurityMode)blob.security;
+        wifiChannel_ = blob.channel;
+        copyString_(wifiSsid_, blob.ssid, WifiSettingsMessage::MAX_STR_SIZE);
+        copyString_(wifiPassword_, blob.password, WifiSettingsMessage::MAX_STR_SIZE);
+        copyString_(wifiHostname_, blob.hostname, WifiSettingsMessage::MAX_STR_SIZE);
     }
-    
-    result = storageHandle_->get_item(RADIO_PORT_ID, radioPort_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "wifiEnabled: %d, wifiMode: %d, wifiSecurity: %d, wifiChannel: %d, wifiSsid: %s, wifiPassword: ********, wifiHostname: %s",
+        wifiEnabled_, wifiMode_, wifiSecurity_, wifiChannel_, wifiSsid_, wifiHostname_);
+
+    if (status != BLOB_OK)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "radioPort not found, will set to default");
-        radioPort_ = DEFAULT_RADIO_PORT;
-        resaveSettings = true;
+        saveWifiSettings_();
     }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving radioPort: %s", esp_err_to_name(result));
+
+    updateSnapshot_();
+
+    // Publish current Wi-Fi settings to everyone who may care.
+    WifiSettingsMessage* message = new WifiSettingsMessage(
+        wifiEnabled_,
+        wifiMode_,
+        wifiSecurity_,
+        wifiChannel_,
+        wifiSsid_,
+        wifiPassword_,
+        wifiHostname_
+    );
+    assert(message != nullptr);
+    publish(message);
+    delete message;
+}
+
+void SettingsTask::initializeRadio_()
+{
+    RadioSettingsBlob blob;
+    auto status = readBlob_(RADIO_SETTINGS_ID, RadioSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "radio settings not found, migrating individual settings");
+        readLegacyItem_(RADIO_ENABLED_ID, radioEnabled_, DEFAULT_RADIO_ENABLED);
+        readLegacyItem_(HEADSET_PTT_ID, headsetPtt_, DEFAULT_RADIO_HEADSET_PTT_ENABLED);
+        readLegacyItem_(TIME_OUT_TIMER_ID, timeOutTimer_, DEFAULT_TIME_OUT_TIMER_SEC);
+        readLegacyItem_(RADIO_TYPE_ID, radioType_, DEFAULT_RADIO_TYPE);
+        readLegacyString_(RADIO_HOSTNAME_ID, radioHostname_, RadioSettingsMessage::MAX_STR_SIZE, DEFAULT_RADIO_HOSTNAME);
+        readLegacyItem_(RADIO_PORT_ID, radioPort_, DEFAULT_RADIO_PORT);
+        readLegacyString_(RADIO_USERNAME_ID, radioUsername_, RadioSettingsMessage::MAX_STR_SIZE, DEFAULT_RADIO_USERNAME);
+        readLegacyString_(RADIO_PASSWORD_ID, radioPassword_, RadioSettingsMessage::MAX_STR_SIZE, DEFAULT_RADIO_PASSWORD);
     }
     else
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "radioPort: %d", radioPort_);
+        radioEnabled_ = blob.enabled;
+        headsetPtt_ = blob.headsetPtt;
+        timeOutTimer_ = blob.timeOutTimer;
+        radioType_ = blob.type;
+        copyString_(radioHostname_, blob.hostname, RadioSettingsMessage::MAX_STR_SIZE);
+        radioPort_ = blob.port;
+        copyString_(radioUsername_, blob.username, RadioSettingsMessage::MAX_STR_SIZE);
+        copyString_(radioPassword_, blob.password, RadioSettingsMessage::MAX_STR_SIZE);
     }
 
     if (radioPort_ == 0)
@@ -586,291 +735,347 @@ void SettingsTask::initializeRadio_()
         // We shouldn't use 0 for the default port as most IC-705s
         // will default to 50001.
         radioPort_ = DEFAULT_RADIO_PORT;
-        resaveSettings = true;
-    }
-    
-    result = storageHandle_->get_string(RADIO_USERNAME_ID, radioUsername_, RadioSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "radioUsername not found, will set to default");
-        memset(radioUsername_, 0, RadioSettingsMessage::MAX_STR_SIZE);
-        strncpy(radioUsername_, DEFAULT_RADIO_USERNAME, RadioSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving radioUsername: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "radioUsername: %s", radioUsername_);
-    }
-    
-    result = storageHandle_->get_string(RADIO_PASSWORD_ID, radioPassword_, RadioSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "radioPassword_ not found, will set to default");
-        memset(radioPassword_, 0, RadioSettingsMessage::MAX_STR_SIZE);
-        strncpy(radioPassword_, DEFAULT_RADIO_PASSWORD, RadioSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving radioPassword: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "radioPassword: ********");
+        status = BLOB_INVALID;
     }
 
-    if (resaveSettings)
-    {
-        // setRadioSettings_ sends RadioSettingsMessage on completion.
-        setRadioSettings_(
-            headsetPtt_, timeOutTimer_, radioEnabled_, radioType_, 
-            radioHostname_, radioPort_, radioUsername_, radioPassword_,
-            true);
-    }
-    else
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "radioEnabled: %d, headsetPtt: %d, timeOutTimer: %d, radioType: %d, radioHostname: %s, radioPort: %d, radioUsername: %s, radioPassword: ********",
+        radioEnabled_, headsetPtt_, timeOutTimer_, radioType_, radioHostname_, radioPort_, radioUsername_);
+
+    if (status != BLOB_OK)
     {
-        // Publish current Wi-Fi settings to everyone who may care.
-        RadioSettingsMessage* message = new RadioSettingsMessage(
-            headsetPtt_,
-            timeOutTimer_,
-            radioEnabled_,
-            radioType_,
-            radioHostname_,
-            radioPort_,
-            radioUsername_,
-            radioPassword_
-        );
-        assert(message != nullptr);
-        publish(message);
-        delete message;
+        saveRadioSettings_();
     }
+
+    updateSnapshot_();
+
+    // Publish current radio settings to everyone who may care.
+    RadioSettingsMessage* message = new RadioSettingsMessage(
+        headsetPtt_,
+        timeOutTimer_,
+        radioEnabled_,
+        radioType_,
+        radioHostname_,
+        radioPort_,
+        radioUsername_,
+        radioPassword_
+    );
+    assert(message != nullptr);
+    publish(message);
+    delete message;
 }
 
 void SettingsTask::initialzeVoiceKeyer_()
 {
-    bool resaveSettings = false;
-
-    esp_err_t result = storageHandle_->get_item(VOICE_KEYER_ENABLED_ID, enableVoiceKeyer_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "enableVoiceKeyer not found, will set to default");
-        enableVoiceKeyer_ = DEFAULT_VOICE_KEYER_ENABLE;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
+    VoiceKeyerSettingsBlob blob;
+    auto status = readBlob_(VOICE_KEYER_SETTINGS_ID, VoiceKeyerSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving enableVoiceKeyer: %s", esp_err_to_name(result));
+        ESP_LOGW(CURRENT_LOG_TAG, "voice keyer settings not found, migrating individual settings");
+        readLegacyItem_(VOICE_KEYER_ENABLED_ID, enableVoiceKeyer_, DEFAULT_VOICE_KEYER_ENABLE);
+        readLegacyItem_(VOICE_KEYER_TIMES_TO_TRANSMIT, voiceKeyerNumberTimesToTransmit_, DEFAULT_VOICE_KEYER_TIMES_TO_TRANSMIT);
+        readLegacyItem_(VOICE_KEYER_SECONDS_TO_WAIT_AFTER_TRANSMIT, voiceKeyerSecondsToWaitAfterTransmit_, DEFAULT_VOICE_KEYER_SECONDS_TO_WAIT);
+        readLegacyItem_(VOICE_KEYER_SLOT_ID, voiceKeyerSlot_, DEFAULT_VOICE_KEYER_SLOT);
     }
     else
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "enableVoiceKeyer: %d", enableVoiceKeyer_);
-    }
-    
-    result = storageHandle_->get_item(VOICE_KEYER_TIMES_TO_TRANSMIT, voiceKeyerNumberTimesToTransmit_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "voiceKeyerNumberTimesToTransmit not found, will set to default");
-        voiceKeyerNumberTimesToTransmit_ = DEFAULT_VOICE_KEYER_TIMES_TO_TRANSMIT;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving voiceKeyerNumberTimesToTransmit: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "voiceKeyerNumberTimesToTransmit: %d", voiceKeyerNumberTimesToTransmit_);
+        enableVoiceKeyer_ = blob.enabled;
+        voiceKeyerNumberTimesToTransmit_ = blob.timesToTransmit;
+        voiceKeyerSecondsToWaitAfterTransmit_ = blob.secondsToWait;
+        voiceKeyerSlot_ = blob.slot;
     }
 
-    result = storageHandle_->get_item(VOICE_KEYER_SECONDS_TO_WAIT_AFTER_TRANSMIT, voiceKeyerSecondsToWaitAfterTransmit_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "voiceKeyerSecondsToWaitAfterTransmit_ not found, will set to default");
-        voiceKeyerSecondsToWaitAfterTransmit_ = DEFAULT_VOICE_KEYER_SECONDS_TO_WAIT;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving voiceKeyerSecondsToWaitAfterTransmit: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "voiceKeyerSecondsToWaitAfterTransmit: %d", voiceKeyerSecondsToWaitAfterTransmit_);
-    }
-    
-    if (resaveSettings)
-    {
-        // setVoiceKeyerSettings_ will broadcast VoiceKeyerSettingsMessage on completion.
-        setVoiceKeyerSettings_(
-            enableVoiceKeyer_, voiceKeyerNumberTimesToTransmit_, 
-            voiceKeyerSecondsToWaitAfterTransmit_, true);
-    }
-    else
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "enableVoiceKeyer: %d, voiceKeyerNumberTimesToTransmit: %d, voiceKeyerSecondsToWaitAfterTransmit: %d, voiceKeyerSlot: %d",
+        enableVoiceKeyer_, voiceKeyerNumberTimesToTransmit_, voiceKeyerSecondsToWaitAfterTransmit_, voiceKeyerSlot_);
+
+    if (status != BLOB_OK)
     {
-        // Publish current voice keyer settings to everyone who may care.
-        VoiceKeyerSettingsMessage* message = new VoiceKeyerSettingsMessage(
-            enableVoiceKeyer_,
-            voiceKeyerNumberTimesToTransmit_,
-            voiceKeyerSecondsToWaitAfterTransmit_
-        );
-        assert(message != nullptr);
-        publish(message);
-        delete message;
+        saveVoiceKeyerSettings_();
     }
+
+    updateSnapshot_();
+
+    // Publish current voice keyer settings to everyone who may care.
+    VoiceKeyerSettingsMessage* message = new VoiceKeyerSettingsMessage(
+        enableVoiceKeyer_,
+        voiceKeyerNumberTimesToTransmit_,
+        voiceKeyerSecondsToWaitAfterTransmit_,
+        voiceKeyerSlot_
+    );
+    assert(message != nullptr);
+    publish(message);
+    delete message;
 }
 
 void SettingsTask::initializeReporting_()
 {
-    bool resaveSettings = false;
-
-    esp_err_t result = storageHandle_->get_string(REPORTING_CALLSIGN_ID, callsign_, ReportingSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "callsign not found, will set to default");
-        memset(callsign_, 0, ReportingSettingsMessage::MAX_STR_SIZE);
-        strncpy(callsign_, DEFAULT_REPORTING_CALLSIGN, ReportingSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving callsign: %s", esp_err_to_name(result));
-    }
-    else
+    ReportingSettingsBlob blob;
+    auto status = readBlob_(REPORTING_SETTINGS_ID, ReportingSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "callsign: %s", callsign_);
-    }
-    
-    result = storageHandle_->get_string(REPORTING_GRID_SQUARE_ID, gridSquare_, ReportingSettingsMessage::MAX_STR_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "gridSquare not found, will set to default");
-        memset(gridSquare_, 0, ReportingSettingsMessage::MAX_STR_SIZE);
-        strncpy(gridSquare_, DEFAULT_REPORTING_GRID_SQUARE, ReportingSettingsMessage::MAX_STR_SIZE - 1);
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving grid square: %s", esp_err_to_name(result));
+        ESP_LOGW(CURRENT_LOG_TAG, "reporting settings not found, migrating individual settings");
+        readLegacyString_(REPORTING_CALLSIGN_ID, callsign_, ReportingSettingsMessage::MAX_STR_SIZE, DEFAULT_REPORTING_CALLSIGN);
+        readLegacyString_(REPORTING_GRID_SQUARE_ID, gridSquare_, ReportingSettingsMessage::MAX_STR_SIZE, DEFAULT_REPORTING_GRID_SQUARE);
+        readLegacyItem_(REPORTING_FORCE_ID, forceReporting_, DEFAULT_REPORTING_FORCE);
+        readLegacyItem_(REPORTING_FREQ_ID, freqHz_, (uint64_t)DEFAULT_REPORTING_FREQ);
+        readLegacyString_(REPORTING_MSG_ID, message_, ReportingSettingsMessage::MAX_MSG_SIZE, DEFAULT_REPORTING_MSG);
     }
     else
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "gridSquare: %s", gridSquare_);
+        copyString_(callsign_, blob.callsign, ReportingSettingsMessage::MAX_STR_SIZE);
+        copyString_(gridSquare_, blob.gridSquare, ReportingSettingsMessage::MAX_STR_SIZE);
+        forceReporting_ = blob.forceReporting;
+        freqHz_ = blob.freqHz;
+        copyString_(message_, blob.message, ReportingSettingsMessage::MAX_MSG_SIZE);
     }
-    
-    result = storageHandle_->get_item(REPORTING_FORCE_ID, forceReporting_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "forceReporting not found, will set to default");
-        forceReporting_ = DEFAULT_REPORTING_FORCE;
-        resaveSettings = true;
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving force reporting value: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "forceReporting: %d", forceReporting_);
-    }
-    
-    result = storageHandle_->get_item(REPORTING_FREQ_ID, freqHz_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "callsign: %s, gridSquare: %s, forceReporting: %d, freqHz: %" PRIu64 ", reportMsg: %s",
+        callsign_, gridSquare_, forceReporting_, freqHz_, message_);
+
+    if (status != BLOB_OK)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "freqHz not found, will set to default");
-        freqHz_ = DEFAULT_REPORTING_FREQ;
-        resaveSettings = true;
+        saveReportingSettings_();
     }
-    else if (result != ESP_OK)
+
+    updateSnapshot_();
+
+    // Publish current reporting settings to everyone who may care.
+    ReportingSettingsMessage* message = new ReportingSettingsMessage(
+        callsign_,
+        gridSquare_,
+        forceReporting_,
+        freqHz_,
+        message_
+    );
+    assert(message != nullptr);
+    publish(message);
+    delete message;
+}
+
+void SettingsTask::initializeLedBrightness_()
+{
+    LedBrightnessSettingsBlob blob;
+    auto status = readBlob_(LED_BRIGHTNESS_SETTINGS_ID, LedBrightnessSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving reporting frequency: %s", esp_err_to_name(result));
+        ESP_LOGW(CURRENT_LOG_TAG, "LED brightness settings not found, migrating individual settings");
+        readLegacyItem_(LED_DUTY_CYCLE_ID, blob.dutyCycle, (int32_t)DEFAULT_LED_DUTY_CYCLE);
     }
-    else
+
+    ledDutyCycle_ = blob.dutyCycle;
+    ESP_LOGI(CURRENT_LOG_TAG, "ledDutyCycle: %d", ledDutyCycle_);
+
+    if (status != BLOB_OK)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "freqHz: %" PRIu64, freqHz_);
+        saveLedBrightness_();
     }
 
-    result = storageHandle_->get_string(REPORTING_MSG_ID, message_, ReportingSettingsMessage::MAX_MSG_SIZE);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+    updateSnapshot_();
+}
+
+void SettingsTask::initializeLastMode_()
+{
+    LastModeSettingsBlob blob;
+    auto status = readBlob_(LAST_MODE_SETTINGS_ID, LastModeSettingsBlob::VERSION, &blob, sizeof(blob));
+    if (status == BLOB_NOT_FOUND)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "message not found, will set to default");
-        memset(message_, 0, ReportingSettingsMessage::MAX_MSG_SIZE);
-        strncpy(message_, DEFAULT_REPORTING_MSG, ReportingSettingsMessage::MAX_MSG_SIZE - 1);
-        resaveSettings = true;
+        ESP_LOGW(CURRENT_LOG_TAG, "Last mode not found, migrating individual setting");
+        readLegacyItem_(LAST_MODE_ID, blob.lastMode, (int32_t)DEFAULT_LAST_MODE);
     }
-    else if (result != ESP_OK)
+
+    bool resave = status != BLOB_OK;
+#if CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+    if (IsRtcPending(DIRTY_LAST_MODE))
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving reporting message: %s", esp_err_to_name(result));
+        ESP_LOGW(CURRENT_LOG_TAG, "restoring unsaved last mode");
+        blob.lastMode = RtcPending.lastMode;
+        resave = true;
     }
-    else
+#endif // CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+
+    lastMode_ = blob.lastMode;
+    ESP_LOGI(CURRENT_LOG_TAG, "lastMode: %d", lastMode_);
+
+    if (resave)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "reportMsg: %s", message_);
+        saveLastMode_();
     }
     
-    if (resaveSettings)
-    {
-        // setReportingSettings_ will broadcast ReportingSettingsMessage when done.
-        setReportingSettings_(
-            callsign_, gridSquare_, forceReporting_, freqHz_, message_, true
-        );
-    }
-    else
-    {
-        // Publish current reporting settings to everyone who may care.
-        ReportingSettingsMessage* message = new ReportingSettingsMessage(
-            callsign_,
-            gridSquare_,
-            forceReporting_,
-            freqHz_,
-            message_
-        );
-        assert(message != nullptr);
-        publish(message);
-        delete message;
-    }
+    updateSnapshot_();
+
+    // Request mode change to previous mode
+    audio::RequestSetFreeDVModeMessage reqMsg((audio::FreeDVMode)lastMode_);
+    publish(&reqMsg);
 }
 
-void SettingsTask::initializeLedBrightness_()
+void SettingsTask::saveVolumeSettings_()
 {
-    esp_err_t result = storageHandle_->get_item(LED_DUTY_CYCLE_ID, ledDutyCycle_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGW(CURRENT_LOG_TAG, "LED brightness settings not found, will set to defaults");
-        setLedBrightness_(DEFAULT_LED_DUTY_CYCLE);
-    }
-    else if (result != ESP_OK)
-    {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving ledDutyCycle: %s", esp_err_to_name(result));
-    }
-    else
-    {
-        ESP_LOGI(CURRENT_LOG_TAG, "ledDutyCycle: %d", ledDutyCycle_);
-    }
+    VolumeSettingsBlob blob;
+    blob.leftChannelVolume = leftChannelVolume_;
+    blob.rightChannelVolume = rightChannelVolume_;
+    writeBlob_(VOLUME_SETTINGS_ID, VolumeSettingsBlob::VERSION, &blob, sizeof(blob));
 }
 
-void SettingsTask::initializeLastMode_()
+void SettingsTask::saveWifiSettings_()
 {
-    esp_err_t result = storageHandle_->get_item(LAST_MODE_ID, lastMode_);
-    if (result == ESP_ERR_NVS_NOT_FOUND)
+    WifiSettingsBlob blob;
+    blob.enabled = wifiEnabled_;
+    blob.mode = wifiMode_;
+    blob.security = wifiSecurity_;
+    blob.channel = wifiChannel_;
+    copyString_(blob.ssid, wifiSsid_, WifiSettingsMessage::MAX_STR_SIZE);
+    copyString_(blob.password, wifiPassword_, WifiSettingsMessage::MAX_STR_SIZE);
+    copyString_(blob.hostname, wifiHostname_, WifiSettingsMessage::MAX_STR_SIZE);
+    writeBlob_(WIFI_SETTINGS_ID, WifiSettingsBlob::VERSION, &blob, sizeof(blob));
+}
+
+void SettingsTask::saveRadioSettings_()
+{
+    RadioSettingsBlob blob;
+    blob.enabled = radioEnabled_;
+    blob.headsetPtt = headsetPtt_;
+    blob.timeOutTimer = timeOutTimer_;
+    blob.type = radioType_;
+    copyString_(blob.hostname, radioHostname_, RadioSettingsMessage::MAX_STR_SIZE);
+    blob.port = radioPort_;
+    copyString_(blob.username, radioUsername_, RadioSettingsMessage::MAX_STR_SIZE);
+    copyString_(blob.password, radioPassword_, RadioSettingsMessage::MAX_STR_SIZE);
+    writeBlob_(RADIO_SETTINGS_ID, RadioSettingsBlob::VERSION, &blob, sizeof(blob));
+}
+
+void SettingsTask::saveVoiceKeyerSettings_()
+{
+    VoiceKeyerSettingsBlob blob;
+    blob.enabled = enableVoiceKeyer_;
+    blob.timesToTransmit = voiceKeyerNumberTimesToTransmit_;
+    blob.secondsToWait = voiceKeyerSecondsToWaitAfterTransmit_;
+    blob.slot = voiceKeyerSlot_;
+    writeBlob_(VOICE_KEYER_SETTINGS_ID, VoiceKeyerSettingsBlob::VERSION, &blob, sizeof(blob));
+}
+
+void SettingsTask::saveReportingSettings_()
+{
+    ReportingSettingsBlob blob;
+    copyString_(blob.callsign, callsign_, ReportingSettingsMessage::MAX_STR_SIZE);
+    copyString_(blob.gridSquare, gridSquare_, ReportingSettingsMessage::MAX_STR_SIZE);
+    blob.forceReporting = forceReporting_;
+    blob.freqHz = freqHz_;
+    copyString_(blob.message, message_, ReportingSettingsMessage::MAX_MSG_SIZE);
+    writeBlob_(REPORTING_SETTINGS_ID, ReportingSettingsBlob::VERSION, &blob, sizeof(blob));
+}
+
+void SettingsTask::saveLedBrightness_()
+{
+    LedBrightnessSettingsBlob blob;
+    blob.dutyCycle = ledDutyCycle_;
+    writeBlob_(LED_BRIGHTNESS_SETTINGS_ID, LedBrightnessSettingsBlob::VERSION, &blob, sizeof(blob));
+}
+
+void SettingsTask::saveLastMode_()
+{
+    LastModeSettingsBlob blob;
+    blob.lastMode = lastMode_;
+    writeBlob_(LAST_MODE_SETTINGS_ID, LastModeSettingsBlob::VERSION, &blob, sizeof(blob));
+}
+
+void SettingsTask::updateSnapshot_()
+{
+    Settings settings;
+    memset(&settings, 0, sizeof(settings));
+
+    settings.volume.leftChannelVolume = leftChannelVolume_;
+    settings.volume.rightChannelVolume = rightChannelVolume_;
+
+    settings.wifi.enabled = wifiEnabled_;
+    settings.wifi.mode = wifiMode_;
+    settings.wifi.security = wifiSecurity_;
+    settings.wifi.channel = wifiChannel_;
+    copyString_(settings.wifi.ssid, wifiSsid_, WifiSettingsMessage::MAX_STR_SIZE);
+    copyString_(settings.wifi.password, wifiPassword_, WifiSettingsMessage::MAX_STR_SIZE);
+    copyString_(settings.wifi.hostname, wifiHostname_, WifiSettingsMessage::MAX_STR_SIZE);
+
+    settings.radio.headsetPtt = headsetPtt_;
+    settings.radio.timeOutTimer = timeOutTimer_;
+    settings.radio.enabled = radioEnabled_;
+    settings.radio.type = radioType_;
+    copyString_(settings.radio.host, radioHostname_, RadioSettingsMessage::MAX_STR_SIZE);
+    settings.radio.port = radioPort_;
+    copyString_(settings.radio.username, radioUsername_, RadioSettingsMessage::MAX_STR_SIZE);
+    copyString_(settings.radio.password, radioPassword_, RadioSettingsMessage::MAX_STR_SIZE);
+
+    settings.voiceKeyer.enabled = enableVoiceKeyer_;
+    settings.voiceKeyer.timesToTransmit = voiceKeyerNumberTimesToTransmit_;
+    settings.voiceKeyer.secondsToWait = voiceKeyerSecondsToWaitAfterTransmit_;
+    settings.voiceKeyer.slot = voiceKeyerSlot_;
+
+    copyString_(settings.reporting.callsign, callsign_, ReportingSettingsMessage::MAX_STR_SIZE);
+    copyString_(settings.reporting.gridSquare, gridSquare_, ReportingSettingsMessage::MAX_STR_SIZE);
+    settings.reporting.forceReporting = forceReporting_;
+    settings.reporting.freqHz = freqHz_;
+    copyString_(settings.reporting.message, message_, ReportingSettingsMessage::MAX_MSG_SIZE);
+
+    settings.ledDutyCycle = ledDutyCycle_;
+    settings.lastMode = lastMode_;
+
+    SettingsChangedMessage message(SettingsSnapshot::Update_(settings));
+    publish(&message);
+}
+
+void SettingsTask::copyString_(char* dest, const char* src, size_t size)
+{
+    // Also safe when dest and src are the same.
+    if (dest != src)
     {
-        ESP_LOGW(CURRENT_LOG_TAG, "Last mode not found, will set to defaults");
-        setLastMode_(DEFAULT_LAST_MODE);
+        strncpy(dest, src, size - 1);
     }
-    else if (result != ESP_OK)
+    dest[size - 1] = 0;
+}
+
+void SettingsTask::markDirty_(uint32_t groups)
+{
+    int64_t nowUs = esp_timer_get_time();
+    if (dirtyGroups_ == 0)
+    {
+        firstDirtyTimeUs_ = nowUs;
+    }
+    dirtyGroups_ |= groups;
+
+#if CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+    RtcPending.magic = RTC_PENDING_MAGIC;
+    RtcPending.dirtyGroups = dirtyGroups_;
+    RtcPending.leftChannelVolume = leftChannelVolume_;
+    RtcPending.rightChannelVolume = rightChannelVolume_;
+    RtcPending.lastMode = lastMode_;
+    RtcPending.crc = RtcPendingCrc();
+#endif // CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+
+    // Wait for the user to stop changing things (e.g. holding down a volume
+    // button), but don't hold on to changes forever.
+    int64_t delayUs = std::min(FLUSH_IDLE_US, firstDirtyTimeUs_ + FLUSH_MAX_DELAY_US - nowUs);
+    flushTimer_.stop();
+    flushTimer_.changeInterval(std::max(delayUs, (int64_t)MIN_FLUSH_DELAY_US));
+    flushTimer_.start(true);
+}
+
+void SettingsTask::flush_()
+{
+    flushTimer_.stop();
+
+    if (dirtyGroups_ & DIRTY_VOLUME)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "error retrieving lastMode: %s", esp_err_to_name(result));
+        saveVolumeSettings_();
     }
-    else
+    if (dirtyGroups_ & DIRTY_LAST_MODE)
     {
-        ESP_LOGI(CURRENT_LOG_TAG, "lastMode: %d", lastMode_);
+        saveLastMode_();
     }
-    
-    // Request mode change to previous mode
-    audio::RequestSetFreeDVModeMessage reqMsg((audio::FreeDVMode)lastMode_);
-    publish(&reqMsg);
+    dirtyGroups_ = 0;
+
+#if CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
+    RtcPending.magic = 0;
+#endif // CONFIG_EZDV_SETTINGS_RTC_WRITE_BACK
 }
 
 void SettingsTask::commit_()
@@ -892,20 +1097,13 @@ void SettingsTask::setLeftChannelVolume_(int8_t vol)
     bool valueChanged = vol != leftChannelVolume_;
     leftChannelVolume_ = vol;
     
+    updateSnapshot_();
+
     if (storageHandle_)
     {
         if (valueChanged)
         {
-            esp_err_t result = storageHandle_->set_item(LEFT_CHAN_VOL_ID, vol);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting leftChannelVolume: %s", esp_err_to_name(result));
-            }
-            else
-            {
-                commitTimer_.stop();
-                commitTimer_.start(true);
-            }
+            markDirty_(DIRTY_VOLUME);
         }
 
         // Publish new volume setting to everyone who may care.
@@ -926,17 +1124,13 @@ void SettingsTask::setRightChannelVolume_(int8_t vol)
     bool valueChanged = vol != rightChannelVolume_;
     rightChannelVolume_ = vol;
     
+    updateSnapshot_();
+
     if (storageHandle_)
     {
         if (valueChanged)
         {
-            esp_err_t result = storageHandle_->set_item(RIGHT_CHAN_VOL_ID, vol);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting rightChannelVolume: %s", esp_err_to_name(result));
-            }
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            markDirty_(DIRTY_VOLUME);
         }
 
         // Publish new volume setting to everyone who may care.
@@ -985,48 +1179,13 @@ void SettingsTask::setWifiSettings_(
     strncpy(wifiPassword_, password, WifiSettingsMessage::MAX_STR_SIZE - 1);
     strncpy(wifiHostname_, hostname, WifiSettingsMessage::MAX_STR_SIZE - 1);
 
+    updateSnapshot_();
+
     if (storageHandle_)
     {
         if (valuesChanged)
         {
-            esp_err_t result = storageHandle_->set_item(WIFI_ENABLED_ID, wifiEnabled_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifiEnabled: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(WIFI_MODE_ID, wifiMode_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifiMode: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(WIFI_SECURITY_ID, wifiSecurity_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifiSecurity: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(WIFI_CHANNEL_ID, wifiChannel_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifiChannel: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_string(WIFI_SSID_ID, wifiSsid_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifiSsid: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_string(WIFI_PASSWORD_ID, wifiPassword_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifPassword: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_string(WIFI_HOSTNAME_ID, wifiHostname_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting wifiHostname: %s", esp_err_to_name(result));
-            }
-                
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            saveWifiSettings_();
         }
 
         // Publish new Wi-Fi settings to everyone who may care.
@@ -1083,53 +1242,13 @@ void SettingsTask::setRadioSettings_(
     strncpy(radioUsername_, username, RadioSettingsMessage::MAX_STR_SIZE - 1);
     strncpy(radioPassword_, password, RadioSettingsMessage::MAX_STR_SIZE - 1);
     
+    updateSnapshot_();
+
     if (storageHandle_)
     {
         if (valuesChanged)
         {
-            esp_err_t result = storageHandle_->set_item(HEADSET_PTT_ID, headsetPtt_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting headsetPtt: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(TIME_OUT_TIMER_ID, timeOutTimer_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting timeOutTimer: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(RADIO_ENABLED_ID, radioEnabled_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting radioEnabled: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(RADIO_TYPE_ID, radioType_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting radioType: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_string(RADIO_HOSTNAME_ID, radioHostname_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting radioHostname: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(RADIO_PORT_ID, radioPort_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting radioPort: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_string(RADIO_USERNAME_ID, radioUsername_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting radioUsername: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_string(RADIO_PASSWORD_ID, radioPassword_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting radioPassword: %s", esp_err_to_name(result));
-            }
-                
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            saveRadioSettings_();
         }
 
         // Publish new Wi-Fi settings to everyone who may care.
@@ -1158,50 +1277,38 @@ void SettingsTask::onSetVoiceKeyerSettingsMessage_(DVTask* origin, SetVoiceKeyer
     // XXX -- this shouldn't be needed.
     vTaskDelay(pdMS_TO_TICKS(50));
     
-    setVoiceKeyerSettings_(message->enabled, message->timesToTransmit, message->secondsToWait);
+    setVoiceKeyerSettings_(message->enabled, message->timesToTransmit, message->secondsToWait, message->slot);
 }
 
-void SettingsTask::setVoiceKeyerSettings_(bool enabled, int timesToTransmit, int secondsToWait, bool force)
+void SettingsTask::setVoiceKeyerSettings_(bool enabled, int timesToTransmit, int secondsToWait, int slot, bool force)
 {
     bool valuesChanged =
         force ||
         enableVoiceKeyer_ != enabled ||
         voiceKeyerNumberTimesToTransmit_ != timesToTransmit ||
-        voiceKeyerSecondsToWaitAfterTransmit_ != secondsToWait;
+        voiceKeyerSecondsToWaitAfterTransmit_ != secondsToWait ||
+        voiceKeyerSlot_ != slot;
 
     enableVoiceKeyer_ = enabled;
     voiceKeyerNumberTimesToTransmit_ = timesToTransmit;
     voiceKeyerSecondsToWaitAfterTransmit_ = secondsToWait;
+    voiceKeyerSlot_ = slot;
     
+    updateSnapshot_();
+
     if (storageHandle_)
     {
         if (valuesChanged)
         {
-            esp_err_t result = storageHandle_->set_item(VOICE_KEYER_ENABLED_ID, enableVoiceKeyer_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting enableVoiceKeyer: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(VOICE_KEYER_TIMES_TO_TRANSMIT, voiceKeyerNumberTimesToTransmit_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting voiceKeyerNumberTimesToTransmit: %s", esp_err_to_name(result));
-            }
-            result = storageHandle_->set_item(VOICE_KEYER_SECONDS_TO_WAIT_AFTER_TRANSMIT, voiceKeyerSecondsToWaitAfterTransmit_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting voiceKeyerSecondsToWaitAfterTransmit: %s", esp_err_to_name(result));
-            }
-
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            saveVoiceKeyerSettings_();
         }
 
         // Publish new voice keyer settings to everyone who may care.
         VoiceKeyerSettingsMessage* message = new VoiceKeyerSettingsMessage(
             enableVoiceKeyer_,
             voiceKeyerNumberTimesToTransmit_,
-            voiceKeyerSecondsToWaitAfterTransmit_
+            voiceKeyerSecondsToWaitAfterTransmit_,
+            voiceKeyerSlot_
         );
         assert(message != nullptr);
         publish(message);
@@ -1240,42 +1347,13 @@ void SettingsTask::setReportingSettings_(
     forceReporting_ = forceReporting;
     freqHz_ = freqHz;
     
+    updateSnapshot_();
+
     if (storageHandle_)
     {
         if (valuesChanged)
         {
-            esp_err_t result = storageHandle_->set_string(REPORTING_CALLSIGN_ID, callsign_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting callsign: %s", esp_err_to_name(result));
-            }
-            
-            result = storageHandle_->set_string(REPORTING_GRID_SQUARE_ID, gridSquare_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting gridSquare: %s", esp_err_to_name(result));
-            }
-            
-            result = storageHandle_->set_item(REPORTING_FORCE_ID, forceReporting_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting forceReporting: %s", esp_err_to_name(result));
-            }
-            
-            result = storageHandle_->set_item(REPORTING_FREQ_ID, freqHz_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting freqHz: %s", esp_err_to_name(result));
-            }
-
-            result = storageHandle_->set_string(REPORTING_MSG_ID, message_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting reporting message: %s", esp_err_to_name(result));
-            }
-                
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            saveReportingSettings_();
         }
 
         // Publish new Wi-Fi settings to everyone who may care.
@@ -1310,18 +1388,13 @@ void SettingsTask::setLedBrightness_(int dutyCycle)
 
     ledDutyCycle_ = dutyCycle;
     
+    updateSnapshot_();
+
     if (storageHandle_)
     {        
         if (valueChanged)
         {
-            esp_err_t result = storageHandle_->set_item(LED_DUTY_CYCLE_ID, ledDutyCycle_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting ledDutyCycle: %s", esp_err_to_name(result));
-            }
-
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            saveLedBrightness_();
         }
 
         // Publish new voice keyer settings to everyone who may care.
@@ -1347,16 +1420,11 @@ void SettingsTask::setLastMode_(int lastMode)
     if (lastMode_ != lastMode)
     {
         lastMode_ = lastMode;
+        updateSnapshot_();
+
         if (storageHandle_)
         {        
-            esp_err_t result = storageHandle_->set_item(LAST_MODE_ID, lastMode_);
-            if (result != ESP_OK)
-            {
-                ESP_LOGE(CURRENT_LOG_TAG, "error setting lastMode: %s", esp_err_to_name(result));
-            }
-
-            commitTimer_.stop();
-            commitTimer_.start(true);
+            markDirty_(DIRTY_LAST_MODE);
         
             // Note: don't report mode changes on update. We're only interested
             // in the last used mode on bootup.
@@ -28,6 +28,7 @@
 #include "task/DVTimer.h"
 
 #include "SettingsMessage.h"
+#include "SettingsSnapshot.h"
 #include "audio/FreeDVMessage.h"
 
 namespace ezdv
@@ -49,6 +50,21 @@ protected:
     virtual void onTaskSleep_() override;
 
 private:
+    enum BlobStatus
+    {
+        BLOB_OK,
+        BLOB_MIGRATED, // stored by older firmware; should be saved again
+        BLOB_NOT_FOUND,
+        BLOB_INVALID,
+    };
+
+    // Frequently changing settings that are written to flash lazily.
+    enum DirtyGroup
+    {
+        DIRTY_VOLUME = 1 << 0,
+        DIRTY_LAST_MODE = 1 << 1,
+    };
+
     int8_t leftChannelVolume_;
     int8_t rightChannelVolume_;
     
@@ -78,11 +94,15 @@ private:
     bool enableVoiceKeyer_;
     int voiceKeyerNumberTimesToTransmit_;
     int voiceKeyerSecondsToWaitAfterTransmit_;
+    int voiceKeyerSlot_;
     
     int ledDutyCycle_;
     int lastMode_;
 
     DVTimer commitTimer_;
+    DVTimer flushTimer_;
+    uint32_t dirtyGroups_;
+    int64_t firstDirtyTimeUs_;
     std::shared_ptr<nvs::NVSHandle> storageHandle_;
     
     void onRequestWifiSettingsMessage_(DVTask* origin, RequestWifiSettingsMessage* message);
@@ -109,12 +129,18 @@ private:
     
     void loadAllSettings_();
     void commit_();
+
+    /// @brief Schedules the given groups to be written once they stop changing.
+    void markDirty_(uint32_t groups);
+
+    /// @brief Writes everything marked by markDirty_() now.
+    void flush_();
     
     void setLeftChannelVolume_(int8_t vol);
     void setRightChannelVolume_(int8_t vol);
     void setWifiSettings_(bool enabled, WifiMode mode, WifiSecurityMode security, int channel, const char* ssid, const char* password, const char* hostname, bool force = false);
     void setRadioSettings_(bool headsetPtt, int timeOutTimer, bool enabled, int type, const char* host, int port, const char* username, const char* password, bool force = false);
-    void setVoiceKeyerSettings_(bool enabled, int timesToTransmit, int secondsToWait, bool force = false);
+    void setVoiceKeyerSettings_(bool enabled, int timesToTransmit, int secondsToWait, int slot, bool force = false);
     void setReportingSettings_(const char* callsign, const char* gridSquare, bool forceReporting, uint64_t freqHz, const char* message, bool force = false);
     void setLedBrightness_(int dutyCycle);
     void setLastMode_(int lastMode);
@@ -126,6 +152,29 @@ private:
     void initializeReporting_();
     void initializeLedBrightness_();
     void initializeLastMode_();
+
+    void saveVolumeSettings_();
+    void saveWifiSettings_();
+    void saveRadioSettings_();
+    void saveVoiceKeyerSettings_();
+    void saveReportingSettings_();
+    void saveLedBrightness_();
+    void saveLastMode_();
+
+    /// @brief Reads a settings group, checking its length and CRC.
+    /// @param payload Structure to read into, pre-filled with defaults.
+    BlobStatus readBlob_(const char* key, uint16_t version, void* payload, size_t payloadSize);
+    void writeBlob_(const char* key, uint16_t version, const void* payload, size_t payloadSize);
+
+    // Used to migrate settings saved before they were grouped.
+    template<typename T>
+    void readLegacyItem_(const char* key, T& value, T defaultValue);
+    void readLegacyString_(const char* key, char* value, size_t size, const char* defaultValue);
+
+    /// @brief Copies the current settings to SettingsSnapshot and announces the new version.
+    void updateSnapshot_();
+
+    static void copyString_(char* dest, const char* src, size_t size);
 };
 
 } // namespace storage
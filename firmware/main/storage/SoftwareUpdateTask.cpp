@@ -15,35 +15,115 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <chrono>
-
-using namespace std::chrono_literals;
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
 
 #include "SoftwareUpdateTask.h"
 #include "SoftwareUpdateMessage.h"
 
+#include "esp_timer.h"
+#include "esp_pthread.h"
+#include "esp_crt_bundle.h"
+
 #define CURRENT_LOG_TAG "SoftwareUpdateTask"
 
+#define STAGE_WAIT_TICKS (pdMS_TO_TICKS(10))
+
+// Downloads (and their decompression) run below anything audio related.
+#define DOWNLOAD_THREAD_PRIORITY (tskIDLE_PRIORITY + 1)
+#define DOWNLOAD_THREAD_STACK_SIZE (8192) // TLS needs the extra stack
+#define DOWNLOAD_TIMEOUT_MS (5000)
+#define DOWNLOAD_RETRY_DELAY_MS (2000)
+
 namespace ezdv
 {
 
 namespace storage
 {
+
+SemaphoreHandle_t SoftwareUpdateTask::ChunkSemaphore_ = nullptr;
+SoftwareUpdateTask* SoftwareUpdateTask::Instance_ = nullptr;
     
 SoftwareUpdateTask::SoftwareUpdateTask()
     : DVTask("SoftwareUpdateTask", 10, 4096, tskNO_AFFINITY, 256)
     , isRunning_(false)
+    , isDownload_(false)
+    , receiveComplete_(false)
     , nextAppPartition_(nullptr)
     , nextHttpPartition_(nullptr)
     , appPartitionHandle_(0)
+    , runningHttpPartition_(nullptr)
+    , httpPartitionOffset_(0)
+    , httpErasedOffset_(0)
+    , flashThreadRunning_(false)
+    , flashFailed_(false)
+    , flashBlocksOutstanding_(0)
+    , flashBuffers_{}
+    , currentFlashBlock_{}
+    , flashBytesWritten_(0)
+    , flashWriteTimeUs_(0)
+    , flashEraseTimeUs_(0)
+    , downloadUrl_{}
+    , deltaPatcher_(nullptr)
 {
-    registerMessageHandler(this, &SoftwareUpdateTask::onStartFirmwareUploadMessage_);
-    registerMessageHandler(this, &SoftwareUpdateTask::onFirmwareUploadDataMessage_);
+    registerMessageHandlers<
+        &SoftwareUpdateTask::onStartFirmwareUploadMessage_,
+        &SoftwareUpdateTask::onFirmwareUploadDataMessage_,
+        &SoftwareUpdateTask::onStartFirmwareDownloadMessage_>(this);
+
+    // A chunk that can't be queued still has to go back to the pool.
+    setMessageOverflowPolicy<network::FirmwareUploadDataMessage>(OVERFLOW_BLOCK, &OnFirmwareUploadDataDropped_);
+    network::UploadBufferPool::Initialize();
+
+    assert(ChunkSemaphore_ == nullptr);
+    ChunkSemaphore_ = xSemaphoreCreateCounting(MAX_CHUNKS_IN_FLIGHT, MAX_CHUNKS_IN_FLIGHT);
+    assert(ChunkSemaphore_ != nullptr);
+
+    // Used only to wake up the next stage; the queues themselves are lock-free.
+    dataBlockSemaphore_ = xSemaphoreCreateBinary();
+    assert(dataBlockSemaphore_ != nullptr);
+    pendingFlashBlockSemaphore_ = xSemaphoreCreateBinary();
+    assert(pendingFlashBlockSemaphore_ != nullptr);
+    freeFlashBufferSemaphore_ = xSemaphoreCreateBinary();
+    assert(freeFlashBufferSemaphore_ != nullptr);
+
+    assert(Instance_ == nullptr);
+    Instance_ = this;
 }
 
 SoftwareUpdateTask::~SoftwareUpdateTask()
 {
-    // empty
+    vSemaphoreDelete(dataBlockSemaphore_);
+    vSemaphoreDelete(pendingFlashBlockSemaphore_);
+    vSemaphoreDelete(freeFlashBufferSemaphore_);
+
+    vSemaphoreDelete(ChunkSemaphore_);
+    ChunkSemaphore_ = nullptr;
+
+    Instance_ = nullptr;
+}
+
+bool SoftwareUpdateTask::WaitForSpace(TickType_t ticksToWait)
+{
+    if (ChunkSemaphore_ == nullptr)
+    {
+        return true;
+    }
+
+    return xSemaphoreTake(ChunkSemaphore_, ticksToWait) == pdTRUE;
+}
+
+SoftwareUpdateTask* SoftwareUpdateTask::GetInstance()
+{
+    return Instance_;
+}
+
+void SoftwareUpdateTask::OnFirmwareUploadDataDropped_(DVTaskMessage* message)
+{
+    network::UploadBufferPool::Release(((network::FirmwareUploadDataMessage*)message)->buf);
+    xSemaphoreGive(ChunkSemaphore_);
 }
 
 void SoftwareUpdateTask::onTaskStart_()
@@ -56,12 +136,26 @@ void SoftwareUpdateTask::onTaskStart_()
 
 void SoftwareUpdateTask::onTaskSleep_()
 {
+    stopUpdate_();
+}
+
+void SoftwareUpdateTask::stopUpdate_()
+{
+    isRunning_ = false;
+
+    // The download thread has to stop first as it could still be passing
+    // on data.
+    if (downloadThread_.joinable())
+    {
+        downloadThread_.join();
+    }
+
     if (updateThread_.joinable())
     {
-        isRunning_ = false;
-        dataBlockCV_.notify_one();
+        xSemaphoreGive(dataBlockSemaphore_);
         updateThread_.join();
     }
+    discardReceivedBlocks_();
 }
 
 void SoftwareUpdateTask::onStartFirmwareUploadMessage_(DVTask* origin, network::StartFirmwareUploadMessage* message)
@@ -72,37 +166,254 @@ void SoftwareUpdateTask::onStartFirmwareUploadMessage_(DVTask* origin, network::
     if (updateThread_.joinable())
     {
         ESP_LOGW(CURRENT_LOG_TAG, "Need to stop current flash before we can start again");
-        
-        isRunning_ = false;
-        dataBlockCV_.notify_one();
-        updateThread_.join();
     }
+    stopUpdate_();
     
     // Start update thread. This is needed because of the API uzlib/tinyutar use
     // that make its use as part of this component infrastructure non-trivial.
     // The thread will end itself once the SW update finishes (either successfully or
     // otherwise).
     isRunning_ = true;
+    isDownload_ = false;
+    receiveComplete_ = false;
     updateThread_ = std::thread(std::bind(&SoftwareUpdateTask::updateThreadEntryFn_, this));
+
+    network::UploadCreditMessage credit(MAX_CHUNKS_IN_FLIGHT);
+    publish(&credit);
 }
 
 void SoftwareUpdateTask::onFirmwareUploadDataMessage_(DVTask* origin, network::FirmwareUploadDataMessage* message)
 {
-    // If we're not currently flashing, ignore the message.
-    if (!updateThread_.joinable())
+    // If we're not currently flashing (or are downloading instead), ignore the message.
+    if (!isRunning_ || isDownload_)
     {
         ESP_LOGW(CURRENT_LOG_TAG, "Received firmware data but not currently running!");
         
-        delete[] message->buf;
+        network::UploadBufferPool::Release(message->buf);
+        xSemaphoreGive(ChunkSemaphore_);
         return;
     }
     
     // Queue received data and let the update thread know that it's available.
+    // There's always room as the web server can't have more than 
+    // MAX_CHUNKS_IN_FLIGHT chunks outstanding.
+    if (!receivedDataBlocks_.push(VectorEntryType(message->buf, message->length)))
     {
-        std::unique_lock<std::mutex> lock(dataBlockMutex_);
-        receivedDataBlocks_.push_back(VectorEntryType(message->buf, message->length));
+        ESP_LOGE(CURRENT_LOG_TAG, "Too many firmware chunks in flight, dropping");
+
+        network::UploadBufferPool::Release(message->buf);
+        xSemaphoreGive(ChunkSemaphore_);
+        return;
+    }
+    xSemaphoreGive(dataBlockSemaphore_);
+}
+
+void SoftwareUpdateTask::onStartFirmwareDownloadMessage_(DVTask* origin, network::StartFirmwareDownloadMessage* message)
+{
+    const char* url = (*message->url != 0) ? message->url : CONFIG_EZDV_OTA_DOWNLOAD_URL;
+    if (*url == 0)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "No firmware download URL provided or configured");
+
+        FirmwareUpdateCompleteMessage response(false);
+        publish(&response);
+        return;
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Beginning firmware download from %s", url);
+
+    if (updateThread_.joinable())
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Need to stop current flash before we can start again");
+    }
+    stopUpdate_();
+
+    strncpy(downloadUrl_, url, sizeof(downloadUrl_) - 1);
+    downloadUrl_[sizeof(downloadUrl_) - 1] = 0;
+
+    isRunning_ = true;
+    isDownload_ = true;
+    receiveComplete_ = false;
+
+    // Decompression and downloading both happen at low priority. As the
+    // pthread configuration is per-thread, it only affects the threads
+    // created here.
+    esp_pthread_cfg_t defaultCfg = esp_pthread_get_default_config();
+    esp_pthread_cfg_t lowPriorityCfg = defaultCfg;
+    lowPriorityCfg.prio = DOWNLOAD_THREAD_PRIORITY;
+    ESP_ERROR_CHECK(esp_pthread_set_cfg(&lowPriorityCfg));
+    updateThread_ = std::thread(std::bind(&SoftwareUpdateTask::updateThreadEntryFn_, this));
+
+    lowPriorityCfg.stack_size = DOWNLOAD_THREAD_STACK_SIZE;
+    ESP_ERROR_CHECK(esp_pthread_set_cfg(&lowPriorityCfg));
+    downloadThread_ = std::thread(std::bind(&SoftwareUpdateTask::downloadThreadEntryFn_, this));
+
+    ESP_ERROR_CHECK(esp_pthread_set_cfg(&defaultCfg));
+}
+
+void SoftwareUpdateTask::downloadThreadEntryFn_()
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Begin FW download thread");
+
+    int offset = 0;
+    int numFailures = 0;
+    bool complete = false;
+
+    while (isRunning_ && !complete && numFailures <= CONFIG_EZDV_OTA_DOWNLOAD_RETRIES)
+    {
+        if (numFailures > 0)
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Resuming download at %d bytes (attempt %d)", offset, numFailures + 1);
+            vTaskDelay(pdMS_TO_TICKS(DOWNLOAD_RETRY_DELAY_MS));
+        }
+
+        esp_http_client_config_t config = {};
+        config.url = downloadUrl_;
+        config.timeout_ms = DOWNLOAD_TIMEOUT_MS;
+        config.crt_bundle_attach = esp_crt_bundle_attach;
+
+        esp_http_client_handle_t client = esp_http_client_init(&config);
+        if (client == nullptr)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not create HTTP client");
+            numFailures++;
+            continue;
+        }
+
+        int prevOffset = offset;
+        complete = downloadRange_(client, offset);
+        esp_http_client_cleanup(client);
+
+        // Only consecutive attempts that didn't get anywhere count 
+        // towards the retry limit.
+        numFailures = (offset > prevOffset) ? 1 : numFailures + 1;
+    }
+
+    if (complete)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Downloaded %d bytes", offset);
+    }
+    else if (isRunning_)
+    {
+        // Stopping makes the update thread report the failure.
+        ESP_LOGE(CURRENT_LOG_TAG, "Giving up on firmware download after %d bytes", offset);
+        isRunning_ = false;
+    }
+
+    // Lets the update thread know a truncated file won't get any longer.
+    receiveComplete_ = true;
+    xSemaphoreGive(dataBlockSemaphore_);
+}
+
+bool SoftwareUpdateTask::downloadRange_(esp_http_client_handle_t client, int& offset)
+{
+    char rangeHeader[32];
+    if (offset > 0)
+    {
+        snprintf(rangeHeader, sizeof(rangeHeader), "bytes=%d-", offset);
+        esp_http_client_set_header(client, "Range", rangeHeader);
+    }
+
+    esp_err_t result = esp_http_client_open(client, 0);
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not connect to download server: %s", esp_err_to_name(result));
+        return false;
+    }
+
+    esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+
+    // Servers that don't support ranges send the whole file again.
+    int toSkip = 0;
+    if (status == 200 && offset > 0)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Download server doesn't support resuming, skipping %d bytes", offset);
+        toSkip = offset;
+    }
+    else if (status != 200 && status != 206)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Download server returned HTTP status %d", status);
+        esp_http_client_close(client);
+        return false;
+    }
+
+    bool complete = false;
+    int64_t startTimeUs = esp_timer_get_time();
+    int64_t bytesThisRequest = 0;
+    while (isRunning_)
+    {
+        // Same flow control as for uploads from the web UI.
+        if (!WaitForSpace(pdMS_TO_TICKS(DOWNLOAD_TIMEOUT_MS)))
+        {
+            continue;
+        }
+
+        char* buf = network::UploadBufferPool::Acquire(pdMS_TO_TICKS(DOWNLOAD_TIMEOUT_MS));
+        if (buf == nullptr)
+        {
+            xSemaphoreGive(ChunkSemaphore_);
+            continue;
+        }
+
+        int length = esp_http_client_read(client, buf, DOWNLOAD_CHUNK_SIZE);
+        if (length <= 0)
+        {
+            network::UploadBufferPool::Release(buf);
+            xSemaphoreGive(ChunkSemaphore_);
+
+            complete = (length == 0) && esp_http_client_is_complete_data_received(client);
+            if (!complete)
+            {
+                ESP_LOGW(CURRENT_LOG_TAG, "Download interrupted at %d bytes", offset);
+            }
+            break;
+        }
+        bytesThisRequest += length;
+
+        if (toSkip > 0)
+        {
+            int skipping = std::min(toSkip, length);
+            memmove(buf, buf + skipping, length - skipping);
+            toSkip -= skipping;
+            length -= skipping;
+
+            if (length == 0)
+            {
+                network::UploadBufferPool::Release(buf);
+                xSemaphoreGive(ChunkSemaphore_);
+                continue;
+            }
+        }
+
+        // There's always room as we hold one of the MAX_CHUNKS_IN_FLIGHT credits.
+        offset += length;
+        receivedDataBlocks_.push(VectorEntryType(buf, length));
+        xSemaphoreGive(dataBlockSemaphore_);
+
+        // Stay under the bandwidth limit by waiting until the data read so 
+        // far should have taken to arrive.
+        int64_t expectedUs = bytesThisRequest * 1000000 / (CONFIG_EZDV_OTA_DOWNLOAD_MAX_KBPS * 1024);
+        int64_t elapsedUs = esp_timer_get_time() - startTimeUs;
+        if (expectedUs > elapsedUs)
+        {
+            vTaskDelay(pdMS_TO_TICKS((expectedUs - elapsedUs) / 1000) + 1);
+        }
+    }
+
+    esp_http_client_close(client);
+    return complete;
+}
+
+void SoftwareUpdateTask::discardReceivedBlocks_()
+{
+    // Only safe once the update thread has exited.
+    VectorEntryType block;
+    while (receivedDataBlocks_.pop(block))
+    {
+        network::UploadBufferPool::Release(block.first);
+        xSemaphoreGive(ChunkSemaphore_);
     }
-    dataBlockCV_.notify_one();
 }
 
 bool SoftwareUpdateTask::setPartitionPointers_()
@@ -129,14 +440,20 @@ bool SoftwareUpdateTask::setPartitionPointers_()
     ESP_LOGI(CURRENT_LOG_TAG, "Will be flashing to slot %d", appSlot);
     
     std::string nextHttpSlotName = "http_0";
+    std::string runningHttpSlotName = "http_1";
     if (appSlot == 0)
     {
         nextHttpSlotName = "http_0";
+        runningHttpSlotName = "http_1";
     }
     else if (appSlot == 1)
     {
         nextHttpSlotName = "http_1";
+        runningHttpSlotName = "http_0";
     }
+
+    // Only needed for delta updates.
+    runningHttpPartition_ = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, runningHttpSlotName.c_str());
     
     nextHttpPartition_ = const_cast<esp_partition_t*>(esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, nextHttpSlotName.c_str()));
     if (nextHttpPartition_ == nullptr)
@@ -146,8 +463,10 @@ bool SoftwareUpdateTask::setPartitionPointers_()
         return false;
     }
     
-    // Open and prep partitions for flashing
-    if (esp_ota_begin(nextAppPartition_, OTA_SIZE_UNKNOWN, &appPartitionHandle_) != ESP_OK)
+    // Open and prep partitions for flashing. Sectors are erased as they're
+    // written rather than all up front (which takes several seconds for
+    // our 4000K app partitions).
+    if (esp_ota_begin(nextAppPartition_, OTA_WITH_SEQUENTIAL_WRITES, &appPartitionHandle_) != ESP_OK)
     {
         ESP_LOGE(CURRENT_LOG_TAG, "Could not begin flashing app partition");
         nextHttpPartition_ = nullptr;
@@ -155,14 +474,9 @@ bool SoftwareUpdateTask::setPartitionPointers_()
         return false;
     }
     
-    if (esp_partition_erase_range(nextHttpPartition_, 0, nextHttpPartition_->size) != ESP_OK)
-    {
-        // Caller will abort the OTA operation if we can't erase this partition.
-        ESP_LOGE(CURRENT_LOG_TAG, "Could not erase http partition '%s'", nextHttpSlotName.c_str());
-        return false;
-    }
-    
+    // The HTTP partition is erased by the flash writer as it goes.
     httpPartitionOffset_ = 0;
+    httpErasedOffset_ = 0;
     return true;
 }
 
@@ -171,9 +485,12 @@ void SoftwareUpdateTask::updateThreadEntryFn_()
     bool success = false;
     
     ESP_LOGI(CURRENT_LOG_TAG, "Begin FW flash helper thread");
+    int64_t updateStartTimeUs = esp_timer_get_time();
     
     // Grab needed partition objects.
     setPartitionPointers_();
+    deltaPatcher_ = new DeltaPatcher();
+    assert(deltaPatcher_ != nullptr);
     
     currentDataBlock_ = nullptr;
     
@@ -187,6 +504,23 @@ void SoftwareUpdateTask::updateThreadEntryFn_()
     
     uzlibData_->contextData = this;
     uzlibData_->source_read_cb = &UzlibReadCallback_;
+
+    // Start flash writer. Internal RAM is used so writes don't need to be
+    // bounced through another buffer.
+    flashFailed_ = false;
+    flashBlocksOutstanding_ = 0;
+    flashBytesWritten_ = 0;
+    flashWriteTimeUs_ = 0;
+    flashEraseTimeUs_ = 0;
+    currentFlashBlock_ = {};
+    for (int index = 0; index < FLASH_BUFFER_COUNT; index++)
+    {
+        flashBuffers_[index] = (unsigned char*)heap_caps_malloc(FLASH_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        assert(flashBuffers_[index] != nullptr);
+        freeFlashBuffers_.push(flashBuffers_[index]);
+    }
+    flashThreadRunning_ = true;
+    flashThread_ = std::thread(std::bind(&SoftwareUpdateTask::flashThreadEntryFn_, this));
     
     auto res = uzlib_gzip_parse_header(uzlibData_);
     if (res != TINF_OK) 
@@ -208,6 +542,22 @@ void SoftwareUpdateTask::updateThreadEntryFn_()
         };
     
         auto ret = read_tar(&untarCallbacks, this);
+        if (ret == 0 && !waitForFlash_())
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not write firmware to flash");
+            ret = -1;
+        }
+
+        int64_t elapsedUs = esp_timer_get_time() - updateStartTimeUs;
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "Wrote %d KB in %d ms (%d KB/s overall); %d ms writing, %d ms erasing HTTP partition",
+            (int)(flashBytesWritten_ / 1024),
+            (int)(elapsedUs / 1000),
+            elapsedUs > 0 ? (int)(flashBytesWritten_ * 1000000 / 1024 / elapsedUs) : 0,
+            (int)(flashWriteTimeUs_ / 1000),
+            (int)(flashEraseTimeUs_ / 1000));
+
         if (ret == 0)
         {
             // Tar read was successful, check if flash was successful.
@@ -236,24 +586,45 @@ void SoftwareUpdateTask::updateThreadEntryFn_()
 fw_cleanup:
     isRunning_ = false;
 
-    // Perform cleanup as required
+    // Stop flash writer. Anything it hasn't written yet is no longer needed.
+    flashFailed_ = true;
+    flashThreadRunning_ = false;
+    xSemaphoreGive(pendingFlashBlockSemaphore_);
+    flashThread_.join();
+
+    FlashBlock block;
+    while (pendingFlashBlocks_.pop(block)) { }
+    unsigned char* buffer;
+    while (freeFlashBuffers_.pop(buffer)) { }
+    for (int index = 0; index < FLASH_BUFFER_COUNT; index++)
     {
-        std::unique_lock<std::mutex> lock(dataBlockMutex_);
-    
-        for (auto& val : receivedDataBlocks_)
+        heap_caps_free(flashBuffers_[index]);
+        flashBuffers_[index] = nullptr;
+    }
+    currentFlashBlock_ = {};
+
+    // Perform cleanup as required. Chunks that arrive from here on are 
+    // discarded by the task itself.
+    {
+        VectorEntryType val;
+        while (receivedDataBlocks_.pop(val))
         {
-            delete[] val.first;
+            network::UploadBufferPool::Release(val.first);
+            xSemaphoreGive(ChunkSemaphore_);
         }
-        receivedDataBlocks_.clear();
         
         if (currentDataBlock_)
         {
-            delete[] currentDataBlock_;
+            network::UploadBufferPool::Release(currentDataBlock_);
+            currentDataBlock_ = nullptr;
         }
         
         heap_caps_free(uzlibData_);
         heap_caps_free(uzlibDict_);
     }
+
+    delete deltaPatcher_;
+    deltaPatcher_ = nullptr;
     
     if (!success)
     {
@@ -268,11 +639,194 @@ fw_cleanup:
     nextHttpPartition_ = nullptr;
 }
 
+void SoftwareUpdateTask::flashThreadEntryFn_()
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Begin FW flash writer thread");
+
+    while (true)
+    {
+        FlashBlock block;
+        if (!pendingFlashBlocks_.pop(block))
+        {
+            if (!flashThreadRunning_)
+            {
+                break;
+            }
+
+            xSemaphoreTake(pendingFlashBlockSemaphore_, STAGE_WAIT_TICKS);
+            continue;
+        }
+
+        if (!flashFailed_)
+        {
+            esp_err_t result = ESP_OK;
+            if (block.partition == nullptr)
+            {
+                // app partition handling. Sectors are erased as they're
+                // reached (see esp_ota_begin() call).
+                int64_t startTimeUs = esp_timer_get_time();
+                result = esp_ota_write(appPartitionHandle_, block.data, block.length);
+                flashWriteTimeUs_ += esp_timer_get_time() - startTimeUs;
+            }
+            else
+            {
+                // HTTP partition handling
+                if (block.data != nullptr)
+                {
+                    result = eraseHttpPartition_(block.partition, block.offset + block.length);
+                }
+                else
+                {
+                    // End of the HTTP image. Erase whatever's left so none
+                    // of the old image remains.
+                    result = eraseHttpPartition_(block.partition, block.partition->size);
+                }
+
+                if (result == ESP_OK && block.data != nullptr)
+                {
+                    int64_t startTimeUs = esp_timer_get_time();
+                    result = esp_partition_write(block.partition, block.offset, block.data, block.length);
+                    flashWriteTimeUs_ += esp_timer_get_time() - startTimeUs;
+                }
+            }
+
+            if (result != ESP_OK)
+            {
+                ESP_LOGE(CURRENT_LOG_TAG, "Flash write failed: %s", esp_err_to_name(result));
+                flashFailed_ = true;
+            }
+            else if (block.data != nullptr)
+            {
+                flashBytesWritten_ += block.length;
+            }
+        }
+
+        if (block.data != nullptr)
+        {
+            freeFlashBuffers_.push(block.data);
+            xSemaphoreGive(freeFlashBufferSemaphore_);
+        }
+
+        flashBlocksOutstanding_--;
+        xSemaphoreGive(freeFlashBufferSemaphore_);
+    }
+}
+
+esp_err_t SoftwareUpdateTask::eraseHttpPartition_(esp_partition_t* partition, int endOffset)
+{
+    // Erase in large chunks, ahead of where we're writing, so there's 
+    // only one (large block) erase per HTTP_ERASE_SIZE worth of writes.
+    while (httpErasedOffset_ < endOffset && httpErasedOffset_ < (int)partition->size)
+    {
+        int eraseLength = std::min((int)HTTP_ERASE_SIZE, (int)partition->size - httpErasedOffset_);
+
+        int64_t startTimeUs = esp_timer_get_time();
+        esp_err_t result = esp_partition_erase_range(partition, httpErasedOffset_, eraseLength);
+        flashEraseTimeUs_ += esp_timer_get_time() - startTimeUs;
+
+        if (result != ESP_OK)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not erase http partition '%s'", partition->label);
+            return result;
+        }
+        httpErasedOffset_ += eraseLength;
+    }
+
+    return ESP_OK;
+}
+
+void SoftwareUpdateTask::queueFlashBlock_()
+{
+    flashBlocksOutstanding_++;
+    pendingFlashBlocks_.push(currentFlashBlock_);
+    xSemaphoreGive(pendingFlashBlockSemaphore_);
+    currentFlashBlock_ = {};
+}
+
+bool SoftwareUpdateTask::queueFlashData_(esp_partition_t* partition, const unsigned char* data, int length)
+{
+    while (length > 0)
+    {
+        if (currentFlashBlock_.data == nullptr)
+        {
+            // Wait for the flash writer to finish with a buffer.
+            unsigned char* buffer;
+            while (!freeFlashBuffers_.pop(buffer))
+            {
+                if (!isRunning_ || flashFailed_)
+                {
+                    return false;
+                }
+                xSemaphoreTake(freeFlashBufferSemaphore_, STAGE_WAIT_TICKS);
+            }
+
+            currentFlashBlock_.data = buffer;
+            currentFlashBlock_.length = 0;
+            currentFlashBlock_.partition = partition;
+            currentFlashBlock_.offset = httpPartitionOffset_;
+        }
+
+        int toCopy = std::min(length, (int)FLASH_BUFFER_SIZE - currentFlashBlock_.length);
+        memcpy(currentFlashBlock_.data + currentFlashBlock_.length, data, toCopy);
+        currentFlashBlock_.length += toCopy;
+        data += toCopy;
+        length -= toCopy;
+
+        if (partition != nullptr)
+        {
+            httpPartitionOffset_ += toCopy;
+        }
+
+        if (currentFlashBlock_.length == FLASH_BUFFER_SIZE)
+        {
+            queueFlashBlock_();
+        }
+    }
+
+    return !flashFailed_;
+}
+
+void SoftwareUpdateTask::endFlashFile_(esp_partition_t* partition)
+{
+    if (currentFlashBlock_.data != nullptr)
+    {
+        queueFlashBlock_();
+    }
+
+    if (partition != nullptr)
+    {
+        // Tells the flash writer to erase the rest of the partition.
+        currentFlashBlock_.partition = partition;
+        queueFlashBlock_();
+    }
+}
+
+bool SoftwareUpdateTask::waitForFlash_()
+{
+    while (flashBlocksOutstanding_ > 0)
+    {
+        xSemaphoreTake(freeFlashBufferSemaphore_, STAGE_WAIT_TICKS);
+    }
+
+    return !flashFailed_;
+}
+
 int SoftwareUpdateTask::UntarHeaderCallback_(header_translated_t *header, 
 										int entry_index, 
 										void *context_data)
 {
+    SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)context_data;
     ESP_LOGI(CURRENT_LOG_TAG, "Starting to read file %s from tarball", header->filename);
+
+    // Deltas are applied against the image we're currently running from.
+    if (!strcmp(header->filename, "ezdv.delta"))
+    {
+        thisPtr->deltaPatcher_->begin(esp_ota_get_running_partition(), &OnDeltaAppOutput_, thisPtr);
+    }
+    else if (!strcmp(header->filename, "http.delta"))
+    {
+        thisPtr->deltaPatcher_->begin(thisPtr->runningHttpPartition_, &OnDeltaHttpOutput_, thisPtr);
+    }
     
     return 0; // non-zero terminates untarring
 }
@@ -286,10 +840,11 @@ int SoftwareUpdateTask::UntarDataCallback_(header_translated_t *header,
     // Called when a data block has been seen in the file.
     SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)context_data;
     
+    // The actual writes happen on the flash writer thread.
     if (!strcmp(header->filename, "ezdv.bin"))
     {
         // app partition handling
-        if (esp_ota_write(thisPtr->appPartitionHandle_, block, length) != ESP_OK)
+        if (!thisPtr->queueFlashData_(nullptr, block, length))
         {
             return -1;
         }
@@ -297,11 +852,19 @@ int SoftwareUpdateTask::UntarDataCallback_(header_translated_t *header,
     else if (!strcmp(header->filename, "http.bin") || !strcmp(header->filename, "http_0.bin"))
     {
         // HTTP partition handling
-        if (esp_partition_write(thisPtr->nextHttpPartition_, thisPtr->httpPartitionOffset_, block, length) != ESP_OK)
+        if (thisPtr->nextHttpPartition_ == nullptr || 
+            !thisPtr->queueFlashData_(thisPtr->nextHttpPartition_, block, length))
+        {
+            return -1;
+        }
+    }
+    else if (!strcmp(header->filename, "ezdv.delta") || !strcmp(header->filename, "http.delta"))
+    {
+        // Output goes to OnDelta*Output_ below.
+        if (!thisPtr->deltaPatcher_->write(block, length))
         {
             return -1;
         }
-        thisPtr->httpPartitionOffset_ += length;
     }
     return 0; // non-zero terminates untarring
 }
@@ -312,8 +875,26 @@ int SoftwareUpdateTask::UntarEndFileCallback_(header_translated_t *header,
 {
     SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)context_data;
     ESP_LOGI(CURRENT_LOG_TAG, "Finished reading %s from tarball", header->filename);
+
+    bool isDelta = !strcmp(header->filename, "ezdv.delta") || !strcmp(header->filename, "http.delta");
+    if (isDelta && !thisPtr->deltaPatcher_->end())
+    {
+        return -1;
+    }
+
+    // Don't mix files in the same flash buffer.
+    if (!strcmp(header->filename, "http.bin") || 
+        !strcmp(header->filename, "http_0.bin") ||
+        !strcmp(header->filename, "http.delta"))
+    {
+        thisPtr->endFlashFile_(thisPtr->nextHttpPartition_);
+    }
+    else
+    {
+        thisPtr->endFlashFile_(nullptr);
+    }
     
-    if (!strcmp(header->filename, "http.bin"))
+    if (!strcmp(header->filename, "http.bin") || !strcmp(header->filename, "http.delta"))
     {
         // Set partition pointer to NULL to mark that we've finished flashing the HTTP partition.
         thisPtr->nextHttpPartition_ = nullptr;
@@ -322,6 +903,20 @@ int SoftwareUpdateTask::UntarEndFileCallback_(header_translated_t *header,
     return 0; // non-zero terminates untarring
 }
 
+bool SoftwareUpdateTask::OnDeltaAppOutput_(void* state, const unsigned char* data, int length)
+{
+    SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)state;
+    return thisPtr->queueFlashData_(nullptr, data, length);
+}
+
+bool SoftwareUpdateTask::OnDeltaHttpOutput_(void* state, const unsigned char* data, int length)
+{
+    SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)state;
+    return 
+        thisPtr->nextHttpPartition_ != nullptr && 
+        thisPtr->queueFlashData_(thisPtr->nextHttpPartition_, data, length);
+}
+
 int SoftwareUpdateTask::UntarReadBlockCallback_(void *context_data, unsigned char* block, int length)
 {
     SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)context_data;
@@ -340,35 +935,55 @@ int SoftwareUpdateTask::UntarReadBlockCallback_(void *context_data, unsigned cha
 int SoftwareUpdateTask::UzlibReadCallback_(struct uzlib_uncomp *uncomp)
 {
     SoftwareUpdateTask* thisPtr = (SoftwareUpdateTask*)uncomp->contextData;
-    std::unique_lock<std::mutex> lock(thisPtr->dataBlockMutex_);
     
     ESP_LOGI(CURRENT_LOG_TAG, "uzlib has requested more data");
     
     // If there's no data available, wait until we get more.
-    while (thisPtr->isRunning_ && thisPtr->receivedDataBlocks_.size() == 0)
+    VectorEntryType nextBlock;
+    while (thisPtr->isRunning_ && !thisPtr->receivedDataBlocks_.pop(nextBlock))
     {
+        if (thisPtr->receiveComplete_ && thisPtr->receivedDataBlocks_.size() == 0)
+        {
+            // The file ended early.
+            ESP_LOGE(CURRENT_LOG_TAG, "Firmware file is truncated");
+            return -1;
+        }
+
         ESP_LOGW(CURRENT_LOG_TAG, "no data yet for uzlib");
-        thisPtr->dataBlockCV_.wait_for(lock, 10ms);
+        xSemaphoreTake(thisPtr->dataBlockSemaphore_, STAGE_WAIT_TICKS);
     }
 
     if (!thisPtr->isRunning_)
     {
-        // Return EOF so we force stop of the gunzip process.
+        // Return EOF so we force stop of the gunzip process. A block popped 
+        // right before stopping still needs to be freed.
+        if (nextBlock.first != nullptr)
+        {
+            network::UploadBufferPool::Release(nextBlock.first);
+            xSemaphoreGive(ChunkSemaphore_);
+        }
         return -1;
     }
     
     // Set source pointers and return.
     if (thisPtr->uzlibData_->source != nullptr)
     {
-        delete[] thisPtr->currentDataBlock_;
+        network::UploadBufferPool::Release(thisPtr->currentDataBlock_);
         thisPtr->uzlibData_->source = nullptr;
         thisPtr->currentDataBlock_ = nullptr;
     }
     
-    thisPtr->currentDataBlock_ = thisPtr->receivedDataBlocks_[0].first;
+    thisPtr->currentDataBlock_ = nextBlock.first;
     thisPtr->uzlibData_->source = (const unsigned char*)thisPtr->currentDataBlock_ + 1;
-    thisPtr->uzlibData_->source_limit = (const unsigned char*)(thisPtr->receivedDataBlocks_[0].first + thisPtr->receivedDataBlocks_[0].second);
-    thisPtr->receivedDataBlocks_.erase(thisPtr->receivedDataBlocks_.begin());
+    thisPtr->uzlibData_->source_limit = (const unsigned char*)(nextBlock.first + nextBlock.second);
+
+    // Let the web server (and the browser) pass on the next chunk.
+    xSemaphoreGive(ChunkSemaphore_);
+    if (!thisPtr->isDownload_)
+    {
+        network::UploadCreditMessage credit(1);
+        thisPtr->publish(&credit);
+    }
     
     return *thisPtr->currentDataBlock_;
 }
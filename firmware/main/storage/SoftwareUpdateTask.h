@@ -18,19 +18,22 @@
 #ifndef SOFTWARE_UPDATE_TASK_H
 #define SOFTWARE_UPDATE_TASK_H
 
+#include <atomic>
 #include <thread>
-#include <condition_variable>
-#include <vector>
-#include <mutex>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_partition.h"
 #include "esp_ota_ops.h"
+#include "esp_http_client.h"
 
 #include "untar.h"
 #include "uzlib.h"
 
-#include "util/PSRamAllocator.h"
+#include "util/SpscQueue.h"
+#include "DeltaPatcher.h"
 #include "network/NetworkMessage.h"
+#include "network/UploadBufferPool.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
 
@@ -50,35 +53,149 @@ public:
     SoftwareUpdateTask();
     virtual ~SoftwareUpdateTask();
 
+    /// @brief Waits until another chunk of firmware can be accepted. Called
+    ///        by the web server before passing each chunk on.
+    /// @param ticksToWait The maximum amount of time to wait.
+    /// @return false if flashing didn't catch up in time.
+    static bool WaitForSpace(TickType_t ticksToWait);
+
+    /// @brief Returns the task that firmware chunks should be sent to, if it exists.
+    static SoftwareUpdateTask* GetInstance();
+
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
     
 private:
+    enum 
+    { 
+        // Number of websocket chunks (4KB each from the web UI) that can be
+        // waiting to be flashed. The browser is granted this many up front 
+        // and one more as each is taken for decompression.
+        MAX_CHUNKS_IN_FLIGHT = 8,
+
+        // Decompressed data is written to flash a sector at a time by a 
+        // separate thread, so decompression can continue while a sector
+        // is being written.
+        FLASH_BUFFER_SIZE = 4096,
+        FLASH_BUFFER_COUNT = 2,
+
+        // The HTTP partition is erased this much at a time (one flash
+        // block erase).
+        HTTP_ERASE_SIZE = 65536,
+
+        // Downloaded data is passed on in chunks the same size as the 
+        // web UI's.
+        DOWNLOAD_CHUNK_SIZE = network::UploadBufferPool::BUFFER_SIZE,
+    };
+
+    static SemaphoreHandle_t ChunkSemaphore_;
+    static SoftwareUpdateTask* Instance_;
+
+    /// @brief Decompressed data waiting to be written to flash.
+    struct FlashBlock
+    {
+        unsigned char* data;
+        int length;
+        esp_partition_t* partition; // or nullptr for the app partition
+        int offset; // only used for partition writes
+        // data == nullptr marks the end of the image in partition.
+    };
+
     char* uzlibDict_;
     std::thread updateThread_;
-    std::condition_variable dataBlockCV_;
-    std::mutex dataBlockMutex_;
     uzlib_uncomp* uzlibData_;
-    bool isRunning_;
+    std::atomic<bool> isRunning_;
+    std::atomic<bool> isDownload_; // data comes from downloadThread_ instead of the web server
+    std::atomic<bool> receiveComplete_; // no more data is coming
     char* currentDataBlock_;
     esp_partition_t* nextAppPartition_;
     esp_partition_t* nextHttpPartition_;
     esp_ota_handle_t appPartitionHandle_;
+    const esp_partition_t* runningHttpPartition_;
     int httpPartitionOffset_;
+    int httpErasedOffset_; // flash writer only
     
+    // Stage 1 -> 2: chunks received from the web server, waiting for 
+    // decompression. All of them are UploadBufferPool buffers owned by 
+    // this task until released.
     typedef std::pair<char*, int> VectorEntryType;
-    std::vector<VectorEntryType, util::PSRamAllocator<VectorEntryType> > receivedDataBlocks_;
+    util::SpscQueue<VectorEntryType, MAX_CHUNKS_IN_FLIGHT> receivedDataBlocks_;
+    SemaphoreHandle_t dataBlockSemaphore_;
+
+    // Stage 2 -> 3: filled buffers waiting to be written by flashThread_, 
+    // and the buffers it's finished with.
+    std::thread flashThread_;
+    std::atomic<bool> flashThreadRunning_;
+    std::atomic<bool> flashFailed_;
+    std::atomic<int> flashBlocksOutstanding_;
+    unsigned char* flashBuffers_[FLASH_BUFFER_COUNT];
+    FlashBlock currentFlashBlock_;
+    util::SpscQueue<FlashBlock, FLASH_BUFFER_COUNT * 2> pendingFlashBlocks_;
+    util::SpscQueue<unsigned char*, FLASH_BUFFER_COUNT> freeFlashBuffers_;
+    SemaphoreHandle_t pendingFlashBlockSemaphore_;
+    SemaphoreHandle_t freeFlashBufferSemaphore_;
+
+    // Flash writer statistics; read once writing is finished.
+    size_t flashBytesWritten_;
+    int64_t flashWriteTimeUs_;
+    int64_t flashEraseTimeUs_;
+
+    // Stage 1 for downloads: fetches the update from downloadUrl_.
+    std::thread downloadThread_;
+    char downloadUrl_[network::StartFirmwareDownloadMessage::MAX_URL_SIZE];
+
+    // Applies ezdv.delta/http.delta (see DeltaPatcher).
+    DeltaPatcher* deltaPatcher_;
     
     // Partition pointer initialization.
     bool setPartitionPointers_();
     
     // Update thread entry function.
     void updateThreadEntryFn_();
+
+    // Flash writer thread entry function.
+    void flashThreadEntryFn_();
+
+    // Download thread entry function.
+    void downloadThreadEntryFn_();
+
+    /// @brief Passes on the response to one download request.
+    /// @param client The client to make the request with.
+    /// @param offset The number of bytes already received; updated as more arrive.
+    /// @return true if the whole file has now been received.
+    bool downloadRange_(esp_http_client_handle_t client, int& offset);
+
+    /// @brief Stops any update in progress and waits for its threads to exit.
+    void stopUpdate_();
+
+    /// @brief Copies decompressed data into flash buffers, queueing each one as it fills.
+    /// @return false if flashing has failed or was cancelled.
+    bool queueFlashData_(esp_partition_t* partition, const unsigned char* data, int length);
+
+    /// @brief Queues the buffer currently being filled.
+    void queueFlashBlock_();
+
+    /// @brief Queues the partially filled buffer (if any) at the end of a file.
+    /// @param partition The file's partition, to erase the rest of (or nullptr).
+    void endFlashFile_(esp_partition_t* partition);
+
+    /// @brief Waits for everything queued to be written.
+    /// @return false if any write failed.
+    bool waitForFlash_();
+
+    /// @brief Erases the HTTP partition (in large chunks) until at least endOffset.
+    esp_err_t eraseHttpPartition_(esp_partition_t* partition, int endOffset);
+
+    /// @brief Deletes chunks that were received but never decompressed.
+    void discardReceivedBlocks_();
     
     // Firmware file upload handlers
     void onStartFirmwareUploadMessage_(DVTask* origin, network::StartFirmwareUploadMessage* message);
     void onFirmwareUploadDataMessage_(DVTask* origin, network::FirmwareUploadDataMessage* message);
+    void onStartFirmwareDownloadMessage_(DVTask* origin, network::StartFirmwareDownloadMessage* message);
+
+    static void OnFirmwareUploadDataDropped_(DVTaskMessage* message);
     
     // uzlib callbacks
     static int UzlibReadCallback_(struct uzlib_uncomp *uncomp);
@@ -99,6 +216,10 @@ private:
     									void *context_data);
 
     static int UntarReadBlockCallback_(void *context_data, unsigned char* block, int length);
+
+    // DeltaPatcher output callbacks
+    static bool OnDeltaAppOutput_(void* state, const unsigned char* data, int length);
+    static bool OnDeltaHttpOutput_(void* state, const unsigned char* data, int length);
 };
 
 }
@@ -0,0 +1,211 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+
+#include "DVMessagePool.h"
+
+// Marks blocks that came from the general heap instead of a pool.
+#define HEAP_FALLBACK_CLASS (0xFF)
+
+namespace ezdv
+{
+
+namespace task
+{
+
+// Block sizes include the MessageEntry header. Counts are per core.
+static const uint32_t PoolBlockSizes_[DVMessagePool::NUM_SIZE_CLASSES] = { 64, 128, 256, 512 };
+static const uint32_t PoolBlockCounts_[DVMessagePool::NUM_SIZE_CLASSES] = { 64, 16, 8, 2 };
+
+struct PoolFreeList
+{
+    portMUX_TYPE lock;
+    void* head;
+    uint32_t inUse;
+    uint32_t highWater;
+};
+
+static PoolFreeList FreeLists_[portNUM_PROCESSORS][DVMessagePool::NUM_SIZE_CLASSES];
+static std::atomic<uint32_t> HeapFallbacks_(0);
+static std::atomic<uint32_t> HeapFallbacksInUse_(0);
+static std::atomic<uint32_t> NumFailed_(0);
+static bool Initialized_ = false;
+
+void DVMessagePool::Initialize()
+{
+    if (Initialized_)
+    {
+        return;
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        for (int sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; sizeClass++)
+        {
+            PoolFreeList& list = FreeLists_[core][sizeClass];
+            portMUX_INITIALIZE(&list.lock);
+            list.head = nullptr;
+            list.inUse = 0;
+            list.highWater = 0;
+
+            uint32_t stride = sizeof(BlockHeader) + PoolBlockSizes_[sizeClass];
+            char* region = (char*)heap_caps_malloc(stride * PoolBlockCounts_[sizeClass], MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            assert(region != nullptr);
+
+            for (uint32_t index = 0; index < PoolBlockCounts_[sizeClass]; index++)
+            {
+                BlockHeader* block = (BlockHeader*)(region + index * stride);
+                block->sizeClass = sizeClass;
+                block->ownerCore = core;
+                block->next = (BlockHeader*)list.head;
+                list.head = block;
+            }
+        }
+    }
+
+    Initialized_ = true;
+}
+
+DVMessagePool::BlockHeader* DVMessagePool::AllocateFromList_(int core, int sizeClass)
+{
+    PoolFreeList& list = FreeLists_[core][sizeClass];
+
+    portENTER_CRITICAL_SAFE(&list.lock);
+    BlockHeader* block = (BlockHeader*)list.head;
+    if (block != nullptr)
+    {
+        list.head = block->next;
+        list.inUse++;
+        if (list.inUse > list.highWater)
+        {
+            list.highWater = list.inUse;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&list.lock);
+
+    return block;
+}
+
+void* DVMessagePool::Allocate(uint32_t size)
+{
+    if (Initialized_)
+    {
+        int ourCore = xPortGetCoreID();
+        for (int sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; sizeClass++)
+        {
+            if (size > PoolBlockSizes_[sizeClass])
+            {
+                continue;
+            }
+
+            // Prefer our own core's list to avoid contending with the other
+            // core, then try the other core's before going to a larger class.
+            for (int coreOffset = 0; coreOffset < portNUM_PROCESSORS; coreOffset++)
+            {
+                int core = (ourCore + coreOffset) % portNUM_PROCESSORS;
+                BlockHeader* block = AllocateFromList_(core, sizeClass);
+                if (block != nullptr)
+                {
+                    return block + 1;
+                }
+            }
+        }
+    }
+
+    // Nothing available in the pools. The heap can't be used from an ISR.
+    if (xPortInIsrContext())
+    {
+        NumFailed_++;
+        return nullptr;
+    }
+
+    // Otherwise fall back to the heap, still in internal RAM.
+    BlockHeader* block = (BlockHeader*)heap_caps_malloc(sizeof(BlockHeader) + size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (block == nullptr)
+    {
+        NumFailed_++;
+        return nullptr;
+    }
+    block->sizeClass = HEAP_FALLBACK_CLASS;
+    block->ownerCore = 0;
+    block->next = nullptr;
+
+    HeapFallbacks_++;
+    HeapFallbacksInUse_++;
+
+    return block + 1;
+}
+
+void DVMessagePool::Free(void* ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    BlockHeader* block = ((BlockHeader*)ptr) - 1;
+    if (block->sizeClass == HEAP_FALLBACK_CLASS)
+    {
+        HeapFallbacksInUse_--;
+        heap_caps_free(block);
+        return;
+    }
+
+    assert(block->sizeClass < NUM_SIZE_CLASSES && block->ownerCore < portNUM_PROCESSORS);
+
+    PoolFreeList& list = FreeLists_[block->ownerCore][block->sizeClass];
+    portENTER_CRITICAL_SAFE(&list.lock);
+    block->next = (BlockHeader*)list.head;
+    list.head = block;
+    list.inUse--;
+    portEXIT_CRITICAL_SAFE(&list.lock);
+}
+
+void DVMessagePool::GetStatistics(Statistics& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    for (int sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; sizeClass++)
+    {
+        stats.blockSize[sizeClass] = PoolBlockSizes_[sizeClass];
+
+        for (int core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            PoolFreeList& list = FreeLists_[core][sizeClass];
+
+            portENTER_CRITICAL_SAFE(&list.lock);
+            stats.blocksTotal[sizeClass] += PoolBlockCounts_[sizeClass];
+            stats.blocksInUse[sizeClass] += list.inUse;
+            stats.blocksHighWater[sizeClass] += list.highWater;
+            portEXIT_CRITICAL_SAFE(&list.lock);
+        }
+    }
+
+    stats.heapFallbacks = HeapFallbacks_;
+    stats.heapFallbacksInUse = HeapFallbacksInUse_;
+    stats.numFailed = NumFailed_;
+}
+
+}
+
+}
@@ -0,0 +1,85 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_MESSAGE_POOL_H
+#define DV_MESSAGE_POOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ezdv
+{
+
+namespace task
+{
+
+/// @brief Size-classed block pool used for DVTask message entries.
+///
+/// Blocks live in internal RAM and are kept on per-core free lists guarded
+/// by spinlocks, so pool allocation and release are safe from both tasks and
+/// ISRs. Requests that don't fit in any size class (or arrive when a class is
+/// exhausted) fall back to the internal RAM heap and are counted. ISRs can't
+/// use the heap, so for them (or when the heap is exhausted too) the
+/// allocation fails and the message is dropped.
+class DVMessagePool
+{
+public:
+    enum { NUM_SIZE_CLASSES = 4 };
+
+    struct Statistics
+    {
+        uint32_t blockSize[NUM_SIZE_CLASSES];
+        uint32_t blocksTotal[NUM_SIZE_CLASSES];
+        uint32_t blocksInUse[NUM_SIZE_CLASSES];
+        uint32_t blocksHighWater[NUM_SIZE_CLASSES];
+        uint32_t heapFallbacks;
+        uint32_t heapFallbacksInUse;
+        uint32_t numFailed; // allocations that couldn't be satisfied at all
+    };
+
+    /// @brief Allocates pool memory. Must be called before first use.
+    static void Initialize();
+
+    /// @brief Allocates a block of at least the given size.
+    /// @param size The number of bytes required.
+    /// @return Pointer to the allocated block, or nullptr if none is available.
+    static void* Allocate(uint32_t size);
+
+    /// @brief Returns a block previously obtained from Allocate().
+    /// @param ptr The block to release.
+    static void Free(void* ptr);
+
+    /// @brief Retrieves a snapshot of pool usage.
+    /// @param stats The structure to fill in.
+    static void GetStatistics(Statistics& stats);
+
+private:
+    struct alignas(8) BlockHeader
+    {
+        BlockHeader* next; // only valid while on a free list
+        uint8_t sizeClass;
+        uint8_t ownerCore;
+    };
+
+    static BlockHeader* AllocateFromList_(int core, int sizeClass);
+};
+
+}
+
+}
+
+#endif // DV_MESSAGE_POOL_H
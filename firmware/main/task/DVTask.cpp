@@ -20,49 +20,161 @@
 #include <inttypes.h>
 
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "DVTask.h"
+#include "DVMessagePool.h"
+#include "DVTimer.h"
+#include "DVTimerWheel.h"
+#include "DVTaskSchedulingProfile.h"
+#include "util/BootTimeline.h"
+#include "util/TaskWatermarks.h"
+#include "util/EventTrace.h"
 
 #define CURRENT_LOG_TAG ("DVTask")
 
+// Maximum number of tasks that can subscribe to a single message type.
+#define MAX_SUBSCRIBERS_PER_MESSAGE 32
+
+// Maximum number of normal lane messages to handle while bulk messages
+// are waiting before letting one of the latter through.
+#define MAX_CONSECUTIVE_NORMAL_LANE_MESSAGES 8
+
 namespace ezdv
 {
 
 namespace task
 {
 
-DVTask::PublishMap DVTask::SubscriberTasksByMessageType_;
-SemaphoreHandle_t DVTask::SubscriberTasksByMessageTypeSemaphore_;
+std::atomic<DVTask::SubscriberList*> DVTask::SubscriberListsBySlot_[DV_TASK_MAX_MESSAGE_SLOTS];
+std::atomic<uint32_t> DVTask::ActivePublishReaders_(0);
+std::atomic<uint32_t> DVTask::SubscriberGenerationsBySlot_[DV_TASK_MAX_MESSAGE_SLOTS];
+SemaphoreHandle_t DVTask::SubscriberUpdateSemaphore_;
+std::atomic<uint32_t> DVTask::NextCorrelationId_(1);
+DVTask* DVTask::FirstTask_ = nullptr;
+SemaphoreHandle_t DVTask::TaskListSemaphore_;
 
 void DVTask::Initialize()
 {
-    SubscriberTasksByMessageTypeSemaphore_ = xSemaphoreCreateBinary();
-    assert(SubscriberTasksByMessageTypeSemaphore_ != nullptr);
+    SubscriberUpdateSemaphore_ = xSemaphoreCreateMutex();
+    assert(SubscriberUpdateSemaphore_ != nullptr);
+
+    TaskListSemaphore_ = xSemaphoreCreateMutex();
+    assert(TaskListSemaphore_ != nullptr);
+
+    DVMessagePool::Initialize();
 }
 
 DVTask::DVTask(const char* taskName, UBaseType_t taskPriority, uint32_t taskStackSize, BaseType_t pinnedCoreId, int32_t taskQueueSize, TickType_t taskTick)
     : taskName_(taskName)
     , taskObject_(nullptr)
+    , dispatchDepth_(0)
+    , handlerCompactionPending_(false)
     , taskQueueSize_(taskQueueSize)
     , taskStackSize_(taskStackSize)
     , taskPriority_(taskPriority)
     , pinnedCoreId_(pinnedCoreId)
     , taskQueue_(nullptr)
     , taskTick_(taskTick)
+    , deadlineTicksEnabled_(false)
+    , nextTickDeadline_(0)
+    , laneSemaphore_(nullptr)
+    , lanesEnabled_(false)
+    , consecutiveNormalMessages_(0)
+    , tickRequested_(false)
+    , directTimerWakePending_(false)
+    , directTimerWakesDropped_(0)
+    , directTimerWakeDeferred_(false)
+    , timerWheel_(nullptr)
+    , coalescedEntriesPending_(false)
+    , overflowBlocked_(0)
+    , overflowBlockTimeouts_(0)
+    , overflowDroppedNewest_(0)
+    , overflowDroppedOldest_(0)
+    , overflowCoalesced_(0)
+    , queueHighWaterMark_(0)
+    , numMessagesHandled_(0)
+    , totalQueueWaitUs_(0)
+    , totalHandlerUs_(0)
+    , numWakeups_(0)
+    , nextTask_(nullptr)
+    , drainMaxMessages_(1)
+    , drainMaxTimeUs_(0)
+    , currentCorrelationId_(0)
 {
+    for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+    {
+        laneQueues_[lane] = nullptr;
+        laneQueueSizes_[lane] = 0;
+    }
+    laneQueueSizes_[MESSAGE_LANE_NORMAL] = taskQueueSize;
+    memset(&tickStats_, 0, sizeof(tickStats_));
+
     // Register task start/wake/sleep handlers.
-    registerMessageHandler(this, &DVTask::onTaskStart_);
-    registerMessageHandler(this, &DVTask::onTaskSleep_);
-    registerMessageHandler(this, &DVTask::onTaskQueueMessage_);
+    // onTaskStart_() and onTaskSleep_() are overloaded, so the handler
+    // versions need to be selected explicitly.
+    registerMessageHandlers<
+        static_cast<void(DVTask::*)(DVTask*, TaskStartMessage*)>(&DVTask::onTaskStart_),
+        static_cast<void(DVTask::*)(DVTask*, TaskSleepMessage*)>(&DVTask::onTaskSleep_),
+        &DVTask::onDumpTaskStatisticsMessage_>(this);
+
+    xSemaphoreTake(TaskListSemaphore_, portMAX_DELAY);
+    nextTask_ = FirstTask_;
+    FirstTask_ = this;
+    xSemaphoreGive(TaskListSemaphore_);
 }
 
 DVTask::~DVTask()
 {
     assert(taskObject_ == nullptr);
 
-    while (eventRegistrationMap_.size() > 0)
+    xSemaphoreTake(TaskListSemaphore_, portMAX_DELAY);
+    for (DVTask** current = &FirstTask_; *current != nullptr; current = &(*current)->nextTask_)
+    {
+        if (*current == this)
+        {
+            *current = nextTask_;
+            break;
+        }
+    }
+    xSemaphoreGive(TaskListSemaphore_);
+
+    // Handlers registered via registerMessageHandlers() have no storage
+    // to free, so just stop receiving everything we were subscribed to.
+    for (auto& list : handlerLists_)
+    {
+        bool subscribed = false;
+        for (auto& record : list.handlers)
+        {
+            if (record.fn != nullptr)
+            {
+                delete record.storage;
+                record.fn = nullptr;
+                record.storage = nullptr;
+                subscribed = true;
+            }
+        }
+
+        if (subscribed)
+        {
+            RemoveSubscriber_(list.slot, this);
+        }
+    }
+
+    for (auto& coalescedEntry : coalescedEntries_)
     {
-        auto iter = eventRegistrationMap_.begin();
-        unregisterMessageHandler(iter->second.second);
+        delete coalescedEntry;
+    }
+
+    // Any timers using the wheel were members of our child class and
+    // have already been destroyed by now.
+    delete timerWheel_;
+
+    clearPublishedState_();
+
+    for (auto& stats : messageStatsBySlot_)
+    {
+        heap_caps_free(stats);
     }
 }
 
@@ -88,11 +200,7 @@ void DVTask::start(DVTask* taskToStart, TickType_t ticksToWait)
     
     if (ticksToWait > 0)
     {
-        auto entry = createMessageEntry_(this, &startMessage);
-        TaskQueueMessage message(taskToStart, entry);
-        post(&message);
-        
-        waitForOurs_<TaskStartedMessage>(taskToStart, ticksToWait);
+        waitForControlResponse_<TaskStartedMessage>(taskToStart, &startMessage, ticksToWait);
     }
     else
     {
@@ -108,11 +216,7 @@ void DVTask::sleep(DVTask* taskToSleep, TickType_t ticksToWait)
             
         if (ticksToWait > 0)
         {
-            auto entry = createMessageEntry_(this, &sleepMessage);
-            TaskQueueMessage message(taskToSleep, entry);
-            post(&message);
-            
-            waitForOurs_<TaskAsleepMessage>(taskToSleep, ticksToWait);
+            waitForControlResponse_<TaskAsleepMessage>(taskToSleep, &sleepMessage, ticksToWait);
         }
         else
         {
@@ -121,85 +225,471 @@ void DVTask::sleep(DVTask* taskToSleep, TickType_t ticksToWait)
     }
 }
 
+void DVTask::registerHandler_(DVTaskMessage& message, EventHandlerFn fn, void* arg, FnPtrStorage* storage)
+{
+    uint32_t slot = message.getTypeSlot();
+
+    // Register task specific handler.
+    if (slot >= handlerListIndexBySlot_.size())
+    {
+        handlerListIndexBySlot_.resize(slot + 1, -1);
+    }
+
+    int listIndex = handlerListIndexBySlot_[slot];
+    if (listIndex < 0)
+    {
+        HandlerList list;
+        list.slot = slot;
+        handlerLists_.push_back(list);
+
+        listIndex = handlerLists_.size() - 1;
+        handlerListIndexBySlot_[slot] = listIndex;
+    }
+
+    HandlerRecord record = { .fn = fn, .arg = arg, .storage = storage };
+    handlerLists_[listIndex].handlers.push_back(record);
+
+    // Register for use by publish.
+    AddSubscriber_(slot, this);
+}
+
 void DVTask::unregisterMessageHandler(MessageHandlerHandle handler)
 {
     FnPtrStorage* handlerPtr = (FnPtrStorage*)handler;
+    if (handlerPtr == nullptr)
+    {
+        return;
+    }
     
-    // Unregister task specific handler.
-    auto iter = eventRegistrationMap_.begin();
-    EventIdentifierPair key;
-    for (; iter != eventRegistrationMap_.end(); iter++)
+    // Unregister task specific handler. Removal from the list itself is
+    // deferred if we're in the middle of dispatching a message so that
+    // the dispatch loop's indices stay valid.
+    HandlerList* foundList = nullptr;
+    for (auto& list : handlerLists_)
     {
-        if (iter->second.second == handlerPtr)
+        for (auto& record : list.handlers)
+        {
+            if (record.storage == handlerPtr)
+            {
+                record.fn = nullptr;
+                record.arg = nullptr;
+                record.storage = nullptr;
+                delete handlerPtr;
+                foundList = &list;
+                break;
+            }
+        }
+
+        if (foundList != nullptr)
         {
-            key = iter->first;
-            eventRegistrationMap_.erase(iter);
-            delete handlerPtr;
             break;
         }
     }
+
+    if (foundList == nullptr)
+    {
+        return;
+    }
+
+    int remainingHandlers = 0;
+    for (auto& record : foundList->handlers)
+    {
+        if (record.fn != nullptr)
+        {
+            remainingHandlers++;
+        }
+    }
+    uint32_t slot = foundList->slot;
+
+    if (dispatchDepth_ == 0)
+    {
+        compactHandlers_();
+    }
+    else
+    {
+        handlerCompactionPending_ = true;
+    }
     
     // Unregister for use by publish.
-    xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    if (eventRegistrationMap_.count(key) == 0)
+    if (remainingHandlers == 0)
+    {
+        RemoveSubscriber_(slot, this);
+    }
+}
+
+void DVTask::AddSubscriber_(uint32_t slot, DVTask* task)
+{
+    xSemaphoreTake(SubscriberUpdateSemaphore_, portMAX_DELAY);
+
+    SubscriberList* oldList = SubscriberListsBySlot_[slot].load(std::memory_order_acquire);
+    uint32_t numTasks = oldList != nullptr ? oldList->numTasks : 0;
+
+    // Tasks only need to receive a given message once regardless of
+    // how many handlers they have for it.
+    for (uint32_t index = 0; index < numTasks; index++)
+    {
+        if (oldList->tasks[index] == task)
+        {
+            xSemaphoreGive(SubscriberUpdateSemaphore_);
+            return;
+        }
+    }
+
+    assert(numTasks < MAX_SUBSCRIBERS_PER_MESSAGE);
+
+    SubscriberList* newList = (SubscriberList*)heap_caps_malloc(
+        sizeof(SubscriberList) + (numTasks + 1) * sizeof(DVTask*), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(newList != nullptr);
+
+    newList->numTasks = numTasks + 1;
+    for (uint32_t index = 0; index < numTasks; index++)
+    {
+        newList->tasks[index] = oldList->tasks[index];
+    }
+    newList->tasks[numTasks] = task;
+
+    ReplaceSubscriberList_(slot, newList);
+    xSemaphoreGive(SubscriberUpdateSemaphore_);
+}
+
+void DVTask::RemoveSubscriber_(uint32_t slot, DVTask* task)
+{
+    xSemaphoreTake(SubscriberUpdateSemaphore_, portMAX_DELAY);
+
+    SubscriberList* oldList = SubscriberListsBySlot_[slot].load(std::memory_order_acquire);
+    uint32_t numTasks = oldList != nullptr ? oldList->numTasks : 0;
+
+    bool found = false;
+    for (uint32_t index = 0; index < numTasks; index++)
+    {
+        if (oldList->tasks[index] == task)
+        {
+            found = true;
+            break;
+        }
+    }
+
+    if (found)
     {
-        auto iter = SubscriberTasksByMessageType_.equal_range(key);
-        for (auto i = iter.first; i != iter.second; i++)
+        SubscriberList* newList = nullptr;
+        if (numTasks > 1)
         {
-            if (i->second == this)
+            newList = (SubscriberList*)heap_caps_malloc(
+                sizeof(SubscriberList) + (numTasks - 1) * sizeof(DVTask*), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            assert(newList != nullptr);
+
+            newList->numTasks = 0;
+            for (uint32_t index = 0; index < numTasks; index++)
             {
-                SubscriberTasksByMessageType_.erase(i);
-                break;
+                if (oldList->tasks[index] != task)
+                {
+                    newList->tasks[newList->numTasks++] = oldList->tasks[index];
+                }
+            }
+        }
+
+        ReplaceSubscriberList_(slot, newList);
+    }
+
+    xSemaphoreGive(SubscriberUpdateSemaphore_);
+}
+
+void DVTask::ReplaceSubscriberList_(uint32_t slot, SubscriberList* newList)
+{
+    // seq_cst pairs with publish(): each side stores one variable and then
+    // loads the other, which acquire/release alone doesn't order. Either 
+    // the reader sees the new list or the wait below sees the reader.
+    SubscriberList* oldList = SubscriberListsBySlot_[slot].exchange(newList, std::memory_order_seq_cst);
+
+    // Forces publishIfChanged() to send the current state to new subscribers.
+    SubscriberGenerationsBySlot_[slot].fetch_add(1, std::memory_order_acq_rel);
+
+    // Wait for any in-progress publish() calls to finish with the old
+    // list before freeing it. Readers only hold it long enough to copy
+    // the task pointers, so this should be very short.
+    int numTries = 0;
+    while (ActivePublishReaders_.load(std::memory_order_seq_cst) > 0)
+    {
+        if (numTries++ < 100)
+        {
+            taskYIELD();
+        }
+        else
+        {
+            vTaskDelay(1);
+        }
+    }
+
+    if (oldList != nullptr)
+    {
+        heap_caps_free(oldList);
+    }
+}
+
+void DVTask::compactHandlers_()
+{
+    for (auto& list : handlerLists_)
+    {
+        auto iter = list.handlers.begin();
+        while (iter != list.handlers.end())
+        {
+            if (iter->fn == nullptr)
+            {
+                iter = list.handlers.erase(iter);
+            }
+            else
+            {
+                iter++;
             }
         }
     }
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
+
+    handlerCompactionPending_ = false;
 }
 
 void DVTask::startTask_()
 {
+    // The previous incarnation of the task (if any) deleted itself from
+    // within a handler, so reset dispatch state before starting again.
+    dispatchDepth_ = 0;
+    if (handlerCompactionPending_)
+    {
+        compactHandlers_();
+    }
+
+    // Make sure everyone gets our state again after waking up.
+    clearPublishedState_();
+
     // Create task event queue
     taskQueue_ = xQueueCreate(taskQueueSize_, sizeof(MessageEntry*));
     assert(taskQueue_ != nullptr);
 
+    // Create additional lanes if needed. Otherwise, everything goes
+    // through the main queue.
+    for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+    {
+        laneQueues_[lane] = taskQueue_;
+    }
+
+    consecutiveNormalMessages_ = 0;
+    directTimerWakePending_.store(false, std::memory_order_release);
+    directTimerWakeDeferred_.store(false, std::memory_order_release);
+    if (lanesEnabled_)
+    {
+        UBaseType_t totalQueueSize = taskQueueSize_;
+        for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+        {
+            // Lanes without their own size share the main queue.
+            if (lane != MESSAGE_LANE_NORMAL && laneQueueSizes_[lane] > 0)
+            {
+                laneQueues_[lane] = xQueueCreate(laneQueueSizes_[lane], sizeof(MessageEntry*));
+                assert(laneQueues_[lane] != nullptr);
+                totalQueueSize += laneQueueSizes_[lane];
+            }
+        }
+
+        laneSemaphore_ = xSemaphoreCreateCounting(totalQueueSize, 0);
+        assert(laneSemaphore_ != nullptr);
+    }
+
+    // The scheduling profile for the current mode takes precedence over
+    // what was passed to our constructor.
+    UBaseType_t priority = taskPriority_;
+    BaseType_t coreId = pinnedCoreId_;
+    if (DVTaskSchedulingProfile::Apply(taskName_, &priority, &coreId))
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Task %s: using priority %d, core %d from scheduling profile", taskName_, (int)priority, (int)coreId);
+    }
+
     auto returnValue = 
-        xTaskCreatePinnedToCore((TaskFunction_t)&ThreadEntry_, taskName_, taskStackSize_, this, taskPriority_, &taskObject_, pinnedCoreId_);
+        xTaskCreatePinnedToCore((TaskFunction_t)&ThreadEntry_, taskName_, taskStackSize_, this, priority, &taskObject_, coreId);
     assert(returnValue == pdPASS);
 }
 
+void DVTask::setMessageDrainBudget(uint32_t maxMessages, uint32_t maxTimeUs)
+{
+    assert(maxMessages > 0);
+
+    drainMaxMessages_ = maxMessages;
+    drainMaxTimeUs_ = maxTimeUs;
+}
+
+void DVTask::enableDeadlineTicks()
+{
+    assert(taskTick_ != portMAX_DELAY && taskTick_ > 0);
+    deadlineTicksEnabled_ = true;
+}
+
+void DVTask::enableMessageLanes(int32_t realtimeQueueSize, int32_t bulkQueueSize)
+{
+    assert(!isAwake());
+    assert(realtimeQueueSize >= 0 && bulkQueueSize >= 0);
+
+    laneQueueSizes_[MESSAGE_LANE_REALTIME] = realtimeQueueSize;
+    laneQueueSizes_[MESSAGE_LANE_BULK] = bulkQueueSize;
+    lanesEnabled_ = true;
+}
+
+DVTask::SlotOptions& DVTask::getMutableSlotOptions_(uint32_t slot)
+{
+    // Only expected to be called before the task starts, as other tasks
+    // read these options when posting to us.
+    assert(!isAwake());
+
+    if (slot >= slotOptions_.size())
+    {
+        SlotOptions defaultOptions = {
+            .lane = MESSAGE_LANE_NORMAL,
+            .overflowPolicy = OVERFLOW_BLOCK,
+            .coalesceIndex = -1,
+            .droppedFn = nullptr
+        };
+        slotOptions_.resize(slot + 1, defaultOptions);
+    }
+    return slotOptions_[slot];
+}
+
+DVTask::SlotOptions DVTask::getSlotOptions_(uint32_t slot) const
+{
+    if (slot >= slotOptions_.size())
+    {
+        SlotOptions defaultOptions = {
+            .lane = MESSAGE_LANE_NORMAL,
+            .overflowPolicy = OVERFLOW_BLOCK,
+            .coalesceIndex = -1,
+            .droppedFn = nullptr
+        };
+        return defaultOptions;
+    }
+    return slotOptions_[slot];
+}
+
+void DVTask::setLaneForSlot_(uint32_t slot, MessageLane lane)
+{
+    assert(lane < NUM_MESSAGE_LANES);
+    getMutableSlotOptions_(slot).lane = lane;
+}
+
+void DVTask::setOverflowPolicyForSlot_(uint32_t slot, OverflowPolicy policy, DroppedMessageFn droppedFn)
+{
+    assert(policy < NUM_OVERFLOW_POLICIES);
+
+    SlotOptions& options = getMutableSlotOptions_(slot);
+    options.overflowPolicy = policy;
+    options.droppedFn = droppedFn;
+
+    if (policy == OVERFLOW_COALESCE_LATEST && options.coalesceIndex < 0)
+    {
+        auto coalescedEntry = new std::atomic<MessageEntry*>(nullptr);
+        assert(coalescedEntry != nullptr);
+
+        coalescedEntries_.push_back(coalescedEntry);
+        options.coalesceIndex = coalescedEntries_.size() - 1;
+    }
+}
+
+void DVTask::getOverflowStatistics(OverflowStatistics& stats)
+{
+    stats.blocked = overflowBlocked_;
+    stats.blockTimeouts = overflowBlockTimeouts_;
+    stats.droppedNewest = overflowDroppedNewest_;
+    stats.droppedOldest = overflowDroppedOldest_;
+    stats.coalesced = overflowCoalesced_;
+}
+
+void DVTask::getTickStatistics(TickStatistics& stats)
+{
+    stats = tickStats_;
+}
+
+void DVTask::getQueueStatistics(QueueStatistics& stats)
+{
+    // Note: the queues only go away while the task is going to sleep,
+    // same as for postHelper_().
+    stats.depth = (taskQueue_ != nullptr && isAwake()) ? getQueueDepth_() : 0;
+    stats.capacity = laneQueueSizes_[MESSAGE_LANE_NORMAL];
+    if (lanesEnabled_)
+    {
+        stats.capacity += laneQueueSizes_[MESSAGE_LANE_REALTIME] + laneQueueSizes_[MESSAGE_LANE_BULK];
+    }
+    stats.highWaterMark = queueHighWaterMark_;
+    stats.numMessages = numMessagesHandled_.load(std::memory_order_relaxed);
+    stats.totalQueueWaitUs = totalQueueWaitUs_.load(std::memory_order_relaxed);
+    stats.totalHandlerUs = totalHandlerUs_.load(std::memory_order_relaxed);
+    stats.numWakeups = numWakeups_.load(std::memory_order_relaxed);
+}
+
+void DVTask::ForEachTask(TaskVisitorFn fn, void* arg)
+{
+    xSemaphoreTake(TaskListSemaphore_, portMAX_DELAY);
+    for (DVTask* task = FirstTask_; task != nullptr; task = task->nextTask_)
+    {
+        (*fn)(task, arg);
+    }
+    xSemaphoreGive(TaskListSemaphore_);
+}
+
 void DVTask::onTaskTick_()
 {
     // optional, default doesn't do anything
 }
 
-DVTask::MessageEntry* DVTask::createMessageEntry_(DVTask* origin, DVTaskMessage* message)
+DVTask::MessageEntry* DVTask::createMessageEntry_(DVTask* origin, DVTaskMessage* message, uint32_t refCount)
 {
     // Create object that's big enough to hold the passed-in message.
     uint32_t size = message->getSize() + sizeof(MessageEntry);
-    char* messageEntryBuf = new char[size];
-    assert(messageEntryBuf != nullptr);
+    MessageEntry* entry = (MessageEntry*)DVMessagePool::Allocate(size);
+    if (entry == nullptr)
+    {
+        // Out of message memory (or in an ISR with the pools empty).
+        return nullptr;
+    }
 
     // Copy the message over to the object.
-    MessageEntry* entry = (MessageEntry*)messageEntryBuf;
     memcpy(&entry->messageStart, message, message->getSize());
 
     // Fill in remaining data fields.
     entry->eventBase = message->getEventBase();
     entry->eventId = message->getEventType();
+    entry->slot = message->getTypeSlot();
     entry->size = size;
     entry->origin = origin;
 
+    // Anything we send while handling a request is considered a response to it.
+    entry->correlationId = (origin != nullptr) ? currentCorrelationId_ : 0;
+    entry->refCount.store(refCount, std::memory_order_relaxed);
+    entry->delivered.store(false, std::memory_order_relaxed);
+#if CONFIG_EZDV_MESSAGE_STATISTICS
+    entry->enqueueTimeUs = esp_timer_get_time();
+#else
+    entry->enqueueTimeUs = 0;
+#endif // CONFIG_EZDV_MESSAGE_STATISTICS
+
     return entry;
 }
 
-bool DVTask::canPostMessage()
+void DVTask::ReleaseMessageEntry_(MessageEntry* entry)
+{
+    // The last queue to finish with the entry returns it to the pool.
+    if (entry->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        DVMessagePool::Free(entry);
+    }
+}
+
+bool DVTask::canPostMessage(MessageLane lane)
 {
-    return uxQueueSpacesAvailable(taskQueue_) > 0;
+    return uxQueueSpacesAvailable(laneQueues_[lane]) > 0;
 }
 
 void DVTask::post(DVTaskMessage* message)
 {
     MessageEntry* entry = createMessageEntry_(nullptr, message);
+    if (entry == nullptr)
+    {
+        dropUnallocated_(message, true);
+        return;
+    }
     postHelper_(entry);
 }
 
@@ -208,9 +698,28 @@ void DVTask::postISR(DVTaskMessage* message)
     if (taskQueue_ && isAwake())
     {
         MessageEntry* entry = createMessageEntry_(nullptr, message);
+        if (entry == nullptr)
+        {
+            // Same as a full queue.
+            dropUnallocated_(message, true);
+            return;
+        }
         BaseType_t taskUnblocked = pdFALSE;
 
-        xQueueSendToBackFromISR(taskQueue_, &entry, &taskUnblocked);
+        // ISRs can't wait for space, so anything that doesn't fit is dropped.
+        QueueHandle_t queue = laneQueues_[getSlotOptions_(entry->slot).lane];
+        if (xQueueSendToBackFromISR(queue, &entry, &taskUnblocked) == pdTRUE)
+        {
+            if (laneSemaphore_ != nullptr)
+            {
+                xSemaphoreGiveFromISR(laneSemaphore_, &taskUnblocked);
+            }
+        }
+        else
+        {
+            overflowDroppedNewest_++;
+            dropEntry_(entry);
+        }
 
         if (taskUnblocked != pdFALSE)
         {
@@ -224,60 +733,113 @@ void DVTask::postTimer(DVTaskMessage* message)
     if (taskQueue_ && isAwake())
     {
         MessageEntry* entry = createMessageEntry_(nullptr, message);
-        auto rv = xQueueSendToFront(taskQueue_, &entry, pdMS_TO_TICKS(100));
-        if (rv == errQUEUE_FULL)
+        if (entry == nullptr)
         {
-            ESP_LOGE(CURRENT_LOG_TAG, "Task %s has a full queue! (maximum: %ld)", taskName_, taskQueueSize_);
-            vTaskDelay(pdMS_TO_TICKS(100));
+            dropUnallocated_(message, true);
+            return;
         }
-        assert(rv != errQUEUE_FULL);
+        postHelper_(entry, true);
     }
 }
 
 void DVTask::sendTo(DVTask* destination, DVTaskMessage* message)
 {
     MessageEntry* entry = createMessageEntry_(this, message);
+    if (entry == nullptr)
+    {
+        destination->dropUnallocated_(message, true);
+        return;
+    }
     destination->postHelper_(entry);
 }
 
 void DVTask::publish(DVTaskMessage* message)
 {    
-    auto messagePair = std::make_pair(message->getEventBase(), message->getEventType());
-
-    std::vector<DVTask*> tasksToPostTo;
+    DVTask* tasksToPostTo[MAX_SUBSCRIBERS_PER_MESSAGE];
+    uint32_t numTasks = 0;
 
     // Get the list of tasks to post to first so we don't deadlock.
-    auto rv = xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    if (rv != pdTRUE)
+    // Subscriber lists are only freed once no publishers are active,
+    // so holding the reader count is enough to safely copy it (see
+    // ReplaceSubscriberList_() for why this needs seq_cst).
+    ActivePublishReaders_.fetch_add(1, std::memory_order_seq_cst);
+    SubscriberList* list = SubscriberListsBySlot_[message->getTypeSlot()].load(std::memory_order_seq_cst);
+    if (list != nullptr)
+    {
+        numTasks = list->numTasks;
+        memcpy(tasksToPostTo, list->tasks, numTasks * sizeof(DVTask*));
+    }
+    ActivePublishReaders_.fetch_sub(1, std::memory_order_seq_cst);
+
+    if (numTasks == 0)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "Could not get task list in time for %s to publish", taskName_);
-        vTaskDelay(pdMS_TO_TICKS(100)); // flush debug output before crashing
-        assert(rv == pdTRUE);
+        return;
     }
 
-    for (auto& taskPair : SubscriberTasksByMessageType_)
+    // Now that we have the list of tasks, we can take our time
+    // posting the messages. All subscribers share a single copy
+    // of the message, which is freed once the last one is done with it.
+    MessageEntry* entry = createMessageEntry_(this, message, numTasks);
+    if (entry == nullptr)
     {
-        if (messagePair == taskPair.first)
+        // Each subscriber counts the drop, but the message is only
+        // cleaned up once (by the first subscriber that knows how).
+        bool cleanedUp = false;
+        for (uint32_t index = 0; index < numTasks; index++)
         {
-            tasksToPostTo.push_back(taskPair.second);
+            cleanedUp |= tasksToPostTo[index]->dropUnallocated_(message, !cleanedUp);
         }
+        return;
     }
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
 
-    // Now that we have the list of tasks, we can take our time
-    // posting the messages.
-    for (auto& task : tasksToPostTo)
+    for (uint32_t index = 0; index < numTasks; index++)
+    {
+        tasksToPostTo[index]->postHelper_(entry);
+    }
+}
+
+DVTask::PublishedState* DVTask::getPublishedState_(DVTaskMessage& message)
+{
+    uint32_t slot = message.getTypeSlot();
+    if (slot >= lastPublishedBySlot_.size())
+    {
+        lastPublishedBySlot_.resize(slot + 1, nullptr);
+    }
+
+    PublishedState* state = lastPublishedBySlot_[slot];
+    if (state == nullptr)
     {
-        MessageEntry* entry = createMessageEntry_(this, message);
-        task->postHelper_(entry);
+        state = (PublishedState*)heap_caps_calloc(1, sizeof(PublishedState) + message.getSize(), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        assert(state != nullptr);
+
+        // Guarantees that the first message is published regardless of contents.
+        state->subscriberGeneration = SubscriberGenerationsBySlot_[slot].load(std::memory_order_acquire) - 1;
+        memcpy(&state->messageStart, (void*)&message, message.getSize());
+        lastPublishedBySlot_[slot] = state;
     }
 
+    return state;
+}
+
+void DVTask::clearPublishedState_()
+{
+    for (auto& state : lastPublishedBySlot_)
+    {
+        if (state != nullptr)
+        {
+            heap_caps_free(state);
+            state = nullptr;
+        }
+    }
 }
 
 void DVTask::onTaskStart_(DVTask* origin, TaskStartMessage* message)
 {
     vTaskDelay(pdMS_TO_TICKS(10));
-    onTaskStart_();
+    {
+        util::BootTimeline::Step step(taskName_);
+        onTaskStart_();
+    }
 
     ESP_LOGI(CURRENT_LOG_TAG, "Task %s started", taskName_);
 
@@ -294,17 +856,35 @@ void DVTask::onTaskSleep_(DVTask* origin, TaskSleepMessage* message)
 
     // Process all remaining messages in message queue in case
     // there are actions that need to be performed during shutdown.
-    MessageEntry* entry = nullptr;
-    while (taskQueue_ != nullptr && xQueuePeek(taskQueue_, &entry, 0) == pdTRUE)
+    while (taskQueue_ != nullptr && hasPendingMessages_())
     {
         singleMessagingLoop_(0);
     }
 
     taskObject_ = nullptr;
+    releaseCoalescedEntries_();
+
+    if (lanesEnabled_)
+    {
+        for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+        {
+            if (laneQueues_[lane] != taskQueue_)
+            {
+                vQueueDelete(laneQueues_[lane]);
+            }
+        }
+        vSemaphoreDelete(laneSemaphore_);
+        laneSemaphore_ = nullptr;
+    }
 
     vQueueDelete(taskQueue_);
     taskQueue_ = nullptr;
 
+    for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+    {
+        laneQueues_[lane] = nullptr;
+    }
+
     TaskAsleepMessage result;
     publish(&result);
 
@@ -312,58 +892,706 @@ void DVTask::onTaskSleep_(DVTask* origin, TaskSleepMessage* message)
     vTaskDelete(nullptr);
 }
 
-void DVTask::postHelper_(MessageEntry* entry)
+void DVTask::postHelper_(MessageEntry* entry, bool isTimer)
 {
     if (taskQueue_ && isAwake())
     {
-        auto rv = xQueueSendToBack(taskQueue_, &entry, pdMS_TO_TICKS(100));
-        if (rv == errQUEUE_FULL)
+        EZDV_TRACE(MESSAGE_ENQUEUE, entry->eventId, entry->eventBase, taskName_);
+        SlotOptions options = getSlotOptions_(entry->slot);
+
+        // Timers get priority over everything else, either by going into
+        // the real-time lane or (if we only have one) the front of the queue.
+        MessageLane lane = isTimer ? MESSAGE_LANE_REALTIME : (MessageLane)options.lane;
+        QueueHandle_t queue = laneQueues_[lane];
+        bool toFront = isTimer && queue == taskQueue_;
+
+        if (!enqueueWithPolicy_(entry, queue, toFront, options))
         {
-            ESP_LOGE(CURRENT_LOG_TAG, "Task %s has a full queue! (maximum: %ld)", taskName_, taskQueueSize_);
-            vTaskDelay(pdMS_TO_TICKS(100));
+            dropEntry_(entry);
         }
-        assert(rv != errQUEUE_FULL);
     }
     else
     {
-        // Task isn't awake, no use keeping the entry around
-        char* entryPtr = (char*)entry;
-        delete[] entryPtr;
+        // Task isn't awake, no use keeping the entry around (but anything
+        // it points to still needs cleaning up).
+        dropEntry_(entry);
     }
 }
 
-void DVTask::singleMessagingLoop_(int64_t ticksRemaining)
+bool DVTask::sendToQueue_(QueueHandle_t queue, MessageEntry* entry, bool toFront, TickType_t ticksToWait)
 {
-    MessageEntry* entry = nullptr;
+    BaseType_t rv = toFront ? 
+        xQueueSendToFront(queue, &entry, ticksToWait) : 
+        xQueueSendToBack(queue, &entry, ticksToWait);
+    return rv == pdTRUE;
+}
+
+bool DVTask::enqueueWithPolicy_(MessageEntry* entry, QueueHandle_t queue, bool toFront, const SlotOptions& options)
+{
+    bool queued = sendToQueue_(queue, entry, toFront, 0);
 
-    if (xQueueReceive(taskQueue_, &entry, ticksRemaining) == pdTRUE)
+    if (!queued)
     {
-        //ESP_LOGI(taskName_.c_str(), "Received message %s:%ld", entry->eventBase, entry->eventId);
-        auto iterPair = eventRegistrationMap_.equal_range(std::make_pair(entry->eventBase, entry->eventId));
-        EventMap::iterator iter = iterPair.first;
-        while (iter != iterPair.second)
+        switch (options.overflowPolicy)
         {
-            (*iter->second.first)(iter->second.second, entry->eventBase, entry->eventId, &entry);
-            iter++;
-        }
+            case OVERFLOW_DROP_NEWEST:
+                overflowDroppedNewest_++;
+                return false;
+            case OVERFLOW_DROP_OLDEST:
+                if (dropOldestAndEnqueue_(entry, queue, toFront))
+                {
+                    overflowDroppedOldest_++;
+                    return true;
+                }
 
-        // Deallocate message now that we're done with it.
-        char* entryPtr = (char*)entry;
-        delete[] entryPtr;
-    }
+                // Lost the race with another sender, just drop ours instead.
+                overflowDroppedNewest_++;
+                return false;
+            case OVERFLOW_COALESCE_LATEST:
+            {
+                // Keep only the latest message of this type until the task
+                // has room for it (see requeueCoalescedEntries_()).
+                MessageEntry* previousEntry = coalescedEntries_[options.coalesceIndex]->exchange(entry, std::memory_order_acq_rel);
+                if (previousEntry != nullptr)
+                {
+                    overflowCoalesced_++;
+                    dropEntry_(previousEntry);
+                }
+                coalescedEntriesPending_.store(true, std::memory_order_release);
+                return true;
+            }
+            case OVERFLOW_BLOCK:
+            default:
+                overflowBlocked_++;
+                queued = sendToQueue_(queue, entry, toFront, pdMS_TO_TICKS(100));
+                if (!queued)
+                {
+                    ESP_LOGE(CURRENT_LOG_TAG, "Task %s has a full queue, dropping message %s:%" PRId32, taskName_, entry->eventBase, entry->eventId);
+                    overflowBlockTimeouts_++;
+                    return false;
+                }
+                break;
+        }
+    }
+
+    if (laneSemaphore_ != nullptr)
+    {
+        xSemaphoreGive(laneSemaphore_);
+    }
+    return true;
+}
+
+bool DVTask::dropOldestAndEnqueue_(MessageEntry* entry, QueueHandle_t queue, bool toFront)
+{
+    // Take one count from the lane semaphore before removing anything so 
+    // that it never claims there are more messages than actually queued.
+    if (laneSemaphore_ != nullptr && xSemaphoreTake(laneSemaphore_, 0) != pdTRUE)
+    {
+        return false;
+    }
+
+    int numRemoved = 0;
+    MessageEntry* oldestEntry = nullptr;
+    if (xQueueReceive(queue, &oldestEntry, 0) == pdTRUE)
+    {
+        dropEntry_(oldestEntry);
+        numRemoved = 1;
+    }
+
+    int numAdded = sendToQueue_(queue, entry, toFront, 0) ? 1 : 0;
+
+    // Give back the count we took, adjusted for what we did to the queue.
+    // (If the task got to the oldest message before we did, it already
+    // took its own count for it.)
+    if (laneSemaphore_ != nullptr)
+    {
+        for (int count = 0; count < 1 + numAdded - numRemoved; count++)
+        {
+            xSemaphoreGive(laneSemaphore_);
+        }
+    }
+
+    return numAdded > 0;
+}
+
+void DVTask::dropEntry_(MessageEntry* entry)
+{
+    if (entry == nullptr)
+    {
+        // Direct wakeup. Leave it pending so that the timers and tick that
+        // asked for it still run after the next message (see
+        // handleReceivedMessage_()).
+        directTimerWakesDropped_++;
+        directTimerWakeDeferred_.store(true, std::memory_order_release);
+        return;
+    }
+
+    // Whoever releases the last reference decides. If that's us and no 
+    // other task handled the message, let the owner clean up anything it 
+    // points to. (Checking refCount before releasing it instead would let 
+    // several subscribers dropping at once all see it above 1.)
+    if (entry->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        SlotOptions options = getSlotOptions_(entry->slot);
+        if (options.droppedFn != nullptr && !entry->delivered.load(std::memory_order_relaxed))
+        {
+            (*options.droppedFn)((DVTaskMessage*)&entry->messageStart);
+        }
+        DVMessagePool::Free(entry);
+    }
+}
+
+bool DVTask::dropUnallocated_(DVTaskMessage* message, bool cleanUp)
+{
+    overflowDroppedNewest_++;
+
+    SlotOptions options = getSlotOptions_(message->getTypeSlot());
+    if (cleanUp && options.droppedFn != nullptr)
+    {
+        (*options.droppedFn)(message);
+        return true;
+    }
+
+    return false;
+}
+
+void DVTask::requeueCoalescedEntries_()
+{
+    if (taskQueue_ == nullptr || !coalescedEntriesPending_.exchange(false, std::memory_order_acq_rel))
+    {
+        return;
+    }
+
+    for (auto& coalescedEntry : coalescedEntries_)
+    {
+        MessageEntry* entry = coalescedEntry->exchange(nullptr, std::memory_order_acq_rel);
+        if (entry == nullptr)
+        {
+            continue;
+        }
+
+        SlotOptions options = getSlotOptions_(entry->slot);
+        if (sendToQueue_(laneQueues_[options.lane], entry, false, 0))
+        {
+            if (laneSemaphore_ != nullptr)
+            {
+                xSemaphoreGive(laneSemaphore_);
+            }
+        }
+        else
+        {
+            // Still no room. Put it back unless a newer one showed up in
+            // the meantime.
+            MessageEntry* expected = nullptr;
+            if (!coalescedEntry->compare_exchange_strong(expected, entry, std::memory_order_acq_rel))
+            {
+                overflowCoalesced_++;
+                dropEntry_(entry);
+            }
+            coalescedEntriesPending_.store(true, std::memory_order_release);
+        }
+    }
+}
+
+void DVTask::releaseCoalescedEntries_()
+{
+    coalescedEntriesPending_.store(false, std::memory_order_release);
+
+    for (auto& coalescedEntry : coalescedEntries_)
+    {
+        MessageEntry* entry = coalescedEntry->exchange(nullptr, std::memory_order_acq_rel);
+        if (entry != nullptr)
+        {
+            dropEntry_(entry);
+        }
+    }
+}
+
+void DVTask::singleMessagingLoop_(int64_t ticksRemaining, bool allowDrain)
+{
+    MessageEntry* entry = nullptr;
+
+    bool received = receiveMessage_(&entry, ticksRemaining);
+
+    // Anything that had to block woke the task back up (for a message or
+    // a timeout), which is what matters for power consumption.
+    if (ticksRemaining > 0)
+    {
+        numWakeups_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (received)
+    {
+        //ESP_LOGI(taskName_.c_str(), "Received message %s:%ld", entry->eventBase, entry->eventId);
+        handleReceivedMessage_(entry);
+
+        // If configured, keep going with whatever else is already queued
+        // (without blocking) until we hit the message or time budget. This
+        // only happens from the main loop as waitFor() needs to check for
+        // its result after every message.
+        if (allowDrain && drainMaxMessages_ > 1)
+        {
+            int64_t drainStartTime = esp_timer_get_time();
+            uint32_t numDispatched = 1;
+
+            while (numDispatched < drainMaxMessages_ &&
+                   taskQueue_ != nullptr &&
+                   (drainMaxTimeUs_ == 0 || (esp_timer_get_time() - drainStartTime) < drainMaxTimeUs_) &&
+                   receiveMessage_(&entry, 0))
+            {
+                handleReceivedMessage_(entry);
+                numDispatched++;
+            }
+        }
+    }
+}
+
+void DVTask::waitForTickDeadline_()
+{
+    // Tick counts can wrap, so compare using differences.
+    TickType_t currentTicks = xTaskGetTickCount();
+    while ((int32_t)(nextTickDeadline_ - currentTicks) > 0)
+    {
+        singleMessagingLoop_(nextTickDeadline_ - currentTicks, true);
+        currentTicks = xTaskGetTickCount();
+    }
+
+    TickType_t overrunTicks = currentTicks - nextTickDeadline_;
+    tickStats_.ticksRun++;
+    if (overrunTicks > 0)
+    {
+        uint32_t overrunMs = pdTICKS_TO_MS(overrunTicks);
+        tickStats_.missedDeadlines++;
+        tickStats_.totalOverrunMs += overrunMs;
+        if (overrunMs > tickStats_.maxOverrunMs)
+        {
+            tickStats_.maxOverrunMs = overrunMs;
+        }
+    }
+
+    // If we're more than a period behind, skip ahead instead of running
+    // onTaskTick_() several times back to back to catch up.
+    TickType_t periodsBehind = overrunTicks / taskTick_;
+    tickStats_.skippedPeriods += periodsBehind;
+    nextTickDeadline_ += (periodsBehind + 1) * taskTick_;
+}
+
+bool DVTask::receiveMessage_(MessageEntry** entry, TickType_t ticksToWait)
+{
+    if (!lanesEnabled_)
+    {
+        return xQueueReceive(taskQueue_, entry, ticksToWait) == pdTRUE;
+    }
+
+    // The semaphore is given after every successful enqueue, so once we
+    // take it there's guaranteed to be a message in one of the lanes.
+    if (xSemaphoreTake(laneSemaphore_, ticksToWait) != pdTRUE)
+    {
+        return false;
+    }
+
+    // Real-time messages always go first. Bulk messages are otherwise 
+    // only serviced when there aren't any normal ones, except that we let
+    // one through every so often so they don't wait forever.
+    if (xQueueReceive(laneQueues_[MESSAGE_LANE_REALTIME], entry, 0) == pdTRUE)
+    {
+        return true;
+    }
+
+    bool preferBulk = consecutiveNormalMessages_ >= MAX_CONSECUTIVE_NORMAL_LANE_MESSAGES;
+    MessageLane firstLane = preferBulk ? MESSAGE_LANE_BULK : MESSAGE_LANE_NORMAL;
+    MessageLane secondLane = preferBulk ? MESSAGE_LANE_NORMAL : MESSAGE_LANE_BULK;
+
+    MessageLane lanesToCheck[] = { firstLane, secondLane };
+    for (auto lane : lanesToCheck)
+    {
+        if (xQueueReceive(laneQueues_[lane], entry, 0) == pdTRUE)
+        {
+            consecutiveNormalMessages_ = (lane == MESSAGE_LANE_NORMAL) ? consecutiveNormalMessages_ + 1 : 0;
+            return true;
+        }
+    }
+
+    // Shouldn't happen, but don't lose track of the count if it does.
+    ESP_LOGW(CURRENT_LOG_TAG, "Task %s: lane semaphore taken with no queued messages", taskName_);
+    return false;
+}
+
+bool DVTask::hasPendingMessages_()
+{
+    for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+    {
+        if (laneQueues_[lane] != nullptr && uxQueueMessagesWaiting(laneQueues_[lane]) > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DVTask::handleReceivedMessage_(MessageEntry* entry)
+{
+    if (entry == nullptr)
+    {
+        // Wakeup from queueDirectWakeup_(), nothing to dispatch.
+        runDirectWakeup_();
+        return;
+    }
+
+    EZDV_TRACE(MESSAGE_DISPATCH_BEGIN, entry->eventId, entry->eventBase, 0);
+
+    // Published entries may still be dropped by other subscribers; this
+    // keeps them from running droppedFn (see dropEntry_()). Our release
+    // below makes it visible to whoever releases last.
+    entry->delivered.store(true, std::memory_order_relaxed);
+
+#if CONFIG_EZDV_MESSAGE_STATISTICS
+    // Includes the message we just received.
+    uint32_t queueDepth = getQueueDepth_() + 1;
+    if (queueDepth > queueHighWaterMark_)
+    {
+        queueHighWaterMark_ = queueDepth;
+    }
+
+    int64_t dispatchStartUs = esp_timer_get_time();
+    dispatchMessage_(entry);
+    recordMessageStatistics_(entry, dispatchStartUs, esp_timer_get_time());
+#else
+    dispatchMessage_(entry);
+#endif // CONFIG_EZDV_MESSAGE_STATISTICS
+
+    EZDV_TRACE(MESSAGE_DISPATCH_END, entry->eventId, entry->eventBase, 0);
+
+    // Drop our reference now that we're done with it.
+    ReleaseMessageEntry_(entry);
+
+    // We now have room for anything that was held back due to overflow.
+    requeueCoalescedEntries_();
+
+    // A direct wakeup that didn't fit in the queue runs here instead.
+    if (directTimerWakeDeferred_.exchange(false, std::memory_order_acq_rel))
+    {
+        runDirectWakeup_();
+    }
+}
+
+static int GetLatencyBucket_(uint32_t timeUs, int numBuckets)
+{
+    if (timeUs < 64)
+    {
+        return 0;
+    }
+
+    // 64-127us -> 1, 128-255us -> 2, etc.
+    int bucket = 32 - __builtin_clz(timeUs) - 6;
+    return bucket < numBuckets ? bucket : numBuckets - 1;
+}
+
+void DVTask::recordMessageStatistics_(MessageEntry* entry, int64_t dispatchStartUs, int64_t dispatchEndUs)
+{
+    uint32_t slot = entry->slot;
+    if (slot >= messageStatsBySlot_.size())
+    {
+        messageStatsBySlot_.resize(slot + 1, nullptr);
+    }
+
+    MessageStatistics* stats = messageStatsBySlot_[slot];
+    if (stats == nullptr)
+    {
+        stats = (MessageStatistics*)heap_caps_calloc(1, sizeof(MessageStatistics), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+        assert(stats != nullptr);
+        messageStatsBySlot_[slot] = stats;
+    }
+
+    // Note: handler time includes anything handled by nested waitFor() calls.
+    uint32_t queueWaitUs = dispatchStartUs > entry->enqueueTimeUs ? dispatchStartUs - entry->enqueueTimeUs : 0;
+    uint32_t handlerUs = dispatchEndUs - dispatchStartUs;
+
+    stats->count++;
+    stats->totalQueueWaitUs += queueWaitUs;
+    stats->totalHandlerUs += handlerUs;
+    if (queueWaitUs > stats->maxQueueWaitUs)
+    {
+        stats->maxQueueWaitUs = queueWaitUs;
+    }
+    if (handlerUs > stats->maxHandlerUs)
+    {
+        stats->maxHandlerUs = handlerUs;
+    }
+    stats->queueWaitHistogram[GetLatencyBucket_(queueWaitUs, NUM_LATENCY_BUCKETS)]++;
+    stats->handlerHistogram[GetLatencyBucket_(handlerUs, NUM_LATENCY_BUCKETS)]++;
+
+    numMessagesHandled_.fetch_add(1, std::memory_order_relaxed);
+    totalQueueWaitUs_.fetch_add(queueWaitUs, std::memory_order_relaxed);
+    totalHandlerUs_.fetch_add(handlerUs, std::memory_order_relaxed);
+}
+
+void DVTask::addDirectTimer_(DVTimer* timer)
+{
+    directTimers_.push_back(timer);
+}
+
+void DVTask::removeDirectTimer_(DVTimer* timer)
+{
+    for (auto iter = directTimers_.begin(); iter != directTimers_.end(); iter++)
+    {
+        if (*iter == timer)
+        {
+            directTimers_.erase(iter);
+            break;
+        }
+    }
+}
+
+DVTimerWheel* DVTask::getTimerWheel_()
+{
+    if (timerWheel_ == nullptr)
+    {
+        timerWheel_ = new DVTimerWheel(this);
+        assert(timerWheel_ != nullptr);
+    }
+
+    return timerWheel_;
+}
+
+void DVTask::queueDirectWakeup_()
+{
+    if (!taskQueue_ || !isAwake())
+    {
+        return;
+    }
+
+    // No need to queue another wakeup if one is already pending, as
+    // runDirectWakeup_() handles everything that requested one.
+    if (directTimerWakePending_.exchange(true, std::memory_order_acq_rel))
+    {
+        return;
+    }
+
+    // Marked deferred before trying so that if the queue is full, whichever
+    // of the messages filling it is handled last still sees it.
+    directTimerWakeDeferred_.store(true, std::memory_order_release);
+
+    QueueHandle_t queue = laneQueues_[MESSAGE_LANE_REALTIME];
+    if (sendToQueue_(queue, nullptr, queue == taskQueue_, 0))
+    {
+        directTimerWakeDeferred_.store(false, std::memory_order_release);
+        if (laneSemaphore_ != nullptr)
+        {
+            xSemaphoreGive(laneSemaphore_);
+        }
+    }
+    else
+    {
+        // The task is going to handle at least one more message, which
+        // runs the wakeup for us (see handleReceivedMessage_()). Leave
+        // it pending until then so we don't keep retrying in the meantime.
+        directTimerWakesDropped_++;
+    }
+}
+
+void DVTask::requestTick()
+{
+    tickRequested_.store(true, std::memory_order_release);
+    queueDirectWakeup_();
+}
+
+void DVTask::runDirectWakeup_()
+{
+    // Clear before running so that timers firing from here on queue
+    // another wakeup.
+    directTimerWakePending_.store(false, std::memory_order_release);
+
+    // Timer handlers may stop or delete timers, so index each time.
+    for (size_t index = 0; index < directTimers_.size(); index++)
+    {
+        directTimers_[index]->runIfPending_();
+    }
+
+    if (tickRequested_.exchange(false, std::memory_order_acq_rel))
+    {
+        onTaskTick_();
+    }
+}
+
+uint32_t DVTask::getQueueDepth_()
+{
+    uint32_t depth = uxQueueMessagesWaiting(taskQueue_);
+    for (int lane = 0; lane < NUM_MESSAGE_LANES; lane++)
+    {
+        if (laneQueues_[lane] != taskQueue_)
+        {
+            depth += uxQueueMessagesWaiting(laneQueues_[lane]);
+        }
+    }
+    return depth;
+}
+
+void DVTask::onDumpTaskStatisticsMessage_(DVTask* origin, DumpTaskStatisticsMessage* message)
+{
+    if (deadlineTicksEnabled_)
+    {
+        ESP_LOGI(
+            taskName_, 
+            "Ticks run: %" PRIu32 ", missed deadlines: %" PRIu32 ", skipped periods: %" PRIu32 ", overrun avg/max %" PRIu32 "/%" PRIu32 " ms",
+            tickStats_.ticksRun,
+            tickStats_.missedDeadlines,
+            tickStats_.skippedPeriods,
+            tickStats_.missedDeadlines > 0 ? (uint32_t)(tickStats_.totalOverrunMs / tickStats_.missedDeadlines) : 0,
+            tickStats_.maxOverrunMs);
+
+        if (message->reset)
+        {
+            memset(&tickStats_, 0, sizeof(tickStats_));
+        }
+    }
+
+    for (auto& timer : directTimers_)
+    {
+        DVTimer::Statistics timerStats = timer->getStatistics();
+        ESP_LOGI(
+            taskName_,
+            "Timer %s: fires %" PRIu32 ", jitter avg/max %" PRIu32 "/%" PRIu32 " us, dispatch latency avg/max %" PRIu32 "/%" PRIu32 " us",
+            timer->getName(),
+            timerStats.numFires,
+            timerStats.numFires > 0 ? (uint32_t)(timerStats.totalJitterUs / timerStats.numFires) : 0,
+            timerStats.maxJitterUs,
+            timerStats.numFires > 0 ? (uint32_t)(timerStats.totalDispatchLatencyUs / timerStats.numFires) : 0,
+            timerStats.maxDispatchLatencyUs);
+
+        if (message->reset)
+        {
+            timer->resetStatistics();
+        }
+    }
+
+    if (directTimerWakesDropped_ > 0)
+    {
+        ESP_LOGW(taskName_, "Deferred %" PRIu32 " direct wakeups due to a full queue", directTimerWakesDropped_.load());
+    }
+
+#if CONFIG_EZDV_MESSAGE_STATISTICS
+    OverflowStatistics overflowStats;
+    getOverflowStatistics(overflowStats);
+
+    ESP_LOGI(
+        taskName_, 
+        "Queue high water mark: %" PRIu32 "/%" PRId32 ", overflows: blocked %" PRIu32 ", timed out %" PRIu32 ", dropped newest %" PRIu32 ", dropped oldest %" PRIu32 ", coalesced %" PRIu32,
+        queueHighWaterMark_,
+        laneQueueSizes_[MESSAGE_LANE_REALTIME] + laneQueueSizes_[MESSAGE_LANE_NORMAL] + laneQueueSizes_[MESSAGE_LANE_BULK],
+        overflowStats.blocked,
+        overflowStats.blockTimeouts,
+        overflowStats.droppedNewest,
+        overflowStats.droppedOldest,
+        overflowStats.coalesced);
+
+    for (uint32_t slot = 0; slot < messageStatsBySlot_.size(); slot++)
+    {
+        MessageStatistics* stats = messageStatsBySlot_[slot];
+        if (stats == nullptr || stats->count == 0)
+        {
+            continue;
+        }
+
+        DVEventBaseType eventBase = nullptr;
+        int32_t eventId = 0;
+        DVTaskMessageSlotRegistry::GetSlotEvent(slot, &eventBase, &eventId);
+
+        ESP_LOGI(
+            taskName_, 
+            "%s:%" PRId32 ": count %" PRIu32 ", queue wait avg/max %" PRIu32 "/%" PRIu32 " us, handler avg/max %" PRIu32 "/%" PRIu32 " us",
+            eventBase,
+            eventId,
+            stats->count,
+            (uint32_t)(stats->totalQueueWaitUs / stats->count),
+            stats->maxQueueWaitUs,
+            (uint32_t)(stats->totalHandlerUs / stats->count),
+            stats->maxHandlerUs);
+
+        // One column per bucket (<64us, <128us, ... <65ms, everything else).
+        char waitHistogram[NUM_LATENCY_BUCKETS * 11 + 1];
+        char handlerHistogram[NUM_LATENCY_BUCKETS * 11 + 1];
+        int waitOffset = 0;
+        int handlerOffset = 0;
+        for (int bucket = 0; bucket < NUM_LATENCY_BUCKETS; bucket++)
+        {
+            waitOffset += snprintf(&waitHistogram[waitOffset], sizeof(waitHistogram) - waitOffset, " %" PRIu32, stats->queueWaitHistogram[bucket]);
+            handlerOffset += snprintf(&handlerHistogram[handlerOffset], sizeof(handlerHistogram) - handlerOffset, " %" PRIu32, stats->handlerHistogram[bucket]);
+        }
+        ESP_LOGI(taskName_, "    queue wait histogram:%s", waitHistogram);
+        ESP_LOGI(taskName_, "    handler histogram:%s", handlerHistogram);
+
+        if (message->reset)
+        {
+            memset(stats, 0, sizeof(MessageStatistics));
+        }
+    }
+
+    if (message->reset)
+    {
+        queueHighWaterMark_ = 0;
+    }
+#else
+    ESP_LOGW(taskName_, "Message statistics are disabled (CONFIG_EZDV_MESSAGE_STATISTICS)");
+#endif // CONFIG_EZDV_MESSAGE_STATISTICS
+}
+
+void DVTask::dispatchMessage_(MessageEntry* entry)
+{
+    if (entry->slot >= handlerListIndexBySlot_.size())
+    {
+        return;
+    }
+
+    int listIndex = handlerListIndexBySlot_[entry->slot];
+    if (listIndex < 0)
+    {
+        return;
+    }
+
+    // Handlers may register or unregister other handlers (e.g. waitFor()),
+    // so index into the list each time instead of holding iterators.
+    uint32_t previousCorrelationId = currentCorrelationId_;
+    currentCorrelationId_ = entry->correlationId;
+    dispatchDepth_++;
+    for (size_t index = 0; index < handlerLists_[listIndex].handlers.size(); index++)
+    {
+        HandlerRecord record = handlerLists_[listIndex].handlers[index];
+        if (record.fn != nullptr)
+        {
+            (*record.fn)(record.arg, entry->eventBase, entry->eventId, &entry);
+        }
+    }
+    dispatchDepth_--;
+    currentCorrelationId_ = previousCorrelationId;
+
+    if (dispatchDepth_ == 0 && handlerCompactionPending_)
+    {
+        compactHandlers_();
+    }
 }
 
 void DVTask::threadEntry_()
 {    
     UBaseType_t stackWaterMark = INT_MAX;
+#if CONFIG_EZDV_MESSAGE_STATISTICS
+    uint32_t queueWaterMark = 0;
+#endif // CONFIG_EZDV_MESSAGE_STATISTICS
     
+    nextTickDeadline_ = xTaskGetTickCount() + taskTick_;
+
     // Run in an infinite loop, continually waiting for messages
     // and processing them.
     for (;;)
     {
         if (taskTick_ == portMAX_DELAY)
         {
-            singleMessagingLoop_(portMAX_DELAY);
+            singleMessagingLoop_(portMAX_DELAY, true);
+        }
+        else if (deadlineTicksEnabled_)
+        {
+            waitForTickDeadline_();
+            onTaskTick_();
         }
         else
         {
@@ -371,25 +1599,122 @@ void DVTask::threadEntry_()
             while (ticksRemaining > 0)
             {
                 auto tasksBegin = xTaskGetTickCount();
-                singleMessagingLoop_(ticksRemaining);
+                singleMessagingLoop_(ticksRemaining, true);
                 ticksRemaining -= xTaskGetTickCount() - tasksBegin;
             }
 
             onTaskTick_();
         }
         
+        bool newWaterMark = false;
         UBaseType_t newStackWaterMark = uxTaskGetStackHighWaterMark(nullptr);
         if (newStackWaterMark < stackWaterMark)
         {
             stackWaterMark = newStackWaterMark;
+            newWaterMark = true;
             ESP_LOGI(taskName_, "New stack high water mark of %d", newStackWaterMark);
         }
+
+#if CONFIG_EZDV_MESSAGE_STATISTICS
+        if (queueHighWaterMark_ > queueWaterMark)
+        {
+            queueWaterMark = queueHighWaterMark_;
+            newWaterMark = true;
+            ESP_LOGI(taskName_, "New queue high water mark of %" PRIu32, queueWaterMark);
+        }
+#endif // CONFIG_EZDV_MESSAGE_STATISTICS
+
+        if (newWaterMark)
+        {
+            QueueStatistics queueStats;
+            getQueueStatistics(queueStats);
+            util::TaskWatermarks::Record(taskName_, taskStackSize_, stackWaterMark, queueStats.capacity, queueStats.highWaterMark);
+        }
+    }
+}
+
+void DVTask::sendWithCorrelation_(DVTask* destination, DVTaskMessage* message, uint32_t correlationId)
+{
+    uint32_t previousCorrelationId = currentCorrelationId_;
+    currentCorrelationId_ = correlationId;
+    if (destination != nullptr)
+    {
+        sendTo(destination, message);
+    }
+    else
+    {
+        publish(message);
+    }
+    currentCorrelationId_ = previousCorrelationId;
+}
+
+uint32_t DVTask::AllocateCorrelationId_()
+{
+    // 0 is reserved for messages that aren't part of a request.
+    uint32_t id = NextCorrelationId_.fetch_add(1, std::memory_order_relaxed);
+    if (id == 0)
+    {
+        id = NextCorrelationId_.fetch_add(1, std::memory_order_relaxed);
     }
+    return id;
+}
+
+DVTaskRequestBatch::DVTaskRequestBatch(DVTask* owner)
+    : owner_(owner)
+    , numResponses_(0)
+{
+    assert(owner_ != nullptr);
 }
 
-void DVTask::onTaskQueueMessage_(DVTask* origin, TaskQueueMessage* message)
+DVTaskRequestBatch::~DVTaskRequestBatch()
 {
-    message->destination->postHelper_(message->entry);
+    unregisterHandlers_();
+
+    for (auto& request : requests_)
+    {
+        heap_caps_free(request.message);
+        delete request.response;
+    }
+}
+
+bool DVTaskRequestBatch::send(TickType_t ticksToWait)
+{
+    // Send everything up front so the destinations can work on them
+    // in parallel with each other.
+    for (auto& request : requests_)
+    {
+        if (request.message != nullptr)
+        {
+            owner_->sendWithCorrelation_(request.destination, request.message, request.correlationId);
+            heap_caps_free(request.message);
+            request.message = nullptr;
+        }
+    }
+
+    int64_t tickDiff = ticksToWait;
+    while (numResponses_ < requests_.size() && tickDiff >= 0)
+    {
+        TickType_t beginTicks = xTaskGetTickCount();
+        owner_->singleMessagingLoop_(tickDiff);
+        tickDiff -= xTaskGetTickCount() - beginTicks;
+    }
+
+    // Unsubscribe from the response messages.
+    unregisterHandlers_();
+
+    return numResponses_ == requests_.size();
+}
+
+void DVTaskRequestBatch::unregisterHandlers_()
+{
+    for (auto& request : requests_)
+    {
+        if (request.handler != nullptr)
+        {
+            owner_->unregisterMessageHandler(request.handler);
+            request.handler = nullptr;
+        }
+    }
 }
 
 void DVTask::ThreadEntry_(DVTask* thisObj)
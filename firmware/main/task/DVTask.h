@@ -20,9 +20,13 @@
 
 #include <map>
 #include <deque>
+#include <vector>
+#include <atomic>
 #include <functional>
+#include <cstring>
 
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -39,11 +43,74 @@ namespace ezdv
 namespace task
 {
 
+class DVTaskRequestBatch;
+class DVTimer;
+class DVTimerWheel;
+
 /// @brief Represents a task in the application.
 class DVTask
 {
 public:
     using MessageHandlerHandle = void*;
+
+    /// @brief Queues that incoming messages can be sorted into. Lanes are
+    ///        serviced in order, with real-time messages always going first.
+    enum MessageLane
+    {
+        MESSAGE_LANE_REALTIME = 0,
+        MESSAGE_LANE_NORMAL,
+        MESSAGE_LANE_BULK,
+        NUM_MESSAGE_LANES
+    };
+
+    /// @brief What to do when a message arrives and its lane is full.
+    enum OverflowPolicy
+    {
+        OVERFLOW_BLOCK = 0,       // wait up to 100ms for space, then drop
+        OVERFLOW_DROP_NEWEST,     // drop the message being posted
+        OVERFLOW_DROP_OLDEST,     // drop the oldest message in the lane
+        OVERFLOW_COALESCE_LATEST, // hold only the latest message until there's space
+        NUM_OVERFLOW_POLICIES
+    };
+
+    /// @brief Number of times each overflow policy has had to act.
+    struct OverflowStatistics
+    {
+        uint32_t blocked;
+        uint32_t blockTimeouts;
+        uint32_t droppedNewest;
+        uint32_t droppedOldest;
+        uint32_t coalesced;
+    };
+
+    /// @brief Timing of onTaskTick_() calls (only tracked with deadline ticks enabled).
+    struct TickStatistics
+    {
+        uint32_t ticksRun;
+        uint32_t missedDeadlines; // ran at least one RTOS tick late
+        uint32_t skippedPeriods;  // so late that whole periods were skipped
+        uint32_t maxOverrunMs;
+        uint64_t totalOverrunMs;
+    };
+
+    /// @brief Queue usage and message latency totals since the task was created.
+    struct QueueStatistics
+    {
+        uint32_t depth; // messages waiting right now
+        uint32_t capacity; // across all lanes
+        uint32_t highWaterMark; // since the last DumpTaskStatisticsMessage reset
+        uint32_t numMessages; // handled (only with CONFIG_EZDV_MESSAGE_STATISTICS)
+        uint64_t totalQueueWaitUs;
+        uint64_t totalHandlerUs;
+        uint32_t numWakeups; // times the task unblocked (for messages, timers or ticks)
+    };
+
+    /// @brief Called for each task by ForEachTask().
+    using TaskVisitorFn = void(*)(DVTask* task, void* arg);
+
+    /// @brief Called with messages that are dropped due to overflow
+    ///        (e.g. to free memory they point to).
+    using DroppedMessageFn = void(*)(DVTaskMessage* message);
     
     /// @brief Constructs a new task for the application
     /// @param taskName The friendly name of the task (used for debugging).
@@ -64,6 +131,12 @@ public:
     void sleep();
 
     /// @brief Determines whether there's enough queue space available to post a message.
+    /// @param lane The lane to check.
+    bool canPostMessage(MessageLane lane = MESSAGE_LANE_NORMAL);
+
+    /// @brief Determines whether there's enough queue space available to post a message.
+    /// @tparam MessageType The type of message that will be posted.
+    template<typename MessageType>
     bool canPostMessage();
 
     /// @brief Posts a message to own event queue.
@@ -87,6 +160,14 @@ public:
     /// @param message The message to publish.
     void publish(DVTaskMessage* message);
 
+    /// @brief Publishes a state message only if it differs from the last one
+    ///        of the same type published by this task (or if the set of
+    ///        subscribers has changed since then).
+    /// @tparam MessageType The type of message to publish. Must have operator==.
+    /// @param message The message to publish.
+    template<typename MessageType>
+    void publishIfChanged(MessageType* message);
+
     /// @brief Registers a new message handler.
     /// @tparam MessageType The type that the handler expects.
     /// @param handler The message handler.
@@ -100,6 +181,16 @@ public:
     template<typename MessageType, typename ObjType>
     MessageHandlerHandle registerMessageHandler(ObjType* taskObj, void(ObjType::*handler)(DVTask*, MessageType*));
 
+    /// @brief Registers message handlers that are known at compile time. Unlike
+    ///        registerMessageHandler(), nothing is allocated and each message is
+    ///        dispatched through a trampoline generated for that specific handler.
+    /// @tparam Handlers Member functions handling messages, e.g. &MyTask::onFoo_.
+    /// @tparam ObjType The type that will be handling the messages.
+    /// @param taskObj The object that will be handling the messages.
+    /// @note Handlers registered this way remain registered until the task is destroyed.
+    template<auto... Handlers, typename ObjType>
+    void registerMessageHandlers(ObjType* taskObj);
+
     /// @brief Unregisteers a message handler.
     /// @param handler The message handler.
     void unregisterMessageHandler(MessageHandlerHandle handler);
@@ -112,12 +203,56 @@ public:
     template<typename ResultMessageType>
     ResultMessageType* waitFor(TickType_t ticksToWait, DVTask** origin);
 
+    /// @brief Sends a request and waits for its response. Unlike waitFor(), 
+    ///        only the response to this specific request is accepted.
+    /// @tparam ResponseMessageType The type of message expected in response.
+    /// @param destination The task to send the request to (nullptr to publish it).
+    /// @param message The request to send.
+    /// @param ticksToWait The maximum amount of time to wait.
+    /// @return Copy of the response (caller must delete) or nullptr if timed out.
+    /// @note Anything sent via sendTo() or publish() while handling a request
+    ///       is tagged as a response to it, so responders need no changes
+    ///       beyond replying with sendTo(origin, ...) instead of origin->post(...).
+    template<typename ResponseMessageType>
+    ResponseMessageType* request(DVTask* destination, DVTaskMessage* message, TickType_t ticksToWait);
+
+    /// @brief Retrieves the number of times messages to this task have overflowed.
+    /// @param stats The structure to fill in.
+    void getOverflowStatistics(OverflowStatistics& stats);
+
+    /// @brief Retrieves how often onTaskTick_() has missed its deadline.
+    /// @param stats The structure to fill in.
+    void getTickStatistics(TickStatistics& stats);
+
+    /// @brief Retrieves queue usage and message latency totals. Safe to call from any task.
+    /// @param stats The structure to fill in.
+    void getQueueStatistics(QueueStatistics& stats);
+
+    /// @brief Returns the name the task was created with.
+    const char* getTaskName() const { return taskName_; }
+
+    /// @brief Runs onTaskTick_() as soon as possible instead of waiting for 
+    ///        the next tick, e.g. because new audio is ready. Safe to call from
+    ///        any task; requests made while one is pending are merged.
+    void requestTick();
+
     /// @brief Determines whether the task is awake.
     /// @return true if the task is awake, false otherwise.
     bool isAwake() const { return taskObject_ != nullptr; }
 
+    /// @brief Returns the underlying FreeRTOS task (nullptr while asleep).
+    TaskHandle_t getTaskHandle() const { return taskObject_; }
+
+    /// @brief Determines whether the caller is running on this task.
+    bool isCurrentTask() const { return taskObject_ != nullptr && xTaskGetCurrentTaskHandle() == taskObject_; }
+
     /// @brief Static initializer, required before using DVTask.
     static void Initialize();
+
+    /// @brief Calls the given function for every task that currently exists
+    ///        (awake or not), e.g. to collect statistics. Tasks can't be 
+    ///        created or destroyed until it returns.
+    static void ForEachTask(TaskVisitorFn fn, void* arg);
 protected:
     virtual void onTaskStart_(DVTask* origin, TaskStartMessage* message);
     virtual void onTaskSleep_(DVTask* origin, TaskSleepMessage* message);
@@ -137,8 +272,48 @@ protected:
     /// @param taskToSleep The task to sleep.
     /// @param ticksToWait The maximum amount of time to wait.
     void sleep(DVTask* taskToSleep, TickType_t ticksToWait = 0);
+
+    /// @brief Allows multiple queued messages to be processed per wakeup.
+    /// @param maxMessages The maximum number of messages to dispatch back-to-back.
+    /// @param maxTimeUs The maximum amount of time to spend dispatching before
+    ///                  returning to the main loop (e.g. to run onTaskTick_()).
+    void setMessageDrainBudget(uint32_t maxMessages, uint32_t maxTimeUs);
+
+    /// @brief Runs onTaskTick_() at fixed absolute deadlines (as with 
+    ///        vTaskDelayUntil()) instead of waiting a full tick interval 
+    ///        after the previous one, so time spent handling messages 
+    ///        doesn't cause it to drift.
+    void enableDeadlineTicks();
+
+    /// @brief Splits the task's queue into real-time, normal and bulk lanes.
+    ///        Must be called before the task is started.
+    /// @param realtimeQueueSize The maximum number of queued real-time messages.
+    /// @param bulkQueueSize The maximum number of queued bulk messages.
+    /// @note A size of 0 makes that lane share the normal lane's queue.
+    /// @note Timer messages always go into the real-time lane once enabled.
+    void enableMessageLanes(int32_t realtimeQueueSize, int32_t bulkQueueSize);
+
+    /// @brief Selects the lane that received messages of the given type go into.
+    /// @tparam MessageType The message type to assign.
+    /// @param lane The lane to use (default is MESSAGE_LANE_NORMAL).
+    template<typename MessageType>
+    void setMessageLane(MessageLane lane);
+
+    /// @brief Selects what happens when a message of the given type can't be queued.
+    /// @tparam MessageType The message type to assign.
+    /// @param policy The policy to use (default is OVERFLOW_BLOCK).
+    /// @param droppedFn Function to call for each message of this type that
+    ///                  is dropped without being handled. Optional. Runs in 
+    ///                  the context of whoever posted the message that overflowed.
+    template<typename MessageType>
+    void setMessageOverflowPolicy(OverflowPolicy policy, DroppedMessageFn droppedFn = nullptr);
     
 private:
+    friend class DVTaskRequestBatch;
+    friend class DVTaskStartScheduler;
+    friend class DVTimer;
+    friend class DVTimerWheel;
+
     // Non-template base class to help handle std::function cleanup
     class FnPtrStorage
     {
@@ -150,9 +325,73 @@ private:
     };
 
     using EventHandlerFn = void(*)(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data);
-    using EventIdentifierPair = std::pair<DVEventBaseType, int32_t>;
-    using EventMap = std::multimap<EventIdentifierPair, std::pair<EventHandlerFn, FnPtrStorage*>>;
-    using PublishMap = std::multimap<EventIdentifierPair, DVTask*>;
+
+    // storage is owned by the record and is nullptr for handlers registered
+    // via registerMessageHandlers(). Removed records have fn == nullptr.
+    struct HandlerRecord
+    {
+        EventHandlerFn fn;
+        void* arg;
+        FnPtrStorage* storage;
+    };
+
+    // Extracts the object and message types from a member function handler.
+    template<typename HandlerType>
+    struct MemberHandlerTraits;
+
+    template<typename ClassObj, typename MessageTypeArg>
+    struct MemberHandlerTraits<void(ClassObj::*)(DVTask*, MessageTypeArg*)>
+    {
+        using ObjectType = ClassObj;
+        using MessageType = MessageTypeArg;
+    };
+
+    // All handlers registered for a single message type.
+    struct HandlerList
+    {
+        uint32_t slot;
+        std::vector<HandlerRecord> handlers;
+    };
+
+    // Copy of the last message of a given type sent via publishIfChanged().
+    struct PublishedState
+    {
+        uint32_t subscriberGeneration;
+        char messageStart; // Placeholder to help write to correct memory location.
+    };
+
+    // Queue wait/handler time histograms. Bucket N holds times less than
+    // (64 << N) microseconds, with the last bucket holding everything else.
+    enum { NUM_LATENCY_BUCKETS = 12 };
+
+    struct MessageStatistics
+    {
+        uint32_t count;
+        uint32_t maxQueueWaitUs;
+        uint32_t maxHandlerUs;
+        uint64_t totalQueueWaitUs;
+        uint64_t totalHandlerUs;
+        uint32_t queueWaitHistogram[NUM_LATENCY_BUCKETS];
+        uint32_t handlerHistogram[NUM_LATENCY_BUCKETS];
+    };
+
+    // Per message type queuing options.
+    struct SlotOptions
+    {
+        uint8_t lane;
+        uint8_t overflowPolicy;
+        int16_t coalesceIndex; // into coalescedEntries_, or -1
+        DroppedMessageFn droppedFn;
+    };
+
+    // Tasks subscribed to a given message type. Lists are immutable once
+    // published; changes allocate a new list and swap the pointer so that
+    // publish() can read them without taking a lock.
+    struct SubscriberList
+    {
+        uint32_t numTasks;
+        DVTask* tasks[]; // numTasks entries follow
+    };
 
     template<typename MessageType>
     class MessageHandler : public FnPtrStorage
@@ -213,7 +452,9 @@ private:
         void (ClassObj::*fn_)(DVTask* origin, MessageType* msg);
     };
 
-    // Structure to help encode messages for queuing.
+    // Structure to help encode messages for queuing. Entries may be shared
+    // between several task queues (see publish()), so the message contents
+    // must be treated as read-only once queued.
     struct MessageEntry
     {
         DVEventBaseType eventBase;
@@ -221,30 +462,23 @@ private:
 
         DVTask* origin;
         uint32_t size;
+        uint32_t slot;
+        uint32_t correlationId; // nonzero if sent in response to (or as) a request
+        int64_t enqueueTimeUs;
+        std::atomic<uint32_t> refCount;
+        std::atomic<bool> delivered; // set once any task starts handling it
         char messageStart; // Placeholder to help write to correct memory location.
     };
     
-    class TaskQueueMessage : public DVTaskMessageBase<DVTaskControlMessageTypes::TASK_QUEUE_MSG, TaskQueueMessage>
-    {
-    public:
-        TaskQueueMessage(DVTask* destinationProvided = nullptr, MessageEntry* entryProvided = nullptr)
-            : DVTaskMessageBase<DVTaskControlMessageTypes::TASK_QUEUE_MSG, TaskQueueMessage>(DV_TASK_CONTROL_MESSAGE)
-            , destination(destinationProvided)
-            , entry(entryProvided)
-        {
-            // empty
-        }
-    
-        virtual ~TaskQueueMessage() = default;
-    
-        DVTask* destination;
-        MessageEntry* entry;
-    };
-
     const char* taskName_;
 
     TaskHandle_t taskObject_;
-    EventMap eventRegistrationMap_;
+
+    // Dispatch table: message type slot -> index into handlerLists_ (or -1).
+    std::vector<int16_t> handlerListIndexBySlot_;
+    std::vector<HandlerList> handlerLists_;
+    int dispatchDepth_;
+    bool handlerCompactionPending_;
 
     int32_t taskQueueSize_;
     int32_t taskStackSize_;
@@ -253,28 +487,194 @@ private:
     QueueHandle_t taskQueue_;
     
     TickType_t taskTick_;
-
-    MessageEntry* createMessageEntry_(DVTask* origin, DVTaskMessage* message);
+    bool deadlineTicksEnabled_;
+    TickType_t nextTickDeadline_;
+    TickStatistics tickStats_;
+
+    // Message lanes. All lanes point at taskQueue_ unless enabled, in which
+    // case laneSemaphore_ counts the total number of queued messages.
+    QueueHandle_t laneQueues_[NUM_MESSAGE_LANES];
+    int32_t laneQueueSizes_[NUM_MESSAGE_LANES];
+    SemaphoreHandle_t laneSemaphore_;
+    bool lanesEnabled_;
+    uint32_t consecutiveNormalMessages_;
+
+    // Timers using direct dispatch and requestTick(). Instead of posting a 
+    // message, these wake the task by queueing a null entry at the front of 
+    // the real-time lane; only one such wakeup is queued at a time. If the
+    // lane is full, the wakeup is deferred until after the next message.
+    std::vector<DVTimer*> directTimers_;
+    std::atomic<bool> tickRequested_;
+    std::atomic<bool> directTimerWakePending_;
+    std::atomic<uint32_t> directTimerWakesDropped_;
+    std::atomic<bool> directTimerWakeDeferred_;
+
+    // Shared by all of our timers using DVTimer::useTimerWheel(). Created on first use.
+    DVTimerWheel* timerWheel_;
+
+    // Overflow handling. Coalesced entries are held here until the
+    // task has room for them in its queue.
+    std::vector<SlotOptions> slotOptions_;
+    std::vector<std::atomic<MessageEntry*>*> coalescedEntries_;
+    std::atomic<bool> coalescedEntriesPending_;
+
+    std::atomic<uint32_t> overflowBlocked_;
+    std::atomic<uint32_t> overflowBlockTimeouts_;
+    std::atomic<uint32_t> overflowDroppedNewest_;
+    std::atomic<uint32_t> overflowDroppedOldest_;
+    std::atomic<uint32_t> overflowCoalesced_;
+
+    std::vector<PublishedState*> lastPublishedBySlot_;
+
+    std::vector<MessageStatistics*> messageStatsBySlot_;
+    uint32_t queueHighWaterMark_;
+
+    // Totals across all message types for getQueueStatistics(). Unlike 
+    // messageStatsBySlot_, these are never reset and can be read by anyone.
+    std::atomic<uint32_t> numMessagesHandled_;
+    std::atomic<uint64_t> totalQueueWaitUs_;
+    std::atomic<uint64_t> totalHandlerUs_;
+    std::atomic<uint32_t> numWakeups_;
+
+    // All tasks, for ForEachTask().
+    DVTask* nextTask_;
+
+    uint32_t drainMaxMessages_;
+    uint32_t drainMaxTimeUs_;
+
+    // Correlation ID of the message currently being handled (0 if none).
+    uint32_t currentCorrelationId_;
+
+    MessageEntry* createMessageEntry_(DVTask* origin, DVTaskMessage* message, uint32_t refCount = 1);
 
     void threadEntry_();
-    void postHelper_(MessageEntry* entry);
+    void postHelper_(MessageEntry* entry, bool isTimer = false);
+
+    SlotOptions getSlotOptions_(uint32_t slot) const;
+    SlotOptions& getMutableSlotOptions_(uint32_t slot);
+    void setLaneForSlot_(uint32_t slot, MessageLane lane);
+    void setOverflowPolicyForSlot_(uint32_t slot, OverflowPolicy policy, DroppedMessageFn droppedFn);
+
+    bool sendToQueue_(QueueHandle_t queue, MessageEntry* entry, bool toFront, TickType_t ticksToWait);
+    bool enqueueWithPolicy_(MessageEntry* entry, QueueHandle_t queue, bool toFront, const SlotOptions& options);
+    bool dropOldestAndEnqueue_(MessageEntry* entry, QueueHandle_t queue, bool toFront);
+    void dropEntry_(MessageEntry* entry);
+    bool dropUnallocated_(DVTaskMessage* message, bool cleanUp);
+    void requeueCoalescedEntries_();
+    void releaseCoalescedEntries_();
+    bool receiveMessage_(MessageEntry** entry, TickType_t ticksToWait);
+    bool hasPendingMessages_();
+
+    void registerHandler_(DVTaskMessage& message, EventHandlerFn fn, void* arg, FnPtrStorage* storage);
+
+    template<auto Handler, typename ObjType>
+    void registerMemberHandler_(ObjType* taskObj);
+    void dispatchMessage_(MessageEntry* entry);
+    void handleReceivedMessage_(MessageEntry* entry);
+    void recordMessageStatistics_(MessageEntry* entry, int64_t dispatchStartUs, int64_t dispatchEndUs);
+    uint32_t getQueueDepth_();
+    void compactHandlers_();
+
+    void addDirectTimer_(DVTimer* timer);
+    void removeDirectTimer_(DVTimer* timer);
+    void queueDirectWakeup_();
+    void runDirectWakeup_();
+    DVTimerWheel* getTimerWheel_();
     
     void startTask_();
 
     template<typename ControlMessageType>
-    void waitForOurs_(DVTask* taskToWaitFor, TickType_t ticksToWait);
+    void waitForControlResponse_(DVTask* taskToWaitFor, DVTaskMessage* controlMessage, TickType_t ticksToWait);
+
+    void sendWithCorrelation_(DVTask* destination, DVTaskMessage* message, uint32_t correlationId);
     
-    void singleMessagingLoop_(int64_t ticksRemaining);
+    void singleMessagingLoop_(int64_t ticksRemaining, bool allowDrain = false);
+    void waitForTickDeadline_();
     
-    void onTaskQueueMessage_(DVTask* origin, TaskQueueMessage* message);
+    void onDumpTaskStatisticsMessage_(DVTask* origin, DumpTaskStatisticsMessage* message);
+
+    PublishedState* getPublishedState_(DVTaskMessage& message);
+    void clearPublishedState_();
     
-    static PublishMap SubscriberTasksByMessageType_;
-    static SemaphoreHandle_t SubscriberTasksByMessageTypeSemaphore_;
+    static std::atomic<SubscriberList*> SubscriberListsBySlot_[DV_TASK_MAX_MESSAGE_SLOTS];
+    static std::atomic<uint32_t> ActivePublishReaders_;
+    static std::atomic<uint32_t> SubscriberGenerationsBySlot_[DV_TASK_MAX_MESSAGE_SLOTS];
+    static SemaphoreHandle_t SubscriberUpdateSemaphore_;
+    static std::atomic<uint32_t> NextCorrelationId_;
+    static DVTask* FirstTask_;
+    static SemaphoreHandle_t TaskListSemaphore_;
+
+    static void AddSubscriber_(uint32_t slot, DVTask* task);
+    static void RemoveSubscriber_(uint32_t slot, DVTask* task);
+    static void ReplaceSubscriberList_(uint32_t slot, SubscriberList* newList);
 
     static void ThreadEntry_(DVTask* thisObj);
+    static void ReleaseMessageEntry_(MessageEntry* entry);
+
+    static uint32_t AllocateCorrelationId_();
 
     template<typename MessageType>
     static void HandleEvent_(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data);
+
+    template<auto Handler>
+    static void HandleMemberEvent_(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data);
+};
+
+/// @brief Sends several requests at once and waits for all of their responses,
+///        so the caller only has to wait for a single round trip.
+class DVTaskRequestBatch
+{
+public:
+    /// @brief Creates a new batch.
+    /// @param owner The task sending the requests. Must be the calling task.
+    DVTaskRequestBatch(DVTask* owner);
+
+    /// @brief Cleans up the batch, including any received responses.
+    virtual ~DVTaskRequestBatch();
+
+    /// @brief Adds a request to the batch. The request is copied, so it 
+    ///        doesn't need to remain valid until send() is called.
+    /// @tparam ResponseMessageType The type of message expected in response.
+    /// @param destination The task to send the request to (nullptr to publish it).
+    /// @param message The request to send.
+    /// @return Index to pass to getResponse().
+    template<typename ResponseMessageType>
+    int add(DVTask* destination, DVTaskMessage* message);
+
+    /// @brief Sends all requests in the batch and waits for their responses.
+    /// @param ticksToWait The maximum amount of time to wait for all responses.
+    /// @return true if every request was responded to, false otherwise.
+    bool send(TickType_t ticksToWait);
+
+    /// @brief Retrieves the response to a request.
+    /// @tparam ResponseMessageType The type of message expected in response.
+    /// @param index The index returned by add().
+    /// @return The response (owned by the batch) or nullptr if none was received.
+    template<typename ResponseMessageType>
+    ResponseMessageType* getResponse(int index);
+
+    /// @brief Retrieves the response to a request and takes ownership of it.
+    /// @tparam ResponseMessageType The type of message expected in response.
+    /// @param index The index returned by add().
+    /// @return The response (caller must delete) or nullptr if none was received.
+    template<typename ResponseMessageType>
+    ResponseMessageType* releaseResponse(int index);
+
+private:
+    struct PendingRequest
+    {
+        DVTask* destination;
+        DVTaskMessage* message; // copy, freed once sent
+        uint32_t correlationId;
+        DVTask::MessageHandlerHandle handler;
+        DVTaskMessage* response;
+    };
+
+    DVTask* owner_;
+    std::vector<PendingRequest> requests_;
+    uint32_t numResponses_;
+
+    void unregisterHandlers_();
 };
 
 template<typename MessageType>
@@ -286,20 +686,8 @@ DVTask::MessageHandlerHandle DVTask::registerMessageHandler(std::function<void(D
     MessageFnObjStorage<MessageType>* fnPtrStorage = new MessageFnObjStorage<MessageType>(fnPtr);
     assert(fnPtrStorage != nullptr);
 
-    // Register task specific handler.
     MessageType tmpMessage;
-    auto key = std::make_pair(tmpMessage.getEventBase(), tmpMessage.getEventType());
-    auto val = std::make_pair((EventHandlerFn)&HandleEvent_<MessageType>, (FnPtrStorage*)fnPtrStorage);
-    eventRegistrationMap_.insert(
-        std::make_pair(key, val)        
-    );
-
-    // Register for use by publish.
-    xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    SubscriberTasksByMessageType_.insert(
-        std::make_pair(key, this)
-    );
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
+    registerHandler_(tmpMessage, (EventHandlerFn)&HandleEvent_<MessageType>, fnPtrStorage, fnPtrStorage);
     
     return fnPtrStorage;
 }
@@ -310,24 +698,70 @@ DVTask::MessageHandlerHandle DVTask::registerMessageHandler(ObjType* taskObj, vo
     MessageFnPtrStorage<ObjType, MessageType>* fnPtrStorage = new MessageFnPtrStorage<ObjType, MessageType>(taskObj, handler);
     assert(fnPtrStorage != nullptr);
 
-    // Register task specific handler.
     MessageType tmpMessage;
-    auto key = std::make_pair(tmpMessage.getEventBase(), tmpMessage.getEventType());
-    auto val = std::make_pair((EventHandlerFn)&HandleEvent_<MessageType>, (FnPtrStorage*)fnPtrStorage);
-    eventRegistrationMap_.insert(
-        std::make_pair(key, val)        
-    );
-
-    // Register for use by publish.
-    xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    SubscriberTasksByMessageType_.insert(
-        std::make_pair(key, this)
-    );
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
+    registerHandler_(tmpMessage, (EventHandlerFn)&HandleEvent_<MessageType>, fnPtrStorage, fnPtrStorage);
     
     return fnPtrStorage;
 }
 
+template<auto... Handlers, typename ObjType>
+void DVTask::registerMessageHandlers(ObjType* taskObj)
+{
+    (registerMemberHandler_<Handlers>(taskObj), ...);
+}
+
+template<auto Handler, typename ObjType>
+void DVTask::registerMemberHandler_(ObjType* taskObj)
+{
+    using Traits = MemberHandlerTraits<decltype(Handler)>;
+
+    // Convert before erasing the type so that the trampoline gets back
+    // the correct pointer even if ObjType has multiple base classes.
+    typename Traits::ObjectType* handlerObj = taskObj;
+
+    typename Traits::MessageType tmpMessage;
+    registerHandler_(tmpMessage, &HandleMemberEvent_<Handler>, (void*)handlerObj, nullptr);
+}
+
+template<typename MessageType>
+void DVTask::publishIfChanged(MessageType* message)
+{
+    PublishedState* state = getPublishedState_(*message);
+    uint32_t subscriberGeneration = SubscriberGenerationsBySlot_[message->getTypeSlot()].load(std::memory_order_acquire);
+    MessageType* lastMessage = (MessageType*)&state->messageStart;
+
+    if (state->subscriberGeneration == subscriberGeneration && *lastMessage == *message)
+    {
+        // Nothing new to tell anyone.
+        return;
+    }
+
+    memcpy((void*)lastMessage, (void*)message, message->getSize());
+    state->subscriberGeneration = subscriberGeneration;
+    publish(message);
+}
+
+template<typename MessageType>
+bool DVTask::canPostMessage()
+{
+    MessageType tmpMessage;
+    return canPostMessage((MessageLane)getSlotOptions_(tmpMessage.getTypeSlot()).lane);
+}
+
+template<typename MessageType>
+void DVTask::setMessageLane(MessageLane lane)
+{
+    MessageType tmpMessage;
+    setLaneForSlot_(tmpMessage.getTypeSlot(), lane);
+}
+
+template<typename MessageType>
+void DVTask::setMessageOverflowPolicy(OverflowPolicy policy, DroppedMessageFn droppedFn)
+{
+    MessageType tmpMessage;
+    setOverflowPolicyForSlot_(tmpMessage.getTypeSlot(), policy, droppedFn);
+}
+
 template<typename MessageType>
 void DVTask::HandleEvent_(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data)
 {
@@ -338,6 +772,17 @@ void DVTask::HandleEvent_(void *event_handler_arg, DVEventBaseType event_base, i
     fnPtrStorage->call(entry->origin, message);
 }
 
+template<auto Handler>
+void DVTask::HandleMemberEvent_(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data)
+{
+    using Traits = MemberHandlerTraits<decltype(Handler)>;
+    typename Traits::ObjectType* handlerObj = (typename Traits::ObjectType*)event_handler_arg;
+
+    MessageEntry* entry = *(MessageEntry**)event_data;
+    typename Traits::MessageType* message = (typename Traits::MessageType*)&entry->messageStart;
+    (handlerObj->*Handler)(entry->origin, message);
+}
+
 template<typename ResultMessageType>
 ResultMessageType* DVTask::waitFor(TickType_t ticksToWait, DVTask** origin)
 {
@@ -380,38 +825,79 @@ ResultMessageType* DVTask::waitFor(TickType_t ticksToWait, DVTask** origin)
     return result;
 }
 
+template<typename ResponseMessageType>
+ResponseMessageType* DVTask::request(DVTask* destination, DVTaskMessage* message, TickType_t ticksToWait)
+{
+    DVTaskRequestBatch batch(this);
+    int index = batch.add<ResponseMessageType>(destination, message);
+    batch.send(ticksToWait);
+    return batch.releaseResponse<ResponseMessageType>(index);
+}
+
 template<typename ControlMessageType>
-void DVTask::waitForOurs_(DVTask* taskToWaitFor, TickType_t ticksToWait)
+void DVTask::waitForControlResponse_(DVTask* taskToWaitFor, DVTaskMessage* controlMessage, TickType_t ticksToWait)
 {
-    int64_t tickDiff = ticksToWait;
-    bool found = false;
+    auto response = request<ControlMessageType>(taskToWaitFor, controlMessage, ticksToWait);
+    if (response == nullptr)
+    {
+        ESP_LOGE("DVTask", "Was waiting for %s but timed out", taskToWaitFor->taskName_);
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    assert(response != nullptr);
+    delete response;
+}
 
-    while (tickDiff >= 0)
+template<typename ResponseMessageType>
+int DVTaskRequestBatch::add(DVTask* destination, DVTaskMessage* message)
+{
+    int index = requests_.size();
+
+    PendingRequest request;
+    request.destination = destination;
+    request.correlationId = DVTask::AllocateCorrelationId_();
+    request.response = nullptr;
+
+    request.message = (DVTaskMessage*)heap_caps_malloc(message->getSize(), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(request.message != nullptr);
+    memcpy((void*)request.message, (void*)message, message->getSize());
+
+    // Subscribe now so that the response can't arrive before we're listening.
+    std::function<void(DVTask*, ResponseMessageType*)> handler = [this, index](DVTask*, ResponseMessageType* response)
     {
-        TickType_t beginTicks = xTaskGetTickCount();
-        DVTask* origin = nullptr;
-        
-        auto message = waitFor<ControlMessageType>((TickType_t)tickDiff, &origin);
-        if (message != nullptr)
+        PendingRequest& pending = requests_[index];
+        if (pending.response != nullptr || owner_->currentCorrelationId_ != pending.correlationId)
         {
-            delete message; // message isn't needed, just the origin
+            // Not ours (or a duplicate).
+            return;
         }
-        
-        tickDiff -= xTaskGetTickCount() - beginTicks;
 
-        if (taskToWaitFor == origin)
-        {
-            found = true;
-            break;
-        }
-    }
+        // Make copy of message for the caller.
+        ResponseMessageType* result = new ResponseMessageType();
+        assert(result != nullptr);
+        memcpy((void*)result, (void*)response, response->getSize());
 
-    if (!found)
-    {
-        ESP_LOGE("DVTask", "Was waiting for %s but timed out", taskToWaitFor->taskName_);
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-    assert(found);
+        pending.response = result;
+        numResponses_++;
+    };
+    request.handler = owner_->registerMessageHandler<ResponseMessageType>(handler);
+
+    requests_.push_back(request);
+    return index;
+}
+
+template<typename ResponseMessageType>
+ResponseMessageType* DVTaskRequestBatch::getResponse(int index)
+{
+    assert(index >= 0 && index < (int)requests_.size());
+    return (ResponseMessageType*)requests_[index].response;
+}
+
+template<typename ResponseMessageType>
+ResponseMessageType* DVTaskRequestBatch::releaseResponse(int index)
+{
+    ResponseMessageType* response = getResponse<ResponseMessageType>(index);
+    requests_[index].response = nullptr;
+    return response;
 }
 
 }
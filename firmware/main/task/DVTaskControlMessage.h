@@ -40,8 +40,7 @@ enum DVTaskControlMessageTypes
     TASK_STARTED = 3,
     TASK_ASLEEP = 4,
     
-    TASK_QUEUE_MSG = 5, // special message so that we can defer sending control messages until waitFor executes
-                        // or when current handler finishes
+    TASK_DUMP_STATISTICS = 6,
 };
 
 template<uint32_t MSG_ID>
@@ -59,6 +58,18 @@ using TaskSleepMessage = TaskControlCommon<TASK_SLEEP>;
 using TaskStartedMessage = TaskControlCommon<TASK_STARTED>;
 using TaskAsleepMessage = TaskControlCommon<TASK_ASLEEP>;
 
+/// @brief Asks all tasks to print their message latency statistics to the console.
+class DumpTaskStatisticsMessage : public DVTaskMessageBase<TASK_DUMP_STATISTICS, DumpTaskStatisticsMessage>
+{
+public:
+    DumpTaskStatisticsMessage(bool resetProvided = false)
+        : DVTaskMessageBase<TASK_DUMP_STATISTICS, DumpTaskStatisticsMessage>(DV_TASK_CONTROL_MESSAGE)
+        , reset(resetProvided) { }
+    virtual ~DumpTaskStatisticsMessage() = default;
+
+    bool reset; // clear statistics after printing
+};
+
 }
 
 }
@@ -0,0 +1,83 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "freertos/FreeRTOS.h"
+
+#include "DVTaskMessage.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+struct SlotRegistration
+{
+    DVEventBaseType base;
+    int32_t id;
+};
+
+static SlotRegistration SlotRegistrations_[DV_TASK_MAX_MESSAGE_SLOTS];
+static uint32_t NumSlots_ = 0;
+static portMUX_TYPE SlotRegistryLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t DVTaskMessageSlotRegistry::GetSlot(DVEventBaseType base, int32_t id)
+{
+    uint32_t slot = 0;
+
+    // Linear search is fine here as it only happens once per message type.
+    portENTER_CRITICAL_SAFE(&SlotRegistryLock_);
+    for (; slot < NumSlots_; slot++)
+    {
+        if (SlotRegistrations_[slot].base == base && SlotRegistrations_[slot].id == id)
+        {
+            break;
+        }
+    }
+
+    if (slot == NumSlots_ && NumSlots_ < DV_TASK_MAX_MESSAGE_SLOTS)
+    {
+        SlotRegistrations_[slot].base = base;
+        SlotRegistrations_[slot].id = id;
+        NumSlots_++;
+    }
+    portEXIT_CRITICAL_SAFE(&SlotRegistryLock_);
+
+    // If this fires, DV_TASK_MAX_MESSAGE_SLOTS needs to be increased.
+    assert(slot < DV_TASK_MAX_MESSAGE_SLOTS);
+    return slot;
+}
+
+uint32_t DVTaskMessageSlotRegistry::GetNumSlots()
+{
+    return NumSlots_;
+}
+
+void DVTaskMessageSlotRegistry::GetSlotEvent(uint32_t slot, DVEventBaseType* base, int32_t* id)
+{
+    assert(slot < NumSlots_);
+
+    // Registrations are never modified once made, so no lock needed.
+    *base = SlotRegistrations_[slot].base;
+    *id = SlotRegistrations_[slot].id;
+}
+
+}
+
+}
@@ -25,12 +25,36 @@ using DVEventBaseType = const char*;
 #define DV_EVENT_DECLARE_BASE(NAME) extern DVEventBaseType NAME
 #define DV_EVENT_DEFINE_BASE(NAME) DVEventBaseType NAME = #NAME
 
+// Maximum number of distinct (event base, event ID) pairs in the application.
+#define DV_TASK_MAX_MESSAGE_SLOTS 384
+
 namespace ezdv
 {
 
 namespace task
 {
 
+/// @brief Assigns small, dense integers ("slots") to each message type so
+/// that handler lookup can be done with an array index.
+class DVTaskMessageSlotRegistry
+{
+public:
+    /// @brief Retrieves the slot for the given event, allocating one if needed.
+    /// @param base The event base.
+    /// @param id The event ID within the base.
+    /// @return The slot assigned to the event.
+    static uint32_t GetSlot(DVEventBaseType base, int32_t id);
+
+    /// @brief Returns the number of slots assigned so far.
+    static uint32_t GetNumSlots();
+
+    /// @brief Retrieves the event that the given slot was assigned to.
+    /// @param slot The slot to look up.
+    /// @param base Set to the event base.
+    /// @param id Set to the event ID within the base.
+    static void GetSlotEvent(uint32_t slot, DVEventBaseType* base, int32_t* id);
+};
+
 class DVTaskMessage
 {
 public:
@@ -40,6 +64,7 @@ public:
     virtual uint32_t getSize() const = 0;
     virtual DVEventBaseType getEventBase() const = 0;
     virtual int32_t getEventType() const = 0;
+    virtual uint32_t getTypeSlot() const = 0;
 };
 
 template<uint32_t EVENT_TYPE_ID, typename MessageType>
@@ -69,6 +94,14 @@ public:
         return sizeof(MessageType);
     }
 
+    virtual uint32_t getTypeSlot() const override
+    {
+        // Resolved once per message type. The registry is keyed on the
+        // (base, ID) pair so that dispatch semantics match the event IDs.
+        static const uint32_t slot = DVTaskMessageSlotRegistry::GetSlot(base_, EVENT_TYPE_ID);
+        return slot;
+    }
+
 private:
     const DVEventBaseType base_;
 };
@@ -0,0 +1,142 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "esp_log.h"
+
+#include "DVTaskSchedulingProfile.h"
+
+#define CURRENT_LOG_TAG ("DVTaskSchedulingProfile")
+
+namespace ezdv
+{
+
+namespace task
+{
+
+// FreeDVTask is pinned to core 0 in all modes as it starts at boot 
+// and does the bulk of the processing while decoding. Its TX engine 
+// runs on core 1 so encoding never competes with decoding. Radio audio 
+// tasks go wherever FreeDVTask isn't.
+static const DVTaskSchedulingEntry StandaloneProfile_[] = {
+    { "FreeDVTask", 15, 0 },
+    { "FreeDVTxTask", 15, 1 },
+    { "TLV320Driver", 15, tskNO_AFFINITY },
+    { "TLV320Driver/Audio", 16, tskNO_AFFINITY },
+    { "AudioMixer", 15, tskNO_AFFINITY },
+    { "FlexVitaTask", 16, 1 },
+    { nullptr, 0, 0 },
+};
+
+static const DVTaskSchedulingEntry FlexProfile_[] = {
+    { "FreeDVTask", 15, 0 },
+    { "FreeDVTxTask", 15, 1 },
+    { "TLV320Driver", 15, tskNO_AFFINITY },
+    { "TLV320Driver/Audio", 16, tskNO_AFFINITY },
+    { "AudioMixer", 15, tskNO_AFFINITY },
+    { "FlexVitaTask", 16, DV_TASK_CORE_LEAST_LOADED },
+    { "FlexTcpTask", 10, tskNO_AFFINITY },
+    { nullptr, 0, 0 },
+};
+
+static const DVTaskSchedulingEntry IcomProfile_[] = {
+    { "FreeDVTask", 15, 0 },
+    { "FreeDVTxTask", 15, 1 },
+    { "TLV320Driver", 15, tskNO_AFFINITY },
+    { "TLV320Driver/Audio", 16, tskNO_AFFINITY },
+    { "AudioMixer", 15, tskNO_AFFINITY },
+    { "FlexVitaTask", 10, tskNO_AFFINITY }, // only used for discovery here
+    { "IcomSocketTask/Audio", 16, DV_TASK_CORE_LEAST_LOADED },
+    { "IcomSocketTask/Control", 10, tskNO_AFFINITY },
+    { "IcomSocketTask/CIV", 10, tskNO_AFFINITY },
+    { "IcomSocketTask", 16, DV_TASK_CORE_LEAST_LOADED }, // CONFIG_EZDV_ICOM_SHARED_SOCKET_TASK
+    { nullptr, 0, 0 },
+};
+
+static const DVTaskSchedulingEntry* Profiles_[NUM_SCHEDULING_MODES] = {
+    StandaloneProfile_,
+    FlexProfile_,
+    IcomProfile_,
+};
+
+std::atomic<int> DVTaskSchedulingProfile::Mode_(SCHEDULING_MODE_STANDALONE);
+std::atomic<int> DVTaskSchedulingProfile::CoreIdlePercent_[portNUM_PROCESSORS];
+std::atomic<bool> DVTaskSchedulingProfile::CoreIdleValid_(false);
+
+void DVTaskSchedulingProfile::SetMode(DVTaskSchedulingMode mode)
+{
+    assert(mode < NUM_SCHEDULING_MODES);
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Switching to scheduling mode %d", mode);
+    Mode_ = mode;
+}
+
+DVTaskSchedulingMode DVTaskSchedulingProfile::GetMode()
+{
+    return (DVTaskSchedulingMode)Mode_.load();
+}
+
+bool DVTaskSchedulingProfile::Apply(const char* taskName, UBaseType_t* priority, BaseType_t* coreId)
+{
+    const DVTaskSchedulingEntry* entry = Profiles_[Mode_.load()];
+    for (; entry->taskName != nullptr; entry++)
+    {
+        if (!strcmp(entry->taskName, taskName))
+        {
+            *priority = entry->priority;
+            *coreId = (entry->coreId == DV_TASK_CORE_LEAST_LOADED) ? GetLeastLoadedCore_() : entry->coreId;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DVTaskSchedulingProfile::ReportCoreIdle(const uint8_t idlePercent[portNUM_PROCESSORS])
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        CoreIdlePercent_[core] = idlePercent[core];
+    }
+    CoreIdleValid_ = true;
+}
+
+BaseType_t DVTaskSchedulingProfile::GetLeastLoadedCore_()
+{
+    // Without measurements, assume core 0 is busiest as that's where 
+    // FreeDVTask lives.
+    BaseType_t bestCore = portNUM_PROCESSORS - 1;
+    if (!CoreIdleValid_)
+    {
+        return bestCore;
+    }
+
+    for (int core = portNUM_PROCESSORS - 1; core >= 0; core--)
+    {
+        if (CoreIdlePercent_[core] > CoreIdlePercent_[bestCore])
+        {
+            bestCore = core;
+        }
+    }
+    return bestCore;
+}
+
+}
+
+}
@@ -0,0 +1,86 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_TASK_SCHEDULING_PROFILE_H
+#define DV_TASK_SCHEDULING_PROFILE_H
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+
+// Pin to whichever core currently has the most idle time.
+#define DV_TASK_CORE_LEAST_LOADED (-2)
+
+namespace ezdv
+{
+
+namespace task
+{
+
+enum DVTaskSchedulingMode
+{
+    SCHEDULING_MODE_STANDALONE = 0,
+    SCHEDULING_MODE_FLEX,
+    SCHEDULING_MODE_ICOM,
+    NUM_SCHEDULING_MODES
+};
+
+/// @brief Priority and core affinity to use for a task in a given mode.
+struct DVTaskSchedulingEntry
+{
+    const char* taskName;
+    UBaseType_t priority;
+    BaseType_t coreId; // or tskNO_AFFINITY/DV_TASK_CORE_LEAST_LOADED
+};
+
+/// @brief Central table of task priorities and core affinities for each
+///        radio mode. Applied whenever a task starts; tasks not listed use
+///        the values passed to their constructor.
+class DVTaskSchedulingProfile
+{
+public:
+    /// @brief Selects the profile used for tasks started from now on.
+    /// @param mode The new mode.
+    static void SetMode(DVTaskSchedulingMode mode);
+
+    /// @brief Returns the current mode.
+    static DVTaskSchedulingMode GetMode();
+
+    /// @brief Overrides the priority and/or core of a task per the current profile.
+    /// @param taskName The name of the task being started.
+    /// @param priority The task's priority. Updated if the task is in the profile.
+    /// @param coreId The task's core. Updated if the task is in the profile.
+    /// @return true if the task is in the profile, false otherwise.
+    static bool Apply(const char* taskName, UBaseType_t* priority, BaseType_t* coreId);
+
+    /// @brief Updates the measured per-core load used for DV_TASK_CORE_LEAST_LOADED.
+    /// @param idlePercent The percentage of time each core spent idle.
+    static void ReportCoreIdle(const uint8_t idlePercent[portNUM_PROCESSORS]);
+
+private:
+    static std::atomic<int> Mode_;
+    static std::atomic<int> CoreIdlePercent_[portNUM_PROCESSORS];
+    static std::atomic<bool> CoreIdleValid_;
+
+    static BaseType_t GetLeastLoadedCore_();
+};
+
+}
+
+}
+
+#endif // DV_TASK_SCHEDULING_PROFILE_H
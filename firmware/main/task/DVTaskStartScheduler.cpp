@@ -0,0 +1,163 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "DVTaskStartScheduler.h"
+
+#define CURRENT_LOG_TAG ("DVTaskStartScheduler")
+
+namespace ezdv
+{
+
+namespace task
+{
+
+DVTaskStartScheduler::DVTaskStartScheduler(DVTask* owner)
+    : owner_(owner)
+    , numComplete_(0)
+{
+    assert(owner_ != nullptr);
+}
+
+void DVTaskStartScheduler::add(DVTask* task, TickType_t ticksToWait, std::vector<DVTask*> dependencies)
+{
+    assert(task != nullptr);
+    assert(ticksToWait > 0);
+
+    ScheduledTask scheduledTask;
+    scheduledTask.task = task;
+    scheduledTask.ticksToWait = ticksToWait;
+    scheduledTask.dependencies = dependencies;
+    scheduledTask.correlationId = 0;
+    scheduledTask.startTicks = 0;
+    scheduledTask.state = START_PENDING;
+    tasks_.push_back(scheduledTask);
+}
+
+void DVTaskStartScheduler::start()
+{
+    std::function<void(DVTask*, TaskStartedMessage*)> handler = [&](DVTask*, TaskStartedMessage*)
+    {
+        for (auto& scheduledTask : tasks_)
+        {
+            if (scheduledTask.state == START_IN_PROGRESS && 
+                scheduledTask.correlationId == owner_->currentCorrelationId_)
+            {
+                ESP_LOGI(
+                    CURRENT_LOG_TAG, 
+                    "%s started after %" PRIu32 " ms", 
+                    scheduledTask.task->taskName_, 
+                    (uint32_t)pdTICKS_TO_MS(xTaskGetTickCount() - scheduledTask.startTicks));
+
+                scheduledTask.state = START_COMPLETE;
+                numComplete_++;
+                break;
+            }
+        }
+    };
+    auto registrationHandle = owner_->registerMessageHandler<TaskStartedMessage>(handler);
+
+    while (numComplete_ < tasks_.size())
+    {
+        startReadyTasks_();
+
+        // Wait until the soonest deadline of the tasks still starting.
+        TickType_t currentTicks = xTaskGetTickCount();
+        int64_t ticksRemaining = -1;
+        ScheduledTask* soonestTask = nullptr;
+        for (auto& scheduledTask : tasks_)
+        {
+            if (scheduledTask.state == START_IN_PROGRESS)
+            {
+                int64_t taskTicksRemaining = (int64_t)scheduledTask.ticksToWait - (currentTicks - scheduledTask.startTicks);
+                if (soonestTask == nullptr || taskTicksRemaining < ticksRemaining)
+                {
+                    soonestTask = &scheduledTask;
+                    ticksRemaining = taskTicksRemaining;
+                }
+            }
+        }
+
+        // If nothing's starting, we have a dependency that can never be satisfied.
+        assert(soonestTask != nullptr);
+
+        if (ticksRemaining < 0)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Was waiting for %s but timed out", soonestTask->task->taskName_);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            assert(ticksRemaining >= 0);
+        }
+
+        owner_->singleMessagingLoop_(ticksRemaining);
+    }
+
+    owner_->unregisterMessageHandler(registrationHandle);
+}
+
+bool DVTaskStartScheduler::hasStarted_(DVTask* task)
+{
+    for (auto& scheduledTask : tasks_)
+    {
+        if (scheduledTask.task == task)
+        {
+            return scheduledTask.state == START_COMPLETE;
+        }
+    }
+
+    // Not one of ours, so it must have been started earlier.
+    assert(task->isAwake());
+    return true;
+}
+
+bool DVTaskStartScheduler::isReady_(ScheduledTask& scheduledTask)
+{
+    for (auto& dependency : scheduledTask.dependencies)
+    {
+        if (!hasStarted_(dependency))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DVTaskStartScheduler::startReadyTasks_()
+{
+    for (auto& scheduledTask : tasks_)
+    {
+        if (scheduledTask.state == START_PENDING && isReady_(scheduledTask))
+        {
+            ESP_LOGI(CURRENT_LOG_TAG, "Starting %s", scheduledTask.task->taskName_);
+
+            scheduledTask.task->startTask_();
+            scheduledTask.correlationId = DVTask::AllocateCorrelationId_();
+            scheduledTask.startTicks = xTaskGetTickCount();
+            scheduledTask.state = START_IN_PROGRESS;
+
+            TaskStartMessage startMessage;
+            owner_->sendWithCorrelation_(scheduledTask.task, &startMessage, scheduledTask.correlationId);
+        }
+    }
+}
+
+}
+
+}
@@ -0,0 +1,83 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_TASK_START_SCHEDULER_H
+#define DV_TASK_START_SCHEDULER_H
+
+#include <vector>
+
+#include "DVTask.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+/// @brief Starts a group of tasks, bringing up each one as soon as the tasks
+///        it depends on have finished starting. Tasks that don't depend on 
+///        each other start concurrently.
+class DVTaskStartScheduler
+{
+public:
+    /// @brief Creates a new scheduler.
+    /// @param owner The task doing the starting. Must be the calling task.
+    DVTaskStartScheduler(DVTask* owner);
+    virtual ~DVTaskStartScheduler() = default;
+
+    /// @brief Adds a task to be started.
+    /// @param task The task to start.
+    /// @param ticksToWait The maximum amount of time the task may take to start.
+    /// @param dependencies Tasks that must finish starting first. Tasks not 
+    ///                     added to this scheduler must already be awake.
+    void add(DVTask* task, TickType_t ticksToWait, std::vector<DVTask*> dependencies = {});
+
+    /// @brief Starts all added tasks and waits until they've finished starting.
+    void start();
+
+private:
+    enum StartState
+    {
+        START_PENDING,
+        START_IN_PROGRESS,
+        START_COMPLETE,
+    };
+
+    struct ScheduledTask
+    {
+        DVTask* task;
+        TickType_t ticksToWait;
+        std::vector<DVTask*> dependencies;
+        uint32_t correlationId;
+        TickType_t startTicks;
+        StartState state;
+    };
+
+    DVTask* owner_;
+    std::vector<ScheduledTask> tasks_;
+    uint32_t numComplete_;
+
+    bool isReady_(ScheduledTask& scheduledTask);
+    bool hasStarted_(DVTask* task);
+    void startReadyTasks_();
+};
+
+}
+
+}
+
+#endif // DV_TASK_START_SCHEDULER_H
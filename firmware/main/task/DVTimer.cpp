@@ -15,7 +15,12 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdlib>
+#include <cstring>
+
 #include "DVTimer.h"
+#include "DVTimerWheel.h"
+#include "util/EventTrace.h"
 
 extern "C"
 {
@@ -33,39 +38,43 @@ DVTimer::DVTimer(DVTask* owner, TimerHandlerFn fn, uint64_t intervalInMicrosecon
     , intervalInMicroseconds_(intervalInMicroseconds)
     , running_(false)
     , once_(false)
+    , timerHandle_(nullptr)
+    , name_(timerName != nullptr ? timerName : "DVTimer")
+    , directDispatch_(false)
+    , firePending_(false)
+    , fireTimeUs_(0)
+    , periodic_(false)
+    , lastCallTimeUs_(0)
+    , wheel_(nullptr)
+    , wheelNext_(nullptr)
+    , wheelPrev_(nullptr)
+    , wheelExpiryTick_(0)
+    , wheelPeriodTicks_(0)
+    , wheelScheduled_(false)
 {
+    memset(&stats_, 0, sizeof(stats_));
+
     fn_ = new TimerHandlerFnForwarder(fn);
     assert(fn_ != nullptr);
     
-    esp_timer_create_args_t args = {
-        .callback = &OnESPTimerFire_,
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "DVTimer",
-        .skip_unhandled_events = true,
-    };
-    
-    if (timerName != nullptr)
-    {
-        args.name = timerName;
-    }
-    
-    ESP_ERROR_CHECK(
-        esp_timer_create(
-            &args, &timerHandle_
-        )
-    );
-    
-    owner->registerMessageHandler(this, &DVTimer::onTimerFire_);
+    owner->registerMessageHandlers<&DVTimer::onTimerFire_>(this);
 }
 
 DVTimer::~DVTimer()
 {
     stop();
     
-    ESP_ERROR_CHECK(
-        esp_timer_delete(timerHandle_)
-    );
+    if (timerHandle_ != nullptr)
+    {
+        ESP_ERROR_CHECK(
+            esp_timer_delete(timerHandle_)
+        );
+    }
+
+    if (directDispatch_)
+    {
+        owner_->removeDirectTimer_(this);
+    }
 
     delete fn_;
 }
@@ -91,6 +100,23 @@ void DVTimer::start(bool once)
 {
     if (!running_)
     {
+        periodic_ = !once;
+        lastCallTimeUs_ = 0;
+
+        if (wheel_ != nullptr)
+        {
+            once_ = once;
+            running_ = true;
+            wheel_->schedule(this, intervalInMicroseconds_, !once);
+            return;
+        }
+
+        // The esp_timer is created on first use as wheel-based timers don't need one.
+        if (timerHandle_ == nullptr)
+        {
+            createTimer_();
+        }
+
         if (once)
         {
             once_ = true;
@@ -107,20 +133,129 @@ void DVTimer::start(bool once)
 
 void DVTimer::stop()
 {
-    if (running_)
+    if (wheel_ != nullptr)
+    {
+        // The wheel may have just cleared running_ for a one-shot timer,
+        // so always cancel to be safe.
+        wheel_->cancel(this);
+        running_ = false;
+        once_ = false;
+    }
+    else if (running_)
     {
         ESP_ERROR_CHECK(esp_timer_stop(timerHandle_));
         running_ = false;
         once_ = false;
     }
+
+    // Don't run the handler for a fire that happened before we stopped.
+    firePending_.store(false, std::memory_order_release);
+}
+
+void DVTimer::restart(bool once)
+{
+    stop();
+    start(once);
+}
+
+void DVTimer::useTimerWheel()
+{
+    assert(timerHandle_ == nullptr);
+
+    if (wheel_ == nullptr)
+    {
+        wheel_ = owner_->getTimerWheel_();
+        enableDirectDispatch();
+    }
+}
+
+void DVTimer::enableDirectDispatch()
+{
+    if (!directDispatch_)
+    {
+        directDispatch_ = true;
+        owner_->addDirectTimer_(this);
+    }
+}
+
+const char* DVTimer::getName() const
+{
+    return name_;
+}
+
+DVTimer::Statistics DVTimer::getStatistics() const
+{
+    return stats_;
+}
+
+void DVTimer::resetStatistics()
+{
+    memset(&stats_, 0, sizeof(stats_));
+    lastCallTimeUs_ = 0;
 }
 
 void DVTimer::onTimerFire_(DVTask* origin, TimerFireMessage* message)
 {
     if (message->timer == this)
     {
-        fn_->call(this);
+        callHandler_(message->fireTimeUs);
+    }
+}
+
+void DVTimer::runIfPending_()
+{
+    if (firePending_.exchange(false, std::memory_order_acq_rel))
+    {
+        callHandler_(fireTimeUs_.load(std::memory_order_relaxed));
+    }
+}
+
+void DVTimer::callHandler_(uint32_t fireTimeUs)
+{
+    int64_t currentTimeUs = esp_timer_get_time();
+
+    // Only the lower 32 bits of the fire time are kept, which is fine
+    // as long as the difference fits.
+    uint32_t dispatchLatencyUs = (uint32_t)currentTimeUs - fireTimeUs;
+    stats_.numFires++;
+    stats_.totalDispatchLatencyUs += dispatchLatencyUs;
+    if (dispatchLatencyUs > stats_.maxDispatchLatencyUs)
+    {
+        stats_.maxDispatchLatencyUs = dispatchLatencyUs;
+    }
+
+    if (periodic_ && lastCallTimeUs_ != 0)
+    {
+        int64_t intervalUs = currentTimeUs - lastCallTimeUs_;
+        uint32_t jitterUs = (uint32_t)std::llabs(intervalUs - (int64_t)intervalInMicroseconds_);
+        stats_.totalJitterUs += jitterUs;
+        if (jitterUs > stats_.maxJitterUs)
+        {
+            stats_.maxJitterUs = jitterUs;
+        }
     }
+    lastCallTimeUs_ = currentTimeUs;
+
+    EZDV_TRACE(TIMER_HANDLER_BEGIN, 0, name_, 0);
+    fn_->call(this);
+    EZDV_TRACE(TIMER_HANDLER_END, 0, name_, 0);
+}
+
+void DVTimer::createTimer_()
+{
+    esp_timer_create_args_t args = {
+        .callback = &OnESPTimerFire_,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = name_,
+        .skip_unhandled_events = true,
+    };
+    
+    ESP_ERROR_CHECK(
+        esp_timer_create(
+            &args, &timerHandle_
+        )
+    );
 }
 
 void DVTimer::OnESPTimerFire_(void* ptr)
@@ -133,8 +268,19 @@ void DVTimer::OnESPTimerFire_(void* ptr)
         obj->running_ = false;
     }
 
-    TimerFireMessage message(obj);
-    obj->owner_->postTimer(&message);
+    uint32_t fireTimeUs = (uint32_t)esp_timer_get_time();
+    EZDV_TRACE(TIMER_FIRE, 0, obj->name_, 0);
+    if (obj->directDispatch_)
+    {
+        obj->fireTimeUs_.store(fireTimeUs, std::memory_order_relaxed);
+        obj->firePending_.store(true, std::memory_order_release);
+        obj->owner_->queueDirectWakeup_();
+    }
+    else
+    {
+        TimerFireMessage message(obj, fireTimeUs);
+        obj->owner_->postTimer(&message);
+    }
 }
 
 }
@@ -18,6 +18,8 @@
 #ifndef DV_TASK_TIMER_H
 #define DV_TASK_TIMER_H
 
+#include <atomic>
+#include <cstring>
 #include <functional>
 #include <inttypes.h>
 
@@ -45,6 +47,16 @@ class DVTimer
 {
 public:
     using TimerHandlerFn = std::function<void(DVTimer*)>;
+
+    /// @brief Timing statistics for the timer's handler.
+    struct Statistics
+    {
+        uint32_t numFires;
+        uint32_t maxJitterUs; // Deviation of the time between handler calls from the interval.
+        uint64_t totalJitterUs;
+        uint32_t maxDispatchLatencyUs; // Time between the timer firing and the handler running.
+        uint64_t totalDispatchLatencyUs;
+    };
     
     DVTimer(DVTask* owner, TimerHandlerFn fn, uint64_t intervalInMicroseconds, const char* timerName);
 
@@ -56,18 +68,50 @@ public:
     void start(bool once = false);
     void stop();
 
+    /// @brief Stops the timer (if running) and starts it again from now.
+    /// @param once Whether the timer should only fire once.
+    void restart(bool once = false);
+
     void changeInterval(uint64_t intervalInMicroseconds);
+
+    /// @brief Wakes the owner directly when the timer fires instead of posting a 
+    ///        message through its queue. Intended for latency-critical timers.
+    void enableDirectDispatch();
+
+    /// @brief Runs the timer off of its owner's timer wheel instead of a dedicated 
+    ///        esp_timer. Each esp_timer costs memory and a trip through the 
+    ///        esp_timer task every time it fires, while the wheel runs all of a 
+    ///        task's timers off of one esp_timer and handles timers expiring on
+    ///        the same tick with a single wakeup. In exchange, intervals are 
+    ///        rounded up to DVTimerWheel::RESOLUTION_US, so this is intended for
+    ///        watchdogs, timeouts and other coarse timers.
+    /// @note Must be called before the timer is first started. Implies direct dispatch.
+    void useTimerWheel();
+
+    /// @brief Returns the name the timer was created with.
+    const char* getName() const;
+
+    /// @brief Returns the timer's handler timing statistics.
+    Statistics getStatistics() const;
+
+    /// @brief Resets the timer's handler timing statistics.
+    void resetStatistics();
     
 private:
+    friend class DVTask;
+    friend class DVTimerWheel;
+
     class TimerFireMessage : public DVTaskMessageBase<1, TimerFireMessage>
     {
     public:
-        TimerFireMessage(DVTimer* timerProvided = nullptr)
+        TimerFireMessage(DVTimer* timerProvided = nullptr, uint32_t fireTimeUsProvided = 0)
             : DVTaskMessageBase<1, TimerFireMessage>(DV_TASK_TIMER_MESSAGE)
-            , timer(timerProvided) { }
+            , timer(timerProvided)
+            , fireTimeUs(fireTimeUsProvided) { }
         virtual ~TimerFireMessage() = default;
         
         DVTimer* timer;
+        uint32_t fireTimeUs;
     };
 
     class TimerHandler
@@ -130,8 +174,29 @@ private:
     bool running_;
     bool once_;
     esp_timer_handle_t timerHandle_;
+    const char* name_;
+
+    // Direct dispatch state, shared with the esp_timer task.
+    bool directDispatch_;
+    std::atomic<bool> firePending_;
+    std::atomic<uint32_t> fireTimeUs_;
+
+    bool periodic_;
+    int64_t lastCallTimeUs_;
+    Statistics stats_;
+
+    // Timer wheel state, protected by the wheel's lock.
+    DVTimerWheel* wheel_;
+    DVTimer* wheelNext_;
+    DVTimer* wheelPrev_;
+    uint32_t wheelExpiryTick_;
+    uint32_t wheelPeriodTicks_;
+    bool wheelScheduled_;
     
     void onTimerFire_(DVTask* origin, TimerFireMessage* message);
+    void runIfPending_();
+    void callHandler_(uint32_t fireTimeUs);
+    void createTimer_();
     
     static void OnESPTimerFire_(void* ptr);
 };
@@ -142,30 +207,26 @@ DVTimer::DVTimer(DVTask* owner, ClassObj* classObj, void (ClassObj::*fn)(DVTimer
     , intervalInMicroseconds_(intervalInMicroseconds)
     , running_(false)
     , once_(false)
+    , timerHandle_(nullptr)
+    , name_(timerName != nullptr ? timerName : "DVTimer")
+    , directDispatch_(false)
+    , firePending_(false)
+    , fireTimeUs_(0)
+    , periodic_(false)
+    , lastCallTimeUs_(0)
+    , wheel_(nullptr)
+    , wheelNext_(nullptr)
+    , wheelPrev_(nullptr)
+    , wheelExpiryTick_(0)
+    , wheelPeriodTicks_(0)
+    , wheelScheduled_(false)
 {
+    memset(&stats_, 0, sizeof(stats_));
+
     fn_ = new TimerHandlerForwarder<ClassObj>(classObj, fn);
     assert(fn_ != nullptr);
-
-    esp_timer_create_args_t args = {
-        .callback = &OnESPTimerFire_,
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "DVTimer",
-        .skip_unhandled_events = true,
-    };
-    
-    if (timerName != nullptr)
-    {
-        args.name = timerName;
-    }
-    
-    ESP_ERROR_CHECK(
-        esp_timer_create(
-            &args, &timerHandle_
-        )
-    );
     
-    owner->registerMessageHandler(this, &DVTimer::onTimerFire_);
+    owner->registerMessageHandlers<&DVTimer::onTimerFire_>(this);
 }
 
 }
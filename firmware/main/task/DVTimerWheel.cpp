@@ -0,0 +1,218 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "DVTimerWheel.h"
+#include "DVTimer.h"
+#include "util/EventTrace.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+DVTimerWheel::DVTimerWheel(DVTask* owner)
+    : owner_(owner)
+    , currentTick_(0)
+    , nextTickTimeUs_(0)
+    , numScheduled_(0)
+    , ticking_(false)
+{
+    portMUX_INITIALIZE(&lock_);
+    memset(slots_, 0, sizeof(slots_));
+
+    esp_timer_create_args_t args = {
+        .callback = &OnESPTimerFire_,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "DVTimerWheel",
+        .skip_unhandled_events = true,
+    };
+
+    ESP_ERROR_CHECK(
+        esp_timer_create(
+            &args, &timerHandle_
+        )
+    );
+}
+
+DVTimerWheel::~DVTimerWheel()
+{
+    // Timers remove themselves when they're destroyed.
+    assert(numScheduled_ == 0);
+
+    esp_timer_stop(timerHandle_);
+    ESP_ERROR_CHECK(
+        esp_timer_delete(timerHandle_)
+    );
+}
+
+void DVTimerWheel::schedule(DVTimer* timer, uint64_t intervalInMicroseconds, bool periodic)
+{
+    bool startTicking = false;
+    int64_t currentTimeUs = esp_timer_get_time();
+
+    portENTER_CRITICAL(&lock_);
+    if (timer->wheelScheduled_)
+    {
+        remove_(timer);
+    }
+
+    if (!ticking_)
+    {
+        ticking_ = true;
+        startTicking = true;
+        nextTickTimeUs_ = currentTimeUs + RESOLUTION_US;
+    }
+
+    // Fire on the first tick at or after the requested time. Periodic
+    // timers are rescheduled from the tick they fired on.
+    int64_t timeAfterNextTickUs = currentTimeUs + (int64_t)intervalInMicroseconds - nextTickTimeUs_;
+    uint32_t ticksAfterNextTick = timeAfterNextTickUs > 0 ? (timeAfterNextTickUs + RESOLUTION_US - 1) / RESOLUTION_US : 0;
+    uint32_t periodTicks = (intervalInMicroseconds + RESOLUTION_US / 2) / RESOLUTION_US;
+    timer->wheelPeriodTicks_ = periodic ? (periodTicks > 0 ? periodTicks : 1) : 0;
+    insert_(timer, currentTick_ + 1 + ticksAfterNextTick);
+    portEXIT_CRITICAL(&lock_);
+
+    if (startTicking)
+    {
+        ESP_ERROR_CHECK(esp_timer_start_once(timerHandle_, RESOLUTION_US));
+    }
+}
+
+void DVTimerWheel::cancel(DVTimer* timer)
+{
+    // The esp_timer keeps going until the next tick notices there's
+    // nothing left, so stop() followed by start() stays cheap.
+    portENTER_CRITICAL(&lock_);
+    if (timer->wheelScheduled_)
+    {
+        remove_(timer);
+    }
+    portEXIT_CRITICAL(&lock_);
+}
+
+void DVTimerWheel::insert_(DVTimer* timer, uint32_t expiryTick)
+{
+    DVTimer** head = &slots_[expiryTick % NUM_SLOTS];
+
+    timer->wheelExpiryTick_ = expiryTick;
+    timer->wheelPrev_ = nullptr;
+    timer->wheelNext_ = *head;
+    if (*head != nullptr)
+    {
+        (*head)->wheelPrev_ = timer;
+    }
+    *head = timer;
+
+    timer->wheelScheduled_ = true;
+    numScheduled_++;
+}
+
+void DVTimerWheel::remove_(DVTimer* timer)
+{
+    if (timer->wheelPrev_ != nullptr)
+    {
+        timer->wheelPrev_->wheelNext_ = timer->wheelNext_;
+    }
+    else
+    {
+        slots_[timer->wheelExpiryTick_ % NUM_SLOTS] = timer->wheelNext_;
+    }
+
+    if (timer->wheelNext_ != nullptr)
+    {
+        timer->wheelNext_->wheelPrev_ = timer->wheelPrev_;
+    }
+
+    timer->wheelNext_ = nullptr;
+    timer->wheelPrev_ = nullptr;
+    timer->wheelScheduled_ = false;
+    numScheduled_--;
+}
+
+void DVTimerWheel::onTick_()
+{
+    bool anyFired = false;
+    bool keepTicking = false;
+    int64_t currentTimeUs = esp_timer_get_time();
+    int64_t delayUs = 0;
+
+    portENTER_CRITICAL(&lock_);
+
+    // Catch up on any ticks we missed (e.g. if the esp_timer task was busy).
+    while (currentTimeUs >= nextTickTimeUs_ - (int64_t)(RESOLUTION_US / 2))
+    {
+        currentTick_++;
+        nextTickTimeUs_ += RESOLUTION_US;
+
+        DVTimer* timer = slots_[currentTick_ % NUM_SLOTS];
+        while (timer != nullptr)
+        {
+            DVTimer* nextTimer = timer->wheelNext_;
+            if (timer->wheelExpiryTick_ == currentTick_)
+            {
+                remove_(timer);
+                EZDV_TRACE(TIMER_FIRE, 0, timer->name_, 0);
+
+                timer->fireTimeUs_.store((uint32_t)currentTimeUs, std::memory_order_relaxed);
+                timer->firePending_.store(true, std::memory_order_release);
+                anyFired = true;
+
+                if (timer->wheelPeriodTicks_ > 0)
+                {
+                    insert_(timer, currentTick_ + timer->wheelPeriodTicks_);
+                }
+                else
+                {
+                    timer->running_ = false;
+                    timer->once_ = false;
+                }
+            }
+            timer = nextTimer;
+        }
+    }
+
+    keepTicking = numScheduled_ > 0;
+    ticking_ = keepTicking;
+    delayUs = nextTickTimeUs_ - currentTimeUs;
+    portEXIT_CRITICAL(&lock_);
+
+    if (keepTicking)
+    {
+        ESP_ERROR_CHECK(esp_timer_start_once(timerHandle_, delayUs > 0 ? delayUs : 1));
+    }
+
+    // Everything that fired on this tick is handled in one go.
+    if (anyFired)
+    {
+        owner_->queueDirectWakeup_();
+    }
+}
+
+void DVTimerWheel::OnESPTimerFire_(void* ptr)
+{
+    DVTimerWheel* obj = (DVTimerWheel*)ptr;
+    obj->onTick_();
+}
+
+}
+
+}
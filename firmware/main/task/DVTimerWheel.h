@@ -0,0 +1,82 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_TASK_TIMER_WHEEL_H
+#define DV_TASK_TIMER_WHEEL_H
+
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+class DVTask;
+class DVTimer;
+
+/// @brief Runs all of a task's wheel-based timers (see DVTimer::useTimerWheel())
+///        off of a single esp_timer. Timers that expire on the same tick are
+///        handled with a single wakeup of the owning task.
+class DVTimerWheel
+{
+public:
+    /// @brief The wheel's resolution. Timer intervals are rounded up to a multiple of this.
+    static constexpr uint64_t RESOLUTION_US = 10000;
+
+    DVTimerWheel(DVTask* owner);
+    virtual ~DVTimerWheel();
+
+    /// @brief Schedules (or reschedules) a timer to fire after the given interval.
+    /// @param timer The timer to schedule.
+    /// @param intervalInMicroseconds The time until the timer fires.
+    /// @param periodic Whether the timer should keep firing at that interval.
+    void schedule(DVTimer* timer, uint64_t intervalInMicroseconds, bool periodic);
+
+    /// @brief Removes a timer from the wheel if it's scheduled.
+    /// @param timer The timer to remove.
+    void cancel(DVTimer* timer);
+
+private:
+    // Timers are kept in intrusive lists (see DVTimer::wheelNext_) by expiry
+    // tick modulo NUM_SLOTS, so that scheduling and cancelling are O(1).
+    enum { NUM_SLOTS = 64 };
+
+    DVTask* owner_;
+    esp_timer_handle_t timerHandle_;
+    portMUX_TYPE lock_;
+    DVTimer* slots_[NUM_SLOTS];
+    uint32_t currentTick_;
+    int64_t nextTickTimeUs_;
+    uint32_t numScheduled_;
+    bool ticking_;
+
+    void insert_(DVTimer* timer, uint32_t expiryTick);
+    void remove_(DVTimer* timer);
+    void onTick_();
+
+    static void OnESPTimerFire_(void* ptr);
+};
+
+}
+
+}
+
+#endif // DV_TASK_TIMER_WHEEL_H
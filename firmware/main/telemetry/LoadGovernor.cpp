@@ -0,0 +1,149 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <climits>
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+
+#include "esp_log.h"
+
+#include "LoadGovernor.h"
+
+#define CURRENT_LOG_TAG ("LoadGovernor")
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+static const char* LevelNames_[] = { "none", "background", "spectrum rate", "spectrum" };
+static_assert(sizeof(LevelNames_) / sizeof(LevelNames_[0]) == LoadSheddingMessage::NUM_SHEDDING_LEVELS, "Missing level names");
+
+LoadGovernor::LoadGovernor()
+    : level_(LoadSheddingMessage::SHED_NONE)
+    , numHealthySamples_(0)
+{
+    // empty
+}
+
+void LoadGovernor::reset()
+{
+    level_ = LoadSheddingMessage::SHED_NONE;
+    numHealthySamples_ = 0;
+}
+
+bool LoadGovernor::update(const TelemetrySample& sample)
+{
+    // The first sample has nothing to compare task run times against, so 
+    // idle time isn't valid yet.
+    if (sample.numTasks == 0)
+    {
+        return false;
+    }
+
+    int minIdle = 100;
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        if (sample.idlePercent[core] < minIdle)
+        {
+            minIdle = sample.idlePercent[core];
+        }
+    }
+
+    // Only modes that actually ran frames this interval count.
+    int32_t minMarginUs = INT32_MAX;
+    uint32_t numLate = 0;
+    for (int index = 0; index < sample.numModemProfiles; index++)
+    {
+        auto& profile = sample.modemProfiles[index];
+        if (profile.numFrames > 0 && profile.worstMarginUs < minMarginUs)
+        {
+            minMarginUs = profile.worstMarginUs;
+        }
+        numLate += profile.numLate;
+    }
+
+    bool underPressure = 
+        minIdle < CONFIG_EZDV_LOAD_GOVERNOR_MIN_IDLE_PERCENT ||
+        minMarginUs < CONFIG_EZDV_LOAD_GOVERNOR_MIN_MARGIN_US ||
+        numLate > 0;
+    bool hasHeadroom = 
+        minIdle >= CONFIG_EZDV_LOAD_GOVERNOR_RESTORE_IDLE_PERCENT &&
+        minMarginUs >= CONFIG_EZDV_LOAD_GOVERNOR_MIN_MARGIN_US &&
+        numLate == 0;
+
+    auto previousLevel = level_;
+    if (underPressure)
+    {
+        numHealthySamples_ = 0;
+        if (level_ < LoadSheddingMessage::NUM_SHEDDING_LEVELS - 1)
+        {
+            level_ = (LoadSheddingMessage::SheddingLevel)(level_ + 1);
+        }
+    }
+    else if (hasHeadroom && level_ > LoadSheddingMessage::SHED_NONE)
+    {
+        if (++numHealthySamples_ >= CONFIG_EZDV_LOAD_GOVERNOR_RESTORE_SAMPLES)
+        {
+            numHealthySamples_ = 0;
+            level_ = (LoadSheddingMessage::SheddingLevel)(level_ - 1);
+        }
+    }
+    else
+    {
+        // In between the two thresholds: hold where we are.
+        numHealthySamples_ = 0;
+    }
+
+    if (level_ == previousLevel)
+    {
+        return false;
+    }
+
+    if (level_ > previousLevel)
+    {
+        ESP_LOGW(
+            CURRENT_LOG_TAG, 
+            "Shedding load (%s -> %s): min idle %d%%, min modem margin %" PRId32 " us, %" PRIu32 " late frames",
+            LevelNames_[previousLevel],
+            LevelNames_[level_],
+            minIdle,
+            minMarginUs == INT32_MAX ? 0 : minMarginUs,
+            numLate);
+    }
+    else
+    {
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "Restoring load (%s -> %s): min idle %d%%",
+            LevelNames_[previousLevel],
+            LevelNames_[level_],
+            minIdle);
+    }
+
+    return true;
+}
+
+}
+
+}
+
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
@@ -0,0 +1,59 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOAD_GOVERNOR_H
+#define LOAD_GOVERNOR_H
+
+#include "TelemetryMessage.h"
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+/// @brief Decides how much non-critical work to shed based on telemetry 
+///        samples. Moves up one level for every sample under pressure (low
+///        idle time on either core, or modem frames late or close to it) and
+///        back down one level after several samples with headroom. Only used
+///        from TelemetryTask.
+class LoadGovernor
+{
+public:
+    LoadGovernor();
+    virtual ~LoadGovernor() = default;
+
+    /// @brief Evaluates the latest sample.
+    /// @param sample The sample just taken.
+    /// @return true if the shedding level changed.
+    bool update(const TelemetrySample& sample);
+
+    /// @brief Goes back to not shedding anything.
+    void reset();
+
+    LoadSheddingMessage::SheddingLevel getLevel() const { return level_; }
+
+private:
+    LoadSheddingMessage::SheddingLevel level_;
+    int numHealthySamples_;
+};
+
+}
+
+}
+
+#endif // LOAD_GOVERNOR_H
@@ -0,0 +1,138 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdarg>
+#include <cstdio>
+
+#include "sdkconfig.h"
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+
+#include "esp_log.h"
+
+#include "MetricsWriter.h"
+
+#define CURRENT_LOG_TAG ("MetricsWriter")
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+MetricsWriter::MetricsWriter(httpd_req_t* request)
+    : request_(request)
+    , metricName_("")
+    , bufferUsed_(0)
+    , failed_(false)
+{
+    // empty
+}
+
+void MetricsWriter::beginMetric(const char* name, const char* type, const char* help)
+{
+    metricName_ = name;
+    append_("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsWriter::writeValue(const char* labels, uint64_t value, const char* suffix)
+{
+    beginSample_(labels, suffix);
+    append_(" %" PRIu64 "\n", value);
+}
+
+void MetricsWriter::writeSignedValue(const char* labels, int64_t value, const char* suffix)
+{
+    beginSample_(labels, suffix);
+    append_(" %" PRId64 "\n", value);
+}
+
+void MetricsWriter::writeSeconds(const char* labels, uint64_t timeUs, const char* suffix)
+{
+    beginSample_(labels, suffix);
+    append_(" %" PRIu64 ".%06" PRIu64 "\n", timeUs / 1000000, timeUs % 1000000);
+}
+
+esp_err_t MetricsWriter::finish()
+{
+    flush_();
+    if (!failed_ && httpd_resp_send_chunk(request_, nullptr, 0) != ESP_OK)
+    {
+        failed_ = true;
+    }
+
+    return failed_ ? ESP_FAIL : ESP_OK;
+}
+
+void MetricsWriter::beginSample_(const char* labels, const char* suffix)
+{
+    if (labels != nullptr && *labels != 0)
+    {
+        append_("%s%s{%s}", metricName_, suffix, labels);
+    }
+    else
+    {
+        append_("%s%s", metricName_, suffix);
+    }
+}
+
+void MetricsWriter::append_(const char* format, ...)
+{
+    if (failed_)
+    {
+        // The client's gone, don't bother.
+        return;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(&buffer_[bufferUsed_], BUFFER_SIZE - bufferUsed_, format, args);
+        va_end(args);
+
+        if (length >= 0 && length < BUFFER_SIZE - bufferUsed_)
+        {
+            bufferUsed_ += length;
+            return;
+        }
+
+        // Didn't fit; send what we have and try again with an empty buffer.
+        flush_();
+    }
+
+    ESP_LOGE(CURRENT_LOG_TAG, "Metrics line too long, skipping");
+}
+
+void MetricsWriter::flush_()
+{
+    if (bufferUsed_ > 0 && !failed_)
+    {
+        if (httpd_resp_send_chunk(request_, buffer_, bufferUsed_) != ESP_OK)
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Sending metrics failed");
+            failed_ = true;
+        }
+    }
+    bufferUsed_ = 0;
+}
+
+}
+
+}
+
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
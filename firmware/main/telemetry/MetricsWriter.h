@@ -0,0 +1,82 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_WRITER_H
+#define METRICS_WRITER_H
+
+#include <cinttypes>
+
+#include "esp_http_server.h"
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+/// @brief Renders metrics in Prometheus text format straight into an HTTP
+///        response. Output is sent in chunks as a small buffer fills, so the 
+///        response never has to be held in memory all at once.
+class MetricsWriter
+{
+public:
+    /// @brief Creates a writer for the given request.
+    /// @param request The request to respond to. Content type should already be set.
+    MetricsWriter(httpd_req_t* request);
+    virtual ~MetricsWriter() = default;
+
+    /// @brief Starts a new metric. All of its samples must follow before the next one.
+    /// @param name The metric name (e.g. "ezdv_heap_free_bytes").
+    /// @param type "counter", "gauge" or "histogram".
+    /// @param help One line description.
+    void beginMetric(const char* name, const char* type, const char* help);
+
+    /// @brief Writes a sample of the current metric.
+    /// @param labels Label list without braces (e.g. "task=\"FreeDV\""), or nullptr.
+    /// @param value The sample's value.
+    /// @param suffix Appended to the metric name (e.g. "_bucket" for histograms).
+    void writeValue(const char* labels, uint64_t value, const char* suffix = "");
+
+    /// @brief Writes a sample that may be negative.
+    void writeSignedValue(const char* labels, int64_t value, const char* suffix = "");
+
+    /// @brief Writes a time in microseconds as seconds.
+    void writeSeconds(const char* labels, uint64_t timeUs, const char* suffix = "");
+
+    /// @brief Sends whatever is left and ends the response.
+    /// @return ESP_OK if the entire response was sent.
+    esp_err_t finish();
+
+private:
+    enum { BUFFER_SIZE = 512 };
+
+    httpd_req_t* request_;
+    const char* metricName_;
+    char buffer_[BUFFER_SIZE];
+    int bufferUsed_;
+    bool failed_;
+
+    void beginSample_(const char* labels, const char* suffix);
+    void append_(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void flush_();
+};
+
+}
+
+}
+
+#endif // METRICS_WRITER_H
@@ -0,0 +1,315 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "SoakTestTask.h"
+#include "driver/ButtonMessage.h"
+
+#define CURRENT_LOG_TAG ("SoakTest")
+
+#define SOAK_TEST_STEP_INTERVAL_US (CONFIG_EZDV_SOAK_TEST_STEP_SECONDS * 1000000ULL)
+#define SOAK_TEST_DURATION_US (CONFIG_EZDV_SOAK_TEST_DURATION_MINUTES * 60000000LL)
+
+// Collect telemetry often enough that none of its history is missed.
+#define SOAK_TEST_SAMPLE_INTERVAL_US \
+    (std::max(1, CONFIG_EZDV_TELEMETRY_NUM_SAMPLES / 2) * CONFIG_EZDV_TELEMETRY_INTERVAL * 1000ULL)
+
+// Each mode gets one RX and one TX step.
+#define SOAK_TEST_STEPS_PER_PASS (audio::MAX_FREEDV_MODES * 2)
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+static const char* ModeNames_[] = { "ANALOG", "700D", "700E", "1600" };
+static_assert(sizeof(ModeNames_) / sizeof(ModeNames_[0]) == audio::MAX_FREEDV_MODES, "Mode names don't match FreeDVMode");
+
+SoakTestTask::SoakTestTask()
+    : DVTask("SoakTestTask", 1, 4096, tskNO_AFFINITY, 8)
+    , stepTimer_(this, this, &SoakTestTask::onStepTimer_, SOAK_TEST_STEP_INTERVAL_US, "SoakTestStepTimer")
+    , sampleTimer_(this, this, &SoakTestTask::onSampleTimer_, SOAK_TEST_SAMPLE_INTERVAL_US, "SoakTestSampleTimer")
+    , startTimeUs_(0)
+    , lastSampleTimeUs_(0)
+    , isRunning_(false)
+    , isFinishing_(false)
+    , step_(0)
+    , numPasses_(0)
+{
+    memset(&results_, 0, sizeof(results_));
+
+    registerMessageHandlers<
+        &SoakTestTask::onTelemetryReportMessage_>(this);
+}
+
+void SoakTestTask::onTaskStart_()
+{
+    memset(&results_, 0, sizeof(results_));
+    results_.worstMarginUs = INT32_MAX;
+    results_.minStackBytes = UINT32_MAX;
+
+    // Only count what happens from here on, not while booting.
+    startTimeUs_ = esp_timer_get_time();
+    lastSampleTimeUs_ = startTimeUs_;
+    isRunning_ = true;
+    isFinishing_ = false;
+    step_ = 0;
+    numPasses_ = 0;
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "Starting soak test: %d s per step, %d minutes total", 
+        CONFIG_EZDV_SOAK_TEST_STEP_SECONDS, 
+        CONFIG_EZDV_SOAK_TEST_DURATION_MINUTES);
+
+    onStepTimer_(nullptr);
+    stepTimer_.start();
+    sampleTimer_.start();
+}
+
+void SoakTestTask::onTaskSleep_()
+{
+    stepTimer_.stop();
+    sampleTimer_.stop();
+
+    if (isRunning_)
+    {
+        setPtt_(false);
+        report_(false);
+        isRunning_ = false;
+    }
+}
+
+void SoakTestTask::onStepTimer_(DVTimer*)
+{
+    if (!isRunning_ || isFinishing_)
+    {
+        return;
+    }
+
+    if (CONFIG_EZDV_SOAK_TEST_DURATION_MINUTES > 0 && 
+        esp_timer_get_time() - startTimeUs_ >= SOAK_TEST_DURATION_US)
+    {
+        // Back to RX and wait for the last of the telemetry.
+        setPtt_(false);
+        stepTimer_.stop();
+        isFinishing_ = true;
+
+        RequestTelemetryMessage request;
+        publish(&request);
+        return;
+    }
+
+    if (step_ > 0 && (step_ % SOAK_TEST_STEPS_PER_PASS) == 0)
+    {
+        numPasses_++;
+        report_(false);
+    }
+
+    auto mode = (audio::FreeDVMode)((step_ / 2) % audio::MAX_FREEDV_MODES);
+    bool ptt = (step_ % 2) == 1;
+    if (ptt)
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Step %d: TX in %s", step_, ModeNames_[mode]);
+        setPtt_(true);
+    }
+    else
+    {
+        ESP_LOGI(CURRENT_LOG_TAG, "Step %d: RX in %s", step_, ModeNames_[mode]);
+        setPtt_(false);
+
+        // Goes through UserInterfaceTask like the mode button, so that 
+        // everything that follows the mode hears about it.
+        audio::RequestSetFreeDVModeMessage request(mode);
+        publish(&request);
+    }
+
+    step_++;
+}
+
+void SoakTestTask::onSampleTimer_(DVTimer*)
+{
+    RequestTelemetryMessage request;
+    publish(&request);
+}
+
+void SoakTestTask::onTelemetryReportMessage_(DVTask* origin, TelemetryReportMessage* message)
+{
+    if (message->snapshot == nullptr)
+    {
+        return;
+    }
+
+    // Snapshots overlap, so only take samples we haven't seen yet.
+    for (uint32_t index = 0; index < message->snapshot->numSamples; index++)
+    {
+        auto& sample = message->snapshot->samples[index];
+        if (sample.timestampUs > lastSampleTimeUs_)
+        {
+            accumulate_(sample);
+            lastSampleTimeUs_ = sample.timestampUs;
+        }
+    }
+    heap_caps_free(message->snapshot);
+
+    if (isFinishing_)
+    {
+        sampleTimer_.stop();
+        isFinishing_ = false;
+        isRunning_ = false;
+        report_(true);
+    }
+}
+
+void SoakTestTask::setPtt_(bool ptt)
+{
+    if (ptt)
+    {
+        driver::ButtonShortPressedMessage message(driver::PTT);
+        publish(&message);
+    }
+    else
+    {
+        driver::ButtonReleasedMessage message(driver::PTT);
+        publish(&message);
+    }
+}
+
+void SoakTestTask::accumulate_(const TelemetrySample& sample)
+{
+    for (int index = 0; index < sample.numModemProfiles; index++)
+    {
+        auto& modem = sample.modemProfiles[index];
+        results_.numFrames += modem.numFrames;
+        results_.numLateFrames += modem.numLate;
+        if (modem.mode < audio::MAX_FREEDV_MODES)
+        {
+            results_.numLateFramesByMode[modem.mode] += modem.numLate;
+        }
+        if (modem.numFrames > 0)
+        {
+            results_.worstMarginUs = std::min(results_.worstMarginUs, modem.worstMarginUs);
+        }
+    }
+
+    for (int index = 0; index < sample.numAudioLinks; index++)
+    {
+        auto& link = sample.audioLinks[index];
+        results_.numOverruns += link.numOverruns;
+        results_.numUnderruns += link.numUnderruns;
+        if (link.numOverruns > results_.worstOverrunCount)
+        {
+            results_.worstOverrunCount = link.numOverruns;
+            strncpy(results_.worstOverrunLink, link.sinkName, sizeof(results_.worstOverrunLink) - 1);
+        }
+    }
+
+    for (int index = 0; index < TELEMETRY_NETWORK_STREAMS; index++)
+    {
+        results_.numPacketsReceived += sample.network[index].numReceived;
+        results_.numPacketsLost += sample.network[index].numLost;
+    }
+
+    for (int index = 0; index < sample.numTasks; index++)
+    {
+        auto& task = sample.tasks[index];
+        if (task.stackHighWaterMark < results_.minStackBytes)
+        {
+            results_.minStackBytes = task.stackHighWaterMark;
+            strncpy(results_.minStackTask, task.name, sizeof(results_.minStackTask) - 1);
+        }
+    }
+}
+
+void SoakTestTask::report_(bool final)
+{
+    // Lowest since boot, which includes anything missed between samples.
+    results_.minInternalHeapBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    results_.minSpiramHeapBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+
+    uint64_t totalPackets = results_.numPacketsReceived + results_.numPacketsLost;
+    uint32_t lossPpm = totalPackets > 0 ? (uint32_t)(results_.numPacketsLost * 1000000 / totalPackets) : 0;
+
+    bool lateFramesOk = results_.numLateFrames <= CONFIG_EZDV_SOAK_TEST_MAX_LATE_FRAMES;
+    bool overrunsOk = results_.numOverruns <= CONFIG_EZDV_SOAK_TEST_MAX_FIFO_OVERRUNS;
+    bool lossOk = lossPpm <= CONFIG_EZDV_SOAK_TEST_MAX_PACKET_LOSS_PPM;
+    bool heapOk = results_.minInternalHeapBytes >= CONFIG_EZDV_SOAK_TEST_MIN_FREE_INTERNAL_HEAP;
+    bool stackOk = results_.minStackBytes == UINT32_MAX || results_.minStackBytes >= CONFIG_EZDV_SOAK_TEST_MIN_FREE_STACK;
+    bool passed = lateFramesOk && overrunsOk && lossOk && heapOk && stackOk;
+
+    auto elapsedMinutes = (esp_timer_get_time() - startTimeUs_) / 60000000;
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "%s after %" PRId64 " minutes (%d passes through all modes):", 
+        final ? "Final results" : "Results so far", elapsedMinutes, numPasses_);
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "  [%s] late modem frames: %" PRIu64 " of %" PRIu64 " (limit %d; ANALOG %" PRIu64 ", 700D %" PRIu64 ", 700E %" PRIu64 ", 1600 %" PRIu64 "), worst margin %" PRId32 " us",
+        lateFramesOk ? "ok" : "FAIL",
+        results_.numLateFrames, results_.numFrames, CONFIG_EZDV_SOAK_TEST_MAX_LATE_FRAMES,
+        results_.numLateFramesByMode[audio::ANALOG], results_.numLateFramesByMode[audio::FREEDV_700D], 
+        results_.numLateFramesByMode[audio::FREEDV_700E], results_.numLateFramesByMode[audio::FREEDV_1600],
+        results_.numFrames > 0 ? results_.worstMarginUs : 0);
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "  [%s] audio FIFO overruns: %" PRIu64 " (limit %d, most at %s), underruns: %" PRIu64,
+        overrunsOk ? "ok" : "FAIL",
+        results_.numOverruns, CONFIG_EZDV_SOAK_TEST_MAX_FIFO_OVERRUNS, 
+        results_.worstOverrunCount > 0 ? results_.worstOverrunLink : "none", results_.numUnderruns);
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "  [%s] packet loss: %" PRIu64 " of %" PRIu64 " (%" PRIu32 " ppm, limit %d)",
+        lossOk ? "ok" : "FAIL",
+        results_.numPacketsLost, totalPackets, lossPpm, CONFIG_EZDV_SOAK_TEST_MAX_PACKET_LOSS_PPM);
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "  [%s] minimum free heap: %" PRIu32 " internal (limit %d), %" PRIu32 " SPIRAM",
+        heapOk ? "ok" : "FAIL",
+        results_.minInternalHeapBytes, CONFIG_EZDV_SOAK_TEST_MIN_FREE_INTERNAL_HEAP, results_.minSpiramHeapBytes);
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "  [%s] minimum free stack: %" PRIu32 " bytes in %s (limit %d)",
+        stackOk ? "ok" : "FAIL",
+        results_.minStackBytes == UINT32_MAX ? 0 : results_.minStackBytes, 
+        results_.minStackBytes == UINT32_MAX ? "none" : results_.minStackTask, 
+        CONFIG_EZDV_SOAK_TEST_MIN_FREE_STACK);
+
+    if (final)
+    {
+        // Meant to be matched by whatever is watching the console.
+        if (passed)
+        {
+            ESP_LOGI(CURRENT_LOG_TAG, "SOAK TEST PASSED");
+        }
+        else
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "SOAK TEST FAILED");
+        }
+    }
+}
+
+}
+
+}
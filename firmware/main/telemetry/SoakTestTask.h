@@ -0,0 +1,95 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOAK_TEST_TASK_H
+#define SOAK_TEST_TASK_H
+
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+#include "audio/FreeDVMessage.h"
+#include "TelemetryMessage.h"
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+using namespace ezdv::task;
+
+/// @brief Exercises ezDV for hours at a time by cycling through every FreeDV
+///        mode, alternating RX and TX in each, as if the buttons were being 
+///        pressed. Late modem frames, audio FIFO overruns and underruns, 
+///        packet loss, heap and stack minimums are gathered from 
+///        TelemetryTask along the way and checked against the 
+///        CONFIG_EZDV_SOAK_TEST_* thresholds. A summary is logged after 
+///        every pass through the modes and a final PASS/FAIL once the test
+///        duration is up.
+class SoakTestTask : public DVTask
+{
+public:
+    SoakTestTask();
+    virtual ~SoakTestTask() = default;
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    struct Results
+    {
+        uint64_t numFrames;
+        uint64_t numLateFrames;
+        uint64_t numLateFramesByMode[audio::MAX_FREEDV_MODES];
+        int32_t worstMarginUs;
+        uint64_t numOverruns;
+        uint64_t numUnderruns;
+        char worstOverrunLink[configMAX_TASK_NAME_LEN];
+        uint32_t worstOverrunCount;
+        uint64_t numPacketsReceived;
+        uint64_t numPacketsLost;
+        uint32_t minStackBytes;
+        char minStackTask[configMAX_TASK_NAME_LEN];
+        uint32_t minInternalHeapBytes;
+        uint32_t minSpiramHeapBytes;
+    };
+
+    DVTimer stepTimer_;
+    DVTimer sampleTimer_;
+
+    int64_t startTimeUs_;
+    int64_t lastSampleTimeUs_;
+    bool isRunning_;
+    bool isFinishing_; // waiting for the last telemetry before the final report
+    int step_;
+    int numPasses_;
+    Results results_;
+
+    void onStepTimer_(DVTimer*);
+    void onSampleTimer_(DVTimer*);
+    void onTelemetryReportMessage_(DVTask* origin, TelemetryReportMessage* message);
+
+    void setPtt_(bool ptt);
+    void accumulate_(const TelemetrySample& sample);
+    void report_(bool final);
+};
+
+}
+
+}
+
+#endif // SOAK_TEST_TASK_H
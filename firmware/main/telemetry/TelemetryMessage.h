@@ -0,0 +1,214 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_MESSAGE_H
+#define TELEMETRY_MESSAGE_H
+
+#include "freertos/FreeRTOS.h"
+#include "esp_http_server.h"
+#include "task/DVTaskMessage.h"
+
+// Maximum number of tasks tracked per sample.
+#define TELEMETRY_MAX_TASKS (32)
+
+// Maximum number of audio links tracked per sample.
+#define TELEMETRY_MAX_AUDIO_LINKS (16)
+
+// Maximum number of modem profiles (task/mode pairs) tracked per sample.
+#define TELEMETRY_MAX_MODEM_PROFILES (8)
+
+// Must match audio::ModemProfiler::NUM_HISTOGRAM_BUCKETS.
+#define TELEMETRY_MODEM_HISTOGRAM_BUCKETS (11)
+
+// Must match network::NetworkQos::NUM_STREAM_TYPES.
+#define TELEMETRY_NETWORK_STREAMS (5)
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(TELEMETRY_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+using namespace ezdv::task;
+
+enum TelemetryMessageTypes
+{
+    REQUEST_TELEMETRY = 1,
+    TELEMETRY_REPORT = 2,
+    RENDER_METRICS = 3,
+    LOAD_SHEDDING = 4,
+};
+
+enum TelemetryHeapType
+{
+    HEAP_INTERNAL,
+    HEAP_SPIRAM,
+    HEAP_DMA,
+
+    NUM_HEAP_TYPES
+};
+
+struct TelemetryTaskSample
+{
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t cpuPercent; // of a single core
+    int8_t coreId; // -1 if not pinned
+    uint16_t stackHighWaterMark; // in bytes
+};
+
+struct TelemetryHeapSample
+{
+    uint32_t freeBytes;
+    uint32_t largestFreeBlock;
+};
+
+struct TelemetryAudioLinkSample
+{
+    char sinkName[configMAX_TASK_NAME_LEN];
+    char sourceName[configMAX_TASK_NAME_LEN]; // empty if not connected
+    uint8_t sinkChannel;
+    uint16_t minUsed; // in samples
+    uint16_t maxUsed;
+    uint16_t averageUsed;
+    uint32_t numUnderruns;
+    uint32_t numOverruns;
+    uint32_t numSamplesDropped;
+};
+
+struct TelemetryModemSample
+{
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t mode; // FreeDVMode
+    uint32_t numFrames;
+    uint32_t averageUs;
+    uint32_t worstUs;
+    int32_t worstMarginUs; // negative if a frame took longer than its period
+    uint32_t numLate;
+    uint32_t histogram[TELEMETRY_MODEM_HISTOGRAM_BUCKETS]; // 10% of the frame period per bucket
+    uint32_t maxOutputLeadUs;
+    uint32_t numDeferred;
+};
+
+struct TelemetryNetworkSample
+{
+    uint32_t numSent;
+    uint32_t numSendFailures;
+    uint32_t numSendRetries;
+    uint32_t numReceived;
+    uint32_t numLost;
+    uint32_t numOutOfOrder;
+    uint32_t jitterUs;
+    uint32_t maxJitterUs;
+    uint32_t rttUs; // 0 if the stream has no pings
+    uint32_t maxRttUs;
+};
+
+struct TelemetrySample
+{
+    int64_t timestampUs;
+    uint8_t idlePercent[portNUM_PROCESSORS];
+    TelemetryHeapSample heap[NUM_HEAP_TYPES];
+    uint8_t numTasks;
+    TelemetryTaskSample tasks[TELEMETRY_MAX_TASKS];
+    uint8_t numAudioLinks;
+    TelemetryAudioLinkSample audioLinks[TELEMETRY_MAX_AUDIO_LINKS];
+    uint8_t numModemProfiles;
+    TelemetryModemSample modemProfiles[TELEMETRY_MAX_MODEM_PROFILES];
+    TelemetryNetworkSample network[TELEMETRY_NETWORK_STREAMS]; // indexed by NetworkQos::StreamType
+    uint32_t wakeupsPerSecond; // across all DVTasks
+    int16_t batteryCurrentMa; // estimated from the fuel gauge; positive while discharging
+    bool batteryCurrentValid; // false until the fuel gauge reports
+};
+
+/// @brief Copy of the telemetry history, oldest sample first.
+struct TelemetrySnapshot
+{
+    uint32_t numSamples;
+    TelemetrySample samples[]; // numSamples entries follow
+};
+
+class RequestTelemetryMessage : public DVTaskMessageBase<REQUEST_TELEMETRY, RequestTelemetryMessage>
+{
+public:
+    RequestTelemetryMessage(int fdProvided = 0)
+        : DVTaskMessageBase<REQUEST_TELEMETRY, RequestTelemetryMessage>(TELEMETRY_MESSAGE)
+        , fd(fdProvided)
+        {}
+    virtual ~RequestTelemetryMessage() = default;
+
+    int fd; // passed back in the report
+};
+
+class TelemetryReportMessage : public DVTaskMessageBase<TELEMETRY_REPORT, TelemetryReportMessage>
+{
+public:
+    TelemetryReportMessage(int fdProvided = 0, TelemetrySnapshot* snapshotProvided = nullptr)
+        : DVTaskMessageBase<TELEMETRY_REPORT, TelemetryReportMessage>(TELEMETRY_MESSAGE)
+        , fd(fdProvided)
+        , snapshot(snapshotProvided)
+        {}
+    virtual ~TelemetryReportMessage() = default;
+
+    int fd;
+    TelemetrySnapshot* snapshot; // receiver must free using heap_caps_free()
+};
+
+class RenderMetricsMessage : public DVTaskMessageBase<RENDER_METRICS, RenderMetricsMessage>
+{
+public:
+    RenderMetricsMessage(httpd_req_t* requestProvided = nullptr)
+        : DVTaskMessageBase<RENDER_METRICS, RenderMetricsMessage>(TELEMETRY_MESSAGE)
+        , request(requestProvided)
+        {}
+    virtual ~RenderMetricsMessage() = default;
+
+    httpd_req_t* request; // async request; completed by TelemetryTask
+};
+
+class LoadSheddingMessage : public DVTaskMessageBase<LOAD_SHEDDING, LoadSheddingMessage>
+{
+public:
+    // Each level also includes everything shed by the ones below it.
+    enum SheddingLevel
+    {
+        SHED_NONE,
+        SHED_BACKGROUND, // LED animations, reporter batching, Wi-Fi scan rate
+        SHED_SPECTRUM_RATE, // web UI spectrum/waterfall updates less often
+        SHED_SPECTRUM, // no spectrum at all
+
+        NUM_SHEDDING_LEVELS
+    };
+
+    LoadSheddingMessage(SheddingLevel levelProvided = SHED_NONE)
+        : DVTaskMessageBase<LOAD_SHEDDING, LoadSheddingMessage>(TELEMETRY_MESSAGE)
+        , level(levelProvided)
+        {}
+    virtual ~LoadSheddingMessage() = default;
+
+    SheddingLevel level;
+};
+
+}
+
+}
+
+#endif // TELEMETRY_MESSAGE_H
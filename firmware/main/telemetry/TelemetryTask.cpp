@@ -0,0 +1,958 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+
+#if CONFIG_EZDV_ENABLE_TELEMETRY
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+
+#include "TelemetryTask.h"
+#include "MetricsWriter.h"
+#include "task/DVTaskSchedulingProfile.h"
+#include "audio/AudioGraph.h"
+#include "audio/ModemProfiler.h"
+#include "network/NetworkQos.h"
+#include "util/AllocationProfiler.h"
+#include "util/DeadlineMonitor.h"
+#include "util/MemoryPlacement.h"
+#include "util/TaskWatermarks.h"
+
+#define CURRENT_LOG_TAG ("TelemetryTask")
+
+// Extra room in case tasks get created between counting and retrieving them.
+#define TASK_STATUS_ARRAY_EXTRA (5)
+
+// Large enough for any label list we generate.
+#define METRICS_LABELS_SIZE (96)
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+TelemetryTask::TelemetryTask()
+    : DVTask("TelemetryTask", 2, 8192, tskNO_AFFINITY, 10, pdMS_TO_TICKS(CONFIG_EZDV_TELEMETRY_INTERVAL))
+    , samples_(nullptr)
+    , numSamples_(0)
+    , nextSampleIndex_(0)
+    , previousTaskStatus_(nullptr)
+    , previousTaskStatusCount_(0)
+    , previousTotalRunTime_(0)
+    , previousNumWakeups_(0)
+    , previousWakeupTimeUs_(0)
+    , socChangeRate_(0)
+    , hasBatteryState_(false)
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    , samplesSinceAllocationReport_(0)
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+#if CONFIG_EZDV_METRICS_ENDPOINT
+    , numAudioLinkTotals_(0)
+    , numModemTotals_(0)
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+{
+    // History is only read occasionally, so it can live in SPIRAM.
+    samples_ = (TelemetrySample*)heap_caps_calloc(CONFIG_EZDV_TELEMETRY_NUM_SAMPLES, sizeof(TelemetrySample), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(samples_ != nullptr);
+
+    registerMessageHandlers<
+        &TelemetryTask::onRequestTelemetryMessage_,
+        &TelemetryTask::onBatteryStateMessage_>(this);
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+    memset(audioLinkTotals_, 0, sizeof(audioLinkTotals_));
+    memset(modemTotals_, 0, sizeof(modemTotals_));
+    memset(networkTotals_, 0, sizeof(networkTotals_));
+
+    registerMessageHandlers<&TelemetryTask::onRenderMetricsMessage_>(this);
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+}
+
+TelemetryTask::~TelemetryTask()
+{
+    heap_caps_free(samples_);
+    heap_caps_free(previousTaskStatus_);
+}
+
+void TelemetryTask::onTaskStart_()
+{
+    numSamples_ = 0;
+    nextSampleIndex_ = 0;
+
+    // Establish the baseline for CPU usage calculations.
+    TelemetrySample baseline;
+    takeSample_(baseline);
+}
+
+void TelemetryTask::onTaskSleep_()
+{
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    // Don't leave anything shed while we're not watching.
+    if (loadGovernor_.getLevel() != LoadSheddingMessage::SHED_NONE)
+    {
+        loadGovernor_.reset();
+
+        LoadSheddingMessage message(LoadSheddingMessage::SHED_NONE);
+        publish(&message);
+    }
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+#if CONFIG_EZDV_TASK_WATERMARKS
+    util::TaskWatermarks::Save(true);
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+
+    heap_caps_free(previousTaskStatus_);
+    previousTaskStatus_ = nullptr;
+    previousTaskStatusCount_ = 0;
+}
+
+void TelemetryTask::onTaskTick_()
+{
+    TelemetrySample& sample = samples_[nextSampleIndex_];
+    takeSample_(sample);
+
+    // Lets tasks being started go wherever there's the most headroom.
+    if (sample.numTasks > 0)
+    {
+        DVTaskSchedulingProfile::ReportCoreIdle(sample.idlePercent);
+    }
+
+#if CONFIG_EZDV_TASK_WATERMARKS
+    util::TaskWatermarks::Save();
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    if (loadGovernor_.update(sample))
+    {
+        LoadSheddingMessage message(loadGovernor_.getLevel());
+        publish(&message);
+    }
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+    util::DeadlineMonitor::LogPendingContext();
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
+
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    if (++samplesSinceAllocationReport_ >= CONFIG_EZDV_ALLOCATION_PROFILER_REPORT_SAMPLES)
+    {
+        samplesSinceAllocationReport_ = 0;
+        util::AllocationProfiler::Report();
+    }
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+
+    nextSampleIndex_ = (nextSampleIndex_ + 1) % CONFIG_EZDV_TELEMETRY_NUM_SAMPLES;
+    if (numSamples_ < CONFIG_EZDV_TELEMETRY_NUM_SAMPLES)
+    {
+        numSamples_++;
+    }
+
+    ESP_LOGD(
+        CURRENT_LOG_TAG, 
+        "idle: %d%%/%d%%, internal free: %" PRIu32 " (largest %" PRIu32 "), SPIRAM free: %" PRIu32 " (largest %" PRIu32 ")",
+        sample.idlePercent[0],
+        sample.idlePercent[portNUM_PROCESSORS - 1],
+        sample.heap[HEAP_INTERNAL].freeBytes,
+        sample.heap[HEAP_INTERNAL].largestFreeBlock,
+        sample.heap[HEAP_SPIRAM].freeBytes,
+        sample.heap[HEAP_SPIRAM].largestFreeBlock);
+}
+
+void TelemetryTask::onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message)
+{
+    socChangeRate_ = message->socChangeRate;
+    hasBatteryState_ = true;
+}
+
+static void SumWakeups_(DVTask* task, void* arg)
+{
+    DVTask::QueueStatistics stats;
+    task->getQueueStatistics(stats);
+    *(uint32_t*)arg += stats.numWakeups;
+}
+
+void TelemetryTask::takeSample_(TelemetrySample& sample)
+{
+    memset(&sample, 0, sizeof(TelemetrySample));
+    sample.timestampUs = esp_timer_get_time();
+
+    // Wakeups and (estimated) battery current, for judging power savings.
+    // The MAX17048 has no current sense; its charge rate (%/hr) is scaled
+    // by the battery capacity instead.
+    uint32_t numWakeups = 0;
+    DVTask::ForEachTask(&SumWakeups_, &numWakeups);
+    if (previousWakeupTimeUs_ > 0 && sample.timestampUs > previousWakeupTimeUs_)
+    {
+        sample.wakeupsPerSecond = 
+            (uint64_t)(numWakeups - previousNumWakeups_) * 1000000 / (sample.timestampUs - previousWakeupTimeUs_);
+    }
+    previousNumWakeups_ = numWakeups;
+    previousWakeupTimeUs_ = sample.timestampUs;
+
+    sample.batteryCurrentValid = hasBatteryState_;
+    sample.batteryCurrentMa = -socChangeRate_ * CONFIG_EZDV_BATTERY_CAPACITY_MAH / 100;
+
+    // Heap usage
+    const uint32_t heapCaps[NUM_HEAP_TYPES] = { MALLOC_CAP_INTERNAL, MALLOC_CAP_SPIRAM, MALLOC_CAP_DMA };
+    for (int heapType = 0; heapType < NUM_HEAP_TYPES; heapType++)
+    {
+        sample.heap[heapType].freeBytes = heap_caps_get_free_size(heapCaps[heapType]);
+        sample.heap[heapType].largestFreeBlock = heap_caps_get_largest_free_block(heapCaps[heapType]);
+    }
+
+    // Audio link usage. Statistics are reset each time so that min/max
+    // reflect only the last interval.
+    audio::AudioLinkStatistics links[TELEMETRY_MAX_AUDIO_LINKS];
+    int numLinks = audio::AudioGraph::GetLinkStatistics(links, TELEMETRY_MAX_AUDIO_LINKS, true);
+    for (int index = 0; index < numLinks; index++)
+    {
+        TelemetryAudioLinkSample& linkSample = sample.audioLinks[sample.numAudioLinks++];
+        audio::AudioRingBuffer::Statistics& stats = links[index].statistics;
+
+        strncpy(linkSample.sinkName, links[index].sinkName, configMAX_TASK_NAME_LEN - 1);
+        if (links[index].sourceName != nullptr)
+        {
+            strncpy(linkSample.sourceName, links[index].sourceName, configMAX_TASK_NAME_LEN - 1);
+        }
+        linkSample.sinkChannel = links[index].sinkChannel;
+        linkSample.minUsed = stats.minUsed > UINT16_MAX ? UINT16_MAX : stats.minUsed;
+        linkSample.maxUsed = stats.maxUsed > UINT16_MAX ? UINT16_MAX : stats.maxUsed;
+        linkSample.averageUsed = stats.averageUsed > UINT16_MAX ? UINT16_MAX : stats.averageUsed;
+        linkSample.numUnderruns = stats.numUnderruns;
+        linkSample.numOverruns = stats.numOverruns;
+        linkSample.numSamplesDropped = stats.numSamplesDropped;
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+        AudioLinkTotals* linkTotals = getAudioLinkTotals_(links[index].sinkName, links[index].sinkChannel);
+        if (linkTotals != nullptr)
+        {
+            linkTotals->numUnderruns += stats.numUnderruns;
+            linkTotals->numOverruns += stats.numOverruns;
+            linkTotals->numSamplesDropped += stats.numSamplesDropped;
+        }
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+
+        if (stats.numUnderruns > 0 || stats.numOverruns > 0)
+        {
+            ESP_LOGD(
+                CURRENT_LOG_TAG,
+                "audio link %s -> %s/%d: %" PRIu32 " underruns, %" PRIu32 " overruns (%" PRIu32 " samples dropped), fill %" PRIu32 "-%" PRIu32 " (avg %" PRIu32 ")",
+                links[index].sourceName != nullptr ? links[index].sourceName : "(none)",
+                links[index].sinkName,
+                (int)links[index].sinkChannel,
+                stats.numUnderruns,
+                stats.numOverruns,
+                stats.numSamplesDropped,
+                stats.minUsed,
+                stats.maxUsed,
+                stats.averageUsed);
+        }
+    }
+
+    // Modem timing, also reset each time.
+    static_assert(
+        TELEMETRY_MODEM_HISTOGRAM_BUCKETS == audio::ModemProfiler::NUM_HISTOGRAM_BUCKETS, 
+        "Modem histogram sizes must match");
+    audio::ModemProfiler::Statistics modemStats[TELEMETRY_MAX_MODEM_PROFILES];
+    audio::FreeDVMode modemModes[TELEMETRY_MAX_MODEM_PROFILES];
+    const char* modemNames[TELEMETRY_MAX_MODEM_PROFILES];
+    int numModemProfiles = audio::ModemProfiler::GetStatistics(
+        modemStats, modemModes, modemNames, TELEMETRY_MAX_MODEM_PROFILES, true);
+    for (int index = 0; index < numModemProfiles; index++)
+    {
+        TelemetryModemSample& modemSample = sample.modemProfiles[sample.numModemProfiles++];
+        audio::ModemProfiler::Statistics& stats = modemStats[index];
+
+        strncpy(modemSample.name, modemNames[index], configMAX_TASK_NAME_LEN - 1);
+        modemSample.mode = modemModes[index];
+        modemSample.numFrames = stats.numFrames;
+        modemSample.averageUs = stats.averageUs;
+        modemSample.worstUs = stats.worstUs;
+        modemSample.worstMarginUs = stats.worstMarginUs;
+        modemSample.numLate = stats.numLate;
+        memcpy(modemSample.histogram, stats.histogram, sizeof(modemSample.histogram));
+        modemSample.maxOutputLeadUs = stats.maxOutputLeadUs;
+        modemSample.numDeferred = stats.numDeferred;
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+        ModemTotals* modemTotals = getModemTotals_(modemNames[index], modemModes[index]);
+        if (modemTotals != nullptr)
+        {
+            modemTotals->numFrames += stats.numFrames;
+            modemTotals->totalUs += (uint64_t)stats.averageUs * stats.numFrames;
+            modemTotals->numLate += stats.numLate;
+            modemTotals->numDeferred += stats.numDeferred;
+        }
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+
+        if (stats.numLate > 0)
+        {
+            ESP_LOGD(
+                CURRENT_LOG_TAG,
+                "%s mode %d: %" PRIu32 " of %" PRIu32 " frames late (worst %" PRIu32 " us, margin %" PRId32 " us)",
+                modemNames[index],
+                (int)modemModes[index],
+                stats.numLate,
+                stats.numFrames,
+                stats.worstUs,
+                stats.worstMarginUs);
+        }
+    }
+
+    // Network stream loss and jitter, also reset each time.
+    static_assert(
+        TELEMETRY_NETWORK_STREAMS == network::NetworkQos::NUM_STREAM_TYPES, 
+        "Network stream counts must match");
+    for (int stream = 0; stream < TELEMETRY_NETWORK_STREAMS; stream++)
+    {
+        network::NetworkQos::Statistics stats;
+        network::NetworkQos::GetStatistics((network::NetworkQos::StreamType)stream, stats, true);
+
+        TelemetryNetworkSample& networkSample = sample.network[stream];
+        networkSample.numSent = stats.numSent;
+        networkSample.numSendFailures = stats.numSendFailures;
+        networkSample.numSendRetries = stats.numSendRetries;
+        networkSample.numReceived = stats.numReceived;
+        networkSample.numLost = stats.numLost;
+        networkSample.numOutOfOrder = stats.numOutOfOrder;
+        networkSample.jitterUs = stats.jitterUs;
+        networkSample.maxJitterUs = stats.maxJitterUs;
+        networkSample.rttUs = stats.rttUs;
+        networkSample.maxRttUs = stats.maxRttUs;
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+        NetworkTotals& networkTotals = networkTotals_[stream];
+        networkTotals.numSent += stats.numSent;
+        networkTotals.numSendFailures += stats.numSendFailures;
+        networkTotals.numReceived += stats.numReceived;
+        networkTotals.numLost += stats.numLost;
+        networkTotals.numRetransmitRequests += stats.numRetransmitRequests;
+        networkTotals.numRetransmits += stats.numRetransmits;
+        networkTotals.numSendRetries += stats.numSendRetries;
+        networkTotals.numOutOfOrder += stats.numOutOfOrder;
+        for (int bucket = 0; bucket < network::NetworkQos::NUM_HISTOGRAM_BUCKETS; bucket++)
+        {
+            networkTotals.deviationHistogram[bucket] += stats.deviationHistogram[bucket];
+            networkTotals.rttHistogram[bucket] += stats.rttHistogram[bucket];
+        }
+        networkTotals.deviationSumUs += stats.deviationSumUs;
+        networkTotals.rttSumUs += stats.rttSumUs;
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+
+        if (stats.numSendFailures > 0 || stats.numLost > 0 || stats.numOutOfOrder > 0)
+        {
+            ESP_LOGD(
+                CURRENT_LOG_TAG,
+                "%s: %" PRIu32 " of %" PRIu32 " sends failed (%" PRIu32 " retries), %" PRIu32 " lost and %" PRIu32 " out of order of %" PRIu32 " received, jitter %" PRIu32 " us (max %" PRIu32 ")",
+                network::NetworkQos::GetStreamName((network::NetworkQos::StreamType)stream),
+                stats.numSendFailures,
+                stats.numSent + stats.numSendFailures,
+                stats.numSendRetries,
+                stats.numLost,
+                stats.numOutOfOrder,
+                stats.numReceived,
+                stats.jitterUs,
+                stats.maxJitterUs);
+        }
+    }
+
+    // Task usage. Run time counters only make sense relative to the 
+    // previous sample, so we need to hold onto those.
+    UBaseType_t taskStatusSize = uxTaskGetNumberOfTasks() + TASK_STATUS_ARRAY_EXTRA;
+    TaskStatus_t* taskStatus = (TaskStatus_t*)heap_caps_malloc(sizeof(TaskStatus_t) * taskStatusSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    if (taskStatus == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not allocate memory for task status");
+        return;
+    }
+
+    configRUN_TIME_COUNTER_TYPE totalRunTime = 0;
+    taskStatusSize = uxTaskGetSystemState(taskStatus, taskStatusSize, &totalRunTime);
+
+    configRUN_TIME_COUNTER_TYPE elapsedRunTime = totalRunTime - previousTotalRunTime_;
+    if (previousTaskStatus_ != nullptr && elapsedRunTime > 0)
+    {
+        TaskHandle_t idleTasks[portNUM_PROCESSORS];
+        for (int core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            idleTasks[core] = xTaskGetIdleTaskHandleForCore(core);
+        }
+
+        for (UBaseType_t index = 0; index < taskStatusSize; index++)
+        {
+            TaskStatus_t& current = taskStatus[index];
+
+            // Tasks created since the last sample are counted starting now.
+            configRUN_TIME_COUNTER_TYPE previousRunTime = current.ulRunTimeCounter;
+            for (UBaseType_t previousIndex = 0; previousIndex < previousTaskStatusCount_; previousIndex++)
+            {
+                if (previousTaskStatus_[previousIndex].xHandle == current.xHandle)
+                {
+                    previousRunTime = previousTaskStatus_[previousIndex].ulRunTimeCounter;
+                    break;
+                }
+            }
+
+            uint64_t percent = ((uint64_t)(current.ulRunTimeCounter - previousRunTime) * 100) / elapsedRunTime;
+            if (percent > 100)
+            {
+                percent = 100;
+            }
+
+            for (int core = 0; core < portNUM_PROCESSORS; core++)
+            {
+                if (current.xHandle == idleTasks[core])
+                {
+                    sample.idlePercent[core] = percent;
+                }
+            }
+
+            if (sample.numTasks < TELEMETRY_MAX_TASKS)
+            {
+                TelemetryTaskSample& taskSample = sample.tasks[sample.numTasks++];
+                strncpy(taskSample.name, current.pcTaskName, configMAX_TASK_NAME_LEN - 1);
+                taskSample.cpuPercent = percent;
+
+                BaseType_t coreId = xTaskGetCoreID(current.xHandle);
+                taskSample.coreId = (coreId == tskNO_AFFINITY) ? -1 : coreId;
+                taskSample.stackHighWaterMark = current.usStackHighWaterMark > UINT16_MAX ? UINT16_MAX : current.usStackHighWaterMark;
+            }
+        }
+    }
+
+    heap_caps_free(previousTaskStatus_);
+    previousTaskStatus_ = taskStatus;
+    previousTaskStatusCount_ = taskStatusSize;
+    previousTotalRunTime_ = totalRunTime;
+}
+
+void TelemetryTask::onRequestTelemetryMessage_(DVTask* origin, RequestTelemetryMessage* message)
+{
+    if (origin == nullptr)
+    {
+        // Nowhere to send the report.
+        return;
+    }
+
+    TelemetrySnapshot* snapshot = (TelemetrySnapshot*)heap_caps_malloc(
+        sizeof(TelemetrySnapshot) + numSamples_ * sizeof(TelemetrySample), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    if (snapshot == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not allocate memory for telemetry snapshot");
+        return;
+    }
+
+    // Oldest sample first.
+    snapshot->numSamples = numSamples_;
+    int firstIndex = (numSamples_ < CONFIG_EZDV_TELEMETRY_NUM_SAMPLES) ? 0 : nextSampleIndex_;
+    for (int index = 0; index < numSamples_; index++)
+    {
+        memcpy(&snapshot->samples[index], &samples_[(firstIndex + index) % CONFIG_EZDV_TELEMETRY_NUM_SAMPLES], sizeof(TelemetrySample));
+    }
+
+    TelemetryReportMessage response(message->fd, snapshot);
+    sendTo(origin, &response);
+}
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+TelemetryTask::AudioLinkTotals* TelemetryTask::getAudioLinkTotals_(const char* sinkName, uint8_t sinkChannel)
+{
+    for (int index = 0; index < numAudioLinkTotals_; index++)
+    {
+        AudioLinkTotals& totals = audioLinkTotals_[index];
+        if (totals.sinkChannel == sinkChannel && !strncmp(totals.sinkName, sinkName, configMAX_TASK_NAME_LEN - 1))
+        {
+            return &totals;
+        }
+    }
+
+    if (numAudioLinkTotals_ == TELEMETRY_MAX_AUDIO_LINKS)
+    {
+        return nullptr;
+    }
+
+    AudioLinkTotals& totals = audioLinkTotals_[numAudioLinkTotals_++];
+    strncpy(totals.sinkName, sinkName, configMAX_TASK_NAME_LEN - 1);
+    totals.sinkChannel = sinkChannel;
+    return &totals;
+}
+
+TelemetryTask::ModemTotals* TelemetryTask::getModemTotals_(const char* name, uint8_t mode)
+{
+    for (int index = 0; index < numModemTotals_; index++)
+    {
+        ModemTotals& totals = modemTotals_[index];
+        if (totals.mode == mode && !strncmp(totals.name, name, configMAX_TASK_NAME_LEN - 1))
+        {
+            return &totals;
+        }
+    }
+
+    if (numModemTotals_ == TELEMETRY_MAX_MODEM_PROFILES)
+    {
+        return nullptr;
+    }
+
+    ModemTotals& totals = modemTotals_[numModemTotals_++];
+    strncpy(totals.name, name, configMAX_TASK_NAME_LEN - 1);
+    totals.mode = mode;
+    return &totals;
+}
+
+namespace
+{
+
+enum TaskMetric
+{
+    TASK_QUEUE_DEPTH,
+    TASK_QUEUE_CAPACITY,
+    TASK_QUEUE_HIGH_WATER_MARK,
+    TASK_MESSAGES,
+    TASK_QUEUE_WAIT,
+    TASK_HANDLER_TIME,
+    TASK_OVERFLOWS,
+    TASK_WAKEUPS,
+};
+
+struct TaskMetricContext
+{
+    MetricsWriter* writer;
+    TaskMetric metric;
+};
+
+void WriteTaskMetric_(DVTask* task, void* arg)
+{
+    auto context = (TaskMetricContext*)arg;
+    char labels[METRICS_LABELS_SIZE];
+    snprintf(labels, sizeof(labels), "task=\"%s\"", task->getTaskName());
+
+    DVTask::QueueStatistics stats;
+    task->getQueueStatistics(stats);
+
+    switch (context->metric)
+    {
+        case TASK_QUEUE_DEPTH:
+            context->writer->writeValue(labels, stats.depth);
+            break;
+        case TASK_QUEUE_CAPACITY:
+            context->writer->writeValue(labels, stats.capacity);
+            break;
+        case TASK_QUEUE_HIGH_WATER_MARK:
+            context->writer->writeValue(labels, stats.highWaterMark);
+            break;
+        case TASK_MESSAGES:
+            context->writer->writeValue(labels, stats.numMessages);
+            break;
+        case TASK_QUEUE_WAIT:
+            context->writer->writeSeconds(labels, stats.totalQueueWaitUs);
+            break;
+        case TASK_HANDLER_TIME:
+            context->writer->writeSeconds(labels, stats.totalHandlerUs);
+            break;
+        case TASK_WAKEUPS:
+            context->writer->writeValue(labels, stats.numWakeups);
+            break;
+        case TASK_OVERFLOWS:
+        {
+            DVTask::OverflowStatistics overflows;
+            task->getOverflowStatistics(overflows);
+
+            const char* actions[] = { "blocked", "block_timeout", "dropped_newest", "dropped_oldest", "coalesced" };
+            const uint32_t counts[] = { overflows.blocked, overflows.blockTimeouts, overflows.droppedNewest, overflows.droppedOldest, overflows.coalesced };
+            for (int index = 0; index < 5; index++)
+            {
+                snprintf(labels, sizeof(labels), "task=\"%s\",action=\"%s\"", task->getTaskName(), actions[index]);
+                context->writer->writeValue(labels, counts[index]);
+            }
+            break;
+        }
+    }
+}
+
+}
+
+void TelemetryTask::onRenderMetricsMessage_(DVTask* origin, RenderMetricsMessage* message)
+{
+    MetricsWriter writer(message->request);
+    char labels[METRICS_LABELS_SIZE];
+
+    writer.beginMetric("ezdv_uptime_seconds", "counter", "Time since boot.");
+    writer.writeSeconds(nullptr, esp_timer_get_time());
+
+    // Heap
+    const char* heapNames[NUM_HEAP_TYPES] = { "internal", "spiram", "dma" };
+    const uint32_t heapCaps[NUM_HEAP_TYPES] = { MALLOC_CAP_INTERNAL, MALLOC_CAP_SPIRAM, MALLOC_CAP_DMA };
+    writer.beginMetric("ezdv_heap_free_bytes", "gauge", "Free heap memory.");
+    for (int heapType = 0; heapType < NUM_HEAP_TYPES; heapType++)
+    {
+        snprintf(labels, sizeof(labels), "heap=\"%s\"", heapNames[heapType]);
+        writer.writeValue(labels, heap_caps_get_free_size(heapCaps[heapType]));
+    }
+    writer.beginMetric("ezdv_heap_minimum_free_bytes", "gauge", "Least free heap memory since boot.");
+    for (int heapType = 0; heapType < NUM_HEAP_TYPES; heapType++)
+    {
+        snprintf(labels, sizeof(labels), "heap=\"%s\"", heapNames[heapType]);
+        writer.writeValue(labels, heap_caps_get_minimum_free_size(heapCaps[heapType]));
+    }
+    writer.beginMetric("ezdv_heap_largest_free_block_bytes", "gauge", "Largest free heap block.");
+    for (int heapType = 0; heapType < NUM_HEAP_TYPES; heapType++)
+    {
+        snprintf(labels, sizeof(labels), "heap=\"%s\"", heapNames[heapType]);
+        writer.writeValue(labels, heap_caps_get_largest_free_block(heapCaps[heapType]));
+    }
+
+    // Memory placement classes
+    writer.beginMetric("ezdv_memory_class_bytes", "gauge", "Heap memory in use per placement class.");
+    for (int memoryClass = 0; memoryClass < util::MemoryPlacement::NUM_MEMORY_CLASSES; memoryClass++)
+    {
+        util::MemoryPlacement::Statistics placementStats;
+        util::MemoryPlacement::GetStatistics((util::MemoryPlacement::MemoryClass)memoryClass, placementStats);
+        const char* className = util::MemoryPlacement::GetName((util::MemoryPlacement::MemoryClass)memoryClass);
+
+        snprintf(labels, sizeof(labels), "class=\"%s\",heap=\"internal\"", className);
+        writer.writeValue(labels, placementStats.internalBytes);
+        snprintf(labels, sizeof(labels), "class=\"%s\",heap=\"spiram\"", className);
+        writer.writeValue(labels, placementStats.spiramBytes);
+    }
+    writer.beginMetric("ezdv_memory_class_fallbacks_total", "counter", "Internal RAM allocations that fell back to SPIRAM.");
+    for (int memoryClass = 0; memoryClass < util::MemoryPlacement::NUM_MEMORY_CLASSES; memoryClass++)
+    {
+        util::MemoryPlacement::Statistics placementStats;
+        util::MemoryPlacement::GetStatistics((util::MemoryPlacement::MemoryClass)memoryClass, placementStats);
+
+        snprintf(labels, sizeof(labels), "class=\"%s\"", util::MemoryPlacement::GetName((util::MemoryPlacement::MemoryClass)memoryClass));
+        writer.writeValue(labels, placementStats.numFallbacks);
+    }
+
+    // Wi-Fi (only available when connected to an access point)
+    wifi_ap_record_t apInfo;
+    if (esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK)
+    {
+        writer.beginMetric("ezdv_wifi_rssi_dbm", "gauge", "Signal strength of the access point we're connected to.");
+        writer.writeSignedValue(nullptr, apInfo.rssi);
+    }
+
+    // CPU and stack usage as of the last sample
+    if (numSamples_ > 0)
+    {
+        TelemetrySample& sample = samples_[(nextSampleIndex_ + CONFIG_EZDV_TELEMETRY_NUM_SAMPLES - 1) % CONFIG_EZDV_TELEMETRY_NUM_SAMPLES];
+
+        writer.beginMetric("ezdv_cpu_idle_percent", "gauge", "Idle time per core over the last telemetry interval.");
+        for (int core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            snprintf(labels, sizeof(labels), "core=\"%d\"", core);
+            writer.writeValue(labels, sample.idlePercent[core]);
+        }
+
+        writer.beginMetric("ezdv_task_cpu_percent", "gauge", "CPU usage per task over the last telemetry interval.");
+        for (int index = 0; index < sample.numTasks; index++)
+        {
+            snprintf(labels, sizeof(labels), "task=\"%s\"", sample.tasks[index].name);
+            writer.writeValue(labels, sample.tasks[index].cpuPercent);
+        }
+
+        writer.beginMetric("ezdv_task_stack_free_bytes", "gauge", "Least free stack space seen per task.");
+        for (int index = 0; index < sample.numTasks; index++)
+        {
+            snprintf(labels, sizeof(labels), "task=\"%s\"", sample.tasks[index].name);
+            writer.writeValue(labels, sample.tasks[index].stackHighWaterMark);
+        }
+    }
+
+    // DVTask queues
+    TaskMetricContext taskContext = { &writer, TASK_QUEUE_DEPTH };
+    writer.beginMetric("ezdv_task_queue_depth", "gauge", "Messages waiting in each task's queue.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_QUEUE_CAPACITY;
+    writer.beginMetric("ezdv_task_queue_capacity", "gauge", "Size of each task's queue.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_QUEUE_HIGH_WATER_MARK;
+    writer.beginMetric("ezdv_task_queue_high_water_mark", "gauge", "Most messages seen waiting in each task's queue.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_MESSAGES;
+    writer.beginMetric("ezdv_task_messages_total", "counter", "Messages handled by each task.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_QUEUE_WAIT;
+    writer.beginMetric("ezdv_task_queue_wait_seconds_total", "counter", "Time messages spent waiting in each task's queue.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_HANDLER_TIME;
+    writer.beginMetric("ezdv_task_handler_seconds_total", "counter", "Time each task spent handling messages.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_OVERFLOWS;
+    writer.beginMetric("ezdv_task_queue_overflows_total", "counter", "Messages that arrived while each task's queue was full.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+    taskContext.metric = TASK_WAKEUPS;
+    writer.beginMetric("ezdv_task_wakeups_total", "counter", "Times each task woke up.");
+    DVTask::ForEachTask(&WriteTaskMetric_, &taskContext);
+
+#if CONFIG_EZDV_TASK_WATERMARKS
+    // Peaks across sessions, for right-sizing stacks and queues.
+    auto watermarks = new util::TaskWatermarks::Entry[util::TaskWatermarks::MAX_TASKS];
+    assert(watermarks != nullptr);
+    int numWatermarks = util::TaskWatermarks::Get(watermarks, util::TaskWatermarks::MAX_TASKS);
+
+    writer.beginMetric("ezdv_task_stack_peak_used_bytes", "gauge", "Most stack space each task has used, across sessions.");
+    for (int index = 0; index < numWatermarks; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", watermarks[index].name);
+        writer.writeValue(labels, watermarks[index].peakStackUsed);
+    }
+    writer.beginMetric("ezdv_task_stack_recommended_bytes", "gauge", "Suggested stack size for each task based on its peak.");
+    for (int index = 0; index < numWatermarks; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", watermarks[index].name);
+        writer.writeValue(labels, util::TaskWatermarks::RecommendStackSize(watermarks[index]));
+    }
+    writer.beginMetric("ezdv_task_queue_peak_depth", "gauge", "Most messages seen waiting in each task's queue, across sessions.");
+    for (int index = 0; index < numWatermarks; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", watermarks[index].name);
+        writer.writeValue(labels, watermarks[index].peakQueueDepth);
+    }
+    writer.beginMetric("ezdv_task_queue_recommended_size", "gauge", "Suggested queue size for each task based on its peak.");
+    for (int index = 0; index < numWatermarks; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", watermarks[index].name);
+        writer.writeValue(labels, util::TaskWatermarks::RecommendQueueSize(watermarks[index]));
+    }
+
+    delete[] watermarks;
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+
+    if (hasBatteryState_)
+    {
+        writer.beginMetric("ezdv_battery_current_milliamps", "gauge", "Battery current estimated from the fuel gauge's charge rate (positive while discharging).");
+        writer.writeSignedValue(nullptr, (int32_t)(-socChangeRate_ * CONFIG_EZDV_BATTERY_CAPACITY_MAH / 100));
+    }
+
+    // Audio links. Totals only include what was read by the last sample,
+    // so add whatever's accumulated since.
+    audio::AudioLinkStatistics links[TELEMETRY_MAX_AUDIO_LINKS];
+    int numLinks = audio::AudioGraph::GetLinkStatistics(links, TELEMETRY_MAX_AUDIO_LINKS, false);
+    for (int index = 0; index < numLinks; index++)
+    {
+        // Make sure links that haven't been sampled yet have totals.
+        getAudioLinkTotals_(links[index].sinkName, links[index].sinkChannel);
+    }
+
+    AudioLinkTotals currentLinks[TELEMETRY_MAX_AUDIO_LINKS];
+    int numCurrentLinks = numAudioLinkTotals_;
+    memcpy(currentLinks, audioLinkTotals_, sizeof(currentLinks));
+    for (int index = 0; index < numLinks; index++)
+    {
+        AudioLinkTotals* totals = getAudioLinkTotals_(links[index].sinkName, links[index].sinkChannel);
+        if (totals != nullptr)
+        {
+            AudioLinkTotals& current = currentLinks[totals - audioLinkTotals_];
+            current.numUnderruns += links[index].statistics.numUnderruns;
+            current.numOverruns += links[index].statistics.numOverruns;
+            current.numSamplesDropped += links[index].statistics.numSamplesDropped;
+        }
+    }
+
+    writer.beginMetric("ezdv_audio_underruns_total", "counter", "Times an audio link's consumer ran short of samples.");
+    for (int index = 0; index < numCurrentLinks; index++)
+    {
+        snprintf(labels, sizeof(labels), "sink=\"%s\",channel=\"%d\"", currentLinks[index].sinkName, currentLinks[index].sinkChannel);
+        writer.writeValue(labels, currentLinks[index].numUnderruns);
+    }
+    writer.beginMetric("ezdv_audio_overruns_total", "counter", "Times an audio link's producer ran out of room.");
+    for (int index = 0; index < numCurrentLinks; index++)
+    {
+        snprintf(labels, sizeof(labels), "sink=\"%s\",channel=\"%d\"", currentLinks[index].sinkName, currentLinks[index].sinkChannel);
+        writer.writeValue(labels, currentLinks[index].numOverruns);
+    }
+    writer.beginMetric("ezdv_audio_dropped_samples_total", "counter", "Samples dropped due to audio link overruns.");
+    for (int index = 0; index < numCurrentLinks; index++)
+    {
+        snprintf(labels, sizeof(labels), "sink=\"%s\",channel=\"%d\"", currentLinks[index].sinkName, currentLinks[index].sinkChannel);
+        writer.writeValue(labels, currentLinks[index].numSamplesDropped);
+    }
+    writer.beginMetric("ezdv_audio_fifo_samples", "gauge", "Average samples queued in each audio link since the last telemetry sample.");
+    for (int index = 0; index < numLinks; index++)
+    {
+        snprintf(labels, sizeof(labels), "sink=\"%s\",channel=\"%d\"", links[index].sinkName, (int)links[index].sinkChannel);
+        writer.writeValue(labels, links[index].statistics.averageUsed);
+    }
+
+    // Modem timing, same idea as above.
+    audio::ModemProfiler::Statistics modemStats[TELEMETRY_MAX_MODEM_PROFILES];
+    audio::FreeDVMode modemModes[TELEMETRY_MAX_MODEM_PROFILES];
+    const char* modemNames[TELEMETRY_MAX_MODEM_PROFILES];
+    int numModemProfiles = audio::ModemProfiler::GetStatistics(
+        modemStats, modemModes, modemNames, TELEMETRY_MAX_MODEM_PROFILES, false);
+    for (int index = 0; index < numModemProfiles; index++)
+    {
+        getModemTotals_(modemNames[index], modemModes[index]);
+    }
+
+    ModemTotals currentModems[TELEMETRY_MAX_MODEM_PROFILES];
+    int numCurrentModems = numModemTotals_;
+    memcpy(currentModems, modemTotals_, sizeof(currentModems));
+    for (int index = 0; index < numModemProfiles; index++)
+    {
+        ModemTotals* totals = getModemTotals_(modemNames[index], modemModes[index]);
+        if (totals != nullptr)
+        {
+            ModemTotals& current = currentModems[totals - modemTotals_];
+            current.numFrames += modemStats[index].numFrames;
+            current.totalUs += (uint64_t)modemStats[index].averageUs * modemStats[index].numFrames;
+            current.numLate += modemStats[index].numLate;
+            current.numDeferred += modemStats[index].numDeferred;
+        }
+    }
+
+    writer.beginMetric("ezdv_modem_frames_total", "counter", "Frames processed by the modem.");
+    for (int index = 0; index < numCurrentModems; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\",mode=\"%d\"", currentModems[index].name, currentModems[index].mode);
+        writer.writeValue(labels, currentModems[index].numFrames);
+    }
+    writer.beginMetric("ezdv_modem_frame_seconds_total", "counter", "Time spent processing modem frames.");
+    for (int index = 0; index < numCurrentModems; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\",mode=\"%d\"", currentModems[index].name, currentModems[index].mode);
+        writer.writeSeconds(labels, currentModems[index].totalUs);
+    }
+    writer.beginMetric("ezdv_modem_late_frames_total", "counter", "Frames that took longer to process than the audio they contain.");
+    for (int index = 0; index < numCurrentModems; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\",mode=\"%d\"", currentModems[index].name, currentModems[index].mode);
+        writer.writeValue(labels, currentModems[index].numLate);
+    }
+    writer.beginMetric("ezdv_modem_deferred_ticks_total", "counter", "Ticks that ran out of time with frames still waiting.");
+    for (int index = 0; index < numCurrentModems; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\",mode=\"%d\"", currentModems[index].name, currentModems[index].mode);
+        writer.writeValue(labels, currentModems[index].numDeferred);
+    }
+    writer.beginMetric("ezdv_modem_worst_frame_seconds", "gauge", "Slowest frame since the last telemetry sample.");
+    for (int index = 0; index < numModemProfiles; index++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\",mode=\"%d\"", modemNames[index], (int)modemModes[index]);
+        writer.writeSeconds(labels, modemStats[index].worstUs);
+    }
+
+    // Network streams
+    network::NetworkQos::Statistics networkStats[TELEMETRY_NETWORK_STREAMS];
+    for (int stream = 0; stream < TELEMETRY_NETWORK_STREAMS; stream++)
+    {
+        network::NetworkQos::GetStatistics((network::NetworkQos::StreamType)stream, networkStats[stream], false);
+    }
+
+    auto writeNetworkCounter = [&](const char* name, const char* help, uint64_t NetworkTotals::*total, uint32_t network::NetworkQos::Statistics::*current)
+    {
+        writer.beginMetric(name, "counter", help);
+        for (int stream = 0; stream < TELEMETRY_NETWORK_STREAMS; stream++)
+        {
+            snprintf(labels, sizeof(labels), "stream=\"%s\"", network::NetworkQos::GetStreamName((network::NetworkQos::StreamType)stream));
+            writer.writeValue(labels, networkTotals_[stream].*total + networkStats[stream].*current);
+        }
+    };
+
+    writeNetworkCounter("ezdv_network_packets_sent_total", "Packets sent.", 
+        &NetworkTotals::numSent, &network::NetworkQos::Statistics::numSent);
+    writeNetworkCounter("ezdv_network_send_failures_total", "Packets dropped locally (e.g. Wi-Fi out of buffers).", 
+        &NetworkTotals::numSendFailures, &network::NetworkQos::Statistics::numSendFailures);
+    writeNetworkCounter("ezdv_network_packets_received_total", "Packets received.", 
+        &NetworkTotals::numReceived, &network::NetworkQos::Statistics::numReceived);
+    writeNetworkCounter("ezdv_network_packets_lost_total", "Gaps in received sequence numbers.", 
+        &NetworkTotals::numLost, &network::NetworkQos::Statistics::numLost);
+    writeNetworkCounter("ezdv_network_retransmit_requests_total", "Packets we asked the radio to resend.", 
+        &NetworkTotals::numRetransmitRequests, &network::NetworkQos::Statistics::numRetransmitRequests);
+    writeNetworkCounter("ezdv_network_retransmits_total", "Packets resent at the radio's request.", 
+        &NetworkTotals::numRetransmits, &network::NetworkQos::Statistics::numRetransmits);
+    writeNetworkCounter("ezdv_network_send_retries_total", "Extra send attempts while Wi-Fi was out of buffers.", 
+        &NetworkTotals::numSendRetries, &network::NetworkQos::Statistics::numSendRetries);
+    writeNetworkCounter("ezdv_network_packets_out_of_order_total", "Packets that arrived after a later one.", 
+        &NetworkTotals::numOutOfOrder, &network::NetworkQos::Statistics::numOutOfOrder);
+
+    writer.beginMetric("ezdv_network_jitter_seconds", "gauge", "Current interarrival jitter estimate.");
+    for (int stream = 0; stream < TELEMETRY_NETWORK_STREAMS; stream++)
+    {
+        snprintf(labels, sizeof(labels), "stream=\"%s\"", network::NetworkQos::GetStreamName((network::NetworkQos::StreamType)stream));
+        writer.writeSeconds(labels, networkStats[stream].jitterUs);
+    }
+    writer.beginMetric("ezdv_network_rtt_seconds", "gauge", "Most recent protocol ping round trip time.");
+    for (int stream = 0; stream < TELEMETRY_NETWORK_STREAMS; stream++)
+    {
+        snprintf(labels, sizeof(labels), "stream=\"%s\"", network::NetworkQos::GetStreamName((network::NetworkQos::StreamType)stream));
+        writer.writeSeconds(labels, networkStats[stream].rttUs);
+    }
+
+    auto writeNetworkHistogram = [&](
+        const char* name, const char* help, 
+        uint64_t (NetworkTotals::*totalBuckets)[network::NetworkQos::NUM_HISTOGRAM_BUCKETS], uint64_t NetworkTotals::*totalSum,
+        uint32_t (network::NetworkQos::Statistics::*currentBuckets)[network::NetworkQos::NUM_HISTOGRAM_BUCKETS], uint64_t network::NetworkQos::Statistics::*currentSum)
+    {
+        writer.beginMetric(name, "histogram", help);
+        for (int stream = 0; stream < TELEMETRY_NETWORK_STREAMS; stream++)
+        {
+            const char* streamName = network::NetworkQos::GetStreamName((network::NetworkQos::StreamType)stream);
+
+            // Prometheus buckets are cumulative.
+            uint64_t count = 0;
+            for (int bucket = 0; bucket < network::NetworkQos::NUM_HISTOGRAM_BUCKETS; bucket++)
+            {
+                count += (networkTotals_[stream].*totalBuckets)[bucket] + (networkStats[stream].*currentBuckets)[bucket];
+
+                uint32_t limitUs = network::NetworkQos::GetHistogramBucketLimitUs(bucket);
+                if (limitUs > 0)
+                {
+                    snprintf(labels, sizeof(labels), "stream=\"%s\",le=\"%" PRIu32 ".%06" PRIu32 "\"", streamName, limitUs / 1000000, limitUs % 1000000);
+                }
+                else
+                {
+                    snprintf(labels, sizeof(labels), "stream=\"%s\",le=\"+Inf\"", streamName);
+                }
+                writer.writeValue(labels, count, "_bucket");
+            }
+
+            snprintf(labels, sizeof(labels), "stream=\"%s\"", streamName);
+            writer.writeSeconds(labels, networkTotals_[stream].*totalSum + networkStats[stream].*currentSum, "_sum");
+            writer.writeValue(labels, count, "_count");
+        }
+    };
+
+    writeNetworkHistogram("ezdv_network_interarrival_deviation_seconds", "How far each packet's arrival strayed from the average interval.",
+        &NetworkTotals::deviationHistogram, &NetworkTotals::deviationSumUs,
+        &network::NetworkQos::Statistics::deviationHistogram, &network::NetworkQos::Statistics::deviationSumUs);
+    writeNetworkHistogram("ezdv_network_ping_rtt_seconds", "Protocol ping round trip times.",
+        &NetworkTotals::rttHistogram, &NetworkTotals::rttSumUs,
+        &network::NetworkQos::Statistics::rttHistogram, &network::NetworkQos::Statistics::rttSumUs);
+
+    if (writer.finish() != ESP_OK)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Could not send all metrics");
+    }
+
+    ESP_ERROR_CHECK(httpd_req_async_handler_complete(message->request));
+}
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+
+}
+
+}
+
+#endif // CONFIG_EZDV_ENABLE_TELEMETRY
@@ -0,0 +1,135 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_TASK_H
+#define TELEMETRY_TASK_H
+
+#include "sdkconfig.h"
+#include "task/DVTask.h"
+#include "driver/BatteryMessage.h"
+#include "TelemetryMessage.h"
+#include "LoadGovernor.h"
+#include "network/NetworkQos.h"
+
+namespace ezdv
+{
+
+namespace telemetry
+{
+
+using namespace ezdv::task;
+
+/// @brief Periodically samples CPU, heap and stack usage and keeps a short 
+/// history of it for retrieval (e.g. by the web UI).
+class TelemetryTask : public DVTask
+{
+public:
+    TelemetryTask();
+    virtual ~TelemetryTask();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+    virtual void onTaskTick_() override;
+
+private:
+    TelemetrySample* samples_;
+    int numSamples_;
+    int nextSampleIndex_;
+
+    TaskStatus_t* previousTaskStatus_;
+    UBaseType_t previousTaskStatusCount_;
+    configRUN_TIME_COUNTER_TYPE previousTotalRunTime_;
+
+    // For wakeups per second since the previous sample.
+    uint32_t previousNumWakeups_;
+    int64_t previousWakeupTimeUs_;
+
+    // Latest from the fuel gauge.
+    float socChangeRate_;
+    bool hasBatteryState_;
+
+#if CONFIG_EZDV_LOAD_GOVERNOR
+    LoadGovernor loadGovernor_;
+#endif // CONFIG_EZDV_LOAD_GOVERNOR
+
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    int samplesSinceAllocationReport_;
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+
+    void takeSample_(TelemetrySample& sample);
+
+    void onRequestTelemetryMessage_(DVTask* origin, RequestTelemetryMessage* message);
+    void onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message);
+
+#if CONFIG_EZDV_METRICS_ENDPOINT
+    // Counters since boot for /metrics. Sampling resets the underlying
+    // statistics, so whatever was read is added here first.
+    struct AudioLinkTotals
+    {
+        char sinkName[configMAX_TASK_NAME_LEN];
+        uint8_t sinkChannel;
+        uint64_t numUnderruns;
+        uint64_t numOverruns;
+        uint64_t numSamplesDropped;
+    };
+
+    struct ModemTotals
+    {
+        char name[configMAX_TASK_NAME_LEN];
+        uint8_t mode;
+        uint64_t numFrames;
+        uint64_t totalUs;
+        uint64_t numLate;
+        uint64_t numDeferred;
+    };
+
+    struct NetworkTotals
+    {
+        uint64_t numSent;
+        uint64_t numSendFailures;
+        uint64_t numReceived;
+        uint64_t numLost;
+        uint64_t numRetransmitRequests;
+        uint64_t numRetransmits;
+        uint64_t numSendRetries;
+        uint64_t numOutOfOrder;
+        uint64_t deviationHistogram[network::NetworkQos::NUM_HISTOGRAM_BUCKETS];
+        uint64_t deviationSumUs;
+        uint64_t rttHistogram[network::NetworkQos::NUM_HISTOGRAM_BUCKETS];
+        uint64_t rttSumUs;
+    };
+
+    AudioLinkTotals audioLinkTotals_[TELEMETRY_MAX_AUDIO_LINKS];
+    int numAudioLinkTotals_;
+    ModemTotals modemTotals_[TELEMETRY_MAX_MODEM_PROFILES];
+    int numModemTotals_;
+    NetworkTotals networkTotals_[TELEMETRY_NETWORK_STREAMS];
+
+    AudioLinkTotals* getAudioLinkTotals_(const char* sinkName, uint8_t sinkChannel);
+    ModemTotals* getModemTotals_(const char* name, uint8_t mode);
+
+    void onRenderMetricsMessage_(DVTask* origin, RenderMetricsMessage* message);
+#endif // CONFIG_EZDV_METRICS_ENDPOINT
+};
+
+}
+
+}
+
+#endif // TELEMETRY_TASK_H
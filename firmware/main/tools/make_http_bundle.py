@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+# Copyright (c) 2024 Mooneer Salem
+#
+# This program is free software: you can redistribute it and/or modify  
+# it under the terms of the GNU General Public License as published by  
+# the Free Software Foundation, version 3.
+#
+# This program is distributed in the hope that it will be useful, but 
+# WITHOUT ANY WARRANTY; without even the implied warranty of 
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License 
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Packs the web UI files into the read-only bundle that HttpServerTask
+serves directly from flash. The layout must match network/HttpAssetBundle.h:
+
+    header (32 bytes): magic "EZWB", uint16 version, uint16 number of files,
+                       char etag[20], uint32 total bundle size
+    entries (40 bytes each, sorted by name): char name[32], uint32 offset, 
+                       uint32 length
+    file data, each starting on a 4 byte boundary
+
+All integers are little-endian and offsets are from the start of the bundle.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"EZWB"
+VERSION = 1
+NAME_LENGTH = 32
+ETAG_LENGTH = 20
+ALIGNMENT = 4
+
+HEADER = struct.Struct("<4sHH%dsI" % ETAG_LENGTH)
+ENTRY = struct.Struct("<%dsII" % NAME_LENGTH)
+
+def align(value):
+    return (value + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--etag", default="", help="identifies this set of files (max %d chars)" % (ETAG_LENGTH - 1))
+    parser.add_argument("--max-size", type=lambda x: int(x, 0), default=0, help="size of the partition the bundle goes in")
+    parser.add_argument("input_dir")
+    parser.add_argument("output_file")
+    args = parser.parse_args()
+
+    etag = args.etag.encode("ascii")
+    if len(etag) >= ETAG_LENGTH:
+        sys.exit("ETag '%s' is too long" % args.etag)
+
+    names = sorted(name for name in os.listdir(args.input_dir) if os.path.isfile(os.path.join(args.input_dir, name)))
+    files = []
+    for name in names:
+        encoded = name.encode("ascii")
+        if len(encoded) >= NAME_LENGTH:
+            sys.exit("File name '%s' is too long" % name)
+        with open(os.path.join(args.input_dir, name), "rb") as f:
+            files.append((encoded, f.read()))
+
+    offset = align(HEADER.size + ENTRY.size * len(files))
+    entries = b""
+    data = b""
+    for name, contents in files:
+        entries += ENTRY.pack(name, offset + len(data), len(contents))
+        data += contents
+        data += b"\0" * (align(len(data)) - len(data))
+
+    total_size = offset + len(data)
+    if args.max_size and total_size > args.max_size:
+        sys.exit("Web UI bundle is %d bytes, but the partition only holds %d" % (total_size, args.max_size))
+
+    header = HEADER.pack(MAGIC, VERSION, len(files), etag, total_size)
+    with open(args.output_file, "wb") as f:
+        f.write(header)
+        f.write(entries)
+        f.write(b"\0" * (offset - len(header) - len(entries)))
+        f.write(data)
+
+    print("Packed %d files (%d bytes) into %s" % (len(files), total_size, args.output_file))
+
+if __name__ == "__main__":
+    main()
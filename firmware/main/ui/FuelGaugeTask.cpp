@@ -44,8 +44,9 @@ FuelGaugeTask::FuelGaugeTask()
     , sentRequest_(false)
     , socChangeRate_(0)
 {
-    registerMessageHandler(this, &FuelGaugeTask::onButtonLongPressedMessage_);
-    registerMessageHandler(this, &FuelGaugeTask::onBatteryStateMessage_);
+    registerMessageHandlers<
+        &FuelGaugeTask::onButtonLongPressedMessage_,
+        &FuelGaugeTask::onBatteryStateMessage_>(this);
 }
 
 FuelGaugeTask::~FuelGaugeTask()
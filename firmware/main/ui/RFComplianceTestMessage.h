@@ -0,0 +1,64 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_COMPLIANCE_TEST_MESSAGE_H
+#define RF_COMPLIANCE_TEST_MESSAGE_H
+
+#include "task/DVTaskMessage.h"
+#include "util/SignalGenerator.h"
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(RF_COMPLIANCE_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace ui
+{
+
+using namespace ezdv::task;
+
+enum RfComplianceMessageTypes
+{
+    SET_SIGNAL_GENERATOR = 1,
+};
+
+/// @brief Overrides the signal the RF compliance test produces on one or 
+///        both channels until the next Mode button press.
+class SetSignalGeneratorMessage : public DVTaskMessageBase<SET_SIGNAL_GENERATOR, SetSignalGeneratorMessage>
+{
+public:
+    enum { LEFT_CHANNEL = 1 << 0, RIGHT_CHANNEL = 1 << 1 };
+
+    SetSignalGeneratorMessage(uint8_t channelsProvided = 0, util::SignalGenerator::Settings settingsProvided = {})
+        : DVTaskMessageBase<SET_SIGNAL_GENERATOR, SetSignalGeneratorMessage>(RF_COMPLIANCE_MESSAGE)
+        , channels(channelsProvided)
+        , settings(settingsProvided)
+        {}
+    virtual ~SetSignalGeneratorMessage() = default;
+
+    uint8_t channels;
+    util::SignalGenerator::Settings settings;
+};
+
+}
+
+}
+
+#endif // RF_COMPLIANCE_TEST_MESSAGE_H
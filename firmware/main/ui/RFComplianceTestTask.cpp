@@ -21,17 +21,15 @@
 #include "RFComplianceTestTask.h"
 #include "driver/LedMessage.h"
 
+#include "esp_log.h"
+
 #define CURRENT_LOG_TAG ("RfComplianceTestTask")
 
 // TBD -- check that these calculations happen at compile time and not runtime.
 #define SAMPLE_RATE 8000
-#define SAMPLE_RATE_RECIP ((float)1.0/(float)SAMPLE_RATE)
 #define LEFT_FREQ_HZ ((float)1275.0)
-#define LEFT_FREQ_HZ_RECIP ((float)1.0/LEFT_FREQ_HZ)
 #define RIGHT_FREQ_HZ ((float)1725.0)
-#define RIGHT_FREQ_HZ_RECIP ((float)1.0/RIGHT_FREQ_HZ)
 
-#define SAMPLES_PER_TICK ((float)0.02*(float)SAMPLE_RATE)
 
 // Max amplitude of the test sine waves is 32767. This has been experimentally determined to 
 // produce ~0 dB for the sine wave frequency (without clipping) in an Audacity spectrum plot 
@@ -46,7 +44,16 @@
 // NOTE: the max amplitude is assuming no LPF on the output (true for v0.6 HW). The TLV320
 /// volume and/or amplitude here may need to be adjusted once a LPF is added.
 #define CODEC_VOLUME_LEVEL 0
-#define SINE_WAVE_AMPLITUDE ((float)32767.0)
+#define SINE_WAVE_AMPLITUDE (32767)
+
+// Two-tone test frequencies (within the SSB passband and not harmonically related).
+#define TWO_TONE_LOW_FREQ_HZ ((float)700.0)
+#define TWO_TONE_HIGH_FREQ_HZ ((float)1900.0)
+
+// Sweep covers the SSB passband.
+#define SWEEP_START_FREQ_HZ ((float)300.0)
+#define SWEEP_END_FREQ_HZ ((float)3000.0)
+#define SWEEP_DURATION_MS (10000)
 
 // Defined in Application.cpp.
 extern void StartSleeping();
@@ -57,22 +64,51 @@ namespace ezdv
 namespace ui
 {
 
+using util::SignalGenerator;
+
+static const SignalGenerator::Settings Silence_ = { SignalGenerator::SILENCE, 0, 0, 0, 0 };
+static const SignalGenerator::Settings LeftSine_ = { SignalGenerator::TONE, LEFT_FREQ_HZ, 0, 0, SINE_WAVE_AMPLITUDE };
+static const SignalGenerator::Settings RightSine_ = { SignalGenerator::TONE, RIGHT_FREQ_HZ, 0, 0, SINE_WAVE_AMPLITUDE };
+static const SignalGenerator::Settings LeftSquare_ = { SignalGenerator::SQUARE, LEFT_FREQ_HZ, 0, 0, SINE_WAVE_AMPLITUDE };
+static const SignalGenerator::Settings RightSquare_ = { SignalGenerator::SQUARE, RIGHT_FREQ_HZ, 0, 0, SINE_WAVE_AMPLITUDE };
+static const SignalGenerator::Settings TwoTone_ = { SignalGenerator::TWO_TONE, TWO_TONE_LOW_FREQ_HZ, TWO_TONE_HIGH_FREQ_HZ, 0, SINE_WAVE_AMPLITUDE };
+static const SignalGenerator::Settings Sweep_ = { SignalGenerator::SWEEP, SWEEP_START_FREQ_HZ, SWEEP_END_FREQ_HZ, SWEEP_DURATION_MS, SINE_WAVE_AMPLITUDE };
+static const SignalGenerator::Settings Noise_ = { SignalGenerator::NOISE, 0, 0, 0, SINE_WAVE_AMPLITUDE };
+
+// Modes selectable with the Mode button (left channel, right channel). The 
+// last one must produce no audio.
+static const SignalGenerator::Settings* const Modes_[][2] = {
+    { &LeftSine_, &RightSine_ },
+    { &LeftSine_, &Silence_ },
+    { &Silence_, &RightSine_ },
+    { &LeftSquare_, &RightSquare_ },
+    { &LeftSquare_, &Silence_ },
+    { &Silence_, &RightSquare_ },
+    { &TwoTone_, &TwoTone_ },
+    { &Sweep_, &Sweep_ },
+    { &Noise_, &Noise_ },
+    { &Silence_, &Silence_ },
+};
+#define NUM_MODES ((int)(sizeof(Modes_) / sizeof(Modes_[0])))
+
 RfComplianceTestTask::RfComplianceTestTask(ezdv::driver::LedArray* ledArrayTask, ezdv::driver::TLV320* tlv320Task)
     : DVTask("RfComplianceTestTask", 10, 4096, tskNO_AFFINITY, 32, pdMS_TO_TICKS(20))
-    , AudioInput(1, 2)
-    , leftChannelSineWave_(LEFT_FREQ_HZ, SINE_WAVE_AMPLITUDE)
-    , rightChannelSineWave_(RIGHT_FREQ_HZ, SINE_WAVE_AMPLITUDE)
+    , AudioInput("RfComplianceTestTask", 2, { AUDIO_INPUT_UNUSED })
+    , leftChannelGenerator_(SAMPLE_RATE)
+    , rightChannelGenerator_(SAMPLE_RATE)
     , isActive_(false)
     , ledArrayTask_(ledArrayTask)
     , tlv320Task_(tlv320Task)
-    , leftChannelCtr_(0)
-    , rightChannelCtr_(0)
     , currentMode_(0)
     , pttCtr_(0)
 {
-    registerMessageHandler(this, &RfComplianceTestTask::onButtonShortPressedMessage_);
-    registerMessageHandler(this, &RfComplianceTestTask::onButtonLongPressedMessage_);
-    registerMessageHandler(this, &RfComplianceTestTask::onButtonReleasedMessage_);
+    registerMessageHandlers<
+        &RfComplianceTestTask::onButtonShortPressedMessage_,
+        &RfComplianceTestTask::onButtonLongPressedMessage_,
+        &RfComplianceTestTask::onButtonReleasedMessage_,
+        &RfComplianceTestTask::onSetSignalGeneratorMessage_>(this);
+
+    applyMode_();
 }
 
 RfComplianceTestTask::~RfComplianceTestTask()
@@ -171,12 +207,16 @@ void RfComplianceTestTask::onButtonReleasedMessage_(DVTask* origin, driver::Butt
             // 4. Square wave, both channels.
             // 5. Square wave, left channel only.
             // 6. Square wave, right channel only.
-            // 7. No audio.
+            // 7. Two-tone, both channels.
+            // 8. Sweep, both channels.
+            // 9. White noise, both channels.
+            // 10. No audio.
             currentMode_++;
-            if (currentMode_ >= 7)
+            if (currentMode_ >= NUM_MODES)
             {
                 currentMode_ = 0;
             }
+            applyMode_();
             break;
         case driver::ButtonLabel::VOL_UP:
             msg.led = ezdv::driver::SetLedStateMessage::LedLabel::OVERLOAD;
@@ -198,17 +238,13 @@ void RfComplianceTestTask::onTaskTick_()
     {
         //auto timeBegin = esp_timer_get_time();
         
-        if (currentMode_ >= 0 && currentMode_ <= 2)
+        // Keep the output FIFOs full so that tick jitter never reaches the 
+        // signal.
         {
-            sineWave_();
-        }
-        else if (currentMode_ >= 3 && currentMode_ <= 5)
-        {
-            squareWave_();
-        }
-        else if (currentMode_ == 6)
-        {
-            // do nothing, silence
+            AudioInput::OutputClaim leftOutput(this, AudioInput::LEFT_CHANNEL);
+            AudioInput::OutputClaim rightOutput(this, AudioInput::RIGHT_CHANNEL);
+            renderSignal_(leftChannelGenerator_, leftOutput.fifo());
+            renderSignal_(rightChannelGenerator_, rightOutput.fifo());
         }
         
         // Get some I2C traffic flowing.
@@ -218,7 +254,8 @@ void RfComplianceTestTask::onTaskTick_()
         tlv320Task_->post(&rightChanVolMessage);
         
         // Toggle PTT line on radio jack every 20ms as long as there's audio on either jack.
-        if (currentMode_ != 6)
+        if (leftChannelGenerator_.getSettings().waveform != SignalGenerator::SILENCE ||
+            rightChannelGenerator_.getSettings().waveform != SignalGenerator::SILENCE)
         {
             pttCtr_++;
             ezdv::driver::SetLedStateMessage msg(ezdv::driver::SetLedStateMessage::LedLabel::PTT_NPN, (pttCtr_ & (1 << 1)) != 0);
@@ -227,88 +264,38 @@ void RfComplianceTestTask::onTaskTick_()
     }
 }
 
-void RfComplianceTestTask::sineWave_()
+void RfComplianceTestTask::onSetSignalGeneratorMessage_(DVTask* origin, SetSignalGeneratorMessage* message)
 {
-    struct FIFO* outputLeftFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* outputRightFifo = getAudioOutput(AudioInput::RIGHT_CHANNEL);
-    
-    if (currentMode_ == 0 || currentMode_ == 1)
+    ESP_LOGI(
+        CURRENT_LOG_TAG, "Signal generator set to waveform %d (%d/%d Hz) on channels %d", 
+        (int)message->settings.waveform, (int)message->settings.frequency1, 
+        (int)message->settings.frequency2, (int)message->channels);
+
+    if (message->channels & SetSignalGeneratorMessage::LEFT_CHANNEL)
     {
-        for (int index = 0; index < SAMPLES_PER_TICK; index++)
-        {
-            if (leftChannelCtr_ >= SAMPLE_RATE)
-            {
-                leftChannelCtr_ = 0;
-            }
-        
-            if (codec2_fifo_free(outputLeftFifo) > 0)
-            {
-                short sample = leftChannelSineWave_.getSample(leftChannelCtr_++);
-                codec2_fifo_write(outputLeftFifo, &sample, 1);
-            }
-        }
+        leftChannelGenerator_.configure(message->settings);
     }
-    
-    if (currentMode_ == 0 || currentMode_ == 2)
+
+    if (message->channels & SetSignalGeneratorMessage::RIGHT_CHANNEL)
     {
-        for (int index = 0; index < SAMPLES_PER_TICK; index++)
-        {
-            if (rightChannelCtr_ >= SAMPLE_RATE)
-            {
-                rightChannelCtr_ = 0;
-            }
-        
-            if (codec2_fifo_free(outputRightFifo) > 0)
-            {
-                short sample = rightChannelSineWave_.getSample(rightChannelCtr_++);
-                codec2_fifo_write(outputRightFifo, &sample, 1);
-            }
-        }
+        rightChannelGenerator_.configure(message->settings);
     }
 }
 
-void RfComplianceTestTask::squareWave_()
+void RfComplianceTestTask::applyMode_()
 {
-    struct FIFO* outputLeftFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* outputRightFifo = getAudioOutput(AudioInput::RIGHT_CHANNEL);
-    
-    if (currentMode_ == 3 || currentMode_ == 4)
-    {
-        for (int index = 0; index < SAMPLES_PER_TICK; index++)
-        {
-            int numSamplesPerPeriod = (int)(SAMPLE_RATE * LEFT_FREQ_HZ_RECIP);
-            if (leftChannelCtr_ >= numSamplesPerPeriod)
-            {
-                leftChannelCtr_ = 0;
-            }
-        
-            if (codec2_fifo_free(outputLeftFifo) > 0)
-            {
-                int halfway = numSamplesPerPeriod >> 1;
-                short val = leftChannelCtr_++ < halfway ? SINE_WAVE_AMPLITUDE : -SINE_WAVE_AMPLITUDE;
-                codec2_fifo_write(outputLeftFifo, &val, 1);
-            }
-        }
-    }
-    
-    if (currentMode_ == 3 || currentMode_ == 5)
-    {
-        for (int index = 0; index < SAMPLES_PER_TICK; index++)
-        {
-            int numSamplesPerPeriod = (int)(SAMPLE_RATE * RIGHT_FREQ_HZ_RECIP);
-            if (rightChannelCtr_ >= numSamplesPerPeriod)
-            {
-                rightChannelCtr_ = 0;
-            }
-        
-            if (codec2_fifo_free(outputRightFifo) > 0)
-            {
-                int halfway = numSamplesPerPeriod >> 1;
-                short val = rightChannelCtr_++ < halfway ? SINE_WAVE_AMPLITUDE : -SINE_WAVE_AMPLITUDE;
-                codec2_fifo_write(outputRightFifo, &val, 1);
-            }
-        }
-    }
+    leftChannelGenerator_.configure(*Modes_[currentMode_][0]);
+    rightChannelGenerator_.configure(*Modes_[currentMode_][1]);
+}
+
+void RfComplianceTestTask::renderSignal_(util::SignalGenerator& generator, audio::AudioRingBuffer* fifo)
+{
+    if (fifo == nullptr) return;
+
+    auto span = fifo->acquireWrite(fifo->numFree());
+    generator.render(span.first, span.firstLength);
+    generator.render(span.second, span.secondLength);
+    fifo->commitWrite(span.size());
 }
 
 }
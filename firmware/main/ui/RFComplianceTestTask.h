@@ -27,7 +27,8 @@
 #include "storage/SettingsMessage.h"
 #include "driver/LedArray.h"
 #include "driver/TLV320.h"
-#include "util/SineWaveGenerator.h"
+#include "util/SignalGenerator.h"
+#include "RFComplianceTestMessage.h"
 
 namespace ezdv
 {
@@ -50,13 +51,11 @@ protected:
     virtual void onTaskTick_() override;
 
 private:
-    util::SineWaveGenerator leftChannelSineWave_;
-    util::SineWaveGenerator rightChannelSineWave_;
+    util::SignalGenerator leftChannelGenerator_;
+    util::SignalGenerator rightChannelGenerator_;
     bool isActive_;
     ezdv::driver::LedArray* ledArrayTask_;
     ezdv::driver::TLV320* tlv320Task_;
-    int leftChannelCtr_;
-    int rightChannelCtr_;
     int currentMode_;
     unsigned int pttCtr_;
 
@@ -65,9 +64,11 @@ private:
     void onButtonLongPressedMessage_(DVTask* origin, driver::ButtonLongPressedMessage* message);
     void onButtonReleasedMessage_(DVTask* origin, driver::ButtonReleasedMessage* message);
     
+    void onSetSignalGeneratorMessage_(DVTask* origin, SetSignalGeneratorMessage* message);
+
     // Mode handling
-    void sineWave_();
-    void squareWave_();
+    void applyMode_();
+    void renderSignal_(util::SignalGenerator& generator, audio::AudioRingBuffer* fifo);
 };
 
 }
@@ -15,15 +15,17 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdio>
 #include <string>
 #include <cstring>
 
+#include "sdkconfig.h"
 #include "UserInterfaceTask.h"
 #include "audio/BeeperMessage.h"
 #include "driver/LedMessage.h"
 
 #define VOL_BUTTON_HOLD_TIMER_TICK_US 100000
-#define NET_LED_FLASH_TIMER_TICK_US 1000000
+#define NET_LED_BLINK_PERIOD_MS (2000)
 
 #define CURRENT_LOG_TAG ("UserInterfaceTask")
 
@@ -44,9 +46,8 @@ static std::map<audio::FreeDVMode, std::string> ModeList_ = {
 };
 
 UserInterfaceTask::UserInterfaceTask()
-    : DVTask("UserInterfaceTask", 10, 4096, tskNO_AFFINITY, 64, pdMS_TO_TICKS(10))
+    : DVTask("UserInterfaceTask", 10, 4096, tskNO_AFFINITY, 64)
     , volHoldTimer_(this, this, &UserInterfaceTask::updateVolumeCommon_, VOL_BUTTON_HOLD_TIMER_TICK_US, "VolHoldTimer")
-    , networkFlashTimer_(this, this, &UserInterfaceTask::flashNetworkLight_, NET_LED_FLASH_TIMER_TICK_US, "NetworkFlashTimer")
     , timeOutTimer_(this, this, &UserInterfaceTask::stopTx_, 1000000 /* placeholder, will be set by user config */, "TxTimeoutTimer")
     , currentMode_(audio::ANALOG)
     , isTransmitting_(false)
@@ -54,34 +55,43 @@ UserInterfaceTask::UserInterfaceTask()
     , leftVolume_(0)
     , rightVolume_(0)
     , volIncrement_(0)
-    , netLedStatus_(false)
+    , networkStatus_(false)
     , radioStatus_(false)
     , voiceKeyerRunning_(false)
     , voiceKeyerEnabled_(false)
+    , voiceKeyerTimesToTransmit_(0)
+    , voiceKeyerSecondsToWait_(0)
+    , voiceKeyerSlot_(0)
+    , modeHeld_(false)
+    , modeChorded_(false)
     , lastBatteryLevel_(0)
     , sleepPending_(false)
     , allowHeadsetPtt_(false)
 {
-    registerMessageHandler(this, &UserInterfaceTask::onButtonShortPressedMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onButtonLongPressedMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onButtonReleasedMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onFreeDVSyncStateMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onNetworkStateChange_);
-    registerMessageHandler(this, &UserInterfaceTask::onRadioStateChange_);
-    registerMessageHandler(this, &UserInterfaceTask::onRequestTxMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onRequestRxMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onVoiceKeyerSettingsMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onVoiceKeyerCompleteMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onADCOverload_);
-    registerMessageHandler(this, &UserInterfaceTask::onHeadsetButtonPressed_);
-    registerMessageHandler(this, &UserInterfaceTask::onBatteryStateUpdate_);
-    registerMessageHandler(this, &UserInterfaceTask::onLeftChannelVolumeMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onRightChannelVolumeMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onRequestSetFreeDVModeMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onRequestStartStopKeyerMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onGetKeyerStateMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onRadioSettingsMessage_);
-    registerMessageHandler(this, &UserInterfaceTask::onIpAddressAssignedMessage_);
+    volHoldTimer_.useTimerWheel();
+    timeOutTimer_.useTimerWheel();
+
+    registerMessageHandlers<
+        &UserInterfaceTask::onButtonShortPressedMessage_,
+        &UserInterfaceTask::onButtonLongPressedMessage_,
+        &UserInterfaceTask::onButtonReleasedMessage_,
+        &UserInterfaceTask::onFreeDVSyncStateMessage_,
+        &UserInterfaceTask::onNetworkStateChange_,
+        &UserInterfaceTask::onRadioStateChange_,
+        &UserInterfaceTask::onRequestTxMessage_,
+        &UserInterfaceTask::onRequestRxMessage_,
+        &UserInterfaceTask::onVoiceKeyerSettingsMessage_,
+        &UserInterfaceTask::onVoiceKeyerCompleteMessage_,
+        &UserInterfaceTask::onADCOverload_,
+        &UserInterfaceTask::onHeadsetButtonPressed_,
+        &UserInterfaceTask::onBatteryStateUpdate_,
+        &UserInterfaceTask::onLeftChannelVolumeMessage_,
+        &UserInterfaceTask::onRightChannelVolumeMessage_,
+        &UserInterfaceTask::onRequestSetFreeDVModeMessage_,
+        &UserInterfaceTask::onRequestStartStopKeyerMessage_,
+        &UserInterfaceTask::onGetKeyerStateMessage_,
+        &UserInterfaceTask::onRadioSettingsMessage_,
+        &UserInterfaceTask::onIpAddressAssignedMessage_>(this);
 }
 
 UserInterfaceTask::~UserInterfaceTask()
@@ -158,13 +168,25 @@ void UserInterfaceTask::onButtonShortPressedMessage_(DVTask* origin, driver::But
             case driver::ButtonLabel::MODE:
             {
                 // Processing will happen on button release.
+                modeHeld_ = true;
+                modeChorded_ = false;
                 break;
             }
             case driver::ButtonLabel::VOL_UP:
+                if (modeHeld_ && !isTransmitting_ && voiceKeyerEnabled_)
+                {
+                    selectVoiceKeyerSlot_(1);
+                    break;
+                }
                 volIncrement_ = 1;
                 updateVolumeCommon_(nullptr);
                 break;
             case driver::ButtonLabel::VOL_DOWN:
+                if (modeHeld_ && !isTransmitting_ && voiceKeyerEnabled_)
+                {
+                    selectVoiceKeyerSlot_(-1);
+                    break;
+                }
                 volIncrement_ = -1;
                 updateVolumeCommon_(nullptr);
                 break;
@@ -178,7 +200,7 @@ void UserInterfaceTask::onButtonLongPressedMessage_(DVTask* origin, driver::Butt
 {
     if (isActive_)
     {
-        if (message->button == driver::ButtonLabel::MODE)
+        if (message->button == driver::ButtonLabel::MODE && !modeChorded_)
         {
             // Long press Mode button triggers shutdown, all other long presses currently ignored
             sleepPending_ = true;
@@ -205,7 +227,7 @@ void UserInterfaceTask::onButtonReleasedMessage_(DVTask* origin, driver::ButtonR
                 break;
             }
             case driver::ButtonLabel::MODE:
-                if (!sleepPending_)
+                if (!sleepPending_ && !modeChorded_)
                 {
                     if (isTransmitting_ && voiceKeyerEnabled_)
                     {
@@ -225,6 +247,8 @@ void UserInterfaceTask::onButtonReleasedMessage_(DVTask* origin, driver::ButtonR
                         post(&request);
                     }
                 }
+                modeHeld_ = false;
+                modeChorded_ = false;
                 break;
             case driver::ButtonLabel::VOL_UP:
             case driver::ButtonLabel::VOL_DOWN:
@@ -277,44 +301,34 @@ void UserInterfaceTask::updateVolumeCommon_(DVTimer*)
     }
 
     // Start hold timer
-    volHoldTimer_.stop();
-    volHoldTimer_.start(true);
+    volHoldTimer_.restart(true);
 }
 
 void UserInterfaceTask::onNetworkStateChange_(DVTask* origin, network::WirelessNetworkStatusMessage* message)
 {
-    if (isActive_)
-    {
-        if (message->state)
-        {
-            networkFlashTimer_.start();
-        }
-        else
-        {
-            networkFlashTimer_.stop();
-            
-            netLedStatus_ = false;
-            driver::SetLedStateMessage* ledMessage = new driver::SetLedStateMessage(driver::SetLedStateMessage::NETWORK, netLedStatus_);
-            publish(ledMessage);
-            delete ledMessage;
-        }
-    }
+    networkStatus_ = message->state;
+    updateNetworkLight_();
 }
 
 void UserInterfaceTask::onRadioStateChange_(DVTask* origin, network::RadioConnectionStatusMessage* message)
 {
     radioStatus_ = message->state;
+    updateNetworkLight_();
 }
 
-void UserInterfaceTask::flashNetworkLight_(DVTimer*)
+void UserInterfaceTask::updateNetworkLight_()
 {
     if (isActive_)
     {
-        netLedStatus_ = radioStatus_ || !netLedStatus_;
-        
-        driver::SetLedStateMessage* ledMessage = new driver::SetLedStateMessage(driver::SetLedStateMessage::NETWORK, netLedStatus_);
-        publish(ledMessage);
-        delete ledMessage;
+        // Network LED: off with no network, blinking while waiting for the
+        // radio and solid once connected. LedArray does the blinking.
+        driver::SetLedStateMessage ledMessage(driver::SetLedStateMessage::NETWORK, networkStatus_);
+        if (networkStatus_ && !radioStatus_)
+        {
+            ledMessage.pattern = driver::SetLedStateMessage::BLINK;
+            ledMessage.periodMs = NET_LED_BLINK_PERIOD_MS;
+        }
+        publish(&ledMessage);
     }
 }
 
@@ -332,6 +346,32 @@ void UserInterfaceTask::onVoiceKeyerSettingsMessage_(
     DVTask* origin, storage::VoiceKeyerSettingsMessage* message)
 {
     voiceKeyerEnabled_ = message->enabled;
+    voiceKeyerTimesToTransmit_ = message->timesToTransmit;
+    voiceKeyerSecondsToWait_ = message->secondsToWait;
+    voiceKeyerSlot_ = message->slot;
+}
+
+void UserInterfaceTask::selectVoiceKeyerSlot_(int increment)
+{
+    modeChorded_ = true;
+    voiceKeyerSlot_ = 
+        (voiceKeyerSlot_ + increment + CONFIG_EZDV_VOICE_KEYER_NUM_SLOTS) % CONFIG_EZDV_VOICE_KEYER_NUM_SLOTS;
+
+    storage::SetVoiceKeyerSettingsMessage request(
+        voiceKeyerEnabled_, voiceKeyerTimesToTransmit_, voiceKeyerSecondsToWait_, voiceKeyerSlot_);
+    publish(&request);
+
+    // Announce the new slot (numbered from 1, same as the web UI).
+    char slotText[8];
+    snprintf(slotText, sizeof(slotText), "%d", voiceKeyerSlot_ + 1);
+
+    audio::ClearBeeperTextMessage* clearBeeperMessage = new audio::ClearBeeperTextMessage();
+    publish(clearBeeperMessage);
+    delete clearBeeperMessage;
+
+    audio::SetBeeperTextMessage* beeperMessage = new audio::SetBeeperTextMessage(slotText);
+    publish(beeperMessage);
+    delete beeperMessage;
 }
 
 void UserInterfaceTask::onVoiceKeyerCompleteMessage_(DVTask* origin, audio::VoiceKeyerCompleteMessage* message)
@@ -485,12 +525,12 @@ void UserInterfaceTask::onGetKeyerStateMessage_(DVTask* origin, audio::GetKeyerS
     if (voiceKeyerRunning_)
     {
         audio::StartVoiceKeyerMessage vkResponse;
-        origin->post(&vkResponse);
+        sendTo(origin, &vkResponse);
     }
     else
     {
         audio::StopVoiceKeyerMessage vkResponse;
-        origin->post(&vkResponse);
+        sendTo(origin, &vkResponse);
     }
 }
 
@@ -48,7 +48,6 @@ protected:
 
 private:
     DVTimer volHoldTimer_;
-    DVTimer networkFlashTimer_;
     DVTimer timeOutTimer_;
     audio::FreeDVMode currentMode_;
     bool isTransmitting_;
@@ -56,10 +55,18 @@ private:
     int8_t leftVolume_;
     int8_t rightVolume_;
     int8_t volIncrement_;
-    bool netLedStatus_;
+    bool networkStatus_;
     bool radioStatus_;
     bool voiceKeyerRunning_;
     bool voiceKeyerEnabled_;
+    int voiceKeyerTimesToTransmit_;
+    int voiceKeyerSecondsToWait_;
+    int voiceKeyerSlot_;
+
+    // Mode + Vol Up/Down selects the voice keyer slot instead of changing
+    // mode/shutting down.
+    bool modeHeld_;
+    bool modeChorded_;
     int lastBatteryLevel_;
     bool sleepPending_;
     bool allowHeadsetPtt_;
@@ -79,7 +86,7 @@ private:
     // Network state handling
     void onNetworkStateChange_(DVTask* origin, network::WirelessNetworkStatusMessage* message);
     void onRadioStateChange_(DVTask* origin, network::RadioConnectionStatusMessage* message);
-    void flashNetworkLight_(DVTimer*);
+    void updateNetworkLight_();
 
     // Voice keyer handling
     void onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage* message);
@@ -88,6 +95,7 @@ private:
     void onVoiceKeyerCompleteMessage_(DVTask* origin, audio::VoiceKeyerCompleteMessage* message);
     void onRequestStartStopKeyerMessage_(DVTask* origin, audio::RequestStartStopKeyerMessage* message);
     void onGetKeyerStateMessage_(DVTask* origin, audio::GetKeyerStateMessage* message);
+    void selectVoiceKeyerSlot_(int increment);
     void startTx_();
     void stopTx_(DVTimer*);
 
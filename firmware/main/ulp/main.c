@@ -1,6 +1,11 @@
 // Simple ULP RISC-V application to monitor the GPIO corresponding to the
 // Mode button. If it's pressed for >= 1 second, we trigger a wakeup of 
 // the main processor.
+//
+// Note: fuel gauge sampling can't be moved here. The MAX17048 sits on 
+// GPIO47/48, which aren't RTC IOs, so neither the RTC I2C peripheral nor 
+// bit-banging from the ULP can reach it. Charging is therefore still 
+// detected via the USB power divider on GPIO0 and handled by FuelGaugeTask.
 
 #include <stdio.h>
 #include <stdint.h>
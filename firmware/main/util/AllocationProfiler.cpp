@@ -0,0 +1,436 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "AllocationProfiler.h"
+
+#define CURRENT_LOG_TAG ("AllocationProfiler")
+
+#define ALLOCATION_PROFILER_MAX_SITES (64)
+#define ALLOCATION_PROFILER_TOP_SITES (12)
+
+// Live allocations are no longer tracked past this fill level of the table
+// so that probe sequences stay short.
+#define ALLOCATION_PROFILER_MAX_FILL_PERCENT (75)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+namespace
+{
+
+static_assert(
+    (CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS & (CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS - 1)) == 0, 
+    "CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS must be a power of two");
+
+struct Site
+{
+    uintptr_t task; // TaskHandle_t; 0 before the scheduler starts or in an ISR
+    uintptr_t caller; // 0 if only the task is known
+    char taskName[configMAX_TASK_NAME_LEN];
+    uint32_t numAllocs;
+    uint32_t numFrees;
+    uint64_t bytesAllocated;
+    uint32_t liveCount;
+    uint32_t liveBytes;
+    uint32_t peakLiveBytes;
+
+    // As of the last report.
+    uint32_t reportedAllocs;
+    uint64_t reportedBytes;
+};
+
+struct Allocation
+{
+    uintptr_t ptr; // 0 if the slot is empty
+    uint32_t size;
+    uint16_t site;
+};
+
+struct HeapReport
+{
+    const char* name;
+    uint32_t caps;
+    uint32_t previousLargestBlock;
+};
+
+// Site 0 collects whatever doesn't fit once all others are in use.
+Site Sites[ALLOCATION_PROFILER_MAX_SITES];
+int NumSites = 0;
+
+Allocation* Allocations = nullptr;
+uint32_t NumAllocations = 0;
+uint32_t NumUntracked = 0; // allocations made while the table was full
+
+Site* ReportSites = nullptr; // copy taken for each report
+int64_t LastReportTimeUs = 0;
+uint32_t LastReportUntracked = 0;
+
+HeapReport Heaps[] = 
+{
+    { "internal", MALLOC_CAP_INTERNAL, 0 },
+    { "SPIRAM", MALLOC_CAP_SPIRAM, 0 },
+};
+
+portMUX_TYPE Lock = portMUX_INITIALIZER_UNLOCKED;
+bool Enabled = false;
+
+// Moving an allocation to its caller's site can briefly take a site below
+// what it was at the last report.
+inline uint32_t AllocsSinceReport(const Site& site)
+{
+    return site.numAllocs > site.reportedAllocs ? site.numAllocs - site.reportedAllocs : 0;
+}
+
+inline uint64_t BytesSinceReport(const Site& site)
+{
+    return site.bytesAllocated > site.reportedBytes ? site.bytesAllocated - site.reportedBytes : 0;
+}
+
+inline uint32_t HashPointer(uintptr_t ptr)
+{
+    return ((ptr >> 2) * 2654435761u) & (CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS - 1);
+}
+
+// Must be called with Lock held.
+int FindAllocation(uintptr_t ptr)
+{
+    for (uint32_t index = HashPointer(ptr);; index = (index + 1) & (CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS - 1))
+    {
+        if (Allocations[index].ptr == ptr)
+        {
+            return index;
+        }
+        else if (Allocations[index].ptr == 0)
+        {
+            return -1;
+        }
+    }
+}
+
+// Must be called with Lock held. Shifts later entries back instead of 
+// leaving tombstones so lookups never get slower over time.
+void RemoveAllocation(uint32_t index)
+{
+    const uint32_t mask = CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS - 1;
+    uint32_t hole = index;
+    for (uint32_t next = (hole + 1) & mask; Allocations[next].ptr != 0; next = (next + 1) & mask)
+    {
+        // Entries whose home slot is cyclically in (hole, next] must stay put.
+        uint32_t home = HashPointer(Allocations[next].ptr);
+        bool staysPut = (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!staysPut)
+        {
+            Allocations[hole] = Allocations[next];
+            hole = next;
+        }
+    }
+
+    Allocations[hole].ptr = 0;
+    NumAllocations--;
+}
+
+// Must be called with Lock held.
+uint16_t GetSite(uintptr_t task, uintptr_t caller)
+{
+    for (int index = 1; index < NumSites; index++)
+    {
+        if (Sites[index].task == task && Sites[index].caller == caller)
+        {
+            return index;
+        }
+    }
+
+    if (NumSites == 0)
+    {
+        strcpy(Sites[0].taskName, "(other)");
+        NumSites = 1;
+    }
+
+    if (NumSites == ALLOCATION_PROFILER_MAX_SITES)
+    {
+        return 0;
+    }
+
+    auto site = &Sites[NumSites];
+    site->task = task;
+    site->caller = caller;
+    if (task != 0)
+    {
+        strncpy(site->taskName, pcTaskGetName((TaskHandle_t)task), configMAX_TASK_NAME_LEN - 1);
+    }
+    else
+    {
+        strcpy(site->taskName, "(none)");
+    }
+    return NumSites++;
+}
+
+inline uintptr_t CurrentTask()
+{
+    return xPortInIsrContext() ? 0 : (uintptr_t)xTaskGetCurrentTaskHandle();
+}
+
+void AddToSite(Site& site, uint32_t size)
+{
+    site.numAllocs++;
+    site.bytesAllocated += size;
+    site.liveCount++;
+    site.liveBytes += size;
+    if (site.liveBytes > site.peakLiveBytes)
+    {
+        site.peakLiveBytes = site.liveBytes;
+    }
+}
+
+void RemoveFromSite(Site& site, uint32_t size, bool undoAlloc)
+{
+    if (undoAlloc)
+    {
+        site.numAllocs--;
+        site.bytesAllocated -= size;
+    }
+    else
+    {
+        site.numFrees++;
+    }
+    site.liveCount--;
+    site.liveBytes -= size;
+}
+
+}
+
+// Heap hooks (CONFIG_HEAP_USE_HOOKS). These must never allocate. Allocations 
+// made with the cache disabled aren't supported (the tables are in SPIRAM),
+// but nothing in ezDV does that.
+extern "C" void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps)
+{
+    if (!Enabled || ptr == nullptr)
+    {
+        return;
+    }
+
+    uintptr_t task = CurrentTask();
+
+    portENTER_CRITICAL_SAFE(&Lock);
+    if (NumAllocations >= CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS * ALLOCATION_PROFILER_MAX_FILL_PERCENT / 100)
+    {
+        NumUntracked++;
+    }
+    else
+    {
+        uint16_t site = GetSite(task, 0);
+
+        uint32_t index = HashPointer((uintptr_t)ptr);
+        while (Allocations[index].ptr != 0)
+        {
+            index = (index + 1) & (CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS - 1);
+        }
+        Allocations[index].ptr = (uintptr_t)ptr;
+        Allocations[index].size = size;
+        Allocations[index].site = site;
+        NumAllocations++;
+
+        AddToSite(Sites[site], size);
+    }
+    portEXIT_CRITICAL_SAFE(&Lock);
+}
+
+extern "C" void esp_heap_trace_free_hook(void* ptr)
+{
+    if (!Enabled || ptr == nullptr)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&Lock);
+    int index = FindAllocation((uintptr_t)ptr);
+    if (index >= 0)
+    {
+        RemoveFromSite(Sites[Allocations[index].site], Allocations[index].size, false);
+        RemoveAllocation(index);
+    }
+    portEXIT_CRITICAL_SAFE(&Lock);
+}
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+
+void AllocationProfiler::Initialize()
+{
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    Allocations = (Allocation*)heap_caps_calloc(
+        CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS, sizeof(Allocation), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    ReportSites = (Site*)heap_caps_calloc(
+        ALLOCATION_PROFILER_MAX_SITES, sizeof(Site), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(Allocations != nullptr && ReportSites != nullptr);
+
+    for (auto& heap : Heaps)
+    {
+        heap.previousLargestBlock = heap_caps_get_largest_free_block(heap.caps);
+    }
+
+    LastReportTimeUs = esp_timer_get_time();
+    Enabled = true;
+
+    ESP_LOGW(CURRENT_LOG_TAG, "Allocation profiling enabled, tracking up to %d allocations", CONFIG_EZDV_ALLOCATION_PROFILER_MAX_ALLOCATIONS);
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+}
+
+void AllocationProfiler::AttributeCaller(const void* ptr, const void* caller)
+{
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    if (!Enabled || ptr == nullptr)
+    {
+        return;
+    }
+
+    uintptr_t task = CurrentTask();
+
+    portENTER_CRITICAL_SAFE(&Lock);
+    int index = FindAllocation((uintptr_t)ptr);
+    if (index >= 0)
+    {
+        auto& allocation = Allocations[index];
+        uint16_t site = GetSite(task, (uintptr_t)caller);
+        if (site != allocation.site)
+        {
+            RemoveFromSite(Sites[allocation.site], allocation.size, true);
+            AddToSite(Sites[site], allocation.size);
+            allocation.site = site;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&Lock);
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+}
+
+void AllocationProfiler::Report()
+{
+#if CONFIG_EZDV_ALLOCATION_PROFILER
+    if (!Enabled)
+    {
+        return;
+    }
+
+    // Snapshot the sites (and what they looked like last time) so that 
+    // logging happens without the lock held.
+    portENTER_CRITICAL(&Lock);
+    int numSites = NumSites;
+    memcpy(ReportSites, Sites, numSites * sizeof(Site));
+    for (int index = 0; index < numSites; index++)
+    {
+        Sites[index].reportedAllocs = Sites[index].numAllocs;
+        Sites[index].reportedBytes = Sites[index].bytesAllocated;
+    }
+    uint32_t numLive = NumAllocations;
+    uint32_t numUntracked = NumUntracked;
+    portEXIT_CRITICAL(&Lock);
+
+    auto now = esp_timer_get_time();
+    int64_t elapsedUs = now - LastReportTimeUs;
+    LastReportTimeUs = now;
+    if (elapsedUs <= 0)
+    {
+        return;
+    }
+
+    // Busiest sites first.
+    for (int index = 1; index < numSites; index++)
+    {
+        Site site = ReportSites[index];
+        uint32_t siteAllocs = AllocsSinceReport(site);
+
+        int dest = index;
+        while (dest > 0 && AllocsSinceReport(ReportSites[dest - 1]) < siteAllocs)
+        {
+            ReportSites[dest] = ReportSites[dest - 1];
+            dest--;
+        }
+        ReportSites[dest] = site;
+    }
+
+    uint32_t totalAllocs = 0;
+    for (int index = 0; index < numSites; index++)
+    {
+        totalAllocs += AllocsSinceReport(ReportSites[index]);
+    }
+
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "%" PRIu32 " allocations/min over the last %" PRId64 " s; %" PRIu32 " live, %" PRIu32 " untracked since last report",
+        (uint32_t)((uint64_t)totalAllocs * 60000000 / elapsedUs),
+        elapsedUs / 1000000,
+        numLive,
+        numUntracked - LastReportUntracked);
+    LastReportUntracked = numUntracked;
+
+    // Callers can be looked up with xtensa-esp32s3-elf-addr2line -e ezDV.elf.
+    for (int index = 0; index < numSites && index < ALLOCATION_PROFILER_TOP_SITES; index++)
+    {
+        auto& site = ReportSites[index];
+        uint32_t siteAllocs = AllocsSinceReport(site);
+        if (siteAllocs == 0 && site.liveCount == 0)
+        {
+            continue;
+        }
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "  %-16s 0x%08" PRIxPTR ": %6" PRIu32 " allocs/min, %7" PRIu32 " B/min, %5" PRIu32 " live (%" PRIu32 " B, peak %" PRIu32 " B)",
+            site.taskName,
+            site.caller,
+            (uint32_t)((uint64_t)siteAllocs * 60000000 / elapsedUs),
+            (uint32_t)(BytesSinceReport(site) * 60000000 / elapsedUs),
+            site.liveCount,
+            site.liveBytes,
+            site.peakLiveBytes);
+    }
+
+    // Fragmentation: how much of the free memory can't be had in one piece.
+    for (auto& heap : Heaps)
+    {
+        uint32_t freeBytes = heap_caps_get_free_size(heap.caps);
+        uint32_t largestBlock = heap_caps_get_largest_free_block(heap.caps);
+        uint32_t fragmentation = freeBytes > 0 ? 100 - (uint64_t)largestBlock * 100 / freeBytes : 0;
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "  %s heap: %" PRIu32 " B free, largest block %" PRIu32 " B (%+" PRId32 " B), %" PRIu32 "%% fragmented, lowest free %" PRIu32 " B",
+            heap.name,
+            freeBytes,
+            largestBlock,
+            (int32_t)(largestBlock - heap.previousLargestBlock),
+            fragmentation,
+            (uint32_t)heap_caps_get_minimum_free_size(heap.caps));
+        heap.previousLargestBlock = largestBlock;
+    }
+#endif // CONFIG_EZDV_ALLOCATION_PROFILER
+}
+
+}
+
+}
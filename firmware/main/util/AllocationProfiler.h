@@ -0,0 +1,59 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALLOCATION_PROFILER_H
+#define ALLOCATION_PROFILER_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Attributes heap allocations to the task (and, for C++ allocations,
+///        the code) making them, using ESP-IDF's heap hooks. Every live 
+///        allocation is remembered so that frees are credited back to 
+///        whoever allocated the memory even when another task frees it 
+///        (e.g. DVTask messages). Reports list the sites allocating most 
+///        often along with their live bytes, followed by per-heap 
+///        fragmentation, so steady-state allocations can be found and 
+///        removed. Does nothing unless CONFIG_EZDV_ALLOCATION_PROFILER is set.
+class AllocationProfiler
+{
+public:
+    /// @brief Allocates the tracking tables and starts profiling. Call early in app_main().
+    static void Initialize();
+
+    /// @brief Credits an allocation already seen by the heap hooks to a specific
+    ///        caller instead of just its task. Called from operator new.
+    /// @param ptr The allocation.
+    /// @param caller Return address of the code that asked for it.
+    static void AttributeCaller(const void* ptr, const void* caller);
+
+    /// @brief Logs activity since the previous report.
+    static void Report();
+};
+
+}
+
+}
+
+#endif // ALLOCATION_PROFILER_H
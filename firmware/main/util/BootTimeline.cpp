@@ -0,0 +1,173 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <cstring>
+
+#include "BootTimeline.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#if CONFIG_EZDV_BOOT_TIMELINE
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#endif // CONFIG_EZDV_BOOT_TIMELINE
+
+#define BOOT_TIMELINE_MAGIC (0x54424456) /* "VDBT" */
+
+// Task restarts etc. after this long aren't part of booting.
+#define BOOT_TIMELINE_WINDOW_US (30000000)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+#if CONFIG_EZDV_BOOT_TIMELINE
+namespace
+{
+
+// Must stay trivially constructible so it isn't cleared on startup.
+RTC_NOINIT_ATTR BootTimeline::Timeline RtcBootTimeline;
+
+BootTimeline::Timeline PreviousTimeline;
+bool HasPreviousTimeline = false;
+bool Recording = false;
+
+portMUX_TYPE TimelineLock = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t TimelineCrc(const BootTimeline::Timeline& timeline)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&timeline, offsetof(BootTimeline::Timeline, crc));
+}
+
+}
+#endif // CONFIG_EZDV_BOOT_TIMELINE
+
+BootTimeline::Step::Step(const char* name)
+    : name_(name)
+    , startUs_(esp_timer_get_time())
+{
+    // empty
+}
+
+BootTimeline::Step::~Step()
+{
+    auto now = esp_timer_get_time();
+    Record_(name_, startUs_, now - startUs_, false);
+}
+
+void BootTimeline::Begin()
+{
+#if CONFIG_EZDV_BOOT_TIMELINE
+    auto& timeline = RtcBootTimeline;
+    if (timeline.magic == BOOT_TIMELINE_MAGIC && timeline.crc == TimelineCrc(timeline) &&
+        timeline.numEvents <= MAX_EVENTS)
+    {
+        PreviousTimeline = timeline;
+        HasPreviousTimeline = true;
+    }
+
+    memset(&timeline, 0, sizeof(timeline));
+    timeline.magic = BOOT_TIMELINE_MAGIC;
+    timeline.resetReason = esp_reset_reason();
+    timeline.crc = TimelineCrc(timeline);
+    Recording = true;
+#endif // CONFIG_EZDV_BOOT_TIMELINE
+}
+
+void BootTimeline::Mark(const char* name)
+{
+    Record_(name, esp_timer_get_time(), 0, false);
+}
+
+void BootTimeline::MarkOnce(const char* name)
+{
+    Record_(name, esp_timer_get_time(), 0, true);
+}
+
+bool BootTimeline::Get(Timeline& timeline, bool previous)
+{
+#if CONFIG_EZDV_BOOT_TIMELINE
+    bool result = false;
+
+    portENTER_CRITICAL(&TimelineLock);
+    if (previous)
+    {
+        if (HasPreviousTimeline)
+        {
+            timeline = PreviousTimeline;
+            result = true;
+        }
+    }
+    else if (RtcBootTimeline.magic == BOOT_TIMELINE_MAGIC)
+    {
+        timeline = RtcBootTimeline;
+        result = true;
+    }
+    portEXIT_CRITICAL(&TimelineLock);
+
+    return result;
+#else
+    return false;
+#endif // CONFIG_EZDV_BOOT_TIMELINE
+}
+
+void BootTimeline::Record_(const char* name, int64_t startUs, int64_t durationUs, bool once)
+{
+#if CONFIG_EZDV_BOOT_TIMELINE
+    // Cheap check first so that this costs next to nothing after boot.
+    if (!Recording)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&TimelineLock);
+    auto& timeline = RtcBootTimeline;
+    if (startUs >= BOOT_TIMELINE_WINDOW_US || timeline.numEvents >= MAX_EVENTS)
+    {
+        Recording = false;
+    }
+    else
+    {
+        bool found = false;
+        for (uint32_t index = 0; once && index < timeline.numEvents; index++)
+        {
+            found = !strncmp(timeline.events[index].name, name, MAX_NAME_LENGTH - 1);
+            if (found) break;
+        }
+
+        if (!found)
+        {
+            auto& event = timeline.events[timeline.numEvents++];
+            strncpy(event.name, name, MAX_NAME_LENGTH - 1);
+            event.name[MAX_NAME_LENGTH - 1] = 0;
+            event.startUs = startUs;
+            event.durationUs = durationUs;
+            timeline.crc = TimelineCrc(timeline);
+        }
+    }
+    portEXIT_CRITICAL(&TimelineLock);
+#endif // CONFIG_EZDV_BOOT_TIMELINE
+}
+
+}
+
+}
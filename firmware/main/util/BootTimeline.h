@@ -0,0 +1,92 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Records when each step of startup happens and how long it takes,
+///        so that boot time improvements can be measured. The timeline lives
+///        in RTC memory, so the previous boot's is still around after a 
+///        reset (e.g. if startup crashed). Does nothing unless 
+///        CONFIG_EZDV_BOOT_TIMELINE is set.
+class BootTimeline
+{
+public:
+    enum { MAX_EVENTS = 32, MAX_NAME_LENGTH = 20 };
+
+    struct Event
+    {
+        char name[MAX_NAME_LENGTH];
+        uint32_t startUs; // since esp_timer started
+        uint32_t durationUs; // 0 for milestones
+    };
+
+    struct Timeline
+    {
+        uint32_t magic;
+        uint32_t resetReason; // esp_reset_reason_t that started this boot
+        uint32_t numEvents;
+        Event events[MAX_EVENTS];
+        uint32_t crc; // of everything above
+    };
+
+    /// @brief Times a step from construction to destruction.
+    class Step
+    {
+    public:
+        Step(const char* name);
+        virtual ~Step();
+
+    private:
+        const char* name_;
+        int64_t startUs_;
+    };
+
+    /// @brief Starts a new timeline. Must be called first thing in app_main().
+    static void Begin();
+
+    /// @brief Records a milestone.
+    static void Mark(const char* name);
+
+    /// @brief Records a milestone unless one with the same name already exists.
+    static void MarkOnce(const char* name);
+
+    /// @brief Copies out a timeline.
+    /// @param timeline Where to copy the timeline to.
+    /// @param previous true for the boot before this one.
+    /// @return false if there's no such timeline.
+    static bool Get(Timeline& timeline, bool previous);
+
+private:
+    static void Record_(const char* name, int64_t startUs, int64_t durationUs, bool once);
+};
+
+}
+
+}
+
+#endif // BOOT_TIMELINE_H
@@ -0,0 +1,188 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <inttypes.h>
+
+#include "sdkconfig.h"
+
+#if CONFIG_EZDV_DEADLINE_WATCHDOG
+
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "DeadlineMonitor.h"
+
+#define CURRENT_LOG_TAG ("DeadlineMonitor")
+
+#define DEADLINE_WINDOW_US (CONFIG_EZDV_DEADLINE_WINDOW_MS * 1000LL)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+namespace
+{
+
+DeadlineMonitor* Monitors = nullptr;
+portMUX_TYPE MonitorsLock = portMUX_INITIALIZER_UNLOCKED;
+
+}
+
+DeadlineMonitor::DeadlineMonitor(const char* name, uint32_t periodUs, uint32_t toleranceUs)
+    : name_(name)
+    , periodUs_(periodUs)
+    , toleranceUs_(toleranceUs)
+    , lastMarkUs_(0)
+    , windowStartUs_(0)
+    , numMisses_(0)
+    , worstLateUs_(0)
+    , numRecoveries_(0)
+#if CONFIG_EZDV_EVENT_TRACE
+    , context_(nullptr)
+    , numContextEntries_(0)
+    , contextPending_(false)
+#endif // CONFIG_EZDV_EVENT_TRACE
+    , next_(nullptr)
+{
+#if CONFIG_EZDV_EVENT_TRACE
+    context_ = (EventTrace::Entry*)heap_caps_calloc(
+        CONTEXT_ENTRIES_PER_CORE * portNUM_PROCESSORS, sizeof(EventTrace::Entry), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(context_ != nullptr);
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+    portENTER_CRITICAL(&MonitorsLock);
+    next_ = Monitors;
+    Monitors = this;
+    portEXIT_CRITICAL(&MonitorsLock);
+}
+
+DeadlineMonitor::~DeadlineMonitor()
+{
+    portENTER_CRITICAL(&MonitorsLock);
+    for (DeadlineMonitor** monitor = &Monitors; *monitor != nullptr; monitor = &(*monitor)->next_)
+    {
+        if (*monitor == this)
+        {
+            *monitor = next_;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&MonitorsLock);
+
+#if CONFIG_EZDV_EVENT_TRACE
+    heap_caps_free(context_);
+#endif // CONFIG_EZDV_EVENT_TRACE
+}
+
+void DeadlineMonitor::reset()
+{
+    lastMarkUs_ = 0;
+    windowStartUs_ = 0;
+    numMisses_ = 0;
+    worstLateUs_ = 0;
+}
+
+bool DeadlineMonitor::mark(int64_t nowUs)
+{
+    int64_t lastMarkUs = lastMarkUs_;
+    lastMarkUs_ = nowUs;
+
+    if (lastMarkUs > 0 && nowUs - lastMarkUs > periodUs_ + toleranceUs_)
+    {
+        return reportMiss(nowUs, nowUs - lastMarkUs - periodUs_);
+    }
+    return false;
+}
+
+bool DeadlineMonitor::reportMiss(int64_t nowUs, uint32_t lateByUs)
+{
+    EZDV_TRACE(DEADLINE_MISS, 0, name_, lateByUs);
+
+    if (nowUs - windowStartUs_ > DEADLINE_WINDOW_US)
+    {
+        windowStartUs_ = nowUs;
+        numMisses_ = 0;
+        worstLateUs_ = 0;
+    }
+
+    numMisses_++;
+    if (lateByUs > worstLateUs_)
+    {
+        worstLateUs_ = lateByUs;
+    }
+
+    if (numMisses_ < CONFIG_EZDV_DEADLINE_MISSES_TO_RECOVER)
+    {
+        return false;
+    }
+
+    numRecoveries_++;
+    EZDV_TRACE(DEADLINE_RECOVERY, 0, name_, numMisses_);
+
+#if CONFIG_EZDV_EVENT_TRACE
+    // Keep the first recovery's context if the last one hasn't been logged yet.
+    if (!contextPending_.load(std::memory_order_acquire))
+    {
+        numContextEntries_ = EventTrace::CopyRecent(context_, CONTEXT_ENTRIES_PER_CORE);
+        contextPending_.store(true, std::memory_order_release);
+    }
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+    ESP_LOGW(
+        CURRENT_LOG_TAG, 
+        "%s: %d deadline misses within %d ms (worst %" PRIu32 " us late), recovering (%" PRIu32 " so far)",
+        name_,
+        numMisses_,
+        CONFIG_EZDV_DEADLINE_WINDOW_MS,
+        worstLateUs_,
+        numRecoveries_);
+
+    // Start over so that recovery gets a chance to work before the next one.
+    reset();
+    return true;
+}
+
+void DeadlineMonitor::LogPendingContext()
+{
+#if CONFIG_EZDV_EVENT_TRACE
+    // Monitors are only ever added at startup, so walking the list without
+    // the lock held (to be able to log) is safe.
+    portENTER_CRITICAL(&MonitorsLock);
+    DeadlineMonitor* monitor = Monitors;
+    portEXIT_CRITICAL(&MonitorsLock);
+
+    for (; monitor != nullptr; monitor = monitor->next_)
+    {
+        if (monitor->contextPending_.load(std::memory_order_acquire))
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Trace leading up to %s recovery:", monitor->name_);
+            EventTrace::LogEntries(CURRENT_LOG_TAG, monitor->context_, monitor->numContextEntries_);
+            monitor->contextPending_.store(false, std::memory_order_release);
+        }
+    }
+#endif // CONFIG_EZDV_EVENT_TRACE
+}
+
+}
+
+}
+
+#endif // CONFIG_EZDV_DEADLINE_WATCHDOG
@@ -0,0 +1,97 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEADLINE_MONITOR_H
+#define DEADLINE_MONITOR_H
+
+#include <atomic>
+#include <cinttypes>
+
+#include "sdkconfig.h"
+#include "EventTrace.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Watches something that has to happen on a schedule (an I2S DMA 
+///        buffer, a modem frame, an outgoing audio packet) for missed 
+///        deadlines. A few misses are normal; CONFIG_EZDV_DEADLINE_MISSES_TO_RECOVER
+///        of them within CONFIG_EZDV_DEADLINE_WINDOW_MS means the owner should
+///        recover (flush FIFOs, reset the modem, restart a connection) rather
+///        than carry on or assert. Recoveries are logged right away. The trace
+///        events leading up to them (with CONFIG_EZDV_EVENT_TRACE) are kept and
+///        logged later by LogPendingContext() so that real-time code never
+///        waits on the console for more than one line.
+class DeadlineMonitor
+{
+public:
+    /// @brief Creates a monitor.
+    /// @param name Shown in logs and traces. Must outlive the monitor.
+    /// @param periodUs How often mark() is expected to be called.
+    /// @param toleranceUs How late mark() can be before it counts as a miss.
+    DeadlineMonitor(const char* name, uint32_t periodUs, uint32_t toleranceUs);
+    virtual ~DeadlineMonitor();
+
+    /// @brief Forgets the previous mark() and any misses, e.g. when the stream starts or stops.
+    void reset();
+
+    /// @brief Records that the scheduled work happened.
+    /// @param nowUs The current time.
+    /// @return true if the owner should recover now.
+    bool mark(int64_t nowUs);
+
+    /// @brief Records a miss detected by the owner (e.g. processing that took too long).
+    /// @param nowUs The current time.
+    /// @param lateByUs How far past the deadline it was.
+    /// @return true if the owner should recover now.
+    bool reportMiss(int64_t nowUs, uint32_t lateByUs);
+
+    /// @brief Logs the trace context of every recovery since the last call. 
+    ///        Call periodically from a low priority task.
+    static void LogPendingContext();
+
+private:
+    enum { CONTEXT_ENTRIES_PER_CORE = 16 };
+
+    const char* name_;
+    uint32_t periodUs_;
+    uint32_t toleranceUs_;
+
+    int64_t lastMarkUs_;
+    int64_t windowStartUs_;
+    int numMisses_;
+    uint32_t worstLateUs_;
+    uint32_t numRecoveries_;
+
+#if CONFIG_EZDV_EVENT_TRACE
+    // Written by the owner when recovering, read by LogPendingContext().
+    EventTrace::Entry* context_;
+    int numContextEntries_;
+    std::atomic<bool> contextPending_;
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+    DeadlineMonitor* next_;
+};
+
+}
+
+}
+
+#endif // DEADLINE_MONITOR_H
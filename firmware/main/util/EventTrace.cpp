@@ -0,0 +1,520 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "EventTrace.h"
+#include "JsonWriter.h"
+#include "audio/AudioGraph.h"
+#include "task/DVTask.h"
+
+#define CURRENT_LOG_TAG ("EventTrace")
+
+// Output is handed to the caller in pieces of this size.
+#define EVENT_TRACE_CHUNK_SIZE (2048)
+#define EVENT_TRACE_MAX_EVENT_SIZE (256)
+
+#define EVENT_TRACE_MAX_TASK_NAMES (48)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+#if CONFIG_EZDV_EVENT_TRACE
+namespace
+{
+
+static_assert(
+    (CONFIG_EZDV_EVENT_TRACE_RECORDS & (CONFIG_EZDV_EVENT_TRACE_RECORDS - 1)) == 0, 
+    "CONFIG_EZDV_EVENT_TRACE_RECORDS must be a power of two");
+
+struct Ring
+{
+    EventTrace::Entry* records;
+    std::atomic<uint32_t> writeIndex; // free-running
+};
+
+Ring Rings[portNUM_PROCESSORS];
+std::atomic<bool> Recording(false);
+
+struct TaskName
+{
+    uintptr_t handle;
+    const char* name;
+};
+
+struct TaskNameList
+{
+    TaskName names[EVENT_TRACE_MAX_TASK_NAMES];
+    int numNames;
+};
+
+/// Collects output into chunks so the writer isn't called for every event.
+class ChunkedOutput
+{
+public:
+    ChunkedOutput(EventTrace::WriteFn fn, void* arg, char* buffer)
+        : fn_(fn)
+        , arg_(arg)
+        , buffer_(buffer)
+        , used_(0)
+        , ok_(true)
+    {
+        // empty
+    }
+
+    void write(const char* data, size_t length)
+    {
+        if (used_ + length > EVENT_TRACE_CHUNK_SIZE)
+        {
+            flush();
+        }
+
+        memcpy(&buffer_[used_], data, length);
+        used_ += length;
+    }
+
+    void flush()
+    {
+        if (ok_ && used_ > 0)
+        {
+            ok_ = (*fn_)(arg_, buffer_, used_);
+        }
+        used_ = 0;
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    EventTrace::WriteFn fn_;
+    void* arg_;
+    char* buffer_;
+    size_t used_;
+    bool ok_;
+};
+
+void AddTaskName(task::DVTask* task, void* arg)
+{
+    auto list = (TaskNameList*)arg;
+    if (task->getTaskHandle() != nullptr && list->numNames < EVENT_TRACE_MAX_TASK_NAMES)
+    {
+        list->names[list->numNames++] = { (uintptr_t)task->getTaskHandle(), task->getTaskName() };
+    }
+}
+
+void DescribeFifo(uintptr_t fifo, char* buffer, size_t size)
+{
+    audio::AudioPort port;
+    if (audio::AudioGraph::FindFifoSink((const void*)fifo, port))
+    {
+        snprintf(buffer, size, "%s/%d", port.node->getAudioNodeName(), (int)port.channel);
+    }
+    else
+    {
+        snprintf(buffer, size, "0x%" PRIxPTR, fifo);
+    }
+}
+
+void WriteEvent(JsonWriter& writer, const EventTrace::Entry& record, int core, uint32_t baseUs)
+{
+    const char* name = "";
+    const char* category = "";
+    const char* phase = "i";
+    char fifoName[48];
+
+    switch (record.type)
+    {
+        case EventTrace::MESSAGE_ENQUEUE:
+            name = (const char*)record.arg0;
+            category = "message";
+            break;
+        case EventTrace::MESSAGE_DISPATCH_BEGIN:
+        case EventTrace::MESSAGE_DISPATCH_END:
+            name = (const char*)record.arg0;
+            category = "message";
+            phase = record.type == EventTrace::MESSAGE_DISPATCH_BEGIN ? "B" : "E";
+            break;
+        case EventTrace::TIMER_FIRE:
+            name = (const char*)record.arg0;
+            category = "timer";
+            break;
+        case EventTrace::TIMER_HANDLER_BEGIN:
+        case EventTrace::TIMER_HANDLER_END:
+            name = (const char*)record.arg0;
+            category = "timer";
+            phase = record.type == EventTrace::TIMER_HANDLER_BEGIN ? "B" : "E";
+            break;
+        case EventTrace::FIFO_UNDERRUN:
+            name = "underrun";
+            category = "audio";
+            break;
+        case EventTrace::FIFO_OVERRUN:
+            name = "overrun";
+            category = "audio";
+            break;
+        case EventTrace::FIFO_WATERMARK:
+            name = record.arg16 ? "high water" : "low water";
+            category = "audio";
+            break;
+        case EventTrace::PACKET_TX:
+        case EventTrace::PACKET_RX:
+        case EventTrace::PACKET_LOST:
+            name = (const char*)record.arg0;
+            category = "network";
+            break;
+        case EventTrace::STATE_TRANSITION:
+            name = "state";
+            category = "state";
+            break;
+        case EventTrace::DEADLINE_MISS:
+        case EventTrace::DEADLINE_RECOVERY:
+            name = (const char*)record.arg0;
+            category = "deadline";
+            break;
+        default:
+            break;
+    }
+
+    writer.beginObject().members(
+        "name", name,
+        "cat", category,
+        "ph", phase,
+        "ts", (uint32_t)(record.timestampUs - baseUs),
+        "pid", 1,
+        "tid", record.task);
+    if (*phase == 'i')
+    {
+        // Instant events only need to show on their own task's track.
+        writer.member("s", "t");
+    }
+
+    writer.key("args").beginObject().member("core", core);
+    switch (record.type)
+    {
+        case EventTrace::MESSAGE_ENQUEUE:
+            writer.members("id", record.arg16, "to", (const char*)record.arg1);
+            break;
+        case EventTrace::MESSAGE_DISPATCH_BEGIN:
+            writer.member("id", record.arg16);
+            break;
+        case EventTrace::FIFO_UNDERRUN:
+        case EventTrace::FIFO_OVERRUN:
+        case EventTrace::FIFO_WATERMARK:
+            DescribeFifo(record.arg0, fifoName, sizeof(fifoName));
+            writer.members("fifo", (const char*)fifoName, "samples", record.arg1);
+            break;
+        case EventTrace::PACKET_TX:
+            writer.members("direction", "tx", "sent", record.arg16 != 0);
+            break;
+        case EventTrace::PACKET_RX:
+            writer.members("direction", "rx", "sequence", record.arg16);
+            break;
+        case EventTrace::PACKET_LOST:
+            writer.members("direction", "lost", "packets", record.arg1);
+            break;
+        case EventTrace::STATE_TRANSITION:
+            writer.members("task", (const char*)record.arg0, "state", (int16_t)record.arg16);
+            break;
+        case EventTrace::DEADLINE_MISS:
+            writer.members("event", "miss", "lateUs", record.arg1);
+            break;
+        case EventTrace::DEADLINE_RECOVERY:
+            writer.members("event", "recovery", "misses", record.arg1);
+            break;
+        default:
+            break;
+    }
+    writer.endObject().endObject();
+}
+
+/// One line summary of an event for the console.
+void DescribeEvent(const EventTrace::Entry& record, char* buffer, size_t size)
+{
+    char fifoName[48];
+
+    switch (record.type)
+    {
+        case EventTrace::MESSAGE_ENQUEUE:
+            snprintf(buffer, size, "enqueue %s:%d to %s", (const char*)record.arg0, record.arg16, (const char*)record.arg1);
+            break;
+        case EventTrace::MESSAGE_DISPATCH_BEGIN:
+        case EventTrace::MESSAGE_DISPATCH_END:
+            snprintf(
+                buffer, size, "%s %s:%d", 
+                record.type == EventTrace::MESSAGE_DISPATCH_BEGIN ? "dispatch" : "dispatched",
+                (const char*)record.arg0, record.arg16);
+            break;
+        case EventTrace::TIMER_FIRE:
+            snprintf(buffer, size, "timer %s fired", (const char*)record.arg0);
+            break;
+        case EventTrace::TIMER_HANDLER_BEGIN:
+        case EventTrace::TIMER_HANDLER_END:
+            snprintf(
+                buffer, size, "timer %s %s", (const char*)record.arg0,
+                record.type == EventTrace::TIMER_HANDLER_BEGIN ? "handler" : "done");
+            break;
+        case EventTrace::FIFO_UNDERRUN:
+        case EventTrace::FIFO_OVERRUN:
+        case EventTrace::FIFO_WATERMARK:
+            DescribeFifo(record.arg0, fifoName, sizeof(fifoName));
+            snprintf(
+                buffer, size, "%s %s, %" PRIuPTR " samples",
+                record.type == EventTrace::FIFO_UNDERRUN ? "underrun" : 
+                    (record.type == EventTrace::FIFO_OVERRUN ? "overrun" : (record.arg16 ? "high water" : "low water")),
+                fifoName, record.arg1);
+            break;
+        case EventTrace::PACKET_TX:
+            snprintf(buffer, size, "%s TX%s", (const char*)record.arg0, record.arg16 ? "" : " failed");
+            break;
+        case EventTrace::PACKET_RX:
+            snprintf(buffer, size, "%s RX seq %d", (const char*)record.arg0, record.arg16);
+            break;
+        case EventTrace::PACKET_LOST:
+            snprintf(buffer, size, "%s lost %" PRIuPTR " packets", (const char*)record.arg0, record.arg1);
+            break;
+        case EventTrace::STATE_TRANSITION:
+            snprintf(buffer, size, "%s state %d", (const char*)record.arg0, (int16_t)record.arg16);
+            break;
+        case EventTrace::DEADLINE_MISS:
+            snprintf(buffer, size, "%s missed deadline by %" PRIuPTR " us", (const char*)record.arg0, record.arg1);
+            break;
+        case EventTrace::DEADLINE_RECOVERY:
+            snprintf(buffer, size, "%s recovering after %" PRIuPTR " misses", (const char*)record.arg0, record.arg1);
+            break;
+        default:
+            snprintf(buffer, size, "event %d", record.type);
+            break;
+    }
+}
+
+}
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+void EventTrace::Initialize()
+{
+#if CONFIG_EZDV_EVENT_TRACE
+    // Only read when dumping, so PSRAM is fine.
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        Rings[core].records = (Entry*)heap_caps_calloc(
+            CONFIG_EZDV_EVENT_TRACE_RECORDS, sizeof(Entry), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+        assert(Rings[core].records != nullptr);
+    }
+
+    Recording.store(true, std::memory_order_release);
+#endif // CONFIG_EZDV_EVENT_TRACE
+}
+
+void EventTrace::Record(EventType type, uint16_t arg16, uintptr_t arg0, uintptr_t arg1)
+{
+#if CONFIG_EZDV_EVENT_TRACE
+    if (!Recording.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // Claiming the slot atomically means an interrupt or higher priority 
+    // task on the same core can't end up writing to it too.
+    auto& ring = Rings[xPortGetCoreID()];
+    uint32_t index = ring.writeIndex.fetch_add(1, std::memory_order_relaxed) & (CONFIG_EZDV_EVENT_TRACE_RECORDS - 1);
+
+    auto& record = ring.records[index];
+    record.timestampUs = (uint32_t)esp_timer_get_time();
+    record.type = type;
+    record.arg16 = arg16;
+    record.task = (uintptr_t)xTaskGetCurrentTaskHandle();
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+#endif // CONFIG_EZDV_EVENT_TRACE
+}
+
+bool EventTrace::Dump(WriteFn fn, void* arg)
+{
+#if CONFIG_EZDV_EVENT_TRACE
+    if (!Recording.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    char* chunk = (char*)heap_caps_malloc(EVENT_TRACE_CHUNK_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    auto taskNames = (TaskNameList*)heap_caps_calloc(1, sizeof(TaskNameList), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    if (chunk == nullptr || taskNames == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not allocate memory for trace dump");
+        heap_caps_free(chunk);
+        heap_caps_free(taskNames);
+        return false;
+    }
+
+    // Give anything in the middle of recording a chance to finish.
+    Recording.store(false, std::memory_order_release);
+    vTaskDelay(1);
+
+    task::DVTask::ForEachTask(&AddTaskName, taskNames);
+
+    // Timestamps are shown relative to the oldest record.
+    uint32_t firstIndex[portNUM_PROCESSORS];
+    uint32_t numRecords[portNUM_PROCESSORS];
+    uint32_t baseUs = (uint32_t)esp_timer_get_time();
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        uint32_t writeIndex = Rings[core].writeIndex.load(std::memory_order_relaxed);
+        numRecords[core] = writeIndex < CONFIG_EZDV_EVENT_TRACE_RECORDS ? writeIndex : CONFIG_EZDV_EVENT_TRACE_RECORDS;
+        firstIndex[core] = writeIndex - numRecords[core];
+
+        if (numRecords[core] > 0)
+        {
+            uint32_t oldestUs = Rings[core].records[firstIndex[core] & (CONFIG_EZDV_EVENT_TRACE_RECORDS - 1)].timestampUs;
+            if ((int32_t)(oldestUs - baseUs) < 0)
+            {
+                baseUs = oldestUs;
+            }
+        }
+    }
+
+    ChunkedOutput output(fn, arg, chunk);
+    char event[EVENT_TRACE_MAX_EVENT_SIZE];
+    bool first = true;
+
+    auto writeEvent = [&](const JsonWriter& writer) {
+        if (!writer.ok())
+        {
+            return;
+        }
+
+        if (!first)
+        {
+            output.write(",\n", 2);
+        }
+        first = false;
+        output.write(writer.c_str(), writer.length());
+    };
+
+    output.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 40);
+    for (int index = 0; index < taskNames->numNames; index++)
+    {
+        JsonWriter writer(event, sizeof(event));
+        writer.beginObject().members(
+            "name", "thread_name",
+            "ph", "M",
+            "pid", 1,
+            "tid", taskNames->names[index].handle);
+        writer.key("args").beginObject().member("name", taskNames->names[index].name).endObject();
+        writer.endObject();
+        writeEvent(writer);
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS && output.ok(); core++)
+    {
+        for (uint32_t index = 0; index < numRecords[core] && output.ok(); index++)
+        {
+            auto& record = Rings[core].records[(firstIndex[core] + index) & (CONFIG_EZDV_EVENT_TRACE_RECORDS - 1)];
+
+            JsonWriter writer(event, sizeof(event));
+            WriteEvent(writer, record, core, baseUs);
+            writeEvent(writer);
+        }
+    }
+    output.write("\n]}\n", 4);
+    output.flush();
+
+    Recording.store(true, std::memory_order_release);
+
+    heap_caps_free(chunk);
+    heap_caps_free(taskNames);
+    return output.ok();
+#else
+    return false;
+#endif // CONFIG_EZDV_EVENT_TRACE
+}
+
+int EventTrace::CopyRecent(Entry* entries, int maxPerCore)
+{
+    int numCopied = 0;
+#if CONFIG_EZDV_EVENT_TRACE
+    if (!Recording.load(std::memory_order_acquire))
+    {
+        return 0;
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        // Events still being recorded may be torn; this is only for context.
+        uint32_t writeIndex = Rings[core].writeIndex.load(std::memory_order_relaxed);
+        uint32_t numRecords = writeIndex < (uint32_t)maxPerCore ? writeIndex : maxPerCore;
+        for (uint32_t index = writeIndex - numRecords; index != writeIndex; index++)
+        {
+            entries[numCopied++] = Rings[core].records[index & (CONFIG_EZDV_EVENT_TRACE_RECORDS - 1)];
+        }
+    }
+#endif // CONFIG_EZDV_EVENT_TRACE
+    return numCopied;
+}
+
+void EventTrace::LogEntries(const char* tag, const Entry* entries, int numEntries)
+{
+#if CONFIG_EZDV_EVENT_TRACE
+    auto taskNames = (TaskNameList*)heap_caps_calloc(1, sizeof(TaskNameList), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    if (taskNames == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not allocate memory for task names");
+        return;
+    }
+    task::DVTask::ForEachTask(&AddTaskName, taskNames);
+
+    char description[EVENT_TRACE_MAX_EVENT_SIZE];
+    char taskName[12];
+    for (int index = 0; index < numEntries; index++)
+    {
+        auto& entry = entries[index];
+        const char* name = nullptr;
+        for (int nameIndex = 0; nameIndex < taskNames->numNames; nameIndex++)
+        {
+            if (taskNames->names[nameIndex].handle == entry.task)
+            {
+                name = taskNames->names[nameIndex].name;
+                break;
+            }
+        }
+        if (name == nullptr)
+        {
+            snprintf(taskName, sizeof(taskName), "0x%08" PRIxPTR, entry.task);
+            name = taskName;
+        }
+
+        DescribeEvent(entry, description, sizeof(description));
+        ESP_LOGW(tag, "  %10" PRIu32 " %-16s %s", entry.timestampUs, name, description);
+    }
+
+    heap_caps_free(taskNames);
+#endif // CONFIG_EZDV_EVENT_TRACE
+}
+
+}
+
+}
@@ -0,0 +1,117 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <cinttypes>
+#include <cstddef>
+
+#include "sdkconfig.h"
+
+/// @brief Records a trace event (see EventTrace::EventType for what the 
+///        arguments mean). Compiles to nothing, without evaluating any of its
+///        arguments, unless CONFIG_EZDV_EVENT_TRACE is set.
+#if CONFIG_EZDV_EVENT_TRACE
+#define EZDV_TRACE(type, arg16, arg0, arg1) \
+    ezdv::util::EventTrace::Record( \
+        ezdv::util::EventTrace::type, (uint16_t)(arg16), (uintptr_t)(arg0), (uintptr_t)(arg1))
+#else
+#define EZDV_TRACE(type, arg16, arg0, arg1) do { } while (0)
+#endif // CONFIG_EZDV_EVENT_TRACE
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Low overhead binary trace of task, timer, audio and network events
+///        for tracking down glitches that logging would disturb. Each core 
+///        records into its own ring of fixed size records without locking, 
+///        keeping only the most recent CONFIG_EZDV_EVENT_TRACE_RECORDS. The 
+///        rings can be dumped in Chrome's JSON trace format, which Perfetto
+///        (ui.perfetto.dev) and chrome://tracing open as a timeline.
+class EventTrace
+{
+public:
+    /// @brief Types of trace events. String arguments must point to storage 
+    ///        that outlives the trace (e.g. literals, event bases, task names).
+    enum EventType : uint16_t
+    {
+        MESSAGE_ENQUEUE, // arg16: event ID, arg0: event base, arg1: destination task name
+        MESSAGE_DISPATCH_BEGIN, // arg16: event ID, arg0: event base
+        MESSAGE_DISPATCH_END, // arg16: event ID, arg0: event base
+        TIMER_FIRE, // arg0: timer name
+        TIMER_HANDLER_BEGIN, // arg0: timer name
+        TIMER_HANDLER_END, // arg0: timer name
+        FIFO_UNDERRUN, // arg0: FIFO, arg1: samples missing
+        FIFO_OVERRUN, // arg0: FIFO, arg1: samples dropped
+        FIFO_WATERMARK, // arg16: 1 when rising above the high mark, 0 when back below the low mark; arg0: FIFO, arg1: samples queued
+        PACKET_TX, // arg16: 1 if sent, arg0: stream name
+        PACKET_RX, // arg16: sequence number (if any), arg0: stream name
+        PACKET_LOST, // arg0: stream name, arg1: number of packets
+        STATE_TRANSITION, // arg16: new state (-1 for none), arg0: owning task name
+        DEADLINE_MISS, // arg0: DeadlineMonitor name, arg1: us late
+        DEADLINE_RECOVERY, // arg0: DeadlineMonitor name, arg1: number of misses
+
+        NUM_EVENT_TYPES
+    };
+
+    struct Entry
+    {
+        uint32_t timestampUs; // lower 32 bits of esp_timer_get_time()
+        uint16_t type;
+        uint16_t arg16;
+        uintptr_t task; // TaskHandle_t of whoever recorded it
+        uintptr_t arg0;
+        uintptr_t arg1;
+    };
+
+    /// @brief Called with each piece of a dump. Returns false to stop early.
+    using WriteFn = bool(*)(void* arg, const char* data, size_t length);
+
+    /// @brief Allocates the rings and starts recording. Call early in app_main().
+    static void Initialize();
+
+    /// @brief Records an event; use EZDV_TRACE() instead so it can be compiled out.
+    static void Record(EventType type, uint16_t arg16, uintptr_t arg0, uintptr_t arg1);
+
+    /// @brief Writes everything recorded so far as a Chrome JSON trace. 
+    ///        Recording is paused while this runs.
+    /// @param fn Called with each piece of output, in order.
+    /// @param arg Passed to fn.
+    /// @return false if fn stopped the dump or tracing is disabled.
+    static bool Dump(WriteFn fn, void* arg);
+
+    /// @brief Copies the most recent events from each core, oldest first per core.
+    ///        Cheap enough to call from real-time code.
+    /// @param entries Room for maxPerCore * portNUM_PROCESSORS entries.
+    /// @param maxPerCore How many events to take from each core.
+    /// @return The number of entries copied (0 if tracing is disabled).
+    static int CopyRecent(Entry* entries, int maxPerCore);
+
+    /// @brief Logs events (e.g. from CopyRecent()) one per line.
+    /// @param tag Log tag to use.
+    static void LogEntries(const char* tag, const Entry* entries, int numEntries);
+};
+
+}
+
+}
+
+#endif // EVENT_TRACE_H
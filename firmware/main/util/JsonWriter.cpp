@@ -0,0 +1,194 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "JsonWriter.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+JsonWriter::JsonWriter(char* buffer, size_t size)
+    : buffer_(buffer)
+    , size_(size)
+    , used_(0)
+    , overflow_(false)
+    , needsComma_(false)
+{
+    assert(size_ > 0);
+    buffer_[0] = 0;
+}
+
+JsonWriter& JsonWriter::beginObject()
+{
+    beginValue_();
+    append_('{');
+    needsComma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject()
+{
+    append_('}');
+    needsComma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray()
+{
+    beginValue_();
+    append_('[');
+    needsComma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray()
+{
+    append_(']');
+    needsComma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(const char* name)
+{
+    beginValue_();
+    appendString_(name);
+    append_(':');
+
+    // The value follows directly.
+    needsComma_ = false;
+    return *this;
+}
+
+void JsonWriter::beginValue_()
+{
+    if (needsComma_)
+    {
+        append_(',');
+    }
+}
+
+void JsonWriter::append_(char c)
+{
+    append_(&c, 1);
+}
+
+void JsonWriter::append_(const char* str, size_t length)
+{
+    // Keep room for the terminator.
+    if (overflow_ || used_ + length >= size_)
+    {
+        overflow_ = true;
+        return;
+    }
+
+    memcpy(&buffer_[used_], str, length);
+    used_ += length;
+    buffer_[used_] = 0;
+}
+
+void JsonWriter::appendString_(const char* str)
+{
+    static const char HexDigits[] = "0123456789abcdef";
+
+    append_('"');
+
+    // Copy runs of characters that don't need escaping all at once.
+    const char* runStart = str;
+    for (; *str != 0; str++)
+    {
+        unsigned char c = *str;
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+
+        append_(runStart, str - runStart);
+        runStart = str + 1;
+
+        char escape[6] = { '\\', 0, 0, 0, 0, 0 };
+        int escapeLength = 2;
+        switch (c)
+        {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = HexDigits[c >> 4];
+                escape[5] = HexDigits[c & 0xF];
+                escapeLength = 6;
+                break;
+        }
+        append_(escape, escapeLength);
+    }
+    append_(runStart, str - runStart);
+
+    append_('"');
+}
+
+void JsonWriter::appendSigned_(int64_t val)
+{
+    char tmp[24];
+    int length = snprintf(tmp, sizeof(tmp), "%" PRId64, val);
+    append_(tmp, length);
+}
+
+void JsonWriter::appendUnsigned_(uint64_t val)
+{
+    char tmp[24];
+    int length = snprintf(tmp, sizeof(tmp), "%" PRIu64, val);
+    append_(tmp, length);
+}
+
+void JsonWriter::appendDouble_(double val, bool isFloat)
+{
+    // JSON has no representation for these (cJSON also uses null).
+    if (std::isnan(val) || std::isinf(val))
+    {
+        append_("null", 4);
+        return;
+    }
+
+    // Like cJSON, prefer the shorter form if it reads back the same.
+    char tmp[32];
+    int length = snprintf(tmp, sizeof(tmp), "%1.*g", isFloat ? 7 : 15, val);
+    double readBack = strtod(tmp, nullptr);
+    if (isFloat ? ((float)readBack != (float)val) : (readBack != val))
+    {
+        length = snprintf(tmp, sizeof(tmp), "%1.*g", isFloat ? 9 : 17, val);
+    }
+    append_(tmp, length);
+}
+
+}
+
+}
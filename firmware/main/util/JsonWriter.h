@@ -0,0 +1,157 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Formats JSON directly into a caller provided buffer, for messages
+///        whose shape is known ahead of time. Unlike building a cJSON tree,
+///        nothing is allocated. Example:
+///
+///            JsonWriter writer(buffer, sizeof(buffer));
+///            writer.beginObject().members("type", "batteryStatus", "voltage", 3.7f).endObject();
+///
+///        If the output doesn't fit, ok() returns false and the buffer's
+///        contents should not be used.
+class JsonWriter
+{
+public:
+    /// @brief Creates a writer.
+    /// @param buffer Where to write the output. Always NUL terminated.
+    /// @param size The size of the buffer, including room for the terminator.
+    JsonWriter(char* buffer, size_t size);
+    virtual ~JsonWriter() = default;
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+
+    /// @brief Writes an object member's name. Its value must follow.
+    JsonWriter& key(const char* name);
+
+    /// @brief Writes a value (in an array, after key() or at the top level).
+    template<typename T>
+    JsonWriter& value(T val);
+
+    /// @brief Writes a name/value pair in the current object.
+    template<typename T>
+    JsonWriter& member(const char* name, T val)
+    {
+        return key(name).value(val);
+    }
+
+    /// @brief Writes any number of name/value pairs in the current object.
+    template<typename T, typename... Rest>
+    JsonWriter& members(const char* name, T val, Rest... rest)
+    {
+        member(name, val);
+        if constexpr (sizeof...(rest) > 0)
+        {
+            members(rest...);
+        }
+        return *this;
+    }
+
+    /// @brief Returns false if the output was truncated.
+    bool ok() const { return !overflow_; }
+
+    const char* c_str() const { return buffer_; }
+    size_t length() const { return used_; }
+
+private:
+    char* buffer_;
+    size_t size_;
+    size_t used_;
+    bool overflow_;
+    bool needsComma_;
+
+    void beginValue_();
+    void append_(char c);
+    void append_(const char* str, size_t length);
+    void appendString_(const char* str);
+    void appendSigned_(int64_t val);
+    void appendUnsigned_(uint64_t val);
+    void appendDouble_(double val, bool isFloat);
+};
+
+template<typename T>
+JsonWriter& JsonWriter::value(T val)
+{
+    beginValue_();
+
+    using Type = std::decay_t<T>;
+    if constexpr (std::is_same_v<Type, bool>)
+    {
+        if (val) append_("true", 4);
+        else append_("false", 5);
+    }
+    else if constexpr (std::is_same_v<Type, std::nullptr_t>)
+    {
+        append_("null", 4);
+    }
+    else if constexpr (std::is_same_v<Type, std::string>)
+    {
+        appendString_(val.c_str());
+    }
+    else if constexpr (std::is_same_v<Type, const char*> || std::is_same_v<Type, char*>)
+    {
+        appendString_(val);
+    }
+    else if constexpr (std::is_enum_v<Type>)
+    {
+        appendSigned_((int64_t)val);
+    }
+    else if constexpr (std::is_integral_v<Type> && std::is_signed_v<Type>)
+    {
+        appendSigned_(val);
+    }
+    else if constexpr (std::is_integral_v<Type>)
+    {
+        appendUnsigned_(val);
+    }
+    else if constexpr (std::is_same_v<Type, float>)
+    {
+        appendDouble_(val, true);
+    }
+    else
+    {
+        static_assert(std::is_floating_point_v<Type>, "unsupported JSON value type");
+        appendDouble_(val, false);
+    }
+
+    needsComma_ = true;
+    return *this;
+}
+
+}
+
+}
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,209 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+
+#include "MemoryPlacement.h"
+
+#define INTERNAL_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT)
+#define SPIRAM_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+struct MemoryClassState
+{
+    const char* name;
+    bool internal;
+    std::atomic<size_t> internalBytes;
+    std::atomic<size_t> spiramBytes;
+    std::atomic<uint32_t> numAllocations;
+    std::atomic<uint32_t> numFallbacks;
+};
+
+#if CONFIG_EZDV_MEMORY_DSP_BUFFERS_INTERNAL
+#define DSP_BUFFERS_INTERNAL true
+#else
+#define DSP_BUFFERS_INTERNAL false
+#endif // CONFIG_EZDV_MEMORY_DSP_BUFFERS_INTERNAL
+
+#if CONFIG_EZDV_MEMORY_VITA_PACKETS_INTERNAL
+#define VITA_PACKETS_INTERNAL true
+#else
+#define VITA_PACKETS_INTERNAL false
+#endif // CONFIG_EZDV_MEMORY_VITA_PACKETS_INTERNAL
+
+#if CONFIG_EZDV_MEMORY_ICOM_PACKETS_INTERNAL
+#define ICOM_PACKETS_INTERNAL true
+#else
+#define ICOM_PACKETS_INTERNAL false
+#endif // CONFIG_EZDV_MEMORY_ICOM_PACKETS_INTERNAL
+
+#if CONFIG_EZDV_MEMORY_CODEC2_INTERNAL
+#define CODEC2_INTERNAL true
+#else
+#define CODEC2_INTERNAL false
+#endif // CONFIG_EZDV_MEMORY_CODEC2_INTERNAL
+
+#if CONFIG_EZDV_MEMORY_CONTAINERS_INTERNAL
+#define CONTAINERS_INTERNAL true
+#else
+#define CONTAINERS_INTERNAL false
+#endif // CONFIG_EZDV_MEMORY_CONTAINERS_INTERNAL
+
+// Indexed by MemoryClass.
+static MemoryClassState Classes_[MemoryPlacement::NUM_MEMORY_CLASSES] = {
+    { "dsp_buffers", DSP_BUFFERS_INTERNAL, {0}, {0}, {0}, {0} },
+    { "vita_packets", VITA_PACKETS_INTERNAL, {0}, {0}, {0}, {0} },
+    { "icom_packets", ICOM_PACKETS_INTERNAL, {0}, {0}, {0}, {0} },
+    { "codec2", CODEC2_INTERNAL, {0}, {0}, {0}, {0} },
+    { "containers", CONTAINERS_INTERNAL, {0}, {0}, {0}, {0} },
+};
+
+static void AccountAllocation_(MemoryClassState& state, void* ptr)
+{
+    size_t size = heap_caps_get_allocated_size(ptr);
+    if (esp_ptr_internal(ptr))
+    {
+        state.internalBytes += size;
+    }
+    else
+    {
+        state.spiramBytes += size;
+    }
+    state.numAllocations++;
+}
+
+void MemoryPlacement::SetInternal(MemoryClass memoryClass, bool internal)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+    Classes_[memoryClass].internal = internal;
+}
+
+bool MemoryPlacement::IsInternal(MemoryClass memoryClass)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+    return Classes_[memoryClass].internal;
+}
+
+const char* MemoryPlacement::GetName(MemoryClass memoryClass)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+    return Classes_[memoryClass].name;
+}
+
+void* MemoryPlacement::Allocate(MemoryClass memoryClass, size_t size)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+    MemoryClassState& state = Classes_[memoryClass];
+
+    void* ptr = nullptr;
+    if (state.internal)
+    {
+        ptr = heap_caps_malloc(size, INTERNAL_CAPS);
+        if (ptr == nullptr)
+        {
+            state.numFallbacks++;
+        }
+    }
+
+    if (ptr == nullptr)
+    {
+        ptr = heap_caps_malloc(size, SPIRAM_CAPS);
+    }
+
+    if (ptr != nullptr)
+    {
+        AccountAllocation_(state, ptr);
+    }
+    return ptr;
+}
+
+void* MemoryPlacement::Calloc(MemoryClass memoryClass, size_t num, size_t size)
+{
+    if (size != 0 && num > SIZE_MAX / size)
+    {
+        return nullptr;
+    }
+
+    void* ptr = Allocate(memoryClass, num * size);
+    if (ptr != nullptr)
+    {
+        memset(ptr, 0, num * size);
+    }
+    return ptr;
+}
+
+void* MemoryPlacement::AllocateWithCaps(MemoryClass memoryClass, size_t size, uint32_t caps)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+
+    void* ptr = heap_caps_malloc(size, caps);
+    if (ptr != nullptr)
+    {
+        AccountAllocation_(Classes_[memoryClass], ptr);
+    }
+    return ptr;
+}
+
+void MemoryPlacement::Free(MemoryClass memoryClass, void* ptr)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    MemoryClassState& state = Classes_[memoryClass];
+    size_t size = heap_caps_get_allocated_size(ptr);
+    if (esp_ptr_internal(ptr))
+    {
+        state.internalBytes -= size;
+    }
+    else
+    {
+        state.spiramBytes -= size;
+    }
+    state.numAllocations--;
+
+    heap_caps_free(ptr);
+}
+
+void MemoryPlacement::GetStatistics(MemoryClass memoryClass, Statistics& stats)
+{
+    assert(memoryClass < NUM_MEMORY_CLASSES);
+    MemoryClassState& state = Classes_[memoryClass];
+
+    stats.internalBytes = state.internalBytes.load();
+    stats.spiramBytes = state.spiramBytes.load();
+    stats.numAllocations = state.numAllocations.load();
+    stats.numFallbacks = state.numFallbacks.load();
+}
+
+}
+
+}
@@ -0,0 +1,96 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMORY_PLACEMENT_H
+#define MEMORY_PLACEMENT_H
+
+#include <cinttypes>
+#include <cstddef>
+
+#include "sdkconfig.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Central policy for where long-lived buffers go (internal RAM or 
+///        SPIRAM). Each subsystem allocates from a named memory class 
+///        whose placement comes from Kconfig (CONFIG_EZDV_MEMORY_*_INTERNAL)
+///        and can be changed at boot with SetInternal(). Bytes currently in
+///        use are tracked per class and heap so the effect of moving a class
+///        can be measured (see /metrics).
+class MemoryPlacement
+{
+public:
+    enum MemoryClass
+    {
+        DSP_BUFFERS,  // resampler and FreeDV frame buffers
+        VITA_PACKETS, // FlexRadio VITA RX/TX packets
+        ICOM_PACKETS, // Icom packet pool
+        CODEC2,       // Codec2/FreeDV internal state
+        CONTAINERS,   // STL containers and state machines (PSRamAllocator)
+        NUM_MEMORY_CLASSES
+    };
+
+    struct Statistics
+    {
+        size_t internalBytes;
+        size_t spiramBytes;
+        uint32_t numAllocations; // currently live
+        uint32_t numFallbacks;   // internal RAM requested but unavailable, since boot
+    };
+
+    /// @brief Changes a class's placement. Only affects allocations made afterward,
+    ///        so this should be called before tasks start.
+    /// @param memoryClass The class to change.
+    /// @param internal true for internal RAM, false for SPIRAM.
+    static void SetInternal(MemoryClass memoryClass, bool internal);
+
+    /// @brief Returns true if the class is currently placed in internal RAM.
+    static bool IsInternal(MemoryClass memoryClass);
+
+    /// @brief Returns the class's name as used in reports.
+    static const char* GetName(MemoryClass memoryClass);
+
+    /// @brief Allocates memory according to the class's placement. Internal 
+    ///        allocations fall back to SPIRAM if internal RAM is exhausted.
+    /// @return The allocation, or nullptr if there's no memory left.
+    static void* Allocate(MemoryClass memoryClass, size_t size);
+
+    /// @brief Same as Allocate() but zeroes the memory.
+    static void* Calloc(MemoryClass memoryClass, size_t num, size_t size);
+
+    /// @brief Allocates with specific caps (no fallback) for callers with their 
+    ///        own placement rules; the memory is still counted against the class.
+    static void* AllocateWithCaps(MemoryClass memoryClass, size_t size, uint32_t caps);
+
+    /// @brief Frees memory from Allocate(), Calloc() or AllocateWithCaps().
+    /// @param memoryClass The class the memory was allocated from.
+    /// @param ptr The allocation (may be nullptr).
+    static void Free(MemoryClass memoryClass, void* ptr);
+
+    /// @brief Retrieves a class's current usage.
+    static void GetStatistics(MemoryClass memoryClass, Statistics& stats);
+};
+
+}
+
+}
+
+#endif // MEMORY_PLACEMENT_H
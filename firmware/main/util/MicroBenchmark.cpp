@@ -0,0 +1,584 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+#include "MicroBenchmark.h"
+#include "JsonWriter.h"
+#include "PowerLock.h"
+
+#include "esp_app_desc.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "codec2_fifo.h"
+#include "codec2_math.h"
+#include "freedv_api.h"
+
+#include "audio/AudioMixer.h"
+#include "audio/AudioRingBuffer.h"
+#include "audio/Codec2Allocator.h"
+#include "audio/Codec2Fft.h"
+#include "audio/FreeDVInstanceCache.h"
+#include "network/flex/SampleRateConverter.h"
+#include "network/icom/IcomPacket.h"
+#include "network/icom/IcomPacketPool.h"
+#include "task/DVTask.h"
+#include "task/DVTaskMessage.h"
+
+#define CURRENT_LOG_TAG ("MicroBenchmark")
+
+// Prefix for every line of results, so they stand out from other logging.
+#define MICRO_BENCHMARK_OUTPUT_PREFIX "EZDV_BENCH "
+
+// FreeDV needs about as much stack as FreeDVTask has. Runs on the core that 
+// FreeDVTask doesn't so that Wi-Fi etc. interfere as little as possible.
+#define MICRO_BENCHMARK_TASK_STACK_SIZE (40000)
+#define MICRO_BENCHMARK_TASK_PRIORITY (5)
+#define MICRO_BENCHMARK_TASK_CORE (1)
+
+// The message benchmark tasks run above the benchmark task on the same core.
+#define MICRO_BENCHMARK_MESSAGE_TASK_PRIORITY (10)
+#define MICRO_BENCHMARK_MESSAGE_TASK_QUEUE_SIZE (16)
+
+// 20 ms of audio at 8 kHz, like most of the audio paths.
+#define MICRO_BENCHMARK_SAMPLES_8K (160)
+#define MICRO_BENCHMARK_SAMPLES_24K (MICRO_BENCHMARK_SAMPLES_8K * FDMDV_OS_24)
+
+#define MICRO_BENCHMARK_FAST_ITERATIONS (10000)
+#define MICRO_BENCHMARK_MESSAGE_ITERATIONS (2000)
+#define MICRO_BENCHMARK_FREEDV_FRAMES (25)
+
+// Modem frames generated by freedv_tx() for freedv_rx() to decode.
+#define MICRO_BENCHMARK_FREEDV_TX_FRAMES (8)
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(MICRO_BENCHMARK_MESSAGE);
+    DV_EVENT_DEFINE_BASE(MICRO_BENCHMARK_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace util
+{
+
+using namespace ezdv::task;
+
+namespace
+{
+
+enum MicroBenchmarkMessageTypes
+{
+    BENCHMARK_START = 1,
+    BENCHMARK_PING = 2,
+    BENCHMARK_PONG = 3,
+    BENCHMARK_SINK = 4,
+};
+
+template<uint32_t TYPE_ID>
+class MicroBenchmarkMessageCommon : public DVTaskMessageBase<TYPE_ID, MicroBenchmarkMessageCommon<TYPE_ID>>
+{
+public:
+    MicroBenchmarkMessageCommon(uint32_t valueProvided = 0)
+        : DVTaskMessageBase<TYPE_ID, MicroBenchmarkMessageCommon<TYPE_ID>>(MICRO_BENCHMARK_MESSAGE)
+        , value(valueProvided)
+        {}
+    virtual ~MicroBenchmarkMessageCommon() = default;
+
+    uint32_t value;
+};
+
+using BenchmarkStartMessage = MicroBenchmarkMessageCommon<BENCHMARK_START>;
+using BenchmarkPingMessage = MicroBenchmarkMessageCommon<BENCHMARK_PING>;
+using BenchmarkPongMessage = MicroBenchmarkMessageCommon<BENCHMARK_PONG>;
+using BenchmarkSinkMessage = MicroBenchmarkMessageCommon<BENCHMARK_SINK>;
+
+/// @brief Answers pings and counts sink messages.
+class BenchmarkEchoTask : public DVTask
+{
+public:
+    BenchmarkEchoTask(SemaphoreHandle_t doneSemaphore)
+        : DVTask("BenchEcho", MICRO_BENCHMARK_MESSAGE_TASK_PRIORITY, 4096, MICRO_BENCHMARK_TASK_CORE, MICRO_BENCHMARK_MESSAGE_TASK_QUEUE_SIZE)
+        , doneSemaphore_(doneSemaphore)
+        , numSinkMessages_(0)
+        , sinkTarget_(0)
+    {
+        registerMessageHandler(this, &BenchmarkEchoTask::onPing_);
+        registerMessageHandler(this, &BenchmarkEchoTask::onSink_);
+    }
+    virtual ~BenchmarkEchoTask() = default;
+
+    /// @brief Gives the semaphore once this many sink messages have arrived.
+    void setSinkTarget(uint32_t target)
+    {
+        numSinkMessages_ = 0;
+        sinkTarget_ = target;
+    }
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    SemaphoreHandle_t doneSemaphore_;
+    uint32_t numSinkMessages_;
+    uint32_t sinkTarget_;
+
+    void onPing_(DVTask* origin, BenchmarkPingMessage*)
+    {
+        BenchmarkPongMessage message;
+        sendTo(origin, &message);
+    }
+
+    void onSink_(DVTask*, BenchmarkSinkMessage*)
+    {
+        if (++numSinkMessages_ == sinkTarget_)
+        {
+            xSemaphoreGive(doneSemaphore_);
+        }
+    }
+};
+
+/// @brief Bounces pings off BenchmarkEchoTask, either directly (sendTo()) or
+///        by publishing them.
+class BenchmarkPingTask : public DVTask
+{
+public:
+    BenchmarkPingTask(DVTask* echoTask, SemaphoreHandle_t doneSemaphore)
+        : DVTask("BenchPing", MICRO_BENCHMARK_MESSAGE_TASK_PRIORITY, 4096, MICRO_BENCHMARK_TASK_CORE, MICRO_BENCHMARK_MESSAGE_TASK_QUEUE_SIZE)
+        , echoTask_(echoTask)
+        , doneSemaphore_(doneSemaphore)
+        , numRoundTrips_(0)
+        , targetRoundTrips_(0)
+        , usePublish_(false)
+    {
+        registerMessageHandler(this, &BenchmarkPingTask::onStart_);
+        registerMessageHandler(this, &BenchmarkPingTask::onPong_);
+    }
+    virtual ~BenchmarkPingTask() = default;
+
+    void setUsePublish(bool usePublish) { usePublish_ = usePublish; }
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    DVTask* echoTask_;
+    SemaphoreHandle_t doneSemaphore_;
+    uint32_t numRoundTrips_;
+    uint32_t targetRoundTrips_;
+    bool usePublish_;
+
+    void onStart_(DVTask*, BenchmarkStartMessage* message)
+    {
+        numRoundTrips_ = 0;
+        targetRoundTrips_ = message->value;
+        sendPing_();
+    }
+
+    void onPong_(DVTask*, BenchmarkPongMessage*)
+    {
+        if (++numRoundTrips_ < targetRoundTrips_)
+        {
+            sendPing_();
+        }
+        else
+        {
+            xSemaphoreGive(doneSemaphore_);
+        }
+    }
+
+    void sendPing_()
+    {
+        BenchmarkPingMessage message;
+        if (usePublish_)
+        {
+            publish(&message);
+        }
+        else
+        {
+            sendTo(echoTask_, &message);
+        }
+    }
+};
+
+}
+
+void MicroBenchmark::Start()
+{
+    TaskHandle_t handle = nullptr;
+    xTaskCreatePinnedToCore(&RunTaskEntry_, "MicroBenchmark", MICRO_BENCHMARK_TASK_STACK_SIZE, nullptr, MICRO_BENCHMARK_TASK_PRIORITY, &handle, MICRO_BENCHMARK_TASK_CORE);
+    assert(handle != nullptr);
+}
+
+void MicroBenchmark::RunTaskEntry_(void*)
+{
+    // Results are only comparable at full speed.
+    PowerLock powerLock("MicroBenchmark");
+    powerLock.acquire();
+
+    // Give the console (and any other startup logging) time to settle.
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    ESP_LOGI(CURRENT_LOG_TAG, "Running microbenchmarks; results are prefixed with " MICRO_BENCHMARK_OUTPUT_PREFIX);
+
+    char buffer[256];
+    JsonWriter writer(buffer, sizeof(buffer));
+    writer.beginObject().members(
+        "type", "begin",
+        "version", esp_app_get_description()->version,
+        "idfVersion", esp_app_get_description()->idf_ver,
+        "cpuMhz", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ).endObject();
+    printf(MICRO_BENCHMARK_OUTPUT_PREFIX "%s\n", writer.c_str());
+
+    BenchmarkMessaging_();
+    BenchmarkAudioBuffers_();
+    BenchmarkMixer_();
+    BenchmarkResampling_();
+    BenchmarkCodec2Math_();
+    BenchmarkFreeDV_();
+    BenchmarkIcom_();
+
+    printf(MICRO_BENCHMARK_OUTPUT_PREFIX "{\"type\":\"end\"}\n");
+    fflush(stdout);
+
+    powerLock.release();
+    vTaskDelete(nullptr);
+}
+
+template<typename FnType>
+void MicroBenchmark::Run_(const char* name, uint32_t iterations, FnType fn)
+{
+    // One untimed pass so that first-use costs (allocations, cache misses)
+    // don't skew the result.
+    fn();
+
+    uint32_t cyclesBegin = esp_cpu_get_cycle_count();
+    int64_t timeBegin = esp_timer_get_time();
+    for (uint32_t count = 0; count < iterations; count++)
+    {
+        fn();
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - cyclesBegin;
+    int64_t timeUs = esp_timer_get_time() - timeBegin;
+
+    Report_(name, iterations, cycles, timeUs);
+}
+
+void MicroBenchmark::Report_(const char* name, uint32_t iterations, uint32_t cycles, int64_t timeUs)
+{
+    // The cycle counter wraps after about 17 seconds at 240 MHz; every 
+    // benchmark here is much shorter than that.
+    char buffer[256];
+    JsonWriter writer(buffer, sizeof(buffer));
+    writer.beginObject().members(
+        "type", "result",
+        "name", name,
+        "iterations", iterations,
+        "cycles", cycles,
+        "timeUs", timeUs,
+        "cyclesPerIteration", (float)cycles / iterations).endObject();
+    assert(writer.ok());
+    printf(MICRO_BENCHMARK_OUTPUT_PREFIX "%s\n", writer.c_str());
+}
+
+void MicroBenchmark::BenchmarkMessaging_()
+{
+    SemaphoreHandle_t doneSemaphore = xSemaphoreCreateBinary();
+    assert(doneSemaphore != nullptr);
+
+    BenchmarkEchoTask echoTask(doneSemaphore);
+    BenchmarkPingTask pingTask(&echoTask, doneSemaphore);
+    echoTask.start();
+    pingTask.start();
+
+    // Each "iteration" below is a full run (start message to semaphore), so
+    // it's reported per message instead of through Run_().
+    for (bool usePublish : { false, true })
+    {
+        pingTask.setUsePublish(usePublish);
+
+        uint32_t cyclesBegin = esp_cpu_get_cycle_count();
+        int64_t timeBegin = esp_timer_get_time();
+        BenchmarkStartMessage message(MICRO_BENCHMARK_MESSAGE_ITERATIONS);
+        pingTask.post(&message);
+        xSemaphoreTake(doneSemaphore, portMAX_DELAY);
+        uint32_t cycles = esp_cpu_get_cycle_count() - cyclesBegin;
+        int64_t timeUs = esp_timer_get_time() - timeBegin;
+
+        Report_(usePublish ? "dvtask_publish_round_trip" : "dvtask_send_to_round_trip", MICRO_BENCHMARK_MESSAGE_ITERATIONS, cycles, timeUs);
+    }
+
+    // Bursts that fit in the queue, i.e. posting and dispatching without 
+    // waiting for a reply each time.
+    {
+        const uint32_t burstSize = MICRO_BENCHMARK_MESSAGE_TASK_QUEUE_SIZE / 2;
+        uint32_t numBursts = MICRO_BENCHMARK_MESSAGE_ITERATIONS / burstSize;
+
+        uint32_t cyclesBegin = esp_cpu_get_cycle_count();
+        int64_t timeBegin = esp_timer_get_time();
+        for (uint32_t burst = 0; burst < numBursts; burst++)
+        {
+            echoTask.setSinkTarget(burstSize);
+            for (uint32_t index = 0; index < burstSize; index++)
+            {
+                BenchmarkSinkMessage message(index);
+                echoTask.post(&message);
+            }
+            xSemaphoreTake(doneSemaphore, portMAX_DELAY);
+        }
+        uint32_t cycles = esp_cpu_get_cycle_count() - cyclesBegin;
+        int64_t timeUs = esp_timer_get_time() - timeBegin;
+
+        Report_("dvtask_post_dispatch", numBursts * burstSize, cycles, timeUs);
+    }
+
+    pingTask.sleep();
+    echoTask.sleep();
+    vTaskDelay(pdMS_TO_TICKS(100));
+    vSemaphoreDelete(doneSemaphore);
+}
+
+void MicroBenchmark::BenchmarkAudioBuffers_()
+{
+    short* samples = (short*)heap_caps_calloc(MICRO_BENCHMARK_SAMPLES_24K, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(samples != nullptr);
+
+    struct FIFO* fifo = codec2_fifo_create(MICRO_BENCHMARK_SAMPLES_24K * 4);
+    assert(fifo != nullptr);
+    Run_("codec2_fifo_write_read", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        codec2_fifo_write(fifo, samples, MICRO_BENCHMARK_SAMPLES_24K);
+        codec2_fifo_read(fifo, samples, MICRO_BENCHMARK_SAMPLES_24K);
+    });
+    codec2_fifo_destroy(fifo);
+
+    audio::AudioRingBuffer ringBuffer(MICRO_BENCHMARK_SAMPLES_24K * 4);
+    Run_("audio_ring_buffer_write_read", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        ringBuffer.write(samples, MICRO_BENCHMARK_SAMPLES_24K);
+        ringBuffer.read(samples, MICRO_BENCHMARK_SAMPLES_24K);
+    });
+
+    heap_caps_free(samples);
+}
+
+void MicroBenchmark::BenchmarkMixer_()
+{
+    short* samples = (short*)heap_caps_calloc(MICRO_BENCHMARK_SAMPLES_8K, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(samples != nullptr);
+    for (int index = 0; index < MICRO_BENCHMARK_SAMPLES_8K; index++)
+    {
+        samples[index] = 16384 * sinf(index * 0.1f);
+    }
+
+    // The mixer isn't started; mix() is called directly instead of by its timer.
+    audio::AudioMixer mixer;
+    audio::AudioRingBuffer output(MICRO_BENCHMARK_SAMPLES_8K * 4);
+    mixer.setAudioOutput(audio::AudioInput::LEFT_CHANNEL, &output);
+
+    // One input is the common case (FreeDV RX only), two covers beeps on 
+    // top of received audio.
+    for (int numInputs = 1; numInputs <= 2; numInputs++)
+    {
+        Run_(numInputs == 1 ? "audio_mixer_one_input" : "audio_mixer_two_inputs", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+            for (int input = 0; input < numInputs; input++)
+            {
+                mixer.getAudioInput((audio::AudioInput::ChannelLabel)input)->write(samples, MICRO_BENCHMARK_SAMPLES_8K);
+            }
+            mixer.mix();
+            output.read(samples, MICRO_BENCHMARK_SAMPLES_8K);
+        });
+    }
+
+    mixer.setAudioOutput(audio::AudioInput::LEFT_CHANNEL, nullptr);
+    heap_caps_free(samples);
+}
+
+void MicroBenchmark::BenchmarkResampling_()
+{
+    // Filter memory comes before the samples proper (see SampleRateConverter.h).
+    short* in8k = (short*)heap_caps_aligned_calloc(16, FDMDV_OS_TAPS_24_8K + MICRO_BENCHMARK_SAMPLES_8K, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    short* in24k = (short*)heap_caps_aligned_calloc(16, FDMDV_OS_TAPS_24K + MICRO_BENCHMARK_SAMPLES_24K, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    float* out24k = (float*)heap_caps_aligned_calloc(16, MICRO_BENCHMARK_SAMPLES_24K, sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    short* out8k = (short*)heap_caps_aligned_calloc(16, MICRO_BENCHMARK_SAMPLES_8K, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    uint32_t* vita = (uint32_t*)heap_caps_aligned_calloc(16, MICRO_BENCHMARK_SAMPLES_24K * 2, sizeof(uint32_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(in8k != nullptr && in24k != nullptr && out24k != nullptr && out8k != nullptr && vita != nullptr);
+
+    for (int index = 0; index < MICRO_BENCHMARK_SAMPLES_8K; index++)
+    {
+        in8k[FDMDV_OS_TAPS_24_8K + index] = 16384 * sinf(index * 0.3f);
+    }
+    for (int index = 0; index < MICRO_BENCHMARK_SAMPLES_24K; index++)
+    {
+        in24k[FDMDV_OS_TAPS_24K + index] = 16384 * sinf(index * 0.1f);
+    }
+
+    Run_("fdmdv_8_to_24_with_scaling", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        fdmdv_8_to_24_with_scaling(out24k, &in8k[FDMDV_OS_TAPS_24_8K], MICRO_BENCHMARK_SAMPLES_8K, 1.0f);
+    });
+
+    Run_("fdmdv_24_to_8", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        fdmdv_24_to_8(out8k, &in24k[FDMDV_OS_TAPS_24K], MICRO_BENCHMARK_SAMPLES_8K);
+    });
+
+    // out24k is what FlexVitaTask packs after upsampling.
+    Run_("fdmdv_float_to_vita", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        fdmdv_float_to_vita(vita, out24k, MICRO_BENCHMARK_SAMPLES_24K);
+    });
+
+    Run_("fdmdv_vita_to_short", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        fdmdv_vita_to_short(in24k, vita, MICRO_BENCHMARK_SAMPLES_24K);
+    });
+
+    heap_caps_free(in8k);
+    heap_caps_free(in24k);
+    heap_caps_free(out24k);
+    heap_caps_free(out8k);
+    heap_caps_free(vita);
+}
+
+void MicroBenchmark::BenchmarkCodec2Math_()
+{
+    // Pilot correlation lengths (M + Ncp) for 700E and 700D.
+    const int lengths[] = { 64, 160 };
+
+    for (int len : lengths)
+    {
+        // Allocated the same way codec2 allocates its own state.
+        COMP* left = (COMP*)audio::Codec2Allocator::Allocate(len * sizeof(COMP));
+        COMP* right = (COMP*)audio::Codec2Allocator::Allocate(len * sizeof(COMP));
+        assert(left != nullptr && right != nullptr);
+
+        for (int index = 0; index < len; index++)
+        {
+            left[index].real = cosf(index * 0.1f);
+            left[index].imag = sinf(index * 0.1f);
+            right[index].real = cosf(index * 0.3f);
+            right[index].imag = -sinf(index * 0.3f);
+        }
+
+        char name[48];
+        snprintf(name, sizeof(name), "codec2_complex_dot_product_f32_%d", len);
+
+        float resultReal = 0;
+        float resultImag = 0;
+        Run_(name, MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+            codec2_complex_dot_product_f32(left, right, len, &resultReal, &resultImag);
+        });
+
+        audio::Codec2Allocator::Free(left);
+        audio::Codec2Allocator::Free(right);
+    }
+}
+
+void MicroBenchmark::BenchmarkFreeDV_()
+{
+    static const struct
+    {
+        audio::FreeDVMode mode;
+        const char* name;
+    } Modes[] = 
+    {
+        { audio::FREEDV_700D, "700d" },
+        { audio::FREEDV_700E, "700e" },
+        { audio::FREEDV_1600, "1600" },
+    };
+
+    // Needs to happen before any FreeDV instance is opened (see FreeDVTask).
+    codec2_fft_accel_init();
+
+    for (auto& mode : Modes)
+    {
+        audio::FreeDVInstanceCache cache;
+        struct freedv* dv = cache.acquire(mode.mode);
+        short* speech = cache.getSpeechBuffer();
+        short* modem = cache.getModemBuffer();
+
+        int numSpeechSamples = freedv_get_n_speech_samples(dv);
+        int numModemSamples = freedv_get_n_nom_modem_samples(dv);
+        int maxModemSamples = freedv_get_n_max_modem_samples(dv);
+        for (int index = 0; index < numSpeechSamples; index++)
+        {
+            speech[index] = 8192 * sinf(index * 0.2f);
+        }
+
+        // Something realistic to demodulate: a few of our own frames.
+        int txSamples = numModemSamples * MICRO_BENCHMARK_FREEDV_TX_FRAMES;
+        short* txAudio = (short*)heap_caps_calloc(txSamples + maxModemSamples, sizeof(short), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        assert(txAudio != nullptr);
+
+        char name[32];
+        snprintf(name, sizeof(name), "freedv_tx_%s", mode.name);
+        int txFrame = 0;
+        Run_(name, MICRO_BENCHMARK_FREEDV_FRAMES, [&]() {
+            freedv_tx(dv, modem, speech);
+            memcpy(&txAudio[(txFrame++ % MICRO_BENCHMARK_FREEDV_TX_FRAMES) * numModemSamples], modem, numModemSamples * sizeof(short));
+        });
+
+        snprintf(name, sizeof(name), "freedv_rx_%s", mode.name);
+        int rxPosition = 0;
+        Run_(name, MICRO_BENCHMARK_FREEDV_FRAMES, [&]() {
+            int nin = freedv_nin(dv);
+            if (rxPosition + nin > txSamples)
+            {
+                rxPosition = 0;
+            }
+            memcpy(modem, &txAudio[rxPosition], nin * sizeof(short));
+            rxPosition += nin;
+            freedv_rx(dv, speech, modem);
+        });
+
+        heap_caps_free(txAudio);
+        cache.release(mode.mode);
+        cache.clear();
+    }
+}
+
+void MicroBenchmark::BenchmarkIcom_()
+{
+    network::icom::IcomPacketPool::Initialize();
+
+    short* audio = (short*)heap_caps_calloc(MICRO_BENCHMARK_SAMPLES_8K, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(audio != nullptr);
+
+    uint16_t audioSeq = 0;
+    Run_("icom_create_audio_packet", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        auto packet = network::icom::IcomPacket::CreateAudioPacket(audioSeq++, 0x12345678, 0x87654321, audio, MICRO_BENCHMARK_SAMPLES_8K);
+        (void)packet;
+    });
+
+    Run_("icom_create_ping_packet", MICRO_BENCHMARK_FAST_ITERATIONS, [&]() {
+        auto packet = network::icom::IcomPacket::CreatePingPacket(audioSeq++, 0x12345678, 0x87654321);
+        (void)packet;
+    });
+
+    heap_caps_free(audio);
+}
+
+}
+
+}
@@ -0,0 +1,64 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MICRO_BENCHMARK_H
+#define MICRO_BENCHMARK_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Cycle counted benchmarks of the hot paths (messaging, audio 
+///        buffers and mixing, resampling, VITA packing, Codec2 math, FreeDV
+///        and Icom packets), run in place of ezDV when 
+///        CONFIG_EZDV_MICROBENCHMARKS is set. Each result is printed on the
+///        console as one line of JSON prefixed with "EZDV_BENCH " so that
+///        it can be picked out of the serial log by scripts.
+class MicroBenchmark
+{
+public:
+    /// @brief Runs every benchmark on a dedicated task. Called from app_main()
+    ///        after DVTask::Initialize().
+    static void Start();
+
+private:
+    static void RunTaskEntry_(void* arg);
+
+    template<typename FnType>
+    static void Run_(const char* name, uint32_t iterations, FnType fn);
+    static void Report_(const char* name, uint32_t iterations, uint32_t cycles, int64_t timeUs);
+
+    static void BenchmarkMessaging_();
+    static void BenchmarkAudioBuffers_();
+    static void BenchmarkMixer_();
+    static void BenchmarkResampling_();
+    static void BenchmarkCodec2Math_();
+    static void BenchmarkFreeDV_();
+    static void BenchmarkIcom_();
+};
+
+}
+
+}
+
+#endif // MICRO_BENCHMARK_H
@@ -0,0 +1,120 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+
+#include "Nco.h"
+
+#include "esp_dsp.h"
+
+// Entries per quarter cycle. Phase bits below the table index are used to
+// interpolate between entries.
+#define NCO_QUARTER_WAVE_BITS (8)
+#define NCO_QUARTER_WAVE_SIZE (1 << NCO_QUARTER_WAVE_BITS)
+#define NCO_FRACTION_BITS (14)
+#define NCO_FRACTION_SHIFT (32 - 2 - NCO_QUARTER_WAVE_BITS - NCO_FRACTION_BITS)
+
+// Samples are generated in chunks this large before amplitude scaling.
+#define NCO_BLOCK_SIZE (64)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+struct QuarterWaveTable
+{
+    // One extra entry so interpolation never needs to wrap.
+    int16_t entries[NCO_QUARTER_WAVE_SIZE + 1];
+
+    QuarterWaveTable()
+    {
+        for (int index = 0; index <= NCO_QUARTER_WAVE_SIZE; index++)
+        {
+            entries[index] = (int16_t)lrintf(32767 * sinf(M_PI / 2 * index / NCO_QUARTER_WAVE_SIZE));
+        }
+    }
+};
+
+static const QuarterWaveTable QuarterWave_;
+
+Nco::Nco(float frequency, int16_t amplitude, int sampleRate)
+    : phase_(0)
+    , phaseIncrement_(0)
+    , amplitude_(amplitude)
+    , sampleRate_(sampleRate)
+{
+    setFrequency(frequency);
+}
+
+void Nco::setFrequency(float frequency)
+{
+    phaseIncrement_ = (uint32_t)((double)frequency * 4294967296.0 / sampleRate_);
+}
+
+short Nco::getSample()
+{
+    short sample = ((int32_t)UnitSample_(phase_) * amplitude_) >> 15;
+    phase_ += phaseIncrement_;
+    return sample;
+}
+
+void Nco::generate(short* output, uint32_t numSamples)
+{
+    while (numSamples > 0)
+    {
+        uint32_t blockSize = numSamples < NCO_BLOCK_SIZE ? numSamples : NCO_BLOCK_SIZE;
+        for (uint32_t index = 0; index < blockSize; index++)
+        {
+            output[index] = UnitSample_(phase_);
+            phase_ += phaseIncrement_;
+        }
+
+        dsps_mulc_s16(output, output, blockSize, amplitude_, 1, 1);
+
+        output += blockSize;
+        numSamples -= blockSize;
+    }
+}
+
+short Nco::UnitSample_(uint32_t phase)
+{
+    uint32_t quadrant = phase >> 30;
+    uint32_t index = (phase >> (32 - 2 - NCO_QUARTER_WAVE_BITS)) & (NCO_QUARTER_WAVE_SIZE - 1);
+    int32_t fraction = (phase >> NCO_FRACTION_SHIFT) & ((1 << NCO_FRACTION_BITS) - 1);
+
+    // The second half of each half cycle is the first half played backwards.
+    int32_t from, to;
+    if (quadrant & 1)
+    {
+        from = QuarterWave_.entries[NCO_QUARTER_WAVE_SIZE - index];
+        to = QuarterWave_.entries[NCO_QUARTER_WAVE_SIZE - index - 1];
+    }
+    else
+    {
+        from = QuarterWave_.entries[index];
+        to = QuarterWave_.entries[index + 1];
+    }
+
+    int32_t sample = from + (((to - from) * fraction) >> NCO_FRACTION_BITS);
+    return (quadrant & 2) ? -sample : sample;
+}
+
+}
+
+}
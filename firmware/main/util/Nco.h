@@ -0,0 +1,67 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NCO_H
+#define NCO_H
+
+#include <cinttypes>
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Numerically controlled oscillator: generates a sine wave of any
+///        frequency and amplitude on the fly using a phase accumulator and a
+///        quarter-wave table (with linear interpolation) shared by every 
+///        instance.
+class Nco
+{
+public:
+    /// @brief Creates an oscillator.
+    /// @param frequency The frequency in Hz.
+    /// @param amplitude The peak amplitude (up to 32767).
+    /// @param sampleRate The sample rate in Hz.
+    Nco(float frequency, int16_t amplitude, int sampleRate = 8000);
+
+    void setFrequency(float frequency);
+    void setAmplitude(int16_t amplitude) { amplitude_ = amplitude; }
+
+    /// @brief Restarts the waveform at zero phase.
+    void reset() { phase_ = 0; }
+
+    /// @brief Returns the next sample.
+    short getSample();
+
+    /// @brief Fills a buffer with the next numSamples samples.
+    void generate(short* output, uint32_t numSamples);
+
+private:
+    uint32_t phase_; // 2^32 is one full cycle
+    uint32_t phaseIncrement_;
+    int16_t amplitude_;
+    int sampleRate_;
+
+    static short UnitSample_(uint32_t phase);
+};
+
+}
+
+}
+
+#endif // NCO_H
@@ -18,7 +18,7 @@
 #ifndef PS_RAM_ALLOCATOR_H
 #define PS_RAM_ALLOCATOR_H
 
-#include "esp_heap_caps.h"
+#include "MemoryPlacement.h"
 
 namespace ezdv
 {
@@ -26,6 +26,8 @@ namespace ezdv
 namespace util
 {
 
+/// @brief STL allocator for containers that don't need to be in internal RAM.
+///        Allocates from MemoryPlacement::CONTAINERS (SPIRAM by default).
 template<typename T>
 struct PSRamAllocator
 {
@@ -44,12 +46,12 @@ struct PSRamAllocator
     
     T* allocate(const size_t n) const noexcept
     {
-        return (T*)heap_caps_malloc(n*sizeof(T), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+        return (T*)MemoryPlacement::Allocate(MemoryPlacement::CONTAINERS, n*sizeof(T));
     }
     
     void deallocate(T* const p, size_t) const noexcept
     {
-        heap_caps_free(p);
+        MemoryPlacement::Free(MemoryPlacement::CONTAINERS, p);
     }
 };
 
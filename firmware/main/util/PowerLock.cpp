@@ -0,0 +1,68 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PowerLock.h"
+
+#include "esp_err.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+PowerLock::PowerLock(const char* name)
+    : isHeld_(false)
+{
+#if CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, name, &handle_));
+#endif // CONFIG_PM_ENABLE
+}
+
+PowerLock::~PowerLock()
+{
+    release();
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_delete(handle_);
+#endif // CONFIG_PM_ENABLE
+}
+
+void PowerLock::acquire()
+{
+    if (!isHeld_)
+    {
+#if CONFIG_PM_ENABLE
+        ESP_ERROR_CHECK(esp_pm_lock_acquire(handle_));
+#endif // CONFIG_PM_ENABLE
+        isHeld_ = true;
+    }
+}
+
+void PowerLock::release()
+{
+    if (isHeld_)
+    {
+#if CONFIG_PM_ENABLE
+        ESP_ERROR_CHECK(esp_pm_lock_release(handle_));
+#endif // CONFIG_PM_ENABLE
+        isHeld_ = false;
+    }
+}
+
+}
+
+}
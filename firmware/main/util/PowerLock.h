@@ -0,0 +1,61 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POWER_LOCK_H
+#define POWER_LOCK_H
+
+#include "sdkconfig.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif // CONFIG_PM_ENABLE
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Keeps the CPU at full speed (and out of automatic light sleep)
+///        while audio processing is going on. Acquiring and releasing are
+///        idempotent so callers can just follow their own active/idle state.
+///        Does nothing unless CONFIG_PM_ENABLE is set.
+class PowerLock
+{
+public:
+    /// @brief Creates a new (released) lock.
+    /// @param name The name shown by esp_pm_dump_locks().
+    PowerLock(const char* name);
+    virtual ~PowerLock();
+
+    void acquire();
+    void release();
+
+    bool isHeld() const { return isHeld_; }
+
+private:
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t handle_;
+#endif // CONFIG_PM_ENABLE
+    bool isHeld_;
+};
+
+}
+
+}
+
+#endif // POWER_LOCK_H
@@ -0,0 +1,141 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "SignalGenerator.h"
+
+// Sweeps and two-tone signals are built in chunks this large. The sweep
+// frequency is updated once per chunk (every 4ms at 8 kHz).
+#define SIGNAL_GENERATOR_CHUNK_SIZE (32)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+SignalGenerator::SignalGenerator(int sampleRate)
+    : sampleRate_(sampleRate)
+    , nco1_(0, 0, sampleRate)
+    , nco2_(0, 0, sampleRate)
+    , sweepPosition_(0)
+    , sweepLength_(0)
+    , squarePhase_(0)
+    , squarePhaseIncrement_(0)
+    , noiseState_(1)
+{
+    settings_.waveform = SILENCE;
+    settings_.frequency1 = 0;
+    settings_.frequency2 = 0;
+    settings_.sweepDurationMs = 0;
+    settings_.amplitude = 0;
+}
+
+void SignalGenerator::configure(const Settings& settings)
+{
+    settings_ = settings;
+
+    int16_t ncoAmplitude = settings.waveform == TWO_TONE ? settings.amplitude / 2 : settings.amplitude;
+    nco1_.reset();
+    nco1_.setFrequency(settings.frequency1);
+    nco1_.setAmplitude(ncoAmplitude);
+    nco2_.reset();
+    nco2_.setFrequency(settings.frequency2);
+    nco2_.setAmplitude(ncoAmplitude);
+
+    sweepPosition_ = 0;
+    sweepLength_ = (uint64_t)settings.sweepDurationMs * sampleRate_ / 1000;
+
+    squarePhase_ = 0;
+    squarePhaseIncrement_ = (uint32_t)((double)settings.frequency1 * 4294967296.0 / sampleRate_);
+}
+
+void SignalGenerator::render(short* output, uint32_t numSamples)
+{
+    switch (settings_.waveform)
+    {
+        case TONE:
+            nco1_.generate(output, numSamples);
+            break;
+        case TWO_TONE:
+        {
+            short chunk[SIGNAL_GENERATOR_CHUNK_SIZE];
+            while (numSamples > 0)
+            {
+                uint32_t chunkSize = numSamples < SIGNAL_GENERATOR_CHUNK_SIZE ? numSamples : SIGNAL_GENERATOR_CHUNK_SIZE;
+                nco1_.generate(output, chunkSize);
+                nco2_.generate(chunk, chunkSize);
+
+                // Each tone is at half amplitude, so this can't overflow.
+                for (uint32_t index = 0; index < chunkSize; index++)
+                {
+                    output[index] += chunk[index];
+                }
+
+                output += chunkSize;
+                numSamples -= chunkSize;
+            }
+            break;
+        }
+        case SWEEP:
+        {
+            while (numSamples > 0)
+            {
+                if (sweepPosition_ >= sweepLength_)
+                {
+                    sweepPosition_ = 0;
+                }
+
+                uint32_t chunkSize = numSamples < SIGNAL_GENERATOR_CHUNK_SIZE ? numSamples : SIGNAL_GENERATOR_CHUNK_SIZE;
+                float progress = sweepLength_ > 0 ? (float)sweepPosition_ / sweepLength_ : 0;
+                nco1_.setFrequency(settings_.frequency1 + (settings_.frequency2 - settings_.frequency1) * progress);
+                nco1_.generate(output, chunkSize);
+
+                sweepPosition_ += chunkSize;
+                output += chunkSize;
+                numSamples -= chunkSize;
+            }
+            break;
+        }
+        case SQUARE:
+            for (uint32_t index = 0; index < numSamples; index++)
+            {
+                output[index] = squarePhase_ < 0x80000000 ? settings_.amplitude : -settings_.amplitude;
+                squarePhase_ += squarePhaseIncrement_;
+            }
+            break;
+        case NOISE:
+            for (uint32_t index = 0; index < numSamples; index++)
+            {
+                // xorshift32
+                noiseState_ ^= noiseState_ << 13;
+                noiseState_ ^= noiseState_ >> 17;
+                noiseState_ ^= noiseState_ << 5;
+                output[index] = ((int32_t)(int16_t)(noiseState_ >> 16) * settings_.amplitude) >> 15;
+            }
+            break;
+        case SILENCE:
+        default:
+            memset(output, 0, numSamples * sizeof(short));
+            break;
+    }
+}
+
+}
+
+}
@@ -0,0 +1,85 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIGNAL_GENERATOR_H
+#define SIGNAL_GENERATOR_H
+
+#include <cinttypes>
+
+#include "Nco.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Renders test signals (tones, two-tone, sweeps, square waves and 
+///        noise) a block at a time.
+class SignalGenerator
+{
+public:
+    enum Waveform
+    {
+        SILENCE,
+        TONE,     // frequency1
+        TWO_TONE, // frequency1 + frequency2, each at half amplitude
+        SWEEP,    // linear from frequency1 to frequency2 over sweepDurationMs, repeating
+        SQUARE,   // frequency1
+        NOISE,    // white
+
+        NUM_WAVEFORMS
+    };
+
+    struct Settings
+    {
+        Waveform waveform;
+        float frequency1;
+        float frequency2;
+        uint32_t sweepDurationMs;
+        int16_t amplitude;
+    };
+
+    /// @brief Creates a generator producing silence.
+    /// @param sampleRate The sample rate in Hz.
+    SignalGenerator(int sampleRate = 8000);
+
+    /// @brief Switches to a new signal, starting from the beginning of it.
+    void configure(const Settings& settings);
+
+    const Settings& getSettings() const { return settings_; }
+
+    /// @brief Renders the next numSamples samples of the signal.
+    void render(short* output, uint32_t numSamples);
+
+private:
+    Settings settings_;
+    int sampleRate_;
+    Nco nco1_;
+    Nco nco2_;
+    uint32_t sweepPosition_;
+    uint32_t sweepLength_;
+    uint32_t squarePhase_;
+    uint32_t squarePhaseIncrement_;
+    uint32_t noiseState_;
+};
+
+}
+
+}
+
+#endif // SIGNAL_GENERATOR_H
@@ -0,0 +1,92 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Fixed size queue for handing items from one thread to another
+///        without locking. Only one thread may push and only one may pop.
+template<typename T, size_t N>
+class SpscQueue
+{
+    // Keeps indexing correct when the counters wrap around.
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    SpscQueue()
+        : head_(0)
+        , tail_(0)
+    {
+        // empty
+    }
+
+    /// @brief Adds an item (producer only).
+    /// @return false if the queue is full.
+    bool push(const T& item)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == N)
+        {
+            return false;
+        }
+
+        items_[head % N] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Removes the oldest item (consumer only).
+    /// @return false if the queue is empty.
+    bool pop(T& item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+        {
+            return false;
+        }
+
+        item = items_[tail % N];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Returns the number of items in the queue.
+    size_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    T items_[N];
+    std::atomic<size_t> head_; // next item to be pushed
+    std::atomic<size_t> tail_; // next item to be popped
+};
+
+}
+
+}
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,331 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#include "TaskWatermarks.h"
+
+#if CONFIG_EZDV_TASK_WATERMARKS
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "nvs_handle.hpp"
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+
+#define CURRENT_LOG_TAG ("TaskWatermarks")
+
+#define TASK_WATERMARKS_MAGIC (0x4d574456) /* "VDWM" */
+#define TASK_WATERMARKS_NVS_NAMESPACE ("taskWatermarks")
+#define TASK_WATERMARKS_NVS_KEY ("peaks")
+
+// Peaks are rare after the first few minutes, so this keeps flash wear
+// negligible while still capturing them before the next power cycle.
+#define TASK_WATERMARKS_SAVE_INTERVAL_US (10 * 60 * 1000000LL)
+
+#define STACK_MIN_HEADROOM (1024)
+#define STACK_ROUNDING (256)
+#define QUEUE_MIN_SIZE (8)
+
+namespace ezdv
+{
+
+namespace util
+{
+
+#if CONFIG_EZDV_TASK_WATERMARKS
+namespace
+{
+
+// Must stay trivially constructible so it isn't cleared on startup.
+struct Table
+{
+    uint32_t magic;
+    uint32_t numEntries;
+    TaskWatermarks::Entry entries[TaskWatermarks::MAX_TASKS];
+    uint32_t crc; // of everything above
+};
+
+RTC_NOINIT_ATTR Table RtcTable;
+
+bool Dirty = false;
+bool Merged = false;
+int64_t LastSaveUs = 0;
+
+portMUX_TYPE TableLock = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t TableCrc(const Table& table)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&table, offsetof(Table, crc));
+}
+
+bool IsTableValid(const Table& table)
+{
+    return table.magic == TASK_WATERMARKS_MAGIC && table.numEntries <= TaskWatermarks::MAX_TASKS &&
+        table.crc == TableCrc(table);
+}
+
+// Must be called with TableLock held.
+void ResetTableIfInvalid()
+{
+    if (!IsTableValid(RtcTable))
+    {
+        memset(&RtcTable, 0, sizeof(RtcTable));
+        RtcTable.magic = TASK_WATERMARKS_MAGIC;
+        RtcTable.crc = TableCrc(RtcTable);
+    }
+}
+
+// Must be called with TableLock held. Returns true if anything changed.
+bool MergeEntry(const TaskWatermarks::Entry& entry, bool current)
+{
+    TaskWatermarks::Entry* existing = nullptr;
+    for (uint32_t index = 0; index < RtcTable.numEntries; index++)
+    {
+        if (!strncmp(RtcTable.entries[index].name, entry.name, TaskWatermarks::MAX_NAME_LENGTH - 1))
+        {
+            existing = &RtcTable.entries[index];
+            break;
+        }
+    }
+
+    if (existing == nullptr)
+    {
+        if (RtcTable.numEntries >= TaskWatermarks::MAX_TASKS)
+        {
+            return false;
+        }
+
+        existing = &RtcTable.entries[RtcTable.numEntries++];
+        memset(existing, 0, sizeof(*existing));
+        strncpy(existing->name, entry.name, TaskWatermarks::MAX_NAME_LENGTH - 1);
+        existing->stackSize = entry.stackSize;
+        existing->queueSize = entry.queueSize;
+    }
+
+    bool changed = false;
+    if (current && (existing->stackSize != entry.stackSize || existing->queueSize != entry.queueSize))
+    {
+        // The task was resized since these peaks were recorded; they
+        // still say how much it needs, so keep them.
+        existing->stackSize = entry.stackSize;
+        existing->queueSize = entry.queueSize;
+        changed = true;
+    }
+    if (entry.peakStackUsed > existing->peakStackUsed)
+    {
+        existing->peakStackUsed = entry.peakStackUsed;
+        changed = true;
+    }
+    if (entry.peakQueueDepth > existing->peakQueueDepth)
+    {
+        existing->peakQueueDepth = entry.peakQueueDepth;
+        changed = true;
+    }
+
+    return changed;
+}
+
+void LogRecommendations(const Table& table)
+{
+    for (uint32_t index = 0; index < table.numEntries; index++)
+    {
+        auto& entry = table.entries[index];
+        auto stackSize = TaskWatermarks::RecommendStackSize(entry);
+        auto queueSize = TaskWatermarks::RecommendQueueSize(entry);
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "%s: stack peak %" PRIu32 "/%" PRIu32 " (recommend %" PRIu32 "), queue peak %" PRIu32 "/%" PRIu32 " (recommend %" PRIu32 ")",
+            entry.name,
+            entry.peakStackUsed,
+            entry.stackSize,
+            stackSize,
+            entry.peakQueueDepth,
+            entry.queueSize,
+            queueSize);
+    }
+}
+
+}
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+
+void TaskWatermarks::Record(const char* name, uint32_t stackSize, uint32_t stackFree, uint32_t queueSize, uint32_t queueDepth)
+{
+#if CONFIG_EZDV_TASK_WATERMARKS
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name, MAX_NAME_LENGTH - 1);
+    entry.stackSize = stackSize;
+    entry.peakStackUsed = stackFree < stackSize ? stackSize - stackFree : 0;
+    entry.queueSize = queueSize;
+    entry.peakQueueDepth = queueDepth;
+
+    portENTER_CRITICAL(&TableLock);
+    ResetTableIfInvalid();
+    if (MergeEntry(entry, true))
+    {
+        RtcTable.crc = TableCrc(RtcTable);
+        Dirty = true;
+    }
+    portEXIT_CRITICAL(&TableLock);
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+}
+
+void TaskWatermarks::Save(bool force)
+{
+#if CONFIG_EZDV_TASK_WATERMARKS
+    auto now = esp_timer_get_time();
+    bool firstSave = !Merged;
+    esp_err_t result = ESP_OK;
+
+    if (firstSave)
+    {
+        // Fold in peaks from before the last power cycle. Max is 
+        // idempotent, so it doesn't matter if RTC memory already has them.
+        Table* saved = new Table;
+        assert(saved != nullptr);
+
+        auto handle = nvs::open_nvs_handle(TASK_WATERMARKS_NVS_NAMESPACE, NVS_READONLY, &result);
+        if (result == ESP_OK && 
+            handle->get_blob(TASK_WATERMARKS_NVS_KEY, saved, sizeof(*saved)) == ESP_OK &&
+            IsTableValid(*saved))
+        {
+            bool changed = false;
+            portENTER_CRITICAL(&TableLock);
+            ResetTableIfInvalid();
+            for (uint32_t index = 0; index < saved->numEntries; index++)
+            {
+                changed |= MergeEntry(saved->entries[index], false);
+            }
+            RtcTable.crc = TableCrc(RtcTable);
+            Dirty |= changed;
+            portEXIT_CRITICAL(&TableLock);
+        }
+
+        delete saved;
+        Merged = true;
+        LastSaveUs = now;
+    }
+    else if (!force && (now - LastSaveUs) < TASK_WATERMARKS_SAVE_INTERVAL_US)
+    {
+        return;
+    }
+
+    Table* table = new Table;
+    assert(table != nullptr);
+
+    portENTER_CRITICAL(&TableLock);
+    ResetTableIfInvalid();
+    *table = RtcTable;
+    bool dirty = Dirty;
+    Dirty = false;
+    portEXIT_CRITICAL(&TableLock);
+
+    if (firstSave)
+    {
+        LogRecommendations(*table);
+    }
+
+    if (dirty && !firstSave)
+    {
+        LastSaveUs = now;
+
+        auto handle = nvs::open_nvs_handle(TASK_WATERMARKS_NVS_NAMESPACE, NVS_READWRITE, &result);
+        if (result == ESP_OK)
+        {
+            result = handle->set_blob(TASK_WATERMARKS_NVS_KEY, table, sizeof(*table));
+        }
+        if (result == ESP_OK)
+        {
+            result = handle->commit();
+        }
+
+        if (result != ESP_OK)
+        {
+            ESP_LOGW(CURRENT_LOG_TAG, "Could not save task watermarks to flash: %s", esp_err_to_name(result));
+
+            portENTER_CRITICAL(&TableLock);
+            Dirty = true;
+            portEXIT_CRITICAL(&TableLock);
+        }
+    }
+    else if (dirty)
+    {
+        // Startup peaks keep coming in for a while; wait for the next 
+        // interval rather than writing flash during boot.
+        portENTER_CRITICAL(&TableLock);
+        Dirty = true;
+        portEXIT_CRITICAL(&TableLock);
+    }
+
+    delete table;
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+}
+
+int TaskWatermarks::Get(Entry* entries, int maxEntries)
+{
+#if CONFIG_EZDV_TASK_WATERMARKS
+    int count = 0;
+
+    portENTER_CRITICAL(&TableLock);
+    if (IsTableValid(RtcTable))
+    {
+        for (; count < maxEntries && count < (int)RtcTable.numEntries; count++)
+        {
+            entries[count] = RtcTable.entries[count];
+        }
+    }
+    portEXIT_CRITICAL(&TableLock);
+
+    return count;
+#else
+    return 0;
+#endif // CONFIG_EZDV_TASK_WATERMARKS
+}
+
+uint32_t TaskWatermarks::RecommendStackSize(const Entry& entry)
+{
+    // 25% headroom for paths that haven't run yet, but at least enough 
+    // for a log call or two.
+    uint32_t headroom = entry.peakStackUsed / 4;
+    if (headroom < STACK_MIN_HEADROOM)
+    {
+        headroom = STACK_MIN_HEADROOM;
+    }
+
+    uint32_t size = entry.peakStackUsed + headroom;
+    return (size + STACK_ROUNDING - 1) / STACK_ROUNDING * STACK_ROUNDING;
+}
+
+uint32_t TaskWatermarks::RecommendQueueSize(const Entry& entry)
+{
+    // No depth means CONFIG_EZDV_MESSAGE_STATISTICS was off; leave it be.
+    if (entry.peakQueueDepth == 0)
+    {
+        return entry.queueSize;
+    }
+
+    uint32_t size = entry.peakQueueDepth * 2;
+    return size < QUEUE_MIN_SIZE ? QUEUE_MIN_SIZE : size;
+}
+
+}
+
+}
@@ -0,0 +1,79 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TASK_WATERMARKS_H
+#define TASK_WATERMARKS_H
+
+#include <cinttypes>
+
+#include "sdkconfig.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Keeps the most stack and queue space each DVTask has ever used,
+///        so that stacks and queues can be sized from field data instead 
+///        of guesses. Peaks live in RTC memory (surviving resets, including
+///        crashes) and are merged into NVS every so often to survive power 
+///        cycles. Does nothing unless CONFIG_EZDV_TASK_WATERMARKS is set.
+class TaskWatermarks
+{
+public:
+    enum { MAX_TASKS = 40, MAX_NAME_LENGTH = 24 };
+
+    struct Entry
+    {
+        char name[MAX_NAME_LENGTH];
+        uint32_t stackSize; // as of the last time the task ran
+        uint32_t peakStackUsed;
+        uint32_t queueSize; // as of the last time the task ran
+        uint32_t peakQueueDepth; // 0 without CONFIG_EZDV_MESSAGE_STATISTICS
+    };
+
+    /// @brief Records a task's usage. Cheap unless it's a new peak.
+    /// @param name The task's name.
+    /// @param stackSize The size of the task's stack (bytes).
+    /// @param stackFree The least free stack space seen this session (bytes).
+    /// @param queueSize The number of messages the task's queue(s) can hold.
+    /// @param queueDepth The most messages seen waiting this session.
+    static void Record(const char* name, uint32_t stackSize, uint32_t stackFree, uint32_t queueSize, uint32_t queueDepth);
+
+    /// @brief Writes new peaks to NVS. The first call after boot merges in 
+    ///        what was saved before and logs recommended sizes; after that, 
+    ///        NVS is written at most every few minutes unless forced.
+    /// @param force Write now if anything changed (e.g. before sleeping).
+    static void Save(bool force = false);
+
+    /// @brief Copies out the peaks recorded so far.
+    /// @return The number of entries copied.
+    static int Get(Entry* entries, int maxEntries);
+
+    /// @brief Returns a stack size that leaves headroom above the task's peak.
+    static uint32_t RecommendStackSize(const Entry& entry);
+
+    /// @brief Returns a queue size that leaves headroom above the task's peak.
+    static uint32_t RecommendQueueSize(const Entry& entry);
+};
+
+}
+
+}
+
+#endif // TASK_WATERMARKS_H
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+# Copyright (c) 2024 Mooneer Salem
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, version 3.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Creates a delta firmware update (see main/storage/DeltaPatcher.h).
+
+Usage:
+    make_ota_delta.py OLD_EZDV_BIN OLD_HTTP_BIN NEW_EZDV_BIN NEW_HTTP_BIN OUTPUT_TAR_GZ
+
+The old images must be exactly the ones on the device (i.e. ezdv.bin and
+http.bin from the -ota.tar.gz of the release it's running). The output is
+uploaded the same way as a regular update.
+"""
+
+import hashlib
+import io
+import struct
+import sys
+import tarfile
+
+MAGIC = b"EZDVDLT1"
+OP_END = 0
+OP_COPY = 1
+OP_DATA = 2
+
+BLOCK_SIZE = 32
+INDEX_STEP = 4
+
+def make_delta(source, target):
+    index = {}
+    for offset in range(0, len(source) - BLOCK_SIZE + 1, INDEX_STEP):
+        index.setdefault(source[offset:offset + BLOCK_SIZE], offset)
+
+    out = io.BytesIO()
+    out.write(MAGIC)
+    out.write(struct.pack("<II", len(source), len(target)))
+    out.write(hashlib.sha256(source).digest())
+    out.write(hashlib.sha256(target).digest())
+
+    literal_start = 0
+    def flush_literal(end):
+        if end > literal_start:
+            out.write(struct.pack("<BII", OP_DATA, end - literal_start, 0))
+            out.write(target[literal_start:end])
+
+    pos = 0
+    while pos + BLOCK_SIZE <= len(target):
+        source_offset = index.get(target[pos:pos + BLOCK_SIZE])
+        if source_offset is None:
+            pos += 1
+            continue
+
+        length = BLOCK_SIZE
+        while (pos + length < len(target) and source_offset + length < len(source) and
+               target[pos + length] == source[source_offset + length]):
+            length += 1
+
+        flush_literal(pos)
+        out.write(struct.pack("<BII", OP_COPY, source_offset, length))
+        pos += length
+        literal_start = pos
+
+    flush_literal(len(target))
+    out.write(struct.pack("<BII", OP_END, 0, 0))
+    return out.getvalue()
+
+def main():
+    if len(sys.argv) != 6:
+        print(__doc__)
+        sys.exit(1)
+
+    old_app, old_http, new_app, new_http = (open(name, "rb").read() for name in sys.argv[1:5])
+
+    with tarfile.open(sys.argv[5], "w:gz") as tar:
+        for name, source, target in (("ezdv.delta", old_app, new_app), ("http.delta", old_http, new_http)):
+            delta = make_delta(source, target)
+            print("%s: %d bytes (%d%% of full image)" % (name, len(delta), 100 * len(delta) // max(len(target), 1)))
+
+            info = tarfile.TarInfo(name)
+            info.size = len(delta)
+            tar.addfile(info, io.BytesIO(delta))
+
+if __name__ == "__main__":
+    main()